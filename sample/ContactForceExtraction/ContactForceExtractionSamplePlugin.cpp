@@ -6,8 +6,8 @@
 #include <cnoid/Plugin>
 #include <cnoid/ItemManager>
 #include <cnoid/SubSimulatorItem>
-#include <cnoid/AISTSimulatorItem>
-#include <cnoid/DyBody>
+#include <cnoid/SimulatorItem>
+#include <cnoid/ContactBuffer>
 #include <boost/bind.hpp>
 #include <sstream>
 
@@ -30,8 +30,10 @@ protected:
     virtual Item* doDuplicate() const;
 
 private:
+    ContactBuffer contacts;
+    ostringstream oss;
+
     void extractContactPoints(SimulatorItem* simulator);
-    void extractBodyContactPoints(DyBody* body, ostream& os);
 };
 
 
@@ -77,13 +79,6 @@ Item* ContactForceExtractorItem::doDuplicate() const
 
 bool ContactForceExtractorItem::initializeSimulation(SimulatorItem* simulator)
 {
-    AISTSimulatorItem* aistSimulator = dynamic_cast<AISTSimulatorItem*>(simulator);
-    if(!aistSimulator){
-        return false;
-    }
-
-    aistSimulator->setConstraintForceOutputEnabled(true);
-
     simulator->addPostDynamicsFunction(
         boost::bind(&ContactForceExtractorItem::extractContactPoints, this, simulator));
 
@@ -93,41 +88,28 @@ bool ContactForceExtractorItem::initializeSimulation(SimulatorItem* simulator)
 
 void ContactForceExtractorItem::extractContactPoints(SimulatorItem* simulator)
 {
-    ostringstream oss;
+    // The buffer is reused over the steps so that the contacts are obtained without allocation
+    simulator->getContacts(contacts);
 
-    const vector<SimulationBody*>& simBodies = simulator->simulationBodies();
-    for(size_t i=0; i < simBodies.size(); ++i){
-        DyBody* body = dynamic_cast<DyBody*>(simBodies[i]->body());
-        if(body){
-            extractBodyContactPoints(body, oss);
-        }
-    }
-    string log = oss.str();
-    if(!log.empty()){
-        mvout() << log << endl;
+    if(contacts.empty() || !contacts.hasForces()){
+        return;
     }
-}
 
-
-void ContactForceExtractorItem::extractBodyContactPoints(DyBody* body, ostream& os)
-{
-    bool put = false;
-    for(int i=0; i < body->numLinks(); ++i){
-        DyLink* link = body->link(i);
-        DyLink::ConstraintForceArray& forces = link->constraintForces();
-        if(!forces.empty()){
-            if(!put){
-                os << body->name() << ":\n";
-                put = true;
-            }
-            os << " " << link->name() << ":\n";
-            for(size_t i=0; i < forces.size(); ++i){
-                const DyLink::ConstraintForce& force = forces[i];
-                const Vector3& p = force.point;
-                const Vector3& f = force.force;
-                os << "  point(" << p.x() << ", " << p.y() << ", " << p.z()
-                   << "), force(" << f.x() << ", " << f.y() << ", " << f.z() << ")\n";
-            }
+    oss.str("");
+    for(int i=0; i < contacts.numLinkPairs(); ++i){
+        const int begin = contacts.contactBegin(i);
+        const int end = contacts.contactEnd(i);
+        if(begin == end){
+            continue;
+        }
+        oss << contacts.link(i, 0)->name() << " of " << contacts.body(i, 0)->name() << " - "
+            << contacts.link(i, 1)->name() << " of " << contacts.body(i, 1)->name() << ":\n";
+        for(int j=begin; j < end; ++j){
+            const Vector3& p = contacts.point(j);
+            const Vector3& f = contacts.force(j);
+            oss << "  point(" << p.x() << ", " << p.y() << ", " << p.z()
+                << "), force(" << f.x() << ", " << f.y() << ", " << f.z() << ")\n";
         }
     }
+    mvout() << oss.str() << endl;
 }
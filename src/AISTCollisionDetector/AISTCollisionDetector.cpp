@@ -8,12 +8,13 @@
 #include <cnoid/IdPair>
 #include <cnoid/SceneDrawables>
 #include <cnoid/MeshExtractor>
-#include <cnoid/ThreadPool>
+#include <cnoid/TaskScheduler>
 #include <boost/make_shared.hpp>
-#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 #include <boost/bind.hpp>
 #include <boost/random.hpp>
 #include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace cnoid;
@@ -22,8 +23,28 @@ namespace {
 
 const bool MULTITHREAD_TYPE = 0;
 const bool USE_THREAD_POOL = true;
+/*
+  The shuffle only changes the assignment of the pairs to the threads. The random engine is
+  reseeded when the geometries are cleared, so the order of the detected pairs is still the same
+  in every simulation and does not depend on the number of threads.
+*/
 const bool ENABLE_SHUFFLE = false;
 
+/**
+   The margin added to the bounding boxes of the broadphase so that the rounding errors of
+   the single precision coordinates used by the narrowphase do not drop touching pairs.
+*/
+const double BROADPHASE_MARGIN = 1.0e-4;
+
+//! The minimum number of the rays cast by a task of the parallel ray casting
+const int RAY_CASTING_GRAIN_SIZE = 64;
+
+//! The minimum number of the pairs computed by a task of the parallel distance computation
+const int DISTANCE_COMPUTATION_GRAIN_SIZE = 8;
+
+//! The number of the models built by a task when the added geometries are built in parallel
+const int MODEL_BUILDING_GRAIN_SIZE = 1;
+
 CollisionDetectorPtr factory()
 {
     return boost::make_shared<AISTCollisionDetector>();
@@ -40,8 +61,39 @@ struct FactoryRegistration
 class ColdetModelEx : public ColdetModel
 {
 public:
-    ColdetModelEx() { isStatic = false; }
+    ColdetModelEx() { isStatic = false; pendingIndex = -1; }
     bool isStatic;
+
+    // The index of the element of pendingModels while the model is waiting for being built
+    int pendingIndex;
+
+    // The bounding box in the local coordinate and that in the world coordinate for the broadphase
+    Vector3 localCenter;
+    Vector3 localHalfSize;
+    Vector3 boxMin;
+    Vector3 boxMax;
+
+    void calcLocalBoundingBox() {
+        Vector3 lower = Vector3::Constant(std::numeric_limits<double>::max());
+        Vector3 upper = -lower;
+        const int n = getNumVertices();
+        for(int i=0; i < n; ++i){
+            float x, y, z;
+            getVertex(i, x, y, z);
+            const Vector3 v(x, y, z);
+            lower = lower.cwiseMin(v);
+            upper = upper.cwiseMax(v);
+        }
+        localCenter = (upper + lower) / 2.0;
+        localHalfSize = (upper - lower) / 2.0 + Vector3::Constant(BROADPHASE_MARGIN);
+    }
+
+    void updateBoundingBox(const Position& T) {
+        const Vector3 center = T * localCenter;
+        const Vector3 halfSize = T.linear().cwiseAbs() * localHalfSize;
+        boxMin = center - halfSize;
+        boxMax = center + halfSize;
+    }
 };
 typedef boost::shared_ptr<ColdetModelEx> ColdetModelExPtr;
         
@@ -64,8 +116,201 @@ public:
 typedef boost::shared_ptr<ColdetModelPairEx> ColdetModelPairExPtr;
 
 
-typedef map<weak_ref_ptr<SgNode>, ColdetModelExPtr>  ModelMap;
-ModelMap modelCache;
+struct MeshInstance
+{
+    SgMeshPtr mesh;
+    Affine3 T;
+};
+typedef vector<MeshInstance, Eigen::aligned_allocator<MeshInstance> > MeshInstanceArray;
+
+/**
+   The cache is keyed by the meshes of a geometry and their transforms because the meshes are
+   shared by the clones of a body while the nodes above them are not.
+*/
+class ModelCacheKey
+{
+public:
+    vector<SgMesh*> meshes;
+    vector<double> transforms;
+    bool isPrimitiveEnabled;
+
+    ModelCacheKey(const MeshInstanceArray& instances, bool isPrimitiveEnabled)
+        : isPrimitiveEnabled(isPrimitiveEnabled) {
+        for(size_t i=0; i < instances.size(); ++i){
+            const MeshInstance& instance = instances[i];
+            meshes.push_back(instance.mesh.get());
+            const Affine3::MatrixType& M = instance.T.matrix();
+            transforms.insert(transforms.end(), M.data(), M.data() + M.size());
+        }
+    }
+    bool operator<(const ModelCacheKey& rhs) const {
+        if(isPrimitiveEnabled != rhs.isPrimitiveEnabled){
+            return rhs.isPrimitiveEnabled;
+        }
+        if(meshes != rhs.meshes){
+            return meshes < rhs.meshes;
+        }
+        return transforms < rhs.transforms;
+    }
+};
+
+/**
+   The meshes are referred weakly so that the cache does not keep the scene graphs alive.
+   An entry whose meshes have been deleted is never used because another mesh may be
+   allocated at the same address.
+*/
+struct ModelCacheEntry
+{
+    ColdetModelExPtr model;
+    vector< weak_ref_ptr<SgMesh> > meshes;
+
+    bool isValid(const ModelCacheKey& key) const {
+        for(size_t i=0; i < meshes.size(); ++i){
+            if(meshes[i].expired() || meshes[i].lock().get() != key.meshes[i]){
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+   A model of which the meshes have been extracted by addGeometry() and which is built
+   by the next makeReady() together with the other ones.
+*/
+struct PendingModel
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    PendingModel(const ColdetModelExPtr& model, const MeshInstanceArray& meshInstances, bool isPrimitiveEnabled)
+        : model(model), meshInstances(meshInstances), key(meshInstances, isPrimitiveEnabled) {
+        sourceIndex = -1;
+        isPositionGiven = false;
+    }
+    ColdetModelExPtr model;
+    MeshInstanceArray meshInstances;
+    ModelCacheKey key;
+    // The index of the pending model with the same key, whose model is copied instead of building this one
+    int sourceIndex;
+    // The position given before the model is built
+    bool isPositionGiven;
+    Position T;
+};
+typedef vector<PendingModel, Eigen::aligned_allocator<PendingModel> > PendingModelArray;
+
+typedef map<ModelCacheKey, ModelCacheEntry> ModelCache;
+ModelCache modelCache;
+boost::mutex modelCacheMutex;
+
+/**
+   The collisions of a model pair are stored in the element of the array at numPairs,
+   which is reused if the array already has it, and numPairs is incremented when there
+   are any collisions.
+*/
+void extractCollisions
+(ColdetModelPairEx& modelPair, const vector<collision_data>& cdata, CollisionPairArray& collisionPairs, int& numPairs)
+{
+    if(cdata.empty()){
+        return;
+    }
+    if(numPairs == (int)collisionPairs.size()){
+        collisionPairs.push_back(CollisionPair());
+    }
+    CollisionPair& collisionPair = collisionPairs[numPairs];
+    collisionPair.geometryId[0] = modelPair.id1();
+    collisionPair.geometryId[1] = modelPair.id2();
+    vector<Collision>& collisions = collisionPair.collisions;
+    collisions.clear();
+    for(size_t i=0; i < cdata.size(); ++i){
+        const collision_data& cd = cdata[i];
+        for(int j=0; j < cd.num_of_i_points; ++j){
+            if(cd.i_point_new[j]){
+                collisions.push_back(Collision());
+                Collision& collision = collisions.back();
+                collision.point = cd.i_points[j];
+                collision.normal = cd.n_vector;
+                collision.depth = cd.depth;
+                collision.id1 = cd.id1;
+                collision.id2 = cd.id2;
+            }
+        }
+    }
+    if(!collisions.empty()){
+        ++numPairs;
+    }
+}
+
+
+bool compareCollisionPairIds(const CollisionPair& pair1, const CollisionPair& pair2)
+{
+    if(pair1.geometryId[0] < pair2.geometryId[0]){
+        return true;
+    } else if(pair1.geometryId[0] == pair2.geometryId[0]){
+        return pair1.geometryId[1] < pair2.geometryId[1];
+    }
+    return false;
+}
+
+
+bool compareModelPairIds(const ColdetModelPairExPtr& pair1, const ColdetModelPairExPtr& pair2)
+{
+    if(pair1->id1() < pair2->id1()){
+        return true;
+    } else if(pair1->id1() == pair2->id1()){
+        return pair1->id2() < pair2->id2();
+    }
+    return false;
+}
+
+
+bool checkBoundingBoxGap(const ColdetModelEx& model1, const ColdetModelEx& model2, double margin)
+{
+    for(int i=0; i < 3; ++i){
+        if(model2.boxMin[i] > model1.boxMax[i] + margin || model1.boxMin[i] > model2.boxMax[i] + margin){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+   The slab test of a ray and an axis-aligned box.
+   \return true if the ray enters the box before the distance given by io_entry,
+   which is then replaced with the entry distance.
+*/
+bool checkRayBoxIntersection
+(const Vector3& origin, const Vector3& direction, const Vector3& boxMin, const Vector3& boxMax, double& io_entry)
+{
+    double tmin = 0.0;
+    double tmax = io_entry;
+    for(int i=0; i < 3; ++i){
+        const double d = direction[i];
+        if(fabs(d) < 1.0e-12){
+            if(origin[i] < boxMin[i] || origin[i] > boxMax[i]){
+                return false;
+            }
+        } else {
+            double t1 = (boxMin[i] - origin[i]) / d;
+            double t2 = (boxMax[i] - origin[i]) / d;
+            if(t1 > t2){
+                std::swap(t1, t2);
+            }
+            if(t1 > tmin){
+                tmin = t1;
+            }
+            if(t2 < tmax){
+                tmax = t2;
+            }
+            if(tmin > tmax){
+                return false;
+            }
+        }
+    }
+    io_entry = tmin;
+    return true;
+}
+
 }
 
 namespace cnoid {
@@ -78,9 +323,19 @@ public:
     typedef vector<ColdetModelPairExPtr> ModelPairArray;
     ModelPairArray modelPairs;
 
+    // The pairs checked by the narrowphase in the current step
+    vector<ColdetModelPairEx*> targetPairs;
+
+    bool isBroadphaseEnabled;
+    // The IDs of the valid models sorted by the lower x coordinates of the bounding boxes
+    vector<int> sweepOrder;
+    vector< IdPair<> > overlappingIdPairs;
+    // A null pointer means the pair is not checked
+    typedef map<IdPair<>, ColdetModelPairExPtr> ModelPairMap;
+    ModelPairMap modelPairMap;
+
     int maxNumThreads;
     int numThreads;
-    boost::scoped_ptr<ThreadPool> threadPool;
     boost::thread_group threadGroup;
 
     vector<int> shuffledPairIndices;
@@ -90,30 +345,84 @@ public:
     typedef set< IdPair<> > IdPairSet;
     IdPairSet nonInterfarencePairs;
 
+    /*
+      The changes after the last makeReady() for updating only the affected pairs.
+      A geometry is dirty when it is added, removed or its static flag is changed.
+    */
+    bool isReady;
+    int numReadyModels;
+    vector<char> dirtyFlags;
+    bool hasDirtyModels;
+    IdPairSet changedNonInterfarencePairs;
+
     MeshExtractor* meshExtractor;
+    MeshInstanceArray meshInstances;
+    bool isGeometryCacheEnabled;
+    bool isPrimitiveCollisionEnabled;
+
+    PendingModelArray pendingModels;
+    // The indices of the pending models which are built, i.e. which are not copied from the others
+    map<ModelCacheKey, int> pendingModelIndices;
         
     AISTCollisionDetectorImpl();
     ~AISTCollisionDetectorImpl();
     int addGeometry(SgNode* geometry);
-    void addMesh(ColdetModelEx* model);
+    bool extractMeshInstances(SgNode* geometry);
+    void addMeshInstance();
+    ColdetModelExPtr findCachedModel(const ModelCacheKey& key);
+    void buildPendingModels();
+    void buildPendingModelsInRange(int begin, int end);
+    void setMeshes(ColdetModelEx* model, const MeshInstanceArray& instances);
+    void setPrimitiveInformation(ColdetModelEx* model, const MeshInstanceArray& instances);
+    void setPositionOfPendingModel(ColdetModelEx* model, const Position& T);
+    void setDirty(int geometryId);
+    void setNonInterfarencePair(int geometryId1, int geometryId2, bool on);
     bool makeReady();
-    void detectCollisions(boost::function<void(const CollisionPair&)> callback);
-    void detectCollisionsInParallel(boost::function<void(const CollisionPair&)> callback);
+    void createAllModelPairs();
+    void updateModelPairs();
+    bool isPairTarget(int id1, int id2) const;
+    void updateTargetPairsWithBroadphase();
+    void collectPairsWithBroadphase(double margin, vector<ColdetModelPairEx*>& out_pairs);
+    ColdetModelPairEx* findOrCreateModelPair(int id1, int id2);
+    void detectCollisions(CollisionPairArray& out_collisionPairs);
+    void detectCollisionsInParallel(CollisionPairArray& out_collisionPairs);
+
+    // for the detection of the moved geometries
+    vector<char> movedFlags;
+    vector<ColdetModelPairEx*> movedPairs;
+    CollisionPairArray movedCollisionPairs;
+    CollisionPairArray mergedCollisionPairs;
+
+    void detectCollisionsOfMovedGeometries(const vector<int>& movedGeometryIds, CollisionPairArray& io_collisionPairs);
+
+    // The array given to the callback
+    CollisionPairArray collisionPairs;
 
     // for multithread type 0
-    typedef vector<CollisionPair> CollisionPairArray;
     vector<CollisionPairArray> collisionPairArrays;
+    vector<int> numCollisionPairsOfThreads;
 
     void extractCollisionsOfAssignedPairs(
-        int pairIndexBegin, int pairIndexEnd, CollisionPairArray& collisionPairs);    
-    void dispatchCollisionsInCollisionPairArrays(boost::function<void(const CollisionPair&)> callback);    
+        int pairIndexBegin, int pairIndexEnd, CollisionPairArray& collisionPairs, int& numPairs);
+    void dispatchCollisionsInCollisionPairArrays(CollisionPairArray& out_collisionPairs);
     
     // for multithread type 1
     vector< vector<ColdetModelPairEx*> > collidingModelPairArrays;
 
     void checkCollisionsOfAssignedPairs(
         int pairIndexBegin, int pairIndexEnd, vector<ColdetModelPairEx*>& collidingModelPairs);
-    void dispatchCollisionsInCollidingModelPairs(boost::function<void(const CollisionPair&)> callback);    
+    void dispatchCollisionsInCollidingModelPairs(CollisionPairArray& out_collisionPairs);
+
+    // for the distance computation
+    vector<ColdetModelPairEx*> distanceTargetPairs;
+    DistancePairArray distancePairs;
+
+    bool computeDistances(double maxDistance, DistancePairArray& out_distancePairs);
+    void computeDistancesInRange(int pairIndexBegin, int pairIndexEnd, double maxDistance);
+
+    void castRaysInRange(
+        int rayIndexBegin, int rayIndexEnd, const vector<Vector3>& origins, const vector<Vector3>& directions,
+        double maxDistance, vector<double>& out_distances, vector<int>& out_geometryIds);
 };
 
 }
@@ -130,6 +439,12 @@ AISTCollisionDetectorImpl::AISTCollisionDetectorImpl()
 {
     maxNumThreads = 0;
     numThreads = 0;
+    isBroadphaseEnabled = true;
+    isGeometryCacheEnabled = true;
+    isPrimitiveCollisionEnabled = false;
+    isReady = false;
+    numReadyModels = 0;
+    hasDirtyModels = false;
     meshExtractor = new MeshExtractor();
 }
 
@@ -159,17 +474,70 @@ CollisionDetectorPtr AISTCollisionDetector::clone() const
 }
 
 
-void AISTCollisionDetector::setNumThreads(int n)
+bool AISTCollisionDetector::setNumThreads(int n)
 {
     impl->maxNumThreads = n;
+    return true;
+}
+
+
+void AISTCollisionDetector::enableBroadphase(bool on)
+{
+    if(on != impl->isBroadphaseEnabled){
+        impl->isBroadphaseEnabled = on;
+        // The pairs are created from scratch in the next makeReady()
+        impl->isReady = false;
+    }
+}
+
+
+bool AISTCollisionDetector::isBroadphaseEnabled() const
+{
+    return impl->isBroadphaseEnabled;
+}
+
+
+void AISTCollisionDetector::enablePrimitiveCollision(bool on)
+{
+    impl->isPrimitiveCollisionEnabled = on;
+}
+
+
+bool AISTCollisionDetector::isPrimitiveCollisionEnabled() const
+{
+    return impl->isPrimitiveCollisionEnabled;
 }
 
         
 void AISTCollisionDetector::clearGeometries()
 {
+    {
+        // The entries of the deleted meshes are removed here so that they do not accumulate
+        boost::lock_guard<boost::mutex> lock(modelCacheMutex);
+        ModelCache::iterator p = modelCache.begin();
+        while(p != modelCache.end()){
+            if(p->second.isValid(p->first)){
+                ++p;
+            } else {
+                modelCache.erase(p++);
+            }
+        }
+    }
+
     impl->models.clear();
+    impl->pendingModels.clear();
+    impl->pendingModelIndices.clear();
     impl->modelPairs.clear();
+    impl->modelPairMap.clear();
+    impl->targetPairs.clear();
+    impl->sweepOrder.clear();
     impl->nonInterfarencePairs.clear();
+    impl->isReady = false;
+    impl->numReadyModels = 0;
+    impl->dirtyFlags.clear();
+    impl->hasDirtyModels = false;
+    impl->changedNonInterfarencePairs.clear();
+    impl->randomEngine.seed();
 }
 
 
@@ -185,22 +553,44 @@ int AISTCollisionDetector::addGeometry(SgNodePtr geometry)
 }
 
 
+/**
+   The model of a geometry which is not found in the cache is only registered here with the meshes
+   extracted from the scene graph, and it is built by the next makeReady() so that the models of
+   the geometries added at the same time are built in parallel.
+*/
 int AISTCollisionDetectorImpl::addGeometry(SgNode* geometry)
 {
     const int index = models.size();
     bool isValid = false;
 
-    if(geometry){
-        ColdetModelExPtr model = boost::make_shared<ColdetModelEx>();
-        if(meshExtractor->extract(geometry, boost::bind(&AISTCollisionDetectorImpl::addMesh, this, model.get()))){
+    if(geometry && extractMeshInstances(geometry)){
+        ColdetModelExPtr cachedModel;
+        if(isGeometryCacheEnabled){
+            cachedModel = findCachedModel(ModelCacheKey(meshInstances, isPrimitiveCollisionEnabled));
+        }
+        if(cachedModel){
+            // The copy shares the vertices, the triangles and the tree of the cached model
+            ColdetModelExPtr model = boost::make_shared<ColdetModelEx>(*cachedModel);
+            model->setName(geometry->name());
+            models.push_back(model);
+        } else {
+            ColdetModelExPtr model = boost::make_shared<ColdetModelEx>();
             model->setName(geometry->name());
-            model->build();
-            if(model->isValid()){
-                models.push_back(model);
-                isValid = true;
+            model->pendingIndex = pendingModels.size();
+            pendingModels.push_back(PendingModel(model, meshInstances, isPrimitiveCollisionEnabled));
+            if(isGeometryCacheEnabled){
+                PendingModel& pending = pendingModels.back();
+                pair<map<ModelCacheKey, int>::iterator, bool> inserted =
+                    pendingModelIndices.insert(make_pair(pending.key, model->pendingIndex));
+                if(!inserted.second){
+                    pending.sourceIndex = inserted.first->second;
+                }
             }
+            models.push_back(model);
         }
+        isValid = true;
     }
+    meshInstances.clear();
 
     if(!isValid){
         models.push_back(ColdetModelExPtr());
@@ -210,61 +600,305 @@ int AISTCollisionDetectorImpl::addGeometry(SgNode* geometry)
 }
 
 
-void AISTCollisionDetectorImpl::addMesh(ColdetModelEx* model)
+bool AISTCollisionDetectorImpl::extractMeshInstances(SgNode* geometry)
 {
-    SgMesh* mesh = meshExtractor->currentMesh();
-    const Affine3& T = meshExtractor->currentTransform();
-    
-    const int vertexIndexTop = model->getNumVertices();
+    meshInstances.clear();
+    return meshExtractor->extract(geometry, boost::bind(&AISTCollisionDetectorImpl::addMeshInstance, this));
+}
+
+
+void AISTCollisionDetectorImpl::addMeshInstance()
+{
+    meshInstances.push_back(MeshInstance());
+    MeshInstance& instance = meshInstances.back();
+    instance.mesh = meshExtractor->currentMesh();
+    instance.T = meshExtractor->currentTransform();
+}
+
+
+ColdetModelExPtr AISTCollisionDetectorImpl::findCachedModel(const ModelCacheKey& key)
+{
+    boost::lock_guard<boost::mutex> lock(modelCacheMutex);
+    ModelCache::iterator p = modelCache.find(key);
+    if(p != modelCache.end()){
+        if(p->second.isValid(key)){
+            return p->second.model;
+        }
+        modelCache.erase(p);
+    }
+    return ColdetModelExPtr();
+}
+
+
+void AISTCollisionDetectorImpl::buildPendingModels()
+{
+    if(pendingModels.empty()){
+        return;
+    }
+
+    TaskScheduler::instance()->parallelForRanges(
+        0, pendingModels.size(),
+        boost::bind(&AISTCollisionDetectorImpl::buildPendingModelsInRange, this, _1, _2),
+        MODEL_BUILDING_GRAIN_SIZE);
+
+    for(size_t i=0; i < pendingModels.size(); ++i){
+        PendingModel& pending = pendingModels[i];
+        ColdetModelExPtr& model = pending.model;
+        if(pending.sourceIndex >= 0){
+            const ColdetModelExPtr& source = pendingModels[pending.sourceIndex].model;
+            if(source->isValid()){
+                // The copy keeps the name, the static flag and the position given to this geometry
+                ColdetModelExPtr copy = boost::make_shared<ColdetModelEx>(*source);
+                copy->setName(model->name());
+                copy->isStatic = model->isStatic;
+                copy->pendingIndex = -1;
+                const Position T = pending.isPositionGiven ? pending.T : Position::Identity();
+                copy->setPosition(T);
+                copy->updateBoundingBox(T);
+                model = copy;
+            }
+        } else if(model->isValid() && isGeometryCacheEnabled){
+            boost::lock_guard<boost::mutex> lock(modelCacheMutex);
+            ModelCacheEntry& entry = modelCache[pending.key];
+            entry.model = boost::make_shared<ColdetModelEx>(*model);
+            entry.model->updateBoundingBox(Position::Identity());
+            entry.meshes.assign(pending.key.meshes.begin(), pending.key.meshes.end());
+        }
+    }
+
+    // The geometries removed before being built are kept removed
+    for(size_t i=0; i < models.size(); ++i){
+        ColdetModelExPtr& model = models[i];
+        if(model && model->pendingIndex >= 0){
+            const ColdetModelExPtr& built = pendingModels[model->pendingIndex].model;
+            if(built->isValid()){
+                model = built;
+                model->pendingIndex = -1;
+            } else {
+                model.reset();
+            }
+        }
+    }
+
+    pendingModels.clear();
+    pendingModelIndices.clear();
+}
+
+
+void AISTCollisionDetectorImpl::buildPendingModelsInRange(int begin, int end)
+{
+    for(int i=begin; i < end; ++i){
+        PendingModel& pending = pendingModels[i];
+        if(pending.sourceIndex >= 0){
+            continue;
+        }
+        ColdetModelEx* model = pending.model.get();
+        setMeshes(model, pending.meshInstances);
+        if(isPrimitiveCollisionEnabled){
+            setPrimitiveInformation(model, pending.meshInstances);
+        }
+        model->build();
+        if(model->isValid()){
+            model->calcLocalBoundingBox();
+            model->updateBoundingBox(pending.isPositionGiven ? pending.T : Position::Identity());
+        }
+    }
+}
+
+
+/**
+   The vertices and the triangles of all the meshes are put into the arrays allocated at once.
+   The meshes are only read here because they may be shared by the models built in parallel.
+*/
+void AISTCollisionDetectorImpl::setMeshes(ColdetModelEx* model, const MeshInstanceArray& instances)
+{
+    int numVertices = 0;
+    int numTriangles = 0;
+    for(size_t i=0; i < instances.size(); ++i){
+        const SgMesh* mesh = instances[i].mesh;
+        numVertices += mesh->vertices()->size();
+        numTriangles += mesh->numTriangles();
+    }
+    model->setNumVertices(numVertices);
+    model->setNumTriangles(numTriangles);
+
+    int vertexIndex = 0;
+    int triangleIndex = 0;
+    for(size_t i=0; i < instances.size(); ++i){
+        const MeshInstance& instance = instances[i];
+        const SgMesh* mesh = instance.mesh;
+        const Affine3& T = instance.T;
+        const int vertexIndexTop = vertexIndex;
     
-    const SgVertexArray& vertices = *mesh->vertices();
-    const int numVertices = vertices.size();
-    for(int i=0; i < numVertices; ++i){
-        const Vector3 v = T * vertices[i].cast<Affine3::Scalar>();
-        model->addVertex(v.x(), v.y(), v.z());
+        const SgVertexArray& vertices = *mesh->vertices();
+        const int n = vertices.size();
+        for(int j=0; j < n; ++j){
+            const Vector3 v = T * vertices[j].cast<Affine3::Scalar>();
+            model->setVertex(vertexIndex++, v.x(), v.y(), v.z());
+        }
+
+        const SgIndexArray& indices = mesh->triangleVertices();
+        const int m = mesh->numTriangles();
+        for(int j=0; j < m; ++j){
+            model->setTriangle(triangleIndex++,
+                               vertexIndexTop + indices[j * 3],
+                               vertexIndexTop + indices[j * 3 + 1],
+                               vertexIndexTop + indices[j * 3 + 2]);
+        }
+    }
+}
+
+
+/**
+   The primitive information is only used for a geometry of a single mesh because the
+   closed-form routines do not handle the union of the shapes. The transform of the mesh
+   must not have any scaling.
+*/
+void AISTCollisionDetectorImpl::setPrimitiveInformation(ColdetModelEx* model, const MeshInstanceArray& instances)
+{
+    if(instances.size() != 1){
+        return;
+    }
+    const MeshInstance& instance = instances.front();
+    const Affine3::LinearMatrixType R = instance.T.linear();
+    if(!(R.transpose() * R).isIdentity(1.0e-9)){
+        return;
+    }
+    SgMesh* mesh = instance.mesh;
+    switch(mesh->primitiveType()){
+    case SgMesh::BOX: {
+        const Vector3& size = mesh->primitive<SgMesh::Box>().size;
+        model->setPrimitiveType(ColdetModel::SP_BOX);
+        model->setNumPrimitiveParams(3);
+        for(int i=0; i < 3; ++i){
+            model->setPrimitiveParam(i, size[i]);
+        }
+        break;
+    }
+    case SgMesh::SPHERE:
+        model->setPrimitiveType(ColdetModel::SP_SPHERE);
+        model->setNumPrimitiveParams(1);
+        model->setPrimitiveParam(0, mesh->primitive<SgMesh::Sphere>().radius);
+        break;
+    case SgMesh::CYLINDER: {
+        const SgMesh::Cylinder& cylinder = mesh->primitive<SgMesh::Cylinder>();
+        if(cylinder.top && cylinder.bottom && cylinder.side){
+            model->setPrimitiveType(ColdetModel::SP_CYLINDER);
+            model->setNumPrimitiveParams(2);
+            model->setPrimitiveParam(0, cylinder.radius);
+            model->setPrimitiveParam(1, cylinder.height);
+        }
+        break;
+    }
+    default:
+        return;
     }
 
-    const int numTriangles = mesh->numTriangles();
-    for(int i=0; i < numTriangles; ++i){
-        SgMesh::TriangleRef tri = mesh->triangle(i);
-        const int v0 = vertexIndexTop + tri[0];
-        const int v1 = vertexIndexTop + tri[1];
-        const int v2 = vertexIndexTop + tri[2];
-        model->addTriangle(v0, v1, v2);
+    // The primitive position is given as the row-major rotation matrix and the translation
+    double Rd[9];
+    for(int i=0; i < 3; ++i){
+        for(int j=0; j < 3; ++j){
+            Rd[i * 3 + j] = R(i, j);
+        }
     }
+    const Vector3 p = instance.T.translation();
+    model->setPrimitivePosition(Rd, p.data());
 }
 
 
 void AISTCollisionDetector::setGeometryStatic(int geometryId, bool isStatic)
 {
     ColdetModelExPtr& model = impl->models[geometryId];
-    if(model){
+    if(model && model->isStatic != isStatic){
         model->isStatic = isStatic;
+        impl->setDirty(geometryId);
+    }
+}
+
+
+/**
+   The geometry is only invalidated so that the IDs of the other geometries are kept.
+*/
+bool AISTCollisionDetector::removeGeometry(int geometryId)
+{
+    if(geometryId >= 0 && geometryId < (int)impl->models.size()){
+        if(impl->models[geometryId]){
+            impl->models[geometryId].reset();
+            impl->setDirty(geometryId);
+        }
+    }
+    return true;
+}
+
+
+void AISTCollisionDetectorImpl::setDirty(int geometryId)
+{
+    if(isReady && geometryId < numReadyModels){
+        if(dirtyFlags.size() < (size_t)numReadyModels){
+            dirtyFlags.resize(numReadyModels, false);
+        }
+        dirtyFlags[geometryId] = true;
+        hasDirtyModels = true;
     }
 }
 
 
+/**
+   The cache is enabled by default. The models built from the same meshes with the same
+   transforms share the vertices, the triangles and the OPCODE tree, and the cached models
+   are reused by the other instances of this class. Call clearGeometryCache() when the
+   meshes of a geometry are modified.
+*/
 bool AISTCollisionDetector::enableGeometryCache(bool on)
 {
-    return false;
+    impl->isGeometryCacheEnabled = on;
+    return true;
 }
 
 
 void AISTCollisionDetector::clearGeometryCache(SgNodePtr geometry)
 {
-    modelCache.erase(weak_ref_ptr<SgNode>(geometry));
+    if(geometry && impl->extractMeshInstances(geometry.get())){
+        boost::lock_guard<boost::mutex> lock(modelCacheMutex);
+        modelCache.erase(ModelCacheKey(impl->meshInstances, false));
+        modelCache.erase(ModelCacheKey(impl->meshInstances, true));
+    }
+    impl->meshInstances.clear();
 }
 
 
 void AISTCollisionDetector::clearAllGeometryCaches()
 {
+    boost::lock_guard<boost::mutex> lock(modelCacheMutex);
     modelCache.clear();
 }
 
 
 void AISTCollisionDetector::setNonInterfarenceGeometyrPair(int geometryId1, int geometryId2)
 {
-    impl->nonInterfarencePairs.insert(IdPair<>(geometryId1, geometryId2));
+    impl->setNonInterfarencePair(geometryId1, geometryId2, true);
+}
+
+
+bool AISTCollisionDetector::unsetNonInterfarenceGeometryPair(int geometryId1, int geometryId2)
+{
+    impl->setNonInterfarencePair(geometryId1, geometryId2, false);
+    return true;
+}
+
+
+void AISTCollisionDetectorImpl::setNonInterfarencePair(int geometryId1, int geometryId2, bool on)
+{
+    const IdPair<> idPair(geometryId1, geometryId2);
+    bool changed;
+    if(on){
+        changed = nonInterfarencePairs.insert(idPair).second;
+    } else {
+        changed = (nonInterfarencePairs.erase(idPair) > 0);
+    }
+    if(changed && isReady && idPair(1) < numReadyModels){
+        changedNonInterfarencePairs.insert(idPair);
+    }
 }
 
 
@@ -274,54 +908,192 @@ bool AISTCollisionDetector::makeReady()
 }
 
 
+/**
+   The pairs are created from scratch only for the first call after the geometries are cleared.
+   In the following calls, only the pairs of the geometries which have been added, removed or
+   changed between static and non-static, and the pairs of which the non interfarence flags
+   have been changed are updated. The other pair objects are kept as they are.
+*/
 bool AISTCollisionDetectorImpl::makeReady()
+{
+    buildPendingModels();
+    
+    if(!isReady){
+        createAllModelPairs();
+        isReady = true;
+    } else {
+        updateModelPairs();
+    }
+    numReadyModels = models.size();
+    dirtyFlags.clear();
+    hasDirtyModels = false;
+    changedNonInterfarencePairs.clear();
+
+    if(maxNumThreads <= 0){
+        numThreads = 0;
+        collisionPairArrays.clear();
+        numCollisionPairsOfThreads.clear();
+        collidingModelPairArrays.clear();
+
+    } else {
+        if(isBroadphaseEnabled){
+            numThreads = maxNumThreads;
+        } else {
+            const int numPairs = modelPairs.size();
+            numThreads = (maxNumThreads > numPairs) ? numPairs : maxNumThreads;
+        }
+        if(MULTITHREAD_TYPE == 0){
+            collisionPairArrays.resize(numThreads);
+            numCollisionPairsOfThreads.resize(numThreads, 0);
+        } else {
+            collidingModelPairArrays.resize(numThreads);
+        }
+    }
+
+    return true;
+}
+
+
+void AISTCollisionDetectorImpl::createAllModelPairs()
 {
     modelPairs.clear();
+    modelPairMap.clear();
+    targetPairs.clear();
+    sweepOrder.clear();
 
     const int n = models.size();
-    for(int i=0; i < n; ++i){
-        ColdetModelExPtr& model1 = models[i];
-        if(model1){
-            for(int j = i+1; j < n; ++j){
-                ColdetModelExPtr& model2 = models[j];
-                if(model2){
-                    if(!model1->isStatic || !model2->isStatic){
-                        if(nonInterfarencePairs.find(IdPair<>(i, j)) == nonInterfarencePairs.end()){
-                            modelPairs.push_back(boost::make_shared<ColdetModelPairEx>(model1, i, model2, j));
+
+    if(isBroadphaseEnabled){
+        for(int i=0; i < n; ++i){
+            if(models[i]){
+                sweepOrder.push_back(i);
+            }
+        }
+    } else {
+        for(int i=0; i < n; ++i){
+            ColdetModelExPtr& model1 = models[i];
+            if(model1){
+                for(int j = i+1; j < n; ++j){
+                    ColdetModelExPtr& model2 = models[j];
+                    if(model2){
+                        if(!model1->isStatic || !model2->isStatic){
+                            if(nonInterfarencePairs.find(IdPair<>(i, j)) == nonInterfarencePairs.end()){
+                                modelPairs.push_back(boost::make_shared<ColdetModelPairEx>(model1, i, model2, j));
+                                targetPairs.push_back(modelPairs.back().get());
+                            }
                         }
                     }
                 }
             }
         }
     }
+}
 
-    const int numPairs = modelPairs.size();
 
-    if(maxNumThreads <= 0){
-        numThreads = 0;
-        threadPool.reset();
-        collisionPairArrays.clear();
-        collidingModelPairArrays.clear();
+bool AISTCollisionDetectorImpl::isPairTarget(int id1, int id2) const
+{
+    const ColdetModelEx* model1 = models[id1].get();
+    const ColdetModelEx* model2 = models[id2].get();
+    if(model1 && model2 && (!model1->isStatic || !model2->isStatic)){
+        return (nonInterfarencePairs.find(IdPair<>(id1, id2)) == nonInterfarencePairs.end());
+    }
+    return false;
+}
 
-    } else {
-        numThreads = (maxNumThreads > numPairs) ? numPairs : maxNumThreads;
-        if(USE_THREAD_POOL){
-            threadPool.reset(new ThreadPool(numThreads));
+
+/**
+   The pairs are kept in the order of the geometry IDs as those created by createAllModelPairs()
+   so that the order of the detected collisions does not depend on the history of the changes.
+*/
+void AISTCollisionDetectorImpl::updateModelPairs()
+{
+    const int n = models.size();
+    dirtyFlags.resize(n, false);
+    for(int i=numReadyModels; i < n; ++i){
+        dirtyFlags[i] = true;
+        hasDirtyModels = true;
+    }
+    if(!hasDirtyModels && changedNonInterfarencePairs.empty()){
+        return;
+    }
+
+    if(isBroadphaseEnabled){
+        // The pair objects are created again when the pairs overlap next time
+        ModelPairMap::iterator p = modelPairMap.begin();
+        while(p != modelPairMap.end()){
+            const IdPair<>& idPair = p->first;
+            if(dirtyFlags[idPair(0)] || dirtyFlags[idPair(1)] ||
+               changedNonInterfarencePairs.find(idPair) != changedNonInterfarencePairs.end()){
+                modelPairMap.erase(p++);
+            } else {
+                ++p;
+            }
         }
-        if(ENABLE_SHUFFLE){
-            shuffledPairIndices.resize(modelPairs.size());
-            for(size_t i=0; i < shuffledPairIndices.size(); ++i){
-                shuffledPairIndices[i] = i;
+        if(hasDirtyModels){
+            vector<int>::iterator q = sweepOrder.begin();
+            while(q != sweepOrder.end()){
+                if(models[*q]){
+                    ++q;
+                } else {
+                    q = sweepOrder.erase(q);
+                }
+            }
+            for(int i=numReadyModels; i < n; ++i){
+                if(models[i]){
+                    sweepOrder.push_back(i);
+                }
             }
         }
-        if(MULTITHREAD_TYPE == 0){
-            collisionPairArrays.resize(numThreads);
-        } else {
-            collidingModelPairArrays.resize(numThreads);
+        // The target pairs may refer to the erased pairs
+        targetPairs.clear();
+        return;
+    }
+
+    // Remove the affected pairs
+    ModelPairArray::iterator end = modelPairs.begin();
+    for(ModelPairArray::iterator p = modelPairs.begin(); p != modelPairs.end(); ++p){
+        ColdetModelPairEx* modelPair = p->get();
+        if(!dirtyFlags[modelPair->id1()] && !dirtyFlags[modelPair->id2()] &&
+           (changedNonInterfarencePairs.empty() ||
+            changedNonInterfarencePairs.find(IdPair<>(modelPair->id1(), modelPair->id2()))
+            == changedNonInterfarencePairs.end())){
+            if(end != p){
+                end->swap(*p);
+            }
+            ++end;
         }
     }
+    modelPairs.erase(end, modelPairs.end());
+    const size_t numKeptPairs = modelPairs.size();
+
+    // Create the affected pairs again
+    if(hasDirtyModels){
+        for(int i=0; i < n; ++i){
+            if(dirtyFlags[i] && models[i]){
+                for(int j=0; j < n; ++j){
+                    if(j != i && (!dirtyFlags[j] || j > i) && isPairTarget(i, j)){
+                        const int id1 = std::min(i, j);
+                        const int id2 = std::max(i, j);
+                        modelPairs.push_back(boost::make_shared<ColdetModelPairEx>(models[id1], id1, models[id2], id2));
+                    }
+                }
+            }
+        }
+    }
+    for(IdPairSet::iterator p = changedNonInterfarencePairs.begin(); p != changedNonInterfarencePairs.end(); ++p){
+        const int id1 = (*p)(0);
+        const int id2 = (*p)(1);
+        if(!dirtyFlags[id1] && !dirtyFlags[id2] && isPairTarget(id1, id2)){
+            modelPairs.push_back(boost::make_shared<ColdetModelPairEx>(models[id1], id1, models[id2], id2));
+        }
+    }
+    std::sort(modelPairs.begin() + numKeptPairs, modelPairs.end(), compareModelPairIds);
+    std::inplace_merge(modelPairs.begin(), modelPairs.begin() + numKeptPairs, modelPairs.end(), compareModelPairIds);
 
-    return true;
+    targetPairs.resize(modelPairs.size());
+    for(size_t i=0; i < modelPairs.size(); ++i){
+        targetPairs[i] = modelPairs[i].get();
+    }
 }
 
 
@@ -330,66 +1102,250 @@ void AISTCollisionDetector::updatePosition(int geometryId, const Position& posit
     ColdetModelExPtr& model = impl->models[geometryId];
     if(model){
         model->setPosition(position);
+        model->updateBoundingBox(position);
+        if(model->pendingIndex >= 0){
+            impl->setPositionOfPendingModel(model.get(), position);
+        }
+    }
+}
+
+
+void AISTCollisionDetectorImpl::setPositionOfPendingModel(ColdetModelEx* model, const Position& T)
+{
+    PendingModel& pending = pendingModels[model->pendingIndex];
+    pending.T = T;
+    pending.isPositionGiven = true;
+}
+
+
+void AISTCollisionDetector::updatePositions(int begin, int end, const PositionArray& positions)
+{
+    for(int i=begin; i < end; ++i){
+        ColdetModelExPtr& model = impl->models[i];
+        if(model){
+            const Position& position = positions[i - begin];
+            model->setPosition(position);
+            model->updateBoundingBox(position);
+            if(model->pendingIndex >= 0){
+                impl->setPositionOfPendingModel(model.get(), position);
+            }
+        }
     }
 }
 
 
 void AISTCollisionDetector::detectCollisions(boost::function<void(const CollisionPair&)> callback)
 {
-    if(impl->numThreads > 0){
-        impl->detectCollisionsInParallel(callback);
+    impl->detectCollisions(impl->collisionPairs);
+    for(size_t i=0; i < impl->collisionPairs.size(); ++i){
+        callback(impl->collisionPairs[i]);
+    }
+}
+
+
+void AISTCollisionDetector::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    impl->detectCollisions(out_collisionPairs);
+}
+
+
+void AISTCollisionDetectorImpl::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    if(isBroadphaseEnabled){
+        updateTargetPairsWithBroadphase();
+    }
+    if(numThreads > 0 && !targetPairs.empty()){
+        detectCollisionsInParallel(out_collisionPairs);
     } else {
-        impl->detectCollisions(callback);
+        int numPairs = 0;
+        for(size_t i=0; i < targetPairs.size(); ++i){
+            ColdetModelPairEx& modelPair = *targetPairs[i];
+            extractCollisions(modelPair, modelPair.detectCollisions(), out_collisionPairs, numPairs);
+        }
+        out_collisionPairs.resize(numPairs);
     }
 } 
 
 
+void AISTCollisionDetector::detectCollisionsOfMovedGeometries
+(const std::vector<int>& movedGeometryIds, CollisionPairArray& io_collisionPairs)
+{
+    impl->detectCollisionsOfMovedGeometries(movedGeometryIds, io_collisionPairs);
+}
+
+
 /**
-   \todo Remeber which geometry positions are updated after the last collision detection
-   and do the actual collision detection only for the updated geometry pairs.
+   The pairs including the moved geometries are removed from the given array, and those of them
+   which collide now are merged into the array. The elements of the array are swapped instead of
+   copied so that the collision arrays of the unchanged pairs are not reallocated.
 */
-void AISTCollisionDetectorImpl::detectCollisions(boost::function<void(const CollisionPair&)> callback)
+void AISTCollisionDetectorImpl::detectCollisionsOfMovedGeometries
+(const vector<int>& movedGeometryIds, CollisionPairArray& io_collisionPairs)
 {
-    CollisionPair collisionPair;
-    vector<Collision>& collisions = collisionPair.collisions;
+    if(movedGeometryIds.empty()){
+        return;
+    }
     
-    const int n = modelPairs.size();
+    movedFlags.assign(models.size(), false);
+    for(size_t i=0; i < movedGeometryIds.size(); ++i){
+        movedFlags[movedGeometryIds[i]] = true;
+    }
+
+    if(isBroadphaseEnabled){
+        // The sweep is cheap compared with the narrowphase of the pairs
+        collectPairsWithBroadphase(0.0, targetPairs);
+    }
+    movedPairs.clear();
+    for(size_t i=0; i < targetPairs.size(); ++i){
+        ColdetModelPairEx* modelPair = targetPairs[i];
+        if(movedFlags[modelPair->id1()] || movedFlags[modelPair->id2()]){
+            movedPairs.push_back(modelPair);
+        }
+    }
+    int numMovedPairs = 0;
+    for(size_t i=0; i < movedPairs.size(); ++i){
+        ColdetModelPairEx& modelPair = *movedPairs[i];
+        extractCollisions(modelPair, modelPair.detectCollisions(), movedCollisionPairs, numMovedPairs);
+    }
+
+    // Merge the kept pairs and the new pairs in the order of the geometry IDs
+    mergedCollisionPairs.resize(io_collisionPairs.size() + numMovedPairs);
+    int numMergedPairs = 0;
+    size_t i = 0;
+    int j = 0;
+    while(true){
+        while(i < io_collisionPairs.size() &&
+              (movedFlags[io_collisionPairs[i].geometryId[0]] || movedFlags[io_collisionPairs[i].geometryId[1]])){
+            ++i;
+        }
+        const bool hasKeptPair = (i < io_collisionPairs.size());
+        const bool hasMovedPair = (j < numMovedPairs);
+        if(!hasKeptPair && !hasMovedPair){
+            break;
+        }
+        CollisionPair& merged = mergedCollisionPairs[numMergedPairs++];
+        if(hasKeptPair &&
+           (!hasMovedPair || compareCollisionPairIds(io_collisionPairs[i], movedCollisionPairs[j]))){
+            merged.geometryId[0] = io_collisionPairs[i].geometryId[0];
+            merged.geometryId[1] = io_collisionPairs[i].geometryId[1];
+            merged.collisions.swap(io_collisionPairs[i].collisions);
+            ++i;
+        } else {
+            merged.geometryId[0] = movedCollisionPairs[j].geometryId[0];
+            merged.geometryId[1] = movedCollisionPairs[j].geometryId[1];
+            merged.collisions.swap(movedCollisionPairs[j].collisions);
+            ++j;
+        }
+    }
+    mergedCollisionPairs.resize(numMergedPairs);
+    io_collisionPairs.swap(mergedCollisionPairs);
+}
+
+
+/**
+   The broadphase sorts the bounding boxes along the x axis and sweeps them to find the
+   overlapping pairs. The order of the previous step is sorted again by the insertion sort,
+   which takes almost linear time because the order rarely changes between the steps.
+   The overlapping pairs are sorted by the geometry IDs so that the collisions are given to
+   the callback in the same order as the detection without the broadphase.
+*/
+void AISTCollisionDetectorImpl::updateTargetPairsWithBroadphase()
+{
+    collectPairsWithBroadphase(0.0, targetPairs);
+}
+
+
+/**
+   @param margin The pairs whose bounding boxes are separated by less than this value are also collected.
+*/
+void AISTCollisionDetectorImpl::collectPairsWithBroadphase(double margin, vector<ColdetModelPairEx*>& out_pairs)
+{
+    const int n = sweepOrder.size();
+    for(int i=1; i < n; ++i){
+        const int id = sweepOrder[i];
+        const double x = models[id]->boxMin.x();
+        int j = i - 1;
+        while(j >= 0 && models[sweepOrder[j]]->boxMin.x() > x){
+            sweepOrder[j + 1] = sweepOrder[j];
+            --j;
+        }
+        sweepOrder[j + 1] = id;
+    }
+
+    overlappingIdPairs.clear();
     for(int i=0; i < n; ++i){
-        ColdetModelPairEx& modelPair = *modelPairs[i];
-        const std::vector<collision_data>& cdata = modelPair.detectCollisions();
-        if(!cdata.empty()){
-            collisionPair.geometryId[0] = modelPair.id1();
-            collisionPair.geometryId[1] = modelPair.id2();
-            collisions.clear();
-            for(size_t j=0; j < cdata.size(); ++j){
-                const collision_data& cd = cdata[j];
-                for(int k=0; k < cd.num_of_i_points; ++k){
-                    if(cd.i_point_new[k]){
-                        collisions.push_back(Collision());
-                        Collision& collision = collisions.back();
-                        collision.point = cd.i_points[k];
-                        collision.normal = cd.n_vector;
-                        collision.depth = cd.depth;
-                        collision.id1 = cd.id1;
-                        collision.id2 = cd.id2;
-                    }
-                }
+        const int id1 = sweepOrder[i];
+        const ColdetModelEx& model1 = *models[id1];
+        for(int j = i+1; j < n; ++j){
+            const int id2 = sweepOrder[j];
+            const ColdetModelEx& model2 = *models[id2];
+            if(model2.boxMin.x() > model1.boxMax.x() + margin){
+                break;
+            }
+            if(model1.isStatic && model2.isStatic){
+                continue;
             }
-            if(!collisions.empty()){
-                callback(collisionPair);
+            if(model1.boxMin.y() <= model2.boxMax.y() + margin && model2.boxMin.y() <= model1.boxMax.y() + margin &&
+               model1.boxMin.z() <= model2.boxMax.z() + margin && model2.boxMin.z() <= model1.boxMax.z() + margin){
+                overlappingIdPairs.push_back(IdPair<>(id1, id2));
             }
         }
     }
+    std::sort(overlappingIdPairs.begin(), overlappingIdPairs.end());
+
+    out_pairs.clear();
+    for(size_t i=0; i < overlappingIdPairs.size(); ++i){
+        const IdPair<>& idPair = overlappingIdPairs[i];
+        ColdetModelPairEx* modelPair = findOrCreateModelPair(idPair(0), idPair(1));
+        if(modelPair){
+            out_pairs.push_back(modelPair);
+        }
+    }
+}
+
+
+/**
+   The pair objects are only created for the pairs which have overlapped once,
+   and they are kept until makeReady() is called again.
+*/
+ColdetModelPairEx* AISTCollisionDetectorImpl::findOrCreateModelPair(int id1, int id2)
+{
+    const IdPair<> idPair(id1, id2);
+    ModelPairMap::iterator p = modelPairMap.find(idPair);
+    if(p == modelPairMap.end()){
+        ColdetModelPairExPtr modelPair;
+        if(nonInterfarencePairs.find(idPair) == nonInterfarencePairs.end()){
+            modelPair = boost::make_shared<ColdetModelPairEx>(models[id1], id1, models[id2], id2);
+        }
+        p = modelPairMap.insert(ModelPairMap::value_type(idPair, modelPair)).first;
+    }
+    return p->second.get();
 }
 
 
-void AISTCollisionDetectorImpl::detectCollisionsInParallel(boost::function<void(const CollisionPair&)> callback)
+void AISTCollisionDetectorImpl::detectCollisionsInParallel(CollisionPairArray& out_collisionPairs)
 {
+    const int numPairs = targetPairs.size();
+
     if(ENABLE_SHUFFLE){
+        shuffledPairIndices.resize(numPairs);
+        for(int i=0; i < numPairs; ++i){
+            shuffledPairIndices[i] = i;
+        }
         std::random_shuffle(shuffledPairIndices.begin(), shuffledPairIndices.end(), randomNumberGenerator);
     }
 
-    const int numPairs = modelPairs.size();
+    // The arrays of the threads which are not given any pairs must be empty in the dispatch
+    for(int i=0; i < numThreads; ++i){
+        if(MULTITHREAD_TYPE == 0){
+            numCollisionPairsOfThreads[i] = 0;
+        } else {
+            collidingModelPairArrays[i].clear();
+        }
+    }
+
+    TaskGroup taskGroup;
+
     const int minSize = numPairs / numThreads;
     int remainder = numPairs % numThreads;
     int index = 0;
@@ -403,94 +1359,79 @@ void AISTCollisionDetectorImpl::detectCollisionsInParallel(boost::function<void(
             break;
         }
         if(MULTITHREAD_TYPE == 0){
+            boost::function<void()> task =
+                boost::bind(&AISTCollisionDetectorImpl::extractCollisionsOfAssignedPairs,
+                            this, index, index + size,
+                            boost::ref(collisionPairArrays[i]), boost::ref(numCollisionPairsOfThreads[i]));
             if(USE_THREAD_POOL){
-                threadPool->start(
-                    boost::bind(&AISTCollisionDetectorImpl::extractCollisionsOfAssignedPairs,
-                                this, index, index + size, boost::ref(collisionPairArrays[i])));
+                taskGroup.run(task);
             } else {
-                threadGroup.create_thread(
-                    boost::bind(&AISTCollisionDetectorImpl::extractCollisionsOfAssignedPairs,
-                                this, index, index + size, boost::ref(collisionPairArrays[i])));
+                threadGroup.create_thread(task);
             }
         } else {
+            boost::function<void()> task =
+                boost::bind(&AISTCollisionDetectorImpl::checkCollisionsOfAssignedPairs,
+                            this, index, index + size, boost::ref(collidingModelPairArrays[i]));
             if(USE_THREAD_POOL){
-                threadPool->start(
-                    boost::bind(&AISTCollisionDetectorImpl::checkCollisionsOfAssignedPairs,
-                                this, index, index + size, boost::ref(collidingModelPairArrays[i])));
+                taskGroup.run(task);
             } else {
-                threadGroup.create_thread(
-                    boost::bind(&AISTCollisionDetectorImpl::checkCollisionsOfAssignedPairs,
-                                this, index, index + size, boost::ref(collidingModelPairArrays[i])));
+                threadGroup.create_thread(task);
             }
         }
         index += size;
     }
     if(USE_THREAD_POOL){
-        threadPool->waitLoop();
-        //threadPool->wait();
+        taskGroup.wait();
     } else {
         threadGroup.join_all();
     }
 
     if(MULTITHREAD_TYPE == 0){
-        dispatchCollisionsInCollisionPairArrays(callback);
+        dispatchCollisionsInCollisionPairArrays(out_collisionPairs);
     } else {
-        dispatchCollisionsInCollidingModelPairs(callback);
+        dispatchCollisionsInCollidingModelPairs(out_collisionPairs);
     }
 }
 
 
 void AISTCollisionDetectorImpl::extractCollisionsOfAssignedPairs
-(int pairIndexBegin, int pairIndexEnd, CollisionPairArray& collisionPairs)
+(int pairIndexBegin, int pairIndexEnd, CollisionPairArray& collisionPairs, int& numPairs)
 {
-    collisionPairs.clear();
-
+    numPairs = 0;
     for(int i=pairIndexBegin; i < pairIndexEnd; ++i){
         ColdetModelPairEx* modelPair;
         if(ENABLE_SHUFFLE){
-            modelPair = modelPairs[shuffledPairIndices[i]].get();
+            modelPair = targetPairs[shuffledPairIndices[i]];
         } else {
-            modelPair = modelPairs[i].get();
-        }
-        const std::vector<collision_data>& cdata = modelPair->detectCollisions();
-        if(!cdata.empty()){
-            collisionPairs.push_back(CollisionPair());
-            CollisionPair& collisionPair = collisionPairs.back();
-            collisionPair.geometryId[0] = modelPair->id1();
-            collisionPair.geometryId[1] = modelPair->id2();
-            vector<Collision>& collisions = collisionPair.collisions;
-            const int n = cdata.size();
-            collisions.reserve(n);
-            for(int j=0; j < n; ++j){
-                const collision_data& cd = cdata[j];
-                for(int k=0; k < cd.num_of_i_points; ++k){
-                    if(cd.i_point_new[k]){
-                        collisions.push_back(Collision());
-                        Collision& collision = collisions.back();
-                        collision.point = cd.i_points[k];
-                        collision.normal = cd.n_vector;
-                        collision.depth = cd.depth;
-                        collision.id1 = cd.id1;
-                        collision.id2 = cd.id2;
-                    }
-                }
-            }
-            if(collisions.empty()){
-                collisionPairs.pop_back();
-            }
+            modelPair = targetPairs[i];
         }
+        extractCollisions(*modelPair, modelPair->detectCollisions(), collisionPairs, numPairs);
     }
 }
 
-void AISTCollisionDetectorImpl::dispatchCollisionsInCollisionPairArrays
-(boost::function<void(const CollisionPair&)> callback)
+
+/**
+   The collision arrays are swapped instead of copied so that the arrays of both sides
+   keep their capacities.
+*/
+void AISTCollisionDetectorImpl::dispatchCollisionsInCollisionPairArrays(CollisionPairArray& out_collisionPairs)
 {
+    int numPairs = 0;
     for(int i=0; i < numThreads; ++i){
-        const CollisionPairArray& collisionPairs = collisionPairArrays[i];
-        for(size_t j=0; j < collisionPairs.size(); ++j){
-            callback(collisionPairs[j]);
+        CollisionPairArray& collisionPairs = collisionPairArrays[i];
+        const int n = numCollisionPairsOfThreads[i];
+        for(int j=0; j < n; ++j){
+            CollisionPair& src = collisionPairs[j];
+            if(numPairs == (int)out_collisionPairs.size()){
+                out_collisionPairs.push_back(CollisionPair());
+            }
+            CollisionPair& dest = out_collisionPairs[numPairs++];
+            dest.geometryId[0] = src.geometryId[0];
+            dest.geometryId[1] = src.geometryId[1];
+            dest.collisions.swap(src.collisions);
         }
     }
+    out_collisionPairs.resize(numPairs);
 }
 
 
@@ -501,9 +1442,9 @@ void AISTCollisionDetectorImpl::checkCollisionsOfAssignedPairs
     for(int i=pairIndexBegin; i < pairIndexEnd; ++i){
         ColdetModelPairEx* modelPair;
         if(ENABLE_SHUFFLE){
-            modelPair = modelPairs[shuffledPairIndices[i]].get();
+            modelPair = targetPairs[shuffledPairIndices[i]];
         } else {
-            modelPair = modelPairs[i].get();
+            modelPair = targetPairs[i];
         }
         if(!modelPair->detectCollisions().empty()){
             collidingModelPairs.push_back(modelPair);
@@ -512,38 +1453,127 @@ void AISTCollisionDetectorImpl::checkCollisionsOfAssignedPairs
 }
 
 
-void AISTCollisionDetectorImpl::dispatchCollisionsInCollidingModelPairs
-(boost::function<void(const CollisionPair&)> callback)
+void AISTCollisionDetectorImpl::dispatchCollisionsInCollidingModelPairs(CollisionPairArray& out_collisionPairs)
 {
-    CollisionPair collisionPair;
-    vector<Collision>& collisions = collisionPair.collisions;
+    int numPairs = 0;
     for(int i=0; i < numThreads; ++i){
         const vector<ColdetModelPairEx*>& collidingModelPairs = collidingModelPairArrays[i];
         for(size_t j=0; j < collidingModelPairs.size(); ++j){
             ColdetModelPairEx& collidingModelPair = *collidingModelPairs[j];
-            const std::vector<collision_data>& cdata = collidingModelPair.collisions();
-            if(!cdata.empty()){
-                collisionPair.geometryId[0] = collidingModelPair.id1();
-                collisionPair.geometryId[1] = collidingModelPair.id2();
-                collisions.clear();
-                for(size_t k=0; k < cdata.size(); ++k){
-                    const collision_data& cd = cdata[k];
-                    for(int l=0; l < cd.num_of_i_points; ++l){
-                        if(cd.i_point_new[l]){
-                            collisions.push_back(Collision());
-                            Collision& collision = collisions.back();
-                            collision.point = cd.i_points[l];
-                            collision.normal = cd.n_vector;
-                            collision.depth = cd.depth;
-                            collision.id1 = cd.id1;
-                            collision.id2 = cd.id2;
-                        }
+            extractCollisions(collidingModelPair, collidingModelPair.collisions(), out_collisionPairs, numPairs);
+        }
+    }
+    out_collisionPairs.resize(numPairs);
+}
+
+
+/**
+   The rays are divided among the threads of TaskScheduler. Each ray is only tested against
+   the meshes whose bounding boxes are hit by the ray nearer than the current nearest hit.
+*/
+bool AISTCollisionDetector::castRays
+(const std::vector<Vector3>& origins, const std::vector<Vector3>& directions,
+ double maxDistance, std::vector<double>& out_distances, std::vector<int>& out_geometryIds)
+{
+    const int n = origins.size();
+    out_distances.resize(n);
+    out_geometryIds.resize(n);
+    TaskScheduler::instance()->parallelForRanges(
+        0, n,
+        boost::bind(&AISTCollisionDetectorImpl::castRaysInRange, impl, _1, _2,
+                    boost::cref(origins), boost::cref(directions), maxDistance,
+                    boost::ref(out_distances), boost::ref(out_geometryIds)),
+        RAY_CASTING_GRAIN_SIZE);
+    return true;
+}
+
+
+void AISTCollisionDetectorImpl::castRaysInRange
+(int rayIndexBegin, int rayIndexEnd, const vector<Vector3>& origins, const vector<Vector3>& directions,
+ double maxDistance, vector<double>& out_distances, vector<int>& out_geometryIds)
+{
+    const int numModels = models.size();
+    
+    for(int i=rayIndexBegin; i < rayIndexEnd; ++i){
+        const Vector3& origin = origins[i];
+        const Vector3& direction = directions[i];
+        double nearest = maxDistance;
+        int nearestId = -1;
+        for(int j=0; j < numModels; ++j){
+            const ColdetModelEx* model = models[j].get();
+            if(model){
+                double entry = nearest;
+                if(checkRayBoxIntersection(origin, direction, model->boxMin, model->boxMax, entry)){
+                    const double d = model->computeDistanceWithRay(origin, direction, nearest);
+                    if(d >= 0.0 && d < nearest){
+                        nearest = d;
+                        nearestId = j;
                     }
                 }
-                if(!collisions.empty()){
-                    callback(collisionPair);
-                }
             }
         }
+        out_distances[i] = nearest;
+        out_geometryIds[i] = nearestId;
+    }
+}
+
+
+bool AISTCollisionDetector::computeDistances(double maxDistance, DistancePairArray& out_distancePairs)
+{
+    return impl->computeDistances(maxDistance, out_distancePairs);
+}
+
+
+/**
+   The candidate pairs are selected by the bounding boxes expanded by maxDistance, with the
+   broadphase if it is enabled, and they are divided among the threads of TaskScheduler.
+*/
+bool AISTCollisionDetectorImpl::computeDistances(double maxDistance, DistancePairArray& out_distancePairs)
+{
+    if(isBroadphaseEnabled){
+        collectPairsWithBroadphase(maxDistance, distanceTargetPairs);
+    } else {
+        distanceTargetPairs.clear();
+        for(size_t i=0; i < modelPairs.size(); ++i){
+            ColdetModelPairEx* modelPair = modelPairs[i].get();
+            if(checkBoundingBoxGap(*models[modelPair->id1()], *models[modelPair->id2()], maxDistance)){
+                distanceTargetPairs.push_back(modelPair);
+            }
+        }
+    }
+
+    const int n = distanceTargetPairs.size();
+    distancePairs.resize(n);
+    TaskScheduler::instance()->parallelForRanges(
+        0, n,
+        boost::bind(&AISTCollisionDetectorImpl::computeDistancesInRange, this, _1, _2, maxDistance),
+        DISTANCE_COMPUTATION_GRAIN_SIZE);
+
+    out_distancePairs.clear();
+    for(int i=0; i < n; ++i){
+        const DistancePair& pair = distancePairs[i];
+        if(pair.distance >= 0.0 && pair.distance < maxDistance){
+            out_distancePairs.push_back(pair);
+        }
+    }
+
+    return true;
+}
+
+
+void AISTCollisionDetectorImpl::computeDistancesInRange(int pairIndexBegin, int pairIndexEnd, double maxDistance)
+{
+    double p0[3], p1[3];
+    
+    for(int i=pairIndexBegin; i < pairIndexEnd; ++i){
+        ColdetModelPairEx& modelPair = *distanceTargetPairs[i];
+        DistancePair& pair = distancePairs[i];
+        pair.geometryId[0] = modelPair.id1();
+        pair.geometryId[1] = modelPair.id2();
+        pair.distance = modelPair.computeDistance(maxDistance, p0, p1);
+        if(pair.distance >= 0.0 && pair.distance < maxDistance){
+            pair.point[0] << p0[0], p0[1], p0[2];
+            pair.point[1] << p1[0], p1[1], p1[2];
+        }
     }
 }
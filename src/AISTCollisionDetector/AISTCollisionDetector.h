@@ -24,15 +24,43 @@ public:
     virtual int numGeometries() const;
     virtual int addGeometry(SgNodePtr geometry);
     virtual void setGeometryStatic(int geometryId, bool isStatic = true);
+    virtual bool removeGeometry(int geometryId);
     virtual bool enableGeometryCache(bool on);
     virtual void clearGeometryCache(SgNodePtr geometry);
     virtual void clearAllGeometryCaches();
     virtual void setNonInterfarenceGeometyrPair(int geometryId1, int geometryId2);
+    virtual bool unsetNonInterfarenceGeometryPair(int geometryId1, int geometryId2);
     virtual bool makeReady();
     virtual void updatePosition(int geometryId, const Position& position);
+    virtual void updatePositions(int begin, int end, const PositionArray& positions);
     virtual void detectCollisions(boost::function<void(const CollisionPair&)> callback);
+    virtual void detectCollisions(CollisionPairArray& out_collisionPairs);
+    virtual void detectCollisionsOfMovedGeometries(
+        const std::vector<int>& movedGeometryIds, CollisionPairArray& io_collisionPairs);
+    virtual bool castRays(const std::vector<Vector3>& origins, const std::vector<Vector3>& directions,
+                          double maxDistance, std::vector<double>& out_distances, std::vector<int>& out_geometryIds);
+    virtual bool computeDistances(double maxDistance, DistancePairArray& out_distancePairs);
 
-    void setNumThreads(int n);
+    virtual bool setNumThreads(int n);
+
+    /**
+       When the broadphase is enabled, the bounding boxes of the geometries in the world
+       coordinate are swept to find the overlapping pairs, and only those pairs are given to
+       the narrowphase. The collisions are the same as those without the broadphase.
+       This is enabled by default and must be set before makeReady() is called.
+    */
+    void enableBroadphase(bool on);
+    bool isBroadphaseEnabled() const;
+
+    /**
+       When this is enabled, a geometry consisting of a single box, sphere or cylinder mesh
+       generated by MeshGenerator keeps the primitive information, and the box-box,
+       box-sphere and sphere-sphere pairs are checked by the closed-form routines instead of
+       the triangle tests. The other pairs are checked with the meshes as before.
+       This is disabled by default and must be set before the geometries are added.
+    */
+    void enablePrimitiveCollision(bool on);
+    bool isPrimitiveCollisionEnabled() const;
 
 private:
     AISTCollisionDetectorImpl* impl;
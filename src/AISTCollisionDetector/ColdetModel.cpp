@@ -5,9 +5,19 @@
 #include "ColdetModel.h"
 #include "ColdetModelInternalModel.h"
 #include "Opcode/Opcode.h"
+#include <cnoid/MemoryUsageCounter>
 #include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <map>
+#include <fstream>
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 using namespace std;
 using namespace cnoid;
@@ -43,6 +53,111 @@ struct trianglePair {
 };
 
 typedef std::map< Edge, trianglePair > EdgeToTriangleMap;
+
+boost::mutex treeCacheMutex;
+string treeCacheDirectory_;
+
+const char treeCacheMagic[8] = { 'C', 'N', 'O', 'I', 'D', 'C', 'D', 'T' };
+const boost::uint32_t treeCacheVersion = 1;
+
+struct TreeCacheHeader
+{
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t numVertices;
+    boost::uint32_t numTriangles;
+    boost::uint32_t numNodes;
+    boost::uint64_t hash;
+};
+
+/**
+   The pointers of a node are stored as the indices of the nodes so that
+   the file does not depend on the address of the node array.
+*/
+struct TreeCacheNode
+{
+    float center[3];
+    float extents[3];
+    // The index of the positive child or the primitive index of a leaf, shifted with the leaf flag
+    boost::uint32_t data;
+    boost::uint32_t parent;
+};
+
+boost::uint64_t addHash(boost::uint64_t hash, const void* data, size_t size)
+{
+    // FNV-1a
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(size_t i=0; i < size; ++i){
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+boost::uint64_t calcMeshHash
+(const vector<IceMaths::Point>& vertices, const vector<IceMaths::IndexedTriangle>& triangles)
+{
+    boost::uint64_t hash = 14695981039346656037ULL;
+    const boost::uint32_t sizes[] = { treeCacheVersion, (boost::uint32_t)vertices.size(), (boost::uint32_t)triangles.size() };
+    hash = addHash(hash, sizes, sizeof(sizes));
+    hash = addHash(hash, &vertices[0], vertices.size() * sizeof(IceMaths::Point));
+    hash = addHash(hash, &triangles[0], triangles.size() * sizeof(IceMaths::IndexedTriangle));
+    return hash;
+}
+
+string getTreeCacheFilename(const string& directory, boost::uint64_t hash)
+{
+    char name[32];
+    sprintf(name, "%08x%08x.cdt", (unsigned int)(hash >> 32), (unsigned int)(hash & 0xffffffff));
+    return (boost::filesystem::path(directory) / name).string();
+}
+
+MemoryUsageCounter& coldetModelMemoryUsageCounter()
+{
+    static MemoryUsageCounter counter("AIST collision models");
+    return counter;
+}
+
+}
+
+
+void ColdetModel::setTreeCacheDirectory(const std::string& directory)
+{
+    boost::lock_guard<boost::mutex> lock(treeCacheMutex);
+    treeCacheDirectory_ = directory;
+}
+
+
+std::string ColdetModel::treeCacheDirectory()
+{
+    boost::lock_guard<boost::mutex> lock(treeCacheMutex);
+    return treeCacheDirectory_;
+}
+
+
+std::string ColdetModel::defaultTreeCacheDirectory()
+{
+    boost::filesystem::path directory;
+#ifdef _WIN32
+    const char* appdata = getenv("LOCALAPPDATA");
+    if(appdata){
+        directory = appdata;
+    }
+#else
+    const char* cache = getenv("XDG_CACHE_HOME");
+    if(cache && cache[0]){
+        directory = cache;
+    } else {
+        const char* home = getenv("HOME");
+        if(home){
+            directory = boost::filesystem::path(home) / ".cache";
+        }
+    }
+#endif
+    if(directory.empty()){
+        return string();
+    }
+    return (directory / "choreonoid" / "coldet").string();
 }
 
 
@@ -60,6 +175,7 @@ ColdetModel::ColdetModel(const ColdetModel& org)
 {
     internalModel = org.internalModel;
     initialize();
+    *pTransform = *org.pTransform;
 }
 
 
@@ -103,9 +219,29 @@ ColdetModelInternalModel::ColdetModelInternalModel()
     refCounter = 0;
     pType = ColdetModel::SP_MESH;
     AABBTreeMaxDepth=0;
+    countedMemoryUsage = 0;
 }    
 
 
+ColdetModelInternalModel::~ColdetModelInternalModel()
+{
+    coldetModelMemoryUsageCounter().subtract(countedMemoryUsage);
+}
+
+
+void ColdetModelInternalModel::updateMemoryUsage()
+{
+    MemoryUsageCounter& counter = coldetModelMemoryUsageCounter();
+    counter.subtract(countedMemoryUsage);
+    countedMemoryUsage =
+        vertices.capacity() * sizeof(IceMaths::Point) +
+        triangles.capacity() * sizeof(IceMaths::IndexedTriangle) +
+        neighbors.capacity() * sizeof(NeighborTriangleSet) +
+        model.GetUsedBytes();
+    counter.add(countedMemoryUsage);
+}
+
+
 ColdetModel::~ColdetModel()
 {
     if(--internalModel->refCounter <= 0){
@@ -187,6 +323,7 @@ void ColdetModel::addTriangle(int v1, int v2, int v3)
 void ColdetModel::build()
 {
     isValid_ = internalModel->build();
+    internalModel->updateMemoryUsage();
     /*
       unsigned int maxDepth = internalModel->getAABBTreeDepth();
       for(unsigned int i=0; i<maxDepth; i++){
@@ -259,14 +396,26 @@ bool ColdetModelInternalModel::build()
     
     if(triangles.size() > 0){
 
+        iMesh.SetPointers(&triangles[0], &vertices[0]);
+        iMesh.SetNbTriangles(triangles.size());
+        iMesh.SetNbVertices(vertices.size());
+
+        string cacheFile;
+        boost::uint64_t hash = 0;
+        const string cacheDirectory = ColdetModel::treeCacheDirectory();
+        if(!cacheDirectory.empty()){
+            hash = calcMeshHash(vertices, triangles);
+            cacheFile = getTreeCacheFilename(cacheDirectory, hash);
+            if(loadTreeCache(cacheFile, hash)){
+                calcTreeStatistics();
+                return true;
+            }
+        }
+
         extractNeghiborTriangles();
 
         Opcode::OPCODECREATE OPCC;
 
-        iMesh.SetPointers(&triangles[0], &vertices[0]);
-        iMesh.SetNbTriangles(triangles.size());
-        iMesh.SetNbVertices(vertices.size());
-        
         OPCC.mIMesh = &iMesh;
         
         OPCC.mNoLeaf = false;
@@ -274,11 +423,10 @@ bool ColdetModelInternalModel::build()
         OPCC.mKeepOriginal = false;
         
         model.Build(OPCC);
-        if(model.GetTree()){
-            AABBTreeMaxDepth = computeDepth(((Opcode::AABBCollisionTree*)model.GetTree())->GetNodes(), 0, -1) + 1;
-            for(int i=0; i<AABBTreeMaxDepth; i++)
-                for(int j=0; j<i; j++)
-                    numBBMap.at(i) += numLeafMap.at(j);
+        calcTreeStatistics();
+
+        if(!cacheFile.empty() && model.GetTree()){
+            saveTreeCache(cacheFile, hash);
         }
         result = true;
     }
@@ -287,6 +435,172 @@ bool ColdetModelInternalModel::build()
 }
 
 
+void ColdetModelInternalModel::calcTreeStatistics()
+{
+    numBBMap.clear();
+    numLeafMap.clear();
+    AABBTreeMaxDepth = 0;
+    
+    if(model.GetTree()){
+        AABBTreeMaxDepth = computeDepth(((Opcode::AABBCollisionTree*)model.GetTree())->GetNodes(), 0, -1) + 1;
+        for(int i=0; i<AABBTreeMaxDepth; i++)
+            for(int j=0; j<i; j++)
+                numBBMap.at(i) += numLeafMap.at(j);
+    }
+}
+
+
+/**
+   The file is mapped into the memory and the nodes are converted into the node array of the tree.
+   The file is not used if it does not match the current vertices and triangles.
+*/
+bool ColdetModelInternalModel::loadTreeCache(const std::string& filename, boost::uint64_t hash)
+{
+    namespace bi = boost::interprocess;
+
+    boost::system::error_code ec;
+    if(!boost::filesystem::exists(filename, ec)){
+        return false;
+    }
+
+    try {
+        bi::file_mapping file(filename.c_str(), bi::read_only);
+        bi::mapped_region region(file, bi::read_only);
+        const char* data = static_cast<const char*>(region.get_address());
+        const size_t size = region.get_size();
+
+        if(size < sizeof(TreeCacheHeader)){
+            return false;
+        }
+        TreeCacheHeader header;
+        memcpy(&header, data, sizeof(header));
+        const boost::uint32_t numTriangles = triangles.size();
+        if(memcmp(header.magic, treeCacheMagic, sizeof(treeCacheMagic)) != 0 ||
+           header.version != treeCacheVersion ||
+           header.hash != hash ||
+           header.numVertices != vertices.size() ||
+           header.numTriangles != numTriangles ||
+           header.numNodes != numTriangles * 2 - 1 ||
+           size != sizeof(TreeCacheHeader) +
+           numTriangles * sizeof(NeighborTriangleSet) + header.numNodes * sizeof(TreeCacheNode)){
+            return false;
+        }
+        const char* p = data + sizeof(TreeCacheHeader);
+
+        neighbors.resize(numTriangles);
+        memcpy(&neighbors[0], p, numTriangles * sizeof(NeighborTriangleSet));
+        p += numTriangles * sizeof(NeighborTriangleSet);
+
+        const boost::uint32_t numNodes = header.numNodes;
+        const TreeCacheNode* srcNodes = reinterpret_cast<const TreeCacheNode*>(p);
+        Opcode::AABBCollisionTree* tree = model.CreateCollisionTree(&iMesh);
+        if(!tree){
+            neighbors.clear();
+            return false;
+        }
+        Opcode::AABBCollisionNode* nodes = tree->AllocateNodes(numNodes);
+        for(boost::uint32_t i=0; i < numNodes; ++i){
+            const TreeCacheNode& src = srcNodes[i];
+            Opcode::AABBCollisionNode& node = nodes[i];
+            node.mAABB.mCenter.Set(src.center[0], src.center[1], src.center[2]);
+            node.mAABB.mExtents.Set(src.extents[0], src.extents[1], src.extents[2]);
+            const boost::uint32_t index = src.data >> 1;
+            bool isValid;
+            if(src.data & 1){
+                node.mData = src.data;
+                isValid = (index < numTriangles);
+            } else {
+                node.mData = (EXWORD)&nodes[index];
+                // The children always follow the parent, which prevents a broken file from making a loop
+                isValid = (index > i && index + 1 < numNodes);
+            }
+            if(!isValid || src.parent >= numNodes){
+                model.CreateCollisionTree(&iMesh);
+                neighbors.clear();
+                return false;
+            }
+            node.mB = &nodes[src.parent];
+        }
+    }
+    catch(const bi::interprocess_exception& ex){
+        neighbors.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+   The file is written with a temporary name and renamed so that the other processes
+   reading the same cache never see an incomplete file.
+*/
+void ColdetModelInternalModel::saveTreeCache(const std::string& filename, boost::uint64_t hash)
+{
+    namespace filesystem = boost::filesystem;
+
+    const Opcode::AABBCollisionTree* tree = (const Opcode::AABBCollisionTree*)model.GetTree();
+    const Opcode::AABBCollisionNode* nodes = tree->GetNodes();
+    const boost::uint32_t numNodes = tree->GetNbNodes();
+    
+    boost::system::error_code ec;
+    const filesystem::path path(filename);
+    filesystem::create_directories(path.parent_path(), ec);
+    if(ec){
+        return;
+    }
+    const filesystem::path tmpPath = filesystem::unique_path(path.string() + ".%%%%%%%%", ec);
+    if(ec){
+        return;
+    }
+
+    {
+        ofstream out(tmpPath.string().c_str(), ios::out | ios::binary);
+        if(!out){
+            return;
+        }
+        TreeCacheHeader header;
+        memcpy(header.magic, treeCacheMagic, sizeof(treeCacheMagic));
+        header.version = treeCacheVersion;
+        header.numVertices = vertices.size();
+        header.numTriangles = triangles.size();
+        header.numNodes = numNodes;
+        header.hash = hash;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        
+        out.write(reinterpret_cast<const char*>(&neighbors[0]), neighbors.size() * sizeof(NeighborTriangleSet));
+
+        vector<TreeCacheNode> dest(numNodes);
+        for(boost::uint32_t i=0; i < numNodes; ++i){
+            const Opcode::AABBCollisionNode& node = nodes[i];
+            TreeCacheNode& node2 = dest[i];
+            const IceMaths::Point& c = node.mAABB.mCenter;
+            const IceMaths::Point& e = node.mAABB.mExtents;
+            node2.center[0] = c.x; node2.center[1] = c.y; node2.center[2] = c.z;
+            node2.extents[0] = e.x; node2.extents[1] = e.y; node2.extents[2] = e.z;
+            if(node.IsLeaf()){
+                node2.data = node.mData;
+            } else {
+                node2.data = (node.GetPos() - nodes) << 1;
+            }
+            node2.parent = node.GetB() - nodes;
+        }
+        out.write(reinterpret_cast<const char*>(&dest[0]), numNodes * sizeof(TreeCacheNode));
+
+        if(!out){
+            out.close();
+            filesystem::remove(tmpPath, ec);
+            return;
+        }
+    }
+
+    filesystem::rename(tmpPath, path, ec);
+    if(ec){
+        filesystem::remove(tmpPath, ec);
+    }
+}
+
+
 void ColdetModel::setPosition(const Position& T)
 {
     transform->Set((float)T(0,0), (float)T(1,0), (float)T(2,0), 0.0f,
@@ -379,6 +693,25 @@ double ColdetModel::computeDistanceWithRay(const double *point,
 }
 
 
+double ColdetModel::computeDistanceWithRay(const Vector3& point, const Vector3& dir, double maxDistance) const
+{
+    Opcode::RayCollider RC;
+    Ray world_ray(Point(point[0], point[1], point[2]),
+                  Point(dir[0], dir[1], dir[2]));
+    Opcode::CollisionFace CF;
+    Opcode::SetupClosestHit(RC, CF);
+    RC.SetCulling(false);
+    if(maxDistance < FLT_MAX){
+        RC.SetMaxDist((float)maxDistance);
+    }
+    RC.Collide(world_ray, internalModel->model, transform);
+    if(CF.mDistance == FLT_MAX){
+        return -1.0;
+    }
+    return CF.mDistance;
+}
+
+
 bool ColdetModel::checkCollisionWithPointCloud(const std::vector<Vector3> &i_cloud, double i_radius)
 {
     Opcode::SphereCollider SC;
@@ -126,6 +126,22 @@ public:
      */
     void build();
 
+    /**
+     * @brief set the directory to store the built trees
+     *
+     * The tree and the neighbor triangle table built by build() are written into a file in
+     * the directory, and they are read from the file when a model of the same vertices and
+     * triangles is built again. The cache is disabled when the directory is empty, which is
+     * the default.
+     */
+    static void setTreeCacheDirectory(const std::string& directory);
+    static std::string treeCacheDirectory();
+
+    /**
+     * @brief get the directory for the tree cache in the user's cache directory
+     */
+    static std::string defaultTreeCacheDirectory();
+
     /**
      * @brief check if build() is already called or not
      * @return true if build() is already called, false otherwise
@@ -198,6 +214,16 @@ public:
      */
     double computeDistanceWithRay(const double *point, const double *dir);
 
+    /**
+     * @brief compute distance between a point and the nearest triangle of this mesh along ray
+     * @param point a point
+     * @param dir unit direction vector of ray
+     * @param maxDistance length of ray
+     * @return distance if ray collides with this mesh within maxDistance, a negative value otherwise
+     * @note Both sides of the triangles are hit. This function can be called from multiple threads.
+     */
+    double computeDistanceWithRay(const Vector3& point, const Vector3& dir, double maxDistance) const;
+
     /**
      * @brief check collision between this triangle mesh and a point cloud
      * @param i_cloud points
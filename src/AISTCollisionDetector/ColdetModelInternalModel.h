@@ -7,7 +7,10 @@
 
 #include "ColdetModel.h"
 #include "Opcode/Opcode.h"
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 #include <vector>
+#include <string>
 
 namespace cnoid {
 
@@ -44,9 +47,13 @@ public:
     typedef std::vector<NeighborTriangleSet> NeighborTriangleSetArray;
 
     ColdetModelInternalModel();
+    ~ColdetModelInternalModel();
 
     bool build();
 
+    //! The size of the mesh and the tree is counted in the memory usage counter of the models
+    void updateMemoryUsage();
+
     // need two instances ?
     Opcode::Model model;
     Opcode::MeshInterface iMesh;
@@ -71,12 +78,17 @@ public:
     };
 
 private:
-    int refCounter;
+    // Atomic because the models sharing this object may be deleted in different threads
+    boost::atomic<int> refCounter;
+    size_t countedMemoryUsage;
     int AABBTreeMaxDepth;
     std::vector<int> numBBMap;
     std::vector<int> numLeafMap;
 
     void extractNeghiborTriangles();
+    void calcTreeStatistics();
+    bool loadTreeCache(const std::string& filename, boost::uint64_t hash);
+    void saveTreeCache(const std::string& filename, boost::uint64_t hash);
     int computeDepth(const Opcode::AABBCollisionNode* node, int currentDepth, int max );
 
     friend class ColdetModel;
@@ -9,6 +9,7 @@
 #include "Opcode/Opcode.h"
 #include "SSVTreeCollider.h"
 #include <iostream>
+#include <limits>
 
 using namespace std;
 using namespace cnoid;
@@ -31,18 +32,78 @@ struct figStruct {
     float area;
     float cx, cy;
 };
+
+/**
+   An edge axis of the box-box test is only used when its overlap is smaller than this ratio
+   of the smallest overlap of the face axes so that the resting boxes get the face contacts.
+*/
+const double BOX_EDGE_AXIS_RATIO = 0.95;
+
+// The cross product of the edge directions shorter than this is not used as an axis
+const double BOX_PARALLEL_EDGE_THRESH = 1.0e-6;
+
+void getPrimitivePosition(const IceMaths::Matrix4x4& T, Matrix3& out_R, Vector3& out_p)
+{
+    for(int i=0; i < 3; ++i){
+        for(int j=0; j < 3; ++j){
+            out_R(j, i) = T[i][j];
+        }
+        out_p[i] = T[3][i];
+    }
+}
+
+void addContact(std::vector<collision_data>& cdata, const Vector3& point, const Vector3& normal, double depth)
+{
+    cdata.push_back(collision_data());
+    collision_data& col = cdata.back();
+    col.id1 = 0;
+    col.id2 = 0;
+    col.depth = depth;
+    col.num_of_i_points = 1;
+    col.i_point_new[0] = 1;
+    col.i_point_new[1] = 0;
+    col.i_point_new[2] = 0;
+    col.i_point_new[3] = 0;
+    col.n_vector = normal;
+    col.i_points[0] = point;
+}
+
+/**
+   Clip a convex polygon by the half space normal * x <= offset.
+   @return the number of the vertices of the clipped polygon
+*/
+int clipPolygon(const Vector3* polygon, int n, const Vector3& normal, double offset, Vector3* out_polygon)
+{
+    int m = 0;
+    for(int i=0; i < n; ++i){
+        const Vector3& a = polygon[i];
+        const Vector3& b = polygon[(i + 1) % n];
+        const double da = normal.dot(a) - offset;
+        const double db = normal.dot(b) - offset;
+        if(da <= 0.0){
+            out_polygon[m++] = a;
+        }
+        if((da < 0.0 && db > 0.0) || (da > 0.0 && db < 0.0)){
+            out_polygon[m++] = a + (b - a) * (da / (da - db));
+        }
+    }
+    return m;
+}
+
 }
 
 
 ColdetModelPair::ColdetModelPair()
 {
     collisionPairInserter = new Opcode::StdCollisionPairInserter;
+    collisionFront = new Opcode::AABBCollisionFront;
 }
 
 
 ColdetModelPair::ColdetModelPair(const ColdetModelPtr& model0, const ColdetModelPtr& model1, double tolerance)
 {
     collisionPairInserter = new Opcode::StdCollisionPairInserter;
+    collisionFront = new Opcode::AABBCollisionFront;
     set(model0, model1);
     tolerance_ = tolerance;
 }
@@ -51,6 +112,7 @@ ColdetModelPair::ColdetModelPair(const ColdetModelPtr& model0, const ColdetModel
 ColdetModelPair::ColdetModelPair(const ColdetModelPair& org)
 {
     collisionPairInserter = new Opcode::StdCollisionPairInserter;
+    collisionFront = org.collisionFront ? new Opcode::AABBCollisionFront : 0;
     set(org.models[0], org.models[1]);
     tolerance_ = org.tolerance_;
 }
@@ -59,6 +121,7 @@ ColdetModelPair::ColdetModelPair(const ColdetModelPair& org)
 ColdetModelPair::~ColdetModelPair()
 {
     delete collisionPairInserter;
+    delete collisionFront;
 }
 
 
@@ -71,6 +134,22 @@ void ColdetModelPair::set(const ColdetModelPtr& model0, const ColdetModelPtr& mo
     if(model0 && model1){
         collisionPairInserter->set(model1->internalModel, model0->internalModel);
     }
+    if(collisionFront){
+        collisionFront->Reset();
+    }
+}
+
+
+void ColdetModelPair::enableTemporalCoherence(bool on)
+{
+    if(on){
+        if(!collisionFront){
+            collisionFront = new Opcode::AABBCollisionFront;
+        }
+    } else {
+        delete collisionFront;
+        collisionFront = 0;
+    }
 }
 
 
@@ -93,6 +172,13 @@ std::vector<collision_data>& ColdetModelPair::detectCollisionsSub(bool detectAll
     else if (pt0 == ColdetModel::SP_SPHERE && pt1 == ColdetModel::SP_SPHERE) {
         detected = detectSphereSphereCollisions(detectAllContacts);
     }
+    else if (pt0 == ColdetModel::SP_BOX && pt1 == ColdetModel::SP_BOX) {
+        detected = detectBoxBoxCollisions(detectAllContacts);
+    }
+    else if ((pt0 == ColdetModel::SP_BOX && pt1 == ColdetModel::SP_SPHERE)
+             || (pt0 == ColdetModel::SP_SPHERE && pt1 == ColdetModel::SP_BOX)) {
+        detected = detectBoxSphereCollisions(detectAllContacts);
+    }
 	
     else if (pt0 == ColdetModel::SP_SPHERE || pt1 == ColdetModel::SP_SPHERE) {
         detected = detectSphereMeshCollisions(detectAllContacts);
@@ -186,7 +272,12 @@ bool ColdetModelPair::detectMeshMeshCollisions(bool detectAllContacts)
             collider.SetFirstContact(true);
         }
         
-        bool isOk = collider.Collide(colCache, models[1]->transform, models[0]->transform);
+        bool isOk;
+        if(collisionFront){
+            isOk = collider.Collide(colCache, models[1]->transform, models[0]->transform, *collisionFront);
+        } else {
+            isOk = collider.Collide(colCache, models[1]->transform, models[0]->transform);
+        }
 		
         if (!isOk)
             std::cerr << "AABBTreeCollider::Collide() failed" << std::endl;
@@ -467,6 +558,224 @@ bool ColdetModelPair::detectSphereMeshCollisions(bool detectAllContacts) {
     return result;
 }
 
+/**
+   The boxes are tested with the separating axes of the face normals and the cross products of
+   the edge directions. When the axis of the smallest overlap is a face normal, the face of the
+   other box that is the most anti-parallel to it is clipped by the side faces of the reference
+   face, and the clipped vertices under the reference face are the contact points. Otherwise
+   the closest points of the two edges are used. The normals point from models[0] to models[1]
+   as the other routines.
+*/
+bool ColdetModelPair::detectBoxBoxCollisions(bool detectAllContacts)
+{
+    Matrix3 R[2];
+    Vector3 p[2];
+    Vector3 h[2];
+    for(int i=0; i < 2; ++i){
+        getPrimitivePosition((*(models[i]->pTransform)) * (*(models[i]->transform)), R[i], p[i]);
+        for(int j=0; j < 3; ++j){
+            float size;
+            models[i]->getPrimitiveParam(j, size);
+            h[i][j] = size / 2.0;
+        }
+    }
+    const Vector3 d = p[1] - p[0];
+
+    // The face axes
+    double faceOverlap = std::numeric_limits<double>::max();
+    int faceBox = 0;
+    int faceAxis = 0;
+    for(int i=0; i < 2; ++i){
+        for(int j=0; j < 3; ++j){
+            const Vector3 axis = R[i].col(j);
+            const double overlap =
+                h[0].dot((R[0].transpose() * axis).cwiseAbs()) +
+                h[1].dot((R[1].transpose() * axis).cwiseAbs()) - fabs(d.dot(axis));
+            if(overlap < 0.0){
+                return false;
+            }
+            if(overlap < faceOverlap){
+                faceOverlap = overlap;
+                faceBox = i;
+                faceAxis = j;
+            }
+        }
+    }
+
+    // The edge axes
+    double edgeOverlap = std::numeric_limits<double>::max();
+    int edge0 = 0;
+    int edge1 = 0;
+    Vector3 edgeAxis;
+    for(int i=0; i < 3; ++i){
+        for(int j=0; j < 3; ++j){
+            Vector3 axis = R[0].col(i).cross(R[1].col(j));
+            const double len = axis.norm();
+            if(len < BOX_PARALLEL_EDGE_THRESH){
+                continue;
+            }
+            axis /= len;
+            const double overlap =
+                h[0].dot((R[0].transpose() * axis).cwiseAbs()) +
+                h[1].dot((R[1].transpose() * axis).cwiseAbs()) - fabs(d.dot(axis));
+            if(overlap < 0.0){
+                return false;
+            }
+            if(overlap < edgeOverlap){
+                edgeOverlap = overlap;
+                edge0 = i;
+                edge1 = j;
+                edgeAxis = axis;
+            }
+        }
+    }
+
+    std::vector<collision_data>& cdata = collisionPairInserter->collisions();
+    cdata.clear();
+
+    if(edgeOverlap < BOX_EDGE_AXIS_RATIO * faceOverlap){
+        const Vector3 n = (d.dot(edgeAxis) >= 0.0) ? edgeAxis : Vector3(-edgeAxis);
+        // The edge of box 0 which is the farthest in n and that of box 1 which is the farthest in -n
+        Vector3 pa = p[0];
+        Vector3 pb = p[1];
+        for(int k=0; k < 3; ++k){
+            if(k != edge0){
+                const Vector3 a = R[0].col(k);
+                pa += (a.dot(n) >= 0.0 ? h[0][k] : -h[0][k]) * a;
+            }
+            if(k != edge1){
+                const Vector3 b = R[1].col(k);
+                pb -= (b.dot(n) >= 0.0 ? h[1][k] : -h[1][k]) * b;
+            }
+        }
+        const Vector3 ua = R[0].col(edge0);
+        const Vector3 ub = R[1].col(edge1);
+        const Vector3 r = pa - pb;
+        const double c = ua.dot(ub);
+        const double s = std::max(-h[0][edge0], std::min(
+                                      h[0][edge0], (c * ub.dot(r) - ua.dot(r)) / (1.0 - c * c)));
+        const double t = std::max(-h[1][edge1], std::min(h[1][edge1], ub.dot(r) + s * c));
+        addContact(cdata, ((pa + s * ua) + (pb + t * ub)) / 2.0, n, edgeOverlap);
+        return true;
+    }
+
+    const int ref = faceBox;
+    const int inc = 1 - ref;
+    const Vector3 axis = R[ref].col(faceAxis);
+    // The normal from the reference box to the incident box
+    const Vector3 n = ((p[inc] - p[ref]).dot(axis) >= 0.0) ? axis : Vector3(-axis);
+
+    int k = 0;
+    double maxCos = -1.0;
+    for(int i=0; i < 3; ++i){
+        const double c = fabs(R[inc].col(i).dot(n));
+        if(c > maxCos){
+            maxCos = c;
+            k = i;
+        }
+    }
+    Vector3 ni = R[inc].col(k);
+    if(ni.dot(n) > 0.0){
+        ni = -ni;
+    }
+    const Vector3 ci = p[inc] + h[inc][k] * ni;
+    const Vector3 u = h[inc][(k + 1) % 3] * R[inc].col((k + 1) % 3);
+    const Vector3 v = h[inc][(k + 2) % 3] * R[inc].col((k + 2) % 3);
+
+    // A quadrangle clipped by four planes has eight vertices at most
+    Vector3 polygon[2][8];
+    polygon[0][0] = ci + u + v;
+    polygon[0][1] = ci - u + v;
+    polygon[0][2] = ci - u - v;
+    polygon[0][3] = ci + u - v;
+    int numVertices = 4;
+    int current = 0;
+
+    const Vector3 cr = p[ref] + h[ref][faceAxis] * n;
+    for(int i=1; i < 3 && numVertices > 0; ++i){
+        const int side = (faceAxis + i) % 3;
+        const Vector3 e = R[ref].col(side);
+        const double offset = e.dot(cr);
+        numVertices = clipPolygon(polygon[current], numVertices, e, offset + h[ref][side], polygon[1 - current]);
+        current = 1 - current;
+        numVertices = clipPolygon(polygon[current], numVertices, -e, -offset + h[ref][side], polygon[1 - current]);
+        current = 1 - current;
+    }
+
+    const Vector3 normal = (ref == 0) ? n : Vector3(-n);
+    for(int i=0; i < numVertices; ++i){
+        const Vector3& x = polygon[current][i];
+        const double depth = n.dot(cr - x);
+        if(depth >= 0.0){
+            addContact(cdata, x + (depth / 2.0) * n, normal, depth);
+        }
+    }
+
+    return !cdata.empty();
+}
+
+
+bool ColdetModelPair::detectBoxSphereCollisions(bool detectAllContacts)
+{
+    const int boxIndex = (models[0]->getPrimitiveType() == ColdetModel::SP_BOX) ? 0 : 1;
+    const ColdetModelPtr& box = models[boxIndex];
+    const ColdetModelPtr& sphere = models[1 - boxIndex];
+
+    Matrix3 R;
+    Vector3 p;
+    getPrimitivePosition((*(box->pTransform)) * (*(box->transform)), R, p);
+    Vector3 h;
+    for(int i=0; i < 3; ++i){
+        float size;
+        box->getPrimitiveParam(i, size);
+        h[i] = size / 2.0;
+    }
+    Matrix3 Rs;
+    Vector3 c;
+    getPrimitivePosition((*(sphere->pTransform)) * (*(sphere->transform)), Rs, c);
+    float radius;
+    sphere->getPrimitiveParam(0, radius);
+
+    // The sphere center and the closest point of the box in the box coordinate
+    const Vector3 cl = R.transpose() * (c - p);
+    const Vector3 q = cl.cwiseMax(-h).cwiseMin(h);
+
+    Vector3 n; // outward normal of the box
+    Vector3 point;
+    double depth;
+    if(q != cl){
+        const Vector3 diff = cl - q;
+        const double distance = diff.norm();
+        if(distance > radius){
+            return false;
+        }
+        n = R * (diff / distance);
+        depth = radius - distance;
+        point = p + R * q - (depth / 2.0) * n;
+    } else {
+        // The center is inside the box
+        int k = 0;
+        double minDistance = std::numeric_limits<double>::max();
+        for(int i=0; i < 3; ++i){
+            const double distance = h[i] - fabs(cl[i]);
+            if(distance < minDistance){
+                minDistance = distance;
+                k = i;
+            }
+        }
+        n = (cl[k] >= 0.0) ? Vector3(R.col(k)) : Vector3(-R.col(k));
+        depth = radius + minDistance;
+        point = c + ((minDistance - radius) / 2.0) * n;
+    }
+
+    std::vector<collision_data>& cdata = collisionPairInserter->collisions();
+    cdata.clear();
+    addContact(cdata, point, (boxIndex == 0) ? n : Vector3(-n), depth);
+
+    return true;
+}
+
+
 bool ColdetModelPair::detectPlaneCylinderCollisions(bool detectAllContacts) {
 
     ColdetModelPtr plane, cylinder;
@@ -635,6 +944,38 @@ double ColdetModelPair::computeDistance(int& triangle0, double* point0, int& tri
 }
 
 
+double ColdetModelPair::computeDistance(double maxDistance, double* point0, double* point1)
+{
+    if(models[0]->isValid() && models[1]->isValid()){
+
+        Opcode::BVTCache colCache;
+
+        colCache.Model0 = &models[1]->internalModel->model;
+        colCache.Model1 = &models[0]->internalModel->model;
+        
+        Opcode::SSVTreeCollider collider;
+        
+        const float maxD = (maxDistance < FLT_MAX) ? (float)maxDistance : FLT_MAX;
+        float d;
+        Point p0, p1;
+        collider.Distance(colCache, d, p0, p1,
+                          models[1]->transform, models[0]->transform, maxD);
+        if(d >= maxD){
+            return maxDistance;
+        }
+        point0[0] = p1.x;
+        point0[1] = p1.y;
+        point0[2] = p1.z;
+        point1[0] = p0.x;
+        point1[1] = p0.y;
+        point1[2] = p0.z;
+        return d;
+    }
+
+    return -1;
+}
+
+
 bool ColdetModelPair::detectIntersection()
 {
     if(models[0]->isValid() && models[1]->isValid()){
@@ -10,6 +10,10 @@
 #include "CollisionPairInserter.h"
 #include "exportdecl.h"
 
+namespace Opcode {
+struct AABBCollisionFront;
+}
+
 namespace cnoid {
 
 class CNOID_EXPORT ColdetModelPair
@@ -49,6 +53,12 @@ public:
     */
     double computeDistance(int& out_triangle0, double* out_point0, int& out_triangle1, double* out_point1);
 
+    /**
+       The same as the above function except that the triangles farther than maxDistance are not checked.
+       @return maxDistance if no triangle pair is nearer than it. The closest points are not set in the case.
+    */
+    double computeDistance(double maxDistance, double* out_point0, double* out_point1);
+
     bool detectIntersection();
 
     double tolerance() const { return tolerance_; }
@@ -59,6 +69,15 @@ public:
 
     void setCollisionPairInserter(Opcode::CollisionPairInserter *inserter); 
 
+    /**
+       When this is enabled, which is the default, the descent of the bounding box trees
+       starts from the node pairs where the previous descent stopped instead of the roots.
+       This reduces the box tests for the models which keep touching each other, and
+       the detected collisions are the same as the ones without this mode.
+    */
+    void enableTemporalCoherence(bool on);
+    bool isTemporalCoherenceEnabled() const { return collisionFront != 0; }
+
     int calculateCentroidIntersection(float &cx, float &cy, float &A, float radius, std::vector<float> vx, std::vector<float> vy);
 		
     int makeCCW(std::vector<float> &vx, std::vector<float> &vy);
@@ -79,12 +98,15 @@ private:
     bool detectMeshMeshCollisions(bool detectAllContacts);
     bool detectSphereSphereCollisions(bool detectAllContacts);
     bool detectSphereMeshCollisions(bool detectAllContacts);
+    bool detectBoxBoxCollisions(bool detectAllContacts);
+    bool detectBoxSphereCollisions(bool detectAllContacts);
     bool detectPlaneCylinderCollisions(bool detectAllContacts);
     bool detectPlaneMeshCollisions(bool detectAllContacts);
 
     ColdetModelPtr models[2];
     double tolerance_;
     Opcode::CollisionPairInserter* collisionPairInserter;
+    Opcode::AABBCollisionFront* collisionFront;
     int boxTestsCount;
     int triTestsCount;
 };
@@ -210,6 +210,15 @@ bool Model::Build(const OPCODECREATE& create)
 	return true;
 }
 
+// Modified for Choreonoid
+AABBCollisionTree* Model::CreateCollisionTree(const MeshInterface* imesh)
+{
+	Release();
+	SetMeshInterface(imesh);
+	if(!CreateTree(false, false))	return null;
+	return static_cast<AABBCollisionTree*>(mTree);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /**
  *	Gets the number of bytes used by the tree.
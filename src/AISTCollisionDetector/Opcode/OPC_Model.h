@@ -36,6 +36,10 @@
 		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		override(BaseModel)	bool				Build(const OPCODECREATE& create);
 
+		// Modified for Choreonoid
+		// Creates an empty collision tree whose nodes are restored by the user instead of Build()
+							AABBCollisionTree*	CreateCollisionTree(const MeshInterface* imesh);
+
 #ifdef __MESHMERIZER_H__
 		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		/**
@@ -266,6 +266,19 @@ bool AABBCollisionTree::Build(AABBTree* tree)
 	return true;
 }
 
+// Modified for Choreonoid
+// The tree nodes restored from a cache file are set into the returned array.
+AABBCollisionNode* AABBCollisionTree::AllocateNodes(udword nb_nodes)
+{
+	if(mNbNodes!=nb_nodes)
+	{
+		mNbNodes = nb_nodes;
+		DELETEARRAY(mNodes);
+		mNodes = new AABBCollisionNode[mNbNodes];
+	}
+	return mNodes;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /**
  *	Refits the collision tree after vertices have been modified.
@@ -188,6 +188,11 @@
 	class OPCODE_API AABBCollisionTree : public AABBOptimizedTree
 	{
 		IMPLEMENT_COLLISION_TREE(AABBCollisionTree, AABBCollisionNode)
+
+		// Modified for Choreonoid
+		// Allocates the nodes which are restored by the user instead of Build()
+		public:
+						AABBCollisionNode*	AllocateNodes(udword nb_nodes);
 	};
 
 	class OPCODE_API AABBNoLeafTree : public AABBOptimizedTree
@@ -41,6 +41,11 @@ using namespace Opcode;
 //#include "OPC_TriBoxOverlap.h"
 #include "OPC_TriTriOverlap.h"
 
+namespace Opcode {
+// Defined in TriOverlap.cpp (modified for Choreonoid)
+unsigned int find_separated_tri_pairs(const float coords[18][4]);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /**
  *	Constructor.
@@ -54,7 +59,9 @@ AABBTreeCollider::AABBTreeCollider() :
 	mNbBVPrimTests		(0),
 	mFullBoxBoxTest		(true),
 	mFullPrimBoxTest	(true),
-        collisionPairInserter(0)
+        collisionPairInserter(0),
+	mBatchSize			(0),
+	mBatchEnabled		(false)
 {
 }
 
@@ -355,7 +362,11 @@ bool AABBTreeCollider::Collide(const AABBCollisionTree* tree0, const AABBCollisi
 	if(CheckTemporalCoherence(cache))		return true;
 
 	// Perform collision query
+	// Modified for Choreonoid: the leaf pairs are tested in batches except for the first contact mode
+	mBatchEnabled = !FirstContactEnabled();
 	_Collide(tree0->GetNodes(), tree1->GetNodes());
+	FlushPrimTests();
+	mBatchEnabled = false;
 
 	UPDATE_CACHE
 
@@ -527,9 +538,7 @@ void AABBTreeCollider::_Collide(const AABBCollisionNode* b0, const AABBCollision
 	{
 		if(b1->IsLeaf())
 		{
-		  mNowNode0 = b0;
-		  mNowNode1 = b1;
-			PrimTest(b0->GetPrimitive(), b1->GetPrimitive());
+			BatchPrimTest(b0, b1);
 		}
 		else
 		{
@@ -557,6 +566,170 @@ void AABBTreeCollider::_Collide(const AABBCollisionNode* b0, const AABBCollision
 }
 #endif
 
+// Modified for Choreonoid
+// The front of the descent is a set of the node pairs such that the descent from the roots reaches
+// exactly one of them on every path to a pair of leaves. The query from the front tests the same
+// primitive pairs in the same order as the query from the roots because a child box is contained in
+// its parent box and the front is kept in the order of the descent.
+bool AABBTreeCollider::Collide(BVTCache& cache, const Matrix4x4* world0, const Matrix4x4* world1, AABBCollisionFront& front)
+{
+	// Checkings
+	if(!cache.Model0 || !cache.Model1)								return false;
+	if(!cache.Model0->HasLeafNodes() || !cache.Model1->HasLeafNodes() ||
+	   cache.Model0->IsQuantized() || cache.Model1->IsQuantized() || FirstContactEnabled())
+	{
+		front.Reset();
+		return Collide(cache, world0, world1);
+	}
+	if(!Setup(cache.Model0->GetMeshInterface(), cache.Model1->GetMeshInterface()))	return false;
+
+	const AABBCollisionTree* T0 = (const AABBCollisionTree*)cache.Model0->GetTree();
+	const AABBCollisionTree* T1 = (const AABBCollisionTree*)cache.Model1->GetTree();
+
+	// Init collision query
+	InitQuery(world0, world1);
+
+	if(front.Tree0!=T0 || front.Tree1!=T1 || front.Entries.empty())
+	{
+		front.Entries.clear();
+		AABBCollisionFrontEntry root;
+		root.Node0		= T0->GetNodes();
+		root.Node1		= T1->GetNodes();
+		root.Depth0		= 0;
+		root.Depth1		= 0;
+		root.Separated	= false;
+		front.Entries.push_back(root);
+		front.Tree0 = T0;
+		front.Tree1 = T1;
+	}
+
+	// Perform collision query
+	std::vector<AABBCollisionFrontEntry>& NewEntries = front.NewEntries;
+	NewEntries.clear();
+	const size_t NbEntries = front.Entries.size();
+	mBatchEnabled = true;
+	for(size_t i=0;i<NbEntries;i++)
+	{
+		const AABBCollisionFrontEntry& Entry = front.Entries[i];
+		_Collide(Entry.Node0, Entry.Node1, Entry.Depth0, Entry.Depth1, NewEntries);
+	}
+	FlushPrimTests();
+	mBatchEnabled = false;
+	front.Entries.swap(NewEntries);
+
+	return true;
+}
+
+// Modified for Choreonoid
+// The same descent rules as _Collide(b0, b1) except that the pairs where the descent stops are put into the front.
+void AABBTreeCollider::_Collide(const AABBCollisionNode* b0, const AABBCollisionNode* b1, udword depth0, udword depth1, std::vector<AABBCollisionFrontEntry>& front)
+{
+	// Perform BV-BV overlap test
+	if(!BoxBoxOverlap(b0->mAABB.mExtents, b0->mAABB.mCenter, b1->mAABB.mExtents, b1->mAABB.mCenter))
+	{
+		_AddSeparatedFrontEntry(b0, b1, depth0, depth1, front);
+		return;
+	}
+
+	if(b0->IsLeaf())
+	{
+		if(b1->IsLeaf())
+		{
+			BatchPrimTest(b0, b1);
+
+			AABBCollisionFrontEntry Entry;
+			Entry.Node0		= b0;
+			Entry.Node1		= b1;
+			Entry.Depth0	= depth0;
+			Entry.Depth1	= depth1;
+			Entry.Separated	= false;
+			front.push_back(Entry);
+		}
+		else
+		{
+			_Collide(b0, b1->GetNeg(), depth0, depth1+1, front);
+			_Collide(b0, b1->GetPos(), depth0, depth1+1, front);
+		}
+	}
+	else if(b1->IsLeaf())
+	{
+		_Collide(b0->GetNeg(), b1, depth0+1, depth1, front);
+		_Collide(b0->GetPos(), b1, depth0+1, depth1, front);
+	}
+	else
+	{
+		_Collide(b0->GetNeg(), b1->GetNeg(), depth0+1, depth1+1, front);
+		_Collide(b0->GetNeg(), b1->GetPos(), depth0+1, depth1+1, front);
+		_Collide(b0->GetPos(), b1->GetNeg(), depth0+1, depth1+1, front);
+		_Collide(b0->GetPos(), b1->GetPos(), depth0+1, depth1+1, front);
+	}
+}
+
+namespace
+{
+	// Modified for Choreonoid
+	// Both nodes are split until one of them is a leaf, and then only the other one is split.
+	// Therefore the parent pair in the descent is determined by the depths.
+	inline_ void GetParentFrontEntry(const AABBCollisionFrontEntry& entry, AABBCollisionFrontEntry& parent)
+	{
+		parent.Node0	= entry.Node0;
+		parent.Node1	= entry.Node1;
+		parent.Depth0	= entry.Depth0;
+		parent.Depth1	= entry.Depth1;
+		if(entry.Depth0 >= entry.Depth1)
+		{
+			parent.Node0	= entry.Node0->GetB();
+			parent.Depth0	= entry.Depth0 - 1;
+		}
+		if(entry.Depth1 >= entry.Depth0)
+		{
+			parent.Node1	= entry.Node1->GetB();
+			parent.Depth1	= entry.Depth1 - 1;
+		}
+		parent.Separated = true;
+	}
+}
+
+// Modified for Choreonoid
+// When all the children of a pair and the pair itself are separated, the entries of the children
+// are replaced with the entry of the pair so that the front moves up as the objects move apart.
+void AABBTreeCollider::_AddSeparatedFrontEntry(const AABBCollisionNode* b0, const AABBCollisionNode* b1, udword depth0, udword depth1, std::vector<AABBCollisionFrontEntry>& front)
+{
+	AABBCollisionFrontEntry Entry;
+	Entry.Node0		= b0;
+	Entry.Node1		= b1;
+	Entry.Depth0	= depth0;
+	Entry.Depth1	= depth1;
+	Entry.Separated	= true;
+	front.push_back(Entry);
+
+	while(true)
+	{
+		const AABBCollisionFrontEntry& Last = front.back();
+		if(Last.Depth0==0 && Last.Depth1==0)	return;
+
+		AABBCollisionFrontEntry Parent;
+		GetParentFrontEntry(Last, Parent);
+		const size_t NbChildren = (!Parent.Node0->IsLeaf() && !Parent.Node1->IsLeaf()) ? 4 : 2;
+		const size_t Size = front.size();
+		if(Size < NbChildren)	return;
+
+		for(size_t i=2;i<=NbChildren;i++)
+		{
+			const AABBCollisionFrontEntry& Sibling = front[Size-i];
+			if(!Sibling.Separated)	return;
+			AABBCollisionFrontEntry SiblingParent;
+			GetParentFrontEntry(Sibling, SiblingParent);
+			if(SiblingParent.Node0!=Parent.Node0 || SiblingParent.Node1!=Parent.Node1)	return;
+		}
+
+		if(BoxBoxOverlap(Parent.Node0->mAABB.mExtents, Parent.Node0->mAABB.mCenter, Parent.Node1->mAABB.mExtents, Parent.Node1->mAABB.mCenter))	return;
+
+		front.resize(Size - NbChildren);
+		front.push_back(Parent);
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // No-leaf trees
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -597,6 +770,85 @@ void AABBTreeCollider::PrimTest(udword id0, udword id1)
 	}
 }
 
+// Modified for Choreonoid
+// The leaf pair is put into the batch, which is tested when four pairs are collected.
+// The pairs which are not rejected by the batched separability test are tested by TriTriOverlap()
+// in the same order as PrimTest() is called, so the results are not changed by the batch.
+inline_ void AABBTreeCollider::BatchPrimTest(const AABBCollisionNode* b0, const AABBCollisionNode* b1)
+{
+	if(!mBatchEnabled)
+	{
+		mNowNode0 = b0;
+		mNowNode1 = b1;
+		PrimTest(b0->GetPrimitive(), b1->GetPrimitive());
+		return;
+	}
+
+	const udword Index = mBatchSize++;
+	mBatchNodes0[Index] = b0;
+	mBatchNodes1[Index] = b1;
+
+	// Request vertices from the app
+	VertexPointers VP0;
+	VertexPointers VP1;
+	mIMesh0->GetTriangle(VP0, b0->GetPrimitive());
+	mIMesh1->GetTriangle(VP1, b1->GetPrimitive());
+
+	// Transform from space 0 to space 1 in the same way as PrimTest()
+	Point* Verts = mBatchVerts[Index];
+	TransformPoint(Verts[0], *VP0.Vertex[0], mR0to1, mT0to1);
+	TransformPoint(Verts[1], *VP0.Vertex[1], mR0to1, mT0to1);
+	TransformPoint(Verts[2], *VP0.Vertex[2], mR0to1, mT0to1);
+	Verts[3] = *VP1.Vertex[0];
+	Verts[4] = *VP1.Vertex[1];
+	Verts[5] = *VP1.Vertex[2];
+
+	if(mBatchSize==4)	FlushPrimTests();
+}
+
+// Modified for Choreonoid
+void AABBTreeCollider::FlushPrimTests()
+{
+	if(!mBatchSize)	return;
+
+	// The unused lanes are filled with the first pair
+	float Coords[18][4];
+	for(udword Lane=0;Lane<4;Lane++)
+	{
+		const Point* Verts = mBatchVerts[(Lane < mBatchSize) ? Lane : 0];
+		for(udword i=0;i<6;i++)
+		{
+			Coords[i*3  ][Lane] = Verts[i].x;
+			Coords[i*3+1][Lane] = Verts[i].y;
+			Coords[i*3+2][Lane] = Verts[i].z;
+		}
+	}
+	const udword Separated = find_separated_tri_pairs(Coords);
+
+	for(udword i=0;i<mBatchSize;i++)
+	{
+		if(Separated & (1<<i))
+		{
+			// Counted as TriTriOverlap() does
+			mNbPrimPrimTests++;
+			continue;
+		}
+		mNowNode0 = mBatchNodes0[i];
+		mNowNode1 = mBatchNodes1[i];
+		mId0 = mNowNode0->GetPrimitive();
+		mId1 = mNowNode1->GetPrimitive();
+		const Point* Verts = mBatchVerts[i];
+		if(TriTriOverlap(Verts[0], Verts[1], Verts[2], Verts[3], Verts[4], Verts[5]))
+		{
+			// Keep track of colliding pairs
+			mPairs.Add(mId0).Add(mId1);
+			// Set contact status
+			mFlags |= OPC_CONTACT;
+		}
+	}
+	mBatchSize = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /**
  *	Leaf-leaf test for a previously fetched triangle from tree A (in B's space) and a new leaf from B.
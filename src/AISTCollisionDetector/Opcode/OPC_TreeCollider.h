@@ -66,6 +66,33 @@
 #endif // __MESHMERIZER_H__
 	};
 
+	// Modified for Choreonoid
+	//! A node pair where the last tree-vs-tree descent stopped.
+	//! The depths are used to find the parent pair in the descent.
+	struct OPCODE_API AABBCollisionFrontEntry
+	{
+		const AABBCollisionNode*	Node0;
+		const AABBCollisionNode*	Node1;
+		udword						Depth0;
+		udword						Depth1;
+		bool						Separated;
+	};
+
+	// Modified for Choreonoid
+	//! The front of the descent kept between the queries for temporal coherence.
+	//! The entries are sorted in the order of the depth-first descent from the roots.
+	struct OPCODE_API AABBCollisionFront
+	{
+		inline_				AABBCollisionFront() : Tree0(null), Tree1(null)	{}
+
+		inline_		void	Reset()		{ Entries.clear(); Tree0 = null; Tree1 = null;	}
+
+		std::vector<AABBCollisionFrontEntry>	Entries;
+		std::vector<AABBCollisionFrontEntry>	NewEntries;
+		const AABBCollisionTree*				Tree0;
+		const AABBCollisionTree*				Tree1;
+	};
+
 	class OPCODE_API AABBTreeCollider : public Collider
 	{
 		public:
@@ -96,6 +123,12 @@
 		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 							bool			Collide(BVTCache& cache, const Matrix4x4* world0=null, const Matrix4x4* world1=null);
 
+		// Modified for Choreonoid
+		// The query starts from the front of the previous query instead of the roots, and the front is updated.
+		// The primitive pairs are tested in the same order as Collide(), so the same contacts are detected.
+		// Collide() is used for the trees other than the normal AABB trees and for the first contact mode.
+							bool			Collide(BVTCache& cache, const Matrix4x4* world0, const Matrix4x4* world1, AABBCollisionFront& front);
+
 		// Collision queries
 							bool			Collide(const AABBCollisionTree* tree0, const AABBCollisionTree* tree1,				const Matrix4x4* world0=null, const Matrix4x4* world1=null, Pair* cache=null);
 							bool			Collide(const AABBNoLeafTree* tree0, const AABBNoLeafTree* tree1,					const Matrix4x4* world0=null, const Matrix4x4* world1=null, Pair* cache=null);
@@ -217,10 +250,20 @@
 							bool			mFullBoxBoxTest;	//!< Perform full BV-BV tests (true) or SAT-lite tests (false)
 							bool			mFullPrimBoxTest;	//!< Perform full Primitive-BV tests (true) or SAT-lite tests (false)
                                                         CollisionPairInserter* collisionPairInserter;
+		// Modified for Choreonoid
+		// The leaf pairs of the normal AABB trees which are tested together
+							const AABBCollisionNode*	mBatchNodes0[4];
+							const AABBCollisionNode*	mBatchNodes1[4];
+							Point			mBatchVerts[4][6];
+							udword			mBatchSize;
+							bool			mBatchEnabled;
 		// Internal methods
 
 			// Standard AABB trees
 							void			_Collide(const AABBCollisionNode* b0, const AABBCollisionNode* b1);
+			// Standard AABB trees with the front (modified for Choreonoid)
+							void			_Collide(const AABBCollisionNode* b0, const AABBCollisionNode* b1, udword depth0, udword depth1, std::vector<AABBCollisionFrontEntry>& front);
+							void			_AddSeparatedFrontEntry(const AABBCollisionNode* b0, const AABBCollisionNode* b1, udword depth0, udword depth1, std::vector<AABBCollisionFrontEntry>& front);
 			// Quantized AABB trees
 							void			_Collide(const AABBQuantizedNode* b0, const AABBQuantizedNode* b1, const Point& a, const Point& Pa, const Point& b, const Point& Pb);
 			// No-leaf AABB trees
@@ -233,6 +276,9 @@
 							void			_Collide(const AABBQuantizedNoLeafNode* a, const AABBQuantizedNoLeafNode* b);
 			// Overlap tests
 							void			PrimTest(udword id0, udword id1);
+			// Batched overlap tests (modified for Choreonoid)
+			inline_			void			BatchPrimTest(const AABBCollisionNode* b0, const AABBCollisionNode* b1);
+							void			FlushPrimTests();
 			inline_			void			PrimTestTriIndex(udword id1);
 			inline_			void			PrimTestIndexTri(udword id0);
 
@@ -74,6 +74,7 @@
 	#include "OPC_IceHook.h"
 //#include<iostream>
 #include <stdint.h>
+#include <vector>
 
 
 	namespace Opcode
@@ -28,10 +28,13 @@ public:
      * @param point1 the closest point on the second link
      * @param world0 transformation of the first link
      * @param world1 transformation of the second link
+     * @param maxD the upper bound of the distance. The nodes farther than this are not
+     * traversed, and minD is maxD without the closest points if no triangles are nearer.
      * @return true if computed successfully, false otherwise
      */
     bool Distance(BVTCache& cache, float& minD, Point &point0, Point&point1,
-                  const Matrix4x4* world0=null, const Matrix4x4* world1=null);
+                  const Matrix4x4* world0=null, const Matrix4x4* world1=null,
+                  float maxD=MAX_FLOAT);
 
     /**
      * @brief detect collision between links. 
@@ -67,7 +70,7 @@ private:
     void Distance(const AABBCollisionTree* tree0, 
                   const AABBCollisionTree* tree1, 
                   const Matrix4x4* world0, const Matrix4x4* world1, 
-                  Pair* cache, float& minD,  Point &point0, Point&point1);
+                  Pair* cache, float& minD,  Point &point0, Point&point1, float maxD);
 
     void _Distance(const AABBCollisionNode* b0, const AABBCollisionNode* b1,
                    float& minD, Point& point0, Point& point1);
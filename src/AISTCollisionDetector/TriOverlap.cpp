@@ -7,6 +7,11 @@
 #include <cstdio>
 #include <iostream>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CNOID_TRI_OVERLAP_USE_SSE
+#include <xmmintrin.h>
+#endif
+
 using namespace std;
 using namespace cnoid;
 
@@ -22,6 +27,112 @@ enum { NOT_INTERSECT = 0,
 
 /* used in cross_test */
 const int INTERSECT = 1;
+
+/*
+  The relative margin of the separability test of find_separated_tri_pairs().
+  The error of the test in single precision is about 1.0e-6 relative to the product of
+  the edge lengths and the distance, so a pair within the margin is left to tri_tri_overlap().
+*/
+const float SEPARATION_MARGIN = 1.0e-5f;
+
+#ifndef CNOID_TRI_OVERLAP_USE_SSE
+inline float l1norm(float x, float y, float z)
+{
+    return fabsf(x) + fabsf(y) + fabsf(z);
+}
+
+/*
+  @return true if the three vertices are surely on the same side of the plane which
+  contains vertex 1 of the other triangle and whose normal is the cross product of the edges.
+*/
+bool is_separated_by_face(const float (*c)[4], int lane, int t, int o)
+{
+    // t : the first row of the triangle making the plane, o : the first row of the other triangle
+    float e1[3], e2[3], d[3][3], n[3];
+    for(int i=0; i < 3; ++i){
+        e1[i] = c[t + 3 + i][lane] - c[t + i][lane];
+        e2[i] = c[t + 6 + i][lane] - c[t + 3 + i][lane];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    float maxDistance = 0.0f;
+    for(int j=0; j < 3; ++j){
+        for(int i=0; i < 3; ++i){
+            d[j][i] = c[o + j * 3 + i][lane] - c[t + i][lane];
+        }
+        const float distance = l1norm(d[j][0], d[j][1], d[j][2]);
+        if(distance > maxDistance){
+            maxDistance = distance;
+        }
+    }
+    const float margin =
+        SEPARATION_MARGIN * l1norm(e1[0], e1[1], e1[2]) * l1norm(e2[0], e2[1], e2[2]) * maxDistance;
+    int numPositives = 0;
+    int numNegatives = 0;
+    for(int j=0; j < 3; ++j){
+        const float s = n[0] * d[j][0] + n[1] * d[j][1] + n[2] * d[j][2];
+        if(s > margin){
+            ++numPositives;
+        } else if(s < -margin){
+            ++numNegatives;
+        }
+    }
+    return (numPositives == 3 || numNegatives == 3);
+}
+#else
+inline __m128 abs_ps(__m128 x)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+inline __m128 l1norm(__m128 x, __m128 y, __m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(abs_ps(x), abs_ps(y)), abs_ps(z));
+}
+
+// The SSE version of is_separated_by_face() which tests the four lanes at once
+__m128 is_separated_by_face(const float (*c)[4], int t, int o)
+{
+    const __m128 p1x = _mm_loadu_ps(c[t]);
+    const __m128 p1y = _mm_loadu_ps(c[t + 1]);
+    const __m128 p1z = _mm_loadu_ps(c[t + 2]);
+    const __m128 p2x = _mm_loadu_ps(c[t + 3]);
+    const __m128 p2y = _mm_loadu_ps(c[t + 4]);
+    const __m128 p2z = _mm_loadu_ps(c[t + 5]);
+    const __m128 e1x = _mm_sub_ps(p2x, p1x);
+    const __m128 e1y = _mm_sub_ps(p2y, p1y);
+    const __m128 e1z = _mm_sub_ps(p2z, p1z);
+    const __m128 e2x = _mm_sub_ps(_mm_loadu_ps(c[t + 6]), p2x);
+    const __m128 e2y = _mm_sub_ps(_mm_loadu_ps(c[t + 7]), p2y);
+    const __m128 e2z = _mm_sub_ps(_mm_loadu_ps(c[t + 8]), p2z);
+    const __m128 nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+    const __m128 ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+    const __m128 nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+
+    __m128 s[3];
+    __m128 maxDistance = _mm_setzero_ps();
+    for(int j=0; j < 3; ++j){
+        const __m128 dx = _mm_sub_ps(_mm_loadu_ps(c[o + j * 3]), p1x);
+        const __m128 dy = _mm_sub_ps(_mm_loadu_ps(c[o + j * 3 + 1]), p1y);
+        const __m128 dz = _mm_sub_ps(_mm_loadu_ps(c[o + j * 3 + 2]), p1z);
+        maxDistance = _mm_max_ps(maxDistance, l1norm(dx, dy, dz));
+        s[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz));
+    }
+    const __m128 margin =
+        _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(SEPARATION_MARGIN), l1norm(e1x, e1y, e1z)),
+                   _mm_mul_ps(l1norm(e2x, e2y, e2z), maxDistance));
+    const __m128 negativeMargin = _mm_sub_ps(_mm_setzero_ps(), margin);
+
+    const __m128 positive =
+        _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(s[0], margin), _mm_cmpgt_ps(s[1], margin)), _mm_cmpgt_ps(s[2], margin));
+    const __m128 negative =
+        _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(s[0], negativeMargin), _mm_cmplt_ps(s[1], negativeMargin)),
+                   _mm_cmplt_ps(s[2], negativeMargin));
+    return _mm_or_ps(positive, negative);
+}
+#endif
+
 }
 
 
@@ -1066,5 +1177,30 @@ int tri_tri_overlap(
 
     return 1;
 }
+
+
+/**
+   Separability test by the supporting planes of the triangles for four triangle pairs at once.
+   The test is conservative, i.e. a pair which is not judged as separated may or may not
+   intersect, and tri_tri_overlap() must be used for such a pair.
+   @param coords The coordinates of the six vertices (P1, P2, P3, Q1, Q2, Q3) of the pairs,
+   where coords[vertex * 3 + axis][pair] is an element.
+   @return The bit mask of the pairs which are surely separated
+*/
+unsigned int find_separated_tri_pairs(const float coords[18][4])
+{
+#ifdef CNOID_TRI_OVERLAP_USE_SSE
+    const __m128 separated = _mm_or_ps(is_separated_by_face(coords, 0, 9), is_separated_by_face(coords, 9, 0));
+    return _mm_movemask_ps(separated);
+#else
+    unsigned int mask = 0;
+    for(int i=0; i < 4; ++i){
+        if(is_separated_by_face(coords, i, 0, 9) || is_separated_by_face(coords, i, 9, 0)){
+            mask |= (1 << i);
+        }
+    }
+    return mask;
+#endif
 }
 
+}
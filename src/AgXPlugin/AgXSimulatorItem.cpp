@@ -43,6 +43,9 @@
 #include <cnoid/IdPair>
 #include <cnoid/EigenArchive>
 #include <cnoid/LinkGroup>
+#include <cnoid/TaskScheduler>
+#include <cnoid/ContactBuffer>
+#include <boost/thread.hpp>
 #include "gettext.h"
 
 using namespace std;
@@ -53,6 +56,44 @@ namespace {
 
 const double DEFAULT_GRAVITY_ACCELERATION = 9.80665;
 
+agx::AffineMatrix4x4 toAgXTransform(const Affine3& T)
+{
+    return agx::AffineMatrix4x4( T(0,0), T(1,0), T(2,0), 0.0,
+                                 T(0,1), T(1,1), T(2,1), 0.0,
+                                 T(0,2), T(1,2), T(2,2), 0.0,
+                                 T(0,3), T(1,3), T(2,3), 1.0 );
+}
+
+
+agxCollide::TrimeshRef createTrimesh(SgMesh* mesh, const Affine3& T)
+{
+    const SgVertexArray& vertices_ = *mesh->vertices();
+    const int numVertices = vertices_.size();
+    const int numTriangles = mesh->numTriangles();
+    if(numVertices == 0 || numTriangles == 0){
+        return 0;
+    }
+
+    agx::Vec3Vector vertices;
+    vertices.reserve(numVertices);
+    for(int i=0; i < numVertices; ++i){
+        const Vector3 v = T * vertices_[i].cast<Position::Scalar>();
+        vertices.push_back( agx::Vec3(v.x(), v.y(), v.z()) );
+    }
+
+    agx::UInt32Vector indices;
+    indices.reserve(numTriangles * 3);
+    for(int i=0; i < numTriangles; ++i){
+        SgMesh::TriangleRef src = mesh->triangle(i);
+        indices.push_back(src[0]);
+        indices.push_back(src[1]);
+        indices.push_back(src[2]);
+    }
+
+    return new agxCollide::Trimesh( &vertices, &indices, "" );
+}
+
+
 class AgXBody;
 
 struct SurfaceViscosityParam {
@@ -102,6 +143,13 @@ struct PlaneJointParam {
     double damping;
 };
 
+struct AgXLinkShape
+{
+    agxCollide::ShapeRef shape;
+    agx::AffineMatrix4x4 localTransform;
+};
+
+
 class AgXLink : public Referenced
 {
 public :
@@ -111,8 +159,6 @@ public :
     AgXLink* parent;
     agx::RigidBodyRef agxRigidBody;
     agx::Constraint* joint;
-    agx::Vec3Vector vertices;
-    agx::UInt32Vector indices;
     Vector3 origin;
     vector<AgXLink*> constraintLinks;
     int customConstraintIndex;
@@ -130,7 +176,6 @@ public :
     void createLinkBody(bool isStatic);
     void createJoint();
     void createGeometry(AgXBody* agxBody);
-    void addMesh(MeshExtractor* extractor, AgXBody* agxBody);
     void setKinematicStateToAgX();
     void getKinematicStateFromAgX();
     void setTorqueToAgX();
@@ -183,10 +228,14 @@ public :
     vector<Track> tracks;
     typedef map<string, int> GeometryGroupIds;
     GeometryGroupIds geometryGroupIds;
+    typedef map<Link*, vector<AgXLinkShape> > LinkShapeMap;
+    LinkShapeMap linkShapes;
 
     AgXBody(Body& orgBody, AgXSimulatorItemImpl* simImpl);
     ~AgXBody();
 
+    void createShapes();
+    void addMeshShape(MeshExtractor* extractor, vector<AgXLinkShape>& shapes);
     void createBody();
     void setKinematicStateToAgX();
     void getKinematicStateFromAgX();
@@ -624,12 +673,26 @@ public:
     typedef std::map<IdPair<agx::Material*>, ContactMaterialParam*> ContactMaterialMap;
     ContactMaterialMap contactMaterialMap;
 
+    struct TrimeshCacheEntry
+    {
+        vector<agxCollide::TrimeshRef> trimeshes;
+        size_t numUsedTrimeshes;
+        TrimeshCacheEntry() : numUsedTrimeshes(0) { }
+    };
+    typedef map<SgMeshPtr, TrimeshCacheEntry> TrimeshCache;
+    TrimeshCache trimeshCache;
+    boost::mutex trimeshCacheMutex;
+
+    vector<BasicSensorSimulationHelper*> gyroAndAccelerationSensorHelpers;
+
     AgXSimulatorItemImpl(AgXSimulatorItem* self);
     AgXSimulatorItemImpl(AgXSimulatorItem* self, const AgXSimulatorItemImpl& org);
     void initialize();
     ~AgXSimulatorItemImpl();
 
     bool initializeSimulation(const std::vector<SimulationBody*>& simBodies);
+    void createShapes(const std::vector<SimulationBody*>& simBodies, int index);
+    agxCollide::TrimeshRef getTrimesh(SgMesh* mesh);
     void addBody(AgXBody* agxBody, int i);
     void clear();
     bool stepSimulation(const std::vector<SimulationBody*>& activeSimBodies);
@@ -1048,33 +1111,51 @@ void AgXLink::createJoint()
 
 void AgXLink::createGeometry(AgXBody* agxBody)
 {
-    if(link->shape()){
-        MeshExtractor* extractor = new MeshExtractor;
-        if(extractor->extract(link->shape(), boost::bind(&AgXLink::addMesh, this, extractor, agxBody))){
-            if(!vertices.empty()){
-                agxCollide::TrimeshRef triangleMesh = new agxCollide::Trimesh( &vertices, &indices, "" );
-                if(link->jointType() == Link::PSEUDO_CONTINUOUS_TRACK || link->jointType() == Link::CRAWLER_JOINT){
-                    agx::ref_ptr<CrawlerGeometry> crawlerGeometry = new CrawlerGeometry( link, agxRigidBody.get() );
-                    crawlerGeometry->add( triangleMesh );
-                    crawlerGeometry->setSurfaceVelocity( agx::Vec3f(1,0,0) );   //適当に設定しておかないとcalculateSurfaceVelocityが呼び出されない。
-                    agxRigidBody->add( crawlerGeometry );
-                }else{
-                    agxRigidBody->add( new agxCollide::Geometry( triangleMesh ) );
-                }
-            }
+    AgXBody::LinkShapeMap::iterator p = agxBody->linkShapes.find(link);
+    if(p == agxBody->linkShapes.end()){
+        return;
+    }
+    const vector<AgXLinkShape>& shapes = p->second;
+    for(size_t i=0; i < shapes.size(); ++i){
+        const AgXLinkShape& shape = shapes[i];
+        agxCollide::GeometryRef agxGeometry;
+        if(link->jointType() == Link::PSEUDO_CONTINUOUS_TRACK || link->jointType() == Link::CRAWLER_JOINT){
+            agxGeometry = new CrawlerGeometry(link, agxRigidBody.get());
+            agxGeometry->setSurfaceVelocity( agx::Vec3f(1,0,0) );   //適当に設定しておかないとcalculateSurfaceVelocityが呼び出されない。
+        }else{
+            agxGeometry = new agxCollide::Geometry();
+        }
+        agxGeometry->add(shape.shape);
+        agxGeometry->setLocalTransform(shape.localTransform);
+        agxRigidBody->add( agxGeometry );
+    }
+}
+
+
+/**
+   The collision shapes of the links are created before the AgX objects of the body are created
+   and added to the simulation. This function does not modify the simulation, so it is executed
+   for the bodies in parallel.
+*/
+void AgXBody::createShapes()
+{
+    linkShapes.clear();
+    MeshExtractor extractor;
+    for(int i=0; i < body()->numLinks(); ++i){
+        Link* link = body()->link(i);
+        if(link->shape()){
+            vector<AgXLinkShape>& shapes = linkShapes[link];
+            extractor.extract(link->shape(), boost::bind(&AgXBody::addMeshShape, this, &extractor, boost::ref(shapes)));
         }
-        delete extractor;
     }
 }
 
 
-void AgXLink::addMesh(MeshExtractor* extractor, AgXBody* agxBody)
+void AgXBody::addMeshShape(MeshExtractor* extractor, vector<AgXLinkShape>& shapes)
 {
     SgMesh* mesh = extractor->currentMesh();
     const Affine3& T = extractor->currentTransform();
 
-    bool meshAdded = false;
-
     if(mesh->primitiveType() != SgMesh::MESH){
         bool doAddPrimitive = false;
         Vector3 scale;
@@ -1107,73 +1188,51 @@ void AgXLink::addMesh(MeshExtractor* extractor, AgXBody* agxBody)
             }
         }
         if(doAddPrimitive){
-            bool created = false;
-            agxCollide::GeometryRef agxGeometry;
-            if(link->jointType() == Link::PSEUDO_CONTINUOUS_TRACK || link->jointType() == Link::CRAWLER_JOINT){
-                agxGeometry = new CrawlerGeometry(link, agxRigidBody.get());
-                agxGeometry->setSurfaceVelocity( agx::Vec3f(1,0,0) );
-            }else{
-                agxGeometry = new agxCollide::Geometry();
-            }
+            agxCollide::ShapeRef shape;
             switch(mesh->primitiveType()){
             case SgMesh::BOX : {
                 const Vector3& s = mesh->primitive<SgMesh::Box>().size / 2.0;
-                agxCollide::BoxRef box = new agxCollide::Box( agx::Vec3( s.x()*scale.x(), s.y()*scale.y(), s.z()*scale.z() ) );
-                agxGeometry->add(box);
-                agxRigidBody->add( agxGeometry );
-                created = true;
+                shape = new agxCollide::Box( agx::Vec3( s.x()*scale.x(), s.y()*scale.y(), s.z()*scale.z() ) );
                 break;
             }
             case SgMesh::SPHERE : {
                 SgMesh::Sphere sphere = mesh->primitive<SgMesh::Sphere>();
-                agxCollide::SphereRef sphere_ = new agxCollide::Sphere( sphere.radius * scale.x() );
-                agxGeometry->add(sphere_);
-                agxRigidBody->add( agxGeometry );
-                created = true;
+                shape = new agxCollide::Sphere( sphere.radius * scale.x() );
                 break;
             }
             case SgMesh::CYLINDER : {
                 SgMesh::Cylinder cylinder = mesh->primitive<SgMesh::Cylinder>();
-                agxCollide::CylinderRef cylinder_ = new agxCollide::Cylinder(cylinder.radius * scale.x(), cylinder.height * scale.y());
-                agxGeometry->add(cylinder_);
-                agxRigidBody->add( agxGeometry );
-                created = true;
+                shape = new agxCollide::Cylinder(cylinder.radius * scale.x(), cylinder.height * scale.y());
                 break;
             }
             default :
                 break;
             }
-            if(created){
+            if(shape){
                 Affine3 T_ = extractor->currentTransformWithoutScaling();
                 if(translation){
                     T_ *= Translation3(*translation);
                 }
-                agxGeometry->setLocalTransform( agx::AffineMatrix4x4( T_(0,0), T_(1,0), T_(2,0), 0.0,
-                                                                      T_(0,1), T_(1,1), T_(2,1), 0.0,
-                                                                      T_(0,2), T_(1,2), T_(2,2), 0.0,
-                                                                      T_(0,3), T_(1,3), T_(2,3), 1.0) );
-                meshAdded = true;
+                AgXLinkShape linkShape;
+                linkShape.shape = shape;
+                linkShape.localTransform = toAgXTransform(T_);
+                shapes.push_back(linkShape);
+                return;
             }
         }
     }
 
-    if(!meshAdded){
-        const size_t vertexIndexTop = vertices.size();
-
-        const SgVertexArray& vertices_ = *mesh->vertices();
-        const int numVertices = vertices_.size();
-        for(int i=0; i < numVertices; ++i){
-            const Vector3 v = T * vertices_[i].cast<Position::Scalar>();
-            vertices.push_back( agx::Vec3(v.x(), v.y(), v.z()) );
-        }
-
-        const int numTriangles = mesh->numTriangles();
-        for(int i=0; i < numTriangles; ++i){
-            SgMesh::TriangleRef src = mesh->triangle(i);
-            indices.push_back(vertexIndexTop + src[0]);
-            indices.push_back(vertexIndexTop + src[1]);
-            indices.push_back(vertexIndexTop + src[2]);
-        }
+    AgXLinkShape linkShape;
+    if(extractor->isCurrentScaled()){
+        // The scaling cannot be expressed by the transform of the geometry
+        linkShape.shape = createTrimesh(mesh, T);
+        linkShape.localTransform = agx::AffineMatrix4x4();
+    } else {
+        linkShape.shape = simImpl->getTrimesh(mesh);
+        linkShape.localTransform = toAgXTransform(T);
+    }
+    if(linkShape.shape){
+        shapes.push_back(linkShape);
     }
 }
 
@@ -1766,7 +1825,7 @@ AgXSimulatorItemImpl::AgXSimulatorItemImpl(AgXSimulatorItem* self)
     gravity << 0.0, 0.0, -DEFAULT_GRAVITY_ACCELERATION;
     friction = 0.5;
     restitution = 0.1;
-    numThreads = 1;
+    numThreads = 0;
     contactReductionBinResolution = 2;
     contactReductionThreshold = 4;
 
@@ -1880,7 +1939,9 @@ bool AgXSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody
 {
     clear();
     agxSimulation = new agxSDK::Simulation();
-    agx::setNumThreads( numThreads );
+
+    // The number of the threads of AgX is global, so it is set by each item when its simulation starts
+    agx::setNumThreads( (numThreads > 0) ? numThreads : boost::thread::hardware_concurrency() );
     agxSimulation->setContactReductionBinResolution( contactReductionBinResolution );
     agxSimulation->setContactReductionThreshold( contactReductionThreshold );
 
@@ -1957,6 +2018,12 @@ bool AgXSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody
     for(Materials::iterator it = materials.begin(); it!=materials.end(); it++)
        agxSimulation->add( *it );
 
+    for(TrimeshCache::iterator p = trimeshCache.begin(); p != trimeshCache.end(); ++p){
+        p->second.numUsedTrimeshes = 0;
+    }
+    TaskScheduler::instance()->parallelFor(
+        0, simBodies.size(), boost::bind(&AgXSimulatorItemImpl::createShapes, this, boost::cref(simBodies), _1));
+
     for(size_t i=0; i < simBodies.size(); ++i){
         addBody(static_cast<AgXBody*>(simBodies[i]),i);
     }
@@ -2000,6 +2067,39 @@ bool AgXSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody
 }
 
 
+void AgXSimulatorItemImpl::createShapes(const std::vector<SimulationBody*>& simBodies, int index)
+{
+    static_cast<AgXBody*>(simBodies[index])->createShapes();
+}
+
+
+/**
+   The trimeshes are kept for the next simulations because the construction of a trimesh
+   takes much time for a large mesh. A trimesh can only be used by one geometry, so the cache
+   has as many trimeshes of a mesh as the geometries which use the mesh in a simulation.
+   This function is called from the threads which create the shapes of the bodies.
+*/
+agxCollide::TrimeshRef AgXSimulatorItemImpl::getTrimesh(SgMesh* mesh)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(trimeshCacheMutex);
+        TrimeshCacheEntry& entry = trimeshCache[mesh];
+        if(entry.numUsedTrimeshes < entry.trimeshes.size()){
+            return entry.trimeshes[entry.numUsedTrimeshes++];
+        }
+    }
+
+    agxCollide::TrimeshRef trimesh = createTrimesh(mesh, Affine3::Identity());
+    if(trimesh){
+        boost::lock_guard<boost::mutex> lock(trimeshCacheMutex);
+        TrimeshCacheEntry& entry = trimeshCache[mesh];
+        entry.trimeshes.push_back(trimesh);
+        entry.numUsedTrimeshes = entry.trimeshes.size();
+    }
+    return trimesh;
+}
+
+
 void AgXSimulatorItem::initializeSimulationThread()
 {
     agx::Thread::registerAsAgxThread();
@@ -2029,6 +2129,7 @@ bool AgXSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>& ac
 
     agxSimulation->stepForward();
 
+    gyroAndAccelerationSensorHelpers.clear();
     for(size_t i=0; i < activeSimBodies.size(); ++i){
         AgXBody* agxBody = static_cast<AgXBody*>(activeSimBodies[i]);
         agxBody->getKinematicStateFromAgX();
@@ -2037,9 +2138,10 @@ bool AgXSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>& ac
             agxBody->updateForceSensors();
         }
         if(agxBody->sensorHelper.hasGyroOrAccelerationSensors()){
-            agxBody->sensorHelper.updateGyroAndAccelerationSensors();
+            gyroAndAccelerationSensorHelpers.push_back(&agxBody->sensorHelper);
         }
     }
+    BasicSensorSimulationHelper::updateGyroAndAccelerationSensors(gyroAndAccelerationSensorHelpers);
 
     return true;
 }
@@ -2085,32 +2187,34 @@ void AgXSimulatorItemImpl::addBody(AgXBody* agxBody, int i)
 
 CollisionLinkPairListPtr AgXSimulatorItem::getCollisions()
 {
-    const agxCollide::GeometryContactPtrVector& contacts = impl->agxSimulation->getSpace()->getGeometryContacts();
+    ContactBuffer contacts;
+    getContacts(contacts);
     CollisionLinkPairListPtr collisionPairs = boost::make_shared<CollisionLinkPairList>();
+    contacts.appendTo(*collisionPairs);
+    return collisionPairs;
+}
+
+
+void AgXSimulatorItem::getContacts(ContactBuffer& out_contacts)
+{
+    out_contacts.clear();
+    const agxCollide::GeometryContactPtrVector& contacts = impl->agxSimulation->getSpace()->getGeometryContacts();
     for(agxCollide::GeometryContactPtrVector::const_iterator it=contacts.begin();
             it!=contacts.end(); it++){
-        CollisionLinkPairPtr dest = boost::make_shared<CollisionLinkPair>();
+        AgXLink* agxLinks[2];
+        for(int j=0; j<2; j++){
+            agx::RigidBody* body = (*it)->rigidBody(j);
+            agxLinks[j] = dynamic_cast<AgXLinkContainer*>( body->getCustomData() )->agxLink;
+        }
+        out_contacts.addLinkPair(agxLinks[0]->agxBody->body(), agxLinks[0]->link,
+                                 agxLinks[1]->agxBody->body(), agxLinks[1]->link);
         agxCollide::ContactPointVector& points = (*it)->points();
         for(int i=0; i<points.size(); i++){
-            dest->collisions.push_back(Collision());
-            Collision& col = dest->collisions.back();
             agx::Vec3 p = points[i].point();
             agx::Vec3f n = points[i].normal();
-            col.depth = points[i].depth();
-            for(int j=0; j<3; j++){
-                col.point[j] = p[j];
-                col.normal[j] = n[j];
-            }
+            out_contacts.addContact(Vector3(p[0], p[1], p[2]), Vector3(n[0], n[1], n[2]), points[i].depth());
         }
-        for(int j=0; j<2; j++){
-            agx::RigidBody* body = (*it)->rigidBody(j);
-            AgXLink* agxLink = dynamic_cast<AgXLinkContainer*>( body->getCustomData() )->agxLink;
-            dest->link[j] = agxLink->link;
-            dest->body[j] = agxLink->agxBody->body();
-        }
-        collisionPairs->push_back(dest);
     }
-    return collisionPairs;
 }
 
 
@@ -2302,7 +2406,7 @@ void AgXSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty("Friction Model Type", frictionModelType, changeProperty(frictionModelType));
     putProperty("Friction Solve Type", frictionSolveType, changeProperty(frictionSolveType));
 
-    putProperty.min(-1)
+    putProperty.min(0)
             ("Number of Threads", numThreads, changeProperty(numThreads));
     putProperty("Contact Reduction Mode", contactReductionMode, changeProperty(contactReductionMode));
     putProperty.min(0)
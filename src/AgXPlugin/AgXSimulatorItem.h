@@ -45,6 +45,8 @@ public:
     void setContactMaterialYoungsModulus(Body* body1, Body* body2, double youngsmodulus);
     void setContactMaterialFrictionModelsolveType(Body* body1, Body* body2, FrictionModelType model, FrictionSolveType solve );
 
+    virtual void getContacts(ContactBuffer& out_contacts);
+
 protected:
 
     virtual bool startSimulation(bool doReset = true);
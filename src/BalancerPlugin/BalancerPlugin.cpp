@@ -35,6 +35,7 @@ namespace {
     public:
         QDoubleSpinBox timeToStartBalancerSpin;
         QSpinBox balancerIterationSpin;
+        QDoubleSpinBox zmpErrorToStopIterationsSpin;
         QCheckBox plainBalancerModeCheck;
         QComboBox boundaryConditionCombo;
         QComboBox boundarySmootherCombo;
@@ -80,6 +81,15 @@ namespace {
             balancerIterationSpin.setValue(2);
             hbox->addWidget(&balancerIterationSpin);
 
+            zmpErrorToStopIterationsSpin.setToolTip(
+                _("The iterations are stopped when the ZMP error becomes smaller than this value (zero disables it)"));
+            zmpErrorToStopIterationsSpin.setDecimals(2);
+            zmpErrorToStopIterationsSpin.setRange(0.0, 9.99);
+            zmpErrorToStopIterationsSpin.setSingleStep(0.01);
+            zmpErrorToStopIterationsSpin.setValue(0.1);
+            hbox->addWidget(&zmpErrorToStopIterationsSpin);
+            hbox->addWidget(new QLabel(_("[mm]")));
+
             hbox->addSpacing(8);
             plainBalancerModeCheck.setText(_("Plain-initial"));
             plainBalancerModeCheck.setToolTip(_("Initial balanced trajectory only depends on the desired ZMP"));
@@ -158,6 +168,7 @@ namespace {
         void storeState(Archive& archive){
             archive.write("timeToStartBalancer", timeToStartBalancerSpin.value());
             archive.write("balancerIterations", balancerIterationSpin.value());
+            archive.write("zmpErrorToStopIterations", zmpErrorToStopIterationsSpin.value());
             archive.write("plainBalancerMode", plainBalancerModeCheck.isChecked());
             archive.write("boundaryConditionType",
                           WaistBalancer::boundaryConditionTypeNameOf(boundaryConditionCombo.currentIndex()));
@@ -174,6 +185,8 @@ namespace {
         void restoreState(const Archive& archive){
             timeToStartBalancerSpin.setValue(archive.get("timeToStartBalancer", timeToStartBalancerSpin.value()));
             balancerIterationSpin.setValue(archive.get("balancerIterations", balancerIterationSpin.value()));
+            zmpErrorToStopIterationsSpin.setValue(
+                archive.get("zmpErrorToStopIterations", zmpErrorToStopIterationsSpin.value()));
             plainBalancerModeCheck.setChecked(archive.get("plainBalancerMode", plainBalancerModeCheck.isChecked()));
 
             boundaryConditionCombo.setCurrentIndex(
@@ -208,6 +221,7 @@ namespace {
                                      bar->postFinalDuration());
             
             balancer->setNumIterations(balancerIterationSpin.value());
+            balancer->setZmpErrorToStopIterations(zmpErrorToStopIterationsSpin.value() / 1000.0);
             balancer->setBoundaryConditionType(boundaryConditionCombo.currentIndex());
             balancer->setBoundarySmoother(boundarySmootherCombo.currentIndex(),
                                           boundarySmootherTimeSpin.value());
@@ -232,7 +246,12 @@ namespace {
             
             if(result){
                 if(putMessages){
-                    mv->notify(fmt(_("OK ! (%1% [s] consumed.)")) % (time.elapsed() / 1000.0));
+                    if(balancer->numDoneIterations() < balancer->numIterations()){
+                        mv->notify(fmt(_("OK ! (Converged with %1% iterations. %2% [s] consumed.)"))
+                                   % balancer->numDoneIterations() % (time.elapsed() / 1000.0));
+                    } else {
+                        mv->notify(fmt(_("OK ! (%1% [s] consumed.)")) % (time.elapsed() / 1000.0));
+                    }
                 }
                 motionItem->notifyUpdate();
             } else {
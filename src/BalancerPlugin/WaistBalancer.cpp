@@ -9,7 +9,10 @@
 #include <cnoid/EigenUtil>
 #include <cnoid/NullOut>
 #include <cnoid/GaussianFilter>
+#include <cnoid/TaskScheduler>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <sstream>
 #include "gettext.h"
 
 using namespace std;
@@ -19,6 +22,9 @@ using namespace cnoid;
 namespace {
 
     const bool DoVerticalAccCompensation = true;
+
+    // The frames are not divided into the blocks smaller than this
+    const int MinNumFramesOfBlock = 200;
     
 #if defined(_MSC_VER) && _MSC_VER < 1800
     inline long lround(double x) {
@@ -41,6 +47,8 @@ WaistBalancer::WaistBalancer()
     g = 9.8;
     waistLink = 0;
     numIterations_ = 2;
+    numDoneIterations_ = 0;
+    zmpErrorToStopIterations = 0.0;
     boundaryConditionType = KEEP_POSITIONS;
     initialWaistTrajectoryMode = ORG_TRAJECTORY;
     timeToStartBalancer = 0.0;
@@ -86,6 +94,18 @@ int WaistBalancer::numIterations() const
 }
 
 
+void WaistBalancer::setZmpErrorToStopIterations(double error)
+{
+    zmpErrorToStopIterations = error;
+}
+
+
+int WaistBalancer::numDoneIterations() const
+{
+    return numDoneIterations_;
+}
+
+
 void WaistBalancer::setTimeRange(double lower, double upper)
 {
     timeRangeLower = lower;
@@ -233,8 +253,14 @@ bool WaistBalancer::apply(PoseProvider* provider_, BodyMotion& motion, bool putA
     p0 = rootLink->p();
     R0 = rootLink->R();
 
+    initFrameState(mainState, body_, provider);
+    mainState.os = os_;
+    numDoneIterations_ = 0;
+
     bool result = apply2(motion, putAllLinkPositions);
 
+    blockStates.clear();
+
     // restore the original body state
     for(int i=0; i < numJoints; ++i){
         body_->joint(i)->q() = q0[i];
@@ -268,7 +294,8 @@ bool WaistBalancer::apply2(BodyMotion& motion, bool putAllLinkPositions)
         initWaistHeightRelaxation();
     }
     
-    initBodyKinematics(endingFrame, Vector3::Zero());
+    FrameState& s = mainState;
+    initBodyKinematics(s, endingFrame, Vector3::Zero());
 
     if(provider->baseLinkIndex() < 0){
         return false;
@@ -277,8 +304,8 @@ bool WaistBalancer::apply2(BodyMotion& motion, bool putAllLinkPositions)
         return false;
     }
 
-    Vector3 cmProjection(cm[0], cm[1], desiredZmp[2]);
-    doProcessFinalBoundary = ((cmProjection - desiredZmp).norm() < 2.0e-3);
+    Vector3 cmProjection(s.cm[0], s.cm[1], s.desiredZmp[2]);
+    doProcessFinalBoundary = ((cmProjection - s.desiredZmp).norm() < 2.0e-3);
 
     doBoundarySmoother = false;
     if(boundarySmootherType_ && boundaryConditionType == KEEP_POSITIONS){
@@ -304,10 +331,22 @@ bool WaistBalancer::apply2(BodyMotion& motion, bool putAllLinkPositions)
     bool result = true;
     
     for(int i=0; i < numIterations_; ++i){
+        const bool isInitialTrajectory = isCalculatingInitialWaistTrajectory;
         result = calcCmTranslations();
         if(!result){
             break;
         }
+        ++numDoneIterations_;
+        // The ZMP error is not calculated for the initial trajectory
+        if(!isInitialTrajectory && zmpErrorToStopIterations > 0.0){
+            double maxZmpError = mainState.maxZmpError;
+            for(size_t j=0; j < blockStates.size(); ++j){
+                maxZmpError = std::max(maxZmpError, blockStates[j]->maxZmpError);
+            }
+            if(maxZmpError < zmpErrorToStopIterations){
+                break;
+            }
+        }
     }
 
     if(result){
@@ -408,26 +447,27 @@ bool WaistBalancer::calcWaistTranslationWithCmAboveZmp
     if(baseLinkIndex < 0){
         return false;
     }
-    baseLink = body_->link(baseLinkIndex);
-    fkTraverse.find(baseLink);
+    FrameState& s = mainState;
+    s.baseLink = body_->link(baseLinkIndex);
+    s.fkTraverse.find(s.baseLink);
 
     bool converged = false;
     const int n = body_->numJoints();
 
     for(int i=0; i < 50; ++i){
 
-        provider->getBaseLinkPosition(baseLink->T());
+        provider->getBaseLinkPosition(s.baseLink->T());
         
-        provider->getJointPositions(jointPositions);
+        provider->getJointPositions(s.jointPositions);
         for(int j=0; j < n; ++j){
             Link* joint = body_->joint(j);
-            const optional<double>& q = jointPositions[j];
+            const optional<double>& q = s.jointPositions[j];
             joint->q() = q ? *q : 0.0;
         }
-        fkTraverse.calcForwardKinematics(true);
-        cm = body_->calcCenterOfMass();
+        s.fkTraverse.calcForwardKinematics(true);
+        s.cm = body_->calcCenterOfMass();
 
-        Vector3 diff(zmp[0] - cm[0], zmp[1] - cm[1], 0.0);
+        Vector3 diff(zmp[0] - s.cm[0], zmp[1] - s.cm[1], 0.0);
 
         if(diff.norm() < 1.0e-6){
             converged = true;
@@ -441,91 +481,109 @@ bool WaistBalancer::calcWaistTranslationWithCmAboveZmp
 }
 
 
-void WaistBalancer::initBodyKinematics(int frame, const Vector3& cmTranslation)
+void WaistBalancer::initFrameState(FrameState& s, Body* body, PoseProvider* provider)
 {
+    s.body = body;
+    s.provider = provider;
+    s.waistLink = body->link(waistLinkIndex);
+    s.baseLink = body->rootLink();
+    s.maxZmpError = 0.0;
+    s.beginningFrame = 0;
+    s.endingFrame = 0;
+}
+
+
+void WaistBalancer::initBodyKinematics(FrameState& s, int frame, const Vector3& cmTranslation)
+{
+    PoseProvider* provider = s.provider;
+    Body* body = s.body;
+    
     provider->seek(timeOfFrame(frame), waistLinkIndex, cmTranslation);
 
     int baseLinkIndex = provider->baseLinkIndex();
     if(baseLinkIndex >= 0){
-        baseLink = body_->link(baseLinkIndex);
-        provider->getBaseLinkPosition(baseLink->T());
+        s.baseLink = body->link(baseLinkIndex);
+        provider->getBaseLinkPosition(s.baseLink->T());
     } else {
-        baseLink = body_->rootLink();
-        baseLink->p().setZero();
-        baseLink->R().setIdentity();
+        s.baseLink = body->rootLink();
+        s.baseLink->p().setZero();
+        s.baseLink->R().setIdentity();
     }
-    baseLink->v().setZero();
-    baseLink->w().setZero();
+    s.baseLink->v().setZero();
+    s.baseLink->w().setZero();
     
-    fkTraverse.find(baseLink);
+    s.fkTraverse.find(s.baseLink);
 
-    const int n = body_->numJoints();
-    provider->getJointPositions(jointPositions);
+    const int n = body->numJoints();
+    provider->getJointPositions(s.jointPositions);
     for(int i=0; i < n; ++i){
-        Link* joint = body_->joint(i);
-        const optional<double>& q = jointPositions[i];
+        Link* joint = body->joint(i);
+        const optional<double>& q = s.jointPositions[i];
         joint->q() = q ? *q : 0.0;
         joint->dq() = 0.0;
     }
 
-    updateCmAndZmp(frame);
+    updateCmAndZmp(s, frame);
 }
 
 
-void WaistBalancer::updateCmAndZmp(int frame)
+void WaistBalancer::updateCmAndZmp(FrameState& s, int frame)
 {
-    fkTraverse.calcForwardKinematics(true);
+    s.fkTraverse.calcForwardKinematics(true);
 
-    cm = body_->calcCenterOfMass();
+    s.cm = s.body->calcCenterOfMass();
 
     if(isCalculatingInitialWaistTrajectory){
         Vector3& p = totalCmTranslations[frame];
-        p.x() = -waistLink->p().x();
-        p.y() = -waistLink->p().y();
+        p.x() = -s.waistLink->p().x();
+        p.y() = -s.waistLink->p().y();
         p.z() = 0.0;
-        desiredZmp = *provider->ZMP();
-        zmpDiff = desiredZmp;
+        s.desiredZmp = *s.provider->ZMP();
+        s.zmpDiff = s.desiredZmp;
 
     } else {
         Vector3 P, L;
-        body_->calcTotalMomentum(P, L);
+        s.body->calcTotalMomentum(P, L);
 
-        dP = (P - P0) / dt;
-        dL = (L - L0) / dt;
+        s.dP = (P - s.P0) / dt;
+        s.dL = (L - s.L0) / dt;
 
-        P0 = P;
-        L0 = L;
+        s.P0 = P;
+        s.L0 = L;
 
         const double inertial_g_thresh = 1.0;
-        double ddz = dP.z() / m;
-        inertial_g = g + ddz;
+        double ddz = s.dP.z() / m;
+        s.inertial_g = g + ddz;
         
-        if(inertial_g < inertial_g_thresh){
-            os() << str(
+        if(s.inertial_g < inertial_g_thresh){
+            *s.os << str(
                 fmt(_("Warning: The body is floating at %1% (Vertical CM acceleration is %2%)."))
                 % (frame * timeStep) % (ddz)) << endl;
 
             if(DoVerticalAccCompensation){
-                dP.z() = m * (inertial_g_thresh - g);
-                inertial_g = inertial_g_thresh;
+                s.dP.z() = m * (inertial_g_thresh - g);
+                s.inertial_g = inertial_g_thresh;
             }
         }
 
-        zmp.x() = (dP.x() * desiredZmp.z() - dL.y() + mg * cm.x()) / (dP.z() + mg);
-        zmp.y() = (dP.y() * desiredZmp.z() + dL.x() + mg * cm.y()) / (dP.z() + mg);
-        zmp.z() = desiredZmp.z();
-        zmpDiff = desiredZmp - zmp;
+        Vector3& zmp = s.zmp;
+        zmp.x() = (s.dP.x() * s.desiredZmp.z() - s.dL.y() + mg * s.cm.x()) / (s.dP.z() + mg);
+        zmp.y() = (s.dP.y() * s.desiredZmp.z() + s.dL.x() + mg * s.cm.y()) / (s.dP.z() + mg);
+        zmp.z() = s.desiredZmp.z();
+        s.zmpDiff = s.desiredZmp - zmp;
 
-        desiredZmp = *provider->ZMP();
+        s.desiredZmp = *s.provider->ZMP();
     }
 }
 
 
-bool WaistBalancer::updateBodyKinematics1(int frame)
+bool WaistBalancer::updateBodyKinematics1(FrameState& s, int frame)
 {
     bool result = true;
-    
-    const int n = body_->numJoints();
+
+    PoseProvider* provider = s.provider;
+    Body* body = s.body;
+    const int n = body->numJoints();
     const int nextFrame = frame + 1;
 
     if(nextFrame <= endingFrame){
@@ -536,14 +594,12 @@ bool WaistBalancer::updateBodyKinematics1(int frame)
         if(!isCalculatingInitialWaistTrajectory){
         
             const int baseLinkIndex = provider->baseLinkIndex();
-            if(baseLinkIndex != baseLink->index() && baseLinkIndex >= 0){
-                baseLink = body_->link(baseLinkIndex);
-                fkTraverse.find(baseLink);
+            if(baseLinkIndex != s.baseLink->index() && baseLinkIndex >= 0){
+                s.baseLink = body->link(baseLinkIndex);
+                s.fkTraverse.find(s.baseLink);
             }
+            Link* baseLink = s.baseLink;
         
-            Vector3 p_next = baseLink->p();
-            Matrix3 R_next = baseLink->R();
-
             Position T_next;
             if(!provider->getBaseLinkPosition(T_next)){
                 T_next = baseLink->T();
@@ -551,10 +607,10 @@ bool WaistBalancer::updateBodyKinematics1(int frame)
             baseLink->v() = (T_next.translation() - baseLink->p()) / dt;
             baseLink->w() = omegaFromRot(baseLink->R().transpose() * T_next.linear()) / dt;
 
-            provider->getJointPositions(jointPositions);
+            provider->getJointPositions(s.jointPositions);
             for(int i=0; i < n; ++i){
-                Link* joint = body_->joint(i);
-                const optional<double>& q = jointPositions[i];
+                Link* joint = body->joint(i);
+                const optional<double>& q = s.jointPositions[i];
                 if(q){
                     joint->dq() = (*q - joint->q()) / dt;
                 } else {
@@ -564,50 +620,106 @@ bool WaistBalancer::updateBodyKinematics1(int frame)
         }
     }
 
-    updateCmAndZmp(frame);
+    updateCmAndZmp(s, frame);
 
     return result;
 }
 
 
-void WaistBalancer::updateBodyKinematics2()
+void WaistBalancer::updateBodyKinematics2(FrameState& s)
 {
-    const int n = body_->numJoints();
-    provider->getJointPositions(jointPositions);
+    const int n = s.body->numJoints();
+    s.provider->getJointPositions(s.jointPositions);
     for(int i=0; i < n; ++i){
-        Link* joint = body_->joint(i);
-        const optional<double>& q = jointPositions[i];
+        Link* joint = s.body->joint(i);
+        const optional<double>& q = s.jointPositions[i];
         if(q){
             joint->q() = *q;
         }
     }
-    provider->getBaseLinkPosition(baseLink->T());
+    s.provider->getBaseLinkPosition(s.baseLink->T());
 }
 
 
-bool WaistBalancer::calcCmTranslations()
+/**
+   The states of the blocks except the head one are created. A block begins at a frame where the
+   base link position is given because the state of a block is initialized from the previous frame.
+*/
+void WaistBalancer::createBlockStates()
 {
-    initBodyKinematics(frameToStartBalancer, totalCmTranslations[frameToStartBalancer]);
+    int numBlocks = std::min(TaskScheduler::instance()->concurrency(), numFilteredFrames / MinNumFramesOfBlock);
+    if(numBlocks < 2){
+        return;
+    }
+    
+    blockStates.clear();
+    for(int i=1; i < numBlocks; ++i){
+        FrameStatePtr state = boost::make_shared<FrameState>();
+        PoseProvider* providerCopy = provider->clone();
+        if(!providerCopy){
+            blockStates.clear();
+            return;
+        }
+        state->providerCopy.reset(providerCopy);
+        initFrameState(*state, body_->clone(), providerCopy);
+        state->messages = boost::make_shared<ostringstream>();
+        state->os = state->messages.get();
+        
+        int frame = (long)numFilteredFrames * i / numBlocks;
+        providerCopy->seek(timeOfFrame(frame - 1 + frameToStartBalancer));
+        if(providerCopy->baseLinkIndex() < 0){
+            continue;
+        }
+        state->beginningFrame = frame;
+        if(!blockStates.empty()){
+            blockStates.back()->endingFrame = frame;
+        }
+        blockStates.push_back(state);
+    }
+    if(!blockStates.empty()){
+        blockStates.back()->endingFrame = numFilteredFrames;
+    }
+}
+
 
-    //const double gdt2 = g * dt2;
+void WaistBalancer::evaluateFrameBlock(int blockIndex)
+{
+    FrameState& s = *blockStates[blockIndex];
     
-    for(int i = 0; i < numFilteredFrames; ++i){
+    // The state is initialized with the frame before the block to calculate the momentum of it
+    std::ostream* os = s.os;
+    s.os = &nullout();
+    const int frame = s.beginningFrame - 1 + frameToStartBalancer;
+    initBodyKinematics(s, frame, totalCmTranslations[frame]);
+    updateBodyKinematics1(s, frame);
+    updateBodyKinematics2(s);
+    s.os = os;
+
+    evaluateFrames(s, s.beginningFrame, s.endingFrame);
+}
+
+
+void WaistBalancer::evaluateFrames(FrameState& s, int beginningFrame, int endingFrame)
+{
+    s.maxZmpError = 0.0;
+    
+    for(int i = beginningFrame; i < endingFrame; ++i){
 
-        updateBodyKinematics1(i + frameToStartBalancer);
+        updateBodyKinematics1(s, i + frameToStartBalancer);
 
         if(doStoreOriginalWaistFeetPositionsForWaistHeightRelaxation){
             // store waist and feet positions
             WaistFeetPos& p = waistFeetPosSeq[i];
-            p.p_Waist = waistLink->p();
-            p.R_Waist = waistLink->R();
+            p.p_Waist = s.waistLink->p();
+            p.R_Waist = s.waistLink->R();
             for(int j=0; j < 2; ++j){
-                Link* footLink = waistFeetIK.baseLink(j);
+                Link* footLink = s.body->link(waistFeetIK.baseLink(j)->index());
                 p.p_Foot[j] = footLink->p();
                 p.R_Foot[j] = footLink->R();
             }
         }
 
-        updateBodyKinematics2();
+        updateBodyKinematics2(s);
 
         Coeff& c = coeffSeq[i];
         /*
@@ -616,16 +728,56 @@ bool WaistBalancer::calcCmTranslations()
         c.d = gdt2 * zmpDiff;
         */
 
+        const double cmz = s.cm.z();
         if(DoVerticalAccCompensation){
-            const double gdt2 = inertial_g * dt2;
-            c.a = -cm.z() / gdt2;
-            c.b = 2.0 * cm.z() / gdt2 + 1.0;
+            const double gdt2 = s.inertial_g * dt2;
+            c.a = -cmz / gdt2;
+            c.b = 2.0 * cmz / gdt2 + 1.0;
         } else {
             const double gdt2 = g * dt2;        
-            c.a = -cm.z() / gdt2;
-            c.b = 2.0 * cm.z() / gdt2 + 1.0;
+            c.a = -cmz / gdt2;
+            c.b = 2.0 * cmz / gdt2 + 1.0;
+        }
+        c.d = s.zmpDiff;
+
+        s.maxZmpError = std::max(s.maxZmpError, s.zmpDiff.head<2>().norm());
+    }
+}
+
+
+/**
+   The waist translations are corrected by solving the tridiagonal system of the ZMP equations
+   of the frames with the Thomas algorithm after the coefficients are given by the dynamics of the frames.
+*/
+bool WaistBalancer::calcCmTranslations()
+{
+    /*
+      The initial trajectory is calculated sequentially because the translation of a frame
+      given by the calculation is used to seek the previous frame.
+    */
+    if(!isCalculatingInitialWaistTrajectory && blockStates.empty()){
+        createBlockStates();
+    }
+    const bool doParallelEvaluation = !isCalculatingInitialWaistTrajectory && !blockStates.empty();
+    
+    initBodyKinematics(mainState, frameToStartBalancer, totalCmTranslations[frameToStartBalancer]);
+
+    if(!doParallelEvaluation){
+        evaluateFrames(mainState, 0, numFilteredFrames);
+    } else {
+        TaskGroup tasks;
+        for(size_t i=0; i < blockStates.size(); ++i){
+            tasks.run(boost::bind(&WaistBalancer::evaluateFrameBlock, this, i));
+        }
+        evaluateFrames(mainState, 0, blockStates.front()->beginningFrame);
+        tasks.wait();
+
+        // The messages are output in the order of the frames
+        for(size_t i=0; i < blockStates.size(); ++i){
+            ostringstream& messages = *blockStates[i]->messages;
+            os() << messages.str();
+            messages.str("");
         }
-        c.d = zmpDiff;
     }
     
     double bet;
@@ -856,25 +1008,26 @@ bool WaistBalancer::applyCmTranslations(BodyMotion& motion, bool putAllLinkPosit
     ZMPSeqPtr zmpseq = getOrCreateZMPSeq(motion);
     zmpseq->setRootRelative(false);
 
-    initBodyKinematics(beginningFrame, totalCmTranslations[beginningFrame]);
+    FrameState& s = mainState;
+    initBodyKinematics(s, beginningFrame, totalCmTranslations[beginningFrame]);
 
     for(int frame = beginningFrame; frame <= endingFrame; ++frame){
 
-        completed &= updateBodyKinematics1(frame); 
+        completed &= updateBodyKinematics1(s, frame); 
 
         MultiValueSeq::Frame qs = qseq.frame(frame);
         for(int i=0; i < numJoints; ++i){
             qs[i] = body_->joint(i)->q();
         }
 
-        zmpseq->at(frame) = zmp;
+        zmpseq->at(frame) = s.zmp;
         
         for(int i=0; i < numLinksToPut; ++i){
             Link* link = body_->link(i);
             pseq.at(frame, i).set(link->T());
         }
 
-        updateBodyKinematics2();
+        updateBodyKinematics2(s);
     }
 
     return completed;
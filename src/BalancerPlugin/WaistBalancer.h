@@ -12,7 +12,9 @@
 #include <cnoid/CompositeIK>
 #include <boost/optional.hpp>
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 #include <vector>
+#include <iosfwd>
 
 namespace cnoid {
 
@@ -33,6 +35,16 @@ namespace cnoid {
         void setWaistLink(Link* waistLink);
         void setNumIterations(int n);
         int numIterations() const;
+
+        /**
+           The iterations are stopped when the maximum horizontal error of the ZMP calculated
+           from the dynamics is smaller than this value. The default value is zero, which means
+           that all the iterations are always done.
+        */
+        void setZmpErrorToStopIterations(double error);
+
+        //! The number of the iterations done by the last apply() call
+        int numDoneIterations() const;
         void setTimeRange(double lower, double upper);
         void setFullTimeRange();
         void setTimeMargins(double timeToStartBalancer, double preInitialDuration, double postFinalDuration);
@@ -86,14 +98,45 @@ namespace cnoid {
         double dynamicsTimeRatio;
 
         BodyPtr body_;
-        Link* baseLink;
-        LinkTraverse fkTraverse;
         PoseProvider* provider;
         bool isCalculatingInitialWaistTrajectory;
 
-        std::vector< boost::optional<double> > jointPositions;
+        /**
+           The state of the body evaluated frame by frame. The frames of each iteration are divided into
+           blocks, and the blocks are evaluated in parallel by the states with the copies of the body and
+           the pose provider when the provider supports PoseProvider::clone().
+        */
+        struct FrameState
+        {
+            BodyPtr body;
+            PoseProvider* provider;
+            boost::shared_ptr<PoseProvider> providerCopy;
+            Link* baseLink;
+            Link* waistLink;
+            LinkTraverse fkTraverse;
+            std::vector< boost::optional<double> > jointPositions;
+            double inertial_g;
+            Vector3 cm; // center of mass
+            Vector3 P0; // prev momentum
+            Vector3 L0; // prev angular momentum
+            Vector3 dP;
+            Vector3 dL;
+            Vector3 zmp; // calculated ZMP
+            Vector3 desiredZmp;
+            Vector3 zmpDiff;
+            double maxZmpError;
+            int beginningFrame; // the index of the filtered frames where the block begins
+            int endingFrame; // the index of the filtered frames where the next block begins
+            boost::shared_ptr<std::ostringstream> messages;
+            std::ostream* os;
+        };
+        typedef boost::shared_ptr<FrameState> FrameStatePtr;
+        FrameState mainState;
+        std::vector<FrameStatePtr> blockStates;
             
         int numIterations_;
+        int numDoneIterations_;
+        double zmpErrorToStopIterations;
         int beginningFrame;
         int endingFrame;
         int numFilteredFrames;
@@ -105,15 +148,6 @@ namespace cnoid {
         double g;
         double mg;
         double m;
-        double inertial_g;
-        Vector3 cm; // center of mass
-        Vector3 P0; // prev momentum
-        Vector3 L0; // prev angular momentum
-        Vector3 dP;
-        Vector3 dL;
-        Vector3 zmp; // calculated ZMP
-        Vector3 desiredZmp;
-        Vector3 zmpDiff;
 
         struct Coeff {
             double a;
@@ -166,10 +200,14 @@ namespace cnoid {
         bool calcBoundaryCmAdjustmentTrajectorySub(int begin, int direction);
         bool calcWaistTranslationWithCmAboveZmp(
             int frame, const Vector3& zmp, Vector3& out_translation);
-        void initBodyKinematics(int frame, const Vector3& cmTranslation);
-        void updateCmAndZmp(int frame);
-        bool updateBodyKinematics1(int frame);
-        void updateBodyKinematics2();
+        void initFrameState(FrameState& s, Body* body, PoseProvider* provider);
+        void initBodyKinematics(FrameState& s, int frame, const Vector3& cmTranslation);
+        void updateCmAndZmp(FrameState& s, int frame);
+        bool updateBodyKinematics1(FrameState& s, int frame);
+        void updateBodyKinematics2(FrameState& s);
+        void createBlockStates();
+        void evaluateFrameBlock(int blockIndex);
+        void evaluateFrames(FrameState& s, int beginningFrame, int endingFrame);
         bool calcCmTranslations();
         void initWaistHeightRelaxation();
         void relaxWaistHeightTrajectory();
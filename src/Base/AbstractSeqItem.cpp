@@ -31,6 +31,13 @@ AbstractSeqItem::~AbstractSeqItem()
 }
 
 
+size_t AbstractSeqItem::memoryUsage() const
+{
+    AbstractSeqPtr seq = const_cast<AbstractSeqItem*>(this)->abstractSeq();
+    return seq ? seq->memoryUsage() : 0;
+}
+
+
 static bool setOffsetTime(AbstractSeqItem* item, double offset)
 {
     return item->abstractSeq()->setOffsetTime(offset);
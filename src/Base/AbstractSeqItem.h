@@ -21,6 +21,8 @@ public:
 
     virtual AbstractSeqPtr abstractSeq() = 0;
 
+    virtual size_t memoryUsage() const;
+
 protected:
     virtual void doPutProperties(PutPropertyFunction& putProperty);
     virtual bool store(Archive& archive);
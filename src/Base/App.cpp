@@ -44,10 +44,14 @@
 #include "MovieRecorder.h"
 #include "LazyCaller.h"
 #include "TextEditView.h"
+#include "MemoryUsageView.h"
+#include "ProfilerView.h"
+#include "EventLoopMonitor.h"
 #include "VirtualJoystickView.h"
 #include "DescriptionDialog.h"
 #include <cnoid/Config>
 #include <cnoid/ValueTree>
+#include <cnoid/TimingProfiler>
 #include <QApplication>
 #include <QTextCodec>
 #include <QGLFormat>
@@ -56,6 +60,7 @@
 #include <boost/bind.hpp>
 
 #include <csignal>
+#include <cstring>
 
 #ifdef Q_OS_WIN32
 #include <windows.h>
@@ -85,6 +90,21 @@ BOOL WINAPI consoleCtrlHandler(DWORD ctrlChar)
 }
 #endif
 
+/**
+   The events are delivered in the scopes of the event loop monitor so that the events
+   blocking the event loop can be identified.
+*/
+class MonitoredApplication : public QApplication
+{
+public:
+    MonitoredApplication(int& argc, char** argv) : QApplication(argc, argv) { }
+
+    virtual bool notify(QObject* receiver, QEvent* event) {
+        EventLoopMonitor::Scope scope(receiver, event);
+        return QApplication::notify(receiver, event);
+    }
+};
+
 }
 
 
@@ -102,6 +122,7 @@ class AppImpl
     std::string vendorName;
     DescriptionDialog* descriptionDialog;
     bool doQuit;
+    std::string timingReportFile;
     
     AppImpl(App* self, int& argc, char**& argv);
     ~AppImpl();
@@ -112,6 +133,8 @@ class AppImpl
     bool processCommandLineOptions();
     void showInformationDialog();
     void onOpenGLVSyncToggled(bool on);
+    void putTimingProfile();
+    void putEventLoopReport();
 
     friend class App;
     friend class View;
@@ -145,7 +168,23 @@ AppImpl::AppImpl(App* self, int& argc, char**& argv)
 
     doQuit = false;
 
-    qapplication = new QApplication(argc, argv);
+    // The timing profiler must be enabled before the initialization to measure the startup
+    for(int i=1; i < argc; ++i){
+        if(strncmp(argv[i], "--timing-report", 15) == 0){
+            TimingProfiler::setEnabled(true);
+            break;
+        }
+    }
+
+    qapplication = new MonitoredApplication(argc, argv);
+
+    // The event loop monitor is enabled after the application is created to watch the event dispatcher
+    for(int i=1; i < argc; ++i){
+        if(strncmp(argv[i], "--event-loop-monitor", 20) == 0){
+            EventLoopMonitor::setEnabled(true);
+            break;
+        }
+    }
 
     self->connect(qapplication, SIGNAL(focusChanged(QWidget*, QWidget*)),
                   self, SLOT(onFocusChanged(QWidget*, QWidget*)));
@@ -179,6 +218,8 @@ void AppImpl::initialize( const char* appName, const char* vendorName, const QIc
     ParametricPathProcessor::instance()->setVariables(
         AppConfig::archive()->openMapping("pathVariables"));
 
+    TimingProfiler::Scope timingScope("App/Initializing");
+
     ext = new ExtensionManager("Base", false);
 
     // OpenGL settings
@@ -201,6 +242,8 @@ void AppImpl::initialize( const char* appName, const char* vendorName, const QIc
     ItemTreeView::initializeClass(ext);
     ItemPropertyView::initializeClass(ext);
     TextEditView::initializeClass(ext);
+    MemoryUsageView::initializeClass(ext);
+    ProfilerView::initializeClass(ext);
     SceneBar::initialize(ext);
     SceneView::initializeClass(ext);
     ImageView::initializeClass(ext);
@@ -236,13 +279,35 @@ void AppImpl::initialize( const char* appName, const char* vendorName, const QIc
     vsyncItem->setChecked(glfmt.swapInterval() > 0);
     vsyncItem->sigToggled().connect(boost::bind(&AppImpl::onOpenGLVSyncToggled, this, _1));
 
+    MenuManager& mm = ext->menuManager().setPath("/Tools").setPath(N_("Timing Profile"));
+    Action* timingProfilingCheck = mm.addCheckItem(_("Enable Profiling"));
+    timingProfilingCheck->setChecked(TimingProfiler::isEnabled());
+    timingProfilingCheck->sigToggled().connect(TimingProfiler::setEnabled);
+    mm.addItem(_("Put Report"))->sigTriggered().connect(boost::bind(&AppImpl::putTimingProfile, this));
+    mm.addItem(_("Clear"))->sigTriggered().connect(TimingProfiler::clear);
+
+    mm.setPath("/Tools").setPath(N_("Event Loop Monitor"));
+    Action* eventLoopMonitoringCheck = mm.addCheckItem(_("Enable Monitoring"));
+    eventLoopMonitoringCheck->setChecked(EventLoopMonitor::isEnabled());
+    eventLoopMonitoringCheck->sigToggled().connect(EventLoopMonitor::setEnabled);
+    mm.addItem(_("Put Report"))->sigTriggered().connect(boost::bind(&AppImpl::putEventLoopReport, this));
+    mm.addItem(_("Clear"))->sigTriggered().connect(EventLoopMonitor::clear);
+
     PluginManager::initialize(ext);
-    PluginManager::instance()->doStartupLoading(pluginPathList);
+    {
+        TimingProfiler::Scope timingScope("App/Loading the plugins");
+        PluginManager::instance()->doStartupLoading(pluginPathList);
+    }
 
     mainWindow->installEventFilter(self);
 
     OptionManager& om = ext->optionManager();
     om.addOption("quit", "quit the application just after it is invoked");
+    om.addOption("timing-report", boost::program_options::value<std::string>(),
+                 "write the time spent in the phases of the startup and the project loading to a YAML file");
+    om.addOption("event-loop-monitor", "report the handlers which block the event loop longer than the threshold");
+    om.addOption("event-loop-monitor-threshold", boost::program_options::value<double>(),
+                 "the threshold time in milliseconds of the event loop monitor (default: 100)");
     om.sigOptionsParsed().connect(boost::bind(&AppImpl::onSigOptionsParsed, this, _1));
 
     // Some plugins such as OpenRTM plugin are driven by a library which tries to catch SIGINT.
@@ -305,6 +370,13 @@ int AppImpl::exec()
 {
     processCommandLineOptions();
 
+    if(!timingReportFile.empty()){
+        if(!TimingProfiler::writeReport(timingReportFile)){
+            MessageView::instance()->putln(
+                MessageView::ERROR, boost::format(_("The timing report cannot be written to \"%1%\".")) % timingReportFile);
+        }
+    }
+
     if(!mainWindow->isVisible()){
         mainWindow->show();
     }
@@ -317,6 +389,8 @@ int AppImpl::exec()
         result = qapplication->exec();
     }
 
+    EventLoopMonitor::setEnabled(false);
+
     PluginManager::finalize();
     delete ext;
     delete mainWindow;
@@ -363,6 +437,12 @@ void AppImpl::onSigOptionsParsed(boost::program_options::variables_map& v)
     if(v.count("quit")){
         doQuit = true;
     }
+    if(v.count("timing-report")){
+        timingReportFile = v["timing-report"].as<std::string>();
+    }
+    if(v.count("event-loop-monitor-threshold")){
+        EventLoopMonitor::setThreshold(v["event-loop-monitor-threshold"].as<double>() / 1000.0);
+    }
 }
     
 
@@ -397,6 +477,24 @@ void AppImpl::showInformationDialog()
 }
 
 
+void AppImpl::putTimingProfile()
+{
+    std::ostream& os = MessageView::instance()->cout();
+    os << _("Timing profile:") << std::endl;
+    TimingProfiler::putReport(os);
+    MessageView::instance()->flush();
+}
+
+
+void AppImpl::putEventLoopReport()
+{
+    std::ostream& os = MessageView::instance()->cout();
+    os << _("Event loop monitor report:") << std::endl;
+    EventLoopMonitor::putReport(os);
+    MessageView::instance()->flush();
+}
+
+
 void AppImpl::onOpenGLVSyncToggled(bool on)
 {
     Mapping* glConfig = AppConfig::archive()->openMapping("OpenGL");
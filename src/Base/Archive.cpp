@@ -58,6 +58,7 @@ public:
     ViewToIdMap viewToIdMap;
         
     Item* currentParentItem;
+    bool isOnDemandLoadingEnabled;
 
     PostProcessList postProcesses;
 };
@@ -160,6 +161,7 @@ void Archive::initSharedInfo(bool useHomeRelativeDirectories)
     }
     
     shared->currentParentItem = 0;
+    shared->isOnDemandLoadingEnabled = false;
 }    
     
 
@@ -509,3 +511,20 @@ void Archive::setCurrentParentItem(Item* parentItem)
         shared->currentParentItem = parentItem;
     }
 }
+
+
+bool Archive::isOnDemandLoadingEnabled() const
+{
+    if(shared){
+        return shared->isOnDemandLoadingEnabled;
+    }
+    return false;
+}
+
+
+void Archive::setOnDemandLoadingEnabled(bool on)
+{
+    if(shared){
+        shared->isOnDemandLoadingEnabled = on;
+    }
+}
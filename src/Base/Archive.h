@@ -70,6 +70,12 @@ public:
 
     Item* currentParentItem() const;
 
+    /**
+       When this is true, the items whose files may be large do not load the files in restore()
+       but load them when they are used for the first time. See Item::loadFileOnDemand().
+    */
+    bool isOnDemandLoadingEnabled() const;
+
     boost::filesystem::path getProjectDir() const { return projectDirPath; }
 
 private:
@@ -78,6 +84,7 @@ private:
 
     Item* findItem(int id) const;
     void setCurrentParentItem(Item* parentItem);
+    void setOnDemandLoadingEnabled(bool on);
     static Archive* invalidArchive();
     void registerItemId(Item* item, int id);
     void registerViewId(View* view, int id);
@@ -0,0 +1,546 @@
+/**
+   @file
+*/
+
+#include "EventLoopMonitor.h"
+#include "LazyCaller.h"
+#include "MessageView.h"
+#include <QObject>
+#include <QEvent>
+#include <QMetaObject>
+#include <QAbstractEventDispatcher>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <map>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef __GNUC__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+bool EventLoopMonitor::isEnabled_ = false;
+
+namespace {
+
+struct Entry
+{
+    const char* category;
+    const char* name;
+    bool isTypeName;
+    int eventType; // -1 if the entry is not a Qt event
+    double beginTime;
+    double idleTimeAtBegin;
+};
+
+struct Record
+{
+    string label;
+    double time;
+    double beginTime;
+    int depth;
+};
+
+struct Statistics
+{
+    Statistics() : count(0), totalTime(0.0), maxTime(0.0) { }
+    int count;
+    double totalTime;
+    double maxTime;
+};
+
+typedef map<string, Statistics> StatisticsMap;
+
+double thresholdTime = 0.1;
+double hangTime_ = 5.0;
+
+vector<Entry> entryStack;
+boost::mutex stackMutex; // guards entryStack against the watchdog thread
+
+vector<Record> records; // the handlers exceeding the threshold in the current top-level handler
+StatisticsMap statisticsMap;
+
+// The time in which the nested event loops wait for events
+double idleTime = 0.0;
+double idleBeginTime = 0.0;
+bool isEventDispatcherConnected = false;
+
+// The time in microseconds at which the event loop began to be blocked. Zero when it is not blocked.
+boost::atomic<long long> busySince(0);
+
+boost::thread watchdogThread;
+boost::mutex watchdogMutex;
+boost::condition_variable watchdogCondition;
+bool isWatchdogStopRequested = false;
+
+
+double currentTime()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec * 1.0e-9;
+#endif
+}
+
+
+long long toMicroseconds(double time)
+{
+    return static_cast<long long>(time * 1.0e6);
+}
+
+
+string demangle(const char* name)
+{
+#ifdef __GNUC__
+    int status;
+    char* demangled = abi::__cxa_demangle(name, 0, 0, &status);
+    if(demangled){
+        string s(demangled);
+        free(demangled);
+        return s;
+    }
+#endif
+    return name;
+}
+
+
+/**
+   The type of a function object made by boost::bind for a member function is long and
+   hard to read, so it is shortened to the class and the argument types of the function.
+*/
+string getFunctionTypeName(const char* name)
+{
+    const string typeName = demangle(name);
+
+    size_t pos = typeName.find("boost::_mfi::");
+    if(pos == string::npos){
+        return typeName;
+    }
+    pos = typeName.find('<', pos);
+    if(pos == string::npos){
+        return typeName;
+    }
+
+    // Split the template arguments of the member function object at the top level
+    vector<string> args;
+    string arg;
+    int level = 0;
+    for(size_t i = pos + 1; i < typeName.size(); ++i){
+        const char c = typeName[i];
+        if(c == '<' || c == '(' || c == '['){
+            ++level;
+        } else if(c == '>' || c == ')' || c == ']'){
+            if(level == 0){
+                args.push_back(arg);
+                break;
+            }
+            --level;
+        } else if(c == ',' && level == 0){
+            args.push_back(arg);
+            arg.clear();
+            continue;
+        }
+        if(c != ' ' || !arg.empty()){
+            arg += c;
+        }
+    }
+    if(args.size() < 2){
+        return typeName;
+    }
+
+    // The arguments are the return type, the class and the parameter types
+    string shortName = args[1] + " member function (";
+    for(size_t i = 2; i < args.size(); ++i){
+        if(i > 2){
+            shortName += ", ";
+        }
+        shortName += args[i];
+    }
+    shortName += ")";
+    return shortName;
+}
+
+
+const char* getEventTypeName(int type)
+{
+    switch(type){
+    case QEvent::Timer: return "Timer";
+    case QEvent::MouseButtonPress: return "MouseButtonPress";
+    case QEvent::MouseButtonRelease: return "MouseButtonRelease";
+    case QEvent::MouseButtonDblClick: return "MouseButtonDblClick";
+    case QEvent::MouseMove: return "MouseMove";
+    case QEvent::KeyPress: return "KeyPress";
+    case QEvent::KeyRelease: return "KeyRelease";
+    case QEvent::FocusIn: return "FocusIn";
+    case QEvent::FocusOut: return "FocusOut";
+    case QEvent::Enter: return "Enter";
+    case QEvent::Leave: return "Leave";
+    case QEvent::Paint: return "Paint";
+    case QEvent::Move: return "Move";
+    case QEvent::Resize: return "Resize";
+    case QEvent::Show: return "Show";
+    case QEvent::Hide: return "Hide";
+    case QEvent::Close: return "Close";
+    case QEvent::Wheel: return "Wheel";
+    case QEvent::UpdateRequest: return "UpdateRequest";
+    case QEvent::LayoutRequest: return "LayoutRequest";
+    case QEvent::ContextMenu: return "ContextMenu";
+    case QEvent::DeferredDelete: return "DeferredDelete";
+    case QEvent::Drop: return "Drop";
+    case QEvent::SockAct: return "SockAct";
+    case QEvent::MetaCall: return "MetaCall";
+    case QEvent::Shortcut: return "Shortcut";
+    default:
+        break;
+    }
+    if(type >= QEvent::User && type <= QEvent::MaxUser){
+        return "User";
+    }
+    return 0;
+}
+
+
+string getLabel(const Entry& entry)
+{
+    string label;
+
+    if(entry.eventType >= 0){
+        const char* typeName = getEventTypeName(entry.eventType);
+        if(typeName){
+            label = str(format("%1% event") % typeName);
+        } else {
+            label = str(format("Event %1%") % entry.eventType);
+        }
+        if(entry.name){
+            label += " to ";
+            label += entry.name;
+        }
+    } else {
+        label = entry.category;
+        if(entry.name){
+            label += " ";
+            if(entry.isTypeName){
+                label += getFunctionTypeName(entry.name);
+            } else {
+                label += entry.name;
+            }
+        }
+    }
+
+    return label;
+}
+
+
+void pushEntry(const char* category, const char* name, bool isTypeName, int eventType)
+{
+    Entry entry;
+    entry.category = category;
+    entry.name = name;
+    entry.isTypeName = isTypeName;
+    entry.eventType = eventType;
+    entry.beginTime = currentTime();
+    entry.idleTimeAtBegin = idleTime;
+
+    boost::mutex::scoped_lock lock(stackMutex);
+    if(entryStack.empty()){
+        busySince = toMicroseconds(entry.beginTime);
+    }
+    entryStack.push_back(entry);
+}
+
+
+bool compareRecords(const Record& r1, const Record& r2)
+{
+    if(r1.beginTime == r2.beginTime){
+        return r1.depth < r2.depth;
+    }
+    return r1.beginTime < r2.beginTime;
+}
+
+
+void putMessage(const string& message)
+{
+    MessageView::instance()->put(MessageView::WARNING, message);
+}
+
+
+void outputRecords(double blockedTime)
+{
+    std::sort(records.begin(), records.end(), compareRecords);
+
+    ostringstream os;
+    os << format(_("The event loop was blocked for %1$.1f ms by the following handlers:\n"))
+        % (blockedTime * 1000.0);
+    for(size_t i = 0; i < records.size(); ++i){
+        const Record& record = records[i];
+        os << string(record.depth * 2 + 2, ' ')
+           << format("%1$.1f ms  %2%\n") % (record.time * 1000.0) % record.label;
+    }
+
+    // The message view may emit signals, so the message is put after the current handler
+    callLater(boost::bind(putMessage, os.str()));
+}
+
+
+void onAboutToBlock()
+{
+    if(!entryStack.empty()){
+        idleBeginTime = currentTime();
+        busySince = 0;
+    }
+}
+
+
+void onAwake()
+{
+    if(idleBeginTime > 0.0){
+        const double now = currentTime();
+        idleTime += now - idleBeginTime;
+        idleBeginTime = 0.0;
+        if(!entryStack.empty()){
+            busySince = toMicroseconds(now);
+        }
+    }
+}
+
+
+void connectEventDispatcher()
+{
+#if QT_VERSION >= 0x050000
+    if(!isEventDispatcherConnected){
+        QAbstractEventDispatcher* dispatcher = QAbstractEventDispatcher::instance();
+        if(dispatcher){
+            QObject::connect(dispatcher, &QAbstractEventDispatcher::aboutToBlock, onAboutToBlock);
+            QObject::connect(dispatcher, &QAbstractEventDispatcher::awake, onAwake);
+            isEventDispatcherConnected = true;
+        }
+    }
+#endif
+}
+
+
+void runWatchdog()
+{
+    long long reportedBusySince = 0;
+
+    boost::unique_lock<boost::mutex> lock(watchdogMutex);
+
+    while(!isWatchdogStopRequested){
+        watchdogCondition.timed_wait(lock, boost::posix_time::milliseconds(100));
+
+        const long long since = busySince;
+        if(since == 0 || since == reportedBusySince){
+            continue;
+        }
+        const double blockedTime = currentTime() - since * 1.0e-6;
+        if(blockedTime < hangTime_){
+            continue;
+        }
+        reportedBusySince = since;
+
+        vector<Entry> entries;
+        {
+            boost::mutex::scoped_lock stackLock(stackMutex);
+            entries = entryStack;
+        }
+        ostringstream os;
+        os << format(_("The event loop has been blocked for %1$.1f s. The following handlers are being executed:\n"))
+            % blockedTime;
+        for(size_t i = 0; i < entries.size(); ++i){
+            os << string(i * 2 + 2, ' ') << getLabel(entries[i]) << "\n";
+        }
+        cerr << os.str();
+        cerr.flush();
+    }
+}
+
+
+void startWatchdog()
+{
+    if(hangTime_ > 0.0 && watchdogThread.get_id() == boost::thread::id()){
+        isWatchdogStopRequested = false;
+        watchdogThread = boost::thread(runWatchdog);
+    }
+}
+
+
+void stopWatchdog()
+{
+    if(watchdogThread.joinable()){
+        {
+            boost::unique_lock<boost::mutex> lock(watchdogMutex);
+            isWatchdogStopRequested = true;
+        }
+        watchdogCondition.notify_all();
+        watchdogThread.join();
+        watchdogThread = boost::thread();
+    }
+}
+
+}
+
+
+void EventLoopMonitor::setEnabled(bool on)
+{
+    if(on != isEnabled_){
+        isEnabled_ = on;
+        if(on){
+            connectEventDispatcher();
+            startWatchdog();
+        } else {
+            stopWatchdog();
+        }
+    }
+}
+
+
+void EventLoopMonitor::setThreshold(double time)
+{
+    thresholdTime = time;
+}
+
+
+double EventLoopMonitor::threshold()
+{
+    return thresholdTime;
+}
+
+
+void EventLoopMonitor::setHangTime(double time)
+{
+    hangTime_ = time;
+    if(isEnabled_){
+        if(time > 0.0){
+            startWatchdog();
+        } else {
+            stopWatchdog();
+        }
+    }
+}
+
+
+double EventLoopMonitor::hangTime()
+{
+    return hangTime_;
+}
+
+
+namespace {
+
+bool compareStatistics(const StatisticsMap::const_iterator& p1, const StatisticsMap::const_iterator& p2)
+{
+    return p1->second.totalTime > p2->second.totalTime;
+}
+
+}
+
+
+void EventLoopMonitor::putReport(std::ostream& os)
+{
+    vector<StatisticsMap::const_iterator> items;
+    size_t width = 7;
+    for(StatisticsMap::const_iterator p = statisticsMap.begin(); p != statisticsMap.end(); ++p){
+        items.push_back(p);
+        width = std::max(width, p->first.size());
+    }
+    std::sort(items.begin(), items.end(), compareStatistics);
+
+    const string handlerFormat = str(format("%%-%1%s") % width);
+
+    os << format(handlerFormat) % "Handler" << "   Count  Total [ms]    Max [ms]\n";
+    for(size_t i = 0; i < items.size(); ++i){
+        const Statistics& s = items[i]->second;
+        os << format(handlerFormat) % items[i]->first
+           << format(" %7d %11.3f %11.3f\n") % s.count % (s.totalTime * 1000.0) % (s.maxTime * 1000.0);
+    }
+    os.flush();
+}
+
+
+void EventLoopMonitor::clear()
+{
+    statisticsMap.clear();
+}
+
+
+void EventLoopMonitor::Scope::begin(const char* category, const char* name, bool isTypeName)
+{
+    if(!isRunningInMainThread()){
+        isActive = false;
+        return;
+    }
+    isActive = true;
+    pushEntry(category, name, isTypeName, -1);
+}
+
+
+void EventLoopMonitor::Scope::begin(QObject* receiver, QEvent* event)
+{
+    if(!isRunningInMainThread()){
+        isActive = false;
+        return;
+    }
+    isActive = true;
+    const char* className = receiver ? receiver->metaObject()->className() : 0;
+    pushEntry("Event", className, false, event->type());
+}
+
+
+void EventLoopMonitor::Scope::end()
+{
+    Entry entry;
+    int depth;
+    {
+        boost::mutex::scoped_lock lock(stackMutex);
+        entry = entryStack.back();
+        entryStack.pop_back();
+        depth = entryStack.size();
+    }
+
+    const double time = currentTime() - entry.beginTime - (idleTime - entry.idleTimeAtBegin);
+
+    if(time >= thresholdTime){
+        Record record;
+        record.label = getLabel(entry);
+        record.time = time;
+        record.beginTime = entry.beginTime;
+        record.depth = depth;
+        records.push_back(record);
+
+        Statistics& s = statisticsMap[record.label];
+        ++s.count;
+        s.totalTime += time;
+        s.maxTime = std::max(s.maxTime, time);
+    }
+
+    if(depth == 0){
+        busySince = 0;
+        if(!records.empty()){
+            outputRecords(time);
+            records.clear();
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BASE_EVENT_LOOP_MONITOR_H
+#define CNOID_BASE_EVENT_LOOP_MONITOR_H
+
+#include <typeinfo>
+#include <iosfwd>
+#include "exportdecl.h"
+
+class QObject;
+class QEvent;
+
+namespace cnoid {
+
+/**
+   This class measures how long the handlers in the main thread block the event loop.
+   A handler is a Qt event delivered by the application, a function called by LazyCaller,
+   QueuedCaller or callLater(), or a part of the code marked by a Scope object such as the
+   emission of a signal of an item. When a top-level handler or a nested one takes longer
+   than the threshold, the handlers which exceeded it are reported to the message view
+   as a tree. The statistics of the reported handlers are given by putReport().
+
+   The time in which a nested event loop such as the one of a modal dialog waits for events
+   is not counted with Qt5.
+
+   The watchdog thread reports the handlers being executed to the standard error output
+   when the event loop is blocked longer than the hang time, so that a hang is reported
+   even if the handler does not finish.
+
+   Nothing is measured unless the monitor is enabled, so the scopes can be left in the code.
+   Only the scopes in the main thread are measured.
+*/
+class CNOID_EXPORT EventLoopMonitor
+{
+public:
+    static void setEnabled(bool on);
+    static bool isEnabled() { return isEnabled_; }
+
+    //! \param time The time in seconds. The default value is 0.1.
+    static void setThreshold(double time);
+    static double threshold();
+
+    //! \param time The time in seconds. Zero disables the watchdog. The default value is 5.0.
+    static void setHangTime(double time);
+    static double hangTime();
+
+    //! The count, the total time and the max time of each kind of the reported handlers
+    static void putReport(std::ostream& os);
+    static void clear();
+
+    class CNOID_EXPORT Scope
+    {
+    public:
+        //! \param name The name of the target such as a signal. This must be a static string.
+        Scope(const char* category, const char* name = 0) {
+            if(isEnabled_){
+                begin(category, name, false);
+            } else {
+                isActive = false;
+            }
+        }
+        //! The target is given by a type, such as the class of an item or the type of a function object
+        Scope(const char* category, const std::type_info& type) {
+            if(isEnabled_){
+                begin(category, type.name(), true);
+            } else {
+                isActive = false;
+            }
+        }
+        //! The scope of a Qt event delivered to the receiver
+        Scope(QObject* receiver, QEvent* event) {
+            if(isEnabled_){
+                begin(receiver, event);
+            } else {
+                isActive = false;
+            }
+        }
+        ~Scope() {
+            if(isActive){
+                end();
+            }
+        }
+    private:
+        bool isActive;
+
+        void begin(const char* category, const char* name, bool isTypeName);
+        void begin(QObject* receiver, QEvent* event);
+        void end();
+
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+    };
+
+private:
+    static bool isEnabled_;
+};
+
+}
+
+#endif
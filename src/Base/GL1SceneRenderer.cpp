@@ -10,11 +10,22 @@
 #include <cnoid/SceneEffects>
 #include <cnoid/EigenUtil>
 #include <cnoid/NullOut>
+#include <cnoid/Image>
+#include <cnoid/MemoryUsageCounter>
 #include <Eigen/StdVector>
 #include <boost/unordered_map.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <deque>
+#include <map>
+#include <typeinfo>
+#include <cstring>
 #include <iostream>
 
 /**
@@ -25,6 +36,14 @@
 
 #include <GL/glu.h>
 
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
 using namespace std;
 using namespace cnoid;
 
@@ -39,6 +58,18 @@ const float MinLineWidthForPicking = 5.0f;
 
 typedef vector<Affine3, Eigen::aligned_allocator<Affine3> > Affine3Array;
 
+MemoryUsageCounter& bufferMemoryUsageCounter()
+{
+    static MemoryUsageCounter counter("GL1 renderer batch buffers");
+    return counter;
+}
+
+MemoryUsageCounter& textureMemoryUsageCounter()
+{
+    static MemoryUsageCounter counter("GL1 renderer textures");
+    return counter;
+}
+
 struct TransparentShapeInfo
 {
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -49,6 +80,178 @@ struct TransparentShapeInfo
 typedef boost::shared_ptr<TransparentShapeInfo> TransparentShapeInfoPtr;
 
     
+/*
+  The triangles of the shapes in an invariant group which have the same material, texture and
+  solidity. The vertices are given in the coordinate of the group.
+*/
+struct ShapeBatch
+{
+    SgMaterialPtr material;
+    SgTexturePtr texture;
+    bool isSolid;
+    vector<Vector3f> vertices;
+    vector<Vector3f> normals;
+    vector<Vector2f, Eigen::aligned_allocator<Vector2f> > texCoords;
+    GLuint bufferNames[3];
+    GLsizei numVertices;
+
+    ShapeBatch() {
+        for(int i=0; i < 3; ++i){
+            bufferNames[i] = GL_INVALID_VALUE;
+        }
+        numVertices = 0;
+    }
+    GLuint& vertexBufferName() { return bufferNames[0]; }
+    GLuint& normalBufferName() { return bufferNames[1]; }
+    GLuint& texCoordBufferName() { return bufferNames[2]; }
+};
+typedef boost::shared_ptr<ShapeBatch> ShapeBatchPtr;
+
+
+/*
+  The batches of an invariant group, which are built by the batching thread and uploaded to the
+  buffer objects in the rendering thread. The state is only changed from BATCH_BUILDING by the
+  batching thread.
+*/
+class ShapeBatchSet
+{
+public:
+    enum State { BATCH_BUILDING, BATCH_BUILT, BATCH_UPLOADED, BATCH_UNAVAILABLE };
+    
+    SgInvariantGroupPtr group;
+    boost::atomic<int> state;
+    vector<ShapeBatchPtr> batches;
+    // The total size of the buffer objects counted in the memory usage counter
+    size_t bufferBytes;
+
+    ShapeBatchSet(SgInvariantGroup* group) : group(group), state(BATCH_BUILDING), bufferBytes(0) { }
+
+    //! This must be called in the rendering thread
+    void deleteBuffers() {
+        // The buffers only exist after the batching thread finishes the set
+        if(state.load(boost::memory_order_acquire) != BATCH_UPLOADED){
+            return;
+        }
+        for(size_t i=0; i < batches.size(); ++i){
+            ShapeBatch& batch = *batches[i];
+            for(int j=0; j < 3; ++j){
+                if(batch.bufferNames[j] != GL_INVALID_VALUE){
+                    glDeleteBuffers(1, &batch.bufferNames[j]);
+                    batch.bufferNames[j] = GL_INVALID_VALUE;
+                }
+            }
+        }
+        bufferMemoryUsageCounter().subtract(bufferBytes);
+        bufferBytes = 0;
+    }
+};
+typedef boost::shared_ptr<ShapeBatchSet> ShapeBatchSetPtr;
+
+
+class ShapeBatchBuilder
+{
+    typedef std::map<boost::tuple<SgMaterial*, SgTexture*, bool>, int> BatchIndexMap;
+    BatchIndexMap batchIndexMap;
+    vector<ShapeBatchPtr>* batches;
+    
+public:
+    bool build(ShapeBatchSet& batchSet) {
+        batches = &batchSet.batches;
+        batchIndexMap.clear();
+        Affine3 T = Affine3::Identity();
+        return extractGroup(batchSet.group, T);
+    }
+
+private:
+    bool extractGroup(SgGroup* group, const Affine3& T) {
+        for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
+            SgNode* node = *p;
+            if(SgShape* shape = dynamic_cast<SgShape*>(node)){
+                if(!extractShape(shape, T)){
+                    return false;
+                }
+            } else if(SgTransform* transform = dynamic_cast<SgTransform*>(node)){
+                Affine3 T1;
+                transform->getTransform(T1);
+                if(!extractGroup(transform, T * T1)){
+                    return false;
+                }
+            } else if(typeid(*node) == typeid(SgGroup) || typeid(*node) == typeid(SgInvariantGroup)){
+                if(!extractGroup(static_cast<SgGroup*>(node), T)){
+                    return false;
+                }
+            } else {
+                // The other nodes need the traversal by the renderer
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool extractShape(SgShape* shape, const Affine3& T) {
+        SgMesh* mesh = shape->mesh();
+        if(!mesh || !mesh->hasVertices()){
+            return true;
+        }
+        SgMaterial* material = shape->material();
+        // The transparent shapes must be sorted and the colors are set per vertex
+        if((material && material->transparency() > 0.0) || mesh->hasColors()){
+            return false;
+        }
+        SgTexture* texture = mesh->hasTexCoords() ? shape->texture() : 0;
+        
+        const boost::tuple<SgMaterial*, SgTexture*, bool> key(material, texture, mesh->isSolid());
+        BatchIndexMap::iterator p = batchIndexMap.find(key);
+        if(p == batchIndexMap.end()){
+            p = batchIndexMap.insert(BatchIndexMap::value_type(key, batches->size())).first;
+            ShapeBatchPtr batch = boost::make_shared<ShapeBatch>();
+            batch->material = material;
+            batch->texture = texture;
+            batch->isSolid = mesh->isSolid();
+            batches->push_back(batch);
+        }
+        ShapeBatch& batch = *(*batches)[p->second];
+
+        const Affine3f Tf = T.cast<float>();
+        const Matrix3f N = Tf.linear().inverse().transpose();
+        // The order of the vertices is reversed by a mirroring transform
+        const bool isMirrored = (Tf.linear().determinant() < 0.0f);
+        const SgVertexArray& vertices = *mesh->vertices();
+        const SgIndexArray& triangleVertices = mesh->triangleVertices();
+        const SgIndexArray& normalIndices = mesh->normalIndices();
+        const SgIndexArray& texCoordIndices = mesh->texCoordIndices();
+        const bool hasNormals = mesh->hasNormals();
+        const int numTriangles = mesh->numTriangles();
+        
+        for(int i=0; i < numTriangles; ++i){
+            Vector3f v[3];
+            for(int j=0; j < 3; ++j){
+                v[j] = Tf * vertices[triangleVertices[i * 3 + j]];
+            }
+            const Vector3f faceNormal = (v[1] - v[0]).cross(v[2] - v[0]).normalized();
+            for(int k=0; k < 3; ++k){
+                const int j = (isMirrored && k > 0) ? (3 - k) : k;
+                const int faceVertexIndex = i * 3 + j;
+                batch.vertices.push_back(v[j]);
+                if(!hasNormals){
+                    batch.normals.push_back(isMirrored ? Vector3f(-faceNormal) : faceNormal);
+                } else {
+                    const int normalIndex =
+                        normalIndices.empty() ? triangleVertices[faceVertexIndex] : normalIndices[faceVertexIndex];
+                    batch.normals.push_back((N * mesh->normals()->at(normalIndex)).normalized());
+                }
+                if(texture){
+                    const int texCoordIndex =
+                        texCoordIndices.empty() ? triangleVertices[faceVertexIndex] : texCoordIndices[faceVertexIndex];
+                    batch.texCoords.push_back(mesh->texCoords()->at(texCoordIndex));
+                }
+            }
+        }
+        return true;
+    }
+};
+
+    
 /*
   A set of variables associated with a scene node
 */
@@ -56,16 +259,13 @@ class ShapeCache : public Referenced
 {
 public:
     GLuint listID;
-    GLuint listIDforPicking;
-    bool useIDforPicking;
     GLuint bufferNames[4];
     GLuint size;
     vector<TransparentShapeInfoPtr> transparentShapes;
+    ShapeBatchSetPtr batchSet;
 
     ShapeCache() {
         listID = 0;
-        useIDforPicking = false;
-        listIDforPicking = 0;
         for(int i=0; i < 4; ++i){
             bufferNames[i] = GL_INVALID_VALUE;
         }
@@ -74,8 +274,8 @@ public:
         if(listID){
             glDeleteLists(listID, 1);
         }
-        if(listIDforPicking){
-            glDeleteLists(listIDforPicking, 1);
+        if(batchSet){
+            batchSet->deleteBuffers();
         }
         for(int i=0; i < 4; ++i){
             if(bufferNames[i] != GL_INVALID_VALUE){
@@ -96,26 +296,44 @@ class TextureCache : public Referenced
 public:
     bool isBound;
     bool isImageUpdateNeeded;
+    bool hasMipmaps;
+    bool isCompressed;
     GLuint textureName;
     int width;
     int height;
     int numComponents;
+    // The size of the texture image counted in the memory usage counter
+    size_t textureBytes;
         
     TextureCache(){
         isBound = false;
         isImageUpdateNeeded = true;
+        hasMipmaps = false;
+        isCompressed = false;
         width = 0;
         height = 0;
         numComponents = 0;
+        textureBytes = 0;
     }
     bool isSameSizeAs(const Image& image){
         return (width == image.width() && height == image.height() && numComponents == image.numComponents());
     }
             
+    //! The mipmaps are estimated to add one third of the size of the base image
+    void setTextureBytes(size_t size){
+        if(hasMipmaps){
+            size += size / 3;
+        }
+        textureMemoryUsageCounter().subtract(textureBytes);
+        textureMemoryUsageCounter().add(size);
+        textureBytes = size;
+    }
+            
     ~TextureCache(){
         if(isBound){
             glDeleteTextures(1, &textureName);
         }
+        textureMemoryUsageCounter().subtract(textureBytes);
     }
 };
 typedef ref_ptr<TextureCache> TextureCachePtr;
@@ -139,6 +357,17 @@ public:
         
     GL1SceneRenderer* self;
 
+    struct ImageReading {
+        GLuint buffer;
+        int width;
+        int height;
+        ImageReading() : buffer(0), width(0), height(0) { }
+    };
+    static const int MaxNumImageReadings = 3;
+    ImageReading imageReadings[MaxNumImageReadings];
+    int imageReadingHead;
+    int numImageReadings;
+
     Affine3Array Vstack; // stack of the model/view matrices
 
     typedef vector<Vector4f, Eigen::aligned_allocator<Vector4f> > ColorArray;
@@ -182,6 +411,8 @@ public:
     GLint maxLights;
     bool defaultSmoothShading;
     bool isTextureEnabled;
+    int numTextureBytesUploaded;
+    bool isTextureUploadDeferred;
     SgMaterialPtr defaultMaterial;
     GLfloat defaultPointSize;
     GLfloat defaultLineWidth;
@@ -191,10 +422,30 @@ public:
     double normalLength;
 
     bool isCompiling;
+    bool isRenderingOverlay;
     bool isNewDisplayListDoubleRenderingEnabled;
     bool isNewDisplayListCreated;
     bool isPicking;
 
+    // for the batching of the static shapes
+    bool isStaticShapeBatchingEnabled;
+    bool isShapeBatchingPending;
+    boost::thread batchingThread;
+    boost::mutex batchingMutex;
+    boost::condition_variable batchingCondition;
+    std::deque<ShapeBatchSetPtr> batchingQueue;
+    bool isBatchingThreadActive;
+    bool isBatchingThreadStopRequested;
+
+    // for the rendering statistics
+    int numDrawCalls;
+    bool isGPUTimerSupported;
+    bool isGPUTimerEnabled;
+    GLuint gpuTimerQueries[2];
+    bool isGPUTimerQueryIssued[2];
+    int gpuTimerQueryIndex;
+    double gpuTime;
+
     GLdouble pickX;
     GLdouble pickY;
     typedef boost::shared_ptr<SgNodePath> SgNodePathPtr;
@@ -204,6 +455,7 @@ public:
     Vector3 pickedPoint;
 
     vector<TransparentShapeInfoPtr> transparentShapeInfos;
+    vector<SgPointSet*> lodPointSets;
 
     // OpenGL states
     enum StateFlag {
@@ -253,22 +505,34 @@ public:
     void beginRendering(bool doRenderingCommands);
     void beginActualRendering(SgCamera* camera);
     void renderCamera(SgCamera* camera, const Affine3& cameraPosition);
+    bool isOutsideFrustum(const BoundingBox& bbox);
     void renderLights(const Affine3& cameraPosition);
     void renderLight(const SgLight* light, GLint id, const Affine3& T);
     void renderFog();
     void onCurrentFogNodeUdpated();
     void endRendering();
     void render();
+    void beginGPUTimer();
+    void endGPUTimer();
     bool pick(int x, int y);
+    bool startImageReading();
+    bool takeReadImage(Image& out_image);
     inline void setPickColor(unsigned int id);
     inline unsigned int pushPickName(SgNode* node, bool doSetColor = true);
     void popPickName();
     void visitInvariantGroup(SgInvariantGroup* group);
+    bool renderShapeBatchSet(SgInvariantGroup* group, ShapeCache* cache);
+    void requestShapeBatchSet(SgInvariantGroup* group, ShapeCache* cache);
+    void runBatchingThread();
+    void stopBatchingThread();
+    void uploadShapeBatchSet(ShapeBatchSet& batchSet);
+    void drawShapeBatchSet(ShapeBatchSet& batchSet);
     void visitShape(SgShape* shape);
     void visitPointSet(SgPointSet* pointSet);
     void renderPlot(SgPlot* plot, SgVertexArray& expandedVertices, GLenum primitiveMode);
     void visitLineSet(SgLineSet* lineSet);
     void renderMaterial(const SgMaterial* material);
+    bool isTextureUploadBudgetExhausted() const;
     bool renderTexture(SgTexture* texture, bool withMaterial);
     void putMeshData(SgMesh* mesh);
     void renderMesh(SgMesh* mesh, bool hasTexture);
@@ -346,6 +610,8 @@ GL1SceneRendererImpl::GL1SceneRendererImpl(GL1SceneRenderer* self)
     defaultSmoothShading = true;
     defaultMaterial = new SgMaterial;
     isTextureEnabled = true;
+    numTextureBytesUploaded = 0;
+    isTextureUploadDeferred = false;
     defaultPointSize = 1.0f;
     defaultLineWidth = 1.0f;
     
@@ -353,11 +619,28 @@ GL1SceneRendererImpl::GL1SceneRendererImpl(GL1SceneRenderer* self)
     normalLength = 0.0;
 
     isCompiling = false;
+    isRenderingOverlay = false;
     isNewDisplayListDoubleRenderingEnabled = false;
     isNewDisplayListCreated = false;
     isPicking = false;
     pickedPoint.setZero();
 
+    isStaticShapeBatchingEnabled = true;
+    isShapeBatchingPending = false;
+    isBatchingThreadActive = false;
+    isBatchingThreadStopRequested = false;
+
+    numDrawCalls = 0;
+    isGPUTimerSupported = false;
+    isGPUTimerEnabled = false;
+    gpuTimerQueries[0] = gpuTimerQueries[1] = 0;
+    isGPUTimerQueryIssued[0] = isGPUTimerQueryIssued[1] = false;
+    gpuTimerQueryIndex = 0;
+    gpuTime = -1.0;
+
+    imageReadingHead = 0;
+    numImageReadings = 0;
+
     stateFlag.resize(NUM_STATE_FLAGS, false);
     clearGLState();
 
@@ -373,7 +656,7 @@ GL1SceneRenderer::~GL1SceneRenderer()
 
 GL1SceneRendererImpl::~GL1SceneRendererImpl()
 {
-
+    stopBatchingThread();
 }
 
 
@@ -420,6 +703,10 @@ bool GL1SceneRendererImpl::initializeGL()
 
     glGenTextures(1, &defaultTextureName);
 
+    const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    isGPUTimerSupported =
+        extensions && (strstr(extensions, "GL_ARB_timer_query") || strstr(extensions, "GL_EXT_timer_query"));
+
     return true;
 }
 
@@ -440,6 +727,11 @@ void GL1SceneRendererImpl::beginRendering(bool doRenderingCommands)
 {
     isCheckingUnusedCaches = isPicking ? false : doUnusedCacheCheck;
 
+    numTextureBytesUploaded = 0;
+    isTextureUploadDeferred = false;
+    isShapeBatchingPending = false;
+    numDrawCalls = 0;
+
     if(isCacheClearRequested){
         cacheMaps[0].clear();
         cacheMaps[1].clear();
@@ -560,6 +852,21 @@ void GL1SceneRendererImpl::renderCamera(SgCamera* camera, const Affine3& cameraP
     const Affine3& V = Vstack.back();
     lastViewMatrix = V;
     glLoadMatrixd(V.data());
+
+    self->setFrustumCullingMatrix(lastProjectionMatrix);
+}
+
+
+/**
+   The culling is not done while the display lists are compiled because they are
+   rendered later with other camera positions.
+*/
+bool GL1SceneRendererImpl::isOutsideFrustum(const BoundingBox& bbox)
+{
+    if(!self->isFrustumCullingEnabled() || isCompiling || isRenderingOverlay){
+        return false;
+    }
+    return !self->isInFrustum(bbox, Vstack.back());
 }
 
 
@@ -722,6 +1029,10 @@ void GL1SceneRendererImpl::endRendering()
     if(isNewDisplayListDoubleRenderingEnabled && isNewDisplayListCreated){
         self->scene()->notifyUpdate();
     }
+
+    if(isTextureUploadDeferred || isShapeBatchingPending){
+        self->sigRenderingRequest()();
+    }
 }
 
 
@@ -733,6 +1044,10 @@ void GL1SceneRenderer::render()
 
 void GL1SceneRendererImpl::render()
 {
+    if(isGPUTimerEnabled){
+        beginGPUTimer();
+    }
+    
     beginRendering(true);
 
     self->sceneRoot()->accept(*self);
@@ -742,6 +1057,72 @@ void GL1SceneRendererImpl::render()
     }
 
     endRendering();
+
+    if(isGPUTimerEnabled){
+        endGPUTimer();
+    }
+}
+
+
+int GL1SceneRenderer::numDrawCalls() const
+{
+    return impl->numDrawCalls;
+}
+
+
+bool GL1SceneRenderer::enableGPUTimer(bool on)
+{
+    impl->isGPUTimerEnabled = on && impl->isGPUTimerSupported;
+    if(!impl->isGPUTimerEnabled){
+        impl->gpuTime = -1.0;
+    }
+    return impl->isGPUTimerSupported;
+}
+
+
+double GL1SceneRenderer::gpuTime() const
+{
+    return impl->gpuTime;
+}
+
+
+/**
+   The two query objects are used alternately so that the result of the query of the previous
+   frame, which has usually been completed, is obtained without waiting for the GPU.
+*/
+void GL1SceneRendererImpl::beginGPUTimer()
+{
+    if(!gpuTimerQueries[0]){
+        glGenQueries(2, gpuTimerQueries);
+    }
+    GLuint query = gpuTimerQueries[gpuTimerQueryIndex];
+    if(isGPUTimerQueryIssued[gpuTimerQueryIndex]){
+        GLuint nanoseconds;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &nanoseconds);
+        gpuTime = nanoseconds * 1.0e-9;
+        isGPUTimerQueryIssued[gpuTimerQueryIndex] = false;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+
+void GL1SceneRendererImpl::endGPUTimer()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    isGPUTimerQueryIssued[gpuTimerQueryIndex] = true;
+    gpuTimerQueryIndex = 1 - gpuTimerQueryIndex;
+
+    if(isGPUTimerQueryIssued[gpuTimerQueryIndex]){
+        GLuint query = gpuTimerQueries[gpuTimerQueryIndex];
+        GLuint isAvailable = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+        if(isAvailable){
+            GLuint nanoseconds;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &nanoseconds);
+            gpuTime = nanoseconds * 1.0e-9;
+            isGPUTimerQueryIssued[gpuTimerQueryIndex] = false;
+        }
+    }
 }
 
 
@@ -812,6 +1193,87 @@ const Vector3& GL1SceneRenderer::pickedPoint() const
     return impl->pickedPoint;
 }
 
+bool GL1SceneRenderer::startImageReading()
+{
+    return impl->startImageReading();
+}
+
+
+bool GL1SceneRendererImpl::startImageReading()
+{
+    if(numImageReadings == MaxNumImageReadings){
+        return false;
+    }
+    int x, y, width, height;
+    self->getViewport(x, y, width, height);
+    if(width <= 0 || height <= 0){
+        return false;
+    }
+    const int index = (imageReadingHead + numImageReadings) % MaxNumImageReadings;
+    ImageReading& reading = imageReadings[index];
+    if(!reading.buffer){
+        glGenBuffers(1, &reading.buffer);
+        if(!reading.buffer){
+            return false;
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, reading.buffer);
+    if(width != reading.width || height != reading.height){
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, 0, GL_STREAM_READ);
+        reading.width = width;
+        reading.height = height;
+    }
+    GLint alignment;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    ++numImageReadings;
+    return true;
+}
+
+
+bool GL1SceneRenderer::takeReadImage(Image& out_image)
+{
+    return impl->takeReadImage(out_image);
+}
+
+
+bool GL1SceneRendererImpl::takeReadImage(Image& out_image)
+{
+    if(numImageReadings == 0){
+        return false;
+    }
+    ImageReading& reading = imageReadings[imageReadingHead];
+    imageReadingHead = (imageReadingHead + 1) % MaxNumImageReadings;
+    --numImageReadings;
+
+    bool result = false;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, reading.buffer);
+    const unsigned char* pixels = static_cast<const unsigned char*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if(pixels){
+        // The rows are stored from the bottom in the frame buffer
+        out_image.setSize(reading.width, reading.height, 3);
+        const int rowSize = reading.width * 3;
+        unsigned char* dest = out_image.pixels();
+        for(int i=0; i < reading.height; ++i){
+            std::copy(pixels + (reading.height - i - 1) * rowSize, pixels + (reading.height - i) * rowSize, dest + i * rowSize);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        result = true;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return result;
+}
+
+
+int GL1SceneRenderer::numPendingImageReadings() const
+{
+    return impl->numImageReadings;
+}
+
 
 
 inline void GL1SceneRendererImpl::setPickColor(unsigned int id)
@@ -884,7 +1346,28 @@ void GL1SceneRendererImpl::visitInvariantGroup(SgInvariantGroup* group)
             cache = static_cast<ShapeCache*>(p->second.get());
         }
 
-        if(!cache->listID && !isPicking){
+        if(isStaticShapeBatchingEnabled && renderShapeBatchSet(group, cache)){
+            if(isCheckingUnusedCaches){
+                nextCacheMap->insert(CacheMap::value_type(group, cache));
+            }
+            currentShapeCache = 0;
+            return;
+        }
+
+        if(isPicking){
+            // The scene graph is traversed instead of compiling another list without the colors
+            self->visitGroup(group);
+            return;
+        }
+
+        if(!cache->listID && isTextureUploadBudgetExhausted()){
+            // The list is created in a following frame because it may include the textures to upload
+            self->visitGroup(group);
+            isTextureUploadDeferred = true;
+            return;
+        }
+
+        if(!cache->listID){
             currentShapeCache = cache;
             currentShapeCacheTopViewMatrixIndex = Vstack.size() - 1;
 
@@ -896,10 +1379,6 @@ void GL1SceneRendererImpl::visitInvariantGroup(SgInvariantGroup* group)
                 clearGLState();
                 self->visitGroup(group);
                 isCompiling = false;
-
-                if(stateFlag[LIGHTING] || stateFlag[CURRENT_COLOR]){
-                    cache->useIDforPicking = true;
-                }
                 glEndList();
 
                 isNewDisplayListCreated = true;
@@ -909,41 +1388,24 @@ void GL1SceneRendererImpl::visitInvariantGroup(SgInvariantGroup* group)
         GLuint listID = cache->listID;
 
         if(listID){
-            if(isPicking && cache->useIDforPicking){
-                if(!cache->listIDforPicking){
-                    currentShapeCache = cache;
-                    currentShapeCacheTopViewMatrixIndex = Vstack.size() - 1;
-                    cache->listIDforPicking = glGenLists(1);
-                    if(cache->listIDforPicking){
-                        glNewList(cache->listIDforPicking, GL_COMPILE);
-                        isCompiling = true;
-                        clearGLState();
-                        self->visitGroup(group);
-                        isCompiling = false;
-                        glEndList();
-                    }
-                }
-                listID = cache->listIDforPicking;
-            }
-            if(listID){
-                const unsigned int pickId = pushPickName(group);
-                glPushAttrib(GL_ENABLE_BIT);
-                glCallList(listID);
-                glPopAttrib();
-                clearGLState();
-                popPickName();
-
-                const vector<TransparentShapeInfoPtr>& transparentShapes = cache->transparentShapes;
-                if(!transparentShapes.empty()){
-                    const Affine3& V = Vstack.back();
-                    for(size_t i=0; i < transparentShapes.size(); ++i){
-                        const TransparentShapeInfo& src = *transparentShapes[i];
-                        TransparentShapeInfoPtr info = make_shared_aligned<TransparentShapeInfo>();
-                        info->shape = src.shape;
-                        info->pickId = pickId;
-                        info->V = V * src.V;
-                        transparentShapeInfos.push_back(info);
-                    }
+            const unsigned int pickId = pushPickName(group);
+            glPushAttrib(GL_ENABLE_BIT);
+            ++numDrawCalls;
+            glCallList(listID);
+            glPopAttrib();
+            clearGLState();
+            popPickName();
+
+            const vector<TransparentShapeInfoPtr>& transparentShapes = cache->transparentShapes;
+            if(!transparentShapes.empty()){
+                const Affine3& V = Vstack.back();
+                for(size_t i=0; i < transparentShapes.size(); ++i){
+                    const TransparentShapeInfo& src = *transparentShapes[i];
+                    TransparentShapeInfoPtr info = make_shared_aligned<TransparentShapeInfo>();
+                    info->shape = src.shape;
+                    info->pickId = pickId;
+                    info->V = V * src.V;
+                    transparentShapeInfos.push_back(info);
                 }
             }
 
@@ -956,6 +1418,191 @@ void GL1SceneRendererImpl::visitInvariantGroup(SgInvariantGroup* group)
 }
 
 
+/**
+   The shapes of the group are rendered with the batches if they can be batched. While the batches
+   are being built by the batching thread, the group is rendered without compiling it.
+   \return false if the group cannot be batched and it should be rendered with a display list
+*/
+bool GL1SceneRendererImpl::renderShapeBatchSet(SgInvariantGroup* group, ShapeCache* cache)
+{
+    if(!cache->batchSet){
+        requestShapeBatchSet(group, cache);
+    }
+    ShapeBatchSet& batchSet = *cache->batchSet;
+    int state = batchSet.state.load(boost::memory_order_acquire);
+    if(state == ShapeBatchSet::BATCH_UNAVAILABLE){
+        return false;
+    }
+    if(state == ShapeBatchSet::BATCH_BUILDING){
+        self->visitGroup(group);
+        isShapeBatchingPending = true;
+        return true;
+    }
+    if(state == ShapeBatchSet::BATCH_BUILT){
+        uploadShapeBatchSet(batchSet);
+    }
+
+    pushPickName(group);
+    glPushAttrib(GL_ENABLE_BIT);
+    drawShapeBatchSet(batchSet);
+    glPopAttrib();
+    clearGLState();
+    popPickName();
+    
+    return true;
+}
+
+
+void GL1SceneRendererImpl::requestShapeBatchSet(SgInvariantGroup* group, ShapeCache* cache)
+{
+    cache->batchSet = boost::make_shared<ShapeBatchSet>(group);
+    {
+        boost::lock_guard<boost::mutex> lock(batchingMutex);
+        batchingQueue.push_back(cache->batchSet);
+    }
+    if(!isBatchingThreadActive){
+        isBatchingThreadStopRequested = false;
+        batchingThread = boost::thread(boost::bind(&GL1SceneRendererImpl::runBatchingThread, this));
+        isBatchingThreadActive = true;
+    } else {
+        batchingCondition.notify_all();
+    }
+}
+
+
+/**
+   The batches are only built from the scene graph in this thread. The buffer objects are
+   created in the rendering thread because the OpenGL context is current only in it.
+*/
+void GL1SceneRendererImpl::runBatchingThread()
+{
+    ShapeBatchBuilder builder;
+    boost::unique_lock<boost::mutex> lock(batchingMutex);
+    while(true){
+        while(batchingQueue.empty() && !isBatchingThreadStopRequested){
+            batchingCondition.wait(lock);
+        }
+        if(isBatchingThreadStopRequested){
+            break;
+        }
+        ShapeBatchSetPtr batchSet = batchingQueue.front();
+        batchingQueue.pop_front();
+        lock.unlock();
+
+        // The set is not built if its cache has already been released
+        if(!batchSet.unique()){
+            if(builder.build(*batchSet)){
+                batchSet->state.store(ShapeBatchSet::BATCH_BUILT, boost::memory_order_release);
+            } else {
+                batchSet->batches.clear();
+                batchSet->state.store(ShapeBatchSet::BATCH_UNAVAILABLE, boost::memory_order_release);
+            }
+        }
+        batchSet.reset();
+        lock.lock();
+    }
+}
+
+
+void GL1SceneRendererImpl::stopBatchingThread()
+{
+    if(isBatchingThreadActive){
+        {
+            boost::lock_guard<boost::mutex> lock(batchingMutex);
+            batchingQueue.clear();
+            isBatchingThreadStopRequested = true;
+        }
+        batchingCondition.notify_all();
+        batchingThread.join();
+        isBatchingThreadActive = false;
+    }
+}
+
+
+void GL1SceneRendererImpl::uploadShapeBatchSet(ShapeBatchSet& batchSet)
+{
+    for(size_t i=0; i < batchSet.batches.size(); ++i){
+        ShapeBatch& batch = *batchSet.batches[i];
+        batch.numVertices = batch.vertices.size();
+        if(batch.numVertices == 0){
+            continue;
+        }
+        glGenBuffers(1, &batch.vertexBufferName());
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBufferName());
+        glBufferData(GL_ARRAY_BUFFER, batch.vertices.size() * sizeof(Vector3f), batch.vertices.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &batch.normalBufferName());
+        glBindBuffer(GL_ARRAY_BUFFER, batch.normalBufferName());
+        glBufferData(GL_ARRAY_BUFFER, batch.normals.size() * sizeof(Vector3f), batch.normals.data(), GL_STATIC_DRAW);
+        if(!batch.texCoords.empty()){
+            glGenBuffers(1, &batch.texCoordBufferName());
+            glBindBuffer(GL_ARRAY_BUFFER, batch.texCoordBufferName());
+            glBufferData(GL_ARRAY_BUFFER, batch.texCoords.size() * sizeof(Vector2f), batch.texCoords.data(), GL_STATIC_DRAW);
+        }
+        const size_t bytes =
+            (batch.vertices.size() + batch.normals.size()) * sizeof(Vector3f) + batch.texCoords.size() * sizeof(Vector2f);
+        batchSet.bufferBytes += bytes;
+        bufferMemoryUsageCounter().add(bytes);
+        // The data are only kept in the buffer objects
+        vector<Vector3f>().swap(batch.vertices);
+        vector<Vector3f>().swap(batch.normals);
+        vector<Vector2f, Eigen::aligned_allocator<Vector2f> >().swap(batch.texCoords);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    batchSet.state.store(ShapeBatchSet::BATCH_UPLOADED, boost::memory_order_relaxed);
+}
+
+
+void GL1SceneRendererImpl::drawShapeBatchSet(ShapeBatchSet& batchSet)
+{
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    const bool doLighting = !isPicking && defaultLighting;
+    
+    for(size_t i=0; i < batchSet.batches.size(); ++i){
+        ShapeBatch& batch = *batchSet.batches[i];
+        if(batch.numVertices == 0){
+            continue;
+        }
+        bool hasTexture = false;
+        if(doLighting){
+            renderMaterial(batch.material);
+            if(batch.texture && isTextureEnabled){
+                hasTexture = renderTexture(batch.texture, batch.material);
+            }
+        }
+        enableCullFace(batch.isSolid);
+        setLightModelTwoSide(!batch.isSolid);
+        
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBufferName());
+        glVertexPointer(3, GL_FLOAT, 0, 0);
+        if(doLighting){
+            glEnableClientState(GL_NORMAL_ARRAY);
+            glBindBuffer(GL_ARRAY_BUFFER, batch.normalBufferName());
+            glNormalPointer(GL_FLOAT, 0, 0);
+        } else {
+            glDisableClientState(GL_NORMAL_ARRAY);
+        }
+        if(hasTexture){
+            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+            glBindBuffer(GL_ARRAY_BUFFER, batch.texCoordBufferName());
+            glTexCoordPointer(2, GL_FLOAT, 0, 0);
+            glEnable(GL_TEXTURE_2D);
+        } else {
+            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        }
+        ++numDrawCalls;
+        glDrawArrays(GL_TRIANGLES, 0, batch.numVertices);
+        if(hasTexture){
+            glDisable(GL_TEXTURE_2D);
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopClientAttrib();
+}
+
+
 void GL1SceneRenderer::visitTransform(SgTransform* transform)
 {
     Affine3 T;
@@ -964,6 +1611,11 @@ void GL1SceneRenderer::visitTransform(SgTransform* transform)
     Affine3Array& Vstack = impl->Vstack;
     Vstack.push_back(Vstack.back() * T);
 
+    if(impl->isOutsideFrustum(transform->untransformedBoundingBox())){
+        Vstack.pop_back();
+        return;
+    }
+
     glPushMatrix();
     glMultMatrixd(T.data());
 
@@ -992,6 +1644,9 @@ void GL1SceneRendererImpl::visitShape(SgShape* shape)
     SgMesh* mesh = shape->mesh();
     if(mesh){
         if(mesh->hasVertices()){
+            if(isOutsideFrustum(mesh->boundingBox())){
+                return;
+            }
             if(!defaultLighting){
                 pushPickName(shape);
                 renderMesh(mesh, false);
@@ -1023,6 +1678,10 @@ void GL1SceneRendererImpl::visitShape(SgShape* shape)
                             hasTexture = renderTexture(texture, material);
                         }
                     }
+                    // The simplified meshes do not have the texture coordinates
+                    if(!isPicking && !isCompiling && !hasTexture && self->isMeshLODEnabled()){
+                        mesh = self->getLODMesh(mesh, Vstack.back());
+                    }
                     renderMesh(mesh, hasTexture);
                     popPickName();
                 }
@@ -1074,6 +1733,13 @@ void GL1SceneRendererImpl::renderMaterial(const SgMaterial* material)
 }
 
 
+bool GL1SceneRendererImpl::isTextureUploadBudgetExhausted() const
+{
+    const int budget = self->textureUploadBudget();
+    return (budget > 0 && numTextureBytesUploaded >= budget);
+}
+
+
 bool GL1SceneRendererImpl::renderTexture(SgTexture* texture, bool withMaterial)
 {
     SgImage* sgImage = texture->image();
@@ -1092,14 +1758,34 @@ bool GL1SceneRendererImpl::renderTexture(SgTexture* texture, bool withMaterial)
     if(p != currentCacheMap->end()){
         cache = static_cast<TextureCache*>(p->second.get());
     } else {
-        cache = new TextureCache;
+        cache = static_cast<TextureCache*>(self->findSharedResource(sgImage));
+        if(!cache){
+            cache = new TextureCache;
+            self->addSharedResource(sgImage, cache);
+        }
         currentCacheMap->insert(CacheMap::value_type(sgImage, cache));
     }
-    if(cache->isBound){
+    if(isCheckingUnusedCaches){
+        nextCacheMap->insert(CacheMap::value_type(sgImage, cache));
+    }
+
+    /*
+      The images are uploaded without the limit when the display lists are compiled because
+      the lists cannot be updated later. The compilation of the new lists is postponed instead.
+    */
+    const bool isUploadNeeded = !cache->isBound || cache->isImageUpdateNeeded;
+    if(isUploadNeeded && !isCompiling && isTextureUploadBudgetExhausted()){
+        isTextureUploadDeferred = true;
+        if(!cache->isBound){
+            return false;
+        }
+        // The previous image is used until the updated one is uploaded
+        glBindTexture(GL_TEXTURE_2D, cache->textureName);
+    } else if(cache->isBound){
         glBindTexture(GL_TEXTURE_2D, cache->textureName);
         if(cache->isImageUpdateNeeded){
             doLoadTexImage = true;
-            doReloadTexImage = cache->isSameSizeAs(image);
+            doReloadTexImage = !isCompiling && !cache->isCompressed && cache->isSameSizeAs(image);
         }
     } else {
         glGenTextures(1, &cache->textureName);
@@ -1107,35 +1793,40 @@ bool GL1SceneRendererImpl::renderTexture(SgTexture* texture, bool withMaterial)
         cache->isBound = true;
         doLoadTexImage = true;
     }
-    if(isCheckingUnusedCaches){
-        nextCacheMap->insert(CacheMap::value_type(sgImage, cache));
+    if(doLoadTexImage){
+        cache->width = width;
+        cache->height = height;
+        cache->numComponents = image.numComponents();
+        cache->isImageUpdateNeeded = false;
     }
-    cache->width = width;
-    cache->height = height;
-    cache->numComponents = image.numComponents();
-    cache->isImageUpdateNeeded = false;
     
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture->repeatS() ? GL_REPEAT : GL_CLAMP);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture->repeatT() ? GL_REPEAT : GL_CLAMP);
     glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, withMaterial ? GL_MODULATE : GL_REPLACE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    if(isCompiling){
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-    } else {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    if(doLoadTexImage && !doReloadTexImage){
+        cache->hasMipmaps = isCompiling || self->isTextureMipmapEnabled();
+        cache->isCompressed = self->isTextureCompressionEnabled();
     }
+    if(doLoadTexImage){
+        // The mipmaps are also updated by glTexSubImage2D while this is true
+        glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, cache->hasMipmaps ? GL_TRUE : GL_FALSE);
+    }
+    // The texture without the mipmaps is incomplete with the mipmap filter
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, cache->hasMipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 
     if(doLoadTexImage){
         GLenum format = GL_RGB;
+        GLenum compressedFormat = GL_COMPRESSED_RGB;
         switch(image.numComponents()){
-        case 1 : format = GL_LUMINANCE; break;
-        case 2 : format = GL_LUMINANCE_ALPHA; break;
-        case 3 : format = GL_RGB; break;
-        case 4 : format = GL_RGBA; break;
+        case 1 : format = GL_LUMINANCE; compressedFormat = GL_COMPRESSED_LUMINANCE; break;
+        case 2 : format = GL_LUMINANCE_ALPHA; compressedFormat = GL_COMPRESSED_LUMINANCE_ALPHA; break;
+        case 3 : format = GL_RGB; compressedFormat = GL_COMPRESSED_RGB; break;
+        case 4 : format = GL_RGBA; compressedFormat = GL_COMPRESSED_RGBA; break;
         default : return false;
         }
+        const GLint internalFormat = cache->isCompressed ? compressedFormat : format;
         
         if(image.numComponents() == 3){
             glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -1143,8 +1834,9 @@ bool GL1SceneRendererImpl::renderTexture(SgTexture* texture, bool withMaterial)
             glPixelStorei(GL_UNPACK_ALIGNMENT, image.numComponents());
         }
 
-        if(!isCompiling && doReloadTexImage){
+        if(doReloadTexImage){
             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, image.pixels());
+            numTextureBytesUploaded += width * height * image.numComponents();
 
         } else {
             double w2 = log2(width);
@@ -1152,14 +1844,18 @@ bool GL1SceneRendererImpl::renderTexture(SgTexture* texture, bool withMaterial)
             double pw = ceil(w2);
             double ph = ceil(h2);
             if((pw - w2 == 0.0) && (ph - h2 == 0.0)){
-                glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, image.pixels());
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, image.pixels());
+                numTextureBytesUploaded += width * height * image.numComponents();
+                cache->setTextureBytes(width * height * image.numComponents());
             } else{
                 GLsizei potWidth = pow(2.0, pw);
                 GLsizei potHeight = pow(2.0, ph);
                 buf->scaledImageBuf.resize(potWidth * potHeight * image.numComponents());
                 gluScaleImage(format, width, height, GL_UNSIGNED_BYTE, image.pixels(),
                               potWidth, potHeight, GL_UNSIGNED_BYTE, &buf->scaledImageBuf.front());
-                glTexImage2D(GL_TEXTURE_2D, 0, format, potWidth, potHeight, 0, format, GL_UNSIGNED_BYTE, &buf->scaledImageBuf.front());
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, potWidth, potHeight, 0, format, GL_UNSIGNED_BYTE, &buf->scaledImageBuf.front());
+                numTextureBytesUploaded += potWidth * potHeight * image.numComponents();
+                cache->setTextureBytes(potWidth * potHeight * image.numComponents());
             }
         } 
     }
@@ -1349,9 +2045,11 @@ void GL1SceneRendererImpl::renderMesh(SgMesh* mesh, bool hasTexture)
             if(USE_INDEXING){
                 if(cache->indexBufferName() != GL_INVALID_VALUE){
                     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cache->indexBufferName());
+                    ++numDrawCalls;
                     glDrawElements(GL_TRIANGLES, cache->size, GL_UNSIGNED_INT, 0);
                 }
             } else {
+                ++numDrawCalls;
                 glDrawArrays(GL_TRIANGLES, 0, cache->size);
             }
             if(cache->texCoordBufferName() != GL_INVALID_VALUE){
@@ -1533,8 +2231,10 @@ void GL1SceneRendererImpl::writeVertexBuffers(SgMesh* mesh, ShapeCache* cache, b
             
     } else {
         if(USE_INDEXING){
+            ++numDrawCalls;
             glDrawElements(GL_TRIANGLES, triangleVertices->size(), GL_UNSIGNED_INT, &triangleVertices->front());
         } else {
+            ++numDrawCalls;
             glDrawArrays(GL_TRIANGLES, 0, vertices->size());
         }
     }
@@ -1559,6 +2259,7 @@ void GL1SceneRendererImpl::writeVertexBuffers(SgMesh* mesh, ShapeCache* cache, b
             glDisableClientState(GL_NORMAL_ARRAY);
             glVertexPointer(3, GL_FLOAT, 0, lines.front().data());
             setColor(Vector3f(0.0f, 1.0f, 0.0f));
+            ++numDrawCalls;
             glDrawArrays(GL_LINES, 0, lines.size());
         }
         enableLighting(true);
@@ -1581,7 +2282,15 @@ void GL1SceneRendererImpl::visitPointSet(SgPointSet* pointSet)
     if(s > 0.0){
         setPointSize(s);
     }
-    renderPlot(pointSet, *pointSet->vertices(), (GLenum)GL_POINTS);
+    if(!isPicking && !isCompiling && self->isPointSetLODEnabled() &&
+       self->getLODPointSets(pointSet, Vstack.back(), lodPointSets)){
+        for(size_t i=0; i < lodPointSets.size(); ++i){
+            SgPointSet* node = lodPointSets[i];
+            renderPlot(node, *node->vertices(), (GLenum)GL_POINTS);
+        }
+    } else {
+        renderPlot(pointSet, *pointSet->vertices(), (GLenum)GL_POINTS);
+    }
     if(s > 0.0){
         setPointSize(s);
     }
@@ -1654,6 +2363,7 @@ void GL1SceneRendererImpl::renderPlot(SgPlot* plot, SgVertexArray& expandedVerti
     }
     
     pushPickName(plot);
+    ++numDrawCalls;
     glDrawArrays(primitiveMode, 0, expandedVertices.size());
     popPickName();
     
@@ -1744,7 +2454,9 @@ void GL1SceneRenderer::visitOverlay(SgOverlay* overlay)
     glLoadIdentity();
     glOrtho(v.left, v.right, v.bottom, v.top, v.zNear, v.zFar);
 
+    impl->isRenderingOverlay = true;
     visitGroup(overlay);
+    impl->isRenderingOverlay = false;
     
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
@@ -2177,6 +2889,21 @@ void GL1SceneRenderer::setNewDisplayListDoubleRenderingEnabled(bool on)
 }
 
 
+void GL1SceneRenderer::enableStaticShapeBatching(bool on)
+{
+    if(on != impl->isStaticShapeBatchingEnabled){
+        impl->isStaticShapeBatchingEnabled = on;
+        requestToClearCache();
+    }
+}
+
+
+bool GL1SceneRenderer::isStaticShapeBatchingEnabled() const
+{
+    return impl->isStaticShapeBatchingEnabled;
+}
+
+
 void GL1SceneRenderer::enableUnusedCacheCheck(bool on)
 {
     if(!on){
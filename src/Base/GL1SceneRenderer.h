@@ -33,6 +33,12 @@ public:
     virtual bool pick(int x, int y);
     virtual const Vector3& pickedPoint() const;
     virtual const SgNodePath& pickedNodePath() const;
+    virtual bool startImageReading();
+    virtual bool takeReadImage(Image& out_image);
+    virtual int numPendingImageReadings() const;
+    virtual int numDrawCalls() const;
+    virtual bool enableGPUTimer(bool on);
+    virtual double gpuTime() const;
 
     virtual void setDefaultLighting(bool on);
     void setHeadLightLightingFromBackEnabled(bool on);
@@ -44,6 +50,17 @@ public:
 
     void setNewDisplayListDoubleRenderingEnabled(bool on);
 
+    /**
+       If this is enabled, the shapes of an invariant group are merged into the vertex buffer
+       objects of their materials instead of being compiled into a display list. The merged
+       data are built by a background thread, and the group is rendered without the cache until
+       they are ready. The groups including the nodes other than groups, transforms and opaque
+       meshes without vertex colors are still compiled into display lists.
+       The default value is true.
+    */
+    void enableStaticShapeBatching(bool on);
+    bool isStaticShapeBatchingEnabled() const;
+
     virtual void showNormalVectors(double length);
 
     virtual void requestToClearCache();
@@ -9,10 +9,14 @@
 #include <cnoid/SceneCameras>
 #include <cnoid/SceneLights>
 #include <cnoid/SceneEffects>
+#include <cnoid/SceneRayPicker>
 #include <cnoid/EigenUtil>
 #include <cnoid/NullOut>
+#include <cnoid/Image>
+#include <cnoid/MemoryUsageCounter>
 #include <Eigen/StdVector>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/bind.hpp>
 #include <iostream>
@@ -28,67 +32,217 @@ const float MinLineWidthForPicking = 5.0f;
 
 typedef vector<Affine3, Eigen::aligned_allocator<Affine3> > Affine3Array;
 
-class ShapeHandleSet : public Referenced
+MemoryUsageCounter& bufferMemoryUsageCounter()
+{
+    static MemoryUsageCounter counter("GLSL renderer vertex buffers");
+    return counter;
+}
+
+/*
+  The buffer objects of a mesh or a plot. They are shared by the renderers whose GL contexts
+  share the objects. The vertex array objects cannot be shared between the contexts, so each
+  renderer binds the buffers to its own vertex array object, which is managed by ShapeHandleSet.
+
+  The buffers of a plot are kept when the plot is updated, and only the modified arrays are
+  uploaded again into them so that the plots updated every frame such as the point clouds of
+  range sensors do not allocate new buffers every time.
+*/
+class VertexBufferSet : public Referenced
 {
 public:
-    GLuint vao;
+    enum { NormalOrColorAttributeBit = 1 << 1, ElementBufferBit = 1 << 2, PackedNormalBit = 1 << 3 };
     GLuint vbos[3];
+    // The number of the element indices for a mesh, which is drawn with glDrawElements
     GLsizei numVertices;
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    GLenum indexType;
     bool hasBuffers;
+    // The vertex attributes and the element buffer which are set to the vertex array object
+    int bindingFlags;
+    // Incremented every time the buffers are created
+    int revision;
+    // The number of the ShapeHandleSets using the buffers
+    int numUsers;
+
+    enum { PlotVerticesModified = 1, PlotColorsModified = 2 };
+    SgPlot* plot;
+    int modifiedPlotArrays;
+    // The sizes in bytes of the data stores of the array buffers of a plot
+    GLsizeiptr capacities[2];
+    // The sizes in bytes of the data stores counted in the memory usage counter
+    GLsizeiptr countedBytes[3];
+
     ScopedConnection connection;
 
-    ShapeHandleSet(GLSLSceneRendererImpl* renderer, SgObject* obj)
+    VertexBufferSet(SgObject* obj)
     {
-        connection.reset(obj->sigUpdated().connect(boost::bind(&ShapeHandleSet::onUpdated, this)));
-        clear();
-        glGenVertexArrays(1, &vao);
+        plot = dynamic_cast<SgPlot*>(obj);
+        if(plot){
+            connection.reset(plot->sigUpdated().connect(boost::bind(&VertexBufferSet::onPlotUpdated, this, _1)));
+        } else {
+            connection.reset(obj->sigUpdated().connect(boost::bind(&VertexBufferSet::onUpdated, this)));
+        }
+        for(int i=0; i < 3; ++i){
+            vbos[i] = 0;
+        }
+        numVertices = 0;
+        indexType = GL_UNSIGNED_INT;
         hasBuffers = false;
+        bindingFlags = 0;
+        revision = 0;
+        numUsers = 0;
+        modifiedPlotArrays = 0;
+        capacities[0] = capacities[1] = 0;
+        countedBytes[0] = countedBytes[1] = countedBytes[2] = 0;
     }
 
     void onUpdated(){
         numVertices = 0;
     }
 
-    bool isValid(){
-        if(numVertices > 0){
-            return true;
-        } else if(hasBuffers){
-            deleteBuffers();
-        }
-        return false;
-    }
-
-    void clear(){
-        vao = 0;
-        for(int i=0; i < 3; ++i){
-            vbos[i] = 0;
+    void onPlotUpdated(const SgUpdate& update){
+        SgObject* updated = update.path().front();
+        if(updated == plot->colors()){
+            modifiedPlotArrays |= PlotColorsModified;
+        } else if(updated == plot->vertices()){
+            modifiedPlotArrays |= PlotVerticesModified;
+        } else if(updated != plot->material()){
+            modifiedPlotArrays |= (PlotVerticesModified | PlotColorsModified);
         }
-        numVertices = 0;
     }
 
     void genBuffers(int n){
         glGenBuffers(n, vbos);
         hasBuffers = true;
+        bindingFlags = 0;
+        ++revision;
     }
 
     void deleteBuffers(){
         glDeleteBuffers(3, vbos);
         for(int i=0; i < 3; ++i){
             vbos[i] = 0;
+            setBufferBytes(i, 0);
         }
         hasBuffers = false;
+        numVertices = 0;
+    }
+
+    void setBufferBytes(int index, GLsizeiptr size){
+        MemoryUsageCounter& counter = bufferMemoryUsageCounter();
+        counter.subtract(countedBytes[index]);
+        counter.add(size);
+        countedBytes[index] = size;
+    }
+
+    ~VertexBufferSet() {
+        if(hasBuffers){
+            glDeleteBuffers(3, vbos);
+        }
+        for(int i=0; i < 3; ++i){
+            setBufferBytes(i, 0);
+        }
+    }
+};
+
+typedef ref_ptr<VertexBufferSet> VertexBufferSetPtr;
+
+
+class ShapeHandleSet : public Referenced
+{
+public:
+    GLuint vao;
+    VertexBufferSetPtr buffers;
+    GLsizei numVertices;
+    GLenum indexType;
+    // The revision of the buffers bound to the vertex array object
+    int revision;
+
+    ShapeHandleSet(GLSLSceneRendererImpl* renderer, SgObject* obj);
+
+    bool isValid(){
+        if(buffers->numVertices > 0){
+            if(revision != buffers->revision){
+                // The buffers have been created by another renderer
+                bindBuffers();
+            }
+            numVertices = buffers->numVertices;
+            indexType = buffers->indexType;
+            return true;
+        } else if(buffers->hasBuffers){
+            buffers->deleteBuffers();
+        }
+        return false;
+    }
+
+    void genBuffers(int n){
+        buffers->genBuffers(n);
+        buffers->numVertices = numVertices;
+        buffers->indexType = indexType;
+        revision = buffers->revision;
     }
 
     GLuint vbo(int index) {
-        return vbos[index];
+        return buffers->vbos[index];
+    }
+
+    //! The array buffer of the attribute must be bound
+    void setVertexAttribute(GLuint index){
+        glVertexAttribPointer(index, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte*)NULL + (0)));
+        glEnableVertexAttribArray(index);
+        buffers->bindingFlags |= (1 << index);
+    }
+
+    /**
+       The normals packed by packNormal(). The attribute is given to the shaders
+       as normalized floating-point values.
+    */
+    void setPackedNormalAttribute(GLuint index){
+        glVertexAttribPointer(index, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 0, ((GLubyte*)NULL + (0)));
+        glEnableVertexAttribArray(index);
+        buffers->bindingFlags |= ((1 << index) | VertexBufferSet::PackedNormalBit);
+    }
+
+    void setElementBuffer(){
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->vbos[2]);
+        buffers->bindingFlags |= VertexBufferSet::ElementBufferBit;
+    }
+
+    void bindBuffers(){
+        for(GLuint i=0; i < 2; ++i){
+            if(buffers->bindingFlags & (1 << i)){
+                glBindBuffer(GL_ARRAY_BUFFER, buffers->vbos[i]);
+                if(i == 1 && (buffers->bindingFlags & VertexBufferSet::PackedNormalBit)){
+                    glVertexAttribPointer(i, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 0, ((GLubyte*)NULL + (0)));
+                } else {
+                    glVertexAttribPointer(i, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte*)NULL + (0)));
+                }
+                glEnableVertexAttribArray(i);
+            } else {
+                glDisableVertexAttribArray(i);
+            }
+        }
+        if(buffers->bindingFlags & VertexBufferSet::ElementBufferBit){
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->vbos[2]);
+        }
+        revision = buffers->revision;
+    }
+
+    //! The handles are released without deleting them, which is used when there is no GL context
+    void clear(){
+        vao = 0;
+        if(--buffers->numUsers == 0){
+            buffers->hasBuffers = false;
+        }
+        buffers.reset();
     }
 
     ~ShapeHandleSet() { 
         if(vao > 0){
             glDeleteVertexArrays(1, &vao);
         }
-        if(hasBuffers){
-            glDeleteBuffers(3, vbos);
+        if(buffers){
+            --buffers->numUsers;
         }
     }
 };
@@ -112,6 +266,126 @@ struct TraversedShape : public Referenced
 };
 typedef ref_ptr<TraversedShape> TraversedShapePtr;
 
+/*
+  The opaque shapes which have the same mesh and material are drawn at once
+  by the instanced drawing with the model matrices of them.
+*/
+struct InstanceGroup
+{
+    SgShape* shape;
+    SgMesh* mesh;
+    Affine3Array modelMatrices;
+};
+typedef boost::unordered_map<std::pair<SgMesh*, SgMaterial*>, int> InstanceGroupIndexMap;
+
+typedef vector<Matrix4f, Eigen::aligned_allocator<Matrix4f> > Matrix4fArray;
+
+// The first location of the four vertex attributes used for the model matrix of each instance
+const GLuint InstanceMatrixLocation = 2;
+
+/*
+  The render list is the flattened scene graph which is built once and is used to render the scene
+  without traversing the scene graph every frame. The groups are stored in the depth-first order,
+  so the parent of a group always precedes the group, and the model matrices and the visibilities
+  of all the groups are updated by a single loop.
+
+  The transforms and switches are not cached because they are usually changed without notifying
+  the updates. The list is rebuilt when a node is added or removed, or when the children of a
+  group given by the update are different from the recorded ones.
+*/
+struct RenderListGroup
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    enum Type { GROUP, TRANSFORM, SWITCH };
+    SgGroup* group;
+    int type;
+    int parentIndex;
+    int childBegin; // the index in RenderList::children
+    int numChildren;
+    bool isVisible;
+    bool isCulled; // by the view frustum of the current pass
+    // True if the transform or the visibility has been changed since the list was built
+    bool isDynamic;
+    Affine3 T;
+};
+
+struct RenderListItem
+{
+    SgNode* node;
+    SgShape* shape; // null if the node is rendered by its visitor function
+    int groupIndex;
+};
+
+struct RenderList
+{
+    vector<RenderListGroup, Eigen::aligned_allocator<RenderListGroup> > groups;
+    vector<SgNode*> children;
+    vector<RenderListItem> items;
+    boost::unordered_map<SgObject*, int> groupIndexMap;
+    bool isValid;
+
+    RenderList() : isValid(false) { }
+
+    void clear(){
+        groups.clear();
+        children.clear();
+        items.clear();
+        groupIndexMap.clear();
+        isValid = false;
+    }
+};
+
+class RenderListBuilder : public SceneVisitor
+{
+    RenderList& list;
+    int currentGroupIndex;
+
+public:
+    RenderListBuilder(RenderList& list) : list(list), currentGroupIndex(-1) { }
+
+    void addGroup(SgGroup* group, int type){
+        const int index = list.groups.size();
+        list.groups.push_back(RenderListGroup());
+        RenderListGroup& g = list.groups.back();
+        g.group = group;
+        g.type = type;
+        g.parentIndex = currentGroupIndex;
+        g.childBegin = list.children.size();
+        g.numChildren = group->numChildren();
+        g.isVisible = false;
+        g.isCulled = false;
+        g.isDynamic = false;
+        for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
+            list.children.push_back(p->get());
+        }
+        list.groupIndexMap.insert(std::make_pair(group, index));
+
+        const int parentIndex = currentGroupIndex;
+        currentGroupIndex = index;
+        for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
+            (*p)->accept(*this);
+        }
+        currentGroupIndex = parentIndex;
+    }
+
+    void addItem(SgNode* node, SgShape* shape){
+        RenderListItem item;
+        item.node = node;
+        item.shape = shape;
+        item.groupIndex = currentGroupIndex;
+        list.items.push_back(item);
+    }
+
+    virtual void visitGroup(SgGroup* group) { addGroup(group, RenderListGroup::GROUP); }
+    virtual void visitTransform(SgTransform* transform) { addGroup(transform, RenderListGroup::TRANSFORM); }
+    virtual void visitSwitch(SgSwitch* switchNode) { addGroup(switchNode, RenderListGroup::SWITCH); }
+    virtual void visitShape(SgShape* shape) { addItem(shape, shape); }
+    virtual void visitNode(SgNode* node) { addItem(node, 0); }
+    virtual void visitPreprocessed(SgPreprocessed* preprocessed) { }
+    virtual void visitOverlay(SgOverlay* overlay) { addItem(overlay, 0); }
+    virtual void visitOutlineGroup(SgOutlineGroup* outline) { addItem(outline, 0); }
+};
+
 
 }
 
@@ -125,6 +399,25 @@ public:
         
     GLSLSceneRenderer* self;
 
+    struct ImageReading {
+        GLuint buffer;
+        int width;
+        int height;
+        ImageReading() : buffer(0), width(0), height(0) { }
+    };
+    static const int MaxNumImageReadings = 3;
+    ImageReading imageReadings[MaxNumImageReadings];
+    int imageReadingHead;
+    int numImageReadings;
+
+    // for the rendering statistics
+    int numDrawCalls;
+    bool isGPUTimerEnabled;
+    GLuint gpuTimerQueries[2];
+    bool isGPUTimerQueryIssued[2];
+    int gpuTimerQueryIndex;
+    double gpuTime;
+
     GLint defaultFBO;
 
     ShaderProgram* currentProgram;
@@ -133,6 +426,12 @@ public:
     
     SolidColorProgram solidColorProgram;
     PhongShadowProgram phongShadowProgram;
+    boost::scoped_ptr<DepthToPointProgram> depthToPointProgram;
+    bool isDepthToPointProgramUnavailable;
+    boost::scoped_ptr<RangeResampleProgram> rangeResampleProgram;
+    bool isRangeResampleProgramUnavailable;
+    boost::scoped_ptr<SensorNoiseProgram> sensorNoiseProgram;
+    bool isSensorNoiseProgramUnavailable;
 
     struct ProgramInfo {
         ShaderProgram* program;
@@ -140,9 +439,26 @@ public:
         NolightingProgram* nolightingProgram;
     };
     vector<ProgramInfo> programStack;
+    vector<SgPointSet*> lodPointSets;
         
     bool isPicking;
     bool isRenderingShadowMap;
+
+    /*
+      The static layer of a shadow map has the shapes whose groups are not dynamic in the
+      render list, and it is kept while they do not change and the light does not move.
+    */
+    struct StaticShadowLayer
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        bool isValid;
+        int lightIndex;
+        Matrix4 PV;
+    };
+    vector<StaticShadowLayer, Eigen::aligned_allocator<StaticShadowLayer> > staticShadowLayers;
+    bool isStaticShadowLayerEnabled;
+    // One of the values of PhongShadowProgram::ShadowMapLayer for the render list
+    int currentShadowMapLayer;
     
     Affine3Array modelMatrixStack; // stack of the model matrices
     Affine3 viewMatrix;
@@ -151,6 +467,22 @@ public:
 
     vector<TraversedShapePtr> transparentShapes;
 
+    bool isInstancingEnabled;
+    ShaderProgram* instancingProgram;
+    vector<InstanceGroup> instanceGroups;
+    int numInstanceGroups;
+    InstanceGroupIndexMap instanceGroupIndexMap;
+    Matrix4fArray instanceMatrices;
+    GLuint instanceMatrixBuffer;
+
+    bool isRenderListEnabled;
+    RenderList renderList;
+    vector<SgGroup*> groupsToCheckChildren;
+    ScopedConnection sceneRootConnection;
+
+    bool isRayPickingEnabled;
+    SceneRayPicker rayPicker;
+
     std::set<int> shadowLightIndices;
 
     bool defaultLighting;
@@ -213,15 +545,30 @@ public:
     ~GLSLSceneRendererImpl();
     bool initializeGL();
     void render();
+    void beginGPUTimer();
+    void endGPUTimer();
     bool pick(int x, int y);
+    bool pickWithRay(int x, int y);
+    bool startImageReading();
+    bool takeReadImage(Image& out_image);
+    bool readDepthBufferAsPoints(void* out_points);
+    bool resampleDepthBufferAsRanges(
+        int numYawSamples, int numPitchSamples, int yawBegin, int yawEnd,
+        double firstYawAngle, double yawStep, double firstPitchAngle, double pitchStep, double depthError);
+    bool readResampledRanges(float* out_ranges);
+    bool applySensorNoise(bool hasColor, double k1, double k2, double rangeNoise, double rangeQuantizationStep,
+                          double dropoutRate, unsigned int seed);
     void renderScene();
-    bool renderShadowMap(int lightIndex);
+    bool renderShadowMap(int lightIndex, int shadowIndex);
+    void invalidateStaticShadowLayers();
     void beginRendering();
     void renderCamera(SgCamera* camera, const Affine3& cameraPosition);
     void renderLights();
     void renderFog();
     void onCurrentFogNodeUdpated();
     void endRendering();
+    void onSceneGraphUpdated(const SgUpdate& update);
+    void updateRenderList();
     void renderSceneGraphNodes();
     void pushProgram(ShaderProgram& program, bool isLightingProgram);
     void popProgram();
@@ -232,6 +579,9 @@ public:
     void flushNolightingTransformMatrices();
     ShapeHandleSet* getOrCreateShapeHandleSet(SgObject* obj, const Affine3& modelMatrix);
     void visitShape(SgShape* shape);
+    void addShapeInstance(SgShape* shape, SgMesh* mesh);
+    void renderInstanceGroups();
+    void resetInstanceMatrixAttribute();
     void renderTransparentShapes();
     void renderMaterial(const SgMaterial* material);
     bool renderTexture(SgTexture* texture, bool withMaterial);
@@ -281,6 +631,36 @@ GLSLSceneRendererImpl::GLSLSceneRendererImpl(GLSLSceneRenderer* self)
     isPicking = false;
     isRenderingShadowMap = false;
     pickedPoint.setZero();
+    imageReadingHead = 0;
+    numImageReadings = 0;
+
+    numDrawCalls = 0;
+    isGPUTimerEnabled = false;
+    gpuTimerQueries[0] = gpuTimerQueries[1] = 0;
+    isGPUTimerQueryIssued[0] = isGPUTimerQueryIssued[1] = false;
+    gpuTimerQueryIndex = 0;
+    gpuTime = -1.0;
+    staticShadowLayers.resize(phongShadowProgram.maxNumShadows());
+    isStaticShadowLayerEnabled = true;
+    currentShadowMapLayer = PhongShadowProgram::WHOLE_SHADOW_MAP;
+    invalidateStaticShadowLayers();
+
+    isDepthToPointProgramUnavailable = false;
+    isRangeResampleProgramUnavailable = false;
+    isSensorNoiseProgramUnavailable = false;
+
+    isInstancingEnabled = true;
+    instancingProgram = 0;
+    numInstanceGroups = 0;
+    instanceMatrixBuffer = 0;
+
+    isRenderListEnabled = true;
+    sceneRootConnection.reset(
+        self->sceneRoot()->sigUpdated().connect(
+            boost::bind(&GLSLSceneRendererImpl::onSceneGraphUpdated, this, _1)));
+
+    isRayPickingEnabled = true;
+    rayPicker.setMinPlotSize(MinLineWidthForPicking);
 
     doUnusedShapeHandleSetCheck = true;
     currentShapeHandleSetMapIndex = 0;
@@ -365,6 +745,9 @@ bool GLSLSceneRendererImpl::initializeGL()
 
     glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
 
+    glGenBuffers(1, &instanceMatrixBuffer);
+    resetInstanceMatrixAttribute();
+
     isShapeHandleSetClearRequested = true;
 
     isCurrentFogUpdated = false;
@@ -389,6 +772,9 @@ void GLSLSceneRenderer::flush()
 void GLSLSceneRenderer::requestToClearCache()
 {
     impl->isShapeHandleSetClearRequested = true;
+    impl->renderList.isValid = false;
+    impl->invalidateStaticShadowLayers();
+    impl->rayPicker.clearCache();
 }
 
 
@@ -400,9 +786,17 @@ void GLSLSceneRenderer::render()
 
 void GLSLSceneRendererImpl::render()
 {
+    if(isGPUTimerEnabled){
+        beginGPUTimer();
+    }
+    
     self->extractPreprocessedNodes();
     beginRendering();
 
+    if(isRenderListEnabled){
+        updateRenderList();
+    }
+
     PhongShadowProgram& program = phongShadowProgram;
     
     if(shadowLightIndices.empty()){
@@ -419,7 +813,7 @@ void GLSLSceneRendererImpl::render()
         while(iter != shadowLightIndices.end() && shadowMapIndex < program.maxNumShadows()){
             program.activateShadowMapGenerationPass(shadowMapIndex);
             int shadowLightIndex = *iter;
-            if(renderShadowMap(shadowLightIndex)){
+            if(renderShadowMap(shadowLightIndex, shadowMapIndex)){
                 ++shadowMapIndex;
             }
             ++iter;
@@ -439,6 +833,73 @@ void GLSLSceneRendererImpl::render()
     popProgram();
 
     endRendering();
+
+    if(isGPUTimerEnabled){
+        endGPUTimer();
+    }
+}
+
+
+int GLSLSceneRenderer::numDrawCalls() const
+{
+    return impl->numDrawCalls;
+}
+
+
+bool GLSLSceneRenderer::enableGPUTimer(bool on)
+{
+    // The timer queries are the core functions of OpenGL 3.3
+    impl->isGPUTimerEnabled = on;
+    if(!on){
+        impl->gpuTime = -1.0;
+    }
+    return true;
+}
+
+
+double GLSLSceneRenderer::gpuTime() const
+{
+    return impl->gpuTime;
+}
+
+
+/**
+   The two query objects are used alternately so that the result of the query of the previous
+   frame, which has usually been completed, is obtained without waiting for the GPU.
+*/
+void GLSLSceneRendererImpl::beginGPUTimer()
+{
+    if(!gpuTimerQueries[0]){
+        glGenQueries(2, gpuTimerQueries);
+    }
+    GLuint query = gpuTimerQueries[gpuTimerQueryIndex];
+    if(isGPUTimerQueryIssued[gpuTimerQueryIndex]){
+        GLuint64 nanoseconds;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        gpuTime = nanoseconds * 1.0e-9;
+        isGPUTimerQueryIssued[gpuTimerQueryIndex] = false;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+
+void GLSLSceneRendererImpl::endGPUTimer()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    isGPUTimerQueryIssued[gpuTimerQueryIndex] = true;
+    gpuTimerQueryIndex = 1 - gpuTimerQueryIndex;
+
+    if(isGPUTimerQueryIssued[gpuTimerQueryIndex]){
+        GLuint query = gpuTimerQueries[gpuTimerQueryIndex];
+        GLuint isAvailable = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+        if(isAvailable){
+            GLuint64 nanoseconds;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            gpuTime = nanoseconds * 1.0e-9;
+            isGPUTimerQueryIssued[gpuTimerQueryIndex] = false;
+        }
+    }
 }
 
 
@@ -450,6 +911,10 @@ bool GLSLSceneRenderer::pick(int x, int y)
 
 bool GLSLSceneRendererImpl::pick(int x, int y)
 {
+    if(isRayPickingEnabled && !SHOW_IMAGE_FOR_PICKING && pickWithRay(x, y)){
+        return !pickedNodePath.empty();
+    }
+    
     self->extractPreprocessedNodes();
     beginRendering();
     
@@ -495,6 +960,180 @@ bool GLSLSceneRendererImpl::pick(int x, int y)
 }
 
 
+/**
+   The ray is given by the camera and the projection of the last rendering.
+   @return false if the ray cannot be determined
+*/
+bool GLSLSceneRendererImpl::pickWithRay(int x, int y)
+{
+    Vector3 nearPoint, farPoint, nearPoint2, farPoint2;
+    if(!self->unproject(x, y, 0.0, nearPoint) || !self->unproject(x, y, 1.0, farPoint) ||
+       !self->unproject(x + 1, y, 0.0, nearPoint2) || !self->unproject(x + 1, y, 1.0, farPoint2)){
+        return false;
+    }
+    const Vector3 ray = farPoint - nearPoint;
+    const double length = ray.norm();
+    if(!(length > 0.0) || !nearPoint.allFinite() || !farPoint.allFinite()){
+        return false;
+    }
+    rayPicker.setPixelSizes((nearPoint2 - nearPoint).norm(), (farPoint2 - farPoint).norm());
+
+    pickedNodePath.clear();
+    if(rayPicker.pick(self->sceneRoot(), nearPoint, ray / length, length)){
+        pickedNodePath = rayPicker.pickedNodePath();
+        pickedPoint = rayPicker.pickedPoint();
+    }
+    return true;
+}
+
+
+bool GLSLSceneRenderer::readDepthBufferAsPoints(void* out_points)
+{
+    return impl->readDepthBufferAsPoints(out_points);
+}
+
+
+bool GLSLSceneRendererImpl::readDepthBufferAsPoints(void* out_points)
+{
+    if(isDepthToPointProgramUnavailable){
+        return false;
+    }
+    
+    // The current frame buffer is used because it may differ from the default one when the renderer is shared
+    GLint sourceFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &sourceFBO);
+    
+    try {
+        if(!depthToPointProgram){
+            depthToPointProgram.reset(new DepthToPointProgram);
+            depthToPointProgram->initialize();
+        }
+        const Array4i vp = self->viewport();
+        depthToPointProgram->convert(
+            sourceFBO, vp[0], vp[1], vp[2], vp[3], projectionMatrix.inverse().cast<float>(), out_points);
+    }
+    catch(GLSLProgram::Exception& ex){
+        os() << ex.what() << endl;
+        depthToPointProgram.reset();
+        isDepthToPointProgramUnavailable = true;
+        glBindFramebuffer(GL_FRAMEBUFFER, sourceFBO);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool GLSLSceneRenderer::resampleDepthBufferAsRanges
+(int numYawSamples, int numPitchSamples, int yawBegin, int yawEnd,
+ double firstYawAngle, double yawStep, double firstPitchAngle, double pitchStep, double depthError)
+{
+    return impl->resampleDepthBufferAsRanges(
+        numYawSamples, numPitchSamples, yawBegin, yawEnd, firstYawAngle, yawStep, firstPitchAngle, pitchStep, depthError);
+}
+
+
+bool GLSLSceneRendererImpl::resampleDepthBufferAsRanges
+(int numYawSamples, int numPitchSamples, int yawBegin, int yawEnd,
+ double firstYawAngle, double yawStep, double firstPitchAngle, double pitchStep, double depthError)
+{
+    if(isRangeResampleProgramUnavailable){
+        return false;
+    }
+
+    GLint sourceFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &sourceFBO);
+    
+    try {
+        if(!rangeResampleProgram){
+            rangeResampleProgram.reset(new RangeResampleProgram);
+            rangeResampleProgram->initialize();
+        }
+        const Array4i vp = self->viewport();
+        rangeResampleProgram->resample(
+            sourceFBO, vp[0], vp[1], vp[2], vp[3], projectionMatrix.cast<float>(),
+            numYawSamples, numPitchSamples, yawBegin, yawEnd,
+            firstYawAngle, yawStep, firstPitchAngle, pitchStep, depthError);
+    }
+    catch(GLSLProgram::Exception& ex){
+        os() << ex.what() << endl;
+        rangeResampleProgram.reset();
+        isRangeResampleProgramUnavailable = true;
+        glBindFramebuffer(GL_FRAMEBUFFER, sourceFBO);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool GLSLSceneRenderer::readResampledRanges(float* out_ranges)
+{
+    return impl->readResampledRanges(out_ranges);
+}
+
+
+bool GLSLSceneRendererImpl::readResampledRanges(float* out_ranges)
+{
+    if(!rangeResampleProgram){
+        return false;
+    }
+
+    GLint sourceFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &sourceFBO);
+
+    try {
+        rangeResampleProgram->readRanges(sourceFBO, out_ranges);
+    }
+    catch(GLSLProgram::Exception& ex){
+        os() << ex.what() << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, sourceFBO);
+        return false;
+    }
+    
+    return true;
+}
+
+
+bool GLSLSceneRenderer::applySensorNoise
+(bool hasColor, double k1, double k2, double rangeNoise, double rangeQuantizationStep, double dropoutRate, unsigned int seed)
+{
+    return impl->applySensorNoise(hasColor, k1, k2, rangeNoise, rangeQuantizationStep, dropoutRate, seed);
+}
+
+
+bool GLSLSceneRendererImpl::applySensorNoise
+(bool hasColor, double k1, double k2, double rangeNoise, double rangeQuantizationStep, double dropoutRate, unsigned int seed)
+{
+    if(isSensorNoiseProgramUnavailable){
+        return false;
+    }
+
+    GLint sourceFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &sourceFBO);
+    
+    try {
+        if(!sensorNoiseProgram){
+            sensorNoiseProgram.reset(new SensorNoiseProgram);
+            sensorNoiseProgram->initialize();
+        }
+        const Array4i vp = self->viewport();
+        sensorNoiseProgram->apply(
+            sourceFBO, vp[0], vp[1], vp[2], vp[3], projectionMatrix.cast<float>(),
+            hasColor, k1, k2, rangeNoise, rangeQuantizationStep, dropoutRate, seed);
+    }
+    catch(GLSLProgram::Exception& ex){
+        os() << ex.what() << endl;
+        sensorNoiseProgram.reset();
+        isSensorNoiseProgramUnavailable = true;
+        glBindFramebuffer(GL_FRAMEBUFFER, sourceFBO);
+        return false;
+    }
+
+    return true;
+}
+
+
 void GLSLSceneRendererImpl::renderScene()
 {
     SgCamera* camera = self->currentCamera();
@@ -512,7 +1151,7 @@ void GLSLSceneRendererImpl::renderScene()
 }
 
 
-bool GLSLSceneRendererImpl::renderShadowMap(int lightIndex)
+bool GLSLSceneRendererImpl::renderShadowMap(int lightIndex, int shadowIndex)
 {
     SgLight* light;
     Affine3 T;
@@ -522,7 +1161,25 @@ bool GLSLSceneRendererImpl::renderShadowMap(int lightIndex)
         if(shadowMapCamera){
             renderCamera(shadowMapCamera, T);
             phongShadowProgram.setShadowMapViewProjection(PV);
-            renderSceneGraphNodes();
+
+            if(isStaticShadowLayerEnabled && isRenderListEnabled){
+                StaticShadowLayer& layer = staticShadowLayers[shadowIndex];
+                if(!layer.isValid || layer.lightIndex != lightIndex || layer.PV != PV){
+                    currentShadowMapLayer = PhongShadowProgram::STATIC_SHADOW_LAYER;
+                    phongShadowProgram.setShadowMapLayer(PhongShadowProgram::STATIC_SHADOW_LAYER);
+                    renderSceneGraphNodes();
+                    layer.isValid = true;
+                    layer.lightIndex = lightIndex;
+                    layer.PV = PV;
+                }
+                currentShadowMapLayer = PhongShadowProgram::DYNAMIC_SHADOW_LAYER;
+                phongShadowProgram.setShadowMapLayer(PhongShadowProgram::DYNAMIC_SHADOW_LAYER);
+                renderSceneGraphNodes();
+                currentShadowMapLayer = PhongShadowProgram::WHOLE_SHADOW_MAP;
+                phongShadowProgram.setShadowMapLayer(PhongShadowProgram::WHOLE_SHADOW_MAP);
+            } else {
+                renderSceneGraphNodes();
+            }
             glFlush();
             glFinish();
             return true;
@@ -555,6 +1212,7 @@ void GLSLSceneRendererImpl::renderCamera(SgCamera* camera, const Affine3& camera
 
     viewMatrix = cameraPosition.inverse(Eigen::Isometry);
     PV = projectionMatrix * viewMatrix.matrix();
+    self->setFrustumCullingMatrix(PV);
 
     modelMatrixStack.clear();
     modelMatrixStack.push_back(Affine3::Identity());
@@ -564,6 +1222,7 @@ void GLSLSceneRendererImpl::renderCamera(SgCamera* camera, const Affine3& camera
 void GLSLSceneRendererImpl::beginRendering()
 {
     isCheckingUnusedShapeHandleSets = isPicking ? false : doUnusedShapeHandleSetCheck;
+    numDrawCalls = 0;
 
     if(isShapeHandleSetClearRequested){
         shapeHandleSetMaps[0].clear();
@@ -602,7 +1261,149 @@ void GLSLSceneRendererImpl::renderSceneGraphNodes()
         }
     }
     
-    self->sceneRoot()->accept(*self);
+    instancingProgram = (isInstancingEnabled && !isPicking) ? currentProgram : 0;
+
+    if(isRenderListEnabled && !isPicking){
+        const bool doCulling = self->isFrustumCullingEnabled();
+        if(doCulling){
+            const int n = renderList.groups.size();
+            for(int i=0; i < n; ++i){
+                RenderListGroup& g = renderList.groups[i];
+                if(g.isVisible){
+                    g.isCulled = (g.parentIndex >= 0) && renderList.groups[g.parentIndex].isCulled;
+                    if(!g.isCulled && g.type == RenderListGroup::TRANSFORM){
+                        g.isCulled = !self->isInFrustum(
+                            static_cast<SgTransform*>(g.group)->untransformedBoundingBox(), g.T);
+                    }
+                }
+            }
+        }
+        const int layer = currentShadowMapLayer;
+        const int n = renderList.items.size();
+        for(int i=0; i < n; ++i){
+            const RenderListItem& item = renderList.items[i];
+            const RenderListGroup& group = renderList.groups[item.groupIndex];
+            if(layer == PhongShadowProgram::STATIC_SHADOW_LAYER && group.isDynamic){
+                continue;
+            }
+            if(layer == PhongShadowProgram::DYNAMIC_SHADOW_LAYER && !group.isDynamic){
+                continue;
+            }
+            if(group.isVisible && !(doCulling && group.isCulled)){
+                modelMatrixStack.push_back(group.T);
+                if(item.shape){
+                    visitShape(item.shape);
+                } else {
+                    item.node->accept(*self);
+                }
+                modelMatrixStack.pop_back();
+            }
+        }
+    } else {
+        self->sceneRoot()->accept(*self);
+    }
+
+    if(instancingProgram){
+        renderInstanceGroups();
+        instancingProgram = 0;
+    }
+}
+
+
+void GLSLSceneRendererImpl::onSceneGraphUpdated(const SgUpdate& update)
+{
+    if(!renderList.isValid){
+        return;
+    }
+    if(update.action() & (SgUpdate::ADDED | SgUpdate::REMOVED)){
+        renderList.isValid = false;
+    } else if(SgGroup* group = dynamic_cast<SgGroup*>(update.path().front())){
+        groupsToCheckChildren.push_back(group);
+    }
+    // The changes of the transforms are detected by comparing them in updateRenderList()
+    if(!dynamic_cast<SgTransform*>(update.path().front())){
+        invalidateStaticShadowLayers();
+    }
+}
+
+
+void GLSLSceneRendererImpl::invalidateStaticShadowLayers()
+{
+    for(size_t i=0; i < staticShadowLayers.size(); ++i){
+        staticShadowLayers[i].isValid = false;
+    }
+}
+
+
+void GLSLSceneRendererImpl::updateRenderList()
+{
+    if(renderList.isValid){
+        for(size_t i=0; i < groupsToCheckChildren.size(); ++i){
+            SgGroup* group = groupsToCheckChildren[i];
+            boost::unordered_map<SgObject*, int>::iterator p = renderList.groupIndexMap.find(group);
+            if(p != renderList.groupIndexMap.end()){
+                const RenderListGroup& g = renderList.groups[p->second];
+                bool isSame = (group->numChildren() == g.numChildren);
+                for(int j=0; isSame && j < g.numChildren; ++j){
+                    isSame = (group->child(j) == renderList.children[g.childBegin + j]);
+                }
+                if(!isSame){
+                    renderList.isValid = false;
+                    break;
+                }
+            }
+        }
+    }
+    groupsToCheckChildren.clear();
+
+    bool isRebuilt = false;
+    if(!renderList.isValid){
+        renderList.clear();
+        RenderListBuilder builder(renderList);
+        self->sceneRoot()->accept(builder);
+        renderList.isValid = true;
+        isRebuilt = true;
+        invalidateStaticShadowLayers();
+    }
+
+    Affine3 T;
+    bool isStaticGroupChanged = false;
+    const int n = renderList.groups.size();
+    for(int i=0; i < n; ++i){
+        RenderListGroup& g = renderList.groups[i];
+        const bool wasVisible = g.isVisible;
+        const Affine3 prevT = g.T;
+        if(g.parentIndex < 0){
+            g.isVisible = true;
+            g.T.setIdentity();
+        } else {
+            const RenderListGroup& parent = renderList.groups[g.parentIndex];
+            g.isVisible = parent.isVisible;
+            if(g.isVisible){
+                g.T = parent.T;
+            }
+        }
+        if(g.isVisible){
+            if(g.type == RenderListGroup::TRANSFORM){
+                static_cast<SgTransform*>(g.group)->getTransform(T);
+                g.T = g.T * T;
+            } else if(g.type == RenderListGroup::SWITCH){
+                g.isVisible = static_cast<SgSwitch*>(g.group)->isTurnedOn();
+            }
+        }
+        if(!g.isDynamic && !isRebuilt){
+            if(g.parentIndex >= 0 && renderList.groups[g.parentIndex].isDynamic){
+                g.isDynamic = true;
+            } else if(g.isVisible != wasVisible || (g.isVisible && !(g.T.matrix() == prevT.matrix()))){
+                g.isDynamic = true;
+                isStaticGroupChanged = true;
+            }
+        }
+    }
+    if(isStaticGroupChanged){
+        // The shapes which have been moved must be removed from the static layers
+        invalidateStaticShadowLayers();
+    }
 }
 
 
@@ -737,6 +1538,87 @@ const Vector3& GLSLSceneRenderer::pickedPoint() const
     return impl->pickedPoint;
 }
 
+bool GLSLSceneRenderer::startImageReading()
+{
+    return impl->startImageReading();
+}
+
+
+bool GLSLSceneRendererImpl::startImageReading()
+{
+    if(numImageReadings == MaxNumImageReadings){
+        return false;
+    }
+    int x, y, width, height;
+    self->getViewport(x, y, width, height);
+    if(width <= 0 || height <= 0){
+        return false;
+    }
+    const int index = (imageReadingHead + numImageReadings) % MaxNumImageReadings;
+    ImageReading& reading = imageReadings[index];
+    if(!reading.buffer){
+        glGenBuffers(1, &reading.buffer);
+        if(!reading.buffer){
+            return false;
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, reading.buffer);
+    if(width != reading.width || height != reading.height){
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, 0, GL_STREAM_READ);
+        reading.width = width;
+        reading.height = height;
+    }
+    GLint alignment;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    ++numImageReadings;
+    return true;
+}
+
+
+bool GLSLSceneRenderer::takeReadImage(Image& out_image)
+{
+    return impl->takeReadImage(out_image);
+}
+
+
+bool GLSLSceneRendererImpl::takeReadImage(Image& out_image)
+{
+    if(numImageReadings == 0){
+        return false;
+    }
+    ImageReading& reading = imageReadings[imageReadingHead];
+    imageReadingHead = (imageReadingHead + 1) % MaxNumImageReadings;
+    --numImageReadings;
+
+    bool result = false;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, reading.buffer);
+    const unsigned char* pixels = static_cast<const unsigned char*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if(pixels){
+        // The rows are stored from the bottom in the frame buffer
+        out_image.setSize(reading.width, reading.height, 3);
+        const int rowSize = reading.width * 3;
+        unsigned char* dest = out_image.pixels();
+        for(int i=0; i < reading.height; ++i){
+            std::copy(pixels + (reading.height - i - 1) * rowSize, pixels + (reading.height - i) * rowSize, dest + i * rowSize);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        result = true;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return result;
+}
+
+
+int GLSLSceneRenderer::numPendingImageReadings() const
+{
+    return impl->numImageReadings;
+}
+
 
 inline void GLSLSceneRendererImpl::setPickColor(unsigned int id)
 {
@@ -815,12 +1697,34 @@ void GLSLSceneRenderer::visitTransform(SgTransform* transform)
     Affine3Array& modelMatrixStack = impl->modelMatrixStack;
     modelMatrixStack.push_back(modelMatrixStack.back() * T);
 
+    if(isFrustumCullingEnabled() && !isInFrustum(transform->untransformedBoundingBox(), modelMatrixStack.back())){
+        modelMatrixStack.pop_back();
+        return;
+    }
+
     visitGroup(transform);
     
     modelMatrixStack.pop_back();
 }
 
 
+ShapeHandleSet::ShapeHandleSet(GLSLSceneRendererImpl* renderer, SgObject* obj)
+{
+    glGenVertexArrays(1, &vao);
+    numVertices = 0;
+    indexType = GL_UNSIGNED_INT;
+    revision = 0;
+
+    GLSLSceneRenderer* self = renderer->self;
+    buffers = static_cast<VertexBufferSet*>(self->findSharedResource(obj));
+    if(!buffers){
+        buffers = new VertexBufferSet(obj);
+        self->addSharedResource(obj, buffers);
+    }
+    ++buffers->numUsers;
+}
+
+
 ShapeHandleSet* GLSLSceneRendererImpl::getOrCreateShapeHandleSet(SgObject* obj, const Affine3& modelMatrix)
 {
     ShapeHandleSet* handleSet;
@@ -858,6 +1762,9 @@ void GLSLSceneRendererImpl::visitShape(SgShape* shape)
 {
     SgMesh* mesh = shape->mesh();
     if(mesh && mesh->hasVertices()){
+        if(self->isFrustumCullingEnabled() && !self->isInFrustum(mesh->boundingBox(), modelMatrixStack.back())){
+            return;
+        }
         SgMaterial* material = shape->material();
         if(material && material->transparency() > 0.0){
             TraversedShapePtr traversed = new TraversedShape();
@@ -869,6 +1776,13 @@ void GLSLSceneRendererImpl::visitShape(SgShape* shape)
                 transparentShapes.push_back(traversed);
             }
         } else {
+            if(!isPicking && self->isMeshLODEnabled()){
+                mesh = self->getLODMesh(mesh, modelMatrixStack.back());
+            }
+            if(currentProgram == instancingProgram){
+                addShapeInstance(shape, mesh);
+                return;
+            }
             if(!isPicking){
                 renderMaterial(shape->material());
             }
@@ -877,13 +1791,99 @@ void GLSLSceneRendererImpl::visitShape(SgShape* shape)
                 createMeshVertexArray(mesh, handleSet);
             }
             pushPickId(shape);
-            glDrawArrays(GL_TRIANGLES, 0, handleSet->numVertices);
+            ++numDrawCalls;
+            glDrawElements(GL_TRIANGLES, handleSet->numVertices, handleSet->indexType, 0);
             popPickId();
         }
     }
 }
 
 
+void GLSLSceneRendererImpl::addShapeInstance(SgShape* shape, SgMesh* mesh)
+{
+    std::pair<InstanceGroupIndexMap::iterator, bool> inserted =
+        instanceGroupIndexMap.insert(
+            InstanceGroupIndexMap::value_type(std::make_pair(mesh, shape->material()), numInstanceGroups));
+    if(inserted.second){
+        if(numInstanceGroups == instanceGroups.size()){
+            instanceGroups.push_back(InstanceGroup());
+        }
+        InstanceGroup& group = instanceGroups[numInstanceGroups++];
+        group.shape = shape;
+        group.mesh = mesh;
+    }
+    instanceGroups[inserted.first->second].modelMatrices.push_back(modelMatrixStack.back());
+}
+
+
+void GLSLSceneRendererImpl::renderInstanceGroups()
+{
+    for(int i=0; i < numInstanceGroups; ++i){
+        InstanceGroup& group = instanceGroups[i];
+        SgShape* shape = group.shape;
+        SgMesh* mesh = group.mesh;
+        renderMaterial(shape->material());
+        const int numInstances = group.modelMatrices.size();
+
+        if(numInstances == 1){
+            ShapeHandleSet* handleSet = getOrCreateShapeHandleSet(mesh, group.modelMatrices.front());
+            if(!handleSet->isValid()){
+                createMeshVertexArray(mesh, handleSet);
+            }
+            ++numDrawCalls;
+            glDrawElements(GL_TRIANGLES, handleSet->numVertices, handleSet->indexType, 0);
+
+        } else {
+            // The model matrices given to the program are multiplied by the instance matrices in the shaders
+            ShapeHandleSet* handleSet = getOrCreateShapeHandleSet(mesh, Affine3::Identity());
+            if(!handleSet->isValid()){
+                createMeshVertexArray(mesh, handleSet);
+            }
+            instanceMatrices.resize(numInstances);
+            for(int j=0; j < numInstances; ++j){
+                instanceMatrices[j] = group.modelMatrices[j].matrix().cast<float>();
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, instanceMatrixBuffer);
+            glBufferData(GL_ARRAY_BUFFER, numInstances * sizeof(Matrix4f), instanceMatrices.data(), GL_STREAM_DRAW);
+            for(int j=0; j < 4; ++j){
+                const GLuint location = InstanceMatrixLocation + j;
+                glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4f),
+                                      ((GLubyte*)NULL + (j * sizeof(Vector4f))));
+                glVertexAttribDivisor(location, 1);
+                glEnableVertexAttribArray(location);
+            }
+
+            ++numDrawCalls;
+            glDrawElementsInstanced(GL_TRIANGLES, handleSet->numVertices, handleSet->indexType, 0, numInstances);
+
+            for(int j=0; j < 4; ++j){
+                glDisableVertexAttribArray(InstanceMatrixLocation + j);
+            }
+            resetInstanceMatrixAttribute();
+        }
+
+        group.modelMatrices.clear();
+    }
+
+    numInstanceGroups = 0;
+    instanceGroupIndexMap.clear();
+}
+
+
+/**
+   The instance matrix is the identity matrix for the shapes which are not drawn as instances.
+   The value is reset after each instanced drawing because the current value of an attribute
+   may be changed by drawing with the array of the attribute.
+*/
+void GLSLSceneRendererImpl::resetInstanceMatrixAttribute()
+{
+    glVertexAttrib4f(InstanceMatrixLocation,     1.0f, 0.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(InstanceMatrixLocation + 1, 0.0f, 1.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(InstanceMatrixLocation + 2, 0.0f, 0.0f, 1.0f, 0.0f);
+    glVertexAttrib4f(InstanceMatrixLocation + 3, 0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+
 void GLSLSceneRendererImpl::renderTransparentShapes()
 {
     if(!isPicking){
@@ -905,7 +1905,8 @@ void GLSLSceneRendererImpl::renderTransparentShapes()
         if(!handleSet->isValid()){
             createMeshVertexArray(shape->mesh(), handleSet);
         }
-        glDrawArrays(GL_TRIANGLES, 0, handleSet->numVertices);
+        ++numDrawCalls;
+        glDrawElements(GL_TRIANGLES, handleSet->numVertices, handleSet->indexType, 0);
     }
 
     if(!isPicking){
@@ -949,64 +1950,110 @@ void GLSLSceneRenderer::onImageUpdated(SgImage* image)
 }
 
 
+/**
+   Packs a unit normal into the signed 10-bit x, y and z components of GL_INT_2_10_10_10_REV,
+   which takes a third of the size of three floats.
+*/
+static GLuint packNormal(const Vector3f& n)
+{
+    GLuint packed = 0;
+    for(int i=0; i < 3; ++i){
+        const float c = std::max(-1.0f, std::min(1.0f, n[i]));
+        const int v = static_cast<int>(floorf(c * 511.0f + 0.5f));
+        packed |= (static_cast<GLuint>(v) & 0x3ff) << (i * 10);
+    }
+    return packed;
+}
+
+
+/**
+   The vertices are shared by the triangles as long as their normals are same, and only the
+   vertices which have different normals in different triangles are split. The triangles are
+   drawn with the element buffer whose indices refer to the shared vertices.
+
+   The buffers are stored in the compact formats to reduce the GPU memory. The normals are
+   packed by packNormal(), and the indices are 16-bit when the number of the vertices allows it.
+*/
 void GLSLSceneRendererImpl::createMeshVertexArray(SgMesh* mesh, ShapeHandleSet* handleSet)
 {
-    SgIndexArray& triangleVertices = mesh->triangleVertices();
+    const SgIndexArray& triangleVertices = mesh->triangleVertices();
     const size_t totalNumVertices = triangleVertices.size();
+    handleSet->numVertices = totalNumVertices;
     
     const SgVertexArray& orgVertices = *mesh->vertices();
-    SgVertexArray vertices;
-    vertices.reserve(totalNumVertices);
-    handleSet->numVertices = totalNumVertices;
-
     const bool hasNormals = mesh->hasNormals();
-    const SgNormalArray& orgNormals = *mesh->normals();
     const SgIndexArray& normalIndices = mesh->normalIndices();
-    SgNormalArray normals;
-    if(hasNormals){
-        normals.reserve(totalNumVertices);
-    }
+
+    const SgVertexArray* vertices;
+    const SgNormalArray* normals = 0;
+    const GLuint* indices;
+    SgVertexArray splitVertices;
+    SgNormalArray splitNormals;
+    vector<GLuint> splitIndices;
+
+    if(!hasNormals || normalIndices.empty()){
+        // The original vertex indices can be used as they are
+        vertices = &orgVertices;
+        if(hasNormals){
+            normals = mesh->normals();
+        }
+        indices = reinterpret_cast<const GLuint*>(triangleVertices.data());
+
+    } else {
+        const SgNormalArray& orgNormals = *mesh->normals();
+        typedef boost::unordered_map<std::pair<int, int>, GLuint> VertexIndexMap;
+        VertexIndexMap vertexIndexMap;
+        splitVertices.reserve(orgVertices.size());
+        splitNormals.reserve(orgVertices.size());
+        splitIndices.resize(totalNumVertices);
         
-    const int numTriangles = mesh->numTriangles();
-    int faceVertexIndex = 0;
-    int numFaceVertices = 0;
-    
-    for(size_t i=0; i < numTriangles; ++i){
-        for(size_t j=0; j < 3; ++j){
-            const int orgVertexIndex = triangleVertices[faceVertexIndex];
-            vertices.push_back(orgVertices[orgVertexIndex]);
-            if(hasNormals){
-                if(normalIndices.empty()){
-                    normals.push_back(orgNormals[orgVertexIndex]);
-                } else {
-                    const int normalIndex = normalIndices[faceVertexIndex];
-                    normals.push_back(orgNormals[normalIndex]);
-                }
+        for(size_t i=0; i < totalNumVertices; ++i){
+            const int vertexIndex = triangleVertices[i];
+            const int normalIndex = normalIndices[i];
+            std::pair<VertexIndexMap::iterator, bool> inserted =
+                vertexIndexMap.insert(VertexIndexMap::value_type(
+                                          std::make_pair(vertexIndex, normalIndex), splitVertices.size()));
+            if(inserted.second){
+                splitVertices.push_back(orgVertices[vertexIndex]);
+                splitNormals.push_back(orgNormals[normalIndex]);
             }
-            ++faceVertexIndex;
+            splitIndices[i] = inserted.first->second;
         }
+        vertices = &splitVertices;
+        normals = &splitNormals;
+        indices = splitIndices.data();
     }
 
-    GLuint normalBufferHandle;
-    if(hasNormals){
-        handleSet->genBuffers(2);
-        normalBufferHandle = handleSet->vbo(1);
-    } else {
-        handleSet->genBuffers(1);
-        normalBufferHandle = 0;
-    }
-    GLuint positionBufferHandle = handleSet->vbo(0);
+    handleSet->genBuffers(3);
         
-    glBindBuffer(GL_ARRAY_BUFFER, positionBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vector3f), vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte*)NULL + (0)));
-    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, handleSet->vbo(0));
+    glBufferData(GL_ARRAY_BUFFER, vertices->size() * sizeof(Vector3f), vertices->data(), GL_STATIC_DRAW);
+    handleSet->buffers->setBufferBytes(0, vertices->size() * sizeof(Vector3f));
+    handleSet->setVertexAttribute(0);
     
-    if(hasNormals){
-        glBindBuffer(GL_ARRAY_BUFFER, normalBufferHandle);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(Vector3f), normals.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer((GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte*)NULL + (0)));
-        glEnableVertexAttribArray(1);
+    if(normals){
+        const size_t numNormals = normals->size();
+        vector<GLuint> packedNormals(numNormals);
+        for(size_t i=0; i < numNormals; ++i){
+            packedNormals[i] = packNormal((*normals)[i]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, handleSet->vbo(1));
+        glBufferData(GL_ARRAY_BUFFER, numNormals * sizeof(GLuint), packedNormals.data(), GL_STATIC_DRAW);
+        handleSet->buffers->setBufferBytes(1, numNormals * sizeof(GLuint));
+        handleSet->setPackedNormalAttribute(1);
+    }
+
+    // The element buffer binding is a part of the state of the vertex array object bound now
+    handleSet->setElementBuffer();
+    if(vertices->size() <= 65536){
+        vector<GLushort> shortIndices(indices, indices + totalNumVertices);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalNumVertices * sizeof(GLushort), shortIndices.data(), GL_STATIC_DRAW);
+        handleSet->buffers->setBufferBytes(2, totalNumVertices * sizeof(GLushort));
+        handleSet->buffers->indexType = handleSet->indexType = GL_UNSIGNED_SHORT;
+    } else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalNumVertices * sizeof(GLuint), indices, GL_STATIC_DRAW);
+        handleSet->buffers->setBufferBytes(2, totalNumVertices * sizeof(GLuint));
+        handleSet->buffers->indexType = handleSet->indexType = GL_UNSIGNED_INT;
     }
 }
 
@@ -1038,12 +2085,52 @@ void GLSLSceneRendererImpl::visitPointSet(SgPointSet* pointSet)
         setPointSize(defaultPointSize);
     }
     
-    renderPlot(pointSet, GL_POINTS, boost::bind(getPointSetVertices, pointSet));
+    if(!isPicking && self->isPointSetLODEnabled() &&
+       self->getLODPointSets(pointSet, modelMatrixStack.back(), lodPointSets)){
+        for(size_t i=0; i < lodPointSets.size(); ++i){
+            SgPointSet* node = lodPointSets[i];
+            renderPlot(node, GL_POINTS, boost::bind(getPointSetVertices, node));
+        }
+    } else {
+        renderPlot(pointSet, GL_POINTS, boost::bind(getPointSetVertices, pointSet));
+    }
 
     popProgram();
 }
 
 
+static SgColorArrayPtr getPlotColors(SgPlot* plot, int numVertices)
+{
+    SgColorArrayPtr colors;
+    if(plot->colorIndices().empty()){
+        const SgColorArray& orgColors = *plot->colors();
+        if(orgColors.size() >= numVertices){
+            colors = plot->colors();
+        } else {
+            colors = new SgColorArray(numVertices);
+            std::copy(orgColors.begin(), orgColors.end(), colors->begin());
+            std::fill(colors->begin() + orgColors.size(), colors->end(), orgColors.back());
+        }
+    }
+    return colors;
+}
+
+
+/**
+   The data store of the bound array buffer is orphaned before the data is written
+   so that the driver can give a new store without waiting for the draws which use the old one.
+   The store is allocated with some margin so that it can be reused when the size grows a little.
+*/
+static void uploadStreamingArray(GLsizeiptr size, const GLvoid* data, GLsizeiptr& capacity)
+{
+    if(size > capacity || size < capacity / 4){
+        capacity = size + size / 4;
+    }
+    glBufferData(GL_ARRAY_BUFFER, capacity, 0, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+}
+
+
 void GLSLSceneRendererImpl::renderPlot
 (SgPlot* plot, GLenum primitiveMode, boost::function<SgVertexArrayPtr()> getVertices)
 {
@@ -1061,7 +2148,13 @@ void GLSLSceneRendererImpl::renderPlot
     }
     
     ShapeHandleSet* handleSet = getOrCreateShapeHandleSet(plot, modelMatrixStack.back());
-    if(!handleSet->isValid()){
+    VertexBufferSet* buffers = handleSet->buffers;
+    bool isValid = handleSet->isValid();
+    if(isValid && (handleSet->vbo(1) != 0) != hasColors){
+        buffers->deleteBuffers();
+        isValid = false;
+    }
+    if(!isValid){
         SgVertexArrayPtr vertices = getVertices();
         const int n = vertices->size();
         handleSet->numVertices = n;
@@ -1070,29 +2163,50 @@ void GLSLSceneRendererImpl::renderPlot
         } else {
             handleSet->genBuffers(2);
             glBindBuffer(GL_ARRAY_BUFFER, handleSet->vbo(1));
-            SgColorArrayPtr colors;
-            if(plot->colorIndices().empty()){
-                const SgColorArray& orgColors = *plot->colors();
-                if(orgColors.size() >= n){
-                    colors = plot->colors();
-                } else {
-                    colors = new SgColorArray(n);
-                    std::copy(orgColors.begin(), orgColors.end(), colors->begin());
-                    std::fill(colors->begin() + orgColors.size(), colors->end(), orgColors.back());
-                }
-            }
+            SgColorArrayPtr colors = getPlotColors(plot, n);
             if(colors){
-                glBufferData(GL_ARRAY_BUFFER, n * sizeof(Vector3f), colors->data(), GL_STATIC_DRAW);
-                glVertexAttribPointer((GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte*)NULL +(0)));
-                glEnableVertexAttribArray(1);
+                buffers->capacities[1] = n * sizeof(Vector3f);
+                glBufferData(GL_ARRAY_BUFFER, buffers->capacities[1], colors->data(), GL_STATIC_DRAW);
+                buffers->setBufferBytes(1, buffers->capacities[1]);
+                handleSet->setVertexAttribute(1);
             }
         }
         glBindBuffer(GL_ARRAY_BUFFER, handleSet->vbo(0));
-        glBufferData(GL_ARRAY_BUFFER, vertices->size() * sizeof(Vector3f), vertices->data(), GL_STATIC_DRAW);
-        glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)));
-        glEnableVertexAttribArray(0);
-    }        
+        buffers->capacities[0] = n * sizeof(Vector3f);
+        glBufferData(GL_ARRAY_BUFFER, buffers->capacities[0], vertices->data(), GL_STATIC_DRAW);
+        buffers->setBufferBytes(0, buffers->capacities[0]);
+        handleSet->setVertexAttribute(0);
+        buffers->modifiedPlotArrays = 0;
+
+    } else if(buffers->modifiedPlotArrays){
+        int n = handleSet->numVertices;
+        bool isNumVerticesChanged = false;
+        if(buffers->modifiedPlotArrays & VertexBufferSet::PlotVerticesModified){
+            SgVertexArrayPtr vertices = getVertices();
+            isNumVerticesChanged = (vertices->size() != n);
+            n = vertices->size();
+            glBindBuffer(GL_ARRAY_BUFFER, handleSet->vbo(0));
+            uploadStreamingArray(n * sizeof(Vector3f), vertices->data(), buffers->capacities[0]);
+            buffers->setBufferBytes(0, buffers->capacities[0]);
+            handleSet->numVertices = n;
+            buffers->numVertices = n;
+        }
+        if(hasColors &&
+           ((buffers->modifiedPlotArrays & VertexBufferSet::PlotColorsModified) || isNumVerticesChanged)){
+            SgColorArrayPtr colors = getPlotColors(plot, n);
+            if(colors){
+                glBindBuffer(GL_ARRAY_BUFFER, handleSet->vbo(1));
+                uploadStreamingArray(n * sizeof(Vector3f), colors->data(), buffers->capacities[1]);
+                buffers->setBufferBytes(1, buffers->capacities[1]);
+                if(!(buffers->bindingFlags & VertexBufferSet::NormalOrColorAttributeBit)){
+                    handleSet->setVertexAttribute(1);
+                }
+            }
+        }
+        buffers->modifiedPlotArrays = 0;
+    }
 
+    ++numDrawCalls;
     glDrawArrays(primitiveMode, 0, handleSet->numVertices);
     
     popPickId();
@@ -1355,6 +2469,37 @@ void GLSLSceneRenderer::setLineWidth(float width)
 }
 
 
+void GLSLSceneRenderer::setRenderListEnabled(bool on)
+{
+    if(!on){
+        impl->renderList.clear();
+    }
+    impl->isRenderListEnabled = on;
+}
+
+
+void GLSLSceneRenderer::setStaticShadowLayerEnabled(bool on)
+{
+    impl->isStaticShadowLayerEnabled = on;
+    impl->invalidateStaticShadowLayers();
+}
+
+
+void GLSLSceneRenderer::setRayPickingEnabled(bool on)
+{
+    if(!on){
+        impl->rayPicker.clearCache();
+    }
+    impl->isRayPickingEnabled = on;
+}
+
+
+void GLSLSceneRenderer::setInstancingEnabled(bool on)
+{
+    impl->isInstancingEnabled = on;
+}
+
+
 void GLSLSceneRenderer::setDefaultLighting(bool on)
 {
     if(on != impl->defaultLighting){
@@ -36,6 +36,76 @@ class CNOID_EXPORT GLSLSceneRenderer : public GLSceneRenderer
     virtual bool pick(int x, int y);
     virtual const Vector3& pickedPoint() const;
     virtual const SgNodePath& pickedNodePath() const;
+    virtual bool startImageReading();
+    virtual bool takeReadImage(Image& out_image);
+    virtual int numPendingImageReadings() const;
+    virtual int numDrawCalls() const;
+    virtual bool enableGPUTimer(bool on);
+    virtual double gpuTime() const;
+
+    /**
+       Read the depth buffer of the frame buffer currently bound as the 3D points in the camera
+       coordinate which are computed on the GPU. The points are written from the top row of the viewport
+       as the float triplets. The pointer is the offset in the buffer if a pixel pack buffer is bound.
+       The depth of the pixel where nothing is rendered is zero or infinity.
+       \return false if the conversion is not available.
+    */
+    bool readDepthBufferAsPoints(void* out_points);
+
+    /**
+       Compute the distances of the beams of a range sensor from the depth buffer of the frame buffer
+       currently bound on the GPU. The beams are given by the yaw and pitch angles in the coordinate of
+       the current camera, and only the beams whose yaw indices are in [yawBegin, yawEnd) are computed,
+       so a wide scan can be rendered and resampled sector by sector.
+       \return false if the resampling is not available.
+    */
+    bool resampleDepthBufferAsRanges(
+        int numYawSamples, int numPitchSamples, int yawBegin, int yawEnd,
+        double firstYawAngle, double yawStep, double firstPitchAngle, double pitchStep, double depthError);
+
+    /**
+       Read the distances computed by resampleDepthBufferAsRanges() as the floats from the lowest pitch angle.
+    */
+    bool readResampledRanges(float* out_ranges);
+
+    /**
+       Apply the lens distortion and the noise of the distances to the color and depth buffers of
+       the frame buffer currently bound. See SensorNoiseProgram and the noise parameters of Camera,
+       RangeCamera and RangeSensor for the details.
+       \return false if the noise cannot be applied.
+    */
+    bool applySensorNoise(bool hasColor, double k1, double k2, double rangeNoise, double rangeQuantizationStep,
+                          double dropoutRate, unsigned int seed);
+
+    /**
+       Draw the opaque shapes which share the same mesh and material by one instanced draw call.
+       This is enabled by default.
+    */
+    void setInstancingEnabled(bool on);
+
+    /**
+       Render the scene from the list of the shapes built by traversing the scene graph once
+       instead of traversing it every frame. The list is rebuilt when the structure of the scene
+       graph is changed with the notification of the update. This is enabled by default.
+    */
+    void setRenderListEnabled(bool on);
+
+    /**
+       Pick the node by casting the ray of the pixel to the meshes with their cached bounding volume
+       hierarchies instead of rendering the scene again. The picking by rendering is still used if
+       this is disabled or the ray cannot be determined before rendering the scene once.
+       This is enabled by default.
+    */
+    void setRayPickingEnabled(bool on);
+
+    /**
+       Keep the depth maps of the shapes which have not moved since the render list was built
+       as the static layers of the shadow maps, and only render the other shapes into the
+       shadow maps every frame. The static layers are rendered again when one of the shapes
+       in them moves, a node other than the transforms is updated, or the light moves.
+       This requires the render list, and it is enabled by default.
+    */
+    void setStaticShadowLayerEnabled(bool on);
 
     virtual void setDefaultLighting(bool on);
     void setHeadLightLightingFromBackEnabled(bool on);
@@ -7,12 +7,44 @@
 #include "MessageView.h"
 #include <cnoid/SceneDrawables>
 #include <cnoid/SceneCameras>
+#include <cnoid/MeshLODGenerator>
+#include <cnoid/PointSetLODGenerator>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/bind.hpp>
+#include <algorithm>
 #include <GL/gl.h>
 
 using namespace std;
 using namespace cnoid;
 
+namespace {
+
+class SharedResourceMap : public Referenced
+{
+public:
+    typedef boost::unordered_map<SgObject*, weak_ref_ptr<Referenced> > Map;
+    Map resources;
+    size_t numResourcesAtLastSweep;
+
+    SharedResourceMap() : numResourcesAtLastSweep(0) { }
+
+    void sweep(){
+        Map::iterator p = resources.begin();
+        while(p != resources.end()){
+            if(p->second.expired()){
+                p = resources.erase(p);
+            } else {
+                ++p;
+            }
+        }
+        numResourcesAtLastSweep = resources.size();
+    }
+};
+typedef ref_ptr<SharedResourceMap> SharedResourceMapPtr;
+
+}
+
 namespace cnoid {
 
 class GLSceneRendererImpl
@@ -28,6 +60,14 @@ public:
     Vector3f backgroundColor;
     Vector3f defaultColor;
     GLSceneRenderer::PolygonMode polygonMode;
+    bool isFrustumCullingEnabled;
+    Matrix4 frustumCullingMatrix;
+    boost::scoped_ptr<MeshLODGenerator> meshLODGenerator;
+    boost::scoped_ptr<PointSetLODGenerator> pointSetLODGenerator;
+    int textureUploadBudget;
+    bool isTextureMipmapEnabled;
+    bool isTextureCompressionEnabled;
+    SharedResourceMapPtr sharedResources;
 
     GLSceneRendererImpl(GLSceneRenderer* self, SgGroup* sceneRoot);
     ~GLSceneRendererImpl();
@@ -60,10 +100,17 @@ GLSceneRendererImpl::GLSceneRendererImpl(GLSceneRenderer* self, SgGroup* sceneRo
     scene = new SgGroup();
     sceneRoot->addChild(scene);
 
+    sharedResources = new SharedResourceMap;
+
     aspectRatio = 1.0f;
     backgroundColor << 0.1f, 0.1f, 0.3f; // dark blue
     defaultColor << 1.0f, 1.0f, 1.0f;
     polygonMode = GLSceneRenderer::FILL_MODE;
+    isFrustumCullingEnabled = true;
+    frustumCullingMatrix.setIdentity();
+    textureUploadBudget = 0;
+    isTextureMipmapEnabled = false;
+    isTextureCompressionEnabled = false;
 }
 
 
@@ -136,6 +183,179 @@ GLSceneRenderer::PolygonMode GLSceneRenderer::polygonMode() const
 }
 
 
+void GLSceneRenderer::enableFrustumCulling(bool on)
+{
+    impl->isFrustumCullingEnabled = on;
+}
+
+
+bool GLSceneRenderer::isFrustumCullingEnabled() const
+{
+    return impl->isFrustumCullingEnabled;
+}
+
+
+void GLSceneRenderer::setFrustumCullingMatrix(const Matrix4& PV)
+{
+    impl->frustumCullingMatrix = PV;
+}
+
+
+/**
+   The planes of the frustum are extracted from the rows of the matrix which maps the local
+   coordinate of the bounding box to the clip coordinate, and the box is outside the frustum
+   if it is on the negative side of any of the planes.
+*/
+bool GLSceneRenderer::isInFrustum(const BoundingBox& bbox, const Affine3& T) const
+{
+    if(bbox.empty()){
+        return true;
+    }
+    const Matrix4 C = impl->frustumCullingMatrix * T.matrix();
+    const Vector3 center = bbox.center();
+    const Vector3 extent = 0.5 * bbox.size();
+    for(int i=0; i < 3; ++i){
+        for(double sign = -1.0; sign <= 1.0; sign += 2.0){
+            const Vector4 plane = (C.row(3) + sign * C.row(i)).transpose();
+            const Vector3 n = plane.head<3>();
+            if(n.dot(center) + plane[3] + n.cwiseAbs().dot(extent) < 0.0){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+void GLSceneRenderer::enableMeshLOD(bool on)
+{
+    if(!on){
+        impl->meshLODGenerator.reset();
+    } else if(!impl->meshLODGenerator){
+        impl->meshLODGenerator.reset(new MeshLODGenerator);
+    }
+}
+
+
+bool GLSceneRenderer::isMeshLODEnabled() const
+{
+    return impl->meshLODGenerator.get() != 0;
+}
+
+
+SgMesh* GLSceneRenderer::getLODMesh(SgMesh* mesh, const Affine3& T)
+{
+    if(!impl->meshLODGenerator){
+        return mesh;
+    }
+    const BoundingBox& bbox = mesh->boundingBox();
+    if(bbox.empty()){
+        return mesh;
+    }
+    const Matrix4 C = impl->frustumCullingMatrix * T.matrix();
+    const double w = C.row(3).dot(bbox.center().homogeneous());
+    if(w <= 1.0e-6){
+        return mesh;
+    }
+    // The scale of the normalized device coordinate to the pixels is the half of the viewport height
+    const double projectedSize = bbox.boundingSphereRadius() * C.block<1, 3>(1, 0).norm() * impl->viewport[3] / w;
+    return impl->meshLODGenerator->getMesh(mesh, projectedSize);
+}
+
+
+void GLSceneRenderer::enablePointSetLOD(bool on)
+{
+    if(!on){
+        impl->pointSetLODGenerator.reset();
+    } else if(!impl->pointSetLODGenerator){
+        impl->pointSetLODGenerator.reset(new PointSetLODGenerator);
+    }
+}
+
+
+bool GLSceneRenderer::isPointSetLODEnabled() const
+{
+    return impl->pointSetLODGenerator.get() != 0;
+}
+
+
+void GLSceneRenderer::setTextureUploadBudget(int bytesPerFrame)
+{
+    impl->textureUploadBudget = std::max(0, bytesPerFrame);
+}
+
+
+int GLSceneRenderer::textureUploadBudget() const
+{
+    return impl->textureUploadBudget;
+}
+
+
+void GLSceneRenderer::enableTextureMipmaps(bool on)
+{
+    impl->isTextureMipmapEnabled = on;
+}
+
+
+bool GLSceneRenderer::isTextureMipmapEnabled() const
+{
+    return impl->isTextureMipmapEnabled;
+}
+
+
+void GLSceneRenderer::enableTextureCompression(bool on)
+{
+    impl->isTextureCompressionEnabled = on;
+}
+
+
+bool GLSceneRenderer::isTextureCompressionEnabled() const
+{
+    return impl->isTextureCompressionEnabled;
+}
+
+
+bool GLSceneRenderer::getLODPointSets(SgPointSet* pointSet, const Affine3& T, std::vector<SgPointSet*>& out_pointSets)
+{
+    if(!impl->pointSetLODGenerator){
+        return false;
+    }
+    const Matrix4 C = impl->frustumCullingMatrix * T.matrix();
+    return impl->pointSetLODGenerator->getPointSets(pointSet, C, impl->viewport[3], out_pointSets);
+}
+
+
+void GLSceneRenderer::shareResourcesWith(GLSceneRenderer* renderer)
+{
+    impl->sharedResources = renderer->impl->sharedResources;
+}
+
+
+Referenced* GLSceneRenderer::findSharedResource(SgObject* object)
+{
+    SharedResourceMap::Map& resources = impl->sharedResources->resources;
+    SharedResourceMap::Map::iterator p = resources.find(object);
+    if(p != resources.end()){
+        if(!p->second.expired()){
+            return p->second.lock().get();
+        }
+        resources.erase(p);
+    }
+    return 0;
+}
+
+
+void GLSceneRenderer::addSharedResource(SgObject* object, Referenced* resource)
+{
+    SharedResourceMap* map = impl->sharedResources;
+    map->resources.erase(object);
+    map->resources.insert(SharedResourceMap::Map::value_type(object, weak_ref_ptr<Referenced>(resource)));
+    if(map->resources.size() > 2 * map->numResourcesAtLastSweep + 16){
+        map->sweep();
+    }
+}
+
+
 void GLSceneRenderer::setViewport(int x, int y, int width, int height)
 {
     if(height > 0){
@@ -167,6 +387,42 @@ double GLSceneRenderer::aspectRatio() const
 }
 
 
+bool GLSceneRenderer::startImageReading()
+{
+    return false;
+}
+
+
+bool GLSceneRenderer::takeReadImage(Image& out_image)
+{
+    return false;
+}
+
+
+int GLSceneRenderer::numPendingImageReadings() const
+{
+    return 0;
+}
+
+
+int GLSceneRenderer::numDrawCalls() const
+{
+    return 0;
+}
+
+
+bool GLSceneRenderer::enableGPUTimer(bool on)
+{
+    return false;
+}
+
+
+double GLSceneRenderer::gpuTime() const
+{
+    return -1.0;
+}
+
+
 bool GLSceneRenderer::initializeGL()
 {
     ostream& os = mvout();
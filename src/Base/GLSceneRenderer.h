@@ -7,10 +7,12 @@
 #define CNOID_BASE_GL_SCENE_RENDERER_H
 
 #include <cnoid/SceneRenderer>
+#include <vector>
 #include "exportdecl.h"
 
 namespace cnoid {
 
+class Image;
 class GLSceneRendererImpl;
     
 class CNOID_EXPORT GLSceneRenderer : public SceneRenderer
@@ -47,6 +49,94 @@ public:
     
     bool unproject(double x, double y, double z, Vector3& out_projected) const;    
 
+    /**
+       The shapes and the transform nodes whose bounding boxes are outside the view frustum
+       of the current camera are not rendered if this is enabled. This is enabled by default.
+    */
+    void enableFrustumCulling(bool on);
+    bool isFrustumCullingEnabled() const;
+
+    /**
+       Set the matrix which maps the coordinate given to isInFrustum() to the clip coordinate,
+       i.e. the product of the projection matrix and the view matrix of the current camera.
+    */
+    void setFrustumCullingMatrix(const Matrix4& PV);
+
+    /**
+       \return false if the bounding box transformed by T is completely outside the frustum.
+       An empty bounding box is regarded as being inside the frustum.
+    */
+    bool isInFrustum(const BoundingBox& bbox, const Affine3& T) const;
+
+    /**
+       The heavy meshes are rendered with their simplified versions generated by MeshLODGenerator
+       when their sizes on the screen are small if this is enabled. This is disabled by default.
+    */
+    void enableMeshLOD(bool on);
+    bool isMeshLODEnabled() const;
+
+    /**
+       \return The level of the mesh for its size on the screen, which is computed with the matrix
+       given by setFrustumCullingMatrix() and the given transform. The mesh itself is returned
+       if the level of detail is disabled.
+    */
+    SgMesh* getLODMesh(SgMesh* mesh, const Affine3& T);
+
+    /**
+       The large point sets are rendered with the nodes of their octrees generated by PointSetLODGenerator
+       if this is enabled. This is disabled by default.
+    */
+    void enablePointSetLOD(bool on);
+    bool isPointSetLODEnabled() const;
+
+    /**
+       \return false if the point set should be rendered as it is. Otherwise the point sets of the octree
+       nodes selected for the view with the matrix given by setFrustumCullingMatrix() and the given transform
+       are given to out_pointSets, and they are rendered instead of the point set.
+    */
+    bool getLODPointSets(SgPointSet* pointSet, const Affine3& T, std::vector<SgPointSet*>& out_pointSets);
+
+    /**
+       Limit the total size of the texture images uploaded to the GPU in a frame so that
+       the rendering is not stalled by a model with a lot of large textures. The textures
+       exceeding the limit are rendered from the following frames, and the rendering of
+       them is requested by sigRenderingRequest(). The size is given in bytes, and zero,
+       which is the default, means no limit.
+    */
+    void setTextureUploadBudget(int bytesPerFrame);
+    int textureUploadBudget() const;
+
+    /**
+       The mipmaps of all the textures are generated if this is enabled. Otherwise they are
+       only generated for the textures rendered in the display lists. This is disabled by default.
+    */
+    void enableTextureMipmaps(bool on);
+    bool isTextureMipmapEnabled() const;
+
+    /**
+       The textures are stored in the compressed formats chosen by the driver if this is enabled
+       to reduce the GPU memory. This is disabled by default.
+    */
+    void enableTextureCompression(bool on);
+    bool isTextureCompressionEnabled() const;
+
+    /**
+       Share the GL objects of the meshes and the images such as the buffers and the textures with
+       the given renderer and the renderers which already share them with it. The renderers must be
+       instances of the same class, and their GL contexts must be in the same share group.
+       This function must be called before rendering anything.
+    */
+    void shareResourcesWith(GLSceneRenderer* renderer);
+
+    /**
+       The functions to implement the sharing for the subclasses.
+       \return The resource created for the object by one of the sharing renderers, or null if there is no such resource.
+    */
+    Referenced* findSharedResource(SgObject* object);
+
+    //! The resource is kept only while it is referenced by one of the renderers.
+    void addSharedResource(SgObject* object, Referenced* resource);
+
     const Vector3f& backgroundColor() const;
     void setBackgroundColor(const Vector3f& color);
 
@@ -78,6 +168,44 @@ public:
 
     virtual void setColor(const Vector3f& color) = 0;
 
+    /**
+       Start transferring the pixels of the viewport of the frame buffer currently bound to a pixel
+       buffer object. The transfer is done by the GPU without stalling the rendering, and the image
+       is obtained by takeReadImage() after the following frames are rendered.
+       \return false if the transfer cannot be started because the pixel buffer objects are not
+       supported or the images of the previous transfers have not been taken.
+    */
+    virtual bool startImageReading();
+
+    /**
+       Get the image of the oldest transfer started by startImageReading() which has not been taken.
+       This function waits for the transfer if it has not been completed yet.
+       \return false if there is no such transfer
+    */
+    virtual bool takeReadImage(Image& out_image);
+
+    virtual int numPendingImageReadings() const;
+
+    /**
+       \return The number of the draw commands such as glDrawArrays, glDrawElements and glCallList
+       issued by the last rendering.
+    */
+    virtual int numDrawCalls() const;
+
+    /**
+       Measure the time spent by the GPU to execute the commands of each render() call with the
+       timer queries if this is enabled. This is disabled by default.
+       \return false if the timer queries are not supported
+    */
+    virtual bool enableGPUTimer(bool on);
+
+    /**
+       \return The GPU time of the latest rendering whose result has been obtained in seconds,
+       or a negative value if it is not available. The result is usually obtained when the next
+       frame is rendered so that the query does not stall the pipeline.
+    */
+    virtual double gpuTime() const;
+
 protected:
     virtual void onSceneGraphUpdated(const SgUpdate& update);
     virtual void onImageUpdated(SgImage* image) = 0;
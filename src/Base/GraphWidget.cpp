@@ -16,6 +16,7 @@
 #include <boost/dynamic_bitset.hpp>
 #include <QGridLayout>
 #include <QPainter>
+#include <QPixmap>
 #include <QFocusEvent>
 #include <cmath>
 #include <deque>
@@ -50,6 +51,151 @@ struct EditHistory
 };
 typedef boost::shared_ptr<EditHistory> EditHistoryPtr;
 typedef deque<EditHistoryPtr> EditHistoryList;
+
+
+inline double calcVelocity(int frame, const double* values, double stepRatio2)
+{
+    return (values[frame + 1] - values[frame - 1]) / stepRatio2;
+}
+
+struct ValueAccessor
+{
+    const double* values;
+    ValueAccessor(const double* values) : values(values) { }
+    double operator()(int frame) const { return values[frame]; }
+};
+
+struct VelocityAccessor
+{
+    const double* values;
+    double stepRatio2;
+    VelocityAccessor(const double* values, double stepRatio2) : values(values), stepRatio2(stepRatio2) { }
+    double operator()(int frame) const { return calcVelocity(frame, values, stepRatio2); }
+};
+
+struct MinMax
+{
+    double min;
+    double max;
+    int minFrame;
+    int maxFrame;
+
+    void set(double v, int frame) {
+        min = max = v;
+        minFrame = maxFrame = frame;
+    }
+    // The earlier frame is kept for the same value so that the result does not depend on the blocks
+    void merge(const MinMax& m) {
+        if(m.max > max){
+            max = m.max;
+            maxFrame = m.maxFrame;
+        }
+        if(m.min < min){
+            min = m.min;
+            minFrame = m.minFrame;
+        }
+    }
+};
+
+/**
+   Multi-resolution table of the minimum and maximum values of a sequence.
+   The i-th block of level l covers the frames [i * s, (i + 1) * s) where s = BaseBlockSize << l.
+   Only the complete blocks are stored, and the frames which are not covered by any block
+   are accessed directly.
+*/
+class MinMaxPyramid
+{
+public:
+    static const int BaseBlockSizeBits = 4;
+    static const int BaseBlockSize = 1 << BaseBlockSizeBits;
+
+    MinMaxPyramid() : isValid_(false), numFrames(0) { }
+
+    bool isValid() const { return isValid_; }
+    void invalidate() { isValid_ = false; }
+
+    template <class Accessor> void build(int numFrames, const Accessor& value) {
+        this->numFrames = numFrames;
+        levels.clear();
+        int numBlocks = numFrames >> BaseBlockSizeBits;
+        while(numBlocks > 0){
+            levels.push_back(vector<MinMax>(numBlocks));
+            numBlocks /= 2;
+        }
+        isValid_ = true;
+        update(0, numFrames, value);
+    }
+
+    //! The blocks containing the frames [frameBegin, frameEnd) are recalculated
+    template <class Accessor> void update(int frameBegin, int frameEnd, const Accessor& value) {
+        if(!isValid_ || levels.empty()){
+            return;
+        }
+        frameBegin = std::max(frameBegin, 0);
+        frameEnd = std::min(frameEnd, numFrames);
+        if(frameBegin >= frameEnd){
+            return;
+        }
+        int blockBegin = frameBegin >> BaseBlockSizeBits;
+        int blockEnd = std::min(((frameEnd - 1) >> BaseBlockSizeBits) + 1, (int)levels[0].size());
+        for(int i=blockBegin; i < blockEnd; ++i){
+            const int frame = i << BaseBlockSizeBits;
+            MinMax& m = levels[0][i];
+            m.set(value(frame), frame);
+            for(int j=1; j < BaseBlockSize; ++j){
+                MinMax v;
+                v.set(value(frame + j), frame + j);
+                m.merge(v);
+            }
+        }
+        for(size_t l=1; l < levels.size(); ++l){
+            const vector<MinMax>& lower = levels[l-1];
+            vector<MinMax>& upper = levels[l];
+            blockBegin /= 2;
+            blockEnd = std::min((blockEnd + 1) / 2, (int)upper.size());
+            for(int i=blockBegin; i < blockEnd; ++i){
+                upper[i] = lower[i*2];
+                upper[i].merge(lower[i*2+1]);
+            }
+        }
+    }
+
+    //! frameBegin must be less than frameEnd
+    template <class Accessor> void find(int frameBegin, int frameEnd, const Accessor& value, MinMax& out) const {
+        int frame = frameBegin;
+        out.set(value(frame), frame);
+        ++frame;
+        MinMax v;
+        while(frame < frameEnd){
+            // use the largest block which starts at the frame and fits in the range
+            int l = -1;
+            if(!(frame & (BaseBlockSize - 1))){
+                const int blockIndex = frame >> BaseBlockSizeBits;
+                for(l = levels.size() - 1; l >= 0; --l){
+                    const int size = BaseBlockSize << l;
+                    if(!(blockIndex & ((1 << l) - 1)) && frame + size <= frameEnd &&
+                       (blockIndex >> l) < (int)levels[l].size()){
+                        break;
+                    }
+                }
+            }
+            if(l >= 0){
+                out.merge(levels[l][frame >> (BaseBlockSizeBits + l)]);
+                frame += (BaseBlockSize << l);
+            } else {
+                v.set(value(frame), frame);
+                out.merge(v);
+                ++frame;
+            }
+        }
+    }
+    
+private:
+    bool isValid_;
+    int numFrames;
+    vector< vector<MinMax> > levels;
+};
+
 }
 
 
@@ -89,6 +235,16 @@ public:
     boost::dynamic_bitset<> controlPointMask;
     bool isControlPointUpdateNeeded;
 
+    // They are built when the trajectory is drawn with more than one frame per pixel
+    MinMaxPyramid valuePyramid;
+    MinMaxPyramid velocityPyramid;
+
+    void invalidatePyramids() {
+        valuePyramid.invalidate();
+        velocityPyramid.invalidate();
+    }
+    void updatePyramids(int frameBegin, int frameEnd);
+
     GraphDataHandler::DataRequestCallback dataRequestCallback;
     GraphDataHandler::DataModifiedCallback dataModifiedCallback;
 };
@@ -110,6 +266,11 @@ public:
     QVector<qreal> limitValueDashes;
     QPolygonF polyline;
 
+    // The graph except the cursor is rendered into this pixmap,
+    // which is reused while only the cursor moves
+    QPixmap graphCache;
+    bool isGraphCacheValid;
+
     GraphWidget::Mode mode;
     GraphWidget::EditMode editMode;
 
@@ -218,6 +379,7 @@ public:
 
     bool onFocusInEvent(QFocusEvent* event);
     bool onScreenResizeEvent(QResizeEvent* event);
+    void updateScreen();
     bool onScreenMouseButtonPressEvent(QMouseEvent* event);
     bool onScreenMouseButtonReleaseEvent(QMouseEvent* event);
     bool onScreenMouseMoveEvent(QMouseEvent* event);
@@ -233,7 +395,11 @@ public:
     void redoTrajectoryEdit();
     void selectEditTargetByClicking(double screenX, double screenY);
     bool onScreenPaintEvent(QPaintEvent* event);
+    void renderGraph();
     void drawTrajectory(QPainter& painter, const QRect& rect, GraphDataHandlerImpl* data);
+    template <class Accessor> void setDecimatedPolyline(
+        const MinMaxPyramid& pyramid, const Accessor& value, int frame, int frame_begin, int frame_end,
+        double screenOffsetX, double xratio);
     void drawLimits(QPainter& painter, GraphDataHandlerImpl* data);
     void updateControlPoints(GraphDataHandlerImpl* data);
     void drawGrid(QPainter& painter);
@@ -301,6 +467,20 @@ void GraphDataHandler::setFrameProperties(int numFrames, double frameRate, doubl
     impl->stepRatio = 1.0 / frameRate;
     impl->offset = offset;
     impl->isControlPointUpdateNeeded = true;
+    impl->invalidatePyramids();
+}
+
+
+void GraphDataHandlerImpl::updatePyramids(int frameBegin, int frameEnd)
+{
+    if(numFrames > 0){
+        double* values_ = &values[1];
+        values_[-1] = values_[0];
+        values_[numFrames] = values_[numFrames - 1];
+        valuePyramid.update(frameBegin, frameEnd, ValueAccessor(values_));
+        // The velocity of a frame depends on the adjacent frames
+        velocityPyramid.update(frameBegin - 1, frameEnd + 1, VelocityAccessor(values_, 2.0 * stepRatio));
+    }
 }
 
 
@@ -377,6 +557,7 @@ GraphWidgetImpl::GraphWidgetImpl(GraphWidget* self, View* parentView)
 
     screen = new QWidget(self);
     screen->setMouseTracking(true);
+    isGraphCacheValid = false;
     screen->installEventFilter(self);
 
     hScrollbar = new DoubleScrollBar(Qt::Horizontal, self);
@@ -518,7 +699,7 @@ void GraphWidgetImpl::clearDataHandlers()
     isReconfigurationNeeded = true;
     isDomainUpdateNeeded = true;
 
-    screen->update();
+    updateScreen();
 }
 
 
@@ -538,8 +719,9 @@ void GraphWidgetImpl::updateData(GraphDataHandlerPtr handler)
     if(data->dataRequestCallback){
         vector<double>& values = data->values;
         data->dataRequestCallback(0, data->numFrames, &(values[1]));
+        data->invalidatePyramids();
     }
-    screen->update();
+    updateScreen();
 }
 
 
@@ -549,7 +731,7 @@ void GraphWidget::setRenderingTypes
     impl->isOrgValueVisible = showOriginalValues;
     impl->isVelocityVisible = showVelocities;
     impl->isAccelerationVisible = showAccelerations;
-    impl->screen->update();
+    impl->updateScreen();
 }
 
 
@@ -630,7 +812,7 @@ bool GraphWidgetImpl::setCursorPosition(double x, bool isTimeBarSyncEnabled, boo
             leftX = std::max(domainLowerX, std::min(domainUpperX - visibleWidth, leftX));
             screenCursorX = screenMarginX + (x - leftX) * scaleX;
             isReconfigurationNeeded = true;
-            screen->update();
+            updateScreen();
         } else {
             double oldScreenCursorX = screenCursorX;
             screenCursorX = screenMarginX + (x - leftX) * scaleX;
@@ -726,7 +908,7 @@ void GraphWidgetImpl::setVerticalValueRange(double lower, double upper)
     rangeLowerY = lower;
     rangeUpperY = upper;
     isReconfigurationNeeded = true;
-    screen->update();
+    updateScreen();
 }
 
 
@@ -740,7 +922,7 @@ void GraphWidget::getVerticalValueRange(double& lower, double& upper)
 void GraphWidget::setLineWidth(double width)
 {
     impl->lineWidth = width;
-    impl->screen->update();
+    impl->updateScreen();
 }
 
 
@@ -777,7 +959,7 @@ void GraphWidget::showLimits(bool show)
 void GraphWidgetImpl::showLimits(bool show)
 {
     isLimitVisible = show;
-    screen->update();
+    updateScreen();
 }
 
 
@@ -797,7 +979,7 @@ void GraphWidgetImpl::showGrid(bool show)
 {
     isGridOn = show;
     isReconfigurationNeeded = true;
-    screen->update();
+    updateScreen();
 }
 
 
@@ -819,7 +1001,7 @@ void GraphWidgetImpl::setGridSize(double width, double height)
     gridHeight = height;
     if(isGridOn){
         isReconfigurationNeeded = true;
-        screen->update();
+        updateScreen();
     }
 }
 
@@ -854,7 +1036,7 @@ void GraphWidgetImpl::setControlPointStep(int step, int offset)
         for(size_t i=0; i < handlers.size(); ++i){
             handlers[i]->impl->isControlPointUpdateNeeded = true;
         }
-        screen->update();
+        updateScreen();
     }
 }
 
@@ -875,7 +1057,7 @@ void GraphWidget::highlightControlPoints(bool on)
 void GraphWidgetImpl::highlightControlPoints(bool on)
 {
     isControlPointsHighlighted = on;
-    screen->update();
+    updateScreen();
 }
 
 
@@ -901,7 +1083,7 @@ void GraphWidgetImpl::changeMode(GraphWidget::Mode mode)
             }
         }
 
-        screen->update();
+        updateScreen();
     }
 }
 
@@ -1060,10 +1242,18 @@ bool GraphWidgetImpl::onScreenResizeEvent(QResizeEvent* event)
     screenWidth = event->size().width();
     screenHeight = event->size().height();
     setupConfiguration();
+    isGraphCacheValid = false;
     return false;
 }
 
 
+void GraphWidgetImpl::updateScreen()
+{
+    isGraphCacheValid = false;
+    screen->update();
+}
+
+
 bool GraphWidgetImpl::onScreenMouseButtonPressEvent(QMouseEvent* event)
 {
     screen->setFocus(Qt::MouseFocusReason);
@@ -1266,7 +1456,7 @@ void GraphWidgetImpl::zoomScreen(int screenX, int screenY)
     centerY = dragOrgCenterY + dy;
     
     isReconfigurationNeeded = true;
-    screen->update();
+    updateScreen();
 }
 
 
@@ -1275,7 +1465,7 @@ void GraphWidgetImpl::moveScreen(double screenX, double screenY)
     leftX = dragOrgLeftX + (pressedScreenX - screenX) / scaleX;
     centerY = dragOrgCenterY + (pressedScreenY - screenY) / scaleY;
     isReconfigurationNeeded = true;
-    screen->update();
+    updateScreen();
 }
 
 
@@ -1450,7 +1640,13 @@ void GraphWidgetImpl::doTrajectoryEdit(int screenX, int screenY, Qt::KeyboardMod
         }
     }
 
-    screen->update();
+    // The history covers all the frames modified in the current edit, including the restored ones
+    EditHistoryPtr& history = editTarget->editHistories.back();
+    if(!history->orgValues.empty()){
+        editTarget->updatePyramids(history->frame, history->frame + history->orgValues.size());
+    }
+
+    updateScreen();
 
 
     double cursorX;
@@ -1502,8 +1698,9 @@ void GraphWidgetImpl::undoTrajectoryEdit()
             EditHistoryPtr history = editTarget->editHistories[currentHistory];
             std::copy(history->orgValues.begin(), history->orgValues.end(),
                       editTarget->values.begin() + history->frame + 1);
+            editTarget->updatePyramids(history->frame, history->frame + history->orgValues.size());
             editTarget->dataModifiedCallback(history->frame, history->orgValues.size(), &history->orgValues[0]);
-            screen->update();
+            updateScreen();
         }
     }
 }
@@ -1518,9 +1715,10 @@ void GraphWidgetImpl::redoTrajectoryEdit()
             EditHistoryPtr history = editTarget->editHistories[currentHistory];
             std::copy(history->newValues.begin(), history->newValues.end(),
                       editTarget->values.begin() + history->frame + 1);
+            editTarget->updatePyramids(history->frame, history->frame + history->newValues.size());
             editTarget->dataModifiedCallback(history->frame, history->newValues.size(), &history->newValues[0]);
             currentHistory++;
-            screen->update();
+            updateScreen();
         }
     }
 }
@@ -1569,7 +1767,7 @@ void GraphWidgetImpl::selectEditTargetByClicking(double screenX, double screenY)
         changeMode(newMode);
     } else {
         if(newTarget != editTarget){
-            screen->update();
+            updateScreen();
         }
         editTarget = newTarget;
     }
@@ -1580,13 +1778,40 @@ bool GraphWidgetImpl::onScreenPaintEvent(QPaintEvent* event)
 {
     if(isReconfigurationNeeded){
         setupConfiguration();
+        isGraphCacheValid = false;
     }
 
-    QPainter painter(screen);
+    if(!isGraphCacheValid || graphCache.size() != screen->size()){
+        renderGraph();
+    }
 
-    //painter.setRenderHint(QPainter::Antialiasing);
+    QPainter painter(screen);
     painter.setClipRegion(event->region());
     painter.setClipping(true);
+    painter.drawPixmap(event->rect(), graphCache, event->rect());
+
+    // draw the cursor
+    pen.setStyle(Qt::SolidLine);
+    pen.setWidthF(1.0);
+    pen.setColor(QColor(25, 25, 25, 230));
+    pen.setDashPattern(cursorDashes);
+    painter.setPen(pen);
+    painter.drawLine(QPointF(screenCursorX, 0.0), QPointF(screenCursorX, screenHeight));
+
+    return false;
+}
+
+
+void GraphWidgetImpl::renderGraph()
+{
+    if(graphCache.size() != screen->size()){
+        graphCache = QPixmap(screen->size());
+    }
+    graphCache.fill(Qt::transparent);
+    
+    QPainter painter(&graphCache);
+
+    //painter.setRenderHint(QPainter::Antialiasing);
 
     pen.setStyle(Qt::SolidLine);
     pen.setWidthF(1.0);
@@ -1612,33 +1837,18 @@ bool GraphWidgetImpl::onScreenPaintEvent(QPaintEvent* event)
     pen.setWidthF(lineWidth);
     painter.setPen(pen);
     
+    const QRect rect = screen->rect();
     for(size_t i=0; i < handlers.size(); ++i){
         GraphDataHandlerImpl* data = handlers[i]->impl;
-        drawTrajectory(painter, event->rect(), data);
+        drawTrajectory(painter, rect, data);
     }
 
-    pen.setWidthF(1.0);
-    painter.setPen(pen);
-    
-    // draw the cursor
-    pen.setColor(QColor(25, 25, 25, 230));
-    pen.setDashPattern(cursorDashes);
-    painter.setPen(pen);
-    painter.drawLine(QPointF(screenCursorX, 0.0), QPointF(screenCursorX, screenHeight));
-
-    //return true;
-    return false;
+    isGraphCacheValid = true;
 }
 
 #include <iomanip>
 
 
-static inline double calcVelocity(int frame, double* values, double stepRatio2)
-{
-    return (values[frame + 1] - values[frame - 1]) / stepRatio2;
-}
-
-
 void GraphWidgetImpl::drawTrajectory
 (QPainter& painter, const QRect& rect, GraphDataHandlerImpl* data)
 {
@@ -1699,37 +1909,11 @@ void GraphWidgetImpl::drawTrajectory
                     ++frame;
                 }
             } else {
-                const int m = (int)(0.5 / xratio);
-                const int n = ceil(double(frame_end - frame) / m);
-                polyline.resize(n * 2);
-                for(int i=0; i < n; ++i){
-                    double px_min = screenOffsetX + (frame - frame_begin) * xratio;
-                    double px_max = px_min;
-                    const int next = std::min(frame + m, frame_end);
-                    double min = calcVelocity(frame++, values, stepRatio2);
-                    double max = min;
-                    while(frame < next){
-                        const double v = calcVelocity(frame, values, stepRatio2);
-                        if(v > max){
-                            max = v;
-                            px_max = screenOffsetX + (frame - frame_begin) * xratio;
-                        } else if(v < min){
-                            min = v;
-                            px_min = screenOffsetX + (frame - frame_begin) * xratio;
-                        }
-                        frame++;
-                    }
-                    const double upper = screenCenterY - (max + centerY) * scaleY;
-                    const double lower = screenCenterY - (min + centerY) * scaleY;
-
-                    if(px_min <= px_max){
-                        polyline[i*2] = QPointF(px_min, lower);
-                        polyline[i*2+1] = QPointF(px_max, upper);
-                    } else {
-                        polyline[i*2] = QPointF(px_max, upper);
-                        polyline[i*2+1] = QPointF(px_min, lower);
-                    }
+                VelocityAccessor velocity(values, stepRatio2);
+                if(!data->velocityPyramid.isValid()){
+                    data->velocityPyramid.build(numFrames, velocity);
                 }
+                setDecimatedPolyline(data->velocityPyramid, velocity, frame, frame_begin, frame_end, screenOffsetX, xratio);
             }
 
             painter.drawPolyline(polyline);
@@ -1755,35 +1939,11 @@ void GraphWidgetImpl::drawTrajectory
                     ++frame;
                 }
             } else {
-                const int m = (int)(0.5 / xratio);
-                const int n = ceil(double(frame_end - frame) / m);
-                polyline.resize(n * 2);
-                for(int i=0; i < n; ++i){
-                    double px_min = screenOffsetX + (frame - frame_begin) * xratio;
-                    double px_max = px_min;
-                    const int next = std::min(frame + m, frame_end);
-                    double min = values[frame++];
-                    double max = min;
-                    while(frame < next){
-                        const double v = values[frame++];
-                        if(v > max){
-                            max = v;
-                            px_max = screenOffsetX + (frame - frame_begin) * xratio;
-                        } else if(v < min){
-                            min = v;
-                            px_min = screenOffsetX + (frame - frame_begin) * xratio;
-                        }
-                    }
-                    const double upper = screenCenterY - (max + centerY) * scaleY;
-                    const double lower = screenCenterY - (min + centerY) * scaleY;
-                    if(px_min <= px_max){
-                        polyline[i*2] = QPointF(px_min, lower);
-                        polyline[i*2+1] = QPointF(px_max, upper);
-                    } else {
-                        polyline[i*2] = QPointF(px_max, upper);
-                        polyline[i*2+1] = QPointF(px_min, lower);
-                    }
+                ValueAccessor value(values);
+                if(!data->valuePyramid.isValid()){
+                    data->valuePyramid.build(numFrames, value);
                 }
+                setDecimatedPolyline(data->valuePyramid, value, frame, frame_begin, frame_end, screenOffsetX, xratio);
             }
 
             painter.drawPolyline(polyline);
@@ -1811,6 +1971,38 @@ void GraphWidgetImpl::drawTrajectory
 }
 
 
+/**
+   The minimum and maximum values in each half pixel are obtained from the pyramid,
+   so the number of the accessed values depends on the screen width rather than the number of frames.
+*/
+template <class Accessor>
+void GraphWidgetImpl::setDecimatedPolyline
+(const MinMaxPyramid& pyramid, const Accessor& value, int frame, int frame_begin, int frame_end,
+ double screenOffsetX, double xratio)
+{
+    const int m = (int)(0.5 / xratio);
+    const int n = ceil(double(frame_end - frame) / m);
+    polyline.resize(n * 2);
+    MinMax minmax;
+    for(int i=0; i < n; ++i){
+        const int next = std::min(frame + m, frame_end);
+        pyramid.find(frame, next, value, minmax);
+        frame = next;
+        const double px_min = screenOffsetX + (minmax.minFrame - frame_begin) * xratio;
+        const double px_max = screenOffsetX + (minmax.maxFrame - frame_begin) * xratio;
+        const double upper = screenCenterY - (minmax.max + centerY) * scaleY;
+        const double lower = screenCenterY - (minmax.min + centerY) * scaleY;
+        if(px_min <= px_max){
+            polyline[i*2] = QPointF(px_min, lower);
+            polyline[i*2+1] = QPointF(px_max, upper);
+        } else {
+            polyline[i*2] = QPointF(px_max, upper);
+            polyline[i*2+1] = QPointF(px_min, lower);
+        }
+    }
+}
+
+
 void GraphWidgetImpl::updateControlPoints(GraphDataHandlerImpl* data)
 {
     if(data->isControlPointUpdateNeeded){
@@ -1894,7 +2086,7 @@ void GraphWidgetImpl::onHScrollbarChanged(double value)
     if(value != leftX){
         leftX = value;
         isReconfigurationNeeded = true;
-        screen->update();
+        updateScreen();
     }
 }
 
@@ -1905,7 +2097,7 @@ void GraphWidgetImpl::onVScrollbarChanged(double value)
     if(y != centerY){
         centerY = y;
         isReconfigurationNeeded = true;
-        screen->update();
+        updateScreen();
     }
 }
 
@@ -2009,7 +2201,7 @@ bool GraphWidgetImpl::restoreState(const Archive& archive)
     archive.read("upper", rangeUpperY);
 
     isReconfigurationNeeded = true;
-    screen->update();
+    updateScreen();
 
     if(GraphBar::instance()->focusedGraphWidget() == self){
         GraphBar::instance()->focus(self, true);
@@ -8,9 +8,12 @@
 #include "ItemPath.h"
 #include "ItemManager.h"
 #include "MessageView.h"
+#include "Archive.h"
+#include "EventLoopMonitor.h"
 #include <typeinfo>
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/format.hpp>
 #include "gettext.h"
 
 using namespace std;
@@ -66,6 +69,7 @@ void Item::init()
 
     isConsistentWithFile_ = false;
     fileModificationTime_ = 0;
+    isFileLoadingPending_ = false;
 }
 
 
@@ -577,6 +581,7 @@ bool Item::traverse(Item* item, const boost::function<bool(Item*)>& function)
 
 void Item::notifyUpdate()
 {
+    EventLoopMonitor::Scope monitorScope("Item::sigUpdated", typeid(*this));
     sigUpdated_();
 }
 
@@ -590,6 +595,7 @@ void Item::notifyUpdate()
 */
 Item* Item::duplicate() const
 {
+    const_cast<Item*>(this)->loadPendingFile();
     Item* duplicated = doDuplicate();
     if(duplicated && (typeid(*duplicated) != typeid(*this))){
         delete duplicated;
@@ -733,6 +739,52 @@ void Item::updateFileInformation(const std::string& filename, const std::string&
 }
 
 
+/**
+   This function is used in restore() instead of load() by the items whose files may be large.
+   When on-demand loading is enabled for the archive, only the file information is restored here,
+   and the file is loaded by loadPendingFile() when the item is checked, selected or used by
+   a simulation for the first time.
+*/
+bool Item::loadFileOnDemand(const Archive& archive, const std::string& filename, const std::string& format)
+{
+    if(!archive.isOnDemandLoadingEnabled()){
+        return load(filename, archive.currentParentItem(), format);
+    }
+    
+    filesystem::path fpath(filename);
+    if(!filesystem::exists(fpath)){
+        MessageView::instance()->putln(
+            MessageView::WARNING, boost::format(_("\"%1%\" does not exist.")) % filename);
+        return false;
+    }
+    updateFileInformation(filename, format);
+    isFileLoadingPending_ = true;
+
+    MessageView::instance()->putln(
+        boost::format(_("\"%1%\" (%2$.1f MB) will be loaded when \"%3%\" is used."))
+        % filename % (filesystem::file_size(fpath) / 1048576.0) % name_);
+    
+    return true;
+}
+
+
+bool Item::loadPendingFile()
+{
+    if(!isFileLoadingPending_){
+        return true;
+    }
+    isFileLoadingPending_ = false;
+
+    const string filename = filePath_;
+    const string format = fileFormat_;
+    if(load(filename, parentItem(), format)){
+        notifyUpdate();
+        return true;
+    }
+    return false;
+}
+
+
 /**
    Use this function to disable the implicit overwrite next time
 */
@@ -802,6 +854,9 @@ void Item::putProperties(PutPropertyFunction& putProperty)
 
     if(!filePath_.empty()){
         putProperty(_("File"), filePath_);
+        if(isFileLoadingPending_){
+            putProperty(_("File loading"), _("On demand"));
+        }
     }
 
     putProperty(_("Num children"), numChildren_);
@@ -833,3 +888,21 @@ bool Item::restore(const Archive& archive)
 {
     return true;
 }
+
+
+boost::function<void()> Item::getFileDataPreloader(const Archive& archive)
+{
+    return boost::function<void()>();
+}
+
+
+boost::function<void()> Item::getFileDataPreloaderForReloading(Item* /* orgItem */)
+{
+    return boost::function<void()>();
+}
+
+
+size_t Item::memoryUsage() const
+{
+    return 0;
+}
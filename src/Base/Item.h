@@ -9,6 +9,7 @@
 #include <cnoid/Referenced>
 #include <cnoid/Signal>
 #include <cnoid/NullOut>
+#include <boost/function.hpp>
 #include <ctime>
 #include <bitset>
 #include <string>
@@ -175,6 +176,13 @@ public:
 
     void clearFileInformation();
 
+    /**
+       This is true when the item has been restored from a project without loading its file.
+       The file is loaded by loadPendingFile() when the item is used for the first time.
+    */
+    bool isFileLoadingPending() const { return isFileLoadingPending_; }
+    bool loadPendingFile();
+
     void suggestFileUpdate() { isConsistentWithFile_ = false; }
 
     void putProperties(PutPropertyFunction& putProperty);
@@ -224,6 +232,34 @@ public:
     virtual bool store(Archive& archive);
     virtual bool restore(const Archive& archive);
 
+    /**
+       This function is called before restore() when the item is restored from a project.
+       An item which loads a file in restore() can return a function which loads the data of
+       the file in advance. The functions of the items are executed concurrently by worker threads,
+       so they must not access the item tree, the GUI and the other items. restore() is then called
+       in the main thread in the order of the item tree, and it can use the loaded data.
+       The default implementation returns an empty function.
+    */
+    virtual boost::function<void()> getFileDataPreloader(const Archive& archive);
+
+    /**
+       This function is called for the duplicate of an item when the item is reloaded.
+       An item can return a function which loads the file data of orgItem in advance in the same way
+       as getFileDataPreloader(). The function is executed by a worker thread, and the original item
+       is kept in the item tree until the function finishes. load() is then called for the duplicate
+       in the main thread, and the duplicate replaces the original item at once.
+       The default implementation returns an empty function.
+    */
+    virtual boost::function<void()> getFileDataPreloaderForReloading(Item* orgItem);
+
+    /**
+       This function returns the size of the memory occupied by the data of this item in bytes.
+       The size is shown in the memory usage view to find the items to unload. The memory shared
+       with other items and the memory of the child items should not be included.
+       The default implementation returns zero, which means that the size is not available.
+    */
+    virtual size_t memoryUsage() const;
+
     Referenced* customData(int id);
     const Referenced* customData(int id) const;
     void setCustomData(int id, ReferencedPtr data);
@@ -244,6 +280,8 @@ protected:
     virtual void doAssign(Item* srcItem);
     virtual void doPutProperties(PutPropertyFunction& putProperty);
 
+    bool loadFileOnDemand(const Archive& archive, const std::string& filename, const std::string& format);
+
     void setAttribute(Attribute attribute) { attributes.set(attribute); }
     void unsetAttribute(Attribute attribute) { attributes.reset(attribute); }
 
@@ -277,6 +315,7 @@ private:
     std::string filePath_;
     std::string fileFormat_;
     std::time_t fileModificationTime_;
+    bool isFileLoadingPending_;
 
     // disable the assignment operator
     Item& operator=(const Item& rhs);
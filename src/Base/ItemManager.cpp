@@ -12,6 +12,8 @@
 #include "MessageView.h"
 #include "CheckBox.h"
 #include "ParametricPathProcessor.h"
+#include "EventLoopMonitor.h"
+#include "LazyCaller.h"
 #include <cnoid/FileUtil>
 #include <cnoid/ExecutablePath>
 #include <QLayout>
@@ -27,6 +29,7 @@
 #include <boost/tokenizer.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/weak_ptr.hpp>
+#include <boost/thread.hpp>
 #include <set>
 #include <sstream>
 #include "gettext.h"
@@ -205,6 +208,47 @@ LoaderMap extToLoaderMap;
 
 QWidget* importMenu;
 
+/**
+   The reloaded item is not used if the original item has been removed from the tree
+   while the file data were preloaded.
+*/
+void replaceWithReloadedItem(ItemPtr item, ItemPtr reloaded)
+{
+    if(!item->parentItem()){
+        return;
+    }
+    if(reloaded->load(item->filePath(), item->parentItem(), item->fileFormat())){
+
+        item->parentItem()->insertChildItem(reloaded, item);
+                    
+        // move children to the reload item
+        ItemPtr child = item->childItem();
+        while(child){
+            ItemPtr nextChild = child->nextItem();
+            if(!child->isSubItem()){
+                child->detachFromParentItem();
+                reloaded->addChildItem(child);
+            }
+            child = nextChild;
+        }
+        reloaded->assign(item);
+
+        item->detachFromParentItem();
+    }
+}
+
+
+void preloadReloadedItem(boost::function<void()> preloader, ItemPtr item, ItemPtr reloaded)
+{
+    try {
+        preloader();
+    } catch(...){
+        // The item loads the file again in load() and reports the error there.
+    }
+    callLater(bind(replaceWithReloadedItem, item, reloaded));
+}
+
+
 void expandExtensionsToVector(const string& extensions, vector<string>& out_extensions)
 {
     typedef tokenizer< char_separator<char> > tokenizer;
@@ -868,7 +912,10 @@ bool ItemManagerImpl::load(LoaderPtr loader, Item* item, const std::string& file
         }
 
         ostream& os = messageView->cout(true);
-        loaded = (*loader->loadingFunction)(item, filename, os, parentItem);
+        {
+            EventLoopMonitor::Scope monitorScope("Item loading", typeid(*item));
+            loaded = (*loader->loadingFunction)(item, filename, os, parentItem);
+        }
         os.flush();
         
         if(!loaded){
@@ -1052,6 +1099,10 @@ bool ItemManagerImpl::save
 (Item* item, bool useDialogToGetFilename, bool doExport, std::string filename, const std::string& formatId)
 {
     item->setTemporal(false);
+
+    if(!item->loadPendingFile()){
+        return false;
+    }
     
     ClassInfoMap::iterator p = typeIdToClassInfoMap.find(typeid(*item).name());
     if(p == typeIdToClassInfoMap.end()){
@@ -1271,6 +1322,11 @@ bool ItemManager::overwrite(Item* item, bool forceOverwrite, const std::string&
 bool ItemManagerImpl::overwrite(Item* item, bool forceOverwrite, const std::string& formatId)
 {
     item->setTemporal(false);
+
+    if(item->isFileLoadingPending() && !forceOverwrite && (formatId.empty() || formatId == item->fileFormat())){
+        // The file has not been loaded, so the item has the same data as the file
+        return true;
+    }
     
     bool needToOverwrite = forceOverwrite;
 
@@ -1330,23 +1386,13 @@ void ItemManager::reloadItems(const ItemList<>& items)
 
             ItemPtr reloaded = item->duplicate();
             if(reloaded){
-                if(reloaded->load(item->filePath(), item->parentItem(), item->fileFormat())){
-
-                    item->parentItem()->insertChildItem(reloaded, item);
-                    
-                    // move children to the reload item
-                    ItemPtr child = item->childItem();
-                    while(child){
-                        ItemPtr nextChild = child->nextItem();
-                        if(!child->isSubItem()){
-                            child->detachFromParentItem();
-                            reloaded->addChildItem(child);
-                        }
-                        child = nextChild;
-                    }
-                    reloaded->assign(item);
-
-                    item->detachFromParentItem();
+                boost::function<void()> preloader = reloaded->getFileDataPreloaderForReloading(item);
+                if(preloader){
+                    // The original item is kept displayed and usable until the data are loaded
+                    boost::thread preloadingThread(bind(preloadReloadedItem, preloader, ItemPtr(item), reloaded));
+                    preloadingThread.detach();
+                } else {
+                    replaceWithReloadedItem(item, reloaded);
                 }
             }
         }
@@ -181,6 +181,10 @@ public:
 
     void addMenuItemToImport(const std::string& caption, boost::function<void()> slot);
 
+    /**
+       The items which give the preloaders by Item::getFileDataPreloaderForReloading()
+       are replaced after the preloaders are executed by worker threads.
+    */
     static void reloadItems(const ItemList<>& items);
 
 private:
@@ -10,6 +10,9 @@
 #include "Archive.h"
 #include <cnoid/YAMLReader>
 #include <cnoid/YAMLWriter>
+#include <cnoid/TaskScheduler>
+#include <cnoid/TimingProfiler>
+#include <boost/bind.hpp>
 #include <set>
 #include "gettext.h"
 
@@ -17,6 +20,19 @@ using namespace std;
 using namespace boost;
 using namespace cnoid;
 
+namespace {
+
+void preloadFileData(boost::function<void()> preloader)
+{
+    try {
+        preloader();
+    } catch(...){
+        // The item loads the file again in restore() and reports the error there.
+    }
+}
+
+}
+
 namespace cnoid {
 
 class ItemTreeArchiverImpl
@@ -28,11 +44,14 @@ public:
     int numArchivedItems;
     int numRestoredItems;
     map<string, bool> nonExistentPlugins;
+    map<Archive*, ItemPtr> preloadingItems;
 
     ItemTreeArchiverImpl();
     ArchivePtr store(Archive& parentArchive, Item* item);
     ArchivePtr storeIter(Archive& parentArchive, Item* item, bool& isComplete);
     bool restore(Archive& archive, Item* parentItem, const std::set<std::string>& optionalPlugins);
+    void preloadItemIter(Archive& archive, TaskGroup& preloadingTasks);
+    ItemPtr createItem(Archive& archive, const string& pluginName, const string& className);
     void restoreItemIter(Archive& archive, Item* parentItem, const std::set<std::string>& optionalPlugins);
 };
 
@@ -180,17 +199,76 @@ bool ItemTreeArchiverImpl::restore(Archive& archive, Item* parentItem, const std
 
     archive.setCurrentParentItem(0);
     try {
+        /*
+          The items are created and the file data given by their preloaders are loaded concurrently
+          before the items are restored in the order of the tree.
+        */
+        {
+            TimingProfiler::Scope timingScope("ItemTreeArchiver/Preloading file data");
+            TaskGroup preloadingTasks;
+            preloadItemIter(archive, preloadingTasks);
+            preloadingTasks.wait();
+        }
         restoreItemIter(archive, parentItem, optionalPlugins);
     } catch (const ValueNode::Exception& ex){
         os << ex.message();
     }
     archive.setCurrentParentItem(0);
     nonExistentPlugins.clear();
+    preloadingItems.clear();
 
     return (numRestoredItems > 0);
 }
 
 
+void ItemTreeArchiverImpl::preloadItemIter(Archive& archive, TaskGroup& preloadingTasks)
+{
+    string name;
+    string pluginName;
+    string className;
+    if(archive.read("name", name) && !archive.get("isSubItem", false) &&
+       archive.read("plugin", pluginName) && archive.read("class", className)){
+
+        const char* actualPluginName = PluginManager::instance()->guessActualPluginName(pluginName);
+        if(actualPluginName){
+            ItemPtr item = ItemManager::create(actualPluginName, className);
+            if(item && !dynamic_pointer_cast<RootItem>(item)){
+                preloadingItems[&archive] = item;
+                item->setName(name);
+                ValueNodePtr dataNode = archive.find("data");
+                if(dataNode->isValid() && dataNode->isMapping()){
+                    Archive* dataArchive = static_cast<Archive*>(dataNode->toMapping());
+                    dataArchive->inheritSharedInfoFrom(archive);
+                    boost::function<void()> preloader = item->getFileDataPreloader(*dataArchive);
+                    if(preloader){
+                        preloadingTasks.run(boost::bind(preloadFileData, preloader));
+                    }
+                }
+            }
+        }
+    }
+
+    ListingPtr children = archive.findListing("children");
+    if(children->isValid()){
+        for(int i=0; i < children->size(); ++i){
+            Archive* childArchive = dynamic_cast<Archive*>(children->at(i)->toMapping());
+            childArchive->inheritSharedInfoFrom(archive);
+            preloadItemIter(*childArchive, preloadingTasks);
+        }
+    }
+}
+
+
+ItemPtr ItemTreeArchiverImpl::createItem(Archive& archive, const string& pluginName, const string& className)
+{
+    map<Archive*, ItemPtr>::iterator p = preloadingItems.find(&archive);
+    if(p != preloadingItems.end()){
+        return p->second;
+    }
+    return ItemManager::create(pluginName, className);
+}
+
+
 void ItemTreeArchiverImpl::restoreItemIter
 (Archive& archive, Item* parentItem, const std::set<std::string>& optionalPlugins)
 {
@@ -220,7 +298,7 @@ void ItemTreeArchiverImpl::restoreItemIter
 
         const char* actualPluginName = PluginManager::instance()->guessActualPluginName(pluginName);
         if(actualPluginName){
-            item = ItemManager::create(actualPluginName, className);
+            item = createItem(archive, actualPluginName, className);
         } else {
             pair<map<string, bool>::iterator, bool> ret =
                 nonExistentPlugins.insert(pair<string, bool>(pluginName, isOptional));
@@ -255,6 +333,8 @@ void ItemTreeArchiverImpl::restoreItemIter
             } else {
                 mv->putln(format(_("Restoring %1% \"%2%\"")) % className % name);
                 mv->flush();
+
+                TimingProfiler::Scope timingScope("ItemTreeArchiver/Restoring ", className);
                 
                 ValueNodePtr dataNode = archive.find("data");
                 if(dataNode->isValid()){
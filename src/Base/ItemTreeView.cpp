@@ -11,6 +11,7 @@
 #include "AppConfig.h"
 #include "Archive.h"
 #include "TreeWidget.h"
+#include "LazyCaller.h"
 #include <cnoid/ConnectionSet>
 #include <QBoxLayout>
 #include <QApplication>
@@ -121,6 +122,13 @@ public:
     bool isDropping;
     int fontPointSizeDiff;
 
+    /*
+      The sub trees added to the root item are inserted into the tree widget in a batch
+      when the control returns to the event loop or when the tree widget items are accessed.
+    */
+    ItemList<> pendingItems;
+    LazyCaller insertPendingItemsLater;
+
     int addCheckColumn();
     void initializeCheckState(QTreeWidgetItem* item, int column);
     void updateCheckColumnToolTipIter(QTreeWidgetItem* item, int column, const QString& tooltip);
@@ -130,10 +138,12 @@ public:
     virtual void mousePressEvent(QMouseEvent* event);
     virtual void keyPressEvent(QKeyEvent* event);
         
+    ItvItem* findItvItem(Item* item);
     ItvItem* getItvItem(Item* item);
     ItvItem* getOrCreateItvItem(Item* item);
     void onSubTreeAddedOrMoved(Item* item);
-    void insertItem(QTreeWidgetItem* parentTwItem, Item* item, Item* nextItem);
+    void insertPendingItems();
+    void insertItem(QTreeWidgetItem* parentTwItem, Item* item);
     void onSubTreeRemoved(Item* item, bool isMoving);
     void onTreeChanged();
     void onItemAssigned(Item* assigned, Item* srcItem);
@@ -232,6 +242,9 @@ void ItvItem::setData(int column, int role, const QVariant& value)
             CheckColumnPtr& cc = itemTreeViewImpl->checkColumns[id];
             cc->needToUpdateCheckedItemList = true;
             const bool checked = ((Qt::CheckState)value.toInt() == Qt::Checked);
+            if(checked){
+                item->loadPendingFile();
+            }
             cc->sigCheckToggled(item.get(), checked);
             SigCheckToggled* sig = sigCheckToggled(id);
             if(sig){
@@ -294,6 +307,8 @@ ItemTreeViewImpl::ItemTreeViewImpl(ItemTreeView* self, RootItem* rootItem, bool
     
     isProceccingSlotForRootItemSignals = 0;
     isDropping = false;
+
+    insertPendingItemsLater.setFunction(bind(&ItemTreeViewImpl::insertPendingItems, this));
     
     setColumnCount(1);
 
@@ -556,7 +571,7 @@ void ItemTreeViewImpl::keyPressEvent(QKeyEvent* event)
 }
 
 
-ItvItem* ItemTreeViewImpl::getItvItem(Item* item)
+ItvItem* ItemTreeViewImpl::findItvItem(Item* item)
 {
     ItvItem* itvItem = 0;
     ItvItemRef* ref = dynamic_cast<ItvItemRef*>(item->customData(0));
@@ -567,6 +582,19 @@ ItvItem* ItemTreeViewImpl::getItvItem(Item* item)
 }
 
 
+/**
+   This function inserts the pending items before returning the tree widget item
+   so that the state of an item can be accessed just after the item is added.
+*/
+ItvItem* ItemTreeViewImpl::getItvItem(Item* item)
+{
+    if(!pendingItems.empty()){
+        insertPendingItems();
+    }
+    return findItvItem(item);
+}
+
+
 ItvItem* ItemTreeViewImpl::getOrCreateItvItem(Item* item)
 {
     ItvItem* itvItem = getItvItem(item);
@@ -579,37 +607,77 @@ ItvItem* ItemTreeViewImpl::getOrCreateItvItem(Item* item)
 
 void ItemTreeViewImpl::onSubTreeAddedOrMoved(Item* item)
 {
+    if(item->parentItem()){
+        pendingItems.push_back(item);
+        insertPendingItemsLater();
+    }
+}
+
+
+void ItemTreeViewImpl::insertPendingItems()
+{
+    insertPendingItemsLater.cancel();
+
+    if(pendingItems.empty()){
+        return;
+    }
+    
     isProceccingSlotForRootItemSignals++;
+
+    ItemList<> items = pendingItems;
+    pendingItems.clear();
+
+    // The tree widget is laid out once for all the items
+    const bool wasUpdatesEnabled = updatesEnabled();
+    setUpdatesEnabled(false);
     
-    Item* parentItem = item->parentItem();
-    if(parentItem){
+    for(size_t i=0; i < items.size(); ++i){
+        Item* item = items.get(i);
+        Item* parentItem = item->parentItem();
+        if(!parentItem || item->findRootItem() != rootItem){
+            continue; // removed before being inserted
+        }
+        ItvItem* itvItem = findItvItem(item);
+        if(itvItem && itvItem->treeWidget()){
+            continue; // already inserted as a descendant of another pending item
+        }
         if(parentItem == rootItem){
-            insertItem(invisibleRootItem(), item, item->nextItem());
+            insertItem(invisibleRootItem(), item);
         } else {
-            ItvItem* parentItvItem = getItvItem(parentItem);
-            if(parentItvItem){
-                insertItem(parentItvItem, item, item->nextItem());
+            ItvItem* parentItvItem = findItvItem(parentItem);
+            if(parentItvItem && parentItvItem->treeWidget()){
+                insertItem(parentItvItem, item);
             }
         }
     }
 
+    setUpdatesEnabled(wasUpdatesEnabled);
+
     isProceccingSlotForRootItemSignals--;
 }
 
 
-void ItemTreeViewImpl::insertItem(QTreeWidgetItem* parentTwItem, Item* item, Item* nextItem)
+void ItemTreeViewImpl::insertItem(QTreeWidgetItem* parentTwItem, Item* item)
 {
-    ItvItem* itvItem = getOrCreateItvItem(item);
-    bool inserted = false;
-    if(nextItem){
-        ItvItem* nextItvItem = getItvItem(nextItem);
-        if(nextItvItem){
-            int index = parentTwItem->indexOfChild(nextItvItem);
-            parentTwItem->insertChild(index, itvItem);
-            inserted = true;
+    ItvItem* itvItem = findItvItem(item);
+    if(!itvItem){
+        itvItem = new ItvItem(item, this);
+    }
+
+    // The next sibling may not have been inserted yet if it is also pending
+    ItvItem* nextItvItem = 0;
+    for(Item* nextItem = item->nextItem(); nextItem; nextItem = nextItem->nextItem()){
+        ItvItem* candidate = findItvItem(nextItem);
+        if(candidate && candidate->treeWidget() &&
+           (candidate->parent() ? candidate->parent() : invisibleRootItem()) == parentTwItem){
+            nextItvItem = candidate;
+            break;
         }
     }
-    if(!inserted){
+    int index = nextItvItem ? parentTwItem->indexOfChild(nextItvItem) : -1;
+    if(index >= 0){
+        parentTwItem->insertChild(index, itvItem);
+    } else {
         parentTwItem->addChild(itvItem);
     }
         
@@ -620,7 +688,7 @@ void ItemTreeViewImpl::insertItem(QTreeWidgetItem* parentTwItem, Item* item, Ite
     }
 
     for(Item* childItem = item->childItem(); childItem; childItem = childItem->nextItem()){
-        insertItem(itvItem, childItem, 0);
+        insertItem(itvItem, childItem);
     }
 }
 
@@ -769,6 +837,7 @@ void ItemTreeViewImpl::onSelectionChanged()
     for(int i=0; i < selected.size(); ++i){
         ItvItem* itvItem = dynamic_cast<ItvItem*>(selected[i]);
         if(itvItem){
+            itvItem->item->loadPendingFile();
             selectedItemList.push_back(itvItem->item.get());
         }
     }
@@ -820,6 +889,7 @@ bool ItemTreeViewImpl::selectItem(Item* item, bool select)
 
 void ItemTreeView::selectAllItems()
 {
+    impl->insertPendingItems();
     impl->selectAll();
 }
 
@@ -927,6 +997,7 @@ ItemList<>& ItemTreeViewImpl::checkedItems(int id)
         CheckColumnPtr& cc = checkColumns[id];
         if(cc){
             if(cc->needToUpdateCheckedItemList){
+                insertPendingItems();
                 cc->checkedItemList.clear();
                 extractCheckedItems(invisibleRootItem(), id + 1, cc->checkedItemList);
                 cc->needToUpdateCheckedItemList = false;
@@ -1201,6 +1272,8 @@ bool ItemTreeViewImpl::restoreItemStates
 
 void ItemTreeViewImpl::storeExpandedItems(Archive& archive)
 {
+    insertPendingItems();
+    
     ListingPtr expanded = new Listing();
     expanded->setFlowStyle(true);
     storeExpandedItemsSub(invisibleRootItem(), archive, expanded);
@@ -1234,6 +1307,7 @@ void ItemTreeViewImpl::restoreExpandedItems(const Archive& archive)
 {
     const Listing& expanded = *archive.findListing("expanded");
     if(expanded.isValid()){
+        insertPendingItems();
         collapseAll();
         for(int i=0; i < expanded.size(); ++i){
             Item* item = archive.findItem(expanded.at(i));
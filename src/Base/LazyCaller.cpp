@@ -3,23 +3,53 @@
 */
 
 #include "LazyCaller.h"
+#include "EventLoopMonitor.h"
 #include <QObject>
 #include <QEvent>
 #include <QCoreApplication>
 #include <QThread>
 #include <QSemaphore>
+#include <QMutex>
 #include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
+#include <deque>
+#include <set>
+
+#if QT_VERSION >= 0x040700
+#include <QElapsedTimer>
+#else
+#include <QTime>
+typedef QTime QElapsedTimer;
+#endif
 
 using namespace std;
 using namespace cnoid;
 
 namespace {
 
-inline int toQtPriority(int priority) {
+const int NUM_PRIORITIES = 3;
+
+/*
+  The functions are called by the dispatcher until this time [ms] passes in a dispatch.
+  The rest of them are called in the next dispatch, so the input events and the painting
+  are processed between the dispatches even if a lot of functions are requested.
+*/
+const int dispatchTimeBudget = 10;
+
+inline int normalizePriority(int priority) {
     if(priority <= LazyCaller::PRIORITY_HIGH){
-        return Qt::HighEventPriority;
+        return LazyCaller::PRIORITY_HIGH;
     } else if(priority >= LazyCaller::PRIORITY_LOW){
+        return LazyCaller::PRIORITY_LOW;
+    } else {
+        return LazyCaller::PRIORITY_NORMAL;
+    }
+}
+
+inline int toQtPriority(int priority) {
+    if(priority == LazyCaller::PRIORITY_HIGH){
+        return Qt::HighEventPriority;
+    } else if(priority == LazyCaller::PRIORITY_LOW){
         return Qt::LowEventPriority;
     } else {
         return Qt::NormalEventPriority;
@@ -36,51 +66,61 @@ public:
     }
 };
 typedef boost::shared_ptr<SyncInfo> SyncInfoPtr;
-    
 
-class CallEvent : public QEvent
+
+struct CallEntry
 {
-public:
-    CallEvent(const boost::function<void(void)>& function)
-        : QEvent(QEvent::User),
-          function(function) {
-    }
-    CallEvent(const boost::function<void(void)>& function, SyncInfoPtr& syncInfo)
-        : QEvent(QEvent::User),
-          function(function),
-          syncInfo(syncInfo) {
-    }
-    CallEvent(const CallEvent& org)
-        : QEvent(QEvent::User),
-          function(org.function),
-          syncInfo(org.syncInfo) {
-    }
-    ~CallEvent() {
-        if(syncInfo){
-            syncInfo->semaphore.release(); // wake up the caller process
-        }
-    }
     boost::function<void(void)> function;
+    // The object which requested the call. The entries of an owner can be canceled together.
+    const void* owner;
+    bool isMerged;
     SyncInfoPtr syncInfo;
 };
-    
 
-class CallEventHandler : public QObject
+
+class DispatchEvent : public QEvent
 {
 public:
-    CallEventHandler() {
-        mainThreadId = QThread::currentThreadId();
+    DispatchEvent(int priority)
+        : QEvent(QEvent::User),
+          priority(priority) {
     }
+    int priority;
+};
+
+
+/**
+   The functions requested by LazyCaller, QueuedCaller, callLater() and so on are stored in
+   the queues of the priorities and called by this object in the main thread. Only one event
+   is posted to the Qt event loop for the requests of each priority made until the dispatch.
+*/
+class CallDispatcher : public QObject
+{
+public:
+    CallDispatcher();
+    ~CallDispatcher();
+    void request(const boost::function<void(void)>& function, int priority, const void* owner = 0,
+                 bool doMerge = false, SyncInfoPtr syncInfo = SyncInfoPtr());
+    void cancel(const void* owner);
     virtual bool event(QEvent* e);
+
     Qt::HANDLE mainThreadId;
+
+private:
+    QMutex mutex;
+    std::deque<CallEntry> queues[NUM_PRIORITIES];
+    int numPostedEvents[NUM_PRIORITIES];
+    std::set<const void*> ownersOfMergedEntries;
+
+    void postDispatchEventIfNecessary(int priority);
 };
     
-CallEventHandler callEventHandler;
+CallDispatcher dispatcher;
 }
 
 namespace cnoid {
 
-class LazyCallerImpl : public QObject
+class LazyCallerImpl
 {
 public:
     LazyCaller* self;
@@ -89,74 +129,204 @@ public:
     bool isConservative;
     LazyCallerImpl(LazyCaller* self);
     LazyCallerImpl(LazyCaller* self, const boost::function<void(void)>& function, int priority);
-    virtual bool event(QEvent* e);
+    void call();
 };
 
-class QueuedCallerImpl : public QObject
+// The address of this object is used as the owner of the requests
+class QueuedCallerImpl
 {
-public:
-    QueuedCaller* self;
-    ~QueuedCallerImpl();
-    virtual bool event(QEvent* e);
+
 };
 
 }
 
 
+CallDispatcher::CallDispatcher()
+{
+    mainThreadId = QThread::currentThreadId();
+    for(int i=0; i < NUM_PRIORITIES; ++i){
+        numPostedEvents[i] = 0;
+    }
+}
+
+
+CallDispatcher::~CallDispatcher()
+{
+    // wake up the threads waiting for the functions which are not called
+    for(int i=0; i < NUM_PRIORITIES; ++i){
+        std::deque<CallEntry>& queue = queues[i];
+        for(size_t j=0; j < queue.size(); ++j){
+            if(queue[j].syncInfo){
+                queue[j].syncInfo->semaphore.release();
+            }
+        }
+    }
+}
+
+
+/**
+   @param doMerge If true, the request is ignored when a request of the same owner is pending
+*/
+void CallDispatcher::request
+(const boost::function<void(void)>& function, int priority, const void* owner, bool doMerge, SyncInfoPtr syncInfo)
+{
+    priority = normalizePriority(priority);
+    
+    QMutexLocker locker(&mutex);
+
+    if(doMerge){
+        if(!ownersOfMergedEntries.insert(owner).second){
+            return;
+        }
+    }
+    queues[priority].push_back(CallEntry());
+    CallEntry& entry = queues[priority].back();
+    entry.function = function;
+    entry.owner = owner;
+    entry.isMerged = doMerge;
+    entry.syncInfo = syncInfo;
+
+    postDispatchEventIfNecessary(priority);
+}
+
+
+/**
+   @note mutex must be locked by the caller
+*/
+void CallDispatcher::postDispatchEventIfNecessary(int priority)
+{
+    // An event which has the same or higher priority will call the function
+    for(int i=0; i <= priority; ++i){
+        if(numPostedEvents[i] > 0){
+            return;
+        }
+    }
+    ++numPostedEvents[priority];
+    QCoreApplication::postEvent(this, new DispatchEvent(priority), toQtPriority(priority));
+}
+
+
+void CallDispatcher::cancel(const void* owner)
+{
+    QMutexLocker locker(&mutex);
+
+    for(int i=0; i < NUM_PRIORITIES; ++i){
+        std::deque<CallEntry>& queue = queues[i];
+        std::deque<CallEntry>::iterator p = queue.begin();
+        while(p != queue.end()){
+            if(p->owner == owner){
+                p = queue.erase(p);
+            } else {
+                ++p;
+            }
+        }
+    }
+    ownersOfMergedEntries.erase(owner);
+}
+
+
+bool CallDispatcher::event(QEvent* e)
+{
+    DispatchEvent* dispatchEvent = dynamic_cast<DispatchEvent*>(e);
+    if(!dispatchEvent){
+        return false;
+    }
+
+    mutex.lock();
+    --numPostedEvents[dispatchEvent->priority];
+    mutex.unlock();
+
+    QElapsedTimer timer;
+    timer.start();
+    int numCalls = 0;
+    CallEntry entry;
+    
+    while(true){
+        mutex.lock();
+        int priority = 0;
+        while(priority < NUM_PRIORITIES && queues[priority].empty()){
+            ++priority;
+        }
+        if(priority == NUM_PRIORITIES){
+            mutex.unlock();
+            break;
+        }
+        if(numCalls > 0 && timer.elapsed() >= dispatchTimeBudget){
+            postDispatchEventIfNecessary(priority);
+            mutex.unlock();
+            break;
+        }
+        std::deque<CallEntry>& queue = queues[priority];
+        entry.function.swap(queue.front().function);
+        entry.owner = queue.front().owner;
+        entry.isMerged = queue.front().isMerged;
+        entry.syncInfo.swap(queue.front().syncInfo);
+        queue.pop_front();
+        if(entry.isMerged){
+            ownersOfMergedEntries.erase(entry.owner);
+        }
+        mutex.unlock();
+
+        {
+            // The merged entries are the calls of LazyCaller, whose functions identify the handlers
+            EventLoopMonitor::Scope scope(
+                entry.isMerged ? "LazyCaller" : "callLater",
+                entry.isMerged ? static_cast<const LazyCallerImpl*>(entry.owner)->function.target_type()
+                : entry.function.target_type());
+
+            // The function may process the events, in which this function is called recursively
+            entry.function();
+        }
+        ++numCalls;
+
+        if(entry.syncInfo){
+            entry.syncInfo->completed = true;
+            entry.syncInfo->semaphore.release(); // wake up the caller process
+            entry.syncInfo.reset();
+        }
+    }
+    
+    return true;
+}
+
+
 bool cnoid::isRunningInMainThread()
 {
-    return (QThread::currentThreadId() == callEventHandler.mainThreadId);
+    return (QThread::currentThreadId() == dispatcher.mainThreadId);
 }
 
 
 void cnoid::callLater(const boost::function<void(void)>& function, int priority)
 {
-    CallEvent* event = new CallEvent(function);
-    QCoreApplication::postEvent(&callEventHandler, event, toQtPriority(priority));
+    dispatcher.request(function, priority);
 }
 
 
 void cnoid::callFromMainThread(const boost::function<void(void)>& function, int priority)
 {
-    if(QThread::currentThreadId() == callEventHandler.mainThreadId){
+    if(QThread::currentThreadId() == dispatcher.mainThreadId){
         function();
     } else {
-        CallEvent* event = new CallEvent(function);
-        QCoreApplication::postEvent(&callEventHandler, event, toQtPriority(priority));
+        dispatcher.request(function, priority);
     }
 }
 
 
 bool cnoid::callSynchronously(const boost::function<void(void)>& function, int priority)
 {
-    if(QThread::currentThreadId() == callEventHandler.mainThreadId){
+    if(QThread::currentThreadId() == dispatcher.mainThreadId){
         function();
         //callLater(function, priority);
         return true;
     } else {
         SyncInfoPtr syncInfo = boost::make_shared<SyncInfo>();
-        QCoreApplication::postEvent(
-            &callEventHandler, new CallEvent(function, syncInfo), toQtPriority(priority));
+        dispatcher.request(function, priority, 0, false, syncInfo);
         syncInfo->semaphore.acquire(); // wait for finish
         return syncInfo->completed;
     }
 }
 
 
-bool CallEventHandler::event(QEvent* e)
-{
-    CallEvent* callEvent = dynamic_cast<CallEvent*>(e);
-    if(callEvent){
-        callEvent->function();
-        if(callEvent->syncInfo){
-            callEvent->syncInfo->completed = true;
-        }
-        return true;
-    }
-    return false;
-}
-
-
 LazyCaller::LazyCaller()
 {
     isPending_ = false;
@@ -224,7 +394,7 @@ void LazyCaller::setConservative(bool on)
 void LazyCaller::cancel()
 {
     if(isPending_){
-        QCoreApplication::removePostedEvents(impl);
+        dispatcher.cancel(impl);
         isPending_ = false;
     }
 }
@@ -233,7 +403,7 @@ void LazyCaller::cancel()
 void LazyCaller::flush()
 {
     if(isPending_){
-        QCoreApplication::removePostedEvents(impl);
+        dispatcher.cancel(impl);
         isPending_ = false;
     }
     impl->function();
@@ -242,25 +412,19 @@ void LazyCaller::flush()
 
 void LazyCaller::postCallEvent()
 {
-    CallEvent* event = new CallEvent(impl->function);
-    QCoreApplication::postEvent(impl, event, toQtPriority(impl->priority));
+    dispatcher.request(boost::bind(&LazyCallerImpl::call, impl), impl->priority, impl, true);
 }
 
 
-bool LazyCallerImpl::event(QEvent* e)
+void LazyCallerImpl::call()
 {
-    CallEvent* callEvent = dynamic_cast<CallEvent*>(e);
-    if(callEvent){
-        if(isConservative){
-            callEvent->function();
-            self->isPending_ = false;
-        } else {
-            self->isPending_ = false;
-            callEvent->function();
-        }
-        return true;
+    if(isConservative){
+        function();
+        self->isPending_ = false;
+    } else {
+        self->isPending_ = false;
+        function();
     }
-    return false;
 }
 
 
@@ -277,31 +441,13 @@ QueuedCaller::~QueuedCaller()
 }
 
 
-QueuedCallerImpl::~QueuedCallerImpl()
-{
-    
-}
-
-
 void QueuedCaller::callLater(const boost::function<void()>& function, int priority)
 {
-    CallEvent* event = new CallEvent(function);
-    QCoreApplication::postEvent(impl, event, toQtPriority(priority));
-}
-
-
-bool QueuedCallerImpl::event(QEvent* e)
-{
-    CallEvent* callEvent = dynamic_cast<CallEvent*>(e);
-    if(callEvent){
-        callEvent->function();
-        return true;
-    }
-    return false;
+    dispatcher.request(function, priority, impl);
 }
 
 
 void QueuedCaller::cancel()
 {
-    QCoreApplication::removePostedEvents(impl);
+    dispatcher.cancel(impl);
 }
@@ -0,0 +1,241 @@
+/**
+   @file
+*/
+
+#include "MemoryUsageView.h"
+#include "ViewManager.h"
+#include "RootItem.h"
+#include "ItemManager.h"
+#include "ItemTreeView.h"
+#include "TreeWidget.h"
+#include "Buttons.h"
+#include <cnoid/MemoryUsageCounter>
+#include <QBoxLayout>
+#include <QLabel>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+enum { NameColumn, ClassColumn, SizeColumn, NumColumns };
+
+struct ItemUsage
+{
+    // The weak reference does not prevent the item from being released after it is removed
+    weak_ref_ptr<Item> item;
+    size_t bytes;
+    bool operator<(const ItemUsage& rhs) const { return bytes > rhs.bytes; }
+};
+
+struct CounterUsage
+{
+    MemoryUsageCounter* counter;
+    long long bytes;
+    bool operator<(const CounterUsage& rhs) const { return bytes > rhs.bytes; }
+};
+
+QString toSizeString(double bytes)
+{
+    static const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    int unit = 0;
+    while(fabs(bytes) >= 1024.0 && unit < 4){
+        bytes /= 1024.0;
+        ++unit;
+    }
+    return QString("%1 %2").arg(bytes, 0, 'f', (unit == 0) ? 0 : 1).arg(units[unit]);
+}
+
+}
+
+namespace cnoid {
+
+class MemoryUsageViewImpl
+{
+public:
+    MemoryUsageView* self;
+    TreeWidget treeWidget;
+    QLabel residentMemoryLabel;
+    vector<ItemUsage> itemUsages;
+
+    MemoryUsageViewImpl(MemoryUsageView* self);
+    void refresh();
+    void collectItemUsages(Item* item);
+    QTreeWidgetItem* addTopLevelItem(const QString& name, size_t totalBytes);
+    void setSizeColumn(QTreeWidgetItem* treeItem, double bytes);
+    void onItemDoubleClicked(QTreeWidgetItem* treeItem, int column);
+};
+
+}
+
+
+void MemoryUsageView::initializeClass(ExtensionManager* ext)
+{
+    ext->viewManager().registerClass<MemoryUsageView>(
+        "MemoryUsageView", N_("Memory Usage"), ViewManager::SINGLE_OPTIONAL);
+}
+
+
+MemoryUsageView::MemoryUsageView()
+{
+    impl = new MemoryUsageViewImpl(this);
+}
+
+
+MemoryUsageViewImpl::MemoryUsageViewImpl(MemoryUsageView* self)
+    : self(self)
+{
+    self->setDefaultLayoutArea(View::BOTTOM);
+
+    QVBoxLayout* vbox = new QVBoxLayout();
+    vbox->setSpacing(0);
+
+    QHBoxLayout* hbox = new QHBoxLayout();
+    hbox->addWidget(&residentMemoryLabel, 10);
+    PushButton* refreshButton = new PushButton(_("Refresh"));
+    refreshButton->sigClicked().connect(boost::bind(&MemoryUsageViewImpl::refresh, this));
+    hbox->addWidget(refreshButton);
+    vbox->addLayout(hbox);
+
+    treeWidget.setColumnCount(NumColumns);
+    QTreeWidgetItem* header = treeWidget.headerItem();
+    header->setText(NameColumn, _("Name"));
+    header->setText(ClassColumn, _("Class"));
+    header->setText(SizeColumn, _("Size"));
+    header->setTextAlignment(SizeColumn, Qt::AlignRight);
+    treeWidget.setHeaderSectionResizeMode(NameColumn, QHeaderView::Stretch);
+    treeWidget.setHeaderSectionResizeMode(ClassColumn, QHeaderView::ResizeToContents);
+    treeWidget.setHeaderSectionResizeMode(SizeColumn, QHeaderView::ResizeToContents);
+    treeWidget.setAlternatingRowColors(true);
+    treeWidget.setVerticalGridLineShown(true);
+    treeWidget.setSelectionMode(QAbstractItemView::SingleSelection);
+    treeWidget.sigItemDoubleClicked().connect(
+        boost::bind(&MemoryUsageViewImpl::onItemDoubleClicked, this, _1, _2));
+    vbox->addWidget(&treeWidget);
+
+    self->setLayout(vbox);
+
+    self->sigActivated().connect(boost::bind(&MemoryUsageViewImpl::refresh, this));
+}
+
+
+MemoryUsageView::~MemoryUsageView()
+{
+    delete impl;
+}
+
+
+void MemoryUsageView::refresh()
+{
+    impl->refresh();
+}
+
+
+void MemoryUsageViewImpl::refresh()
+{
+    treeWidget.clear();
+
+    const long residentSize = getResidentMemorySize();
+    if(residentSize >= 0){
+        residentMemoryLabel.setText(QString(_("Resident memory of the process: %1")).arg(toSizeString(residentSize)));
+    } else {
+        residentMemoryLabel.setText(QString());
+    }
+
+    itemUsages.clear();
+    collectItemUsages(RootItem::instance());
+    std::sort(itemUsages.begin(), itemUsages.end());
+    size_t totalItemBytes = 0;
+    for(size_t i=0; i < itemUsages.size(); ++i){
+        totalItemBytes += itemUsages[i].bytes;
+    }
+    QTreeWidgetItem* itemsTop = addTopLevelItem(_("Items"), totalItemBytes);
+    for(size_t i=0; i < itemUsages.size(); ++i){
+        ItemPtr item = itemUsages[i].item.lock();
+        QTreeWidgetItem* treeItem = new QTreeWidgetItem(itemsTop);
+        treeItem->setText(NameColumn, item->name().c_str());
+        string moduleName, className;
+        if(ItemManager::getClassIdentifier(item, moduleName, className)){
+            treeItem->setText(ClassColumn, className.c_str());
+        }
+        setSizeColumn(treeItem, itemUsages[i].bytes);
+        treeItem->setData(NameColumn, Qt::UserRole, static_cast<int>(i));
+    }
+
+    vector<MemoryUsageCounter*> counters;
+    MemoryUsageCounter::getCounters(counters);
+    vector<CounterUsage> counterUsages(counters.size());
+    long long totalCounterBytes = 0;
+    for(size_t i=0; i < counters.size(); ++i){
+        counterUsages[i].counter = counters[i];
+        counterUsages[i].bytes = counters[i]->bytes();
+        totalCounterBytes += counterUsages[i].bytes;
+    }
+    std::sort(counterUsages.begin(), counterUsages.end());
+    QTreeWidgetItem* subsystemsTop = addTopLevelItem(_("Subsystems"), totalCounterBytes);
+    for(size_t i=0; i < counterUsages.size(); ++i){
+        QTreeWidgetItem* treeItem = new QTreeWidgetItem(subsystemsTop);
+        treeItem->setText(NameColumn, counterUsages[i].counter->name().c_str());
+        setSizeColumn(treeItem, counterUsages[i].bytes);
+    }
+
+    itemsTop->setExpanded(true);
+    subsystemsTop->setExpanded(true);
+}
+
+
+void MemoryUsageViewImpl::collectItemUsages(Item* item)
+{
+    for(Item* child = item->childItem(); child; child = child->nextItem()){
+        const size_t bytes = child->memoryUsage();
+        if(bytes > 0){
+            ItemUsage usage;
+            usage.item = child;
+            usage.bytes = bytes;
+            itemUsages.push_back(usage);
+        }
+        collectItemUsages(child);
+    }
+}
+
+
+QTreeWidgetItem* MemoryUsageViewImpl::addTopLevelItem(const QString& name, size_t totalBytes)
+{
+    QTreeWidgetItem* treeItem = new QTreeWidgetItem(&treeWidget);
+    treeItem->setText(NameColumn, name);
+    setSizeColumn(treeItem, totalBytes);
+    treeItem->setFlags(Qt::ItemIsEnabled);
+    return treeItem;
+}
+
+
+void MemoryUsageViewImpl::setSizeColumn(QTreeWidgetItem* treeItem, double bytes)
+{
+    treeItem->setText(SizeColumn, toSizeString(bytes));
+    treeItem->setTextAlignment(SizeColumn, Qt::AlignRight | Qt::AlignVCenter);
+}
+
+
+/**
+   The item of the double-clicked row is selected in the item tree view
+   so that it can be removed or unloaded there.
+*/
+void MemoryUsageViewImpl::onItemDoubleClicked(QTreeWidgetItem* treeItem, int /* column */)
+{
+    QVariant data = treeItem->data(NameColumn, Qt::UserRole);
+    if(data.isValid()){
+        const int index = data.toInt();
+        if(index < (int)itemUsages.size()){
+            ItemPtr item = itemUsages[index].item.lock();
+            if(item && item->findRootItem()){
+                ItemTreeView* itemTreeView = ItemTreeView::instance();
+                itemTreeView->clearSelection();
+                itemTreeView->selectItem(item);
+            }
+        }
+    }
+}
@@ -0,0 +1,37 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BASE_MEMORY_USAGE_VIEW_H
+#define CNOID_BASE_MEMORY_USAGE_VIEW_H
+
+#include <cnoid/View>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class MemoryUsageViewImpl;
+
+/**
+   This view lists the memory occupied by the items, which is given by Item::memoryUsage(),
+   and the memory counted by the counters of the subsystems such as the sequence buffers,
+   the GL buffers and the collision models, which are registered as MemoryUsageCounter.
+   The list is updated when the view is activated and when the refresh button is pressed.
+*/
+class CNOID_EXPORT MemoryUsageView : public View
+{
+public:
+    static void initializeClass(ExtensionManager* ext);
+
+    MemoryUsageView();
+    virtual ~MemoryUsageView();
+
+    void refresh();
+
+private:
+    MemoryUsageViewImpl* impl;
+};
+
+}
+
+#endif
@@ -8,7 +8,9 @@
 #include "InfoBar.h"
 #include "Item.h"
 #include "TextEdit.h"
+#include "Timer.h"
 #include <stack>
+#include <vector>
 #include <iostream>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream_buffer.hpp>
@@ -17,6 +19,15 @@
 #include <QMessageBox>
 #include <QCoreApplication>
 #include <QThread>
+#include <QMutex>
+#include <QTextDocument>
+
+#if QT_VERSION >= 0x040700
+#include <QElapsedTimer>
+#else
+#include <QTime>
+typedef QTime QElapsedTimer;
+#endif
 #include "gettext.h"
 
 using namespace std;
@@ -45,7 +56,7 @@ struct StdioInfo {
     streambuf* cerr;
 };
 
-enum MvCommand { MV_PUT, MV_CLEAR };
+enum MvCommand { MV_PUT, MV_CLEAR, MV_INSERT_BUFFERED_MESSAGES };
 
 class MessageViewEvent : public QEvent
 {
@@ -72,6 +83,20 @@ public:
     bool doFlush;
 };
 
+/**
+   A message put from a non-main thread. The text written by the stream is kept as it is,
+   and it is converted into QString when it is inserted by the main thread.
+*/
+struct BufferedMessage
+{
+    QString message;
+    std::string localText;
+    bool isLocalText;
+    bool doLF;
+    bool doNotify;
+    bool doFlush;
+};
+
 int flushingRef = 0;
 Signal<void()> sigFlushFinished_;
 
@@ -115,10 +140,28 @@ public:
 
     Signal<void(const std::string& text)> sigMessage;
 
+    QMutex bufferMutex;
+    std::vector<BufferedMessage> buffer;
+    std::vector<BufferedMessage> messagesToInsert;
+    size_t bufferSize;
+    size_t maxBufferSize;
+    int numDroppedMessagesInBuffer;
+    int numDroppedMessages;
+    bool isInsertionRequested;
+    bool isClearRequested;
+    double maxBatchRate;
+    QElapsedTimer batchTimer;
+    Timer batchDelayTimer;
+
     MessageViewImpl(MessageView* self);
 
     void put(const QString& message, bool doLF, bool doNotify, bool doFlush);
     void put(int type, const QString& message, bool doLF, bool doNotify, bool doFlush);
+    void putLocalText(const char* text, int size, bool doFlush);
+    BufferedMessage* addBufferedMessage(size_t size, bool isLocalText);
+    void requestToInsertBufferedMessages();
+    void insertBufferedMessages();
+    void doInsertBufferedMessages();
     void doPut(const QString& message, bool doLF, bool doNotify, bool doFlush);
     void handleMessageViewEvent(MessageViewEvent* event);
     void flush();
@@ -148,7 +191,7 @@ TextSink::TextSink(MessageViewImpl* messageViewImpl, bool doFlush)
 
 std::streamsize TextSink::write(const char* s, std::streamsize n)
 {
-    messageViewImpl->put(QString::fromLocal8Bit(s, n), false, false, doFlush);
+    messageViewImpl->putLocalText(s, n, doFlush);
     //messageViewImpl->put(QString::fromUtf8(s, n), false, false, doFlush);
     return n;
 }
@@ -221,12 +264,24 @@ MessageViewImpl::MessageViewImpl(MessageView* self) :
 {
     self->setDefaultLayoutArea(View::BOTTOM);
 
+    bufferSize = 0;
+    maxBufferSize = 1024 * 1024;
+    numDroppedMessagesInBuffer = 0;
+    numDroppedMessages = 0;
+    isInsertionRequested = false;
+    isClearRequested = false;
+    maxBatchRate = 20.0;
+    batchTimer.start();
+    batchDelayTimer.setSingleShot(true);
+    batchDelayTimer.sigTimeout().connect(boost::bind(&MessageViewImpl::doInsertBufferedMessages, this));
+
     textEdit.setObjectName("TextEdit");
     textEdit.setFrameShape(QFrame::NoFrame);
     //textEdit.setReadOnly(true);
     textEdit.setTextInteractionFlags(
         Qt::TextSelectableByMouse | Qt::TextSelectableByKeyboard);
     textEdit.setWordWrapMode(QTextOption::WrapAnywhere);
+    textEdit.document()->setMaximumBlockCount(10000);
 
     QHBoxLayout* layout = new QHBoxLayout();
     layout->addWidget(&textEdit);
@@ -418,12 +473,214 @@ void MessageViewImpl::put(const QString& message, bool doLF, bool doNotify, bool
     if(QThread::currentThreadId() == mainThreadId){
         doPut(message, doLF, doNotify, doFlush);
     } else {
-        MessageViewEvent* event = new MessageViewEvent(message, doLF, doNotify, doFlush);
-        QCoreApplication::postEvent(self, event, Qt::NormalEventPriority);
+        bool isBuffered = false;
+        {
+            QMutexLocker locker(&bufferMutex);
+            BufferedMessage* buffered = addBufferedMessage(message.size() * sizeof(QChar), false);
+            if(buffered){
+                buffered->message = message;
+                buffered->isLocalText = false;
+                buffered->doLF = doLF;
+                buffered->doNotify = doNotify;
+                buffered->doFlush = doFlush;
+                isBuffered = true;
+            }
+        }
+        if(isBuffered){
+            requestToInsertBufferedMessages();
+        }
+    }
+}
+
+
+void MessageViewImpl::putLocalText(const char* text, int size, bool doFlush)
+{
+    if(QThread::currentThreadId() == mainThreadId){
+        doPut(QString::fromLocal8Bit(text, size), false, false, doFlush);
+    } else {
+        bool isBuffered = false;
+        {
+            QMutexLocker locker(&bufferMutex);
+            BufferedMessage* buffered = addBufferedMessage(size, true);
+            if(buffered){
+                // consecutive texts from the stream are joined into one entry
+                buffered->localText.append(text, size);
+                buffered->doFlush |= doFlush;
+                isBuffered = true;
+            }
+        }
+        if(isBuffered){
+            requestToInsertBufferedMessages();
+        }
+    }
+}
+
+
+/**
+   @note bufferMutex must be locked by the caller.
+   @return The entry to which the message is added, or null if the message must be discarded.
+   The entry for a text written by the stream may be the last entry which has already contained
+   the previous text.
+*/
+BufferedMessage* MessageViewImpl::addBufferedMessage(size_t size, bool isLocalText)
+{
+    if(bufferSize + size > maxBufferSize && !buffer.empty()){
+        ++numDroppedMessagesInBuffer;
+        ++numDroppedMessages;
+        return 0;
+    }
+    bufferSize += size;
+
+    /*
+      The buffer is not cleared but swapped with the vector of the inserted messages, so the
+      entries and their string capacities are reused.
+    */
+    if(!isLocalText || buffer.empty() || !buffer.back().isLocalText){
+        buffer.resize(buffer.size() + 1);
+        BufferedMessage& message = buffer.back();
+        message.message.clear();
+        message.localText.clear();
+        message.isLocalText = isLocalText;
+        message.doLF = false;
+        message.doNotify = false;
+        message.doFlush = false;
+    }
+    return &buffer.back();
+}
+
+
+void MessageViewImpl::requestToInsertBufferedMessages()
+{
+    bool doRequest = false;
+    {
+        QMutexLocker locker(&bufferMutex);
+        if(!isInsertionRequested){
+            isInsertionRequested = true;
+            doRequest = true;
+        }
+    }
+    // Only one event is posted until the buffered messages are inserted
+    if(doRequest){
+        QCoreApplication::postEvent(
+            self, new MessageViewEvent(MV_INSERT_BUFFERED_MESSAGES), Qt::NormalEventPriority);
+    }
+}
+
+
+void MessageViewImpl::insertBufferedMessages()
+{
+    if(batchDelayTimer.isActive()){
+        return;
+    }
+    const int interval = (maxBatchRate > 0.0) ? (1000.0 / maxBatchRate) : 0;
+    const int elapsed = batchTimer.elapsed();
+    if(elapsed < interval){
+        batchDelayTimer.start(interval - elapsed);
+    } else {
+        doInsertBufferedMessages();
     }
 }
 
 
+void MessageViewImpl::doInsertBufferedMessages()
+{
+    int numDropped;
+    bool isClearing;
+    {
+        QMutexLocker locker(&bufferMutex);
+        messagesToInsert.swap(buffer);
+        buffer.clear();
+        bufferSize = 0;
+        numDropped = numDroppedMessagesInBuffer;
+        numDroppedMessagesInBuffer = 0;
+        isInsertionRequested = false;
+        isClearing = isClearRequested;
+        isClearRequested = false;
+    }
+
+    batchTimer.restart();
+
+    if(isClearing){
+        doClear();
+    }
+
+    QString text;
+    QString notification;
+    bool doNotify = false;
+    bool doFlush = false;
+    for(size_t i=0; i < messagesToInsert.size(); ++i){
+        BufferedMessage& message = messagesToInsert[i];
+        if(message.isLocalText){
+            text.append(QString::fromLocal8Bit(message.localText.c_str(), message.localText.size()));
+        } else {
+            text.append(message.message);
+            if(message.doLF){
+                text.append("\n");
+            }
+            if(message.doNotify){
+                notification = message.message;
+                doNotify = true;
+            }
+        }
+        doFlush |= message.doFlush;
+    }
+    messagesToInsert.clear();
+
+    if(!text.isEmpty()){
+        doPut(text, false, false, false);
+    }
+    if(numDropped > 0){
+        doPut(QString("\033[31m") +
+              QString(_("Warning: %1 messages were discarded because too many messages were put.")).arg(numDropped) +
+              "\033[0m", true, false, false);
+    }
+    if(doNotify){
+        InfoBar::instance()->notify(notification);
+    }
+    if(doFlush){
+        flush();
+    }
+}
+
+
+void MessageView::setMaxBatchRate(double rate)
+{
+    impl->maxBatchRate = rate;
+}
+
+
+double MessageView::maxBatchRate() const
+{
+    return impl->maxBatchRate;
+}
+
+
+void MessageView::setMaxNumLines(int n)
+{
+    impl->textEdit.document()->setMaximumBlockCount(n);
+}
+
+
+int MessageView::maxNumLines() const
+{
+    return impl->textEdit.document()->maximumBlockCount();
+}
+
+
+void MessageView::setMaxBufferSize(int size)
+{
+    QMutexLocker locker(&impl->bufferMutex);
+    impl->maxBufferSize = size;
+}
+
+
+int MessageView::numDroppedMessages() const
+{
+    QMutexLocker locker(&impl->bufferMutex);
+    return impl->numDroppedMessages;
+}
+
+
 void MessageViewImpl::put(int type, const QString& message, bool doLF, bool doNotify, bool doFlush)
 {
     if(type == MessageView::NORMAL){
@@ -516,6 +773,9 @@ void MessageViewImpl::handleMessageViewEvent(MessageViewEvent* event)
     case MV_CLEAR:
         doClear();
         break;
+    case MV_INSERT_BUFFERED_MESSAGES:
+        insertBufferedMessages();
+        break;
     default:
         break;
     }
@@ -600,7 +860,18 @@ void MessageViewImpl::clear()
     if(QThread::currentThreadId() == mainThreadId){
         doClear();
     } else {
-        QCoreApplication::postEvent(self, new MessageViewEvent(MV_CLEAR), Qt::NormalEventPriority);
+        /*
+          The clear is processed with the buffered messages so that the messages put
+          before and after it are not mixed up.
+        */
+        {
+            QMutexLocker locker(&bufferMutex);
+            buffer.clear();
+            bufferSize = 0;
+            numDroppedMessagesInBuffer = 0;
+            isClearRequested = true;
+        }
+        requestToInsertBufferedMessages();
     }
 }
 
@@ -80,6 +80,27 @@ public:
         
     void flush();
     void clear();
+
+    /**
+       The messages put from the threads other than the main thread are buffered and
+       inserted into the view in a batch at most the given times per second. The default is 20.
+    */
+    void setMaxBatchRate(double rate);
+    double maxBatchRate() const;
+
+    //! The maximum number of the lines kept in the view. Zero means no limit. The default is 10000.
+    void setMaxNumLines(int n);
+    int maxNumLines() const;
+
+    /**
+       The maximum total size in bytes of the buffered messages. A message put while the buffer
+       is full is discarded, and the number of the discarded messages is shown when the buffered
+       messages are inserted. The default is 1MB.
+    */
+    void setMaxBufferSize(int size);
+
+    //! The total number of the messages discarded because the buffer was full
+    int numDroppedMessages() const;
       
     std::ostream& cout(bool doFlush = false);
 
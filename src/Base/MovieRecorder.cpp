@@ -24,6 +24,7 @@
 #include "Separator.h"
 #include "Timer.h"
 #include "LazyCaller.h"
+#include "Process.h"
 #include <cnoid/ConnectionSet>
 #include <cnoid/Selection>
 #include <QPainter>
@@ -33,7 +34,9 @@
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <deque>
+#include <algorithm>
 
 #ifdef Q_OS_LINUX
 #include <QX11Info>
@@ -53,6 +56,43 @@ namespace {
 
 enum RecordinMode { OFFLINE_MODE, ONLINE_MODE, DIRECT_MODE, N_RECORDING_MODES };
 
+enum OutputFormat { IMAGE_FILES_OUTPUT, VIDEO_OUTPUT, N_OUTPUT_FORMATS };
+
+/*
+  The quality values given to QImage::save(). The quality of PNG selects the compression level of
+  zlib, where 80 and 100 correspond to the levels 1 and 0, respectively.
+*/
+struct ImageFormatInfo {
+    const char* symbol;
+    const char* label;
+    const char* format;
+    const char* extension;
+    int quality;
+};
+const ImageFormatInfo imageFormats[] = {
+    { "png",             N_("PNG"),                "PNG", "png",  -1 },
+    { "pngFast",         N_("PNG (fast)"),         "PNG", "png",  80 },
+    { "pngUncompressed", N_("PNG (uncompressed)"), "PNG", "png", 100 },
+    { "jpeg",            N_("JPEG"),               "JPG", "jpg",  90 }
+};
+const int numImageFormats = sizeof(imageFormats) / sizeof(imageFormats[0]);
+
+/*
+  The codecs which can be selected for the video output. The hardware encoders are tried
+  in this order when the codec is "auto", and the software encoder is used if none of them
+  works on the machine.
+*/
+struct VideoCodecInfo {
+    const char* name;
+    const char* options;
+};
+const VideoCodecInfo videoCodecs[] = {
+    { "h264_nvenc", "-preset fast -rc vbr -cq 19" },
+    { "h264_qsv",   "-global_quality 20" },
+    { "libx264",    "-preset veryfast -crf 18" }
+};
+const int numVideoCodecs = sizeof(videoCodecs) / sizeof(videoCodecs[0]);
+
 MovieRecorder* movieRecorder = 0;
 
 class MovieRecorderBar : public ToolBar
@@ -98,6 +138,12 @@ public:
     ComboBox targetViewCombo;
     CheckBox viewMarkerCheck;
     RadioButton modeRadioButtons[N_RECORDING_MODES];
+    RadioButton outputFormatRadioButtons[N_OUTPUT_FORMATS];
+    LineEdit encoderEntry;
+    ComboBox videoCodecCombo;
+    ComboBox imageFormatCombo;
+    CheckBox asyncCaptureCheck;
+    SpinBox maxNumQueuedFramesSpin;
     LineEdit directoryEntry;
     PushButton directoryButton;
     LineEdit basenameEntry;
@@ -140,6 +186,9 @@ public:
         recordingToggle.setChecked(on);
         recordingToggle.blockSignals(false);
     }
+    int outputFormat() const {
+        return outputFormatRadioButtons[VIDEO_OUTPUT].isChecked() ? VIDEO_OUTPUT : IMAGE_FILES_OUTPUT;
+    }
 
     ConfigDialog(MovieRecorderImpl* recorder);
     virtual void showEvent(QShowEvent* event);
@@ -200,21 +249,34 @@ public:
     
     Timer flashTimer;
 
-    typedef boost::variant<QPixmap, QImage> ImageVariant;
-
     class CapturedImage : public Referenced {
     public:
-        ImageVariant image;
+        QImage image;
         int frame;
     };
     typedef ref_ptr<CapturedImage> CapturedImagePtr;
 
     deque<CapturedImagePtr> capturedImages;
+    int maxNumQueuedImages;
+    int numDroppedFrames;
     vector<quint32> tmpImageBuf;
-    boost::thread imageOutputThread;
+    boost::scoped_ptr<boost::thread_group> imageOutputThreads;
     boost::mutex imageQueueMutex;
     boost::condition_variable imageQueueCondition;
+    bool isImageOutputFailed;
     boost::format filenameFormat;
+    const ImageFormatInfo* imageFormat;
+
+    bool isAsyncCaptureEnabled;
+    SceneWidget* asyncCaptureWidget;
+    deque<int> asyncCaptureFrames;
+
+    bool isVideoOutput;
+    string videoFilename;
+    string videoEncoder;
+    string videoCodec;
+    string autoSelectedVideoCodec;
+    double frameRate;
 
     MovieRecorderImpl(ExtensionManager* ext);
     ~MovieRecorderImpl();
@@ -235,10 +297,20 @@ public:
     void startDirectModeRecording();
     void onDirectModeTimerTimeout();
     void captureViewImage(bool waitForPrevOutput);
+    bool startAsyncCapture(SceneWidget* sceneWidget, bool waitForPrevOutput);
+    void takeAsyncCapturedImage(bool waitForPrevOutput);
+    void flushAsyncCapturedImages();
+    void pushCapturedImage(CapturedImage* captured, bool waitForPrevOutput);
     void drawMouseCursorImage(QPainter& painter);
     void captureSceneWidgets(QWidget* widget, QPixmap& pixmap);
     void startImageOutput();
     void outputImages();
+    bool outputImageFile(CapturedImage* captured);
+    QImage toVideoFrameImage(const QImage& image, QSize& io_frameSize);
+    const VideoCodecInfo& selectVideoCodec();
+    bool startVideoEncoder(Process& encoder, const QSize& frameSize, string& out_message);
+    bool writeVideoFrame(Process& encoder, const QImage& image, string& out_message);
+    bool finishVideoEncoder(Process& encoder, string& out_message);
     void onImageOutputFailed(std::string message);
     void stopRecording(bool isFinished);
     void onViewMarkerToggled(bool on);
@@ -297,6 +369,14 @@ MovieRecorderImpl::MovieRecorderImpl(ExtensionManager* ext)
     isRecording = false;
     isBeforeFirstFrameCapture = false;
     requestStopRecording = false;
+    maxNumQueuedImages = 256;
+    numDroppedFrames = 0;
+    isVideoOutput = false;
+    frameRate = 30.0;
+    isImageOutputFailed = false;
+    imageFormat = &imageFormats[0];
+    isAsyncCaptureEnabled = true;
+    asyncCaptureWidget = 0;
 
     directModeTimer.sigTimeout().connect(
         boost::bind(&MovieRecorderImpl::onDirectModeTimerTimeout, this));
@@ -355,6 +435,42 @@ ConfigDialog::ConfigDialog(MovieRecorderImpl* recorder)
     hbox->addStretch();
     vbox->addLayout(hbox);
 
+    hbox = new QHBoxLayout();
+    hbox->addWidget(new QLabel(_("Output: ")));
+    outputFormatRadioButtons[IMAGE_FILES_OUTPUT].setText(_("Image files"));
+    outputFormatRadioButtons[VIDEO_OUTPUT].setText(_("Video"));
+    ButtonGroup* outputFormatGroup = new ButtonGroup();
+    for(int i=0; i < N_OUTPUT_FORMATS; ++i){
+        outputFormatGroup->addButton(&outputFormatRadioButtons[i], i);
+        hbox->addWidget(&outputFormatRadioButtons[i]);
+    }
+    outputFormatRadioButtons[IMAGE_FILES_OUTPUT].setChecked(true);
+    hbox->addSpacing(8);
+    hbox->addWidget(new QLabel(_("Encoder")));
+    encoderEntry.setText("ffmpeg");
+    hbox->addWidget(&encoderEntry);
+    hbox->addWidget(new QLabel(_("Codec")));
+    videoCodecCombo.addItem("auto");
+    for(int i=0; i < numVideoCodecs; ++i){
+        videoCodecCombo.addItem(videoCodecs[i].name);
+    }
+    hbox->addWidget(&videoCodecCombo);
+    hbox->addStretch();
+    vbox->addLayout(hbox);
+
+    hbox = new QHBoxLayout();
+    hbox->addWidget(new QLabel(_("Image format")));
+    for(int i=0; i < numImageFormats; ++i){
+        imageFormatCombo.addItem(_(imageFormats[i].label));
+    }
+    hbox->addWidget(&imageFormatCombo);
+    hbox->addSpacing(4);
+    asyncCaptureCheck.setText(_("Capture the scene asynchronously"));
+    asyncCaptureCheck.setChecked(true);
+    hbox->addWidget(&asyncCaptureCheck);
+    hbox->addStretch();
+    vbox->addLayout(hbox);
+
     hbox = new QHBoxLayout();
     hbox->addWidget(new QLabel(_("Directory")));
     hbox->addWidget(&directoryEntry);
@@ -385,6 +501,11 @@ ConfigDialog::ConfigDialog(MovieRecorderImpl* recorder)
     fpsSpin.setSingleStep(0.1);
     hbox->addWidget(&fpsSpin);
     hbox->addWidget(new QLabel(_("[fps]")));
+    hbox->addSpacing(4);
+    hbox->addWidget(new QLabel(_("Max queued frames")));
+    maxNumQueuedFramesSpin.setRange(1, 9999);
+    maxNumQueuedFramesSpin.setValue(256);
+    hbox->addWidget(&maxNumQueuedFramesSpin);
     hbox->addStretch();
     vbox->addLayout(hbox);
 
@@ -699,8 +820,22 @@ bool MovieRecorderImpl::setupViewAndFilenameFormat()
         return false;
     }
 
+    imageFormat = &imageFormats[std::max(0, dialog->imageFormatCombo.currentIndex())];
+    isAsyncCaptureEnabled = dialog->asyncCaptureCheck.isChecked();
+
     filesystem::path directory(dialog->directoryEntry.string());
-    filesystem::path basename(dialog->basenameEntry.string() + "%08u.png");
+    filesystem::path basename(dialog->basenameEntry.string() + "%08u." + imageFormat->extension);
+
+    isVideoOutput = (dialog->outputFormat() == VIDEO_OUTPUT);
+    if(isVideoOutput){
+        videoEncoder = dialog->encoderEntry.string();
+        if(videoEncoder.empty()){
+            showWarningDialog(_("Please set the encoder program to output a video."));
+            return false;
+        }
+        videoCodec = dialog->videoCodecCombo.currentText().toStdString();
+        frameRate = dialog->frameRate();
+    }
 
     if(directory.empty()){
         showWarningDialog(_("Please set a directory to output image files."));
@@ -718,6 +853,7 @@ bool MovieRecorderImpl::setupViewAndFilenameFormat()
     }
 
     filenameFormat = boost::format((directory / basename).string());
+    videoFilename = (directory / filesystem::path(dialog->basenameEntry.string() + ".mp4")).string();
 
     if(dialog->imageSizeCheck.isChecked()){
         int width = dialog->imageWidthSpin.value();
@@ -730,6 +866,9 @@ bool MovieRecorderImpl::setupViewAndFilenameFormat()
 
     boost::unique_lock<boost::mutex> lock(imageQueueMutex);
     capturedImages.clear();
+    maxNumQueuedImages = dialog->maxNumQueuedFramesSpin.value();
+    numDroppedFrames = 0;
+    isImageOutputFailed = false;
     
     return true;
 }
@@ -865,36 +1004,111 @@ void MovieRecorderImpl::onDirectModeTimerTimeout()
 
 void MovieRecorderImpl::captureViewImage(bool waitForPrevOutput)
 {
+    /*
+      The frame is dropped without capturing the view when the output does not keep up with
+      the recording so that the memory used by the queued images does not grow without bound.
+      The dropped frames are filled with the previous frame in the video output.
+    */
+    if(!waitForPrevOutput){
+        boost::unique_lock<boost::mutex> lock(imageQueueMutex);
+        if(static_cast<int>(capturedImages.size()) >= maxNumQueuedImages){
+            ++numDroppedFrames;
+            return;
+        }
+    }
+    
+    SceneView* sceneView = dynamic_cast<SceneView*>(targetView);
+    if(sceneView && isAsyncCaptureEnabled){
+        if(startAsyncCapture(sceneView->sceneWidget(), waitForPrevOutput)){
+            return;
+        }
+    }
+    
     CapturedImagePtr captured = new CapturedImage();
     captured->frame = frame;
     
-    if(SceneView* sceneView = dynamic_cast<SceneView*>(targetView)){
+    if(sceneView){
         captured->image = sceneView->sceneWidget()->getImage();
-        if(dialog->mouseCursorCheck.isChecked()){
-            QPainter painter(&boost::get<QImage>(captured->image));
-            drawMouseCursorImage(painter);
-        }
     } else {
-        captured->image = QPixmap();
-        QPixmap& pixmap = boost::get<QPixmap>(captured->image);
-        pixmap.grabWidget(targetView);
-
+        QPixmap pixmap = QPixmap::grabWidget(targetView);
         captureSceneWidgets(targetView, pixmap);
+        // The images are converted in this thread because QPixmap cannot be used in the output threads
+        captured->image = pixmap.toImage();
+    }
+    if(dialog->mouseCursorCheck.isChecked()){
+        QPainter painter(&captured->image);
+        drawMouseCursorImage(painter);
+    }
+
+    pushCapturedImage(captured, waitForPrevOutput);
+}
+
+
+/**
+   The image of the scene widget is transferred from the GPU while the following frames are prepared,
+   and it is pushed to the output queue when the image of the next frame is captured. This avoids
+   stalling the rendering pipeline to read back each frame.
+   \return false if the asynchronous capture is not available
+*/
+bool MovieRecorderImpl::startAsyncCapture(SceneWidget* sceneWidget, bool waitForPrevOutput)
+{
+    if(sceneWidget != asyncCaptureWidget){
+        flushAsyncCapturedImages();
+        asyncCaptureWidget = sceneWidget;
+    }
+    if(!sceneWidget->startImageCapture()){
+        if(asyncCaptureFrames.empty()){
+            return false;
+        }
+        takeAsyncCapturedImage(waitForPrevOutput);
+        if(!sceneWidget->startImageCapture()){
+            return false;
+        }
+    }
+    asyncCaptureFrames.push_back(frame);
+
+    while(asyncCaptureFrames.size() > 1){
+        takeAsyncCapturedImage(waitForPrevOutput);
+    }
+    return true;
+}
+
 
+void MovieRecorderImpl::takeAsyncCapturedImage(bool waitForPrevOutput)
+{
+    CapturedImagePtr captured = new CapturedImage();
+    captured->frame = asyncCaptureFrames.front();
+    asyncCaptureFrames.pop_front();
+    if(asyncCaptureWidget->takeCapturedImage(captured->image)){
         if(dialog->mouseCursorCheck.isChecked()){
-            QPainter painter(&pixmap);
+            QPainter painter(&captured->image);
             drawMouseCursorImage(painter);
         }
+        pushCapturedImage(captured, waitForPrevOutput);
+    }
+}
+
+
+void MovieRecorderImpl::flushAsyncCapturedImages()
+{
+    while(!asyncCaptureFrames.empty()){
+        takeAsyncCapturedImage(false);
     }
+}
 
+
+void MovieRecorderImpl::pushCapturedImage(CapturedImage* captured, bool waitForPrevOutput)
+{
     {
         boost::unique_lock<boost::mutex> lock(imageQueueMutex);
         if(waitForPrevOutput){
-            while(!capturedImages.empty()){
+            while(!capturedImages.empty() && !isImageOutputFailed){
                 imageQueueCondition.wait(lock);
             }
         }
-        capturedImages.push_back(captured);
+        if(!isImageOutputFailed){
+            capturedImages.push_back(captured);
+        }
     }
     imageQueueCondition.notify_all();
 }
@@ -947,55 +1161,212 @@ void MovieRecorderImpl::captureSceneWidgets(QWidget* widget, QPixmap& pixmap)
 }
 
 
+/**
+   The image files are saved by the threads as many as the cores because the compression of the images
+   is the bottleneck of the recording. The file names are given by the frame numbers, so the order of
+   the saving does not matter. The video frames are written by a single thread to keep the order.
+*/
 void MovieRecorderImpl::startImageOutput()
 {
-    if(!imageOutputThread.joinable()){
-        imageOutputThread = boost::thread(
-            boost::bind(&MovieRecorderImpl::outputImages, this));
+    if(!imageOutputThreads){
+        imageOutputThreads.reset(new boost::thread_group);
+        int numThreads = isVideoOutput ? 1 : std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+        for(int i=0; i < numThreads; ++i){
+            imageOutputThreads->create_thread(boost::bind(&MovieRecorderImpl::outputImages, this));
+        }
     }
 }
 
 
 void MovieRecorderImpl::outputImages()
 {
+    Process encoder;
+    QSize frameSize;
+    QImage prevFrameImage;
+    int prevFrame = -1;
+    string message;
+    bool failed = false;
+    
     while(true){
         CapturedImagePtr captured;
         {
             boost::unique_lock<boost::mutex> lock(imageQueueMutex);
-            while(isRecording && capturedImages.empty()){
+            while(isRecording && capturedImages.empty() && !isImageOutputFailed){
                 imageQueueCondition.wait(lock);
             }
-            if(capturedImages.empty() && !isRecording){
+            if(isImageOutputFailed || (capturedImages.empty() && !isRecording)){
                 break;
             }
             captured = capturedImages.front();
             capturedImages.pop_front();
         }
         imageQueueCondition.notify_all();
-        
-        bool saved = false;
 
-        string filename = str(filenameFormat % captured->frame);
-        
-        if(captured->image.which() == 0){
-            QPixmap& pixmap = boost::get<QPixmap>(captured->image);
-            saved = pixmap.save(filename.c_str());
+        if(!isVideoOutput){
+            if(!outputImageFile(captured)){
+                message = str(fmt(_("Saving an image to \"%1%\" failed.")) % str(boost::format(filenameFormat) % captured->frame));
+                failed = true;
+            }
         } else {
-            QImage& image = boost::get<QImage>(captured->image);
-            saved = image.save(filename.c_str());
+            QImage image = toVideoFrameImage(captured->image, frameSize);
+            if(prevFrame < 0){
+                failed = !startVideoEncoder(encoder, frameSize, message);
+            } else {
+                // The frames dropped in the recording are filled with the previous frame to keep the timing
+                for(int i = prevFrame + 1; !failed && i < captured->frame; ++i){
+                    failed = !writeVideoFrame(encoder, prevFrameImage, message);
+                }
+            }
+            if(!failed){
+                failed = !writeVideoFrame(encoder, image, message);
+            }
+            prevFrameImage = image;
+            prevFrame = captured->frame;
         }
 
-        if(!saved){
-            string message = str(fmt(_("Saving an image to \"%1%\" failed.")) % filename);
-            callLater(boost::bind(&MovieRecorderImpl::onImageOutputFailed, this, message));
-            {
-                boost::unique_lock<boost::mutex> lock(imageQueueMutex);
-                capturedImages.clear();
-            }
-            imageQueueCondition.notify_all();
+        if(failed){
             break;
         }
     }
+
+    if(isVideoOutput && prevFrame >= 0 && !failed){
+        failed = !finishVideoEncoder(encoder, message);
+    }
+
+    if(failed){
+        bool isFirstFailure;
+        {
+            boost::unique_lock<boost::mutex> lock(imageQueueMutex);
+            isFirstFailure = !isImageOutputFailed;
+            isImageOutputFailed = true;
+            capturedImages.clear();
+        }
+        imageQueueCondition.notify_all();
+        if(isFirstFailure){
+            callLater(boost::bind(&MovieRecorderImpl::onImageOutputFailed, this, message));
+        }
+    }
+}
+
+
+bool MovieRecorderImpl::outputImageFile(CapturedImage* captured)
+{
+    // The format object is copied because it is shared by the output threads
+    string filename = str(boost::format(filenameFormat) % captured->frame);
+    return captured->image.save(filename.c_str(), imageFormat->format, imageFormat->quality);
+}
+
+
+/**
+   @param io_frameSize The size of the video frames, which is given by the first image
+   The width and height are rounded down to even numbers for the chroma subsampling of the encoder.
+*/
+QImage MovieRecorderImpl::toVideoFrameImage(const QImage& capturedImage, QSize& io_frameSize)
+{
+    QImage image = capturedImage;
+    if(!io_frameSize.isValid()){
+        io_frameSize = QSize(std::max(2, image.width() & ~1), std::max(2, image.height() & ~1));
+    }
+    if(image.size() != io_frameSize){
+        if(image.width() - io_frameSize.width() <= 1 && image.height() - io_frameSize.height() <= 1 &&
+           image.width() >= io_frameSize.width() && image.height() >= io_frameSize.height()){
+            image = image.copy(0, 0, io_frameSize.width(), io_frameSize.height());
+        } else {
+            image = image.scaled(io_frameSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        }
+    }
+    return image.convertToFormat(QImage::Format_RGB888);
+}
+
+
+/**
+   A hardware encoder is selected for the "auto" codec only if the encoder program can actually
+   encode a test frame with it. The result is kept for the following recordings.
+*/
+const VideoCodecInfo& MovieRecorderImpl::selectVideoCodec()
+{
+    const string& codec = (videoCodec == "auto") ? autoSelectedVideoCodec : videoCodec;
+    for(int i=0; i < numVideoCodecs; ++i){
+        if(codec == videoCodecs[i].name){
+            return videoCodecs[i];
+        }
+    }
+    for(int i=0; i < numVideoCodecs - 1; ++i){
+        Process tester;
+        QStringList args;
+        args << "-hide_banner" << "-loglevel" << "error"
+             << "-f" << "lavfi" << "-i" << "color=size=256x256"
+             << "-frames:v" << "1" << "-c:v" << videoCodecs[i].name << "-f" << "null" << "-";
+        tester.start(videoEncoder.c_str(), args);
+        if(tester.waitForFinished(10000) &&
+           tester.exitStatus() == QProcess::NormalExit && tester.exitCode() == 0){
+            autoSelectedVideoCodec = videoCodecs[i].name;
+            return videoCodecs[i];
+        }
+        tester.kill();
+        tester.waitForFinished();
+    }
+    autoSelectedVideoCodec = videoCodecs[numVideoCodecs - 1].name;
+    return videoCodecs[numVideoCodecs - 1];
+}
+
+
+bool MovieRecorderImpl::startVideoEncoder(Process& encoder, const QSize& frameSize, string& out_message)
+{
+    const VideoCodecInfo& codec = selectVideoCodec();
+    
+    QStringList args;
+    args << "-y" << "-hide_banner" << "-loglevel" << "error" << "-nostats"
+         << "-f" << "rawvideo" << "-pix_fmt" << "rgb24"
+         << "-s" << QString("%1x%2").arg(frameSize.width()).arg(frameSize.height())
+         << "-r" << QString::number(frameRate)
+         << "-i" << "-"
+         << "-c:v" << codec.name;
+    args << QString(codec.options).split(" ", QString::SkipEmptyParts);
+    args << "-pix_fmt" << "yuv420p" << videoFilename.c_str();
+
+    encoder.setProcessChannelMode(QProcess::MergedChannels);
+    encoder.start(videoEncoder.c_str(), args);
+    if(!encoder.waitForStarted()){
+        out_message = str(fmt(_("The video encoder \"%1%\" cannot be started.")) % videoEncoder);
+        return false;
+    }
+    return true;
+}
+
+
+bool MovieRecorderImpl::writeVideoFrame(Process& encoder, const QImage& image, string& out_message)
+{
+    // The lines of QImage are aligned to four bytes while the raw video frames are not
+    const int lineSize = image.width() * 3;
+    for(int y=0; y < image.height(); ++y){
+        encoder.write(reinterpret_cast<const char*>(image.constScanLine(y)), lineSize);
+    }
+    while(encoder.bytesToWrite() > 0 && encoder.state() == QProcess::Running){
+        encoder.waitForBytesWritten(1000);
+    }
+    // The messages of the encoder are only kept for the error report
+    QByteArray output = encoder.readAll();
+    
+    if(encoder.state() != QProcess::Running){
+        out_message = str(fmt(_("The video encoder has terminated while encoding \"%1%\": %2%"))
+                          % videoFilename % output.constData());
+        return false;
+    }
+    return true;
+}
+
+
+bool MovieRecorderImpl::finishVideoEncoder(Process& encoder, string& out_message)
+{
+    encoder.closeWriteChannel();
+    encoder.waitForFinished(-1);
+    if(encoder.exitStatus() != QProcess::NormalExit || encoder.exitCode() != 0){
+        QByteArray output = encoder.readAll();
+        out_message = str(fmt(_("Encoding the video \"%1%\" failed: %2%")) % videoFilename % output.constData());
+        return false;
+    }
+    return true;
 }
 
 
@@ -1013,6 +1384,8 @@ void MovieRecorderImpl::stopRecording(bool isFinished)
     if(isRecording){
 
         stopFlash();
+
+        flushAsyncCapturedImages();
         
         int numRemainingImages = 0;
         {
@@ -1020,7 +1393,9 @@ void MovieRecorderImpl::stopRecording(bool isFinished)
             numRemainingImages = capturedImages.size();
         }
         if(numRemainingImages > 1){
-            QProgressDialog progress(_("Outputting sequential image files..."), _("Abort Output"), 0, numRemainingImages, MainWindow::instance());
+            QProgressDialog progress(
+                isVideoOutput ? _("Encoding the video...") : _("Outputting sequential image files..."),
+                _("Abort Output"), 0, numRemainingImages, MainWindow::instance());
             progress.setWindowTitle(_("Movie Recorder's Output Status"));
             progress.setWindowModality(Qt::WindowModal);
             while(true){
@@ -1047,13 +1422,18 @@ void MovieRecorderImpl::stopRecording(bool isFinished)
         isRecording = false;
         requestStopRecording = true;
         imageQueueCondition.notify_all();
-        imageOutputThread.join();
+        imageOutputThreads->join_all();
+        imageOutputThreads.reset();
 
         if(isFinished){
             mv->putln(boost::format(_("Recording of %1% has been finished.")) % targetView->name());
         } else {
             mv->putln(boost::format(_("Recording of %1% has been stopped.")) % targetView->name());
         }
+        if(numDroppedFrames > 0){
+            mv->putln(boost::format(_("%1% of %2% frames were dropped because the output could not keep up with the recording."))
+                      % numDroppedFrames % frame);
+        }
     }
     
     timeBarConnections.disconnect();
@@ -1190,6 +1570,12 @@ bool ConfigDialog::store(Mapping& archive)
     archive.write("width", imageWidthSpin.value());
     archive.write("height", imageHeightSpin.value());
     archive.write("mouseCursor", mouseCursorCheck.isChecked());
+    archive.write("output", (outputFormat() == VIDEO_OUTPUT) ? "video" : "images");
+    archive.write("videoEncoder", encoderEntry.string());
+    archive.write("videoCodec", videoCodecCombo.currentText().toStdString());
+    archive.write("maxQueuedFrames", maxNumQueuedFramesSpin.value());
+    archive.write("imageFormat", imageFormats[std::max(0, imageFormatCombo.currentIndex())].symbol);
+    archive.write("asyncCapture", asyncCaptureCheck.isChecked());
     return true;
 }
 
@@ -1221,4 +1607,25 @@ void ConfigDialog::restore(const Mapping& archive)
     imageWidthSpin.setValue(archive.get("width", imageWidthSpin.value()));
     imageHeightSpin.setValue(archive.get("height", imageHeightSpin.value()));
     mouseCursorCheck.setChecked(archive.get("mouseCursor", mouseCursorCheck.isChecked()));
+    string symbol;
+    if(archive.read("output", symbol)){
+        outputFormatRadioButtons[(symbol == "video") ? VIDEO_OUTPUT : IMAGE_FILES_OUTPUT].setChecked(true);
+    }
+    encoderEntry.setText(archive.get("videoEncoder", encoderEntry.string()));
+    if(archive.read("videoCodec", symbol)){
+        int index = videoCodecCombo.findText(symbol.c_str());
+        if(index >= 0){
+            videoCodecCombo.setCurrentIndex(index);
+        }
+    }
+    maxNumQueuedFramesSpin.setValue(archive.get("maxQueuedFrames", maxNumQueuedFramesSpin.value()));
+    if(archive.read("imageFormat", symbol)){
+        for(int i=0; i < numImageFormats; ++i){
+            if(symbol == imageFormats[i].symbol){
+                imageFormatCombo.setCurrentIndex(i);
+                break;
+            }
+        }
+    }
+    asyncCaptureCheck.setChecked(archive.get("asyncCapture", asyncCaptureCheck.isChecked()));
 }
@@ -51,6 +51,7 @@ class SceneMultiPointSet : public SgPosTransform, public SceneWidgetEditable
     void setAttentionPoint(const Vector3& p, bool doNotify);
     bool removeAttentionPoint(const Vector3& point, double distanceThresh, bool doNotify);
     void notifyAttentionPointChange();
+    Vector3 snapToNearestPoint(const Vector3& point);
 
     virtual bool onButtonPressEvent(const SceneWidgetEvent& event);
     virtual bool onPointerMoveEvent(const SceneWidgetEvent& event);
@@ -450,6 +451,24 @@ Affine3 MultiPointSetItem::offsetTransform(int index) const
 }
 
 
+bool MultiPointSetItem::findNearestPoint(const Vector3& point, double maxDistance, Vector3& out_point) const
+{
+    const Affine3& T = topOffsetTransform();
+    const Vector3 p = T.inverse() * point;
+    double distance = maxDistance;
+    bool found = false;
+    for(int i=0; i < numActivePointSetItems(); ++i){
+        Vector3 q;
+        if(activePointSetItem(i)->findNearestPoint(p, distance, q)){
+            distance = (q - p).norm();
+            out_point = T * q;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
 SgPointSetPtr MultiPointSetItem::getTransformedPointSet(int index) const
 {
     SgPointSetPtr transformed = new SgPointSet();
@@ -670,7 +689,7 @@ bool SceneMultiPointSet::removeAttentionPoint(const Vector3& point, double dista
     SgGroup::iterator iter = attentionPointMarkerGroup->begin();
     while(iter != attentionPointMarkerGroup->end()){
         CrossMarker* marker = dynamic_cast<CrossMarker*>(iter->get());
-        if(point.isApprox(marker->translation(), distanceThresh)){
+        if((T().inverse() * point - marker->translation()).norm() <= distanceThresh){
             iter = attentionPointMarkerGroup->erase(iter);
             removed = true;
         } else {
@@ -700,12 +719,13 @@ bool SceneMultiPointSet::onButtonPressEvent(const SceneWidgetEvent& event)
     bool processed = false;
     
     if(event.button() == Qt::LeftButton){
+        const Vector3 point = snapToNearestPoint(event.point());
         if(event.modifiers() & Qt::ControlModifier){
-            if(!removeAttentionPoint(event.point(), 0.01, true)){
-                addAttentionPoint(event.point(), true);
+            if(!removeAttentionPoint(point, 0.01, true)){
+                addAttentionPoint(point, true);
             }
         } else {
-            setAttentionPoint(event.point(), true);
+            setAttentionPoint(point, true);
         }
         processed = true;
     }
@@ -714,6 +734,17 @@ bool SceneMultiPointSet::onButtonPressEvent(const SceneWidgetEvent& event)
 }
 
 
+Vector3 SceneMultiPointSet::snapToNearestPoint(const Vector3& point)
+{
+    Vector3 nearest;
+    MultiPointSetItem* item = weakMultiPointSetItem.lock();
+    if(item && item->findNearestPoint(point, 0.02, nearest)){
+        return nearest;
+    }
+    return point;
+}
+
+
 bool SceneMultiPointSet::onPointerMoveEvent(const SceneWidgetEvent& event)
 {
     return false;
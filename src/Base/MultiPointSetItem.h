@@ -50,6 +50,12 @@ public:
 
     Affine3 offsetTransform(int index) const;
     SgPointSetPtr getTransformedPointSet(int index) const;
+
+    /**
+       Finds the nearest point of the active point sets with their k-d trees.
+       @see PointSetItem::findNearestPoint
+    */
+    bool findNearestPoint(const Vector3& point, double maxDistance, Vector3& out_point) const;
     
     int numAttentionPoints() const;
     Vector3 attentionPoint(int index) const;
@@ -13,6 +13,8 @@
 #include "MainWindow.h"
 #include <cnoid/ExecutablePath>
 #include <cnoid/FileUtil>
+#include <cnoid/YAMLReader>
+#include <cnoid/TimingProfiler>
 #include <QLibrary>
 #include <QRegExp>
 #include <QFileDialog>
@@ -72,7 +74,9 @@ public:
     PluginManagerImpl(ExtensionManager* ext);
     ~PluginManagerImpl();
 
+    ExtensionManager* ext;
     Action* startupLoadingCheck;
+    Action* onDemandLoadingCheck;
         
     MessageView* mv;
 
@@ -88,8 +92,10 @@ public:
             status = PluginManager::NOT_LOADED;
             areAllRequisitiesResolved = false;
             doReloading = false;
+            isDeferred = false;
             aboutMenuItem = 0;
             aboutDialog = 0;
+            deferredLoadingMenuItem = 0;
         }
         QLibrary dll;
         std::string pathString;
@@ -101,8 +107,10 @@ public:
         int status;
         bool areAllRequisitiesResolved;
         bool doReloading;
+        bool isDeferred;
         Action* aboutMenuItem;
         DescriptionDialog* aboutDialog;
+        Action* deferredLoadingMenuItem;
     };
 
     typedef vector<PluginInfoPtr> PluginInfoArray;
@@ -114,6 +122,10 @@ public:
     typedef multimap<std::string, std::string> MultiNameMap;
     MultiNameMap oldNameToCurrentPluginNameMap;
 
+    // The plugins whose loading is deferred until they are used.
+    // The names and the old names given by the manifest files are the keys.
+    PluginMap deferredPluginMap;
+
     typedef map<std::string, int> CountMap;
     CountMap precedentCountMap;
 
@@ -129,6 +141,10 @@ public:
     void scanPluginFilesInDefaultPath(const std::string& pathList);
     void scanPluginFilesInDirectoyOfExecFile();
     void scanPluginFiles(const std::string& pathString, bool isRecursive);
+    void readManifest(PluginInfoPtr info);
+    void undeferPlugin(PluginInfoPtr info);
+    bool undeferRequisitesOfLoadedPlugins();
+    bool loadDeferredPlugins(const vector<string>& names);
     void loadPlugins();
     void unloadPluginsActually();
     bool finalizePlugins();
@@ -190,7 +206,8 @@ PluginManager::PluginManager(ExtensionManager* ext)
 
 
 PluginManagerImpl::PluginManagerImpl(ExtensionManager* ext)
-    : mv(MessageView::mainInstance()),
+    : ext(ext),
+      mv(MessageView::mainInstance()),
       unloadPluginsLater(boost::bind(&PluginManagerImpl::unloadPluginsActually, this), LazyCaller::PRIORITY_LOW),
       reloadPluginsLater(boost::bind(&PluginManagerImpl::loadPlugins, this), LazyCaller::PRIORITY_LOW)
 {
@@ -210,6 +227,9 @@ PluginManagerImpl::PluginManagerImpl(ExtensionManager* ext)
 
     startupLoadingCheck = mm.addCheckItem(_("Startup Plugin Loading"));
     startupLoadingCheck->setChecked(config->get("startupPluginLoading", true));
+
+    onDemandLoadingCheck = mm.addCheckItem(_("On-demand Plugin Loading"));
+    onDemandLoadingCheck->setChecked(config->get("onDemandPluginLoading", true));
     
     mm.addSeparator();
 }
@@ -227,6 +247,8 @@ PluginManagerImpl::~PluginManagerImpl()
 
     AppConfig::archive()->openMapping("PluginManager")
         ->write("startupPluginLoading", startupLoadingCheck->isChecked());
+    AppConfig::archive()->openMapping("PluginManager")
+        ->write("onDemandPluginLoading", onDemandLoadingCheck->isChecked());
 }
 
 
@@ -356,13 +378,155 @@ void PluginManagerImpl::scanPluginFiles(const std::string& pathString, bool isRe
                     info->pathString = pathString;
                     allPluginInfos.push_back(info);
                     pathToPluginInfoMap[pathString] = info;
+                    readManifest(info);
+                }
+            }
+        }
+    }
+}
+
+
+/**
+   A plugin file may be accompanied by a manifest file, which has the same base name as the plugin
+   file and the extension ".manifest". The manifest is a YAML mapping like the following:
+
+   name: PoseSeq
+   oldNames: [ Pose ]
+   loadOnDemand: true
+
+   When "loadOnDemand" is true, the plugin file is not loaded by loadPlugins() but loaded when
+   a project which contains the items, the views or the states of the plugin is loaded,
+   when another plugin requiring the plugin is loaded, or when the plugin is selected in the
+   "Load Deferred Plugin" menu. The items, the views and the other objects of a plugin are stored in
+   a project with the plugin name, so the name is enough to determine the plugin to load.
+*/
+void PluginManagerImpl::readManifest(PluginInfoPtr info)
+{
+    filesystem::path manifestPath(info->pathString);
+    manifestPath.replace_extension(".manifest");
+    if(!filesystem::exists(manifestPath)){
+        return;
+    }
+    
+    try {
+        YAMLReader reader;
+        const Mapping& manifest = *reader.loadDocument(getNativePathString(manifestPath))->toMapping();
+        string name;
+        if(!manifest.read("name", name)){
+            mv->putln(fmt(_("The manifest file of \"%1%\" does not have the plugin name.")) % info->pathString);
+            return;
+        }
+        if(onDemandLoadingCheck->isChecked() && manifest.get("loadOnDemand", false)){
+            info->name = name;
+            info->isDeferred = true;
+            deferredPluginMap[name] = info;
+            const Listing& oldNames = *manifest.findListing("oldNames");
+            if(oldNames.isValid()){
+                for(int i=0; i < oldNames.size(); ++i){
+                    deferredPluginMap.insert(make_pair(oldNames[i].toString(), info));
                 }
             }
+            info->deferredLoadingMenuItem =
+                ext->menuManager().setPath("/File").setPath(_("Load Deferred Plugin")).addItem(name.c_str());
+            info->deferredLoadingMenuItem->sigTriggered().connect(
+                boost::bind(&PluginManagerImpl::loadDeferredPlugins, this, vector<string>(1, name)));
         }
+    } catch(const ValueNode::Exception& ex){
+        mv->putln(fmt(_("The manifest file of \"%1%\" cannot be read: %2%")) % info->pathString % ex.message());
     }
 }
 
 
+void PluginManagerImpl::undeferPlugin(PluginInfoPtr info)
+{
+    info->isDeferred = false;
+
+    PluginMap::iterator p = deferredPluginMap.begin();
+    while(p != deferredPluginMap.end()){
+        if(p->second == info){
+            deferredPluginMap.erase(p++);
+        } else {
+            ++p;
+        }
+    }
+    
+    if(info->deferredLoadingMenuItem){
+        delete info->deferredLoadingMenuItem;
+        info->deferredLoadingMenuItem = 0;
+    }
+}
+
+
+/**
+   @return true if a deferred plugin is required by the loaded plugins and it is undeferred
+*/
+bool PluginManagerImpl::undeferRequisitesOfLoadedPlugins()
+{
+    bool undeferred = false;
+    for(size_t i=0; i < allPluginInfos.size(); ++i){
+        PluginInfoPtr& info = allPluginInfos[i];
+        if(info->status == PluginManager::LOADED){
+            for(size_t j=0; j < info->requisites.size(); ++j){
+                PluginMap::iterator p = deferredPluginMap.find(info->requisites[j]);
+                if(p != deferredPluginMap.end()){
+                    undeferPlugin(p->second);
+                    undeferred = true;
+                }
+            }
+        }
+    }
+    return undeferred;
+}
+
+
+/**
+   This function loads the deferred plugin of the name with the plugins it requires.
+   @return true if the plugin is active
+*/
+bool PluginManager::loadDeferredPlugin(const std::string& name)
+{
+    return impl->loadDeferredPlugins(vector<string>(1, name));
+}
+
+
+/**
+   This function loads the deferred plugins of the names at once.
+   The names which do not correspond to deferred plugins are ignored.
+   @return false if any of the deferred plugins of the names cannot be activated
+*/
+bool PluginManager::loadDeferredPlugins(const std::vector<std::string>& names)
+{
+    return impl->loadDeferredPlugins(names);
+}
+
+
+bool PluginManagerImpl::loadDeferredPlugins(const vector<string>& names)
+{
+    PluginInfoArray targets;
+    for(size_t i=0; i < names.size(); ++i){
+        PluginMap::iterator p = deferredPluginMap.find(names[i]);
+        if(p != deferredPluginMap.end()){
+            PluginInfoPtr info = p->second;
+            undeferPlugin(info);
+            targets.push_back(info);
+        }
+    }
+    if(targets.empty()){
+        return true;
+    }
+    
+    loadPlugins();
+
+    bool activated = true;
+    for(size_t i=0; i < targets.size(); ++i){
+        if(targets[i]->status != PluginManager::ACTIVE){
+            activated = false;
+        }
+    }
+    return activated;
+}
+
+
 void PluginManager::clearUnusedPlugins()
 {
     impl->clearUnusedPlugins();
@@ -376,7 +540,7 @@ void PluginManagerImpl::clearUnusedPlugins()
 
     for(size_t i=0; i < oldList.size(); ++i){
         PluginInfoPtr& info = oldList[i];
-        if(info->status == PluginManager::ACTIVE){
+        if(info->status == PluginManager::ACTIVE || info->isDeferred){
             allPluginInfos.push_back(info);
         } else {
             pathToPluginInfoMap.erase(info->pathString);
@@ -397,7 +561,8 @@ void PluginManagerImpl::loadPlugins()
         int numLoaded = 0;
         int numNotLoaded = 0;
         for(size_t i=0; i < allPluginInfos.size(); ++i){
-            if(allPluginInfos[i]->status == PluginManager::NOT_LOADED){
+            PluginInfoPtr& info = allPluginInfos[i];
+            if(info->status == PluginManager::NOT_LOADED && !info->isDeferred){
                 if(loadPlugin(i)){
                     ++numLoaded;
                 } else {
@@ -406,7 +571,10 @@ void PluginManagerImpl::loadPlugins()
             }
         }
         if(numLoaded == 0 || numNotLoaded == 0){
-            break;
+            // The deferred plugins required by the loaded plugins must be loaded, too
+            if(!undeferRequisitesOfLoadedPlugins()){
+                break;
+            }
         }
     }
 
@@ -474,6 +642,8 @@ bool PluginManagerImpl::loadPlugin(int index)
         mv->putln(fmt(_("Detecting plugin file \"%1%\"")) % info->pathString);
         mv->flush();
 
+        TimingProfiler::Scope timingScope("PluginManager/Loading ", getFilename(filesystem::path(info->pathString)));
+
         info->dll.setFileName(info->pathString.c_str());
 
         // Some Python modules written in C/C++ requires the following options
@@ -594,8 +764,14 @@ bool PluginManagerImpl::activatePlugin(int index)
         if(requisitesActive){
 
             info->areAllRequisitiesResolved = true;
+
+            bool initialized;
+            {
+                TimingProfiler::Scope timingScope("PluginManager/Initializing ", info->name);
+                initialized = info->plugin->initialize();
+            }
                 
-            if(!info->plugin->initialize()){
+            if(!initialized){
                 info->status = PluginManager::INVALID;
                 errorMessage = _("The plugin object cannot be intialized.");
 
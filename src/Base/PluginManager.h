@@ -6,6 +6,7 @@
 #define CNOID_BASE_PLUGIN_MANAGER_H
 
 #include <string>
+#include <vector>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -47,6 +48,9 @@ public:
     bool unloadPlugin(const std::string& name);
     bool reloadPlugin(const std::string& name);
 
+    bool loadDeferredPlugin(const std::string& name);
+    bool loadDeferredPlugins(const std::vector<std::string>& names);
+
     const char* guessActualPluginName(const std::string& name);
 	
 private:
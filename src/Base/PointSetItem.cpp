@@ -14,10 +14,13 @@
 #include <cnoid/SceneDrawables>
 #include <cnoid/SceneCameras>
 #include <cnoid/SceneMarkers>
+#include <cnoid/SceneUtil>
 #include <cnoid/PointSetUtil>
 #include <cnoid/Exception>
 #include <cnoid/FileUtil>
 #include <cnoid/PolyhedralRegion>
+#include <cnoid/PointKdTree>
+#include <cnoid/TaskScheduler>
 #include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include "gettext.h"
@@ -63,6 +66,7 @@ public:
     void setAttentionPoint(const Vector3& p, bool doNotify);
     bool removeAttentionPoint(const Vector3& point, double distanceThresh, bool doNotify);
     void notifyAttentionPointChange();
+    Vector3 snapToNearestPoint(const Vector3& point);
     void updateVisualization(bool updateContents);
     void updateVisiblePointSet();
     void updateVoxels();
@@ -74,10 +78,104 @@ public:
     virtual void onContextMenuRequest(const SceneWidgetEvent& event, MenuManager& menuManager);
     void onContextMenuRequestInEraserMode(const SceneWidgetEvent& event, MenuManager& menuManager);
     void onRegionFixed(const PolyhedralRegion& region);
+    void downsample();
+    void removeOutliers();
 };
 
 typedef ref_ptr<ScenePointSet> ScenePointSetPtr;
 
+/**
+   The points are divided into the blocks of the consecutive points, and the bounding boxes of
+   the blocks are used to skip testing the points of the blocks which are entirely inside or
+   outside of the region. The points given by a scanner are usually spatially coherent in the
+   order of the array, so most of the blocks are not intersecting the region.
+*/
+const int PointBlockSize = 4096;
+const int PointBlockGrainSize = 4;
+
+struct PointBlockBounds
+{
+    Vector3f min;
+    Vector3f max;
+};
+
+enum PointBlockState { BLOCK_KEPT, BLOCK_REMOVED, BLOCK_MIXED, BLOCK_INTERSECTING = BLOCK_MIXED };
+
+int classifyPointBlock(const PointBlockBounds& bounds, const PolyhedralRegion& region, const Affine3& T)
+{
+    static const double margin = 1.0e-9;
+    
+    Vector3 corners[8];
+    for(int i=0; i < 8; ++i){
+        const Vector3f c((i & 1) ? bounds.max.x() : bounds.min.x(),
+                         (i & 2) ? bounds.max.y() : bounds.min.y(),
+                         (i & 4) ? bounds.max.z() : bounds.min.z());
+        corners[i] = T * c.cast<Vector3::Scalar>();
+    }
+    bool isInside = true;
+    for(int i=0; i < region.numBoundingPlanes(); ++i){
+        const PolyhedralRegion::Plane& plane = region.plane(i);
+        int numInsideCorners = 0;
+        for(int j=0; j < 8; ++j){
+            const double distance = corners[j].dot(plane.normal) - plane.d;
+            if(distance >= -margin){
+                ++numInsideCorners;
+                if(distance < margin){
+                    isInside = false;
+                }
+            }
+        }
+        if(numInsideCorners == 0){
+            return BLOCK_KEPT;
+        } else if(numInsideCorners < 8){
+            isInside = false;
+        }
+    }
+    return isInside ? BLOCK_REMOVED : BLOCK_INTERSECTING;
+}
+
+
+/**
+   Removes the elements of the removed blocks and the removed points of the mixed blocks
+   by moving the remaining elements forward so that their order is kept.
+   The elements after the points are kept as they are.
+*/
+template<class ElementContainer>
+void compactElements
+(ElementContainer& elements, int numPoints, const vector<char>& blockStates, const vector<unsigned char>& removalFlags,
+ int firstBlock)
+{
+    const int numElements = elements.size();
+    const int n = std::min(numElements, numPoints);
+    if(firstBlock * PointBlockSize >= n){
+        return;
+    }
+    typename ElementContainer::value_type* data = &elements[0];
+    int dest = firstBlock * PointBlockSize;
+    for(int begin = dest; begin < n; begin += PointBlockSize){
+        const int end = std::min(begin + PointBlockSize, n);
+        switch(blockStates[begin / PointBlockSize]){
+        case BLOCK_KEPT:
+            if(dest != begin){
+                std::copy(data + begin, data + end, data + dest);
+            }
+            dest += end - begin;
+            break;
+        case BLOCK_MIXED:
+            for(int i=begin; i < end; ++i){
+                if(!removalFlags[i]){
+                    data[dest++] = data[i];
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    std::copy(data + n, data + numElements, data + dest);
+    elements.resize(dest + (numElements - n));
+}
+
 }
 
 namespace cnoid {
@@ -91,13 +189,31 @@ public:
     ScopedConnection pointSetUpdateConnection;
     Signal<void(const PolyhedralRegion& region)> sigPointsInRegionRemoved;
 
+    // The bounding boxes of the point blocks, which are kept until the point set is updated
+    vector<PointBlockBounds> pointBlockBounds;
+    SgVertexArrayPtr pointBlockBoundsVertices;
+    vector<char> pointBlockStates;
+    vector<unsigned char> pointRemovalFlags;
+
+    // The k-d tree of the points, which is built when it is first used after the point set is updated
+    PointKdTree pointKdTree;
+    bool isPointKdTreeValid;
+
+    ScopedConnection spatialIndexInvalidationConnection;
+
     PointSetItemImpl(PointSetItem* self);
     PointSetItemImpl(PointSetItem* self, const PointSetItemImpl& org);
     void setRenderingMode(int mode);
     bool onEditableChanged(bool on);
+    void invalidateSpatialIndices();
+    bool findNearestPoint(const Vector3& point, double maxDistance, Vector3& out_point);
     void removePoints(const PolyhedralRegion& region);
+    void classifyPointBlocks(
+        const SgVertexArray* points, const PolyhedralRegion* region, const Affine3* T, bool doUpdateBounds,
+        int beginBlock, int endBlock);
+    void updatePointBlockBounds(const SgVertexArray* points, int beginBlock, int endBlock);
     template<class ElementContainer>
-    void removeSubElements(ElementContainer& elements, SgIndexArray& indices, const vector<int>& indicesToRemove);
+    void removeSubElements(ElementContainer& elements, SgIndexArray& indices, int firstBlock);
     bool onRenderingModePropertyChanged(int mode);
     bool onTranslationPropertyChanged(const std::string& value);
     bool onRotationPropertyChanged(const std::string& value);
@@ -166,6 +282,7 @@ PointSetItemImpl::PointSetItemImpl(PointSetItem* self)
 {
     pointSet = new SgPointSet;
     scene = new ScenePointSet(this);
+    isPointKdTreeValid = false;
 }
 
 
@@ -183,6 +300,7 @@ PointSetItemImpl::PointSetItemImpl(PointSetItem* self, const PointSetItemImpl& o
     pointSet = new SgPointSet(*org.pointSet);
     scene = new ScenePointSet(this);
     scene->T() = org.scene->T();
+    isPointKdTreeValid = false;
 }
 
 
@@ -191,6 +309,20 @@ void PointSetItem::initialize()
     impl->pointSetUpdateConnection.reset(
         impl->pointSet->sigUpdated().connect(
             boost::bind(&PointSetItem::notifyUpdate, this)));
+
+    impl->spatialIndexInvalidationConnection.reset(
+        impl->pointSet->sigUpdated().connect(
+            boost::bind(&PointSetItemImpl::invalidateSpatialIndices, impl)));
+}
+
+
+void PointSetItemImpl::invalidateSpatialIndices()
+{
+    pointBlockBoundsVertices.reset();
+    if(isPointKdTreeValid){
+        pointKdTree.clear();
+        isPointKdTreeValid = false;
+    }
 }
 
 
@@ -239,6 +371,21 @@ SgPointSet* PointSetItem::pointSet()
 }
 
 
+size_t PointSetItem::memoryUsage() const
+{
+    std::set<const void*> countedObjects;
+    size_t usage = calcSceneMemoryUsage(impl->pointSet, countedObjects);
+    usage += calcSceneMemoryUsage(impl->scene, countedObjects);
+    usage += impl->pointBlockBounds.capacity() * sizeof(PointBlockBounds);
+    if(impl->pointBlockBoundsVertices){
+        usage += impl->pointBlockBoundsVertices->memoryUsage();
+    }
+    usage += impl->pointBlockStates.capacity() + impl->pointRemovalFlags.capacity();
+    usage += impl->pointKdTree.memoryUsage();
+    return usage;
+}
+
+
 const Affine3& PointSetItem::offsetTransform() const
 {
     return impl->scene->T();
@@ -413,6 +560,33 @@ SignalProxy<void(const PolyhedralRegion& region)> PointSetItem::sigPointsInRegio
 }
 
 
+bool PointSetItem::findNearestPoint(const Vector3& point, double maxDistance, Vector3& out_point) const
+{
+    return impl->findNearestPoint(point, maxDistance, out_point);
+}
+
+
+bool PointSetItemImpl::findNearestPoint(const Vector3& point, double maxDistance, Vector3& out_point)
+{
+    if(!pointSet->hasVertices()){
+        return false;
+    }
+    const SgVertexArray& points = *pointSet->vertices();
+    if(!isPointKdTreeValid){
+        pointKdTree.build(points);
+        isPointKdTreeValid = true;
+    }
+    const Affine3& T = scene->T();
+    const int index = pointKdTree.findNearestPoint((T.inverse() * point).cast<float>(), maxDistance);
+    // The points may have been modified without the update notification
+    if(index < 0 || index >= static_cast<int>(points.size())){
+        return false;
+    }
+    out_point = T * points[index].cast<Vector3::Scalar>();
+    return true;
+}
+
+
 void PointSetItem::removePoints(const PolyhedralRegion& region)
 {
     impl->removePoints(region);
@@ -421,94 +595,144 @@ void PointSetItem::removePoints(const PolyhedralRegion& region)
 
 void PointSetItemImpl::removePoints(const PolyhedralRegion& region)
 {
-    vector<int> indicesToRemove;
-    const Affine3 T = scene->T();
-    SgVertexArray orgPoints(*pointSet->vertices());
-    const int numOrgPoints = orgPoints.size();
+    SgVertexArrayPtr vertices = pointSet->vertices();
+    const int numOrgPoints = vertices ? vertices->size() : 0;
+
+    if(numOrgPoints > 0){
+        const Affine3 T = scene->T();
+        const SgVertexArray* points = vertices;
+        const int numBlocks = (numOrgPoints + PointBlockSize - 1) / PointBlockSize;
+        const bool doUpdateBounds =
+            (pointBlockBoundsVertices != vertices || pointBlockBounds.size() != static_cast<size_t>(numBlocks));
+        if(doUpdateBounds){
+            pointBlockBounds.resize(numBlocks);
+        }
+        pointBlockStates.resize(numBlocks);
+        // Only the flags of the mixed blocks are set and used, so the flags are not cleared
+        pointRemovalFlags.resize(numOrgPoints);
+
+        TaskScheduler::instance()->parallelForRanges(
+            0, numBlocks,
+            boost::bind(&PointSetItemImpl::classifyPointBlocks, this, points, &region, &T, doUpdateBounds, _1, _2),
+            PointBlockGrainSize);
 
-    for(int i=0; i < numOrgPoints; ++i){
-        if(region.checkInside(T * orgPoints[i].cast<Vector3::Scalar>())){
-            indicesToRemove.push_back(i);
+        pointBlockBoundsVertices = vertices;
+
+        int firstBlock = 0;
+        while(firstBlock < numBlocks && pointBlockStates[firstBlock] == BLOCK_KEPT){
+            ++firstBlock;
         }
-    }
 
-    if(!indicesToRemove.empty()){
-        SgVertexArray& points = *pointSet->vertices();
-        points.clear();
-        int j = 0;
-        int nextIndexToRemove = indicesToRemove[j++];
-        for(int i=0; i < numOrgPoints; ++i){
-            if(i == nextIndexToRemove){
-                if(j < indicesToRemove.size()){
-                    nextIndexToRemove = indicesToRemove[j++];
-                }
-            } else {
-                points.push_back(orgPoints[i]);
-                
+        if(firstBlock < numBlocks){
+            compactElements(*vertices, numOrgPoints, pointBlockStates, pointRemovalFlags, firstBlock);
+            if(pointSet->hasNormals()){
+                removeSubElements(*pointSet->normals(), pointSet->normalIndices(), firstBlock);
             }
-        }
-        if(pointSet->hasNormals()){
-            removeSubElements(*pointSet->normals(), pointSet->normalIndices(), indicesToRemove);
-        }
-        if(pointSet->hasColors()){
-            removeSubElements(*pointSet->colors(), pointSet->colorIndices(), indicesToRemove);
-        }
+            if(pointSet->hasColors()){
+                removeSubElements(*pointSet->colors(), pointSet->colorIndices(), firstBlock);
+            }
+
+            // The blocks before the first changed one are not changed by the compaction
+            const int numNewBlocks = (vertices->size() + PointBlockSize - 1) / PointBlockSize;
+            pointBlockBounds.resize(numNewBlocks);
+            TaskScheduler::instance()->parallelForRanges(
+                firstBlock, numNewBlocks,
+                boost::bind(&PointSetItemImpl::updatePointBlockBounds, this, points, _1, _2),
+                PointBlockGrainSize);
+
+            pointSet->notifyUpdate();
 
-        pointSet->notifyUpdate();
+            pointBlockBoundsVertices = vertices;
+        }
     }
 
     sigPointsInRegionRemoved(region);
 }
 
 
-template<class ElementContainer>
-void PointSetItemImpl::removeSubElements(ElementContainer& elements, SgIndexArray& indices, const vector<int>& indicesToRemove)
+void PointSetItemImpl::classifyPointBlocks
+(const SgVertexArray* points, const PolyhedralRegion* region, const Affine3* T, bool doUpdateBounds,
+ int beginBlock, int endBlock)
 {
-    const ElementContainer orgElements(elements);
-    const int numOrgElements = orgElements.size();
-    elements.clear();
+    if(doUpdateBounds){
+        updatePointBlockBounds(points, beginBlock, endBlock);
+    }
+    const int numPoints = points->size();
     
-    if(indices.empty()){
-        int j = 0;
-        int nextIndexToRemove = indicesToRemove[j++];
-        for(int i=0; i < numOrgElements; ++i){
-            if(i == nextIndexToRemove){
-                if(j < indicesToRemove.size()){
-                    nextIndexToRemove = indicesToRemove[j++];
+    for(int i=beginBlock; i < endBlock; ++i){
+        int state = classifyPointBlock(pointBlockBounds[i], *region, *T);
+        if(state == BLOCK_INTERSECTING){
+            const int begin = i * PointBlockSize;
+            const int end = std::min(begin + PointBlockSize, numPoints);
+            int numRemovedPoints = 0;
+            for(int j=begin; j < end; ++j){
+                const bool isInside = region->checkInside(*T * (*points)[j].cast<Vector3::Scalar>());
+                pointRemovalFlags[j] = isInside;
+                if(isInside){
+                    ++numRemovedPoints;
                 }
+            }
+            if(numRemovedPoints == 0){
+                state = BLOCK_KEPT;
+            } else if(numRemovedPoints == end - begin){
+                state = BLOCK_REMOVED;
             } else {
-                elements.push_back(orgElements[i]);
+                state = BLOCK_MIXED;
             }
         }
+        pointBlockStates[i] = state;
+    }
+}
+
+
+void PointSetItemImpl::updatePointBlockBounds(const SgVertexArray* points, int beginBlock, int endBlock)
+{
+    const int numPoints = points->size();
+    
+    for(int i=beginBlock; i < endBlock; ++i){
+        const int begin = i * PointBlockSize;
+        const int end = std::min(begin + PointBlockSize, numPoints);
+        PointBlockBounds& bounds = pointBlockBounds[i];
+        bounds.min = bounds.max = (*points)[begin];
+        for(int j=begin + 1; j < end; ++j){
+            const Vector3f& p = (*points)[j];
+            bounds.min = bounds.min.cwiseMin(p);
+            bounds.max = bounds.max.cwiseMax(p);
+        }
+    }
+}
+
+
+template<class ElementContainer>
+void PointSetItemImpl::removeSubElements(ElementContainer& elements, SgIndexArray& indices, int firstBlock)
+{
+    const int numPoints = pointRemovalFlags.size();
+    
+    if(indices.empty()){
+        compactElements(elements, numPoints, pointBlockStates, pointRemovalFlags, firstBlock);
+
     } else {
-        const SgIndexArray orgIndices(indices);
-        const int numOrgIndices = orgIndices.size();
-        indices.clear();
+        compactElements(indices, numPoints, pointBlockStates, pointRemovalFlags, firstBlock);
+
+        // Remove the elements which are not referred to by the remaining indices
+        const int numOrgElements = elements.size();
         dynamic_bitset<> elementValidness(numOrgElements);
-        int j = 0;
-        int nextIndexToRemove = indicesToRemove[j++];
-        for(int i=0; i < numOrgIndices; ++i){
-            if(i == nextIndexToRemove){
-                if(j < indicesToRemove.size()){
-                    nextIndexToRemove = indicesToRemove[j++];
-                }
-            } else {
-                int index = orgIndices[i];
-                elementValidness.set(index);
-                indices.push_back(index);
-            }
+        for(size_t i=0; i < indices.size(); ++i){
+            elementValidness.set(indices[i]);
         }
         vector<int> indexMap(numOrgElements);
         int newIndex = 0;
         for(int i=0; i < numOrgElements; ++i){
             if(elementValidness.test(i)){
-                elements.push_back(orgElements[i]);
-                ++newIndex;
+                if(newIndex < i){
+                    elements[newIndex] = elements[i];
+                }
+                indexMap[i] = newIndex++;
             }
-            indexMap[i] = newIndex;
         }
+        elements.resize(newIndex);
         for(size_t i=0; i < indices.size(); ++i){
-            indices[i] = indexMap[i];
+            indices[i] = indexMap[indices[i]];
         }
     }
 }
@@ -598,7 +822,7 @@ bool PointSetItem::restore(const Archive& archive)
     
     std::string filename, formatId;
     if(archive.readRelocatablePath("file", filename) && archive.read("format", formatId)){
-        return load(filename, archive.currentParentItem(), formatId);
+        return loadFileOnDemand(archive, filename, formatId);
     }
     return true;
 }
@@ -714,7 +938,7 @@ bool ScenePointSet::removeAttentionPoint(const Vector3& point, double distanceTh
         SgGroup::iterator iter = attentionPointMarkerGroup->begin();
         while(iter != attentionPointMarkerGroup->end()){
             CrossMarker* marker = dynamic_cast<CrossMarker*>(iter->get());
-            if(point.isApprox(marker->translation(), distanceThresh)){
+            if((T().inverse() * point - marker->translation()).norm() <= distanceThresh){
                 iter = attentionPointMarkerGroup->erase(iter);
                 removed = true;
             } else {
@@ -873,12 +1097,13 @@ bool ScenePointSet::onButtonPressEvent(const SceneWidgetEvent& event)
     bool processed = false;
     
     if(event.button() == Qt::LeftButton){
+        const Vector3 point = snapToNearestPoint(event.point());
         if(event.modifiers() & Qt::ControlModifier){
-            if(!removeAttentionPoint(event.point(), 0.01, true)){
-                addAttentionPoint(event.point(), true);
+            if(!removeAttentionPoint(point, 0.01, true)){
+                addAttentionPoint(point, true);
             }
         } else {
-            setAttentionPoint(event.point(), true);
+            setAttentionPoint(point, true);
         }
         processed = true;
     }
@@ -887,6 +1112,21 @@ bool ScenePointSet::onButtonPressEvent(const SceneWidgetEvent& event)
 }
 
 
+/**
+   The picked point given by the depth buffer is moved to the nearest point of the point set
+   so that the attention points are put on the measured points.
+*/
+Vector3 ScenePointSet::snapToNearestPoint(const Vector3& point)
+{
+    Vector3 nearest;
+    PointSetItem* item = weakPointSetItem.lock();
+    if(item && item->findNearestPoint(point, 0.02, nearest)){
+        return nearest;
+    }
+    return point;
+}
+
+
 bool ScenePointSet::onPointerMoveEvent(const SceneWidgetEvent& event)
 {
     return false;
@@ -904,6 +1144,11 @@ void ScenePointSet::onContextMenuRequest(const SceneWidgetEvent& event, MenuMana
                 menuManager.addItem(_("PointSet: Start Eraser Mode"))->sigTriggered().connect(
                     boost::bind(&RectRegionMarker::startEditing, regionMarker.get(), event.sceneWidget())));
         }
+
+        menuManager.addItem(_("PointSet: Downsample with Voxel Size"))->sigTriggered().connect(
+            boost::bind(&ScenePointSet::downsample, this));
+        menuManager.addItem(_("PointSet: Remove Outliers"))->sigTriggered().connect(
+            boost::bind(&ScenePointSet::removeOutliers, this));
     }
 }
 
@@ -916,6 +1161,20 @@ void ScenePointSet::onContextMenuRequestInEraserMode(const SceneWidgetEvent& eve
 }
 
 
+void ScenePointSet::downsample()
+{
+    downsamplePointSet(orgPointSet, voxelSize);
+    orgPointSet->notifyUpdate();
+}
+
+
+void ScenePointSet::removeOutliers()
+{
+    removeStatisticalOutliers(orgPointSet, 20, 2.0);
+    orgPointSet->notifyUpdate();
+}
+
+
 void ScenePointSet::onRegionFixed(const PolyhedralRegion& region)
 {
     PointSetItem* item = weakPointSetItem.lock();
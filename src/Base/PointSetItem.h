@@ -32,6 +32,9 @@ public:
     SgPointSet* pointSet();
 
     virtual void notifyUpdate();
+
+    //! The point set, the points shown in the scene and the search structures are counted
+    virtual size_t memoryUsage() const;
         
     const Affine3& offsetTransform() const;
     void setOffsetTransform(const Affine3& T);
@@ -68,6 +71,14 @@ public:
     void clearAttentionPoint();  // deprecated
     void setAttentionPoint(const Vector3& p);  // deprecated
 
+    /**
+       Finds the point nearest to the given point with the k-d tree of the point set, which is built
+       when this function is first called after the point set is updated.
+       The positions are given in the coordinate frame of offsetTransform().
+       @return false if there is no point within maxDistance
+    */
+    bool findNearestPoint(const Vector3& point, double maxDistance, Vector3& out_point) const;
+
     void removePoints(const PolyhedralRegion& region);
 
     SignalProxy<void(const PolyhedralRegion& region)> sigPointsInRegionRemoved();
@@ -0,0 +1,313 @@
+/**
+   @file
+*/
+
+#include "ProfilerView.h"
+#include "ViewManager.h"
+#include "MainWindow.h"
+#include "MessageView.h"
+#include "AppConfig.h"
+#include "TreeWidget.h"
+#include "Buttons.h"
+#include "CheckBox.h"
+#include "Timer.h"
+#include <cnoid/Profiler>
+#include <cnoid/AllocationTracker>
+#include <cnoid/ValueTree>
+#include <QBoxLayout>
+#include <QLabel>
+#include <QFileDialog>
+#include <QDir>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <set>
+#include <algorithm>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+enum { NameColumn, CountColumn, TotalColumn, AverageColumn, MaxColumn, RatioColumn,
+       AllocationsColumn, AllocatedBytesColumn, NumColumns };
+
+bool compareTotalTimes(const Profiler::Node* node1, const Profiler::Node* node2)
+{
+    return node1->totalTime > node2->totalTime;
+}
+
+}
+
+namespace cnoid {
+
+class ProfilerViewImpl
+{
+public:
+    ProfilerView* self;
+    TreeWidget treeWidget;
+    CheckBox enableCheck;
+    QLabel droppedScopesLabel;
+    Timer timer;
+    // The rows collapsed by the user are kept collapsed after the tree is updated
+    set<QString> collapsedPaths;
+
+    ProfilerViewImpl(ProfilerView* self);
+    void onEnableToggled(bool on);
+    void updateTimer();
+    void refresh();
+    void storeCollapsedPaths(QTreeWidgetItem* treeItem, const QString& path);
+    void addTreeItems(QTreeWidgetItem* parentItem, const Profiler::Node& node, const QString& path);
+    void setTimeColumn(QTreeWidgetItem* treeItem, int column, double time);
+    void clear();
+    void exportTrace();
+};
+
+}
+
+
+void ProfilerView::initializeClass(ExtensionManager* ext)
+{
+    ext->viewManager().registerClass<ProfilerView>(
+        "ProfilerView", N_("Profiler"), ViewManager::SINGLE_OPTIONAL);
+}
+
+
+ProfilerView::ProfilerView()
+{
+    impl = new ProfilerViewImpl(this);
+}
+
+
+ProfilerViewImpl::ProfilerViewImpl(ProfilerView* self)
+    : self(self)
+{
+    self->setDefaultLayoutArea(View::BOTTOM);
+
+    QVBoxLayout* vbox = new QVBoxLayout();
+    vbox->setSpacing(0);
+
+    QHBoxLayout* hbox = new QHBoxLayout();
+    enableCheck.setText(_("Enable"));
+    enableCheck.setChecked(Profiler::isEnabled());
+    enableCheck.sigToggled().connect(boost::bind(&ProfilerViewImpl::onEnableToggled, this, _1));
+    hbox->addWidget(&enableCheck);
+    hbox->addWidget(&droppedScopesLabel, 10);
+    PushButton* refreshButton = new PushButton(_("Refresh"));
+    refreshButton->sigClicked().connect(boost::bind(&ProfilerViewImpl::refresh, this));
+    hbox->addWidget(refreshButton);
+    PushButton* clearButton = new PushButton(_("Clear"));
+    clearButton->sigClicked().connect(boost::bind(&ProfilerViewImpl::clear, this));
+    hbox->addWidget(clearButton);
+    PushButton* exportButton = new PushButton(_("Export Trace"));
+    exportButton->sigClicked().connect(boost::bind(&ProfilerViewImpl::exportTrace, this));
+    hbox->addWidget(exportButton);
+    vbox->addLayout(hbox);
+
+    treeWidget.setColumnCount(NumColumns);
+    QTreeWidgetItem* header = treeWidget.headerItem();
+    header->setText(NameColumn, _("Scope"));
+    header->setText(CountColumn, _("Count"));
+    header->setText(TotalColumn, _("Total [ms]"));
+    header->setText(AverageColumn, _("Average [ms]"));
+    header->setText(MaxColumn, _("Max [ms]"));
+    header->setText(RatioColumn, _("Ratio [%]"));
+    header->setText(AllocationsColumn, _("Allocations / call"));
+    header->setText(AllocatedBytesColumn, _("Allocated [B] / call"));
+    treeWidget.setHeaderSectionResizeMode(NameColumn, QHeaderView::Stretch);
+    for(int i = CountColumn; i < NumColumns; ++i){
+        header->setTextAlignment(i, Qt::AlignRight);
+        treeWidget.setHeaderSectionResizeMode(i, QHeaderView::ResizeToContents);
+    }
+    // The allocations are only counted with the build option of AllocationTracker
+    if(!AllocationTracker::isAvailable()){
+        treeWidget.setColumnHidden(AllocationsColumn, true);
+        treeWidget.setColumnHidden(AllocatedBytesColumn, true);
+    }
+    treeWidget.setAlternatingRowColors(true);
+    treeWidget.setVerticalGridLineShown(true);
+    treeWidget.setSelectionMode(QAbstractItemView::SingleSelection);
+    vbox->addWidget(&treeWidget);
+
+    self->setLayout(vbox);
+
+    timer.setInterval(1000);
+    timer.sigTimeout().connect(boost::bind(&ProfilerViewImpl::refresh, this));
+
+    self->sigActivated().connect(boost::bind(&ProfilerViewImpl::updateTimer, this));
+    self->sigActivated().connect(boost::bind(&ProfilerViewImpl::refresh, this));
+    self->sigDeactivated().connect(boost::bind(&Timer::stop, &timer));
+}
+
+
+ProfilerView::~ProfilerView()
+{
+    delete impl;
+}
+
+
+void ProfilerViewImpl::onEnableToggled(bool on)
+{
+    Profiler::setEnabled(on);
+    updateTimer();
+}
+
+
+void ProfilerViewImpl::updateTimer()
+{
+    if(Profiler::isEnabled() && self->isActive()){
+        timer.start();
+    } else {
+        timer.stop();
+    }
+}
+
+
+void ProfilerView::refresh()
+{
+    impl->refresh();
+}
+
+
+void ProfilerViewImpl::refresh()
+{
+    if(enableCheck.isChecked() != Profiler::isEnabled()){
+        enableCheck.blockSignals(true);
+        enableCheck.setChecked(Profiler::isEnabled());
+        enableCheck.blockSignals(false);
+        updateTimer();
+    }
+
+    Profiler::Node root;
+    Profiler::getTree(root);
+
+    for(int i=0; i < treeWidget.topLevelItemCount(); ++i){
+        QTreeWidgetItem* treeItem = treeWidget.topLevelItem(i);
+        storeCollapsedPaths(treeItem, treeItem->text(NameColumn));
+    }
+
+    treeWidget.setUpdatesEnabled(false);
+    treeWidget.clear();
+    addTreeItems(0, root, QString());
+    treeWidget.setUpdatesEnabled(true);
+
+    const int numDroppedScopes = Profiler::numDroppedScopes();
+    if(numDroppedScopes > 0){
+        droppedScopesLabel.setText(
+            QString(_("%1 scopes were dropped because the event buffers were full.")).arg(numDroppedScopes));
+    } else {
+        droppedScopesLabel.setText(QString());
+    }
+}
+
+
+void ProfilerViewImpl::storeCollapsedPaths(QTreeWidgetItem* treeItem, const QString& path)
+{
+    if(treeItem->childCount() > 0){
+        if(treeItem->isExpanded()){
+            collapsedPaths.erase(path);
+        } else {
+            collapsedPaths.insert(path);
+        }
+    }
+    for(int i=0; i < treeItem->childCount(); ++i){
+        QTreeWidgetItem* child = treeItem->child(i);
+        storeCollapsedPaths(child, path + "/" + child->text(NameColumn));
+    }
+}
+
+
+void ProfilerViewImpl::addTreeItems(QTreeWidgetItem* parentItem, const Profiler::Node& node, const QString& path)
+{
+    vector<const Profiler::Node*> children(node.children.size());
+    double childrenTime = 0.0;
+    for(size_t i=0; i < node.children.size(); ++i){
+        children[i] = &node.children[i];
+        childrenTime += children[i]->totalTime;
+    }
+    std::sort(children.begin(), children.end(), compareTotalTimes);
+
+    // The top-level scopes of a thread are compared with the sum of them
+    const double parentTime = (node.count > 0) ? node.totalTime : childrenTime;
+
+    for(size_t i=0; i < children.size(); ++i){
+        const Profiler::Node& child = *children[i];
+        QTreeWidgetItem* treeItem;
+        if(parentItem){
+            treeItem = new QTreeWidgetItem(parentItem);
+        } else {
+            treeItem = new QTreeWidgetItem(&treeWidget);
+        }
+        const QString name(child.name.c_str());
+        const QString childPath = path.isEmpty() ? name : (path + "/" + name);
+        treeItem->setText(NameColumn, name);
+
+        // The nodes of the threads do not have the times
+        if(child.count > 0){
+            treeItem->setText(CountColumn, QString::number(child.count));
+            treeItem->setTextAlignment(CountColumn, Qt::AlignRight | Qt::AlignVCenter);
+            setTimeColumn(treeItem, TotalColumn, child.totalTime);
+            setTimeColumn(treeItem, AverageColumn, child.totalTime / child.count);
+            setTimeColumn(treeItem, MaxColumn, child.maxTime);
+            if(parentTime > 0.0){
+                treeItem->setText(RatioColumn, QString::number(child.totalTime / parentTime * 100.0, 'f', 1));
+                treeItem->setTextAlignment(RatioColumn, Qt::AlignRight | Qt::AlignVCenter);
+            }
+            treeItem->setText(AllocationsColumn, QString::number((double)child.numAllocations / child.count, 'f', 1));
+            treeItem->setTextAlignment(AllocationsColumn, Qt::AlignRight | Qt::AlignVCenter);
+            treeItem->setText(AllocatedBytesColumn, QString::number((double)child.numAllocatedBytes / child.count, 'f', 0));
+            treeItem->setTextAlignment(AllocatedBytesColumn, Qt::AlignRight | Qt::AlignVCenter);
+        }
+
+        addTreeItems(treeItem, child, childPath);
+
+        treeItem->setExpanded(collapsedPaths.find(childPath) == collapsedPaths.end());
+    }
+}
+
+
+void ProfilerViewImpl::setTimeColumn(QTreeWidgetItem* treeItem, int column, double time)
+{
+    treeItem->setText(column, QString::number(time * 1000.0, 'f', 3));
+    treeItem->setTextAlignment(column, Qt::AlignRight | Qt::AlignVCenter);
+}
+
+
+void ProfilerViewImpl::clear()
+{
+    Profiler::clear();
+    refresh();
+}
+
+
+void ProfilerViewImpl::exportTrace()
+{
+    QFileDialog dialog(MainWindow::instance());
+    dialog.setWindowTitle(_("Export the trace of the profiler"));
+    dialog.setFileMode(QFileDialog::AnyFile);
+    dialog.setAcceptMode(QFileDialog::AcceptSave);
+    dialog.setViewMode(QFileDialog::List);
+    dialog.setLabelText(QFileDialog::Accept, _("Export"));
+    dialog.setLabelText(QFileDialog::Reject, _("Cancel"));
+
+    QStringList filters;
+    filters << _("Chrome trace files (*.json)");
+    filters << _("Any files (*)");
+    dialog.setNameFilters(filters);
+
+    MappingPtr config = AppConfig::archive()->openMapping("ProfilerView");
+    dialog.setDirectory(config->get("directory", QDir::currentPath().toStdString()).c_str());
+    dialog.selectFile("profile.json");
+
+    if(dialog.exec()){
+        config->writePath("directory", dialog.directory().absolutePath().toStdString());
+        const string filename = dialog.selectedFiles().front().toStdString();
+        if(Profiler::exportChromeTrace(filename)){
+            MessageView::instance()->putln(
+                boost::format(_("The trace of the profiler has been exported to \"%1%\".")) % filename);
+        } else {
+            MessageView::instance()->putln(
+                MessageView::ERROR, boost::format(_("The trace of the profiler cannot be exported to \"%1%\".")) % filename);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BASE_PROFILER_VIEW_H
+#define CNOID_BASE_PROFILER_VIEW_H
+
+#include <cnoid/View>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ProfilerViewImpl;
+
+/**
+   This view shows the tree of the scopes measured by Profiler for each thread.
+   Each row has the count, the total, average and max times of a scope and the ratio of
+   its total time to that of the parent scope. The heap allocations per call counted by
+   AllocationTracker are also shown when it is available. The tree is updated every second while
+   the profiler is enabled and the view is shown. The trace can be exported to a file
+   which can be opened by chrome://tracing.
+*/
+class CNOID_EXPORT ProfilerView : public View
+{
+public:
+    static void initializeClass(ExtensionManager* ext);
+
+    ProfilerView();
+    virtual ~ProfilerView();
+
+    void refresh();
+
+private:
+    ProfilerViewImpl* impl;
+};
+
+}
+
+#endif
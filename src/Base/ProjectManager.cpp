@@ -15,11 +15,13 @@
 #include "MenuManager.h"
 #include "AppConfig.h"
 #include "LazyCaller.h"
+#include "PluginManager.h"
 #include <cnoid/MainWindow>
 #include <cnoid/YAMLReader>
 #include <cnoid/YAMLWriter>
 #include <cnoid/FileUtil>
 #include <cnoid/ExecutablePath>
+#include <cnoid/TimingProfiler>
 #include <QFileDialog>
 #include <QCoreApplication>
 #include <boost/bind.hpp>
@@ -63,6 +65,7 @@ public:
 
     void onPerspectiveCheckToggled();
     void onHomeRelativeCheckToggled();
+    void onOnDemandLoadingCheckToggled();
         
     void connectArchiver(
         const std::string& name,
@@ -75,6 +78,7 @@ public:
     string lastAccessedProjectFile;
     Action* perspectiveCheck;
     Action* homeRelativeCheck;
+    Action* onDemandLoadingCheck;
 
     struct ArchiverInfo {
         boost::function<bool(Archive&)> storeFunction;
@@ -135,6 +139,10 @@ ProjectManagerImpl::ProjectManagerImpl(ExtensionManager* em)
     homeRelativeCheck->setChecked(config->get("useHomeRelative", false));
     homeRelativeCheck->sigToggled().connect(bind(&ProjectManagerImpl::onHomeRelativeCheckToggled, this));
 
+    onDemandLoadingCheck = mm.addCheckItem(_("Load large item files on demand"));
+    onDemandLoadingCheck->setChecked(config->get("loadFilesOnDemand", true));
+    onDemandLoadingCheck->sigToggled().connect(bind(&ProjectManagerImpl::onOnDemandLoadingCheckToggled, this));
+
     mm.setPath("/File");
     mm.addSeparator();
 
@@ -161,6 +169,54 @@ ProjectManagerImpl::~ProjectManagerImpl()
 }
 
 
+namespace {
+
+void collectPluginNamesOfItems(Mapping* itemNode, vector<string>& out_names)
+{
+    string pluginName;
+    if(itemNode->read("plugin", pluginName)){
+        out_names.push_back(pluginName);
+    }
+    Listing* children = itemNode->findListing("children");
+    if(children->isValid()){
+        for(int i=0; i < children->size(); ++i){
+            ValueNode* child = children->at(i);
+            if(child->isMapping()){
+                collectPluginNamesOfItems(child->toMapping(), out_names);
+            }
+        }
+    }
+}
+
+/**
+   The names of the plugins which provide the items, the views and the other states
+   stored in a project are collected so that the deferred plugins of the names can be loaded
+   before restoring the project.
+*/
+void collectPluginNamesInProject(Mapping* archive, vector<string>& out_names)
+{
+    for(Mapping::iterator p = archive->begin(); p != archive->end(); ++p){
+        out_names.push_back(p->first);
+    }
+    Listing* views = archive->findListing("views");
+    if(views->isValid()){
+        string pluginName;
+        for(int i=0; i < views->size(); ++i){
+            ValueNode* view = views->at(i);
+            if(view->isMapping() && view->toMapping()->read("plugin", pluginName)){
+                out_names.push_back(pluginName);
+            }
+        }
+    }
+    Mapping* items = archive->findMapping("items");
+    if(items->isValid()){
+        collectPluginNamesOfItems(items, out_names);
+    }
+}
+
+}
+
+
 template <class TObject>
 bool ProjectManagerImpl::restoreObjectStates
 (Archive* projectArchive, Archive* states, const vector<TObject*>& objects, const char* nameSuffix)
@@ -195,6 +251,8 @@ void ProjectManager::loadProject(const std::string& filename)
 
 void ProjectManagerImpl::loadProject(const std::string& filename, bool isInvokingApplication)
 {
+    TimingProfiler::Scope timingScope("ProjectManager/Loading the project");
+    
     bool loaded = false;
     YAMLReader reader;
     reader.setMappingClass<Archive>();
@@ -209,8 +267,14 @@ void ProjectManagerImpl::loadProject(const std::string& filename, bool isInvokin
 
         int numArchivedItems = 0;
         int numRestoredItems = 0;
+
+        bool isFileLoaded;
+        {
+            TimingProfiler::Scope timingScope("ProjectManager/Parsing the project file");
+            isFileLoaded = reader.load(filename);
+        }
         
-        if(!reader.load(filename)){
+        if(!isFileLoaded){
             messageView->put(reader.errorMessage() + "\n");
 
         } else if(reader.numDocuments() == 0){
@@ -219,6 +283,7 @@ void ProjectManagerImpl::loadProject(const std::string& filename, bool isInvokin
         } else {
             Archive* archive = static_cast<Archive*>(reader.document()->toMapping());
             archive->initSharedInfo(filename);
+            archive->setOnDemandLoadingEnabled(onDemandLoadingCheck->isChecked());
 
             std::set<string> optionalPlugins;
             Listing& optionalPluginsNode = *archive->findListing("optionalPlugins");
@@ -228,20 +293,33 @@ void ProjectManagerImpl::loadProject(const std::string& filename, bool isInvokin
                 }
             }
 
+            {
+                TimingProfiler::Scope timingScope("ProjectManager/Loading the deferred plugins");
+                vector<string> pluginNames;
+                collectPluginNamesInProject(archive, pluginNames);
+                PluginManager::instance()->loadDeferredPlugins(pluginNames);
+            }
+
             ViewManager::ViewStateInfo viewStateInfo;
-            ViewManager::restoreViews(archive, "views", viewStateInfo);
+            {
+                TimingProfiler::Scope timingScope("ProjectManager/Restoring the views");
+                ViewManager::restoreViews(archive, "views", viewStateInfo);
+            }
 
             MainWindow* mainWindow = MainWindow::instance();
-            if(isInvokingApplication){
-                if(perspectiveCheck->isChecked()){
-                    mainWindow->setInitialLayout(archive);
-                }
-                mainWindow->show();
-                messageView->flush();
-                mainWindow->repaint();
-            } else {
-                if(perspectiveCheck->isChecked()){
-                    mainWindow->restoreLayout(archive);
+            {
+                TimingProfiler::Scope timingScope("ProjectManager/Restoring the layout");
+                if(isInvokingApplication){
+                    if(perspectiveCheck->isChecked()){
+                        mainWindow->setInitialLayout(archive);
+                    }
+                    mainWindow->show();
+                    messageView->flush();
+                    mainWindow->repaint();
+                } else {
+                    if(perspectiveCheck->isChecked()){
+                        mainWindow->restoreLayout(archive);
+                    }
                 }
             }
 
@@ -292,7 +370,10 @@ void ProjectManagerImpl::loadProject(const std::string& filename, bool isInvokin
             Archive* items = archive->findSubArchive("items");
             if(items->isValid()){
                 items->inheritSharedInfoFrom(*archive);
-                itemTreeArchiver.restore(items, RootItem::mainInstance(), optionalPlugins);
+                {
+                    TimingProfiler::Scope timingScope("ProjectManager/Restoring the items");
+                    itemTreeArchiver.restore(items, RootItem::mainInstance(), optionalPlugins);
+                }
                 numArchivedItems = itemTreeArchiver.numArchivedItems();
                 numRestoredItems = itemTreeArchiver.numRestoredItems();
                 messageView->putln(format(_("%1% / %2% item(s) are loaded.")) % numRestoredItems % numArchivedItems);
@@ -539,6 +620,13 @@ void ProjectManagerImpl::onHomeRelativeCheckToggled()
     AppConfig::archive()->openMapping("ProjectManager")
         ->write("useHomeRelative", homeRelativeCheck->isChecked());
 }
+
+
+void ProjectManagerImpl::onOnDemandLoadingCheckToggled()
+{
+    AppConfig::archive()->openMapping("ProjectManager")
+        ->write("loadFilesOnDemand", onDemandLoadingCheck->isChecked());
+}
                                            
 
 void ProjectManager::setArchiver(
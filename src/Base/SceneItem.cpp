@@ -15,7 +15,7 @@
 #include <cnoid/EigenArchive>
 #include <cnoid/Exception>
 #include <boost/bind.hpp>
-#include <boost/scoped_ptr.hpp>
+#include <sstream>
 #include "gettext.h"
 
 using namespace std;
@@ -23,56 +23,48 @@ using namespace cnoid;
 
 namespace {
 
-boost::scoped_ptr<VRMLParser> vrmlParser;
-boost::scoped_ptr<VRMLToSGConverter> vrmlConverter;
-
-bool loadVRML(SceneItem* item, const std::string& filename, std::ostream& os)
+/*
+  The loaders do not share any object so that they can be executed by the worker threads
+  which preload the files of the items.
+*/
+SgNodePtr loadVRML(const std::string& filename, std::ostream& os)
 {
-    item->topNode()->clearChildren(true);
-    
-    if(!vrmlParser){
-        vrmlParser.reset(new VRMLParser);
-        vrmlConverter.reset(new VRMLToSGConverter);
-    }
-    vrmlConverter->setMessageSink(os);
-    vrmlConverter->clearConvertedNodeMap();
+    VRMLParser parser;
+    VRMLToSGConverter converter;
+    converter.setMessageSink(os);
 
     SgInvariantGroupPtr group = new SgInvariantGroup;
 
     try {
-        vrmlParser->load(filename);
-        while(VRMLNodePtr vrml = vrmlParser->readNode()){
-            SgNodePtr node = vrmlConverter->convert(vrml);
+        parser.load(filename);
+        while(VRMLNodePtr vrml = parser.readNode()){
+            SgNodePtr node = converter.convert(vrml);
             if(node){
                 group->addChild(node);
             }
         }
-        vrmlParser->checkEOF();
+        parser.checkEOF();
 
     } catch(EasyScanner::Exception& ex){
         os << ex.getFullMessage();
-        return false;
+        return 0;
     }
         
     if(group->empty()){
         os << _("The VRML file does not have any valid entity.") << endl;
-    } else {
-        item->topNode()->addChild(group, true);
-        return true;
+        return 0;
     }
-    return false;
+    return group;
 }
 
-bool loadSTL(SceneItem* item, const std::string& filename, std::ostream& os)
+SgNodePtr loadSTL(const std::string& filename, std::ostream& os)
 {
     STLSceneLoader loader;
-    SgNode* scene = loader.load(filename);
+    SgNodePtr scene = loader.load(filename);
     if(!scene){
         os << _("The STL file cannot be loaded.") << endl;
-    } else {
-        item->topNode()->addChild(scene);
     }
-    return (scene != 0);
+    return scene;
 }
 
 }
@@ -86,11 +78,11 @@ void SceneItem::initializeClass(ExtensionManager* ext)
 
         ext->itemManager().addLoader<SceneItem>(
             "VRML", "VRML-FILE", "wrl",
-            boost::bind(::loadVRML, _1, _2, _3), ItemManager::PRIORITY_CONVERSION);
+            boost::bind(&SceneItem::loadSceneFile, _1, _2, _3, loadVRML), ItemManager::PRIORITY_CONVERSION);
 
         ext->itemManager().addLoader<SceneItem>(
             "Stereolithography (STL)", "STL-FILE", "stl",
-            boost::bind(::loadSTL, _1, _2, _3), ItemManager::PRIORITY_CONVERSION);
+            boost::bind(&SceneItem::loadSceneFile, _1, _2, _3, loadSTL), ItemManager::PRIORITY_CONVERSION);
         
         initialized = true;
     }
@@ -118,6 +110,35 @@ SceneItem::~SceneItem()
 }
 
 
+bool SceneItem::loadSceneFile(const std::string& filename, std::ostream& os, SceneFileLoader loadFile)
+{
+    topNode_->clearChildren(true);
+
+    SgNodePtr scene;
+    if(preloadedScene){
+        scene = preloadedScene;
+        preloadedScene = 0;
+        os << preloadingMessage;
+        preloadingMessage.clear();
+    } else {
+        scene = loadFile(filename, os);
+    }
+    if(scene){
+        topNode_->addChild(scene, true);
+        return true;
+    }
+    return false;
+}
+
+
+void SceneItem::preloadSceneFile(const std::string& filename, SceneFileLoader loadFile)
+{
+    ostringstream os;
+    preloadedScene = loadFile(filename, os);
+    preloadingMessage = os.str();
+}
+
+
 void SceneItem::setName(const std::string& name)
 {
     topNode_->setName(name);
@@ -195,9 +216,27 @@ bool SceneItem::restore(const Archive& archive)
         if(read(archive, "rotation", rot)){
             topNode_->setRotation(rot);
         }
-        if(load(filename, archive.currentParentItem(), formatId)){
+        bool loaded = loadFileOnDemand(archive, filename, formatId);
+        preloadedScene = 0;
+        preloadingMessage.clear();
+        if(loaded){
             return true;
         }
     }
     return false;
 }
+
+
+boost::function<void()> SceneItem::getFileDataPreloader(const Archive& archive)
+{
+    std::string filename, formatId;
+    if(!archive.isOnDemandLoadingEnabled() &&
+       archive.readRelocatablePath("file", filename) && archive.read("format", formatId)){
+        if(formatId == "VRML-FILE"){
+            return boost::bind(&SceneItem::preloadSceneFile, this, filename, loadVRML);
+        } else if(formatId == "STL-FILE"){
+            return boost::bind(&SceneItem::preloadSceneFile, this, filename, loadSTL);
+        }
+    }
+    return boost::function<void()>();
+}
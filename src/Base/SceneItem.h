@@ -31,10 +31,17 @@ protected:
     virtual Item* doDuplicate() const;
     virtual bool store(Archive& archive);
     virtual bool restore(const Archive& archive);
+    virtual boost::function<void()> getFileDataPreloader(const Archive& archive);
     virtual void doPutProperties(PutPropertyFunction& putProperty);
 
 private:
     SgPosTransformPtr topNode_;
+    SgNodePtr preloadedScene;
+    std::string preloadingMessage;
+
+    typedef SgNodePtr (*SceneFileLoader)(const std::string& filename, std::ostream& os);
+    bool loadSceneFile(const std::string& filename, std::ostream& os, SceneFileLoader loadFile);
+    void preloadSceneFile(const std::string& filename, SceneFileLoader loadFile);
 
     bool onTranslationChanged(const std::string& value);
     bool onRotationChanged(const std::string& value);
@@ -25,6 +25,8 @@
 #include <cnoid/SceneCameras>
 #include <cnoid/SceneLights>
 #include <cnoid/MeshGenerator>
+#include <cnoid/Image>
+#include <cnoid/TimingProfiler>
 #include <QGLWidget>
 #include <QGLPixelBuffer>
 #include <QLabel>
@@ -35,10 +37,15 @@
 #include <QColorDialog>
 #include <QElapsedTimer>
 #include <QMessageBox>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#include <QGuiApplication>
+#include <QScreen>
+#endif
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
 #include <boost/foreach.hpp>
 #include <set>
+#include <algorithm>
 #include <iostream>
 #include "gettext.h"
 
@@ -129,16 +136,21 @@ public:
     PushButton backgroundColorButton;
     PushButton gridColorButton[3];
     CheckBox textureCheck;
+    CheckBox textureMipmapCheck;
+    CheckBox textureCompressionCheck;
+    SpinBox textureUploadBudgetSpin;
     PushButton defaultColorButton;
     DoubleSpinBox pointSizeSpin;
     DoubleSpinBox lineWidthSpin;
     CheckBox pointRenderingModeCheck;
     Connection pointRenderingModeCheckConnection;
+    CheckBox pointSetLODCheck;
     CheckBox normalVisualizationCheck;
     DoubleSpinBox normalLengthSpin;
     CheckBox coordinateAxesCheck;
     CheckBox fpsCheck;
     PushButton fpsTestButton;
+    SpinBox maxFrameRateSpin;
     CheckBox newDisplayListDoubleRenderingCheck;
     CheckBox bufferForPickingCheck;
 
@@ -196,6 +208,7 @@ public:
     SgGroupPtr systemGroup;
     SgGroup* scene;
     GLSceneRenderer* renderer;
+    vector<SceneWidgetImpl*>* sharingWidgets;
     QGLPixelBuffer* pixelBufferForPicking;
     LazyCaller extractPreprocessedNodesLater;
     SgUpdate modified;
@@ -268,6 +281,23 @@ public:
     Timer fpsRenderingTimer;
     bool fpsRendered;
 
+    /*
+      The rendering requests from the scene graph are coalesced so that the scene is rendered
+      at most once in the redraw interval, which is given by the max frame rate or the refresh
+      rate of the display.
+    */
+    double maxFrameRate; // zero means the refresh rate of the display
+    int redrawInterval; // msec
+    Timer redrawTimer;
+    QElapsedTimer redrawClock;
+    bool isRedrawRequested;
+    qint64 lastRedrawTime;
+    qint64 redrawDueTime;
+    int numCoalescedFrames;
+    int numDroppedFrames;
+    int lastNumCoalescedFrames;
+    int lastNumDroppedFrames;
+
     ConfigDialog* config;
     QLabel* indicatorLabel;
 
@@ -295,6 +325,11 @@ public:
 
     void onSceneGraphUpdated(const SgUpdate& update);
 
+    void requestRedraw();
+    void onRedrawTimeout();
+    void setMaxFrameRate(double rate);
+    void updateRedrawInterval();
+
     void showFPS(bool on);
     void doFPSTest();
     void onFPSUpdateRequest();
@@ -311,10 +346,14 @@ public:
     void onCurrentCameraChanged();
 
     void onTextureToggled(bool on);
+    void onTextureMipmapToggled(bool on);
+    void onTextureCompressionToggled(bool on);
+    void onTextureUploadBudgetChanged(int megaBytes);
     void onLineWidthChanged(double width);
     void onPointSizeChanged(double width);
     void setPolygonMode(int mode);
     void onPointRenderingModeToggled(bool on);
+    void onPointSetLODToggled(bool on);
     void setCollisionLinesVisible(bool on);
     void onFieldOfViewChanged();
     void onClippingDepthChanged();
@@ -388,6 +427,23 @@ public:
 
 }
 
+namespace {
+
+/*
+  The widgets whose GL contexts share the objects such as the buffers and the textures.
+  The widgets using GLSL and the others are separated because their contexts are different.
+*/
+vector<SceneWidgetImpl*> sharingWidgetsForGLSL;
+vector<SceneWidgetImpl*> sharingWidgetsForGL1;
+
+QGLWidget* getShareWidget(bool useGLSL)
+{
+    vector<SceneWidgetImpl*>& widgets = useGLSL ? sharingWidgetsForGLSL : sharingWidgetsForGL1;
+    return widgets.empty() ? 0 : widgets.front();
+}
+
+}
+
 
 SceneWidgetRoot::SceneWidgetRoot(SceneWidget* sceneWidget)
     : sceneWidget_(sceneWidget)
@@ -456,7 +512,7 @@ SceneWidget::SceneWidget()
 
 
 SceneWidgetImpl::SceneWidgetImpl(QGLFormat& format, bool useGLSL, SceneWidget* self)
-    : QGLWidget(format, self),
+    : QGLWidget(format, self, getShareWidget(useGLSL)),
       self(self),
       os(MessageView::mainInstance()->cout()),
       sceneRoot(new SceneWidgetRoot(self)),
@@ -482,9 +538,12 @@ SceneWidgetImpl::SceneWidgetImpl(QGLFormat& format, bool useGLSL, SceneWidget* s
         renderer = new GL1SceneRenderer(sceneRoot);
     }
     
+    sharingWidgets = useGLSL ? &sharingWidgetsForGLSL : &sharingWidgetsForGL1;
+    sharingWidgets->push_back(this);
+
     renderer->setOutputStream(os);
     renderer->enableUnusedCacheCheck(true);
-    renderer->sigRenderingRequest().connect(boost::bind(&SceneWidgetImpl::update, this));
+    renderer->sigRenderingRequest().connect(boost::bind(&SceneWidgetImpl::requestRedraw, this));
     renderer->sigCamerasChanged().connect(boost::bind(&SceneWidgetImpl::onCamerasChanged, this));
     renderer->sigCurrentCameraChanged().connect(boost::bind(&SceneWidgetImpl::onCurrentCameraChanged, this));
 
@@ -577,6 +636,19 @@ SceneWidgetImpl::SceneWidgetImpl(QGLFormat& format, bool useGLSL, SceneWidget* s
     initializeCoordinateAxes();
     updateGrids();
 
+    maxFrameRate = 0.0;
+    updateRedrawInterval();
+    redrawTimer.setSingleShot(true);
+    redrawTimer.sigTimeout().connect(boost::bind(&SceneWidgetImpl::onRedrawTimeout, this));
+    redrawClock.start();
+    isRedrawRequested = false;
+    lastRedrawTime = -redrawInterval;
+    redrawDueTime = 0;
+    numCoalescedFrames = 0;
+    numDroppedFrames = 0;
+    lastNumCoalescedFrames = 0;
+    lastNumDroppedFrames = 0;
+
     if(!useGLSL){
         fpsTimer.sigTimeout().connect(boost::bind(&SceneWidgetImpl::onFPSUpdateRequest, this));
         fpsRenderingTimer.setSingleShot(true);
@@ -602,7 +674,11 @@ SceneWidgetImpl::~SceneWidgetImpl()
         pixelBufferForPicking->makeCurrent();
         delete pixelBufferForPicking;
     }
-    
+
+    sharingWidgets->erase(std::find(sharingWidgets->begin(), sharingWidgets->end(), this));
+
+    // The objects shared with the other widgets are deleted in their share group
+    makeCurrent();
     delete renderer;
     
     delete indicatorLabel;
@@ -640,6 +716,18 @@ void SceneWidgetImpl::initializeGL()
         os << "SceneWidgetImpl::initializeGL()" << endl;
     }
 
+    TimingProfiler::Scope timingScope("SceneWidget/Initializing GL");
+
+    if(isSharing()){
+        for(size_t i=0; i < sharingWidgets->size(); ++i){
+            SceneWidgetImpl* widget = (*sharingWidgets)[i];
+            if(widget != this){
+                renderer->shareResourcesWith(widget->renderer);
+                break;
+            }
+        }
+    }
+
     if(!renderer->initializeGL()){
         os << "OpenGL initialization failed." << endl;
         // This view shoulbe be disabled when the glew initialization is failed.
@@ -700,6 +788,66 @@ void SceneWidgetImpl::onSceneGraphUpdated(const SgUpdate& update)
 }
 
 
+void SceneWidgetImpl::requestRedraw()
+{
+    if(isRedrawRequested){
+        ++numCoalescedFrames;
+        return;
+    }
+    isRedrawRequested = true;
+
+    const qint64 now = redrawClock.elapsed();
+    redrawDueTime = std::max(now, lastRedrawTime + redrawInterval);
+    if(redrawDueTime <= now){
+        update();
+    } else {
+        redrawTimer.start(static_cast<int>(redrawDueTime - now));
+    }
+}
+
+
+void SceneWidgetImpl::onRedrawTimeout()
+{
+    if(isRedrawRequested){
+        update();
+    }
+}
+
+
+void SceneWidgetImpl::setMaxFrameRate(double rate)
+{
+    maxFrameRate = std::max(0.0, rate);
+    updateRedrawInterval();
+}
+
+
+/**
+   The swap interval of the format is considered because the buffer swap waits for
+   the vertical blanks in that case and the frames rendered in the meantime are not displayed.
+*/
+void SceneWidgetImpl::updateRedrawInterval()
+{
+    double rate = maxFrameRate;
+    double refreshRate = 60.0;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    if(QScreen* screen = QGuiApplication::primaryScreen()){
+        if(screen->refreshRate() > 0.0){
+            refreshRate = screen->refreshRate();
+        }
+    }
+#endif
+    const int swapInterval = QGLWidget::format().swapInterval();
+    if(swapInterval > 0){
+        refreshRate /= swapInterval;
+    }
+    if(rate <= 0.0 || (swapInterval > 0 && rate > refreshRate)){
+        rate = refreshRate;
+    }
+    // The interval is rounded down so that the frames are not skipped by the timer resolution
+    redrawInterval = static_cast<int>(1000.0 / rate);
+}
+
+
 void SceneWidgetImpl::paintGL()
 {
     if(TRACE_FUNCTIONS){
@@ -707,6 +855,17 @@ void SceneWidgetImpl::paintGL()
         os << "SceneWidgetImpl::paintGL() " << counter++ << endl;
     }
 
+    const qint64 now = redrawClock.elapsed();
+    if(isRedrawRequested){
+        // The frames which could have been displayed while the GUI thread was busy
+        if(redrawInterval > 0 && now > redrawDueTime + redrawInterval){
+            numDroppedFrames += (now - redrawDueTime) / redrawInterval;
+        }
+        isRedrawRequested = false;
+        redrawTimer.stop();
+    }
+    lastRedrawTime = now;
+
     renderer->render();
 
     if(fpsTimer.isActive()){
@@ -786,6 +945,8 @@ void SceneWidgetImpl::renderFPS()
 {
     renderer->setColor(Vector3f(1.0f, 1.0f, 1.0f));
     renderText(20, 20, QString("FPS: %1").arg(fps));
+    renderText(20, 40, QString(_("Coalesced: %1, Dropped: %2"))
+               .arg(lastNumCoalescedFrames).arg(lastNumDroppedFrames));
     fpsRendered = true;
     ++fpsCounter;
 }
@@ -796,6 +957,10 @@ void SceneWidgetImpl::onFPSUpdateRequest()
     double oldFps = fps;
     fps = fpsCounter / 0.5;
     fpsCounter = 0;
+    lastNumCoalescedFrames = numCoalescedFrames;
+    lastNumDroppedFrames = numDroppedFrames;
+    numCoalescedFrames = 0;
+    numDroppedFrames = 0;
     fpsRendered = false;
     if(oldFps > 0.0 || fps > 0.0){
         fpsRenderingTimer.start(100);
@@ -816,6 +981,8 @@ void SceneWidgetImpl::showFPS(bool on)
 {
     if(on){
         fpsCounter = 0;
+        numCoalescedFrames = 0;
+        numDroppedFrames = 0;
         fpsTimer.start(500);
     } else {
         fpsTimer.stop();
@@ -2066,6 +2233,30 @@ void SceneWidgetImpl::onTextureToggled(bool on)
 }
 
 
+void SceneWidgetImpl::onTextureMipmapToggled(bool on)
+{
+    renderer->enableTextureMipmaps(on);
+    // The uploaded textures are uploaded again with the new setting
+    renderer->requestToClearCache();
+    update();
+}
+
+
+void SceneWidgetImpl::onTextureCompressionToggled(bool on)
+{
+    renderer->enableTextureCompression(on);
+    renderer->requestToClearCache();
+    update();
+}
+
+
+void SceneWidgetImpl::onTextureUploadBudgetChanged(int megaBytes)
+{
+    renderer->setTextureUploadBudget(megaBytes * 1024 * 1024);
+    update();
+}
+
+
 void SceneWidgetImpl::onLineWidthChanged(double width)
 {
     renderer->setDefaultLineWidth(width);
@@ -2130,6 +2321,13 @@ SceneWidget::PolygonMode SceneWidget::polygonMode() const
 }
 
 
+void SceneWidgetImpl::onPointSetLODToggled(bool on)
+{
+    renderer->enablePointSetLOD(on);
+    update();
+}
+
+
 void SceneWidgetImpl::onPointRenderingModeToggled(bool on)
 {
     if(on){
@@ -2363,6 +2561,12 @@ void SceneWidget::setShowFPS(bool on)
 }
 
 
+void SceneWidget::setMaxFrameRate(double rate)
+{
+    impl->config->maxFrameRateSpin.setValue(rate);
+}
+
+
 void SceneWidget::setCameraPosition(const Vector3& eye, const Vector3& direction, const Vector3& up)
 {
     impl->builtinCameraTransform->setPosition(SgCamera::positionLookingFor(eye, direction, up));
@@ -2423,6 +2627,35 @@ QImage SceneWidget::getImage()
 }
 
 
+bool SceneWidget::startImageCapture()
+{
+    impl->makeCurrent();
+    return impl->renderer->startImageReading();
+}
+
+
+bool SceneWidget::takeCapturedImage(QImage& out_image)
+{
+    impl->makeCurrent();
+    Image image;
+    if(!impl->renderer->takeReadImage(image)){
+        return false;
+    }
+    out_image = QImage(image.width(), image.height(), QImage::Format_RGB888);
+    const int rowSize = image.width() * 3;
+    for(int i=0; i < image.height(); ++i){
+        std::copy(image.pixels() + i * rowSize, image.pixels() + (i + 1) * rowSize, out_image.scanLine(i));
+    }
+    return true;
+}
+
+
+int SceneWidget::numPendingCapturedImages() const
+{
+    return impl->renderer->numPendingImageReadings();
+}
+
+
 void SceneWidget::setScreenSize(int width, int height)
 {
     impl->setScreenSize(width, height);
@@ -3077,6 +3310,20 @@ ConfigDialog::ConfigDialog(SceneWidgetImpl* impl, bool useGLSL)
     textureCheck.setChecked(true);
     textureCheck.sigToggled().connect(boost::bind(&SceneWidgetImpl::onTextureToggled, impl, _1));
     hbox->addWidget(&textureCheck);
+    textureMipmapCheck.setText(_("Mipmaps"));
+    textureMipmapCheck.sigToggled().connect(boost::bind(&SceneWidgetImpl::onTextureMipmapToggled, impl, _1));
+    hbox->addWidget(&textureMipmapCheck);
+    textureCompressionCheck.setText(_("Compression"));
+    textureCompressionCheck.sigToggled().connect(boost::bind(&SceneWidgetImpl::onTextureCompressionToggled, impl, _1));
+    hbox->addWidget(&textureCompressionCheck);
+    hbox->addWidget(new QLabel(_("Upload limit per frame")));
+    textureUploadBudgetSpin.setRange(0, 9999);
+    textureUploadBudgetSpin.setSpecialValueText(_("None"));
+    textureUploadBudgetSpin.setValue(0);
+    textureUploadBudgetSpin.sigValueChanged().connect(
+        boost::bind(&SceneWidgetImpl::onTextureUploadBudgetChanged, impl, _1));
+    hbox->addWidget(&textureUploadBudgetSpin);
+    hbox->addWidget(new QLabel(_("[MB]")));
     hbox->addStretch();
     vbox->addLayout(hbox);
 
@@ -3111,6 +3358,13 @@ ConfigDialog::ConfigDialog(SceneWidgetImpl* impl, bool useGLSL)
     hbox->addWidget(&pointRenderingModeCheck);
     hbox->addStretch();
     vbox->addLayout(hbox);
+
+    hbox = new QHBoxLayout();
+    pointSetLODCheck.setText(_("Render large point sets with the level of detail"));
+    pointSetLODCheck.sigToggled().connect(boost::bind(&SceneWidgetImpl::onPointSetLODToggled, impl, _1));
+    hbox->addWidget(&pointSetLODCheck);
+    hbox->addStretch();
+    vbox->addLayout(hbox);
     
     hbox = new QHBoxLayout();
     normalVisualizationCheck.setText(_("Normal Visualization"));
@@ -3150,6 +3404,17 @@ ConfigDialog::ConfigDialog(SceneWidgetImpl* impl, bool useGLSL)
     hbox->addStretch();
     vbox->addLayout(hbox);
 
+    hbox = new QHBoxLayout();
+    hbox->addWidget(new QLabel(_("Max frame rate")));
+    maxFrameRateSpin.setAlignment(Qt::AlignCenter);
+    maxFrameRateSpin.setRange(0, 1000);
+    maxFrameRateSpin.setSpecialValueText(_("Display"));
+    maxFrameRateSpin.setValue(0);
+    maxFrameRateSpin.sigValueChanged().connect(boost::bind(&SceneWidgetImpl::setMaxFrameRate, impl, _1));
+    hbox->addWidget(&maxFrameRateSpin);
+    hbox->addStretch();
+    vbox->addLayout(hbox);
+
     hbox = new QHBoxLayout();
     newDisplayListDoubleRenderingCheck.setText(_("Do double rendering when a new display list is created."));
     newDisplayListDoubleRenderingCheck.sigToggled().connect(boost::bind(&SceneWidgetImpl::onNewDisplayListDoubleRenderingToggled, impl, _1));
@@ -3207,12 +3472,17 @@ void ConfigDialog::storeState(Archive& archive)
     archive.write("yzGridSpan", gridSpanSpin[YZ_GRID].value());
     archive.write("yzGridInterval", gridIntervalSpin[YZ_GRID].value());
     archive.write("texture", textureCheck.isChecked());
+    archive.write("textureMipmaps", textureMipmapCheck.isChecked());
+    archive.write("textureCompression", textureCompressionCheck.isChecked());
+    archive.write("textureUploadBudget", textureUploadBudgetSpin.value());
     archive.write("lineWidth", lineWidthSpin.value());
     archive.write("pointSize", pointSizeSpin.value());
+    archive.write("pointSetLOD", pointSetLODCheck.isChecked());
     archive.write("normalVisualization", normalVisualizationCheck.isChecked());
     archive.write("normalLength", normalLengthSpin.value());
     archive.write("coordinateAxes", coordinateAxesCheck.isChecked());
     archive.write("showFPS", fpsCheck.isChecked());
+    archive.write("maxFrameRate", maxFrameRateSpin.value());
     archive.write("enableNewDisplayListDoubleRendering", newDisplayListDoubleRenderingCheck.isChecked());
     archive.write("useBufferForPicking", bufferForPickingCheck.isChecked());
 }
@@ -3255,12 +3525,17 @@ void ConfigDialog::restoreState(const Archive& archive)
     gridSpanSpin[YZ_GRID].setValue(archive.get("yzGridSpan", gridSpanSpin[YZ_GRID].value()));
     gridIntervalSpin[YZ_GRID].setValue(archive.get("yzGridInterval", gridIntervalSpin[YZ_GRID].value()));
     textureCheck.setChecked(archive.get("texture", textureCheck.isChecked()));
+    textureMipmapCheck.setChecked(archive.get("textureMipmaps", textureMipmapCheck.isChecked()));
+    textureCompressionCheck.setChecked(archive.get("textureCompression", textureCompressionCheck.isChecked()));
+    textureUploadBudgetSpin.setValue(archive.get("textureUploadBudget", textureUploadBudgetSpin.value()));
     lineWidthSpin.setValue(archive.get("lineWidth", lineWidthSpin.value()));
     pointSizeSpin.setValue(archive.get("pointSize", pointSizeSpin.value()));
+    pointSetLODCheck.setChecked(archive.get("pointSetLOD", pointSetLODCheck.isChecked()));
     normalVisualizationCheck.setChecked(archive.get("normalVisualization", normalVisualizationCheck.isChecked()));
     normalLengthSpin.setValue(archive.get("normalLength", normalLengthSpin.value()));
     coordinateAxesCheck.setChecked(archive.get("coordinateAxes", coordinateAxesCheck.isChecked()));
     fpsCheck.setChecked(archive.get("showFPS", fpsCheck.isChecked()));
+    maxFrameRateSpin.setValue(archive.get("maxFrameRate", maxFrameRateSpin.value()));
     newDisplayListDoubleRenderingCheck.setChecked(archive.get("enableNewDisplayListDoubleRendering", newDisplayListDoubleRenderingCheck.isChecked()));
     bufferForPickingCheck.setChecked(archive.get("useBufferForPicking", bufferForPickingCheck.isChecked()));
 }
@@ -87,6 +87,12 @@ public:
     void setNormalVisualization(bool on);
     void setCoordinateAxes(bool on);
     void setShowFPS(bool on);
+
+    /**
+       The rendering requests from the scene graph are coalesced so that the scene is not
+       rendered more often than this rate. Zero means the refresh rate of the display.
+    */
+    void setMaxFrameRate(double rate);
     void setNewDisplayListDoubleRenderingEnabled(bool on);
     void setUseBufferForPicking(bool on);
        
@@ -122,6 +128,22 @@ public:
 
     bool saveImage(const std::string& filename);
     QImage getImage();
+
+    /**
+       Start capturing the current image without waiting for the transfer from the GPU.
+       The captured images are obtained by takeCapturedImage() in the order of the capturing.
+       \return false if the asynchronous capturing is not available or the captured images
+       which have not been taken are too many.
+    */
+    bool startImageCapture();
+
+    /**
+       Get the oldest image started by startImageCapture() which has not been taken.
+       \return false if there is no such image
+    */
+    bool takeCapturedImage(QImage& out_image);
+    int numPendingCapturedImages() const;
+    
     void setScreenSize(int width, int height);
 
     void updateIndicator(const std::string& text);
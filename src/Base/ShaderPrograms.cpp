@@ -131,6 +131,7 @@ PhongShadowProgram::PhongShadowProgram()
     isShadowAntiAliasingEnabled_ = false;
     shadowMapWidth_ = 1024;
     shadowMapHeight_ = 1024;
+    shadowMapLayer_ = WHOLE_SHADOW_MAP;
     persShadowCamera = new SgPerspectiveCamera();
     orthoShadowCamera = new SgOrthographicCamera();
     orthoShadowCamera->setHeight(5.0);
@@ -248,6 +249,33 @@ void PhongShadowProgram::initializeShadowInfo(int index)
     if(result != GL_FRAMEBUFFER_COMPLETE) {
         throw Exception("Framebuffer is not complete.\n");
     }
+
+    shadow.staticDepthBuffer = 0;
+    shadow.staticFrameBuffer = 0;
+}
+
+
+/**
+   The static layer is a render buffer so that the bindings of the texture units
+   for the shadow maps are not changed.
+*/
+void PhongShadowProgram::createStaticShadowLayer(ShadowInfo& shadow)
+{
+    glGenRenderbuffers(1, &shadow.staticDepthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, shadow.staticDepthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, shadowMapWidth_, shadowMapHeight_);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &shadow.staticFrameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadow.staticFrameBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, shadow.staticDepthBuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(result != GL_FRAMEBUFFER_COMPLETE) {
+        throw Exception("Framebuffer is not complete.\n");
+    }
 }
 
 
@@ -434,6 +462,17 @@ void ShadowMapProgram::activate()
 void ShadowMapProgram::initializeRendering()
 {
     PhongShadowProgram::ShadowInfo& shadow = mainProgram->shadowInfos[mainProgram->currentShadowIndex];
+    const PhongShadowProgram::ShadowMapLayer layer = mainProgram->shadowMapLayer_;
+
+    if(layer == PhongShadowProgram::STATIC_SHADOW_LAYER){
+        if(!shadow.staticFrameBuffer){
+            mainProgram->createStaticShadowLayer(shadow);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, shadow.staticFrameBuffer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return;
+    }
+
     glBindFramebuffer(GL_FRAMEBUFFER, shadow.frameBuffer);
         
     if(mainProgram->isShadowAntiAliasingEnabled_){
@@ -444,7 +483,16 @@ void ShadowMapProgram::initializeRendering()
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     }
 
-    glClear(GL_DEPTH_BUFFER_BIT);
+    if(layer == PhongShadowProgram::DYNAMIC_SHADOW_LAYER && shadow.staticFrameBuffer){
+        const int w = mainProgram->shadowMapWidth_;
+        const int h = mainProgram->shadowMapHeight_;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, shadow.staticFrameBuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow.frameBuffer);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadow.frameBuffer);
+    } else {
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
 }
 
 
@@ -452,3 +500,379 @@ void ShadowMapProgram::deactivate()
 {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
+
+
+DepthToPointProgram::DepthToPointProgram()
+{
+    depthTexture = 0;
+    pointTexture = 0;
+    frameBuffer = 0;
+    vertexArray = 0;
+    width = 0;
+    height = 0;
+}
+
+
+void DepthToPointProgram::initialize()
+{
+    loadVertexShader(":/Base/shader/depthtopoint.vert");
+    loadFragmentShader(":/Base/shader/depthtopoint.frag");
+    link();
+
+    depthTextureLocation = getUniformLocation("depthTexture");
+    inverseProjectionMatrixLocation = getUniformLocation("inverseProjectionMatrix");
+    sizeLocation = getUniformLocation("size");
+
+    // The core profile requires a vertex array object to draw even if it has no attributes
+    glGenVertexArrays(1, &vertexArray);
+}
+
+
+void DepthToPointProgram::setSize(int width, int height) throw (Exception)
+{
+    GLint prevActiveTexture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    
+    if(!depthTexture){
+        glGenTextures(1, &depthTexture);
+        glGenTextures(1, &pointTexture);
+        glGenFramebuffers(1, &frameBuffer);
+    }
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, pointTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glActiveTexture(prevActiveTexture);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pointTexture, 0);
+    GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(result != GL_FRAMEBUFFER_COMPLETE) {
+        throw Exception("Framebuffer is not complete.\n");
+    }
+
+    this->width = width;
+    this->height = height;
+}
+
+
+/**
+   The depth buffer is copied into a texture because the source frame buffer usually
+   has a render buffer, which cannot be sampled, for the depth.
+*/
+void DepthToPointProgram::convert
+(GLuint sourceFrameBuffer, int x, int y, int width, int height,
+ const Matrix4f& inverseProjectionMatrix, void* out_points) throw (Exception)
+{
+    if(width != this->width || height != this->height){
+        setSize(width, height);
+    }
+
+    GLint prevActiveTexture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFrameBuffer);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, width, height);
+    const GLboolean isDepthTestEnabled = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    use();
+    glUniform1i(depthTextureLocation, textureUnit);
+    glUniformMatrix4fv(inverseProjectionMatrixLocation, 1, GL_FALSE, inverseProjectionMatrix.data());
+    glUniform2i(sizeLocation, width, height);
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, out_points);
+
+    if(isDepthTestEnabled){
+        glEnable(GL_DEPTH_TEST);
+    }
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glActiveTexture(prevActiveTexture);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFrameBuffer);
+}
+
+
+RangeResampleProgram::RangeResampleProgram()
+{
+    depthTexture = 0;
+    rangeTexture = 0;
+    frameBuffer = 0;
+    vertexArray = 0;
+    depthWidth = 0;
+    depthHeight = 0;
+    numYawSamples = 0;
+    numPitchSamples = 0;
+}
+
+
+void RangeResampleProgram::initialize()
+{
+    loadVertexShader(":/Base/shader/depthtopoint.vert");
+    loadFragmentShader(":/Base/shader/rangeresample.frag");
+    link();
+
+    depthTextureLocation = getUniformLocation("depthTexture");
+    depthSizeLocation = getUniformLocation("depthSize");
+    projectionScaleLocation = getUniformLocation("projectionScale");
+    inverseDepthCoefficientsLocation = getUniformLocation("inverseDepthCoefficients");
+    firstYawAngleLocation = getUniformLocation("firstYawAngle");
+    yawStepLocation = getUniformLocation("yawStep");
+    firstPitchAngleLocation = getUniformLocation("firstPitchAngle");
+    pitchStepLocation = getUniformLocation("pitchStep");
+    depthErrorLocation = getUniformLocation("depthError");
+
+    glGenVertexArrays(1, &vertexArray);
+}
+
+
+void RangeResampleProgram::setSizes
+(int depthWidth, int depthHeight, int numYawSamples, int numPitchSamples) throw (Exception)
+{
+    GLint prevActiveTexture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    
+    if(!depthTexture){
+        glGenTextures(1, &depthTexture);
+        glGenTextures(1, &rangeTexture);
+        glGenFramebuffers(1, &frameBuffer);
+    }
+    if(depthWidth != this->depthWidth || depthHeight != this->depthHeight){
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, depthWidth, depthHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    if(numYawSamples != this->numYawSamples || numPitchSamples != this->numPitchSamples){
+        glBindTexture(GL_TEXTURE_2D, rangeTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, numYawSamples, numPitchSamples, 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    glActiveTexture(prevActiveTexture);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rangeTexture, 0);
+    GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(result != GL_FRAMEBUFFER_COMPLETE) {
+        throw Exception("Framebuffer is not complete.\n");
+    }
+
+    this->depthWidth = depthWidth;
+    this->depthHeight = depthHeight;
+    this->numYawSamples = numYawSamples;
+    this->numPitchSamples = numPitchSamples;
+}
+
+
+/**
+   Only the fragments of the beams in the given yaw range are drawn so that the results of
+   the other sectors are kept in the range texture.
+*/
+void RangeResampleProgram::resample
+(GLuint sourceFrameBuffer, int x, int y, int width, int height, const Matrix4f& projectionMatrix,
+ int numYawSamples, int numPitchSamples, int yawBegin, int yawEnd,
+ float firstYawAngle, float yawStep, float firstPitchAngle, float pitchStep, float depthError) throw (Exception)
+{
+    if(width != depthWidth || height != depthHeight ||
+       numYawSamples != this->numYawSamples || numPitchSamples != this->numPitchSamples){
+        setSizes(width, height, numYawSamples, numPitchSamples);
+    }
+
+    GLint prevActiveTexture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFrameBuffer);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(yawBegin, 0, yawEnd - yawBegin, numPitchSamples);
+    const GLboolean isDepthTestEnabled = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    const Matrix4f Pinv = projectionMatrix.inverse();
+
+    use();
+    glUniform1i(depthTextureLocation, textureUnit);
+    glUniform2i(depthSizeLocation, width, height);
+    glUniform2f(projectionScaleLocation, projectionMatrix(0, 0), projectionMatrix(1, 1));
+    glUniform2f(inverseDepthCoefficientsLocation, Pinv(3, 2), Pinv(3, 3));
+    glUniform1f(firstYawAngleLocation, firstYawAngle);
+    glUniform1f(yawStepLocation, yawStep);
+    glUniform1f(firstPitchAngleLocation, firstPitchAngle);
+    glUniform1f(pitchStepLocation, pitchStep);
+    glUniform1f(depthErrorLocation, depthError);
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    if(isDepthTestEnabled){
+        glEnable(GL_DEPTH_TEST);
+    }
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glActiveTexture(prevActiveTexture);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFrameBuffer);
+}
+
+
+void RangeResampleProgram::readRanges(GLuint sourceFrameBuffer, void* out_ranges) throw (Exception)
+{
+    if(!frameBuffer){
+        throw Exception("No range has been resampled.\n");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, numYawSamples, numPitchSamples, GL_RED, GL_FLOAT, out_ranges);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFrameBuffer);
+}
+
+
+SensorNoiseProgram::SensorNoiseProgram()
+{
+    colorTexture = 0;
+    depthTexture = 0;
+    vertexArray = 0;
+    width = 0;
+    height = 0;
+}
+
+
+void SensorNoiseProgram::initialize()
+{
+    loadVertexShader(":/Base/shader/depthtopoint.vert");
+    loadFragmentShader(":/Base/shader/sensornoise.frag");
+    link();
+
+    colorTextureLocation = getUniformLocation("colorTexture");
+    depthTextureLocation = getUniformLocation("depthTexture");
+    originLocation = getUniformLocation("origin");
+    sizeLocation = getUniformLocation("size");
+    projectionCoefficientsLocation = getUniformLocation("projectionCoefficients");
+    depthRangeLocation = getUniformLocation("depthRange");
+    lensDistortionLocation = getUniformLocation("lensDistortion");
+    rangeNoiseLocation = getUniformLocation("rangeNoise");
+    rangeQuantizationStepLocation = getUniformLocation("rangeQuantizationStep");
+    dropoutRateLocation = getUniformLocation("dropoutRate");
+    seedLocation = getUniformLocation("seed");
+
+    glGenVertexArrays(1, &vertexArray);
+}
+
+
+void SensorNoiseProgram::setSize(int width, int height)
+{
+    if(!colorTexture){
+        glGenTextures(1, &colorTexture);
+        glGenTextures(1, &depthTexture);
+    }
+    glActiveTexture(GL_TEXTURE0 + colorTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glActiveTexture(GL_TEXTURE0 + depthTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    this->width = width;
+    this->height = height;
+}
+
+
+/**
+   The buffers are copied to the textures first because the source frame buffer cannot be read
+   as textures while it is being drawn. The depth is written with gl_FragDepth.
+*/
+void SensorNoiseProgram::apply
+(GLuint sourceFrameBuffer, int x, int y, int width, int height, const Matrix4f& projectionMatrix,
+ bool hasColor, float k1, float k2, float rangeNoise, float rangeQuantizationStep, float dropoutRate,
+ unsigned int seed) throw (Exception)
+{
+    GLint prevActiveTexture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFrameBuffer);
+    if(width != this->width || height != this->height){
+        setSize(width, height);
+    }
+    if(hasColor){
+        glActiveTexture(GL_TEXTURE0 + colorTextureUnit);
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+    }
+    glActiveTexture(GL_TEXTURE0 + depthTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+
+    GLint depthFunc;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    GLboolean depthMask;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+    const GLboolean isDepthTestEnabled = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean isBlendEnabled = glIsEnabled(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    if(!hasColor){
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    }
+
+    const float P22 = projectionMatrix(2, 2);
+    const float P23 = projectionMatrix(2, 3);
+
+    use();
+    glUniform1i(colorTextureLocation, colorTextureUnit);
+    glUniform1i(depthTextureLocation, depthTextureUnit);
+    glUniform2i(originLocation, x, y);
+    glUniform2i(sizeLocation, width, height);
+    glUniform4f(projectionCoefficientsLocation, projectionMatrix(0, 0), projectionMatrix(1, 1), P22, P23);
+    glUniform2f(depthRangeLocation, P23 / (P22 - 1.0f), P23 / (P22 + 1.0f));
+    glUniform2f(lensDistortionLocation, k1, k2);
+    glUniform1f(rangeNoiseLocation, rangeNoise);
+    glUniform1f(rangeQuantizationStepLocation, rangeQuantizationStep);
+    glUniform1f(dropoutRateLocation, dropoutRate);
+    glUniform1ui(seedLocation, seed);
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    if(!hasColor){
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+    if(isBlendEnabled){
+        glEnable(GL_BLEND);
+    }
+    glDepthMask(depthMask);
+    glDepthFunc(depthFunc);
+    if(!isDepthTestEnabled){
+        glDisable(GL_DEPTH_TEST);
+    }
+    glActiveTexture(prevActiveTexture);
+}
@@ -145,12 +145,26 @@ class PhongShadowProgram : public LightingProgram
         GLint shadowMapLocation;
         GLuint depthTexture;
         GLuint frameBuffer;
+        // The depth map of the static layer, which is created when it is first rendered
+        GLuint staticDepthBuffer;
+        GLuint staticFrameBuffer;
         Matrix4 BPV;
     };
     std::vector<ShadowInfo> shadowInfos;
 
     Matrix4 shadowBias;
 
+public:
+    /**
+       A shadow map can be rendered as two layers. The static layer is rendered into its own
+       buffer, and it is copied into the shadow map before the dynamic layer is rendered.
+       The static layer can be kept for the next frames while the static shapes do not move.
+    */
+    enum ShadowMapLayer { WHOLE_SHADOW_MAP, STATIC_SHADOW_LAYER, DYNAMIC_SHADOW_LAYER };
+
+private:
+    ShadowMapLayer shadowMapLayer_;
+
     GLint maxFogDistLocation;
     GLint minFogDistLocation;
     GLint fogColorLocation;
@@ -178,6 +192,7 @@ public:
     int shadowMapHeight() const { return shadowMapHeight_; }
     SgCamera* getShadowMapCamera(SgLight* light, Affine3& io_T);
     void setShadowMapViewProjection(const Matrix4& PV);
+    void setShadowMapLayer(ShadowMapLayer layer) { shadowMapLayer_ = layer; }
     ShadowMapProgram& shadowMapProgram() { return *shadowMapProgram_; }
     void setFogEnabled(bool on) {
         glUniform1i(isFogEnabledLocation, on);
@@ -192,6 +207,7 @@ public:
 
 private:
     void initializeShadowInfo(int index);
+    void createStaticShadowLayer(ShadowInfo& shadow);
 
     friend class ShadowMapProgram;
 };
@@ -209,6 +225,141 @@ public:
     virtual void deactivate();
 };
 
+
+/**
+   This program converts the depth buffer into the 3D points in the camera coordinate
+   by rendering them into a floating point texture.
+*/
+class DepthToPointProgram : public ShaderProgram
+{
+    GLint depthTextureLocation;
+    GLint inverseProjectionMatrixLocation;
+    GLint sizeLocation;
+    GLuint depthTexture;
+    GLuint pointTexture;
+    GLuint frameBuffer;
+    GLuint vertexArray;
+    int width;
+    int height;
+
+    static const int textureUnit = 4;
+
+public:
+    DepthToPointProgram();
+
+    virtual void initialize();
+
+    /**
+       \param sourceFrameBuffer The frame buffer bound to GL_FRAMEBUFFER when this function returns
+       \param out_points The float triplets of the points are written like the data of glReadPixels().
+       The pointer is the offset in the buffer if a pixel pack buffer is bound.
+    */
+    void convert(GLuint sourceFrameBuffer, int x, int y, int width, int height,
+                 const Matrix4f& inverseProjectionMatrix, void* out_points) throw (Exception);
+
+private:
+    void setSize(int width, int height) throw (Exception);
+};
+
+
+/**
+   This program computes the distances of the beams of a range sensor from the depth buffer.
+   A wide scan can be rendered as several sectors, and the distances of the beams in each sector
+   are written into the columns of the result texture, so that only the beams are read back.
+*/
+class RangeResampleProgram : public ShaderProgram
+{
+    GLint depthTextureLocation;
+    GLint depthSizeLocation;
+    GLint projectionScaleLocation;
+    GLint inverseDepthCoefficientsLocation;
+    GLint firstYawAngleLocation;
+    GLint yawStepLocation;
+    GLint firstPitchAngleLocation;
+    GLint pitchStepLocation;
+    GLint depthErrorLocation;
+    GLuint depthTexture;
+    GLuint rangeTexture;
+    GLuint frameBuffer;
+    GLuint vertexArray;
+    int depthWidth;
+    int depthHeight;
+    int numYawSamples;
+    int numPitchSamples;
+
+    static const int textureUnit = 4;
+
+public:
+    RangeResampleProgram();
+
+    virtual void initialize();
+
+    /**
+       \param sourceFrameBuffer The frame buffer bound to GL_FRAMEBUFFER when this function returns
+       \param yawBegin, yawEnd The range of the yaw indices of the beams computed from the source
+       \param firstYawAngle The yaw angle of the first beam in the camera coordinate
+    */
+    void resample(GLuint sourceFrameBuffer, int x, int y, int width, int height, const Matrix4f& projectionMatrix,
+                  int numYawSamples, int numPitchSamples, int yawBegin, int yawEnd,
+                  float firstYawAngle, float yawStep, float firstPitchAngle, float pitchStep, float depthError)
+        throw (Exception);
+
+    /**
+       \param out_ranges The float distances of the (numYawSamples * numPitchSamples) beams
+       from the lowest pitch angle. The distance is infinity if nothing is rendered for the beam.
+    */
+    void readRanges(GLuint sourceFrameBuffer, void* out_ranges) throw (Exception);
+
+private:
+    void setSizes(int depthWidth, int depthHeight, int numYawSamples, int numPitchSamples) throw (Exception);
+};
+
+
+/**
+   This program applies the lens distortion and the noise of the distances to the rendered image
+   of a vision sensor. The color and depth buffers of the frame buffer are overwritten so that
+   the results can be read back in the same way as the image without the noise.
+*/
+class SensorNoiseProgram : public ShaderProgram
+{
+    GLint colorTextureLocation;
+    GLint depthTextureLocation;
+    GLint originLocation;
+    GLint sizeLocation;
+    GLint projectionCoefficientsLocation;
+    GLint depthRangeLocation;
+    GLint lensDistortionLocation;
+    GLint rangeNoiseLocation;
+    GLint rangeQuantizationStepLocation;
+    GLint dropoutRateLocation;
+    GLint seedLocation;
+    GLuint colorTexture;
+    GLuint depthTexture;
+    GLuint vertexArray;
+    int width;
+    int height;
+
+    static const int colorTextureUnit = 4;
+    static const int depthTextureUnit = 5;
+
+public:
+    SensorNoiseProgram();
+
+    virtual void initialize();
+
+    /**
+       \param sourceFrameBuffer The frame buffer whose buffers are overwritten
+       \param hasColor The color buffer is not copied and not written if this is false.
+       \param seed The random numbers are determined by this value and the pixel positions.
+    */
+    void apply(GLuint sourceFrameBuffer, int x, int y, int width, int height, const Matrix4f& projectionMatrix,
+               bool hasColor, float k1, float k2, float rangeNoise, float rangeQuantizationStep, float dropoutRate,
+               unsigned int seed) throw (Exception);
+
+private:
+    void setSize(int width, int height);
+};
+
 }
 
 #endif
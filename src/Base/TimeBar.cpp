@@ -190,6 +190,7 @@ public:
     void updateFillLevel(int id, double time);
     void updateMinFillLevel();
     void stopFillLevelUpdate(int id);
+    double getPlaybackTime();
 
     void onTimeRangeSpinsChanged();
     void onFrameRateSpinChanged();
@@ -227,6 +228,7 @@ public:
     map<int, double> fillLevelMap;
     double fillLevel;
     bool isFillLevelActive;
+    boost::function<bool(double& out_time)> playbackClock;
 
     Signal<bool(double time), LogicalProduct> sigPlaybackInitialized;
     Signal<void(double time)> sigPlaybackStarted;
@@ -770,19 +772,38 @@ void TimeBar::startPlaybackFromFillLevel()
 }
 
 
+void TimeBar::setPlaybackClock(boost::function<bool(double& out_time)> clock)
+{
+    impl->playbackClock = clock;
+}
+
+
 double TimeBar::realPlaybackTime() const
 {
     if(impl->isDoingPlayback){
-        return impl->animationTimeOffset + impl->playbackSpeedScale * (impl->timer.elapsed() / 1000.0);
+        return impl->getPlaybackTime();
     } else {
         return time_;
     }
 }
 
 
+double TimeBarImpl::getPlaybackTime()
+{
+    double time;
+    if(playbackClock && playbackClock(time)){
+        // The timer is adjusted to continue from the time when the clock is stopped
+        animationTimeOffset = time - playbackSpeedScale * (timer.elapsed() / 1000.0);
+    } else {
+        time = animationTimeOffset + playbackSpeedScale * (timer.elapsed() / 1000.0);
+    }
+    return time;
+}
+
+
 void TimeBarImpl::timerEvent(QTimerEvent* event)
 {
-    double time = animationTimeOffset + playbackSpeedScale * (timer.elapsed() / 1000.0);
+    double time = getPlaybackTime();
 
     bool doStopAtLastFillLevel = false;
     if(isFillLevelActive){
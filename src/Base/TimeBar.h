@@ -6,6 +6,7 @@
 #define CNOID_BASE_TIME_BAR_H
 
 #include <cnoid/ToolBar>
+#include <boost/function.hpp>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -73,6 +74,15 @@ public:
     void stopFillLevelUpdate(int id);
     void setFillLevelSync(bool on);
 
+    /**
+       The playback time is given by the clock function instead of the timer of the time bar
+       while the function returns true, so that the playback is driven by an external clock
+       such as the position of the audio output. The playback speed scale is not applied to
+       the time given by the clock. The timer continues from the last time of the clock when
+       the function returns false. An empty function removes the clock.
+    */
+    void setPlaybackClock(boost::function<bool(double& out_time)> clock);
+
     virtual int stretchableDefaultWidth() const;
 
 protected:
@@ -65,12 +65,44 @@ ItemPtr Item_duplicateAll(Item& self) { return self.duplicateAll(); }
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_addChildItem_overloads, addChildItem, 1, 2)
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_insertChildItem, insertChildItem, 2, 3)
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_setTemporal, setTemporal, 0, 1)
-BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_load1_overloads, load, 1, 2)
-BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_load2_overloads, load, 2, 3)
-BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_save, load, 1, 2)
-BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(Item_overwrite, overwrite, 0, 2)
+/*
+  The GIL is released while an item is loaded or saved and while a script is waited for
+  because they may take a long time, and the script item may need the GIL to finish.
+*/
+bool Item_load1(Item& self, const std::string& filename, const std::string& format = std::string())
+{
+    PyGILUnlock unlock;
+    return self.load(filename, format);
+}
+BOOST_PYTHON_FUNCTION_OVERLOADS(Item_load1_overloads, Item_load1, 2, 3)
+
+bool Item_load2(Item& self, const std::string& filename, Item* parent, const std::string& format = std::string())
+{
+    PyGILUnlock unlock;
+    return self.load(filename, parent, format);
+}
+BOOST_PYTHON_FUNCTION_OVERLOADS(Item_load2_overloads, Item_load2, 3, 4)
 
-BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(ScriptItem_waitToFinish, waitToFinish, 0, 1)
+bool Item_save(Item& self, const std::string& filename, const std::string& format = std::string())
+{
+    PyGILUnlock unlock;
+    return self.save(filename, format);
+}
+BOOST_PYTHON_FUNCTION_OVERLOADS(Item_save_overloads, Item_save, 2, 3)
+
+bool Item_overwrite(Item& self, bool forceOverwrite = false, const std::string& format = std::string())
+{
+    PyGILUnlock unlock;
+    return self.overwrite(forceOverwrite, format);
+}
+BOOST_PYTHON_FUNCTION_OVERLOADS(Item_overwrite_overloads, Item_overwrite, 1, 3)
+
+bool ScriptItem_waitToFinish(ScriptItem& self, double timeout = 0.0)
+{
+    PyGILUnlock unlock;
+    return self.waitToFinish(timeout);
+}
+BOOST_PYTHON_FUNCTION_OVERLOADS(ScriptItem_waitToFinish_overloads, ScriptItem_waitToFinish, 1, 2)
 
 RootItemPtr RootItem_Instance() { return RootItem::instance(); }
 
@@ -114,9 +146,6 @@ void exportPyItems()
     to_python_converter<ItemList<MultiSE3SeqItem>, ItemList_to_pylist_converter<MultiSE3SeqItem> >();
     to_python_converter<ItemList<Vector3SeqItem>, ItemList_to_pylist_converter<Vector3SeqItem> >();
 
-    bool (Item::*Item_load1)(const std::string& filename, const std::string& formatId) = &Item::load;
-    bool (Item::*Item_load2)(const std::string& filename, Item* parent, const std::string& formatId) = &Item::load;
-    
     class_<Item, ItemPtr, boost::noncopyable> itemClass("Item", no_init);
     
     itemClass
@@ -149,8 +178,8 @@ void exportPyItems()
         .def("assign", &Item::assign)
         .def("load", Item_load1, Item_load1_overloads())
         .def("load", Item_load2, Item_load2_overloads())
-        .def("save", &Item::save, Item_save())
-        .def("overwrite", &Item::overwrite, Item_overwrite())
+        .def("save", Item_save, Item_save_overloads())
+        .def("overwrite", Item_overwrite, Item_overwrite_overloads())
         .def("filePath", &Item::filePath, return_value_policy<copy_const_reference>())
         .def("fileFormat", &Item::fileFormat, return_value_policy<copy_const_reference>())
         .def("clearFileInformation", &Item::clearFileInformation)
@@ -201,7 +230,7 @@ void exportPyItems()
         .def("isBackgroundMode", &ScriptItem::isBackgroundMode)
         .def("isRunning", &ScriptItem::isRunning)
         .def("execute", &ScriptItem::execute)
-        .def("waitToFinish", &ScriptItem::waitToFinish, ScriptItem_waitToFinish())
+        .def("waitToFinish", ScriptItem_waitToFinish, ScriptItem_waitToFinish_overloads())
         .def("resultString", &ScriptItem::resultString)
         .def("sigScriptFinished", &ScriptItem::sigScriptFinished)
         .def("terminate", &ScriptItem::terminate)
@@ -0,0 +1,41 @@
+#version 330
+
+uniform sampler2D depthTexture;
+uniform mat4 inverseProjectionMatrix;
+uniform ivec2 size;
+
+layout(location = 0) out vec3 point;
+
+const float infinity = uintBitsToFloat(0x7f800000u);
+const float nan = uintBitsToFloat(0x7fc00000u);
+
+float multiplyInfinity(int v)
+{
+    if(v > 0){
+        return infinity;
+    } else if(v < 0){
+        return -infinity;
+    }
+    return nan;
+}
+
+/*
+  The points are written from the top row of the image, and the invalid points
+  are the same values as the ones given by the CPU conversion of GLVisionSimulatorItem.
+*/
+void main()
+{
+    int x = int(gl_FragCoord.x);
+    int y = size.y - 1 - int(gl_FragCoord.y);
+    float z = texelFetch(depthTexture, ivec2(x, y), 0).r;
+
+    if(z > 0.0 && z < 1.0){
+        vec4 n = vec4(2.0 * float(x) / float(size.x) - 1.0, 2.0 * float(y) / float(size.y) - 1.0, 2.0 * z - 1.0, 1.0);
+        vec4 o = inverseProjectionMatrix * n;
+        point = o.xyz / o.w;
+    } else if(z <= 0.0){
+        point = vec3(0.0);
+    } else {
+        point = vec3(multiplyInfinity(x - size.x / 2), multiplyInfinity(y - size.x / 2), -infinity);
+    }
+}
@@ -0,0 +1,8 @@
+#version 330
+
+// A triangle covering the whole viewport is generated without any vertex attributes
+void main()
+{
+    vec2 position = vec2(float(gl_VertexID & 1) * 4.0 - 1.0, float(gl_VertexID & 2) * 2.0 - 1.0);
+    gl_Position = vec4(position, 0.0, 1.0);
+}
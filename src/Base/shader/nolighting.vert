@@ -2,6 +2,7 @@
 
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
+layout (location = 2) in mat4 instanceMatrix; // See phongshadow.vert
 
 out vec3 colorV;
 
@@ -10,7 +11,7 @@ uniform float pointSize = 1.0;
 
 void main()
 {
-    gl_Position = MVP * vec4(vertexPosition, 1.0);
+    gl_Position = MVP * (instanceMatrix * vec4(vertexPosition, 1.0));
     gl_PointSize = pointSize;
     colorV = vertexColor;
 }
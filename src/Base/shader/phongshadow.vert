@@ -5,6 +5,13 @@
 layout (location = 0) in vec4 vertexPosition;
 layout (location = 1) in vec3 vertexNormal;
 
+/*
+  The model matrix of each instance for the instanced drawing, which is multiplied to the vertex
+  before the following matrices. The value of this attribute is the identity matrix when the
+  shape is not drawn as instances.
+*/
+layout (location = 2) in mat4 instanceMatrix;
+
 out vec3 position;
 out vec3 normal;
 out vec4 shadowCoords[MAX_NUM_SHADOWS];
@@ -33,12 +40,13 @@ uniform mat4 shadowMatrices[MAX_NUM_SHADOWS];
 
 void main()
 {
-    normal = normalize(normalMatrix * vertexNormal);
-    position = vec3(modelViewMatrix * vertexPosition);
+    vec4 p = instanceMatrix * vertexPosition;
+    normal = normalize(normalMatrix * (mat3(instanceMatrix) * vertexNormal));
+    position = vec3(modelViewMatrix * p);
 
     for(int i=0; i < numShadows; ++i){
-        shadowCoords[i] = shadowMatrices[i] * vertexPosition;
+        shadowCoords[i] = shadowMatrices[i] * p;
     }
     
-    gl_Position = MVP * vertexPosition;
+    gl_Position = MVP * p;
 }
@@ -0,0 +1,38 @@
+#version 330
+
+uniform sampler2D depthTexture;
+uniform ivec2 depthSize;
+uniform vec2 projectionScale;
+uniform vec2 inverseDepthCoefficients;
+uniform float firstYawAngle;
+uniform float yawStep;
+uniform float firstPitchAngle;
+uniform float pitchStep;
+uniform float depthError;
+
+layout(location = 0) out float range;
+
+const float infinity = uintBitsToFloat(0x7f800000u);
+
+/*
+  Each fragment is a beam of the range sensor. The column and the row are the indices of
+  the yaw and pitch angles, which are the same order as the range data of RangeSensor.
+  The camera looks at the -z direction and a positive yaw angle is on the left side.
+*/
+void main()
+{
+    float yawAngle = firstYawAngle + float(int(gl_FragCoord.x)) * yawStep;
+    float pitchAngle = firstPitchAngle + float(int(gl_FragCoord.y)) * pitchStep;
+
+    vec2 n = vec2(-projectionScale.x * tan(yawAngle), projectionScale.y * tan(pitchAngle));
+    ivec2 p = clamp(ivec2(floor((n * 0.5 + 0.5) * vec2(depthSize))), ivec2(0), depthSize - 1);
+    float z = texelFetch(depthTexture, p, 0).r;
+
+    if(z > 0.0 && z < 1.0){
+        float w = inverseDepthCoefficients.x * (2.0 * z - 1.0) + inverseDepthCoefficients.y;
+        float d = -1.0 / w + depthError;
+        range = abs((d / cos(pitchAngle)) / cos(yawAngle));
+    } else {
+        range = infinity;
+    }
+}
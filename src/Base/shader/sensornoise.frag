@@ -0,0 +1,85 @@
+#version 330
+
+uniform sampler2D colorTexture;
+uniform sampler2D depthTexture;
+uniform ivec2 origin;
+uniform ivec2 size;
+uniform vec4 projectionCoefficients; // P(0,0), P(1,1), P(2,2), P(2,3)
+uniform vec2 depthRange; // The near and far clip distances
+uniform vec2 lensDistortion;
+uniform float rangeNoise;
+uniform float rangeQuantizationStep;
+uniform float dropoutRate;
+uniform uint seed;
+
+layout(location = 0) out vec4 color;
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// A uniform random number in [0, 1)
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state >> 8) * (1.0 / 16777216.0);
+}
+
+/*
+  The rendered image is remapped by the lens distortion, and the noise is added to the distance
+  of each pixel along its ray. The depth of the pixel which has no distance is 1.0, which is the
+  same as the pixel where nothing is rendered.
+*/
+void main()
+{
+    vec2 f = gl_FragCoord.xy - vec2(origin);
+    ivec2 q = ivec2(f);
+    vec2 n = (f / vec2(size)) * 2.0 - 1.0;
+    vec2 m = n / projectionCoefficients.xy;
+    float r2 = dot(m, m);
+    vec2 s = n * (1.0 + lensDistortion.x * r2 + lensDistortion.y * r2 * r2);
+
+    if(any(greaterThan(abs(s), vec2(1.0)))){
+        color = vec4(0.0, 0.0, 0.0, 1.0);
+        gl_FragDepth = 1.0;
+        return;
+    }
+
+    ivec2 p = clamp(ivec2(floor((s * 0.5 + 0.5) * vec2(size))), ivec2(0), size - 1);
+    color = texelFetch(colorTexture, p, 0);
+    float z = texelFetch(depthTexture, p, 0).r;
+
+    if(z > 0.0 && z < 1.0){
+        uint state = hash(uint(q.x) + hash(uint(q.y) + hash(seed)));
+        if(random(state) < dropoutRate){
+            z = 1.0;
+        } else {
+            float ze = -projectionCoefficients.w / ((2.0 * z - 1.0) + projectionCoefficients.z);
+            float rayScale = sqrt(1.0 + r2);
+            float d = -ze * rayScale;
+            if(rangeNoise > 0.0){
+                // Box-Muller transform
+                float u1 = 1.0 - random(state);
+                float u2 = random(state);
+                d += rangeNoise * sqrt(-2.0 * log(u1)) * cos(6.28318530718 * u2);
+            }
+            if(rangeQuantizationStep > 0.0){
+                d = floor(d / rangeQuantizationStep + 0.5) * rangeQuantizationStep;
+            }
+            ze = -d / rayScale;
+            if(-ze <= depthRange.x || -ze >= depthRange.y){
+                z = 1.0;
+            } else {
+                z = ((projectionCoefficients.z * ze + projectionCoefficients.w) / -ze) * 0.5 + 0.5;
+            }
+        }
+    }
+
+    gl_FragDepth = z;
+}
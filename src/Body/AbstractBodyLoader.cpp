@@ -50,3 +50,9 @@ void AbstractBodyLoader::setDefaultCreaseAngle(double theta)
 {
 
 }
+
+
+bool AbstractBodyLoader::getSourceFiles(std::vector<std::string>& out_filenames) const
+{
+    return false;
+}
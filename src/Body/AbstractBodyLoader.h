@@ -7,6 +7,8 @@
 #define CNOID_BODY_ABSTRACT_BODY_LOADER_H
 
 #include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
 #include <iosfwd>
 #include "exportdecl.h"
 
@@ -32,6 +34,13 @@ public:
     virtual void setDefaultDivisionNumber(int n);
     virtual void setDefaultCreaseAngle(double theta);
     virtual bool load(Body* body, const std::string& filename) = 0;
+
+    /**
+       This function gives the files read by the last load() call.
+       @return false if the loader does not know the files. The body loaded by such a loader
+       is not stored in the cache of BodyLoader.
+    */
+    virtual bool getSourceFiles(std::vector<std::string>& out_filenames) const;
 };
 
 typedef boost::shared_ptr<AbstractBodyLoader> AbstractBodyLoaderPtr;
@@ -5,6 +5,8 @@
 
 #include "BasicSensorSimulationHelper.h"
 #include "Body.h"
+#include <cnoid/TaskScheduler>
+#include <boost/bind.hpp>
 #include <Eigen/StdVector>
 
 using namespace std;
@@ -41,11 +43,23 @@ public:
 
     BasicSensorSimulationHelperImpl(BasicSensorSimulationHelper* self);
     void initialize(Body* body, double timeStep, const Vector3& gravityAcceleration);
+    void calcGyroAndAccelerationSensorStates();
+    void notifyGyroAndAccelerationSensorStateChanges();
+    static void calcGyroAndAccelerationSensorStatesOfHelpers(
+        const std::vector<BasicSensorSimulationHelper*>* helpers, int begin, int end);
 };
 }
 
 namespace {
+
 typedef BasicSensorSimulationHelperImpl Impl;
+
+/*
+  The state of a sensor is computed with a few matrix-vector products, so the sensors are
+  only updated by separate tasks when each task has this number of sensors at least.
+*/
+const int MinNumSensorsPerTask = 64;
+
 }
     
 
@@ -165,42 +179,92 @@ void Impl::initialize(Body* body, double timeStep, const Vector3& gravityAcceler
 
 void BasicSensorSimulationHelper::updateGyroAndAccelerationSensors()
 {
-    for(size_t i=0; i < rateGyroSensors_.size(); ++i){
-        RateGyroSensor* gyro = rateGyroSensors_[i];
+    impl->calcGyroAndAccelerationSensorStates();
+    impl->notifyGyroAndAccelerationSensorStateChanges();
+}
+
+
+void BasicSensorSimulationHelper::updateGyroAndAccelerationSensors
+(const std::vector<BasicSensorSimulationHelper*>& helpers)
+{
+    const int n = helpers.size();
+    int numSensors = 0;
+    for(int i=0; i < n; ++i){
+        numSensors += helpers[i]->rateGyroSensors_.size() + helpers[i]->accelerationSensors_.size();
+    }
+    if(numSensors >= 2 * MinNumSensorsPerTask && n > 1){
+        const int grainSize = std::max(1, n * MinNumSensorsPerTask / numSensors);
+        TaskScheduler::instance()->parallelForRanges(
+            0, n, boost::bind(&Impl::calcGyroAndAccelerationSensorStatesOfHelpers, &helpers, _1, _2), grainSize);
+    } else {
+        for(int i=0; i < n; ++i){
+            helpers[i]->impl->calcGyroAndAccelerationSensorStates();
+        }
+    }
+    for(int i=0; i < n; ++i){
+        helpers[i]->impl->notifyGyroAndAccelerationSensorStateChanges();
+    }
+}
+
+
+void Impl::calcGyroAndAccelerationSensorStatesOfHelpers
+(const std::vector<BasicSensorSimulationHelper*>* helpers, int begin, int end)
+{
+    for(int i=begin; i < end; ++i){
+        (*helpers)[i]->impl->calcGyroAndAccelerationSensorStates();
+    }
+}
+
+
+void Impl::calcGyroAndAccelerationSensorStates()
+{
+    const DeviceList<RateGyroSensor>& rateGyroSensors = self->rateGyroSensors_;
+    for(size_t i=0; i < rateGyroSensors.size(); ++i){
+        RateGyroSensor* gyro = rateGyroSensors[i];
         const Link* link = gyro->link();
-        gyro->w() = gyro->R_local().transpose() * link->R().transpose() * link->w();
-        gyro->notifyStateChange();
+        // The vector is rotated twice to avoid the product of the rotation matrices
+        gyro->w().noalias() = gyro->R_local().transpose() * (link->R().transpose() * link->w());
     }
 
-    if(!impl->isOldAccelSensorCalcMode){
-        for(size_t i=0; i < accelerationSensors_.size(); ++i){
-            AccelerationSensor* sensor = accelerationSensors_[i];
+    const DeviceList<AccelerationSensor>& accelerationSensors = self->accelerationSensors_;
+    
+    if(!isOldAccelSensorCalcMode){
+        for(size_t i=0; i < accelerationSensors.size(); ++i){
+            AccelerationSensor* sensor = accelerationSensors[i];
             const Link* link = sensor->link();
-            sensor->dv() = sensor->R_local().transpose() * link->R().transpose() * (link->dv() - impl->g);
-            sensor->notifyStateChange();
+            sensor->dv().noalias() = sensor->R_local().transpose() * (link->R().transpose() * (link->dv() - g));
         }
 
-    } else if(!accelerationSensors_.empty()){
-        const Matrix2& A = impl->A;
-        const Vector2& B = impl->B;
+    } else {
+        for(size_t i=0; i < accelerationSensors.size(); ++i){
 
-        for(size_t i=0; i < accelerationSensors_.size(); ++i){
-
-            AccelerationSensor* sensor = accelerationSensors_[i];
+            AccelerationSensor* sensor = accelerationSensors[i];
             const Link* link = sensor->link();
             
             // kalman filtering
-            Impl::KFState& s = impl->kfStates[i];
+            KFState& s = kfStates[i];
             const Vector3 o_Vgsens = link->R() * (link->R().transpose() * link->w()).cross(sensor->p_local()) + link->v();
             for(int i=0; i < 3; ++i){
                 s.x[i] = A * s.x[i] + o_Vgsens(i) * B;
             }
             
             Vector3 o_Agsens(s.x[0](1), s.x[1](1), s.x[2](1));
-            o_Agsens -= impl->g;
+            o_Agsens -= g;
             
-            sensor->dv() = sensor->R_local().transpose() * link->R().transpose() * o_Agsens;
-            sensor->notifyStateChange();
+            sensor->dv().noalias() = sensor->R_local().transpose() * (link->R().transpose() * o_Agsens);
         }
     }
 }
+
+
+void Impl::notifyGyroAndAccelerationSensorStateChanges()
+{
+    const DeviceList<RateGyroSensor>& rateGyroSensors = self->rateGyroSensors_;
+    for(size_t i=0; i < rateGyroSensors.size(); ++i){
+        rateGyroSensors[i]->notifyStateChange();
+    }
+    const DeviceList<AccelerationSensor>& accelerationSensors = self->accelerationSensors_;
+    for(size_t i=0; i < accelerationSensors.size(); ++i){
+        accelerationSensors[i]->notifyStateChange();
+    }
+}
@@ -10,6 +10,7 @@
 #include "ForceSensor.h"
 #include "RateGyroSensor.h"
 #include "AccelerationSensor.h"
+#include <vector>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -36,6 +37,13 @@ public:
         
     void updateGyroAndAccelerationSensors();
 
+    /**
+       Updates the gyro and acceleration sensors of the helpers together. The states of the sensors
+       are computed in parallel when there are many sensors, and then the state changes are notified
+       in the calling thread for each helper in order.
+    */
+    static void updateGyroAndAccelerationSensors(const std::vector<BasicSensorSimulationHelper*>& helpers);
+
 private:
     BasicSensorSimulationHelperImpl* impl;
     bool isActive_;
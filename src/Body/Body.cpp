@@ -8,6 +8,7 @@
 #include <cnoid/SceneGraph>
 #include <cnoid/EigenUtil>
 #include <cnoid/ValueTree>
+#include <algorithm>
 
 using namespace std;
 using namespace boost;
@@ -40,6 +41,8 @@ class BodyImpl
 public:
     NameToLinkMap nameToLinkMap;
     DeviceNameMap deviceNameMap;
+    std::vector<unsigned char> deviceStateChangeFlags;
+    Signal<void(const std::vector<unsigned char>& flags)> sigDeviceStatesChanged;
     CacheMap cacheMap;
     MappingPtr info;
     Vector3 centerOfMass;
@@ -171,6 +174,9 @@ void Body::cloneShapes(SgCloneMap& cloneMap)
 Body::~Body()
 {
     setRootLink(0);
+
+    // The devices may be referred to after the body is deleted
+    clearDevices();
     
     if(impl->customizerHandle){
         impl->customizerInterface->destroy(impl->customizerHandle);
@@ -310,6 +316,8 @@ void Body::addDevice(Device* device)
 {
     device->setIndex(devices_.size());
     devices_.push_back(device);
+    impl->deviceStateChangeFlags.push_back(0);
+    device->setStateChangeFlags(&impl->deviceStateChangeFlags);
     if(!device->name().empty()){
         impl->deviceNameMap[device->name()] = device;
     }
@@ -318,8 +326,40 @@ void Body::addDevice(Device* device)
 
 void Body::clearDevices()
 {
+    for(size_t i=0; i < devices_.size(); ++i){
+        devices_[i]->setStateChangeFlags(0);
+    }
     devices_.clear();
     impl->deviceNameMap.clear();
+    impl->deviceStateChangeFlags.clear();
+}
+
+
+const std::vector<unsigned char>& Body::deviceStateChangeFlags() const
+{
+    return impl->deviceStateChangeFlags;
+}
+
+
+void Body::clearDeviceStateChangeFlag(int deviceIndex)
+{
+    impl->deviceStateChangeFlags[deviceIndex] = 0;
+}
+
+
+void Body::notifyDeviceStateChanges()
+{
+    vector<unsigned char>& flags = impl->deviceStateChangeFlags;
+    if(std::find(flags.begin(), flags.end(), 1) != flags.end()){
+        impl->sigDeviceStatesChanged(flags);
+        std::fill(flags.begin(), flags.end(), 0);
+    }
+}
+
+
+SignalProxy<void(const std::vector<unsigned char>& flags)> Body::sigDeviceStatesChanged()
+{
+    return impl->sigDeviceStatesChanged;
 }
 
 
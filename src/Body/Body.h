@@ -159,6 +159,21 @@ public:
     void addDevice(Device* device);
     void initializeDeviceStates();
     void clearDevices();
+
+    /**
+       The flag of a device is set when Device::notifyStateChange() of the device is called,
+       and the flags are cleared by notifyDeviceStateChanges().
+    */
+    const std::vector<unsigned char>& deviceStateChangeFlags() const;
+    void clearDeviceStateChangeFlag(int deviceIndex);
+
+    /**
+       Emits sigDeviceStatesChanged() with the flags if any of them is set, and clears the flags.
+       The simulator calls this once per step so that the objects interested in the changes of
+       many devices do not have to connect to the signal of each device.
+    */
+    void notifyDeviceStateChanges();
+    SignalProxy<void(const std::vector<unsigned char>& flags)> sigDeviceStatesChanged();
         
     /**
        This function returns true when the whole body is a static, fixed object like a floor.
@@ -183,6 +198,14 @@ public:
     void calcForwardKinematics(bool calcVelocity = false, bool calcAcceleration = false) {
         linkTraverse_.calcForwardKinematics(calcVelocity, calcAcceleration);
     }
+
+    /**
+       Calculates the link positions that are affected by the changes since the previous call.
+       \see LinkTraverse::calcIncrementalForwardKinematics()
+    */
+    int calcIncrementalForwardKinematics() {
+        return linkTraverse_.calcIncrementalForwardKinematics();
+    }
         
     void clearExternalForces();
 
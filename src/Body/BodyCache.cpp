@@ -0,0 +1,1287 @@
+/**
+   \file
+*/
+
+#include "BodyCache.h"
+#include "Body.h"
+#include "Link.h"
+#include "ForceSensor.h"
+#include "RateGyroSensor.h"
+#include "AccelerationSensor.h"
+#include "Camera.h"
+#include "RangeCamera.h"
+#include "RangeSensor.h"
+#include "PointLight.h"
+#include "SpotLight.h"
+#include <cnoid/SceneDrawables>
+#include <cnoid/SceneLights>
+#include <cnoid/YAMLReader>
+#include <cnoid/YAMLWriter>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <typeinfo>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+using namespace cnoid;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+typedef boost::int32_t int32;
+typedef boost::uint32_t uint32;
+typedef boost::uint64_t uint64;
+
+const char bodyCacheMagic[8] = { 'C', 'N', 'O', 'I', 'D', 'B', 'D', 'C' };
+const uint32 bodyCacheVersion = 1;
+
+struct BrokenCacheException { };
+struct UnsupportedObjectException { };
+
+enum ObjectTypeID {
+    SG_NODE = 1,
+    SG_GROUP,
+    SG_INVARIANT_GROUP,
+    SG_UNPICKABLE_GROUP,
+    SG_POS_TRANSFORM,
+    SG_SCALE_TRANSFORM,
+    SG_SWITCH,
+    SG_SHAPE,
+    SG_POINT_SET,
+    SG_LINE_SET,
+    SG_DIRECTIONAL_LIGHT,
+    SG_POINT_LIGHT,
+    SG_SPOT_LIGHT,
+    SG_MESH,
+    SG_MATERIAL,
+    SG_TEXTURE,
+    SG_TEXTURE_TRANSFORM,
+    SG_IMAGE,
+    SG_VECTOR3F_ARRAY,
+    SG_TEX_COORD_ARRAY
+};
+
+const uint64 initialHash = 14695981039346656037ULL;
+
+uint64 addHash(uint64 hash, const void* data, size_t size)
+{
+    // FNV-1a
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(size_t i=0; i < size; ++i){
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool getFileHash(const string& filename, uint64& out_size, uint64& out_hash)
+{
+    ifstream ifs(filename.c_str(), ios::in | ios::binary);
+    if(!ifs){
+        return false;
+    }
+    uint64 size = 0;
+    uint64 hash = initialHash;
+    vector<char> buf(65536);
+    while(ifs){
+        ifs.read(&buf[0], buf.size());
+        const streamsize n = ifs.gcount();
+        if(n > 0){
+            hash = addHash(hash, &buf[0], n);
+            size += n;
+        }
+    }
+    if(ifs.bad()){
+        return false;
+    }
+    out_size = size;
+    out_hash = hash;
+    return true;
+}
+
+
+/**
+   The objects shared in the scene graph are written once and referred by their indices
+   after that so that the restored graph has the same structure.
+*/
+class CacheWriter
+{
+public:
+    vector<char> data;
+    map<const SgObject*, int> objectIndices;
+
+    void write(const void* p, size_t size){
+        const char* c = static_cast<const char*>(p);
+        data.insert(data.end(), c, c + size);
+    }
+
+    template<class T> void write(const T& value){
+        write(&value, sizeof(T));
+    }
+
+    void writeInt(int value){
+        write<int32>(value);
+    }
+
+    void writeBool(bool on){
+        write<char>(on ? 1 : 0);
+    }
+
+    void writeString(const string& str){
+        writeInt(str.size());
+        write(str.data(), str.size());
+    }
+
+    template<class Derived> void writeMatrix(const Eigen::MatrixBase<Derived>& m){
+        for(int i=0; i < m.rows(); ++i){
+            for(int j=0; j < m.cols(); ++j){
+                write<typename Derived::Scalar>(m(i, j));
+            }
+        }
+    }
+
+    void writeIndexArray(const SgIndexArray& indices){
+        writeInt(indices.size());
+        if(!indices.empty()){
+            write(&indices.front(), indices.size() * sizeof(int));
+        }
+    }
+
+    template<class TArray> void writeVectorArray(const TArray& array){
+        writeInt(array.size());
+        if(!array.empty()){
+            write(array.data(), array.size() * sizeof(typename TArray::value_type));
+        }
+    }
+
+    void writeObject(const SgObject* object);
+    void writeGroup(const SgGroup* group);
+    void writeLight(const SgLight* light);
+    void writePlot(const SgPlot* plot);
+    void writeMesh(const SgMesh* mesh);
+    void writeBody(Body* body);
+    void writeLinkInfo(const Link* link);
+    void writeDevice(Device* device);
+};
+
+
+class CacheReader
+{
+public:
+    const char* pos;
+    const char* end;
+    vector<SgObjectPtr> objects;
+
+    CacheReader(const vector<char>& data){
+        pos = data.empty() ? 0 : &data.front();
+        end = pos + data.size();
+    }
+
+    void checkSize(size_t size){
+        if(static_cast<size_t>(end - pos) < size){
+            throw BrokenCacheException();
+        }
+    }
+
+    void read(void* p, size_t size){
+        checkSize(size);
+        memcpy(p, pos, size);
+        pos += size;
+    }
+
+    template<class T> T read(){
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+
+    int readInt(){
+        return read<int32>();
+    }
+
+    int readSize(size_t elementSize){
+        const int size = readInt();
+        if(size < 0){
+            throw BrokenCacheException();
+        }
+        checkSize(size * elementSize);
+        return size;
+    }
+
+    bool readBool(){
+        return read<char>();
+    }
+
+    double readDouble(){
+        return read<double>();
+    }
+
+    float readFloat(){
+        return read<float>();
+    }
+
+    string readString(){
+        const int size = readSize(1);
+        string str(pos, size);
+        pos += size;
+        return str;
+    }
+
+    template<class Derived> void readMatrix(Eigen::MatrixBase<Derived>& m){
+        for(int i=0; i < m.rows(); ++i){
+            for(int j=0; j < m.cols(); ++j){
+                m(i, j) = read<typename Derived::Scalar>();
+            }
+        }
+    }
+
+    void readIndexArray(SgIndexArray& indices){
+        const int size = readSize(sizeof(int));
+        indices.resize(size);
+        if(size > 0){
+            read(&indices.front(), size * sizeof(int));
+        }
+    }
+
+    template<class TArray> void readVectorArray(TArray& array){
+        const int size = readSize(sizeof(typename TArray::value_type));
+        array.resize(size);
+        if(size > 0){
+            read(array.data(), size * sizeof(typename TArray::value_type));
+        }
+    }
+
+    SgObject* readObject();
+
+    template<class T> T* readObject(){
+        SgObject* object = readObject();
+        if(!object){
+            return 0;
+        }
+        T* typed = dynamic_cast<T*>(object);
+        if(!typed){
+            throw BrokenCacheException();
+        }
+        return typed;
+    }
+
+    SgObject* createObject(int typeId);
+    void readGroup(SgGroup* group);
+    void readLight(SgLight* light);
+    void readPlot(SgPlot* plot);
+    void readMesh(SgMesh* mesh);
+};
+
+
+void CacheWriter::writeObject(const SgObject* object)
+{
+    if(!object){
+        writeInt(-1);
+        return;
+    }
+    map<const SgObject*, int>::iterator p = objectIndices.find(object);
+    if(p != objectIndices.end()){
+        writeInt(p->second);
+        return;
+    }
+    const int index = objectIndices.size();
+    objectIndices[object] = index;
+    writeInt(index);
+
+    const type_info& type = typeid(*object);
+
+    if(type == typeid(SgNode)){
+        writeInt(SG_NODE);
+        writeString(object->name());
+
+    } else if(type == typeid(SgGroup)){
+        writeInt(SG_GROUP);
+        writeString(object->name());
+        writeGroup(static_cast<const SgGroup*>(object));
+
+    } else if(type == typeid(SgInvariantGroup)){
+        writeInt(SG_INVARIANT_GROUP);
+        writeString(object->name());
+        writeGroup(static_cast<const SgGroup*>(object));
+
+    } else if(type == typeid(SgUnpickableGroup)){
+        writeInt(SG_UNPICKABLE_GROUP);
+        writeString(object->name());
+        writeGroup(static_cast<const SgGroup*>(object));
+
+    } else if(type == typeid(SgPosTransform)){
+        const SgPosTransform* transform = static_cast<const SgPosTransform*>(object);
+        writeInt(SG_POS_TRANSFORM);
+        writeString(object->name());
+        writeMatrix(transform->T().matrix());
+        writeGroup(transform);
+
+    } else if(type == typeid(SgScaleTransform)){
+        const SgScaleTransform* transform = static_cast<const SgScaleTransform*>(object);
+        writeInt(SG_SCALE_TRANSFORM);
+        writeString(object->name());
+        writeMatrix(transform->scale());
+        writeGroup(transform);
+
+    } else if(type == typeid(SgSwitch)){
+        const SgSwitch* switchNode = static_cast<const SgSwitch*>(object);
+        writeInt(SG_SWITCH);
+        writeString(object->name());
+        writeBool(switchNode->isTurnedOn());
+        writeGroup(switchNode);
+
+    } else if(type == typeid(SgShape)){
+        const SgShape* shape = static_cast<const SgShape*>(object);
+        writeInt(SG_SHAPE);
+        writeString(object->name());
+        writeObject(shape->mesh());
+        writeObject(shape->material());
+        writeObject(shape->texture());
+
+    } else if(type == typeid(SgPointSet)){
+        const SgPointSet* pointSet = static_cast<const SgPointSet*>(object);
+        writeInt(SG_POINT_SET);
+        writeString(object->name());
+        writePlot(pointSet);
+        write<double>(pointSet->pointSize());
+
+    } else if(type == typeid(SgLineSet)){
+        const SgLineSet* lineSet = static_cast<const SgLineSet*>(object);
+        writeInt(SG_LINE_SET);
+        writeString(object->name());
+        writePlot(lineSet);
+        writeIndexArray(lineSet->lineVertices());
+        write<float>(lineSet->lineWidth());
+
+    } else if(type == typeid(SgDirectionalLight)){
+        const SgDirectionalLight* light = static_cast<const SgDirectionalLight*>(object);
+        writeInt(SG_DIRECTIONAL_LIGHT);
+        writeString(object->name());
+        writeLight(light);
+        writeMatrix(light->direction());
+
+    } else if(type == typeid(SgPointLight) || type == typeid(SgSpotLight)){
+        const SgPointLight* light = static_cast<const SgPointLight*>(object);
+        const bool isSpotLight = (type == typeid(SgSpotLight));
+        writeInt(isSpotLight ? SG_SPOT_LIGHT : SG_POINT_LIGHT);
+        writeString(object->name());
+        writeLight(light);
+        write<float>(light->constantAttenuation());
+        write<float>(light->linearAttenuation());
+        write<float>(light->quadraticAttenuation());
+        if(isSpotLight){
+            const SgSpotLight* spotLight = static_cast<const SgSpotLight*>(light);
+            writeMatrix(spotLight->direction());
+            write<float>(spotLight->beamWidth());
+            write<float>(spotLight->cutOffAngle());
+            write<float>(spotLight->cutOffExponent());
+        }
+
+    } else if(type == typeid(SgMesh)){
+        writeInt(SG_MESH);
+        writeString(object->name());
+        writeMesh(static_cast<const SgMesh*>(object));
+
+    } else if(type == typeid(SgMaterial)){
+        const SgMaterial* material = static_cast<const SgMaterial*>(object);
+        writeInt(SG_MATERIAL);
+        writeString(object->name());
+        writeMatrix(material->diffuseColor());
+        writeMatrix(material->emissiveColor());
+        writeMatrix(material->specularColor());
+        write<float>(material->ambientIntensity());
+        write<float>(material->transparency());
+        write<float>(material->shininess());
+
+    } else if(type == typeid(SgTexture)){
+        const SgTexture* texture = static_cast<const SgTexture*>(object);
+        writeInt(SG_TEXTURE);
+        writeString(object->name());
+        writeObject(texture->image());
+        writeObject(texture->textureTransform());
+        writeBool(texture->repeatS());
+        writeBool(texture->repeatT());
+
+    } else if(type == typeid(SgTextureTransform)){
+        const SgTextureTransform* transform = static_cast<const SgTextureTransform*>(object);
+        writeInt(SG_TEXTURE_TRANSFORM);
+        writeString(object->name());
+        writeMatrix(transform->center());
+        writeMatrix(transform->scale());
+        writeMatrix(transform->translation());
+        write<double>(transform->rotation());
+
+    } else if(type == typeid(SgImage)){
+        const SgImage* image = static_cast<const SgImage*>(object);
+        writeInt(SG_IMAGE);
+        writeString(object->name());
+        writeInt(image->width());
+        writeInt(image->height());
+        writeInt(image->numComponents());
+        if(!image->empty()){
+            write(image->pixels(), image->width() * image->height() * image->numComponents());
+        }
+
+    } else if(type == typeid(SgVertexArray)){
+        writeInt(SG_VECTOR3F_ARRAY);
+        writeString(object->name());
+        writeVectorArray(*static_cast<const SgVertexArray*>(object));
+
+    } else if(type == typeid(SgTexCoordArray)){
+        writeInt(SG_TEX_COORD_ARRAY);
+        writeString(object->name());
+        writeVectorArray(*static_cast<const SgTexCoordArray*>(object));
+
+    } else {
+        throw UnsupportedObjectException();
+    }
+}
+
+
+void CacheWriter::writeGroup(const SgGroup* group)
+{
+    writeInt(group->numChildren());
+    for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
+        writeObject(*p);
+    }
+}
+
+
+void CacheWriter::writeLight(const SgLight* light)
+{
+    writeBool(light->on());
+    writeMatrix(light->color());
+    write<float>(light->intensity());
+    write<float>(light->ambientIntensity());
+}
+
+
+void CacheWriter::writePlot(const SgPlot* plot)
+{
+    writeObject(plot->vertices());
+    writeObject(plot->normals());
+    writeIndexArray(plot->normalIndices());
+    writeObject(plot->colors());
+    writeIndexArray(plot->colorIndices());
+    writeObject(plot->material());
+}
+
+
+void CacheWriter::writeMesh(const SgMesh* mesh)
+{
+    writeObject(mesh->vertices());
+    writeObject(mesh->normals());
+    writeIndexArray(mesh->normalIndices());
+    writeObject(mesh->colors());
+    writeIndexArray(mesh->colorIndices());
+    writeObject(mesh->texCoords());
+    writeIndexArray(mesh->texCoordIndices());
+    writeBool(mesh->isSolid());
+    writeIndexArray(mesh->triangleVertices());
+
+    const int primitiveType = mesh->primitiveType();
+    writeInt(primitiveType);
+    switch(primitiveType){
+    case SgMesh::BOX:
+        writeMatrix(mesh->primitive<SgMesh::Box>().size);
+        break;
+    case SgMesh::SPHERE:
+        write<double>(mesh->primitive<SgMesh::Sphere>().radius);
+        break;
+    case SgMesh::CYLINDER:
+    {
+        const SgMesh::Cylinder& cylinder = mesh->primitive<SgMesh::Cylinder>();
+        write<double>(cylinder.radius);
+        write<double>(cylinder.height);
+        writeBool(cylinder.bottom);
+        writeBool(cylinder.side);
+        writeBool(cylinder.top);
+        break;
+    }
+    case SgMesh::CONE:
+    {
+        const SgMesh::Cone& cone = mesh->primitive<SgMesh::Cone>();
+        write<double>(cone.radius);
+        write<double>(cone.height);
+        writeBool(cone.bottom);
+        writeBool(cone.side);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+
+SgObject* CacheReader::readObject()
+{
+    const int index = readInt();
+    if(index < 0){
+        return 0;
+    }
+    if(index < (int)objects.size()){
+        return objects[index];
+    }
+    if(index != (int)objects.size()){
+        throw BrokenCacheException();
+    }
+
+    const int typeId = readInt();
+    SgObject* object = createObject(typeId);
+    objects.push_back(object);
+    object->setName(readString());
+
+    switch(typeId){
+
+    case SG_NODE:
+        break;
+
+    case SG_GROUP:
+    case SG_INVARIANT_GROUP:
+    case SG_UNPICKABLE_GROUP:
+        readGroup(static_cast<SgGroup*>(object));
+        break;
+
+    case SG_POS_TRANSFORM:
+    {
+        SgPosTransform* transform = static_cast<SgPosTransform*>(object);
+        readMatrix(transform->T().matrix());
+        readGroup(transform);
+        break;
+    }
+    case SG_SCALE_TRANSFORM:
+    {
+        SgScaleTransform* transform = static_cast<SgScaleTransform*>(object);
+        readMatrix(transform->scale());
+        readGroup(transform);
+        break;
+    }
+    case SG_SWITCH:
+    {
+        SgSwitch* switchNode = static_cast<SgSwitch*>(object);
+        switchNode->setTurnedOn(readBool());
+        readGroup(switchNode);
+        break;
+    }
+    case SG_SHAPE:
+    {
+        SgShape* shape = static_cast<SgShape*>(object);
+        shape->setMesh(readObject<SgMesh>());
+        shape->setMaterial(readObject<SgMaterial>());
+        shape->setTexture(readObject<SgTexture>());
+        break;
+    }
+    case SG_POINT_SET:
+    {
+        SgPointSet* pointSet = static_cast<SgPointSet*>(object);
+        readPlot(pointSet);
+        pointSet->setPointSize(readDouble());
+        break;
+    }
+    case SG_LINE_SET:
+    {
+        SgLineSet* lineSet = static_cast<SgLineSet*>(object);
+        readPlot(lineSet);
+        readIndexArray(lineSet->lineVertices());
+        lineSet->setLineWidth(readFloat());
+        break;
+    }
+    case SG_DIRECTIONAL_LIGHT:
+    {
+        SgDirectionalLight* light = static_cast<SgDirectionalLight*>(object);
+        readLight(light);
+        Vector3 direction;
+        readMatrix(direction);
+        light->setDirection(direction);
+        break;
+    }
+    case SG_POINT_LIGHT:
+    case SG_SPOT_LIGHT:
+    {
+        SgPointLight* light = static_cast<SgPointLight*>(object);
+        readLight(light);
+        light->setConstantAttenuation(readFloat());
+        light->setLinearAttenuation(readFloat());
+        light->setQuadraticAttenuation(readFloat());
+        if(typeId == SG_SPOT_LIGHT){
+            SgSpotLight* spotLight = static_cast<SgSpotLight*>(light);
+            Vector3 direction;
+            readMatrix(direction);
+            spotLight->setDirection(direction);
+            spotLight->setBeamWidth(readFloat());
+            spotLight->setCutOffAngle(readFloat());
+            spotLight->setCutOffExponent(readFloat());
+        }
+        break;
+    }
+    case SG_MESH:
+        readMesh(static_cast<SgMesh*>(object));
+        break;
+
+    case SG_MATERIAL:
+    {
+        SgMaterial* material = static_cast<SgMaterial*>(object);
+        Vector3f color;
+        readMatrix(color);
+        material->setDiffuseColor(color);
+        readMatrix(color);
+        material->setEmissiveColor(color);
+        readMatrix(color);
+        material->setSpecularColor(color);
+        material->setAmbientIntensity(readFloat());
+        material->setTransparency(readFloat());
+        material->setShininess(readFloat());
+        break;
+    }
+    case SG_TEXTURE:
+    {
+        SgTexture* texture = static_cast<SgTexture*>(object);
+        texture->setImage(readObject<SgImage>());
+        texture->setTextureTransform(readObject<SgTextureTransform>());
+        const bool repeatS = readBool();
+        const bool repeatT = readBool();
+        texture->setRepeat(repeatS, repeatT);
+        break;
+    }
+    case SG_TEXTURE_TRANSFORM:
+    {
+        SgTextureTransform* transform = static_cast<SgTextureTransform*>(object);
+        Vector2 v;
+        readMatrix(v);
+        transform->setCenter(v);
+        readMatrix(v);
+        transform->setScale(v);
+        readMatrix(v);
+        transform->setTranslation(v);
+        transform->setRotation(readDouble());
+        break;
+    }
+    case SG_IMAGE:
+    {
+        SgImage* image = static_cast<SgImage*>(object);
+        const int width = readInt();
+        const int height = readInt();
+        const int numComponents = readInt();
+        if(width < 0 || height < 0 || numComponents < 0){
+            throw BrokenCacheException();
+        }
+        const size_t size = (size_t)width * height * numComponents;
+        if(size > 0){
+            checkSize(size);
+            image->setSize(width, height, numComponents);
+            read(image->pixels(), size);
+        }
+        break;
+    }
+    case SG_VECTOR3F_ARRAY:
+        readVectorArray(*static_cast<SgVertexArray*>(object));
+        break;
+
+    case SG_TEX_COORD_ARRAY:
+        readVectorArray(*static_cast<SgTexCoordArray*>(object));
+        break;
+    }
+
+    return object;
+}
+
+
+SgObject* CacheReader::createObject(int typeId)
+{
+    switch(typeId){
+    case SG_NODE: return new SgNode;
+    case SG_GROUP: return new SgGroup;
+    case SG_INVARIANT_GROUP: return new SgInvariantGroup;
+    case SG_UNPICKABLE_GROUP: return new SgUnpickableGroup;
+    case SG_POS_TRANSFORM: return new SgPosTransform;
+    case SG_SCALE_TRANSFORM: return new SgScaleTransform;
+    case SG_SWITCH: return new SgSwitch;
+    case SG_SHAPE: return new SgShape;
+    case SG_POINT_SET: return new SgPointSet;
+    case SG_LINE_SET: return new SgLineSet;
+    case SG_DIRECTIONAL_LIGHT: return new SgDirectionalLight;
+    case SG_POINT_LIGHT: return new SgPointLight;
+    case SG_SPOT_LIGHT: return new SgSpotLight;
+    case SG_MESH: return new SgMesh;
+    case SG_MATERIAL: return new SgMaterial;
+    case SG_TEXTURE: return new SgTexture;
+    case SG_TEXTURE_TRANSFORM: return new SgTextureTransform;
+    case SG_IMAGE: return new SgImage;
+    case SG_VECTOR3F_ARRAY: return new SgVertexArray;
+    case SG_TEX_COORD_ARRAY: return new SgTexCoordArray;
+    default:
+        throw BrokenCacheException();
+    }
+}
+
+
+void CacheReader::readGroup(SgGroup* group)
+{
+    const int numChildren = readSize(sizeof(int32));
+    for(int i=0; i < numChildren; ++i){
+        SgNode* child = readObject<SgNode>();
+        if(!child){
+            throw BrokenCacheException();
+        }
+        group->addChild(child);
+    }
+}
+
+
+void CacheReader::readLight(SgLight* light)
+{
+    light->on(readBool());
+    Vector3f color;
+    readMatrix(color);
+    light->setColor(color);
+    light->setIntensity(readFloat());
+    light->setAmbientIntensity(readFloat());
+}
+
+
+void CacheReader::readPlot(SgPlot* plot)
+{
+    plot->setVertices(readObject<SgVertexArray>());
+    plot->setNormals(readObject<SgNormalArray>());
+    readIndexArray(plot->normalIndices());
+    plot->setColors(readObject<SgColorArray>());
+    readIndexArray(plot->colorIndices());
+    plot->setMaterial(readObject<SgMaterial>());
+    plot->updateBoundingBox();
+}
+
+
+void CacheReader::readMesh(SgMesh* mesh)
+{
+    mesh->setVertices(readObject<SgVertexArray>());
+    mesh->setNormals(readObject<SgNormalArray>());
+    readIndexArray(mesh->normalIndices());
+    mesh->setColors(readObject<SgColorArray>());
+    readIndexArray(mesh->colorIndices());
+    mesh->setTexCoords(readObject<SgTexCoordArray>());
+    readIndexArray(mesh->texCoordIndices());
+    mesh->setSolid(readBool());
+    readIndexArray(mesh->triangleVertices());
+
+    const int numVertices = mesh->vertices() ? mesh->vertices()->size() : 0;
+    const SgIndexArray& triangles = mesh->triangleVertices();
+    for(size_t i=0; i < triangles.size(); ++i){
+        if(triangles[i] < 0 || triangles[i] >= numVertices){
+            throw BrokenCacheException();
+        }
+    }
+
+    switch(readInt()){
+    case SgMesh::MESH:
+        break;
+    case SgMesh::BOX:
+    {
+        Vector3 size;
+        readMatrix(size);
+        mesh->setPrimitive(SgMesh::Box(size));
+        break;
+    }
+    case SgMesh::SPHERE:
+        mesh->setPrimitive(SgMesh::Sphere(readDouble()));
+        break;
+    case SgMesh::CYLINDER:
+    {
+        SgMesh::Cylinder cylinder;
+        cylinder.radius = readDouble();
+        cylinder.height = readDouble();
+        cylinder.bottom = readBool();
+        cylinder.side = readBool();
+        cylinder.top = readBool();
+        mesh->setPrimitive(cylinder);
+        break;
+    }
+    case SgMesh::CONE:
+    {
+        SgMesh::Cone cone;
+        cone.radius = readDouble();
+        cone.height = readDouble();
+        cone.bottom = readBool();
+        cone.side = readBool();
+        mesh->setPrimitive(cone);
+        break;
+    }
+    default:
+        throw BrokenCacheException();
+    }
+
+    mesh->updateBoundingBox();
+}
+
+
+Device* createDevice(const string& typeName)
+{
+    if(typeName == "ForceSensor"){
+        return new ForceSensor;
+    } else if(typeName == "RateGyroSensor"){
+        return new RateGyroSensor;
+    } else if(typeName == "AccelerationSensor"){
+        return new AccelerationSensor;
+    } else if(typeName == "Camera"){
+        return new Camera;
+    } else if(typeName == "RangeCamera"){
+        return new RangeCamera;
+    } else if(typeName == "RangeSensor"){
+        return new RangeSensor;
+    } else if(typeName == "PointLight"){
+        return new PointLight;
+    } else if(typeName == "SpotLight"){
+        return new SpotLight;
+    }
+    return 0;
+}
+
+
+/**
+   The specifications of the devices which are not included in their states
+*/
+void writeDeviceSpec(CacheWriter& w, Device* device)
+{
+    if(ForceSensor* sensor = dynamic_cast<ForceSensor*>(device)){
+        w.writeMatrix(sensor->F_max());
+    } else if(RateGyroSensor* sensor = dynamic_cast<RateGyroSensor*>(device)){
+        w.writeMatrix(sensor->w_max());
+    } else if(AccelerationSensor* sensor = dynamic_cast<AccelerationSensor*>(device)){
+        w.writeMatrix(sensor->dv_max());
+    } else if(Camera* camera = dynamic_cast<Camera*>(device)){
+        w.writeInt(camera->imageType());
+        w.write<double>(camera->lensDistortionK1());
+        w.write<double>(camera->lensDistortionK2());
+        if(RangeCamera* rangeCamera = dynamic_cast<RangeCamera*>(camera)){
+            w.writeBool(rangeCamera->isOrganized());
+            w.writeInt(rangeCamera->pointDataFormat());
+            w.write<double>(rangeCamera->depthImageStep());
+            w.write<double>(rangeCamera->rangeNoise());
+            w.write<double>(rangeCamera->rangeQuantizationStep());
+            w.write<double>(rangeCamera->dropoutRate());
+        }
+    } else if(RangeSensor* sensor = dynamic_cast<RangeSensor*>(device)){
+        w.write<double>(sensor->rangeNoise());
+        w.write<double>(sensor->rangeQuantizationStep());
+        w.write<double>(sensor->dropoutRate());
+        w.writeInt(sensor->rangeDataFormat());
+        w.write<double>(sensor->fixedPointRangeStep());
+    } else if(SpotLight* light = dynamic_cast<SpotLight*>(device)){
+        w.write<float>(light->cutOffExponent());
+    }
+}
+
+
+void readDeviceSpec(CacheReader& r, Device* device)
+{
+    if(ForceSensor* sensor = dynamic_cast<ForceSensor*>(device)){
+        r.readMatrix(sensor->F_max());
+    } else if(RateGyroSensor* sensor = dynamic_cast<RateGyroSensor*>(device)){
+        r.readMatrix(sensor->w_max());
+    } else if(AccelerationSensor* sensor = dynamic_cast<AccelerationSensor*>(device)){
+        r.readMatrix(sensor->dv_max());
+    } else if(Camera* camera = dynamic_cast<Camera*>(device)){
+        const int imageType = r.readInt();
+        if(imageType < Camera::NO_IMAGE || imageType > Camera::GRAYSCALE_IMAGE){
+            throw BrokenCacheException();
+        }
+        camera->setImageType(static_cast<Camera::ImageType>(imageType));
+        const double k1 = r.readDouble();
+        const double k2 = r.readDouble();
+        camera->setLensDistortion(k1, k2);
+        if(RangeCamera* rangeCamera = dynamic_cast<RangeCamera*>(camera)){
+            rangeCamera->setOrganized(r.readBool());
+            const int format = r.readInt();
+            if(format < RangeCamera::POINT_DATA || format > RangeCamera::DEPTH_IMAGE){
+                throw BrokenCacheException();
+            }
+            rangeCamera->setPointDataFormat(static_cast<RangeCamera::PointDataFormat>(format));
+            rangeCamera->setDepthImageStep(r.readDouble());
+            rangeCamera->setRangeNoise(r.readDouble());
+            rangeCamera->setRangeQuantizationStep(r.readDouble());
+            rangeCamera->setDropoutRate(r.readDouble());
+        }
+    } else if(RangeSensor* sensor = dynamic_cast<RangeSensor*>(device)){
+        sensor->setRangeNoise(r.readDouble());
+        sensor->setRangeQuantizationStep(r.readDouble());
+        sensor->setDropoutRate(r.readDouble());
+        const int format = r.readInt();
+        if(format < RangeSensor::DOUBLE_RANGE_DATA || format > RangeSensor::FIXED_POINT_RANGE_DATA){
+            throw BrokenCacheException();
+        }
+        sensor->setRangeDataFormat(static_cast<RangeSensor::RangeDataFormat>(format));
+        sensor->setFixedPointRangeStep(r.readDouble());
+    } else if(SpotLight* light = dynamic_cast<SpotLight*>(device)){
+        light->setCutOffExponent(r.readFloat());
+    }
+}
+
+
+void CacheWriter::writeDevice(Device* device)
+{
+    const string typeName = device->typeName();
+    DevicePtr prototype = createDevice(typeName);
+    // The devices of the classes defined outside this library are not supported
+    if(!prototype || typeid(*prototype) != typeid(*device) || !device->link()){
+        throw UnsupportedObjectException();
+    }
+    writeString(typeName);
+    writeInt(device->id());
+    writeString(device->name());
+    writeInt(device->link()->index());
+    writeMatrix(device->T_local().matrix());
+    write<double>(device->cycle());
+
+    vector<double> state(device->stateSize());
+    if(!state.empty()){
+        device->writeState(&state.front());
+    }
+    writeInt(state.size());
+    if(!state.empty()){
+        write(&state.front(), state.size() * sizeof(double));
+    }
+    writeDeviceSpec(*this, device);
+}
+
+
+void CacheWriter::writeLinkInfo(const Link* link)
+{
+    const Mapping* info = link->info();
+    if(!info || info->empty()){
+        writeString(string());
+    } else {
+        ostringstream os;
+        YAMLWriter writer(os);
+        writer.setDoubleFormat("%.17g");
+        writer.putNode(info);
+        writeString(os.str());
+    }
+}
+
+
+void CacheWriter::writeBody(Body* body)
+{
+    writeString(body->modelName());
+    writeBool(body->customizerInterface() != 0);
+
+    const int numLinks = body->numLinks();
+    writeInt(numLinks);
+    for(int i=0; i < numLinks; ++i){
+        Link* link = body->link(i);
+        writeInt(link->parent() ? link->parent()->index() : -1);
+        writeString(link->name());
+        writeInt(link->jointType());
+        writeInt(link->jointId());
+        writeMatrix(link->a());
+        writeMatrix(link->Tb().matrix());
+        writeMatrix(link->T().matrix());
+        writeMatrix(link->Rs());
+        writeMatrix(link->c());
+        write<double>(link->m());
+        writeMatrix(link->I());
+        write<double>(link->Jm2());
+        write<double>(link->q_upper());
+        write<double>(link->q_lower());
+        write<double>(link->dq_upper());
+        write<double>(link->dq_lower());
+        write<double>(link->initialJointDisplacement());
+        write<double>(link->q());
+        writeObject(link->visualShape());
+        writeObject(link->collisionShape());
+        writeLinkInfo(link);
+    }
+
+    const int numDevices = body->numDevices();
+    writeInt(numDevices);
+    for(int i=0; i < numDevices; ++i){
+        writeDevice(body->device(i));
+    }
+
+    const int numExtraJoints = body->numExtraJoints();
+    writeInt(numExtraJoints);
+    for(int i=0; i < numExtraJoints; ++i){
+        const Body::ExtraJoint& joint = body->extraJoint(i);
+        writeInt(joint.type);
+        writeMatrix(joint.axis);
+        for(int j=0; j < 2; ++j){
+            writeInt(joint.link[j] ? joint.link[j]->index() : -1);
+            writeMatrix(joint.point[j]);
+        }
+    }
+}
+
+
+/**
+   The body is only modified after all the data are read without an error.
+*/
+void readBody(CacheReader& r, Body* body)
+{
+    const string modelName = r.readString();
+    const bool hasCustomizer = r.readBool();
+
+    const int numLinks = r.readInt();
+    if(numLinks <= 0){
+        throw BrokenCacheException();
+    }
+    vector<LinkPtr> links;
+    links.reserve(numLinks);
+    for(int i=0; i < numLinks; ++i){
+        const int parentIndex = r.readInt();
+        if((i == 0 && parentIndex != -1) || (i > 0 && (parentIndex < 0 || parentIndex >= i))){
+            throw BrokenCacheException();
+        }
+        LinkPtr link = body->createLink();
+        link->setName(r.readString());
+        const int jointType = r.readInt();
+        if(jointType < Link::REVOLUTE_JOINT || jointType > Link::AGX_CRAWLER_JOINT){
+            throw BrokenCacheException();
+        }
+        link->setJointType(static_cast<Link::JointType>(jointType));
+        link->setJointId(r.readInt());
+        Vector3 v;
+        r.readMatrix(v);
+        link->setJointAxis(v);
+        r.readMatrix(link->Tb().matrix());
+        r.readMatrix(link->T().matrix());
+        Matrix3 M;
+        r.readMatrix(M);
+        link->setAccumulatedSegmentRotation(M);
+        r.readMatrix(v);
+        link->setCenterOfMass(v);
+        link->setMass(r.readDouble());
+        r.readMatrix(M);
+        link->setInertia(M);
+        link->setEquivalentRotorInertia(r.readDouble());
+        const double q_upper = r.readDouble();
+        const double q_lower = r.readDouble();
+        link->setJointRange(q_lower, q_upper);
+        const double dq_upper = r.readDouble();
+        const double dq_lower = r.readDouble();
+        link->setJointVelocityRange(dq_lower, dq_upper);
+        link->initialJointDisplacement() = r.readDouble();
+        link->q() = r.readDouble();
+        link->setVisualShape(r.readObject<SgNode>());
+        link->setCollisionShape(r.readObject<SgNode>());
+
+        const string info = r.readString();
+        if(!info.empty()){
+            YAMLReader reader;
+            if(!reader.parse(info) || reader.numDocuments() == 0){
+                throw BrokenCacheException();
+            }
+            link->resetInfo(reader.document()->toMapping());
+        }
+
+        if(parentIndex >= 0){
+            links[parentIndex]->appendChild(link);
+        }
+        links.push_back(link);
+    }
+
+    const int numDevices = r.readInt();
+    if(numDevices < 0){
+        throw BrokenCacheException();
+    }
+    vector<DevicePtr> devices;
+    for(int i=0; i < numDevices; ++i){
+        DevicePtr device = createDevice(r.readString());
+        if(!device){
+            throw BrokenCacheException();
+        }
+        device->setId(r.readInt());
+        device->setName(r.readString());
+        const int linkIndex = r.readInt();
+        if(linkIndex < 0 || linkIndex >= numLinks){
+            throw BrokenCacheException();
+        }
+        device->setLink(links[linkIndex]);
+        r.readMatrix(device->T_local().matrix());
+        device->setCycle(r.readDouble());
+        const int stateSize = r.readInt();
+        if(stateSize != device->stateSize()){
+            throw BrokenCacheException();
+        }
+        if(stateSize > 0){
+            vector<double> state(stateSize);
+            r.read(&state.front(), stateSize * sizeof(double));
+            device->readState(&state.front());
+        }
+        readDeviceSpec(r, device);
+        devices.push_back(device);
+    }
+
+    const int numExtraJoints = r.readInt();
+    if(numExtraJoints < 0){
+        throw BrokenCacheException();
+    }
+    vector<Body::ExtraJoint> extraJoints(numExtraJoints);
+    for(int i=0; i < numExtraJoints; ++i){
+        Body::ExtraJoint& joint = extraJoints[i];
+        const int type = r.readInt();
+        if(type != Body::EJ_PISTON && type != Body::EJ_BALL){
+            throw BrokenCacheException();
+        }
+        joint.type = static_cast<Body::ExtraJointType>(type);
+        r.readMatrix(joint.axis);
+        for(int j=0; j < 2; ++j){
+            const int linkIndex = r.readInt();
+            if(linkIndex < -1 || linkIndex >= numLinks){
+                throw BrokenCacheException();
+            }
+            joint.link[j] = (linkIndex >= 0) ? links[linkIndex].get() : 0;
+            r.readMatrix(joint.point[j]);
+        }
+    }
+
+    if(r.pos != r.end){
+        throw BrokenCacheException();
+    }
+
+    body->clearDevices();
+    body->clearExtraJoints();
+    body->setModelName(modelName);
+    body->setRootLink(links[0]);
+    for(size_t i=0; i < devices.size(); ++i){
+        body->addDevice(devices[i]);
+    }
+    for(size_t i=0; i < extraJoints.size(); ++i){
+        body->addExtraJoint(extraJoints[i]);
+    }
+    if(hasCustomizer){
+        body->installCustomizer();
+    }
+}
+
+}
+
+
+BodyCache::BodyCache(const std::string& directory, const std::string& modelFilename, const std::string& key)
+    : modelFilename(modelFilename),
+      key(key)
+{
+    uint64 hash = initialHash;
+    hash = addHash(hash, &bodyCacheVersion, sizeof(bodyCacheVersion));
+    hash = addHash(hash, modelFilename.data(), modelFilename.size());
+    hash = addHash(hash, key.data(), key.size());
+    char name[32];
+    sprintf(name, "%08x%08x.cbc", (unsigned int)(hash >> 32), (unsigned int)(hash & 0xffffffff));
+    filename_ = (filesystem::path(directory) / name).string();
+}
+
+
+bool BodyCache::restore(Body* body)
+{
+    vector<char> data;
+    {
+        ifstream ifs(filename_.c_str(), ios::in | ios::binary);
+        if(!ifs){
+            return false;
+        }
+        ifs.seekg(0, ios::end);
+        const streamoff size = ifs.tellg();
+        if(size <= 0){
+            return false;
+        }
+        ifs.seekg(0);
+        data.resize(size);
+        if(!ifs.read(&data.front(), size)){
+            return false;
+        }
+    }
+
+    try {
+        CacheReader r(data);
+        char magic[sizeof(bodyCacheMagic)];
+        r.read(magic, sizeof(magic));
+        if(memcmp(magic, bodyCacheMagic, sizeof(bodyCacheMagic)) != 0 ||
+           r.read<uint32>() != bodyCacheVersion ||
+           r.readString() != modelFilename ||
+           r.readString() != key){
+            return false;
+        }
+        const int numSourceFiles = r.readInt();
+        for(int i=0; i < numSourceFiles; ++i){
+            const string sourceFile = r.readString();
+            const uint64 size = r.read<uint64>();
+            const uint64 hash = r.read<uint64>();
+            uint64 actualSize, actualHash;
+            if(!getFileHash(sourceFile, actualSize, actualHash) || actualSize != size || actualHash != hash){
+                return false;
+            }
+        }
+        readBody(r, body);
+    }
+    catch(const BrokenCacheException& ex){
+        return false;
+    }
+    catch(const ValueNode::Exception& ex){
+        return false;
+    }
+
+    return true;
+}
+
+
+bool BodyCache::store(Body* body, const std::vector<std::string>& sourceFiles)
+{
+    CacheWriter w;
+    w.write(bodyCacheMagic, sizeof(bodyCacheMagic));
+    w.write<uint32>(bodyCacheVersion);
+    w.writeString(modelFilename);
+    w.writeString(key);
+
+    // The same file may be given more than once
+    vector<string> files(sourceFiles);
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    w.writeInt(files.size());
+    for(size_t i=0; i < files.size(); ++i){
+        uint64 size, hash;
+        if(!getFileHash(files[i], size, hash)){
+            return false;
+        }
+        w.writeString(files[i]);
+        w.write<uint64>(size);
+        w.write<uint64>(hash);
+    }
+
+    try {
+        w.writeBody(body);
+    }
+    catch(const UnsupportedObjectException& ex){
+        return false;
+    }
+
+    boost::system::error_code ec;
+    const filesystem::path path(filename_);
+    filesystem::create_directories(path.parent_path(), ec);
+    if(ec){
+        return false;
+    }
+    const filesystem::path tmpPath = filesystem::unique_path(path.string() + ".%%%%%%%%", ec);
+    if(ec){
+        return false;
+    }
+    {
+        ofstream out(tmpPath.string().c_str(), ios::out | ios::binary);
+        if(!out){
+            return false;
+        }
+        out.write(&w.data.front(), w.data.size());
+        if(!out){
+            out.close();
+            filesystem::remove(tmpPath, ec);
+            return false;
+        }
+    }
+    filesystem::rename(tmpPath, path, ec);
+    if(ec){
+        filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
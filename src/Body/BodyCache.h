@@ -0,0 +1,51 @@
+/**
+   \file
+*/
+
+#ifndef CNOID_BODY_BODY_CACHE_H
+#define CNOID_BODY_BODY_CACHE_H
+
+#include <string>
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class Body;
+
+/**
+   The binary cache of a body model built by a body loader.
+   A cache file contains the link tree, the devices, the extra joints and the shapes of the links,
+   and it is identified by the model file and the loading settings.
+   The file also has the hashes of the source files of the model, which are checked when it is restored.
+*/
+class CNOID_EXPORT BodyCache
+{
+public:
+    /**
+       @param key The string which identifies the loading settings other than the model file
+    */
+    BodyCache(const std::string& directory, const std::string& modelFilename, const std::string& key);
+
+    const std::string& filename() const { return filename_; }
+
+    /**
+       @return false if the cache file does not exist, its source files are modified or it is broken.
+       The body is not modified in that case.
+    */
+    bool restore(Body* body);
+
+    /**
+       @return false if the body has an object which cannot be stored or the file cannot be written.
+    */
+    bool store(Body* body, const std::vector<std::string>& sourceFiles);
+
+private:
+    std::string filename_;
+    std::string modelFilename;
+    std::string key;
+};
+
+}
+
+#endif
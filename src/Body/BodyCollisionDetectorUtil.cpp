@@ -4,8 +4,14 @@
 */
 
 #include "BodyCollisionDetectorUtil.h"
+#include "BodyMotion.h"
 #include <cnoid/ValueTree>
+#include <cnoid/TaskScheduler>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 using namespace boost;
@@ -108,3 +114,148 @@ int cnoid::addBodyToCollisionDetector(Body& body, CollisionDetector& detector, b
 
     return idTop;
 }
+
+
+namespace {
+
+struct MotionCollisionBlock
+{
+    int beginningFrame;
+    int endingFrame;
+    CollisionDetectorPtr detector;
+    vector<BodyPtr> bodies;
+    vector<int> geometryIdTops;
+};
+
+class MotionCollisionDetection
+{
+public:
+    const vector<Body*>& orgBodies;
+    const vector<BodyMotion*>& motions;
+    double frameRate;
+    vector<MotionCollisionBlock> blocks;
+    vector< vector<CollisionLinkPairPtr> >& collisions;
+
+    MotionCollisionDetection(
+        const vector<Body*>& orgBodies, const vector<BodyMotion*>& motions, double frameRate,
+        vector< vector<CollisionLinkPairPtr> >& collisions)
+        : orgBodies(orgBodies), motions(motions), frameRate(frameRate), collisions(collisions) { }
+
+    void detect(int blockIndex);
+    void setBodyPosition(Body* body, BodyMotion* motion, double time);
+    void extractCollisionPair(const CollisionPair& pair, MotionCollisionBlock* block, int frame);
+};
+
+}
+
+
+void MotionCollisionDetection::detect(int blockIndex)
+{
+    MotionCollisionBlock& block = blocks[blockIndex];
+    const int numBodies = block.bodies.size();
+    for(int frame = block.beginningFrame; frame < block.endingFrame; ++frame){
+        // The small offset prevents frameOfTime() from truncating the time to the previous frame
+        const double time = (frame + 1.0e-6) / frameRate;
+        for(int i=0; i < numBodies; ++i){
+            Body* body = block.bodies[i];
+            setBodyPosition(body, motions[i], time);
+            const int idTop = block.geometryIdTops[i];
+            for(int j=0; j < body->numLinks(); ++j){
+                block.detector->updatePosition(idTop + j, body->link(j)->T());
+            }
+        }
+        block.detector->detectCollisions(
+            boost::bind(&MotionCollisionDetection::extractCollisionPair, this, _1, &block, frame));
+    }
+}
+
+
+void MotionCollisionDetection::setBodyPosition(Body* body, BodyMotion* motion, double time)
+{
+    const MultiValueSeqPtr& qSeq = motion->jointPosSeq();
+    if(qSeq && qSeq->numFrames() > 0){
+        const MultiValueSeq::Frame q = qSeq->frame(qSeq->clampFrameIndex(qSeq->frameOfTime(time)));
+        const int n = std::min(body->numAllJoints(), qSeq->numParts());
+        for(int i=0; i < n; ++i){
+            body->joint(i)->q() = q[i];
+        }
+    }
+    int numGivenLinks = 0;
+    const MultiSE3SeqPtr& positions = motion->linkPosSeq();
+    if(positions && positions->numFrames() > 0){
+        const int frame = positions->clampFrameIndex(positions->frameOfTime(time));
+        numGivenLinks = std::min(body->numLinks(), positions->numParts());
+        for(int i=0; i < numGivenLinks; ++i){
+            Link* link = body->link(i);
+            const SE3& position = positions->at(frame, i);
+            link->p() = position.translation();
+            link->R() = position.rotation().toRotationMatrix();
+        }
+    }
+    if(numGivenLinks < body->numLinks()){
+        body->calcForwardKinematics();
+    }
+}
+
+
+void MotionCollisionDetection::extractCollisionPair(const CollisionPair& pair, MotionCollisionBlock* block, int frame)
+{
+    CollisionLinkPairPtr linkPair = boost::make_shared<CollisionLinkPair>();
+    linkPair->collisions = pair.collisions;
+    const vector<int>& tops = block->geometryIdTops;
+    for(int i=0; i < 2; ++i){
+        const int geometryId = pair.geometryId[i];
+        const int bodyIndex = (std::upper_bound(tops.begin(), tops.end(), geometryId) - tops.begin()) - 1;
+        Body* body = orgBodies[bodyIndex];
+        linkPair->body[i] = body;
+        linkPair->link[i] = body->link(geometryId - tops[bodyIndex]);
+    }
+    collisions[frame].push_back(linkPair);
+}
+
+
+bool cnoid::detectCollisionsOfBodyMotions
+(const CollisionDetector& detector, const std::vector<Body*>& bodies, const std::vector<BodyMotion*>& motions,
+ const std::vector<bool>& selfCollisionFlags, double frameRate,
+ std::vector< std::vector<CollisionLinkPairPtr> >& out_collisions)
+{
+    out_collisions.clear();
+
+    const int numBodies = std::min(bodies.size(), motions.size());
+    int numFrames = 0;
+    for(int i=0; i < numBodies; ++i){
+        BodyMotion* motion = motions[i];
+        const int n = (int)ceil(motion->numFrames() * frameRate / motion->frameRate() - 1.0e-6);
+        numFrames = std::max(numFrames, n);
+    }
+    if(numBodies == 0 || numFrames == 0 || frameRate <= 0.0){
+        return false;
+    }
+    out_collisions.resize(numFrames);
+
+    vector<Body*> orgBodies(bodies.begin(), bodies.begin() + numBodies);
+    vector<BodyMotion*> orgMotions(motions.begin(), motions.begin() + numBodies);
+    MotionCollisionDetection detection(orgBodies, orgMotions, frameRate, out_collisions);
+
+    // The detectors and the bodies are prepared in this thread
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int numBlocks = std::min(scheduler->concurrency(), numFrames);
+    detection.blocks.resize(numBlocks);
+    for(int i=0; i < numBlocks; ++i){
+        MotionCollisionBlock& block = detection.blocks[i];
+        block.beginningFrame = (long long)numFrames * i / numBlocks;
+        block.endingFrame = (long long)numFrames * (i + 1) / numBlocks;
+        block.detector = detector.clone();
+        for(int j=0; j < numBodies; ++j){
+            BodyPtr body = bodies[j]->clone();
+            const bool isSelfCollisionEnabled = selfCollisionFlags.empty() ? true : selfCollisionFlags[j];
+            block.geometryIdTops.push_back(addBodyToCollisionDetector(*body, *block.detector, isSelfCollisionEnabled));
+            block.bodies.push_back(body);
+        }
+        block.detector->makeReady();
+    }
+
+    scheduler->parallelFor(0, numBlocks, boost::bind(&MotionCollisionDetection::detect, &detection, _1));
+
+    return true;
+}
@@ -8,12 +8,34 @@
 
 #include <cnoid/CollisionDetector>
 #include <cnoid/Body>
+#include "CollisionLinkPair.h"
 #include "exportdecl.h"
 
 namespace cnoid {
 
+class BodyMotion;
+
 CNOID_EXPORT int addBodyToCollisionDetector(Body& body, CollisionDetector& detector, bool enableSelfCollisions = true);
 
+/**
+   This function detects the collisions between the bodies in each frame of their motions.
+   The link positions are given by the link position sequence of a motion if it has all the links,
+   and otherwise they are calculated from the root link position and the joint displacements.
+   The frames are divided into blocks which are processed in parallel with the clones of the
+   detector and the bodies, so the given detector and bodies are not modified.
+   
+   \param detector The detectors used in the threads are created by its clone() function
+   \param selfCollisionFlags Whether the self collisions of each body are detected or not.
+   They are detected for all the bodies if this is empty.
+   \param frameRate The frame rate of the output. Each motion is sampled at the time of a frame.
+   \param out_collisions The collisions of each frame. The link pairs refer to the given bodies.
+   eturn false if no frame can be processed
+*/
+CNOID_EXPORT bool detectCollisionsOfBodyMotions(
+    const CollisionDetector& detector, const std::vector<Body*>& bodies, const std::vector<BodyMotion*>& motions,
+    const std::vector<bool>& selfCollisionFlags, double frameRate,
+    std::vector< std::vector<CollisionLinkPairPtr> >& out_collisions);
+
 }
 
 #endif
@@ -7,15 +7,19 @@
 #include "YAMLBodyLoader.h"
 #include "VRMLBodyLoader.h"
 #include "ColladaBodyLoader.h"
+#include "BodyCache.h"
 #include "Body.h"
 #include <cnoid/STLSceneLoader>
 #include <cnoid/Exception>
 #include <cnoid/YAMLReader>
 #include <cnoid/FileUtil>
 #include <cnoid/NullOut>
+#include <cnoid/TimingProfiler>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdlib>
 #include "gettext.h"
 
 using namespace std;
@@ -29,6 +33,9 @@ typedef map<string, LoaderFactory> LoaderFactoryMap;
 LoaderFactoryMap loaderFactoryMap;
 boost::mutex loaderFactoryMapMutex;
 
+string cacheDirectory_;
+boost::mutex cacheDirectoryMutex;
+
 
 AbstractBodyLoaderPtr yamlBodyLoaderFactory()
 {
@@ -48,6 +55,7 @@ AbstractBodyLoaderPtr colladaBodyLoaderFactory()
 class SceneLoaderAdapter : public AbstractBodyLoader
 {
     AbstractSceneLoader* loader;
+    string filename;
 public:
     SceneLoaderAdapter(AbstractSceneLoader* loader) : loader(loader) { }
     ~SceneLoaderAdapter() { delete loader; }
@@ -58,6 +66,7 @@ public:
         body->clearDevices();
         body->clearExtraJoints();
 
+        this->filename = filename;
         SgNode* scene = loader->load(filename);
         if(scene){
             Link* link = body->createLink();
@@ -71,6 +80,12 @@ public:
 
         return (scene != 0);
     }
+
+    virtual bool getSourceFiles(std::vector<std::string>& out_filenames) const {
+        out_filenames.clear();
+        out_filenames.push_back(getAbsolutePathString(filesystem::path(filename)));
+        return true;
+    }
 };
 
 
@@ -101,6 +116,46 @@ bool BodyLoader::registerLoader(const std::string& extension, boost::function<Ab
     loaderFactoryMap[extension] = factory;
     return  true;
 }
+
+
+void BodyLoader::setCacheDirectory(const std::string& directory)
+{
+    boost::lock_guard<boost::mutex> lock(cacheDirectoryMutex);
+    cacheDirectory_ = directory;
+}
+
+
+std::string BodyLoader::cacheDirectory()
+{
+    boost::lock_guard<boost::mutex> lock(cacheDirectoryMutex);
+    return cacheDirectory_;
+}
+
+
+std::string BodyLoader::defaultCacheDirectory()
+{
+    filesystem::path directory;
+#ifdef _WIN32
+    const char* appdata = getenv("LOCALAPPDATA");
+    if(appdata){
+        directory = appdata;
+    }
+#else
+    const char* cache = getenv("XDG_CACHE_HOME");
+    if(cache && cache[0]){
+        directory = cache;
+    } else {
+        const char* home = getenv("HOME");
+        if(home){
+            directory = filesystem::path(home) / ".cache";
+        }
+    }
+#endif
+    if(directory.empty()){
+        return string();
+    }
+    return (directory / "choreonoid" / "body").string();
+}
     
 
 namespace cnoid {
@@ -121,6 +176,7 @@ public:
     BodyLoaderImpl();
     ~BodyLoaderImpl();
     bool load(Body* body, const std::string& filename);
+    bool loadWithCache(Body* body, const std::string& filename, const std::string& modelFilename, int divisionNumber);
 };
 
 }
@@ -210,6 +266,8 @@ Body* BodyLoader::load(const std::string& filename)
 
 bool BodyLoaderImpl::load(Body* body, const std::string& filename)
 {
+    TimingProfiler::Scope timingScope("BodyLoader/Loading");
+    
     bool result = false;
 
     filesystem::path orgpath(filename);
@@ -288,7 +346,7 @@ bool BodyLoaderImpl::load(Body* body, const std::string& filename)
                     body->info()->clear();
                 }
 
-                result = loader->load(body, modelFilename);
+                result = loadWithCache(body, filename, modelFilename, dn);
             }
         }
         
@@ -307,6 +365,43 @@ bool BodyLoaderImpl::load(Body* body, const std::string& filename)
 }
 
 
+bool BodyLoaderImpl::loadWithCache
+(Body* body, const std::string& filename, const std::string& modelFilename, int divisionNumber)
+{
+    const string directory = BodyLoader::cacheDirectory();
+    if(directory.empty()){
+        return loader->load(body, modelFilename);
+    }
+
+    const string key = str(boost::format("%1% %2% %3% %4%")
+                           % loader->format() % isShapeLoadingEnabled % divisionNumber
+                           % boost::lexical_cast<string>(defaultCreaseAngle));
+    BodyCache cache(directory, getAbsolutePathString(filesystem::path(modelFilename)), key);
+
+    if(cache.restore(body)){
+        if(isVerbose){
+            (*os) << str(boost::format(_("The body model \"%1%\" has been restored from the cache \"%2%\".\n"))
+                         % modelFilename % cache.filename());
+        }
+        return true;
+    }
+
+    if(!loader->load(body, modelFilename)){
+        return false;
+    }
+
+    vector<string> sourceFiles;
+    if(loader->getSourceFiles(sourceFiles)){
+        if(filename != modelFilename){
+            // The yaml file which specifies the model file
+            sourceFiles.push_back(getAbsolutePathString(filesystem::path(filename)));
+        }
+        cache.store(body, sourceFiles);
+    }
+    return true;
+}
+
+
 AbstractBodyLoaderPtr BodyLoader::lastActualBodyLoader() const
 {
     return impl->loader;
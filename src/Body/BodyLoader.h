@@ -18,6 +18,15 @@ class CNOID_EXPORT BodyLoader : public AbstractBodyLoader
 {
 public:
     static bool registerLoader(const std::string& extension, boost::function<AbstractBodyLoaderPtr()> factory);
+
+    /**
+       The bodies loaded by the loaders which can give their source files are stored in the directory
+       as binary caches, and they are restored from the caches when the same models are loaded again
+       with the same settings. The cache is disabled when the directory is empty, which is the default.
+    */
+    static void setCacheDirectory(const std::string& directory);
+    static std::string cacheDirectory();
+    static std::string defaultCacheDirectory();
         
     BodyLoader();
     ~BodyLoader();
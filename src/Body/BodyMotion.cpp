@@ -10,12 +10,81 @@
 #include <cnoid/Vector3Seq>
 #include <cnoid/YAMLReader>
 #include <cnoid/YAMLWriter>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/cstdint.hpp>
+#include <fstream>
+#include <cstring>
 
 using namespace std;
 using namespace cnoid;
 
 namespace {
 //bool TRACE_FUNCTIONS = false;
+
+const char binaryFormatMagic[8] = { 'C', 'N', 'O', 'I', 'D', 'B', 'M', '\0' };
+const boost::uint32_t binaryFormatVersion = 1;
+const boost::uint32_t byteOrderMark = 0x01020304;
+
+enum BinaryComponentType { JOINT_POSITION_BLOCK = 1, LINK_POSITION_BLOCK = 2, VECTOR3_BLOCK = 3 };
+enum BinaryComponentFlag { ROOT_RELATIVE = 1 };
+
+struct BinaryHeader
+{
+    char magic[8];
+    boost::uint32_t byteOrderMark;
+    boost::uint32_t version;
+    boost::uint32_t numComponents;
+    boost::uint32_t reserved;
+};
+
+/**
+   The header is followed by the content name padded to a multiple of eight bytes and the values.
+   The values of a frame are stored contiguously. A link position is stored as the seven values of
+   the translation and the quaternion (w, x, y, z).
+*/
+struct BinaryComponentHeader
+{
+    boost::uint32_t type;
+    boost::uint32_t flags;
+    boost::int32_t numFrames;
+    boost::int32_t numParts;
+    double frameRate;
+    boost::uint32_t contentNameLength;
+    boost::uint32_t reserved;
+    boost::uint64_t numValues;
+};
+
+size_t paddedSize(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+void writeComponent
+(std::ofstream& ofs, BinaryComponentType type, boost::uint32_t flags,
+ const AbstractSeq& seq, const string& content, int numFrames, int numParts, int numElements, const vector<double>& values)
+{
+    BinaryComponentHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = type;
+    header.flags = flags;
+    header.numFrames = numFrames;
+    header.numParts = numParts;
+    header.frameRate = seq.getFrameRate();
+    header.contentNameLength = content.size();
+    header.numValues = static_cast<boost::uint64_t>(numFrames) * numParts * numElements;
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    vector<char> name(paddedSize(content.size()), 0);
+    std::copy(content.begin(), content.end(), name.begin());
+    if(!name.empty()){
+        ofs.write(&name[0], name.size());
+    }
+    if(!values.empty()){
+        ofs.write(reinterpret_cast<const char*>(&values[0]), values.size() * sizeof(double));
+    }
+}
+
 }
 
 
@@ -117,6 +186,16 @@ void BodyMotion::setNumFrames(int n, bool clearNewArea)
 }
 
 
+size_t BodyMotion::memoryUsage() const
+{
+    size_t usage = jointPosSeq_->memoryUsage() + linkPosSeq_->memoryUsage();
+    for(ExtraSeqMap::const_iterator p = extraSeqs.begin(); p != extraSeqs.end(); ++p){
+        usage += p->second->memoryUsage();
+    }
+    return usage;
+}
+
+
 int BodyMotion::getOffsetTimeFrame() const {
     return linkPosSeq_->offsetTimeFrame();
 }
@@ -157,6 +236,7 @@ bool BodyMotion::loadStandardYAMLformat(const std::string& filename)
     clearSeqMessage();
     YAMLReader reader;
     reader.expectRegularMultiListing();
+    MultiValueSeq::setCompactFrameReader(reader);
     
     try {
         result = read(*reader.loadDocument(filename)->toMapping());
@@ -292,6 +372,228 @@ bool BodyMotion::saveAsStandardYAMLformat(const std::string& filename)
 }
 
 
+bool BodyMotion::saveAsBinaryFormat(const std::string& filename)
+{
+    clearSeqMessage();
+    
+    vector<Vector3SeqPtr> vector3Seqs;
+    vector<string> vector3SeqNames;
+    for(ExtraSeqMap::iterator p = extraSeqs.begin(); p != extraSeqs.end(); ++p){
+        Vector3SeqPtr seq = boost::dynamic_pointer_cast<Vector3Seq>(p->second);
+        if(!seq){
+            addSeqMessage(
+                string("Extra sequence \"") + p->first + "\" cannot be saved in the binary body motion format.");
+            return false;
+        }
+        vector3Seqs.push_back(seq);
+        vector3SeqNames.push_back(p->first);
+    }
+
+    std::ofstream ofs(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!ofs){
+        addSeqMessage(string("\"") + filename + "\" cannot be opened.");
+        return false;
+    }
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, binaryFormatMagic, sizeof(binaryFormatMagic));
+    header.byteOrderMark = byteOrderMark;
+    header.version = binaryFormatVersion;
+    header.numComponents = 2 + vector3Seqs.size();
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    vector<double> values;
+
+    const int numJointFrames = jointPosSeq_->numFrames();
+    const int numJoints = jointPosSeq_->numParts();
+    values.resize(numJointFrames * numJoints);
+    for(int i=0; i < numJointFrames; ++i){
+        MultiValueSeq::Frame frame = jointPosSeq_->frame(i);
+        std::copy(frame.begin(), frame.end(), values.begin() + i * numJoints);
+    }
+    writeComponent(ofs, JOINT_POSITION_BLOCK, 0, *jointPosSeq_, "JointPosition", numJointFrames, numJoints, 1, values);
+
+    const int numLinkFrames = linkPosSeq_->numFrames();
+    const int numLinks = linkPosSeq_->numParts();
+    values.resize(numLinkFrames * numLinks * 7);
+    vector<double>::iterator q = values.begin();
+    for(int i=0; i < numLinkFrames; ++i){
+        MultiSE3Seq::Frame frame = linkPosSeq_->frame(i);
+        for(int j=0; j < numLinks; ++j){
+            const SE3& position = frame[j];
+            const Vector3& p = position.translation();
+            const Quat& quat = position.rotation();
+            *q++ = p.x();
+            *q++ = p.y();
+            *q++ = p.z();
+            *q++ = quat.w();
+            *q++ = quat.x();
+            *q++ = quat.y();
+            *q++ = quat.z();
+        }
+    }
+    writeComponent(ofs, LINK_POSITION_BLOCK, 0, *linkPosSeq_, "LinkPosition", numLinkFrames, numLinks, 7, values);
+
+    for(size_t i=0; i < vector3Seqs.size(); ++i){
+        Vector3Seq& seq = *vector3Seqs[i];
+        const int n = seq.numFrames();
+        values.resize(n * 3);
+        for(int j=0; j < n; ++j){
+            const Vector3& v = seq[j];
+            values[j * 3] = v.x();
+            values[j * 3 + 1] = v.y();
+            values[j * 3 + 2] = v.z();
+        }
+        boost::uint32_t flags = 0;
+        ZMPSeq* zmpSeq = dynamic_cast<ZMPSeq*>(&seq);
+        if(zmpSeq && zmpSeq->isRootRelative()){
+            flags |= ROOT_RELATIVE;
+        }
+        writeComponent(ofs, VECTOR3_BLOCK, flags, seq, vector3SeqNames[i], n, 1, 3, values);
+    }
+
+    if(!ofs){
+        addSeqMessage(string("Failed to write \"") + filename + "\".");
+        return false;
+    }
+    return true;
+}
+
+
+bool BodyMotion::loadBinaryFormat(const std::string& filename)
+{
+    namespace bi = boost::interprocess;
+
+    clearSeqMessage();
+    setDimension(0, 1, 1);
+    if(!extraSeqs.empty()){
+        extraSeqs.clear();
+        sigExtraSeqsChanged_();
+    }
+
+    bool result = false;
+    
+    try {
+        bi::file_mapping file(filename.c_str(), bi::read_only);
+        bi::mapped_region region(file, bi::read_only);
+        const char* p = static_cast<const char*>(region.get_address());
+        const char* pend = p + region.get_size();
+
+        BinaryHeader header;
+        if(pend - p < static_cast<ptrdiff_t>(sizeof(header))){
+            addSeqMessage(string("\"") + filename + "\" is not a binary body motion file.");
+            return false;
+        }
+        memcpy(&header, p, sizeof(header));
+        p += sizeof(header);
+        if(memcmp(header.magic, binaryFormatMagic, sizeof(binaryFormatMagic)) != 0){
+            addSeqMessage(string("\"") + filename + "\" is not a binary body motion file.");
+            return false;
+        }
+        if(header.byteOrderMark != byteOrderMark){
+            addSeqMessage(string("The byte order of \"") + filename + "\" is different from this machine.");
+            return false;
+        }
+        if(header.version != binaryFormatVersion){
+            addSeqMessage(string("The version of \"") + filename + "\" is not supported.");
+            return false;
+        }
+
+        result = true;
+        
+        for(boost::uint32_t i=0; i < header.numComponents; ++i){
+            BinaryComponentHeader component;
+            if(pend - p < static_cast<ptrdiff_t>(sizeof(component))){
+                result = false;
+                break;
+            }
+            memcpy(&component, p, sizeof(component));
+            p += sizeof(component);
+
+            const size_t nameSize = paddedSize(component.contentNameLength);
+            const boost::uint64_t dataSize = component.numValues * sizeof(double);
+            if(component.numFrames < 0 || component.numParts < 0 ||
+               static_cast<boost::uint64_t>(pend - p) < nameSize ||
+               static_cast<boost::uint64_t>(pend - p) - nameSize < dataSize){
+                result = false;
+                break;
+            }
+            const string content(p, component.contentNameLength);
+            p += nameSize;
+            const double* values = reinterpret_cast<const double*>(p);
+            p += dataSize;
+
+            const int numFrames = component.numFrames;
+            const int numParts = component.numParts;
+            const boost::uint64_t numFrameParts = static_cast<boost::uint64_t>(numFrames) * numParts;
+
+            if(component.type == JOINT_POSITION_BLOCK){
+                if(component.numValues != numFrameParts){
+                    result = false;
+                    break;
+                }
+                jointPosSeq_->setFrameRate(component.frameRate);
+                jointPosSeq_->setDimension(numFrames, numParts);
+                for(int j=0; j < numFrames; ++j){
+                    const double* src = values + j * numParts;
+                    std::copy(src, src + numParts, jointPosSeq_->frame(j).begin());
+                }
+            } else if(component.type == LINK_POSITION_BLOCK){
+                if(component.numValues != numFrameParts * 7){
+                    result = false;
+                    break;
+                }
+                linkPosSeq_->setFrameRate(component.frameRate);
+                linkPosSeq_->setDimension(numFrames, numParts);
+                const double* q = values;
+                for(int j=0; j < numFrames; ++j){
+                    MultiSE3Seq::Frame frame = linkPosSeq_->frame(j);
+                    for(int k=0; k < numParts; ++k){
+                        frame[k].set(Vector3(q[0], q[1], q[2]), Quat(q[3], q[4], q[5], q[6]));
+                        q += 7;
+                    }
+                }
+            } else if(component.type == VECTOR3_BLOCK){
+                if(component.numValues != numFrameParts * 3){
+                    result = false;
+                    break;
+                }
+                Vector3SeqPtr seq;
+                if(content == ZMPSeq::key()){
+                    ZMPSeqPtr zmpSeq = getOrCreateExtraSeq<ZMPSeq>(content);
+                    zmpSeq->setRootRelative(component.flags & ROOT_RELATIVE);
+                    seq = zmpSeq;
+                } else {
+                    seq = getOrCreateExtraSeq<Vector3Seq>(content);
+                    seq->setSeqContentName(content);
+                }
+                seq->setFrameRate(component.frameRate);
+                seq->setNumFrames(numFrames);
+                for(int j=0; j < numFrames; ++j){
+                    const double* v = values + j * 3;
+                    (*seq)[j] = Vector3(v[0], v[1], v[2]);
+                }
+            }
+            // Unknown blocks are skipped for the compatibility with the future versions
+        }
+        if(!result){
+            addSeqMessage(string("\"") + filename + "\" is broken.");
+        }
+    }
+    catch(const bi::interprocess_exception& ex){
+        addSeqMessage(string("\"") + filename + "\" cannot be opened: " + ex.what());
+        result = false;
+    }
+
+    if(!result){
+        setDimension(0, 1, 1);
+    }
+
+    return result;
+}
+
+
 void BodyMotion::clearExtraSeq(const std::string& contentName)
 {
     if(extraSeqs.erase(contentName) > 0){
@@ -50,6 +50,8 @@ public:
     virtual int getNumFrames() const;
     virtual void setNumFrames(int n, bool clearNewArea = false);
 
+    virtual size_t memoryUsage() const;
+
     MultiValueSeqPtr jointPosSeq() {
         return jointPosSeq_;
     }
@@ -105,6 +107,16 @@ public:
     bool loadStandardYAMLformat(const std::string& filename);
     bool saveAsStandardYAMLformat(const std::string& filename);
 
+    /**
+       The binary format stores the values of the joint positions, the link positions and
+       the Vector3Seq based extra sequences such as ZMP as the blocks of the native double values.
+       The file is mapped into the memory and the blocks are copied into the sequences directly,
+       so it is loaded much faster than the YAML format. The file is not portable between
+       the machines with different byte orders.
+    */
+    bool loadBinaryFormat(const std::string& filename);
+    bool saveAsBinaryFormat(const std::string& filename);
+
     typedef std::map<std::string, AbstractSeqPtr> ExtraSeqMap;
     typedef ExtraSeqMap::const_iterator ConstSeqIterator;
         
@@ -10,12 +10,16 @@
 #include "ForceSensor.h"
 #include "RateGyroSensor.h"
 #include "AccelerationSensor.h"
+#include "InverseDynamics.h"
 #include <cnoid/EigenUtil>
 #include <cnoid/Vector3Seq>
 #include <cnoid/GaussianFilter>
 #include <cnoid/RangeLimiter>
 #include <cnoid/FileUtil>
+#include <cnoid/TaskScheduler>
 #include <boost/format.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
 #include <fstream>
 #include <vector>
 #include <limits>
@@ -145,6 +149,166 @@ void cnoid::calcLinkAccSeq
 }
 
 
+namespace {
+
+const double gravityAcceleration = 9.80665;
+
+/**
+   The derivatives are given by the averaged and differenced velocities of the two adjacent intervals.
+   The acceleration at an end of the sequence is zero.
+*/
+template<class T>
+void setDifferences(const T& vPrev, const T& vNext, bool hasPrev, bool hasNext, double dt, T& out_v, T& out_a)
+{
+    if(hasPrev && hasNext){
+        out_v = 0.5 * (vPrev + vNext);
+        out_a = (vNext - vPrev) / dt;
+    } else {
+        out_v = hasPrev ? vPrev : vNext;
+        out_a = out_v * 0.0;
+    }
+}
+
+
+struct InverseDynamicsSeqCalculator
+{
+    MultiValueSeq& qseq;
+    MultiSE3Seq& pseq;
+    MultiValueSeq& out_torqueSeq;
+    ZMPSeq& out_zmpSeq;
+    int numFrames;
+    double dt;
+    std::vector<Body*> freeBodies;
+    boost::mutex mutex;
+
+    InverseDynamicsSeqCalculator(
+        BodyMotion& motion, MultiValueSeq& out_torqueSeq, ZMPSeq& out_zmpSeq)
+        : qseq(*motion.jointPosSeq()),
+          pseq(*motion.linkPosSeq()),
+          out_torqueSeq(out_torqueSeq),
+          out_zmpSeq(out_zmpSeq) {
+        numFrames = motion.numFrames();
+        dt = 1.0 / motion.frameRate();
+    }
+
+    void calc(int begin, int end) {
+        Body* body;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            body = freeBodies.back();
+            freeBodies.pop_back();
+        }
+        for(int i = begin; i < end; ++i){
+            calcFrame(body, i);
+        }
+        boost::mutex::scoped_lock lock(mutex);
+        freeBodies.push_back(body);
+    }
+
+    void calcFrame(Body* body, int frame) {
+        const bool hasPrev = (frame > 0);
+        const bool hasNext = (frame < numFrames - 1);
+        Link* root = body->rootLink();
+
+        const int numRootFrames = pseq.numParts() > 0 ? pseq.numFrames() : 0;
+        if(numRootFrames > 0){
+            MultiSE3Seq::Part rootSeq = pseq.part(0);
+            const int last = numRootFrames - 1;
+            const SE3& P = rootSeq[std::min(frame, last)];
+            const SE3& Pprev = rootSeq[std::min(std::max(frame - 1, 0), last)];
+            const SE3& Pnext = rootSeq[std::min(frame + 1, last)];
+            const Matrix3 R(P.rotation());
+            const Matrix3 Rprev(Pprev.rotation());
+            root->p() = P.translation();
+            root->R() = R;
+            const Vector3 vPrev = (P.translation() - Pprev.translation()) / dt;
+            const Vector3 vNext = (Pnext.translation() - P.translation()) / dt;
+            setDifferences(vPrev, vNext, hasPrev, hasNext, dt, root->v(), root->dv());
+            // omegaFromRot() cannot be used because it ignores the small rotations between the frames
+            const AngleAxis aPrev(Pprev.rotation().inverse() * P.rotation());
+            const AngleAxis aNext(P.rotation().inverse() * Pnext.rotation());
+            const Vector3 wPrev = Rprev * aPrev.axis() * (aPrev.angle() / dt);
+            const Vector3 wNext = R * aNext.axis() * (aNext.angle() / dt);
+            setDifferences(wPrev, wNext, hasPrev, hasNext, dt, root->w(), root->dw());
+        } else {
+            root->v().setZero();
+            root->w().setZero();
+            root->dv().setZero();
+            root->dw().setZero();
+        }
+        // The gravity is given as the upward acceleration of the root link
+        root->dv().z() += gravityAcceleration;
+
+        const int numJoints = out_torqueSeq.numParts();
+        const int numJointFrames = qseq.numFrames();
+        for(int i=0; i < numJoints; ++i){
+            Link* joint = body->joint(i);
+            if(i < qseq.numParts() && numJointFrames > 0){
+                MultiValueSeq::Part q = qseq.part(i);
+                const int last = numJointFrames - 1;
+                const double q0 = q[std::min(std::max(frame - 1, 0), last)];
+                const double q1 = q[std::min(frame, last)];
+                const double q2 = q[std::min(frame + 1, last)];
+                joint->q() = q1;
+                setDifferences((q1 - q0) / dt, (q2 - q1) / dt, hasPrev, hasNext, dt, joint->dq(), joint->ddq());
+            } else {
+                joint->dq() = 0.0;
+                joint->ddq() = 0.0;
+            }
+        }
+
+        body->calcForwardKinematics(true, true);
+        const Vector6 f = calcInverseDynamics(root);
+
+        MultiValueSeq::Frame torques = out_torqueSeq.frame(frame);
+        for(int i=0; i < numJoints; ++i){
+            torques[i] = body->joint(i)->u();
+        }
+        Vector3& zmp = out_zmpSeq[frame];
+        if(f[2] > 0.0){
+            zmp << -f[4] / f[2], f[3] / f[2], 0.0;
+        } else {
+            zmp.setZero();
+        }
+    }
+};
+
+}
+
+
+bool cnoid::calcInverseDynamicsSeq
+(BodyMotion& motion, Body* body, MultiValueSeq& out_torqueSeq, ZMPSeq& out_zmpSeq)
+{
+    const int numFrames = motion.numFrames();
+    if(numFrames == 0){
+        return false;
+    }
+    
+    out_torqueSeq.setFrameRate(motion.frameRate());
+    out_torqueSeq.setDimension(numFrames, body->numJoints());
+    out_zmpSeq.setFrameRate(motion.frameRate());
+    out_zmpSeq.setNumFrames(numFrames);
+    out_zmpSeq.setRootRelative(false);
+
+    InverseDynamicsSeqCalculator calculator(motion, out_torqueSeq, out_zmpSeq);
+
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int numBodies = std::min(scheduler->concurrency(), numFrames);
+    vector<BodyPtr> bodies(numBodies);
+    for(int i=0; i < numBodies; ++i){
+        bodies[i] = body->clone();
+        calculator.freeBodies.push_back(bodies[i].get());
+    }
+
+    // Each thread processes the frames in ranges so that the bodies are not exchanged too often
+    const int grainSize = std::max(1, std::min(64, numFrames / (numBodies * 4)));
+    scheduler->parallelForRanges(
+        0, numFrames, boost::bind(&InverseDynamicsSeqCalculator::calc, &calculator, _1, _2), grainSize);
+
+    return true;
+}
+
+
 bool cnoid::loadHrpsysSeqFileSet(BodyMotion& motion, const std::string& filename, std::ostream& os)
 {
     motion.setNumFrames(0);
@@ -399,44 +563,70 @@ bool cnoid::applyVelocityLimitFilterDummy()
 }
 
 
+namespace {
+
+struct VelocityLimitFilter
+{
+    MultiValueSeq* seq;
+    vector<int> partIndices;
+    vector<double> deltaUVLimits;
+    vector<double> deltaLVLimits;
+    double deltaKs;
+    bool usePollardMethod;
+
+    void apply(int index) {
+        // The buffers are allocated for each part so that the parts can be processed in parallel
+        const int numFrames = seq->numFrames();
+        vector<double> forward(numFrames);
+        vector<double> backward(numFrames);
+        const int i = partIndices[index];
+        if(usePollardMethod){
+            applyPollardVelocityLimitFilterSub(
+                seq->part(i), deltaUVLimits[index], deltaLVLimits[index], deltaKs, forward, backward);
+        } else {
+            applyVelocityLimitFilterSub(
+                seq->part(i), deltaUVLimits[index], deltaLVLimits[index], forward, backward);
+        }
+    }
+};
+
+}
+
+
 static bool applyVelocityLimitFilterMain
 (MultiValueSeq& seq, Body* body, double ks, bool usePollardMethod, std::ostream& os)
 {
-    bool applied = false;
-    
     os << "applying the velocity limit filter ..." << endl;
     
     const int numParts = seq.numParts();
-    const int numFrames = seq.numFrames();
     const double frameRate = seq.frameRate();
-    const double deltaKs = ks / frameRate;
-    
-    vector<double> forward(numFrames);
-    vector<double> backward(numFrames);
+
+    VelocityLimitFilter filter;
+    filter.seq = &seq;
+    filter.deltaKs = ks / frameRate;
+    filter.usePollardMethod = usePollardMethod;
     
     int n = std::min(numParts, body->numJoints());
     for(int i=0; i < n; ++i){
         Link* joint = body->joint(i);
         if(joint->dq_upper() != std::numeric_limits<double>::max() ||
            joint->dq_lower() != -std::numeric_limits<double>::max()){
-            const double deltaUVLimit = joint->dq_upper() / frameRate;
-            const double deltaLVLimit = joint->dq_lower() / frameRate;
-            
             os << str(format(" seq %1%: lower limit = %2%, upper limit = %3%")
                       % i % joint->dq_lower() % joint->dq_upper()) << endl;
-
-            if(usePollardMethod){
-                applyPollardVelocityLimitFilterSub(
-                    seq.part(i), deltaUVLimit, deltaLVLimit, deltaKs, forward, backward);
-            } else {
-                applyVelocityLimitFilterSub(
-                    seq.part(i), deltaUVLimit, deltaLVLimit, forward, backward);
-            }
-                    
-            applied = true;
+            filter.partIndices.push_back(i);
+            filter.deltaUVLimits.push_back(joint->dq_upper() / frameRate);
+            filter.deltaLVLimits.push_back(joint->dq_lower() / frameRate);
         }
     }
-    return applied;
+
+    if(filter.partIndices.empty()){
+        return false;
+    }
+    if(seq.numFrames() > 0){
+        TaskScheduler::instance()->parallelFor(
+            0, filter.partIndices.size(), boost::bind(&VelocityLimitFilter::apply, &filter, _1));
+    }
+    return true;
 }
 
 
@@ -454,36 +644,116 @@ bool cnoid::applyVelocityLimitFilter
 }
 
 
+namespace {
+
+/**
+   The frames of the source are stored in a contiguous buffer, and each output frame is calculated
+   as the weighted sum of the source frames, which is vectorized over the parts of a frame.
+   The frames are independent of each other, so the ranges of them are processed in parallel.
+*/
+struct GaussianFilter
+{
+    MultiValueSeq* seq;
+    vector<double> orgseq;
+    vector<double> gwin;
+    int range;
+
+    void apply(int frameBegin, int frameEnd) {
+        typedef Eigen::Map<VectorXd> FrameMap;
+        typedef Eigen::Map<const VectorXd> ConstFrameMap;
+        const int numFrames = seq->numFrames();
+        const int numParts = seq->numParts();
+        for(int i=frameBegin; i < frameEnd; ++i){
+            FrameMap v(seq->frame(i).begin(), numParts);
+            v.setZero();
+            const int jBegin = std::max(-range, -i);
+            const int jEnd = std::min(range, numFrames - 1 - i);
+            double ave = 0.0;
+            for(int j=jBegin; j <= jEnd; ++j){
+                const double w = gwin[j + range];
+                v += w * ConstFrameMap(&orgseq[(i + j) * numParts], numParts);
+                ave += w;
+            }
+            // normalization for the head and tail frames whose window is truncated
+            if(jBegin > -range || jEnd < range){
+                v /= ave;
+            }
+        }
+    }
+};
+
+}
+
+
 void cnoid::applyGaussianFilter
 (MultiValueSeq& seq, double sigma, int range, std::ostream& os)
 {
-    vector<double> gwin;
-    setGaussWindow(sigma, range, gwin);
-    
-    vector<double> orgseq(seq.numFrames());
+    const int numFrames = seq.numFrames();
+    const int numParts = seq.numParts();
     
-    for(int i=0; i < seq.numParts(); ++i){
+    for(int i=0; i < numParts; ++i){
         if(i==0){
             os << str(format("applying the gaussian filter (sigma = %1%, range = %2%) to seq") %
                       sigma % range) << endl;
         }
         os << " " << i;
+    }
+
+    if(numFrames == 0 || numParts == 0){
+        return;
+    }
+    
+    GaussianFilter filter;
+    filter.seq = &seq;
+    filter.range = range;
+    setGaussWindow(sigma, range, filter.gwin);
+
+    filter.orgseq.resize(numFrames * numParts);
+    for(int i=0; i < numFrames; ++i){
+        MultiValueSeq::Frame frame = seq.frame(i);
+        std::copy(frame.begin(), frame.begin() + numParts, filter.orgseq.begin() + i * numParts);
+    }
+
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int grainSize = std::max(1, std::min(256, numFrames / (scheduler->concurrency() * 4)));
+    scheduler->parallelForRanges(
+        0, numFrames, boost::bind(&GaussianFilter::apply, &filter, _1, _2), grainSize);
+}
 
-        MultiValueSeq::Part part = seq.part(i);
-        std::copy(part.begin(), part.end(), orgseq.begin());
-        applyGaussianFilter(part, orgseq, gwin, 0.0);
+
+namespace {
+
+struct RangeLimitFilter
+{
+    MultiValueSeq* seq;
+    vector<int> partIndices;
+    vector<double> uppers;
+    vector<double> lowers;
+    double limitGrad;
+    double edgeGradRatio;
+
+    void apply(int index) {
+        // RangeLimiter has internal state, so each part uses its own one
+        RangeLimiter limiter;
+        MultiValueSeq::Part part = seq->part(partIndices[index]);
+        limiter.apply(part, uppers[index], lowers[index], limitGrad, edgeGradRatio);
     }
+};
+
 }
 
 
 void cnoid::applyRangeLimitFilter
 (MultiValueSeq& seq, Body* body, double limitGrad, double edgeGradRatio, double margin, std::ostream& os)
 {
-    RangeLimiter limiter;
-
     os << "applying the joint position range limit filter ..." << endl;
     
     const int numParts = seq.numParts();
+
+    RangeLimitFilter filter;
+    filter.seq = &seq;
+    filter.limitGrad = limitGrad;
+    filter.edgeGradRatio = edgeGradRatio;
     
     int n = std::min(numParts, body->numJoints());
     for(int i=0; i < n; ++i){
@@ -495,10 +765,15 @@ void cnoid::applyRangeLimitFilter
             if(upper > lower){
                 os << str(format(" seq %1%: lower limit = %2%, upper limit = %3%")
                           % i % joint->q_lower() % joint->q_upper()) << endl;
-
-                MultiValueSeq::Part part = seq.part(i);
-                limiter.apply(part, upper, lower, limitGrad, edgeGradRatio);
+                filter.partIndices.push_back(i);
+                filter.uppers.push_back(upper);
+                filter.lowers.push_back(lower);
             }
         }
     }
+
+    if(!filter.partIndices.empty()){
+        TaskScheduler::instance()->parallelFor(
+            0, filter.partIndices.size(), boost::bind(&RangeLimitFilter::apply, &filter, _1));
+    }
 }
@@ -17,6 +17,7 @@ class BodyMotion;
 class Vector3Seq;
 class MultiSE3Seq;
 class MultiValueSeq;
+class ZMPSeq;
 class PoseProvider;
 class AccelerationSensor;
 
@@ -29,6 +30,17 @@ CNOID_EXPORT bool saveHrpsysSeqFileSet(
 CNOID_EXPORT void calcLinkAccSeq(
     MultiSE3Seq& linkPosSeq, AccelerationSensor* gsens, int frameBegin, int numFrames, Vector3Seq& out_accSeq);
 
+/**
+   Calculate the joint torques and the ZMP of each frame with the inverse dynamics.
+   The velocities and accelerations are given by the central differences of the joint and root link positions.
+   The frames are divided among the threads of TaskScheduler, each of which uses its own copy of the body.
+   \param out_zmpSeq The ZMP in the world coordinate on the horizontal plane at the height of zero.
+   The ZMP of a frame without the upward ground reaction force is set to the zero vector.
+   \return false if the motion has no frames
+*/
+CNOID_EXPORT bool calcInverseDynamicsSeq(
+    BodyMotion& motion, Body* body, MultiValueSeq& out_torqueSeq, ZMPSeq& out_zmpSeq);
+
 CNOID_EXPORT bool applyVelocityLimitFilter(
     MultiValueSeq& seq, Body* body, std::ostream& os = nullout());
 
@@ -27,6 +27,8 @@ Camera::Camera()
     farClipDistance_ = 100.0;
     frameRate_ = 30.0;
     delay_ = 0.0;
+    lensDistortionK1_ = 0.0;
+    lensDistortionK2_ = 0.0;
     image_ = boost::make_shared<Image>();
 }
 
@@ -44,6 +46,7 @@ void Camera::copyStateFrom(const Camera& other)
 {
     copyCameraStateFrom(other);
     image_ = other.image_;
+    encodedImage_ = other.encodedImage_;
 }
 
 
@@ -59,12 +62,15 @@ void Camera::copyCameraStateFrom(const Camera& other)
     farClipDistance_ = other.farClipDistance_;
     frameRate_ = other.frameRate_;
     delay_ = other.delay_;
+    lensDistortionK1_ = other.lensDistortionK1_;
+    lensDistortionK2_ = other.lensDistortionK2_;
 }
 
 
 Camera::Camera(const Camera& org, bool copyStateOnly)
     : Device(org, copyStateOnly),
-      image_(org.image_)
+      image_(org.image_),
+      encodedImage_(org.encodedImage_)
 {
     copyCameraStateFrom(org);
 }
@@ -86,6 +92,7 @@ Camera::Camera(const Camera& org, int x /* dummy */)
     
     if(org.isImageStateClonable_){
         image_ = org.image_;
+        encodedImage_ = org.encodedImage_;
     } else {
         image_ = boost::make_shared<Image>();
     }
@@ -108,6 +115,10 @@ void Camera::forEachActualType(boost::function<bool(const std::type_info& type)>
 
 Image& Camera::image()
 {
+    if(!image_){
+        decodeImage();
+    }
+    encodedImage_.reset();
     if(image_.use_count() > 1){
         image_ = boost::make_shared<Image>(*image_);
     }
@@ -118,6 +129,7 @@ Image& Camera::image()
 Image& Camera::newImage()
 {
     image_ = boost::make_shared<Image>();
+    encodedImage_.reset();
     return *image_;
 }
 
@@ -130,6 +142,7 @@ void Camera::setImage(boost::shared_ptr<Image>& image)
         image_ = boost::make_shared<Image>(*image);
     }
     image.reset();
+    encodedImage_.reset();
 }
 
 
@@ -140,6 +153,34 @@ void Camera::clearState()
     } else {
         image_ = boost::make_shared<Image>();
     }
+    encodedImage_.reset();
+}
+
+
+void Camera::encodeImage(ImageIO::Format format, int jpegQuality)
+{
+    if(!image_ || image_->empty()){
+        return;
+    }
+    if(format == ImageIO::JPEG && image_->hasAlphaComponent()){
+        format = ImageIO::PNG;
+    }
+    boost::shared_ptr< std::vector<unsigned char> > data = boost::make_shared< std::vector<unsigned char> >();
+    ImageIO().saveToMemory(*image_, format, *data, jpegQuality);
+    encodedImage_ = data;
+    image_.reset();
+}
+
+
+/**
+   The decoded image is kept with the encoded data so that the image is decoded only once.
+*/
+void Camera::decodeImage() const
+{
+    image_ = boost::make_shared<Image>();
+    if(encodedImage_ && !encodedImage_->empty()){
+        ImageIO().loadFromMemory(*image_, &encodedImage_->front(), encodedImage_->size());
+    }
 }
 
 
@@ -7,7 +7,7 @@
 #define CNOID_BODY_CAMERA_H
 
 #include "Device.h"
-#include <cnoid/Image>
+#include <cnoid/ImageIO>
 #include <boost/shared_ptr.hpp>
 #include "exportdecl.h"
 
@@ -67,12 +67,37 @@ public:
     void setFrameRate(double r) { frameRate_ = r; }
     double frameRate() const { return frameRate_; }
 
+    /**
+       The radial lens distortion. The pixel at the normalized image coordinate p shows the point
+       rendered at p * (1 + k1 * r^2 + k2 * r^4) where r = |p|. The coordinate is normalized by
+       the focal length, and both the coefficients are zero by default.
+    */
+    void setLensDistortion(double k1, double k2) { lensDistortionK1_ = k1; lensDistortionK2_ = k2; }
+    double lensDistortionK1() const { return lensDistortionK1_; }
+    double lensDistortionK2() const { return lensDistortionK2_; }
+
     const Image& image() const;
-    const Image& constImage() const { return *image_; }
+    const Image& constImage() const {
+        if(!image_) decodeImage();
+        return *image_;
+    }
     Image& image();
     Image& newImage();
 
-    boost::shared_ptr<const Image> sharedImage() const { return image_; }
+    boost::shared_ptr<const Image> sharedImage() const {
+        constImage();
+        return image_;
+    }
+
+    /**
+       The image is replaced with the data encoded in an image file format to reduce the memory
+       of the recorded states. The encoded image is decoded when the image is accessed.
+       The image must not be accessed by the other threads during the encoding.
+       @param jpegQuality The quality of the lossy compression of the JPEG format
+       @note The JPEG format is not used for the images which have the alpha component.
+    */
+    void encodeImage(ImageIO::Format format, int jpegQuality = 90);
+    bool isImageEncoded() const { return !image_; }
 
     /**
        Move semantics. If the use_count() of the given shared image pointer is one,
@@ -98,10 +123,15 @@ private:
     double fieldOfView_;
     double frameRate_;
     double delay_;
-    boost::shared_ptr<Image> image_;
+    double lensDistortionK1_;
+    double lensDistortionK2_;
+    // This is null if the image is encoded
+    mutable boost::shared_ptr<Image> image_;
+    boost::shared_ptr< const std::vector<unsigned char> > encodedImage_;
 
     Camera(const Camera& org, int x);
     void copyCameraStateFrom(const Camera& other);
+    void decodeImage() const;
 };
 
 typedef ref_ptr<Camera> CameraPtr;
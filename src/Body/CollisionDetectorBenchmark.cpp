@@ -0,0 +1,422 @@
+/**
+   @file
+*/
+
+#include "CollisionDetectorBenchmark.h"
+#include "BodyCollisionDetectorUtil.h"
+#include "BodyLoader.h"
+#include "BodyMotion.h"
+#include "DyWorld.h"
+#include "DyBody.h"
+#include "ConstraintForceSolver.h"
+#include <cnoid/ValueTree>
+#include <cnoid/YAMLWriter>
+#include <cnoid/ExecutablePath>
+#include <cnoid/TimeMeasure>
+#include <cnoid/NullOut>
+#include <cnoid/MemoryUsageCounter>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <fstream>
+#include <algorithm>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+const double timeStep = 0.001;
+
+struct BenchmarkScene
+{
+    string name;
+    vector<BodyPtr> bodies;
+    vector<bool> selfCollisionFlags;
+    // The positions of all the links of the bodies in each frame
+    vector<PositionArray> frames;
+};
+
+double percentile(vector<double>& times, double ratio)
+{
+    if(times.empty()){
+        return 0.0;
+    }
+    const size_t index = std::min(times.size() - 1, (size_t)(ratio * (times.size() - 1) + 0.5));
+    std::nth_element(times.begin(), times.begin() + index, times.end());
+    return times[index];
+}
+
+void getLinkPositions(const vector<BodyPtr>& bodies, PositionArray& out_positions)
+{
+    out_positions.clear();
+    for(size_t i=0; i < bodies.size(); ++i){
+        Body* body = bodies[i];
+        for(int j=0; j < body->numLinks(); ++j){
+            out_positions.push_back(body->link(j)->T());
+        }
+    }
+}
+
+}
+
+namespace cnoid {
+
+class CollisionDetectorBenchmarkImpl
+{
+public:
+    ostream* os;
+    vector<string> detectorNames;
+    vector<int> threadCounts;
+    int maxNumFrames;
+    int numBinParts;
+    boost::function<void(CollisionDetector* detector)> configureDetector;
+    BodyLoader bodyLoader;
+    vector<BenchmarkScene> scenes;
+    MappingPtr results;
+
+    CollisionDetectorBenchmarkImpl();
+    BodyPtr loadModel(const string& path);
+    bool createBinScene(BenchmarkScene& scene);
+    bool createWalkingScene(BenchmarkScene& scene, const string& floorModel, bool doSelfCollisionDetection);
+    bool run();
+    void measure(BenchmarkScene& scene, const string& detectorName, Mapping* result);
+};
+
+}
+
+
+CollisionDetectorBenchmark::CollisionDetectorBenchmark()
+{
+    impl = new CollisionDetectorBenchmarkImpl;
+}
+
+
+CollisionDetectorBenchmarkImpl::CollisionDetectorBenchmarkImpl()
+{
+    os = &nullout();
+    threadCounts.push_back(1);
+    maxNumFrames = 1000;
+    numBinParts = 50;
+}
+
+
+CollisionDetectorBenchmark::~CollisionDetectorBenchmark()
+{
+    delete impl;
+}
+
+
+void CollisionDetectorBenchmark::setMessageSink(std::ostream& os)
+{
+    impl->os = &os;
+    impl->bodyLoader.setMessageSink(os);
+}
+
+
+void CollisionDetectorBenchmark::setDetectorNames(const std::vector<std::string>& names)
+{
+    impl->detectorNames = names;
+}
+
+
+void CollisionDetectorBenchmark::setThreadCounts(const std::vector<int>& counts)
+{
+    impl->threadCounts = counts;
+    if(impl->threadCounts.empty()){
+        impl->threadCounts.push_back(1);
+    }
+}
+
+
+void CollisionDetectorBenchmark::setMaxNumFrames(int n)
+{
+    impl->maxNumFrames = std::max(1, n);
+}
+
+
+void CollisionDetectorBenchmark::setNumBinParts(int n)
+{
+    impl->numBinParts = std::max(0, n);
+}
+
+
+void CollisionDetectorBenchmark::setDetectorConfigurationFunction(boost::function<void(CollisionDetector* detector)> func)
+{
+    impl->configureDetector = func;
+}
+
+
+BodyPtr CollisionDetectorBenchmarkImpl::loadModel(const string& path)
+{
+    const string filename = (filesystem::path(shareDirectory()) / "model" / path).string();
+    BodyPtr body = new DyBody;
+    if(!bodyLoader.load(body, filename)){
+        (*os) << format(_("The model file \"%1%\" cannot be loaded.")) % filename << endl;
+        return 0;
+    }
+    body->calcForwardKinematics();
+    return body;
+}
+
+
+bool CollisionDetectorBenchmark::run()
+{
+    return impl->run();
+}
+
+
+bool CollisionDetectorBenchmarkImpl::run()
+{
+    scenes.clear();
+    scenes.resize(3);
+    bool created = createBinScene(scenes[0]);
+    created &= createWalkingScene(scenes[1], "", true);
+    created &= createWalkingScene(scenes[2], "misc/unevenfloor.wrl", false);
+    if(!created){
+        return false;
+    }
+
+    vector<string> names = detectorNames;
+    if(names.empty()){
+        for(int i=0; i < CollisionDetector::numFactories(); ++i){
+            const string name = CollisionDetector::factoryName(i);
+            if(name != "NullCollisionDetector"){
+                names.push_back(name);
+            }
+        }
+    }
+
+    results = new Mapping();
+    results->write("timeUnit", "ms");
+    results->write("memoryUnit", "KiB");
+    Listing& sceneList = *results->createListing("scenes");
+    for(size_t i=0; i < scenes.size(); ++i){
+        BenchmarkScene& scene = scenes[i];
+        Mapping* sceneInfo = sceneList.newMapping();
+        sceneInfo->write("name", scene.name);
+        sceneInfo->write("numFrames", (int)scene.frames.size());
+        sceneInfo->write("numGeometries", scene.frames.empty() ? 0 : (int)scene.frames.front().size());
+        Listing& detectorList = *sceneInfo->createListing("detectors");
+        for(size_t j=0; j < names.size(); ++j){
+            Mapping* result = detectorList.newMapping();
+            result->write("name", names[j]);
+            measure(scene, names[j], result);
+        }
+    }
+    return true;
+}
+
+
+/**
+   The trajectories of the parts are recorded by simulating the parts dropped into the bin
+*/
+bool CollisionDetectorBenchmarkImpl::createBinScene(BenchmarkScene& scene)
+{
+    scene.name = "bin";
+
+    BodyPtr bin = loadModel("benchmark/bin.body");
+    if(!bin){
+        return false;
+    }
+    World<ConstraintForceSolver> world;
+    world.setGravityAcceleration(Vector3(0.0, 0.0, -9.80665));
+    world.setTimeStep(timeStep);
+    world.setCurrentTime(0.0);
+    world.addBody(static_cast<DyBody*>(bin.get()));
+    scene.bodies.push_back(bin);
+
+    // The parts are dropped from a grid of 4 x 4 positions above the bin
+    for(int i=0; i < numBinParts; ++i){
+        BodyPtr part = loadModel("benchmark/part.body");
+        if(!part){
+            return false;
+        }
+        const int layer = i / 16;
+        const double x = ((i % 16) % 4 - 1.5) * 0.12;
+        const double y = ((i % 16) / 4 - 1.5) * 0.12;
+        part->rootLink()->p() << x, y, 0.4 + layer * 0.08;
+        part->calcForwardKinematics();
+        world.addBody(static_cast<DyBody*>(part.get()));
+        scene.bodies.push_back(part);
+    }
+    scene.selfCollisionFlags.resize(scene.bodies.size(), false);
+
+    (*os) << format(_("Recording the motions of %1% parts dropped into the bin ...")) % numBinParts << endl;
+
+    world.initialize();
+    scene.frames.resize(maxNumFrames);
+    for(int i=0; i < maxNumFrames; ++i){
+        world.constraintForceSolver.clearExternalForces();
+        world.calcNextState();
+        getLinkPositions(scene.bodies, scene.frames[i]);
+    }
+    return true;
+}
+
+
+/**
+   The frames are sampled from the whole walking pattern of SR1
+*/
+bool CollisionDetectorBenchmarkImpl::createWalkingScene
+(BenchmarkScene& scene, const string& floorModel, bool doSelfCollisionDetection)
+{
+    scene.name = doSelfCollisionDetection ? "humanoidSelfCollision" : "terrain";
+
+    if(!floorModel.empty()){
+        BodyPtr floor = loadModel(floorModel);
+        if(!floor){
+            return false;
+        }
+        scene.bodies.push_back(floor);
+        scene.selfCollisionFlags.push_back(false);
+    }
+    BodyPtr robot = loadModel("SR1/SR1.body");
+    if(!robot){
+        return false;
+    }
+    scene.bodies.push_back(robot);
+    scene.selfCollisionFlags.push_back(doSelfCollisionDetection);
+
+    const string motionFile = (filesystem::path(shareDirectory()) / "motion" / "SR1" / "SR1WalkPattern.yaml").string();
+    BodyMotion motion;
+    if(!motion.loadStandardYAMLformat(motionFile)){
+        (*os) << format(_("The motion file \"%1%\" cannot be loaded.")) % motionFile << endl;
+        return false;
+    }
+    const MultiValueSeqPtr qSeq = motion.jointPosSeq();
+    const MultiSE3SeqPtr rootSeq = motion.linkPosSeq();
+    const int numMotionFrames = motion.numFrames();
+    const int numFrames = std::min(maxNumFrames, numMotionFrames);
+    const int numJoints = std::min(robot->numAllJoints(), qSeq->numParts());
+    Link* rootLink = robot->rootLink();
+
+    scene.frames.resize(numFrames);
+    for(int i=0; i < numFrames; ++i){
+        const int frame = (int)((double)i * numMotionFrames / numFrames);
+        if(frame < qSeq->numFrames()){
+            MultiValueSeq::Frame q = qSeq->frame(frame);
+            for(int j=0; j < numJoints; ++j){
+                robot->joint(j)->q() = q[j];
+            }
+        }
+        if(rootSeq->numParts() > 0 && frame < rootSeq->numFrames()){
+            const SE3& position = rootSeq->at(frame, 0);
+            rootLink->p() = position.translation();
+            rootLink->R() = position.rotation().toRotationMatrix();
+        }
+        robot->calcForwardKinematics();
+        getLinkPositions(scene.bodies, scene.frames[i]);
+    }
+    return true;
+}
+
+
+void CollisionDetectorBenchmarkImpl::measure(BenchmarkScene& scene, const string& detectorName, Mapping* result)
+{
+    const int factoryIndex = CollisionDetector::factoryIndex(detectorName);
+    if(factoryIndex < 0){
+        result->write("available", false);
+        return;
+    }
+
+    (*os) << format(_("Measuring %1% with the \"%2%\" scene ...")) % detectorName % scene.name << endl;
+
+    const long memory0 = getResidentMemorySize();
+
+    CollisionDetectorPtr detector = CollisionDetector::create(factoryIndex);
+    detector->enableGeometryCache(false);
+    if(configureDetector){
+        configureDetector(detector.get());
+    }
+    bool isMultithreadingSupported = detector->setNumThreads(threadCounts.front());
+    for(size_t i=0; i < scene.bodies.size(); ++i){
+        addBodyToCollisionDetector(*scene.bodies[i], *detector, scene.selfCollisionFlags[i]);
+    }
+    const int numGeometries = detector->numGeometries();
+    if(!scene.frames.empty()){
+        detector->updatePositions(0, numGeometries, scene.frames.front());
+    }
+
+    TimeMeasure timer;
+    timer.begin();
+    const bool isReady = detector->makeReady();
+    timer.end();
+    result->write("makeReadyTime", timer.time() * 1.0e3);
+
+    const long memory1 = getResidentMemorySize();
+    if(memory0 >= 0 && memory1 >= 0){
+        result->write("memoryIncrease", (double)(memory1 - memory0) / 1024.0);
+    }
+    if(!isReady){
+        result->write("ready", false);
+        return;
+    }
+
+    Listing& runs = *result->createListing("runs");
+    CollisionPairArray collisionPairs;
+    vector<double> times(scene.frames.size());
+
+    for(size_t i=0; i < threadCounts.size(); ++i){
+        if(i > 0){
+            if(!isMultithreadingSupported){
+                break;
+            }
+            // The number of the threads is applied in makeReady()
+            detector->setNumThreads(threadCounts[i]);
+            detector->makeReady();
+        }
+        int totalPairs = 0;
+        int totalContacts = 0;
+        int maxContacts = 0;
+        for(size_t frame=0; frame < scene.frames.size(); ++frame){
+            detector->updatePositions(0, numGeometries, scene.frames[frame]);
+            timer.begin();
+            detector->detectCollisions(collisionPairs);
+            timer.end();
+            times[frame] = timer.time();
+
+            int numContacts = 0;
+            for(size_t j=0; j < collisionPairs.size(); ++j){
+                numContacts += collisionPairs[j].collisions.size();
+            }
+            totalPairs += collisionPairs.size();
+            totalContacts += numContacts;
+            maxContacts = std::max(maxContacts, numContacts);
+        }
+
+        const double numFrames = std::max((size_t)1, scene.frames.size());
+        double totalTime = 0.0;
+        for(size_t frame=0; frame < times.size(); ++frame){
+            totalTime += times[frame];
+        }
+        Mapping* run = runs.newMapping();
+        run->setFlowStyle(true);
+        if(isMultithreadingSupported){
+            run->write("threads", threadCounts[i]);
+        } else {
+            run->write("threads", "unsupported");
+        }
+        run->write("mean", totalTime / numFrames * 1.0e3);
+        run->write("p50", percentile(times, 0.5) * 1.0e3);
+        run->write("p99", percentile(times, 0.99) * 1.0e3);
+        run->write("max", percentile(times, 1.0) * 1.0e3);
+        run->write("collisionPairs", totalPairs / numFrames);
+        run->write("contacts", totalContacts / numFrames);
+        run->write("maxContacts", maxContacts);
+    }
+}
+
+
+bool CollisionDetectorBenchmark::writeResults(const std::string& filename)
+{
+    if(!impl->results){
+        return false;
+    }
+    YAMLWriter writer(filename);
+    writer.setKeyOrderPreservationMode(true);
+    writer.putNode(impl->results.get());
+    return true;
+}
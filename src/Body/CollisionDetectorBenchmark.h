@@ -0,0 +1,73 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_COLLISION_DETECTOR_BENCHMARK_H
+#define CNOID_BODY_COLLISION_DETECTOR_BENCHMARK_H
+
+#include <cnoid/CollisionDetector>
+#include <boost/function.hpp>
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class CollisionDetectorBenchmarkImpl;
+
+/**
+   This class measures the collision detectors created by the factories of CollisionDetector
+   with the same geometries moved along the same trajectories. The following scenes are used.
+
+   - bin: The parts dropped into a bin. The trajectories are recorded by simulating the
+     scene with the AIST dynamics before the measurement.
+   - humanoidSelfCollision: The self collisions of SR1 walking along its walking pattern.
+   - terrain: SR1 walking along the walking pattern on an uneven floor of a mesh without
+     the self collisions.
+
+   For each scene and detector, the time of makeReady(), the increase of the resident memory
+   by adding the geometries and calling makeReady(), the time of detectCollisions() for each
+   frame with each number of threads, and the numbers of the collision pairs and the contact
+   points are measured. The detectors which do not support multiple threads are measured
+   only once. The geometry caches of the detectors are disabled so that the models are always
+   built in makeReady().
+*/
+class CNOID_EXPORT CollisionDetectorBenchmark
+{
+public:
+    CollisionDetectorBenchmark();
+    ~CollisionDetectorBenchmark();
+
+    void setMessageSink(std::ostream& os);
+
+    //! All the registered detectors except NullCollisionDetector are measured by default
+    void setDetectorNames(const std::vector<std::string>& names);
+
+    //! Only one thread is used by default
+    void setThreadCounts(const std::vector<int>& counts);
+
+    //! The maximum number of the frames of a scene. The default value is 1000.
+    void setMaxNumFrames(int n);
+
+    //! The default value is 50
+    void setNumBinParts(int n);
+
+    /**
+       The function is called for each created detector before the geometries are added.
+       This can be used to set the options specific to a detector class.
+    */
+    void setDetectorConfigurationFunction(boost::function<void(CollisionDetector* detector)> func);
+
+    bool run();
+
+    //! The results are written in the YAML format
+    bool writeResults(const std::string& filename);
+
+private:
+    CollisionDetectorBenchmarkImpl* impl;
+};
+
+}
+
+#endif
@@ -6,6 +6,10 @@
 #include "CompositeIK.h"
 #include "Link.h"
 #include "JointPath.h"
+#include "LinkPath.h"
+#include <cnoid/TaskScheduler>
+#include <boost/bind.hpp>
+#include <algorithm>
 
 using namespace std;
 using namespace boost;
@@ -16,11 +20,14 @@ CompositeIK::CompositeIK()
 {
     targetLink_ = 0;
     isAnalytical_ = false;
+    isParallelSolvingEnabled_ = false;
+    areJointPathsIndependent = true;
 }
 
 
 CompositeIK::CompositeIK(Body* body, Link* targetLink)
 {
+    isParallelSolvingEnabled_ = false;
     reset(body, targetLink);
 }
 
@@ -37,6 +44,8 @@ void CompositeIK::reset(Body* body, Link* targetLink)
     targetLink_ = targetLink;
     isAnalytical_ = false;
     pathList.clear();
+    pathLinks.clear();
+    areJointPathsIndependent = true;
 }
    
 
@@ -50,6 +59,16 @@ bool CompositeIK::addBaseLink(Link* baseLink)
             info.path = path;
             info.endLink = baseLink;
             pathList.push_back(info);
+
+            // The target link is shared by all the paths and it is not modified in solving the paths
+            LinkPath linkPath(targetLink_, baseLink);
+            for(int i=1; i < linkPath.numLinks(); ++i){
+                Link* link = linkPath[i];
+                if(std::find(pathLinks.begin(), pathLinks.end(), link) != pathLinks.end()){
+                    areJointPathsIndependent = false;
+                }
+                pathLinks.push_back(link);
+            }
             return true;
         }
     }
@@ -65,11 +84,18 @@ void CompositeIK::setMaxIKerror(double e)
 }
 
 
+void CompositeIK::setParallelSolvingEnabled(bool on)
+{
+    isParallelSolvingEnabled_ = on;
+}
+
+
 bool CompositeIK::hasAnalyticalIK() const
 {
     return isAnalytical_;
 }
 
+
 bool CompositeIK::calcInverseKinematics(const Vector3& p, const Matrix3& R)
 {
     const int n = body_->numJoints();
@@ -84,17 +110,21 @@ bool CompositeIK::calcInverseKinematics(const Vector3& p, const Matrix3& R)
     targetLink_->p() = p;
     targetLink_->R() = R;
     bool solved = true;
-    for(size_t i=0; i < pathList.size(); ++i){
-        PathInfo& info = pathList[i];
-        info.p_given = info.endLink->p();
-        info.R_given = info.endLink->R();
-        //solved = info.path->setGoal(p, R, info.p_given, info.R_given).calcInverseKinematics();
-        solved = info.path->calcInverseKinematics(p, R, info.p_given, info.R_given);
-        if(!solved){
-            break;
+    if(isParallelSolvingEnabled_ && areJointPathsIndependent && pathList.size() >= 2){
+        solved = solveJointPathsInParallel(p, R);
+    } else {
+        for(size_t i=0; i < pathList.size(); ++i){
+            PathInfo& info = pathList[i];
+            info.p_given = info.endLink->p();
+            info.R_given = info.endLink->R();
+            //solved = info.path->setGoal(p, R, info.p_given, info.R_given).calcInverseKinematics();
+            solved = info.path->calcInverseKinematics(p, R, info.p_given, info.R_given);
+            if(!solved){
+                break;
+            }
+            info.endLink->p() = info.p_given;
+            info.endLink->R() = info.R_given;
         }
-        info.endLink->p() = info.p_given;
-        info.endLink->R() = info.R_given;
     }
 
     if(!solved){
@@ -113,3 +143,103 @@ bool CompositeIK::calcInverseKinematics(const Vector3& p, const Matrix3& R)
 
     return solved;
 }
+
+
+bool CompositeIK::solveJointPathsInParallel(const Vector3& p, const Matrix3& R)
+{
+    const int numPaths = pathList.size();
+    solvedFlags.assign(numPaths, 0);
+    int numNumericalPaths = 0;
+    
+    for(int i=0; i < numPaths; ++i){
+        PathInfo& info = pathList[i];
+        info.p_given = info.endLink->p();
+        info.R_given = info.endLink->R();
+        if(info.path->hasAnalyticalIK()){
+            solvedFlags[i] = info.path->calcInverseKinematics(p, R, info.p_given, info.R_given);
+            if(!solvedFlags[i]){
+                return false;
+            }
+            info.endLink->p() = info.p_given;
+            info.endLink->R() = info.R_given;
+        } else {
+            ++numNumericalPaths;
+        }
+    }
+
+    if(numNumericalPaths == 1){
+        for(int i=0; i < numPaths; ++i){
+            solveNumericalJointPath(i);
+        }
+    } else if(numNumericalPaths >= 2){
+        TaskScheduler::instance()->parallelFor(
+            0, numPaths, boost::bind(&CompositeIK::solveNumericalJointPath, this, _1));
+    }
+
+    for(int i=0; i < numPaths; ++i){
+        if(!solvedFlags[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+   The given pose of the base link of the path, which is the target link, has already been set,
+   so it is not written here to avoid the concurrent writes from the other paths.
+*/
+void CompositeIK::solveNumericalJointPath(int index)
+{
+    PathInfo& info = pathList[index];
+    if(info.path->hasAnalyticalIK()){
+        return;
+    }
+    info.path->calcForwardKinematics();
+    if(info.path->calcInverseKinematics(info.p_given, info.R_given)){
+        solvedFlags[index] = 1;
+        info.endLink->p() = info.p_given;
+        info.endLink->R() = info.R_given;
+    }
+}
+
+
+namespace {
+
+struct CompositeIKBatch
+{
+    const std::vector<CompositeIK*>& iks;
+    const std::vector<Position, Eigen::aligned_allocator<Position> >& targets;
+    std::vector<char> solvedFlags;
+
+    CompositeIKBatch(const std::vector<CompositeIK*>& iks,
+                     const std::vector<Position, Eigen::aligned_allocator<Position> >& targets)
+        : iks(iks), targets(targets), solvedFlags(iks.size(), 0) { }
+
+    void solve(int index) {
+        const Position& T = targets[index];
+        solvedFlags[index] = iks[index]->calcInverseKinematics(T.translation(), T.linear());
+    }
+};
+
+}
+
+
+int cnoid::calcCompositeIKsInParallel
+(const std::vector<CompositeIK*>& iks, const std::vector<Position, Eigen::aligned_allocator<Position> >& targets,
+ std::vector<bool>& out_solved)
+{
+    const int n = std::min(iks.size(), targets.size());
+    CompositeIKBatch batch(iks, targets);
+    TaskScheduler::instance()->parallelFor(0, n, boost::bind(&CompositeIKBatch::solve, &batch, _1));
+
+    out_solved.assign(n, false);
+    int numSolved = 0;
+    for(int i=0; i < n; ++i){
+        if(batch.solvedFlags[i]){
+            out_solved[i] = true;
+            ++numSolved;
+        }
+    }
+    return numSolved;
+}
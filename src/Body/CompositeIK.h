@@ -26,6 +26,15 @@ public:
     bool addBaseLink(Link* link);
     void setMaxIKerror(double e);
 
+    /**
+       When this is enabled, the joint paths which are solved by the numerical IK are solved in
+       parallel by TaskScheduler if the paths have no common links except the target link.
+       The paths with the analytical IK are solved in the calling thread because they are fast enough.
+       The results are the same as those of the sequential solving.
+    */
+    void setParallelSolvingEnabled(bool on);
+    bool isParallelSolvingEnabled() const { return isParallelSolvingEnabled_; }
+
     Body* body() { return body_; }
     Link* targetLink() { return targetLink_; }
     int numJointPaths() const { return pathList.size(); }
@@ -46,11 +55,28 @@ private:
     };
     std::vector<PathInfo> pathList;
     std::vector<double> q0;
+    std::vector<Link*> pathLinks;
+    std::vector<char> solvedFlags;
     bool isAnalytical_;
+    bool isParallelSolvingEnabled_;
+    bool areJointPathsIndependent;
+
+    bool solveJointPathsInParallel(const Vector3& p, const Matrix3& R);
+    void solveNumericalJointPath(int index);
 };
 
 typedef boost::shared_ptr<CompositeIK> CompositeIKPtr;
 
+/**
+   Solve the IK problems of CompositeIK instances in parallel with TaskScheduler.
+   The instances must have different bodies.
+   @param targets The positions of the target links
+   @return The number of the solved instances
+*/
+CNOID_EXPORT int calcCompositeIKsInParallel(
+    const std::vector<CompositeIK*>& iks, const std::vector<Position, Eigen::aligned_allocator<Position> >& targets,
+    std::vector<bool>& out_solved);
+
 }
 
 #endif
@@ -19,12 +19,14 @@
 #include <cnoid/EigenUtil>
 #include <cnoid/AISTCollisionDetector>
 #include <cnoid/TimeMeasure>
+#include <cnoid/TaskScheduler>
 #include <boost/format.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/random.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
 #include <limits>
+#include <algorithm>
 
 #include <fstream>
 #include <iomanip>
@@ -144,9 +146,36 @@ public:
         int globalFrictionIndex;
         int numFrictionVectors;
         Vector3 frictionVector[4][2];
+        int featureId[2]; // ids of the colliding triangles of a contact
+        Vector3 force; // the force acting on link[1] in the last solution
+        int persistentContactIndex; // index of the persistent contact of a speculative contact, or -1
     };
     typedef std::vector<ConstraintPoint> ConstraintPointArray;
 
+    /**
+       A contact point of a link pair in the previous step. The points on the surfaces of the links
+       are expressed in the local frames of the links, and the normal toward the inside of link[1]
+       is expressed in the frame of link[0].
+    */
+    struct PersistentContact {
+        Vector3 localPoint[2];
+        Vector3 localNormal;
+        int featureId[2];
+    };
+    typedef std::vector<PersistentContact> PersistentContactArray;
+
+    /**
+       The solution of a constraint point in the previous step.
+       The point and the friction force are expressed in the local frame of link[0].
+    */
+    struct CachedConstraintForce {
+        Vector3 localPoint;
+        int featureId[2];
+        double normalForce;
+        Vector3 localFrictionForce;
+    };
+    typedef std::vector<CachedConstraintForce> CachedConstraintForceArray;
+
     struct LinkData
     {
         Vector3 dvo;
@@ -162,15 +191,41 @@ public:
     };
     typedef std::vector<LinkData> LinkDataArray;
 
+    /**
+       The states of a link which are compared every step while the body is sleeping.
+       The body is woken up when one of them is changed by a controller or an external force.
+    */
+    struct SleepingLinkState
+    {
+        double q;
+        double u;
+        Vector3 f_ext;
+        Vector3 tau_ext;
+    };
+
+    struct SleepingState
+    {
+        bool isSleeping;
+        double restTime; // time for which the velocities have been below the thresholds
+        Vector3 rootPosition;
+        Matrix3 rootAttitude;
+        std::vector<SleepingLinkState> links;
+    };
+
     struct BodyData
     {
         DyBodyPtr body;
-        bool isStatic;
+        bool isStatic; // true for a sleeping body, too
         bool hasConstrainedLinks;
         bool isTestForceBeingApplied;
         int geometryId;
         LinkDataArray linksData;
 
+        bool canSleep;
+        bool isMoving;
+        bool isWakeUpRequested;
+        SleepingState sleeping;
+
         Vector3 dpf;
         Vector3 dptau;
 
@@ -223,6 +278,7 @@ public:
     class LinkPair
     {
     public:
+        LinkPair() : islandIndex(0), cachedForceFrame(-1), collisionFrame(-1), persistentContactFrame(-1) { }
         virtual ~LinkPair() { }
         bool isSameBodyPair;
         int bodyIndex[2];
@@ -232,9 +288,18 @@ public:
         ConstraintPointArray constraintPoints;
         bool isNonContactConstraint;
         ContactAttributeEx attr;
+        int islandIndex;
+        CachedConstraintForceArray cachedForces;
+        int cachedForceFrame; // frame in which cachedForces was stored
+        int collisionFrame; // frame in which the pair was detected by the collision detector
+        PersistentContactArray persistentContacts;
+        int persistentContactFrame; // frame in which persistentContacts was stored
     };
 
     CollisionDetectorPtr collisionDetector;
+    // The buffers reused in every step
+    PositionArray linkPositions;
+    CollisionPairArray collisionPairs;
     vector<int> geometryIdToBodyIndexMap;
     typedef std::map<IdPair<>, LinkPair> GeometryPairToLinkPairMap;
     GeometryPairToLinkPairMap geometryPairToLinkPairMap;
@@ -269,6 +334,14 @@ public:
 
     std::vector<LinkPair*> constrainedLinkPairs;
 
+    double speculativeContactMargin;
+    // The contact link pairs which have the persistent contacts of the previous step
+    std::vector<LinkPair*> persistentLinkPairs;
+    std::vector<LinkPair*> nextPersistentLinkPairs;
+    PersistentContactArray persistentContactsBuf;
+    std::vector< std::pair<Vector3, Vector3> > persistentContactPoints;
+    std::vector<char> isPersistentContactMatched;
+
     int globalNumConstraintVectors;
 
     int globalNumContactNormalVectors;
@@ -305,6 +378,103 @@ public:
     VectorX contactIndexToMu;
     VectorX mcpHi;
 
+    /**
+       A set of the constrained link pairs which are coupled through non-static bodies.
+       The MCP of an island can be solved independently of the other islands.
+    */
+    struct Island
+    {
+        std::vector<LinkPair*> linkPairs;
+        std::vector<int> globalIndices; // constraint index in the global MCP of each local index
+        int numContactNormalVectors;
+        int numConstraintVectors;
+        MatrixX M;
+        VectorX b;
+        VectorX x;
+        VectorX mu;
+        VectorX hi;
+        std::vector<int> frictionIndexToContactIndex;
+    };
+    std::vector<Island> islands;
+    int numIslands;
+    std::vector<int> islandParents;
+    std::vector<int> islandRootToIslandIndex;
+    int currentIslandIndex;
+    bool isIslandDecompositionEnabled;
+
+    /**
+       Block-sparse storage of the MCP matrix. The rows of the constraints in a link pair
+       share the column spans of the link pairs coupled with it through non-static bodies,
+       and only the elements in the spans are stored because the others are always zero.
+    */
+    struct BlockSparseMatrix
+    {
+        struct Span
+        {
+            int begin;
+            int end;
+            int offset; // position of the element of column 'begin' in a row
+        };
+        struct RowBlock
+        {
+            std::vector<Span> spans;
+            int numCols;
+        };
+        std::vector<RowBlock> rowBlocks; // one block for each link pair
+        std::vector<int> rowToRowBlockIndex;
+        std::vector<int> rowTops; // position of the first element of each row in 'values'
+        std::vector<int> diagonalPositions;
+        std::vector<double> values;
+
+        int rows() const { return rowTops.size(); }
+
+        double* find(int row, int col) {
+            const std::vector<Span>& spans = rowBlocks[rowToRowBlockIndex[row]].spans;
+            for(size_t i=0; i < spans.size(); ++i){
+                const Span& span = spans[i];
+                if(col >= span.begin && col < span.end){
+                    return &values[rowTops[row] + span.offset + (col - span.begin)];
+                }
+            }
+            return 0;
+        }
+        double& coeffRef(int row, int col) {
+            return *find(row, col);
+        }
+        double coeff(int row, int col) const {
+            const double* p = const_cast<BlockSparseMatrix*>(this)->find(row, col);
+            return p ? *p : 0.0;
+        }
+        double operator()(int row, int col) const {
+            if(row == col){
+                return values[diagonalPositions[row]];
+            }
+            return coeff(row, col);
+        }
+
+        // counterpart of Eigen::Block used for setting the elements of a sub matrix
+        class Block
+        {
+        public:
+            Block(BlockSparseMatrix& M, int rowOffset, int colOffset)
+                : M(M), rowOffset(rowOffset), colOffset(colOffset) { }
+            double& operator()(int row, int col) {
+                return M.coeffRef(rowOffset + row, colOffset + col);
+            }
+        private:
+            BlockSparseMatrix& M;
+            int rowOffset;
+            int colOffset;
+        };
+    };
+    bool isContactWarmStartEnabled;
+    int currentFrame;
+
+    BlockSparseMatrix sparseMlcp;
+    std::vector< std::vector<int> > bodyIndexToLinkPairIndices;
+    std::vector<int> coupledLinkPairIndices;
+    bool isBlockSparseMatrixEnabled;
+
     int  maxNumGaussSeidelIteration;
     int  numGaussSeidelInitialIteration;
     double gaussSeidelErrorCriterion;
@@ -315,36 +485,62 @@ public:
     int numGaussSeidelTotalCalls;
     int numGaussSeidelTotalLoopsMax;
 
+    bool isSleepingEnabled;
+    double sleepingLinearVelocityThreshold;
+    double sleepingAngularVelocityThreshold;
+    double sleepingTime;
+    int numSleepingBodies;
+
     void initBody(const DyBodyPtr& body, BodyData& bodyData);
     void initExtraJoints(int bodyIndex);
     void init2Dconstraint(int bodyIndex);
+    void updateSleepingStates();
+    bool isBodyAtRest(BodyData& bodyData);
+    bool isSleepingBodyDisturbed(BodyData& bodyData);
+    void putBodyToSleep(int bodyIndex);
+    void wakeUpBody(int bodyIndex);
+    void setBodySleeping(int bodyIndex, bool on);
     void setConstraintPoints();
     void setDefaultContactAttributeValues(ContactAttributeEx& attr);
     void extractConstraintPoints(const CollisionPair& collisionPair);
-    bool setContactConstraintPoint(LinkPair& linkPair, const Collision& collision);
+    bool setContactConstraintPoint(LinkPair& linkPair, const Collision& collision, int persistentContactIndex = -1);
+    void setSpeculativeConstraintPoints();
+    void addSpeculativeConstraintPoints(LinkPair& linkPair);
+    void storePersistentContacts(LinkPair& linkPair);
     void setFrictionVectors(ConstraintPoint& constraintPoint);
     void setExtraJointConstraintPoints(const ExtraJointLinkPairPtr& linkPair);
     void set2dConstraintPoints(const Constrain2dLinkPairPtr& linkPair);
     void putContactPoints();
+    void extractIslands();
+    int findIslandRoot(int bodyIndex);
+    void solveIslands();
+    void solveIsland(Island& island);
     void solveImpactConstraints();
     void initMatrices();
     void setAccelCalcSkipInformation();
     void setDefaultAccelerationVector();
+    void setBlockSparseMatrixStructure();
     void setAccelerationMatrix();
+    template<class TBlock>
+    void setAccelerationMatrixBlocks(TBlock& Knn, TBlock& Ktn, TBlock& Knt, TBlock& Ktt);
     void initABMForceElementsWithNoExtForce(BodyData& bodyData);
     void calcABMForceElementsWithTestForce(BodyData& bodyData, DyLink* linkToApplyForce, const Vector3& f, const Vector3& tau);
     void calcAccelsABM(BodyData& bodyData, int constraintIndex);
     void calcAccelsMM(BodyData& bodyData, int constraintIndex);
 
+    template<class TBlock>
     void extractRelAccelsOfConstraintPoints
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, int testForceIndex, int constraintIndex);
+    (TBlock& Kxn, TBlock& Kxt, int testForceIndex, int constraintIndex);
 
+    template<class TBlock>
     void extractRelAccelsFromLinkPairCase1
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int testForceIndex, int constraintIndex);
+    (TBlock& Kxn, TBlock& Kxt, LinkPair& linkPair, int testForceIndex, int constraintIndex);
+    template<class TBlock>
     void extractRelAccelsFromLinkPairCase2
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int iTestForce, int iDefault, int testForceIndex, int constraintIndex);
+    (TBlock& Kxn, TBlock& Kxt, LinkPair& linkPair, int iTestForce, int iDefault, int testForceIndex, int constraintIndex);
+    template<class TBlock>
     void extractRelAccelsFromLinkPairCase3
-    (Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int testForceIndex, int constraintIndex);
+    (TBlock& Kxn, TBlock& Kxt, LinkPair& linkPair, int testForceIndex, int constraintIndex);
 
     void copySymmetricElementsOfAccelerationMatrix
     (Eigen::Block<MatrixX>& Knn, Eigen::Block<MatrixX>& Ktn, Eigen::Block<MatrixX>& Knt, Eigen::Block<MatrixX>& Ktt);
@@ -354,13 +550,37 @@ public:
     void setConstantVectorAndMuBlock();
     void addConstraintForceToLinks();
     void addConstraintForceToLink(LinkPair* linkPair, int ipair);
+    void setInitialSolutionFromCachedForces();
+    void storeCachedForces();
+
+    /**
+       The dimensions and the friction related arrays of an MCP solved by the Gauss-Seidel method.
+       The pointers refer to the arrays owned by the global problem or by an island.
+    */
+    struct MCPStructure
+    {
+        int numContactNormalVectors;
+        int numConstraintVectors;
+        int size;
+        const double* mu;
+        double* hi;
+        const int* frictionIndexToContactIndex;
+    };
+
+    MCPStructure globalMCPStructure();
 
+    static double calcOffDiagonalRowProduct(const MatrixX& M, const VectorX& x, int row, int size);
+    static double calcOffDiagonalRowProduct(const BlockSparseMatrix& M, const VectorX& x, int row, int size);
+
+    template<class TMatrix>
     void solveMCPByProjectedGaussSeidel
-    (const MatrixX& M, const VectorX& b, VectorX& x);
+    (const TMatrix& M, const VectorX& b, VectorX& x, const MCPStructure& mcp);
+    template<class TMatrix>
     void solveMCPByProjectedGaussSeidelMainStep
-    (const MatrixX& M, const VectorX& b, VectorX& x);
+    (const TMatrix& M, const VectorX& b, VectorX& x, const MCPStructure& mcp);
+    template<class TMatrix>
     void solveMCPByProjectedGaussSeidelInitial
-    (const MatrixX& M, const VectorX& b, VectorX& x, const int numIteration);
+    (const TMatrix& M, const VectorX& b, VectorX& x, const MCPStructure& mcp, const int numIteration);
 
     void checkLCPResult(MatrixX& M, VectorX& b, VectorX& x);
     void checkMCPResult(MatrixX& M, VectorX& b, VectorX& x);
@@ -413,6 +633,33 @@ public:
     }
 
     CollisionLinkPairListPtr getCollisions();
+    void getContacts(ContactBuffer& out_contacts);
+
+    //! A speculative contact is reported only when it actually supports the force
+    static bool isContactReported(const ConstraintPoint& constraint) {
+        return (constraint.persistentContactIndex < 0 || !constraint.force.isZero(0.0));
+    }
+
+    class State : public Referenced
+    {
+    public:
+        int currentFrame;
+        int numConstraintVectors;
+        int numContactNormalVectors;
+        int numFrictionVectors;
+        VectorX solution;
+        boost::mt19937 randomEngine;
+        typedef std::pair<int, CachedConstraintForceArray> CachedForces;
+        std::map<IdPair<>, CachedForces> geometryPairForces;
+        std::vector<CachedForces> extraJointForces;
+        std::vector<CachedForces> constrain2dForces;
+        std::vector<SleepingState> sleepingStates;
+        std::vector<LinkPair*> persistentLinkPairs;
+        std::vector<PersistentContactArray> persistentContacts;
+    };
+
+    ReferencedPtr storeState() const;
+    void restoreState(const State& state);
 
 #ifdef ENABLE_SIMULATION_PROFILING
     double collisionTime;
@@ -450,9 +697,21 @@ CFSImpl::ConstraintForceSolverImpl(WorldBase& world) :
     gaussSeidelErrorCriterion = DEFAULT_GAUSS_SEIDEL_ERROR_CRITERION;
     contactCorrectionDepth = DEFAULT_CONTACT_CORRECTION_DEPTH;
     contactCorrectionVelocityRatio = DEFAULT_CONTACT_CORRECTION_VELOCITY_RATIO;
+    speculativeContactMargin = 0.0;
 
     isConstraintForceOutputMode = false;
     is2Dmode = false;
+    isIslandDecompositionEnabled = false;
+    isBlockSparseMatrixEnabled = false;
+    isContactWarmStartEnabled = false;
+    isSleepingEnabled = false;
+    sleepingLinearVelocityThreshold = 0.005;
+    sleepingAngularVelocityThreshold = 0.02;
+    sleepingTime = 0.5;
+    numSleepingBodies = 0;
+    currentFrame = 0;
+    numIslands = 0;
+    currentIslandIndex = 0;
 }
 
 
@@ -472,6 +731,12 @@ void CFSImpl::initBody(const DyBodyPtr& body, BodyData& bodyData)
     bodyData.hasConstrainedLinks = false;
     bodyData.isTestForceBeingApplied = false;
     bodyData.isStatic = body->isStaticModel();
+    bodyData.canSleep = false;
+    bodyData.isMoving = false;
+    bodyData.isWakeUpRequested = false;
+    bodyData.sleeping.isSleeping = false;
+    bodyData.sleeping.restTime = 0.0;
+    bodyData.sleeping.links.clear();
 
     LinkDataArray& linksData = bodyData.linksData;
     const int n = body->numLinks();
@@ -521,6 +786,8 @@ void CFSImpl::initExtraJoints(int bodyIndex)
                 ConstraintPoint& constraint = linkPair->constraintPoints[k];
                 constraint.numFrictionVectors = 0;
                 constraint.globalFrictionIndex = numeric_limits<int>::max();
+                constraint.force.setZero();
+                constraint.persistentContactIndex = -1;
             }
             for(int k=0; k < 2; ++k){
                 linkPair->bodyIndex[k] = bodyIndex;
@@ -561,6 +828,8 @@ void CFSImpl::init2Dconstraint(int bodyIndex)
         ConstraintPoint& constraint = linkPair->constraintPoints[i];
         constraint.numFrictionVectors = 0;
         constraint.globalFrictionIndex = numeric_limits<int>::max();
+        constraint.force.setZero();
+        constraint.persistentContactIndex = -1;
         linkPair->globalYpositions[i] = (rootLink->R() * local2dConstraintPoints[i] + rootLink->p()).y();
     }
         
@@ -604,6 +873,7 @@ void CFSImpl::initialize(void)
     }
     geometryIdToBodyIndexMap.clear();
     geometryPairToLinkPairMap.clear();
+    persistentLinkPairs.clear();
 
     contactAttributeMap.clear();
 
@@ -637,13 +907,20 @@ void CFSImpl::initialize(void)
         if(is2Dmode && !body->isStaticModel()){
             init2Dconstraint(bodyIndex);
         }
+
+        // The bodies which are kept moving by the high-gain mode joints and the bodies
+        // with the constraints which are not contacts are not put to sleep
+        bodyData.canSleep =
+            !bodyData.isStatic && !bodyData.forwardDynamicsCBM && body->numExtraJoints() == 0 && !is2Dmode;
     }
 
     collisionDetector->makeReady();
+    numSleepingBodies = 0;
 
     prevGlobalNumConstraintVectors = 0;
     prevGlobalNumFrictionVectors = 0;
     numUnconverged = 0;
+    currentFrame = 0;
 
     randomAngle.engine().seed();
 
@@ -665,16 +942,29 @@ void CFSImpl::solve()
         os << "Time: " << world.currentTime() << std::endl;
     }
 
+    if(isSleepingEnabled || numSleepingBodies > 0){
+        updateSleepingStates();
+    }
+
     for(size_t i=0; i < bodiesData.size(); ++i){
         BodyData& data = bodiesData[i];
         data.hasConstrainedLinks = false;
         DyBodyPtr& body = data.body;
         const int n = body->numLinks();
+        if(data.sleeping.isSleeping){
+            // The links of a sleeping body do not move
+            for(int j=0; j < n; ++j){
+                body->link(j)->constraintForces().clear();
+            }
+            continue;
+        }
+        linkPositions.resize(n);
         for(int j=0; j < n; ++j){
             DyLink* link = body->link(j);
-            collisionDetector->updatePosition(data.geometryId + j, link->T());
+            linkPositions[j] = link->T();
             link->constraintForces().clear();
         }
+        collisionDetector->updatePositions(data.geometryId, data.geometryId + n, linkPositions);
     }
 
     globalNumConstraintVectors = 0;
@@ -706,6 +996,14 @@ void CFSImpl::solve()
             solveImpactConstraints();
         }
 
+        if(isIslandDecompositionEnabled){
+            extractIslands();
+        }
+
+        if(isBlockSparseMatrixEnabled){
+            setBlockSparseMatrixStructure();
+        }
+
         if(SKIP_REDUNDANT_ACCEL_CALC){
             setAccelCalcSkipInformation();
         }
@@ -729,10 +1027,18 @@ void CFSImpl::solve()
 #ifdef USE_PIVOTING_LCP
         isConverged = callPathLCPSolver(Mlcp, b, solution);
 #else
-        if(!USE_PREVIOUS_LCP_SOLUTION || constraintsSizeChanged){
+        if(isContactWarmStartEnabled){
+            setInitialSolutionFromCachedForces();
+        } else if(!USE_PREVIOUS_LCP_SOLUTION || constraintsSizeChanged){
             solution.setZero();
         }
-        solveMCPByProjectedGaussSeidel(Mlcp, b, solution);
+        if(isIslandDecompositionEnabled){
+            solveIslands();
+        } else if(isBlockSparseMatrixEnabled){
+            solveMCPByProjectedGaussSeidel(sparseMlcp, b, solution, globalMCPStructure());
+        } else {
+            solveMCPByProjectedGaussSeidel(Mlcp, b, solution, globalMCPStructure());
+        }
         isConverged = true;
 #endif
 
@@ -743,27 +1049,198 @@ void CFSImpl::solve()
         } else {
             if(CFS_DEBUG)
                 os << "LCP converged" << std::endl;
-            if(CFS_DEBUG_LCPCHECK){
+            if(CFS_DEBUG_LCPCHECK && !isBlockSparseMatrixEnabled){
                 // checkLCPResult(Mlcp, b, solution);
                 checkMCPResult(Mlcp, b, solution);
             }
 
             addConstraintForceToLinks();
+
+            if(isContactWarmStartEnabled){
+                storeCachedForces();
+            }
         }
     }
 
+    ++currentFrame;
     prevGlobalNumConstraintVectors = globalNumConstraintVectors;
     prevGlobalNumFrictionVectors = globalNumFrictionVectors;
 }
 
 
+/**
+   A body whose velocities have been below the thresholds for the sleeping time is put to sleep.
+   A sleeping body is treated as a static body: its forward dynamics is not calculated, its geometries
+   are static in the collision detector so that the pairs with the static and sleeping geometries are
+   not checked, and it is not coupled with the other bodies in the MCP.
+   It is woken up in the next step when a moving or woken-up body touches it or when its joint positions,
+   joint torques, external forces or root position are changed from outside the solver.
+*/
+void CFSImpl::updateSleepingStates()
+{
+    bool isGeometryStatusChanged = false;
+    const double dt = world.timeStep();
+    
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        BodyData& bodyData = bodiesData[i];
+        if(bodyData.sleeping.isSleeping){
+            if(!isSleepingEnabled || bodyData.isWakeUpRequested || isSleepingBodyDisturbed(bodyData)){
+                wakeUpBody(i);
+                // The sleeping bodies in contact with the body are also woken up in the next step
+                bodyData.isMoving = true;
+                isGeometryStatusChanged = true;
+            }
+        } else if(!bodyData.isStatic){
+            if(!isBodyAtRest(bodyData)){
+                bodyData.isMoving = true;
+                bodyData.sleeping.restTime = 0.0;
+            } else {
+                bodyData.isMoving = false;
+                if(isSleepingEnabled && bodyData.canSleep){
+                    bodyData.sleeping.restTime += dt;
+                    if(bodyData.sleeping.restTime >= sleepingTime){
+                        putBodyToSleep(i);
+                        isGeometryStatusChanged = true;
+                    }
+                }
+            }
+        }
+        bodyData.isWakeUpRequested = false;
+    }
+
+    if(isGeometryStatusChanged){
+        collisionDetector->makeReady();
+    }
+}
+
+
+bool CFSImpl::isBodyAtRest(BodyData& bodyData)
+{
+    const double lth2 = sleepingLinearVelocityThreshold * sleepingLinearVelocityThreshold;
+    const double ath2 = sleepingAngularVelocityThreshold * sleepingAngularVelocityThreshold;
+    
+    const DyBodyPtr& body = bodyData.body;
+    DyLink* rootLink = body->rootLink();
+    if(rootLink->v().squaredNorm() > lth2 || rootLink->w().squaredNorm() > ath2){
+        return false;
+    }
+    const int n = body->numLinks();
+    for(int i=1; i < n; ++i){
+        DyLink* link = body->link(i);
+        const double th = link->isSlideJoint() ? sleepingLinearVelocityThreshold : sleepingAngularVelocityThreshold;
+        if(fabs(link->dq()) > th){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool CFSImpl::isSleepingBodyDisturbed(BodyData& bodyData)
+{
+    const SleepingState& sleeping = bodyData.sleeping;
+    const DyBodyPtr& body = bodyData.body;
+    DyLink* rootLink = body->rootLink();
+    if(rootLink->p() != sleeping.rootPosition || rootLink->R() != sleeping.rootAttitude){
+        return true;
+    }
+    const int n = body->numLinks();
+    for(int i=0; i < n; ++i){
+        DyLink* link = body->link(i);
+        const SleepingLinkState& state = sleeping.links[i];
+        if(link->q() != state.q || link->u() != state.u ||
+           link->f_ext() != state.f_ext || link->tau_ext() != state.tau_ext){
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void CFSImpl::putBodyToSleep(int bodyIndex)
+{
+    BodyData& bodyData = bodiesData[bodyIndex];
+    SleepingState& sleeping = bodyData.sleeping;
+    const DyBodyPtr& body = bodyData.body;
+    const int n = body->numLinks();
+    sleeping.links.resize(n);
+    for(int i=0; i < n; ++i){
+        DyLink* link = body->link(i);
+        link->v().setZero();
+        link->w().setZero();
+        link->vo().setZero();
+        link->dv().setZero();
+        link->dw().setZero();
+        link->dvo().setZero();
+        link->dq() = 0.0;
+        link->ddq() = 0.0;
+        SleepingLinkState& state = sleeping.links[i];
+        state.q = link->q();
+        state.u = link->u();
+        state.f_ext = link->f_ext();
+        state.tau_ext = link->tau_ext();
+    }
+    DyLink* rootLink = body->rootLink();
+    sleeping.rootPosition = rootLink->p();
+    sleeping.rootAttitude = rootLink->R();
+
+    setBodySleeping(bodyIndex, true);
+}
+
+
+void CFSImpl::wakeUpBody(int bodyIndex)
+{
+    BodyData& bodyData = bodiesData[bodyIndex];
+    setBodySleeping(bodyIndex, false);
+    bodyData.sleeping.restTime = 0.0;
+}
+
+
+void CFSImpl::setBodySleeping(int bodyIndex, bool on)
+{
+    BodyData& bodyData = bodiesData[bodyIndex];
+    if(bodyData.sleeping.isSleeping == on){
+        return;
+    }
+    bodyData.sleeping.isSleeping = on;
+    bodyData.isStatic = on;
+    world.setBodySleeping(bodyIndex, on);
+    
+    if(on){
+        LinkDataArray& linksData = bodyData.linksData;
+        for(size_t i=0; i < linksData.size(); ++i){
+            linksData[i].dw.setZero();
+            linksData[i].dvo.setZero();
+        }
+        ++numSleepingBodies;
+    } else {
+        --numSleepingBodies;
+    }
+    
+    const int n = bodyData.body->numLinks();
+    for(int i=0; i < n; ++i){
+        collisionDetector->setGeometryStatic(bodyData.geometryId + i, on);
+    }
+}
+
+
 void CFSImpl::setConstraintPoints()
 {
 #ifdef ENABLE_SIMULATION_PROFILING
     timer.begin();
 #endif
 
-    collisionDetector->detectCollisions(boost::bind(&CFSImpl::extractConstraintPoints, this, _1));
+    {
+        SimulationProfiler::Scope scope(
+            world.profiler(), world.profilingStageId(WorldBase::COLLISION_DETECTION_STAGE));
+        collisionDetector->detectCollisions(collisionPairs);
+        for(size_t i=0; i < collisionPairs.size(); ++i){
+            extractConstraintPoints(collisionPairs[i]);
+        }
+        if(speculativeContactMargin > 0.0){
+            setSpeculativeConstraintPoints();
+        }
+    }
 
 #ifdef ENABLE_SIMULATION_PROFILING
         collisionTime = timer.measure();
@@ -829,6 +1306,7 @@ void CFSImpl::extractConstraintPoints(const CollisionPair& collisionPair)
     }
 
     const vector<Collision>& collisions = collisionPair.collisions;
+    pLinkPair->collisionFrame = currentFrame;
 
     CollisionHandler& collisionHandler = pLinkPair->attr.collisionHandler;
     if(collisionHandler){
@@ -839,10 +1317,22 @@ void CFSImpl::extractConstraintPoints(const CollisionPair& collisionPair)
     
     pLinkPair->bodyData[0]->hasConstrainedLinks = true;
     pLinkPair->bodyData[1]->hasConstrainedLinks = true;
+
+    if(numSleepingBodies > 0){
+        for(int i=0; i < 2; ++i){
+            BodyData* bodyData = pLinkPair->bodyData[i];
+            if(bodyData->sleeping.isSleeping && pLinkPair->bodyData[1 - i]->isMoving){
+                bodyData->isWakeUpRequested = true;
+            }
+        }
+    }
     
     for(size_t i=0; i < collisions.size(); ++i){
         setContactConstraintPoint(*pLinkPair, collisions[i]);
     }
+    if(speculativeContactMargin > 0.0){
+        addSpeculativeConstraintPoints(*pLinkPair);
+    }
 
     if(!pLinkPair->constraintPoints.empty()){
         constrainedLinkPairs.push_back(pLinkPair);
@@ -850,6 +1340,148 @@ void CFSImpl::extractConstraintPoints(const CollisionPair& collisionPair)
 }
 
 
+/**
+   The contacts of the previous step which are not detected in this step are kept as the speculative
+   contacts while the gaps of them are within the margin. The constraints of a speculative contact
+   only prevent the gap from being closed more than the gap itself in a step, so they are usually
+   inactive. However, they keep the contact sets of the resting bodies and the dimension of the MCP
+   stable between the steps, which keeps the warm start of the solver valid.
+*/
+void CFSImpl::setSpeculativeConstraintPoints()
+{
+    for(size_t i=0; i < persistentLinkPairs.size(); ++i){
+        LinkPair& linkPair = *persistentLinkPairs[i];
+        if(linkPair.collisionFrame == currentFrame || linkPair.attr.collisionHandler){
+            continue;
+        }
+        if(linkPair.bodyData[0]->isStatic && linkPair.bodyData[1]->isStatic){
+            continue;
+        }
+        linkPair.constraintPoints.clear();
+        addSpeculativeConstraintPoints(linkPair);
+        if(!linkPair.constraintPoints.empty()){
+            linkPair.bodyData[0]->hasConstrainedLinks = true;
+            linkPair.bodyData[1]->hasConstrainedLinks = true;
+            constrainedLinkPairs.push_back(&linkPair);
+        }
+    }
+
+    nextPersistentLinkPairs.clear();
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair* linkPair = constrainedLinkPairs[i];
+        storePersistentContacts(*linkPair);
+        nextPersistentLinkPairs.push_back(linkPair);
+    }
+    persistentLinkPairs.swap(nextPersistentLinkPairs);
+}
+
+
+void CFSImpl::addSpeculativeConstraintPoints(LinkPair& linkPair)
+{
+    if(linkPair.persistentContactFrame != currentFrame - 1){
+        return;
+    }
+    
+    DyLink* link0 = linkPair.link[0];
+    DyLink* link1 = linkPair.link[1];
+    const PersistentContactArray& contacts = linkPair.persistentContacts;
+    const int numContacts = contacts.size();
+    ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    const int numDetectedPoints = constraintPoints.size();
+    if(numDetectedPoints >= numContacts){
+        return;
+    }
+
+    persistentContactPoints.resize(numContacts);
+    isPersistentContactMatched.assign(numContacts, 0);
+    for(int i=0; i < numContacts; ++i){
+        const PersistentContact& contact = contacts[i];
+        persistentContactPoints[i].first = link0->p() + link0->R() * contact.localPoint[0];
+        persistentContactPoints[i].second = link1->p() + link1->R() * contact.localPoint[1];
+    }
+
+    /*
+      Each detected point takes over the nearest previous contact so that the previous contacts
+      which are not detected again are kept even if the detected points have moved a little.
+    */
+    const double maxDistance2 = linkPair.attr.contactCullingDistance * linkPair.attr.contactCullingDistance;
+    for(int i=0; i < numDetectedPoints; ++i){
+        const Vector3& point = constraintPoints[i].point;
+        int nearest = -1;
+        double minDistance2 = maxDistance2;
+        for(int j=0; j < numContacts; ++j){
+            if(!isPersistentContactMatched[j]){
+                const Vector3 p = 0.5 * (persistentContactPoints[j].first + persistentContactPoints[j].second);
+                const double d2 = (p - point).squaredNorm();
+                if(d2 < minDistance2){
+                    nearest = j;
+                    minDistance2 = d2;
+                }
+            }
+        }
+        if(nearest >= 0){
+            isPersistentContactMatched[nearest] = 1;
+        }
+    }
+
+    // The number of the contacts does not exceed that of the previous step
+    for(int i=0; i < numContacts && (int)constraintPoints.size() < numContacts; ++i){
+        if(isPersistentContactMatched[i]){
+            continue;
+        }
+        const Vector3& p0 = persistentContactPoints[i].first;
+        const Vector3& p1 = persistentContactPoints[i].second;
+        const Vector3 d = p1 - p0;
+        const PersistentContact& contact = contacts[i];
+        Collision collision;
+        collision.normal = link0->R() * contact.localNormal;
+        const double gap = collision.normal.dot(d);
+        if(gap > speculativeContactMargin){
+            continue;
+        }
+        // The contact is lost when the surfaces have slid on each other
+        if((d - gap * collision.normal).norm() > linkPair.attr.contactCullingDistance){
+            continue;
+        }
+        collision.point = 0.5 * (p0 + p1);
+        // The penetration which is not detected by the collision detector is not corrected
+        collision.depth = std::min(-gap, 0.0);
+        collision.id1 = contact.featureId[0];
+        collision.id2 = contact.featureId[1];
+        setContactConstraintPoint(linkPair, collision, i);
+    }
+}
+
+
+void CFSImpl::storePersistentContacts(LinkPair& linkPair)
+{
+    DyLink* link0 = linkPair.link[0];
+    DyLink* link1 = linkPair.link[1];
+    const ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+    persistentContactsBuf.resize(constraintPoints.size());
+
+    for(size_t i=0; i < constraintPoints.size(); ++i){
+        const ConstraintPoint& constraint = constraintPoints[i];
+        PersistentContact& contact = persistentContactsBuf[i];
+        if(constraint.persistentContactIndex >= 0){
+            // The surface points of a speculative contact are kept so that the sliding is accumulated
+            contact = linkPair.persistentContacts[constraint.persistentContactIndex];
+        } else {
+            const Vector3& n = constraint.normalTowardInside[1];
+            const Vector3 p0 = constraint.point + (0.5 * constraint.depth) * n;
+            const Vector3 p1 = constraint.point - (0.5 * constraint.depth) * n;
+            contact.localPoint[0] = link0->R().transpose() * (p0 - link0->p());
+            contact.localPoint[1] = link1->R().transpose() * (p1 - link1->p());
+            contact.localNormal = link0->R().transpose() * n;
+            contact.featureId[0] = constraint.featureId[0];
+            contact.featureId[1] = constraint.featureId[1];
+        }
+    }
+    linkPair.persistentContacts.swap(persistentContactsBuf);
+    linkPair.persistentContactFrame = currentFrame;
+}
+
+
 CollisionLinkPairListPtr CFSImpl::getCollisions()
 {
     CollisionLinkPairListPtr collisionPairs = boost::make_shared<CollisionLinkPairList>();
@@ -860,12 +1492,18 @@ CollisionLinkPairListPtr CFSImpl::getCollisions()
 
         for(int j=0; j < numConstraintsInPair; ++j){
             ConstraintPoint& constraint = source.constraintPoints[j];
+            if(!isContactReported(constraint)){
+                continue;
+            }
             dest->collisions.push_back(Collision());
             Collision& col = dest->collisions.back();
             col.point = constraint.point;
             col.normal = constraint.normalTowardInside[1];
             col.depth = constraint.depth;
         }
+        if(dest->collisions.empty()){
+            continue;
+        }
         for(int j=0; j<2; j++){
             dest->body[j] = source.bodyData[j]->body;
             dest->link[j] = source.link[j];
@@ -877,10 +1515,28 @@ CollisionLinkPairListPtr CFSImpl::getCollisions()
 }
 
 
+void CFSImpl::getContacts(ContactBuffer& out_contacts)
+{
+    out_contacts.clear();
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+        LinkPair& source = *constrainedLinkPairs[i];
+        out_contacts.addLinkPair(source.bodyData[0]->body.get(), source.link[0], source.bodyData[1]->body.get(), source.link[1]);
+        const ConstraintPointArray& constraintPoints = source.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            const ConstraintPoint& constraint = constraintPoints[j];
+            if(!isContactReported(constraint)){
+                continue;
+            }
+            out_contacts.addContact(constraint.point, constraint.normalTowardInside[1], constraint.depth, constraint.force);
+        }
+    }
+}
+
+
 /**
    @retuen true if the point is actually added to the constraints
 */
-bool CFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& collision)
+bool CFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& collision, int persistentContactIndex)
 {
     // skip the contact which has too much depth
     if(collision.depth > linkPair.attr.contactCullingDepth){
@@ -892,9 +1548,11 @@ bool CFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& col
     ConstraintPoint& contact = constraintPoints.back();
 
     contact.point = collision.point;
+    contact.force.setZero();
+    contact.persistentContactIndex = persistentContactIndex;
 
     // dense contact points are eliminated
-    int nPrevPoints = constraintPoints.size() - 1;
+    int nPrevPoints = (persistentContactIndex < 0) ? (constraintPoints.size() - 1) : 0;
     for(int i=0; i < nPrevPoints; ++i){
         if((constraintPoints[i].point - contact.point).norm() < linkPair.attr.contactCullingDistance){
             constraintPoints.pop_back();
@@ -905,6 +1563,8 @@ bool CFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& col
     contact.normalTowardInside[1] = collision.normal;
     contact.normalTowardInside[0] = -contact.normalTowardInside[1];
     contact.depth = collision.depth;
+    contact.featureId[0] = collision.id1;
+    contact.featureId[1] = collision.id2;
     contact.globalIndex = globalNumConstraintVectors++;
 
     // check velocities
@@ -941,7 +1601,7 @@ bool CFSImpl::setContactConstraintPoint(LinkPair& linkPair, const Collision& col
 
     contact.normalProjectionOfRelVelocityOn0 = contact.normalTowardInside[1].dot(contact.relVelocityOn0);
 
-    if(!areThereImpacts){
+    if(!areThereImpacts && persistentContactIndex < 0){
         if(contact.normalProjectionOfRelVelocityOn0 < -1.0e-6){
             areThereImpacts = true;
         }
@@ -1158,7 +1818,11 @@ void CFSImpl::initMatrices()
 
     const int dimLCP = usePivotingLCP ? (n + m + m) : (n + m);
 
-    Mlcp.resize(dimLCP, dimLCP);
+    if(isBlockSparseMatrixEnabled){
+        Mlcp.resize(0, 0);
+    } else {
+        Mlcp.resize(dimLCP, dimLCP);
+    }
     b.resize(dimLCP);
     solution.resize(dimLCP);
 
@@ -1181,6 +1845,115 @@ void CFSImpl::initMatrices()
 }
 
 
+/**
+   Two link pairs are coupled when they share a non-static body. The elements of
+   the un-coupled link pairs are not stored because they are always zero.
+   The constraint indices of a link pair are contiguous and they increase with the
+   link pair index, so the column spans can be made by merging the adjacent ranges.
+*/
+void CFSImpl::setBlockSparseMatrixStructure()
+{
+    const int n = globalNumConstraintVectors;
+    const int numLinkPairs = constrainedLinkPairs.size();
+
+    bodyIndexToLinkPairIndices.resize(bodiesData.size());
+    for(size_t i=0; i < bodyIndexToLinkPairIndices.size(); ++i){
+        bodyIndexToLinkPairIndices[i].clear();
+    }
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        for(int k=0; k < 2; ++k){
+            const int bodyIndex = linkPair.bodyIndex[k];
+            if(bodyIndex >= 0 && !bodiesData[bodyIndex].isStatic && (k == 0 || bodyIndex != linkPair.bodyIndex[0])){
+                bodyIndexToLinkPairIndices[bodyIndex].push_back(i);
+            }
+        }
+    }
+
+    BlockSparseMatrix& M = sparseMlcp;
+    const int size = n + globalNumFrictionVectors;
+    M.rowBlocks.resize(numLinkPairs);
+    M.rowToRowBlockIndex.resize(size);
+    M.rowTops.resize(size);
+    M.diagonalPositions.resize(size);
+    int top = 0;
+
+    for(int i=0; i < numLinkPairs; ++i){
+
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+
+        coupledLinkPairIndices.clear();
+        coupledLinkPairIndices.push_back(i);
+        for(int k=0; k < 2; ++k){
+            const int bodyIndex = linkPair.bodyIndex[k];
+            if(bodyIndex >= 0){
+                const std::vector<int>& indices = bodyIndexToLinkPairIndices[bodyIndex];
+                coupledLinkPairIndices.insert(coupledLinkPairIndices.end(), indices.begin(), indices.end());
+            }
+        }
+        std::sort(coupledLinkPairIndices.begin(), coupledLinkPairIndices.end());
+        coupledLinkPairIndices.erase(
+            std::unique(coupledLinkPairIndices.begin(), coupledLinkPairIndices.end()), coupledLinkPairIndices.end());
+
+        BlockSparseMatrix::RowBlock& block = M.rowBlocks[i];
+        block.spans.clear();
+        block.numCols = 0;
+
+        // normal vectors first and friction vectors next
+        for(int pass=0; pass < 2; ++pass){
+            for(size_t j=0; j < coupledLinkPairIndices.size(); ++j){
+                ConstraintPointArray& constraintPoints = constrainedLinkPairs[coupledLinkPairIndices[j]]->constraintPoints;
+                if(constraintPoints.empty()){
+                    continue;
+                }
+                int begin, end;
+                if(pass == 0){
+                    begin = constraintPoints.front().globalIndex;
+                    end = constraintPoints.back().globalIndex + 1;
+                } else {
+                    const ConstraintPoint& last = constraintPoints.back();
+                    begin = n + constraintPoints.front().globalFrictionIndex;
+                    end = n + last.globalFrictionIndex + last.numFrictionVectors;
+                }
+                if(begin < end){
+                    if(!block.spans.empty() && block.spans.back().end == begin){
+                        block.spans.back().end = end;
+                    } else {
+                        BlockSparseMatrix::Span span;
+                        span.begin = begin;
+                        span.end = end;
+                        span.offset = block.numCols;
+                        block.spans.push_back(span);
+                    }
+                    block.numCols += (end - begin);
+                }
+            }
+        }
+
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            int row = constraint.globalIndex;
+            M.rowToRowBlockIndex[row] = i;
+            M.rowTops[row] = top;
+            top += block.numCols;
+            for(int k=0; k < constraint.numFrictionVectors; ++k){
+                row = n + constraint.globalFrictionIndex + k;
+                M.rowToRowBlockIndex[row] = i;
+                M.rowTops[row] = top;
+                top += block.numCols;
+            }
+        }
+    }
+
+    M.values.resize(top);
+    std::fill(M.values.begin(), M.values.end(), 0.0);
+    for(int i=0; i < size; ++i){
+        M.diagonalPositions[i] = M.find(i, i) - &M.values.front();
+    }
+}
+
+
 void CFSImpl::setAccelCalcSkipInformation()
 {
     // clear skip check numbers
@@ -1271,17 +2044,40 @@ void CFSImpl::setAccelerationMatrix()
     const int n = globalNumConstraintVectors;
     const int m = globalNumFrictionVectors;
 
-    Eigen::Block<MatrixX> Knn = Mlcp.block(0, 0, n, n);
-    Eigen::Block<MatrixX> Ktn = Mlcp.block(0, n, n, m);
-    Eigen::Block<MatrixX> Knt = Mlcp.block(n, 0, m, n);
-    Eigen::Block<MatrixX> Ktt = Mlcp.block(n, n, m, m);
+    if(isBlockSparseMatrixEnabled){
+        BlockSparseMatrix::Block Knn(sparseMlcp, 0, 0);
+        BlockSparseMatrix::Block Ktn(sparseMlcp, 0, n);
+        BlockSparseMatrix::Block Knt(sparseMlcp, n, 0);
+        BlockSparseMatrix::Block Ktt(sparseMlcp, n, n);
+        setAccelerationMatrixBlocks(Knn, Ktn, Knt, Ktt);
+
+    } else {
+        Eigen::Block<MatrixX> Knn = Mlcp.block(0, 0, n, n);
+        Eigen::Block<MatrixX> Ktn = Mlcp.block(0, n, n, m);
+        Eigen::Block<MatrixX> Knt = Mlcp.block(n, 0, m, n);
+        Eigen::Block<MatrixX> Ktt = Mlcp.block(n, n, m, m);
+        setAccelerationMatrixBlocks(Knn, Ktn, Knt, Ktt);
+
+        if(ASSUME_SYMMETRIC_MATRIX){
+            copySymmetricElementsOfAccelerationMatrix(Knn, Ktn, Knt, Ktt);
+        }
+    }
+}
+
 
+template<class TBlock>
+void CFSImpl::setAccelerationMatrixBlocks(TBlock& Knn, TBlock& Ktn, TBlock& Knt, TBlock& Ktt)
+{
     for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
 
         LinkPair& linkPair = *constrainedLinkPairs[i];
         int numConstraintsInPair = linkPair.constraintPoints.size();
 
-        for(int j=0; j < numConstraintsInPair; ++j){
+        if(isIslandDecompositionEnabled){
+            currentIslandIndex = linkPair.islandIndex;
+        }
+
+        for(int j=0; j < numConstraintsInPair; ++j){
 
             ConstraintPoint& constraint = linkPair.constraintPoints[j];
             int constraintIndex = constraint.globalIndex;
@@ -1342,10 +2138,6 @@ void CFSImpl::setAccelerationMatrix()
             linkPair.bodyData[1]->isTestForceBeingApplied = false;
         }
     }
-
-    if(ASSUME_SYMMETRIC_MATRIX){
-        copySymmetricElementsOfAccelerationMatrix(Knn, Ktn, Knt, Ktt);
-    }
 }
 
 
@@ -1510,15 +2302,24 @@ void CFSImpl::calcAccelsMM(BodyData& bodyData, int constraintIndex)
 }
 
 
+template<class TBlock>
 void CFSImpl::extractRelAccelsOfConstraintPoints
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, int testForceIndex, int constraintIndex)
+(TBlock& Kxn, TBlock& Kxt, int testForceIndex, int constraintIndex)
 {
-    int maxConstraintIndexToExtract = ASSUME_SYMMETRIC_MATRIX ? constraintIndex : globalNumConstraintVectors;
+    // The symmetric elements are not copied in the block-sparse matrix, so all the elements are extracted
+    int maxConstraintIndexToExtract =
+        (ASSUME_SYMMETRIC_MATRIX && !isBlockSparseMatrixEnabled) ? constraintIndex : globalNumConstraintVectors;
 
+    /*
+      The elements between the different islands are always zero and they are not
+      accessed by the island solver, so only the link pairs of the current island are processed.
+    */
+    const std::vector<LinkPair*>& linkPairs =
+        isIslandDecompositionEnabled ? islands[currentIslandIndex].linkPairs : constrainedLinkPairs;
 
-    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+    for(size_t i=0; i < linkPairs.size(); ++i){
 
-        LinkPair& linkPair = *constrainedLinkPairs[i];
+        LinkPair& linkPair = *linkPairs[i];
 
         BodyData& bodyData0 = *linkPair.bodyData[0];
         BodyData& bodyData1 = *linkPair.bodyData[1];
@@ -1532,7 +2333,8 @@ void CFSImpl::extractRelAccelsOfConstraintPoints
         } else {
             if(bodyData1.isTestForceBeingApplied){
                 extractRelAccelsFromLinkPairCase2(Kxn, Kxt, linkPair, 1, 0, testForceIndex, maxConstraintIndexToExtract);
-            } else {
+            } else if(!isBlockSparseMatrixEnabled){
+                // The elements of the link pairs not coupled with the test force are not stored in the block-sparse matrix
                 extractRelAccelsFromLinkPairCase3(Kxn, Kxt, linkPair, testForceIndex, maxConstraintIndexToExtract);
             }
         }
@@ -1540,8 +2342,9 @@ void CFSImpl::extractRelAccelsOfConstraintPoints
 }
 
 
+template<class TBlock>
 void CFSImpl::extractRelAccelsFromLinkPairCase1
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt,
+(TBlock& Kxn, TBlock& Kxt,
  LinkPair& linkPair, int testForceIndex, int maxConstraintIndexToExtract)
 {
     ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
@@ -1581,8 +2384,9 @@ void CFSImpl::extractRelAccelsFromLinkPairCase1
 }
 
 
+template<class TBlock>
 void CFSImpl::extractRelAccelsFromLinkPairCase2
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt,
+(TBlock& Kxn, TBlock& Kxt,
  LinkPair& linkPair, int iTestForce, int iDefault, int testForceIndex, int maxConstraintIndexToExtract)
 {
     ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
@@ -1618,8 +2422,9 @@ void CFSImpl::extractRelAccelsFromLinkPairCase2
 }
 
 
+template<class TBlock>
 void CFSImpl::extractRelAccelsFromLinkPairCase3
-(Eigen::Block<MatrixX>& Kxn, Eigen::Block<MatrixX>& Kxt, LinkPair& linkPair, int testForceIndex, int maxConstraintIndexToExtract)
+(TBlock& Kxn, TBlock& Kxt, LinkPair& linkPair, int testForceIndex, int maxConstraintIndexToExtract)
 {
     ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
 
@@ -1680,6 +2485,21 @@ void CFSImpl::copySymmetricElementsOfAccelerationMatrix
 
 void CFSImpl::clearSingularPointConstraintsOfClosedLoopConnections()
 {
+    if(isBlockSparseMatrixEnabled){
+        for(int i = 0; i < sparseMlcp.rows(); ++i){
+            double& d = sparseMlcp.values[sparseMlcp.diagonalPositions[i]];
+            if(d < 1.0e-4){
+                for(int j=0; j < sparseMlcp.rows(); ++j){
+                    if(double* p = sparseMlcp.find(j, i)){
+                        *p = 0.0;
+                    }
+                }
+                d = numeric_limits<double>::max();
+            }
+        }
+        return;
+    }
+    
     for(int i = 0; i < Mlcp.rows(); ++i){
         if(Mlcp(i, i) < 1.0e-4){
             for(int j=0; j < Mlcp.rows(); ++j){
@@ -1725,7 +2545,10 @@ void CFSImpl::setConstantVectorAndMuBlock()
 
             } else {
                 // contact constraint
-                if(ENABLE_CONTACT_DEPTH_CORRECTION){
+                if(constraint.persistentContactIndex >= 0){
+                    // a speculative contact, whose depth is the negative gap, can approach by the gap in a step
+                    b(globalIndex) = an0(globalIndex) + (constraint.normalProjectionOfRelVelocityOn0 - constraint.depth * dtinv) * dtinv;
+                } else if(ENABLE_CONTACT_DEPTH_CORRECTION){
                     double velOffset;
                     const double depth = constraint.depth - contactCorrectionDepth;
                     if(depth <= 0.0){
@@ -1807,10 +2630,16 @@ void CFSImpl::addConstraintForceToLink(LinkPair* linkPair, int ipair)
         if(isConstraintForceOutputMode){
             link->constraintForces().push_back(DyLink::ConstraintForce(constraint.point, f));
         }
+        if(ipair == 1){
+            constraint.force = f;
+        }
     }
     
-    link->f_ext()   += f_total;
-    link->tau_ext() += tau_total;
+    // The external forces of a sleeping body are kept to detect the disturbance
+    if(!linkPair->bodyData[ipair]->sleeping.isSleeping){
+        link->f_ext()   += f_total;
+        link->tau_ext() += tau_total;
+    }
 
 
     if(CFS_DEBUG){
@@ -1820,12 +2649,433 @@ void CFSImpl::addConstraintForceToLink(LinkPair* linkPair, int ipair)
 
 
 
-void CFSImpl::solveMCPByProjectedGaussSeidel(const MatrixX& M, const VectorX& b, VectorX& x)
+/**
+   The solution of a contact is initialized with the cached force of the nearest
+   previous contact of the same link pair within the contact culling distance.
+   The contacts on the same pair of the triangles are preferred. The friction
+   force is projected to the new friction vectors. This keeps the warm start
+   of the persisting contacts when the other contacts appear or disappear.
+*/
+void CFSImpl::setInitialSolutionFromCachedForces()
+{
+    const int n = globalNumConstraintVectors;
+    solution.setZero();
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        if(linkPair.cachedForceFrame != currentFrame - 1){
+            continue;
+        }
+        const CachedConstraintForceArray& cachedForces = linkPair.cachedForces;
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+
+        if(linkPair.isNonContactConstraint){
+            if(cachedForces.size() == constraintPoints.size()){
+                for(size_t j=0; j < constraintPoints.size(); ++j){
+                    solution(constraintPoints[j].globalIndex) = cachedForces[j].normalForce;
+                }
+            }
+            continue;
+        }
+
+        DyLink* link0 = linkPair.link[0];
+        const double maxDistance2 = linkPair.attr.contactCullingDistance * linkPair.attr.contactCullingDistance;
+
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+
+            ConstraintPoint& contact = constraintPoints[j];
+            const Vector3 localPoint = link0->R().transpose() * (contact.point - link0->p());
+
+            const CachedConstraintForce* matched = 0;
+            bool isSameFeature = false;
+            double minDistance2 = maxDistance2;
+            for(size_t k=0; k < cachedForces.size(); ++k){
+                const CachedConstraintForce& cached = cachedForces[k];
+                const double d2 = (cached.localPoint - localPoint).squaredNorm();
+                if(d2 < maxDistance2){
+                    const bool same = (cached.featureId[0] == contact.featureId[0] &&
+                                       cached.featureId[1] == contact.featureId[1]);
+                    if((same && !isSameFeature) || (same == isSameFeature && d2 < minDistance2)){
+                        matched = &cached;
+                        isSameFeature = same;
+                        minDistance2 = d2;
+                    }
+                }
+            }
+
+            if(matched){
+                solution(contact.globalIndex) = matched->normalForce;
+                const Vector3 frictionForce = link0->R() * matched->localFrictionForce;
+                for(int k=0; k < contact.numFrictionVectors; ++k){
+                    double f = frictionForce.dot(contact.frictionVector[k][1]);
+                    if(!STATIC_FRICTION_BY_TWO_CONSTRAINTS && f < 0.0){
+                        f = 0.0;
+                    }
+                    solution(n + contact.globalFrictionIndex + k) = f;
+                }
+            }
+        }
+    }
+}
+
+
+void CFSImpl::storeCachedForces()
+{
+    const int n = globalNumConstraintVectors;
+
+    for(size_t i=0; i < constrainedLinkPairs.size(); ++i){
+
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        CachedConstraintForceArray& cachedForces = linkPair.cachedForces;
+        cachedForces.resize(constraintPoints.size());
+        linkPair.cachedForceFrame = currentFrame;
+
+        DyLink* link0 = linkPair.link[0];
+
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            ConstraintPoint& constraint = constraintPoints[j];
+            CachedConstraintForce& cached = cachedForces[j];
+            cached.normalForce = solution(constraint.globalIndex);
+            if(!linkPair.isNonContactConstraint){
+                cached.localPoint = link0->R().transpose() * (constraint.point - link0->p());
+                cached.featureId[0] = constraint.featureId[0];
+                cached.featureId[1] = constraint.featureId[1];
+                Vector3 f = Vector3::Zero();
+                for(int k=0; k < constraint.numFrictionVectors; ++k){
+                    f += solution(n + constraint.globalFrictionIndex + k) * constraint.frictionVector[k][1];
+                }
+                cached.localFrictionForce = link0->R().transpose() * f;
+            }
+        }
+    }
+}
+
+
+ReferencedPtr CFSImpl::storeState() const
+{
+    State* state = new State;
+    state->currentFrame = currentFrame;
+    state->numConstraintVectors = prevGlobalNumConstraintVectors;
+    state->numContactNormalVectors = globalNumContactNormalVectors;
+    state->numFrictionVectors = prevGlobalNumFrictionVectors;
+    state->solution = solution;
+    state->randomEngine = randomAngle.engine();
+
+    for(GeometryPairToLinkPairMap::const_iterator p = geometryPairToLinkPairMap.begin();
+        p != geometryPairToLinkPairMap.end(); ++p){
+        const LinkPair& linkPair = p->second;
+        if(linkPair.cachedForceFrame >= 0){
+            state->geometryPairForces[p->first] = make_pair(linkPair.cachedForceFrame, linkPair.cachedForces);
+        }
+    }
+    state->extraJointForces.reserve(extraJointLinkPairs.size());
+    for(size_t i=0; i < extraJointLinkPairs.size(); ++i){
+        const LinkPair& linkPair = *extraJointLinkPairs[i];
+        state->extraJointForces.push_back(make_pair(linkPair.cachedForceFrame, linkPair.cachedForces));
+    }
+    state->constrain2dForces.reserve(constrain2dLinkPairs.size());
+    for(size_t i=0; i < constrain2dLinkPairs.size(); ++i){
+        const LinkPair& linkPair = *constrain2dLinkPairs[i];
+        state->constrain2dForces.push_back(make_pair(linkPair.cachedForceFrame, linkPair.cachedForces));
+    }
+    state->sleepingStates.reserve(bodiesData.size());
+    for(size_t i=0; i < bodiesData.size(); ++i){
+        state->sleepingStates.push_back(bodiesData[i].sleeping);
+    }
+    // The link pairs are kept in the map until the solver is initialized again
+    state->persistentLinkPairs = persistentLinkPairs;
+    state->persistentContacts.reserve(persistentLinkPairs.size());
+    for(size_t i=0; i < persistentLinkPairs.size(); ++i){
+        state->persistentContacts.push_back(persistentLinkPairs[i]->persistentContacts);
+    }
+
+    return state;
+}
+
+
+void CFSImpl::restoreState(const State& state)
+{
+    currentFrame = state.currentFrame;
+    randomAngle.engine() = state.randomEngine;
+
+    // The matrices are allocated for the stored sizes so that the stored solution can be
+    // reused in the next step in the same way as it was when the state was stored
+    if(state.numConstraintVectors > 0){
+        globalNumConstraintVectors = state.numConstraintVectors;
+        globalNumContactNormalVectors = state.numContactNormalVectors;
+        globalNumFrictionVectors = state.numFrictionVectors;
+        initMatrices();
+        solution = state.solution;
+    }
+    prevGlobalNumConstraintVectors = state.numConstraintVectors;
+    prevGlobalNumFrictionVectors = state.numFrictionVectors;
+
+    // The map only grows during a simulation, so all the stored pairs exist in it
+    for(GeometryPairToLinkPairMap::iterator p = geometryPairToLinkPairMap.begin();
+        p != geometryPairToLinkPairMap.end(); ++p){
+        LinkPair& linkPair = p->second;
+        std::map<IdPair<>, State::CachedForces>::const_iterator q = state.geometryPairForces.find(p->first);
+        if(q != state.geometryPairForces.end()){
+            linkPair.cachedForceFrame = q->second.first;
+            linkPair.cachedForces = q->second.second;
+        } else {
+            linkPair.cachedForceFrame = -1;
+            linkPair.cachedForces.clear();
+        }
+        linkPair.collisionFrame = -1;
+        linkPair.persistentContactFrame = -1;
+    }
+    persistentLinkPairs = state.persistentLinkPairs;
+    for(size_t i=0; i < persistentLinkPairs.size(); ++i){
+        persistentLinkPairs[i]->persistentContacts = state.persistentContacts[i];
+        persistentLinkPairs[i]->persistentContactFrame = currentFrame - 1;
+    }
+    const size_t n = std::min(extraJointLinkPairs.size(), state.extraJointForces.size());
+    for(size_t i=0; i < n; ++i){
+        extraJointLinkPairs[i]->cachedForceFrame = state.extraJointForces[i].first;
+        extraJointLinkPairs[i]->cachedForces = state.extraJointForces[i].second;
+    }
+    const size_t m = std::min(constrain2dLinkPairs.size(), state.constrain2dForces.size());
+    for(size_t i=0; i < m; ++i){
+        constrain2dLinkPairs[i]->cachedForceFrame = state.constrain2dForces[i].first;
+        constrain2dLinkPairs[i]->cachedForces = state.constrain2dForces[i].second;
+    }
+
+    bool isGeometryStatusChanged = false;
+    const size_t numBodies = std::min(bodiesData.size(), state.sleepingStates.size());
+    for(size_t i=0; i < numBodies; ++i){
+        BodyData& bodyData = bodiesData[i];
+        const SleepingState& sleeping = state.sleepingStates[i];
+        if(bodyData.sleeping.isSleeping != sleeping.isSleeping){
+            setBodySleeping(i, sleeping.isSleeping);
+            isGeometryStatusChanged = true;
+        }
+        bodyData.sleeping = sleeping;
+        bodyData.isMoving = false;
+        bodyData.isWakeUpRequested = false;
+    }
+    if(isGeometryStatusChanged){
+        collisionDetector->makeReady();
+    }
+}
+
+
+/**
+   Link pairs are grouped into islands by the union-find of the non-static bodies
+   connected by the constraints. A static body does not couple the link pairs
+   constrained with it because its accelerations are always zero.
+*/
+void CFSImpl::extractIslands()
+{
+    const int numBodies = bodiesData.size();
+    islandParents.resize(numBodies);
+    for(int i=0; i < numBodies; ++i){
+        islandParents[i] = i;
+    }
+
+    const int numLinkPairs = constrainedLinkPairs.size();
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        const int index0 = linkPair.bodyIndex[0];
+        const int index1 = linkPair.bodyIndex[1];
+        if(index0 >= 0 && index1 >= 0 && !bodiesData[index0].isStatic && !bodiesData[index1].isStatic){
+            const int root0 = findIslandRoot(index0);
+            const int root1 = findIslandRoot(index1);
+            if(root0 != root1){
+                islandParents[std::max(root0, root1)] = std::min(root0, root1);
+            }
+        }
+    }
+
+    islandRootToIslandIndex.assign(numBodies, -1);
+    numIslands = 0;
+
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *constrainedLinkPairs[i];
+        int bodyIndex = linkPair.bodyIndex[1];
+        if(bodyIndex < 0 || (bodiesData[bodyIndex].isStatic && linkPair.bodyIndex[0] >= 0)){
+            bodyIndex = linkPair.bodyIndex[0];
+        }
+        int& islandIndex = islandRootToIslandIndex[findIslandRoot(bodyIndex)];
+        if(islandIndex < 0){
+            islandIndex = numIslands++;
+            if(islands.size() < numIslands){
+                islands.resize(numIslands);
+            }
+            islands[islandIndex].linkPairs.clear();
+        }
+        linkPair.islandIndex = islandIndex;
+        islands[islandIndex].linkPairs.push_back(&linkPair);
+    }
+
+    if(CFS_DEBUG){
+        os << "Num islands: " << numIslands << std::endl;
+    }
+}
+
+
+int CFSImpl::findIslandRoot(int bodyIndex)
+{
+    int root = bodyIndex;
+    while(islandParents[root] != root){
+        root = islandParents[root];
+    }
+    while(islandParents[bodyIndex] != root){
+        const int parent = islandParents[bodyIndex];
+        islandParents[bodyIndex] = root;
+        bodyIndex = parent;
+    }
+    return root;
+}
+
+
+void CFSImpl::solveIslands()
+{
+    TaskScheduler* scheduler = world.taskScheduler();
+
+    if(scheduler && numIslands > 1){
+        TaskGroup group(scheduler);
+        for(int i=0; i < numIslands; ++i){
+            group.run(boost::bind(&CFSImpl::solveIsland, this, boost::ref(islands[i])));
+        }
+        group.wait();
+    } else {
+        for(int i=0; i < numIslands; ++i){
+            solveIsland(islands[i]);
+        }
+    }
+}
+
+
+/**
+   The sub MCP of an island keeps the layout of the global MCP, i.e. the normal
+   vectors of the contacts, the normal vectors of the other constraints, and
+   the friction vectors are put in this order. The link pairs of an island are
+   stored in the order of the global constraint indices, so the relative order
+   of the constraints is also kept.
+*/
+void CFSImpl::solveIsland(Island& island)
+{
+    std::vector<int>& indices = island.globalIndices;
+    indices.clear();
+    island.numContactNormalVectors = 0;
+
+    const int numLinkPairs = island.linkPairs.size();
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *island.linkPairs[i];
+        ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+        for(size_t j=0; j < constraintPoints.size(); ++j){
+            indices.push_back(constraintPoints[j].globalIndex);
+        }
+        if(!linkPair.isNonContactConstraint){
+            island.numContactNormalVectors += constraintPoints.size();
+        }
+    }
+    island.numConstraintVectors = indices.size();
+
+    island.frictionIndexToContactIndex.clear();
+    int contactIndex = 0;
+    for(int i=0; i < numLinkPairs; ++i){
+        LinkPair& linkPair = *island.linkPairs[i];
+        if(!linkPair.isNonContactConstraint){
+            ConstraintPointArray& constraintPoints = linkPair.constraintPoints;
+            for(size_t j=0; j < constraintPoints.size(); ++j){
+                ConstraintPoint& constraint = constraintPoints[j];
+                for(int k=0; k < constraint.numFrictionVectors; ++k){
+                    indices.push_back(globalNumConstraintVectors + constraint.globalFrictionIndex + k);
+                    island.frictionIndexToContactIndex.push_back(contactIndex);
+                }
+                ++contactIndex;
+            }
+        }
+    }
+
+    const int size = indices.size();
+    island.M.resize(size, size);
+    island.b.resize(size);
+    island.x.resize(size);
+    for(int i=0; i < size; ++i){
+        const int row = indices[i];
+        for(int j=0; j < size; ++j){
+            island.M(i, j) = isBlockSparseMatrixEnabled ? sparseMlcp.coeff(row, indices[j]) : Mlcp(row, indices[j]);
+        }
+        island.b(i) = b(row);
+        island.x(i) = solution(row);
+    }
+
+    const int numContacts = island.numContactNormalVectors;
+    island.mu.resize(numContacts);
+    island.hi.resize(numContacts);
+    for(int i=0; i < numContacts; ++i){
+        island.mu(i) = contactIndexToMu(indices[i]);
+    }
+
+    MCPStructure mcp;
+    mcp.numContactNormalVectors = numContacts;
+    mcp.numConstraintVectors = island.numConstraintVectors;
+    mcp.size = size;
+    mcp.mu = island.mu.data();
+    mcp.hi = island.hi.data();
+    mcp.frictionIndexToContactIndex =
+        island.frictionIndexToContactIndex.empty() ? 0 : &island.frictionIndexToContactIndex.front();
+
+    solveMCPByProjectedGaussSeidel(island.M, island.b, island.x, mcp);
+
+    for(int i=0; i < size; ++i){
+        solution(indices[i]) = island.x(i);
+    }
+}
+
+
+CFSImpl::MCPStructure CFSImpl::globalMCPStructure()
+{
+    MCPStructure mcp;
+    mcp.numContactNormalVectors = globalNumContactNormalVectors;
+    mcp.numConstraintVectors = globalNumConstraintVectors;
+    mcp.size = globalNumConstraintVectors + globalNumFrictionVectors;
+    mcp.mu = contactIndexToMu.data();
+    mcp.hi = mcpHi.data();
+    mcp.frictionIndexToContactIndex =
+        frictionIndexToContactIndex.empty() ? 0 : &frictionIndexToContactIndex.front();
+    return mcp;
+}
+
+
+double CFSImpl::calcOffDiagonalRowProduct(const MatrixX& M, const VectorX& x, int row, int size)
+{
+    double sum = -M(row, row) * x(row);
+    for(int k=0; k < size; ++k){
+        sum += M(row, k) * x(k);
+    }
+    return sum;
+}
+
+
+double CFSImpl::calcOffDiagonalRowProduct(const BlockSparseMatrix& M, const VectorX& x, int row, int /* size */)
+{
+    const std::vector<BlockSparseMatrix::Span>& spans = M.rowBlocks[M.rowToRowBlockIndex[row]].spans;
+    const double* values = &M.values[M.rowTops[row]];
+    double sum = -M.values[M.diagonalPositions[row]] * x(row);
+    for(size_t i=0; i < spans.size(); ++i){
+        const BlockSparseMatrix::Span& span = spans[i];
+        const double* v = values + span.offset - span.begin;
+        for(int k=span.begin; k < span.end; ++k){
+            sum += v[k] * x(k);
+        }
+    }
+    return sum;
+}
+
+
+template<class TMatrix>
+void CFSImpl::solveMCPByProjectedGaussSeidel(const TMatrix& M, const VectorX& b, VectorX& x, const MCPStructure& mcp)
 {
     static const int loopBlockSize = DEFAULT_NUM_GAUSS_SEIDEL_ITERATION_BLOCK;
 
     if(numGaussSeidelInitialIteration > 0){
-        solveMCPByProjectedGaussSeidelInitial(M, b, x, numGaussSeidelInitialIteration);
+        solveMCPByProjectedGaussSeidelInitial(M, b, x, mcp, numGaussSeidelInitialIteration);
     }
 
     int numBlockLoops = maxNumGaussSeidelIteration / loopBlockSize;
@@ -1844,11 +3094,11 @@ void CFSImpl::solveMCPByProjectedGaussSeidel(const MatrixX& M, const VectorX& b,
         i++;
 
         for(int j=0; j < loopBlockSize - 1; ++j){
-            solveMCPByProjectedGaussSeidelMainStep(M, b, x);
+            solveMCPByProjectedGaussSeidelMainStep(M, b, x, mcp);
         }
 
         x0 = x;
-        solveMCPByProjectedGaussSeidelMainStep(M, b, x);
+        solveMCPByProjectedGaussSeidelMainStep(M, b, x, mcp);
 
         if(true){
             double n = x.norm();
@@ -1895,20 +3145,18 @@ void CFSImpl::solveMCPByProjectedGaussSeidel(const MatrixX& M, const VectorX& b,
 }
 
 
-void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const VectorX& b, VectorX& x)
+template<class TMatrix>
+void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const TMatrix& M, const VectorX& b, VectorX& x, const MCPStructure& mcp)
 {
-    const int size = globalNumConstraintVectors + globalNumFrictionVectors;
+    const int size = mcp.size;
 
-    for(int j=0; j < globalNumContactNormalVectors; ++j){
+    for(int j=0; j < mcp.numContactNormalVectors; ++j){
 
         double xx;
         if(M(j,j) == numeric_limits<double>::max()){
             xx=0.0;
         } else {
-            double sum = -M(j, j) * x(j);
-            for(int k=0; k < size; ++k){
-                sum += M(j, k) * x(k);
-            }
+            double sum = calcOffDiagonalRowProduct(M, x, j, size);
             xx = (-b(j) - sum) / M(j, j);
         }
         if(xx < 0.0){
@@ -1916,18 +3164,15 @@ void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const Vec
         } else {
             x(j) = xx;
         }
-        mcpHi[j] = contactIndexToMu[j] * x(j);
+        mcp.hi[j] = mcp.mu[j] * x(j);
     }
     
-    for(int j=globalNumContactNormalVectors; j < globalNumConstraintVectors; ++j){
+    for(int j=mcp.numContactNormalVectors; j < mcp.numConstraintVectors; ++j){
         
         if(M(j,j) == numeric_limits<double>::max()){
             x(j)=0.0;
         } else {
-            double sum = -M(j, j) * x(j);
-            for(int k=0; k < size; ++k){
-                sum += M(j, k) * x(k);
-            }
+            double sum = calcOffDiagonalRowProduct(M, x, j, size);
             x(j) = (-b(j) - sum) / M(j, j);
         }
     }
@@ -1936,16 +3181,13 @@ void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const Vec
     if(ENABLE_TRUE_FRICTION_CONE){
 
         int contactIndex = 0;
-        for(int j=globalNumConstraintVectors; j < size; ++j, ++contactIndex){
+        for(int j=mcp.numConstraintVectors; j < size; ++j, ++contactIndex){
             
             double fx0;
             if(M(j,j) == numeric_limits<double>::max()) {
                 fx0 = 0.0;
             } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
+                double sum = calcOffDiagonalRowProduct(M, x, j, size);
                 fx0 = (-b(j) - sum) / M(j, j);
             }
             double& fx = x(j);
@@ -1956,15 +3198,12 @@ void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const Vec
             if(M(j,j) == numeric_limits<double>::max()) {
                 fy0=0.0;
             } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
+                double sum = calcOffDiagonalRowProduct(M, x, j, size);
                 fy0 = (-b(j) - sum) / M(j, j);
             }
             double& fy = x(j);
             
-            const double fmax = mcpHi[contactIndex];
+            const double fmax = mcp.hi[contactIndex];
             const double fmax2 = fmax * fmax;
             const double fmag2 = fx0 * fx0 + fy0 * fy0;
 
@@ -1981,21 +3220,18 @@ void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const Vec
     } else {
 
         int frictionIndex = 0;
-        for(int j=globalNumConstraintVectors; j < size; ++j, ++frictionIndex){
+        for(int j=mcp.numConstraintVectors; j < size; ++j, ++frictionIndex){
 
             double xx;
             if(M(j,j) == numeric_limits<double>::max()) {
                 xx=0.0;
             } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
+                double sum = calcOffDiagonalRowProduct(M, x, j, size);
                 xx = (-b(j) - sum) / M(j, j);
             }
             
-            const int contactIndex = frictionIndexToContactIndex[frictionIndex];
-            const double fmax = mcpHi[contactIndex];
+            const int contactIndex = mcp.frictionIndexToContactIndex[frictionIndex];
+            const double fmax = mcp.hi[contactIndex];
             const double fmin = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? -fmax : 0.0);
             
             if(xx < fmin){
@@ -2010,26 +3246,24 @@ void CFSImpl::solveMCPByProjectedGaussSeidelMainStep(const MatrixX& M, const Vec
 }
 
 
+template<class TMatrix>
 void CFSImpl::solveMCPByProjectedGaussSeidelInitial
-(const MatrixX& M, const VectorX& b, VectorX& x, const int numIteration)
+(const TMatrix& M, const VectorX& b, VectorX& x, const MCPStructure& mcp, const int numIteration)
 {
-    const int size = globalNumConstraintVectors + globalNumFrictionVectors;
+    const int size = mcp.size;
 
     const double rstep = 1.0 / (numIteration * size);
     double r = 0.0;
 
     for(int i=0; i < numIteration; ++i){
 
-        for(int j=0; j < globalNumContactNormalVectors; ++j){
+        for(int j=0; j < mcp.numContactNormalVectors; ++j){
 
             double xx;
             if(M(j,j)==numeric_limits<double>::max()){
                 xx=0.0;
             } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
+                double sum = calcOffDiagonalRowProduct(M, x, j, size);
                 xx = (-b(j) - sum) / M(j, j);
             }
             if(xx < 0.0){
@@ -2038,18 +3272,15 @@ void CFSImpl::solveMCPByProjectedGaussSeidelInitial
                 x(j) = r * xx;
             }
             r += rstep;
-            mcpHi[j] = contactIndexToMu[j] * x(j);
+            mcp.hi[j] = mcp.mu[j] * x(j);
         }
 
-        for(int j=globalNumContactNormalVectors; j < globalNumConstraintVectors; ++j){
+        for(int j=mcp.numContactNormalVectors; j < mcp.numConstraintVectors; ++j){
 
             if(M(j,j)==numeric_limits<double>::max()){
                 x(j) = 0.0;
             } else {
-                double sum = -M(j, j) * x(j);
-                for(int k=0; k < size; ++k){
-                    sum += M(j, k) * x(k);
-                }
+                double sum = calcOffDiagonalRowProduct(M, x, j, size);
                 x(j) = r * (-b(j) - sum) / M(j, j);
             }
             r += rstep;
@@ -2058,16 +3289,13 @@ void CFSImpl::solveMCPByProjectedGaussSeidelInitial
         if(ENABLE_TRUE_FRICTION_CONE){
 
             int contactIndex = 0;
-            for(int j=globalNumConstraintVectors; j < size; ++j, ++contactIndex){
+            for(int j=mcp.numConstraintVectors; j < size; ++j, ++contactIndex){
 
                 double fx0;
                 if(M(j,j)==numeric_limits<double>::max())
                     fx0 = 0.0;
                 else{
-                    double sum = -M(j, j) * x(j);
-                    for(int k=0; k < size; ++k){
-                        sum += M(j, k) * x(k);
-                    }
+                    double sum = calcOffDiagonalRowProduct(M, x, j, size);
                     fx0 = (-b(j) - sum) / M(j, j);
                 }
                 double& fx = x(j);
@@ -2078,15 +3306,12 @@ void CFSImpl::solveMCPByProjectedGaussSeidelInitial
                 if(M(j,j)==numeric_limits<double>::max())
                     fy0 = 0.0;
                 else{
-                    double sum = -M(j, j) * x(j);
-                    for(int k=0; k < size; ++k){
-                        sum += M(j, k) * x(k);
-                    }
+                    double sum = calcOffDiagonalRowProduct(M, x, j, size);
                     fy0 = (-b(j) - sum) / M(j, j);
                 }
                 double& fy = x(j);
 
-                const double fmax = mcpHi[contactIndex];
+                const double fmax = mcp.hi[contactIndex];
                 const double fmax2 = fmax * fmax;
                 const double fmag2 = fx0 * fx0 + fy0 * fy0;
 
@@ -2104,21 +3329,18 @@ void CFSImpl::solveMCPByProjectedGaussSeidelInitial
         } else {
 
             int frictionIndex = 0;
-            for(int j=globalNumConstraintVectors; j < size; ++j, ++frictionIndex){
+            for(int j=mcp.numConstraintVectors; j < size; ++j, ++frictionIndex){
 
                 double xx;
                 if(M(j,j)==numeric_limits<double>::max())
                     xx = 0.0;
                 else{
-                    double sum = -M(j, j) * x(j);
-                    for(int k=0; k < size; ++k){
-                        sum += M(j, k) * x(k);
-                    }
+                    double sum = calcOffDiagonalRowProduct(M, x, j, size);
                     xx = (-b(j) - sum) / M(j, j);
                 }
 
-                const int contactIndex = frictionIndexToContactIndex[frictionIndex];
-                const double fmax = mcpHi[contactIndex];
+                const int contactIndex = mcp.frictionIndexToContactIndex[frictionIndex];
+                const double fmax = mcp.hi[contactIndex];
                 const double fmin = (STATIC_FRICTION_BY_TWO_CONSTRAINTS ? -fmax : 0.0);
 
                 if(xx < fmin){
@@ -2465,12 +3687,132 @@ double ConstraintForceSolver::contactCorrectionVelocityRatio()
 }
 
 
+void ConstraintForceSolver::setSpeculativeContactMargin(double margin)
+{
+    impl->speculativeContactMargin = std::max(0.0, margin);
+}
+
+
+double ConstraintForceSolver::speculativeContactMargin() const
+{
+    return impl->speculativeContactMargin;
+}
+
+
 void ConstraintForceSolver::enableConstraintForceOutput(bool on)
 {
     impl->isConstraintForceOutputMode = on;
 }
 
 
+void ConstraintForceSolver::enableIslandDecomposition(bool on)
+{
+    impl->isIslandDecompositionEnabled = on;
+}
+
+
+bool ConstraintForceSolver::isIslandDecompositionEnabled() const
+{
+    return impl->isIslandDecompositionEnabled;
+}
+
+
+void ConstraintForceSolver::enableBlockSparseMatrix(bool on)
+{
+    on = on && !usePivotingLCP;
+    if(on != impl->isBlockSparseMatrixEnabled){
+        impl->isBlockSparseMatrixEnabled = on;
+        // reallocate the matrices for the new storage at the next step
+        impl->prevGlobalNumConstraintVectors = -1;
+    }
+}
+
+
+bool ConstraintForceSolver::isBlockSparseMatrixEnabled() const
+{
+    return impl->isBlockSparseMatrixEnabled;
+}
+
+
+void ConstraintForceSolver::enableContactWarmStart(bool on)
+{
+    impl->isContactWarmStartEnabled = on;
+}
+
+
+bool ConstraintForceSolver::isContactWarmStartEnabled() const
+{
+    return impl->isContactWarmStartEnabled;
+}
+
+
+void ConstraintForceSolver::enableSleeping(bool on)
+{
+    impl->isSleepingEnabled = on;
+}
+
+
+bool ConstraintForceSolver::isSleepingEnabled() const
+{
+    return impl->isSleepingEnabled;
+}
+
+
+void ConstraintForceSolver::setSleepingThresholds(double linearVelocity, double angularVelocity, double time)
+{
+    impl->sleepingLinearVelocityThreshold = linearVelocity;
+    impl->sleepingAngularVelocityThreshold = angularVelocity;
+    impl->sleepingTime = time;
+}
+
+
+double ConstraintForceSolver::sleepingLinearVelocityThreshold() const
+{
+    return impl->sleepingLinearVelocityThreshold;
+}
+
+
+double ConstraintForceSolver::sleepingAngularVelocityThreshold() const
+{
+    return impl->sleepingAngularVelocityThreshold;
+}
+
+
+double ConstraintForceSolver::sleepingTime() const
+{
+    return impl->sleepingTime;
+}
+
+
+int ConstraintForceSolver::numSleepingBodies() const
+{
+    return impl->numSleepingBodies;
+}
+
+
+void ConstraintForceSolver::wakeUpBody(int bodyIndex)
+{
+    if(bodyIndex >= 0 && bodyIndex < (int)impl->bodiesData.size()){
+        impl->bodiesData[bodyIndex].isWakeUpRequested = true;
+    }
+}
+
+
+ReferencedPtr ConstraintForceSolver::storeState() const
+{
+    return impl->storeState();
+}
+
+
+void ConstraintForceSolver::restoreState(const Referenced* state)
+{
+    const CFSImpl::State* cfsState = dynamic_cast<const CFSImpl::State*>(state);
+    if(cfsState){
+        impl->restoreState(*cfsState);
+    }
+}
+
+
 void ConstraintForceSolver::set2Dmode(bool on)
 {
     impl->is2Dmode = on;
@@ -2500,6 +3842,12 @@ CollisionLinkPairListPtr ConstraintForceSolver::getCollisions()
     return impl->getCollisions();
 }
 
+
+void ConstraintForceSolver::getContacts(ContactBuffer& out_contacts)
+{
+    impl->getContacts(out_contacts);
+}
+
 #ifdef ENABLE_SIMULATION_PROFILING
 double ConstraintForceSolver::getCollisionTime()
 {
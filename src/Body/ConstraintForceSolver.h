@@ -7,6 +7,8 @@
 
 #include <cnoid/CollisionDetector>
 #include <cnoid/CollisionSeq>
+#include <cnoid/ContactBuffer>
+#include <cnoid/Referenced>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -50,15 +52,86 @@ public:
     double contactCorrectionDepth();
     double contactCorrectionVelocityRatio();
 
+    /**
+       When the margin is positive, the contacts of the previous step which are not detected in the
+       current step are kept as the speculative contacts while the gaps between the surfaces are
+       within the margin. This keeps the contact sets of the resting bodies and the dimension of the
+       constraint problem stable between the steps, which makes the contact warm start effective.
+       The speculative contacts are reported by getCollisions() only when they support forces.
+       The default margin is zero, which disables the speculative contacts.
+    */
+    void setSpeculativeContactMargin(double margin);
+    double speculativeContactMargin() const;
+
     void set2Dmode(bool on);
     void enableConstraintForceOutput(bool on);
 
+    /**
+       When this is enabled, the constraints are divided into the islands which are
+       not coupled with each other, and the MCP of each island is solved separately.
+       The islands are solved in parallel when the world has a task scheduler.
+    */
+    void enableIslandDecomposition(bool on);
+    bool isIslandDecompositionEnabled() const;
+
+    /**
+       When this is enabled, the MCP matrix only stores the elements between the
+       constraints coupled through non-static bodies, and the Gauss-Seidel iteration
+       skips the other elements, which are always zero.
+    */
+    void enableBlockSparseMatrix(bool on);
+    bool isBlockSparseMatrixEnabled() const;
+
+    /**
+       When this is enabled, the Gauss-Seidel solver starts from the forces of the
+       matching contacts of the previous step, which are cached for each link pair,
+       even when the number of the constraints changes.
+    */
+    void enableContactWarmStart(bool on);
+    bool isContactWarmStartEnabled() const;
+
+    /**
+       When this is enabled, a body whose root velocities and joint velocities stay below the thresholds
+       for the given time is put to sleep. The sleeping body is frozen and treated as a static body until
+       a moving body touches it or its joint positions, joint torques, external forces or root position
+       are changed, and then it is woken up in the next step.
+       The bodies with high-gain mode joints or extra joints and the bodies in the 2D mode do not sleep.
+    */
+    void enableSleeping(bool on);
+    bool isSleepingEnabled() const;
+
+    //! The default thresholds are 0.005 [m/s], 0.02 [rad/s] and 0.5 [s]
+    void setSleepingThresholds(double linearVelocity, double angularVelocity, double time);
+    double sleepingLinearVelocityThreshold() const;
+    double sleepingAngularVelocityThreshold() const;
+    double sleepingTime() const;
+
+    int numSleepingBodies() const;
+
+    //! The body is woken up at the beginning of the next step
+    void wakeUpBody(int bodyIndex);
+
+    /**
+       The returned object holds the data which the solver carries over from a step to the next one,
+       such as the LCP solution, the cached contact forces and the state of the random number generator.
+       Restoring the object makes the solver continue as it did from the step when the object was stored.
+       The object can only be restored to the solver which has stored it without calling initialize() in between.
+    */
+    ReferencedPtr storeState() const;
+    void restoreState(const Referenced* state);
+
     void initialize(void);
     void solve();
     void clearExternalForces();
 
     CollisionLinkPairListPtr getCollisions();
 
+    /**
+       Fills the buffer with the contacts and the constraint forces of the last step.
+       This function does not allocate memory when the buffer has enough capacity.
+    */
+    void getContacts(ContactBuffer& out_contacts);
+
 #ifdef ENABLE_SIMULATION_PROFILING
     double getCollisionTime();
 #endif
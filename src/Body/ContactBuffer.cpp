@@ -0,0 +1,108 @@
+/**
+   @file
+*/
+
+#include "ContactBuffer.h"
+#include <boost/make_shared.hpp>
+
+using namespace std;
+using namespace cnoid;
+
+
+ContactBuffer::ContactBuffer()
+    : contactOffsets_(1, 0)
+{
+    hasForces_ = true;
+}
+
+
+void ContactBuffer::clear()
+{
+    bodies_.clear();
+    links_.clear();
+    contactOffsets_.resize(1);
+    linkPairIndices_.clear();
+    points_.clear();
+    normals_.clear();
+    depths_.clear();
+    forces_.clear();
+    hasForces_ = true;
+}
+
+
+void ContactBuffer::reserve(int numLinkPairs, int numContacts)
+{
+    bodies_.reserve(numLinkPairs * 2);
+    links_.reserve(numLinkPairs * 2);
+    contactOffsets_.reserve(numLinkPairs + 1);
+    linkPairIndices_.reserve(numContacts);
+    points_.reserve(numContacts);
+    normals_.reserve(numContacts);
+    depths_.reserve(numContacts);
+    forces_.reserve(numContacts);
+}
+
+
+void ContactBuffer::swap(ContactBuffer& other)
+{
+    bodies_.swap(other.bodies_);
+    links_.swap(other.links_);
+    contactOffsets_.swap(other.contactOffsets_);
+    linkPairIndices_.swap(other.linkPairIndices_);
+    points_.swap(other.points_);
+    normals_.swap(other.normals_);
+    depths_.swap(other.depths_);
+    forces_.swap(other.forces_);
+    std::swap(hasForces_, other.hasForces_);
+}
+
+
+int ContactBuffer::addLinkPair(Body* body0, Link* link0, Body* body1, Link* link1)
+{
+    bodies_.push_back(body0);
+    bodies_.push_back(body1);
+    links_.push_back(link0);
+    links_.push_back(link1);
+    contactOffsets_.push_back(contactOffsets_.back());
+    return contactOffsets_.size() - 2;
+}
+
+
+void ContactBuffer::appendTo(std::vector<CollisionLinkPairPtr>& out_linkPairs) const
+{
+    const int n = numLinkPairs();
+    for(int i=0; i < n; ++i){
+        const int begin = contactOffsets_[i];
+        const int end = contactOffsets_[i + 1];
+        if(begin == end){
+            continue;
+        }
+        CollisionLinkPairPtr linkPair = boost::make_shared<CollisionLinkPair>();
+        for(int j=0; j < 2; ++j){
+            linkPair->body[j] = bodies_[i * 2 + j];
+            linkPair->link[j] = links_[i * 2 + j];
+        }
+        linkPair->collisions.resize(end - begin);
+        for(int k = begin; k < end; ++k){
+            Collision& collision = linkPair->collisions[k - begin];
+            collision.point = points_[k];
+            collision.normal = normals_[k];
+            collision.depth = depths_[k];
+        }
+        out_linkPairs.push_back(linkPair);
+    }
+}
+
+
+void ContactBuffer::appendFrom(const std::vector<CollisionLinkPairPtr>& linkPairs)
+{
+    for(size_t i=0; i < linkPairs.size(); ++i){
+        const CollisionLinkPair& linkPair = *linkPairs[i];
+        addLinkPair(linkPair.body[0].get(), linkPair.link[0], linkPair.body[1].get(), linkPair.link[1]);
+        const vector<Collision>& collisions = linkPair.collisions;
+        for(size_t j=0; j < collisions.size(); ++j){
+            const Collision& collision = collisions[j];
+            addContact(collision.point, collision.normal, collision.depth);
+        }
+    }
+}
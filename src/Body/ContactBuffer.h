@@ -0,0 +1,90 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_CONTACT_BUFFER_H
+#define CNOID_BODY_CONTACT_BUFFER_H
+
+#include "CollisionLinkPair.h"
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   This class stores the contacts of a simulation step as arrays of the elements.
+   The contacts are grouped by the link pairs, and the contacts of a link pair are stored
+   contiguously between contactBegin() and contactEnd() of the pair.
+
+   The normal of a contact points toward the inside of the second link of the pair, and the force
+   is the contact force acting on the second link. The force is zero when the engine does not
+   give it, in which case hasForces() returns false.
+
+   clear() keeps the allocated memory, so filling a buffer which is reused over the steps
+   does not allocate memory once the buffer has grown to the number of the contacts.
+*/
+class CNOID_EXPORT ContactBuffer
+{
+public:
+    ContactBuffer();
+
+    void clear();
+    void reserve(int numLinkPairs, int numContacts);
+    void swap(ContactBuffer& other);
+
+    //! The contacts added after this call belong to the link pair. @return the index of the pair
+    int addLinkPair(Body* body0, Link* link0, Body* body1, Link* link1);
+
+    void addContact(const Vector3& point, const Vector3& normal, double depth) {
+        addContact(point, normal, depth, Vector3::Zero());
+        hasForces_ = false;
+    }
+    void addContact(const Vector3& point, const Vector3& normal, double depth, const Vector3& force) {
+        points_.push_back(point);
+        normals_.push_back(normal);
+        depths_.push_back(depth);
+        forces_.push_back(force);
+        linkPairIndices_.push_back(contactOffsets_.size() - 2);
+        ++contactOffsets_.back();
+    }
+
+    bool empty() const { return depths_.empty(); }
+    int numLinkPairs() const { return contactOffsets_.size() - 1; }
+    int numContacts() const { return depths_.size(); }
+    bool hasForces() const { return hasForces_; }
+
+    Body* body(int linkPairIndex, int which) const { return bodies_[linkPairIndex * 2 + which]; }
+    Link* link(int linkPairIndex, int which) const { return links_[linkPairIndex * 2 + which]; }
+    int contactBegin(int linkPairIndex) const { return contactOffsets_[linkPairIndex]; }
+    int contactEnd(int linkPairIndex) const { return contactOffsets_[linkPairIndex + 1]; }
+
+    int linkPairIndex(int contactIndex) const { return linkPairIndices_[contactIndex]; }
+    const Vector3& point(int contactIndex) const { return points_[contactIndex]; }
+    const Vector3& normal(int contactIndex) const { return normals_[contactIndex]; }
+    double depth(int contactIndex) const { return depths_[contactIndex]; }
+    const Vector3& force(int contactIndex) const { return forces_[contactIndex]; }
+
+    const std::vector<Vector3>& points() const { return points_; }
+    const std::vector<Vector3>& normals() const { return normals_; }
+    const std::vector<double>& depths() const { return depths_; }
+    const std::vector<Vector3>& forces() const { return forces_; }
+
+    //! The link pairs which have no contacts are skipped
+    void appendTo(std::vector<CollisionLinkPairPtr>& out_linkPairs) const;
+    void appendFrom(const std::vector<CollisionLinkPairPtr>& linkPairs);
+
+private:
+    std::vector<Body*> bodies_;
+    std::vector<Link*> links_;
+    std::vector<int> contactOffsets_;
+    std::vector<int> linkPairIndices_;
+    std::vector<Vector3> points_;
+    std::vector<Vector3> normals_;
+    std::vector<double> depths_;
+    std::vector<Vector3> forces_;
+    bool hasForces_;
+};
+
+}
+
+#endif
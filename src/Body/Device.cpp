@@ -15,6 +15,7 @@ Device::Device()
     ns->index = -1;
     ns->id = -1;
     ns->link = 0;
+    ns->stateChangeFlags = 0;
     T_local().setIdentity();
     setCycle(20.0);
 }
@@ -30,6 +31,7 @@ Device::Device(const Device& org, bool copyStateOnly)
         ns->id = org.ns->id;
         ns->name = org.ns->name;
         ns->link = 0;
+        ns->stateChangeFlags = 0;
         T_local() = org.T_local();
         setCycle(org.cycle());
     }
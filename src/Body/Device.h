@@ -9,6 +9,7 @@
 #include <cnoid/EigenTypes>
 #include <cnoid/Signal>
 #include <string>
+#include <vector>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -61,6 +62,8 @@ class CNOID_EXPORT Device : public DeviceState
         double cycle;
         const Isometry3& const_T_local() const { return T_local; }
         Signal<void()> sigStateChanged;
+        // The flags of the devices of the body, which are owned by the body
+        std::vector<unsigned char>* stateChangeFlags;
     };
         
     NonState* ns;
@@ -77,6 +80,9 @@ public:
     void setName(const std::string& name) { ns->name = name; }
     void setLink(Link* link) { ns->link = link; }
 
+    //! This is called by Body::addDevice() to share the state change flags of the body
+    void setStateChangeFlags(std::vector<unsigned char>* flags) { ns->stateChangeFlags = flags; }
+
     virtual Device* clone() const = 0;
     virtual void forEachActualType(boost::function<bool(const std::type_info& type)> func);
     virtual void clearState();
@@ -118,7 +124,14 @@ public:
         return ns->sigStateChanged;
     }
 
+    /**
+       The state change flag of the device in the body is also set so that the change is published
+       by Body::notifyDeviceStateChanges() together with the changes of the other devices.
+    */
     void notifyStateChange() {
+        if(ns->stateChangeFlags){
+            (*ns->stateChangeFlags)[ns->index] = 1;
+        }
         ns->sigStateChanged();
     }
 
@@ -0,0 +1,204 @@
+/**
+   @file
+*/
+
+#include "DeviceStateEncoder.h"
+#include "RangeCamera.h"
+#include <cnoid/Exception>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <deque>
+#include <iostream>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class DeviceStateEncoderImpl
+{
+public:
+    DeviceStateEncoder::ImageCompression imageCompression;
+    int jpegQuality;
+    bool isPointDataCompressionEnabled;
+
+    boost::thread encodingThread;
+    boost::mutex mutex;
+    boost::condition_variable requestCondition;
+    boost::condition_variable completionCondition;
+    deque<DeviceStatePtr> queuedStates;
+    bool isEncodingThreadActive;
+    bool isEncodingThreadStopRequested;
+    // The counts are compared to wait for the states given before waitForEncoding() is called
+    long numRequestedStates;
+    long numEncodedStates;
+
+    DeviceStateEncoderImpl();
+    ~DeviceStateEncoderImpl();
+    void encodeLater(DeviceState* state);
+    void waitForEncoding();
+    void runEncodingThread();
+    void encode(DeviceState* state);
+};
+
+}
+
+
+DeviceStateEncoder::DeviceStateEncoder()
+{
+    impl = new DeviceStateEncoderImpl;
+}
+
+
+DeviceStateEncoderImpl::DeviceStateEncoderImpl()
+{
+    imageCompression = DeviceStateEncoder::LOSSLESS_IMAGE_COMPRESSION;
+    jpegQuality = 90;
+    isPointDataCompressionEnabled = true;
+    isEncodingThreadActive = false;
+    isEncodingThreadStopRequested = false;
+    numRequestedStates = 0;
+    numEncodedStates = 0;
+}
+
+
+DeviceStateEncoder::~DeviceStateEncoder()
+{
+    delete impl;
+}
+
+
+//! The queued states are compressed before the thread exits.
+DeviceStateEncoderImpl::~DeviceStateEncoderImpl()
+{
+    if(isEncodingThreadActive){
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            isEncodingThreadStopRequested = true;
+        }
+        requestCondition.notify_all();
+        encodingThread.join();
+    }
+}
+
+
+void DeviceStateEncoder::setImageCompression(ImageCompression compression)
+{
+    impl->imageCompression = compression;
+}
+
+
+DeviceStateEncoder::ImageCompression DeviceStateEncoder::imageCompression() const
+{
+    return impl->imageCompression;
+}
+
+
+void DeviceStateEncoder::setJpegQuality(int quality)
+{
+    impl->jpegQuality = std::max(0, std::min(quality, 100));
+}
+
+
+void DeviceStateEncoder::setPointDataCompressionEnabled(bool on)
+{
+    impl->isPointDataCompressionEnabled = on;
+}
+
+
+bool DeviceStateEncoder::isPointDataCompressionEnabled() const
+{
+    return impl->isPointDataCompressionEnabled;
+}
+
+
+void DeviceStateEncoder::encodeLater(DeviceState* state)
+{
+    impl->encodeLater(state);
+}
+
+
+void DeviceStateEncoderImpl::encodeLater(DeviceState* state)
+{
+    if(!dynamic_cast<Camera*>(state)){
+        return;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        queuedStates.push_back(state);
+        ++numRequestedStates;
+    }
+    if(!isEncodingThreadActive){
+        isEncodingThreadStopRequested = false;
+        encodingThread = boost::thread(boost::bind(&DeviceStateEncoderImpl::runEncodingThread, this));
+        isEncodingThreadActive = true;
+    } else {
+        requestCondition.notify_all();
+    }
+}
+
+
+void DeviceStateEncoder::waitForEncoding()
+{
+    impl->waitForEncoding();
+}
+
+
+void DeviceStateEncoderImpl::waitForEncoding()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    const long numStatesToWait = numRequestedStates;
+    while(numEncodedStates < numStatesToWait){
+        completionCondition.wait(lock);
+    }
+}
+
+
+void DeviceStateEncoderImpl::runEncodingThread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(true){
+        while(queuedStates.empty() && !isEncodingThreadStopRequested){
+            requestCondition.wait(lock);
+        }
+        if(queuedStates.empty()){
+            break;
+        }
+        DeviceStatePtr state = queuedStates.front();
+        queuedStates.pop_front();
+        lock.unlock();
+
+        encode(state);
+        state.reset();
+
+        lock.lock();
+        ++numEncodedStates;
+        completionCondition.notify_all();
+    }
+}
+
+
+/**
+   The states which cannot be compressed are left as they are.
+*/
+void DeviceStateEncoderImpl::encode(DeviceState* state)
+{
+    Camera* camera = static_cast<Camera*>(state);
+    try {
+        if(imageCompression != DeviceStateEncoder::NO_IMAGE_COMPRESSION){
+            camera->encodeImage(
+                (imageCompression == DeviceStateEncoder::LOSSY_IMAGE_COMPRESSION) ? ImageIO::JPEG : ImageIO::PNG,
+                jpegQuality);
+        }
+        if(isPointDataCompressionEnabled){
+            if(RangeCamera* rangeCamera = dynamic_cast<RangeCamera*>(camera)){
+                rangeCamera->encodePointData();
+            }
+        }
+    }
+    catch(const exception_base& ex){
+        if(const std::string* message = boost::get_error_info<error_info_message>(ex)){
+            cerr << *message << endl;
+        }
+    }
+}
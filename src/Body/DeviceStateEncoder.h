@@ -0,0 +1,62 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_DEVICE_STATE_ENCODER_H
+#define CNOID_BODY_DEVICE_STATE_ENCODER_H
+
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class DeviceState;
+class DeviceStateEncoderImpl;
+
+/**
+   This class compresses the images and the point data of the recorded states of the cameras
+   and the range cameras in a background thread to reduce the memory of the recorded states.
+   The compressed data is decompressed when the data of a state is accessed.
+   The other types of the states are not modified.
+*/
+class CNOID_EXPORT DeviceStateEncoder
+{
+public:
+    DeviceStateEncoder();
+    ~DeviceStateEncoder();
+
+    enum ImageCompression {
+        NO_IMAGE_COMPRESSION,
+        //! The PNG format
+        LOSSLESS_IMAGE_COMPRESSION,
+        //! The JPEG format. The images which have the alpha component are compressed in the PNG format.
+        LOSSY_IMAGE_COMPRESSION
+    };
+    void setImageCompression(ImageCompression compression);
+    ImageCompression imageCompression() const;
+
+    //! The quality (0-100) of the lossy image compression. The default value is 90.
+    void setJpegQuality(int quality);
+
+    //! The point data of the range cameras is compressed if this is enabled. This is enabled by default.
+    void setPointDataCompressionEnabled(bool on);
+    bool isPointDataCompressionEnabled() const;
+
+    /**
+       The state is compressed in the background thread if it has the data to compress.
+       The state must not be accessed until waitForEncoding() returns.
+    */
+    void encodeLater(DeviceState* state);
+
+    //! Wait until the states given before this function is called are compressed.
+    void waitForEncoding();
+
+private:
+    DeviceStateEncoderImpl* impl;
+
+    DeviceStateEncoder(const DeviceStateEncoder& org);
+    DeviceStateEncoder& operator=(const DeviceStateEncoder& rhs);
+};
+
+}
+
+#endif
@@ -13,14 +13,35 @@ using namespace cnoid;
 
 DyLink::DyLink()
 {
-
+    initializeDynamicsVariables();
 }
 
 
 DyLink::DyLink(const Link& link)
     : Link(link)
 {
+    initializeDynamicsVariables();
+}
 
+
+void DyLink::initializeDynamicsVariables()
+{
+    // Some of the values are used before they are calculated in the first step
+    vo_.setZero();
+    dvo_.setZero();
+    sw_.setZero();
+    sv_.setZero();
+    cv_.setZero();
+    cw_.setZero();
+    Iww_.setZero();
+    Iwv_.setZero();
+    Ivv_.setZero();
+    pf_.setZero();
+    ptau_.setZero();
+    hhv_.setZero();
+    hhw_.setZero();
+    uu_ = 0.0;
+    dd_ = 0.0;
 }
 
 
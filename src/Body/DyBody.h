@@ -77,6 +77,8 @@ public:
     virtual void appendChild(Link* link);
         
 private:
+    void initializeDynamicsVariables();
+    
     Vector3 vo_;  ///< translation elements of spacial velocity
     Vector3 dvo_; ///< derivative of vo
     
@@ -7,7 +7,10 @@
 #include "ForwardDynamicsABM.h"
 #include "ForwardDynamicsCBM.h"
 #include <cnoid/EigenUtil>
+#include <cnoid/TaskScheduler>
+#include <boost/bind.hpp>
 #include <string>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -29,7 +32,14 @@ WorldBase::WorldBase()
     isEulerMethod =false;
     sensorsAreEnabled = false;
     isOldAccelSensorCalcMode = false;
+    isPackedLinkWorkspaceEnabled = false;
     numRegisteredLinkPairs = 0;
+    maxNumThreads = 0;
+    taskScheduler_ = 0;
+    profiler_ = 0;
+    for(int i=0; i < NUM_PROFILING_STAGES; ++i){
+        profilingStageIds[i] = -1;
+    }
 }
 
 
@@ -95,13 +105,41 @@ void WorldBase::setOldAccelSensorCalcMode(bool on)
 }
 
 
+void WorldBase::setNumThreads(int n)
+{
+    maxNumThreads = std::max(0, n);
+}
+
+
+void WorldBase::setProfiler(SimulationProfiler* profiler)
+{
+    profiler_ = profiler;
+    if(profiler){
+        profilingStageIds[VIRTUAL_JOINT_FORCE_STAGE] = profiler->registerStage("Virtual joint forces");
+        profilingStageIds[CONSTRAINT_FORCE_STAGE] = profiler->registerStage("Constraint force solving");
+        profilingStageIds[COLLISION_DETECTION_STAGE] = profiler->registerStage("Collision detection");
+        profilingStageIds[FORWARD_DYNAMICS_STAGE] = profiler->registerStage("Forward dynamics");
+    }
+}
+
+
+void WorldBase::enablePackedLinkWorkspace(bool on)
+{
+    isPackedLinkWorkspaceEnabled = on;
+}
+
+
 void WorldBase::initialize()
 {
     const int n = bodyInfoArray.size();
 
+    const int numThreads = std::min(maxNumThreads, n);
+    taskScheduler_ = (numThreads > 1) ? TaskScheduler::instance() : 0;
+
     for(int i=0; i < n; ++i){
 
         BodyInfo& info = bodyInfoArray[i];
+        info.isSleeping = false;
 
         if(!info.forwardDynamics){
             info.forwardDynamics = make_shared_aligned<ForwardDynamicsABM>(info.body);
@@ -116,6 +154,10 @@ void WorldBase::initialize()
         info.forwardDynamics->setTimeStep(timeStep_);
         info.forwardDynamics->enableSensors(sensorsAreEnabled);
         info.forwardDynamics->setOldAccelSensorCalcMode(isOldAccelSensorCalcMode);
+        ForwardDynamicsABM* abm = dynamic_cast<ForwardDynamicsABM*>(info.forwardDynamics.get());
+        if(abm){
+            abm->enablePackedLinkWorkspace(isPackedLinkWorkspaceEnabled);
+        }
         info.forwardDynamics->initialize();
     }
 }
@@ -137,13 +179,38 @@ void WorldBase::calcNextState()
     if(debugMode){
         cout << "World current time = " << currentTime_ << endl;
     }
-    const int n = bodyInfoArray.size();
+    if(taskScheduler_){
+        calcNextStatesOfBodiesInParallel();
+    } else {
+        const int n = bodyInfoArray.size();
+        for(int i=0; i < n; ++i){
+            BodyInfo& info = bodyInfoArray[i];
+            if(!info.isSleeping){
+                info.forwardDynamics->calcNextState();
+            }
+        }
+    }
+    currentTime_ += timeStep_;
+}
 
+
+/**
+   Each body is given to the scheduler as a separate task because the computational
+   costs of the bodies usually differ a lot (e.g. a humanoid robot and a box).
+   The forward dynamics of a body only accesses the states of the body itself,
+   so the results do not depend on the execution order.
+*/
+void WorldBase::calcNextStatesOfBodiesInParallel()
+{
+    TaskGroup group(taskScheduler_);
+    const int n = bodyInfoArray.size();
     for(int i=0; i < n; ++i){
         BodyInfo& info = bodyInfoArray[i];
-        info.forwardDynamics->calcNextState();
+        if(!info.isSleeping){
+            group.run(boost::bind(&ForwardDynamics::calcNextState, info.forwardDynamics.get()));
+        }
     }
-    currentTime_ += timeStep_;
+    group.wait();
 }
 
 
@@ -155,6 +222,7 @@ int WorldBase::addBody(DyBody* body)
     BodyInfo info;
     info.body = body;
     info.hasVirtualJointForces = body->hasVirtualJointForces();
+    info.isSleeping = false;
     bodyInfoArray.push_back(info);
 
     return bodyInfoArray.size() - 1;
@@ -7,6 +7,7 @@
 #define CNOID_BODY_DYWORLD_H
 
 #include "ForwardDynamics.h"
+#include "SimulationProfiler.h"
 #include <cnoid/TimeMeasure>
 #include <map>
 #include "exportdecl.h"
@@ -15,6 +16,7 @@ namespace cnoid {
 
 class DyLink;
 class DyBody;
+class TaskScheduler;
 typedef ref_ptr<DyBody> DyBodyPtr;
 
 #ifdef ENABLE_SIMULATION_PROFILING
@@ -78,6 +80,18 @@ public:
        a forward dynamics calculater.
     */
     int addBody(DyBody* body, const ForwardDynamicsPtr& forwardDynamics);
+
+    /**
+       The forward dynamics of a sleeping body is not calculated, so the body is kept frozen.
+       The constraint force solver puts the bodies which have come to rest to sleep
+       when the sleeping is enabled in it. All the bodies are awake after initialize().
+    */
+    void setBodySleeping(int index, bool on) {
+        bodyInfoArray[index].isSleeping = on;
+    }
+    bool isBodySleeping(int index) const {
+        return bodyInfoArray[index].isSleeping;
+    }
         
     /**
        @brief clear bodies in this world
@@ -145,6 +159,54 @@ public:
     */
     void setRungeKuttaMethod();
 
+    /**
+       @brief set the number of threads used for the per-body forward dynamics
+       @param n the number of threads. Zero means that the bodies are processed serially.
+       @note This must be called before initialize() is called.
+       The bodies are processed by the shared TaskScheduler when the value is larger than one,
+       so the value only switches the parallel processing on and the actual number of the threads
+       is that of the scheduler.
+       The results are the same as those of the serial processing because
+       each body is integrated independently after the constraint forces are solved.
+    */
+    void setNumThreads(int n);
+
+    int numThreads() const { return maxNumThreads; }
+
+    /**
+       @brief enable the packed link workspace of ForwardDynamicsABM for the bodies using it
+       @note This must be called before initialize() is called.
+       \see ForwardDynamicsABM::enablePackedLinkWorkspace
+    */
+    void enablePackedLinkWorkspace(bool on);
+
+    /**
+       @return the task scheduler for the parallel computations, or null when the serial mode is used.
+       The scheduler is available after initialize() is called and it is also used by
+       the constraint force solver.
+    */
+    TaskScheduler* taskScheduler() const { return taskScheduler_; }
+
+    /**
+       @brief set the profiler which records the durations of the stages of calcNextState()
+       @param profiler the profiler to use. Null disables the profiling.
+       The stages are the virtual joint forces, the constraint force solving, the collision
+       detection (which is a part of the constraint force solving) and the forward dynamics.
+    */
+    void setProfiler(SimulationProfiler* profiler);
+
+    SimulationProfiler* profiler() const { return profiler_; }
+
+    enum ProfilingStageID {
+        VIRTUAL_JOINT_FORCE_STAGE,
+        CONSTRAINT_FORCE_STAGE,
+        COLLISION_DETECTION_STAGE,
+        FORWARD_DYNAMICS_STAGE,
+        NUM_PROFILING_STAGES
+    };
+
+    int profilingStageId(ProfilingStageID stage) const { return profilingStageIds[stage]; }
+
     /**
        @brief initialize this world. This must be called after all bodies are registered.
     */
@@ -174,11 +236,13 @@ protected:
         DyBodyPtr body;
         ForwardDynamicsPtr forwardDynamics;
         bool hasVirtualJointForces;
+        bool isSleeping;
     };
     std::vector<BodyInfo> bodyInfoArray;
 
     bool sensorsAreEnabled;
     bool isOldAccelSensorCalcMode;
+    bool isPackedLinkWorkspaceEnabled;
 
 private:
     typedef std::map<std::string, int> NameToIndexMap;
@@ -200,7 +264,13 @@ private:
     LinkPairKeyToIndexMap linkPairKeyToIndexMap;
 
     int numRegisteredLinkPairs;
-		
+
+    int maxNumThreads;
+    TaskScheduler* taskScheduler_;
+    SimulationProfiler* profiler_;
+    int profilingStageIds[NUM_PROFILING_STAGES];
+
+    void calcNextStatesOfBodiesInParallel();
 };
 
 template <class TConstraintForceSolver> class World : public WorldBase
@@ -223,20 +293,30 @@ public:
     }
 
     virtual void calcNextState(){
+        SimulationProfiler* prof = profiler();
 #ifdef ENABLE_SIMULATION_PROFILING
             timer.begin();
 #endif
-        WorldBase::setVirtualJointForces();
+        {
+            SimulationProfiler::Scope scope(prof, profilingStageId(VIRTUAL_JOINT_FORCE_STAGE));
+            WorldBase::setVirtualJointForces();
+        }
 #ifdef ENABLE_SIMULATION_PROFILING
         customizerTime = timer.measure();
         timer.begin();
 #endif
-        constraintForceSolver.solve();
+        {
+            SimulationProfiler::Scope scope(prof, profilingStageId(CONSTRAINT_FORCE_STAGE));
+            constraintForceSolver.solve();
+        }
 #ifdef ENABLE_SIMULATION_PROFILING
         forceSolveTime = timer.measure();
         timer.begin();
 #endif
-        WorldBase::calcNextState();
+        {
+            SimulationProfiler::Scope scope(prof, profilingStageId(FORWARD_DYNAMICS_STAGE));
+            WorldBase::calcNextState();
+        }
 #ifdef ENABLE_SIMULATION_PROFILING
         forwardDynamicsTime = timer.measure();
 #endif
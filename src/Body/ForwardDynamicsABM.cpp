@@ -7,6 +7,7 @@
 #include "DyBody.h"
 #include "LinkTraverse.h"
 #include <cnoid/EigenUtil>
+#include <map>
 
 using namespace std;
 using namespace boost;
@@ -15,6 +16,368 @@ using namespace cnoid;
 static const bool debugMode = false;
 static const bool rootAttitudeNormalizationEnabled = false;
 
+namespace cnoid {
+
+/**
+   The link variables used in the ABM passes, packed into the arrays indexed by
+   the position in the link traverse. The children of a link are stored as a
+   contiguous range of childIndices so that they are visited in the same order
+   as the child-sibling list of the link objects.
+*/
+class ABMPackedLinkWorkspace
+{
+public:
+    typedef std::vector<Vector3> Vector3Array;
+    typedef std::vector<Matrix3> Matrix3Array;
+
+    int numLinks;
+    std::vector<DyLink*> links;
+    std::vector<int> parents;
+    std::vector<Link::JointType> jointTypes;
+    std::vector<char> isFixedJoint;
+    std::vector<int> childBegins;
+    std::vector<int> childIndices;
+
+    // link parameters
+    Vector3Array b;
+    Vector3Array a;
+    Vector3Array c;
+    Matrix3Array I;
+    std::vector<double> m;
+    std::vector<double> Jm2;
+
+    // inputs given to a step
+    Vector3Array f_ext;
+    Vector3Array tau_ext;
+    std::vector<double> u;
+
+    // state variables
+    Position rootT;
+    std::vector<double> q;
+    std::vector<double> dq;
+    std::vector<double> q0;
+    std::vector<double> dq0;
+    std::vector<double> dqSum;
+    std::vector<double> ddqSum;
+
+    // variables calculated in the ABM passes
+    Matrix3Array R;
+    Vector3Array p;
+    Vector3Array w;
+    Vector3Array vo;
+    Vector3Array sw;
+    Vector3Array sv;
+    Vector3Array cv;
+    Vector3Array cw;
+    Vector3Array wc;
+    Matrix3Array Iww;
+    Matrix3Array Iwv;
+    Matrix3Array Ivv;
+    Vector3Array pf;
+    Vector3Array ptau;
+    Vector3Array hhv;
+    Vector3Array hhw;
+    std::vector<double> uu;
+    std::vector<double> dd;
+    std::vector<double> ddq;
+    Vector3Array dvo;
+    Vector3Array dw;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+    ABMPackedLinkWorkspace(const LinkTraverse& traverse);
+    void gather();
+    void calcPhase1(const Vector3& g);
+    void calcPhase2();
+    void calcPhase3();
+};
+
+}
+
+
+ABMPackedLinkWorkspace::ABMPackedLinkWorkspace(const LinkTraverse& traverse)
+{
+    const int n = traverse.numLinks();
+    numLinks = n;
+
+    links.resize(n);
+    std::map<Link*, int> traverseIndices;
+    for(int i=0; i < n; ++i){
+        links[i] = static_cast<DyLink*>(traverse[i]);
+        traverseIndices[links[i]] = i;
+    }
+
+    parents.resize(n);
+    jointTypes.resize(n);
+    isFixedJoint.resize(n);
+    childBegins.resize(n + 1);
+    childIndices.clear();
+    b.resize(n);
+    a.resize(n);
+    c.resize(n);
+    I.resize(n);
+    m.resize(n);
+    Jm2.resize(n);
+
+    for(int i=0; i < n; ++i){
+        DyLink* link = links[i];
+        DyLink* parent = link->parent();
+        std::map<Link*, int>::iterator found = traverseIndices.find(parent);
+        parents[i] = (i > 0 && found != traverseIndices.end()) ? found->second : -1;
+        childBegins[i] = childIndices.size();
+        for(DyLink* child = link->child(); child; child = child->sibling()){
+            childIndices.push_back(traverseIndices[child]);
+        }
+        jointTypes[i] = link->jointType();
+        isFixedJoint[i] = link->isFixedJoint();
+        b[i] = link->b();
+        a[i] = link->a();
+        c[i] = link->c();
+        I[i] = link->I();
+        m[i] = link->m();
+        Jm2[i] = link->Jm2();
+    }
+    childBegins[n] = childIndices.size();
+
+    f_ext.resize(n);
+    tau_ext.resize(n);
+    u.resize(n);
+    q.resize(n);
+    dq.resize(n);
+    q0.resize(n);
+    dq0.resize(n);
+    dqSum.resize(n);
+    ddqSum.resize(n);
+    R.resize(n);
+    p.resize(n);
+    w.resize(n);
+    vo.resize(n);
+    sw.resize(n);
+    sv.resize(n);
+    cv.resize(n);
+    cw.resize(n);
+    wc.resize(n);
+    Iww.resize(n);
+    Iwv.resize(n);
+    Ivv.resize(n);
+    pf.resize(n);
+    ptau.resize(n);
+    hhv.resize(n);
+    hhw.resize(n);
+    uu.resize(n);
+    dd.resize(n);
+    ddq.resize(n);
+    dvo.resize(n);
+    dw.resize(n);
+}
+
+
+/**
+   Copy the state of the links at the beginning of a step.
+   The variables which are not initialized here are calculated in the passes
+   before they are used.
+*/
+void ABMPackedLinkWorkspace::gather()
+{
+    DyLink* root = links[0];
+    rootT = root->T();
+    w[0] = root->w();
+    vo[0] = root->vo();
+    sw[0] = root->sw();
+    sv[0] = root->sv();
+    cv[0] = root->cv();
+    cw[0] = root->cw();
+    dvo[0] = root->dvo();
+    dw[0] = root->dw();
+
+    for(int i=0; i < numLinks; ++i){
+        DyLink* link = links[i];
+        f_ext[i] = link->f_ext();
+        tau_ext[i] = link->tau_ext();
+        u[i] = link->u();
+        q[i] = link->q();
+        dq[i] = link->dq();
+        ddq[i] = link->ddq();
+    }
+}
+
+
+/**
+   The same calculation as ForwardDynamicsABM::calcABMPhase1(false)
+*/
+void ABMPackedLinkWorkspace::calcPhase1(const Vector3& g)
+{
+    R[0] = rootT.linear();
+    p[0] = rootT.translation();
+
+    for(int i=0; i < numLinks; ++i){
+        const int j = parents[i];
+
+        if(j >= 0){
+            
+            switch(jointTypes[i]){
+                
+            case Link::ROTATIONAL_JOINT:
+            {
+                const Vector3 arm = R[j] * b[i];
+                R[i].noalias() = R[j] * AngleAxisd(q[i], a[i]);
+                p[i].noalias() = arm + p[j];
+                sw[i].noalias() = R[j] * a[i];
+                sv[i].noalias() = p[i].cross(sw[i]);
+                w[i].noalias() = dq[i] * sw[i] + w[j];
+                break;
+            }
+                
+            case Link::SLIDE_JOINT:
+                p[i].noalias() = R[j] * (b[i] + q[i] * a[i]) + p[j];
+                R[i] = R[j];
+                sw[i].setZero();
+                sv[i].noalias() = R[j] * a[i];
+                w[i] = w[j];
+                break;
+                
+            case Link::FIXED_JOINT:
+            default:
+                p[i].noalias() = R[j] * b[i] + p[j];
+                R[i] = R[j];
+                w[i] = w[j];
+                vo[i] = vo[j];
+                sw[i].setZero();
+                sv[i].setZero();
+                cv[i].setZero();
+                cw[i].setZero();
+                goto COMMON_CALCS_FOR_ALL_JOINT_TYPES;
+            }
+            
+            // Common for ROTATE and SLIDE
+            vo[i].noalias() = dq[i] * sv[i] + vo[j];
+            const Vector3 dsv = w[j].cross(sv[i]) + vo[j].cross(sw[i]);
+            const Vector3 dsw = w[j].cross(sw[i]);
+            cv[i] = dq[i] * dsv;
+            cw[i] = dq[i] * dsw;
+        }
+        
+COMMON_CALCS_FOR_ALL_JOINT_TYPES:
+
+        wc[i].noalias() = R[i] * c[i] + p[i];
+        
+        const Matrix3 Iw = R[i] * I[i] * R[i].transpose();
+        
+        const double mi = m[i];
+        const Matrix3 c_hat = hat(wc[i]);
+        Iww[i].noalias() = mi * c_hat * c_hat.transpose() + Iw;
+
+        Ivv[i] <<
+            mi,  0.0, 0.0,
+            0.0,  mi,  0.0,
+            0.0, 0.0,  mi;
+        
+        Iwv[i] = mi * c_hat;
+        
+        const Vector3 P = mi * (vo[i] + w[i].cross(wc[i]));
+        const Vector3 L = Iww[i] * w[i] + mi * wc[i].cross(vo[i]);
+        
+        pf[i].noalias() = w[i].cross(P);
+        ptau[i].noalias() = vo[i].cross(P) + w[i].cross(L);
+        
+        const Vector3 fg = mi * g;
+        const Vector3 tg = wc[i].cross(fg);
+        
+        pf[i] -= fg;
+        ptau[i] -= tg;
+    }
+}
+
+
+/**
+   The same calculation as ForwardDynamicsABM::calcABMPhase2()
+*/
+void ABMPackedLinkWorkspace::calcPhase2()
+{
+    for(int i = numLinks-1; i >= 0; --i){
+
+        pf[i]   -= f_ext[i];
+        ptau[i] -= tau_ext[i];
+
+        const int childEnd = childBegins[i+1];
+        for(int k = childBegins[i]; k < childEnd; ++k){
+            const int j = childIndices[k];
+
+            if(isFixedJoint[j]){
+                Ivv[i] += Ivv[j];
+                Iwv[i] += Iwv[j];
+                Iww[i] += Iww[j];
+
+            }else{
+                const Vector3 hhv_dd = hhv[j] / dd[j];
+                Ivv[i].noalias() += Ivv[j] - hhv[j] * hhv_dd.transpose();
+                Iwv[i].noalias() += Iwv[j] - hhw[j] * hhv_dd.transpose();
+                Iww[i].noalias() += Iww[j] - hhw[j] * (hhw[j] / dd[j]).transpose();
+            }
+
+            pf[i]  .noalias() += Ivv[j] * cv[j] + Iwv[j].transpose() * cw[j] + pf[j];
+            ptau[i].noalias() += Iwv[j] * cv[j] + Iww[j] * cw[j] + ptau[j];
+
+            if(!isFixedJoint[j]){
+                const double uu_dd = uu[j] / dd[j];
+                pf[i]   += uu_dd * hhv[j];
+                ptau[i] += uu_dd * hhw[j];
+            }
+        }
+
+        if(i > 0){
+            if(!isFixedJoint[i]){
+                hhv[i].noalias() = Ivv[i] * sv[i] + Iwv[i].transpose() * sw[i];
+                hhw[i].noalias() = Iwv[i] * sv[i] + Iww[i] * sw[i];
+                dd[i] = sv[i].dot(hhv[i]) + sw[i].dot(hhw[i]) + Jm2[i];
+                uu[i] = u[i] -
+                    (hhv[i].dot(cv[i]) + hhw[i].dot(cw[i]) + sv[i].dot(pf[i]) + sw[i].dot(ptau[i]));
+            }
+        }
+    }
+}
+
+
+/**
+   The same calculation as ForwardDynamicsABM::calcABMPhase3()
+*/
+void ABMPackedLinkWorkspace::calcPhase3()
+{
+    if(jointTypes[0] == Link::FREE_JOINT){
+
+        Eigen::Matrix<double, 6, 6> M;
+        M << Ivv[0], Iwv[0].transpose(),
+            Iwv[0], Iww[0];
+        
+        Eigen::Matrix<double, 6, 1> f;
+        f << pf[0],
+            ptau[0];
+        f *= -1.0;
+
+        Eigen::Matrix<double, 6, 1> x(M.colPivHouseholderQr().solve(f));
+
+        dvo[0] = x.head<3>();
+        dw[0] = x.tail<3>();
+
+    } else {
+        dvo[0].setZero();
+        dw[0].setZero();
+    }
+
+    for(int i=1; i < numLinks; ++i){
+        const int j = parents[i];
+        if(!isFixedJoint[i]){
+            ddq[i] = (uu[i] - (hhv[i].dot(dvo[j]) + hhw[i].dot(dw[j]))) / dd[i];
+            dvo[i].noalias() = dvo[j] + cv[i] + sv[i] * ddq[i];
+            dw[i].noalias()  = dw[j]  + cw[i] + sw[i] * ddq[i];
+        }else{
+            ddq[i] = 0.0;
+            dvo[i] = dvo[j];
+            dw[i]  = dw[j]; 
+        }
+    }
+}
+
 
 ForwardDynamicsABM::ForwardDynamicsABM(DyBody* body) :
     ForwardDynamics(body),
@@ -23,13 +386,20 @@ ForwardDynamicsABM::ForwardDynamicsABM(DyBody* body) :
     dq(body->numLinks()),
     ddq(body->numLinks())
 {
-
+    isPackedLinkWorkspaceEnabled_ = false;
+    packed = 0;
 }
 
 
 ForwardDynamicsABM::~ForwardDynamicsABM()
 {
+    delete packed;
+}
 
+
+void ForwardDynamicsABM::enablePackedLinkWorkspace(bool on)
+{
+    isPackedLinkWorkspaceEnabled_ = on;
 }
 
 
@@ -45,6 +415,12 @@ void ForwardDynamicsABM::initialize()
     rootLink->uu() = 0.0;
     rootLink->dd() = 0.0;
 
+    delete packed;
+    packed = 0;
+    if(isPackedLinkWorkspaceEnabled_){
+        packed = new ABMPackedLinkWorkspace(body->linkTraverse());
+    }
+
     initializeSensors();
     calcABMFirstHalf();
 }
@@ -73,7 +449,11 @@ void ForwardDynamicsABM::calcNextState()
         break;
 		
     case RUNGEKUTTA_METHOD:
-        calcMotionWithRungeKuttaMethod();
+        if(packed){
+            calcMotionWithRungeKuttaMethodInPackedWorkspace();
+        } else {
+            calcMotionWithRungeKuttaMethod();
+        }
         break;
     }
 
@@ -212,6 +592,98 @@ void ForwardDynamicsABM::calcMotionWithRungeKuttaMethod()
 }
 
 
+/**
+   This function does the same calculation as calcMotionWithRungeKuttaMethod(),
+   but the three intermediate ABM passes are calculated in the packed workspace.
+   The links are only updated with the integrated state and the accelerations of the last pass.
+*/
+void ForwardDynamicsABM::calcMotionWithRungeKuttaMethodInPackedWorkspace()
+{
+    DyLink* root = body->rootLink();
+
+    if(!root->isFixedJoint()){
+        T0 = root->T();
+        vo0 = root->vo();
+        w0  = root->w();
+    }
+
+    vo.setZero();
+    w.setZero();
+    dvo.setZero();
+    dw.setZero();
+
+    calcABMLastHalf();
+
+    if(!sensorHelper.forceSensors().empty()){
+        updateForceSensors();
+    }
+
+    ABMPackedLinkWorkspace& ws = *packed;
+    ws.gather();
+
+    const int n = ws.numLinks;
+    for(int i=1; i < n; ++i){
+        ws.q0[i]  = ws.q[i];
+        ws.dq0[i] = ws.dq[i];
+        ws.dqSum[i]  = 0.0;
+        ws.ddqSum[i] = 0.0;
+    }
+
+    static const double rs[] = { 1.0 / 6.0, 2.0 / 6.0, 2.0 / 6.0 };
+    static const double dts[] = { 0.5, 0.5, 1.0 };
+
+    for(int k=0; k < 3; ++k){
+        const double r = rs[k];
+        const double dt = timeStep * dts[k];
+
+        if(!root->isFixedJoint()){
+            SE3exp(ws.rootT, T0, ws.w[0], ws.vo[0], dt);
+            ws.vo[0].noalias() = vo0 + ws.dvo[0] * dt;
+            ws.w[0].noalias()  = w0  + ws.dw[0]  * dt;
+
+            vo  += r * ws.vo[0];
+            w   += r * ws.w[0];
+            dvo += r * ws.dvo[0];
+            dw  += r * ws.dw[0];
+        }
+
+        for(int i=1; i < n; ++i){
+            ws.q[i]  =  ws.q0[i] + dt * ws.dq[i];
+            ws.dq[i] = ws.dq0[i] + dt * ws.ddq[i];
+
+            ws.dqSum[i]  += r * ws.dq[i];
+            ws.ddqSum[i] += r * ws.ddq[i];
+        }
+
+        ws.calcPhase1(g);
+        ws.calcPhase2();
+        ws.calcPhase3();
+    }
+
+    if(!root->isFixedJoint()){
+        root->dvo() = dvo + ws.dvo[0] / 6.0;
+        root->dw() = dw  + ws.dw[0]  / 6.0;
+        root->dv() =
+            root->dvo() - T0.translation().cross(root->dw()) + w0.cross(vo0 + w0.cross(T0.translation()));
+        root->vo() = vo0 + root->dvo() * timeStep;
+        root->w()  = w0  + root->dw() * timeStep;
+        SE3exp(root->T(), T0, w0, vo0, timeStep);
+    } else {
+        root->dvo() = ws.dvo[0];
+        root->dw() = ws.dw[0];
+    }
+
+    for(int i=1; i < n; ++i){
+        DyLink* link = ws.links[i];
+        link->q()  =  ws.q0[i] + ( ws.dqSum[i] + ws.dq[i]  / 6.0) * timeStep;
+        link->dq() = ws.dq0[i] + (ws.ddqSum[i] + ws.ddq[i] / 6.0) * timeStep;
+        link->ddq() = ws.ddq[i];
+        link->dvo() = ws.dvo[i];
+        link->dw() = ws.dw[i];
+    }
+}
+
+
 /**
    \note v, dv, dw are not used in the forward dynamics, but are calculated
    for forward dynamics users.
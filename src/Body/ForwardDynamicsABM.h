@@ -11,6 +11,8 @@
 
 namespace cnoid
 {
+class ABMPackedLinkWorkspace;
+
 /**
    Forward dynamics calculation using Featherstone's Articulated Body Method (ABM)
 */
@@ -25,6 +27,18 @@ public:
     virtual void initialize();
     virtual void calcNextState();
 
+    /**
+       When this is enabled, the intermediate ABM passes of the Runge Kutta method are
+       calculated on the link variables packed into arrays in the order of the link traverse,
+       and the link objects are only updated with the final state of each step.
+       The workspace is built in initialize(), so it must be called again when the
+       link structure or the link parameters such as mass and inertia are changed.
+       The results are the same as those of the normal mode.
+       @note This has no effect for the Euler method.
+    */
+    void enablePackedLinkWorkspace(bool on);
+    bool isPackedLinkWorkspaceEnabled() const { return isPackedLinkWorkspaceEnabled_; }
+
 private:
         
     void calcMotionWithEulerMethod();
@@ -53,6 +67,8 @@ private:
 
     void updateForceSensors();
 
+    void calcMotionWithRungeKuttaMethodInPackedWorkspace();
+
     // Buffers for the Runge Kutta Method
     Position T0;
     Vector3 vo0;
@@ -66,6 +82,9 @@ private:
     Vector3 dw;
     std::vector<double> dq;
     std::vector<double> ddq;
+
+    bool isPackedLinkWorkspaceEnabled_;
+    ABMPackedLinkWorkspace* packed;
 };
 	
 };
@@ -81,17 +81,26 @@ void ForwardDynamicsCBM::initialize()
 
     const int numLinks = body->numLinks();
 
+    unknownDofIndices.assign(numLinks, -1);
+    givenDofIndices.assign(numLinks, -1);
+
     for(int i=1; i < numLinks; ++i){
         DyLink* link = body->link(i);
         if(link->isRotationalJoint() || link->isSlideJoint()){
             if(highGainModeLinkFlag[i]){
+                givenDofIndices[i] = given_rootDof + highGainModeJoints.size();
                 highGainModeJoints.push_back(link);
             } else {
+                unknownDofIndices[i] = unknown_rootDof + torqueModeJoints.size();
                 torqueModeJoints.push_back(link);
             }
         }
     }
 
+    compositeMasses.resize(numLinks);
+    compositeMassMoments.resize(numLinks);
+    compositeInertias.resize(numLinks);
+
     const int n = unknown_rootDof + torqueModeJoints.size();
     const int m = highGainModeJoints.size();
     
@@ -430,9 +439,10 @@ COMMON_CALCS_FOR_ALL_JOINT_TYPES:
 
 
 /**
-   calculate the mass matrix using the unit vector method
-   \todo replace the unit vector method here with
-   a more efficient method that only requires O(n) computation time
+   calculate the mass matrix using the composite rigid body algorithm.
+   The elements between a joint and its ancestor joints are given by the composite inertia of
+   the subtree below the joint, and the constant term b1 is given by the inverse dynamics
+   without the accelerations.
 */
 void ForwardDynamicsCBM::calcMassMatrix()
 {
@@ -455,73 +465,111 @@ void ForwardDynamicsCBM::calcMassMatrix()
 	
     setColumnOfMassMatrix(b1, 0);
 
-    if(unknown_rootDof){
-        for(int i=0; i < 3; ++i){
-            root->dvo()[i] += 1.0;
-            setColumnOfMassMatrix(M11, i);
-            root->dvo()[i] -= 1.0;
-        }
-        for(int i=0; i < 3; ++i){
-            root->dw()[i] = 1.0;
-            Vector3 dw_x_p = root->dw().cross(root->p());
-            root->dvo() -= dw_x_p;
-            setColumnOfMassMatrix(M11, i + 3);
-            root->dvo() += dw_x_p;
-            root->dw()[i] = 0.0;
-        }
-    }
-    if(given_rootDof){
-        for(int i=0; i < 3; ++i){
-            root->dvo()[i] += 1.0;
-            setColumnOfMassMatrix(M12, i);
-            root->dvo()[i] -= 1.0;
-        }
-        for(int i=0; i < 3; ++i){
-            root->dw()[i] = 1.0;
-            Vector3 dw_x_p = root->dw().cross(root->p());
-            root->dvo() -= dw_x_p;
-            setColumnOfMassMatrix(M12, i + 3);
-            root->dvo() += dw_x_p;
-            root->dw()[i] = 0.0;
-        }
+    for(int i=1; i < numLinks; ++i){
+        DyLink* link = body->link(i);
+        link->ddq() = ddqorg[i];
+        link->u()   = uorg  [i];
     }
+    root->dvo() = dvoorg;
+    root->dw()  = dworg;
 
-    for(size_t i=0; i < torqueModeJoints.size(); ++i){
-        DyLink* link = torqueModeJoints[i];
-        link->ddq() = 1.0;
-        int j = i + unknown_rootDof;
-        setColumnOfMassMatrix(M11, j);
-        M11(j, j) += link->Jm2(); // motor inertia
-        link->ddq() = 0.0;
+    // composite inertias (the parents precede their children in the link order)
+    for(int i=0; i < numLinks; ++i){
+        DyLink* link = body->link(i);
+        compositeMasses[i] = link->m();
+        compositeMassMoments[i] = link->m() * link->wc();
+        compositeInertias[i] = link->Iww();
     }
-    for(size_t i=0; i < highGainModeJoints.size(); ++i){
-        DyLink* link = highGainModeJoints[i];
-        link->ddq() = 1.0;
-        int j = i + given_rootDof;
-        setColumnOfMassMatrix(M12, j);
-        link->ddq() = 0.0;
+    for(int i = numLinks - 1; i > 0; --i){
+        const int parentIndex = body->link(i)->parent()->index();
+        compositeMasses[parentIndex] += compositeMasses[i];
+        compositeMassMoments[parentIndex] += compositeMassMoments[i];
+        compositeInertias[parentIndex] += compositeInertias[i];
     }
 
-    // subtract the constant term
-    for(int i=0; i < M11.cols(); ++i){
-        M11.col(i) -= b1;
-    }
-    for(int i=0; i < M12.cols(); ++i){
-        M12.col(i) -= b1;
-    }
+    M11.setZero();
+    M12.setZero();
+
+    const Vector3& p0 = root->p();
+    Vector3 f, tau;
 
     for(int i=1; i < numLinks; ++i){
+        const int unknownIndex = unknownDofIndices[i];
+        const int givenIndex = givenDofIndices[i];
+        if(unknownIndex < 0 && givenIndex < 0){
+            continue;
+        }
         DyLink* link = body->link(i);
-        link->ddq() = ddqorg[i];
-        link->u()   = uorg  [i];
+
+        // the force to give the unit acceleration to the joint
+        const Vector3& mc = compositeMassMoments[i];
+        f = compositeMasses[i] * link->sv() + link->sw().cross(mc);
+        tau.noalias() = mc.cross(link->sv()) + compositeInertias[i] * link->sw();
+
+        for(DyLink* joint = link; joint != root; joint = joint->parent()){
+            const int k = joint->index();
+            if(unknownDofIndices[k] >= 0 || givenDofIndices[k] >= 0){
+                double Mij = joint->sv().dot(f) + joint->sw().dot(tau);
+                if(joint == link && unknownIndex >= 0){
+                    Mij += link->Jm2(); // motor inertia
+                }
+                setMassMatrixElement(unknownDofIndices[k], givenDofIndices[k], unknownIndex, givenIndex, Mij);
+            }
+        }
+
+        if(unknown_rootDof || given_rootDof){
+            tau -= p0.cross(f);
+            for(int j=0; j < 6; ++j){
+                const int rootUnknownIndex = unknown_rootDof ? j : -1;
+                const int rootGivenIndex = given_rootDof ? j : -1;
+                const double Mij = (j < 3) ? f[j] : tau[j - 3];
+                setMassMatrixElement(rootUnknownIndex, rootGivenIndex, unknownIndex, givenIndex, Mij);
+            }
+        }
+    }
+
+    if(unknown_rootDof){
+        const double m = compositeMasses[0];
+        const Vector3& mc = compositeMassMoments[0];
+        for(int i=0; i < 3; ++i){
+            // dv = e_i
+            f = m * Vector3::Unit(i);
+            tau = mc.cross(Vector3::Unit(i)) - p0.cross(f);
+            M11.block<3, 1>(0, i) = f;
+            M11.block<3, 1>(3, i) = tau;
+            // dw = e_i
+            const Vector3 dvo = p0.cross(Vector3::Unit(i));
+            f = m * dvo + Vector3::Unit(i).cross(mc);
+            tau = mc.cross(dvo) + compositeInertias[0].col(i) - p0.cross(f);
+            M11.block<3, 1>(0, i + 3) = f;
+            M11.block<3, 1>(3, i + 3) = tau;
+        }
     }
-    root->dvo() = dvoorg;
-    root->dw()  = dworg;
 
     accelSolverInitialized = false;
 }
 
 
+/**
+   set an element of the symmetric mass matrix to the corresponding elements of M11 and M12.
+   Each degree of freedom is specified by its index in M11 or in the columns of M12, the other index being -1.
+*/
+void ForwardDynamicsCBM::setMassMatrixElement
+(int unknownIndex1, int givenIndex1, int unknownIndex2, int givenIndex2, double value)
+{
+    if(unknownIndex1 >= 0){
+        if(unknownIndex2 >= 0){
+            M11(unknownIndex1, unknownIndex2) = value;
+            M11(unknownIndex2, unknownIndex1) = value;
+        } else {
+            M12(unknownIndex1, givenIndex2) = value;
+        }
+    } else if(unknownIndex2 >= 0){
+        M12(unknownIndex2, givenIndex1) = value;
+    }
+}
+
+
 void ForwardDynamicsCBM::setColumnOfMassMatrix(MatrixXd& M, int column)
 {
     Vector3 f;
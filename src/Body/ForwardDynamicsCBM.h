@@ -100,11 +100,18 @@ private:
 
     Vector3 root_w_x_v;
 
-    // buffers for the unit vector method
+    // buffers for calculating the constant term b1
     VectorXd ddqorg;
     VectorXd uorg;
     Vector3 dvoorg;
     Vector3 dworg;
+
+    // buffers for the composite rigid body algorithm
+    std::vector<int> unknownDofIndices; ///< row / column of each joint link in M11, or -1
+    std::vector<int> givenDofIndices;   ///< column of each joint link in M12, or -1
+    std::vector<double> compositeMasses;
+    std::vector<Vector3> compositeMassMoments; ///< sum of m * c around the world origin
+    std::vector<Matrix3> compositeInertias;    ///< sum of Iww
 		
     struct ForceSensorInfo {
         bool hasSensor;
@@ -144,6 +151,7 @@ private:
     void calcPositionAndVelocityFK();
     void calcMassMatrix();
     void setColumnOfMassMatrix(MatrixXd& M, int column);
+    void setMassMatrixElement(int unknownIndex1, int givenIndex1, int unknownIndex2, int givenIndex2, double value);
     void calcInverseDynamics(DyLink* link, Vector3& out_f, Vector3& out_tau);
     void calcd1(DyLink* link, Vector3& out_f, Vector3& out_tau);
     inline void calcAccelFKandForceSensorValues();
@@ -2,6 +2,8 @@
 #include "Jacobian.h"
 #include "Link.h"
 #include "JointPath.h"
+#include <cnoid/EigenUtil>
+#include <boost/make_shared.hpp>
 #include <iostream>
 
 using namespace std;
@@ -55,65 +57,81 @@ void calcSubMass(Link* link, vector<SubMass>& subMasses, bool calcIw)
     }
 }
 
+
+void setSubMassOfLink(Link* link, SubMass& sub, bool calcIw)
+{
+    sub.m = link->m();
+    sub.mwc = link->m() * link->wc();
+    if(calcIw){
+        sub.Iw = link->R() * link->I() * link->R().transpose();
+    }
 }
 
-namespace cnoid {
 
 /**
-   @brief compute CoM Jacobian
-   @param base link fixed to the environment
-   @param J CoM Jacobian
-   @note Link::wc must be computed by calcCM() before calling
+   @param basePath The path from the root link to the base link, which is empty if the root link is free
 */
-void calcCMJacobian(Body* body, Link* base, Eigen::MatrixXd& J)
+void calcSubMasses(Body* body, const JointPath& basePath, bool calcIw, vector<SubMass>& subMasses)
 {
-    // prepare subm, submwc
-
-    const int nj = body->numJoints();
-    vector<SubMass> subMasses(body->numLinks());
     Link* rootLink = body->rootLink();
-        
-    JointPath path;
-    if(!base){
-        calcSubMass(rootLink, subMasses, false);
-        J.resize(3, nj + 6);
+
+    if(basePath.numJoints() == 0){
+        calcSubMass(rootLink, subMasses, calcIw);
 
     } else {
-        path.setPath(rootLink, base);
-        Link* skip = path.joint(0);
+        Link* skip = basePath.joint(0);
         SubMass& sub = subMasses[skip->index()];
-        sub.m = rootLink->m();
-        sub.mwc = rootLink->m() * rootLink->wc();
+        setSubMassOfLink(rootLink, sub, calcIw);
             
         for(Link* child = rootLink->child(); child; child = child->sibling()){
             if(child != skip){
-                calcSubMass(child, subMasses, false);
-                const SubMass& c = subMasses[child->index()];
-                sub.m += c.m;
-                sub.mwc += c.mwc;
+                calcSubMass(child, subMasses, calcIw);
+                sub += subMasses[child->index()];
             }
         }
             
         // assuming there is no branch between base and root
-        for(int i=1; i < path.numJoints(); i++){
-            Link* joint = path.joint(i);
-            const Link* parent = joint->parent();
+        for(int i=1; i < basePath.numJoints(); i++){
+            Link* joint = basePath.joint(i);
+            Link* parent = joint->parent();
             SubMass& sub = subMasses[joint->index()];
-            sub.m = parent->m();
-            sub.mwc = parent->m() * parent->wc();
-            const SubMass& p = subMasses[parent->index()];
-            sub.m += p.m;
-            sub.mwc += p.mwc;
+            setSubMassOfLink(parent, sub, calcIw);
+            sub += subMasses[parent->index()];
         }
-            
-        J.resize(3, nj);
     }
-        
-    // compute Jacobian
-    std::vector<int> sgn(nj, 1);
-    for(int i=0; i < path.numJoints(); i++){
-        sgn[path.joint(i)->jointId()] = -1;
+}
+
+
+void getJointSigns(Body* body, const JointPath& basePath, vector<int>& out_signs)
+{
+    out_signs.assign(body->numJoints(), 1);
+    for(int i=0; i < basePath.numJoints(); i++){
+        const int id = basePath.joint(i)->jointId();
+        if(id >= 0){
+            out_signs[id] = -1;
+        }
     }
+}
+
+
+void putUnsupportedJointTypes(Body* body, const char* functionName)
+{
+    for(int i=0; i < body->numJoints(); ++i){
+        Link* joint = body->joint(i);
+        if(!joint->isRotationalJoint()){
+            std::cerr << functionName << " : unsupported jointType("
+                      << joint->jointType() << std::endl;
+        }
+    }
+}
+
+
+/**
+   The columns of the unsupported joints are set to zero.
+*/
+void setCMJacobian(Body* body, bool isRootFree, const vector<SubMass>& subMasses, const vector<int>& sgn, MatrixXd& J)
+{
+    const int nj = body->numJoints();
     
     for(int i=0; i < nj; i++){
         Link* joint = body->joint(i);
@@ -124,16 +142,15 @@ void calcCMJacobian(Body* body, Link* base, Eigen::MatrixXd& J)
             const Vector3 dp = omega.cross(arm);
             J.col(joint->jointId()) = dp;
         } else {
-            std::cerr << "calcCMJacobian() : unsupported jointType("
-                      << joint->jointType() << std::endl;
+            J.col(joint->jointId()).setZero();
         }
     }
 
-    if(!base){
+    if(isRootFree){
         const int c = nj;
         J.block(0, c, 3, 3).setIdentity();
 
-        const Vector3 dp = subMasses[0].mwc / body->mass() - rootLink->p();
+        const Vector3 dp = subMasses[0].mwc / body->mass() - body->rootLink()->p();
 
         J.block(0, c + 3, 3, 3) <<
             0.0,  dp(2), -dp(1),
@@ -142,6 +159,70 @@ void calcCMJacobian(Body* body, Link* base, Eigen::MatrixXd& J)
     }
 }
 
+
+/**
+   The angular momentum is about the CoM when the root link is free.
+   @param J The CoM Jacobian given by setCMJacobian()
+*/
+void setAngularMomentumJacobian
+(Body* body, bool isRootFree, const vector<SubMass>& subMasses, const vector<int>& sgn, const MatrixXd& J, MatrixXd& H)
+{
+    const int nj = body->numJoints();
+    const double mass = body->mass();
+    
+    for(int i=0; i < nj; ++i){
+        Link* joint = body->joint(i);
+        if(joint->isRotationalJoint()){
+            const Vector3 omega = sgn[joint->jointId()] * joint->R() * joint->a();
+            const SubMass& sub = subMasses[joint->index()];
+            const Vector3 Mcol = J.col(joint->jointId()) * mass;
+            const Vector3 dp = (sub.mwc/sub.m).cross(Mcol) + sub.Iw * omega;
+            H.col(joint->jointId()) = dp;
+        } else {
+            H.col(joint->jointId()).setZero();
+        }
+    }
+
+    if(isRootFree){
+        const Vector3 cm = subMasses[0].mwc / mass;
+        H.leftCols(nj) -= hat(cm) * J.leftCols(nj) * mass;
+        // The translation of the root link does not change the angular momentum about the CoM
+        H.block(0, nj, 3, 3).setZero();
+        H.block(0, nj + 3, 3, 3) = subMasses[0].Iw;
+    }
+}
+
+}
+
+namespace cnoid {
+
+/**
+   @brief compute CoM Jacobian
+   @param base link fixed to the environment
+   @param J CoM Jacobian
+   @note Link::wc must be computed by calcCM() before calling
+*/
+void calcCMJacobian(Body* body, Link* base, Eigen::MatrixXd& J)
+{
+    // prepare subm, submwc
+
+    const int nj = body->numJoints();
+    vector<SubMass> subMasses(body->numLinks());
+        
+    JointPath path;
+    if(base){
+        path.setPath(body->rootLink(), base);
+    }
+    calcSubMasses(body, path, false, subMasses);
+    J.resize(3, base ? nj : nj + 6);
+        
+    // compute Jacobian
+    std::vector<int> sgn;
+    getJointSigns(body, path, sgn);
+    putUnsupportedJointTypes(body, "calcCMJacobian()");
+    setCMJacobian(body, !base, subMasses, sgn, J);
+}
+
 /**
    @brief compute Angular Momentum Jacobian
    @param base link fixed to the environment
@@ -150,85 +231,233 @@ void calcCMJacobian(Body* body, Link* base, Eigen::MatrixXd& J)
 */
 void calcAngularMomentumJacobian(Body* body, Link* base, Eigen::MatrixXd& H)
 {
-
     // prepare subm, submwc
 
     const int nj = body->numJoints();
     std::vector<SubMass> subMasses(body->numLinks());
-    Link* rootLink = body->rootLink();
-
-    MatrixXd M;
-    calcCMJacobian( body, base, M );
-    M.conservativeResize(3, nj);
-    M *= body->mass();
 
     JointPath path;
-    if(!base){
-        calcSubMass(rootLink, subMasses, true);
-        H.resize(3, nj + 6);
-
-    } else {
-        path.setPath(rootLink, base);
-        Link* skip = path.joint(0);
-        SubMass& sub = subMasses[skip->index()];
-        sub.m = rootLink->m();
-        sub.mwc = rootLink->m() * rootLink->wc();
-            
-        for(Link* child = rootLink->child(); child; child = child->sibling()){
-            if(child != skip){
-                calcSubMass(child, subMasses, true);
-                sub += subMasses[child->index()];
-            }
-        }
-            
-        // assuming there is no branch between base and root
-        for(int i=1; i < path.numJoints(); i++){
-            Link* joint = path.joint(i);
-            const Link* parent = joint->parent();
-            SubMass& sub = subMasses[joint->index()];
-            sub.m = parent->m();
-            sub.mwc = parent->m() * parent->wc();
-            sub += subMasses[parent->index()];
-        }
-            
-        H.resize(3, nj);
+    if(base){
+        path.setPath(body->rootLink(), base);
     }
+    calcSubMasses(body, path, true, subMasses);
+
+    MatrixXd M(3, base ? nj : nj + 6);
+    H.resize(3, base ? nj : nj + 6);
 
     // compute Jacobian
-    std::vector<int> sgn(nj, 1);
-    for(int i=0; i < path.numJoints(); i++){
-        sgn[path.joint(i)->jointId()] = -1;
+    std::vector<int> sgn;
+    getJointSigns(body, path, sgn);
+    putUnsupportedJointTypes(body, "calcAngularMomentumJacobian()");
+    setCMJacobian(body, !base, subMasses, sgn, M);
+    setAngularMomentumJacobian(body, !base, subMasses, sgn, M, H);
+}
+
+
+class JacobianWorkspaceImpl
+{
+public:
+    struct EndLinkInfo
+    {
+        Link* link;
+        Vector3 localPos;
+        JointPathPtr path;
+        MatrixXd J;
+    };
+    
+    Body* body;
+    Link* base;
+    JointPathPtr basePath;
+    vector<int> jointSigns;
+    vector<SubMass> subMasses;
+    bool isCMJacobianEnabled;
+    bool isAngularMomentumJacobianEnabled;
+    MatrixXd J;
+    MatrixXd H;
+    vector<EndLinkInfo> endLinks;
+
+    JacobianWorkspaceImpl(Body* body, Link* base);
+    int numColumns() const { return base ? body->numJoints() : body->numJoints() + 6; }
+    void setBaseLink(Link* base);
+    void initializeEndLinkJacobian(EndLinkInfo& info);
+    void update();
+    void updateEndLinkJacobian(EndLinkInfo& info);
+};
+
+}
+
+
+JacobianWorkspace::JacobianWorkspace(Body* body, Link* base)
+{
+    impl = new JacobianWorkspaceImpl(body, base);
+}
+
+
+JacobianWorkspaceImpl::JacobianWorkspaceImpl(Body* body, Link* base)
+    : body(body),
+      base(0),
+      subMasses(body->numLinks())
+{
+    isCMJacobianEnabled = true;
+    isAngularMomentumJacobianEnabled = false;
+    setBaseLink(base);
+}
+
+
+JacobianWorkspace::~JacobianWorkspace()
+{
+    delete impl;
+}
+
+
+void JacobianWorkspace::setBaseLink(Link* base)
+{
+    impl->setBaseLink(base);
+}
+
+
+void JacobianWorkspaceImpl::setBaseLink(Link* base)
+{
+    this->base = base;
+    basePath = boost::make_shared<JointPath>();
+    if(base){
+        basePath->setPath(body->rootLink(), base);
     }
+    getJointSigns(body, *basePath, jointSigns);
 
-    for(int i=0; i < nj; ++i){
-        Link* joint = body->joint(i);
-        if(joint->isRotationalJoint()){
-            const Vector3 omega = sgn[joint->jointId()] * joint->R() * joint->a();
-            const SubMass& sub = subMasses[joint->index()];
-            const Vector3 Mcol = M.col(joint->jointId());
-            const Vector3 dp = (sub.mwc/sub.m).cross(Mcol) + sub.Iw * omega;
-            H.col(joint->jointId()) = dp;
-        } else {
-            std::cerr << "calcAngularMomentumJacobian() : unsupported jointType("
-                      << joint->jointType() << std::endl;
-        }
+    const int nc = numColumns();
+    J.setZero(3, nc);
+    H.setZero(3, nc);
+    for(size_t i=0; i < endLinks.size(); ++i){
+        initializeEndLinkJacobian(endLinks[i]);
     }
+}
 
 
+void JacobianWorkspace::setCMJacobianEnabled(bool on)
+{
+    impl->isCMJacobianEnabled = on;
+}
+
+
+void JacobianWorkspace::setAngularMomentumJacobianEnabled(bool on)
+{
+    impl->isAngularMomentumJacobianEnabled = on;
+}
+
+
+int JacobianWorkspace::addEndLink(Link* link, const Vector3& localPos)
+{
+    impl->endLinks.push_back(JacobianWorkspaceImpl::EndLinkInfo());
+    JacobianWorkspaceImpl::EndLinkInfo& info = impl->endLinks.back();
+    info.link = link;
+    info.localPos = localPos;
+    impl->initializeEndLinkJacobian(info);
+    return impl->endLinks.size() - 1;
+}
+
+
+void JacobianWorkspaceImpl::initializeEndLinkJacobian(EndLinkInfo& info)
+{
+    info.path = boost::make_shared<JointPath>(base ? base : body->rootLink(), info.link);
+    info.J.setZero(6, numColumns());
     if(!base){
-        const int c = nj;
-        H.block(0, c, 3, 3).setIdentity();
+        const int c = body->numJoints();
+        info.J.block(0, c, 3, 3).setIdentity();
+        info.J.block(3, c + 3, 3, 3).setIdentity();
+    }
+}
 
-        Vector3 cm = body->calcCenterOfMass();
-        Matrix3d cm_cross;
-        cm_cross <<
-            0.0,  -cm(2), cm(1),
-            cm(2),    0.0,  -cm(0),
-            -cm(1), cm(0),    0.0;
-        H -= cm_cross * M;
 
+void JacobianWorkspace::clearEndLinks()
+{
+    impl->endLinks.clear();
+}
+
+
+void JacobianWorkspace::update()
+{
+    impl->update();
+}
+
+
+/**
+   The sub masses are calculated in a single traversal of the link tree for both the CoM
+   Jacobian and the angular momentum Jacobian.
+*/
+void JacobianWorkspaceImpl::update()
+{
+    if(isCMJacobianEnabled || isAngularMomentumJacobianEnabled){
+        calcSubMasses(body, *basePath, isAngularMomentumJacobianEnabled, subMasses);
+        setCMJacobian(body, !base, subMasses, jointSigns, J);
+        if(isAngularMomentumJacobianEnabled){
+            setAngularMomentumJacobian(body, !base, subMasses, jointSigns, J, H);
+        }
     }
+    for(size_t i=0; i < endLinks.size(); ++i){
+        updateEndLinkJacobian(endLinks[i]);
+    }
+}
+
+
+void JacobianWorkspaceImpl::updateEndLinkJacobian(EndLinkInfo& info)
+{
+    const Vector3 p = info.link->p() + info.link->R() * info.localPos;
+    const JointPath& path = *info.path;
+    const int n = path.numJoints();
     
+    for(int i=0; i < n; ++i){
+        Link* joint = path.joint(i);
+        const int id = joint->jointId();
+        if(id < 0){
+            continue;
+        }
+        MatrixXd::ColXpr Ji = info.J.col(id);
+        switch(joint->jointType()){
+        case Link::ROTATIONAL_JOINT:
+        {
+            Vector3 omega = joint->R() * joint->a();
+            if(!path.isJointDownward(i)){
+                omega = -omega;
+            }
+            Ji.head<3>() = omega.cross(p - joint->p());
+            Ji.tail<3>() = omega;
+        }
+        break;
+        case Link::SLIDE_JOINT:
+        {
+            Vector3 dp = joint->R() * joint->d();
+            if(!path.isJointDownward(i)){
+                dp = -dp;
+            }
+            Ji.head<3>() = dp;
+            Ji.tail<3>().setZero();
+        }
+        break;
+        default:
+            Ji.setZero();
+        }
+    }
+
+    if(!base){
+        info.J.block(0, body->numJoints() + 3, 3, 3) = -hat(p - body->rootLink()->p());
+    }
+}
+
+
+const Eigen::MatrixXd& JacobianWorkspace::cmJacobian() const
+{
+    return impl->J;
 }
 
+
+const Eigen::MatrixXd& JacobianWorkspace::angularMomentumJacobian() const
+{
+    return impl->H;
+}
+
+
+const Eigen::MatrixXd& JacobianWorkspace::endLinkJacobian(int index) const
+{
+    return impl->endLinks[index].J;
 }
@@ -13,6 +13,50 @@ CNOID_EXPORT void calcCMJacobian(Body* body, Link* base, Eigen::MatrixXd& J);
 
 CNOID_EXPORT void calcAngularMomentumJacobian(Body* body, Link* base, Eigen::MatrixXd& H);
 
+class JacobianWorkspaceImpl;
+
+/**
+   This class keeps the matrices of the CoM Jacobian, the angular momentum Jacobian and the
+   Jacobians of end links, and updates the enabled ones from the current link state in update().
+   The matrices are not reallocated unless the settings are changed, so the object can be used
+   in a control loop instead of calcCMJacobian() and calcAngularMomentumJacobian().
+   The columns correspond to the joint IDs, which are followed by the translation and rotation
+   of the root link when the base link is not specified.
+*/
+class CNOID_EXPORT JacobianWorkspace
+{
+public:
+    /**
+       @param base The link fixed to the environment. The root link is free if it is null.
+    */
+    JacobianWorkspace(Body* body, Link* base = 0);
+    ~JacobianWorkspace();
+
+    void setBaseLink(Link* base);
+    void setCMJacobianEnabled(bool on);
+    void setAngularMomentumJacobianEnabled(bool on);
+
+    /**
+       @return The index of the Jacobian, which has the rows of the linear and angular velocities
+       of the point fixed to the link
+    */
+    int addEndLink(Link* link, const Vector3& localPos = Vector3::Zero());
+    void clearEndLinks();
+
+    /**
+       @note Link::wc must be computed by Body::calcCenterOfMass() before calling
+    */
+    void update();
+
+    const Eigen::MatrixXd& cmJacobian() const;
+    const Eigen::MatrixXd& angularMomentumJacobian() const;
+    const Eigen::MatrixXd& endLinkJacobian(int index) const;
+
+private:
+    JacobianWorkspaceImpl* impl;
+    JacobianWorkspace(const JacobianWorkspace& org);
+};
+
 template<int elementMask, int rowOffset, int colOffset, bool useTargetLinkLocalPos>
 void setJacobian(const JointPath& path, Link* targetLink, const Vector3& targetLinkLocalPos,
                  MatrixXd& out_J) {
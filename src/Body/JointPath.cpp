@@ -9,8 +9,10 @@
 #include "BodyCustomizerInterface.h"
 #include <cnoid/EigenUtil>
 #include <cnoid/TruncatedSVD>
+#include <cnoid/TaskScheduler>
 #include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 using namespace cnoid;
@@ -79,7 +81,165 @@ public:
         J.resize(dTask.size(), numJoints);
         dq.resize(numJoints);
     }
+
+    template<int N>
+    bool solveWithFixedSizeMatrices(JointPath& path, const Vector3& end_p, const Matrix3& end_R);
+
+    void copyOptions(const JointPathIkImpl& org){
+        isBestEffortIKmode = org.isBestEffortIKmode;
+        deltaScale = org.deltaScale;
+        maxIterations = org.maxIterations;
+        maxIKerrorSqr = org.maxIKerrorSqr;
+        dampingConstantSqr = org.dampingConstantSqr;
+        svd = org.svd;
+    }
+};
+}
+
+
+/**
+   The numerical IK for the default target of a path with N joints.
+   This is the same as the damped least squares method of JointPath::calcInverseKinematics()
+   except that the matrices have fixed sizes and the damped matrix, which is symmetric and
+   positive definite, is solved by the LDLT decomposition.
+   The sizes are known at compile time, so no matrix is allocated on the heap.
+*/
+template<int N>
+bool JointPathIkImpl::solveWithFixedSizeMatrices(JointPath& path, const Vector3& end_p, const Matrix3& end_R)
+{
+    typedef Eigen::Matrix<double, 6, 6> Matrix6;
+    Eigen::Matrix<double, 6, N> Jf;
+    Eigen::Matrix<double, N, 1> dqf;
+    Matrix6 JJf;
+    Vector6 dTaskf;
+    Eigen::LDLT<Matrix6> ldlt;
+
+    Link* target = path.endLink();
+    double prevErrsqr = std::numeric_limits<double>::max();
+    bool completed = false;
+
+    for(iteration = 0; iteration < maxIterations; ++iteration){
+
+        dTaskf.head<3>() = end_p - target->p();
+        dTaskf.tail<3>() = target->R() * omegaFromRot(target->R().transpose() * end_R);
+        const double errorSqr = dTaskf.squaredNorm();
+
+        if(errorSqr < maxIKerrorSqr){
+            completed = true;
+            break;
+        }
+        if(prevErrsqr - errorSqr < maxIKerrorSqr){
+            if(isBestEffortIKmode && (errorSqr > prevErrsqr)){
+                for(int j=0; j < N; ++j){
+                    path.joint(j)->q() = q0[j];
+                }
+                path.calcForwardKinematics();
+            }
+            break;
+        }
+        prevErrsqr = errorSqr;
+
+        for(int i=0; i < N; ++i){
+            Link* link = path.joint(i);
+            switch(link->jointType()){
+            case Link::ROTATIONAL_JOINT:
+            {
+                Vector3 omega = link->R() * link->a();
+                if(!path.isJointDownward(i)){
+                    omega = -omega;
+                }
+                Jf.col(i) << omega.cross(target->p() - link->p()), omega;
+                break;
+            }
+            case Link::SLIDE_JOINT:
+            {
+                Vector3 dp = link->R() * link->d();
+                if(!path.isJointDownward(i)){
+                    dp = -dp;
+                }
+                Jf.col(i) << dp, Vector3::Zero();
+                break;
+            }
+            default:
+                Jf.col(i).setZero();
+                break;
+            }
+        }
+
+        JJf.noalias() = Jf * Jf.transpose();
+        JJf.diagonal().array() += dampingConstantSqr;
+        dqf.noalias() = Jf.transpose() * ldlt.compute(JJf).solve(dTaskf);
+
+        if(isBestEffortIKmode){
+            for(int j=0; j < N; ++j){
+                double& q = path.joint(j)->q();
+                q0[j] = q;
+                q += deltaScale * dqf(j);
+            }
+        } else {
+            for(int j=0; j < N; ++j){
+                path.joint(j)->q() += deltaScale * dqf(j);
+            }
+        }
+
+        path.calcForwardKinematics();
+    }
+
+    return completed;
+}
+
+
+namespace {
+
+/**
+   A copy of the links of a joint path which is used by one thread at a time
+*/
+struct BatchIKWorkspace
+{
+    std::vector<LinkPtr> links;
+    JointPathPtr path;
 };
+
+struct BatchIKSolver
+{
+    const std::vector<Position, Eigen::aligned_allocator<Position> >& endPositions;
+    const MatrixXd& seeds;
+    MatrixXd& out_q;
+    std::vector<char> solvedFlags;
+    std::vector<BatchIKWorkspace*> freeWorkspaces;
+    boost::mutex mutex;
+
+    BatchIKSolver(const std::vector<Position, Eigen::aligned_allocator<Position> >& endPositions,
+                  const MatrixXd& seeds, MatrixXd& out_q)
+        : endPositions(endPositions), seeds(seeds), out_q(out_q), solvedFlags(endPositions.size(), 0) { }
+
+    void solve(int begin, int end) {
+        BatchIKWorkspace* workspace;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            workspace = freeWorkspaces.back();
+            freeWorkspaces.pop_back();
+        }
+        JointPath& path = *workspace->path;
+        const int n = path.numJoints();
+        for(int i = begin; i < end; ++i){
+            const int seedIndex = (seeds.cols() > 0) ? i : 0;
+            for(int j=0; j < n; ++j){
+                path.joint(j)->q() = seeds(j, seedIndex);
+            }
+            path.calcForwardKinematics();
+            const Position& T = endPositions[i];
+            path.setGoal(T.translation(), T.linear());
+            solvedFlags[i] = path.calcNumericalIK();
+            for(int j=0; j < n; ++j){
+                out_q(j, i) = path.joint(j)->q();
+            }
+        }
+        boost::mutex::scoped_lock lock(mutex);
+        freeWorkspaces.push_back(workspace);
+    }
+};
+
 }
 
 
@@ -386,10 +546,6 @@ bool JointPath::calcInverseKinematics()
     if(!ik){
         ik = new JointPathIkImpl();
     }
-    if(!ik->jacobianFunc){
-        ik->jacobianFunc = boost::bind(setJacobian<0x3f, 0, 0>, boost::ref(*this), endLink(), _1);
-    }
-    ik->resize(n);
     
     Link* target = linkPath.endLink();
 
@@ -405,9 +561,36 @@ bool JointPath::calcInverseKinematics()
         }
     }
 
-    double prevErrsqr = std::numeric_limits<double>::max();
     bool completed = false;
 
+    // The paths of the usual arms and legs are solved without the dynamic size matrices
+    const bool isDefaultTarget = !ik->errorFunc && !ik->jacobianFunc;
+    const bool useFixedSizeMatrices =
+        isDefaultTarget && !USE_USUAL_INVERSE_SOLUTION_FOR_6x6_NON_BEST_EFFORT_PROBLEM && !USE_SVD_FOR_BEST_EFFORT_IK;
+
+    if(useFixedSizeMatrices && n <= 7){
+        switch(n){
+        case 1: completed = ik->solveWithFixedSizeMatrices<1>(*this, targetTranslationGoal, targetRotationGoal); break;
+        case 2: completed = ik->solveWithFixedSizeMatrices<2>(*this, targetTranslationGoal, targetRotationGoal); break;
+        case 3: completed = ik->solveWithFixedSizeMatrices<3>(*this, targetTranslationGoal, targetRotationGoal); break;
+        case 4: completed = ik->solveWithFixedSizeMatrices<4>(*this, targetTranslationGoal, targetRotationGoal); break;
+        case 5: completed = ik->solveWithFixedSizeMatrices<5>(*this, targetTranslationGoal, targetRotationGoal); break;
+        case 6: completed = ik->solveWithFixedSizeMatrices<6>(*this, targetTranslationGoal, targetRotationGoal); break;
+        case 7: completed = ik->solveWithFixedSizeMatrices<7>(*this, targetTranslationGoal, targetRotationGoal); break;
+        }
+        if(!completed && !ik->isBestEffortIKmode){
+            for(int i=0; i < n; ++i){
+                joints[i]->q() = ik->q0[i];
+            }
+            calcForwardKinematics();
+        }
+        return completed;
+    }
+
+    ik->resize(n);
+
+    double prevErrsqr = std::numeric_limits<double>::max();
+
     bool useUsualInverseSolution = false;
     if(USE_USUAL_INVERSE_SOLUTION_FOR_6x6_NON_BEST_EFFORT_PROBLEM){
         if(!ik->isBestEffortIKmode && (n == 6) && (ik->dTask.size() == 6)){
@@ -445,7 +628,11 @@ bool JointPath::calcInverseKinematics()
         }
         prevErrsqr = errorSqr;
 
-        ik->jacobianFunc(ik->J);
+        if(ik->jacobianFunc){
+            ik->jacobianFunc(ik->J);
+        } else {
+            setJacobian<0x3f, 0, 0>(*this, target, ik->J);
+        }
 
         if(useUsualInverseSolution){
             ik->dq = ik->QR.compute(ik->J).solve(ik->dTask);
@@ -485,6 +672,72 @@ bool JointPath::calcInverseKinematics()
 }
 
 
+int JointPath::calcBatchInverseKinematics
+(const std::vector<Position, Eigen::aligned_allocator<Position> >& endPositions,
+ MatrixXd& out_q, std::vector<bool>& out_solved, const MatrixXd& seeds)
+{
+    const int numTargets = endPositions.size();
+    const int n = numJoints();
+
+    out_q.resize(n, numTargets);
+    out_solved.assign(numTargets, false);
+    if(numTargets == 0 || linkPath.empty()){
+        return 0;
+    }
+    if(seeds.cols() > 0 && (seeds.rows() != n || seeds.cols() != numTargets)){
+        return 0;
+    }
+
+    MatrixXd currentPosition;
+    if(seeds.cols() == 0){
+        currentPosition.resize(n, 1);
+        for(int i=0; i < n; ++i){
+            currentPosition(i, 0) = joints[i]->q();
+        }
+    }
+    BatchIKSolver solver(endPositions, (seeds.cols() == 0) ? currentPosition : seeds, out_q);
+
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int numWorkspaces = std::min(scheduler->concurrency(), numTargets);
+    vector<BatchIKWorkspace> workspaces(numWorkspaces);
+    const int numLinks = linkPath.numLinks();
+
+    for(int i=0; i < numWorkspaces; ++i){
+        BatchIKWorkspace& workspace = workspaces[i];
+        workspace.links.resize(numLinks);
+        for(int j=0; j < numLinks; ++j){
+            workspace.links[j] = new Link(*linkPath[j]);
+        }
+        for(int j=0; j < numLinks - 1; ++j){
+            if(linkPath.isDownward(j)){
+                workspace.links[j]->appendChild(workspace.links[j+1]);
+            } else {
+                workspace.links[j+1]->appendChild(workspace.links[j]);
+            }
+        }
+        workspace.path = boost::make_shared<JointPath>(workspace.links.front(), workspace.links.back());
+        if(ik){
+            workspace.path->getOrCreateIK()->copyOptions(*ik);
+        }
+        solver.freeWorkspaces.push_back(&workspace);
+    }
+
+    // Each thread processes the targets in ranges so that the workspaces are not exchanged too often
+    const int grainSize = std::max(1, std::min(16, numTargets / (numWorkspaces * 4)));
+    scheduler->parallelForRanges(
+        0, numTargets, boost::bind(&BatchIKSolver::solve, &solver, _1, _2), grainSize);
+
+    int numSolved = 0;
+    for(int i=0; i < numTargets; ++i){
+        if(solver.solvedFlags[i]){
+            out_solved[i] = true;
+            ++numSolved;
+        }
+    }
+    return numSolved;
+}
+
+
 int JointPath::numIterations() const
 {
     return ik ? ik->iteration : 0;
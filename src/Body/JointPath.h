@@ -102,6 +102,25 @@ public:
         return JointPath::calcInverseKinematics();
     }
 
+    /**
+       This function solves the numerical inverse kinematics for each of the given end link positions
+       in parallel. The links of the path are not modified. Each thread solves the problems with its
+       own copy of the links, starting from the current base link position and the seed joint displacements.
+       The options of the numerical IK are applied, but a target customized by customizeTarget()
+       and the analytical IK of a custom joint path are not used.
+
+       \param endPositions The target positions of the end link
+       \param out_q The joint displacements of the solution of the i-th target are stored in the i-th column.
+       When a target is not solved, the column contains the seed unless the best effort mode is enabled.
+       \param out_solved Whether each target is solved or not
+       \param seeds The initial joint displacements for the i-th target in the i-th column.
+       If the matrix is empty, the current joint displacements are used for all the targets.
+       \return The number of the solved targets
+    */
+    int calcBatchInverseKinematics(
+        const std::vector<Position, Eigen::aligned_allocator<Position> >& endPositions,
+        MatrixXd& out_q, std::vector<bool>& out_solved, const MatrixXd& seeds = MatrixXd());
+
     int numIterations() const;
 
     //! deprecated
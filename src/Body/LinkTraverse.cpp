@@ -6,6 +6,8 @@
   
 #include "LinkTraverse.h"
 #include "Link.h"
+#include <map>
+#include <limits>
 
 using namespace std;
 using namespace cnoid;
@@ -31,8 +33,8 @@ LinkTraverse::LinkTraverse(Link* root, bool doUpward, bool doDownward)
 
 
 LinkTraverse::LinkTraverse(const LinkTraverse& org)
-    : links(links),
-      numUpwardConnections(numUpwardConnections)
+    : links(org.links),
+      numUpwardConnections(org.numUpwardConnections)
 {
 
 }
@@ -48,12 +50,14 @@ void LinkTraverse::clear()
 {
     links.clear();
     numUpwardConnections = 0;
+    linkStates.clear();
 }
 
 void LinkTraverse::find(Link* root, bool doUpward, bool doDownward)
 {
     numUpwardConnections = 0;
     links.clear();
+    linkStates.clear();
     traverse(root, doUpward, doDownward, false, 0);
 }
 
@@ -81,6 +85,7 @@ void LinkTraverse::traverse(Link* link, bool doUpward, bool doDownward, bool isU
 void LinkTraverse::append(Link* link, bool isDownward)
 {
     links.push_back(link);
+    linkStates.clear();
     if(!isDownward){
         ++numUpwardConnections;
     }
@@ -136,8 +141,8 @@ void LinkTraverse::calcForwardKinematics(bool calcVelocity, bool calcAcceleratio
             
         case Link::FIXED_JOINT:
         default:
-            arm.noalias() = link->R() * child->b();
             link->R() = child->R();
+            arm.noalias() = link->R() * child->b();
             link->p().noalias() = child->p() - arm;
 
             if(calcVelocity){
@@ -217,3 +222,118 @@ void LinkTraverse::calcForwardKinematics(bool calcVelocity, bool calcAcceleratio
         }
     }
 }
+
+
+void LinkTraverse::initializeLinkStates()
+{
+    const int n = links.size();
+    linkStates.resize(n);
+    linkUpdatedFlags.resize(n);
+
+    std::map<Link*, int> indexMap;
+    for(int i=0; i < n; ++i){
+        indexMap[links[i]] = i;
+    }
+    for(int i=0; i < n; ++i){
+        LinkState& state = linkStates[i];
+        if(i == 0){
+            state.sourceIndex = -1;
+        } else if(i <= numUpwardConnections){
+            state.sourceIndex = i - 1;
+        } else {
+            std::map<Link*, int>::iterator p = indexMap.find(links[i]->parent());
+            state.sourceIndex = (p != indexMap.end()) ? p->second : -1;
+        }
+        // NaN never equals the joint displacement, so the link is updated at the first calculation
+        state.q = std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+
+int LinkTraverse::calcIncrementalForwardKinematics()
+{
+    if(links.empty()){
+        return 0;
+    }
+    if(linkStates.size() != links.size()){
+        initializeLinkStates();
+    }
+
+    int numUpdatedLinks = 0;
+    Vector3 arm;
+    const int n = links.size();
+
+    for(int i=0; i < n; ++i){
+
+        Link* link = links[i];
+        LinkState& state = linkStates[i];
+
+        // the link that has the joint between the link and the source link
+        const Link* jointLink = (i <= numUpwardConnections) ? ((i > 0) ? links[i-1] : 0) : link;
+        const double q = jointLink ? jointLink->q() : 0.0;
+
+        bool doUpdate;
+        if(i > 0 && state.sourceIndex < 0){
+            doUpdate = true; // the source link is not included in the traverse
+        } else {
+            doUpdate = (q != state.q || link->R() != state.R || link->p() != state.p);
+            if(!doUpdate && state.sourceIndex >= 0){
+                doUpdate = linkUpdatedFlags[state.sourceIndex];
+            }
+        }
+
+        if(doUpdate && i > 0){
+            if(i <= numUpwardConnections){
+                const Link* child = jointLink;
+                switch(child->jointType()){
+                case Link::ROTATIONAL_JOINT:
+                    link->R().noalias() = child->R() * AngleAxisd(child->q(), child->a()).inverse();
+                    arm.noalias() = link->R() * child->b();
+                    link->p().noalias() = child->p() - arm;
+                    break;
+                case Link::SLIDE_JOINT:
+                    link->R() = child->R();
+                    arm.noalias() = link->R() * (child->b() + child->q() * child->d());
+                    link->p().noalias() = child->p() - arm;
+                    break;
+                case Link::FIXED_JOINT:
+                default:
+                    link->R() = child->R();
+                    arm.noalias() = link->R() * child->b();
+                    link->p().noalias() = child->p() - arm;
+                    break;
+                }
+            } else {
+                const Link* parent = link->parent();
+                switch(link->jointType()){
+                case Link::ROTATIONAL_JOINT:
+                    link->R().noalias() = parent->R() * AngleAxisd(link->q(), link->a());
+                    arm.noalias() = parent->R() * link->b();
+                    link->p().noalias() = parent->p() + arm;
+                    break;
+                case Link::SLIDE_JOINT:
+                    link->R() = parent->R();
+                    arm.noalias() = parent->R() * (link->b() + link->q() * link->d());
+                    link->p() = parent->p() + arm;
+                    break;
+                case Link::FIXED_JOINT:
+                default:
+                    arm.noalias() = parent->R() * link->b();
+                    link->R() = parent->R();
+                    link->p().noalias() = arm + parent->p();
+                    break;
+                }
+            }
+            ++numUpdatedLinks;
+        }
+
+        if(doUpdate){
+            state.q = q;
+            state.R = link->R();
+            state.p = link->p();
+        }
+        linkUpdatedFlags[i] = doUpdate;
+    }
+
+    return numUpdatedLinks;
+}
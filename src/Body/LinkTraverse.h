@@ -7,6 +7,7 @@
 #ifndef CNOID_BODY_LINK_TRAVERSE_H
 #define CNOID_BODY_LINK_TRAVERSE_H
 
+#include <cnoid/EigenTypes>
 #include <vector>
 #include "exportdecl.h"
 
@@ -73,12 +74,34 @@ public:
 	
     void calcForwardKinematics(bool calcVelocity = false, bool calcAcceleration = false) const;
 
+    /**
+       This function only calculates the positions of the links that are affected by the changes
+       since the previous call of this function, and the result is the same as calcForwardKinematics().
+       A link is updated when its joint displacement has been changed, when its position has been
+       changed by other than this function, or when the link it is connected from has been updated.
+       Velocities and accelerations are not calculated.
+       The changes of the joint types, axes and offsets are not detected, and
+       calcForwardKinematics() must be used after them.
+       \return the number of the updated links
+    */
+    int calcIncrementalForwardKinematics();
+
 protected:
     std::vector<Link*> links;
     int numUpwardConnections;
 
 private:
+    struct LinkState {
+        int sourceIndex; // the index of the link that the position is calculated from, or -1
+        double q;
+        Matrix3 R;
+        Vector3 p;
+    };
+    std::vector<LinkState> linkStates;
+    std::vector<char> linkUpdatedFlags;
+
     void traverse(Link* link, bool doUpward, bool doDownward, bool isUpward, Link* prev);
+    void initializeLinkStates();
 };
 
 };
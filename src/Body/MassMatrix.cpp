@@ -4,27 +4,65 @@
 
 #include "MassMatrix.h"
 #include "Link.h"
-#include "InverseDynamics.h"
+#include <cnoid/EigenUtil>
 
+using namespace std;
 using namespace cnoid;
 
 namespace {
 
-void setColumnOfMassMatrix(Body* body, MatrixXd& out_M, int column)
+/**
+   Inertia of a link or of a composite rigid body around the world origin
+*/
+struct CompositeInertia
 {
-    Link* rootLink = body->rootLink();
-    Vector6 f = calcInverseDynamics(rootLink);
-        
-    if(!rootLink->isFixedJoint()){
-        f.tail<3>() -= rootLink->p().cross(f.head<3>());
-        out_M.block<6, 1>(0, column) = f;
+    double m;
+    Vector3 mc;  // m * (center of mass)
+    Matrix3 I;   // rotational inertia around the world origin
+
+    void setLinkInertia(Link* link) {
+        m = link->m();
+        const Vector3 c = link->R() * link->c() + link->p();
+        mc = m * c;
+        const Matrix3 c_hat = hat(c);
+        I.noalias() = link->R() * link->I() * link->R().transpose() + m * c_hat * c_hat.transpose();
     }
-    const int n = body->numJoints();
-    for(int i = 0; i < n; ++i){
-        Link* joint = body->joint(i);
-        out_M(i + 6, column) = joint->u();
+
+    void add(const CompositeInertia& other) {
+        m += other.m;
+        mc += other.mc;
+        I += other.I;
+    }
+
+    /// spatial force required to give the spatial acceleration (dvo, dw)
+    void force(const Vector3& dvo, const Vector3& dw, Vector3& out_f, Vector3& out_tau) const {
+        out_f = m * dvo + dw.cross(mc);
+        out_tau.noalias() = mc.cross(dvo) + I * dw;
+    }
+};
+
+
+/**
+   spatial axis of a joint around the world origin
+*/
+void getJointAxis(Link* link, Vector3& out_sv, Vector3& out_sw)
+{
+    switch(link->jointType()){
+    case Link::ROTATIONAL_JOINT:
+        out_sw.noalias() = link->R() * link->a();
+        out_sv = link->p().cross(out_sw);
+        break;
+    case Link::SLIDE_JOINT:
+        out_sw.setZero();
+        out_sv.noalias() = link->R() * link->d();
+        break;
+    default:
+        out_sw.setZero();
+        out_sv.setZero();
+        break;
     }
 }
+
 }
 
 
@@ -32,84 +70,99 @@ namespace cnoid {
 
 
 /**
-   calculate the mass matrix using the unit vector method
-   \todo replace the unit vector method here with a more efficient method
-       
+   calculate the mass matrix using the composite rigid body algorithm
+
    The motion equation (dv != dvo)
    |       |   | dv   |   |    |   | fext      |
    | out_M | * | dw   | + | b1 | = | tauext    |
    |       |   |ddq   |   |    |   | u         |
+
+   The rows and columns of dv and dw only exist when the root link is not fixed.
+   The mass matrix does not depend on the gravity acceleration g.
+
+   The composite inertia of the subtree below each joint gives the column elements of the joint
+   and of its ancestor joints, and the other elements, which are zero, are not calculated.
 */
 void calcMassMatrix(Body* body, const Vector3& g, Eigen::MatrixXd& out_M)
 {
     const int nj = body->numJoints();
+    const int numLinks = body->numLinks();
     Link* rootLink = body->rootLink();
-    const int totaldof = rootLink->isFixedJoint() ? nj : nj + 6;
-
-    out_M.resize(totaldof, totaldof);
-        
-    // preserve and clear the joint accelerations
-    VectorXd ddqorg(nj);
-    VectorXd uorg(nj);
-    for(int i = 0; i < nj; ++i){
-        Link* joint = body->joint(i);
-        ddqorg[i] = joint->ddq();
-        uorg  [i] = joint->u();
-        joint->ddq() = 0.0;
-    }
-
-    // preserve and clear the root link acceleration
-    const Vector3 dvorg = rootLink->dv();
-    const Vector3 dworg  = rootLink->dw();
+    const int rootDof = rootLink->isFixedJoint() ? 0 : 6;
+    const int totaldof = rootDof + nj;
 
-    //const Vector3 root_w_x_v = rootLink->w().cross(rootLink->vo() + rootLink->w().cross(rootLink->p()));
+    out_M.setZero(totaldof, totaldof);
 
-    rootLink->dv() = g;
-    rootLink->dw().setZero();
-	
-    MatrixXd b1(totaldof, 1);
-        
-    setColumnOfMassMatrix(body, b1, 0);
-
-    if(!rootLink->isFixedJoint()){
-        for(int i=0; i < 3; ++i){
-            rootLink->dv()[i] += 1.0;
-            setColumnOfMassMatrix(body, out_M, i);
-            rootLink->dv()[i] -= 0.0;
-        }
-        for(int i=0; i < 3; ++i){
-            rootLink->dw()[i] = 1.0;
-            setColumnOfMassMatrix(body, out_M, i + 3);
-            rootLink->dw()[i] = 0.0;
+    vector<int> dofIndex(numLinks, -1);
+    for(int i=0; i < nj; ++i){
+        Link* joint = body->joint(i);
+        if(joint->index() >= 0){
+            dofIndex[joint->index()] = rootDof + i;
         }
     }
 
-    for(int i = 0; i < nj; ++i){
-        Link* joint = body->joint(i);
-        joint->ddq() = 1.0;
-        int j = i + 6;
-        setColumnOfMassMatrix(body, out_M, j);
-        out_M(j, j) += joint->Jm2(); // motor inertia
-        joint->ddq() = 0.0;
+    // The parents precede their children in the link order
+    vector<CompositeInertia> inertias(numLinks);
+    for(int i = numLinks - 1; i >= 0; --i){
+        inertias[i].setLinkInertia(body->link(i));
     }
+    for(int i = numLinks - 1; i > 0; --i){
+        Link* link = body->link(i);
+        inertias[link->parent()->index()].add(inertias[i]);
+    }
+
+    const Vector3& p0 = rootLink->p();
+    Vector3 f, tau, sv, sw;
 
-    // subtract the constant term
-    for(int i = 0; i < out_M.cols(); ++i){
-        out_M.col(i) -= b1;
+    for(int i=1; i < numLinks; ++i){
+        Link* link = body->link(i);
+        const int column = dofIndex[i];
+        if(column < 0){
+            continue;
+        }
+        getJointAxis(link, sv, sw);
+        inertias[i].force(sv, sw, f, tau);
+        out_M(column, column) = link->Jm2(); // motor inertia
+
+        for(Link* joint = link; joint->parent(); joint = joint->parent()){
+            const int row = dofIndex[joint->index()];
+            if(row >= 0){
+                if(joint != link){
+                    getJointAxis(joint, sv, sw);
+                }
+                const double Mij = sv.dot(f) + sw.dot(tau);
+                out_M(row, column) += Mij;
+                if(row != column){
+                    out_M(column, row) += Mij;
+                }
+            }
+        }
+        if(rootDof){
+            out_M.block<3, 1>(0, column) = f;
+            out_M.block<3, 1>(3, column) = tau - p0.cross(f);
+            out_M.block<1, 3>(column, 0) = f.transpose();
+            out_M.block<1, 3>(column, 3) = (tau - p0.cross(f)).transpose();
+        }
     }
 
-    // recover state
-    for(int i = 0; i < nj; ++i){
-        Link* joint = body->joint(i);
-        joint->ddq()  = ddqorg[i];
-        joint->u()    = uorg  [i];
+    if(rootDof){
+        const CompositeInertia& total = inertias[0];
+        for(int i=0; i < 3; ++i){
+            // dv = e_i
+            total.force(Vector3::Unit(i), Vector3::Zero(), f, tau);
+            out_M.block<3, 1>(0, i) = f;
+            out_M.block<3, 1>(3, i) = tau - p0.cross(f);
+            // dw = e_i
+            const Vector3 dvo = p0.cross(Vector3::Unit(i));
+            total.force(dvo, Vector3::Unit(i), f, tau);
+            out_M.block<3, 1>(0, i + 3) = f;
+            out_M.block<3, 1>(3, i + 3) = tau - p0.cross(f);
+        }
     }
-    rootLink->dv() = dvorg;
-    rootLink->dw() = dworg;
 }
 
 
-void calcMassMatrix(const BodyPtr& body, MatrixXd& out_M)
+void calcMassMatrix(Body* body, MatrixXd& out_M)
 {
     const Vector3 g(0, 0, 9.8);
     calcMassMatrix(body, g, out_M);
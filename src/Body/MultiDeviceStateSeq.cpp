@@ -59,6 +59,25 @@ AbstractSeqPtr MultiDeviceStateSeq::cloneSeq() const
 }
 
 
+size_t MultiDeviceStateSeq::memoryUsage() const
+{
+    size_t usage = BaseSeqType::memoryUsage();
+    const int nf = numFrames();
+    const int np = numParts();
+    for(int i=0; i < np; ++i){
+        const DeviceState* prev = 0;
+        for(int j=0; j < nf; ++j){
+            const DeviceState* state = (*this)(j, i).get();
+            if(state && state != prev){
+                usage += sizeof(DeviceState) + state->stateSize() * sizeof(double);
+            }
+            prev = state;
+        }
+    }
+    return usage;
+}
+
+
 MultiDeviceStateSeq::~MultiDeviceStateSeq()
 {
 
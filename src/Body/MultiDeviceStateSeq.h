@@ -28,6 +28,12 @@ public:
 
     MultiDeviceStateSeq& operator=(const MultiDeviceStateSeq& rhs);
     virtual AbstractSeqPtr cloneSeq() const;        
+
+    /**
+       The sizes of the state objects are estimated from their state sizes.
+       A state shared by consecutive frames is counted only once.
+    */
+    virtual size_t memoryUsage() const;
 };
 
 typedef MultiDeviceStateSeq::Ptr MultiDeviceStateSeqPtr;
@@ -3,7 +3,6 @@
 */
 
 #include "PenetrationBlocker.h"
-#include <boost/bind.hpp>
 
 using namespace std;
 using namespace cnoid;
@@ -22,6 +21,8 @@ public:
 
     Link* targetLink;
     vector<Link*> opponentLinks;
+    PositionArray opponentPositions;
+    CollisionPairArray collisionPairs;
         
     double targetDepth;
     Vector3 pPrevGiven;
@@ -36,6 +37,7 @@ public:
     PenetrationBlockerImpl(CollisionDetectorPtr& collisionDetector, Link* targetLink);
     void addOpponentLink(Link* link);
     void start();
+    void updateOpponentPositions(bool doForce);
     bool adjust(Position& io_T, const Vector3& pushDirection);
     void onCollisionDetected(const CollisionPair& collisionPair);
 };
@@ -70,7 +72,8 @@ void PenetrationBlocker::addOpponentLink(Link* link)
 
 void PenetrationBlockerImpl::addOpponentLink(Link* link)
 {
-    collisionDetector->addGeometry(link->collisionShape());
+    const int id = collisionDetector->addGeometry(link->collisionShape());
+    collisionDetector->setGeometryStatic(id);
     opponentLinks.push_back(link);
     isCollisionDetectorReady = false;
 }
@@ -99,10 +102,33 @@ void PenetrationBlockerImpl::start()
         collisionDetector->makeReady();
         isCollisionDetectorReady = true;
     }
+    updateOpponentPositions(true);
     isPrevBlocked = false;
 }
 
 
+/**
+   The opponent links are usually not moved while the target link is dragged, so only the
+   positions changed since the last call are given to the collision detector.
+*/
+void PenetrationBlockerImpl::updateOpponentPositions(bool doForce)
+{
+    const size_t n = opponentLinks.size();
+    if(opponentPositions.size() != n){
+        opponentPositions.resize(n);
+        doForce = true;
+    }
+    for(size_t i=0; i < n; ++i){
+        const Position& T = opponentLinks[i]->position();
+        Position& cached = opponentPositions[i];
+        if(doForce || T.translation() != cached.translation() || T.linear() != cached.linear()){
+            cached = T;
+            collisionDetector->updatePosition(i+1, T);
+        }
+    }
+}
+
+
 bool PenetrationBlocker::adjust(Position& io_T, const Vector3& pushDirection)
 {
     return impl->adjust(io_T, pushDirection);
@@ -120,10 +146,8 @@ bool PenetrationBlockerImpl::adjust(Position& io_T, const Vector3& pushDirection
 
     bool blocked = false;
     s = pushDirection.normalized();
-    
-    for(size_t i=0; i < opponentLinks.size(); ++i){
-        collisionDetector->updatePosition(i+1, opponentLinks[i]->position());
-    }
+
+    updateOpponentPositions(false);
 
     int loop;
     maxnormal = Vector3::Zero();
@@ -135,7 +159,10 @@ bool PenetrationBlockerImpl::adjust(Position& io_T, const Vector3& pushDirection
         maxsdepth = 0.0;
         maxdepth = 0.0;
 
-        collisionDetector->detectCollisions(boost::bind(&PenetrationBlockerImpl::onCollisionDetected, this, _1));
+        collisionDetector->detectCollisions(collisionPairs);
+        for(size_t i=0; i < collisionPairs.size(); ++i){
+            onCollisionDetected(collisionPairs[i]);
+        }
         
         if(maxsdepth > 0.0){
             io_T.translation() += (maxdepth - targetDepth) * maxnormal;
@@ -14,7 +14,8 @@ namespace cnoid {
 class PenetrationBlockerImpl;
 
 /**
-   \todo use the CollidionDetector API
+   The opponent links are registered as static geometries, so only the pairs of the target link
+   and the opponent links are checked by the collision detector in adjust().
 */
 class CNOID_EXPORT PenetrationBlocker
 {
@@ -19,7 +19,8 @@ using namespace cnoid;
 namespace {
 
 const bool SOLVE_CONSTRAINTS_BY_SR_INVERSE = false;
-const bool SOLVE_CONSTRAINTS_BY_SVD = !SOLVE_CONSTRAINTS_BY_SR_INVERSE;
+const bool SOLVE_CONSTRAINTS_BY_SVD = false;
+const bool SOLVE_CONSTRAINTS_BY_QR = !SOLVE_CONSTRAINTS_BY_SR_INVERSE && !SOLVE_CONSTRAINTS_BY_SVD;
     
 double calcLU(int n, MatrixXd& a, std::vector<int>& pivots);
 void solveByLU(int n, MatrixXd& a, std::vector<int>& pivots, const MatrixXd::ColXpr& x, const VectorXd& b);
@@ -80,10 +81,16 @@ public:
     // Matrices
     MatrixXd Jaux;       // Jacobian Matrix (C x N)
     MatrixXd Jauxinv;    
-    MatrixXd W;       
+    MatrixXd JauxJinv;   // Jaux * Jinv (C x M)
             
     MatrixXd S;        // (C x N)
     MatrixXd Sinv;    
+
+    // The decompositions to solve the constraints by QR, whose buffers are reused in the iterations
+    Eigen::ColPivHouseholderQR<MatrixXd> Sqr;
+    Eigen::HouseholderQR<MatrixXd> Rqr;
+    MatrixXd Rt;
+    VectorXd Qtb;
             
     MatrixXd JJ2;    
             
@@ -152,6 +159,7 @@ public:
             
     IKStepResult calcOneStep(const Vector3& v, const Vector3& omega);
     void solveConstraints();
+    void solveConstraintsByQR(const VectorXd& deltaPaux);
     void setJacobianForOnePath(MatrixXd& J, int row, JointPath& jointPath, int axes);
     void setJacobianForFreeRoot(MatrixXd& J, int row, JointPath& jointPath, int axes);
     void addPinConstraints();
@@ -454,7 +462,7 @@ bool PinDragIKImpl::initialize()
     JJ2.resize(JJsize, JJsize);
     JJinv.resize(JJsize, JJsize);
 
-    W.resize(N, N);
+    JauxJinv.resize(C, M);
   
     pivots.resize(C);  
 
@@ -578,7 +586,8 @@ PinDragIKImpl::IKStepResult PinDragIKImpl::calcOneStep(const Vector3& v, const V
         normalizeRotation(baseLink->T());
     }
 
-    fkTraverse.calcForwardKinematics();
+    // the links that are not moved by the joints of the target joint path are skipped
+    fkTraverse.calcIncrementalForwardKinematics();
 
     double maxErrorSqr = 0.0;
     for(PinPropertyMap::iterator p = pinPropertyMap.begin(); p != pinPropertyMap.end(); p++){
@@ -604,24 +613,9 @@ PinDragIKImpl::IKStepResult PinDragIKImpl::calcOneStep(const Vector3& v, const V
 
 void PinDragIKImpl::solveConstraints()
 {
-    // W = (E - J# J)  (size N x N)
-    W.noalias() = MatrixXd::Identity(N, N) - Jinv * J;
-    
-    // normalize W for weighted theta
     /*
-      for(int i=0; i < N; i++){
-      double norm2 = 0.0;
-      for(int j=0; j < N; j++){
-      double a = W(j,i);
-      norm2 += qWeights[j] * a * a;
-      }
-      double norm = sqrt(norm2);
-      if(norm > 0.0001){
-      for(int j=0; j < N; j++){
-      W(j,i) /= norm;
-      }
-      }
-      }
+      The null space projector W = (E - J# J) (size N x N) is not formed because S = Jaux W and
+      W y are calculated with the low rank product J# J, whose rank is only M.
     */
 
     addPinConstraints();
@@ -634,7 +628,10 @@ void PinDragIKImpl::solveConstraints()
     dPaux.noalias() -= Jaux * dq;
     VectorXd& deltaPaux = dPaux;
 
-    S.noalias() = Jaux * W;
+    // S = Jaux W = Jaux - (Jaux J#) J
+    JauxJinv.noalias() = Jaux * Jinv;
+    S = Jaux;
+    S.noalias() -= JauxJinv * J;
 
     // normalize S and deltaPaux for weighted targets (weights of constraned positions)
     /*
@@ -653,10 +650,43 @@ void PinDragIKImpl::solveConstraints()
 
     } else if(SOLVE_CONSTRAINTS_BY_SVD){
         y = Eigen::JacobiSVD<MatrixXd>(S, Eigen::ComputeThinU | Eigen::ComputeThinV).solve(deltaPaux);
+
+    } else if(SOLVE_CONSTRAINTS_BY_QR){
+        solveConstraintsByQR(deltaPaux);
+    }
+
+    // dq = dq0 + W y = dq0 + y - J# (J y)
+    dq += y;
+    dq.noalias() -= Jinv * (J * y);
+}
+
+
+/**
+   Give the minimum norm least squares solution of S y = deltaPaux as the SVD does with the complete
+   orthogonal decomposition. S P = Q [R1 R2; 0 0] is given by the QR decomposition with column pivoting,
+   and [R1 R2]^T = Z T is decomposed again so that y = P Z (T^T)^-1 (Q^T deltaPaux) holds.
+   This is about ten times faster than JacobiSVD for the sizes of the pin constraints of humanoids.
+*/
+void PinDragIKImpl::solveConstraintsByQR(const VectorXd& deltaPaux)
+{
+    Sqr.compute(S);
+    const int rank = Sqr.rank();
+    const int n = S.cols();
+
+    if(rank == 0){
+        y.setZero(n);
+        return;
     }
+    
+    Rt = Sqr.matrixR().topRows(rank).triangularView<Eigen::Upper>().transpose();
+    Rqr.compute(Rt);
 
-    // dq = dq0 + W y
-    dq.noalias() += W * y;
+    Qtb.noalias() = Sqr.householderQ().transpose() * deltaPaux;
+    
+    y.setZero(n);
+    y.head(rank) = Rqr.matrixQR().topLeftCorner(rank, rank).triangularView<Eigen::Upper>().transpose().solve(Qtb.head(rank));
+    y = Rqr.householderQ() * y;
+    y = Sqr.colsPermutation() * y;
 }
 
 
@@ -27,6 +27,13 @@ public:
     virtual void getJointPositions(std::vector< boost::optional<double> >& out_q) const = 0;
     virtual boost::optional<Vector3> ZMP() const = 0;
 
+    /**
+       A provider which supports this function returns a copy which can be used in another thread
+       independently of the original one, and the copy must be deleted by the caller.
+       The default implementation returns null.
+    */
+    virtual PoseProvider* clone() const { return 0; }
+
 #ifdef CNOID_BACKWARD_COMPATIBILITY
     bool getBaseLinkPosition(Vector3& out_p, Matrix3& out_R) const {
         Position T;
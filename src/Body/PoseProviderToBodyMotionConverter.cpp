@@ -9,14 +9,32 @@
 #include "BodyMotion.h"
 #include "ZMPSeq.h"
 #include "PoseProvider.h"
+#include <cnoid/TaskScheduler>
+#include <boost/bind.hpp>
 
 using namespace std;
 using namespace cnoid;
 
+
+/**
+   The frames generated by one thread with its own copies of the body and the provider
+*/
+struct PoseProviderToBodyMotionConverter::FrameBlock
+{
+    int beginningFrame;
+    int nextBlockFrame;
+    BodyPtr body;
+    boost::shared_ptr<PoseProvider> provider;
+};
+
+
 PoseProviderToBodyMotionConverter::PoseProviderToBodyMotionConverter()
 {
     setFullTimeRange();
     allLinkPositionOutputMode = true;
+    numFramesToConvert_ = 0;
+    numConvertedFrames_ = 0;
+    isCanceled = false;
 }
 
     
@@ -43,6 +61,9 @@ void PoseProviderToBodyMotionConverter::setAllLinkPositionOutput(bool on)
 
 bool PoseProviderToBodyMotionConverter::convert(Body* body, PoseProvider* provider, BodyMotion& motion)
 {
+    isCanceled = false;
+    numConvertedFrames_ = 0;
+    
     const double frameRate = motion.frameRate();
     const int beginningFrame = static_cast<int>(frameRate * std::max(provider->beginningTime(), lowerTime));
     const int endingFrame = static_cast<int>(frameRate * std::min(provider->endingTime(), upperTime));
@@ -50,11 +71,86 @@ bool PoseProviderToBodyMotionConverter::convert(Body* body, PoseProvider* provid
     const int numLinksToPut = (allLinkPositionOutputMode ? body->numLinks() : 1);
     
     motion.setDimension(endingFrame + 1, numJoints, numLinksToPut, true);
+    getOrCreateZMPSeq(motion);
+
+    const int numFrames = endingFrame - beginningFrame + 1;
+    numFramesToConvert_ = std::max(0, numFrames);
+
+    vector<FrameBlock> blocks;
+    const int numBlocks = std::min(TaskScheduler::instance()->concurrency(), numFrames);
+    if(numBlocks >= 2){
+        blocks.resize(numBlocks);
+        for(int i=0; i < numBlocks; ++i){
+            FrameBlock& block = blocks[i];
+            block.provider.reset(provider->clone());
+            if(!block.provider){
+                blocks.clear();
+                break;
+            }
+            block.beginningFrame = beginningFrame + (long)numFrames * i / numBlocks;
+            block.nextBlockFrame = beginningFrame + (long)numFrames * (i + 1) / numBlocks;
+            block.body = body->clone();
+        }
+    }
+
+    if(!blocks.empty()){
+        TaskScheduler::instance()->parallelFor(
+            0, blocks.size(),
+            boost::bind(&PoseProviderToBodyMotionConverter::convertFrameBlock, this, &motion, &blocks, _1));
+
+    } else {
+        // store the original state
+        vector<double> orgq(numJoints);
+        for(int i=0; i < numJoints; ++i){
+            orgq[i] = body->joint(i)->q();
+        }
+        Link* rootLink = body->rootLink();
+        Vector3 p0 = rootLink->p();
+        Matrix3 R0 = rootLink->R();
+
+        convertFrames(body, provider, motion, beginningFrame, endingFrame + 1, endingFrame, true);
+
+        // restore the original state
+        for(int i=0; i < numJoints; ++i){
+            body->joint(i)->q() = orgq[i];
+        }
+        rootLink->p() = p0;
+        rootLink->R() = R0;
+        body->calcForwardKinematics();
+    }
+
+    return !isCanceled;
+}
+
+
+void PoseProviderToBodyMotionConverter::convertFrameBlock
+(BodyMotion* motion, std::vector<FrameBlock>* blocks, int blockIndex)
+{
+    FrameBlock& block = (*blocks)[blockIndex];
+    const int endingFrame = blocks->back().nextBlockFrame - 1;
+    convertFrames(block.body, block.provider.get(), *motion,
+                  block.beginningFrame, block.nextBlockFrame, endingFrame, (blockIndex == 0));
+}
+
 
+/**
+   The frames from beginningFrame are generated until the frame before the one where the next block begins.
+   The generation of a block except the head one begins at the first frame where the base link position
+   is given because the base link position is kept from the previous frames when it is not given.
+   The previous block continues the generation until the same frame, and a block where the base link position
+   is not given at all is completely generated by the previous block.
+*/
+void PoseProviderToBodyMotionConverter::convertFrames
+(Body* body, PoseProvider* provider, BodyMotion& motion,
+ int beginningFrame, int nextBlockFrame, int endingFrame, bool isHead)
+{
+    const double frameRate = motion.frameRate();
+    const int numJoints = body->numJoints();
+    const int numLinksToPut = (allLinkPositionOutputMode ? body->numLinks() : 1);
+    
     MultiValueSeq& qseq = *motion.jointPosSeq();
     MultiSE3Seq& pseq = *motion.linkPosSeq();
-    ZMPSeq& zmpseq = *getOrCreateZMPSeq(motion);
-    bool isZmpValid = false;
+    ZMPSeq& zmpseq = *getZMPSeq(motion);
 
     Link* rootLink = body->rootLink();
     Link* baseLink = rootLink;
@@ -66,21 +162,32 @@ bool PoseProviderToBodyMotionConverter::convert(Body* body, PoseProvider* provid
         fkTraverse.reset(new LinkPath(baseLink, rootLink));
     }
 
-    // store the original state
-    vector<double> orgq(numJoints);
-    for(int i=0; i < numJoints; ++i){
-        orgq[i] = body->joint(i)->q();
-    }
-    Vector3 p0 = rootLink->p();
-    Matrix3 R0 = rootLink->R();
-
     std::vector< boost::optional<double> > jointPositions(numJoints);
 
+    bool isStarted = isHead;
+
     for(int frame = beginningFrame; frame <= endingFrame; ++frame){
 
+        if(isCanceled){
+            break;
+        }
+
         provider->seek(frame / frameRate);
 
         const int baseLinkIndex = provider->baseLinkIndex();
+
+        if(!isStarted){
+            if(baseLinkIndex < 0){
+                if(frame + 1 >= nextBlockFrame){
+                    break;
+                }
+                continue;
+            }
+            isStarted = true;
+        } else if(frame >= nextBlockFrame && baseLinkIndex >= 0){
+            break;
+        }
+        
         if(baseLinkIndex >= 0){
             if(baseLinkIndex != baseLink->index()){
                 baseLink = body->link(baseLinkIndex);
@@ -114,22 +221,8 @@ bool PoseProviderToBodyMotionConverter::convert(Body* body, PoseProvider* provid
         boost::optional<Vector3> zmp = provider->ZMP();
         if(zmp){
             zmpseq[frame] = *zmp;
-            isZmpValid = true;
         }
 
+        ++numConvertedFrames_;
     }
-
-    if(!isZmpValid){
-        //bodyMotionItem->clearRelativeZmpSeq();
-    }
-
-    // restore the original state
-    for(int i=0; i < numJoints; ++i){
-        body->joint(i)->q() = orgq[i];
-    }
-    rootLink->p() = p0;
-    rootLink->R() = R0;
-    body->calcForwardKinematics();
-
-    return true;
 }
@@ -5,6 +5,8 @@
 #ifndef CNOID_BODY_POSE_PROVIDER_TO_BODY_MOTION_CONVERTER_H
 #define CNOID_BODY_POSE_PROVIDER_TO_BODY_MOTION_CONVERTER_H
 
+#include <vector>
+#include <boost/atomic.hpp>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -20,12 +22,37 @@ public:
     void setTimeRange(double lower, double upper);
     void setFullTimeRange();
     void setAllLinkPositionOutput(bool on);
+
+    /**
+       When the provider supports PoseProvider::clone(), the time range is divided into blocks
+       and the frames of the blocks are generated in parallel with the copies of the body and the provider.
+       In this case the given body and provider are not modified.
+       This function may be executed in a thread other than the main thread so that the main thread can
+       show the progress by numConvertedFrames() and call cancel().
+       @return false if the conversion is canceled
+    */
     bool convert(Body* body, PoseProvider* provider, BodyMotion& motion);
 
+    int numFramesToConvert() const { return numFramesToConvert_; }
+    int numConvertedFrames() const { return numConvertedFrames_; }
+    void cancel() { isCanceled = true; }
+
 private:
     double lowerTime;
     double upperTime;
     bool allLinkPositionOutputMode;
+    boost::atomic<int> numFramesToConvert_;
+    boost::atomic<int> numConvertedFrames_;
+    boost::atomic<bool> isCanceled;
+
+    struct FrameBlock;
+    void convertFrameBlock(BodyMotion* motion, std::vector<FrameBlock>* blocks, int blockIndex);
+    void convertFrames(
+        Body* body, PoseProvider* provider, BodyMotion& motion,
+        int beginningFrame, int nextBlockFrame, int endingFrame, bool isHead);
+
+    PoseProviderToBodyMotionConverter(const PoseProviderToBodyMotionConverter& org);
+    PoseProviderToBodyMotionConverter& operator=(const PoseProviderToBodyMotionConverter& rhs);
 };
 
 }
@@ -4,16 +4,32 @@
 */
 
 #include "RangeCamera.h"
+#include <cnoid/SceneCameras>
 #include <boost/make_shared.hpp>
+#include <boost/cstdint.hpp>
+#include <zlib.h>
+#include <limits>
+#include <algorithm>
 
+using namespace std;
 using namespace cnoid;
 
 
+const unsigned short RangeCamera::DepthImageNoReturn;
+
+
 RangeCamera::RangeCamera()
 {
     setImageType(NO_IMAGE);
     points_ = boost::make_shared<PointData>();
+    depthImage_ = boost::make_shared<DepthImage>();
+    validPointData_ = POINTS_VALID | DEPTH_IMAGE_VALID;
     isOrganized_ = false;
+    pointDataFormat_ = POINT_DATA;
+    depthImageStep_ = 0.001;
+    rangeNoise_ = 0.0;
+    rangeQuantizationStep_ = 0.0;
+    dropoutRate_ = 0.0;
 }
 
 
@@ -37,20 +53,31 @@ void RangeCamera::copyStateFrom(const RangeCamera& other)
     Camera::copyStateFrom(other);
     copyRangeCameraStateFrom(other);
     points_ = other.points_;
+    depthImage_ = other.depthImage_;
+    encodedPointData_ = other.encodedPointData_;
+    validPointData_ = other.validPointData_;
 }
 
 
 void RangeCamera::copyRangeCameraStateFrom(const RangeCamera& other)
 {
     isOrganized_ = other.isOrganized_;
+    pointDataFormat_ = other.pointDataFormat_;
+    depthImageStep_ = other.depthImageStep_;
+    rangeNoise_ = other.rangeNoise_;
+    rangeQuantizationStep_ = other.rangeQuantizationStep_;
+    dropoutRate_ = other.dropoutRate_;
 }
 
 
 RangeCamera::RangeCamera(const RangeCamera& org, bool copyStateOnly)
     : Camera(org, copyStateOnly),
-      points_(org.points_)
+      points_(org.points_),
+      depthImage_(org.depthImage_),
+      encodedPointData_(org.encodedPointData_)
 {
     copyRangeCameraStateFrom(org);
+    validPointData_ = org.validPointData_;
 }
 
         
@@ -70,8 +97,13 @@ RangeCamera::RangeCamera(const RangeCamera& org, int x /* dummy */)
     
     if(org.isImageStateClonable()){
         points_ = org.points_;
+        depthImage_ = org.depthImage_;
+        encodedPointData_ = org.encodedPointData_;
+        validPointData_ = org.validPointData_;
     } else {
         points_ = boost::make_shared<PointData>();
+        depthImage_ = boost::make_shared<DepthImage>();
+        validPointData_ = POINTS_VALID | DEPTH_IMAGE_VALID;
     }
 }
 
@@ -90,11 +122,25 @@ void RangeCamera::forEachActualType(boost::function<bool(const std::type_info& t
 }
 
 
+void RangeCamera::setDepthImageStep(double step)
+{
+    if(step > 0.0){
+        depthImageStep_ = step;
+    }
+}
+
+
+/**
+   The depth image is discarded because the returned points may be modified.
+*/
 RangeCamera::PointData& RangeCamera::points()
 {
+    constPoints();
     if(points_.use_count() > 1){
         points_ = boost::make_shared<PointData>(*points_);
     }
+    validPointData_ = POINTS_VALID;
+    encodedPointData_.reset();
     return *points_;
 }
 
@@ -102,6 +148,8 @@ RangeCamera::PointData& RangeCamera::points()
 RangeCamera::PointData& RangeCamera::newPoints()
 {
     points_ = boost::make_shared<PointData>();
+    validPointData_ = POINTS_VALID;
+    encodedPointData_.reset();
     return *points_;
 }
 
@@ -114,6 +162,92 @@ void RangeCamera::setPoints(boost::shared_ptr<PointData>& points)
         points_ = boost::make_shared<PointData>(*points);
     }
     points.reset();
+    validPointData_ = POINTS_VALID;
+    encodedPointData_.reset();
+}
+
+
+void RangeCamera::setDepthImage(boost::shared_ptr<DepthImage>& image)
+{
+    if(image.use_count() == 1){
+        depthImage_ = image;
+    } else {
+        depthImage_ = boost::make_shared<DepthImage>(*image);
+    }
+    image.reset();
+    validPointData_ = DEPTH_IMAGE_VALID;
+    encodedPointData_.reset();
+}
+
+
+/**
+   The points converted from a depth image are organized, and the point of a pixel which has
+   no depth is at infinity in the direction of the pixel as the points given by the simulator.
+   A depth image can only be converted from the organized points of the camera resolution.
+*/
+void RangeCamera::updatePointData(int format) const
+{
+    if(!(validPointData_ & (POINTS_VALID | DEPTH_IMAGE_VALID))){
+        decodePointData();
+        if(validPointData_ & format){
+            return;
+        }
+    }
+    
+    const int width = resolutionX();
+    const int height = resolutionY();
+    const double step = depthImageStep_;
+    
+    if(format == POINTS_VALID){
+        boost::shared_ptr<PointData> points = boost::make_shared<PointData>();
+        const DepthImage& image = *depthImage_;
+        if(image.size() == (size_t)(width * height)){
+            const double aspectRatio = (double)width / height;
+            const float tanY = tan(SgPerspectiveCamera::fovy(aspectRatio, fieldOfView()) / 2.0);
+            const float tanX = tanY * aspectRatio;
+            const float inf = numeric_limits<float>::infinity();
+            points->resize(width * height);
+            Vector3f* p = &points->front();
+            for(int row=0; row < height; ++row){
+                const int y = height - 1 - row;
+                const float ny = 2.0f * y / height - 1.0f;
+                const unsigned short* src = &image[row * width];
+                for(int x=0; x < width; ++x){
+                    const float nx = 2.0f * x / width - 1.0f;
+                    if(src[x] != DepthImageNoReturn){
+                        const float d = src[x] * step;
+                        *p++ << nx * tanX * d, ny * tanY * d, -d;
+                    } else {
+                        *p++ << (x - width / 2) * inf, (y - height / 2) * inf, -inf;
+                    }
+                }
+            }
+        }
+        points_ = points;
+
+    } else if(format == DEPTH_IMAGE_VALID){
+        boost::shared_ptr<DepthImage> image = boost::make_shared<DepthImage>();
+        const PointData& points = *points_;
+        if(isOrganized_ && points.size() == (size_t)(width * height)){
+            const double maxDepth = 65535 * step;
+            image->resize(width * height);
+            for(int row=0; row < height; ++row){
+                const Vector3f* src = &points[row * width];
+                unsigned short* dest = &(*image)[row * width];
+                for(int x=0; x < width; ++x){
+                    const double d = -src[x].z();
+                    if(d > 0.0 && d <= maxDepth){
+                        dest[x] = std::max(1, static_cast<int>(d / step + 0.5));
+                    } else {
+                        dest[x] = DepthImageNoReturn;
+                    }
+                }
+            }
+        }
+        depthImage_ = image;
+    }
+
+    validPointData_ |= format;
 }
 
 
@@ -126,6 +260,180 @@ void RangeCamera::clearState()
     } else {
         points_ = boost::make_shared<PointData>();
     }
+    depthImage_ = boost::make_shared<DepthImage>();
+    validPointData_ = POINTS_VALID | DEPTH_IMAGE_VALID;
+    encodedPointData_.reset();
+}
+
+
+namespace {
+
+/*
+  The compressed point data begins with the type octet. The values are stored as the
+  differences from the previous values, and the bytes of the differences are arranged
+  in the planes of the same significance so that zlib compresses the small differences well.
+*/
+enum EncodedPointDataType { ENCODED_DEPTH_IMAGE = 1, ENCODED_POINTS = 2 };
+
+// The sentinels of the quantized coordinates which are not finite
+const boost::int32_t PositiveInfinity = std::numeric_limits<boost::int32_t>::max();
+const boost::int32_t NegativeInfinity = std::numeric_limits<boost::int32_t>::min();
+const boost::int32_t NotANumber = NegativeInfinity + 1;
+const double MaxQuantizedValue = 1.0e9;
+
+
+template<class UIntType>
+void encodeDifferences(const UIntType* values, size_t size, std::vector<unsigned char>& out_data)
+{
+    const int numBytes = sizeof(UIntType);
+    const size_t offset = out_data.size();
+    std::vector<unsigned char> planes(size * numBytes);
+    UIntType prev = 0;
+    for(size_t i=0; i < size; ++i){
+        const UIntType diff = values[i] - prev;
+        prev = values[i];
+        for(int j=0; j < numBytes; ++j){
+            planes[j * size + i] = (diff >> (j * 8)) & 0xff;
+        }
+    }
+    const boost::uint32_t planesSize = planes.size();
+    uLongf compressedSize = compressBound(planesSize);
+    out_data.resize(offset + 4 + compressedSize);
+    for(int j=0; j < 4; ++j){
+        out_data[offset + j] = (planesSize >> (j * 8)) & 0xff;
+    }
+    if(planesSize > 0){
+        compress2(&out_data[offset + 4], &compressedSize, &planes.front(), planesSize, Z_BEST_SPEED);
+    } else {
+        compressedSize = 0;
+    }
+    out_data.resize(offset + 4 + compressedSize);
+}
+
+
+template<class UIntType>
+bool decodeDifferences(const std::vector<unsigned char>& data, size_t pos, std::vector<UIntType>& out_values)
+{
+    const int numBytes = sizeof(UIntType);
+    if(pos + 4 > data.size()){
+        return false;
+    }
+    boost::uint32_t planesSize = 0;
+    for(int j=0; j < 4; ++j){
+        planesSize |= static_cast<boost::uint32_t>(data[pos + j]) << (j * 8);
+    }
+    pos += 4;
+    const size_t size = planesSize / numBytes;
+    out_values.resize(size);
+    if(size == 0){
+        return true;
+    }
+    std::vector<unsigned char> planes(planesSize);
+    uLongf uncompressedSize = planesSize;
+    if(uncompress(&planes.front(), &uncompressedSize, &data[pos], data.size() - pos) != Z_OK ||
+       uncompressedSize != planesSize){
+        out_values.clear();
+        return false;
+    }
+    UIntType prev = 0;
+    for(size_t i=0; i < size; ++i){
+        UIntType diff = 0;
+        for(int j=0; j < numBytes; ++j){
+            diff |= static_cast<UIntType>(planes[j * size + i]) << (j * 8);
+        }
+        prev += diff;
+        out_values[i] = prev;
+    }
+    return true;
+}
+
+}
+
+
+void RangeCamera::encodePointData()
+{
+    if(isPointDataEncoded()){
+        return;
+    }
+    boost::shared_ptr< std::vector<unsigned char> > data = boost::make_shared< std::vector<unsigned char> >();
+
+    const int numPixels = resolutionX() * resolutionY();
+    if(isOrganized_ && ((validPointData_ & DEPTH_IMAGE_VALID) || points_->size() == (size_t)numPixels)){
+        const DepthImage& image = depthImage();
+        data->push_back(ENCODED_DEPTH_IMAGE);
+        encodeDifferences(image.empty() ? 0 : &image.front(), image.size(), *data);
+
+    } else {
+        const PointData& points = constPoints();
+        const size_t n = points.size();
+        const double r = 1.0 / depthImageStep_;
+        // The coordinates are arranged by the axes so that the successive values are close
+        std::vector<boost::uint32_t> values(n * 3);
+        for(int k=0; k < 3; ++k){
+            for(size_t i=0; i < n; ++i){
+                const double x = points[i][k];
+                boost::int32_t q;
+                if(x != x){
+                    q = NotANumber;
+                } else if(x * r > MaxQuantizedValue){
+                    q = PositiveInfinity;
+                } else if(x * r < -MaxQuantizedValue){
+                    q = NegativeInfinity;
+                } else {
+                    q = static_cast<boost::int32_t>(floor(x * r + 0.5));
+                }
+                values[k * n + i] = static_cast<boost::uint32_t>(q);
+            }
+        }
+        data->push_back(ENCODED_POINTS);
+        encodeDifferences(values.empty() ? 0 : &values.front(), values.size(), *data);
+    }
+
+    encodedPointData_ = data;
+    points_.reset();
+    depthImage_.reset();
+    validPointData_ = 0;
+}
+
+
+void RangeCamera::decodePointData() const
+{
+    const std::vector<unsigned char>* data = encodedPointData_.get();
+    const int type = (data && !data->empty()) ? (*data)[0] : 0;
+
+    if(type == ENCODED_DEPTH_IMAGE){
+        boost::shared_ptr<DepthImage> image = boost::make_shared<DepthImage>();
+        decodeDifferences(*data, 1, *image);
+        depthImage_ = image;
+        validPointData_ |= DEPTH_IMAGE_VALID;
+        
+    } else {
+        boost::shared_ptr<PointData> points = boost::make_shared<PointData>();
+        std::vector<boost::uint32_t> values;
+        if(type == ENCODED_POINTS && decodeDifferences(*data, 1, values)){
+            const size_t n = values.size() / 3;
+            const float step = depthImageStep_;
+            const float inf = numeric_limits<float>::infinity();
+            points->resize(n);
+            for(int k=0; k < 3; ++k){
+                for(size_t i=0; i < n; ++i){
+                    const boost::int32_t q = static_cast<boost::int32_t>(values[k * n + i]);
+                    float& x = (*points)[i][k];
+                    if(q == PositiveInfinity){
+                        x = inf;
+                    } else if(q == NegativeInfinity){
+                        x = -inf;
+                    } else if(q == NotANumber){
+                        x = numeric_limits<float>::quiet_NaN();
+                    } else {
+                        x = q * step;
+                    }
+                }
+            }
+        }
+        points_ = points;
+        validPointData_ |= POINTS_VALID;
+    }
 }
 
 
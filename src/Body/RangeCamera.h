@@ -25,19 +25,70 @@ public:
     virtual void forEachActualType(boost::function<bool(const std::type_info& type)> func);
     virtual void clearState();
 
-    int numPoints() const { return points_->size(); }
+    int numPoints() const { return constPoints().size(); }
 
     typedef std::vector<Vector3f> PointData;
 
-    const PointData& points() const { return *points_; }
-    const PointData& constPoints() const { return *points_; }
+    /**
+       The points are given as a depth image by the simulator if the format is DEPTH_IMAGE.
+       The points are converted from the depth image when they are accessed in that case.
+    */
+    enum PointDataFormat { POINT_DATA, DEPTH_IMAGE };
+    PointDataFormat pointDataFormat() const { return pointDataFormat_; }
+    void setPointDataFormat(PointDataFormat format) { pointDataFormat_ = format; }
+
+    /**
+       The depth image has the same size as the camera image, and the rows are stored from the top.
+       Each pixel is the depth along the optical axis in the unit of depthImageStep().
+       The pixel is DepthImageNoReturn if nothing is measured or the depth exceeds the range.
+    */
+    typedef std::vector<unsigned short> DepthImage;
+    static const unsigned short DepthImageNoReturn = 0;
+    double depthImageStep() const { return depthImageStep_; }
+    void setDepthImageStep(double step);
+
+    const PointData& points() const { return constPoints(); }
+    const PointData& constPoints() const {
+        if(!(validPointData_ & POINTS_VALID)) updatePointData(POINTS_VALID);
+        return *points_;
+    }
     PointData& points();
     PointData& newPoints();
 
+    const DepthImage& depthImage() const {
+        if(!(validPointData_ & DEPTH_IMAGE_VALID)) updatePointData(DEPTH_IMAGE_VALID);
+        return *depthImage_;
+    }
+    boost::shared_ptr<const DepthImage> sharedDepthImage() const {
+        depthImage();
+        return depthImage_;
+    }
+
     bool isOrganized() const { return isOrganized_; }
     void setOrganized(bool on);
+
+    /**
+       The standard deviation [m] of the Gaussian noise added to the measured distances
+    */
+    double rangeNoise() const { return rangeNoise_; }
+    void setRangeNoise(double sigma) { rangeNoise_ = sigma; }
+
+    /**
+       The measured distances are rounded to the multiples of this value [m] if it is positive
+    */
+    double rangeQuantizationStep() const { return rangeQuantizationStep_; }
+    void setRangeQuantizationStep(double step) { rangeQuantizationStep_ = step; }
+
+    /**
+       The probability that a measurement fails and no distance is given
+    */
+    double dropoutRate() const { return dropoutRate_; }
+    void setDropoutRate(double rate) { dropoutRate_ = rate; }
             
-    boost::shared_ptr<const PointData> sharedPoints() const { return points_; }
+    boost::shared_ptr<const PointData> sharedPoints() const {
+        constPoints();
+        return points_;
+    }
 
     /**
        Move semantics. If the use_count() of the given shared point data pointer is one,
@@ -45,13 +96,35 @@ public:
        Otherwise, the data is copied.
     */
     void setPoints(boost::shared_ptr<PointData>& points);
+    void setDepthImage(boost::shared_ptr<DepthImage>& image);
+
+    /**
+       The point data is replaced with the compressed data to reduce the memory of the recorded states,
+       and it is decompressed when it is accessed. The organized points are compressed as the depth image,
+       whose compression is lossless, and the other points are compressed with their coordinates
+       quantized by depthImageStep().
+       The point data must not be accessed by the other threads during the compression.
+    */
+    void encodePointData();
+    bool isPointDataEncoded() const { return !(validPointData_ & (POINTS_VALID | DEPTH_IMAGE_VALID)); }
 
 private:
-    boost::shared_ptr< std::vector<Vector3f> > points_;
+    enum { POINTS_VALID = 1, DEPTH_IMAGE_VALID = 2 };
+    mutable int validPointData_;
+    mutable boost::shared_ptr< std::vector<Vector3f> > points_;
+    mutable boost::shared_ptr<DepthImage> depthImage_;
+    boost::shared_ptr< const std::vector<unsigned char> > encodedPointData_;
     bool isOrganized_;
+    PointDataFormat pointDataFormat_;
+    double depthImageStep_;
+    double rangeNoise_;
+    double rangeQuantizationStep_;
+    double dropoutRate_;
 
     RangeCamera(const RangeCamera& org, int x);
     void copyRangeCameraStateFrom(const RangeCamera& other);    
+    void updatePointData(int format) const;
+    void decodePointData() const;
 };
 
 typedef ref_ptr<RangeCamera> RangeCameraPtr;
@@ -5,6 +5,7 @@
 
 #include "RangeSensor.h"
 #include <boost/make_shared.hpp>
+#include <limits>
 
 using namespace std;
 using namespace cnoid;
@@ -14,6 +15,9 @@ const double PI = 3.14159265358979323846;
 }
 
 
+const unsigned short RangeSensor::FixedPointNoReturn;
+
+
 const char* RangeSensor::typeName()
 {
     return "RangeSensor";
@@ -32,7 +36,15 @@ RangeSensor::RangeSensor()
     maxDistance_ = 10.0;
     frameRate_ = 10.0;
     delay_ = 0.0;
+    rangeNoise_ = 0.0;
+    rangeQuantizationStep_ = 0.0;
+    dropoutRate_ = 0.0;
+    rangeDataFormat_ = DOUBLE_RANGE_DATA;
+    fixedPointRangeStep_ = 0.001;
     rangeData_ = boost::make_shared<RangeData>();
+    floatRangeData_ = boost::make_shared<FloatRangeData>();
+    fixedPointRangeData_ = boost::make_shared<FixedPointRangeData>();
+    validRangeData_ = DOUBLE_VALID | FLOAT_VALID | FIXED_POINT_VALID;
 }
 
 
@@ -49,6 +61,9 @@ void RangeSensor::copyStateFrom(const RangeSensor& other)
 {
     copyRangeSensorStateFrom(other);
     rangeData_ = other.rangeData_;
+    floatRangeData_ = other.floatRangeData_;
+    fixedPointRangeData_ = other.fixedPointRangeData_;
+    validRangeData_ = other.validRangeData_;
 }
 
 
@@ -64,14 +79,22 @@ void RangeSensor::copyRangeSensorStateFrom(const RangeSensor& other)
     maxDistance_ = other.maxDistance_;
     frameRate_ = other.frameRate_;
     delay_ = other.delay_;
+    rangeNoise_ = other.rangeNoise_;
+    rangeQuantizationStep_ = other.rangeQuantizationStep_;
+    dropoutRate_ = other.dropoutRate_;
+    rangeDataFormat_ = other.rangeDataFormat_;
+    fixedPointRangeStep_ = other.fixedPointRangeStep_;
 }
 
 
 RangeSensor::RangeSensor(const RangeSensor& org, bool copyStateOnly)
     : Device(org, copyStateOnly),
-      rangeData_(org.rangeData_)
+      rangeData_(org.rangeData_),
+      floatRangeData_(org.floatRangeData_),
+      fixedPointRangeData_(org.fixedPointRangeData_)
 {
     copyRangeSensorStateFrom(org);
+    validRangeData_ = org.validRangeData_;
 }
 
         
@@ -91,8 +114,14 @@ RangeSensor::RangeSensor(const RangeSensor& org, int x /* dummy */)
 
     if(org.isRangeDataStateClonable_){
         rangeData_ = org.rangeData_;
+        floatRangeData_ = org.floatRangeData_;
+        fixedPointRangeData_ = org.fixedPointRangeData_;
+        validRangeData_ = org.validRangeData_;
     } else {
         rangeData_ = boost::make_shared<RangeData>();
+        floatRangeData_ = boost::make_shared<FloatRangeData>();
+        fixedPointRangeData_ = boost::make_shared<FixedPointRangeData>();
+        validRangeData_ = DOUBLE_VALID | FLOAT_VALID | FIXED_POINT_VALID;
     }
 }
 
@@ -195,11 +224,24 @@ void RangeSensor::setFrameRate(double r)
 }
 
 
+void RangeSensor::setFixedPointRangeStep(double step)
+{
+    if(step > 0.0){
+        fixedPointRangeStep_ = step;
+    }
+}
+
+
+/**
+   The data of the other formats are discarded because the returned data may be modified.
+*/
 RangeSensor::RangeData& RangeSensor::rangeData()
 {
+    constRangeData();
     if(rangeData_.use_count() > 1){
         rangeData_ = boost::make_shared<RangeData>(*rangeData_);
     }
+    validRangeData_ = DOUBLE_VALID;
     return *rangeData_;
 }
 
@@ -207,6 +249,7 @@ RangeSensor::RangeData& RangeSensor::rangeData()
 RangeSensor::RangeData& RangeSensor::newRangeData()
 {
     rangeData_ = boost::make_shared<RangeData>();
+    validRangeData_ = DOUBLE_VALID;
     return *rangeData_;
 }
 
@@ -219,6 +262,75 @@ void RangeSensor::setRangeData(boost::shared_ptr<RangeData>& data)
         rangeData_ = boost::make_shared<RangeData>(*data);
     }
     data.reset();
+    validRangeData_ = DOUBLE_VALID;
+}
+
+
+void RangeSensor::setFloatRangeData(boost::shared_ptr<FloatRangeData>& data)
+{
+    if(data.use_count() == 1){
+        floatRangeData_ = data;
+    } else {
+        floatRangeData_ = boost::make_shared<FloatRangeData>(*data);
+    }
+    data.reset();
+    validRangeData_ = FLOAT_VALID;
+}
+
+
+void RangeSensor::setFixedPointRangeData(boost::shared_ptr<FixedPointRangeData>& data)
+{
+    if(data.use_count() == 1){
+        fixedPointRangeData_ = data;
+    } else {
+        fixedPointRangeData_ = boost::make_shared<FixedPointRangeData>(*data);
+    }
+    data.reset();
+    validRangeData_ = FIXED_POINT_VALID;
+}
+
+
+/**
+   The data of the given format is converted from the data of another format which is valid.
+   A new object is created for the converted data because the previous one may be shared.
+*/
+void RangeSensor::updateRangeData(int format) const
+{
+    const double step = fixedPointRangeStep_;
+    const double maxDistance = (FixedPointNoReturn - 1) * step;
+    
+    if(format == DOUBLE_VALID){
+        boost::shared_ptr<RangeData> data = boost::make_shared<RangeData>();
+        if(validRangeData_ & FLOAT_VALID){
+            data->assign(floatRangeData_->begin(), floatRangeData_->end());
+        } else if(validRangeData_ & FIXED_POINT_VALID){
+            const FixedPointRangeData& src = *fixedPointRangeData_;
+            data->resize(src.size());
+            for(size_t i=0; i < src.size(); ++i){
+                (*data)[i] = (src[i] == FixedPointNoReturn) ? numeric_limits<double>::infinity() : src[i] * step;
+            }
+        }
+        rangeData_ = data;
+
+    } else if(format == FLOAT_VALID){
+        const RangeData& src = constRangeData();
+        floatRangeData_ = boost::make_shared<FloatRangeData>(src.begin(), src.end());
+
+    } else if(format == FIXED_POINT_VALID){
+        const RangeData& src = constRangeData();
+        boost::shared_ptr<FixedPointRangeData> data = boost::make_shared<FixedPointRangeData>(src.size());
+        for(size_t i=0; i < src.size(); ++i){
+            const double d = src[i];
+            if(d >= 0.0 && d <= maxDistance){
+                (*data)[i] = static_cast<unsigned short>(d / step + 0.5);
+            } else {
+                (*data)[i] = FixedPointNoReturn;
+            }
+        }
+        fixedPointRangeData_ = data;
+    }
+
+    validRangeData_ |= format;
 }
 
 
@@ -229,6 +341,9 @@ void RangeSensor::clearState()
     } else {
         rangeData_ = boost::make_shared<RangeData>();
     }
+    floatRangeData_ = boost::make_shared<FloatRangeData>();
+    fixedPointRangeData_ = boost::make_shared<FixedPointRangeData>();
+    validRangeData_ = DOUBLE_VALID | FLOAT_VALID | FIXED_POINT_VALID;
 }
 
 
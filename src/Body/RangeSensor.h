@@ -53,20 +53,79 @@ public:
     double frameRate() const { return frameRate_; }
     void setFrameRate(double r);
 
+    /**
+       The standard deviation [m] of the Gaussian noise added to the measured distances
+    */
+    double rangeNoise() const { return rangeNoise_; }
+    void setRangeNoise(double sigma) { rangeNoise_ = sigma; }
+
+    /**
+       The measured distances are rounded to the multiples of this value [m] if it is positive
+    */
+    double rangeQuantizationStep() const { return rangeQuantizationStep_; }
+    void setRangeQuantizationStep(double step) { rangeQuantizationStep_ = step; }
+
+    /**
+       The probability that a measurement fails and no distance is given
+    */
+    double dropoutRate() const { return dropoutRate_; }
+    void setDropoutRate(double rate) { dropoutRate_ = rate; }
+
     typedef std::vector<double> RangeData;
 
     void setRangeDataStateClonable(bool on) { isRangeDataStateClonable_ = on; }
     bool isRangeDataStateClonable() const { return isRangeDataStateClonable_; }
 
+    /**
+       The format of the range data given by the simulator. The data of the other formats are
+       converted from it when they are accessed. The distance of a beam which hits nothing is
+       infinity in the double and float formats, and FixedPointNoReturn in the fixed point format.
+    */
+    enum RangeDataFormat { DOUBLE_RANGE_DATA, FLOAT_RANGE_DATA, FIXED_POINT_RANGE_DATA };
+    RangeDataFormat rangeDataFormat() const { return rangeDataFormat_; }
+    void setRangeDataFormat(RangeDataFormat format) { rangeDataFormat_ = format; }
+
+    //! The distance [m] of the unit of the fixed point format
+    double fixedPointRangeStep() const { return fixedPointRangeStep_; }
+    void setFixedPointRangeStep(double step);
+
+    typedef std::vector<float> FloatRangeData;
+    typedef std::vector<unsigned short> FixedPointRangeData;
+    static const unsigned short FixedPointNoReturn = 0xffff;
+
     /**
        \note You must check if the range data is not empty before accessing the data
     */
-    const RangeData& rangeData() const { return *rangeData_; }
-    const RangeData& constRangeData() const { return *rangeData_; }
+    const RangeData& rangeData() const { return constRangeData(); }
+    const RangeData& constRangeData() const {
+        if(!(validRangeData_ & DOUBLE_VALID)) updateRangeData(DOUBLE_VALID);
+        return *rangeData_;
+    }
     RangeData& rangeData();
     RangeData& newRangeData();
 
-    boost::shared_ptr<RangeData> sharedRangeData() const { return rangeData_; }
+    boost::shared_ptr<RangeData> sharedRangeData() const {
+        constRangeData();
+        return rangeData_;
+    }
+
+    const FloatRangeData& floatRangeData() const {
+        if(!(validRangeData_ & FLOAT_VALID)) updateRangeData(FLOAT_VALID);
+        return *floatRangeData_;
+    }
+    boost::shared_ptr<const FloatRangeData> sharedFloatRangeData() const {
+        floatRangeData();
+        return floatRangeData_;
+    }
+    
+    const FixedPointRangeData& fixedPointRangeData() const {
+        if(!(validRangeData_ & FIXED_POINT_VALID)) updateRangeData(FIXED_POINT_VALID);
+        return *fixedPointRangeData_;
+    }
+    boost::shared_ptr<const FixedPointRangeData> sharedFixedPointRangeData() const {
+        fixedPointRangeData();
+        return fixedPointRangeData_;
+    }
 
     /**
        Move semantics. If the use_count() of the given shared range data pointer is one,
@@ -74,6 +133,8 @@ public:
        Otherwise, the data is copied.
     */
     void setRangeData(boost::shared_ptr<RangeData>& rangeData);
+    void setFloatRangeData(boost::shared_ptr<FloatRangeData>& rangeData);
+    void setFixedPointRangeData(boost::shared_ptr<FixedPointRangeData>& rangeData);
 
     /**
        Time [s] consumed in the measurement
@@ -92,7 +153,20 @@ private:
     double maxDistance_;
     double frameRate_;
     double delay_;
-    boost::shared_ptr<RangeData> rangeData_;
+    double rangeNoise_;
+    double rangeQuantizationStep_;
+    double dropoutRate_;
+    RangeDataFormat rangeDataFormat_;
+    double fixedPointRangeStep_;
+
+    // The data of the formats which have not been accessed since the data was given are not converted.
+    enum { DOUBLE_VALID = 1, FLOAT_VALID = 2, FIXED_POINT_VALID = 4 };
+    mutable int validRangeData_;
+    mutable boost::shared_ptr<RangeData> rangeData_;
+    mutable boost::shared_ptr<FloatRangeData> floatRangeData_;
+    mutable boost::shared_ptr<FixedPointRangeData> fixedPointRangeData_;
+
+    void updateRangeData(int format) const;
 
     RangeSensor(const RangeSensor& org, int x /* dummy */);
     void copyRangeSensorStateFrom(const RangeSensor& other);    
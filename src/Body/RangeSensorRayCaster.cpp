@@ -0,0 +1,162 @@
+/**
+   @author Shin'ichiro Nakaoka
+*/
+
+#include "RangeSensorRayCaster.h"
+#include "Link.h"
+#include <limits>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class RangeSensorRayCasterImpl
+{
+public:
+    CollisionDetectorPtr collisionDetector;
+    vector<Link*> links;
+    PositionArray positions;
+    vector<Vector3> origins;
+    vector<Vector3> directions;
+    vector<double> distances;
+    vector<int> geometryIds;
+
+    RangeSensorRayCasterImpl(CollisionDetectorPtr& collisionDetector);
+    void addBody(Body* body);
+    bool makeReady();
+    void updatePositions();
+    void scan(const RangeSensor& sensor, RangeSensor::RangeData& out_rangeData);
+};
+}
+
+
+RangeSensorRayCaster::RangeSensorRayCaster(CollisionDetectorPtr collisionDetector)
+{
+    impl = new RangeSensorRayCasterImpl(collisionDetector);
+}
+
+
+RangeSensorRayCasterImpl::RangeSensorRayCasterImpl(CollisionDetectorPtr& collisionDetector)
+    : collisionDetector(collisionDetector)
+{
+    collisionDetector->clearGeometries();
+}
+
+
+RangeSensorRayCaster::~RangeSensorRayCaster()
+{
+    delete impl;
+}
+
+
+void RangeSensorRayCaster::addBody(Body* body)
+{
+    impl->addBody(body);
+}
+
+
+void RangeSensorRayCasterImpl::addBody(Body* body)
+{
+    const int n = body->numLinks();
+    for(int i=0; i < n; ++i){
+        Link* link = body->link(i);
+        collisionDetector->addGeometry(link->collisionShape());
+        links.push_back(link);
+    }
+}
+
+
+bool RangeSensorRayCaster::makeReady()
+{
+    return impl->makeReady();
+}
+
+
+bool RangeSensorRayCasterImpl::makeReady()
+{
+    // The ray casting does not use the pairs, so all of them are excluded
+    const int n = links.size();
+    for(int i=0; i < n; ++i){
+        collisionDetector->setGeometryStatic(i);
+    }
+    if(!collisionDetector->makeReady()){
+        return false;
+    }
+    positions.resize(n);
+    
+    origins.clear();
+    directions.clear();
+    return collisionDetector->castRays(origins, directions, 0.0, distances, geometryIds);
+}
+
+
+void RangeSensorRayCaster::updatePositions()
+{
+    impl->updatePositions();
+}
+
+
+void RangeSensorRayCasterImpl::updatePositions()
+{
+    const int n = links.size();
+    for(int i=0; i < n; ++i){
+        positions[i] = links[i]->position();
+    }
+    collisionDetector->updatePositions(0, n, positions);
+}
+
+
+void RangeSensorRayCaster::scan(const RangeSensor& sensor, RangeSensor::RangeData& out_rangeData)
+{
+    impl->scan(sensor, out_rangeData);
+}
+
+
+/**
+   The sensor looks in the -z direction of its local coordinate with the y axis upward as a camera.
+   The rays start at the min distance as the near clip plane of the rendering.
+*/
+void RangeSensorRayCasterImpl::scan(const RangeSensor& sensor, RangeSensor::RangeData& out_rangeData)
+{
+    const double yawRange = sensor.yawRange();
+    const int yawResolution = sensor.yawResolution();
+    const double yawStep = sensor.yawStep();
+    const double pitchRange = sensor.pitchRange();
+    const int pitchResolution = sensor.pitchResolution();
+    const double pitchStep = sensor.pitchStep();
+    const double minDistance = sensor.minDistance();
+    const double maxDistance = sensor.maxDistance();
+
+    const Position T = sensor.link()->position() * sensor.T_local();
+    const Vector3 p = T.translation();
+    const Matrix3 R = T.linear();
+
+    const int n = yawResolution * pitchResolution;
+    origins.resize(n);
+    directions.resize(n);
+    int index = 0;
+    for(int pitch=0; pitch < pitchResolution; ++pitch){
+        const double pitchAngle = pitch * pitchStep - pitchRange / 2.0;
+        const double sinPitchAngle = sin(pitchAngle);
+        const double cosPitchAngle = cos(pitchAngle);
+        for(int yaw=0; yaw < yawResolution; ++yaw){
+            const double yawAngle = yaw * yawStep - yawRange / 2.0;
+            const Vector3 d = R * Vector3(-sin(yawAngle) * cosPitchAngle, sinPitchAngle, -cos(yawAngle) * cosPitchAngle);
+            origins[index] = p + minDistance * d;
+            directions[index] = d;
+            ++index;
+        }
+    }
+
+    collisionDetector->castRays(origins, directions, maxDistance - minDistance, distances, geometryIds);
+
+    out_rangeData.resize(n);
+    for(int i=0; i < n; ++i){
+        if(geometryIds[i] >= 0){
+            out_rangeData[i] = distances[i] + minDistance;
+        } else {
+            out_rangeData[i] = std::numeric_limits<double>::infinity();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/**
+   @author Shin'ichiro Nakaoka
+*/
+
+#ifndef CNOID_BODY_RANGE_SENSOR_RAY_CASTER_H
+#define CNOID_BODY_RANGE_SENSOR_RAY_CASTER_H
+
+#include "Body.h"
+#include "RangeSensor.h"
+#include <cnoid/CollisionDetector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class RangeSensorRayCasterImpl;
+
+/**
+   This class computes the range data of RangeSensor devices by casting a ray for each beam
+   against the collision shapes of the links. The rays are cast by
+   CollisionDetector::castRays(), so the cost is proportional to the number of the beams.
+*/
+class CNOID_EXPORT RangeSensorRayCaster
+{
+public:
+    /**
+       @param collidionDetector A CollisionDetector object which is only used for the RangeSensorRayCaster instance.
+    */
+    RangeSensorRayCaster(CollisionDetectorPtr collisionDetector);
+    ~RangeSensorRayCaster();
+
+    void addBody(Body* body);
+
+    /**
+       @return false if the collision detector does not support the ray casting.
+    */
+    bool makeReady();
+
+    //! The geometry positions are updated with the current link positions of the added bodies.
+    void updatePositions();
+
+    /**
+       The range data is stored in the same order as that of GLVisionSimulatorItem, i.e. the yaw
+       angle changes faster than the pitch angle. A beam which does not hit anything between the
+       min distance and the max distance of the sensor gives infinity.
+    */
+    void scan(const RangeSensor& sensor, RangeSensor::RangeData& out_rangeData);
+        
+private:
+    RangeSensorRayCasterImpl* impl;
+};
+
+typedef boost::shared_ptr<RangeSensorRayCaster> RangeSensorRayCasterPtr;
+}
+
+#endif
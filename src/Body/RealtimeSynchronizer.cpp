@@ -0,0 +1,371 @@
+/**
+   @file
+*/
+
+#include "RealtimeSynchronizer.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+typedef boost::int64_t nsec_t;
+
+nsec_t getCurrentNanoTime()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    static bool isFrequencyInitialized = false;
+    if(!isFrequencyInitialized){
+        QueryPerformanceFrequency(&frequency);
+        isFrequencyInitialized = true;
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (nsec_t)((double)counter.QuadPart / frequency.QuadPart * 1.0e9);
+#else
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (nsec_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+#endif
+}
+
+
+void sleepUntil(nsec_t time)
+{
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = time / 1000000000;
+    ts.tv_nsec = time % 1000000000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR) { }
+#else
+    const nsec_t duration = time - getCurrentNanoTime();
+    if(duration > 0){
+#ifdef _WIN32
+        ::Sleep((DWORD)(duration / 1000000));
+#else
+        struct timespec ts;
+        ts.tv_sec = duration / 1000000000;
+        ts.tv_nsec = duration % 1000000000;
+        nanosleep(&ts, 0);
+#endif
+    }
+#endif
+}
+
+}
+
+namespace cnoid {
+
+class RealtimeSynchronizerImpl
+{
+public:
+    nsec_t timeStep;
+    nsec_t spinTime;
+    nsec_t maxDelay;
+    nsec_t deadline;
+    int threadPriority;
+    int cpuAffinity;
+
+    mutable boost::mutex statisticsMutex;
+    double binWidth;
+    vector<int> histogram;
+    int numSteps;
+    int numOverruns;
+    double totalLateness;
+    double maxLateness;
+
+    RealtimeSynchronizerImpl();
+    void clearStatistics();
+    void record(nsec_t lateness, bool isOverrun);
+};
+
+}
+
+
+RealtimeSynchronizer::RealtimeSynchronizer()
+{
+    impl = new RealtimeSynchronizerImpl();
+}
+
+
+RealtimeSynchronizerImpl::RealtimeSynchronizerImpl()
+{
+    timeStep = 1000000;
+    spinTime = 0;
+    maxDelay = 100000000;
+    deadline = 0;
+    threadPriority = 0;
+    cpuAffinity = -1;
+    binWidth = 1.0e-5;
+    histogram.resize(100);
+    clearStatistics();
+}
+
+
+RealtimeSynchronizer::~RealtimeSynchronizer()
+{
+    delete impl;
+}
+
+
+double RealtimeSynchronizer::currentTime()
+{
+    return getCurrentNanoTime() * 1.0e-9;
+}
+
+
+void RealtimeSynchronizer::setTimeStep(double timeStep)
+{
+    impl->timeStep = std::max((nsec_t)1, (nsec_t)(timeStep * 1.0e9 + 0.5));
+}
+
+
+double RealtimeSynchronizer::timeStep() const
+{
+    return impl->timeStep * 1.0e-9;
+}
+
+
+void RealtimeSynchronizer::setSpinTime(double time)
+{
+    impl->spinTime = std::max((nsec_t)0, (nsec_t)(time * 1.0e9 + 0.5));
+}
+
+
+double RealtimeSynchronizer::spinTime() const
+{
+    return impl->spinTime * 1.0e-9;
+}
+
+
+void RealtimeSynchronizer::setMaxDelay(double time)
+{
+    impl->maxDelay = std::max((nsec_t)0, (nsec_t)(time * 1.0e9 + 0.5));
+}
+
+
+double RealtimeSynchronizer::maxDelay() const
+{
+    return impl->maxDelay * 1.0e-9;
+}
+
+
+void RealtimeSynchronizer::setThreadPriority(int priority)
+{
+    impl->threadPriority = priority;
+}
+
+
+int RealtimeSynchronizer::threadPriority() const
+{
+    return impl->threadPriority;
+}
+
+
+void RealtimeSynchronizer::setCpuAffinity(int cpu)
+{
+    impl->cpuAffinity = cpu;
+}
+
+
+int RealtimeSynchronizer::cpuAffinity() const
+{
+    return impl->cpuAffinity;
+}
+
+
+bool RealtimeSynchronizer::applyThreadSettings()
+{
+    bool result = true;
+    const int priority = impl->threadPriority;
+    const int cpu = impl->cpuAffinity;
+
+#if defined(__linux__)
+    if(priority != 0){
+        struct sched_param param;
+        param.sched_priority = priority;
+        if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0){
+            result = false;
+        }
+    }
+    if(cpu >= 0){
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0){
+            result = false;
+        }
+    }
+#elif defined(_WIN32)
+    if(priority != 0){
+        if(!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)){
+            result = false;
+        }
+    }
+    if(cpu >= 0){
+        if(cpu >= (int)(sizeof(DWORD_PTR) * 8) ||
+           !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu)){
+            result = false;
+        }
+    }
+#else
+    if(priority != 0 || cpu >= 0){
+        result = false;
+    }
+#endif
+
+    return result;
+}
+
+
+void RealtimeSynchronizer::start()
+{
+    impl->deadline = getCurrentNanoTime() + impl->timeStep;
+}
+
+
+void RealtimeSynchronizer::waitForNextStep()
+{
+    const nsec_t deadline = impl->deadline;
+    nsec_t time = getCurrentNanoTime();
+    const bool isOverrun = (time > deadline);
+
+    if(!isOverrun){
+        const nsec_t wakeUpTime = deadline - impl->spinTime;
+        if(time < wakeUpTime){
+            sleepUntil(wakeUpTime);
+        }
+        do {
+            time = getCurrentNanoTime();
+        } while(time < deadline);
+    }
+
+    const nsec_t lateness = time - deadline;
+    if(lateness > impl->maxDelay){
+        impl->deadline = time + impl->timeStep;
+    } else {
+        impl->deadline = deadline + impl->timeStep;
+    }
+
+    impl->record(lateness, isOverrun);
+}
+
+
+void RealtimeSynchronizerImpl::record(nsec_t lateness, bool isOverrun)
+{
+    const double t = lateness * 1.0e-9;
+    const int numBins = histogram.size();
+    const int bin = std::min(numBins - 1, (int)(t / binWidth));
+
+    boost::mutex::scoped_lock lock(statisticsMutex);
+    ++histogram[bin];
+    ++numSteps;
+    if(isOverrun){
+        ++numOverruns;
+    }
+    totalLateness += t;
+    if(t > maxLateness){
+        maxLateness = t;
+    }
+}
+
+
+void RealtimeSynchronizer::setHistogramBins(double binWidth, int numBins)
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    impl->binWidth = (binWidth > 0.0) ? binWidth : 1.0e-5;
+    impl->histogram.resize(std::max(1, numBins));
+    impl->clearStatistics();
+}
+
+
+double RealtimeSynchronizer::histogramBinWidth() const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    return impl->binWidth;
+}
+
+
+void RealtimeSynchronizer::getLatenessHistogram(std::vector<int>& out_counts) const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    out_counts = impl->histogram;
+}
+
+
+void RealtimeSynchronizer::clearStatistics()
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    impl->clearStatistics();
+}
+
+
+void RealtimeSynchronizerImpl::clearStatistics()
+{
+    std::fill(histogram.begin(), histogram.end(), 0);
+    numSteps = 0;
+    numOverruns = 0;
+    totalLateness = 0.0;
+    maxLateness = 0.0;
+}
+
+
+int RealtimeSynchronizer::numSteps() const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    return impl->numSteps;
+}
+
+
+int RealtimeSynchronizer::numOverruns() const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    return impl->numOverruns;
+}
+
+
+double RealtimeSynchronizer::meanLateness() const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    return (impl->numSteps > 0) ? (impl->totalLateness / impl->numSteps) : 0.0;
+}
+
+
+double RealtimeSynchronizer::maxLateness() const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+    return impl->maxLateness;
+}
+
+
+double RealtimeSynchronizer::latenessPercentile(double ratio) const
+{
+    boost::mutex::scoped_lock lock(impl->statisticsMutex);
+
+    if(impl->numSteps == 0){
+        return 0.0;
+    }
+    const double n = std::max(0.0, std::min(1.0, ratio)) * impl->numSteps;
+    const int numBins = impl->histogram.size();
+    int count = 0;
+    for(int i=0; i < numBins - 1; ++i){
+        count += impl->histogram[i];
+        if(count >= n){
+            return std::min((i + 1) * impl->binWidth, impl->maxLateness);
+        }
+    }
+    return impl->maxLateness;
+}
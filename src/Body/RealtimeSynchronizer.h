@@ -0,0 +1,108 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_REALTIME_SYNCHRONIZER_H
+#define CNOID_BODY_REALTIME_SYNCHRONIZER_H
+
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class RealtimeSynchronizerImpl;
+
+/**
+   This class paces the steps of a simulation to the real time.
+   The deadline of each step is an absolute time on the monotonic clock, so the errors of
+   the sleeps do not accumulate. The thread sleeps until the deadline minus the spin time,
+   and then it spins until the deadline to avoid the wake-up latency of the OS.
+   When a step is finished after its deadline, the following steps are executed without sleeping
+   until the delay is recovered. When the delay exceeds the maximum delay, the deadlines are
+   moved so that the simulation does not try to catch up with the time which has been lost.
+
+   The lateness of each step, which is the time from the deadline to the time when the next step
+   is started, is recorded in a histogram. The statistics can be read from any thread.
+*/
+class CNOID_EXPORT RealtimeSynchronizer
+{
+public:
+    RealtimeSynchronizer();
+    ~RealtimeSynchronizer();
+
+    void setTimeStep(double timeStep);
+    double timeStep() const;
+
+    //! The default time is zero, which means the thread does not spin
+    void setSpinTime(double time);
+    double spinTime() const;
+
+    //! The default time is 0.1 [s]
+    void setMaxDelay(double time);
+    double maxDelay() const;
+
+    /**
+       The priority of the real-time scheduling policy which is applied by applyThreadSettings().
+       Zero means the scheduling of the thread is not changed.
+    */
+    void setThreadPriority(int priority);
+    int threadPriority() const;
+
+    /**
+       The CPU to which the thread is bound by applyThreadSettings().
+       A negative value means the affinity of the thread is not changed.
+    */
+    void setCpuAffinity(int cpu);
+    int cpuAffinity() const;
+
+    /**
+       Applies the priority and the CPU affinity to the calling thread.
+       @return false if a setting cannot be applied
+    */
+    bool applyThreadSettings();
+
+    /**
+       Sets the deadline of the next step to the current time plus the time step.
+       This must also be called when the simulation is resumed after a pause.
+    */
+    void start();
+
+    //! Waits for the deadline of the current step and advances the deadline
+    void waitForNextStep();
+
+    void setHistogramBins(double binWidth, int numBins);
+    double histogramBinWidth() const;
+
+    /**
+       The last bin also counts the steps whose lateness exceeds the range of the histogram.
+    */
+    void getLatenessHistogram(std::vector<int>& out_counts) const;
+
+    void clearStatistics();
+    int numSteps() const;
+
+    //! The number of the steps which have been finished after their deadlines
+    int numOverruns() const;
+    double meanLateness() const;
+    double maxLateness() const;
+
+    /**
+       @param ratio The ratio of the steps in [0, 1]
+       @return The lateness below which the given ratio of the steps are.
+       The value is estimated from the histogram.
+    */
+    double latenessPercentile(double ratio) const;
+
+    //! The time of the monotonic clock in seconds
+    static double currentTime();
+
+private:
+    RealtimeSynchronizerImpl* impl;
+
+    RealtimeSynchronizer(const RealtimeSynchronizer& org);
+    RealtimeSynchronizer& operator=(const RealtimeSynchronizer& rhs);
+};
+
+}
+
+#endif
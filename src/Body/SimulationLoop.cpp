@@ -0,0 +1,305 @@
+/**
+   @file
+*/
+
+#include "SimulationLoop.h"
+#include "SimulationProfiler.h"
+#include <cnoid/TimeMeasure>
+#include <limits>
+#include <cmath>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class SimulationLoopImpl
+{
+public:
+    double timeStep;
+    double timeLength;
+    int currentFrame;
+    int maxFrame;
+    volatile bool isStopRequested;
+    bool doCheckContinue;
+    double actualSimulationTime;
+    int idCounter;
+
+    ConcurrentFunctionSet preDynamicsFunctions;
+    ConcurrentFunctionSet midDynamicsFunctions;
+    ConcurrentFunctionSet postDynamicsFunctions;
+    SimulationLoop::ControlFunction controlFunction;
+    SimulationLoop::ControlFunction dynamicsFunction;
+
+    SimulationProfiler* profiler;
+    enum { PRE_DYNAMICS_STAGE, CONTROL_STAGE, MID_DYNAMICS_STAGE, DYNAMICS_STAGE, POST_DYNAMICS_STAGE, NUM_STAGES };
+    int stageIds[NUM_STAGES];
+
+    SimulationLoopImpl();
+    int addFunction(ConcurrentFunctionSet& functions, SimulationLoop::Function& func,
+                    const FunctionDependency* dependency);
+    bool step();
+    int run();
+};
+
+}
+
+
+SimulationLoop::SimulationLoop()
+{
+    impl = new SimulationLoopImpl();
+}
+
+
+SimulationLoopImpl::SimulationLoopImpl()
+{
+    timeStep = 0.001;
+    timeLength = -1.0;
+    currentFrame = 0;
+    isStopRequested = false;
+    doCheckContinue = false;
+    actualSimulationTime = 0.0;
+    idCounter = 0;
+    profiler = 0;
+}
+
+
+SimulationLoop::~SimulationLoop()
+{
+    delete impl;
+}
+
+
+void SimulationLoop::setTimeStep(double step)
+{
+    impl->timeStep = step;
+}
+
+
+double SimulationLoop::timeStep() const
+{
+    return impl->timeStep;
+}
+
+
+void SimulationLoop::setTimeLength(double length)
+{
+    impl->timeLength = length;
+}
+
+
+int SimulationLoopImpl::addFunction
+(ConcurrentFunctionSet& functions, SimulationLoop::Function& func, const FunctionDependency* dependency)
+{
+    const int id = idCounter++;
+    if(dependency){
+        functions.add(id, func, *dependency);
+    } else {
+        functions.add(id, func);
+    }
+    return id;
+}
+
+
+int SimulationLoop::addPreDynamicsFunction(Function func)
+{
+    return impl->addFunction(impl->preDynamicsFunctions, func, 0);
+}
+
+
+int SimulationLoop::addPreDynamicsFunction(Function func, const FunctionDependency& dependency)
+{
+    return impl->addFunction(impl->preDynamicsFunctions, func, &dependency);
+}
+
+
+int SimulationLoop::addMidDynamicsFunction(Function func)
+{
+    return impl->addFunction(impl->midDynamicsFunctions, func, 0);
+}
+
+
+int SimulationLoop::addMidDynamicsFunction(Function func, const FunctionDependency& dependency)
+{
+    return impl->addFunction(impl->midDynamicsFunctions, func, &dependency);
+}
+
+
+int SimulationLoop::addPostDynamicsFunction(Function func)
+{
+    return impl->addFunction(impl->postDynamicsFunctions, func, 0);
+}
+
+
+int SimulationLoop::addPostDynamicsFunction(Function func, const FunctionDependency& dependency)
+{
+    return impl->addFunction(impl->postDynamicsFunctions, func, &dependency);
+}
+
+
+void SimulationLoop::removeFunction(int id)
+{
+    if(!impl->preDynamicsFunctions.remove(id)){
+        if(!impl->midDynamicsFunctions.remove(id)){
+            impl->postDynamicsFunctions.remove(id);
+        }
+    }
+}
+
+
+void SimulationLoop::clearFunctions()
+{
+    impl->preDynamicsFunctions.clear();
+    impl->midDynamicsFunctions.clear();
+    impl->postDynamicsFunctions.clear();
+}
+
+
+void SimulationLoop::setControlFunction(ControlFunction func)
+{
+    impl->controlFunction = func;
+}
+
+
+void SimulationLoop::setControlContinuationCheck(bool on)
+{
+    impl->doCheckContinue = on;
+}
+
+
+void SimulationLoop::setDynamicsFunction(ControlFunction func)
+{
+    impl->dynamicsFunction = func;
+}
+
+
+void SimulationLoop::setProfiler(SimulationProfiler* profiler)
+{
+    impl->profiler = profiler;
+    if(profiler){
+        impl->stageIds[SimulationLoopImpl::PRE_DYNAMICS_STAGE] = profiler->registerStage("Pre-dynamics functions");
+        impl->stageIds[SimulationLoopImpl::CONTROL_STAGE] = profiler->registerStage("Controller control");
+        impl->stageIds[SimulationLoopImpl::MID_DYNAMICS_STAGE] = profiler->registerStage("Mid-dynamics functions");
+        impl->stageIds[SimulationLoopImpl::DYNAMICS_STAGE] = profiler->registerStage("Dynamics");
+        impl->stageIds[SimulationLoopImpl::POST_DYNAMICS_STAGE] = profiler->registerStage("Post-dynamics functions");
+    }
+}
+
+
+SimulationProfiler* SimulationLoop::profiler() const
+{
+    return impl->profiler;
+}
+
+
+bool SimulationLoop::step()
+{
+    return impl->step();
+}
+
+
+bool SimulationLoopImpl::step()
+{
+    ++currentFrame;
+
+    if(profiler){
+        profiler->beginFrame(currentFrame);
+    }
+
+    bool doContinue = !doCheckContinue;
+
+    {
+        SimulationProfiler::Scope scope(profiler, stageIds[PRE_DYNAMICS_STAGE]);
+        preDynamicsFunctions.call();
+    }
+
+    if(controlFunction){
+        SimulationProfiler::Scope scope(profiler, stageIds[CONTROL_STAGE]);
+        doContinue |= controlFunction();
+    }
+
+    {
+        SimulationProfiler::Scope scope(profiler, stageIds[MID_DYNAMICS_STAGE]);
+        midDynamicsFunctions.call();
+    }
+
+    if(dynamicsFunction){
+        SimulationProfiler::Scope scope(profiler, stageIds[DYNAMICS_STAGE]);
+        if(!dynamicsFunction()){
+            doContinue = false;
+        }
+    }
+
+    {
+        SimulationProfiler::Scope scope(profiler, stageIds[POST_DYNAMICS_STAGE]);
+        postDynamicsFunctions.call();
+    }
+
+    if(profiler){
+        profiler->endFrame();
+    }
+
+    return doContinue;
+}
+
+
+int SimulationLoop::run()
+{
+    return impl->run();
+}
+
+
+int SimulationLoopImpl::run()
+{
+    currentFrame = 0;
+    isStopRequested = false;
+
+    if(timeLength >= 0.0){
+        maxFrame = static_cast<int>(floor(timeLength / timeStep + 0.5));
+    } else {
+        maxFrame = std::numeric_limits<int>::max();
+    }
+
+    TimeMeasure timer;
+    timer.begin();
+
+    while(currentFrame < maxFrame && !isStopRequested){
+        if(!step()){
+            break;
+        }
+    }
+
+    actualSimulationTime = timer.measure();
+
+    return currentFrame;
+}
+
+
+void SimulationLoop::requestStop()
+{
+    impl->isStopRequested = true;
+}
+
+
+bool SimulationLoop::isStopRequested() const
+{
+    return impl->isStopRequested;
+}
+
+
+int SimulationLoop::currentFrame() const
+{
+    return impl->currentFrame;
+}
+
+
+double SimulationLoop::currentTime() const
+{
+    return impl->currentFrame * impl->timeStep;
+}
+
+
+double SimulationLoop::actualSimulationTime() const
+{
+    return impl->actualSimulationTime;
+}
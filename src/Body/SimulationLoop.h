@@ -0,0 +1,107 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_SIMULATION_LOOP_H
+#define CNOID_BODY_SIMULATION_LOOP_H
+
+#include <cnoid/ConcurrentFunctionSet>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SimulationLoopImpl;
+class SimulationProfiler;
+
+/**
+   This class executes the steps of a simulation in the same order as SimulatorItem does,
+   that is, the pre-dynamics functions, the control function, the mid-dynamics functions,
+   the dynamics function and the post-dynamics functions.
+   The class does not depend on the GUI and can be used in the programs without it.
+*/
+class CNOID_EXPORT SimulationLoop
+{
+public:
+    SimulationLoop();
+    ~SimulationLoop();
+
+    void setTimeStep(double step);
+    double timeStep() const;
+
+    /**
+       The loop is finished when the time reaches this length.
+       A negative value means the loop continues until the stop is requested.
+    */
+    void setTimeLength(double length);
+
+    typedef boost::function<void()> Function;
+
+    /**
+       The control function returns true if the simulation should be continued.
+    */
+    typedef boost::function<bool()> ControlFunction;
+
+    int addPreDynamicsFunction(Function func);
+    int addMidDynamicsFunction(Function func);
+    int addPostDynamicsFunction(Function func);
+
+    /**
+       The functions added with their dependencies may be executed concurrently with the other
+       functions of the same group. See ConcurrentFunctionSet for the details.
+    */
+    int addPreDynamicsFunction(Function func, const FunctionDependency& dependency);
+    int addMidDynamicsFunction(Function func, const FunctionDependency& dependency);
+    int addPostDynamicsFunction(Function func, const FunctionDependency& dependency);
+
+    void removeFunction(int id);
+    void clearFunctions();
+
+    void setControlFunction(ControlFunction func);
+
+    /**
+       If this is enabled, the loop is finished when the control function returns false.
+    */
+    void setControlContinuationCheck(bool on);
+
+    /**
+       The dynamics function returns false if the dynamics computation fails.
+    */
+    void setDynamicsFunction(ControlFunction func);
+
+    /**
+       The profiler records the durations of the steps and the function groups in them.
+       Null disables the profiling.
+    */
+    void setProfiler(SimulationProfiler* profiler);
+    SimulationProfiler* profiler() const;
+
+    /**
+       Execute one step of the simulation.
+       @return false if the loop should be finished
+    */
+    bool step();
+
+    /**
+       Execute the steps until the time length or the stop request.
+       @return the number of the executed steps
+    */
+    int run();
+
+    void requestStop();
+    bool isStopRequested() const;
+
+    int currentFrame() const;
+    double currentTime() const;
+
+    /**
+       The wall-clock time taken by the last call of run() in seconds.
+    */
+    double actualSimulationTime() const;
+
+private:
+    SimulationLoopImpl* impl;
+};
+
+}
+
+#endif
@@ -0,0 +1,410 @@
+/**
+   @file
+*/
+
+#include "SimulationProfiler.h"
+#include <boost/thread.hpp>
+#include <boost/algorithm/string.hpp>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+struct Event
+{
+    int stageId;
+    int frame;
+    int threadIndex;
+    double beginTime;
+    double duration;
+};
+
+string escapeJsonString(const string& s)
+{
+    string escaped;
+    escaped.reserve(s.size());
+    for(size_t i=0; i < s.size(); ++i){
+        const char c = s[i];
+        if(c == '"' || c == '\\'){
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+}
+
+namespace cnoid {
+
+class SimulationProfilerImpl
+{
+public:
+    mutable boost::mutex mutex;
+    vector<string> stageNames;
+    vector<const char*> profilerScopeNames;
+    map<string, int> stageNameToIdMap;
+    vector<Event> events;
+    size_t maxNumEvents;
+    size_t headIndex;
+    vector<boost::thread::id> threadIds;
+    int currentFrame;
+    double frameBeginTime;
+    double originTime;
+
+    SimulationProfilerImpl();
+    void clear();
+    int registerStage(const string& name);
+    void record(int stageId, double beginTime, double endTime);
+    const Event& event(size_t index) const {
+        return events[(headIndex + index) % events.size()];
+    }
+    void getFrameTimes(map<int, vector<double> >& out_frameTimes) const;
+};
+
+}
+
+
+SimulationProfiler::SimulationProfiler()
+{
+    impl = new SimulationProfilerImpl();
+    isEnabled_ = false;
+}
+
+
+SimulationProfilerImpl::SimulationProfilerImpl()
+{
+    maxNumEvents = 1000000;
+    registerStage("Step");
+    clear();
+}
+
+
+SimulationProfiler::~SimulationProfiler()
+{
+    delete impl;
+}
+
+
+double SimulationProfiler::currentTime()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    static bool isFrequencyInitialized = false;
+    if(!isFrequencyInitialized){
+        QueryPerformanceFrequency(&frequency);
+        isFrequencyInitialized = true;
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 199309L
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + (double)tp.tv_nsec * 1.0e-9;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + (double)tv.tv_usec * 1.0e-6;
+#endif
+}
+
+
+void SimulationProfiler::setEnabled(bool on)
+{
+    isEnabled_ = on;
+}
+
+
+void SimulationProfiler::setMaxNumEvents(int n)
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    impl->maxNumEvents = std::max(1, n);
+    impl->clear();
+}
+
+
+int SimulationProfiler::registerStage(const std::string& name)
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    return impl->registerStage(name);
+}
+
+
+int SimulationProfilerImpl::registerStage(const string& name)
+{
+    map<string, int>::iterator p = stageNameToIdMap.find(name);
+    if(p != stageNameToIdMap.end()){
+        return p->second;
+    }
+    int id = stageNames.size();
+    stageNames.push_back(name);
+    profilerScopeNames.push_back(Profiler::internName(name));
+    stageNameToIdMap[name] = id;
+    return id;
+}
+
+
+int SimulationProfiler::numStages() const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    return impl->stageNames.size();
+}
+
+
+const std::string& SimulationProfiler::stageName(int stageId) const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    return impl->stageNames[stageId];
+}
+
+
+const char* SimulationProfiler::profilerScopeName(int stageId) const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    return impl->profilerScopeNames[stageId];
+}
+
+
+void SimulationProfiler::clear()
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    impl->clear();
+}
+
+
+void SimulationProfilerImpl::clear()
+{
+    events.clear();
+    headIndex = 0;
+    threadIds.clear();
+    currentFrame = 0;
+    frameBeginTime = 0.0;
+    originTime = SimulationProfiler::currentTime();
+}
+
+
+void SimulationProfiler::beginFrame_(int frame)
+{
+    double time = currentTime();
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    impl->currentFrame = frame;
+    impl->frameBeginTime = time;
+}
+
+
+void SimulationProfiler::endFrame_()
+{
+    double time = currentTime();
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    impl->record(0, impl->frameBeginTime, time);
+}
+
+
+void SimulationProfiler::record(int stageId, double beginTime)
+{
+    double time = currentTime();
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    impl->record(stageId, beginTime, time);
+}
+
+
+void SimulationProfilerImpl::record(int stageId, double beginTime, double endTime)
+{
+    Event event;
+    event.stageId = stageId;
+    event.frame = currentFrame;
+    event.beginTime = beginTime;
+    event.duration = endTime - beginTime;
+
+    const boost::thread::id threadId = boost::this_thread::get_id();
+    event.threadIndex = std::find(threadIds.begin(), threadIds.end(), threadId) - threadIds.begin();
+    if(event.threadIndex == (int)threadIds.size()){
+        threadIds.push_back(threadId);
+    }
+
+    if(events.size() < maxNumEvents){
+        events.push_back(event);
+    } else {
+        events[headIndex] = event;
+        headIndex = (headIndex + 1) % events.size();
+    }
+}
+
+
+int SimulationProfiler::numEvents() const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    return impl->events.size();
+}
+
+
+void SimulationProfilerImpl::getFrameTimes(map<int, vector<double> >& out_frameTimes) const
+{
+    out_frameTimes.clear();
+    const int numStages = stageNames.size();
+    for(size_t i=0; i < events.size(); ++i){
+        const Event& e = event(i);
+        vector<double>& times = out_frameTimes[e.frame];
+        if(times.empty()){
+            times.resize(numStages, 0.0);
+        }
+        times[e.stageId] += e.duration;
+    }
+}
+
+
+int SimulationProfiler::numFrames() const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    map<int, vector<double> > frameTimes;
+    impl->getFrameTimes(frameTimes);
+    return frameTimes.size();
+}
+
+
+double SimulationProfiler::averageTime(int stageId) const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    map<int, vector<double> > frameTimes;
+    impl->getFrameTimes(frameTimes);
+    if(frameTimes.empty()){
+        return 0.0;
+    }
+    double total = 0.0;
+    for(map<int, vector<double> >::iterator p = frameTimes.begin(); p != frameTimes.end(); ++p){
+        total += p->second[stageId];
+    }
+    return total / frameTimes.size();
+}
+
+
+double SimulationProfiler::maxTime(int stageId) const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    map<int, vector<double> > frameTimes;
+    impl->getFrameTimes(frameTimes);
+    double maxTime = 0.0;
+    for(map<int, vector<double> >::iterator p = frameTimes.begin(); p != frameTimes.end(); ++p){
+        maxTime = std::max(maxTime, p->second[stageId]);
+    }
+    return maxTime;
+}
+
+
+double SimulationProfiler::percentileTime(int stageId, double ratio) const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    map<int, vector<double> > frameTimes;
+    impl->getFrameTimes(frameTimes);
+    if(frameTimes.empty()){
+        return 0.0;
+    }
+    vector<double> times;
+    times.reserve(frameTimes.size());
+    for(map<int, vector<double> >::iterator p = frameTimes.begin(); p != frameTimes.end(); ++p){
+        times.push_back(p->second[stageId]);
+    }
+    ratio = std::max(0.0, std::min(ratio, 1.0));
+    const size_t index = std::min(times.size() - 1, (size_t)(ratio * (times.size() - 1) + 0.5));
+    std::nth_element(times.begin(), times.begin() + index, times.end());
+    return times[index];
+}
+
+
+void SimulationProfiler::getEventDurations(int stageId, std::vector<double>& out_durations) const
+{
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+    out_durations.clear();
+    for(size_t i=0; i < impl->events.size(); ++i){
+        const Event& e = impl->event(i);
+        if(e.stageId == stageId){
+            out_durations.push_back(e.duration);
+        }
+    }
+}
+
+
+bool SimulationProfiler::exportChromeTrace(const std::string& filename) const
+{
+    ofstream ofs(filename.c_str());
+    if(!ofs){
+        return false;
+    }
+
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+
+    ofs.precision(15);
+    ofs << "{\"traceEvents\":[\n";
+    for(size_t i=0; i < impl->events.size(); ++i){
+        const Event& e = impl->event(i);
+        if(i > 0){
+            ofs << ",\n";
+        }
+        ofs << "{\"name\":\"" << escapeJsonString(impl->stageNames[e.stageId]) << "\""
+            << ",\"cat\":\"simulation\",\"ph\":\"X\""
+            << ",\"ts\":" << (e.beginTime - impl->originTime) * 1.0e6
+            << ",\"dur\":" << e.duration * 1.0e6
+            << ",\"pid\":1,\"tid\":" << e.threadIndex
+            << ",\"args\":{\"frame\":" << e.frame << "}}";
+    }
+    ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return ofs.good();
+}
+
+
+/**
+   Each row contains the total durations of the stages in a frame in milliseconds.
+   Note that the time of a nested stage is also included in the stages containing it.
+*/
+bool SimulationProfiler::exportCSV(const std::string& filename) const
+{
+    ofstream ofs(filename.c_str());
+    if(!ofs){
+        return false;
+    }
+
+    boost::unique_lock<boost::mutex> lock(impl->mutex);
+
+    const vector<string>& names = impl->stageNames;
+    ofs << "frame";
+    for(size_t i=0; i < names.size(); ++i){
+        ofs << ",\"" << names[i] << "\"";
+    }
+    ofs << "\n";
+
+    map<int, vector<double> > frameTimes;
+    impl->getFrameTimes(frameTimes);
+    for(map<int, vector<double> >::iterator p = frameTimes.begin(); p != frameTimes.end(); ++p){
+        ofs << p->first;
+        const vector<double>& times = p->second;
+        for(size_t i=0; i < times.size(); ++i){
+            ofs << "," << times[i] * 1.0e3;
+        }
+        ofs << "\n";
+    }
+
+    return ofs.good();
+}
+
+
+bool SimulationProfiler::exportFile(const std::string& filename) const
+{
+    if(boost::iends_with(filename, ".csv")){
+        return exportCSV(filename);
+    }
+    return exportChromeTrace(filename);
+}
@@ -0,0 +1,155 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_SIMULATION_PROFILER_H
+#define CNOID_BODY_SIMULATION_PROFILER_H
+
+#include <string>
+#include <vector>
+#include <cnoid/Profiler>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SimulationProfilerImpl;
+
+/**
+   This class records the durations of the stages of the simulation steps.
+   The stages are registered by name, and each call of begin() / end() records an event
+   with the frame, the thread and the time span. The events are kept in a ring buffer so that
+   the profiler can be left enabled in long simulations, and they can be exported as
+   a Chrome trace (chrome://tracing) or as a CSV file which has a row for each frame.
+
+   When the profiler is disabled, begin() and end() only check a flag.
+   The functions can be called from multiple threads.
+
+   The stages measured by Scope objects are also recorded as the scopes of Profiler
+   when it is enabled.
+*/
+class CNOID_EXPORT SimulationProfiler
+{
+public:
+    SimulationProfiler();
+    ~SimulationProfiler();
+
+    void setEnabled(bool on);
+    bool isEnabled() const { return isEnabled_; }
+
+    /**
+       The oldest events are discarded when the number of the events exceeds this value.
+    */
+    void setMaxNumEvents(int n);
+
+    /**
+       @return the ID of the stage. The same ID is returned for the same name.
+    */
+    int registerStage(const std::string& name);
+    int numStages() const;
+    const std::string& stageName(int stageId) const;
+
+    //! The name of the stage given to the scope of Profiler
+    const char* profilerScopeName(int stageId) const;
+
+    void clear();
+
+    /**
+       The events recorded until the next call are associated with the frame.
+       The duration of the whole step is also recorded as the "Step" stage.
+    */
+    void beginFrame(int frame) {
+        if(isEnabled_){
+            beginFrame_(frame);
+        }
+    }
+    void endFrame() {
+        if(isEnabled_){
+            endFrame_();
+        }
+    }
+
+    /**
+       @return the time stamp which must be given to end()
+    */
+    double begin() const {
+        return isEnabled_ ? currentTime() : 0.0;
+    }
+    void end(int stageId, double beginTime) {
+        if(isEnabled_){
+            record(stageId, beginTime);
+        }
+    }
+
+    class Scope
+    {
+    public:
+        Scope(SimulationProfiler* profiler, int stageId)
+            : profilerScope((Profiler::isEnabled() && profiler) ? profiler->profilerScopeName(stageId) : 0),
+              profiler(profiler), stageId(stageId) {
+            if(profiler){
+                beginTime = profiler->begin();
+            }
+        }
+        ~Scope() {
+            if(profiler){
+                profiler->end(stageId, beginTime);
+            }
+        }
+    private:
+        Profiler::Scope profilerScope;
+        SimulationProfiler* profiler;
+        int stageId;
+        double beginTime;
+    };
+
+    int numEvents() const;
+    int numFrames() const;
+
+    /**
+       @return the average duration of the stage per frame in seconds
+    */
+    double averageTime(int stageId) const;
+
+    /**
+       @return the maximum duration of the stage in a frame in seconds
+    */
+    double maxTime(int stageId) const;
+
+    /**
+       @return the duration of the stage in a frame which is not exceeded by the given ratio
+       of the frames. For example, the ratio 0.99 gives the 99th percentile in seconds.
+    */
+    double percentileTime(int stageId, double ratio) const;
+
+    /**
+       Get the durations of the recorded events of the stage in seconds. This is useful for
+       the stages which are not executed in every frame such as the rendering of the sensors.
+    */
+    void getEventDurations(int stageId, std::vector<double>& out_durations) const;
+
+    bool exportChromeTrace(const std::string& filename) const;
+    bool exportCSV(const std::string& filename) const;
+
+    /**
+       The format is selected by the extension of the file name.
+       ".csv" means CSV and the others mean Chrome trace.
+    */
+    bool exportFile(const std::string& filename) const;
+
+    static double currentTime();
+
+private:
+    SimulationProfilerImpl* impl;
+    volatile bool isEnabled_;
+
+    void beginFrame_(int frame);
+    void endFrame_();
+    void record(int stageId, double beginTime);
+
+    SimulationProfiler(const SimulationProfiler& org);
+    SimulationProfiler& operator=(const SimulationProfiler& rhs);
+};
+
+}
+
+#endif
@@ -378,6 +378,13 @@ VRMLNodePtr VRMLBodyLoader::getOriginalNode(Link* link)
 }
 
 
+bool VRMLBodyLoader::getSourceFiles(std::vector<std::string>& out_filenames) const
+{
+    out_filenames = impl->vrmlParser.sourceFiles();
+    return true;
+}
+
+
 VRMLNodePtr VRMLBodyLoaderImpl::getOriginalNode(Link* link)
 {
     LinkOriginalMap::iterator it;
@@ -454,6 +461,8 @@ void VRMLBodyLoaderImpl::readTopNodes()
                 if(humanoidNodeLoaded){
                     throw invalid_argument(_("Humanoid nodes more than one are defined."));
                 }
+                sgConverter.preloadAnotherFormatFiles(instance);
+                sgConverter.preloadTextureImages(instance);
                 readHumanoidNode(instance);
                 humanoidNodeLoaded = true;
                 continue;
@@ -474,6 +483,8 @@ void VRMLBodyLoaderImpl::readTopNodes()
     if(humanoidNodeLoaded){
         setExtraJoints();
     } else if(!nonHumanoidNodeGroup->children.empty()){
+        sgConverter.preloadAnotherFormatFiles(nonHumanoidNodeGroup);
+        sgConverter.preloadTextureImages(nonHumanoidNodeGroup);
         SgNodePtr scene = sgConverter.convert(nonHumanoidNodeGroup);
         if(scene){
             Link* link = body->createLink();
@@ -26,6 +26,7 @@ public:
     virtual void enableShapeLoading(bool on);
     virtual void setDefaultDivisionNumber(int n);
     virtual bool load(Body* body, const std::string& filename);
+    virtual bool getSourceFiles(std::vector<std::string>& out_filenames) const;
     VRMLNodePtr getOriginalNode(Link* link);
 
 private:
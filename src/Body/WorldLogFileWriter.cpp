@@ -0,0 +1,838 @@
+/**
+   @file
+*/
+
+#include "WorldLogFileWriter.h"
+#include "Body.h"
+#include "Link.h"
+#include "Device.h"
+#include <cnoid/EigenTypes>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <zlib.h>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <stack>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+typedef boost::int64_t int64;
+
+class WriteBuf
+{
+public:
+    vector<char> data;
+    // The size of the data which has been passed to the file
+    int64 seekOffset;
+
+    WriteBuf() {
+        seekOffset = 0;
+    }
+
+    char* buf() {
+        return &data.front();
+    }
+
+    size_t pos() {
+        return data.size();
+    }
+
+    int64 seekPos() {
+        return seekOffset + data.size();
+    }
+
+    void clear(){
+        data.clear();
+    }
+
+    void reset(){
+        data.clear();
+        seekOffset = 0;
+    }
+
+    int size() const {
+        return data.size();
+    }
+
+    void writeID(WorldLogFileWriter::DataTypeID id){
+        writeOctet((char)id);
+    }
+
+    void writeBool(bool value){
+        data.push_back(value);
+    }
+
+    void writeOctet(char value){
+        data.push_back(value);
+    }
+
+    void writeShort(short value){
+        data.push_back(value & 0xff);
+        data.push_back(value >> 8);
+    }
+
+    void writeInt(int value){
+        data.push_back(value & 0xff);
+        data.push_back((value >> 8) & 0xff);
+        data.push_back((value >> 16) & 0xff);
+        data.push_back((value >> 24) & 0xff);
+    }
+
+    void writeInt(int pos, int value){
+        data[pos++] = value & 0xff;
+        data[pos++] = (value >> 8) & 0xff;
+        data[pos++] = (value >> 16) & 0xff;
+        data[pos++] = (value >> 24) & 0xff;
+    }
+
+    void writeInt64(int64 value){
+        for(int i=0; i < 8; ++i){
+            data.push_back((value >> (i * 8)) & 0xff);
+        }
+    }
+
+    void writeSeekPos(int64 pos){
+        writeInt64(pos);
+    }
+
+    void writeSeekOffset(int offset){
+        writeInt(offset);
+    }
+
+    void writeSeekOffset(int pos, int offset){
+        writeInt(pos, offset);
+    }
+
+    void writeFloat(float value){
+        char* p = (char*)&value;
+        const int n = sizeof(float);
+        for(int i=0; i < n; ++i){
+            data.push_back(p[i]);
+        }
+    }
+
+    void writeSE3(const SE3& position){
+        const Vector3& p = position.translation();
+        writeFloat(p.x());
+        writeFloat(p.y());
+        writeFloat(p.z());
+        const Quat& q = position.rotation();
+        writeFloat(q.w());
+        writeFloat(q.x());
+        writeFloat(q.y());
+        writeFloat(q.z());
+    }
+
+    void writeString(const std::string& str){
+        const int size = str.size();
+        data.reserve(data.size() + size + 1);
+        writeShort((unsigned char)size);
+        for(int i=0; i < size; ++i){
+            writeOctet(str[i]);
+        }
+    }
+};
+
+}
+
+namespace cnoid {
+
+class WorldLogFileWriterImpl
+{
+public:
+    vector<string> bodyNames;
+    ofstream ofs;
+    WriteBuf writeBuf;
+    int64 lastOutputFramePos;
+    stack<int> sizeHeaderStack;
+
+    struct FrameIndexEntry {
+        float time;
+        int64 pos;
+        bool isKeyFrame;
+    };
+    vector<FrameIndexEntry> frameIndex;
+
+    struct DeviceStateCache : public Referenced {
+        DeviceStatePtr state;
+        int64 seekPos;
+    };
+    typedef ref_ptr<DeviceStateCache> DeviceStateCachePtr;
+
+    vector<DeviceStateCachePtr> deviceStateCacheArrays[2];
+    vector<DeviceStateCachePtr>* pLastDeviceStateCacheArray;
+    vector<DeviceStateCachePtr>* pCurrentDeviceStateCacheArray;
+    int deviceIndex;
+    int numDeviceStateCaches;
+    int currentDeviceStateCacheArrayIndex;
+    vector<double> doubleWriteBuf;
+    vector<SE3, Eigen::aligned_allocator<SE3> > linkPositionBuf;
+    vector<double> jointPositionBuf;
+
+    /*
+      In the asynchronous output, the data of the completed frames are passed to the output thread
+      through the queue, and the buffers written by the thread are reused for the next frames.
+    */
+    bool isAsynchronousOutputEnabled;
+    int maxNumQueuedBuffers;
+    boost::thread outputThread;
+    boost::mutex outputMutex;
+    boost::condition_variable outputCondition;
+    deque< vector<char> > queuedBuffers;
+    vector< vector<char> > freeBuffers;
+    bool isOutputThreadActive;
+    bool isOutputThreadStopRequested;
+    bool isBackpressured;
+    int numBackpressuredFrames;
+
+    /*
+      In the compressed format, the frames are output as the chunks of the frames. The data of
+      the frames except the first one in a chunk are the XOR of the data and the previous frame,
+      and the chunk is compressed by zlib. The first frame of a chunk is the key frame.
+    */
+    bool isCompressionEnabled;
+    int keyFrameInterval;
+    size_t frameBeginPos;
+    vector<char> prevFrameData;
+    vector<char> chunkData;
+    vector<unsigned char> compressedChunkData;
+    int numChunkFrames;
+    float chunkTime;
+
+    WorldLogFileWriterImpl();
+    ~WorldLogFileWriterImpl();
+    bool open(const std::string& filename);
+    void close();
+    void flushWriteBuf(bool doForce);
+    void stopOutputThread();
+    void runOutputThread();
+    void writeFrameIndex();
+    void reserveSizeHeader();
+    void fixSizeHeader();
+    void beginFrameOutput(double time);
+    void endFrameOutput();
+    void appendFrameToChunk();
+    void outputChunk();
+    void outputDeviceState(DeviceState* state);
+    void exchangeDeviceStateCacheArrays();
+};
+
+}
+
+
+WorldLogFileWriter::WorldLogFileWriter()
+{
+    impl = new WorldLogFileWriterImpl();
+}
+
+
+WorldLogFileWriterImpl::WorldLogFileWriterImpl()
+{
+    isAsynchronousOutputEnabled = false;
+    maxNumQueuedBuffers = 64;
+    isOutputThreadActive = false;
+    isOutputThreadStopRequested = false;
+    isBackpressured = false;
+    numBackpressuredFrames = 0;
+    isCompressionEnabled = false;
+    keyFrameInterval = 100;
+    numChunkFrames = 0;
+    lastOutputFramePos = 0;
+    currentDeviceStateCacheArrayIndex = 0;
+    exchangeDeviceStateCacheArrays();
+}
+
+
+WorldLogFileWriter::~WorldLogFileWriter()
+{
+    delete impl;
+}
+
+
+WorldLogFileWriterImpl::~WorldLogFileWriterImpl()
+{
+    close();
+}
+
+
+bool WorldLogFileWriter::open(const std::string& filename)
+{
+    return impl->open(filename);
+}
+
+
+bool WorldLogFileWriterImpl::open(const std::string& filename)
+{
+    bodyNames.clear();
+
+    close();
+    ofs.clear();
+    ofs.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    writeBuf.reset();
+    lastOutputFramePos = 0;
+    frameIndex.clear();
+    numChunkFrames = 0;
+    chunkData.clear();
+    isBackpressured = false;
+    numBackpressuredFrames = 0;
+
+    while(!sizeHeaderStack.empty()){
+        sizeHeaderStack.pop();
+    }
+    deviceStateCacheArrays[0].clear();
+    deviceStateCacheArrays[1].clear();
+    currentDeviceStateCacheArrayIndex = 0;
+    exchangeDeviceStateCacheArrays();
+
+    return ofs.is_open();
+}
+
+
+bool WorldLogFileWriter::isOpen() const
+{
+    return impl->ofs.is_open();
+}
+
+
+void WorldLogFileWriter::close()
+{
+    impl->close();
+}
+
+
+void WorldLogFileWriterImpl::close()
+{
+    if(ofs.is_open()){
+        outputChunk();
+        flushWriteBuf(true);
+        writeFrameIndex();
+        stopOutputThread();
+        ofs.close();
+    }
+}
+
+
+/**
+   The data cannot be output while the file system is slow in the asynchronous output
+   because the simulation must not wait for it. The output of the frames is stopped
+   when the number of the queued buffers reaches the limit, and the data is kept in the
+   write buffer and is passed to the output thread with the next frames.
+*/
+void WorldLogFileWriter::setAsynchronousOutputEnabled(bool on)
+{
+    if(!on && impl->isAsynchronousOutputEnabled){
+        impl->flushWriteBuf(true);
+        impl->stopOutputThread();
+    }
+    impl->isAsynchronousOutputEnabled = on;
+}
+
+
+bool WorldLogFileWriter::isAsynchronousOutputEnabled() const
+{
+    return impl->isAsynchronousOutputEnabled;
+}
+
+
+void WorldLogFileWriter::setMaxNumQueuedBuffers(int n)
+{
+    impl->maxNumQueuedBuffers = std::max(1, n);
+}
+
+
+/**
+   The compression is applied to the file opened after this function is called.
+   The compressed file is read by the reader which supports the format version 3.
+*/
+void WorldLogFileWriter::setCompressionEnabled(bool on)
+{
+    impl->isCompressionEnabled = on;
+}
+
+
+bool WorldLogFileWriter::isCompressionEnabled() const
+{
+    return impl->isCompressionEnabled;
+}
+
+
+void WorldLogFileWriter::setKeyFrameInterval(int numFrames)
+{
+    impl->keyFrameInterval = std::max(1, numFrames);
+}
+
+
+bool WorldLogFileWriter::isBackpressured() const
+{
+    return impl->isBackpressured;
+}
+
+
+int WorldLogFileWriter::numBackpressuredFrames() const
+{
+    return impl->numBackpressuredFrames;
+}
+
+
+size_t WorldLogFileWriter::memoryUsage() const
+{
+    size_t usage =
+        impl->writeBuf.data.capacity() +
+        impl->frameIndex.capacity() * sizeof(WorldLogFileWriterImpl::FrameIndexEntry) +
+        impl->prevFrameData.capacity() +
+        impl->chunkData.capacity() +
+        impl->compressedChunkData.capacity() +
+        (impl->doubleWriteBuf.capacity() + impl->jointPositionBuf.capacity()) * sizeof(double) +
+        impl->linkPositionBuf.capacity() * sizeof(SE3);
+
+    for(int i=0; i < 2; ++i){
+        usage += impl->deviceStateCacheArrays[i].capacity() * sizeof(WorldLogFileWriterImpl::DeviceStateCachePtr);
+    }
+
+    boost::mutex::scoped_lock lock(impl->outputMutex);
+    for(size_t i=0; i < impl->queuedBuffers.size(); ++i){
+        usage += impl->queuedBuffers[i].capacity();
+    }
+    for(size_t i=0; i < impl->freeBuffers.size(); ++i){
+        usage += impl->freeBuffers[i].capacity();
+    }
+    return usage;
+}
+
+
+void WorldLogFileWriterImpl::flushWriteBuf(bool doForce)
+{
+    if(writeBuf.data.empty()){
+        return;
+    }
+    const int size = writeBuf.data.size();
+    
+    if(!isAsynchronousOutputEnabled){
+        ofs.write(&writeBuf.data.front(), size);
+        ofs.flush();
+
+    } else {
+        {
+            boost::lock_guard<boost::mutex> lock(outputMutex);
+            if(!doForce && queuedBuffers.size() >= maxNumQueuedBuffers){
+                isBackpressured = true;
+                ++numBackpressuredFrames;
+                return;
+            }
+            queuedBuffers.push_back(vector<char>());
+            queuedBuffers.back().swap(writeBuf.data);
+            if(!freeBuffers.empty()){
+                writeBuf.data.swap(freeBuffers.back());
+                freeBuffers.pop_back();
+            }
+        }
+        isBackpressured = false;
+        if(!isOutputThreadActive){
+            isOutputThreadStopRequested = false;
+            outputThread = boost::thread(boost::bind(&WorldLogFileWriterImpl::runOutputThread, this));
+            isOutputThreadActive = true;
+        } else {
+            outputCondition.notify_all();
+        }
+    }
+
+    writeBuf.seekOffset += size;
+    writeBuf.clear();
+}
+
+
+//! The queued buffers are written before the thread exits.
+void WorldLogFileWriterImpl::stopOutputThread()
+{
+    if(isOutputThreadActive){
+        {
+            boost::lock_guard<boost::mutex> lock(outputMutex);
+            isOutputThreadStopRequested = true;
+        }
+        outputCondition.notify_all();
+        outputThread.join();
+        isOutputThreadActive = false;
+    }
+}
+
+
+//! All the queued buffers are taken at once so that the file is flushed once for them.
+void WorldLogFileWriterImpl::runOutputThread()
+{
+    deque< vector<char> > buffers;
+    boost::unique_lock<boost::mutex> lock(outputMutex);
+    while(true){
+        while(queuedBuffers.empty() && !isOutputThreadStopRequested){
+            outputCondition.wait(lock);
+        }
+        if(queuedBuffers.empty()){
+            break;
+        }
+        buffers.swap(queuedBuffers);
+        lock.unlock();
+
+        for(size_t i=0; i < buffers.size(); ++i){
+            ofs.write(&buffers[i].front(), buffers[i].size());
+        }
+        ofs.flush();
+
+        lock.lock();
+        while(!buffers.empty()){
+            if(freeBuffers.size() < 4){
+                freeBuffers.push_back(vector<char>());
+                freeBuffers.back().swap(buffers.back());
+                freeBuffers.back().clear();
+            }
+            buffers.pop_back();
+        }
+    }
+}
+
+
+/**
+   The frame index is written at the end of the file when the file is closed.
+   The reader can seek any frame with the index without reading the frame headers.
+   It is not written if the file is not closed correctly, and the reader builds the index
+   by reading the frame headers in that case.
+*/
+void WorldLogFileWriterImpl::writeFrameIndex()
+{
+    if(frameIndex.empty()){
+        return;
+    }
+    const int64 indexPos = writeBuf.seekPos();
+    writeBuf.writeInt64(-1); // distinguishes the index from a frame header
+    writeBuf.writeInt(frameIndex.size());
+    for(size_t i=0; i < frameIndex.size(); ++i){
+        const FrameIndexEntry& entry = frameIndex[i];
+        writeBuf.writeFloat(entry.time);
+        writeBuf.writeSeekPos(entry.pos);
+        writeBuf.writeBool(entry.isKeyFrame);
+    }
+    writeBuf.writeSeekPos(indexPos);
+    for(int i=0; i < 4; ++i){
+        writeBuf.writeOctet(WorldLogFileWriter::frameIndexSignature()[i]);
+    }
+    flushWriteBuf(true);
+    frameIndex.clear();
+}
+
+
+const char* WorldLogFileWriter::frameIndexSignature()
+{
+    return "CWLI";
+}
+
+
+void WorldLogFileWriterImpl::reserveSizeHeader()
+{
+    sizeHeaderStack.push(writeBuf.size());
+    writeBuf.writeSeekOffset(0);
+}
+
+
+void WorldLogFileWriterImpl::fixSizeHeader()
+{
+    if(!sizeHeaderStack.empty()){
+        writeBuf.writeSeekOffset(sizeHeaderStack.top(), writeBuf.size() - (sizeHeaderStack.top() + sizeof(int)));
+        sizeHeaderStack.pop();
+    }
+}
+
+
+void WorldLogFileWriter::beginHeaderOutput()
+{
+    impl->writeBuf.clear();
+    // The negative value distinguishes the format from the first one, which begins with the header size
+    impl->writeBuf.writeInt(impl->isCompressionEnabled ? -COMPRESSED_FORMAT_VERSION : -FORMAT_VERSION);
+    impl->reserveSizeHeader();
+}
+
+
+int WorldLogFileWriter::outputBodyHeader(const std::string& name)
+{
+    int index = impl->bodyNames.size();
+    impl->bodyNames.push_back(name);
+    impl->writeBuf.writeString(name);
+    return index;
+}
+
+
+void WorldLogFileWriter::endHeaderOutput()
+{
+    impl->fixSizeHeader();
+    impl->flushWriteBuf(true);
+}
+
+
+int WorldLogFileWriter::numBodies() const
+{
+    return impl->bodyNames.size();
+}
+
+
+const std::string& WorldLogFileWriter::bodyName(int bodyIndex) const
+{
+    return impl->bodyNames[bodyIndex];
+}
+
+
+void WorldLogFileWriter::beginFrameOutput(double time)
+{
+    impl->beginFrameOutput(time);
+}
+
+
+void WorldLogFileWriterImpl::beginFrameOutput(double time)
+{
+    if(isCompressionEnabled){
+        // The frame in a chunk only has the time and the data size as the header
+        frameBeginPos = writeBuf.size();
+        if(numChunkFrames == 0){
+            chunkTime = time;
+        }
+        deviceIndex = 0;
+        writeBuf.writeFloat(time);
+        reserveSizeHeader();
+        return;
+    }
+    
+    int64 pos = writeBuf.seekPos();
+
+    if(lastOutputFramePos){
+        writeBuf.writeInt64(pos - lastOutputFramePos);
+    } else {
+        writeBuf.writeInt64(0);
+    }
+    lastOutputFramePos = pos;
+
+    FrameIndexEntry entry;
+    entry.time = time;
+    entry.pos = pos;
+    entry.isKeyFrame = true;
+    frameIndex.push_back(entry);
+
+    deviceIndex = 0;
+    writeBuf.writeFloat(time);
+    reserveSizeHeader(); // area for the frame data size
+}
+
+
+void WorldLogFileWriter::beginBodyStateOutput()
+{
+    impl->writeBuf.writeID(BODY_STATE);
+    impl->reserveSizeHeader();
+}
+
+
+void WorldLogFileWriter::outputLinkPositions(SE3* positions, int size)
+{
+    impl->writeBuf.writeID(LINK_POSITIONS);
+    impl->reserveSizeHeader();
+    impl->writeBuf.writeShort(size);
+    for(int i=0; i < size; ++i){
+        impl->writeBuf.writeSE3(positions[i]);
+    }
+    impl->fixSizeHeader();
+}
+
+
+void WorldLogFileWriter::outputJointPositions(double* values, int size)
+{
+    impl->writeBuf.writeID(JOINT_POSITIONS);
+    impl->reserveSizeHeader();
+    impl->writeBuf.writeShort(size);
+    for(int i=0; i < size; ++i){
+        impl->writeBuf.writeFloat(values[i]);
+    }
+    impl->fixSizeHeader();
+}
+
+
+void WorldLogFileWriter::beginDeviceStateOutput()
+{
+    impl->writeBuf.writeID(DEVICE_STATES);
+    impl->reserveSizeHeader();
+}
+
+
+/**
+   The state which is same object as the state of the same device in the last frame
+   is output as the reference to the last output.
+*/
+void WorldLogFileWriter::outputDeviceState(DeviceState* state)
+{
+    impl->outputDeviceState(state);
+}
+
+
+void WorldLogFileWriterImpl::outputDeviceState(DeviceState* state)
+{
+    DeviceStateCache* cache = 0;
+
+    if(deviceIndex >= numDeviceStateCaches){
+        cache = new DeviceStateCache;
+    } else {
+        cache = (*pLastDeviceStateCacheArray)[deviceIndex];
+        if(state == cache->state && !isCompressionEnabled){
+            writeBuf.writeOctet(-1);
+            writeBuf.writeSeekPos(cache->seekPos);
+            frameIndex.back().isKeyFrame = false;
+            goto endOutputDeviceState;
+        }
+    }
+    cache->state = state;
+    cache->seekPos = writeBuf.seekPos();
+    if(!state){
+        writeBuf.writeOctet(0);
+    } else {
+        int size = state->stateSize();
+        writeBuf.writeOctet(size);
+        doubleWriteBuf.resize(size);
+        state->writeState(&doubleWriteBuf.front());
+        for(size_t i=0; i < size; ++i){
+            writeBuf.writeFloat(doubleWriteBuf[i]);
+        }
+    }
+endOutputDeviceState:
+
+    pCurrentDeviceStateCacheArray->push_back(cache);
+    ++deviceIndex;
+}
+
+
+void WorldLogFileWriter::endDeviceStateOutput()
+{
+    impl->fixSizeHeader();
+}
+
+
+void WorldLogFileWriter::endBodyStateOutput()
+{
+    impl->fixSizeHeader();
+}
+
+
+void WorldLogFileWriter::endFrameOutput()
+{
+    impl->endFrameOutput();
+}
+
+
+void WorldLogFileWriterImpl::endFrameOutput()
+{
+    fixSizeHeader();
+    if(!isCompressionEnabled){
+        flushWriteBuf(false);
+    } else {
+        appendFrameToChunk();
+        if(numChunkFrames >= keyFrameInterval){
+            outputChunk();
+        }
+    }
+    exchangeDeviceStateCacheArrays();
+}
+
+
+/**
+   The device states are always output in the compressed format because the same data
+   in the successive frames is compressed to a few bytes by the XOR with the previous frame.
+*/
+void WorldLogFileWriterImpl::appendFrameToChunk()
+{
+    const int frameHeaderSize = sizeof(float) + sizeof(int);
+    const char* frame = &writeBuf.data[frameBeginPos];
+    const char* data = frame + frameHeaderSize;
+    const size_t dataSize = writeBuf.data.size() - frameBeginPos - frameHeaderSize;
+
+    chunkData.insert(chunkData.end(), frame, data);
+    if(numChunkFrames == 0){
+        chunkData.insert(chunkData.end(), data, data + dataSize);
+    } else {
+        const size_t n = std::min(dataSize, prevFrameData.size());
+        for(size_t i=0; i < n; ++i){
+            chunkData.push_back(data[i] ^ prevFrameData[i]);
+        }
+        chunkData.insert(chunkData.end(), data + n, data + dataSize);
+    }
+    prevFrameData.assign(data, data + dataSize);
+    writeBuf.data.resize(frameBeginPos);
+    ++numChunkFrames;
+}
+
+
+/**
+   The header of a chunk is the same as the header of a frame in the uncompressed format
+   except that the size of the uncompressed data follows the size of the compressed data.
+*/
+void WorldLogFileWriterImpl::outputChunk()
+{
+    if(numChunkFrames == 0){
+        return;
+    }
+    
+    uLongf compressedSize = compressBound(chunkData.size());
+    compressedChunkData.resize(compressedSize);
+    compress2(&compressedChunkData.front(), &compressedSize,
+              reinterpret_cast<const Bytef*>(&chunkData.front()), chunkData.size(), Z_BEST_SPEED);
+
+    int64 pos = writeBuf.seekPos();
+    writeBuf.writeInt64(lastOutputFramePos ? (pos - lastOutputFramePos) : 0);
+    lastOutputFramePos = pos;
+    writeBuf.writeFloat(chunkTime);
+    writeBuf.writeInt(compressedSize);
+    writeBuf.writeInt(chunkData.size());
+    writeBuf.data.insert(writeBuf.data.end(), compressedChunkData.begin(), compressedChunkData.begin() + compressedSize);
+
+    // The frame index of the compressed format has the entries of the chunks
+    FrameIndexEntry entry;
+    entry.time = chunkTime;
+    entry.pos = pos;
+    entry.isKeyFrame = true;
+    frameIndex.push_back(entry);
+
+    chunkData.clear();
+    numChunkFrames = 0;
+    
+    flushWriteBuf(false);
+}
+
+
+void WorldLogFileWriterImpl::exchangeDeviceStateCacheArrays()
+{
+    int i = 1 - currentDeviceStateCacheArrayIndex;
+    pCurrentDeviceStateCacheArray = &deviceStateCacheArrays[i];
+    pCurrentDeviceStateCacheArray->clear();
+    pLastDeviceStateCacheArray = &deviceStateCacheArrays[1-i];
+    numDeviceStateCaches = pLastDeviceStateCacheArray->size();
+    currentDeviceStateCacheArrayIndex = i;
+}
+
+
+void WorldLogFileWriter::outputBodyState(Body* body, bool doOutputAllLinkPositions)
+{
+    beginBodyStateOutput();
+
+    const int numLinks = doOutputAllLinkPositions ? body->numLinks() : 1;
+    impl->linkPositionBuf.resize(numLinks);
+    for(int i=0; i < numLinks; ++i){
+        Link* link = body->link(i);
+        impl->linkPositionBuf[i].set(link->p(), link->R());
+    }
+    outputLinkPositions(&impl->linkPositionBuf.front(), numLinks);
+
+    const int numJoints = body->numJoints();
+    if(numJoints > 0){
+        impl->jointPositionBuf.resize(numJoints);
+        for(int i=0; i < numJoints; ++i){
+            impl->jointPositionBuf[i] = body->joint(i)->q();
+        }
+        outputJointPositions(&impl->jointPositionBuf.front(), numJoints);
+    }
+
+    endBodyStateOutput();
+}
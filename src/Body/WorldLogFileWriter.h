@@ -0,0 +1,124 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_WORLD_LOG_FILE_WRITER_H
+#define CNOID_BODY_WORLD_LOG_FILE_WRITER_H
+
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SE3;
+class Body;
+class DeviceState;
+class WorldLogFileWriterImpl;
+
+/**
+   The writer of the world log file format, which is read by WorldLogFileItem.
+   This class does not depend on the GUI so that the log can be recorded by
+   the programs without the GUI.
+
+   The file consists of the top header, the frames and the frame index.
+   The seek positions in the file are 64-bit integers so that the size of the file is not limited
+   to 2 GB.
+*/
+class CNOID_EXPORT WorldLogFileWriter
+{
+public:
+    enum DataTypeID {
+        BODY_STATE,
+        LINK_POSITIONS,
+        JOINT_POSITIONS,
+        DEVICE_STATES
+    };
+
+    /**
+       The first format, which has no version number in the file, is version 1.
+       It has the 32-bit seek positions and no frame index.
+    */
+    enum { FORMAT_VERSION = 2 };
+
+    /**
+       The format of the compressed file. The frames are output as the compressed chunks
+       of the frames from a key frame to the frame before the next key frame, and the frame index
+       only has the entries of the chunks.
+    */
+    enum { COMPRESSED_FORMAT_VERSION = 3 };
+
+    /**
+       The four characters at the end of the file which has the frame index.
+       The 64-bit position of the index precedes them.
+       The index has the marker of -1 as a 64-bit integer, the number of the frames as a 32-bit integer,
+       and the time (float), the position (64-bit) and the key frame flag (octet) of each frame.
+       The key frames contain all the device states without the references to the previous frames.
+    */
+    static const char* frameIndexSignature();
+
+    WorldLogFileWriter();
+    ~WorldLogFileWriter();
+
+    bool open(const std::string& filename);
+    bool isOpen() const;
+    //! The frame index is written before the file is closed.
+    void close();
+
+    /**
+       Write the file in a background thread so that the output of a frame does not wait for
+       the file system. This is disabled by default.
+    */
+    void setAsynchronousOutputEnabled(bool on);
+    bool isAsynchronousOutputEnabled() const;
+
+    //! The max number of the frame buffers waiting for the background thread. The default value is 64.
+    void setMaxNumQueuedBuffers(int n);
+
+    /**
+       True if the last frame has been kept in memory because the queue of the
+       background thread is full. The kept frames are output with the next frames.
+    */
+    bool isBackpressured() const;
+
+    void setCompressionEnabled(bool on);
+    bool isCompressionEnabled() const;
+
+    //! The number of the frames in a compressed chunk. The default value is 100.
+    void setKeyFrameInterval(int numFrames);
+
+    //! The number of the frames kept in memory by the backpressure since the file was opened
+    int numBackpressuredFrames() const;
+
+    //! The size of the buffers, the queued frames and the frame index in bytes
+    size_t memoryUsage() const;
+
+    void beginHeaderOutput();
+    int outputBodyHeader(const std::string& name);
+    void endHeaderOutput();
+    void beginFrameOutput(double time);
+    void beginBodyStateOutput();
+    void outputLinkPositions(SE3* positions, int size);
+    void outputJointPositions(double* values, int size);
+    void beginDeviceStateOutput();
+    void outputDeviceState(DeviceState* state);
+    void endDeviceStateOutput();
+    void endBodyStateOutput();
+    void endFrameOutput();
+
+    /**
+       Output the body state block of a body, which consists of the link positions
+       and the joint positions. The device states are not output by this function.
+       @param doOutputAllLinkPositions If false, only the root link position is output.
+    */
+    void outputBodyState(Body* body, bool doOutputAllLinkPositions = false);
+
+    int numBodies() const;
+    const std::string& bodyName(int bodyIndex) const;
+
+private:
+    WorldLogFileWriterImpl* impl;
+};
+
+}
+
+#endif
@@ -24,7 +24,9 @@
 #include <cnoid/EasyScanner>
 #include <cnoid/VRMLToSGConverter>
 #include <cnoid/NullOut>
+#include <cnoid/TaskScheduler>
 #include <Eigen/StdVector>
+#include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include "gettext.h"
 
@@ -76,6 +78,23 @@ public:
     
     vector<LinkInfoPtr> linkInfos;
 
+    /**
+       The shape files of the links are loaded concurrently after all the links are read.
+    */
+    struct ShapeFileLoad : public Referenced
+    {
+        LinkPtr link;
+        SgGroupPtr shape;
+        bool hasShape;
+        string filename;
+        vector<SgNodePtr> nodes;
+        bool hasError;
+        EasyScanner::Exception error;
+    };
+    typedef ref_ptr<ShapeFileLoad> ShapeFileLoadPtr;
+
+    vector<ShapeFileLoadPtr> shapeFileLoads;
+
     typedef map<string, LinkPtr> LinkMap;
     LinkMap linkMap;
 
@@ -117,8 +136,6 @@ public:
 
     SgMaterialPtr defaultMaterial;
 
-    VRMLParser vrmlParser;
-    VRMLToSGConverter sgConverter;
 
     ostream& os() { return *os_; }
 
@@ -130,6 +147,8 @@ public:
     bool readBody(Mapping* topNode);
     LinkPtr readLink(Mapping* linkNode);
     void setMassParameters(Link* link);
+    void loadShapeFile(int index);
+    void finishShapeFileLoads();
     //! \return true if any scene nodes other than Group and Transform are added in the sub tree
     bool readElements(ValueNode& elements, SgGroupPtr& sceneGroup);
     bool readNode(Mapping& node, const string& type);
@@ -306,7 +325,6 @@ void YAMLBodyLoaderImpl::setDefaultDivisionNumber(int n)
 {
     divisionNumber = n;
     meshGenerator.setDivisionNumber(divisionNumber);
-    sgConverter.setDivisionNumber(divisionNumber);
 }
 
 
@@ -362,6 +380,7 @@ bool YAMLBodyLoaderImpl::readTopNode(Body* body, Mapping* topNode)
     body->clearExtraJoints();
 
     linkInfos.clear();
+    shapeFileLoads.clear();
     linkMap.clear();
     validJointIdSet.clear();
     numValidJointIds = 0;
@@ -379,6 +398,7 @@ bool YAMLBodyLoaderImpl::readTopNode(Body* body, Mapping* topNode)
     }
 
     linkInfos.clear();
+    shapeFileLoads.clear();
     linkMap.clear();
     validJointIdSet.clear();
     nameStack.clear();
@@ -448,6 +468,8 @@ bool YAMLBodyLoaderImpl::readBody(Mapping* topNode)
         }
     }
 
+    finishShapeFileLoads();
+
     // construct a link tree
     for(size_t i=0; i < linkInfos.size(); ++i){
         LinkInfo* info = linkInfos[i];
@@ -623,17 +645,15 @@ LinkPtr YAMLBodyLoaderImpl::readLink(Mapping* linkNode)
             filepath = directoryPath / filepath;
             filepath.normalize();
         }
-        vrmlParser.load(getAbsolutePathString(filepath));
-        while(VRMLNodePtr vrmlNode = vrmlParser.readNode()){
-            SgNodePtr node = sgConverter.convert(vrmlNode);
-            if(node){
-                shape->addChild(node);
-                hasShape = true;
-            }
-        }
-    }
-
-    if(hasShape){
+        ShapeFileLoad* load = new ShapeFileLoad;
+        load->link = link;
+        load->shape = shape;
+        load->hasShape = hasShape;
+        load->filename = getAbsolutePathString(filepath);
+        load->hasError = false;
+        shapeFileLoads.push_back(load);
+
+    } else if(hasShape){
         link->setShape(shape);
     }
 
@@ -656,6 +676,55 @@ LinkPtr YAMLBodyLoaderImpl::readLink(Mapping* linkNode)
 }
 
 
+void YAMLBodyLoaderImpl::loadShapeFile(int index)
+{
+    ShapeFileLoad* load = shapeFileLoads[index];
+    try {
+        VRMLParser vrmlParser;
+        VRMLToSGConverter sgConverter;
+        sgConverter.setDivisionNumber(divisionNumber);
+        vrmlParser.load(load->filename);
+        while(VRMLNodePtr vrmlNode = vrmlParser.readNode()){
+            SgNodePtr node = sgConverter.convert(vrmlNode);
+            if(node){
+                load->nodes.push_back(node);
+            }
+        }
+    } catch(const EasyScanner::Exception& ex){
+        load->error = ex;
+        load->hasError = true;
+    }
+}
+
+
+/**
+   The shapes are added in the order of the links so that the result is the same as
+   the sequential loading.
+*/
+void YAMLBodyLoaderImpl::finishShapeFileLoads()
+{
+    if(shapeFileLoads.empty()){
+        return;
+    }
+    TaskScheduler::instance()->parallelFor(
+        0, shapeFileLoads.size(), boost::bind(&YAMLBodyLoaderImpl::loadShapeFile, this, _1));
+
+    for(size_t i=0; i < shapeFileLoads.size(); ++i){
+        ShapeFileLoad* load = shapeFileLoads[i];
+        if(load->hasError){
+            throw load->error;
+        }
+        for(size_t j=0; j < load->nodes.size(); ++j){
+            load->shape->addChild(load->nodes[j]);
+        }
+        if(load->hasShape || !load->nodes.empty()){
+            load->link->setShape(load->shape);
+        }
+    }
+    shapeFileLoads.clear();
+}
+
+
 void YAMLBodyLoaderImpl::setMassParameters(Link* link)
 {
     /*
@@ -976,6 +1045,26 @@ bool YAMLBodyLoaderImpl::readCamera(Mapping& node)
     if(node.read("nearClipDistance", value)) camera->setNearClipDistance(value);
     if(node.read("farClipDistance", value)) camera->setFarClipDistance(value);
     if(node.read("frameRate", value)) camera->setFrameRate(value);
+
+    const Listing& distortion = *node.findListing("lensDistortion");
+    if(distortion.isValid() && distortion.size() == 2){
+        camera->setLensDistortion(distortion[0].toDouble(), distortion[1].toDouble());
+    }
+    if(range){
+        if(node.read("rangeNoise", value)) range->setRangeNoise(value);
+        if(node.read("rangeQuantizationStep", value)) range->setRangeQuantizationStep(value);
+        if(node.read("dropoutRate", value)) range->setDropoutRate(value);
+        string pointDataFormat;
+        if(node.read("pointDataFormat", pointDataFormat)){
+            if(pointDataFormat == "DEPTH_IMAGE"){
+                range->setOrganized(true);
+                range->setPointDataFormat(RangeCamera::DEPTH_IMAGE);
+            } else if(pointDataFormat == "POINT_DATA"){
+                range->setPointDataFormat(RangeCamera::POINT_DATA);
+            }
+        }
+        if(node.read("depthImageStep", value)) range->setDepthImageStep(value);
+    }
     
     return readDevice(camera, node);
 }
@@ -992,6 +1081,20 @@ bool YAMLBodyLoaderImpl::readRangeSensor(Mapping& node)
     if(node.read("minDistance", value)) rangeSensor->setMinDistance(value);
     if(node.read("maxDistance", value)) rangeSensor->setMaxDistance(value);
     if(node.read("scanRate", value)) rangeSensor->setFrameRate(value);
+    if(node.read("rangeNoise", value)) rangeSensor->setRangeNoise(value);
+    if(node.read("rangeQuantizationStep", value)) rangeSensor->setRangeQuantizationStep(value);
+    if(node.read("dropoutRate", value)) rangeSensor->setDropoutRate(value);
+    string rangeDataFormat;
+    if(node.read("rangeDataFormat", rangeDataFormat)){
+        if(rangeDataFormat == "FLOAT"){
+            rangeSensor->setRangeDataFormat(RangeSensor::FLOAT_RANGE_DATA);
+        } else if(rangeDataFormat == "FIXED_POINT"){
+            rangeSensor->setRangeDataFormat(RangeSensor::FIXED_POINT_RANGE_DATA);
+        } else if(rangeDataFormat == "DOUBLE"){
+            rangeSensor->setRangeDataFormat(RangeSensor::DOUBLE_RANGE_DATA);
+        }
+    }
+    if(node.read("fixedPointRangeStep", value)) rangeSensor->setFixedPointRangeStep(value);
     
     return readDevice(rangeSensor, node);
 }
@@ -95,7 +95,156 @@ PyObject* Body_calcTotalMomentum(Body& self) {
 }
 
 
-BodyPtr BodyLoader_load2(BodyLoader& self, const std::string& filename) { return self.load(filename); }
+/*
+  The following functions get and set the whole state of a body with a single call so that
+  a script does not have to access the links one by one. The values are packed into a contiguous
+  buffer and the array is created from it by numpy.frombuffer, and the setters read the buffer
+  of the array converted by numpy.ascontiguousarray.
+*/
+python::object numpy_frombuffer;
+python::object numpy_ascontiguousarray;
+python::object numpy_float64;
+
+python::object createArray(const std::vector<double>& buf, const python::tuple& shape)
+{
+    python::object bytes(
+        python::handle<>(
+            PyByteArray_FromStringAndSize(
+                buf.empty() ? "" : reinterpret_cast<const char*>(&buf[0]), buf.size() * sizeof(double))));
+    return numpy_frombuffer(bytes, numpy_float64).attr("reshape")(shape);
+}
+
+
+class ArrayReader
+{
+    python::object array;
+    Py_buffer view;
+public:
+    ArrayReader(python::object values, int size) {
+        array = numpy_ascontiguousarray(values, numpy_float64);
+        if(PyObject_GetBuffer(array.ptr(), &view, PyBUF_C_CONTIGUOUS) < 0){
+            python::throw_error_already_set();
+        }
+        if(view.len != static_cast<Py_ssize_t>(size * sizeof(double))){
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "The number of the values does not match the body");
+            python::throw_error_already_set();
+        }
+    }
+    ~ArrayReader() {
+        PyBuffer_Release(&view);
+    }
+    const double* data() const { return static_cast<const double*>(view.buf); }
+};
+
+
+typedef double& (Link::*LinkJointValueFunc)();
+
+python::object getJointValues(Body& body, LinkJointValueFunc func)
+{
+    const int n = body.numJoints();
+    std::vector<double> buf(n);
+    for(int i=0; i < n; ++i){
+        buf[i] = (body.joint(i)->*func)();
+    }
+    return createArray(buf, python::make_tuple(n));
+}
+
+void setJointValues(Body& body, python::object values, LinkJointValueFunc func)
+{
+    const int n = body.numJoints();
+    ArrayReader reader(values, n);
+    const double* data = reader.data();
+    for(int i=0; i < n; ++i){
+        (body.joint(i)->*func)() = data[i];
+    }
+}
+
+python::object Body_jointPositions(Body& self) { return getJointValues(self, &Link::q); }
+void Body_setJointPositions(Body& self, python::object q) { setJointValues(self, q, &Link::q); }
+python::object Body_jointVelocities(Body& self) { return getJointValues(self, &Link::dq); }
+void Body_setJointVelocities(Body& self, python::object dq) { setJointValues(self, dq, &Link::dq); }
+python::object Body_jointAccelerations(Body& self) { return getJointValues(self, &Link::ddq); }
+void Body_setJointAccelerations(Body& self, python::object ddq) { setJointValues(self, ddq, &Link::ddq); }
+python::object Body_jointTorques(Body& self) { return getJointValues(self, &Link::u); }
+void Body_setJointTorques(Body& self, python::object u) { setJointValues(self, u, &Link::u); }
+
+//! The array has the shape (numLinks, 4, 4), and each element is the homogeneous matrix of a link.
+python::object Body_linkPositions(Body& self)
+{
+    const int n = self.numLinks();
+    std::vector<double> buf(n * 16);
+    double* p = n > 0 ? &buf[0] : 0;
+    for(int i=0; i < n; ++i){
+        Eigen::Map<Eigen::Matrix<double, 4, 4, Eigen::RowMajor> > T(p);
+        T.topRows<3>() = self.link(i)->position().matrix();
+        T.row(3) << 0.0, 0.0, 0.0, 1.0;
+        p += 16;
+    }
+    return createArray(buf, python::make_tuple(n, 4, 4));
+}
+
+void Body_setLinkPositions(Body& self, python::object positions)
+{
+    const int n = self.numLinks();
+    ArrayReader reader(positions, n * 16);
+    const double* p = reader.data();
+    for(int i=0; i < n; ++i){
+        Eigen::Map<const Eigen::Matrix<double, 4, 4, Eigen::RowMajor> > T(p);
+        Link* link = self.link(i);
+        link->translation() = T.block<3, 1>(0, 3);
+        link->rotation() = T.block<3, 3>(0, 0);
+        p += 16;
+    }
+}
+
+int Body_deviceStateSize(Body& self)
+{
+    int size = 0;
+    const int n = self.numDevices();
+    for(int i=0; i < n; ++i){
+        size += self.device(i)->stateSize();
+    }
+    return size;
+}
+
+//! The states of all the devices written by Device::writeState are concatenated in the order of the devices.
+python::object Body_deviceStates(Body& self)
+{
+    const int size = Body_deviceStateSize(self);
+    std::vector<double> buf(size);
+    double* p = size > 0 ? &buf[0] : 0;
+    const int n = self.numDevices();
+    for(int i=0; i < n; ++i){
+        p = self.device(i)->writeState(p);
+    }
+    return createArray(buf, python::make_tuple(size));
+}
+
+void Body_setDeviceStates(Body& self, python::object states)
+{
+    ArrayReader reader(states, Body_deviceStateSize(self));
+    const double* p = reader.data();
+    const int n = self.numDevices();
+    for(int i=0; i < n; ++i){
+        Device* device = self.device(i);
+        p = device->readState(p);
+        device->notifyStateChange();
+    }
+}
+
+
+bool AbstractBodyLoader_load(AbstractBodyLoader& self, Body* body, const std::string& filename)
+{
+    PyGILUnlock unlock;
+    return self.load(body, filename);
+}
+
+BodyPtr BodyLoader_load2(BodyLoader& self, const std::string& filename)
+{
+    PyGILUnlock unlock;
+    return self.load(filename);
+}
 
 LinkPtr JointPath_joint(JointPath& self, int index) { return self.joint(index); }
 LinkPtr JointPath_baseLink(JointPath& self) { return self.baseLink(); }
@@ -120,6 +269,11 @@ BOOST_PYTHON_MODULE(Body)
 {
     boost::python::import("cnoid.Util");
 
+    python::object numpy = python::import("numpy");
+    numpy_frombuffer = numpy.attr("frombuffer");
+    numpy_ascontiguousarray = numpy.attr("ascontiguousarray");
+    numpy_float64 = numpy.attr("float64");
+
     {
         scope linkScope = 
             class_< Link, LinkPtr, bases<Referenced> >("Link")
@@ -245,6 +399,19 @@ BOOST_PYTHON_MODULE(Body)
             .def("calcCenterOfMass", &Body::calcCenterOfMass, return_value_policy<return_by_value>())
             .def("centerOfMass", &Body::centerOfMass, return_value_policy<return_by_value>())
             .def("calcTotalMomentum", Body_calcTotalMomentum)
+            .def("jointPositions", Body_jointPositions)
+            .def("setJointPositions", Body_setJointPositions)
+            .def("jointVelocities", Body_jointVelocities)
+            .def("setJointVelocities", Body_setJointVelocities)
+            .def("jointAccelerations", Body_jointAccelerations)
+            .def("setJointAccelerations", Body_setJointAccelerations)
+            .def("jointTorques", Body_jointTorques)
+            .def("setJointTorques", Body_setJointTorques)
+            .def("linkPositions", Body_linkPositions)
+            .def("setLinkPositions", Body_setLinkPositions)
+            .def("deviceStateSize", Body_deviceStateSize)
+            .def("deviceStates", Body_deviceStates)
+            .def("setDeviceStates", Body_setDeviceStates)
             .def("calcForwardKinematics", &Body::calcForwardKinematics, Body_calcForwardKinematics_overloads())
             .def("clearExternalForces", &Body::clearExternalForces)
             .def("numExtraJoints", &Body::numExtraJoints)
@@ -271,7 +438,7 @@ BOOST_PYTHON_MODULE(Body)
         .def("setShapeLoadingEnabled", &AbstractBodyLoader::setShapeLoadingEnabled)
         .def("setDefaultDivisionNumber", &AbstractBodyLoader::setDefaultDivisionNumber)
         .def("setDefaultCreaseAngle", &AbstractBodyLoader::setDefaultCreaseAngle)
-        .def("load", &AbstractBodyLoader::load)
+        .def("load", AbstractBodyLoader_load)
         ;
 
     class_<BodyLoader, bases<AbstractBodyLoader> >("BodyLoader")
@@ -0,0 +1,88 @@
+/*
+  This file is part of Choreonoid, an extensible graphical robotics application suit.
+  Copyright (c) 2007-2014 National Institute of Advanced Industrial Science and Technology (AIST)
+  Released under the MIT license. See accompanying file 'LICENSE' for more information.
+*/
+
+/**
+   This program runs CollisionDetectorBenchmark without the GUI. Only the detectors of the
+   libraries linked to this program are available, so the detectors of the plugins such as
+   ODE, Bullet and FCL are measured by the --collision-benchmark option of Choreonoid.
+*/
+
+#include <cnoid/CollisionDetectorBenchmark>
+#include <cnoid/AISTCollisionDetector>
+#include <boost/program_options.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+void configureDetector(CollisionDetector* detector, bool isBroadphaseEnabled)
+{
+    AISTCollisionDetector* aist = dynamic_cast<AISTCollisionDetector*>(detector);
+    if(aist){
+        aist->enableBroadphase(isBroadphaseEnabled);
+    }
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    string outputFile;
+    vector<string> detectorNames;
+    vector<int> threadCounts;
+    int numFrames;
+    int numParts;
+    bool isBroadphaseDisabled;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("output,o", po::value<string>(&outputFile)->default_value("collision-benchmark.yaml"),
+         "YAML file to output the result")
+        ("detector,d", po::value< vector<string> >(&detectorNames),
+         "Detector to measure. All the available detectors are measured by default.")
+        ("threads,t", po::value< vector<int> >(&threadCounts)->multitoken(),
+         "Numbers of the threads used in detecting the collisions")
+        ("frames,n", po::value<int>(&numFrames)->default_value(1000), "Maximum number of the frames of a scene")
+        ("parts", po::value<int>(&numParts)->default_value(50), "Number of the parts in the bin")
+        ("no-broadphase", po::bool_switch(&isBroadphaseDisabled), "Disable the broadphase of AISTCollisionDetector")
+        ("help,h", "Show this help");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, options), vm);
+        po::notify(vm);
+    } catch(const po::error& ex){
+        cerr << ex.what() << endl;
+        return 1;
+    }
+    if(vm.count("help")){
+        cout << options << endl;
+        return 0;
+    }
+
+    CollisionDetectorBenchmark benchmark;
+    benchmark.setMessageSink(cout);
+    benchmark.setDetectorNames(detectorNames);
+    benchmark.setThreadCounts(threadCounts);
+    benchmark.setMaxNumFrames(numFrames);
+    benchmark.setNumBinParts(numParts);
+    benchmark.setDetectorConfigurationFunction(boost::bind(configureDetector, _1, !isBroadphaseDisabled));
+
+    if(!benchmark.run()){
+        return 1;
+    }
+    if(!benchmark.writeResults(outputFile)){
+        cerr << outputFile << " cannot be written." << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,541 @@
+/*
+  This file is part of Choreonoid, an extensible graphical robotics application suit.
+  Copyright (c) 2007-2014 National Institute of Advanced Industrial Science and Technology (AIST)
+  Released under the MIT license. See accompanying file 'LICENSE' for more information.
+*/
+
+/**
+   This program measures the time of each call of the dynamics and kinematics functions of
+   the Body library with the sample robots and writes the percentiles of the times as JSON
+   so that the results can be compared between the releases and the compiler options.
+*/
+
+#include <cnoid/Config>
+#include <cnoid/BodyLoader>
+#include <cnoid/DyWorld>
+#include <cnoid/DyBody>
+#include <cnoid/ForwardDynamicsABM>
+#include <cnoid/ForwardDynamicsCBM>
+#include <cnoid/ConstraintForceSolver>
+#include <cnoid/LinkTraverse>
+#include <cnoid/JointPath>
+#include <cnoid/PinDragIK>
+#include <cnoid/MassMatrix>
+#include <cnoid/InverseDynamics>
+#include <cnoid/EigenUtil>
+#include <cnoid/BoundingBox>
+#include <cnoid/SceneGraph>
+#include <cnoid/ExecutablePath>
+#include <cnoid/TimeMeasure>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+using namespace cnoid;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+struct Result
+{
+    string name;
+    string model;
+    vector<double> times;
+};
+
+vector<Result> results;
+int numCalls = 1000;
+BodyLoader bodyLoader;
+const double timeStep = 0.001;
+const Vector3 gravity(0.0, 0.0, -9.80665);
+
+
+void doNothing() { }
+
+/**
+   The time of each call of func is measured. The functions given by before and after are
+   called before and after each call of func without the measurement to prepare and
+   advance the state.
+*/
+void measure(const string& name, const string& model, boost::function<void()> func,
+             boost::function<void()> before = doNothing, boost::function<void()> after = doNothing)
+{
+    results.push_back(Result());
+    Result& result = results.back();
+    result.name = name;
+    result.model = model;
+    result.times.reserve(numCalls);
+
+    TimeMeasure timer;
+    for(int i=0; i < numCalls; ++i){
+        before();
+        timer.begin();
+        func();
+        timer.end();
+        after();
+        result.times.push_back(timer.time());
+    }
+
+    cout << name << " (" << model << "): " << timer.avarageTime() * 1.0e6 << " [us]" << endl;
+}
+
+
+double percentile(vector<double>& times, double ratio)
+{
+    const size_t index = std::min(times.size() - 1, (size_t)(ratio * (times.size() - 1) + 0.5));
+    std::nth_element(times.begin(), times.begin() + index, times.end());
+    return times[index];
+}
+
+
+string escapeJsonString(const string& s)
+{
+    string escaped;
+    for(size_t i=0; i < s.size(); ++i){
+        const char c = s[i];
+        if(c == '"' || c == '\\'){
+            escaped += '\\';
+            escaped += c;
+        } else if(static_cast<unsigned char>(c) < 0x20){
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            escaped += buf;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+
+void writeResults(ostream& os)
+{
+    os << "{\n";
+    os << "  \"version\": \"" << CNOID_FULL_VERSION_STRING << "\",\n";
+#ifdef BENCHMARK_BUILD_TYPE
+    os << "  \"buildType\": \"" << escapeJsonString(BENCHMARK_BUILD_TYPE) << "\",\n";
+#endif
+#ifdef BENCHMARK_CXX_FLAGS
+    os << "  \"cxxFlags\": \"" << escapeJsonString(BENCHMARK_CXX_FLAGS) << "\",\n";
+#endif
+#ifdef __VERSION__
+    os << "  \"compiler\": \"" << escapeJsonString(__VERSION__) << "\",\n";
+#endif
+    os << "  \"numCalls\": " << numCalls << ",\n";
+    os << "  \"results\": [";
+
+    for(size_t i=0; i < results.size(); ++i){
+        Result& result = results[i];
+        vector<double>& times = result.times;
+        double sum = 0.0;
+        for(size_t j=0; j < times.size(); ++j){
+            sum += times[j];
+        }
+        os << ((i == 0) ? "\n" : ",\n");
+        os << "    { \"name\": \"" << escapeJsonString(result.name) << "\""
+           << ", \"model\": \"" << escapeJsonString(result.model) << "\""
+           << ", \"unit\": \"us\""
+           << ", \"mean\": " << sum / times.size() * 1.0e6
+           << ", \"min\": " << percentile(times, 0.0) * 1.0e6
+           << ", \"p50\": " << percentile(times, 0.5) * 1.0e6
+           << ", \"p90\": " << percentile(times, 0.9) * 1.0e6
+           << ", \"p99\": " << percentile(times, 0.99) * 1.0e6
+           << ", \"max\": " << percentile(times, 1.0) * 1.0e6 << " }";
+    }
+    os << "\n  ]\n}\n";
+}
+
+
+DyBodyPtr loadBody(const string& filename)
+{
+    DyBodyPtr body = new DyBody;
+    if(!bodyLoader.load(body, filename)){
+        cerr << filename << " cannot be loaded." << endl;
+        return 0;
+    }
+    body->calcForwardKinematics();
+    return body;
+}
+
+
+BoundingBox calcBodyBoundingBox(Body* body)
+{
+    BoundingBox bbox;
+    for(int i=0; i < body->numLinks(); ++i){
+        Link* link = body->link(i);
+        if(link->collisionShape()){
+            BoundingBox linkBBox = link->collisionShape()->boundingBox();
+            linkBBox.transform(Affine3(link->T()));
+            bbox.expandBy(linkBBox);
+        }
+    }
+    return bbox;
+}
+
+
+//! Moves the body vertically so that its lowest point touches the height
+void putBodyOn(Body* body, double height)
+{
+    const BoundingBox bbox = calcBodyBoundingBox(body);
+    if(!bbox.empty()){
+        body->rootLink()->p().z() += height - bbox.min().z();
+        body->calcForwardKinematics();
+    }
+}
+
+
+//! The end link whose path from the root link is the longest
+Link* findDeepestEndLink(Body* body, Link* excludedEndLink = 0)
+{
+    Link* deepest = 0;
+    int maxDepth = -1;
+    for(int i=0; i < body->numLinks(); ++i){
+        Link* link = body->link(i);
+        if(link->child() || link == excludedEndLink){
+            continue;
+        }
+        int depth = 0;
+        for(Link* l = link; l->parent(); l = l->parent()){
+            ++depth;
+        }
+        if(depth > maxDepth){
+            deepest = link;
+            maxDepth = depth;
+        }
+    }
+    return deepest;
+}
+
+
+class BodyState
+{
+public:
+    BodyState(Body* body) : body(body) {
+        p = body->rootLink()->p();
+        R = body->rootLink()->R();
+        const int n = body->numJoints();
+        q.resize(n);
+        for(int i=0; i < n; ++i){
+            q[i] = body->joint(i)->q();
+        }
+    }
+    void restore() {
+        body->rootLink()->p() = p;
+        body->rootLink()->R() = R;
+        body->rootLink()->v().setZero();
+        body->rootLink()->w().setZero();
+        for(size_t i=0; i < q.size(); ++i){
+            Link* joint = body->joint(i);
+            joint->q() = q[i];
+            joint->dq() = 0.0;
+            joint->ddq() = 0.0;
+        }
+        body->calcForwardKinematics();
+    }
+private:
+    Body* body;
+    Vector3 p;
+    Matrix3 R;
+    vector<double> q;
+};
+
+
+void calcMassMatrixOf(Body* body, MatrixXd* M)
+{
+    calcMassMatrix(body, gravity, *M);
+}
+
+
+void calcInverseDynamicsOf(Body* body)
+{
+    calcInverseDynamics(body->rootLink());
+}
+
+
+void benchmarkKinematics(const string& model, Body* body)
+{
+    // A posture whose joint velocities and accelerations are not zero
+    for(int i=0; i < body->numJoints(); ++i){
+        Link* joint = body->joint(i);
+        joint->q() = 0.1 * ((i % 3) - 1);
+        joint->dq() = 0.2;
+        joint->ddq() = 0.3;
+    }
+    body->calcForwardKinematics(true, true);
+
+    LinkTraverse traverse(body->rootLink());
+    measure("LinkTraverse::calcForwardKinematics", model,
+            boost::bind(&LinkTraverse::calcForwardKinematics, &traverse, true, true));
+
+    MatrixXd M;
+    measure("calcMassMatrix", model, boost::bind(calcMassMatrixOf, body, &M));
+
+    measure("calcInverseDynamics", model, boost::bind(calcInverseDynamicsOf, body));
+}
+
+
+void setTargetPosture(Body* body, const JointPath& path, Vector3& out_p, Matrix3& out_R)
+{
+    for(int i=0; i < path.numJoints(); ++i){
+        path.joint(i)->q() += (i % 2) ? 0.3 : -0.2;
+    }
+    body->calcForwardKinematics();
+    out_p = path.endLink()->p();
+    out_R = path.endLink()->R();
+}
+
+
+bool solveIK(JointPath* path, const Vector3* p, const Matrix3* R)
+{
+    return path->calcInverseKinematics(*p, *R);
+}
+
+
+bool solvePinDragIK(PinDragIK* ik, const Vector3* p, const Matrix3* R)
+{
+    return ik->calcInverseKinematics(*p, *R);
+}
+
+
+void benchmarkInverseKinematics(const string& model, Body* body)
+{
+    for(int i=0; i < body->numJoints(); ++i){
+        body->joint(i)->q() = 0.0;
+    }
+    body->calcForwardKinematics();
+    BodyState initialState(body);
+
+    // The targets are given by the forward kinematics so that they are reachable
+    Link* endLink = findDeepestEndLink(body);
+    JointPath path(body->rootLink(), endLink);
+    Vector3 p;
+    Matrix3 R;
+    setTargetPosture(body, path, p, R);
+    initialState.restore();
+
+    measure("JointPath::calcInverseKinematics", model,
+            boost::bind(solveIK, &path, &p, &R),
+            boost::bind(&BodyState::restore, &initialState));
+
+    // The end link is dragged with another end link pinned
+    Link* pinnedLink = findDeepestEndLink(body, endLink);
+    PinDragIK ik(body);
+    ik.setBaseLink(body->rootLink());
+    ik.setTargetLink(endLink, true);
+    if(pinnedLink){
+        ik.setPin(pinnedLink, InverseKinematics::TRANSFORM_6D);
+    }
+    if(!ik.initialize()){
+        cerr << "PinDragIK cannot be initialized for " << model << "." << endl;
+        return;
+    }
+    const Vector3 dragged_p = endLink->p() + Vector3(0.02, 0.02, 0.02);
+    const Matrix3 dragged_R = endLink->R();
+
+    measure("PinDragIK::calcInverseKinematics", model,
+            boost::bind(solvePinDragIK, &ik, &dragged_p, &dragged_R),
+            boost::bind(&BodyState::restore, &initialState));
+}
+
+
+void benchmarkForwardDynamics(const string& model, const string& filename)
+{
+    DyBodyPtr body = loadBody(filename);
+    boost::shared_ptr<ForwardDynamicsABM> abm = make_shared_aligned<ForwardDynamicsABM>(body.get());
+    abm->setGravityAcceleration(gravity);
+    abm->setTimeStep(timeStep);
+    abm->setRungeKuttaMethod();
+    abm->enableSensors(true);
+    abm->initialize();
+    measure("ForwardDynamicsABM::calcNextState", model,
+            boost::bind(&ForwardDynamicsABM::calcNextState, abm.get()));
+
+    body = loadBody(filename);
+    boost::shared_ptr<ForwardDynamicsCBM> cbm = make_shared_aligned<ForwardDynamicsCBM>(body.get());
+    cbm->setHighGainModeForAllJoints();
+    cbm->setGravityAcceleration(gravity);
+    cbm->setTimeStep(timeStep);
+    cbm->setRungeKuttaMethod();
+    cbm->enableSensors(true);
+    cbm->initialize();
+    measure("ForwardDynamicsCBM::calcNextState", model,
+            boost::bind(&ForwardDynamicsCBM::calcNextState, cbm.get()));
+}
+
+
+void prepareConstraintForceSolving(World<ConstraintForceSolver>* world)
+{
+    world->constraintForceSolver.clearExternalForces();
+    world->setVirtualJointForces();
+}
+
+
+void calcForwardDynamicsOfWorld(World<ConstraintForceSolver>* world)
+{
+    world->WorldBase::calcNextState();
+}
+
+
+void runWorld(World<ConstraintForceSolver>& world, int numSteps)
+{
+    for(int i=0; i < numSteps; ++i){
+        world.constraintForceSolver.clearExternalForces();
+        world.calcNextState();
+    }
+}
+
+
+void initializeWorld(World<ConstraintForceSolver>& world, DyBody* floor)
+{
+    world.setGravityAcceleration(gravity);
+    world.setTimeStep(timeStep);
+    world.setRungeKuttaMethod();
+    world.setCurrentTime(0.0);
+    world.addBody(floor);
+}
+
+
+void measureConstraintForceSolving(const string& scenario, World<ConstraintForceSolver>& world)
+{
+    world.initialize();
+
+    // The contacts are settled before the measurement
+    runWorld(world, 200);
+
+    measure("ConstraintForceSolver::solve", scenario,
+            boost::bind(&ConstraintForceSolver::solve, &world.constraintForceSolver),
+            boost::bind(prepareConstraintForceSolving, &world),
+            boost::bind(calcForwardDynamicsOfWorld, &world));
+}
+
+
+/**
+   The robot stands on the floor with the joints in the high-gain mode
+*/
+void benchmarkStandingRobot(const string& model, const string& filename, const string& floorFile)
+{
+    DyBodyPtr floor = loadBody(floorFile);
+    DyBodyPtr robot = loadBody(filename);
+    if(!floor || !robot){
+        return;
+    }
+    putBodyOn(robot, calcBodyBoundingBox(floor).max().z());
+
+    World<ConstraintForceSolver> world;
+    initializeWorld(world, floor);
+    boost::shared_ptr<ForwardDynamicsCBM> cbm = make_shared_aligned<ForwardDynamicsCBM>(robot.get());
+    cbm->setHighGainModeForAllJoints();
+    world.addBody(robot, cbm);
+
+    measureConstraintForceSolving(model + " standing", world);
+}
+
+
+void benchmarkBoxStack(const string& boxFile, const string& floorFile, int numBoxes)
+{
+    DyBodyPtr floor = loadBody(floorFile);
+    if(!floor){
+        return;
+    }
+    World<ConstraintForceSolver> world;
+    initializeWorld(world, floor);
+
+    double height = calcBodyBoundingBox(floor).max().z();
+    for(int i=0; i < numBoxes; ++i){
+        DyBodyPtr box = loadBody(boxFile);
+        if(!box){
+            return;
+        }
+        // The boxes are crossed alternately as the blocks of a tower
+        if(i % 2){
+            box->rootLink()->R() = AngleAxis(PI / 2.0, Vector3::UnitZ()).toRotationMatrix();
+            box->calcForwardKinematics();
+        }
+        putBodyOn(box, height);
+        height = calcBodyBoundingBox(box).max().z();
+        world.addBody(box);
+    }
+
+    char scenario[64];
+    snprintf(scenario, sizeof(scenario), "box stack %d", numBoxes);
+    measureConstraintForceSolving(scenario, world);
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    string outputFile;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("calls,n", po::value<int>(&numCalls)->default_value(1000), "Number of the measured calls of each function")
+        ("output,o", po::value<string>(&outputFile), "JSON file to output the result (standard output by default)")
+        ("share-dir", po::value<string>(), "Share directory containing the model files")
+        ("help,h", "Show this help");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, options), vm);
+        po::notify(vm);
+    } catch(const po::error& ex){
+        cerr << ex.what() << endl;
+        return 1;
+    }
+    if(vm.count("help")){
+        cout << options << endl;
+        return 0;
+    }
+    if(numCalls <= 0){
+        cerr << "The number of the calls must be positive." << endl;
+        return 1;
+    }
+
+    const filesystem::path modelDir =
+        filesystem::path(vm.count("share-dir") ? vm["share-dir"].as<string>() : shareDirectory()) / "model";
+
+    bodyLoader.setMessageSink(cerr);
+
+    static const char* models[][2] = {
+        { "SR1", "SR1/SR1.body" },
+        { "GR001", "GR001/GR001.body" },
+        { 0, 0 }
+    };
+    const string floorFile = (modelDir / "misc" / "floor.wrl").string();
+
+    for(int i=0; models[i][0]; ++i){
+        const string model = models[i][0];
+        const string filename = (modelDir / models[i][1]).string();
+        DyBodyPtr body = loadBody(filename);
+        if(!body){
+            continue;
+        }
+        benchmarkKinematics(model, body);
+        benchmarkInverseKinematics(model, body);
+        benchmarkForwardDynamics(model, filename);
+        benchmarkStandingRobot(model, filename, floorFile);
+    }
+    benchmarkBoxStack((modelDir / "misc" / "box1.wrl").string(), floorFile, 10);
+
+    if(outputFile.empty()){
+        writeResults(cout);
+    } else {
+        ofstream ofs(outputFile.c_str());
+        if(!ofs){
+            cerr << outputFile << " cannot be opened." << endl;
+            return 1;
+        }
+        writeResults(ofs);
+    }
+
+    return 0;
+}
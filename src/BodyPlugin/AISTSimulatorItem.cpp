@@ -12,6 +12,7 @@
 #include "AISTSimulatorItem.h"
 #include "BodyItem.h"
 #include "ControllerItem.h"
+#include "SimulationCommandQueue.h"
 #include <cnoid/ItemManager>
 #include <cnoid/Archive>
 #include <cnoid/EigenArchive>
@@ -19,6 +20,8 @@
 #include <cnoid/DyBody>
 #include <cnoid/ForwardDynamicsCBM>
 #include <cnoid/ConstraintForceSolver>
+#include <cnoid/ColdetModel>
+#include <cnoid/AISTCollisionDetector>
 #include <cnoid/LeggedBodyHelper>
 #include <cnoid/FloatingNumberString>
 #include <cnoid/EigenUtil>
@@ -71,6 +74,41 @@ public:
     LinkTraverse traverse;
 };
 
+
+/**
+   The variables of the links which are not stored by SimulatorItem. The articulated body
+   inertias and the bias forces must also be stored because they are calculated for the
+   next step at the end of a step and the constraint force solver uses them.
+*/
+struct DyLinkState
+{
+    Vector3 vo;
+    Vector3 dvo;
+    Vector3 sw;
+    Vector3 sv;
+    Vector3 cv;
+    Vector3 cw;
+    Matrix3 Iww;
+    Matrix3 Iwv;
+    Matrix3 Ivv;
+    Vector3 pf;
+    Vector3 ptau;
+    Vector3 hhv;
+    Vector3 hhw;
+    double uu;
+    double dd;
+};
+
+
+class AISTSimulationState : public Referenced
+{
+public:
+    double time;
+    // The states of all the links in the world
+    vector<DyLinkState> links;
+    ReferencedPtr constraintForceSolverState;
+};
+
 }
 
 
@@ -96,10 +134,22 @@ public:
     int maxNumIterations;
     FloatingNumberString contactCorrectionDepth;
     FloatingNumberString contactCorrectionVelocityRatio;
+    FloatingNumberString speculativeContactMargin;
     double epsilon;
     bool is2Dmode;
     bool isKinematicWalkingEnabled;
     bool isOldAccelSensorMode;
+    int numDynamicsThreads;
+    bool isContactIslandMode;
+    bool isBlockSparseMatrixMode;
+    bool isContactWarmStartMode;
+    bool isSleepingMode;
+    double sleepingLinearVelocity;
+    double sleepingAngularVelocity;
+    double sleepingTime;
+    bool isPackedLinkWorkspaceMode;
+    bool isCollisionTreeCacheMode;
+    bool isPrimitiveCollisionMode;
 
     typedef std::map<Body*, int> BodyIndexMap;
     BodyIndexMap bodyIndexMap;
@@ -117,16 +167,28 @@ public:
     typedef std::map<IdPair<Link*>, ContactAttribute> ContactAttributeMap;
     ContactAttributeMap contactAttributeMap;
 
-    boost::optional<int> forcedBodyPositionFunctionId;
-    boost::mutex forcedBodyPositionMutex;
+    // A null body means clearing the forced position
+    struct ForcedPositionCommand {
+        DyBody* body;
+        Vector3 p;
+        Matrix3 R;
+    };
+    SimulationCommandQueue<ForcedPositionCommand> forcedPositionCommandQueue;
+
+    // This is only accessed by the main thread
     DyBody* forcedPositionBody;
-    Position forcedBodyPosition;
+
+    // This is only accessed by the simulation thread
+    ForcedPositionCommand currentForcedPosition;
 
     AISTSimulatorItemImpl(AISTSimulatorItem* self);
     AISTSimulatorItemImpl(AISTSimulatorItem* self, const AISTSimulatorItemImpl& org);
     ContactAttribute& getOrCreateContactAttribute(Link* link1, Link* link2);
     bool initializeSimulation(const std::vector<SimulationBody*>& simBodies);
+    void setWorldParameters(World<ConstraintForceSolver>& world, double timeStep);
+    void setCollisionDetector(World<ConstraintForceSolver>& world, CollisionDetectorPtr collisionDetector);
     void addBody(AISTSimBody* simBody);
+    int addBodyToWorld(World<ConstraintForceSolver>& world, DyBody* body);
     void clearExternalForces();
     void setForcedPosition(BodyItem* bodyItem, const Position& T);
     void doSetForcedPosition();
@@ -167,6 +229,7 @@ AISTSimulatorItemImpl::AISTSimulatorItemImpl(AISTSimulatorItem* self)
     integrationMode.setSymbol(AISTSimulatorItem::EULER_INTEGRATION,  N_("Euler"));
     integrationMode.setSymbol(AISTSimulatorItem::RUNGE_KUTTA_INTEGRATION,  N_("Runge Kutta"));
     integrationMode.select(AISTSimulatorItem::RUNGE_KUTTA_INTEGRATION);
+    forcedPositionBody = 0;
     
     gravity << 0.0, 0.0, -DEFAULT_GRAVITY_ACCELERATION;
 
@@ -181,10 +244,22 @@ AISTSimulatorItemImpl::AISTSimulatorItemImpl(AISTSimulatorItem* self)
     maxNumIterations = cfs.gaussSeidelMaxNumIterations();
     contactCorrectionDepth = cfs.contactCorrectionDepth();
     contactCorrectionVelocityRatio = cfs.contactCorrectionVelocityRatio();
+    speculativeContactMargin = cfs.speculativeContactMargin();
 
     isKinematicWalkingEnabled = false;
     is2Dmode = false;
     isOldAccelSensorMode = false;
+    numDynamicsThreads = 0;
+    isContactIslandMode = false;
+    isBlockSparseMatrixMode = false;
+    isContactWarmStartMode = false;
+    isSleepingMode = false;
+    sleepingLinearVelocity = 0.005;
+    sleepingAngularVelocity = 0.02;
+    sleepingTime = 0.5;
+    isPackedLinkWorkspaceMode = false;
+    isCollisionTreeCacheMode = false;
+    isPrimitiveCollisionMode = false;
 }
 
 
@@ -201,6 +276,7 @@ AISTSimulatorItemImpl::AISTSimulatorItemImpl(AISTSimulatorItem* self, const AIST
       dynamicsMode(org.dynamicsMode),
       integrationMode(org.integrationMode)
 {
+    forcedPositionBody = 0;
     gravity = org.gravity;
     staticFriction = org.staticFriction;
     slipFriction = org.slipFriction;
@@ -210,10 +286,22 @@ AISTSimulatorItemImpl::AISTSimulatorItemImpl(AISTSimulatorItem* self, const AIST
     maxNumIterations = org.maxNumIterations;
     contactCorrectionDepth = org.contactCorrectionDepth;
     contactCorrectionVelocityRatio = org.contactCorrectionVelocityRatio;
+    speculativeContactMargin = org.speculativeContactMargin;
     epsilon = org.epsilon;
     isKinematicWalkingEnabled = org.isKinematicWalkingEnabled;
     is2Dmode = org.is2Dmode;
     isOldAccelSensorMode = org.isOldAccelSensorMode;
+    numDynamicsThreads = org.numDynamicsThreads;
+    isContactIslandMode = org.isContactIslandMode;
+    isBlockSparseMatrixMode = org.isBlockSparseMatrixMode;
+    isContactWarmStartMode = org.isContactWarmStartMode;
+    isSleepingMode = org.isSleepingMode;
+    sleepingLinearVelocity = org.sleepingLinearVelocity;
+    sleepingAngularVelocity = org.sleepingAngularVelocity;
+    sleepingTime = org.sleepingTime;
+    isPackedLinkWorkspaceMode = org.isPackedLinkWorkspaceMode;
+    isCollisionTreeCacheMode = org.isCollisionTreeCacheMode;
+    isPrimitiveCollisionMode = org.isPrimitiveCollisionMode;
 }
 
 
@@ -330,6 +418,12 @@ void AISTSimulatorItem::setContactCorrectionVelocityRatio(double value)
 }
 
 
+void AISTSimulatorItem::setSpeculativeContactMargin(double margin)
+{
+    impl->speculativeContactMargin = margin;
+}
+
+
 void AISTSimulatorItem::setEpsilon(double epsilon)
 {
     impl->epsilon = epsilon;
@@ -354,6 +448,62 @@ void AISTSimulatorItem::setConstraintForceOutputEnabled(bool on)
 }
 
 
+void AISTSimulatorItem::setNumDynamicsThreads(int n)
+{
+    impl->numDynamicsThreads = std::max(0, n);
+}
+
+
+void AISTSimulatorItem::setContactIslandMode(bool on)
+{
+    impl->isContactIslandMode = on;
+}
+
+
+void AISTSimulatorItem::setBlockSparseMatrixMode(bool on)
+{
+    impl->isBlockSparseMatrixMode = on;
+}
+
+
+void AISTSimulatorItem::setContactWarmStartMode(bool on)
+{
+    impl->isContactWarmStartMode = on;
+}
+
+
+void AISTSimulatorItem::setSleepingMode(bool on)
+{
+    impl->isSleepingMode = on;
+}
+
+
+void AISTSimulatorItem::setSleepingThresholds(double linearVelocity, double angularVelocity, double time)
+{
+    impl->sleepingLinearVelocity = linearVelocity;
+    impl->sleepingAngularVelocity = angularVelocity;
+    impl->sleepingTime = time;
+}
+
+
+void AISTSimulatorItem::setPackedLinkWorkspaceMode(bool on)
+{
+    impl->isPackedLinkWorkspaceMode = on;
+}
+
+
+void AISTSimulatorItem::setCollisionTreeCacheMode(bool on)
+{
+    impl->isCollisionTreeCacheMode = on;
+}
+
+
+void AISTSimulatorItem::setPrimitiveCollisionMode(bool on)
+{
+    impl->isPrimitiveCollisionMode = on;
+}
+
+
 Item* AISTSimulatorItem::doDuplicate() const
 {
     return new AISTSimulatorItem(*this);
@@ -405,26 +555,15 @@ bool AISTSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBod
         os << setprecision(30);
     }
 
-    if(integrationMode.is(AISTSimulatorItem::EULER_INTEGRATION)){
-        world.setEulerMethod();
-    } else if(integrationMode.is(AISTSimulatorItem::RUNGE_KUTTA_INTEGRATION)){
-        world.setRungeKuttaMethod();
-    }
-    world.setGravityAcceleration(gravity);
-    world.enableSensors(true);
-    world.setOldAccelSensorCalcMode(isOldAccelSensorMode);
-    world.setTimeStep(self->worldTimeStep());
-    world.setCurrentTime(0.0);
-
-    ConstraintForceSolver& cfs = world.constraintForceSolver;
-
-    cfs.setGaussSeidelErrorCriterion(errorCriterion.value());
-    cfs.setGaussSeidelMaxNumIterations(maxNumIterations);
-    cfs.setContactDepthCorrection(
-        contactCorrectionDepth.value(), contactCorrectionVelocityRatio.value());
+    setWorldParameters(world, self->worldTimeStep());
 
     self->addPreDynamicsFunction(boost::bind(&AISTSimulatorItemImpl::clearExternalForces, this));
 
+    forcedPositionCommandQueue.clear();
+    forcedPositionBody = 0;
+    currentForcedPosition.body = 0;
+    self->addPostDynamicsFunction(boost::bind(&AISTSimulatorItemImpl::doSetForcedPosition, this));
+
     world.clearBodies();
     bodyIndexMap.clear();
 
@@ -432,16 +571,10 @@ bool AISTSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBod
         addBody(static_cast<AISTSimBody*>(simBodies[i]));
     }
 
-    cfs.setFriction(staticFriction, slipFriction);
-    cfs.setContactCullingDistance(contactCullingDistance.value());
-    cfs.setContactCullingDepth(contactCullingDepth.value());
-    cfs.setCoefficientOfRestitution(epsilon);
-    cfs.setCollisionDetector(self->collisionDetector());
-
-    if(is2Dmode){
-        cfs.set2Dmode(true);
-    }
+    setCollisionDetector(world, self->collisionDetector());
+    ConstraintForceSolver& cfs = world.constraintForceSolver;
 
+    world.setProfiler(self->profiler());
     world.initialize();
 
     ContactAttributeMap::iterator iter = contactAttributeMap.begin();
@@ -482,10 +615,84 @@ bool AISTSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBod
 }
 
 
+void AISTSimulatorItemImpl::setWorldParameters(World<ConstraintForceSolver>& world, double timeStep)
+{
+    if(integrationMode.is(AISTSimulatorItem::EULER_INTEGRATION)){
+        world.setEulerMethod();
+    } else if(integrationMode.is(AISTSimulatorItem::RUNGE_KUTTA_INTEGRATION)){
+        world.setRungeKuttaMethod();
+    }
+    world.setGravityAcceleration(gravity);
+    world.enableSensors(true);
+    world.setOldAccelSensorCalcMode(isOldAccelSensorMode);
+    world.setTimeStep(timeStep);
+    world.setCurrentTime(0.0);
+    world.setNumThreads(numDynamicsThreads);
+    world.enablePackedLinkWorkspace(isPackedLinkWorkspaceMode);
+
+    ColdetModel::setTreeCacheDirectory(
+        isCollisionTreeCacheMode ? ColdetModel::defaultTreeCacheDirectory() : string());
+
+    ConstraintForceSolver& cfs = world.constraintForceSolver;
+
+    cfs.setGaussSeidelErrorCriterion(errorCriterion.value());
+    cfs.setGaussSeidelMaxNumIterations(maxNumIterations);
+    cfs.setContactDepthCorrection(
+        contactCorrectionDepth.value(), contactCorrectionVelocityRatio.value());
+    cfs.setSpeculativeContactMargin(speculativeContactMargin.value());
+    cfs.enableIslandDecomposition(isContactIslandMode);
+    cfs.enableBlockSparseMatrix(isBlockSparseMatrixMode);
+    cfs.enableContactWarmStart(isContactWarmStartMode);
+    cfs.enableSleeping(isSleepingMode);
+    cfs.setSleepingThresholds(sleepingLinearVelocity, sleepingAngularVelocity, sleepingTime);
+
+    cfs.setFriction(staticFriction, slipFriction);
+    cfs.setContactCullingDistance(contactCullingDistance.value());
+    cfs.setContactCullingDepth(contactCullingDepth.value());
+    cfs.setCoefficientOfRestitution(epsilon);
+
+    if(is2Dmode){
+        cfs.set2Dmode(true);
+    }
+}
+
+
+void AISTSimulatorItem::initializeWorld
+(World<ConstraintForceSolver>& world, const std::vector<DyBodyPtr>& bodies,
+ CollisionDetectorPtr collisionDetector, double timeStep)
+{
+    impl->setWorldParameters(world, timeStep);
+
+    world.clearBodies();
+    for(size_t i=0; i < bodies.size(); ++i){
+        impl->addBodyToWorld(world, bodies[i]);
+    }
+    impl->setCollisionDetector(world, collisionDetector);
+
+    world.initialize();
+}
+
+
+void AISTSimulatorItemImpl::setCollisionDetector
+(World<ConstraintForceSolver>& world, CollisionDetectorPtr collisionDetector)
+{
+    AISTCollisionDetector* aistCollisionDetector = dynamic_cast<AISTCollisionDetector*>(collisionDetector.get());
+    if(aistCollisionDetector){
+        aistCollisionDetector->enablePrimitiveCollision(isPrimitiveCollisionMode);
+    }
+    world.constraintForceSolver.setCollisionDetector(collisionDetector);
+}
+
+
 void AISTSimulatorItemImpl::addBody(AISTSimBody* simBody)
 {
     DyBody* body = static_cast<DyBody*>(simBody->body());
+    bodyIndexMap[body] = addBodyToWorld(world, body);
+}
 
+
+int AISTSimulatorItemImpl::addBodyToWorld(World<ConstraintForceSolver>& world, DyBody* body)
+{
     DyLink* rootLink = body->rootLink();
     rootLink->v().setZero();
     rootLink->dv().setZero();
@@ -512,7 +719,7 @@ void AISTSimulatorItemImpl::addBody(AISTSimBody* simBody)
     } else {
         bodyIndex = world.addBody(body);
     }
-    bodyIndexMap[body] = bodyIndex;
+    return bodyIndex;
 }
 
 
@@ -586,6 +793,80 @@ CollisionLinkPairListPtr AISTSimulatorItem::getCollisions()
 }
 
 
+void AISTSimulatorItem::getContacts(ContactBuffer& out_contacts)
+{
+    impl->world.constraintForceSolver.getContacts(out_contacts);
+}
+
+
+ReferencedPtr AISTSimulatorItem::storeSimulationState()
+{
+    World<ConstraintForceSolver>& world = impl->world;
+    AISTSimulationState* state = new AISTSimulationState;
+    state->time = world.currentTime();
+    for(int i=0; i < world.numBodies(); ++i){
+        DyBody* body = world.body(i);
+        for(int j=0; j < body->numLinks(); ++j){
+            DyLink* link = body->link(j);
+            state->links.push_back(DyLinkState());
+            DyLinkState& ls = state->links.back();
+            ls.vo = link->vo();
+            ls.dvo = link->dvo();
+            ls.sw = link->sw();
+            ls.sv = link->sv();
+            ls.cv = link->cv();
+            ls.cw = link->cw();
+            ls.Iww = link->Iww();
+            ls.Iwv = link->Iwv();
+            ls.Ivv = link->Ivv();
+            ls.pf = link->pf();
+            ls.ptau = link->ptau();
+            ls.hhv = link->hhv();
+            ls.hhw = link->hhw();
+            ls.uu = link->uu();
+            ls.dd = link->dd();
+        }
+    }
+    state->constraintForceSolverState = world.constraintForceSolver.storeState();
+    return state;
+}
+
+
+void AISTSimulatorItem::restoreSimulationState(const Referenced* state)
+{
+    const AISTSimulationState* aistState = dynamic_cast<const AISTSimulationState*>(state);
+    if(!aistState){
+        return;
+    }
+    World<ConstraintForceSolver>& world = impl->world;
+    world.setCurrentTime(aistState->time);
+    size_t index = 0;
+    for(int i=0; i < world.numBodies(); ++i){
+        DyBody* body = world.body(i);
+        for(int j=0; j < body->numLinks() && index < aistState->links.size(); ++j){
+            DyLink* link = body->link(j);
+            const DyLinkState& ls = aistState->links[index++];
+            link->vo() = ls.vo;
+            link->dvo() = ls.dvo;
+            link->sw() = ls.sw;
+            link->sv() = ls.sv;
+            link->cv() = ls.cv;
+            link->cw() = ls.cw;
+            link->Iww() = ls.Iww;
+            link->Iwv() = ls.Iwv;
+            link->Ivv() = ls.Ivv;
+            link->pf() = ls.pf;
+            link->ptau() = ls.ptau;
+            link->hhv() = ls.hhv;
+            link->hhw() = ls.hhw;
+            link->uu() = ls.uu;
+            link->dd() = ls.dd;
+        }
+    }
+    world.constraintForceSolver.restoreState(aistState->constraintForceSolverState);
+}
+
+
 void AISTSimulatorItem::setForcedPosition(BodyItem* bodyItem, const Position& T)
 {
     impl->setForcedPosition(bodyItem, T);
@@ -595,16 +876,12 @@ void AISTSimulatorItem::setForcedPosition(BodyItem* bodyItem, const Position& T)
 void AISTSimulatorItemImpl::setForcedPosition(BodyItem* bodyItem, const Position& T)
 {
     if(SimulationBody* simBody = self->findSimulationBody(bodyItem)){
-        {
-            boost::unique_lock<boost::mutex> lock(forcedBodyPositionMutex);
-            forcedPositionBody = static_cast<DyBody*>(simBody->body());
-            forcedBodyPosition = T;
-        }
-        if(!forcedBodyPositionFunctionId){
-            forcedBodyPositionFunctionId =
-                self->addPostDynamicsFunction(
-                    boost::bind(&AISTSimulatorItemImpl::doSetForcedPosition, this));
-        }
+        ForcedPositionCommand command;
+        command.body = static_cast<DyBody*>(simBody->body());
+        command.p = T.translation();
+        command.R = T.linear();
+        forcedPositionCommandQueue.post(command);
+        forcedPositionBody = command.body;
     }
 }
 
@@ -612,13 +889,10 @@ void AISTSimulatorItemImpl::setForcedPosition(BodyItem* bodyItem, const Position
 bool AISTSimulatorItem::isForcedPositionActiveFor(BodyItem* bodyItem) const
 {
     bool isActive = false;
-    if(impl->forcedBodyPositionFunctionId){
+    if(impl->forcedPositionBody){
         SimulationBody* simBody = const_cast<AISTSimulatorItem*>(this)->findSimulationBody(bodyItem);
-        {
-            boost::unique_lock<boost::mutex> lock(impl->forcedBodyPositionMutex);
-            if(impl->forcedPositionBody == static_cast<DyBody*>(simBody->body())){
-                isActive = true;
-            }
+        if(simBody && impl->forcedPositionBody == static_cast<DyBody*>(simBody->body())){
+            isActive = true;
         }
     }
     return isActive;
@@ -627,22 +901,30 @@ bool AISTSimulatorItem::isForcedPositionActiveFor(BodyItem* bodyItem) const
 
 void AISTSimulatorItem::clearForcedPositions()
 {
-    if(impl->forcedBodyPositionFunctionId){
-        removePostDynamicsFunction(*impl->forcedBodyPositionFunctionId);
-        impl->forcedBodyPositionFunctionId = boost::none;
+    if(impl->forcedPositionBody){
+        AISTSimulatorItemImpl::ForcedPositionCommand command;
+        command.body = 0;
+        impl->forcedPositionCommandQueue.post(command);
+        impl->forcedPositionBody = 0;
     }
 }
     
 
 void AISTSimulatorItemImpl::doSetForcedPosition()
 {
-    boost::unique_lock<boost::mutex> lock(forcedBodyPositionMutex);
-    DyLink* rootLink = forcedPositionBody->rootLink();
-    rootLink->setPosition(forcedBodyPosition);
-    rootLink->v().setZero();
-    rootLink->w().setZero();
-    rootLink->vo().setZero();
-    forcedPositionBody->calcSpatialForwardKinematics();
+    ForcedPositionCommand command;
+    while(forcedPositionCommandQueue.pop(command)){
+        currentForcedPosition = command;
+    }
+    DyBody* body = currentForcedPosition.body;
+    if(body){
+        DyLink* rootLink = body->rootLink();
+        rootLink->setPosition(currentForcedPosition.R, currentForcedPosition.p);
+        rootLink->v().setZero();
+        rootLink->w().setZero();
+        rootLink->vo().setZero();
+        body->calcSpatialForwardKinematics();
+    }
 }
 
 
@@ -674,10 +956,24 @@ void AISTSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
                 boost::bind(&FloatingNumberString::setNonNegativeValue, boost::ref(contactCorrectionDepth), _1));
     putProperty(_("CC v-ratio"), contactCorrectionVelocityRatio,
                 boost::bind(&FloatingNumberString::setNonNegativeValue, boost::ref(contactCorrectionVelocityRatio), _1));
+    putProperty(_("Speculative contact margin"), speculativeContactMargin,
+                boost::bind(&FloatingNumberString::setNonNegativeValue, boost::ref(speculativeContactMargin), _1));
     putProperty(_("Kinematic walking"), isKinematicWalkingEnabled,
                 changeProperty(isKinematicWalkingEnabled));
     putProperty(_("2D mode"), is2Dmode, changeProperty(is2Dmode));
     putProperty(_("Old accel sensor mode"), isOldAccelSensorMode, changeProperty(isOldAccelSensorMode));
+    putProperty.min(0)(_("Dynamics threads"), numDynamicsThreads, changeProperty(numDynamicsThreads));
+    putProperty(_("Contact islands"), isContactIslandMode, changeProperty(isContactIslandMode));
+    putProperty(_("Block-sparse contact matrix"), isBlockSparseMatrixMode, changeProperty(isBlockSparseMatrixMode));
+    putProperty(_("Contact warm start"), isContactWarmStartMode, changeProperty(isContactWarmStartMode));
+    putProperty(_("Sleeping"), isSleepingMode, changeProperty(isSleepingMode));
+    putProperty.decimals(3).min(0.0);
+    putProperty(_("Sleeping linear velocity"), sleepingLinearVelocity, changeProperty(sleepingLinearVelocity));
+    putProperty(_("Sleeping angular velocity"), sleepingAngularVelocity, changeProperty(sleepingAngularVelocity));
+    putProperty(_("Sleeping time"), sleepingTime, changeProperty(sleepingTime));
+    putProperty(_("Packed link workspace"), isPackedLinkWorkspaceMode, changeProperty(isPackedLinkWorkspaceMode));
+    putProperty(_("Collision tree cache"), isCollisionTreeCacheMode, changeProperty(isCollisionTreeCacheMode));
+    putProperty(_("Primitive collision"), isPrimitiveCollisionMode, changeProperty(isPrimitiveCollisionMode));
 }
 
 
@@ -701,9 +997,21 @@ bool AISTSimulatorItemImpl::store(Archive& archive)
     archive.write("maxNumIterations", maxNumIterations);
     archive.write("contactCorrectionDepth", contactCorrectionDepth);
     archive.write("contactCorrectionVelocityRatio", contactCorrectionVelocityRatio);
+    archive.write("speculativeContactMargin", speculativeContactMargin);
     archive.write("kinematicWalking", isKinematicWalkingEnabled);
     archive.write("2Dmode", is2Dmode);
     archive.write("oldAccelSensorMode", isOldAccelSensorMode);
+    archive.write("dynamicsThreads", numDynamicsThreads);
+    archive.write("contactIslands", isContactIslandMode);
+    archive.write("blockSparseContactMatrix", isBlockSparseMatrixMode);
+    archive.write("contactWarmStart", isContactWarmStartMode);
+    archive.write("sleeping", isSleepingMode);
+    archive.write("sleepingLinearVelocity", sleepingLinearVelocity);
+    archive.write("sleepingAngularVelocity", sleepingAngularVelocity);
+    archive.write("sleepingTime", sleepingTime);
+    archive.write("packedLinkWorkspace", isPackedLinkWorkspaceMode);
+    archive.write("collisionTreeCache", isCollisionTreeCacheMode);
+    archive.write("primitiveCollision", isPrimitiveCollisionMode);
     return true;
 }
 
@@ -733,9 +1041,21 @@ bool AISTSimulatorItemImpl::restore(const Archive& archive)
     archive.read("maxNumIterations", maxNumIterations);
     contactCorrectionDepth = archive.get("contactCorrectionDepth", contactCorrectionDepth.string());
     contactCorrectionVelocityRatio = archive.get("contactCorrectionVelocityRatio", contactCorrectionVelocityRatio.string());
+    speculativeContactMargin = archive.get("speculativeContactMargin", speculativeContactMargin.string());
     archive.read("kinematicWalking", isKinematicWalkingEnabled);
     archive.read("2Dmode", is2Dmode);
     archive.read("oldAccelSensorMode", isOldAccelSensorMode);
+    archive.read("dynamicsThreads", numDynamicsThreads);
+    archive.read("contactIslands", isContactIslandMode);
+    archive.read("blockSparseContactMatrix", isBlockSparseMatrixMode);
+    archive.read("contactWarmStart", isContactWarmStartMode);
+    archive.read("sleeping", isSleepingMode);
+    archive.read("sleepingLinearVelocity", sleepingLinearVelocity);
+    archive.read("sleepingAngularVelocity", sleepingAngularVelocity);
+    archive.read("sleepingTime", sleepingTime);
+    archive.read("packedLinkWorkspace", isPackedLinkWorkspaceMode);
+    archive.read("collisionTreeCache", isCollisionTreeCacheMode);
+    archive.read("primitiveCollision", isPrimitiveCollisionMode);
     return true;
 }
 
@@ -8,12 +8,17 @@
 
 #include "SimulatorItem.h"
 #include <cnoid/Collision>
+#include <cnoid/CollisionDetector>
 #include "exportdecl.h"
 
 namespace cnoid {
 
 class ContactAttribute;
 class AISTSimulatorItemImpl;
+class DyBody;
+typedef ref_ptr<DyBody> DyBodyPtr;
+class ConstraintForceSolver;
+template <class TConstraintForceSolver> class World;
         
 class CNOID_EXPORT AISTSimulatorItem : public SimulatorItem
 {
@@ -40,15 +45,85 @@ public:
     void setMaxNumIterations(int value);
     void setContactCorrectionDepth(double value);
     void setContactCorrectionVelocityRatio(double value);
+
+    /**
+       Keep the contacts of the previous step as the constraints which are usually inactive while the
+       gaps of them are within the margin, so that the contact sets of the resting bodies do not change
+       every step. This is effective with the contact warm start mode. Zero disables it.
+    */
+    void setSpeculativeContactMargin(double margin);
+
     void setEpsilon(double epsilon);
     void set2Dmode(bool on);
     void setKinematicWalkingEnabled(bool on);
     void setConstraintForceOutputEnabled(bool on);
 
+    /**
+       Set the number of threads used for computing the forward dynamics of the bodies.
+       Zero means the serial computation.
+    */
+    void setNumDynamicsThreads(int n);
+
+    /**
+       Solve the constraint forces of the groups of the contacting bodies separately.
+       The groups are solved in parallel when the dynamics threads are enabled.
+    */
+    void setContactIslandMode(bool on);
+
+    /**
+       Store only the non-zero blocks of the constraint force matrix, which
+       reduces the memory and the solver time when many bodies are in contact.
+    */
+    void setBlockSparseMatrixMode(bool on);
+
+    /**
+       Start the constraint force calculation from the forces of the previous step
+       for the contacts that persist.
+    */
+    void setContactWarmStartMode(bool on);
+
+    /**
+       Freeze the bodies which have come to rest and exclude them from the forward dynamics,
+       the collision detection with the static and other frozen bodies, and the constraint force
+       calculation until they are touched by a moving body or moved by a controller or an external force.
+    */
+    void setSleepingMode(bool on);
+    void setSleepingThresholds(double linearVelocity, double angularVelocity, double time);
+
+    /**
+       Calculate the intermediate steps of the Runge Kutta method of the forward dynamics
+       on the link variables packed in the traverse order.
+    */
+    void setPackedLinkWorkspaceMode(bool on);
+
+    /**
+       Store the collision trees built from the meshes into the user's cache directory
+       and read them when the simulation is started again with the same meshes.
+    */
+    void setCollisionTreeCacheMode(bool on);
+
+    /**
+       Check the pairs of the box and sphere primitives with the closed-form routines of
+       AISTCollisionDetector instead of their triangle meshes.
+    */
+    void setPrimitiveCollisionMode(bool on);
+
+    /**
+       Initialize a world with the dynamics parameters of this item so that it can be
+       simulated without this item, e.g. by BatchSimulator. The kinematics mode and the
+       link-pair specific contact attributes are not applied to the world.
+       @param collisionDetector A detector which is not shared with any other world.
+    */
+    void initializeWorld(
+        World<ConstraintForceSolver>& world, const std::vector<DyBodyPtr>& bodies,
+        CollisionDetectorPtr collisionDetector, double timeStep);
+
     virtual void setForcedPosition(BodyItem* bodyItem, const Position& T);
     virtual bool isForcedPositionActiveFor(BodyItem* bodyItem) const;
     virtual void clearForcedPositions();
 
+    virtual void getContacts(ContactBuffer& out_contacts);
+
     // experimental functions
     void setFriction(Link* link1, Link* link2, double staticFriction, double slipFriction);
 
@@ -65,6 +140,8 @@ protected:
     virtual bool stepSimulation(const std::vector<SimulationBody*>& activeSimBodies);
     virtual void finalizeSimulation();
     virtual CollisionLinkPairListPtr getCollisions();
+    virtual ReferencedPtr storeSimulationState();
+    virtual void restoreSimulationState(const Referenced* state);
         
     virtual Item* doDuplicate() const;
     virtual void doPutProperties(PutPropertyFunction& putProperty);
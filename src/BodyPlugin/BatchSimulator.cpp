@@ -0,0 +1,301 @@
+/*!
+  @file
+*/
+
+#include "BatchSimulator.h"
+#include "WorldItem.h"
+#include "BodyItem.h"
+#include "AISTSimulatorItem.h"
+#include <cnoid/ItemList>
+#include <cnoid/SceneGraph>
+#include <cnoid/TaskScheduler>
+#include <cnoid/MessageView>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+namespace cnoid {
+
+class BatchSimulatorImpl
+{
+public:
+    WorldItemPtr worldItem;
+    AISTSimulatorItemPtr simulatorItem;
+    int numRuns;
+    int numThreads;
+    double timeStep;
+    double timeLength;
+    boost::function<void(int runIndex)> setupFunction;
+    BatchSimulator::Function initializationFunction;
+    BatchSimulator::Function controlFunction;
+    BatchSimulator::Function finalizationFunction;
+    vector<BatchSimulationRun*> runs;
+    boost::atomic<int> nextRunIndex;
+    MessageView* mv;
+
+    BatchSimulatorImpl();
+    ~BatchSimulatorImpl();
+    void clearRuns();
+    bool run();
+    bool initializeRun(BatchSimulationRun* run, const ItemList<BodyItem>& bodyItems);
+    void simulateRemainingRuns();
+    void simulate(BatchSimulationRun* run);
+};
+
+}
+
+
+BatchSimulationRun::BatchSimulationRun(int index)
+    : index_(index),
+      result_(new Mapping())
+{
+    isStopRequested = false;
+}
+
+
+BatchSimulator::BatchSimulator()
+{
+    impl = new BatchSimulatorImpl();
+}
+
+
+BatchSimulatorImpl::BatchSimulatorImpl()
+{
+    numRuns = 1;
+    numThreads = 0;
+    timeStep = 0.001;
+    timeLength = 1.0;
+    mv = MessageView::mainInstance();
+}
+
+
+BatchSimulator::~BatchSimulator()
+{
+    delete impl;
+}
+
+
+BatchSimulatorImpl::~BatchSimulatorImpl()
+{
+    clearRuns();
+}
+
+
+void BatchSimulatorImpl::clearRuns()
+{
+    for(size_t i=0; i < runs.size(); ++i){
+        delete runs[i];
+    }
+    runs.clear();
+}
+
+
+void BatchSimulator::setWorldItem(WorldItem* worldItem)
+{
+    impl->worldItem = worldItem;
+}
+
+
+void BatchSimulator::setSimulatorItem(AISTSimulatorItem* simulatorItem)
+{
+    impl->simulatorItem = simulatorItem;
+}
+
+
+void BatchSimulator::setNumRuns(int n)
+{
+    impl->numRuns = n;
+}
+
+
+int BatchSimulator::numRuns() const
+{
+    return impl->numRuns;
+}
+
+
+void BatchSimulator::setNumThreads(int n)
+{
+    impl->numThreads = n;
+}
+
+
+void BatchSimulator::setTimeStep(double step)
+{
+    impl->timeStep = step;
+}
+
+
+void BatchSimulator::setTimeLength(double length)
+{
+    impl->timeLength = length;
+}
+
+
+void BatchSimulator::setSetupFunction(boost::function<void(int runIndex)> func)
+{
+    impl->setupFunction = func;
+}
+
+
+void BatchSimulator::setInitializationFunction(Function func)
+{
+    impl->initializationFunction = func;
+}
+
+
+void BatchSimulator::setControlFunction(Function func)
+{
+    impl->controlFunction = func;
+}
+
+
+void BatchSimulator::setFinalizationFunction(Function func)
+{
+    impl->finalizationFunction = func;
+}
+
+
+bool BatchSimulator::run()
+{
+    return impl->run();
+}
+
+
+/**
+   The worlds are initialized in the main thread because the bodies and the
+   shapes of the items are copied and the collision detectors read the shapes.
+   Only the simulation loops are executed in parallel.
+*/
+bool BatchSimulatorImpl::run()
+{
+    clearRuns();
+
+    if(!worldItem){
+        mv->putln(_("A world item must be specified for the batch simulation."));
+        return false;
+    }
+
+    ItemList<BodyItem> bodyItems;
+    bodyItems.extractChildItems(worldItem);
+    if(bodyItems.empty()){
+        mv->putln(format(_("There are no bodies to simulate in %1%.")) % worldItem->name());
+        return false;
+    }
+
+    if(!simulatorItem){
+        simulatorItem = new AISTSimulatorItem();
+    }
+
+    for(int i=0; i < numRuns; ++i){
+        if(setupFunction){
+            setupFunction(i);
+        }
+        BatchSimulationRun* run = new BatchSimulationRun(i);
+        runs.push_back(run);
+        if(!initializeRun(run, bodyItems)){
+            clearRuns();
+            return false;
+        }
+        if(initializationFunction){
+            initializationFunction(*run);
+        }
+    }
+
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    int n = numThreads;
+    if(n <= 0){
+        n = scheduler->concurrency();
+    }
+    n = std::min(n, numRuns);
+
+    nextRunIndex = 0;
+    if(n <= 1){
+        simulateRemainingRuns();
+    } else {
+        TaskGroup group(scheduler);
+        for(int i=0; i < n; ++i){
+            group.run(boost::bind(&BatchSimulatorImpl::simulateRemainingRuns, this));
+        }
+        group.wait();
+    }
+
+    return true;
+}
+
+
+bool BatchSimulatorImpl::initializeRun(BatchSimulationRun* run, const ItemList<BodyItem>& bodyItems)
+{
+    SgCloneMap cloneMap;
+    vector<DyBodyPtr> bodies;
+    for(size_t i=0; i < bodyItems.size(); ++i){
+        DyBodyPtr body = new DyBody(*bodyItems[i]->body());
+        body->cloneShapes(cloneMap);
+        bodies.push_back(body);
+    }
+
+    CollisionDetectorPtr collisionDetector = worldItem->collisionDetector()->clone();
+    if(!collisionDetector){
+        mv->putln(format(_("The collision detector of %1% cannot be cloned.")) % worldItem->name());
+        return false;
+    }
+
+    simulatorItem->initializeWorld(run->world_, bodies, collisionDetector, timeStep);
+
+    return true;
+}
+
+
+/**
+   Each of the tasks given to the scheduler takes the runs one by one until all the runs are
+   taken, so the number of the runs executed at the same time is limited to that of the tasks.
+*/
+void BatchSimulatorImpl::simulateRemainingRuns()
+{
+    while(true){
+        const int index = nextRunIndex++;
+        if(index >= numRuns){
+            break;
+        }
+        simulate(runs[index]);
+    }
+}
+
+
+void BatchSimulatorImpl::simulate(BatchSimulationRun* run)
+{
+    World<ConstraintForceSolver>& world = run->world_;
+    const int numSteps = static_cast<int>(floor(timeLength / timeStep + 0.5));
+
+    int i;
+    for(i=0; i < numSteps && !run->isStopRequested; ++i){
+        world.constraintForceSolver.clearExternalForces();
+        if(controlFunction){
+            controlFunction(*run);
+        }
+        world.calcNextState();
+    }
+
+    if(finalizationFunction){
+        finalizationFunction(*run);
+    }
+
+    Mapping* result = run->result();
+    result->write("time", world.currentTime());
+    result->write("numSteps", i);
+}
+
+
+Mapping* BatchSimulator::result(int runIndex)
+{
+    if(runIndex >= 0 && runIndex < static_cast<int>(impl->runs.size())){
+        return impl->runs[runIndex]->result();
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_BATCH_SIMULATOR_H
+#define CNOID_BODYPLUGIN_BATCH_SIMULATOR_H
+
+#include <cnoid/DyWorld>
+#include <cnoid/DyBody>
+#include <cnoid/ConstraintForceSolver>
+#include <cnoid/ValueTree>
+#include <boost/function.hpp>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class WorldItem;
+class AISTSimulatorItem;
+class BatchSimulatorImpl;
+
+/**
+   The state of a run of the batch simulation.
+   A run has its own world, bodies and collision detector.
+*/
+class CNOID_EXPORT BatchSimulationRun
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+    int index() const { return index_; }
+    World<ConstraintForceSolver>& world() { return world_; }
+    double currentTime() const { return world_.currentTime(); }
+
+    /**
+       The values put into this mapping are gathered as the result of the run.
+    */
+    Mapping* result() { return result_.get(); }
+
+    /**
+       Called from the run thread to finish the run before the time length.
+    */
+    void stop() { isStopRequested = true; }
+
+private:
+    BatchSimulationRun(int index);
+
+    int index_;
+    World<ConstraintForceSolver> world_;
+    MappingPtr result_;
+    bool isStopRequested;
+
+    friend class BatchSimulatorImpl;
+};
+
+
+/**
+   This class runs many copies of the world of a WorldItem in parallel without
+   the simulator items and the GUI. Each run is executed on a thread of TaskScheduler and
+   the controllers are given as the functions called from the thread.
+*/
+class CNOID_EXPORT BatchSimulator
+{
+public:
+    BatchSimulator();
+    ~BatchSimulator();
+
+    void setWorldItem(WorldItem* worldItem);
+
+    /**
+       The dynamics parameters of the item are applied to the worlds of the runs.
+       The default parameters of AISTSimulatorItem are used when this is not specified.
+    */
+    void setSimulatorItem(AISTSimulatorItem* simulatorItem);
+
+    void setNumRuns(int n);
+    int numRuns() const;
+
+    /**
+       The maximum number of the runs executed at the same time. The runs are executed by
+       the shared TaskScheduler, so a value larger than its concurrency does not increase
+       the actual parallelism. Zero means the concurrency of the scheduler.
+    */
+    void setNumThreads(int n);
+    void setTimeStep(double step);
+    void setTimeLength(double length);
+
+    typedef boost::function<void(BatchSimulationRun& run)> Function;
+
+    /**
+       Called from the main thread before the world of each run is created from the items.
+       The items can be modified for the run in this function because the bodies and the
+       dynamics parameters are copied from the items when the world is created.
+    */
+    void setSetupFunction(boost::function<void(int runIndex)> func);
+
+    /**
+       Called from the main thread after the world of a run is initialized.
+       This can be used for setting the parameters of each run.
+    */
+    void setInitializationFunction(Function func);
+
+    /**
+       Called from the run thread before the dynamics computation of every step.
+    */
+    void setControlFunction(Function func);
+
+    /**
+       Called from the run thread after the last step of a run.
+    */
+    void setFinalizationFunction(Function func);
+
+    /**
+       Execute all the runs. This function returns when all the runs are finished.
+    */
+    bool run();
+
+    /**
+       The result of a run contains "time" and "numSteps" in addition to the values
+       put by the functions.
+    */
+    Mapping* result(int runIndex);
+
+private:
+    BatchSimulatorImpl* impl;
+};
+
+}
+
+#endif
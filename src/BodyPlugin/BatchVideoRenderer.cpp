@@ -0,0 +1,651 @@
+/*!
+  @file
+*/
+
+#include "BatchVideoRenderer.h"
+#include "WorldLogFileItem.h"
+#include "BodyMotionItem.h"
+#include "BodyMotionEngine.h"
+#include "WorldItem.h"
+#include "BodyItem.h"
+#include <cnoid/RootItem>
+#include <cnoid/ItemList>
+#include <cnoid/ItemTreeView>
+#include <cnoid/SceneProvider>
+#include <cnoid/SceneBody>
+#include <cnoid/SceneCameras>
+#include <cnoid/GLSLSceneRenderer>
+#include <cnoid/Image>
+#include <cnoid/Process>
+#include <cnoid/TimeMeasure>
+#include <cnoid/MessageView>
+#include <cnoid/OptionManager>
+#include <cnoid/ExtensionManager>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <boost/bind.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#define USE_QT5_OPENGL 1
+#else
+#define USE_QT5_OPENGL 0
+#endif
+
+#if USE_QT5_OPENGL
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+#else
+#include <QGLPixelBuffer>
+#endif
+
+#ifdef CNOID_ENABLE_EGL
+#include <cnoid/EGLOffscreenContext>
+#endif
+
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+namespace {
+
+bool parseValues(const string& text, vector<double>& out_values)
+{
+    vector<string> tokens;
+    boost::split(tokens, text, boost::is_any_of(", "), boost::token_compress_on);
+    out_values.clear();
+    try {
+        for(size_t i=0; i < tokens.size(); ++i){
+            if(!tokens[i].empty()){
+                out_values.push_back(boost::lexical_cast<double>(tokens[i]));
+            }
+        }
+    } catch(const boost::bad_lexical_cast&){
+        return false;
+    }
+    return true;
+}
+
+
+Item* findMotionItem(const string& path)
+{
+    RootItem* rootItem = RootItem::instance();
+    Item* item = rootItem->findItem(path);
+    if(!item){
+        // The name of the item is also accepted
+        ItemList<> items;
+        items.extractChildItems(rootItem);
+        for(size_t i=0; i < items.size(); ++i){
+            if(items[i]->name() == path &&
+               (dynamic_cast<WorldLogFileItem*>(items.get(i)) || dynamic_cast<BodyMotionItem*>(items.get(i)))){
+                item = items.get(i);
+                break;
+            }
+        }
+    }
+    return item;
+}
+
+
+void onSigOptionsParsed(boost::program_options::variables_map& v)
+{
+    if(v.count("render-video")){
+        MessageView* mv = MessageView::mainInstance();
+        BatchVideoRenderer renderer;
+        const string path = v["render-video"].as<string>();
+        Item* item = findMotionItem(path);
+        if(!item){
+            mv->putln(MessageView::ERROR, format(_("The item \"%1%\" to render is not found.")) % path);
+            return;
+        }
+        if(!renderer.setMotionItem(item)){
+            mv->putln(MessageView::ERROR, format(_("\"%1%\" is neither a WorldLogFileItem nor a BodyMotionItem.")) % path);
+            return;
+        }
+        if(v.count("render-video-output")){
+            renderer.setOutputFile(v["render-video-output"].as<string>());
+        }
+        if(v.count("render-video-size")){
+            int width, height;
+            if(sscanf(v["render-video-size"].as<string>().c_str(), "%dx%d", &width, &height) == 2){
+                renderer.setImageSize(width, height);
+            } else {
+                mv->putln(MessageView::ERROR, _("The image size must be given as <width>x<height>."));
+                return;
+            }
+        }
+        if(v.count("render-video-fps")){
+            renderer.setFrameRate(v["render-video-fps"].as<double>());
+        }
+        if(v.count("render-video-camera")){
+            vector<double> values;
+            if(parseValues(v["render-video-camera"].as<string>(), values) && values.size() == 6){
+                renderer.setCameraPosition(Vector3(values[0], values[1], values[2]), Vector3(values[3], values[4], values[5]));
+            } else {
+                mv->putln(MessageView::ERROR, _("The camera must be given as the six values of the eye and the center."));
+                return;
+            }
+        }
+        if(v.count("render-video-codec")){
+            renderer.setVideoCodec(v["render-video-codec"].as<string>());
+        }
+        renderer.render();
+    }
+}
+
+}
+
+namespace cnoid {
+
+class BatchVideoRendererImpl
+{
+public:
+    MessageView* mv;
+    WorldLogFileItemPtr worldLogFileItem;
+    BodyMotionItemPtr bodyMotionItem;
+    BodyMotionEnginePtr bodyMotionEngine;
+    string outputFile;
+    int width;
+    int height;
+    double frameRate;
+    bool isCameraPositionSpecified;
+    Vector3 eye;
+    Vector3 center;
+    double fieldOfView;
+    string encoder;
+    string videoCodec;
+
+#if USE_QT5_OPENGL
+    QOpenGLContext* glContext;
+    QOffscreenSurface* offscreenSurface;
+    QOpenGLFramebufferObject* frameBuffer;
+#else
+    QGLPixelBuffer* renderingBuffer;
+#endif
+#ifdef CNOID_ENABLE_EGL
+    EGLOffscreenContext* eglContext;
+    unsigned int eglFrameBuffer;
+#endif
+    GLSLSceneRenderer* renderer;
+    SgPosTransformPtr cameraTransform;
+    SgPerspectiveCameraPtr camera;
+    Process encoderProcess;
+    int numWrittenFrames;
+
+    BatchVideoRendererImpl();
+    ~BatchVideoRendererImpl();
+    bool render();
+    bool initializeGLContext();
+    void makeGLContextCurrent();
+    void finalizeGLContext();
+    void initializeScene();
+    bool applyStateAtTime(double time);
+    void updateCamera();
+    bool startEncoder();
+    bool writeFrame(const Image& image);
+    bool finishEncoder();
+};
+
+}
+
+
+void BatchVideoRenderer::initialize(ExtensionManager* ext)
+{
+    ext->optionManager()
+        .addOption("render-video", boost::program_options::value<string>(),
+                   "render the motion of a world log file item or a body motion item to a video file")
+        .addOption("render-video-output", boost::program_options::value<string>(),
+                   "the video file to which the motion is rendered")
+        .addOption("render-video-size", boost::program_options::value<string>(),
+                   "the image size of the rendered video given as <width>x<height>")
+        .addOption("render-video-fps", boost::program_options::value<double>(),
+                   "the frame rate of the rendered video")
+        .addOption("render-video-camera", boost::program_options::value<string>(),
+                   "the camera of the rendered video given as \"x,y,z,cx,cy,cz\" of the eye and the center")
+        .addOption("render-video-codec", boost::program_options::value<string>(),
+                   "the codec of the encoder for the rendered video")
+        .sigOptionsParsed().connect(onSigOptionsParsed);
+}
+
+
+BatchVideoRenderer::BatchVideoRenderer()
+{
+    impl = new BatchVideoRendererImpl();
+}
+
+
+BatchVideoRendererImpl::BatchVideoRendererImpl()
+{
+    mv = MessageView::mainInstance();
+    width = 1280;
+    height = 720;
+    frameRate = 30.0;
+    isCameraPositionSpecified = false;
+    eye << 3.0, -3.0, 2.0;
+    center.setZero();
+    fieldOfView = 0.6978;
+    encoder = "ffmpeg";
+    videoCodec = "libx264";
+
+#if USE_QT5_OPENGL
+    glContext = 0;
+    offscreenSurface = 0;
+    frameBuffer = 0;
+#else
+    renderingBuffer = 0;
+#endif
+#ifdef CNOID_ENABLE_EGL
+    eglContext = 0;
+    eglFrameBuffer = 0;
+#endif
+    renderer = 0;
+    numWrittenFrames = 0;
+}
+
+
+BatchVideoRenderer::~BatchVideoRenderer()
+{
+    delete impl;
+}
+
+
+BatchVideoRendererImpl::~BatchVideoRendererImpl()
+{
+    finalizeGLContext();
+}
+
+
+bool BatchVideoRenderer::setMotionItem(Item* item)
+{
+    impl->worldLogFileItem = dynamic_cast<WorldLogFileItem*>(item);
+    impl->bodyMotionItem = dynamic_cast<BodyMotionItem*>(item);
+    if(impl->outputFile.empty() && item){
+        impl->outputFile = item->name() + ".mp4";
+    }
+    return impl->worldLogFileItem || impl->bodyMotionItem;
+}
+
+
+void BatchVideoRenderer::setOutputFile(const std::string& filename)
+{
+    impl->outputFile = filename;
+}
+
+
+void BatchVideoRenderer::setImageSize(int width, int height)
+{
+    // The chroma subsampling of the encoder requires the even numbers
+    impl->width = std::max(2, width & ~1);
+    impl->height = std::max(2, height & ~1);
+}
+
+
+void BatchVideoRenderer::setFrameRate(double fps)
+{
+    if(fps > 0.0){
+        impl->frameRate = fps;
+    }
+}
+
+
+void BatchVideoRenderer::setCameraPosition(const Vector3& eye, const Vector3& center)
+{
+    impl->eye = eye;
+    impl->center = center;
+    impl->isCameraPositionSpecified = true;
+}
+
+
+void BatchVideoRenderer::setFieldOfView(double fov)
+{
+    impl->fieldOfView = fov;
+}
+
+
+void BatchVideoRenderer::setEncoder(const std::string& program)
+{
+    impl->encoder = program;
+}
+
+
+void BatchVideoRenderer::setVideoCodec(const std::string& codec)
+{
+    impl->videoCodec = codec;
+}
+
+
+bool BatchVideoRenderer::render()
+{
+    return impl->render();
+}
+
+
+bool BatchVideoRendererImpl::render()
+{
+    if(!worldLogFileItem && !bodyMotionItem){
+        return false;
+    }
+    Item* motionItem = worldLogFileItem ? static_cast<Item*>(worldLogFileItem) : static_cast<Item*>(bodyMotionItem);
+
+    if(bodyMotionItem){
+        BodyItem* bodyItem = bodyMotionItem->findOwnerItem<BodyItem>();
+        if(!bodyItem){
+            mv->putln(MessageView::ERROR, format(_("The body motion item \"%1%\" is not a child of a body item.")) % motionItem->name());
+            return false;
+        }
+        bodyMotionEngine = new BodyMotionEngine(bodyItem, bodyMotionItem);
+    }
+
+    if(!initializeGLContext()){
+        return false;
+    }
+    renderer = new GLSLSceneRenderer;
+    if(!renderer->initializeGL()){
+        mv->putln(MessageView::ERROR, _("OpenGL 3.3 is not available for rendering the video."));
+        finalizeGLContext();
+        return false;
+    }
+    initializeScene();
+
+    if(!startEncoder()){
+        finalizeGLContext();
+        return false;
+    }
+
+    mv->putln(format(_("Rendering \"%1%\" to \"%2%\" ...")) % motionItem->name() % outputFile);
+    mv->flush();
+
+    TimeMeasure timer;
+    timer.begin();
+    numWrittenFrames = 0;
+    bool failed = false;
+    Image image;
+
+    for(int frame = 0; !failed; ++frame){
+        if(!applyStateAtTime(frame / frameRate)){
+            break;
+        }
+        // The states of the body items are reflected in their scene bodies by the lazy signals
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+
+        makeGLContextCurrent();
+        if(frame == 0){
+            updateCamera();
+        }
+        renderer->render();
+
+        /*
+          The pixels of the frame are transferred while the next frame is rendered, and the previous
+          frame is written to the encoder. The encoder runs in parallel as another process.
+        */
+        renderer->startImageReading();
+        while(renderer->numPendingImageReadings() > 1){
+            if(!renderer->takeReadImage(image) || !writeFrame(image)){
+                failed = true;
+                break;
+            }
+        }
+    }
+    makeGLContextCurrent();
+    while(!failed && renderer->numPendingImageReadings() > 0){
+        if(!renderer->takeReadImage(image) || !writeFrame(image)){
+            failed = true;
+        }
+    }
+    finalizeGLContext();
+
+    if(!finishEncoder()){
+        failed = true;
+    }
+    timer.end();
+
+    if(!failed){
+        mv->putln(format(_("%1% frames have been rendered to \"%2%\" in %3% [s]."))
+                  % numWrittenFrames % outputFile % timer.totalTime());
+    }
+    bodyMotionEngine.reset();
+
+    return !failed;
+}
+
+
+bool BatchVideoRendererImpl::initializeGLContext()
+{
+#ifdef CNOID_ENABLE_EGL
+    eglContext = new EGLOffscreenContext;
+    if(eglContext->create(true)){
+        eglContext->makeCurrent();
+        eglFrameBuffer = eglContext->createFrameBuffer(width, height);
+        if(eglFrameBuffer){
+            return true;
+        }
+    }
+    // The context of the window system is used instead
+    mv->putln(eglContext->errorMessage());
+    delete eglContext;
+    eglContext = 0;
+#endif
+
+#if USE_QT5_OPENGL
+    glContext = new QOpenGLContext;
+    QSurfaceFormat format;
+    format.setSwapBehavior(QSurfaceFormat::SingleBuffer);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setVersion(3, 3);
+    glContext->setFormat(format);
+    if(!glContext->create()){
+        mv->putln(MessageView::ERROR, _("The OpenGL context for rendering the video cannot be created."));
+        delete glContext;
+        glContext = 0;
+        return false;
+    }
+    offscreenSurface = new QOffscreenSurface;
+    offscreenSurface->setFormat(format);
+    offscreenSurface->create();
+    glContext->makeCurrent(offscreenSurface);
+    frameBuffer = new QOpenGLFramebufferObject(width, height, QOpenGLFramebufferObject::CombinedDepthStencil);
+    frameBuffer->bind();
+#else
+    QGLFormat format;
+    format.setDoubleBuffer(false);
+    format.setProfile(QGLFormat::CoreProfile);
+    format.setVersion(3, 3);
+    renderingBuffer = new QGLPixelBuffer(width, height, format);
+    renderingBuffer->makeCurrent();
+#endif
+
+    return true;
+}
+
+
+//! The other contexts such as the ones of the scene views may be made current in processing the events
+void BatchVideoRendererImpl::makeGLContextCurrent()
+{
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->makeCurrent();
+        eglContext->bindFrameBuffer(eglFrameBuffer);
+        return;
+    }
+#endif
+#if USE_QT5_OPENGL
+    glContext->makeCurrent(offscreenSurface);
+    frameBuffer->bind();
+#else
+    renderingBuffer->makeCurrent();
+#endif
+}
+
+
+void BatchVideoRendererImpl::finalizeGLContext()
+{
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->makeCurrent();
+        delete renderer;
+        renderer = 0;
+        eglContext->deleteFrameBuffer(eglFrameBuffer);
+        eglContext->doneCurrent();
+        delete eglContext;
+        eglContext = 0;
+        return;
+    }
+#endif
+#if USE_QT5_OPENGL
+    if(glContext){
+        glContext->makeCurrent(offscreenSurface);
+        delete renderer;
+        renderer = 0;
+        delete frameBuffer;
+        frameBuffer = 0;
+        glContext->doneCurrent();
+        delete glContext;
+        glContext = 0;
+        delete offscreenSurface;
+        offscreenSurface = 0;
+    }
+#else
+    if(renderingBuffer){
+        renderingBuffer->makeCurrent();
+        delete renderer;
+        renderer = 0;
+        renderingBuffer->doneCurrent();
+        delete renderingBuffer;
+        renderingBuffer = 0;
+    }
+#endif
+}
+
+
+/**
+   The scene bodies of the body items are shared with the scene views because only their
+   link positions are updated in rendering the frames.
+*/
+void BatchVideoRendererImpl::initializeScene()
+{
+    Item* motionItem = worldLogFileItem ? static_cast<Item*>(worldLogFileItem) : static_cast<Item*>(bodyMotionItem);
+    Item* topItem = motionItem->findOwnerItem<WorldItem>();
+    if(!topItem){
+        topItem = RootItem::instance();
+    }
+
+    SgGroup* sceneRoot = renderer->sceneRoot();
+    ItemList<> items;
+    items.extractChildItems(topItem);
+    ItemTreeView* itemTreeView = ItemTreeView::instance();
+    for(size_t i=0; i < items.size(); ++i){
+        Item* item = items.get(i);
+        if(BodyItem* bodyItem = dynamic_cast<BodyItem*>(item)){
+            sceneRoot->addChild(bodyItem->sceneBody());
+        } else if(SceneProvider* provider = dynamic_cast<SceneProvider*>(item)){
+            if(itemTreeView && itemTreeView->isItemChecked(item)){
+                SgNode* scene = provider->getScene();
+                if(scene){
+                    sceneRoot->addChild(scene);
+                }
+            }
+        }
+    }
+
+    camera = new SgPerspectiveCamera;
+    camera->setFieldOfView(fieldOfView);
+    cameraTransform = new SgPosTransform;
+    cameraTransform->addChild(camera);
+    sceneRoot->addChild(cameraTransform);
+
+    renderer->setViewport(0, 0, width, height);
+    renderer->extractPreprocessedNodes();
+    renderer->setCurrentCamera(camera);
+}
+
+
+/**
+   @return false if the time is out of the range of the motion
+*/
+bool BatchVideoRendererImpl::applyStateAtTime(double time)
+{
+    if(worldLogFileItem){
+        return worldLogFileItem->recallStateAtTime(time);
+    } else {
+        return bodyMotionEngine->onTimeChanged(time);
+    }
+}
+
+
+void BatchVideoRendererImpl::updateCamera()
+{
+    if(!isCameraPositionSpecified){
+        // The camera is placed so that the bounding sphere of the scene is in the view
+        const BoundingBox& bbox = renderer->scene()->boundingBox();
+        if(!bbox.empty()){
+            center = bbox.center();
+            const double radius = bbox.boundingSphereRadius();
+            const double fovy = SgPerspectiveCamera::fovy(static_cast<double>(width) / height, fieldOfView);
+            const double distance = radius / sin(std::min(fovy, fieldOfView) / 2.0);
+            eye = center + distance * Vector3(1.0, -1.0, 0.7).normalized();
+        }
+    }
+    cameraTransform->setPosition(SgCamera::positionLookingAt(eye, center, Vector3::UnitZ()));
+    const double distance = (eye - center).norm();
+    camera->setNearDistance(std::max(0.001, distance * 0.01));
+    camera->setFarDistance(std::max(100.0, distance * 10.0));
+}
+
+
+bool BatchVideoRendererImpl::startEncoder()
+{
+    QStringList args;
+    args << "-y" << "-hide_banner" << "-loglevel" << "error" << "-nostats"
+         << "-f" << "rawvideo" << "-pix_fmt" << "rgb24"
+         << "-s" << QString("%1x%2").arg(width).arg(height)
+         << "-r" << QString::number(frameRate)
+         << "-i" << "-"
+         << "-c:v" << videoCodec.c_str()
+         << "-pix_fmt" << "yuv420p" << outputFile.c_str();
+
+    encoderProcess.setProcessChannelMode(QProcess::MergedChannels);
+    encoderProcess.start(encoder.c_str(), args);
+    if(!encoderProcess.waitForStarted()){
+        mv->putln(MessageView::ERROR, format(_("The video encoder \"%1%\" cannot be started.")) % encoder);
+        return false;
+    }
+    return true;
+}
+
+
+bool BatchVideoRendererImpl::writeFrame(const Image& image)
+{
+    encoderProcess.write(reinterpret_cast<const char*>(image.pixels()), image.width() * image.height() * 3);
+    while(encoderProcess.bytesToWrite() > 0 && encoderProcess.state() == QProcess::Running){
+        encoderProcess.waitForBytesWritten(1000);
+    }
+    QByteArray output = encoderProcess.readAll();
+    if(encoderProcess.state() != QProcess::Running){
+        mv->putln(MessageView::ERROR, format(_("The video encoder has terminated while encoding \"%1%\": %2%"))
+                  % outputFile % output.constData());
+        return false;
+    }
+    ++numWrittenFrames;
+    return true;
+}
+
+
+bool BatchVideoRendererImpl::finishEncoder()
+{
+    if(encoderProcess.state() == QProcess::NotRunning){
+        return false;
+    }
+    encoderProcess.closeWriteChannel();
+    encoderProcess.waitForFinished(-1);
+    if(encoderProcess.exitStatus() != QProcess::NormalExit || encoderProcess.exitCode() != 0){
+        QByteArray output = encoderProcess.readAll();
+        mv->putln(MessageView::ERROR, format(_("Encoding the video \"%1%\" failed: %2%")) % outputFile % output.constData());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_BATCH_VIDEO_RENDERER_H
+#define CNOID_BODYPLUGIN_BATCH_VIDEO_RENDERER_H
+
+#include <cnoid/EigenTypes>
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ExtensionManager;
+class Item;
+class BatchVideoRendererImpl;
+
+/**
+   This class renders the motion recorded in a WorldLogFileItem or a BodyMotionItem to a video
+   file without the playback of the time bar. Each frame is rendered by GLSLSceneRenderer into an
+   offscreen frame buffer as fast as the GPU allows, and the frames are written to an encoder
+   process such as ffmpeg through a pipe. The EGL offscreen context is used if it is enabled in
+   the build, so the rendering can be done on the servers which do not have the window system.
+
+   The scene consists of the body items in the world item of the motion item and the other
+   scene provider items checked in the item tree view.
+
+   The rendering can be executed from the command line with the following options:
+   --project <file> --render-video <item path> [--render-video-output <file>]
+   [--render-video-size <width>x<height>] [--render-video-fps <fps>]
+   [--render-video-camera <x,y,z,cx,cy,cz>] [--render-video-codec <codec>] [--quit]
+*/
+class CNOID_EXPORT BatchVideoRenderer
+{
+public:
+    static void initialize(ExtensionManager* ext);
+
+    BatchVideoRenderer();
+    ~BatchVideoRenderer();
+
+    //! The item must be a WorldLogFileItem or a BodyMotionItem
+    bool setMotionItem(Item* item);
+    
+    void setOutputFile(const std::string& filename);
+    void setImageSize(int width, int height);
+    void setFrameRate(double fps);
+
+    /**
+       The camera looks at the center from the eye. If this is not specified, the camera looks
+       at the center of the bounding box of the scene at the first frame so that the whole scene
+       is in the view.
+    */
+    void setCameraPosition(const Vector3& eye, const Vector3& center);
+    void setFieldOfView(double fov);
+
+    //! The default encoder is "ffmpeg"
+    void setEncoder(const std::string& program);
+
+    //! The default codec is "libx264". The hardware encoders such as "h264_nvenc" can be specified.
+    void setVideoCodec(const std::string& codec);
+
+    /**
+       Renders all the frames of the motion item. This function returns when the video is written.
+    */
+    bool render();
+
+private:
+    BatchVideoRendererImpl* impl;
+
+    BatchVideoRenderer(const BatchVideoRenderer& org);
+    BatchVideoRenderer& operator=(const BatchVideoRenderer& rhs);
+};
+
+}
+
+#endif
@@ -9,6 +9,7 @@
 #include "EditableSceneBody.h"
 #include "LinkSelectionView.h"
 #include <cnoid/LeggedBodyHelper>
+#include <cnoid/EventLoopMonitor>
 #include <cnoid/YAMLReader>
 #include <cnoid/EigenArchive>
 #include <cnoid/Archive>
@@ -29,11 +30,14 @@
 #include <cnoid/PinDragIK>
 #include <cnoid/PenetrationBlocker>
 #include <cnoid/FileUtil>
+#include <cnoid/SceneUtil>
+#include <cnoid/BodyCollisionDetectorUtil>
 #include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
 #include <bitset>
 #include <deque>
 #include <iostream>
+#include <sstream>
 #include <algorithm>
 #include "gettext.h"
 
@@ -66,6 +70,9 @@ bool loadBodyItem(BodyItem* item, const std::string& filename)
     
 void onSigOptionsParsed(boost::program_options::variables_map& variables)
 {
+    if(variables.count("body-cache")){
+        BodyLoader::setCacheDirectory(BodyLoader::defaultCacheDirectory());
+    }
     if(variables.count("hrpmodel")){
         vector<string> modelFileNames = variables["hrpmodel"].as< vector<string> >();
         for(size_t i=0; i < modelFileNames.size(); ++i){
@@ -123,6 +130,9 @@ public:
 
     Signal<void()> sigModelUpdated;
 
+    BodyPtr preloadedBody;
+    std::string preloadingMessage;
+
     BodyItemImpl(BodyItem* self);
     BodyItemImpl(BodyItem* self, const BodyItemImpl& org);
     ~BodyItemImpl();
@@ -130,6 +140,7 @@ public:
     void init(bool calledFromCopyConstructor);
     void initBody(bool calledFromCopyConstructor);
     bool loadModelFile(const std::string& filename);
+    void preloadModelFile(const std::string& filename, CollisionDetectorPtr collisionDetector, bool doSelfCollisionDetection);
     void setCurrentBaseLink(Link* link);
     void emitSigKinematicStateChanged();
     void emitSigKinematicStateEdited();
@@ -171,6 +182,7 @@ void BodyItem::initializeClass(ExtensionManager* ext)
 
         OptionManager& om = ext->optionManager();
         om.addOption("hrpmodel", boost::program_options::value< vector<string> >(), "load an OpenHRP model file");
+        om.addOption("body-cache", "restore the body models from the binary caches in the user's cache directory");
         om.sigOptionsParsed().connect(onSigOptionsParsed);
 
         initialized = true;
@@ -324,12 +336,19 @@ bool BodyItem::loadModelFile(const std::string& filename)
 bool BodyItemImpl::loadModelFile(const std::string& filename)
 {
     MessageView* mv = MessageView::instance();
-    mv->beginStdioRedirect();
-    bodyLoader.setMessageSink(mv->cout(true));
-
-    BodyPtr newBody = bodyLoader.load(filename);
+    BodyPtr newBody;
 
-    mv->endStdioRedirect();
+    if(preloadedBody){
+        newBody = preloadedBody;
+        preloadedBody = 0;
+        mv->cout(true) << preloadingMessage;
+        preloadingMessage.clear();
+    } else {
+        mv->beginStdioRedirect();
+        bodyLoader.setMessageSink(mv->cout(true));
+        newBody = bodyLoader.load(filename);
+        mv->endStdioRedirect();
+    }
     
     if(newBody){
         body = newBody;
@@ -343,6 +362,28 @@ bool BodyItemImpl::loadModelFile(const std::string& filename)
 }
 
 
+/**
+   This function is executed by a worker thread, so it uses its own loader
+   and keeps the messages until the body is used by loadModelFile().
+   @param collisionDetector If this is given, the collision models of the body are built by the
+   detector so that the detector of the world item finds them in the geometry cache.
+*/
+void BodyItemImpl::preloadModelFile
+(const std::string& filename, CollisionDetectorPtr collisionDetector, bool doSelfCollisionDetection)
+{
+    BodyLoader loader;
+    ostringstream os;
+    loader.setMessageSink(os);
+    preloadedBody = loader.load(filename);
+    preloadingMessage = os.str();
+
+    if(preloadedBody && collisionDetector){
+        addBodyToCollisionDetector(*preloadedBody, *collisionDetector, doSelfCollisionDetection);
+        collisionDetector->makeReady();
+    }
+}
+
+
 void BodyItem::setName(const std::string& name)
 {
     if(impl->body){
@@ -889,11 +930,19 @@ void BodyItem::notifyKinematicStateChange
 void BodyItemImpl::emitSigKinematicStateChanged()
 {
     if(isFkRequested){
-        fkTraverse.calcForwardKinematics(isVelFkRequested, isAccFkRequested);
+        if(isVelFkRequested || isAccFkRequested){
+            fkTraverse.calcForwardKinematics(isVelFkRequested, isAccFkRequested);
+        } else {
+            // Only the links moved by the changed joints are updated in editing the pose
+            fkTraverse.calcIncrementalForwardKinematics();
+        }
         isFkRequested = isVelFkRequested = isAccFkRequested = false;
     }
 
-    sigKinematicStateChanged.signal()();
+    {
+        EventLoopMonitor::Scope monitorScope("BodyItem::sigKinematicStateChanged");
+        sigKinematicStateChanged.signal()();
+    }
 
     if(needToAppendKinematicStateToHistory){
         appendKinematicStateToHistory();
@@ -1084,6 +1133,22 @@ EditableSceneBody* BodyItem::existingSceneBody()
 }
 
 
+size_t BodyItem::memoryUsage() const
+{
+    std::set<const void*> countedObjects;
+    const Body* body = impl->body;
+    const int n = body->numLinks();
+    size_t usage = n * sizeof(Link);
+    for(int i=0; i < n; ++i){
+        Link* link = body->link(i);
+        usage += calcSceneMemoryUsage(link->visualShape(), countedObjects);
+        usage += calcSceneMemoryUsage(link->collisionShape(), countedObjects);
+    }
+    usage += calcSceneMemoryUsage(impl->sceneBody, countedObjects);
+    return usage;
+}
+
+
 bool BodyItemImpl::onEditableChanged(bool on)
 {
     self->setEditable(on);
@@ -1173,6 +1238,36 @@ bool BodyItem::restore(const Archive& archive)
 }
 
 
+boost::function<void()> BodyItem::getFileDataPreloader(const Archive& archive)
+{
+    string modelFile;
+    if(archive.readRelocatablePath("modelFile", modelFile)){
+        return boost::bind(&BodyItemImpl::preloadModelFile, impl, modelFile, CollisionDetectorPtr(), false);
+    }
+    return boost::function<void()>();
+}
+
+
+/**
+   The body is loaded by a worker thread when the item is reloaded, and the collision models
+   are also built if the original item is checked by a world item.
+*/
+boost::function<void()> BodyItem::getFileDataPreloaderForReloading(Item* orgItem)
+{
+    const string& filename = orgItem->filePath();
+    if(filename.empty()){
+        return boost::function<void()>();
+    }
+    CollisionDetectorPtr collisionDetector;
+    WorldItem* worldItem = orgItem->findOwnerItem<WorldItem>();
+    if(worldItem && worldItem->isCollisionDetectionEnabled() && impl->isCollisionDetectionEnabled){
+        collisionDetector = worldItem->collisionDetector()->clone();
+    }
+    return boost::bind(&BodyItemImpl::preloadModelFile, impl, filename,
+                       collisionDetector, impl->isSelfCollisionDetectionEnabled);
+}
+
+
 bool BodyItemImpl::restore(const Archive& archive)
 {
     bool restored = false;
@@ -1186,6 +1281,8 @@ bool BodyItemImpl::restore(const Archive& archive)
     if(archive.readRelocatablePath("modelFile", modelFile)){
         restored = self->load(modelFile);
     }
+    preloadedBody = 0;
+    preloadingMessage.clear();
 
     if(restored){
 
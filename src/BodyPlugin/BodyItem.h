@@ -137,12 +137,17 @@ public:
     EditableSceneBody* sceneBody();
     EditableSceneBody* existingSceneBody();
 
+    //! The links, their shapes and the scene of the body are counted
+    virtual size_t memoryUsage() const;
+
 protected:
     virtual Item* doDuplicate() const;
     virtual void doAssign(Item* item);
     virtual void doPutProperties(PutPropertyFunction& putProperty);
     virtual bool store(Archive& archive);
     virtual bool restore(const Archive& archive);
+    virtual boost::function<void()> getFileDataPreloader(const Archive& archive);
+    virtual boost::function<void()> getFileDataPreloaderForReloading(Item* orgItem);
             
 private:
     friend class BodyItemImpl;
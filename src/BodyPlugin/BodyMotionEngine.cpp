@@ -9,8 +9,12 @@
 #include <cnoid/MenuManager>
 #include <cnoid/ConnectionSet>
 #include <cnoid/Archive>
+#include <cnoid/TimeBar>
+#include <cnoid/LazyCaller>
+#include <cnoid/TaskScheduler>
 #include <boost/bind.hpp>
 #include <map>
+#include <algorithm>
 #include "gettext.h"
 
 using namespace std;
@@ -28,6 +32,24 @@ Action* updateVelocityCheck;
 
 }
 
+namespace cnoid {
+class BodyMotionEngineImpl;
+}
+
+namespace {
+
+/**
+   The forward kinematics of the bodies whose motions only have the root link positions
+   is calculated for all the bodies in parallel when the pending calls are processed,
+   and the kinematic state changes are notified together after it.
+*/
+vector<BodyMotionEngineImpl*> enginesToUpdateKinematicState;
+LazyCaller updateKinematicStatesLater;
+
+void updateKinematicStates();
+
+}
+
 static bool storeProperties(Archive& archive)
 {
     archive.write("updateJointVelocities", updateVelocityCheck->isChecked());
@@ -52,6 +74,11 @@ public:
     bool calcForwardKinematics;
     std::vector<TimeSyncItemEnginePtr> extraSeqEngines;
     ConnectionSet connections;
+    TimeBar* timeBar;
+
+    // The frames applied to the body, which are used to skip the same frames in the playback
+    int currentJointFrame;
+    int currentPositionFrame;
         
     BodyMotionEngineImpl(BodyMotionEngine* self, BodyItem* bodyItem, BodyMotionItem* motionItem){
 
@@ -63,9 +90,14 @@ public:
         qSeq = motion->jointPosSeq();
         positions = motion->linkPosSeq();
         calcForwardKinematics = !(positions && positions->numParts() > 1);
+        timeBar = TimeBar::instance();
+        resetCurrentFrames();
         
         updateExtraSeqEngines();
         
+        connections.add(
+            motionItem->sigUpdated().connect(
+                boost::bind(&BodyMotionEngineImpl::resetCurrentFrames, this)));
         connections.add(
             motionItem->sigUpdated().connect(
                 boost::bind(&BodyMotionEngine::notifyUpdate, self)));
@@ -93,12 +125,26 @@ public:
 
     ~BodyMotionEngineImpl(){
         connections.disconnect();
+        vector<BodyMotionEngineImpl*>& engines = enginesToUpdateKinematicState;
+        engines.erase(std::remove(engines.begin(), engines.end(), this), engines.end());
+    }
+
+    void resetCurrentFrames(){
+        currentJointFrame = -1;
+        currentPositionFrame = -1;
     }
         
     virtual bool onTimeChanged(double time){
 
         bool isActive = false;
-        bool fkDone = false;
+        bool isUpdated = false;
+
+        /*
+          When the playback is faster than the display rate or the time bar has a higher frame rate
+          than the motion, the same frame is given repeatedly and it is not applied again.
+          Out of the playback, the frame is always applied because the body may have been edited.
+        */
+        const bool doSkipSameFrame = timeBar->isDoingPlayback();
             
         if(qSeq){
             bool isValid = false;
@@ -108,21 +154,15 @@ public:
                 const int frame = qSeq->frameOfTime(time);
                 isValid = (frame < numFrames);
                 const int clampedFrame = qSeq->clampFrameIndex(frame);
-                const MultiValueSeq::Frame q = qSeq->frame(clampedFrame);
-                for(int i=0; i < numAllJoints; ++i){
-                    body->joint(i)->q() = q[i];
-                }
-                if(updateVelocityCheck->isChecked()){
-                    const double dt = qSeq->timeStep();
-                    const MultiValueSeq::Frame q_prev = qSeq->frame((clampedFrame == 0) ? 0 : (clampedFrame -1));
-                    for(int i=0; i < numAllJoints; ++i){
-                        body->joint(i)->dq() = (q[i] - q_prev[i]) / dt;
-                    }
+                if(!doSkipSameFrame || clampedFrame != currentJointFrame){
+                    applyJointFrame(clampedFrame, numAllJoints);
+                    isUpdated = true;
                 }
             }
             isActive = isValid;
         }
 
+        bool isRootPositionOnly = false;
         if(positions){
             bool isValid = false;
             const int numLinks = positions->numParts();
@@ -131,29 +171,59 @@ public:
                 const int frame = positions->frameOfTime(time);
                 isValid = (frame < numFrames);
                 const int clampedFrame = positions->clampFrameIndex(frame);
-                for(int i=0; i < numLinks; ++i){
-                    Link* link = body->link(i);
-                    const SE3& position = positions->at(clampedFrame, i);
-                    link->p() = position.translation();
-                    link->R() = position.rotation().toRotationMatrix();
+                if(!doSkipSameFrame || clampedFrame != currentPositionFrame){
+                    applyPositionFrame(clampedFrame, numLinks);
+                    isUpdated = true;
                 }
             }
             isActive |= isValid;
-
-            if(positions->numParts() == 1){
-                body->calcForwardKinematics(); // FK from the root
-                fkDone = true;
-            }
+            isRootPositionOnly = (numLinks == 1);
         }
 
         for(size_t i=0; i < extraSeqEngines.size(); ++i){
             isActive |= extraSeqEngines[i]->onTimeChanged(time);
         }
 
-        bodyItem->notifyKinematicStateChange(!fkDone && calcForwardKinematics);
+        if(isUpdated || !doSkipSameFrame){
+            if(isRootPositionOnly){
+                // FK from the root is done with the other bodies
+                if(std::find(enginesToUpdateKinematicState.begin(), enginesToUpdateKinematicState.end(), this)
+                   == enginesToUpdateKinematicState.end()){
+                    enginesToUpdateKinematicState.push_back(this);
+                }
+                updateKinematicStatesLater();
+            } else {
+                bodyItem->notifyKinematicStateChange(calcForwardKinematics);
+            }
+        }
 
         return isActive;
     }
+
+    void applyJointFrame(int frame, int numAllJoints){
+        currentJointFrame = frame;
+        const MultiValueSeq::Frame q = qSeq->frame(frame);
+        for(int i=0; i < numAllJoints; ++i){
+            body->joint(i)->q() = q[i];
+        }
+        if(updateVelocityCheck->isChecked()){
+            const double dt = qSeq->timeStep();
+            const MultiValueSeq::Frame q_prev = qSeq->frame((frame == 0) ? 0 : (frame -1));
+            for(int i=0; i < numAllJoints; ++i){
+                body->joint(i)->dq() = (q[i] - q_prev[i]) / dt;
+            }
+        }
+    }
+
+    void applyPositionFrame(int frame, int numLinks){
+        currentPositionFrame = frame;
+        for(int i=0; i < numLinks; ++i){
+            Link* link = body->link(i);
+            const SE3& position = positions->at(frame, i);
+            link->p() = position.translation();
+            link->R() = position.rotation().toRotationMatrix();
+        }
+    }
 };
 
 
@@ -172,6 +242,41 @@ TimeSyncItemEngine* createBodyMotionEngine(Item* sourceItem)
 }
 
 
+namespace {
+
+void calcForwardKinematicsOfBody(vector<Body*>* bodies, int index)
+{
+    (*bodies)[index]->calcForwardKinematics();
+}
+
+void updateKinematicStates()
+{
+    vector<BodyMotionEngineImpl*> engines;
+    engines.swap(enginesToUpdateKinematicState);
+
+    // A body may be moved by more than one motion
+    vector<Body*> bodies;
+    for(size_t i=0; i < engines.size(); ++i){
+        Body* body = engines[i]->body.get();
+        if(std::find(bodies.begin(), bodies.end(), body) == bodies.end()){
+            bodies.push_back(body);
+        }
+    }
+    if(bodies.size() == 1){
+        bodies.front()->calcForwardKinematics();
+    } else {
+        TaskScheduler::instance()->parallelFor(
+            0, bodies.size(), boost::bind(calcForwardKinematicsOfBody, &bodies, _1));
+    }
+    
+    for(size_t i=0; i < engines.size(); ++i){
+        engines[i]->bodyItem->notifyKinematicStateChange(false);
+    }
+}
+
+}
+
+
 BodyMotionEngine::BodyMotionEngine(BodyItem* bodyItem, BodyMotionItem* motionItem)
 {
     impl = new BodyMotionEngineImpl(this, bodyItem, motionItem);
@@ -206,6 +311,8 @@ void BodyMotionEngine::initialize(ExtensionManager* ext)
 {
     ext->timeSyncItemEngineManger().addEngineFactory(createBodyMotionEngine);
 
+    updateKinematicStatesLater.setFunction(updateKinematicStates);
+
     MenuManager& mm = ext->menuManager();
     mm.setPath("/Options").setPath(N_("Body Motion Engine"));
     updateVelocityCheck = mm.addCheckItem(_("Update Joint Velocities"));
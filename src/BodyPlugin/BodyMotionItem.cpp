@@ -12,6 +12,7 @@
 #include <cnoid/LazyCaller>
 #include <cnoid/MessageView>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/format.hpp>
 #include "gettext.h"
 
@@ -58,6 +59,7 @@ public:
     vector<ExtraSeqItemInfoPtr> extraSeqItemInfos;
     Signal<void()> sigExtraSeqItemsChanged;
     Connection extraSeqsChangedConnection;
+    BodyMotionPtr preloadedMotion;
 
     BodyMotionItemImpl(BodyMotionItem* self);
     ~BodyMotionItemImpl();
@@ -65,6 +67,8 @@ public:
     void onSubItemUpdated();
     void onExtraSeqItemSetChanged();
     void updateExtraSeqItems();
+    void preloadStandardYamlFile(const std::string& filename);
+    static bool loadStandardYamlFile(BodyMotionItem* item, const std::string& filename);
 };
 }
 
@@ -80,7 +84,7 @@ static bool fileIoSub(BodyMotionItem* item, std::ostream& os, bool loaded, bool
 
 static bool loadStandardYamlFormat(BodyMotionItem* item, const std::string& filename, std::ostream& os)
 {
-    return fileIoSub(item, os, item->motion()->loadStandardYAMLformat(filename), true);
+    return fileIoSub(item, os, BodyMotionItemImpl::loadStandardYamlFile(item, filename), true);
 }
     
 
@@ -89,6 +93,18 @@ static bool saveAsStandardYamlFormat(BodyMotionItem* item, const std::string& fi
     return fileIoSub(item, os, item->motion()->saveAsStandardYAMLformat(filename), false);
 }
 
+
+static bool loadBinaryFormat(BodyMotionItem* item, const std::string& filename, std::ostream& os)
+{
+    return fileIoSub(item, os, item->motion()->loadBinaryFormat(filename), true);
+}
+
+
+static bool saveAsBinaryFormat(BodyMotionItem* item, const std::string& filename, std::ostream& os)
+{
+    return fileIoSub(item, os, item->motion()->saveAsBinaryFormat(filename), false);
+}
+
 static bool bodyMotionItemPreFilter(BodyMotionItem* protoItem, Item* parentItem)
 {
     BodyItemPtr bodyItem = dynamic_cast<BodyItem*>(parentItem);
@@ -152,6 +168,10 @@ void BodyMotionItem::initializeClass(ExtensionManager* ext)
         _("Body Motion"), "BODY-MOTION-YAML", "yaml",
         boost::bind(loadStandardYamlFormat, _1, _2, _3),  boost::bind(saveAsStandardYamlFormat, _1, _2, _3));
 
+    im.addLoaderAndSaver<BodyMotionItem>(
+        _("Body Motion (Binary)"), "BODY-MOTION-BINARY", "cbm",
+        boost::bind(loadBinaryFormat, _1, _2, _3),  boost::bind(saveAsBinaryFormat, _1, _2, _3));
+
     initialized = true;
 }
 
@@ -411,9 +431,48 @@ bool BodyMotionItem::restore(const Archive& archive)
 {
     std::string filename, format;
     if(archive.readRelocatablePath("filename", filename) && archive.read("format", format)){
-        if(load(filename, format)){
+        bool loaded = loadFileOnDemand(archive, filename, format);
+        impl->preloadedMotion.reset();
+        if(loaded){
             return true;
         }
     }
     return false;
 }
+
+
+boost::function<void()> BodyMotionItem::getFileDataPreloader(const Archive& archive)
+{
+    std::string filename, format;
+    if(archive.readRelocatablePath("filename", filename) && archive.read("format", format)){
+        if(format == "BODY-MOTION-YAML" && !archive.isOnDemandLoadingEnabled()){
+            return boost::bind(&BodyMotionItemImpl::preloadStandardYamlFile, impl, filename);
+        }
+    }
+    return boost::function<void()>();
+}
+
+
+void BodyMotionItemImpl::preloadStandardYamlFile(const std::string& filename)
+{
+    BodyMotionPtr motion = boost::make_shared<BodyMotion>();
+    if(motion->loadStandardYAMLformat(filename)){
+        preloadedMotion = motion;
+    }
+}
+
+
+/**
+   The motion loaded by preloadStandardYamlFile() is used if it exists.
+   Otherwise the file is loaded here, and the error messages are given by the motion.
+*/
+bool BodyMotionItemImpl::loadStandardYamlFile(BodyMotionItem* item, const std::string& filename)
+{
+    BodyMotionItemImpl* impl = item->impl;
+    if(impl->preloadedMotion){
+        *item->motion() = *impl->preloadedMotion;
+        impl->preloadedMotion.reset();
+        return true;
+    }
+    return item->motion()->loadStandardYAMLformat(filename);
+}
@@ -71,6 +71,7 @@ protected:
     virtual Item* doDuplicate() const;
     virtual bool store(Archive& archive);
     virtual bool restore(const Archive& archive);
+    virtual boost::function<void()> getFileDataPreloader(const Archive& archive);
 
 private:
     BodyMotionPtr bodyMotion_;
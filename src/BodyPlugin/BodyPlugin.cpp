@@ -11,7 +11,10 @@
 #include "AISTSimulatorItem.h"
 #include "BodyMotionControllerItem.h"
 #include "GLVisionSimulatorItem.h"
+#include "RayCastRangeSensorSimulatorItem.h"
+#include "OccupancyMapSimulatorItem.h"
 #include "WorldLogFileItem.h"
+#include "SimulationStreamerItem.h"
 #include "SensorVisualizerItem.h"
 #include "BodyTrackingCameraItem.h"
 //#include "FilterDialogs.h"
@@ -28,6 +31,10 @@
 #include "LinkGraphView.h"
 #include "KinematicsBar.h"
 #include "SimulationBar.h"
+#include "SimulationSweep.h"
+#include "SimulationBenchmark.h"
+#include "BatchVideoRenderer.h"
+#include "RenderingBenchmark.h"
 #include "BodyMotionEngine.h"
 #include "EditableSceneBody.h"
 #include "HrpsysFileIO.h"
@@ -62,7 +69,10 @@ public:
         AISTSimulatorItem::initializeClass(this);
         BodyMotionControllerItem::initializeClass(this);
         GLVisionSimulatorItem::initializeClass(this);
+        RayCastRangeSensorSimulatorItem::initializeClass(this);
+        OccupancyMapSimulatorItem::initializeClass(this);
         WorldLogFileItem::initializeClass(this);
+        SimulationStreamerItem::initializeClass(this);
         SensorVisualizerItem::initializeClass(this);
         BodyTrackingCameraItem::initializeClass(this);
 
@@ -78,6 +88,10 @@ public:
         EditableSceneBody::initializeClass(this);
 
         SimulationBar::initialize(this);
+        SimulationSweep::initialize(this);
+        SimulationBenchmark::initialize(this);
+        BatchVideoRenderer::initialize(this);
+        RenderingBenchmark::initialize(this);
         addToolBar(BodyBar::instance());
         addToolBar(LeggedBodyBar::instance());
         addToolBar(KinematicsBar::instance());
@@ -206,3 +206,26 @@ void CollisionSeq::readCollisionData(int nFrames, const Listing& values)
         }
     }
 }
+
+
+size_t CollisionSeq::memoryUsage() const
+{
+    size_t usage = BaseSeqType::memoryUsage();
+    const int nf = numFrames();
+    const int np = numParts();
+    for(int i=0; i < nf; ++i){
+        for(int j=0; j < np; ++j){
+            const CollisionLinkPairList* pairs = (*this)(i, j).get();
+            if(pairs){
+                usage += sizeof(CollisionLinkPairList) + pairs->capacity() * sizeof(CollisionLinkPairPtr);
+                for(size_t k=0; k < pairs->size(); ++k){
+                    const CollisionLinkPair* pair = (*pairs)[k].get();
+                    if(pair){
+                        usage += sizeof(CollisionLinkPair) + pair->collisions.capacity() * sizeof(Collision);
+                    }
+                }
+            }
+        }
+    }
+    return usage;
+}
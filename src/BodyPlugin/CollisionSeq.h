@@ -37,6 +37,8 @@ public:
     void writeCollsionData(YAMLWriter& writer, const CollisionLinkPairListPtr ptr);
     void readCollisionData(int nFrames, const Listing& values);
 
+    virtual size_t memoryUsage() const;
+
 };
 
 typedef boost::shared_ptr<CollisionSeq> CollisionSeqPtr;
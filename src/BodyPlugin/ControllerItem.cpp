@@ -5,7 +5,11 @@
 
 #include "ControllerItem.h"
 #include <cnoid/Archive>
+#include <cnoid/MessageView>
 #include <boost/tokenizer.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
 #include "gettext.h"
 
 using namespace std;
@@ -19,16 +23,53 @@ double ControllerItemIO::worldTimeStep() const
 }
 
 
+namespace {
+
+const size_t maxNumOverrunTimes = 1000;
+
+}
+
+
 ControllerItem::ControllerItem()
+    : overrunAction_(N_OVERRUN_ACTIONS, CNOID_GETTEXT_DOMAIN_NAME)
 {
     isImmediateMode_ = true;
+    isParallelControlEnabled_ = false;
+    controlPeriod_ = 0.0;
+    timeBudget_ = 0.0;
+    initializeOverrunActionSelection();
+    overrunAction_.select(LOG_OVERRUNS);
+    numPersistentOverruns_ = 10;
+    controlInterval_ = 1;
+    isControlDue_ = true;
+    lastControlResult_ = false;
+    resetControlTimeStatistics();
 }
 
 
 ControllerItem::ControllerItem(const ControllerItem& org)
-    : Item(org)
+    : Item(org),
+      overrunAction_(N_OVERRUN_ACTIONS, CNOID_GETTEXT_DOMAIN_NAME)
 {
     isImmediateMode_ = org.isImmediateMode_;
+    isParallelControlEnabled_ = org.isParallelControlEnabled_;
+    controlPeriod_ = org.controlPeriod_;
+    timeBudget_ = org.timeBudget_;
+    initializeOverrunActionSelection();
+    overrunAction_.select(org.overrunAction_.which());
+    numPersistentOverruns_ = org.numPersistentOverruns_;
+    controlInterval_ = 1;
+    isControlDue_ = true;
+    lastControlResult_ = false;
+    resetControlTimeStatistics();
+}
+
+
+void ControllerItem::initializeOverrunActionSelection()
+{
+    overrunAction_.setSymbol(LOG_OVERRUNS, N_("Log"));
+    overrunAction_.setSymbol(STOP_ON_OVERRUNS, N_("Stop"));
+    overrunAction_.setSymbol(IGNORE_OVERRUNS, N_("Ignore"));
 }
 
 
@@ -60,6 +101,107 @@ void ControllerItem::setImmediateMode(bool on)
 }
 
 
+void ControllerItem::setParallelControlEnabled(bool on)
+{
+    isParallelControlEnabled_ = on;
+}
+
+
+void ControllerItem::setControlPeriod(double period)
+{
+    controlPeriod_ = std::max(0.0, period);
+}
+
+
+void ControllerItem::setTimeBudget(double time)
+{
+    timeBudget_ = std::max(0.0, time);
+}
+
+
+void ControllerItem::setOverrunAction(int action)
+{
+    overrunAction_.select(action);
+}
+
+
+void ControllerItem::setNumPersistentOverruns(int n)
+{
+    numPersistentOverruns_ = std::max(1, n);
+}
+
+
+void ControllerItem::resetControlTimeStatistics()
+{
+    ControlTimeStatistics& s = controlTimeStatistics_;
+    s.numControlSteps = 0;
+    s.totalInputTime = 0.0;
+    s.totalControlTime = 0.0;
+    s.totalOutputTime = 0.0;
+    s.maxStepTime = 0.0;
+    s.numOverruns = 0;
+    s.overrunTimes.clear();
+    inputTime_ = 0.0;
+    controlTime_ = 0.0;
+    outputTime_ = 0.0;
+    numConsecutiveOverruns_ = 0;
+}
+
+
+/**
+   This function is called by the simulator item in the simulation thread after the outputs
+   of the control step.
+   @return false to request stopping the simulation
+*/
+bool ControllerItem::updateControlTimeStatistics(double simulationTime)
+{
+    ControlTimeStatistics& s = controlTimeStatistics_;
+    const double stepTime = inputTime_ + controlTime_ + outputTime_;
+    ++s.numControlSteps;
+    s.totalInputTime += inputTime_;
+    s.totalControlTime += controlTime_;
+    s.totalOutputTime += outputTime_;
+    s.maxStepTime = std::max(s.maxStepTime, stepTime);
+    inputTime_ = 0.0;
+    controlTime_ = 0.0;
+    outputTime_ = 0.0;
+
+    if(timeBudget_ <= 0.0 || stepTime <= timeBudget_){
+        numConsecutiveOverruns_ = 0;
+        return true;
+    }
+
+    ++s.numOverruns;
+    if(s.overrunTimes.size() < maxNumOverrunTimes){
+        s.overrunTimes.push_back(simulationTime);
+    }
+
+    // The action is taken once for each series of the overruns
+    if(++numConsecutiveOverruns_ != numPersistentOverruns_){
+        return true;
+    }
+
+    const int action = overrunAction_.which();
+    if(action == LOG_OVERRUNS){
+        MessageView::instance()->putln(
+            MessageView::WARNING,
+            boost::format(_("%1% has exceeded its time budget of %2$.3f [ms] in %3% consecutive control steps "
+                            "at %4$.3f [s]. The last step took %5$.3f [ms]."))
+            % name() % (timeBudget_ * 1000.0) % numConsecutiveOverruns_ % simulationTime % (stepTime * 1000.0));
+
+    } else if(action == STOP_ON_OVERRUNS){
+        MessageView::instance()->putln(
+            MessageView::ERROR,
+            boost::format(_("The simulation is stopped because %1% has exceeded its time budget of %2$.3f [ms] "
+                            "in %3% consecutive control steps at %4$.3f [s]."))
+            % name() % (timeBudget_ * 1000.0) % numConsecutiveOverruns_ % simulationTime);
+        return false;
+    }
+
+    return true;
+}
+
+
 bool ControllerItem::isActive() const
 {
     return simulatorItem_ ? simulatorItem_->isRunning() : false;
@@ -90,6 +232,18 @@ void ControllerItem::stop()
 }
 
 
+ReferencedPtr ControllerItem::storeSimulationState()
+{
+    return 0;
+}
+
+
+void ControllerItem::restoreSimulationState(const Referenced* state)
+{
+
+}
+
+
 std::string ControllerItem::getMessage()
 {
     string message(message_);
@@ -117,14 +271,51 @@ SignalProxy<void(const std::string& message)> ControllerItem::sigMessage()
 void ControllerItem::doPutProperties(PutPropertyFunction& putProperty)
 {
     putProperty(_("Immediate mode"), isImmediateMode_, changeProperty(isImmediateMode_));
+    putProperty(_("Parallel control"), isParallelControlEnabled_, changeProperty(isParallelControlEnabled_));
+    putProperty.decimals(4).min(0.0)(_("Control period"), controlPeriod_, changeProperty(controlPeriod_));
     putProperty(_("Controller options"), optionString_, changeProperty(optionString_));
+    putProperty.decimals(3).min(0.0)(_("Time budget [ms]"), timeBudget_ * 1000.0,
+                                     boost::bind(&ControllerItem::onTimeBudgetPropertyChanged, this, _1));
+    putProperty(_("Overrun action"), overrunAction_,
+                boost::bind(&Selection::selectIndex, &overrunAction_, _1));
+    putProperty.min(1)(_("Persistent overruns"), numPersistentOverruns_, changeProperty(numPersistentOverruns_));
+
+    const ControlTimeStatistics& s = controlTimeStatistics_;
+    if(s.numControlSteps > 0){
+        const double averageTime = (s.totalInputTime + s.totalControlTime + s.totalOutputTime) / s.numControlSteps;
+        putProperty(_("Control step time [ms]"),
+                    str(boost::format(_("mean %1$.3f, max %2$.3f")) % (averageTime * 1000.0) % (s.maxStepTime * 1000.0)));
+        putProperty(_("Input / control / output [ms]"),
+                    str(boost::format("%1$.3f / %2$.3f / %3$.3f")
+                        % (s.totalInputTime / s.numControlSteps * 1000.0)
+                        % (s.totalControlTime / s.numControlSteps * 1000.0)
+                        % (s.totalOutputTime / s.numControlSteps * 1000.0)));
+        if(s.numOverruns > 0){
+            putProperty(_("Overruns"),
+                        str(boost::format(_("%1% (last at %2$.3f [s])")) % s.numOverruns % s.overrunTimes.back()));
+        } else {
+            putProperty(_("Overruns"), 0);
+        }
+    }
+}
+
+
+bool ControllerItem::onTimeBudgetPropertyChanged(double time)
+{
+    setTimeBudget(time / 1000.0);
+    return true;
 }
 
 
 bool ControllerItem::store(Archive& archive)
 {
     archive.write("isImmediateMode", isImmediateMode_);
+    archive.write("isParallelControlEnabled", isParallelControlEnabled_);
+    archive.write("controlPeriod", controlPeriod_);
     archive.write("controllerOptions", optionString_, DOUBLE_QUOTED);
+    archive.write("timeBudget", timeBudget_);
+    archive.write("overrunAction", overrunAction_.selectedSymbol());
+    archive.write("numPersistentOverruns", numPersistentOverruns_);
     return true;
 }
 
@@ -132,7 +323,15 @@ bool ControllerItem::store(Archive& archive)
 bool ControllerItem::restore(const Archive& archive)
 {
     archive.read("isImmediateMode", isImmediateMode_);
+    archive.read("isParallelControlEnabled", isParallelControlEnabled_);
+    archive.read("controlPeriod", controlPeriod_);
     archive.read("controllerOptions", optionString_);
+    archive.read("timeBudget", timeBudget_);
+    string symbol;
+    if(archive.read("overrunAction", symbol)){
+        overrunAction_.select(symbol);
+    }
+    archive.read("numPersistentOverruns", numPersistentOverruns_);
     return true;
 }
 
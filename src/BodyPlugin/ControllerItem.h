@@ -7,6 +7,7 @@
 #define CNOID_BODY_PLUGIN_CONTROLLER_ITEM_H
 
 #include "SimulatorItem.h"
+#include <cnoid/Selection>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -39,6 +40,61 @@ public:
     bool isImmediateMode() const { return isImmediateMode_; }
     void setImmediateMode(bool on);
 
+    /**
+       When the controller threads are used, the control() functions of the controllers for which
+       this mode is enabled are executed in parallel with the controllers of the other bodies.
+       The mode should only be enabled when control() does not access the data shared with
+       the other controllers without the synchronization. The controllers of the same body are
+       executed in order, and the simulation step waits for all the controllers as before.
+    */
+    bool isParallelControlEnabled() const { return isParallelControlEnabled_; }
+    void setParallelControlEnabled(bool on);
+
+    /**
+       The period in which input(), control() and output() are called in a simulation.
+       Zero, which is the default, means every simulation step. The period is rounded to a multiple
+       of the world time step, and the time step of the ControllerItemIO object given to the controller
+       is the rounded period, so the controller does not have to count the simulation steps.
+       The physics is calculated at the world time step between the control steps, and the outputs
+       of the controller are kept until its next control step.
+    */
+    void setControlPeriod(double period);
+    double controlPeriod() const { return controlPeriod_; }
+
+    /**
+       The time budget of input(), control() and output() in a control step. Zero, which is
+       the default, disables the check. A control step exceeding the budget is counted as
+       an overrun, and the overrun action is taken when the overruns continue for the number of
+       the persistent overruns. The action is logging a warning by default.
+    */
+    void setTimeBudget(double time);
+    double timeBudget() const { return timeBudget_; }
+
+    enum OverrunAction { LOG_OVERRUNS, STOP_ON_OVERRUNS, IGNORE_OVERRUNS, N_OVERRUN_ACTIONS };
+    void setOverrunAction(int action);
+    int overrunAction() const { return overrunAction_.which(); }
+
+    //! The default value is 10
+    void setNumPersistentOverruns(int n);
+    int numPersistentOverruns() const { return numPersistentOverruns_; }
+
+    /**
+       The durations of input(), control() and output() in the control steps of the current
+       or last simulation in seconds. The simulation times of the first 1000 overruns are kept.
+       @note The statistics are updated in the simulation thread.
+    */
+    struct ControlTimeStatistics
+    {
+        int numControlSteps;
+        double totalInputTime;
+        double totalControlTime;
+        double totalOutputTime;
+        double maxStepTime;
+        int numOverruns;
+        std::vector<double> overrunTimes;
+    };
+    const ControlTimeStatistics& controlTimeStatistics() const { return controlTimeStatistics_; }
+
     const std::string& optionString() const { return optionString_; }
     bool splitOptionString(const std::string& optionString, std::vector<std::string>& out_options) const;
 
@@ -85,6 +141,21 @@ public:
     */
     virtual void stop();
 
+    /**
+       Override this function to include the internal state of the controller in the checkpoints
+       created by SimulatorItem::createCheckpoint(). The returned object is only used as the argument
+       of restoreSimulationState(), so its type can be defined by the controller.
+       @return A null pointer if the controller does not support the checkpoints, which is the default
+       @note This function is called from the simulation thread between the simulation steps.
+    */
+    virtual ReferencedPtr storeSimulationState();
+
+    /**
+       @param state The object returned by storeSimulationState() when the checkpoint was created
+       @note This function is called from the simulation thread between the simulation steps.
+    */
+    virtual void restoreSimulationState(const Referenced* state);
+
     SignalProxy<void(const std::string& message)> sigMessage();
     std::string getMessage();
 
@@ -103,15 +174,35 @@ protected:
 private:
     SimulatorItemPtr simulatorItem_;
     bool isImmediateMode_;
+    bool isParallelControlEnabled_;
+    double controlPeriod_;
+    double timeBudget_;
+    Selection overrunAction_;
+    int numPersistentOverruns_;
+    ControlTimeStatistics controlTimeStatistics_;
+
+    // The following variables are used by the simulator item
+    int controlInterval_;
+    bool isControlDue_;
+    bool lastControlResult_;
     std::string message_;
     Signal<void(const std::string& message)> sigMessage_;
     std::string optionString_;
+    double inputTime_;
+    double controlTime_;
+    double outputTime_;
+    int numConsecutiveOverruns_;
 
     friend class SimulatorItemImpl;
+    friend class SimulationBodyImpl;
 
     void setSimulatorItem(SimulatorItem* item) {
         simulatorItem_ = item;
     }
+    void initializeOverrunActionSelection();
+    bool onTimeBudgetPropertyChanged(double time);
+    void resetControlTimeStatistics();
+    bool updateControlTimeStatistics(double simulationTime);
 };
         
 typedef ref_ptr<ControllerItem> ControllerItemPtr;
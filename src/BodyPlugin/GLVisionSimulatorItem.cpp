@@ -21,13 +21,20 @@
 #include <cnoid/SceneCameras>
 #include <cnoid/SceneLights>
 #include <cnoid/EigenUtil>
+#include <cnoid/SimulationProfiler>
+#include <cnoid/ProfiledMutex>
+#include <cnoid/SharedObjectPool>
+#include <cnoid/PointSetUtil>
 #include <QThread>
 #include <QApplication>
 #include <boost/thread.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
-#include <queue>
+#include <boost/functional/hash.hpp>
+#include <deque>
+#include <algorithm>
+#include <cstring>
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
 #define USE_QT5_OPENGL 1
@@ -43,6 +50,23 @@
 #include <QGLPixelBuffer>
 #endif
 
+#ifdef CNOID_ENABLE_EGL
+#include <cnoid/EGLOffscreenContext>
+#endif
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
 #include "gettext.h"
 
 using namespace std;
@@ -66,6 +90,21 @@ inline double myNearByInt(double x)
 #endif
 }
 
+bool containsLightOrCamera(SgNode* node)
+{
+    if(dynamic_cast<SgLight*>(node) || dynamic_cast<SgCamera*>(node)){
+        return true;
+    }
+    if(SgGroup* group = dynamic_cast<SgGroup*>(node)){
+        for(SgGroup::iterator p = group->begin(); p != group->end(); ++p){
+            if(containsLightOrCamera(*p)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 string getNameListString(const vector<string>& names)
 {
     string nameList;
@@ -98,6 +137,134 @@ bool updateNames(const string& nameListString, string& newNameListString, vector
     return true;
 }
 
+/**
+   The functions for the pixel buffer objects, which are not declared in the OpenGL 1.1 header.
+   The functions must be obtained for each context because they may differ among the contexts.
+*/
+struct PixelBufferFunctions
+{
+    typedef void (APIENTRY *GenBuffersFunc)(GLsizei n, GLuint* buffers);
+    typedef void (APIENTRY *DeleteBuffersFunc)(GLsizei n, const GLuint* buffers);
+    typedef void (APIENTRY *BindBufferFunc)(GLenum target, GLuint buffer);
+    typedef void (APIENTRY *BufferDataFunc)(GLenum target, ptrdiff_t size, const GLvoid* data, GLenum usage);
+    typedef GLvoid* (APIENTRY *MapBufferFunc)(GLenum target, GLenum access);
+    typedef GLboolean (APIENTRY *UnmapBufferFunc)(GLenum target);
+
+    GenBuffersFunc genBuffers;
+    DeleteBuffersFunc deleteBuffers;
+    BindBufferFunc bindBuffer;
+    BufferDataFunc bufferData;
+    MapBufferFunc mapBuffer;
+    UnmapBufferFunc unmapBuffer;
+
+#ifdef CNOID_ENABLE_EGL
+    //! The functions are obtained from this context instead of the Qt's current context if it is given.
+    EGLOffscreenContext* eglContext;
+#endif
+
+    PixelBufferFunctions(){
+#ifdef CNOID_ENABLE_EGL
+        eglContext = 0;
+#endif
+    }
+
+    template<class FunctionType> bool getFunction(const char* name, FunctionType& out_function){
+#ifdef CNOID_ENABLE_EGL
+        if(eglContext){
+            out_function = reinterpret_cast<FunctionType>(eglContext->getProcAddress(name));
+            return (out_function != 0);
+        }
+#endif
+#if USE_QT5_OPENGL
+        out_function = reinterpret_cast<FunctionType>(QOpenGLContext::currentContext()->getProcAddress(name));
+#else
+        out_function = reinterpret_cast<FunctionType>(QGLContext::currentContext()->getProcAddress(name));
+#endif
+        return (out_function != 0);
+    }
+
+    //! The GL context must be current when this function is called.
+    bool initialize(){
+        return getFunction("glGenBuffers", genBuffers) &&
+            getFunction("glDeleteBuffers", deleteBuffers) &&
+            getFunction("glBindBuffer", bindBuffer) &&
+            getFunction("glBufferData", bufferData) &&
+            getFunction("glMapBuffer", mapBuffer) &&
+            getFunction("glUnmapBuffer", unmapBuffer);
+    }
+};
+
+/**
+   A part of the scene which is not rendered when its bounding sphere is outside the view of a sensor.
+   The bounding box of the switch node is given in the coordinate of the transform node, or in the
+   world coordinate if the transform node is null. The scene links have the world positions.
+*/
+struct CullingNode
+{
+    SgSwitchPtr switchNode;
+    SgPosTransform* transform;
+};
+
+/**
+   The scene graph, the GL context and the renderer which are shared by all the sensors
+   rendered in the queue thread. Each sensor gives the link positions at its onset time
+   as a snapshot because the scene may be being rendered for another sensor.
+*/
+class SharedVisionScene : public Referenced
+{
+public:
+    SgGroupPtr sceneGroup;
+    vector<SceneBodyPtr> sceneBodies;
+    vector<CullingNode> cullingNodes;
+#if USE_QT5_OPENGL
+    QOpenGLContext* glContext;
+    QOffscreenSurface* offscreenSurface;
+#endif
+#ifdef CNOID_ENABLE_EGL
+    EGLOffscreenContext* eglContext;
+#endif
+    GLSceneRenderer* renderer;
+
+    /**
+       This is locked while the scene is rendered. The scenes of the devices are only updated
+       by the simulation thread when the mutex can be locked without waiting.
+    */
+    boost::mutex sceneMutex;
+
+    SharedVisionScene() {
+#if USE_QT5_OPENGL
+        glContext = 0;
+        offscreenSurface = 0;
+#endif
+#ifdef CNOID_ENABLE_EGL
+        eglContext = 0;
+#endif
+        renderer = 0;
+    }
+
+    ~SharedVisionScene() {
+#ifdef CNOID_ENABLE_EGL
+        if(eglContext){
+            eglContext->makeCurrent();
+            delete renderer;
+            renderer = 0;
+            eglContext->doneCurrent();
+            delete eglContext;
+        }
+#endif
+#if USE_QT5_OPENGL
+        if(glContext){
+            glContext->makeCurrent(offscreenSurface);
+            delete renderer;
+            glContext->doneCurrent();
+            delete glContext;
+            delete offscreenSurface;
+        }
+#endif
+    }
+};
+typedef ref_ptr<SharedVisionScene> SharedVisionScenePtr;
+
 class QThreadEx : public QThread
 {
     boost::function<void()> function;
@@ -114,15 +281,20 @@ public:
 class VisionRenderer : public Referenced
 {
 public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        
     GLVisionSimulatorItemImpl* simImpl;
     bool isRendering; // only updated and referred to in the simulation thread
     double elapsedTime;
     double cycleTime;
     double latency;
     double onsetTime;
+    double dataOnsetTime;
+    //! The time by which the data must be available, which is used to order the rendering queue
+    double deadline;
     QThreadEx renderingThread;
-    boost::condition_variable renderingCondition;
-    boost::mutex renderingMutex;
+    ProfiledConditionVariable renderingCondition;
+    ProfiledMutex renderingMutex;
     bool isRenderingRequested;
     bool isRenderingFinished;
     bool isTerminationRequested;
@@ -138,9 +310,40 @@ public:
     RangeCameraPtr rangeCameraForRendering;
     RangeSensorPtr rangeSensorForRendering;
     double depthError;
+    double rangeCameraVoxelSize;
+
+    /**
+       A range sensor whose yaw range is too wide for a frustum is rendered as the sectors which
+       have the same yaw ranges by rotating the camera. The number is zero for the other sensors.
+    */
+    int numRangeSectors;
+    double rangeSectorYawRange;
+    //! The yaw indices of the beams of the i-th sector are in [rangeSectorYawIndices[i], rangeSectorYawIndices[i+1])
+    vector<int> rangeSectorYawIndices;
+    SgPosTransformPtr rangeCameraPos;
+    vector<float> rangeSectorBuffer;
+
+    bool hasSensorNoise;
+    bool isSensorNoiseUnavailable;
+    double lensDistortionK1;
+    double lensDistortionK2;
+    double rangeNoise;
+    double rangeQuantizationStep;
+    double dropoutRate;
+    unsigned int noiseSeed;
+    unsigned int noiseFrameCounter;
         
     SgGroupPtr sceneGroup;
     vector<SceneBodyPtr> sceneBodies;
+    vector<CullingNode> cullingNodes;
+    SgCamera* sensorCamera;
+    //! The world position of the sensor camera is given by these nodes for the culling
+    SceneLink* sensorSceneLink;
+    SgPosTransform* sensorCameraTransform;
+    SharedVisionScenePtr sharedScene;
+    vector<Position, Eigen::aligned_allocator<Position> > linkPositionSnapshot;
+    //! Used to notify the link position updates, which invalidate the cached bounding boxes for the frustum culling
+    SgUpdate sceneUpdate;
 
 #if USE_QT5_OPENGL
     QOpenGLContext* glContext;
@@ -149,36 +352,117 @@ public:
 #else
     QGLPixelBuffer* renderingBuffer;
 #endif
+#ifdef CNOID_ENABLE_EGL
+    EGLOffscreenContext* eglContext;
+    unsigned int eglFrameBuffer;
+#endif
 
     GLSceneRenderer* renderer;
     int pixelWidth;
     int pixelHeight;
+
+    //! The projection matrix of the last rendering, which is used to extract the data later
+    Matrix4 projectionMatrix;
+
+    /**
+       The pixels are read into one of the pixel buffer objects asynchronously and the data is
+       extracted from the oldest one, so the data delays by (pixelBuffers.size() - 1) frames.
+    */
+    struct PixelBuffer {
+        GLuint colorBuffer;
+        GLuint depthBuffer;
+        double onsetTime;
+        bool isFilled;
+        bool hasPoints; // the depth buffer contains the points converted on the GPU
+    };
+    PixelBufferFunctions pbo;
+    vector<PixelBuffer> pixelBuffers;
+    int pixelBufferIndex;
+
+    /**
+       If this is true, the data is extracted after the other sensors in the queue are rendered
+       so that the transfer of the pixels is overlapped with the rendering.
+    */
+    bool isPixelBufferReadbackDeferred;
+
+    //! The points of the range camera are computed by the GLSL renderer
+    bool isPointConversionOnGPU;
+    
     boost::shared_ptr<Image> tmpImage;
     boost::shared_ptr<RangeCamera::PointData> tmpPoints;
+    vector<int> voxelPointIndices;
+    vector<int> voxelBegins;
+    vector<Vector3f> downsampledPoints;
+    vector<unsigned char> downsampledColors;
+    boost::shared_ptr<RangeCamera::DepthImage> tmpDepthImage;
     boost::shared_ptr<RangeSensor::RangeData> tmpRangeData;
+    boost::shared_ptr<RangeSensor::FloatRangeData> tmpFloatRangeData;
+    boost::shared_ptr<RangeSensor::FixedPointRangeData> tmpFixedPointRangeData;
+    bool isDepthImageOutput;
+
+    /**
+       The data given to the devices are returned to these pools when the devices and the controllers
+       release them, so the buffers are not allocated and initialized for every frame.
+    */
+    SharedObjectPool<Image> imagePool;
+    SharedObjectPool<RangeCamera::PointData> pointsPool;
+    SharedObjectPool<RangeCamera::DepthImage> depthImagePool;
+    SharedObjectPool<RangeSensor::RangeData> rangeDataPool;
+    SharedObjectPool<RangeSensor::FloatRangeData> floatRangeDataPool;
+    SharedObjectPool<RangeSensor::FixedPointRangeData> fixedPointRangeDataPool;
     SimulationBody* simBody;
     int bodyIndex;
+    int renderingStageId;
+    int readbackStageId;
+    int pointConversionStageId;
+    int gpuStageId;
 
     VisionRenderer(GLVisionSimulatorItemImpl* simImpl, Device* sensor, SimulationBody* simBody, int bodyIndex);
     ~VisionRenderer();
     bool initialize(const vector<SimulationBody*>& simBodies);
+    bool initializeGLContext();
     void initializeScene(const vector<SimulationBody*>& simBodies);
+    void initializeCullingNodes();
     SgCamera* initializeCamera();
+    void initializeSensorNoise();
+    void initializeRangeSensorSectors(SgPerspectiveCamera* camera);
+    bool initializePixelBuffers();
+    void deletePixelBuffers();
     void moveRenderingBufferToThread(QThread& thread);
     void moveRenderingBufferToMainThread();
     void makeGLContextCurrent();
     void doneGLContextCurrent();
+    void bindFrameBuffer();
+    void setRenderingStatesOfSensor();
     void updateScene(bool updateSensorForRenderingThread);
+    void applyLinkPositionSnapshot();
     void renderInCurrentThread(bool doStoreResultToTmpDataBuffer);
+    void renderScene(bool doStoreResultToTmpDataBuffer);
+    void applySensorNoise();
+    void recordGPUTime();
+    void cullSceneNodes();
+    void renderRangeSensorSectors(bool doStoreResultToTmpDataBuffer);
+    void resampleRangeSensorSector(vector<double>& rangeData, const float* depthBuf, int yawBegin, int yawEnd, double firstYawAngle);
     void startConcurrentRendering();
     void concurrentRenderingLoop();
     void storeResultToTmpDataBuffer();
+    void startPixelBufferReadback();
+    void finishPixelBufferReadback();
+    void finishDeferredPixelBufferReadback();
     bool waitForRenderingToFinish();
-    bool waitForRenderingToFinish(boost::unique_lock<boost::mutex>& lock);
+    bool waitForRenderingToFinish(boost::unique_lock<ProfiledMutex>& lock);
     void copyVisionData();
     bool getCameraImage(Image& image);
     bool getRangeCameraData(Image& image, vector<Vector3f>& points);
+    bool getRangeCameraDepthImage(Image& image, RangeCamera::DepthImage& depthImage);
     bool getRangeSensorData(vector<double>& rangeData);
+    bool extractCameraImage(Image& image, const unsigned char* colorBuf);
+    bool extractRangeCameraData(Image& image, vector<Vector3f>& points, const unsigned char* colorBuf, const float* depthBuf);
+    bool extractRangeCameraDataFromPoints(Image& image, vector<Vector3f>& points, const unsigned char* colorBuf);
+    void downsampleRangeCameraData(Image& image, vector<Vector3f>& points);
+    bool extractRangeCameraDepthImage(Image& image, RangeCamera::DepthImage& depthImage, const unsigned char* colorBuf, const float* depthBuf);
+    bool extractRangeSensorData(vector<double>& rangeData, const float* depthBuf);
+    void convertRangeSensorDataFormat();
 };
 typedef ref_ptr<VisionRenderer> VisionRendererPtr;
 
@@ -192,6 +476,8 @@ public:
     GLVisionSimulatorItem* self;
     ostream& os;
     SimulatorItem* simulatorItem;
+    SimulationProfiler* profiler;
+    int renderingWaitStageId;
     double worldTimeStep;
     double currentTime;
     vector<VisionRendererPtr> visionRenderers;
@@ -206,12 +492,13 @@ public:
 
     // for the single vision simulator thread rendering
     QThreadEx queueThread;
-    boost::condition_variable queueCondition;
-    boost::mutex queueMutex;
-    queue<VisionRenderer*> rendererQueue;
+    ProfiledConditionVariable queueCondition;
+    ProfiledMutex queueMutex;
+    deque<VisionRenderer*> rendererQueue;
     
     double rangeSensorPrecisionRatio;
     double depthError;
+    double rangeCameraVoxelSize;
 
     vector<string> bodyNames;
     string bodyNameListString;
@@ -219,6 +506,14 @@ public:
     string sensorNameListString;
     bool useThreadsForSensorsProperty;
     bool isBestEffortModeProperty;
+    bool isPixelBufferReadbackEnabled;
+    int readbackDelay;
+    bool isSceneSharingEnabled;
+    SharedVisionScenePtr sharedScene;
+    bool isDeadlineSchedulingEnabled;
+    bool isCullingEnabled;
+    bool isEGLContextEnabled;
+    bool useEGL;
     bool shootAllSceneObjects;
     bool isHeadLightEnabled;
     bool areAdditionalLightsEnabled;
@@ -231,7 +526,9 @@ public:
     ~GLVisionSimulatorItemImpl();
     bool initializeSimulation(SimulatorItem* simulatorItem);
     void addTargetSensor(SimulationBody* simBody, int bodyIndex, Device* sensor);
+    void staggerSensorPhases();
     void onPreDynamics();
+    void pushToRendererQueue(VisionRenderer* renderer);
     void queueRenderingLoop();
     void onPostDynamics();
     void getVisionDataInThreadsForSensors();
@@ -268,18 +565,29 @@ GLVisionSimulatorItem::GLVisionSimulatorItem()
 
 GLVisionSimulatorItemImpl::GLVisionSimulatorItemImpl(GLVisionSimulatorItem* self)
     : self(self),
-      os(MessageView::instance()->cout())
+      os(MessageView::instance()->cout()),
+      queueCondition("Vision rendering queue"),
+      queueMutex("Vision rendering queue")
 {
     simulatorItem = 0;
+    profiler = 0;
     maxFrameRate = 1000.0;
     maxLatency = 1.0;
     rangeSensorPrecisionRatio = 2.0;
     depthError = 0.0;
+    rangeCameraVoxelSize = 0.0;
 
     useGLSL = (getenv("CNOID_USE_GLSL") != 0);
     isVisionDataRecordingEnabled = false;
     useThreadsForSensorsProperty = true;
     isBestEffortModeProperty = false;
+    isPixelBufferReadbackEnabled = false;
+    readbackDelay = 0;
+    isSceneSharingEnabled = false;
+    isDeadlineSchedulingEnabled = false;
+    isCullingEnabled = true;
+    isEGLContextEnabled = false;
+    useEGL = false;
     isHeadLightEnabled = true;
     areAdditionalLightsEnabled = true;
     shootAllSceneObjects = false;
@@ -296,19 +604,30 @@ GLVisionSimulatorItem::GLVisionSimulatorItem(const GLVisionSimulatorItem& org)
 GLVisionSimulatorItemImpl::GLVisionSimulatorItemImpl(GLVisionSimulatorItem* self, const GLVisionSimulatorItemImpl& org)
     : self(self),
       os(MessageView::instance()->cout()),
+      queueCondition("Vision rendering queue"),
+      queueMutex("Vision rendering queue"),
       bodyNames(org.bodyNames),
       sensorNames(org.sensorNames)
 {
     simulatorItem = 0;
+    profiler = 0;
 
     useGLSL = org.useGLSL;
     isVisionDataRecordingEnabled = org.isVisionDataRecordingEnabled;
     rangeSensorPrecisionRatio = org.rangeSensorPrecisionRatio;
     depthError = org.depthError;
+    rangeCameraVoxelSize = org.rangeCameraVoxelSize;
     bodyNameListString = getNameListString(bodyNames);
     sensorNameListString = getNameListString(sensorNames);
     useThreadsForSensorsProperty = org.useThreadsForSensorsProperty;
     isBestEffortModeProperty = org.isBestEffortModeProperty;
+    isPixelBufferReadbackEnabled = org.isPixelBufferReadbackEnabled;
+    readbackDelay = org.readbackDelay;
+    isSceneSharingEnabled = org.isSceneSharingEnabled;
+    isDeadlineSchedulingEnabled = org.isDeadlineSchedulingEnabled;
+    isCullingEnabled = org.isCullingEnabled;
+    isEGLContextEnabled = org.isEGLContextEnabled;
+    useEGL = false;
     shootAllSceneObjects = org.shootAllSceneObjects;
     isHeadLightEnabled = org.isHeadLightEnabled;
     areAdditionalLightsEnabled = org.areAdditionalLightsEnabled;
@@ -379,12 +698,83 @@ void GLVisionSimulatorItem::setBestEffortMode(bool on)
 }
 
 
+void GLVisionSimulatorItem::setPixelBufferReadbackEnabled(bool on)
+{
+    impl->setProperty(impl->isPixelBufferReadbackEnabled, on);
+}
+
+
+/**
+   \param frames The number of the frames by which the vision data delays in the pixel buffer readback.
+   The rendering of the next frame is overlapped with the transfer of the pixels if this is 1 or 2.
+   If this is 0, only the rendering of the other sensors in the queue thread is overlapped with it.
+*/
+void GLVisionSimulatorItem::setReadbackDelay(int frames)
+{
+    impl->setProperty(impl->readbackDelay, std::max(0, std::min(frames, 2)));
+}
+
+
+/**
+   All the sensors are rendered from one scene graph with one GL context and one renderer
+   if this is enabled. This is only available when the dedicated sensor threads are disabled.
+*/
+void GLVisionSimulatorItem::setSharedSceneEnabled(bool on)
+{
+    impl->setProperty(impl->isSceneSharingEnabled, on);
+}
+
+
+/**
+   The onsets of the sensors are staggered so that the rendering is spread over the simulation steps,
+   and the sensors in the rendering queue are rendered in the order of their deadlines if this is enabled.
+*/
+void GLVisionSimulatorItem::setDeadlineSchedulingEnabled(bool on)
+{
+    impl->setProperty(impl->isDeadlineSchedulingEnabled, on);
+}
+
+
+/**
+   The links and the scene objects outside the view volume of a sensor are not rendered for the sensor
+   if this is enabled. The links which have devices and the objects including lights or cameras are
+   always rendered.
+*/
+void GLVisionSimulatorItem::setCullingEnabled(bool on)
+{
+    impl->setProperty(impl->isCullingEnabled, on);
+}
+
+
+/**
+   The GL contexts are created with EGL instead of Qt if this is enabled, so that the sensors
+   can be rendered by the GPU without the window system. This is only available when
+   Choreonoid is built with the ENABLE_EGL option.
+*/
+void GLVisionSimulatorItem::setEGLContextEnabled(bool on)
+{
+    impl->setProperty(impl->isEGLContextEnabled, on);
+}
+
+
+void GLVisionSimulatorItem::setGLSLRendererEnabled(bool on)
+{
+    impl->setProperty(impl->useGLSL, on);
+}
+
+
 void GLVisionSimulatorItem::setRangeSensorPrecisionRatio(double r)
 {
     impl->setProperty(impl->rangeSensorPrecisionRatio, r);
 }
 
 
+void GLVisionSimulatorItem::setRangeCameraVoxelSize(double size)
+{
+    impl->setProperty(impl->rangeCameraVoxelSize, std::max(0.0, size));
+}
+
+
 void GLVisionSimulatorItem::setAllSceneObjectsEnabled(bool on)
 {
     impl->setProperty(impl->shootAllSceneObjects, on);
@@ -411,8 +801,18 @@ bool GLVisionSimulatorItem::initializeSimulation(SimulatorItem* simulatorItem)
 
 bool GLVisionSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
 {
+    useEGL = false;
+    if(isEGLContextEnabled){
+#ifdef CNOID_ENABLE_EGL
+        useEGL = true;
+#else
+        os << (format(_("%1%: The EGL context is not available because Choreonoid is built without the EGL support."))
+               % self->name()) << endl;
+#endif
+    }
+    
 #if !USE_QT5_OPENGL
-    if(!QGLPixelBuffer::hasOpenGLPbuffers()){
+    if(!useEGL && !QGLPixelBuffer::hasOpenGLPbuffers()){
         os << (format(_("The vision sensor simulation by %1% cannot be performed because the OpenGL pbuffer is not available."))
                % self->name()) << endl;
         return false;
@@ -421,6 +821,8 @@ bool GLVisionSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorIte
 
     this->simulatorItem = simulatorItem;
     worldTimeStep = simulatorItem->worldTimeStep();
+    profiler = simulatorItem->profiler();
+    renderingWaitStageId = profiler->registerStage("Vision rendering wait");
     currentTime = 0;
     visionRenderers.clear();
 
@@ -433,8 +835,26 @@ bool GLVisionSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorIte
     }
     
     isBestEffortMode = isBestEffortModeProperty;
+    if(isBestEffortMode && simulatorItem->isDeterministicMode()){
+        os << (format(_("%1%: The best effort mode is disabled because the simulation is in the deterministic mode."))
+               % self->name()) << endl;
+        isBestEffortMode = false;
+    }
     renderersInRendering.clear();
 
+    sharedScene.reset();
+    if(isSceneSharingEnabled){
+        if(!USE_QT5_OPENGL && !useEGL){
+            os << (format(_("%1%: The scene sharing is not supported with this version of Qt."))
+                   % self->name()) << endl;
+        } else if(useQueueThreadForAllSensors){
+            sharedScene = new SharedVisionScene;
+        } else {
+            os << (format(_("%1%: The scene cannot be shared by the sensors rendered in the dedicated threads."))
+                   % self->name()) << endl;
+        }
+    }
+
     cloneMap.clear();
 
 #ifdef CNOID_REFERENCED_USE_ATOMIC_COUNTER
@@ -501,13 +921,15 @@ bool GLVisionSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorIte
     }
 
     if(!visionRenderers.empty()){
+        if(isDeadlineSchedulingEnabled){
+            staggerSensorPhases();
+        }
+        
         simulatorItem->addPreDynamicsFunction(boost::bind(&GLVisionSimulatorItemImpl::onPreDynamics, this));
         simulatorItem->addPostDynamicsFunction(boost::bind(&GLVisionSimulatorItemImpl::onPostDynamics, this));
 
         if(useQueueThreadForAllSensors){
-            while(!rendererQueue.empty()){
-                rendererQueue.pop();
-            }
+            rendererQueue.clear();
             isQueueRenderingTerminationRequested = false;
             queueThread.start(boost::bind(&GLVisionSimulatorItemImpl::queueRenderingLoop, this));
             for(size_t i=0; i < visionRenderers.size(); ++i){
@@ -531,8 +953,78 @@ void GLVisionSimulatorItemImpl::addTargetSensor(SimulationBody* simBody, int bod
 }
 
 
+/**
+   Each sensor is given a phase offset less than its cycle. The offset only postpones the first frame,
+   so the frame rate and the latency of every sensor are kept. The offsets are chosen greedily from the
+   sensor which has the most pixels, and each one minimizes the maximum rendering load of the steps in
+   the common period of the sensors, where the load of a sensor is estimated by its number of pixels.
+*/
+void GLVisionSimulatorItemImpl::staggerSensorPhases()
+{
+    const int n = visionRenderers.size();
+    vector<int> periods(n);
+    vector< pair<double, int> > costs(n);
+    int maxPeriod = 1;
+    for(int i=0; i < n; ++i){
+        VisionRenderer* renderer = visionRenderers[i];
+        periods[i] = std::max(1, (int)myNearByInt(renderer->cycleTime / worldTimeStep));
+        maxPeriod = std::max(maxPeriod, periods[i]);
+        costs[i].first = (double)renderer->pixelWidth * renderer->pixelHeight * std::max(1, renderer->numRangeSectors);
+        costs[i].second = i;
+    }
+
+    // The common period is limited because it is only used to evaluate the loads
+    const long long maxCommonPeriod = (long long)maxPeriod * 16;
+    long long commonPeriod = 1;
+    for(int i=0; i < n && commonPeriod < maxCommonPeriod; ++i){
+        long long a = commonPeriod;
+        long long b = periods[i];
+        while(b){
+            const long long r = a % b;
+            a = b;
+            b = r;
+        }
+        commonPeriod = std::min(commonPeriod / a * periods[i], maxCommonPeriod);
+    }
+    const int numSteps = commonPeriod;
+
+    std::sort(costs.begin(), costs.end(), std::greater< pair<double, int> >());
+    
+    vector<double> loads(numSteps, 0.0);
+    for(int i=0; i < n; ++i){
+        const double cost = costs[i].first;
+        const int index = costs[i].second;
+        const int period = periods[index];
+        int bestPhase = 0;
+        double minMaxLoad = std::numeric_limits<double>::max();
+        double minSquareSum = std::numeric_limits<double>::max();
+        for(int phase=0; phase < period; ++phase){
+            double maxLoad = 0.0;
+            double squareSum = 0.0;
+            for(int j=phase; j < numSteps; j += period){
+                const double load = loads[j] + cost;
+                maxLoad = std::max(maxLoad, load);
+                squareSum += load * load - loads[j] * loads[j];
+            }
+            if(maxLoad < minMaxLoad || (maxLoad == minMaxLoad && squareSum < minSquareSum)){
+                bestPhase = phase;
+                minMaxLoad = maxLoad;
+                minSquareSum = squareSum;
+            }
+        }
+        for(int j=bestPhase; j < numSteps; j += period){
+            loads[j] += cost;
+        }
+        VisionRenderer* renderer = visionRenderers[index];
+        renderer->elapsedTime -= bestPhase * worldTimeStep;
+    }
+}
+
+
 VisionRenderer::VisionRenderer(GLVisionSimulatorItemImpl* simImpl, Device* device, SimulationBody* simBody, int bodyIndex)
     : simImpl(simImpl),
+      renderingCondition("Vision rendering"),
+      renderingMutex("Vision rendering"),
       device(device),
       simBody(simBody),
       bodyIndex(bodyIndex)
@@ -554,74 +1046,98 @@ VisionRenderer::VisionRenderer(GLVisionSimulatorItemImpl* simImpl, Device* devic
 #else
     renderingBuffer = 0;
 #endif
+#ifdef CNOID_ENABLE_EGL
+    eglContext = 0;
+    eglFrameBuffer = 0;
+#endif
     
     renderer = 0;
+    sensorCamera = 0;
+    pixelBufferIndex = 0;
+    isPixelBufferReadbackDeferred = false;
+    isPointConversionOnGPU = false;
+    isDepthImageOutput = false;
+    sensorSceneLink = 0;
+    sensorCameraTransform = 0;
+    renderingStageId = -1;
+    readbackStageId = -1;
+    pointConversionStageId = -1;
+    gpuStageId = -1;
+    numRangeSectors = 0;
+    rangeSectorYawRange = 0.0;
+    hasSensorNoise = false;
+    isSensorNoiseUnavailable = false;
+    noiseSeed = 0;
+    noiseFrameCounter = 0;
 }
 
 
 bool VisionRenderer::initialize(const vector<SimulationBody*>& simBodies)
 {
+    sharedScene = simImpl->sharedScene;
+    
     initializeScene(simBodies);
 
-    SgCamera* sceneCamera = initializeCamera();
-    if(!sceneCamera){
+    sensorCamera = initializeCamera();
+    if(!sensorCamera){
         return false;
     }
 
-#if USE_QT5_OPENGL
-    glContext = new QOpenGLContext;
-    QSurfaceFormat format;
-    format.setSwapBehavior(QSurfaceFormat::SingleBuffer);
-    if(simImpl->useGLSL){
-        format.setProfile(QSurfaceFormat::CoreProfile);
-        format.setVersion(3, 3);
-    }
-    glContext->setFormat(format);
-    glContext->create();
-    offscreenSurface = new QOffscreenSurface;
-    offscreenSurface->setFormat(format);
-    offscreenSurface->create();
-    glContext->makeCurrent(offscreenSurface);
-    frameBuffer = new QOpenGLFramebufferObject(pixelWidth, pixelHeight, QOpenGLFramebufferObject::CombinedDepthStencil);
-    frameBuffer->bind();
-#else
-    QGLFormat format;
-    format.setDoubleBuffer(false);
-    if(simImpl->useGLSL){
-        format.setProfile(QGLFormat::CoreProfile);
-        format.setVersion(3, 3);
+    if(!initializeGLContext()){
+        return false;
     }
-    renderingBuffer = new QGLPixelBuffer(pixelWidth, pixelHeight, format);
-    renderingBuffer->makeCurrent();
-#endif
 
-    if(!renderer){
-        if(simImpl->useGLSL){
-            renderer = new GLSLSceneRenderer;
-        } else {
-            renderer = new GL1SceneRenderer;
+    if(sharedScene && sharedScene->renderer){
+        renderer = sharedScene->renderer;
+    } else {
+        if(!renderer){
+            if(simImpl->useGLSL){
+                renderer = new GLSLSceneRenderer;
+            } else {
+                renderer = new GL1SceneRenderer;
+            }
+        }
+        renderer->initializeGL();
+        renderer->sceneRoot()->addChild(sceneGroup);
+        if(sharedScene){
+            sharedScene->renderer = renderer;
         }
     }
-    
-    renderer->initializeGL();
-    renderer->setViewport(0, 0, pixelWidth, pixelHeight);
-    renderer->sceneRoot()->addChild(sceneGroup);
     renderer->extractPreprocessedNodes();
-    renderer->setCurrentCamera(sceneCamera);
+    setRenderingStatesOfSensor();
 
-    if(rangeSensor){
-        renderer->setDefaultLighting(false);
-    } else {
-        renderer->headLight()->on(simImpl->isHeadLightEnabled);
-        renderer->enableAdditionalLights(simImpl->areAdditionalLightsEnabled);
+    // The GPU time of the shared renderer cannot be separated for each sensor
+    if(simImpl->profiler->isEnabled() && !sharedScene){
+        renderer->enableGPUTimer(true);
+    }
+
+    isDepthImageOutput =
+        rangeCameraForRendering && (rangeCameraForRendering->pointDataFormat() == RangeCamera::DEPTH_IMAGE);
+    // The depth image is computed from the depth buffer which is smaller than the points
+    isPointConversionOnGPU = simImpl->useGLSL && rangeCameraForRendering && !isDepthImageOutput;
+
+    initializeSensorNoise();
+
+    if(simImpl->isPixelBufferReadbackEnabled){
+        if(!initializePixelBuffers()){
+            simImpl->os << (format(_("%1%: The pixel buffer readback is not available for \"%2%\"."))
+                            % simImpl->self->name() % device->name()) << endl;
+        }
     }
 
     doneGLContextCurrent();
+
+    const string sensorName = device->link()->body()->name() + "/" + device->name();
+    renderingStageId = simImpl->profiler->registerStage(str(format("Vision rendering (%1%)") % sensorName));
+    readbackStageId = simImpl->profiler->registerStage(str(format("Vision readback (%1%)") % sensorName));
+    pointConversionStageId = simImpl->profiler->registerStage(str(format("Vision point conversion (%1%)") % sensorName));
+    gpuStageId = simImpl->profiler->registerStage(str(format("Vision GPU (%1%)") % sensorName));
     
     isRendering = false;
     elapsedTime = cycleTime + 1.0e-6;
     latency = std::min(cycleTime, simImpl->maxLatency);
     onsetTime = 0.0;
+    dataOnsetTime = 0.0;
     hasUpdatedData = false;
 
     isRenderingRequested = false;
@@ -636,11 +1152,94 @@ bool VisionRenderer::initialize(const vector<SimulationBody*>& simBodies)
 }
 
 
+/**
+   The created context is current and the frame buffer for the sensor is bound when this function returns true.
+*/
+bool VisionRenderer::initializeGLContext()
+{
+#ifdef CNOID_ENABLE_EGL
+    if(simImpl->useEGL){
+        if(sharedScene && sharedScene->eglContext){
+            eglContext = sharedScene->eglContext;
+        } else {
+            eglContext = new EGLOffscreenContext;
+            if(!eglContext->create(simImpl->useGLSL)){
+                simImpl->os << (format(_("%1%: %2%")) % simImpl->self->name() % eglContext->errorMessage()) << endl;
+                delete eglContext;
+                eglContext = 0;
+                return false;
+            }
+            if(sharedScene){
+                sharedScene->eglContext = eglContext;
+            }
+        }
+        eglContext->makeCurrent();
+        eglFrameBuffer = eglContext->createFrameBuffer(pixelWidth, pixelHeight);
+        if(!eglFrameBuffer){
+            simImpl->os << (format(_("%1%: %2%")) % simImpl->self->name() % eglContext->errorMessage()) << endl;
+            eglContext->doneCurrent();
+            if(!sharedScene){
+                delete eglContext;
+            }
+            eglContext = 0;
+            return false;
+        }
+        return true;
+    }
+#endif
+
+#if USE_QT5_OPENGL
+    if(sharedScene && sharedScene->glContext){
+        glContext = sharedScene->glContext;
+        offscreenSurface = sharedScene->offscreenSurface;
+    } else {
+        glContext = new QOpenGLContext;
+        QSurfaceFormat format;
+        format.setSwapBehavior(QSurfaceFormat::SingleBuffer);
+        if(simImpl->useGLSL){
+            format.setProfile(QSurfaceFormat::CoreProfile);
+            format.setVersion(3, 3);
+        }
+        glContext->setFormat(format);
+        glContext->create();
+        offscreenSurface = new QOffscreenSurface;
+        offscreenSurface->setFormat(format);
+        offscreenSurface->create();
+        if(sharedScene){
+            sharedScene->glContext = glContext;
+            sharedScene->offscreenSurface = offscreenSurface;
+        }
+    }
+    glContext->makeCurrent(offscreenSurface);
+    frameBuffer = new QOpenGLFramebufferObject(pixelWidth, pixelHeight, QOpenGLFramebufferObject::CombinedDepthStencil);
+    frameBuffer->bind();
+#else
+    QGLFormat format;
+    format.setDoubleBuffer(false);
+    if(simImpl->useGLSL){
+        format.setProfile(QGLFormat::CoreProfile);
+        format.setVersion(3, 3);
+    }
+    renderingBuffer = new QGLPixelBuffer(pixelWidth, pixelHeight, format);
+    renderingBuffer->makeCurrent();
+#endif
+
+    return true;
+}
+
+
 /**
    \todo use cache of the cloned scene graph nodes
 */
 void VisionRenderer::initializeScene(const vector<SimulationBody*>& simBodies)
 {
+    if(sharedScene && sharedScene->sceneGroup){
+        sceneGroup = sharedScene->sceneGroup;
+        sceneBodies = sharedScene->sceneBodies;
+        cullingNodes = sharedScene->cullingNodes;
+        return;
+    }
+    
     sceneGroup = new SgGroup;
 
 #ifndef CNOID_REFERENCED_USE_ATOMIC_COUNTER
@@ -669,12 +1268,66 @@ void VisionRenderer::initializeScene(const vector<SimulationBody*>& simBodies)
                 if(sceneProvider && !dynamic_cast<BodyItem*>(item)){
                     SgNode* scene = sceneProvider->getScene(simImpl->cloneMap);
                     if(scene){
-                        sceneGroup->addChild(scene);
+                        if(simImpl->isCullingEnabled && !containsLightOrCamera(scene)){
+                            CullingNode node;
+                            node.switchNode = new SgSwitch;
+                            node.switchNode->addChild(scene);
+                            node.transform = 0;
+                            cullingNodes.push_back(node);
+                            sceneGroup->addChild(node.switchNode);
+                        } else {
+                            sceneGroup->addChild(scene);
+                        }
                     }
                 }
             }
         }
     }
+
+    if(simImpl->isCullingEnabled){
+        initializeCullingNodes();
+    }
+
+    if(sharedScene){
+        sharedScene->sceneGroup = sceneGroup;
+        sharedScene->sceneBodies = sceneBodies;
+        sharedScene->cullingNodes = cullingNodes;
+    }
+}
+
+
+/**
+   The children of each scene link are moved to a switch node. The links which have devices are not
+   culled because the devices may have the cameras and lights, and the cameras of the range sensors
+   are added to the links of the sensors.
+*/
+void VisionRenderer::initializeCullingNodes()
+{
+    for(size_t i=0; i < sceneBodies.size(); ++i){
+        SceneBody* sceneBody = sceneBodies[i];
+        Body* body = sceneBody->body();
+        vector<bool> hasDevices(body->numLinks(), false);
+        const DeviceList<Device>& devices = body->devices();
+        for(size_t j=0; j < devices.size(); ++j){
+            hasDevices[devices[j]->link()->index()] = true;
+        }
+        const int n = sceneBody->numSceneLinks();
+        for(int j=0; j < n; ++j){
+            SceneLink* sceneLink = sceneBody->sceneLink(j);
+            if(hasDevices[sceneLink->link()->index()] || sceneLink->empty() || containsLightOrCamera(sceneLink)){
+                continue;
+            }
+            CullingNode node;
+            node.switchNode = new SgSwitch;
+            for(SgGroup::iterator p = sceneLink->begin(); p != sceneLink->end(); ++p){
+                node.switchNode->addChild(*p);
+            }
+            sceneLink->clearChildren();
+            sceneLink->addChild(node.switchNode);
+            node.transform = sceneLink;
+            cullingNodes.push_back(node);
+        }
+    }
 }
 
 
@@ -687,6 +1340,8 @@ SgCamera* VisionRenderer::initializeCamera()
         SceneDevice* sceneDevice = sceneBody->getSceneDevice(device);
         if(sceneDevice){
             sceneCamera = sceneDevice->findNodeOfType<SgCamera>();
+            sensorSceneLink = sceneBody->sceneLink(camera->link()->index());
+            sensorCameraTransform = sceneDevice;
             pixelWidth = camera->resolutionX();
             pixelHeight = camera->resolutionY();
             double frameRate = std::max(0.1, std::min(camera->frameRate(), simImpl->maxFrameRate));
@@ -694,12 +1349,13 @@ SgCamera* VisionRenderer::initializeCamera()
             if(simImpl->isVisionDataRecordingEnabled){
                 camera->setImageStateClonable(true);
             }
+            rangeCameraVoxelSize = simImpl->rangeCameraVoxelSize;
         }
     } else if(rangeSensor){
 
         const double thresh = (170.0 * PI / 180.0); // 170[deg]
-        bool isWithinPossibleRanges =
-            (rangeSensor->yawRange() < thresh) && (rangeSensor->pitchRange() < thresh);
+        // A wider yaw range is covered by the sectors
+        bool isWithinPossibleRanges = (rangeSensor->pitchRange() < thresh);
         if(isWithinPossibleRanges){
             SceneLink* sceneLink = sceneBody->sceneLink(rangeSensor->link()->index());
             if(sceneLink){
@@ -710,9 +1366,15 @@ SgCamera* VisionRenderer::initializeCamera()
                 SgPosTransform* cameraPos = new SgPosTransform();
                 cameraPos->setTransform(rangeSensor->T_local());
                 cameraPos->addChild(persCamera);
-                sceneLink->addChild(cameraPos);
-
-                if(rangeSensor->yawRange() > rangeSensor->pitchRange()){
+                // The notification is necessary for the renderer which already has the shared scene
+                sceneLink->addChild(cameraPos, true);
+                rangeCameraPos = cameraPos;
+                sensorSceneLink = sceneLink;
+                sensorCameraTransform = cameraPos;
+
+                if(rangeSensor->yawRange() >= thresh){
+                    initializeRangeSensorSectors(persCamera);
+                } else if(rangeSensor->yawRange() > rangeSensor->pitchRange()){
                     pixelWidth = rangeSensor->yawResolution() * simImpl->rangeSensorPrecisionRatio;
                     if(rangeSensor->pitchRange() == 0.0){
                         pixelHeight = 1;
@@ -748,10 +1410,166 @@ SgCamera* VisionRenderer::initializeCamera()
 }
 
 
+/**
+   The yaw range of each sector is at most 90 degrees so that the beams at the edges of a sector
+   are not sampled much more coarsely than the ones at the center. The pixels are square in the
+   tangent space of the angles, and the image is large enough for both of the yaw and pitch
+   resolutions multiplied by the precision ratio.
+*/
+void VisionRenderer::initializeRangeSensorSectors(SgPerspectiveCamera* camera)
+{
+    const double yawRange = rangeSensor->yawRange();
+    const int yawResolution = rangeSensor->yawResolution();
+    const double yawStep = rangeSensor->yawStep();
+    const double pitchRange = rangeSensor->pitchRange();
+    const double ratio = simImpl->rangeSensorPrecisionRatio;
+
+    numRangeSectors = std::max(1, (int)ceil(yawRange / (PI / 2.0) - 1.0e-6));
+    rangeSectorYawRange = yawRange / numRangeSectors;
+
+    rangeSectorYawIndices.resize(numRangeSectors + 1);
+    rangeSectorYawIndices[0] = 0;
+    for(int i=1; i < numRangeSectors; ++i){
+        if(yawStep > 0.0){
+            rangeSectorYawIndices[i] = std::min(yawResolution, (int)ceil(i * rangeSectorYawRange / yawStep - 1.0e-6));
+        } else {
+            rangeSectorYawIndices[i] = yawResolution;
+        }
+    }
+    rangeSectorYawIndices[numRangeSectors] = yawResolution;
+
+    const double tanHalfYaw = tan(rangeSectorYawRange / 2.0);
+    const int minWidth = std::max(1, (int)ceil((double)yawResolution / numRangeSectors * ratio));
+    if(pitchRange == 0.0){
+        pixelWidth = minWidth;
+        pixelHeight = 1;
+        camera->setFieldOfView(atan2(tanHalfYaw / pixelWidth, 1.0) * 2.0);
+    } else {
+        const double tanHalfPitch = tan(pitchRange / 2.0);
+        const int minHeight = std::max(1, (int)ceil(rangeSensor->pitchResolution() * ratio));
+        pixelWidth = std::max(minWidth, (int)ceil(minHeight * tanHalfYaw / tanHalfPitch));
+        pixelHeight = std::max(minHeight, (int)myNearByInt(pixelWidth * tanHalfPitch / tanHalfYaw));
+        // The field of view is the angle of the shorter side
+        camera->setFieldOfView((pixelWidth >= pixelHeight) ? pitchRange : rangeSectorYawRange);
+    }
+}
+
+
+void VisionRenderer::initializeSensorNoise()
+{
+    lensDistortionK1 = 0.0;
+    lensDistortionK2 = 0.0;
+    rangeNoise = 0.0;
+    rangeQuantizationStep = 0.0;
+    dropoutRate = 0.0;
+    
+    if(cameraForRendering){
+        lensDistortionK1 = cameraForRendering->lensDistortionK1();
+        lensDistortionK2 = cameraForRendering->lensDistortionK2();
+        if(rangeCameraForRendering){
+            rangeNoise = rangeCameraForRendering->rangeNoise();
+            rangeQuantizationStep = rangeCameraForRendering->rangeQuantizationStep();
+            dropoutRate = rangeCameraForRendering->dropoutRate();
+        }
+    } else if(rangeSensorForRendering){
+        rangeNoise = rangeSensorForRendering->rangeNoise();
+        rangeQuantizationStep = rangeSensorForRendering->rangeQuantizationStep();
+        dropoutRate = rangeSensorForRendering->dropoutRate();
+    }
+
+    hasSensorNoise =
+        (lensDistortionK1 != 0.0 || lensDistortionK2 != 0.0 ||
+         rangeNoise > 0.0 || rangeQuantizationStep > 0.0 || dropoutRate > 0.0);
+
+    if(hasSensorNoise && !simImpl->useGLSL){
+        simImpl->os << (format(_("%1%: The noise of \"%2%\" is not simulated because it requires the GLSL renderer."))
+                        % simImpl->self->name() % device->name()) << endl;
+        hasSensorNoise = false;
+    }
+
+    // The same random numbers are given in every simulation
+    noiseSeed = boost::hash<string>()(device->link()->body()->name() + "/" + device->name());
+    noiseFrameCounter = 0;
+}
+
+
+bool VisionRenderer::initializePixelBuffers()
+{
+    const bool readsColors = cameraForRendering && (cameraForRendering->imageType() == Camera::COLOR_IMAGE);
+    const bool readsDepths = rangeCameraForRendering || rangeSensorForRendering;
+    if(!readsColors && !readsDepths){
+        return false;
+    }
+    // The sectors are resampled one by one right after each of them is rendered
+    if(numRangeSectors > 0){
+        return false;
+    }
+#ifdef CNOID_ENABLE_EGL
+    pbo.eglContext = eglContext;
+#endif
+    if(!pbo.initialize()){
+        return false;
+    }
+    
+    pixelBuffers.resize(simImpl->readbackDelay + 1);
+    for(size_t i=0; i < pixelBuffers.size(); ++i){
+        PixelBuffer& buffer = pixelBuffers[i];
+        buffer.colorBuffer = 0;
+        buffer.depthBuffer = 0;
+        buffer.onsetTime = 0.0;
+        buffer.isFilled = false;
+        if(readsColors){
+            pbo.genBuffers(1, &buffer.colorBuffer);
+            pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.colorBuffer);
+            pbo.bufferData(GL_PIXEL_PACK_BUFFER, pixelWidth * pixelHeight * 3, 0, GL_STREAM_READ);
+        }
+        buffer.hasPoints = false;
+        if(readsDepths){
+            // The buffer can also contain the points converted on the GPU
+            const int depthSize = isPointConversionOnGPU ? sizeof(Vector3f) : sizeof(float);
+            pbo.genBuffers(1, &buffer.depthBuffer);
+            pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.depthBuffer);
+            pbo.bufferData(GL_PIXEL_PACK_BUFFER, pixelWidth * pixelHeight * depthSize, 0, GL_STREAM_READ);
+        }
+    }
+    pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // The rows of the buffers are not padded
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    pixelBufferIndex = 0;
+    isPixelBufferReadbackDeferred = simImpl->useQueueThreadForAllSensors && (pixelBuffers.size() == 1);
+
+    return true;
+}
+
+
+//! The GL context must be current when this function is called.
+void VisionRenderer::deletePixelBuffers()
+{
+    for(size_t i=0; i < pixelBuffers.size(); ++i){
+        PixelBuffer& buffer = pixelBuffers[i];
+        if(buffer.colorBuffer){
+            pbo.deleteBuffers(1, &buffer.colorBuffer);
+        }
+        if(buffer.depthBuffer){
+            pbo.deleteBuffers(1, &buffer.depthBuffer);
+        }
+    }
+    pixelBuffers.clear();
+}
+
+
+/**
+   The EGL context does not have to be moved because it is not bound to any thread
+   while it is not current.
+*/
 void VisionRenderer::moveRenderingBufferToThread(QThread& thread)
 {
 #if USE_QT5_OPENGL
-    glContext->moveToThread(&thread);
+    if(glContext){
+        glContext->moveToThread(&thread);
+    }
 #endif
 }
 
@@ -759,14 +1577,23 @@ void VisionRenderer::moveRenderingBufferToThread(QThread& thread)
 void VisionRenderer::moveRenderingBufferToMainThread()
 {
 #if USE_QT5_OPENGL
-    QThread* mainThread = QApplication::instance()->thread();
-    glContext->moveToThread(mainThread);
+    if(glContext){
+        QThread* mainThread = QApplication::instance()->thread();
+        glContext->moveToThread(mainThread);
+    }
 #endif
 }
 
 
 void VisionRenderer::makeGLContextCurrent()
 {
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->makeCurrent();
+        eglContext->bindFrameBuffer(eglFrameBuffer);
+        return;
+    }
+#endif
 #if USE_QT5_OPENGL
     glContext->makeCurrent(offscreenSurface);
 #else
@@ -777,6 +1604,12 @@ void VisionRenderer::makeGLContextCurrent()
 
 void VisionRenderer::doneGLContextCurrent()
 {
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->doneCurrent();
+        return;
+    }
+#endif
 #if USE_QT5_OPENGL
     glContext->doneCurrent();
 #else
@@ -785,17 +1618,52 @@ void VisionRenderer::doneGLContextCurrent()
 }
 
 
+void VisionRenderer::bindFrameBuffer()
+{
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->bindFrameBuffer(eglFrameBuffer);
+        return;
+    }
+#endif
+#if USE_QT5_OPENGL
+    frameBuffer->bind();
+#endif
+}
+
+
+/**
+   This is called for every rendering if the renderer is shared by the sensors.
+*/
+void VisionRenderer::setRenderingStatesOfSensor()
+{
+    renderer->setViewport(0, 0, pixelWidth, pixelHeight);
+    renderer->setCurrentCamera(sensorCamera);
+
+    if(rangeSensor){
+        renderer->setDefaultLighting(false);
+    } else {
+        if(sharedScene){
+            renderer->setDefaultLighting(true);
+        }
+        renderer->headLight()->on(simImpl->isHeadLightEnabled);
+        renderer->enableAdditionalLights(simImpl->areAdditionalLightsEnabled);
+    }
+}
+
+
 void GLVisionSimulatorItemImpl::onPreDynamics()
 {
     currentTime = simulatorItem->currentTime();
 
-    boost::mutex* pQueueMutex = 0;
+    ProfiledMutex* pQueueMutex = 0;
     
     for(size_t i=0; i < visionRenderers.size(); ++i){
         VisionRenderer* renderer = visionRenderers[i];
         if(renderer->elapsedTime >= renderer->cycleTime){
             if(!renderer->isRendering){
                 renderer->onsetTime = currentTime;
+                renderer->deadline = currentTime + renderer->latency;
                 renderer->isRendering = true;
                 if(useThreadsForSensors){
                     renderer->startConcurrentRendering();
@@ -805,7 +1673,7 @@ void GLVisionSimulatorItemImpl::onPreDynamics()
                         pQueueMutex->lock();
                     }
                     renderer->updateScene(true);
-                    rendererQueue.push(renderer);
+                    pushToRendererQueue(renderer);
                 }
                 renderer->elapsedTime -= renderer->cycleTime;
                 renderersInRendering.push_back(renderer);
@@ -821,29 +1689,79 @@ void GLVisionSimulatorItemImpl::onPreDynamics()
 }
 
 
+namespace {
+
+bool isDeadlineEarlier(VisionRenderer* renderer1, VisionRenderer* renderer2)
+{
+    return renderer1->deadline < renderer2->deadline;
+}
+
+}
+
+
+/**
+   The queue mutex must be locked when this function is called.
+   The renderers with the same deadline are rendered in the order in which they are pushed.
+*/
+void GLVisionSimulatorItemImpl::pushToRendererQueue(VisionRenderer* renderer)
+{
+    if(isDeadlineSchedulingEnabled){
+        rendererQueue.insert(
+            std::upper_bound(rendererQueue.begin(), rendererQueue.end(), renderer, isDeadlineEarlier), renderer);
+    } else {
+        rendererQueue.push_back(renderer);
+    }
+}
+
+
 void GLVisionSimulatorItemImpl::queueRenderingLoop()
 {
     VisionRenderer* renderer = 0;
+    vector<VisionRenderer*> renderersInReadback;
     
     while(true){
         {
-            boost::unique_lock<boost::mutex> lock(queueMutex);
+            boost::unique_lock<ProfiledMutex> lock(queueMutex);
             while(true){
                 if(isQueueRenderingTerminationRequested){
                     goto exitRenderingQueueLoop;
                 }
                 if(!rendererQueue.empty()){
                     renderer = rendererQueue.front();
-                    rendererQueue.pop();
+                    rendererQueue.pop_front();
+                    break;
+                }
+                if(!renderersInReadback.empty()){
+                    renderer = 0;
                     break;
                 }
                 queueCondition.wait(lock);
             }
         }
-        renderer->renderInCurrentThread(true);
+
+        if(!renderer){
+            for(size_t i=0; i < renderersInReadback.size(); ++i){
+                renderersInReadback[i]->finishDeferredPixelBufferReadback();
+            }
+            {
+                boost::unique_lock<ProfiledMutex> lock(queueMutex);
+                for(size_t i=0; i < renderersInReadback.size(); ++i){
+                    renderersInReadback[i]->isRenderingFinished = true;
+                }
+            }
+            renderersInReadback.clear();
+            queueCondition.notify_all();
+            continue;
+        }
         
+        renderer->renderInCurrentThread(true);
+
+        if(renderer->isPixelBufferReadbackDeferred){
+            renderersInReadback.push_back(renderer);
+            continue;
+        }
         {
-            boost::unique_lock<boost::mutex> lock(queueMutex);
+            boost::unique_lock<ProfiledMutex> lock(queueMutex);
             renderer->isRenderingFinished = true;
         }
         queueCondition.notify_all();
@@ -859,10 +1777,27 @@ exitRenderingQueueLoop:
 
 void VisionRenderer::updateScene(bool updateSensorForRenderingThread)
 {
-    for(size_t i=0; i < sceneBodies.size(); ++i){
-        SceneBody* sceneBody = sceneBodies[i];
-        sceneBody->updateLinkPositions();
-        sceneBody->updateSceneDevices();
+    if(sharedScene){
+        linkPositionSnapshot.clear();
+        for(size_t i=0; i < sceneBodies.size(); ++i){
+            SceneBody* sceneBody = sceneBodies[i];
+            const int n = sceneBody->numSceneLinks();
+            for(int j=0; j < n; ++j){
+                linkPositionSnapshot.push_back(sceneBody->sceneLink(j)->link()->T());
+            }
+        }
+        if(sharedScene->sceneMutex.try_lock()){
+            for(size_t i=0; i < sceneBodies.size(); ++i){
+                sceneBodies[i]->updateSceneDevices();
+            }
+            sharedScene->sceneMutex.unlock();
+        }
+    } else {
+        for(size_t i=0; i < sceneBodies.size(); ++i){
+            SceneBody* sceneBody = sceneBodies[i];
+            sceneBody->updateLinkPositions(sceneUpdate);
+            sceneBody->updateSceneDevices();
+        }
     }
     if(updateSensorForRenderingThread){
         deviceForRendering->copyStateFrom(*device);
@@ -870,22 +1805,287 @@ void VisionRenderer::updateScene(bool updateSensorForRenderingThread)
 }
 
 
+void VisionRenderer::applyLinkPositionSnapshot()
+{
+    int index = 0;
+    for(size_t i=0; i < sceneBodies.size(); ++i){
+        SceneBody* sceneBody = sceneBodies[i];
+        const int n = sceneBody->numSceneLinks();
+        for(int j=0; j < n; ++j){
+            SceneLink* sceneLink = sceneBody->sceneLink(j);
+            const Position& T = linkPositionSnapshot[index++];
+            sceneLink->setRotation(T.linear());
+            sceneLink->setTranslation(T.translation());
+            sceneLink->notifyUpdate(sceneUpdate);
+        }
+    }
+}
+
+
 void VisionRenderer::renderInCurrentThread(bool doStoreResultToTmpDataBuffer)
 {
+    SimulationProfiler* profiler = simImpl->profiler;
+    
     makeGLContextCurrent();
+
+    if(!sharedScene){
+        renderScene(doStoreResultToTmpDataBuffer);
+    } else {
+        boost::unique_lock<boost::mutex> lock(sharedScene->sceneMutex);
+        bindFrameBuffer();
+        applyLinkPositionSnapshot();
+        setRenderingStatesOfSensor();
+        renderScene(doStoreResultToTmpDataBuffer);
+    }
+
+    doneGLContextCurrent();
+}
+
+
+void VisionRenderer::renderScene(bool doStoreResultToTmpDataBuffer)
+{
+    if(numRangeSectors > 0){
+        renderRangeSensorSectors(doStoreResultToTmpDataBuffer);
+        return;
+    }
+
+    SimulationProfiler* profiler = simImpl->profiler;
+    
+    const double renderingBeginTime = profiler->begin();
+    cullSceneNodes();
     renderer->render();
     renderer->flush();
+    if(sharedScene){
+        // The renderer may bind the frame buffer of another sensor in flush()
+        bindFrameBuffer();
+    }
+    applySensorNoise();
+    profiler->end(renderingStageId, renderingBeginTime);
+    recordGPUTime();
+    
     if(doStoreResultToTmpDataBuffer){
+        const double readbackBeginTime = profiler->begin();
         storeResultToTmpDataBuffer();
+        profiler->end(readbackStageId, readbackBeginTime);
+    }
+}
+
+
+/**
+   The switch of each culling node is turned off if the bounding sphere of the node is outside the
+   view volume including the near and far clip planes. This must be done for every rendering because
+   the switches are shared by the sensors rendering the shared scene.
+*/
+void VisionRenderer::cullSceneNodes()
+{
+    if(cullingNodes.empty()){
+        return;
+    }
+    SgPerspectiveCamera* camera = dynamic_cast<SgPerspectiveCamera*>(sensorCamera);
+    if(!camera || !sensorSceneLink || !sensorCameraTransform){
+        for(size_t i=0; i < cullingNodes.size(); ++i){
+            cullingNodes[i].switchNode->turnOn();
+        }
+        return;
+    }
+
+    const Affine3 T = sensorSceneLink->T() * sensorCameraTransform->T();
+    const Affine3 Tinv = T.inverse(Eigen::Isometry);
+    const double aspectRatio = (double)pixelWidth / pixelHeight;
+    const double tanY = tan(camera->fovy(aspectRatio) / 2.0);
+    const double tanX = tanY * aspectRatio;
+    const double lx = sqrt(1.0 + tanX * tanX);
+    const double ly = sqrt(1.0 + tanY * tanY);
+    const double zNear = camera->nearClipDistance();
+    const double zFar = camera->farClipDistance();
+
+    for(size_t i=0; i < cullingNodes.size(); ++i){
+        CullingNode& node = cullingNodes[i];
+        const BoundingBox& bbox = node.switchNode->boundingBox();
+        bool isVisible = true;
+        if(!bbox.empty()){
+            Vector3 c = bbox.center();
+            if(node.transform){
+                c = node.transform->T() * c;
+            }
+            const Vector3 p = Tinv * c;
+            const double r = bbox.boundingSphereRadius();
+            const double z = -p.z();
+            isVisible =
+                (z + r >= zNear) && (z - r <= zFar) &&
+                (fabs(p.x()) - z * tanX <= r * lx) &&
+                (fabs(p.y()) - z * tanY <= r * ly);
+        }
+        node.switchNode->setTurnedOn(isVisible);
+    }
+}
+
+
+/**
+   The noise is applied to the frame buffer before the readback so that all the readback modes
+   give the data with the noise. The random numbers are different in each rendering.
+*/
+void VisionRenderer::applySensorNoise()
+{
+    if(hasSensorNoise && !isSensorNoiseUnavailable){
+        const unsigned int seed = noiseSeed + (noiseFrameCounter++) * 0x9e3779b9u;
+        const bool hasColor = cameraForRendering && (cameraForRendering->imageType() == Camera::COLOR_IMAGE);
+        if(!static_cast<GLSLSceneRenderer*>(renderer)->applySensorNoise(
+               hasColor, lensDistortionK1, lensDistortionK2, rangeNoise, rangeQuantizationStep, dropoutRate, seed)){
+            isSensorNoiseUnavailable = true;
+        }
+    }
+}
+
+
+/**
+   The result of the timer query is obtained when the next frame is rendered, so the recorded
+   GPU time is the one of the previous rendering of the sensor. It is recorded as the event
+   which ends at the current time.
+*/
+void VisionRenderer::recordGPUTime()
+{
+    if(!sharedScene){
+        const double gpuTime = renderer->gpuTime();
+        if(gpuTime >= 0.0){
+            SimulationProfiler* profiler = simImpl->profiler;
+            profiler->end(gpuStageId, profiler->begin() - gpuTime);
+        }
+    }
+}
+
+
+/**
+   The beams of each sector are resampled right after the sector is rendered. When the GLSL renderer
+   is used, the distances are computed on the GPU and only the distances of the beams are read back.
+*/
+void VisionRenderer::renderRangeSensorSectors(bool doStoreResultToTmpDataBuffer)
+{
+    SimulationProfiler* profiler = simImpl->profiler;
+    RangeSensor* sensor = rangeSensorForRendering.get();
+    const int yawResolution = sensor->yawResolution();
+    const int pitchResolution = sensor->pitchResolution();
+    const double yawRange = sensor->yawRange();
+    const double pitchRange = sensor->pitchRange();
+    const Isometry3& T_local = sensor->T_local();
+
+    vector<double>* rangeData = 0;
+    if(doStoreResultToTmpDataBuffer){
+        dataOnsetTime = onsetTime;
+        tmpRangeData = rangeDataPool.acquire();
+        tmpRangeData->resize(yawResolution * pitchResolution);
+        rangeData = tmpRangeData.get();
+    }
+    GLSLSceneRenderer* glslRenderer = dynamic_cast<GLSLSceneRenderer*>(renderer);
+    bool isResampledOnGPU = (glslRenderer != 0);
+    bool isValid = true;
+
+    for(int i=0; i < numRangeSectors; ++i){
+        const double renderingBeginTime = profiler->begin();
+        const double centerYawAngle = (i + 0.5) * rangeSectorYawRange - yawRange / 2.0;
+        rangeCameraPos->setTranslation(T_local.translation());
+        rangeCameraPos->setRotation(T_local.linear() * AngleAxis(centerYawAngle, Vector3::UnitY()));
+        cullSceneNodes();
+        renderer->render();
+        renderer->flush();
+        if(sharedScene){
+            bindFrameBuffer();
+        }
+        applySensorNoise();
+        profiler->end(renderingStageId, renderingBeginTime);
+        recordGPUTime();
+
+        if(!rangeData){
+            continue;
+        }
+        
+        const double readbackBeginTime = profiler->begin();
+        projectionMatrix = renderer->projectionMatrix();
+        const int yawBegin = rangeSectorYawIndices[i];
+        const int yawEnd = rangeSectorYawIndices[i + 1];
+        const double firstYawAngle = -yawRange / 2.0 - centerYawAngle;
+        if(isResampledOnGPU){
+            isResampledOnGPU = glslRenderer->resampleDepthBufferAsRanges(
+                yawResolution, pitchResolution, yawBegin, yawEnd,
+                firstYawAngle, sensor->yawStep(), -pitchRange / 2.0, sensor->pitchStep(), depthError);
+            if(!isResampledOnGPU && i > 0){
+                // The distances of the previous sectors are lost
+                isValid = false;
+            }
+        }
+        if(!isResampledOnGPU){
+            rangeSectorBuffer.resize(pixelWidth * pixelHeight);
+            glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, &rangeSectorBuffer[0]);
+            resampleRangeSensorSector(*rangeData, &rangeSectorBuffer[0], yawBegin, yawEnd, firstYawAngle);
+        }
+        profiler->end(readbackStageId, readbackBeginTime);
+    }
+
+    if(rangeData){
+        if(isResampledOnGPU){
+            const double readbackBeginTime = profiler->begin();
+            rangeSectorBuffer.resize(rangeData->size());
+            if(glslRenderer->readResampledRanges(&rangeSectorBuffer[0])){
+                std::copy(rangeSectorBuffer.begin(), rangeSectorBuffer.end(), rangeData->begin());
+            } else {
+                isValid = false;
+            }
+            profiler->end(readbackStageId, readbackBeginTime);
+        }
+        hasUpdatedData = isValid;
+        convertRangeSensorDataFormat();
+    }
+}
+
+
+/**
+   The pixel of a beam is given by the projection matrix in the same way as the resampling shader.
+*/
+void VisionRenderer::resampleRangeSensorSector
+(vector<double>& rangeData, const float* depthBuf, int yawBegin, int yawEnd, double firstYawAngle)
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
+    const int yawResolution = rangeSensorForRendering->yawResolution();
+    const double yawStep = rangeSensorForRendering->yawStep();
+    const double pitchRange = rangeSensorForRendering->pitchRange();
+    const int pitchResolution = rangeSensorForRendering->pitchResolution();
+    const double pitchStep = rangeSensorForRendering->pitchStep();
+
+    const Matrix4 Pinv = projectionMatrix.inverse();
+    const double Pinv_32 = Pinv(3, 2);
+    const double Pinv_33 = Pinv(3, 3);
+    const double sx = projectionMatrix(0, 0);
+    const double sy = projectionMatrix(1, 1);
+
+    for(int pitch=0; pitch < pitchResolution; ++pitch){
+        const double pitchAngle = pitch * pitchStep - pitchRange / 2.0;
+        const double cosPitchAngle = cos(pitchAngle);
+        const int py = std::max(0, std::min(pixelHeight - 1, (int)floor((sy * tan(pitchAngle) * 0.5 + 0.5) * pixelHeight)));
+        const float* src = depthBuf + py * pixelWidth;
+        double* dest = &rangeData[pitch * yawResolution];
+        
+        for(int yaw=yawBegin; yaw < yawEnd; ++yaw){
+            const double yawAngle = firstYawAngle + yaw * yawStep;
+            const int px = std::max(0, std::min(pixelWidth - 1, (int)floor((-sx * tan(yawAngle) * 0.5 + 0.5) * pixelWidth)));
+            const float depth = src[px];
+            if(depth > 0.0f && depth < 1.0f){
+                const double z0 = 2.0 * depth - 1.0;
+                const double w = Pinv_32 * z0 + Pinv_33;
+                const double z = -1.0 / w + depthError;
+                dest[yaw] = fabs((z / cosPitchAngle) / cos(yawAngle));
+            } else {
+                dest[yaw] = std::numeric_limits<double>::infinity();
+            }
+        }
     }
-    doneGLContextCurrent();
 }
 
 
 void VisionRenderer::startConcurrentRendering()
 {
     {
-        boost::unique_lock<boost::mutex> lock(renderingMutex);
+        boost::unique_lock<ProfiledMutex> lock(renderingMutex);
         updateScene(true);
         isRenderingRequested = true;
     }
@@ -900,7 +2100,7 @@ void VisionRenderer::concurrentRenderingLoop()
     
     while(true){
         {
-            boost::unique_lock<boost::mutex> lock(renderingMutex);
+            boost::unique_lock<ProfiledMutex> lock(renderingMutex);
             while(true){
                 if(isTerminationRequested){
                     goto exitConcurrentRenderingLoop;
@@ -916,12 +2116,10 @@ void VisionRenderer::concurrentRenderingLoop()
             makeGLContextCurrent();
             isGLContextCurrent = true;
         }
-        renderer->render();
-        renderer->flush();
-        storeResultToTmpDataBuffer();
+        renderScene(true);
     
         {
-            boost::unique_lock<boost::mutex> lock(renderingMutex);
+            boost::unique_lock<ProfiledMutex> lock(renderingMutex);
             isRenderingFinished = true;
         }
         renderingCondition.notify_all();
@@ -935,23 +2133,148 @@ exitConcurrentRenderingLoop:
 
 void VisionRenderer::storeResultToTmpDataBuffer()
 {
+    projectionMatrix = renderer->projectionMatrix();
+    
+    if(!pixelBuffers.empty()){
+        startPixelBufferReadback();
+        if(!isPixelBufferReadbackDeferred){
+            finishPixelBufferReadback();
+        }
+        return;
+    }
+
+    dataOnsetTime = onsetTime;
+    
     if(cameraForRendering){
         if(!tmpImage){
-            tmpImage = boost::make_shared<Image>();
+            tmpImage = imagePool.acquire();
         }
-        if(rangeCameraForRendering){
-            tmpPoints = boost::make_shared< vector<Vector3f> >();
+        if(isDepthImageOutput){
+            tmpDepthImage = depthImagePool.acquire();
+            hasUpdatedData = getRangeCameraDepthImage(*tmpImage, *tmpDepthImage);
+        } else if(rangeCameraForRendering){
+            tmpPoints = pointsPool.acquire();
             hasUpdatedData = getRangeCameraData(*tmpImage, *tmpPoints);
+            if(hasUpdatedData){
+                downsampleRangeCameraData(*tmpImage, *tmpPoints);
+            }
         } else {
             hasUpdatedData = getCameraImage(*tmpImage);
         }
     } else if(rangeSensorForRendering){
-        tmpRangeData = boost::make_shared< vector<double> >();
+        tmpRangeData = rangeDataPool.acquire();
         hasUpdatedData = getRangeSensorData(*tmpRangeData);
+        convertRangeSensorDataFormat();
     }
 }
 
 
+void VisionRenderer::startPixelBufferReadback()
+{
+    PixelBuffer& buffer = pixelBuffers[pixelBufferIndex];
+    if(buffer.colorBuffer){
+        pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.colorBuffer);
+        glReadPixels(0, 0, pixelWidth, pixelHeight, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    }
+    if(buffer.depthBuffer){
+        pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.depthBuffer);
+        buffer.hasPoints = false;
+        if(isPointConversionOnGPU){
+            buffer.hasPoints = static_cast<GLSLSceneRenderer*>(renderer)->readDepthBufferAsPoints(0);
+            isPointConversionOnGPU = buffer.hasPoints;
+        }
+        if(!buffer.hasPoints){
+            glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+        }
+    }
+    pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    buffer.onsetTime = onsetTime;
+    buffer.isFilled = true;
+
+    pixelBufferIndex = (pixelBufferIndex + 1) % pixelBuffers.size();
+}
+
+
+/**
+   The data is extracted from the buffer which has been filled earliest.
+   That is the buffer given to the latest startPixelBufferReadback() if there is only one buffer.
+*/
+void VisionRenderer::finishPixelBufferReadback()
+{
+    hasUpdatedData = false;
+    
+    PixelBuffer& buffer = pixelBuffers[pixelBufferIndex];
+    if(!buffer.isFilled){
+        return;
+    }
+    buffer.isFilled = false;
+
+    const unsigned char* colorBuf = 0;
+    const float* depthBuf = 0;
+    bool mapped = true;
+    if(buffer.colorBuffer){
+        pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.colorBuffer);
+        colorBuf = (const unsigned char*)pbo.mapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        mapped = (colorBuf != 0);
+    }
+    if(buffer.depthBuffer){
+        pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.depthBuffer);
+        depthBuf = (const float*)pbo.mapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        mapped = mapped && (depthBuf != 0);
+    }
+
+    if(mapped){
+        dataOnsetTime = buffer.onsetTime;
+        if(cameraForRendering){
+            if(!tmpImage){
+                tmpImage = imagePool.acquire();
+            }
+            if(isDepthImageOutput){
+                tmpDepthImage = depthImagePool.acquire();
+                hasUpdatedData = extractRangeCameraDepthImage(*tmpImage, *tmpDepthImage, colorBuf, depthBuf);
+            } else if(rangeCameraForRendering){
+                tmpPoints = pointsPool.acquire();
+                if(buffer.hasPoints){
+                    const Vector3f* pointBuf = reinterpret_cast<const Vector3f*>(depthBuf);
+                    tmpPoints->assign(pointBuf, pointBuf + pixelWidth * pixelHeight);
+                    hasUpdatedData = extractRangeCameraDataFromPoints(*tmpImage, *tmpPoints, colorBuf);
+                } else {
+                    hasUpdatedData = extractRangeCameraData(*tmpImage, *tmpPoints, colorBuf, depthBuf);
+                }
+                if(hasUpdatedData){
+                    downsampleRangeCameraData(*tmpImage, *tmpPoints);
+                }
+            } else {
+                hasUpdatedData = extractCameraImage(*tmpImage, colorBuf);
+            }
+        } else if(rangeSensorForRendering){
+            tmpRangeData = rangeDataPool.acquire();
+            hasUpdatedData = extractRangeSensorData(*tmpRangeData, depthBuf);
+            convertRangeSensorDataFormat();
+        }
+    }
+
+    if(depthBuf){
+        pbo.unmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    if(colorBuf){
+        pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.colorBuffer);
+        pbo.unmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    pbo.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+
+void VisionRenderer::finishDeferredPixelBufferReadback()
+{
+    makeGLContextCurrent();
+    const double readbackBeginTime = simImpl->profiler->begin();
+    finishPixelBufferReadback();
+    simImpl->profiler->end(readbackStageId, readbackBeginTime);
+    doneGLContextCurrent();
+}
+
+
 void GLVisionSimulatorItemImpl::onPostDynamics()
 {
     if(useThreadsForSensors){
@@ -968,7 +2291,10 @@ void GLVisionSimulatorItemImpl::getVisionDataInThreadsForSensors()
     while(p != renderersInRendering.end()){
         VisionRenderer* renderer = *p;
         if(renderer->elapsedTime >= renderer->latency){
-            if(renderer->waitForRenderingToFinish()){
+            const double waitBeginTime = profiler->begin();
+            const bool isRenderingFinished = renderer->waitForRenderingToFinish();
+            profiler->end(renderingWaitStageId, waitBeginTime);
+            if(isRenderingFinished){
                 renderer->copyVisionData();
                 renderer->isRendering = false;
             }
@@ -984,7 +2310,7 @@ void GLVisionSimulatorItemImpl::getVisionDataInThreadsForSensors()
 
 bool VisionRenderer::waitForRenderingToFinish()
 {
-    boost::unique_lock<boost::mutex> lock(renderingMutex);
+    boost::unique_lock<ProfiledMutex> lock(renderingMutex);
 
     if(!isRenderingFinished){
         if(simImpl->isBestEffortMode){
@@ -1005,13 +2331,16 @@ bool VisionRenderer::waitForRenderingToFinish()
 
 void GLVisionSimulatorItemImpl::getVisionDataInQueueThread()
 {
-    boost::unique_lock<boost::mutex> lock(queueMutex);
+    boost::unique_lock<ProfiledMutex> lock(queueMutex);
     
     vector<VisionRenderer*>::iterator p = renderersInRendering.begin();
     while(p != renderersInRendering.end()){
         VisionRenderer* renderer = *p;
         if(renderer->elapsedTime >= renderer->latency){
-            if(renderer->waitForRenderingToFinish(lock)){
+            const double waitBeginTime = profiler->begin();
+            const bool isRenderingFinished = renderer->waitForRenderingToFinish(lock);
+            profiler->end(renderingWaitStageId, waitBeginTime);
+            if(isRenderingFinished){
                 renderer->copyVisionData();
                 renderer->isRendering = false;
             }
@@ -1025,7 +2354,53 @@ void GLVisionSimulatorItemImpl::getVisionDataInQueueThread()
 }
 
 
-bool VisionRenderer::waitForRenderingToFinish(boost::unique_lock<boost::mutex>& lock)
+/**
+   The range data computed as doubles is converted to the data of the format of the sensor
+   in the rendering thread so that the simulation thread only moves the data to the sensor.
+*/
+void VisionRenderer::convertRangeSensorDataFormat()
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
+    if(!hasUpdatedData){
+        return;
+    }
+    const RangeSensor::RangeData& src = *tmpRangeData;
+    
+    switch(rangeSensorForRendering->rangeDataFormat()){
+
+    case RangeSensor::FLOAT_RANGE_DATA:
+        tmpFloatRangeData = floatRangeDataPool.acquire();
+        tmpFloatRangeData->assign(src.begin(), src.end());
+        tmpRangeData.reset();
+        break;
+        
+    case RangeSensor::FIXED_POINT_RANGE_DATA:
+    {
+        const double step = rangeSensorForRendering->fixedPointRangeStep();
+        const double maxDistance = (RangeSensor::FixedPointNoReturn - 1) * step;
+        tmpFixedPointRangeData = fixedPointRangeDataPool.acquire();
+        RangeSensor::FixedPointRangeData& data = *tmpFixedPointRangeData;
+        data.resize(src.size());
+        for(size_t i=0; i < src.size(); ++i){
+            const double d = src[i];
+            if(d >= 0.0 && d <= maxDistance){
+                data[i] = static_cast<unsigned short>(d / step + 0.5);
+            } else {
+                data[i] = RangeSensor::FixedPointNoReturn;
+            }
+        }
+        tmpRangeData.reset();
+        break;
+    }
+    
+    default:
+        break;
+    }
+}
+
+
+bool VisionRenderer::waitForRenderingToFinish(boost::unique_lock<ProfiledMutex>& lock)
 {
     if(!isRenderingFinished){
         if(simImpl->isBestEffortMode){
@@ -1047,17 +2422,31 @@ bool VisionRenderer::waitForRenderingToFinish(boost::unique_lock<boost::mutex>&
 void VisionRenderer::copyVisionData()
 {
     if(hasUpdatedData){
-        double delay = simImpl->currentTime - onsetTime;
+        double delay = simImpl->currentTime - dataOnsetTime;
         if(camera){
             if(!tmpImage->empty()){
                 camera->setImage(tmpImage);
             }
             if(rangeCamera){
-                rangeCamera->setPoints(tmpPoints);
+                if(isDepthImageOutput){
+                    rangeCamera->setDepthImage(tmpDepthImage);
+                } else {
+                    rangeCamera->setPoints(tmpPoints);
+                }
             }
             camera->setDelay(delay);
         } else if(rangeSensor){
-            rangeSensor->setRangeData(tmpRangeData);
+            switch(rangeSensorForRendering->rangeDataFormat()){
+            case RangeSensor::FLOAT_RANGE_DATA:
+                rangeSensor->setFloatRangeData(tmpFloatRangeData);
+                break;
+            case RangeSensor::FIXED_POINT_RANGE_DATA:
+                rangeSensor->setFixedPointRangeData(tmpFixedPointRangeData);
+                break;
+            default:
+                rangeSensor->setRangeData(tmpRangeData);
+                break;
+            }
             rangeSensor->setDelay(delay);
         }
         if(simImpl->isVisionDataRecordingEnabled){
@@ -1082,15 +2471,164 @@ bool VisionRenderer::getCameraImage(Image& image)
 }
 
 
+bool VisionRenderer::extractCameraImage(Image& image, const unsigned char* colorBuf)
+{
+    image.setSize(pixelWidth, pixelHeight, 3);
+    const int rowSize = pixelWidth * 3;
+    unsigned char* pixels = image.pixels();
+    for(int y = pixelHeight - 1; y >= 0; --y){
+        std::memcpy(pixels, colorBuf + y * rowSize, rowSize);
+        pixels += rowSize;
+    }
+    return true;
+}
+
+
 bool VisionRenderer::getRangeCameraData(Image& image, vector<Vector3f>& points)
 {
     unsigned char* colorBuf = 0;
+    if(cameraForRendering->imageType() == Camera::COLOR_IMAGE){
+        colorBuf = (unsigned char*)alloca(pixelWidth * pixelHeight * 3 * sizeof(unsigned char));
+        glReadPixels(0, 0, pixelWidth, pixelHeight, GL_RGB, GL_UNSIGNED_BYTE, colorBuf);
+    }
+
+    if(isPointConversionOnGPU){
+        points.resize(pixelWidth * pixelHeight);
+        if(static_cast<GLSLSceneRenderer*>(renderer)->readDepthBufferAsPoints(points.front().data())){
+            return extractRangeCameraDataFromPoints(image, points, colorBuf);
+        }
+        isPointConversionOnGPU = false;
+    }
+    
+    float* depthBuf = (float*)alloca(pixelWidth * pixelHeight * sizeof(float));
+    glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, depthBuf);
+
+    return extractRangeCameraData(image, points, colorBuf, depthBuf);
+}
+
+
+/**
+   \param points The organized points given by GLSLSceneRenderer::readDepthBufferAsPoints().
+   The invalid points are removed if the range camera is not organized.
+*/
+bool VisionRenderer::extractRangeCameraDataFromPoints
+(Image& image, vector<Vector3f>& points, const unsigned char* colorBuf)
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
+    if(rangeCameraForRendering->isOrganized()){
+        if(colorBuf){
+            extractCameraImage(image, colorBuf);
+        }
+        return true;
+    }
+
     unsigned char* pixels = 0;
+    if(colorBuf){
+        image.setSize(pixelWidth * pixelHeight, 1, 3);
+        pixels = image.pixels();
+    }
+    const float inf = numeric_limits<float>::infinity();
+    const int rowSize = pixelWidth * 3;
+    int srcIndex = 0;
+    int numValidPoints = 0;
+    
+    for(int y = pixelHeight - 1; y >= 0; --y){
+        const unsigned char* colorSrc = colorBuf ? (colorBuf + y * rowSize) : 0;
+        for(int x=0; x < pixelWidth; ++x){
+            const Vector3f p = points[srcIndex++];
+            // The z coordinate of a valid point is finite and negative
+            if(p.z() < 0.0f && p.z() > -inf){
+                points[numValidPoints++] = p;
+                if(pixels){
+                    pixels[0] = colorSrc[0];
+                    pixels[1] = colorSrc[1];
+                    pixels[2] = colorSrc[2];
+                    pixels += 3;
+                }
+            }
+            if(colorSrc){
+                colorSrc += 3;
+            }
+        }
+    }
+    points.resize(numValidPoints);
+
+    if(colorBuf){
+        image.setSize(numValidPoints, 1, 3);
+    }
+
+    return true;
+}
+
 
-    const bool extractColors = (cameraForRendering->imageType() == Camera::COLOR_IMAGE);
+/**
+   The points of a range camera which is not organized are replaced with the centroids of the points
+   in the cells of the voxel grid when the voxel size is given, and the colors are averaged in the same way.
+*/
+void VisionRenderer::downsampleRangeCameraData(Image& image, vector<Vector3f>& points)
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
+    const int numPoints = points.size();
+    if(rangeCameraVoxelSize <= 0.0 || rangeCameraForRendering->isOrganized() || numPoints == 0){
+        return;
+    }
+    groupPointsByVoxels(&points.front(), numPoints, rangeCameraVoxelSize, voxelPointIndices, voxelBegins);
+    
+    const int numVoxels = voxelBegins.size() - 1;
+    const bool hasColors = (image.numComponents() == 3 && image.width() * image.height() == numPoints);
+    const unsigned char* colors = hasColors ? image.pixels() : 0;
+    downsampledPoints.resize(numVoxels);
+    if(hasColors){
+        downsampledColors.resize(numVoxels * 3);
+    }
+    for(int i=0; i < numVoxels; ++i){
+        const int begin = voxelBegins[i];
+        const int end = voxelBegins[i + 1];
+        Vector3f p = Vector3f::Zero();
+        int r = 0, g = 0, b = 0;
+        for(int j = begin; j < end; ++j){
+            const int index = voxelPointIndices[j];
+            p += points[index];
+            if(hasColors){
+                const unsigned char* c = colors + index * 3;
+                r += c[0];
+                g += c[1];
+                b += c[2];
+            }
+        }
+        const int n = end - begin;
+        downsampledPoints[i] = p / n;
+        if(hasColors){
+            unsigned char* c = &downsampledColors[i * 3];
+            c[0] = r / n;
+            c[1] = g / n;
+            c[2] = b / n;
+        }
+    }
+    points.swap(downsampledPoints);
+    if(hasColors){
+        image.setSize(numVoxels, 1, 3);
+        if(numVoxels > 0){
+            std::copy(downsampledColors.begin(), downsampledColors.end(), image.pixels());
+        }
+    }
+}
+
+
+/**
+   \param colorBuf The colors are not extracted if this is null.
+*/
+bool VisionRenderer::extractRangeCameraData
+(Image& image, vector<Vector3f>& points, const unsigned char* colorBuf, const float* depthBuf)
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
+    unsigned char* pixels = 0;
+
+    const bool extractColors = (colorBuf != 0);
     if(extractColors){
-        colorBuf = (unsigned char*)alloca(pixelWidth * pixelHeight * 3 * sizeof(unsigned char));
-        glReadPixels(0, 0, pixelWidth, pixelHeight, GL_RGB, GL_UNSIGNED_BYTE, colorBuf);
         if(rangeCameraForRendering->isOrganized()){
             image.setSize(pixelWidth, pixelHeight, 3);
         } else {
@@ -1099,16 +2637,14 @@ bool VisionRenderer::getRangeCameraData(Image& image, vector<Vector3f>& points)
         pixels = image.pixels();
     }
 
-    float* depthBuf = (float*)alloca(pixelWidth * pixelHeight * sizeof(float));
-    glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, depthBuf);
-    const Matrix4f Pinv = renderer->projectionMatrix().inverse().cast<float>();
+    const Matrix4f Pinv = projectionMatrix.inverse().cast<float>();
     const float fw = pixelWidth;
     const float fh = pixelHeight;
     Vector4f n;
     n[3] = 1.0f;
     points.clear();
     points.reserve(pixelWidth * pixelHeight);
-    unsigned char* colorSrc = 0;
+    const unsigned char* colorSrc = 0;
     
     for(int y = pixelHeight - 1; y >= 0; --y){
         int srcpos = y * pixelWidth;
@@ -1159,8 +2695,73 @@ bool VisionRenderer::getRangeCameraData(Image& image, vector<Vector3f>& points)
 }
 
 
+bool VisionRenderer::getRangeCameraDepthImage(Image& image, RangeCamera::DepthImage& depthImage)
+{
+    unsigned char* colorBuf = 0;
+    if(cameraForRendering->imageType() == Camera::COLOR_IMAGE){
+        colorBuf = (unsigned char*)alloca(pixelWidth * pixelHeight * 3 * sizeof(unsigned char));
+        glReadPixels(0, 0, pixelWidth, pixelHeight, GL_RGB, GL_UNSIGNED_BYTE, colorBuf);
+    }
+    float* depthBuf = (float*)alloca(pixelWidth * pixelHeight * sizeof(float));
+    glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, depthBuf);
+
+    return extractRangeCameraDepthImage(image, depthImage, colorBuf, depthBuf);
+}
+
+
+/**
+   Only the depth along the optical axis is computed for each pixel, and the points are computed
+   from the depth image when a controller accesses them.
+*/
+bool VisionRenderer::extractRangeCameraDepthImage
+(Image& image, RangeCamera::DepthImage& depthImage, const unsigned char* colorBuf, const float* depthBuf)
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
+    if(colorBuf){
+        extractCameraImage(image, colorBuf);
+    }
+    
+    const double P22 = projectionMatrix(2, 2);
+    const double P23 = projectionMatrix(2, 3);
+    const double step = rangeCameraForRendering->depthImageStep();
+    const double maxDepth = 65535 * step;
+    
+    depthImage.resize(pixelWidth * pixelHeight);
+    unsigned short* dest = &depthImage.front();
+    
+    for(int y = pixelHeight - 1; y >= 0; --y){
+        const float* src = depthBuf + y * pixelWidth;
+        for(int x=0; x < pixelWidth; ++x){
+            const float z = src[x];
+            unsigned short value = RangeCamera::DepthImageNoReturn;
+            if(z > 0.0f && z < 1.0f){
+                const double d = P23 / ((2.0 * z - 1.0) + P22);
+                if(d > 0.0 && d <= maxDepth){
+                    value = std::max(1, static_cast<int>(d / step + 0.5));
+                }
+            }
+            *dest++ = value;
+        }
+    }
+
+    return true;
+}
+
+
 bool VisionRenderer::getRangeSensorData(vector<double>& rangeData)
 {
+    float* depthBuf = (float*)alloca(pixelWidth * pixelHeight * sizeof(float));
+    glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, depthBuf);
+
+    return extractRangeSensorData(rangeData, depthBuf);
+}
+
+
+bool VisionRenderer::extractRangeSensorData(vector<double>& rangeData, const float* depthBuf)
+{
+    SimulationProfiler::Scope scope(simImpl->profiler, pointConversionStageId);
+
     const double yawRange = rangeSensorForRendering->yawRange();
     const int yawResolution = rangeSensorForRendering->yawResolution();
     const double yawStep = rangeSensorForRendering->yawStep();
@@ -1171,15 +2772,13 @@ bool VisionRenderer::getRangeSensorData(vector<double>& rangeData)
     const double pitchStep = rangeSensorForRendering->pitchStep();
     const double maxTanPitchAngle = tan(pitchRange / 2.0);
 
-    const Matrix4 Pinv = renderer->projectionMatrix().inverse();
+    const Matrix4 Pinv = projectionMatrix.inverse();
     const double Pinv_32 = Pinv(3, 2);
     const double Pinv_33 = Pinv(3, 3);
     const double fw = pixelWidth;
     const double fh = pixelHeight;
 
-    float* depthBuf = (float*)alloca(pixelWidth * pixelHeight * sizeof(float));
-    glReadPixels(0, 0, pixelWidth, pixelHeight, GL_DEPTH_COMPONENT, GL_FLOAT, depthBuf);
-
+    rangeData.clear();
     rangeData.reserve(yawResolution * pitchResolution);
 
     for(int pitch=0; pitch < pitchResolution; ++pitch){
@@ -1230,17 +2829,16 @@ void GLVisionSimulatorItemImpl::finalizeSimulation()
 {
     if(useQueueThreadForAllSensors){
         {
-            boost::unique_lock<boost::mutex> lock(queueMutex);
+            boost::unique_lock<ProfiledMutex> lock(queueMutex);
             isQueueRenderingTerminationRequested = true;
         }
         queueCondition.notify_all();
         queueThread.wait();
-        while(!rendererQueue.empty()){
-            rendererQueue.pop();
-        }
+        rendererQueue.clear();
     }
         
     visionRenderers.clear();
+    sharedScene.reset();
 }
 
 
@@ -1248,24 +2846,49 @@ VisionRenderer::~VisionRenderer()
 {
     if(simImpl->useThreadsForSensors){
         {
-            boost::unique_lock<boost::mutex> lock(renderingMutex);
+            boost::unique_lock<ProfiledMutex> lock(renderingMutex);
             isTerminationRequested = true;
         }
         renderingCondition.notify_all();
         renderingThread.wait();
     }
 
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        makeGLContextCurrent();
+        deletePixelBuffers();
+        eglContext->deleteFrameBuffer(eglFrameBuffer);
+        if(sharedScene){
+            // The context and the renderer are deleted by the shared scene
+            doneGLContextCurrent();
+        } else {
+            delete renderer;
+            eglContext->doneCurrent();
+            delete eglContext;
+        }
+        renderer = 0;
+        eglContext = 0;
+    }
+#endif
 #if USE_QT5_OPENGL
     if(glContext){
         makeGLContextCurrent();
+        deletePixelBuffers();
         frameBuffer->release();
         delete frameBuffer;
-        delete glContext;
-        delete offscreenSurface;
+        if(sharedScene){
+            // The context and the renderer are deleted by the shared scene
+            doneGLContextCurrent();
+            renderer = 0;
+        } else {
+            delete glContext;
+            delete offscreenSurface;
+        }
     }
 #else
     if(renderingBuffer){
         makeGLContextCurrent();
+        deletePixelBuffers();
         delete renderingBuffer;
     }
 #endif
@@ -1291,10 +2914,20 @@ void GLVisionSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty
     putProperty(_("Record vision data"), isVisionDataRecordingEnabled, changeProperty(isVisionDataRecordingEnabled));
     putProperty(_("Threads for sensors"), useThreadsForSensorsProperty, changeProperty(useThreadsForSensorsProperty));
     putProperty(_("Best effort"), isBestEffortModeProperty, changeProperty(isBestEffortModeProperty));
-    putProperty(_("All scene objects"), shootAllSceneObjects, changeProperty(shootAllSceneObjects));
+    putProperty(_("Deadline scheduling"), isDeadlineSchedulingEnabled, changeProperty(isDeadlineSchedulingEnabled));
+    putProperty(_("Culling"), isCullingEnabled, changeProperty(isCullingEnabled));
+    putProperty(_("Shared scene"), isSceneSharingEnabled, changeProperty(isSceneSharingEnabled));
+#ifdef CNOID_ENABLE_EGL
+    putProperty(_("EGL context"), isEGLContextEnabled, changeProperty(isEGLContextEnabled));
+#endif
+    putProperty(_("Pixel buffer readback"), isPixelBufferReadbackEnabled, changeProperty(isPixelBufferReadbackEnabled));
+    putProperty.min(0).max(2)(_("Readback delay [frames]"), readbackDelay, changeProperty(readbackDelay));
+    putProperty.reset()(_("All scene objects"), shootAllSceneObjects, changeProperty(shootAllSceneObjects));
     putProperty.min(1.0)(_("Precision ratio of range sensors"),
                          rangeSensorPrecisionRatio, changeProperty(rangeSensorPrecisionRatio));
     putProperty.reset()(_("Depth error"), depthError, changeProperty(depthError));
+    putProperty.min(0.0).decimals(3)(_("Voxel size of range cameras"),
+                                     rangeCameraVoxelSize, changeProperty(rangeCameraVoxelSize));
     putProperty.reset()(_("Head light"), isHeadLightEnabled, changeProperty(isHeadLightEnabled));
     putProperty.reset()(_("Additional lights"), areAdditionalLightsEnabled, changeProperty(areAdditionalLightsEnabled));
 }
@@ -1316,9 +2949,16 @@ bool GLVisionSimulatorItemImpl::store(Archive& archive)
     archive.write("recordVisionData", isVisionDataRecordingEnabled);
     archive.write("useThreadsForSensors", useThreadsForSensorsProperty);
     archive.write("bestEffort", isBestEffortModeProperty);
+    archive.write("deadlineScheduling", isDeadlineSchedulingEnabled);
+    archive.write("culling", isCullingEnabled);
+    archive.write("shareScene", isSceneSharingEnabled);
+    archive.write("useEGL", isEGLContextEnabled);
+    archive.write("pixelBufferReadback", isPixelBufferReadbackEnabled);
+    archive.write("readbackDelay", readbackDelay);
     archive.write("allSceneObjects", shootAllSceneObjects);
     archive.write("rangeSensorPrecisionRatio", rangeSensorPrecisionRatio);
     archive.write("depthError", depthError);
+    archive.write("rangeCameraVoxelSize", rangeCameraVoxelSize);
     archive.write("enableHeadLight", isHeadLightEnabled);    
     archive.write("enableAdditionalLights", areAdditionalLightsEnabled);
     return true;
@@ -1344,9 +2984,18 @@ bool GLVisionSimulatorItemImpl::restore(const Archive& archive)
     archive.read("recordVisionData", isVisionDataRecordingEnabled);
     archive.read("useThreadsForSensors", useThreadsForSensorsProperty);
     archive.read("bestEffort", isBestEffortModeProperty);
+    archive.read("deadlineScheduling", isDeadlineSchedulingEnabled);
+    archive.read("culling", isCullingEnabled);
+    archive.read("shareScene", isSceneSharingEnabled);
+    archive.read("useEGL", isEGLContextEnabled);
+    archive.read("pixelBufferReadback", isPixelBufferReadbackEnabled);
+    if(archive.read("readbackDelay", readbackDelay)){
+        readbackDelay = std::max(0, std::min(readbackDelay, 2));
+    }
     archive.read("allSceneObjects", shootAllSceneObjects);
     archive.read("rangeSensorPrecisionRatio", rangeSensorPrecisionRatio);
     archive.read("depthError", depthError);
+    archive.read("rangeCameraVoxelSize", rangeCameraVoxelSize);
     archive.read("enableHeadLight", isHeadLightEnabled);
     archive.read("enableAdditionalLights", areAdditionalLightsEnabled);
     
@@ -29,7 +29,26 @@ public:
     void setVisionDataRecordingEnabled(bool on);
     void setDedicatedSensorThreadsEnabled(bool on);
     void setBestEffortMode(bool on);
+    void setPixelBufferReadbackEnabled(bool on);
+    void setReadbackDelay(int frames);
+    void setDeadlineSchedulingEnabled(bool on);
+    void setCullingEnabled(bool on);
+    void setSharedSceneEnabled(bool on);
+    void setEGLContextEnabled(bool on);
+
+    /**
+       The sensors are rendered by GLSLSceneRenderer instead of GL1SceneRenderer if this is enabled.
+       This is enabled by default when the environment variable CNOID_USE_GLSL is set.
+    */
+    void setGLSLRendererEnabled(bool on);
     void setRangeSensorPrecisionRatio(double r);
+
+    /**
+       The points of the range cameras which are not organized are downsampled with the voxel grid
+       of this size. The points are not downsampled if the size is zero, which is the default.
+    */
+    void setRangeCameraVoxelSize(double size);
+    
     void setAllSceneObjectsEnabled(bool on);
     void setHeadLightEnabled(bool on);
     void setAdditionalLightsEnabled(bool on);
@@ -10,6 +10,7 @@
 #include <cnoid/ItemManager>
 #include <cnoid/BodyMotionUtil>
 #include <cnoid/ZMPSeq>
+#include <cnoid/PlainSeqFormatLoader>
 #include <QMessageBox>
 #include <boost/bind.hpp>
 #include <boost/tokenizer.hpp>
@@ -23,7 +24,7 @@
 #endif
 #include <boost/filesystem.hpp>
 #include <fstream>
-#include <list>
+#include <iterator>
 #include <vector>
 #include <map>
 #include "gettext.h"
@@ -66,8 +67,6 @@ public:
     
     int numComponents[NUM_DATA_TYPES];
     
-    std::list< std::vector<double> > frames;
-    
     HrpsysLogLoader() {
         if(labelToTypeMap.empty()){
             labelToTypeMap["JA"] = JOINT_POS;
@@ -85,19 +84,26 @@ public:
         }
     }
 
+    /**
+       The header line is read by the tokenizer, and the data lines are converted by PlainSeqFileLoader,
+       which maps an uncompressed file into memory and parses the lines in parallel.
+    */
     bool loadLogFile(BodyMotionItem* item, const std::string& filename, std::ostream& os){
 
         iostreams::filtering_istream is;
 
+        bool isCompressed = false;
 #ifndef _WINDOWS
         string ext = filesystem::extension(filesystem::path(filename));
         if(ext == ".gz"){
             is.push(iostreams::gzip_decompressor());
+            isCompressed = true;
         } else if(ext == ".bz2"){
             is.push(iostreams::bzip2_decompressor());
+            isCompressed = true;
         }
 #endif
-        ifstream ifs(filename.c_str());
+        ifstream ifs(filename.c_str(), ios::in | ios::binary);
 
         if(!ifs){
             os << (format("\"%1%\" cannot be opened.") % filename) << endl;
@@ -107,7 +113,6 @@ public:
         is.push(ifs);
         
         elements.clear();
-        frames.clear();
         Separator sep(" \t\r\n", "%");
         string line;
         
@@ -126,26 +131,30 @@ public:
             return false;
         }
 
-        const size_t numElements = elements.size();
+        // The loader skips the header line
+        PlainSeqFileLoader loader;
+        bool loaded;
+        if(isCompressed){
+            string text;
+            text.append(istreambuf_iterator<char>(is), istreambuf_iterator<char>());
+            loaded = loader.load(text.data(), text.size(), filename);
+        } else {
+            is.reset();
+            ifs.close();
+            loaded = loader.load(filename);
+        }
+        if(!loaded){
+            os << loader.errorMessage() << endl;
+            return false;
+        }
 
-        while(getline(is, line)){
-            Tokenizer tokens(line, sep);
-            Tokenizer::iterator it = tokens.begin();
-            if(it != tokens.end()){
-                frames.push_back(vector<double>(numElements));
-                vector<double>& frame = frames.back();
-                size_t i;
-                for(i=0; (i < numElements) && (it != tokens.end()); ++i, ++it){
-                    frame[i] = lexical_cast<double>(*it);
-                }
-                if(i < numElements /* || it != tokens.end() */ ){
-                    os << (format("\"%1%\" contains different size columns.") % filename) << endl;
-                    return false;
-                }
-            }
+        const size_t numElements = elements.size();
+        if(loader.numColumns() < static_cast<int>(numElements)){
+            os << (format("\"%1%\" contains different size columns.") % filename) << endl;
+            return false;
         }
 
-        const size_t numFrames = frames.size();
+        const int numFrames = loader.numFrames();
 
         BodyMotionPtr motion = item->motion();
         motion->setDimension(numFrames, numComponents[JOINT_POS], 0);
@@ -156,10 +165,8 @@ public:
         //MultiValueSeqPtr useq;
         ZMPSeqPtr zmpseq = getOrCreateZMPSeq(*item->motion());
 
-        std::list< std::vector<double> >::iterator p = frames.begin();
-        
-        for(size_t i=0; i < numFrames; ++i){
-            vector<double>& frame = *p++;
+        for(int i=0; i < numFrames; ++i){
+            const double* frame = loader.frame(i);
             MultiValueSeq::Frame q = qseq->frame(i);
             for(size_t j=0; j < numElements; ++j){
                 Element& e = elements[j];
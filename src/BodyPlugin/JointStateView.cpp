@@ -9,10 +9,12 @@
 #include <cnoid/EigenUtil>
 #include <cnoid/ExtraBodyStateAccessor>
 #include <cnoid/LazyCaller>
+#include <cnoid/Timer>
 #include <cnoid/ViewManager>
 #include <QBoxLayout>
 #include <QHeaderView>
 #include <boost/bind.hpp>
+#include <boost/dynamic_bitset.hpp>
 #include <iostream>
 #include "gettext.h"
 
@@ -22,6 +24,9 @@ using namespace cnoid;
 namespace {
 const bool TRACE_FUNCTIONS = false;
 const bool doColumnStretch = true;
+
+// The view is updated at most 30 times per second
+const int minUpdateInterval = 33; // [ms]
 }
 
 namespace cnoid {
@@ -43,6 +48,9 @@ public:
     bool isKinematicStateChanged;
     bool isExtraJointStateChanged;
     LazyCaller updateViewLater;
+    Timer updateIntervalTimer;
+    vector<LinkTreeItem*> itemsInViewport;
+    boost::dynamic_bitset<> isJointInViewport;
     ConnectionSet connections;
     ConnectionSet connectionsToBody;
 
@@ -54,6 +62,9 @@ public:
     void updateJointList();
     void onKinematicStateChanged();
     void onExtraJointStateChanged();
+    void onViewportChanged();
+    void requestViewUpdate();
+    void onUpdateIntervalTimeout();
     void updateView();
 };
 }
@@ -122,6 +133,7 @@ JointStateViewImpl::JointStateViewImpl(JointStateView* self)
     }
     
     jointStateWidget.sigUpdateRequest().connect(boost::bind(&JointStateViewImpl::updateJointList, this));
+    jointStateWidget.sigViewportChanged().connect(boost::bind(&JointStateViewImpl::onViewportChanged, this));
     
     vbox->addWidget(&jointStateWidget);
 
@@ -131,6 +143,9 @@ JointStateViewImpl::JointStateViewImpl(JointStateView* self)
     self->sigDeactivated().connect(boost::bind(&JointStateViewImpl::onActivated, this ,false));
 
     updateViewLater.setFunction(boost::bind(&JointStateViewImpl::updateView, this));
+    updateIntervalTimer.setSingleShot(true);
+    updateIntervalTimer.setInterval(minUpdateInterval);
+    updateIntervalTimer.sigTimeout().connect(boost::bind(&JointStateViewImpl::onUpdateIntervalTimeout, this));
 
     //self->enableFontSizeZoomKeys(true);
 }
@@ -306,27 +321,72 @@ void JointStateViewImpl::updateJointList()
 void JointStateViewImpl::onKinematicStateChanged()
 {
     isKinematicStateChanged = true;
-    updateViewLater();
+    requestViewUpdate();
 }
 
 
 void JointStateViewImpl::onExtraJointStateChanged()
 {
+    isExtraJointStateChanged = true;
+    requestViewUpdate();
+}
+
+
+/**
+   Only the rows in the viewport are updated, so the rows which come into the viewport
+   are updated with all the states.
+*/
+void JointStateViewImpl::onViewportChanged()
+{
+    isKinematicStateChanged = true;
     isExtraJointStateChanged = true;
     updateViewLater();
 }
 
 
+void JointStateViewImpl::requestViewUpdate()
+{
+    /*
+      The update requested within the interval from the previous update is postponed
+      until the interval timer started in updateView() expires.
+    */
+    if(!updateIntervalTimer.isActive()){
+        updateViewLater();
+    }
+}
+
+
+void JointStateViewImpl::onUpdateIntervalTimeout()
+{
+    if(isKinematicStateChanged || isExtraJointStateChanged){
+        updateViewLater();
+    }
+}
+
+
 void JointStateViewImpl::updateView()
 {
     if(!currentBody){
         return;
     }
 
+    const int numJoints = currentBody->numJoints();
+    isJointInViewport.reset();
+    isJointInViewport.resize(numJoints, false);
+    jointStateWidget.getItemsInViewport(itemsInViewport);
+    for(size_t i=0; i < itemsInViewport.size(); ++i){
+        const Link* link = itemsInViewport[i]->link();
+        if(link && link->jointId() >= 0 && link->jointId() < numJoints){
+            isJointInViewport.set(link->jointId());
+        }
+    }
+
+    updateIntervalTimer.start();
+
     if(isKinematicStateChanged){
-        for(int i = 0; i < currentBody->numJoints(); ++i){
+        for(int i = 0; i < numJoints; ++i){
             Link* joint = currentBody->joint(i);
-            if(joint){
+            if(joint && isJointInViewport[i]){
                 LinkTreeItem* item = jointStateWidget.itemOfLink(joint->index());
                 if(joint->jointType() == Link::ROTATIONAL_JOINT){
                     item->setText(qColumn, QString::number(degree(joint->q()), 'f', 2));
@@ -348,6 +408,9 @@ void JointStateViewImpl::updateView()
             const int n = jointState.rowSize();
             const int m = jointState.colSize();
             for(int j=0; j < n; ++j){
+                if(j >= numJoints || !isJointInViewport[j]){
+                    continue;
+                }
                 Link* joint = currentBody->joint(j);
                 Array2D<ExtraBodyStateAccessor::Value>::Row js = jointState.row(j);
                 if(joint){
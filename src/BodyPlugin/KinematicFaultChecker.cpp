@@ -7,7 +7,6 @@
 #include "BodyMotionItem.h"
 #include "WorldItem.h"
 #include "LinkSelectionView.h"
-#include <cnoid/BodyState>
 #include <cnoid/Archive>
 #include <cnoid/MainWindow>
 #include <cnoid/MenuManager>
@@ -22,11 +21,15 @@
 #include <cnoid/EigenUtil>
 #include <cnoid/BodyCollisionDetectorUtil>
 #include <cnoid/IdPair>
+#include <cnoid/TaskScheduler>
 #include <QDialogButtonBox>
 #include <QBoxLayout>
 #include <QFrame>
 #include <QLabel>
+#include <QProgressDialog>
 #include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 #include <map>
 #include "gettext.h"
 
@@ -37,10 +40,34 @@ using boost::format;
 
 namespace {
 
-bool USE_DUPLICATED_BODY = false;
-
 KinematicFaultChecker* checkerInstance = 0;
 
+struct FaultEvent
+{
+    enum Type { JOINT_POSITION, JOINT_VELOCITY, SELF_COLLISION };
+    Type type;
+    int frame;
+    int id1; // joint id or the link index of the first geometry
+    int id2; // the link index of the second geometry
+    double value; // joint position or velocity
+
+    FaultEvent(Type type, int frame, int id1, int id2, double value)
+        : type(type), frame(frame), id1(id1), id2(id2), value(value) { }
+};
+
+/**
+   The successive frames which are checked by one thread with its own copies of
+   the body and the collision detector
+*/
+struct FrameBlock
+{
+    int beginningFrame;
+    int endingFrame;
+    BodyPtr body;
+    CollisionDetectorPtr collisionDetector;
+    vector<FaultEvent> events;
+};
+
 #if defined(_MSC_VER) && _MSC_VER < 1800
 inline long lround(double x) {
     return static_cast<long>((x > 0.0) ? floor(x + 0.5) : ceil(x -0.5));
@@ -82,6 +109,21 @@ public:
     double translationMargin;
     double velocityLimitRatio;
 
+    // the conditions shared by the threads checking the frame blocks
+    MultiValueSeqPtr qseq;
+    MultiSE3SeqPtr pseq;
+    bool checkPosition;
+    bool checkVelocity;
+    bool checkCollision;
+    dynamic_bitset<> linkSelection;
+    int numJoints;
+    int numLinks;
+    int beginningFrame;
+    int endingFrame;
+    vector<FrameBlock> frameBlocks;
+    boost::atomic<int> numCheckedFrames;
+    boost::atomic<bool> isCanceled;
+
     KinematicFaultCheckerImpl();
     bool store(Archive& archive);
     void restore(const Archive& archive);
@@ -89,10 +131,13 @@ public:
     int checkFaults(
         BodyItem* bodyItem, BodyMotionItem* motionItem, std::ostream& os,
         bool checkPosition, bool checkVelocity, bool checkCollision,
-        dynamic_bitset<> linkSelection, double beginningTime, double endingTime);
-    void putJointPositionFault(int frame, Link* joint, std::ostream& os);
-    void putJointVelocityFault(int frame, Link* joint, std::ostream& os);
-    void putSelfCollision(Body* body, int frame, const CollisionPair& collisionPair, std::ostream& os);
+        dynamic_bitset<> linkSelection, double beginningTime, double endingTime, bool showProgress = false);
+    void checkFrameBlocks();
+    void checkFrameBlock(int blockIndex);
+    static void addSelfCollisionEvent(FrameBlock* block, int frame, const CollisionPair& collisionPair);
+    void putJointPositionFault(int frame, Link* joint, double q, std::ostream& os);
+    void putJointVelocityFault(int frame, Link* joint, double dq, std::ostream& os);
+    void putSelfCollision(Body* body, int frame, int linkIndex1, int linkIndex2, std::ostream& os);
 };
 }
 
@@ -138,6 +183,9 @@ KinematicFaultCheckerImpl::KinematicFaultCheckerImpl()
       os(mes.cout())
 {
     setWindowTitle(_("Kinematic Fault Checker"));
+
+    numCheckedFrames = 0;
+    isCanceled = false;
     
     QVBoxLayout* vbox = new QVBoxLayout();
     setLayout(vbox);
@@ -311,8 +359,12 @@ void KinematicFaultCheckerImpl::apply()
                                     velocityCheck.isChecked(),
                                     collisionCheck.isChecked(),
                                     linkSelection,
-                                    beginningTime, endingTime);
-                
+                                    beginningTime, endingTime, true);
+
+                if(isCanceled){
+                    mes.notify(_("The check has been canceled."));
+                    break;
+                }
                 if(n > 0){
                     if(n == 1){
                         mes.notify(_("A fault has been detected."));
@@ -345,31 +397,29 @@ int KinematicFaultChecker::checkFaults
 int KinematicFaultCheckerImpl::checkFaults
 (BodyItem* bodyItem, BodyMotionItem* motionItem, std::ostream& os,
  bool checkPosition, bool checkVelocity, bool checkCollision, dynamic_bitset<> linkSelection,
- double beginningTime, double endingTime)
+ double beginningTime, double endingTime, bool showProgress)
 {
     numFaults = 0;
+    isCanceled = false;
 
-    BodyPtr body = bodyItem->body();
+    Body* body = bodyItem->body();
     BodyMotionPtr motion = motionItem->motion();
-    MultiValueSeqPtr qseq = motion->jointPosSeq();;
-    MultiSE3SeqPtr pseq = motion->linkPosSeq();
+    qseq = motion->jointPosSeq();;
+    pseq = motion->linkPosSeq();
     
     if((!checkPosition && !checkVelocity && !checkCollision) || body->isStaticModel() || !qseq->getNumFrames()){
         return numFaults;
     }
 
-    BodyState orgKinematicState;
-    
-    if(USE_DUPLICATED_BODY){
-        body = body->clone();
-    } else {
-        bodyItem->storeKinematicState(orgKinematicState);
-    }
+    this->checkPosition = checkPosition;
+    this->checkVelocity = checkVelocity;
+    this->checkCollision = checkCollision;
+    this->linkSelection = linkSelection;
 
     CollisionDetectorPtr collisionDetector;
     WorldItem* worldItem = bodyItem->findOwnerItem<WorldItem>();
     if(worldItem){
-        collisionDetector = worldItem->collisionDetector()->clone();
+        collisionDetector = worldItem->collisionDetector();
     } else {
         int index = CollisionDetector::factoryIndex("AISTCollisionDetector");
         if(index >= 0){
@@ -380,34 +430,121 @@ int KinematicFaultCheckerImpl::checkFaults
         }
     }
 
-    addBodyToCollisionDetector(*body, *collisionDetector);
-    collisionDetector->makeReady();
-
-    const int numJoints = std::min(body->numJoints(), qseq->numParts());
-    const int numLinks = std::min(body->numLinks(), pseq->numParts());
+    numJoints = std::min(body->numJoints(), qseq->numParts());
+    numLinks = std::min(body->numLinks(), pseq->numParts());
 
     frameRate = motion->frameRate();
-    double stepRatio2 = 2.0 / frameRate;
     angleMargin = radian(angleMarginSpin.value());
     translationMargin = translationMarginSpin.value();
     velocityLimitRatio = velocityLimitRatioSpin.value() / 100.0;
 
-    int beginningFrame = std::max(0, (int)(beginningTime * frameRate));
-    int endingFrame = std::min((motion->numFrames() - 1), (int)lround(endingTime * frameRate));
+    beginningFrame = std::max(0, (int)(beginningTime * frameRate));
+    endingFrame = std::min((motion->numFrames() - 1), (int)lround(endingTime * frameRate));
+    const int numFrames = endingFrame - beginningFrame + 1;
+    if(numFrames <= 0){
+        return numFaults;
+    }
 
-    lastPosFaultFrames.clear();
-    lastPosFaultFrames.resize(numJoints, std::numeric_limits<int>::min());
-    lastVelFaultFrames.clear();
-    lastVelFaultFrames.resize(numJoints, std::numeric_limits<int>::min());
-    lastCollisionFrames.clear();
+    /*
+      The frames are divided into the blocks checked in parallel. The copies of the body and
+      the collision detector are created here because the original body may be moved by the
+      GUI while the blocks are checked.
+    */
+    const int numBlocks = std::min(TaskScheduler::instance()->concurrency(), numFrames);
+    frameBlocks.clear();
+    frameBlocks.resize(numBlocks);
+    for(int i=0; i < numBlocks; ++i){
+        FrameBlock& block = frameBlocks[i];
+        block.beginningFrame = beginningFrame + (long)numFrames * i / numBlocks;
+        block.endingFrame = beginningFrame + (long)numFrames * (i + 1) / numBlocks - 1;
+        block.body = body->clone();
+        if(checkCollision){
+            Link* root = block.body->rootLink();
+            root->p().setZero();
+            root->R().setIdentity();
+            block.collisionDetector = collisionDetector->clone();
+            addBodyToCollisionDetector(*block.body, *block.collisionDetector);
+            block.collisionDetector->makeReady();
+        }
+    }
 
-    if(checkCollision){
-        Link* root = body->rootLink();
-        root->p().setZero();
-        root->R().setIdentity();
+    numCheckedFrames = 0;
+    boost::thread checkingThread(boost::bind(&KinematicFaultCheckerImpl::checkFrameBlocks, this));
+
+    if(showProgress){
+        QProgressDialog progress(_("Checking kinematic faults..."), _("Cancel"), 0, numFrames, MainWindow::instance());
+        progress.setWindowTitle(_("Kinematic Fault Checker"));
+        progress.setWindowModality(Qt::WindowModal);
+        while(true){
+            const int n = numCheckedFrames;
+            progress.setValue(n);
+            if(progress.wasCanceled()){
+                isCanceled = true;
+                break;
+            }
+            if(n < numFrames){
+                boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+            } else {
+                break;
+            }
+        }
     }
-        
-    for(int frame = beginningFrame; frame <= endingFrame; ++frame){
+
+    checkingThread.join();
+
+    if(!isCanceled){
+        // The faults are put in the frame order as a continuous fault is only reported at its beginning
+        lastPosFaultFrames.clear();
+        lastPosFaultFrames.resize(numJoints, std::numeric_limits<int>::min());
+        lastVelFaultFrames.clear();
+        lastVelFaultFrames.resize(numJoints, std::numeric_limits<int>::min());
+        lastCollisionFrames.clear();
+
+        for(size_t i=0; i < frameBlocks.size(); ++i){
+            const vector<FaultEvent>& events = frameBlocks[i].events;
+            for(size_t j=0; j < events.size(); ++j){
+                const FaultEvent& event = events[j];
+                switch(event.type){
+                case FaultEvent::JOINT_POSITION:
+                    putJointPositionFault(event.frame, body->joint(event.id1), event.value, os);
+                    break;
+                case FaultEvent::JOINT_VELOCITY:
+                    putJointVelocityFault(event.frame, body->joint(event.id1), event.value, os);
+                    break;
+                case FaultEvent::SELF_COLLISION:
+                    putSelfCollision(body, event.frame, event.id1, event.id2, os);
+                    break;
+                }
+            }
+        }
+    }
+
+    frameBlocks.clear();
+    qseq.reset();
+    pseq.reset();
+
+    return numFaults;
+}
+
+
+void KinematicFaultCheckerImpl::checkFrameBlocks()
+{
+    TaskScheduler::instance()->parallelFor(
+        0, frameBlocks.size(), boost::bind(&KinematicFaultCheckerImpl::checkFrameBlock, this, _1));
+}
+
+
+void KinematicFaultCheckerImpl::checkFrameBlock(int blockIndex)
+{
+    FrameBlock& block = frameBlocks[blockIndex];
+    Body* body = block.body;
+    const double stepRatio2 = 2.0 / frameRate;
+
+    for(int frame = block.beginningFrame; frame <= block.endingFrame; ++frame){
+
+        if(isCanceled){
+            break;
+        }
 
         int prevFrame = (frame == beginningFrame) ? beginningFrame : frame - 1;
         int nextFrame = (frame == endingFrame) ? endingFrame : frame + 1;
@@ -425,14 +562,14 @@ int KinematicFaultCheckerImpl::checkFaults
                         fault = (q > (joint->q_upper() - translationMargin) || q < (joint->q_lower() + translationMargin));
                     }
                     if(fault){
-                        putJointPositionFault(frame, joint, os);
+                        block.events.push_back(FaultEvent(FaultEvent::JOINT_POSITION, frame, i, -1, q));
                     }
                 }
                 if(checkVelocity){
                     double dq = (qseq->at(nextFrame, i) - qseq->at(prevFrame, i)) / stepRatio2;
                     joint->dq() = dq;
                     if(dq > (joint->dq_upper() * velocityLimitRatio) || dq < (joint->dq_lower() * velocityLimitRatio)){
-                        putJointVelocityFault(frame, joint, os);
+                        block.events.push_back(FaultEvent(FaultEvent::JOINT_VELOCITY, frame, i, -1, dq));
                     }
                 }
             }
@@ -467,35 +604,37 @@ int KinematicFaultCheckerImpl::checkFaults
 
             for(int i=0; i < numLinks; ++i){
                 link = body->link(i);
-                collisionDetector->updatePosition(i, link->position());
+                block.collisionDetector->updatePosition(i, link->position());
             }
-            collisionDetector->detectCollisions(
-                boost::bind(&KinematicFaultCheckerImpl::putSelfCollision, this, body.get(), frame, _1, boost::ref(os)));
+            block.collisionDetector->detectCollisions(
+                boost::bind(&KinematicFaultCheckerImpl::addSelfCollisionEvent, &block, frame, _1));
         }
-    }
 
-    if(!USE_DUPLICATED_BODY){
-        bodyItem->restoreKinematicState(orgKinematicState);
+        ++numCheckedFrames;
     }
+}
 
-    return numFaults;
+
+void KinematicFaultCheckerImpl::addSelfCollisionEvent(FrameBlock* block, int frame, const CollisionPair& collisionPair)
+{
+    block->events.push_back(
+        FaultEvent(FaultEvent::SELF_COLLISION, frame, collisionPair.geometryId[0], collisionPair.geometryId[1], 0.0));
 }
 
 
-void KinematicFaultCheckerImpl::putJointPositionFault(int frame, Link* joint, std::ostream& os)
+void KinematicFaultCheckerImpl::putJointPositionFault(int frame, Link* joint, double q, std::ostream& os)
 {
     static format f1(fmt(_("%1$7.3f [s]: Position limit over of %2% (%3% is beyond the range (%4% , %5%) with margin %6%.)")));
     static format f2(fmt(_("%1$7.3f [s]: Position limit over of %2% (%3% is beyond the range (%4% , %5%).)")));
     
     if(frame > lastPosFaultFrames[joint->jointId()] + 1){
-        double q, l, u, m;
+        double l, u, m;
         if(joint->isRotationalJoint()){
-            q = degree(joint->q());
+            q = degree(q);
             l = degree(joint->q_lower());
             u = degree(joint->q_upper());
             m = degree(angleMargin);
         } else {
-            q = joint->q();
             l = joint->q_lower();
             u = joint->q_upper();
             m = translationMargin;
@@ -513,18 +652,17 @@ void KinematicFaultCheckerImpl::putJointPositionFault(int frame, Link* joint, st
 }
 
 
-void KinematicFaultCheckerImpl::putJointVelocityFault(int frame, Link* joint, std::ostream& os)
+void KinematicFaultCheckerImpl::putJointVelocityFault(int frame, Link* joint, double dq, std::ostream& os)
 {
     static format f(fmt(_("%1$7.3f [s]: Velocity limit over of %2% (%3% is %4$.0f %% of the range (%5% , %6%).)")));
     
     if(frame > lastVelFaultFrames[joint->jointId()] + 1){
-        double dq, l, u;
+        double l, u;
         if(joint->isRotationalJoint()){
-            dq = degree(joint->dq());
+            dq = degree(dq);
             l = degree(joint->dq_lower());
             u = degree(joint->dq_upper());
         } else {
-            dq = joint->dq();
             l = joint->dq_lower();
             u = joint->dq_upper();
         }
@@ -540,12 +678,12 @@ void KinematicFaultCheckerImpl::putJointVelocityFault(int frame, Link* joint, st
 }
 
 
-void KinematicFaultCheckerImpl::putSelfCollision(Body* body, int frame, const CollisionPair& collisionPair, std::ostream& os)
+void KinematicFaultCheckerImpl::putSelfCollision(Body* body, int frame, int linkIndex1, int linkIndex2, std::ostream& os)
 {
     static format f(fmt(_("%1$7.3f [s]: Collision between %2% and %3%")));
     
     bool putMessage = false;
-    IdPair<int> idPair(collisionPair.geometryId);
+    IdPair<int> idPair(linkIndex1, linkIndex2);
     LastCollisionFrameMap::iterator p = lastCollisionFrames.find(idPair);
     if(p == lastCollisionFrames.end()){
         putMessage = true;
@@ -558,8 +696,8 @@ void KinematicFaultCheckerImpl::putSelfCollision(Body* body, int frame, const Co
     }
 
     if(putMessage){
-        Link* link0 = body->link(collisionPair.geometryId[0]);
-        Link* link1 = body->link(collisionPair.geometryId[1]);
+        Link* link0 = body->link(linkIndex1);
+        Link* link1 = body->link(linkIndex2);
         os << (f % (frame / frameRate) % link0->name() % link1->name()) << endl;
         numFaults++;
     }
@@ -13,6 +13,7 @@
 #include <QRadioButton>
 #include <QBoxLayout>
 #include <QEvent>
+#include <QScrollBar>
 #include <QApplication>
 #include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
@@ -63,6 +64,7 @@ public:
     Signal<void(bool isInitialCreation)> sigUpdateRequest;
     Signal<void(LinkTreeItem* item, int column)> sigItemChanged;
     Signal<void()> sigSelectionChanged;
+    Signal<void()> sigViewportChanged;
 
     int defaultExpansionLevel;
     bool isCacheEnabled;
@@ -125,6 +127,8 @@ public:
     void restoreTreeStateSub(QTreeWidgetItem* parentItem);
     void addChild(LinkTreeItem* parentItem, LinkTreeItem* item);
     void addChild(LinkTreeItem* item);
+    void createItemWidgets(LinkTreeItem* item);
+    void createPendingItemWidgets(QTreeWidgetItem* parentItem);
     void setLinkTree(Link* link, bool onlyJoints);
     void setLinkTreeSub(Link* link, Link* parentLink, LinkTreeItem* parentItem, bool onlyJoints);
     void setJointList(const BodyPtr& body);
@@ -178,6 +182,7 @@ LinkTreeItem::LinkTreeItem(const std::string& name)
     rowIndex_ = -1;
     link_ = 0;
     isLinkGroup_ = true;
+    isItemWidgetCreationPending_ = false;
 }
 
 
@@ -192,6 +197,7 @@ LinkTreeItem::LinkTreeItem(Link* link, LinkTreeWidgetImpl* treeImpl)
     rowIndex_ = -1;
     link_ = link;
     isLinkGroup_ = false;
+    isItemWidgetCreationPending_ = false;
     treeImpl->linkIndexToItemMap[link->index()] = this;
 }
 
@@ -207,6 +213,7 @@ LinkTreeItem::LinkTreeItem(LinkGroup* linkGroup, LinkTreeWidgetImpl* treeImpl)
     rowIndex_ = -1;
     link_ = 0;
     isLinkGroup_ = true;
+    isItemWidgetCreationPending_ = false;
 }
 
 
@@ -305,6 +312,9 @@ void LinkTreeWidgetImpl::initialize()
     QObject::connect(self, SIGNAL(itemSelectionChanged()),
                      self, SLOT(onSelectionChanged()));
 
+    QObject::connect(self->verticalScrollBar(), SIGNAL(valueChanged(int)),
+                     self, SLOT(onVerticalScrollBarValueChanged(int)));
+
     // The order of the following labes must correspond to that of ListingMode
     listingModeCombo.enableI18n(CNOID_GETTEXT_DOMAIN_NAME);
     listingModeCombo.addI18nItem(N_("Link List"));
@@ -467,6 +477,13 @@ void LinkTreeWidget::changeEvent(QEvent* event)
 }
 
 
+void LinkTreeWidget::resizeEvent(QResizeEvent* event)
+{
+    TreeWidget::resizeEvent(event);
+    impl->sigViewportChanged();
+}
+
+
 void LinkTreeWidget::setNameColumnMarginEnabled(bool on)
 {
     impl->isNameColumnMarginEnabled = on;
@@ -612,6 +629,36 @@ LinkTreeItem* LinkTreeWidget::itemOfLink(int linkIndex)
 }
 
 
+void LinkTreeWidget::getItemsInViewport(std::vector<LinkTreeItem*>& out_items)
+{
+    out_items.clear();
+    const int bottom = viewport()->height();
+    QTreeWidgetItem* item = itemAt(0, 0);
+    while(item){
+        if(visualItemRect(item).top() >= bottom){
+            break;
+        }
+        LinkTreeItem* linkTreeItem = dynamic_cast<LinkTreeItem*>(item);
+        if(linkTreeItem){
+            out_items.push_back(linkTreeItem);
+        }
+        item = itemBelow(item);
+    }
+}
+
+
+SignalProxy<void()> LinkTreeWidget::sigViewportChanged()
+{
+    return impl->sigViewportChanged;
+}
+
+
+void LinkTreeWidget::onVerticalScrollBarValueChanged(int value)
+{
+    impl->sigViewportChanged();
+}
+
+
 void LinkTreeWidgetImpl::clearTreeItems()
 {
     // Take custom row items before calling clear() to prevent the items from being deleted.
@@ -635,6 +682,10 @@ void LinkTreeWidgetImpl::setCurrentBodyItem(BodyItem* bodyItem, bool forceTreeUp
     
     if(forceTreeUpdate || currentChanged){
 
+        // The rows are laid out once after all of them are added
+        const bool wasUpdatesEnabled = self->updatesEnabled();
+        self->setUpdatesEnabled(false);
+
         self->blockSignals(true);
 
         clearTreeItems();
@@ -688,8 +739,11 @@ void LinkTreeWidgetImpl::setCurrentBodyItem(BodyItem* bodyItem, bool forceTreeUp
             }
 
             addCustomRows();
+            createPendingItemWidgets(self->invisibleRootItem());
         }
 
+        self->setUpdatesEnabled(wasUpdatesEnabled);
+
         sigUpdateRequest(true);
     }
 }
@@ -726,6 +780,9 @@ void LinkTreeWidgetImpl::restoreTreeStateSub(QTreeWidgetItem* parentItem)
     for(int i=0; i < n; ++i){
         LinkTreeItem* item = dynamic_cast<LinkTreeItem*>(parentItem->child(i));
         if(item){
+            if(item->isItemWidgetCreationPending_){
+                createItemWidgets(item);
+            }
             const Link* link = item->link();
             if(link){
                 const dynamic_bitset<>& selection = currentBodyItemInfo->selection;
@@ -764,6 +821,15 @@ void LinkTreeWidgetImpl::addChild(LinkTreeItem* parentItem, LinkTreeItem* item)
     }
     item->rowIndex_ = rowIndexCounter++;
 
+    // The widgets of a row are created when the row is shown by expanding its ancestors
+    item->isItemWidgetCreationPending_ = true;
+}
+
+
+void LinkTreeWidgetImpl::createItemWidgets(LinkTreeItem* item)
+{
+    item->isItemWidgetCreationPending_ = false;
+    
     for(size_t col=0; col < columnInfos.size(); ++col){
         LinkTreeWidget::ColumnWidgetFunction& func = columnInfos[col].widgetFunction;
         if(!func.empty()){
@@ -776,6 +842,23 @@ void LinkTreeWidgetImpl::addChild(LinkTreeItem* parentItem, LinkTreeItem* item)
 }
 
 
+void LinkTreeWidgetImpl::createPendingItemWidgets(QTreeWidgetItem* parentItem)
+{
+    const int n = parentItem->childCount();
+    for(int i=0; i < n; ++i){
+        LinkTreeItem* item = dynamic_cast<LinkTreeItem*>(parentItem->child(i));
+        if(item){
+            if(item->isItemWidgetCreationPending_){
+                createItemWidgets(item);
+            }
+            if(item->isExpanded()){
+                createPendingItemWidgets(item);
+            }
+        }
+    }
+}
+
+
 void LinkTreeWidgetImpl::addChild(LinkTreeItem* item)
 {
     addChild(0, item);
@@ -1072,6 +1155,7 @@ void LinkTreeWidgetImpl::onItemExpanded(QTreeWidgetItem* treeWidgetItem)
         setExpansionState(item, true);
         restoreSubTreeState(item);
     }
+    sigViewportChanged();
 }
 
 
@@ -1090,6 +1174,7 @@ void LinkTreeWidgetImpl::onItemCollapsed(QTreeWidgetItem* treeWidgetItem)
     if(item){
         setExpansionState(item, false);
     }
+    sigViewportChanged();
 }
 
 
@@ -42,6 +42,7 @@ private:
     QString nameText_;
     Link* link_;
     bool isLinkGroup_;
+    bool isItemWidgetCreationPending_;
 
     LinkTreeItem(Link* link, LinkTreeWidgetImpl* treeImpl);
     LinkTreeItem(LinkGroup* linkGroup, LinkTreeWidgetImpl* treeImpl);
@@ -104,6 +105,15 @@ class CNOID_EXPORT LinkTreeWidget : public TreeWidget
 
     int numLinkTreeItems();
 
+    //! Gets the items whose rows are currently shown in the viewport
+    void getItemsInViewport(std::vector<LinkTreeItem*>& out_items);
+
+    /**
+       This signal is emitted when the rows shown in the viewport may be changed
+       by scrolling, resizing, expanding or collapsing.
+    */
+    SignalProxy<void()> sigViewportChanged();
+
     SignalProxy<void(LinkTreeItem* item, int column)> sigItemChanged();
                     
     SignalProxy<void()> sigSelectionChanged();
@@ -130,6 +140,7 @@ class CNOID_EXPORT LinkTreeWidget : public TreeWidget
 
 protected:
     virtual void changeEvent(QEvent* event);
+    virtual void resizeEvent(QResizeEvent* event);
 
 private Q_SLOTS:
     void onItemChanged(QTreeWidgetItem* item, int column);
@@ -138,6 +149,7 @@ private Q_SLOTS:
     void onItemExpanded(QTreeWidgetItem* treeWidgetItem);
     void onItemCollapsed(QTreeWidgetItem* treeWidgetItem);
     void onHeaderSectionResized();
+    void onVerticalScrollBarValueChanged(int value);
         
 private:
             
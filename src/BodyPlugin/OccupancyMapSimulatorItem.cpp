@@ -0,0 +1,506 @@
+/*!
+  @file
+*/
+
+#include "OccupancyMapSimulatorItem.h"
+#include "SimulatorItem.h"
+#include <cnoid/ItemManager>
+#include <cnoid/ItemList>
+#include <cnoid/MessageView>
+#include <cnoid/LazyCaller>
+#include <cnoid/Archive>
+#include <cnoid/ValueTreeUtil>
+#include <cnoid/ConnectionSet>
+#include <cnoid/Body>
+#include <cnoid/RangeSensor>
+#include <cnoid/RangeCamera>
+#include <cnoid/SimulationProfiler>
+#include <cnoid/SceneDrawables>
+#include <boost/tokenizer.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <set>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+namespace {
+
+string getNameListString(const vector<string>& names)
+{
+    string nameList;
+    if(!names.empty()){
+        size_t n = names.size() - 1;
+        for(size_t i=0; i < n; ++i){
+            nameList += names[i];
+            nameList += ", ";
+        }
+        nameList += names.back();
+    }
+    return nameList;
+}
+
+bool updateNames(const string& nameListString, string& newNameListString, vector<string>& names)
+{
+    using boost::tokenizer;
+    using boost::char_separator;
+    
+    names.clear();
+    char_separator<char> sep(",");
+    tokenizer< char_separator<char> > tok(nameListString, sep);
+    for(tokenizer< char_separator<char> >::iterator p = tok.begin(); p != tok.end(); ++p){
+        string name = boost::trim_copy(*p);
+        if(!name.empty()){
+            names.push_back(name);
+        }
+    }
+    newNameListString = nameListString;
+    return true;
+}
+
+/*
+  The data of a sensor is captured by sharing it with the sensor when the sensor notifies
+  the update, and it is released after it is integrated so that the next data can be written
+  into the same buffer.
+*/
+struct SensorInfo
+{
+    RangeSensor* rangeSensor;
+    RangeCamera* rangeCamera;
+    bool isUpdated;
+    Position T;
+    boost::shared_ptr<const RangeSensor::RangeData> rangeData;
+    boost::shared_ptr<const RangeCamera::PointData> points;
+};
+
+}
+
+namespace cnoid {
+
+class OccupancyMapSimulatorItemImpl
+{
+public:
+    OccupancyMapSimulatorItem* self;
+    ostream& os;
+    OccupancyVoxelMapPtr map;
+    SimulationProfiler* profiler;
+    int mappingStageId;
+    vector<SensorInfo> sensorInfos;
+    ScopedConnectionSet sensorConnections;
+    vector<Vector3f> endPoints;
+    vector<unsigned char> hitFlags;
+
+    SgPointSetPtr pointSet;
+    boost::mutex sceneUpdateMutex;
+    bool isSceneUpdateRequested;
+
+    vector<string> bodyNames;
+    string bodyNameListString;
+    vector<string> sensorNames;
+    string sensorNameListString;
+    double voxelSize;
+        
+    OccupancyMapSimulatorItemImpl(OccupancyMapSimulatorItem* self);
+    OccupancyMapSimulatorItemImpl(OccupancyMapSimulatorItem* self, const OccupancyMapSimulatorItemImpl& org);
+    void initialize();
+    bool initializeSimulation(SimulatorItem* simulatorItem);
+    void onSensorStateChanged(int index);
+    void onPostDynamics();
+    void integrateRangeSensorData(SensorInfo& info);
+    void integrateRangeCameraData(SensorInfo& info);
+    void requestSceneUpdate();
+    void updateScene();
+    void finalizeSimulation();
+    void doPutProperties(PutPropertyFunction& putProperty);
+    bool store(Archive& archive);
+    bool restore(const Archive& archive);
+};
+
+}
+
+
+void OccupancyMapSimulatorItem::initializeClass(ExtensionManager* ext)
+{
+    ext->itemManager().registerClass<OccupancyMapSimulatorItem>(N_("OccupancyMapSimulatorItem"));
+    ext->itemManager().addCreationPanel<OccupancyMapSimulatorItem>();
+}
+
+
+OccupancyVoxelMap* OccupancyMapSimulatorItem::findOccupancyMap(Item* item)
+{
+    SimulatorItem* simulatorItem = SimulatorItem::findActiveSimulatorItemFor(item);
+    if(simulatorItem){
+        ItemList<OccupancyMapSimulatorItem> items;
+        items.extractChildItems(simulatorItem);
+        for(size_t i=0; i < items.size(); ++i){
+            if(items[i]->isEnabled()){
+                return items[i]->occupancyMap();
+            }
+        }
+    }
+    return 0;
+}
+
+
+OccupancyMapSimulatorItem::OccupancyMapSimulatorItem()
+{
+    impl = new OccupancyMapSimulatorItemImpl(this);
+    setName("OccupancyMapSimulator");
+}
+
+
+OccupancyMapSimulatorItemImpl::OccupancyMapSimulatorItemImpl(OccupancyMapSimulatorItem* self)
+    : self(self),
+      os(MessageView::instance()->cout())
+{
+    voxelSize = 0.05;
+    initialize();
+}
+
+
+OccupancyMapSimulatorItem::OccupancyMapSimulatorItem(const OccupancyMapSimulatorItem& org)
+    : SubSimulatorItem(org)
+{
+    impl = new OccupancyMapSimulatorItemImpl(this, *org.impl);
+}
+
+
+OccupancyMapSimulatorItemImpl::OccupancyMapSimulatorItemImpl
+(OccupancyMapSimulatorItem* self, const OccupancyMapSimulatorItemImpl& org)
+    : self(self),
+      os(MessageView::instance()->cout()),
+      bodyNames(org.bodyNames),
+      sensorNames(org.sensorNames)
+{
+    bodyNameListString = getNameListString(bodyNames);
+    sensorNameListString = getNameListString(sensorNames);
+    voxelSize = org.voxelSize;
+    initialize();
+}
+
+
+void OccupancyMapSimulatorItemImpl::initialize()
+{
+    map = new OccupancyVoxelMap;
+    map->setVoxelSize(voxelSize);
+    profiler = 0;
+    isSceneUpdateRequested = false;
+
+    pointSet = new SgPointSet;
+    pointSet->setPointSize(4.0);
+    pointSet->getOrCreateVertices();
+    SgMaterial* material = pointSet->getOrCreateMaterial();
+    material->setDiffuseColor(Vector3f::Zero());
+    material->setEmissiveColor(Vector3f(0.2f, 0.8f, 1.0f));
+}
+
+
+Item* OccupancyMapSimulatorItem::doDuplicate() const
+{
+    return new OccupancyMapSimulatorItem(*this);
+}
+
+
+OccupancyMapSimulatorItem::~OccupancyMapSimulatorItem()
+{
+    delete impl;
+}
+
+
+void OccupancyMapSimulatorItem::setTargetBodies(const std::string& names)
+{
+    updateNames(names, impl->bodyNameListString, impl->bodyNames);
+    notifyUpdate();
+}
+
+
+void OccupancyMapSimulatorItem::setTargetSensors(const std::string& names)
+{
+    updateNames(names, impl->sensorNameListString, impl->sensorNames);
+    notifyUpdate();
+}
+
+
+void OccupancyMapSimulatorItem::setVoxelSize(double size)
+{
+    if(size > 0.0 && size != impl->voxelSize){
+        impl->voxelSize = size;
+        notifyUpdate();
+    }
+}
+
+
+OccupancyVoxelMap* OccupancyMapSimulatorItem::occupancyMap()
+{
+    return impl->map;
+}
+
+
+SgNode* OccupancyMapSimulatorItem::getScene()
+{
+    return impl->pointSet;
+}
+
+
+bool OccupancyMapSimulatorItem::initializeSimulation(SimulatorItem* simulatorItem)
+{
+    return impl->initializeSimulation(simulatorItem);
+}
+
+
+bool OccupancyMapSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
+{
+    profiler = simulatorItem->profiler();
+    mappingStageId = profiler->registerStage("Occupancy mapping");
+    sensorInfos.clear();
+    sensorConnections.disconnect();
+    map->setVoxelSize(voxelSize);
+    map->clear();
+    updateScene();
+
+    std::set<string> bodyNameSet(bodyNames.begin(), bodyNames.end());
+    std::set<string> sensorNameSet(sensorNames.begin(), sensorNames.end());
+
+    const vector<SimulationBody*>& simBodies = simulatorItem->simulationBodies();
+    for(size_t i=0; i < simBodies.size(); ++i){
+        Body* body = simBodies[i]->body();
+        if(!bodyNameSet.empty() && bodyNameSet.find(body->name()) == bodyNameSet.end()){
+            continue;
+        }
+        for(int j=0; j < body->numDevices(); ++j){
+            Device* device = body->device(j);
+            RangeSensor* rangeSensor = dynamic_cast<RangeSensor*>(device);
+            RangeCamera* rangeCamera = dynamic_cast<RangeCamera*>(device);
+            if(!rangeSensor && !rangeCamera){
+                continue;
+            }
+            if(!sensorNameSet.empty() && sensorNameSet.find(device->name()) == sensorNameSet.end()){
+                continue;
+            }
+            os << (format(_("%1% detected range sensor \"%2%\" of %3% as a target."))
+                   % self->name() % device->name() % body->name()) << endl;
+            
+            sensorInfos.push_back(SensorInfo());
+            SensorInfo& info = sensorInfos.back();
+            info.rangeSensor = rangeSensor;
+            info.rangeCamera = rangeCamera;
+            info.isUpdated = false;
+            sensorConnections.add(
+                device->sigStateChanged().connect(
+                    boost::bind(&OccupancyMapSimulatorItemImpl::onSensorStateChanged, this, sensorInfos.size() - 1)));
+        }
+    }
+
+    if(sensorInfos.empty()){
+        os << (format(_("%1% has no target sensors")) % self->name()) << endl;
+        return false;
+    }
+
+    simulatorItem->addPostDynamicsFunction(boost::bind(&OccupancyMapSimulatorItemImpl::onPostDynamics, this));
+
+    return true;
+}
+
+
+/**
+   This function is called in the thread where the sensor data is updated, which is the simulation thread.
+   The position of the sensor is recorded with the data because the data is integrated later.
+*/
+void OccupancyMapSimulatorItemImpl::onSensorStateChanged(int index)
+{
+    SensorInfo& info = sensorInfos[index];
+    if(info.rangeSensor){
+        if(!info.rangeSensor->on()){
+            return;
+        }
+        info.rangeData = info.rangeSensor->sharedRangeData();
+        info.T = info.rangeSensor->link()->position() * info.rangeSensor->T_local();
+    } else {
+        if(!info.rangeCamera->on()){
+            return;
+        }
+        info.points = info.rangeCamera->sharedPoints();
+        info.T = info.rangeCamera->link()->position() * info.rangeCamera->T_local();
+    }
+    info.isUpdated = true;
+}
+
+
+void OccupancyMapSimulatorItemImpl::onPostDynamics()
+{
+    bool isMapUpdated = false;
+    
+    for(size_t i=0; i < sensorInfos.size(); ++i){
+        SensorInfo& info = sensorInfos[i];
+        if(info.isUpdated){
+            const double beginTime = profiler->begin();
+            if(info.rangeSensor){
+                integrateRangeSensorData(info);
+                info.rangeData.reset();
+            } else {
+                integrateRangeCameraData(info);
+                info.points.reset();
+            }
+            profiler->end(mappingStageId, beginTime);
+            info.isUpdated = false;
+            isMapUpdated = true;
+        }
+    }
+
+    if(isMapUpdated){
+        requestSceneUpdate();
+    }
+}
+
+
+/**
+   The directions of the rays are the same as the ones of RangeSensorRayCaster. The rays which do not
+   hit anything clear the voxels up to the max distance of the sensor.
+*/
+void OccupancyMapSimulatorItemImpl::integrateRangeSensorData(SensorInfo& info)
+{
+    const RangeSensor& sensor = *info.rangeSensor;
+    const RangeSensor::RangeData& ranges = *info.rangeData;
+    const int yawResolution = sensor.yawResolution();
+    const int pitchResolution = sensor.pitchResolution();
+    const int n = yawResolution * pitchResolution;
+    if(ranges.size() < (size_t)n){
+        return;
+    }
+    const double yawRange = sensor.yawRange();
+    const double yawStep = sensor.yawStep();
+    const double pitchRange = sensor.pitchRange();
+    const double pitchStep = sensor.pitchStep();
+    const double maxDistance = sensor.maxDistance();
+    const Vector3 p = info.T.translation();
+    const Matrix3 R = info.T.linear();
+
+    endPoints.resize(n);
+    hitFlags.resize(n);
+    int index = 0;
+    for(int pitch=0; pitch < pitchResolution; ++pitch){
+        const double pitchAngle = pitch * pitchStep - pitchRange / 2.0;
+        const double sinPitchAngle = sin(pitchAngle);
+        const double cosPitchAngle = cos(pitchAngle);
+        for(int yaw=0; yaw < yawResolution; ++yaw){
+            const double yawAngle = yaw * yawStep - yawRange / 2.0;
+            const Vector3 d = R * Vector3(-sin(yawAngle) * cosPitchAngle, sinPitchAngle, -cos(yawAngle) * cosPitchAngle);
+            const double distance = ranges[index];
+            const bool isHit = (distance < maxDistance);
+            endPoints[index] = (p + (isHit ? distance : maxDistance) * d).cast<float>();
+            hitFlags[index] = isHit;
+            ++index;
+        }
+    }
+    map->insertRays(p.cast<float>(), &endPoints.front(), n, &hitFlags.front());
+}
+
+
+//! The points which are not finite are the ones of the pixels which do not have the depth and they are skipped.
+void OccupancyMapSimulatorItemImpl::integrateRangeCameraData(SensorInfo& info)
+{
+    const RangeCamera::PointData& points = *info.points;
+    const int n = points.size();
+    if(n == 0){
+        return;
+    }
+    const Matrix3f R = info.T.linear().cast<float>();
+    const Vector3f p = info.T.translation().cast<float>();
+    endPoints.resize(n);
+    for(int i=0; i < n; ++i){
+        endPoints[i] = R * points[i] + p;
+    }
+    map->insertRays(p, &endPoints.front(), n);
+}
+
+
+/**
+   The scene is updated in the main thread, and the requests made before the update are merged.
+*/
+void OccupancyMapSimulatorItemImpl::requestSceneUpdate()
+{
+    boost::lock_guard<boost::mutex> lock(sceneUpdateMutex);
+    if(!isSceneUpdateRequested){
+        isSceneUpdateRequested = true;
+        callLater(boost::bind(&OccupancyMapSimulatorItemImpl::updateScene, this), LazyCaller::PRIORITY_LOW);
+    }
+}
+
+
+void OccupancyMapSimulatorItemImpl::updateScene()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(sceneUpdateMutex);
+        isSceneUpdateRequested = false;
+    }
+    map->getOccupiedVoxelCenters(*pointSet->vertices());
+    pointSet->vertices()->notifyUpdate();
+}
+
+
+void OccupancyMapSimulatorItem::finalizeSimulation()
+{
+    impl->finalizeSimulation();
+}
+
+
+void OccupancyMapSimulatorItemImpl::finalizeSimulation()
+{
+    sensorConnections.disconnect();
+    sensorInfos.clear();
+}
+
+
+void OccupancyMapSimulatorItem::doPutProperties(PutPropertyFunction& putProperty)
+{
+    SubSimulatorItem::doPutProperties(putProperty);
+    impl->doPutProperties(putProperty);
+}
+
+
+void OccupancyMapSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
+{
+    putProperty(_("Target bodies"), bodyNameListString, boost::bind(updateNames, _1, boost::ref(bodyNameListString), boost::ref(bodyNames)));
+    putProperty(_("Target sensors"), sensorNameListString, boost::bind(updateNames, _1, boost::ref(sensorNameListString), boost::ref(sensorNames)));
+    putProperty.decimals(3).min(0.001)(_("Voxel size"), voxelSize, changeProperty(voxelSize));
+    putProperty(_("Number of occupied voxels"), map->numOccupiedVoxels());
+}
+
+
+bool OccupancyMapSimulatorItem::store(Archive& archive)
+{
+    SubSimulatorItem::store(archive);
+    return impl->store(archive);
+}
+
+
+bool OccupancyMapSimulatorItemImpl::store(Archive& archive)
+{
+    writeElements(archive, "targetBodies", bodyNames, true);
+    writeElements(archive, "targetSensors", sensorNames, true);
+    archive.write("voxelSize", voxelSize);
+    return true;
+}
+
+
+bool OccupancyMapSimulatorItem::restore(const Archive& archive)
+{
+    SubSimulatorItem::restore(archive);
+    return impl->restore(archive);
+}
+
+
+bool OccupancyMapSimulatorItemImpl::restore(const Archive& archive)
+{
+    readElements(archive, "targetBodies", bodyNames);
+    bodyNameListString = getNameListString(bodyNames);
+    readElements(archive, "targetSensors", sensorNames);
+    sensorNameListString = getNameListString(sensorNames);
+    archive.read("voxelSize", voxelSize);
+    return true;
+}
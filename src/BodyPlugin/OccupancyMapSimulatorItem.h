@@ -0,0 +1,65 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_OCCUPANCY_MAP_SIMULATOR_ITEM_H
+#define CNOID_BODYPLUGIN_OCCUPANCY_MAP_SIMULATOR_ITEM_H
+
+#include "SubSimulatorItem.h"
+#include <cnoid/SceneProvider>
+#include <cnoid/OccupancyVoxelMap>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class OccupancyMapSimulatorItemImpl;
+
+/**
+   This item builds an occupancy voxel map of the world from the data of the range sensors and
+   the range cameras during the simulation. The data given to the sensors by the other sub simulators
+   is integrated in the simulation thread without being copied, and the rays are traced in parallel.
+   The occupied voxels are shown as a point set in the scene.
+*/
+class CNOID_EXPORT OccupancyMapSimulatorItem : public SubSimulatorItem, public SceneProvider
+{
+public:
+    static void initializeClass(ExtensionManager* ext);
+
+    /**
+       @return The map of the first enabled item of this type under the simulator item which
+       simulates the given item, or null if there is no such item. This function should be called
+       in the main thread, e.g. when a controller is initialized, and the returned map can be accessed
+       from the controller threads.
+    */
+    static OccupancyVoxelMap* findOccupancyMap(Item* item);
+        
+    OccupancyMapSimulatorItem();
+    OccupancyMapSimulatorItem(const OccupancyMapSimulatorItem& org);
+    ~OccupancyMapSimulatorItem();
+        
+    void setTargetBodies(const std::string& bodyNames);
+    void setTargetSensors(const std::string& sensorNames);
+    void setVoxelSize(double size);
+
+    //! The map is cleared when a simulation is started and kept after the simulation is finished.
+    OccupancyVoxelMap* occupancyMap();
+
+    virtual SgNode* getScene();
+    virtual bool initializeSimulation(SimulatorItem* simulatorItem);
+    virtual void finalizeSimulation();
+
+protected:
+    virtual Item* doDuplicate() const;
+    virtual void doPutProperties(PutPropertyFunction& putProperty);
+    virtual bool store(Archive& archive);
+    virtual bool restore(const Archive& archive);
+
+private:
+    OccupancyMapSimulatorItemImpl* impl;
+};
+
+typedef ref_ptr<OccupancyMapSimulatorItem> OccupancyMapSimulatorItemPtr;
+
+}
+
+#endif
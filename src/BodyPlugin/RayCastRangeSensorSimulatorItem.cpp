@@ -0,0 +1,401 @@
+/*!
+  @file
+  @author Shin'ichiro Nakaoka
+*/
+
+#include "RayCastRangeSensorSimulatorItem.h"
+#include "SimulatorItem.h"
+#include "WorldItem.h"
+#include <cnoid/ItemManager>
+#include <cnoid/MessageView>
+#include <cnoid/Archive>
+#include <cnoid/ValueTreeUtil>
+#include <cnoid/Body>
+#include <cnoid/RangeSensor>
+#include <cnoid/RangeSensorRayCaster>
+#include <cnoid/SimulationProfiler>
+#include <boost/tokenizer.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <set>
+#include <algorithm>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+namespace {
+
+string getNameListString(const vector<string>& names)
+{
+    string nameList;
+    if(!names.empty()){
+        size_t n = names.size() - 1;
+        for(size_t i=0; i < n; ++i){
+            nameList += names[i];
+            nameList += ", ";
+        }
+        nameList += names.back();
+    }
+    return nameList;
+}
+
+bool updateNames(const string& nameListString, string& newNameListString, vector<string>& names)
+{
+    using boost::tokenizer;
+    using boost::char_separator;
+    
+    names.clear();
+    char_separator<char> sep(",");
+    tokenizer< char_separator<char> > tok(nameListString, sep);
+    for(tokenizer< char_separator<char> >::iterator p = tok.begin(); p != tok.end(); ++p){
+        string name = boost::trim_copy(*p);
+        if(!name.empty()){
+            names.push_back(name);
+        }
+    }
+    newNameListString = nameListString;
+    return true;
+}
+
+struct SensorInfo
+{
+    RangeSensorPtr sensor;
+    SimulationBody* simBody;
+    double cycleTime;
+    double elapsedTime;
+};
+
+}
+
+namespace cnoid {
+
+class RayCastRangeSensorSimulatorItemImpl
+{
+public:
+    RayCastRangeSensorSimulatorItem* self;
+    ostream& os;
+    SimulatorItem* simulatorItem;
+    SimulationProfiler* profiler;
+    int rayCastingStageId;
+    double worldTimeStep;
+    RangeSensorRayCasterPtr rayCaster;
+    vector<SensorInfo> sensorInfos;
+
+    vector<string> bodyNames;
+    string bodyNameListString;
+    vector<string> sensorNames;
+    string sensorNameListString;
+    double maxFrameRate;
+    bool isRangeDataRecordingEnabled;
+        
+    RayCastRangeSensorSimulatorItemImpl(RayCastRangeSensorSimulatorItem* self);
+    RayCastRangeSensorSimulatorItemImpl(RayCastRangeSensorSimulatorItem* self, const RayCastRangeSensorSimulatorItemImpl& org);
+    bool initializeSimulation(SimulatorItem* simulatorItem);
+    RangeSensorRayCasterPtr createRayCaster(CollisionDetectorPtr collisionDetector, const vector<SimulationBody*>& simBodies);
+    void addTargetSensor(SimulationBody* simBody, RangeSensor* sensor);
+    void onPostDynamics();
+    void finalizeSimulation();
+    void doPutProperties(PutPropertyFunction& putProperty);
+    bool store(Archive& archive);
+    bool restore(const Archive& archive);
+
+    template<typename Type> void setProperty(Type& variable, const Type& value){
+        if(value != variable){
+            variable = value;
+            self->notifyUpdate();
+        }
+    }
+};
+
+}
+
+
+void RayCastRangeSensorSimulatorItem::initializeClass(ExtensionManager* ext)
+{
+    ext->itemManager().registerClass<RayCastRangeSensorSimulatorItem>(N_("RayCastRangeSensorSimulatorItem"));
+    ext->itemManager().addCreationPanel<RayCastRangeSensorSimulatorItem>();
+}
+
+
+RayCastRangeSensorSimulatorItem::RayCastRangeSensorSimulatorItem()
+{
+    impl = new RayCastRangeSensorSimulatorItemImpl(this);
+    setName("RayCastRangeSensorSimulator");
+}
+
+
+RayCastRangeSensorSimulatorItemImpl::RayCastRangeSensorSimulatorItemImpl(RayCastRangeSensorSimulatorItem* self)
+    : self(self),
+      os(MessageView::instance()->cout())
+{
+    simulatorItem = 0;
+    profiler = 0;
+    maxFrameRate = 1000.0;
+    isRangeDataRecordingEnabled = false;
+}
+
+
+RayCastRangeSensorSimulatorItem::RayCastRangeSensorSimulatorItem(const RayCastRangeSensorSimulatorItem& org)
+    : SubSimulatorItem(org)
+{
+    impl = new RayCastRangeSensorSimulatorItemImpl(this, *org.impl);
+}
+
+
+RayCastRangeSensorSimulatorItemImpl::RayCastRangeSensorSimulatorItemImpl
+(RayCastRangeSensorSimulatorItem* self, const RayCastRangeSensorSimulatorItemImpl& org)
+    : self(self),
+      os(MessageView::instance()->cout()),
+      bodyNames(org.bodyNames),
+      sensorNames(org.sensorNames)
+{
+    simulatorItem = 0;
+    profiler = 0;
+    bodyNameListString = getNameListString(bodyNames);
+    sensorNameListString = getNameListString(sensorNames);
+    maxFrameRate = org.maxFrameRate;
+    isRangeDataRecordingEnabled = org.isRangeDataRecordingEnabled;
+}
+
+
+Item* RayCastRangeSensorSimulatorItem::doDuplicate() const
+{
+    return new RayCastRangeSensorSimulatorItem(*this);
+}
+
+
+RayCastRangeSensorSimulatorItem::~RayCastRangeSensorSimulatorItem()
+{
+    delete impl;
+}
+
+
+void RayCastRangeSensorSimulatorItem::setTargetBodies(const std::string& names)
+{
+    updateNames(names, impl->bodyNameListString, impl->bodyNames);
+    notifyUpdate();
+}
+
+
+void RayCastRangeSensorSimulatorItem::setTargetSensors(const std::string& names)
+{
+    updateNames(names, impl->sensorNameListString, impl->sensorNames);
+    notifyUpdate();
+}
+
+
+void RayCastRangeSensorSimulatorItem::setMaxFrameRate(double rate)
+{
+    impl->setProperty(impl->maxFrameRate, rate);
+}
+
+
+void RayCastRangeSensorSimulatorItem::setRangeDataRecordingEnabled(bool on)
+{
+    impl->setProperty(impl->isRangeDataRecordingEnabled, on);
+}
+
+
+bool RayCastRangeSensorSimulatorItem::initializeSimulation(SimulatorItem* simulatorItem)
+{
+    return impl->initializeSimulation(simulatorItem);
+}
+
+
+bool RayCastRangeSensorSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
+{
+    this->simulatorItem = simulatorItem;
+    worldTimeStep = simulatorItem->worldTimeStep();
+    profiler = simulatorItem->profiler();
+    rayCastingStageId = profiler->registerStage("Range sensor ray casting");
+    sensorInfos.clear();
+    rayCaster.reset();
+
+    std::set<string> bodyNameSet;
+    for(size_t i=0; i < bodyNames.size(); ++i){
+        bodyNameSet.insert(bodyNames[i]);
+    }
+    std::set<string> sensorNameSet;
+    for(size_t i=0; i < sensorNames.size(); ++i){
+        sensorNameSet.insert(sensorNames[i]);
+    }
+
+    const vector<SimulationBody*>& simBodies = simulatorItem->simulationBodies();
+    for(size_t i=0; i < simBodies.size(); ++i){
+        SimulationBody* simBody = simBodies[i];
+        Body* body = simBody->body();
+        if(bodyNameSet.empty() || bodyNameSet.find(body->name()) != bodyNameSet.end()){
+            for(size_t j=0; j < body->numDevices(); ++j){
+                RangeSensor* sensor = dynamic_cast<RangeSensor*>(body->device(j));
+                if(sensor){
+                    if(sensorNameSet.empty() || sensorNameSet.find(sensor->name()) != sensorNameSet.end()){
+                        addTargetSensor(simBody, sensor);
+                    }
+                }
+            }
+        }
+    }
+
+    if(sensorInfos.empty()){
+        os << (format(_("%1% has no target sensors")) % self->name()) << endl;
+        return false;
+    }
+
+    // The collision detector of the world is used if it supports the ray casting
+    WorldItem* worldItem = self->findOwnerItem<WorldItem>();
+    if(worldItem){
+        rayCaster = createRayCaster(worldItem->collisionDetector()->clone(), simBodies);
+    }
+    if(!rayCaster){
+        rayCaster = createRayCaster(
+            CollisionDetector::create(CollisionDetector::factoryIndex("AISTCollisionDetector")), simBodies);
+    }
+    if(!rayCaster){
+        os << (format(_("%1%: No collision detector which supports the ray casting is available."))
+               % self->name()) << endl;
+        sensorInfos.clear();
+        return false;
+    }
+
+    simulatorItem->addPostDynamicsFunction(boost::bind(&RayCastRangeSensorSimulatorItemImpl::onPostDynamics, this));
+
+    return true;
+}
+
+
+RangeSensorRayCasterPtr RayCastRangeSensorSimulatorItemImpl::createRayCaster
+(CollisionDetectorPtr collisionDetector, const vector<SimulationBody*>& simBodies)
+{
+    RangeSensorRayCasterPtr caster;
+    if(collisionDetector){
+        caster = boost::make_shared<RangeSensorRayCaster>(collisionDetector);
+        for(size_t i=0; i < simBodies.size(); ++i){
+            caster->addBody(simBodies[i]->body());
+        }
+        if(!caster->makeReady()){
+            caster.reset();
+        }
+    }
+    return caster;
+}
+
+
+void RayCastRangeSensorSimulatorItemImpl::addTargetSensor(SimulationBody* simBody, RangeSensor* sensor)
+{
+    os << (format(_("%1% detected range sensor \"%2%\" of %3% as a target."))
+           % self->name() % sensor->name() % simBody->body()->name()) << endl;
+
+    sensorInfos.push_back(SensorInfo());
+    SensorInfo& info = sensorInfos.back();
+    info.sensor = sensor;
+    info.simBody = simBody;
+    const double frameRate = std::max(0.1, std::min(sensor->frameRate(), maxFrameRate));
+    info.cycleTime = 1.0 / frameRate;
+    info.elapsedTime = info.cycleTime + 1.0e-6;
+    if(isRangeDataRecordingEnabled){
+        sensor->setRangeDataStateClonable(true);
+    }
+}
+
+
+/**
+   The range data is computed with the link positions after the dynamics of the current step,
+   so the data has no delay. The geometry positions are only updated when any sensor measures.
+*/
+void RayCastRangeSensorSimulatorItemImpl::onPostDynamics()
+{
+    bool isPositionUpdated = false;
+    
+    for(size_t i=0; i < sensorInfos.size(); ++i){
+        SensorInfo& info = sensorInfos[i];
+        if(info.elapsedTime >= info.cycleTime){
+            RangeSensor* sensor = info.sensor;
+            if(sensor->on()){
+                const double beginTime = profiler->begin();
+                if(!isPositionUpdated){
+                    rayCaster->updatePositions();
+                    isPositionUpdated = true;
+                }
+                rayCaster->scan(*sensor, sensor->rangeData());
+                sensor->setDelay(0.0);
+                profiler->end(rayCastingStageId, beginTime);
+                if(isRangeDataRecordingEnabled){
+                    sensor->notifyStateChange();
+                } else {
+                    info.simBody->notifyUnrecordedDeviceStateChange(sensor);
+                }
+            }
+            info.elapsedTime -= info.cycleTime;
+        }
+        info.elapsedTime += worldTimeStep;
+    }
+}
+
+
+void RayCastRangeSensorSimulatorItem::finalizeSimulation()
+{
+    impl->finalizeSimulation();
+}
+
+
+void RayCastRangeSensorSimulatorItemImpl::finalizeSimulation()
+{
+    sensorInfos.clear();
+    rayCaster.reset();
+}
+
+
+void RayCastRangeSensorSimulatorItem::doPutProperties(PutPropertyFunction& putProperty)
+{
+    SubSimulatorItem::doPutProperties(putProperty);
+    impl->doPutProperties(putProperty);
+}
+
+
+void RayCastRangeSensorSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
+{
+    putProperty(_("Target bodies"), bodyNameListString, boost::bind(updateNames, _1, boost::ref(bodyNameListString), boost::ref(bodyNames)));
+    putProperty(_("Target sensors"), sensorNameListString, boost::bind(updateNames, _1, boost::ref(sensorNameListString), boost::ref(sensorNames)));
+    putProperty(_("Max frame rate"), maxFrameRate, changeProperty(maxFrameRate));
+    putProperty(_("Record range data"), isRangeDataRecordingEnabled, changeProperty(isRangeDataRecordingEnabled));
+}
+
+
+bool RayCastRangeSensorSimulatorItem::store(Archive& archive)
+{
+    SubSimulatorItem::store(archive);
+    return impl->store(archive);
+}
+
+
+bool RayCastRangeSensorSimulatorItemImpl::store(Archive& archive)
+{
+    writeElements(archive, "targetBodies", bodyNames, true);
+    writeElements(archive, "targetSensors", sensorNames, true);
+    archive.write("maxFrameRate", maxFrameRate);
+    archive.write("recordRangeData", isRangeDataRecordingEnabled);
+    return true;
+}
+
+
+bool RayCastRangeSensorSimulatorItem::restore(const Archive& archive)
+{
+    SubSimulatorItem::restore(archive);
+    return impl->restore(archive);
+}
+
+
+bool RayCastRangeSensorSimulatorItemImpl::restore(const Archive& archive)
+{
+    readElements(archive, "targetBodies", bodyNames);
+    bodyNameListString = getNameListString(bodyNames);
+    readElements(archive, "targetSensors", sensorNames);
+    sensorNameListString = getNameListString(sensorNames);
+    archive.read("maxFrameRate", maxFrameRate);
+    archive.read("recordRangeData", isRangeDataRecordingEnabled);
+    return true;
+}
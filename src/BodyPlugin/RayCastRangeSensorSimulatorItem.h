@@ -0,0 +1,52 @@
+/*!
+  @file
+  @author Shin'ichiro Nakaoka
+*/
+
+#ifndef CNOID_BODYPLUGIN_RAY_CAST_RANGE_SENSOR_SIMULATOR_ITEM_H
+#define CNOID_BODYPLUGIN_RAY_CAST_RANGE_SENSOR_SIMULATOR_ITEM_H
+
+#include "SubSimulatorItem.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class RayCastRangeSensorSimulatorItemImpl;
+
+/**
+   This item simulates the RangeSensor devices by casting the rays against the collision shapes
+   of the simulated bodies. An OpenGL context is not required, and the cost is proportional to
+   the number of the beams instead of the resolution of the rendered depth image.
+*/
+class CNOID_EXPORT RayCastRangeSensorSimulatorItem : public SubSimulatorItem
+{
+public:
+    static void initializeClass(ExtensionManager* ext);
+        
+    RayCastRangeSensorSimulatorItem();
+    RayCastRangeSensorSimulatorItem(const RayCastRangeSensorSimulatorItem& org);
+    ~RayCastRangeSensorSimulatorItem();
+        
+    void setTargetBodies(const std::string& bodyNames);
+    void setTargetSensors(const std::string& sensorNames);
+    void setMaxFrameRate(double rate);
+    void setRangeDataRecordingEnabled(bool on);
+
+    virtual bool initializeSimulation(SimulatorItem* simulatorItem);
+    virtual void finalizeSimulation();
+
+protected:
+    virtual Item* doDuplicate() const;
+    virtual void doPutProperties(PutPropertyFunction& putProperty);
+    virtual bool store(Archive& archive);
+    virtual bool restore(const Archive& archive);
+
+private:
+    RayCastRangeSensorSimulatorItemImpl* impl;
+};
+
+typedef ref_ptr<RayCastRangeSensorSimulatorItem> RayCastRangeSensorSimulatorItemPtr;
+
+}
+
+#endif
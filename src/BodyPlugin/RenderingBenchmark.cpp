@@ -0,0 +1,811 @@
+/*!
+  @file
+*/
+
+#include "RenderingBenchmark.h"
+#include "SimulatorItem.h"
+#include "GLVisionSimulatorItem.h"
+#include "WorldItem.h"
+#include "BodyItem.h"
+#include "EditableSceneBody.h"
+#include <cnoid/RootItem>
+#include <cnoid/ItemList>
+#include <cnoid/ItemTreeView>
+#include <cnoid/ProjectManager>
+#include <cnoid/SceneProvider>
+#include <cnoid/SceneCameras>
+#include <cnoid/GL1SceneRenderer>
+#include <cnoid/GLSLSceneRenderer>
+#include <cnoid/Camera>
+#include <cnoid/RangeSensor>
+#include <cnoid/Image>
+#include <cnoid/EigenUtil>
+#include <cnoid/Archive>
+#include <cnoid/YAMLReader>
+#include <cnoid/YAMLWriter>
+#include <cnoid/SimulationProfiler>
+#include <cnoid/TimeMeasure>
+#include <cnoid/MessageView>
+#include <cnoid/OptionManager>
+#include <cnoid/ExtensionManager>
+#include <QEventLoop>
+#include <boost/bind.hpp>
+#include <set>
+#include <map>
+#include <algorithm>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#define USE_QT5_OPENGL 1
+#else
+#define USE_QT5_OPENGL 0
+#endif
+
+#if USE_QT5_OPENGL
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+#else
+#include <QGLPixelBuffer>
+#endif
+
+#ifdef CNOID_ENABLE_EGL
+#include <cnoid/EGLOffscreenContext>
+#endif
+
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+namespace {
+
+struct BenchmarkScene
+{
+    string name;
+    string projectFile;
+    double timeLength;
+};
+
+struct VisionConfiguration
+{
+    string name;
+    bool useGLSL;
+    bool useThreadsForSensors;
+    double resolutionScale;
+};
+
+
+/**
+   The GL context with the frame buffer of the image size. The compatibility profile is used
+   for GL1SceneRenderer and the core profile of OpenGL 3.3 is used for GLSLSceneRenderer.
+*/
+class OffscreenContext
+{
+public:
+#if USE_QT5_OPENGL
+    QOpenGLContext* glContext;
+    QOffscreenSurface* offscreenSurface;
+    QOpenGLFramebufferObject* frameBuffer;
+#else
+    QGLPixelBuffer* renderingBuffer;
+#endif
+#ifdef CNOID_ENABLE_EGL
+    EGLOffscreenContext* eglContext;
+    unsigned int eglFrameBuffer;
+#endif
+
+    OffscreenContext() {
+#if USE_QT5_OPENGL
+        glContext = 0;
+        offscreenSurface = 0;
+        frameBuffer = 0;
+#else
+        renderingBuffer = 0;
+#endif
+#ifdef CNOID_ENABLE_EGL
+        eglContext = 0;
+        eglFrameBuffer = 0;
+#endif
+    }
+
+    ~OffscreenContext() {
+        finalize();
+    }
+
+    bool create(bool useCoreProfile, int width, int height);
+    void makeCurrent();
+    void finalize();
+};
+
+
+bool OffscreenContext::create(bool useCoreProfile, int width, int height)
+{
+#ifdef CNOID_ENABLE_EGL
+    eglContext = new EGLOffscreenContext;
+    if(eglContext->create(useCoreProfile)){
+        eglContext->makeCurrent();
+        eglFrameBuffer = eglContext->createFrameBuffer(width, height);
+        if(eglFrameBuffer){
+            return true;
+        }
+    }
+    delete eglContext;
+    eglContext = 0;
+#endif
+
+#if USE_QT5_OPENGL
+    glContext = new QOpenGLContext;
+    QSurfaceFormat format;
+    format.setSwapBehavior(QSurfaceFormat::SingleBuffer);
+    if(useCoreProfile){
+        format.setProfile(QSurfaceFormat::CoreProfile);
+        format.setVersion(3, 3);
+    }
+    glContext->setFormat(format);
+    if(!glContext->create()){
+        delete glContext;
+        glContext = 0;
+        return false;
+    }
+    offscreenSurface = new QOffscreenSurface;
+    offscreenSurface->setFormat(format);
+    offscreenSurface->create();
+    glContext->makeCurrent(offscreenSurface);
+    frameBuffer = new QOpenGLFramebufferObject(width, height, QOpenGLFramebufferObject::CombinedDepthStencil);
+    frameBuffer->bind();
+#else
+    QGLFormat format;
+    format.setDoubleBuffer(false);
+    if(useCoreProfile){
+        format.setProfile(QGLFormat::CoreProfile);
+        format.setVersion(3, 3);
+    }
+    renderingBuffer = new QGLPixelBuffer(width, height, format);
+    renderingBuffer->makeCurrent();
+#endif
+
+    return true;
+}
+
+
+void OffscreenContext::makeCurrent()
+{
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->makeCurrent();
+        eglContext->bindFrameBuffer(eglFrameBuffer);
+        return;
+    }
+#endif
+#if USE_QT5_OPENGL
+    glContext->makeCurrent(offscreenSurface);
+    frameBuffer->bind();
+#else
+    renderingBuffer->makeCurrent();
+#endif
+}
+
+
+//! The renderer must be deleted before this function is called
+void OffscreenContext::finalize()
+{
+#ifdef CNOID_ENABLE_EGL
+    if(eglContext){
+        eglContext->makeCurrent();
+        eglContext->deleteFrameBuffer(eglFrameBuffer);
+        eglContext->doneCurrent();
+        delete eglContext;
+        eglContext = 0;
+    }
+#endif
+#if USE_QT5_OPENGL
+    if(glContext){
+        glContext->makeCurrent(offscreenSurface);
+        delete frameBuffer;
+        frameBuffer = 0;
+        glContext->doneCurrent();
+        delete glContext;
+        glContext = 0;
+        delete offscreenSurface;
+        offscreenSurface = 0;
+    }
+#else
+    if(renderingBuffer){
+        renderingBuffer->doneCurrent();
+        delete renderingBuffer;
+        renderingBuffer = 0;
+    }
+#endif
+}
+
+
+double getPercentile(vector<double>& times, double ratio)
+{
+    const size_t index = std::min(times.size() - 1, (size_t)(ratio * (times.size() - 1) + 0.5));
+    std::nth_element(times.begin(), times.begin() + index, times.end());
+    return times[index];
+}
+
+
+//! The times are written in milliseconds
+void putTimes(Mapping* result, const string& key, vector<double>& times)
+{
+    if(times.empty()){
+        return;
+    }
+    double total = 0.0;
+    for(size_t i=0; i < times.size(); ++i){
+        total += times[i];
+    }
+    Mapping* info = result->createFlowStyleMapping(key);
+    info->write("mean", total / times.size() * 1.0e3);
+    info->write("p50", getPercentile(times, 0.5) * 1.0e3);
+    info->write("p90", getPercentile(times, 0.9) * 1.0e3);
+    info->write("p99", getPercentile(times, 0.99) * 1.0e3);
+    info->write("max", *std::max_element(times.begin(), times.end()) * 1.0e3);
+}
+
+
+void onSigOptionsParsed(boost::program_options::variables_map& v)
+{
+    if(v.count("rendering-benchmark")){
+        RenderingBenchmark benchmark;
+        if(benchmark.load(v["rendering-benchmark"].as<string>())){
+            if(v.count("rendering-benchmark-output")){
+                benchmark.setOutputFile(v["rendering-benchmark-output"].as<string>());
+            }
+            benchmark.run();
+        }
+    }
+}
+
+}
+
+namespace cnoid {
+
+class RenderingBenchmarkImpl
+{
+public:
+    MessageView* mv;
+    int numFrames;
+    int width;
+    int height;
+    vector<BenchmarkScene> scenes;
+    vector<BenchmarkScene> visionScenes;
+    vector<VisionConfiguration> visionConfigurations;
+    ArchivePtr pathArchive;
+    string outputFile;
+    MappingPtr results;
+
+    RenderingBenchmarkImpl();
+    bool load(const string& filename);
+    void readScenes(const Mapping& benchmark, const char* key, vector<BenchmarkScene>& out_scenes);
+    bool run();
+    WorldItem* loadProject(const string& projectFile, ItemList<>& out_sceneItems);
+    void renderScene(const BenchmarkScene& scene, Mapping* result);
+    void renderSceneWithRenderer(const vector<SgNodePtr>& nodes, bool useGLSL, Mapping* result);
+    void runVisionScene(const BenchmarkScene& scene, Mapping* result);
+    void runVisionSimulation(
+        const BenchmarkScene& scene, WorldItem* worldItem, SimulatorItem* simulatorItem,
+        const VisionConfiguration& config, Mapping* result);
+    void putVisionStageTimes(SimulationProfiler* profiler, Mapping* result);
+};
+
+}
+
+
+void RenderingBenchmark::initialize(ExtensionManager* ext)
+{
+    ext->optionManager()
+        .addOption("rendering-benchmark", boost::program_options::value<string>(),
+                   "measure the renderers and the vision sensor simulation with the scenes given by a benchmark file")
+        .addOption("rendering-benchmark-output", boost::program_options::value<string>(),
+                   "the file to which the results of the rendering benchmark are written")
+        .sigOptionsParsed().connect(onSigOptionsParsed);
+}
+
+
+RenderingBenchmark::RenderingBenchmark()
+{
+    impl = new RenderingBenchmarkImpl();
+}
+
+
+RenderingBenchmarkImpl::RenderingBenchmarkImpl()
+{
+    mv = MessageView::mainInstance();
+    numFrames = 300;
+    width = 1280;
+    height = 720;
+    outputFile = "rendering-benchmark.yaml";
+}
+
+
+RenderingBenchmark::~RenderingBenchmark()
+{
+    delete impl;
+}
+
+
+void RenderingBenchmark::setOutputFile(const std::string& filename)
+{
+    impl->outputFile = filename;
+}
+
+
+bool RenderingBenchmark::load(const std::string& filename)
+{
+    return impl->load(filename);
+}
+
+
+bool RenderingBenchmarkImpl::load(const string& filename)
+{
+    scenes.clear();
+    visionScenes.clear();
+    visionConfigurations.clear();
+
+    pathArchive = new Archive();
+    pathArchive->initSharedInfo(filename);
+
+    try {
+        YAMLReader reader;
+        if(!reader.load(filename)){
+            mv->putln(MessageView::ERROR,
+                      format(_("The benchmark file \"%1%\" cannot be loaded: %2%")) % filename % reader.errorMessage());
+            return false;
+        }
+        const Mapping& benchmark = *reader.document()->toMapping();
+        benchmark.read("numFrames", numFrames);
+        numFrames = std::max(numFrames, 2);
+
+        const Listing& size = *benchmark.findListing("imageSize");
+        if(size.isValid() && size.size() == 2){
+            width = size[0].toInt();
+            height = size[1].toInt();
+        }
+
+        readScenes(benchmark, "scenes", scenes);
+        readScenes(benchmark, "visionScenes", visionScenes);
+
+        const Listing& configList = *benchmark.findListing("visionConfigurations");
+        if(configList.isValid()){
+            for(int i=0; i < configList.size(); ++i){
+                const Mapping& info = *configList[i].toMapping();
+                visionConfigurations.push_back(VisionConfiguration());
+                VisionConfiguration& config = visionConfigurations.back();
+                if(!info.read("name", config.name)){
+                    config.name = str(format("configuration%1%") % i);
+                }
+                config.useGLSL = (info.get("renderer", "GLSL") == "GLSL");
+                config.useThreadsForSensors = info.get("dedicatedSensorThreads", true);
+                config.resolutionScale = info.get("resolutionScale", 1.0);
+            }
+        } else {
+            visionConfigurations.push_back(VisionConfiguration());
+            VisionConfiguration& config = visionConfigurations.back();
+            config.name = "default";
+            config.useGLSL = true;
+            config.useThreadsForSensors = true;
+            config.resolutionScale = 1.0;
+        }
+    } catch(const ValueNode::Exception& ex){
+        mv->putln(MessageView::ERROR, format(_("The benchmark file \"%1%\" is invalid: %2%")) % filename % ex.message());
+        scenes.clear();
+        visionScenes.clear();
+        return false;
+    }
+
+    if(scenes.empty() && visionScenes.empty()){
+        mv->putln(MessageView::WARNING, format(_("The benchmark file \"%1%\" has no scenes.")) % filename);
+        return false;
+    }
+    return true;
+}
+
+
+void RenderingBenchmarkImpl::readScenes(const Mapping& benchmark, const char* key, vector<BenchmarkScene>& out_scenes)
+{
+    const Listing& sceneList = *benchmark.findListing(key);
+    if(sceneList.isValid()){
+        for(int i=0; i < sceneList.size(); ++i){
+            const Mapping& info = *sceneList[i].toMapping();
+            out_scenes.push_back(BenchmarkScene());
+            BenchmarkScene& scene = out_scenes.back();
+            if(!info.read("name", scene.name)){
+                scene.name = str(format("scene%1%") % i);
+            }
+            scene.projectFile = pathArchive->resolveRelocatablePath(info.get("project", ""));
+            scene.timeLength = info.get("timeLength", 3.0);
+        }
+    }
+}
+
+
+bool RenderingBenchmark::run()
+{
+    return impl->run();
+}
+
+
+bool RenderingBenchmarkImpl::run()
+{
+    results = new Mapping();
+    results->write("numFrames", numFrames);
+    Listing& imageSize = *results->createFlowStyleListing("imageSize");
+    imageSize.append(width);
+    imageSize.append(height);
+
+    TimeMeasure timer;
+    timer.begin();
+
+    if(!scenes.empty()){
+        Listing& sceneResults = *results->createListing("scenes");
+        for(size_t i=0; i < scenes.size(); ++i){
+            Mapping* result = sceneResults.newMapping();
+            result->write("scene", scenes[i].name);
+            renderScene(scenes[i], result);
+        }
+    }
+    if(!visionScenes.empty()){
+        Listing& visionResults = *results->createListing("visionScenes");
+        for(size_t i=0; i < visionScenes.size(); ++i){
+            Mapping* result = visionResults.newMapping();
+            result->write("scene", visionScenes[i].name);
+            runVisionScene(visionScenes[i], result);
+        }
+    }
+
+    timer.end();
+    results->write("computationTime", timer.time());
+
+    YAMLWriter writer(outputFile);
+    writer.setKeyOrderPreservationMode(true);
+    writer.putNode(results.get());
+
+    mv->putln(format(_("The rendering benchmark has been finished in %1% [s]. The results are written to \"%2%\"."))
+              % timer.time() % outputFile);
+
+    return true;
+}
+
+
+WorldItem* RenderingBenchmarkImpl::loadProject(const string& projectFile, ItemList<>& out_sceneItems)
+{
+    RootItem* rootItem = RootItem::instance();
+    set<Item*> existingItems;
+    for(Item* item = rootItem->childItem(); item; item = item->nextItem()){
+        existingItems.insert(item);
+    }
+
+    ProjectManager::instance()->loadProject(projectFile);
+
+    WorldItem* worldItem = 0;
+    for(Item* item = rootItem->childItem(); item; item = item->nextItem()){
+        if(existingItems.find(item) == existingItems.end()){
+            out_sceneItems.push_back(item);
+            if(!worldItem){
+                worldItem = dynamic_cast<WorldItem*>(item);
+            }
+        }
+    }
+    return worldItem;
+}
+
+
+/**
+   The scene consists of the scene bodies of the body items and the scenes of the other
+   scene provider items checked in the item tree view as in BatchVideoRenderer.
+*/
+void RenderingBenchmarkImpl::renderScene(const BenchmarkScene& scene, Mapping* result)
+{
+    ItemList<> sceneItems;
+    loadProject(scene.projectFile, sceneItems);
+    if(sceneItems.empty()){
+        mv->putln(MessageView::ERROR, format(_("Benchmark scene \"%1%\" cannot be created.")) % scene.name);
+        result->write("available", false);
+        return;
+    }
+
+    vector<SgNodePtr> nodes;
+    ItemTreeView* itemTreeView = ItemTreeView::instance();
+    for(size_t i=0; i < sceneItems.size(); ++i){
+        ItemList<> items;
+        items.extractChildItems(sceneItems[i]);
+        items.push_back(sceneItems[i]);
+        for(size_t j=0; j < items.size(); ++j){
+            Item* item = items.get(j);
+            if(BodyItem* bodyItem = dynamic_cast<BodyItem*>(item)){
+                nodes.push_back(bodyItem->sceneBody());
+            } else if(SceneProvider* provider = dynamic_cast<SceneProvider*>(item)){
+                if(itemTreeView && itemTreeView->isItemChecked(item)){
+                    SgNode* node = provider->getScene();
+                    if(node){
+                        nodes.push_back(node);
+                    }
+                }
+            }
+        }
+    }
+
+    mv->putln(format(_("Rendering benchmark scene \"%1%\" ...")) % scene.name);
+    mv->flush();
+
+    renderSceneWithRenderer(nodes, false, result->createMapping("GL1SceneRenderer"));
+    renderSceneWithRenderer(nodes, true, result->createMapping("GLSLSceneRenderer"));
+
+    for(size_t i=0; i < sceneItems.size(); ++i){
+        sceneItems[i]->detachFromParentItem();
+    }
+}
+
+
+void RenderingBenchmarkImpl::renderSceneWithRenderer(const vector<SgNodePtr>& nodes, bool useGLSL, Mapping* result)
+{
+    OffscreenContext context;
+    if(!context.create(useGLSL, width, height)){
+        result->write("available", false);
+        mv->putln(MessageView::ERROR, _("The OpenGL context for the rendering benchmark cannot be created."));
+        return;
+    }
+    GLSceneRenderer* renderer;
+    if(useGLSL){
+        renderer = new GLSLSceneRenderer;
+    } else {
+        renderer = new GL1SceneRenderer;
+    }
+    if(!renderer->initializeGL()){
+        result->write("available", false);
+        delete renderer;
+        return;
+    }
+    result->write("available", true);
+
+    SgGroup* sceneRoot = renderer->sceneRoot();
+    for(size_t i=0; i < nodes.size(); ++i){
+        sceneRoot->addChild(nodes[i]);
+    }
+    Vector3 center = Vector3::Zero();
+    double radius = 1.0;
+    const BoundingBox& bbox = renderer->scene()->boundingBox();
+    if(!bbox.empty()){
+        center = bbox.center();
+        radius = bbox.boundingSphereRadius();
+    }
+    SgPerspectiveCameraPtr camera = new SgPerspectiveCamera;
+    const double fovy = SgPerspectiveCamera::fovy(static_cast<double>(width) / height, camera->fieldOfView());
+    const double distance = radius / sin(std::min(fovy, camera->fieldOfView()) / 2.0);
+    camera->setNearDistance(std::max(0.001, distance * 0.01));
+    camera->setFarDistance(std::max(100.0, distance * 10.0));
+    SgPosTransformPtr cameraTransform = new SgPosTransform;
+    cameraTransform->addChild(camera);
+    sceneRoot->addChild(cameraTransform);
+
+    renderer->setViewport(0, 0, width, height);
+    renderer->extractPreprocessedNodes();
+    renderer->setCurrentCamera(camera);
+    const bool isGPUTimerAvailable = renderer->enableGPUTimer(true);
+
+    vector<double> cpuTimes;
+    vector<double> gpuTimes;
+    vector<double> readbackTimes;
+    double firstFrameTime = 0.0;
+    int maxNumDrawCalls = 0;
+    double totalNumDrawCalls = 0.0;
+    TimeMeasure timer;
+    Image image;
+
+    // The camera moves along an orbit around the scene, which is elevated by 30 degrees
+    const double elevation = radian(30.0);
+    for(int frame = 0; frame < numFrames; ++frame){
+        const double angle = 2.0 * PI * frame / numFrames;
+        const Vector3 eye =
+            center + distance * Vector3(cos(angle) * cos(elevation), sin(angle) * cos(elevation), sin(elevation));
+        cameraTransform->setPosition(SgCamera::positionLookingAt(eye, center, Vector3::UnitZ()));
+
+        timer.begin();
+        renderer->render();
+        renderer->flush();
+        timer.end();
+        const double cpuTime = timer.time();
+
+        timer.begin();
+        if(renderer->startImageReading()){
+            renderer->takeReadImage(image);
+        }
+        timer.end();
+
+        if(frame == 0){
+            firstFrameTime = cpuTime + timer.time();
+            continue;
+        }
+        cpuTimes.push_back(cpuTime);
+        readbackTimes.push_back(timer.time());
+        const int numDrawCalls = renderer->numDrawCalls();
+        maxNumDrawCalls = std::max(maxNumDrawCalls, numDrawCalls);
+        totalNumDrawCalls += numDrawCalls;
+
+        // The result of the first frame is obtained in the second frame
+        if(frame >= 2){
+            const double gpuTime = renderer->gpuTime();
+            if(gpuTime >= 0.0){
+                gpuTimes.push_back(gpuTime);
+            }
+        }
+    }
+
+    result->write("firstFrameTime", firstFrameTime * 1.0e3);
+    putTimes(result, "cpuTime", cpuTimes);
+    if(isGPUTimerAvailable){
+        putTimes(result, "gpuTime", gpuTimes);
+    }
+    putTimes(result, "readbackTime", readbackTimes);
+    Mapping* drawCalls = result->createFlowStyleMapping("drawCalls");
+    drawCalls->write("mean", totalNumDrawCalls / (numFrames - 1));
+    drawCalls->write("max", maxNumDrawCalls);
+
+    context.makeCurrent();
+    sceneRoot->clearChildren();
+    delete renderer;
+    context.finalize();
+}
+
+
+void RenderingBenchmarkImpl::runVisionScene(const BenchmarkScene& scene, Mapping* result)
+{
+    ItemList<> sceneItems;
+    WorldItem* worldItem = loadProject(scene.projectFile, sceneItems);
+    ItemList<SimulatorItem> simulatorItems;
+    if(worldItem){
+        simulatorItems.extractChildItems(worldItem);
+    }
+    if(simulatorItems.empty()){
+        mv->putln(MessageView::ERROR, format(_("Benchmark scene \"%1%\" has no simulator item.")) % scene.name);
+        result->write("available", false);
+    } else {
+        Listing& runs = *result->createListing("runs");
+        for(size_t i=0; i < visionConfigurations.size(); ++i){
+            const VisionConfiguration& config = visionConfigurations[i];
+            Mapping* run = runs.newMapping();
+            run->write("configuration", config.name);
+            mv->putln(format(_("Benchmark scene \"%1%\" with vision configuration \"%2%\" ...")) % scene.name % config.name);
+            mv->flush();
+            runVisionSimulation(scene, worldItem, simulatorItems[0], config, run);
+        }
+    }
+    for(size_t i=0; i < sceneItems.size(); ++i){
+        sceneItems[i]->detachFromParentItem();
+    }
+}
+
+
+void RenderingBenchmarkImpl::runVisionSimulation
+(const BenchmarkScene& scene, WorldItem* worldItem, SimulatorItem* simulatorItem,
+ const VisionConfiguration& config, Mapping* result)
+{
+    ItemList<GLVisionSimulatorItem> visionItems;
+    visionItems.extractChildItems(simulatorItem);
+    for(size_t i=0; i < visionItems.size(); ++i){
+        visionItems[i]->setGLSLRendererEnabled(config.useGLSL);
+        visionItems[i]->setDedicatedSensorThreadsEnabled(config.useThreadsForSensors);
+    }
+
+    // The resolutions are restored after the simulation
+    vector<CameraPtr> cameras;
+    vector<Vector2i> cameraResolutions;
+    vector<RangeSensorPtr> rangeSensors;
+    vector<Vector2i> rangeSensorResolutions;
+    ItemList<BodyItem> bodyItems;
+    bodyItems.extractChildItems(worldItem);
+    for(size_t i=0; i < bodyItems.size(); ++i){
+        Body* body = bodyItems[i]->body();
+        DeviceList<Camera> bodyCameras(body->devices());
+        for(size_t j=0; j < bodyCameras.size(); ++j){
+            Camera* camera = bodyCameras[j];
+            cameras.push_back(camera);
+            cameraResolutions.push_back(Vector2i(camera->resolutionX(), camera->resolutionY()));
+            camera->setResolution(
+                std::max(1, (int)(camera->resolutionX() * config.resolutionScale)),
+                std::max(1, (int)(camera->resolutionY() * config.resolutionScale)));
+        }
+        DeviceList<RangeSensor> bodyRangeSensors(body->devices());
+        for(size_t j=0; j < bodyRangeSensors.size(); ++j){
+            RangeSensor* sensor = bodyRangeSensors[j];
+            rangeSensors.push_back(sensor);
+            rangeSensorResolutions.push_back(Vector2i(sensor->yawResolution(), sensor->pitchResolution()));
+            sensor->setYawResolution(std::max(1, (int)(sensor->yawResolution() * config.resolutionScale)));
+            sensor->setPitchResolution(std::max(1, (int)(sensor->pitchResolution() * config.resolutionScale)));
+        }
+    }
+
+    // The properties are set through the archive because the time length has no setter
+    Item* item = simulatorItem;
+    ArchivePtr archive = new Archive();
+    archive->initSharedInfo();
+    item->store(*archive);
+    archive->write("realtimeSync", false);
+    archive->write("recording", "off");
+    archive->write("timeRangeMode", "Specified time");
+    archive->write("timeLength", scene.timeLength);
+    archive->write("stepProfiling", true);
+    archive->write("profileOutputFile", "");
+    item->restore(*archive);
+
+    TimeMeasure timer;
+    QEventLoop eventLoop;
+    Connection connection =
+        simulatorItem->sigSimulationFinished().connect(boost::bind(&QEventLoop::quit, &eventLoop));
+    timer.begin();
+    const bool isSucceeded = simulatorItem->startSimulation(true);
+    if(isSucceeded){
+        eventLoop.exec();
+    }
+    timer.end();
+    connection.disconnect();
+
+    result->write("succeeded", isSucceeded);
+    if(isSucceeded){
+        result->write("numSteps", simulatorItem->simulationFrame());
+        result->write("computationTime", timer.time());
+        putVisionStageTimes(simulatorItem->profiler(), result);
+    }
+
+    for(size_t i=0; i < cameras.size(); ++i){
+        cameras[i]->setResolution(cameraResolutions[i][0], cameraResolutions[i][1]);
+    }
+    for(size_t i=0; i < rangeSensors.size(); ++i){
+        rangeSensors[i]->setYawResolution(rangeSensorResolutions[i][0]);
+        rangeSensors[i]->setPitchResolution(rangeSensorResolutions[i][1]);
+    }
+}
+
+
+/**
+   The stages of the sensors are named "Vision <stage> (<body>/<sensor>)" by GLVisionSimulatorItem.
+   The times of each rendering of the sensors are written instead of the times per frame.
+*/
+void RenderingBenchmarkImpl::putVisionStageTimes(SimulationProfiler* profiler, Mapping* result)
+{
+    static const char* stages[][2] = {
+        { "rendering", "renderingTime" },
+        { "GPU", "gpuTime" },
+        { "readback", "readbackTime" },
+        { "point conversion", "pointConversionTime" }
+    };
+    const int numStageTypes = sizeof(stages) / sizeof(stages[0]);
+
+    map<string, MappingPtr> sensorResults;
+    vector<double> durations;
+    for(int i=0; i < profiler->numStages(); ++i){
+        const string& name = profiler->stageName(i);
+        const size_t pos = name.find(" (");
+        if(name.compare(0, 7, "Vision ") != 0 || pos == string::npos || name[name.size() - 1] != ')'){
+            continue;
+        }
+        const string stage = name.substr(7, pos - 7);
+        const string sensor = name.substr(pos + 2, name.size() - pos - 3);
+        for(int j=0; j < numStageTypes; ++j){
+            if(stage == stages[j][0]){
+                profiler->getEventDurations(i, durations);
+                if(!durations.empty()){
+                    MappingPtr& sensorResult = sensorResults[sensor];
+                    if(!sensorResult){
+                        sensorResult = new Mapping();
+                    }
+                    if(j == 0){
+                        sensorResult->write("numRenderings", (int)durations.size());
+                    }
+                    putTimes(sensorResult.get(), stages[j][1], durations);
+                }
+            }
+        }
+    }
+
+    Listing& sensors = *result->createListing("sensors");
+    for(map<string, MappingPtr>::iterator p = sensorResults.begin(); p != sensorResults.end(); ++p){
+        Mapping* info = sensors.newMapping();
+        info->write("sensor", p->first);
+        info->insert(p->second.get());
+    }
+}
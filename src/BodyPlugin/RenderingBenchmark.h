@@ -0,0 +1,72 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_RENDERING_BENCHMARK_H
+#define CNOID_BODYPLUGIN_RENDERING_BENCHMARK_H
+
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ExtensionManager;
+class RenderingBenchmarkImpl;
+
+/**
+   This class measures the offscreen rendering of GL1SceneRenderer and GLSLSceneRenderer and
+   the vision sensor simulation of GLVisionSimulatorItem, and writes the results to a YAML file.
+   The benchmark file is a YAML file as follows:
+
+   \verbatim
+   numFrames: 300
+   imageSize: [ 1280, 720 ]
+   scenes:               # Rendered by each renderer along an orbit around the scene
+     - { name: SR1Walk, project: "${SHARE}/project/SR1Walk.cnoid" }
+   visionScenes:         # Simulated with each of the vision configurations
+     - { name: Tank, project: "${SHARE}/project/TankJoystickVisionSensors.cnoid", timeLength: 3.0 }
+   visionConfigurations:
+     - { name: queueThread, renderer: GLSL, dedicatedSensorThreads: false }
+     - { name: sensorThreads, renderer: GLSL, dedicatedSensorThreads: true }
+     - { name: halfResolution, renderer: GLSL, dedicatedSensorThreads: true, resolutionScale: 0.5 }
+   \endverbatim
+
+   For each frame of the scenes, the CPU time of render(), the GPU time given by the timer
+   queries, the number of the draw calls and the time of reading back the image are measured.
+   The readback time includes the time of waiting for the GPU to finish the rendering.
+   The first frame, in which the GL resources are created, is reported separately.
+
+   The vision scenes are the projects which have a simulator item with GLVisionSimulatorItem.
+   The resolutions of the cameras and the range sensors are scaled by "resolutionScale".
+   The rendering, GPU, readback and point conversion times of each sensor are obtained from
+   the stages recorded by the profiler of the simulator item. The readback time includes the
+   point conversion time.
+
+   The benchmark can be executed from the command line with the following options:
+   --rendering-benchmark <file> [--rendering-benchmark-output <file>] [--quit]
+*/
+class CNOID_EXPORT RenderingBenchmark
+{
+public:
+    static void initialize(ExtensionManager* ext);
+
+    RenderingBenchmark();
+    ~RenderingBenchmark();
+
+    bool load(const std::string& filename);
+
+    //! The default file is "rendering-benchmark.yaml" in the current directory
+    void setOutputFile(const std::string& filename);
+
+    bool run();
+
+private:
+    RenderingBenchmarkImpl* impl;
+
+    RenderingBenchmark(const RenderingBenchmark& org);
+    RenderingBenchmark& operator=(const RenderingBenchmark& rhs);
+};
+
+}
+
+#endif
@@ -11,7 +11,9 @@
 #include <cnoid/SceneDrawables>
 #include <cnoid/MeshGenerator>
 #include <cnoid/ConnectionSet>
+#include <cnoid/LazyCaller>
 #include <boost/bind.hpp>
+#include <boost/dynamic_bitset.hpp>
 #include <iostream>
 #include "gettext.h"
 
@@ -24,7 +26,6 @@ namespace {
 class Arrow : public SgPosTransform
 {
 public:
-    SgUpdate update;
     SgPosTransformPtr cylinderPosition;
     SgScaleTransformPtr cylinderScale;
     SgShapePtr cylinder;
@@ -46,6 +47,7 @@ public:
         addChild(conePosition);
     }
 
+    //! The update is not notified here so that the updates of all the arrows are notified together
     void setVector(const Vector3& v) {
         double len = v.norm();
         cylinderScale->setScale(Vector3(1.0, len, 1.0));
@@ -56,7 +58,10 @@ public:
         double angle = acos(Vector3::UnitY().dot(v) / len);
         setRotation(AngleAxis(angle, axis));
 
-        notifyUpdate(update);
+        cylinderScale->invalidateBoundingBox();
+        cylinderPosition->invalidateBoundingBox();
+        conePosition->invalidateBoundingBox();
+        invalidateBoundingBox();
     }
 };
 
@@ -79,12 +84,22 @@ public:
     double visualRatio;
     ScopedConnectionSet connections;
 
+    /*
+      The sensor states may be changed much more frequently than the scene is rendered,
+      so the arrows are updated in a lazy call and their update is notified at once.
+    */
+    boost::dynamic_bitset<> forceSensorStateChangeFlags;
+    bool areSensorPositionsChanged;
+    LazyCaller updateSceneLater;
+    SgUpdate update;
+
     SensorVisualizerItemImpl(SensorVisualizerItem* self);
     void onPositionChanged();
     void onSensorPositionsChanged();
     void updateSensorState();
     void updateForceSensorState(int index);
     void onForceSensorStateChanged(int index);
+    void updateScene();
     bool onLengthRatioPropertyChanged(double ratio);
 };
 
@@ -127,6 +142,11 @@ SensorVisualizerItemImpl::SensorVisualizerItemImpl(SensorVisualizerItem* self)
     cylinder->setMaterial(material);
 
     visualRatio = 0.002;
+
+    bodyItem = 0;
+    areSensorPositionsChanged = false;
+    updateSceneLater.setFunction(boost::bind(&SensorVisualizerItemImpl::updateScene, this));
+    updateSceneLater.setPriority(LazyCaller::PRIORITY_NORMAL);
 }
 
 
@@ -167,7 +187,9 @@ void SensorVisualizerItemImpl::onPositionChanged()
     if(newBodyItem != bodyItem){
         bodyItem = newBodyItem;
         connections.disconnect();
+        updateSceneLater.cancel();
         forceSensors.clear();
+        forceSensorStateChangeFlags.clear();
         if(bodyItem){
             Body* body = bodyItem->body();
 
@@ -178,15 +200,17 @@ void SensorVisualizerItemImpl::onPositionChanged()
             scene->clearChildren();
             forceSensorArrows.clear();
             forceSensors << body->devices();
+            forceSensorStateChangeFlags.resize(forceSensors.size());
             for(size_t i=0; i < forceSensors.size(); ++i){
                 ArrowPtr arrow = new Arrow(cylinder, cone);
                 forceSensorArrows.push_back(arrow);
                 scene->addChild(arrow);
                 connections.add(
                     forceSensors[i]->sigStateChanged().connect(
-                        boost::bind(&SensorVisualizerItemImpl::updateForceSensorState, this, i)));
-                updateForceSensorState(i);
+                        boost::bind(&SensorVisualizerItemImpl::onForceSensorStateChanged, this, i)));
             }
+            areSensorPositionsChanged = true;
+            updateSensorState();
         }
     }
 }
@@ -194,19 +218,44 @@ void SensorVisualizerItemImpl::onPositionChanged()
 
 void SensorVisualizerItemImpl::onSensorPositionsChanged()
 {
-    for(size_t i=0; i < forceSensors.size(); ++i){
-        ForceSensor* sensor = forceSensors[i];
-        Vector3 p = sensor->link()->T() * sensor->localTranslation();
-        forceSensorArrows[i]->setTranslation(p);
-    }
+    areSensorPositionsChanged = true;
+    updateSceneLater();
+}
+
+
+void SensorVisualizerItemImpl::onForceSensorStateChanged(int index)
+{
+    forceSensorStateChangeFlags.set(index);
+    updateSceneLater();
 }
 
 
 void SensorVisualizerItemImpl::updateSensorState()
 {
-    for(size_t i=0; i < forceSensors.size(); ++i){
+    forceSensorStateChangeFlags.set();
+    updateSceneLater();
+}
+
+
+void SensorVisualizerItemImpl::updateScene()
+{
+    if(areSensorPositionsChanged){
+        for(size_t i=0; i < forceSensors.size(); ++i){
+            ForceSensor* sensor = forceSensors[i];
+            Arrow* arrow = forceSensorArrows[i];
+            arrow->setTranslation(sensor->link()->T() * sensor->localTranslation());
+            arrow->invalidateBoundingBox();
+        }
+        areSensorPositionsChanged = false;
+    }
+    boost::dynamic_bitset<>::size_type i = forceSensorStateChangeFlags.find_first();
+    while(i != forceSensorStateChangeFlags.npos){
         updateForceSensorState(i);
+        i = forceSensorStateChangeFlags.find_next(i);
     }
+    forceSensorStateChangeFlags.reset();
+
+    scene->notifyUpdate(update);
 }
 
     
@@ -0,0 +1,675 @@
+/*!
+  @file
+*/
+
+#include "SimulationBenchmark.h"
+#include "SimulatorItem.h"
+#include "SubSimulatorItem.h"
+#include "CollisionSeqItem.h"
+#include "BodyMotionItem.h"
+#include "WorldItem.h"
+#include "BodyItem.h"
+#include <cnoid/RootItem>
+#include <cnoid/ItemList>
+#include <cnoid/ItemManager>
+#include <cnoid/ProjectManager>
+#include <cnoid/Archive>
+#include <cnoid/YAMLReader>
+#include <cnoid/YAMLWriter>
+#include <cnoid/SimulationProfiler>
+#include <cnoid/CollisionDetectorBenchmark>
+#include <cnoid/ExecutablePath>
+#include <cnoid/TimeMeasure>
+#include <cnoid/MessageView>
+#include <cnoid/OptionManager>
+#include <cnoid/ExtensionManager>
+#include <QEventLoop>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <set>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+const double G = 9.80665;
+
+const char* defaultSimulators[] = {
+    "Body/AISTSimulatorItem",
+    "ODE/ODESimulatorItem",
+    "Bullet/BulletSimulatorItem",
+    "PhysX/PhysXSimulatorItem",
+    "AgX/AgXSimulatorItem",
+    "Roki/RokiSimulatorItem"
+};
+
+struct BenchmarkScene
+{
+    string name;
+    string type;
+    string projectFile;
+    int numObjects;
+};
+
+struct BenchmarkRun
+{
+    int sceneIndex;
+    string simulator;
+    MappingPtr result;
+    bool isSucceeded;
+};
+
+double calcMechanicalEnergy(const vector<Body*>& bodies)
+{
+    double energy = 0.0;
+    for(size_t i=0; i < bodies.size(); ++i){
+        Body* body = bodies[i];
+        for(int j=0; j < body->numLinks(); ++j){
+            Link* link = body->link(j);
+            const double m = link->m();
+            if(m <= 0.0){
+                continue;
+            }
+            const Vector3 c = link->R() * link->c();
+            const Vector3 vc = link->v() + link->w().cross(c);
+            const Matrix3 I = link->R() * link->I() * link->R().transpose();
+            energy += m * G * (link->p().z() + c.z());
+            energy += 0.5 * m * vc.squaredNorm() + 0.5 * link->w().dot(I * link->w());
+        }
+    }
+    return energy;
+}
+
+
+/**
+   This item is temporarily added to the simulator item of a run to record the energy
+   of the bodies after each step.
+*/
+class EnergyMonitorItem : public SubSimulatorItem
+{
+public:
+    vector<Body*> bodies;
+    double initialEnergy;
+    double finalEnergy;
+    double maxEnergyGain;
+
+    EnergyMonitorItem() {
+        setName("BenchmarkEnergyMonitor");
+        setTemporal();
+        initialEnergy = 0.0;
+        finalEnergy = 0.0;
+        maxEnergyGain = 0.0;
+    }
+
+    virtual bool initializeSimulation(SimulatorItem* simulatorItem) {
+        bodies.clear();
+        const vector<SimulationBody*>& simBodies = simulatorItem->simulationBodies();
+        for(size_t i=0; i < simBodies.size(); ++i){
+            Body* body = simBodies[i]->body();
+            if(body && !body->isStaticModel()){
+                bodies.push_back(body);
+            }
+        }
+        initialEnergy = calcMechanicalEnergy(bodies);
+        finalEnergy = initialEnergy;
+        maxEnergyGain = 0.0;
+        simulatorItem->addPostDynamicsFunction(boost::bind(&EnergyMonitorItem::onPostDynamics, this));
+        return true;
+    }
+
+    //! Called from the simulation thread
+    void onPostDynamics() {
+        finalEnergy = calcMechanicalEnergy(bodies);
+        maxEnergyGain = std::max(maxEnergyGain, finalEnergy - initialEnergy);
+    }
+
+protected:
+    virtual Item* doDuplicate() const {
+        return new EnergyMonitorItem;
+    }
+};
+
+typedef ref_ptr<EnergyMonitorItem> EnergyMonitorItemPtr;
+
+
+void onSigOptionsParsed(boost::program_options::variables_map& v)
+{
+    if(v.count("benchmark")){
+        SimulationBenchmark benchmark;
+        if(benchmark.load(v["benchmark"].as<string>())){
+            if(v.count("benchmark-output")){
+                benchmark.setOutputFile(v["benchmark-output"].as<string>());
+            }
+            benchmark.run();
+        }
+    }
+
+    if(v.count("collision-benchmark")){
+        // The detectors of all the loaded plugins are measured with the powers of two threads
+        vector<int> threadCounts;
+        const int maxNumThreads = std::max(1, (int)boost::thread::hardware_concurrency());
+        for(int n = 1; n <= maxNumThreads; n *= 2){
+            threadCounts.push_back(n);
+        }
+        CollisionDetectorBenchmark benchmark;
+        benchmark.setMessageSink(MessageView::mainInstance()->cout());
+        benchmark.setThreadCounts(threadCounts);
+        const string outputFile = v["collision-benchmark"].as<string>();
+        if(benchmark.run() && !benchmark.writeResults(outputFile)){
+            MessageView::mainInstance()->putln(
+                MessageView::ERROR, format(_("The results cannot be written to \"%1%\".")) % outputFile);
+        }
+    }
+}
+
+}
+
+namespace cnoid {
+
+class SimulationBenchmarkImpl
+{
+public:
+    MessageView* mv;
+    double timeLength;
+    vector<string> simulators;
+    vector<BenchmarkScene> scenes;
+    vector<BenchmarkRun> runs;
+    ArchivePtr pathArchive;
+    string outputFile;
+    int numFailedRuns;
+
+    SimulationBenchmarkImpl();
+    bool load(const string& filename);
+    bool run();
+    WorldItem* createScene(const BenchmarkScene& scene, ItemList<>& out_sceneItems);
+    BodyItemPtr loadModel(const string& name);
+    void addBody(WorldItem* worldItem, BodyItem* proto, const string& name, const Vector3& p);
+    WorldItem* createBoxStack(const BenchmarkScene& scene);
+    WorldItem* createBin(const BenchmarkScene& scene);
+    WorldItem* loadProjectScene(const BenchmarkScene& scene, ItemList<>& out_sceneItems);
+    void runSimulator(WorldItem* worldItem, BenchmarkRun& run);
+    void putStepTimes(Mapping* result, SimulatorItem* simulatorItem);
+    void putContacts(Mapping* result, CollisionSeqItem* collisionSeqItem);
+    void writeResults(double computationTime);
+};
+
+}
+
+
+void SimulationBenchmark::initialize(ExtensionManager* ext)
+{
+    ext->optionManager()
+        .addOption("benchmark", boost::program_options::value<string>(),
+                   "run the scenes given by a benchmark file with each of the available simulators")
+        .addOption("benchmark-output", boost::program_options::value<string>(),
+                   "the file to which the results of the benchmark are written")
+        .addOption("collision-benchmark", boost::program_options::value<string>(),
+                   "measure the available collision detectors and write the results to the given file")
+        .sigOptionsParsed().connect(onSigOptionsParsed);
+}
+
+
+SimulationBenchmark::SimulationBenchmark()
+{
+    impl = new SimulationBenchmarkImpl();
+}
+
+
+SimulationBenchmarkImpl::SimulationBenchmarkImpl()
+{
+    mv = MessageView::mainInstance();
+    timeLength = 5.0;
+    outputFile = "benchmark.yaml";
+    numFailedRuns = 0;
+}
+
+
+SimulationBenchmark::~SimulationBenchmark()
+{
+    delete impl;
+}
+
+
+void SimulationBenchmark::setOutputFile(const std::string& filename)
+{
+    impl->outputFile = filename;
+}
+
+
+int SimulationBenchmark::numRuns() const
+{
+    return impl->runs.size();
+}
+
+
+int SimulationBenchmark::numFailedRuns() const
+{
+    return impl->numFailedRuns;
+}
+
+
+bool SimulationBenchmark::load(const std::string& filename)
+{
+    return impl->load(filename);
+}
+
+
+bool SimulationBenchmarkImpl::load(const string& filename)
+{
+    simulators.clear();
+    scenes.clear();
+
+    pathArchive = new Archive();
+    pathArchive->initSharedInfo(filename);
+
+    try {
+        YAMLReader reader;
+        if(!reader.load(filename)){
+            mv->putln(MessageView::ERROR,
+                      format(_("The benchmark file \"%1%\" cannot be loaded: %2%")) % filename % reader.errorMessage());
+            return false;
+        }
+        const Mapping& benchmark = *reader.document()->toMapping();
+        benchmark.read("timeLength", timeLength);
+
+        const Listing& simulatorList = *benchmark.findListing("simulators");
+        if(simulatorList.isValid()){
+            for(int i=0; i < simulatorList.size(); ++i){
+                simulators.push_back(simulatorList[i].toString());
+            }
+        } else {
+            const int n = sizeof(defaultSimulators) / sizeof(defaultSimulators[0]);
+            simulators.assign(defaultSimulators, defaultSimulators + n);
+        }
+
+        const Listing& sceneList = *benchmark.findListing("scenes");
+        if(sceneList.isValid()){
+            for(int i=0; i < sceneList.size(); ++i){
+                const Mapping& info = *sceneList[i].toMapping();
+                scenes.push_back(BenchmarkScene());
+                BenchmarkScene& scene = scenes.back();
+                if(!info.read("name", scene.name)){
+                    scene.name = str(format("scene%1%") % i);
+                }
+                if(info.read("project", scene.projectFile)){
+                    scene.type = "project";
+                    scene.projectFile = pathArchive->resolveRelocatablePath(scene.projectFile);
+                } else {
+                    scene.type = info.get("type", "boxStack");
+                }
+                scene.numObjects = 10;
+                if(!info.read("numBoxes", scene.numObjects)){
+                    info.read("numParts", scene.numObjects);
+                }
+            }
+        }
+    } catch(const ValueNode::Exception& ex){
+        mv->putln(MessageView::ERROR, format(_("The benchmark file \"%1%\" is invalid: %2%")) % filename % ex.message());
+        scenes.clear();
+        return false;
+    }
+
+    if(scenes.empty()){
+        mv->putln(MessageView::WARNING, format(_("The benchmark file \"%1%\" has no scenes.")) % filename);
+        return false;
+    }
+    return true;
+}
+
+
+bool SimulationBenchmark::run()
+{
+    return impl->run();
+}
+
+
+bool SimulationBenchmarkImpl::run()
+{
+    runs.clear();
+    numFailedRuns = 0;
+
+    TimeMeasure timer;
+    timer.begin();
+
+    for(size_t i=0; i < scenes.size(); ++i){
+        const BenchmarkScene& scene = scenes[i];
+        ItemList<> sceneItems;
+        WorldItemPtr worldItem = createScene(scene, sceneItems);
+        if(!worldItem){
+            mv->putln(MessageView::ERROR, format(_("Benchmark scene \"%1%\" cannot be created.")) % scene.name);
+            for(size_t j=0; j < simulators.size(); ++j){
+                runs.push_back(BenchmarkRun());
+                BenchmarkRun& run = runs.back();
+                run.sceneIndex = i;
+                run.simulator = simulators[j];
+                run.isSucceeded = false;
+                ++numFailedRuns;
+            }
+            continue;
+        }
+        for(size_t j=0; j < simulators.size(); ++j){
+            runs.push_back(BenchmarkRun());
+            BenchmarkRun& run = runs.back();
+            run.sceneIndex = i;
+            run.simulator = simulators[j];
+            mv->putln(format(_("Benchmark scene \"%1%\" with %2% ...")) % scene.name % run.simulator);
+            mv->flush();
+            runSimulator(worldItem, run);
+        }
+        for(size_t j=0; j < sceneItems.size(); ++j){
+            sceneItems[j]->detachFromParentItem();
+        }
+    }
+
+    timer.end();
+
+    writeResults(timer.time());
+
+    mv->putln(format(_("The benchmark of %1% runs has been finished in %2% [s] (%3% failed). "
+                       "The results are written to \"%4%\"."))
+              % runs.size() % timer.time() % numFailedRuns % outputFile);
+
+    return true;
+}
+
+
+WorldItem* SimulationBenchmarkImpl::createScene(const BenchmarkScene& scene, ItemList<>& out_sceneItems)
+{
+    if(scene.type == "project"){
+        return loadProjectScene(scene, out_sceneItems);
+    }
+
+    WorldItem* worldItem = 0;
+    if(scene.type == "boxStack"){
+        worldItem = createBoxStack(scene);
+    } else if(scene.type == "bin"){
+        worldItem = createBin(scene);
+    } else {
+        mv->putln(MessageView::ERROR,
+                  format(_("The type \"%1%\" of benchmark scene \"%2%\" is unknown.")) % scene.type % scene.name);
+    }
+    if(worldItem){
+        RootItem::instance()->addChildItem(worldItem);
+        out_sceneItems.push_back(worldItem);
+    }
+    return worldItem;
+}
+
+
+BodyItemPtr SimulationBenchmarkImpl::loadModel(const string& name)
+{
+    const string filename =
+        (filesystem::path(shareDirectory()) / "model" / "benchmark" / (name + ".body")).string();
+    BodyItemPtr bodyItem = new BodyItem();
+    if(!bodyItem->loadModelFile(filename)){
+        mv->putln(MessageView::ERROR, format(_("The benchmark model \"%1%\" cannot be loaded.")) % filename);
+        return 0;
+    }
+    return bodyItem;
+}
+
+
+void SimulationBenchmarkImpl::addBody(WorldItem* worldItem, BodyItem* proto, const string& name, const Vector3& p)
+{
+    BodyItem* bodyItem = static_cast<BodyItem*>(proto->duplicate());
+    bodyItem->setName(name);
+    Body* body = bodyItem->body();
+    body->rootLink()->p() = p;
+    body->calcForwardKinematics();
+    bodyItem->storeInitialState();
+    worldItem->addChildItem(bodyItem);
+}
+
+
+WorldItem* SimulationBenchmarkImpl::createBoxStack(const BenchmarkScene& scene)
+{
+    BodyItemPtr floor = loadModel("floor");
+    BodyItemPtr box = loadModel("box");
+    if(!floor || !box){
+        return 0;
+    }
+    WorldItem* worldItem = new WorldItem();
+    worldItem->setName(scene.name);
+    worldItem->setTemporal();
+    addBody(worldItem, floor, "Floor", Vector3::Zero());
+
+    // The boxes are stacked with small gaps so that each box lands on the one below it
+    for(int i=0; i < scene.numObjects; ++i){
+        addBody(worldItem, box, str(format("Box%1%") % i), Vector3(0.0, 0.0, 0.05 + i * 0.101));
+    }
+    return worldItem;
+}
+
+
+WorldItem* SimulationBenchmarkImpl::createBin(const BenchmarkScene& scene)
+{
+    BodyItemPtr bin = loadModel("bin");
+    BodyItemPtr part = loadModel("part");
+    if(!bin || !part){
+        return 0;
+    }
+    WorldItem* worldItem = new WorldItem();
+    worldItem->setName(scene.name);
+    worldItem->setTemporal();
+    addBody(worldItem, bin, "Bin", Vector3::Zero());
+
+    // The parts are dropped from a grid of 4 x 4 positions above the bin
+    for(int i=0; i < scene.numObjects; ++i){
+        const int layer = i / 16;
+        const double x = ((i % 16) % 4 - 1.5) * 0.12;
+        const double y = ((i % 16) / 4 - 1.5) * 0.12;
+        addBody(worldItem, part, str(format("Part%1%") % i), Vector3(x, y, 0.4 + layer * 0.08));
+    }
+    return worldItem;
+}
+
+
+WorldItem* SimulationBenchmarkImpl::loadProjectScene(const BenchmarkScene& scene, ItemList<>& out_sceneItems)
+{
+    RootItem* rootItem = RootItem::instance();
+    set<Item*> existingItems;
+    for(Item* item = rootItem->childItem(); item; item = item->nextItem()){
+        existingItems.insert(item);
+    }
+
+    ProjectManager::instance()->loadProject(scene.projectFile);
+
+    WorldItem* worldItem = 0;
+    for(Item* item = rootItem->childItem(); item; item = item->nextItem()){
+        if(existingItems.find(item) == existingItems.end()){
+            out_sceneItems.push_back(item);
+            if(!worldItem){
+                worldItem = dynamic_cast<WorldItem*>(item);
+            }
+        }
+    }
+    return worldItem;
+}
+
+
+void SimulationBenchmarkImpl::runSimulator(WorldItem* worldItem, BenchmarkRun& run)
+{
+    run.result = new Mapping();
+    run.isSucceeded = false;
+    Mapping* result = run.result.get();
+
+    SimulatorItemPtr simulatorItem;
+    const size_t pos = run.simulator.find('/');
+    if(pos != string::npos){
+        simulatorItem = dynamic_pointer_cast<SimulatorItem>(
+            ItemManager::create(run.simulator.substr(0, pos), run.simulator.substr(pos + 1)));
+    }
+    if(!simulatorItem){
+        result->write("available", false);
+        mv->putln(format(_("%1% is not available.")) % run.simulator);
+        return;
+    }
+    result->write("available", true);
+
+    simulatorItem->setName("BenchmarkSimulator");
+    simulatorItem->setTemporal();
+    worldItem->addChildItem(simulatorItem);
+
+    // The properties are set through the archive because the time length has no setter
+    Item* item = simulatorItem.get();
+    ArchivePtr archive = new Archive();
+    archive->initSharedInfo();
+    item->store(*archive);
+    archive->write("realtimeSync", false);
+    archive->write("recording", "full");
+    archive->write("timeRangeMode", "Specified time");
+    archive->write("timeLength", timeLength);
+    archive->write("recordCollisionData", true);
+    archive->write("offlineCollisionDetection", true);
+    archive->write("stepProfiling", true);
+    archive->write("profileOutputFile", "");
+    item->restore(*archive);
+
+    EnergyMonitorItemPtr monitor = new EnergyMonitorItem();
+    simulatorItem->addChildItem(monitor);
+
+    TimeMeasure timer;
+    QEventLoop eventLoop;
+    Connection connection =
+        simulatorItem->sigSimulationFinished().connect(boost::bind(&QEventLoop::quit, &eventLoop));
+    timer.begin();
+    run.isSucceeded = simulatorItem->startSimulation(true);
+    if(run.isSucceeded){
+        eventLoop.exec();
+    }
+    timer.end();
+    connection.disconnect();
+
+    result->write("succeeded", run.isSucceeded);
+
+    const string collisionSeqName = simulatorItem->name() + "-collisions";
+    CollisionSeqItemPtr collisionSeqItem = worldItem->findChildItem<CollisionSeqItem>(collisionSeqName);
+
+    if(!run.isSucceeded){
+        ++numFailedRuns;
+    } else {
+        const int numSteps = simulatorItem->simulationFrame();
+        result->write("numSteps", numSteps);
+        result->write("timeStep", simulatorItem->worldTimeStep());
+        result->write("computationTime", timer.time());
+        if(timer.time() > 0.0){
+            result->write("realtimeFactor", numSteps * simulatorItem->worldTimeStep() / timer.time());
+        }
+        putStepTimes(result, simulatorItem);
+        putContacts(result, collisionSeqItem);
+
+        Mapping* energy = result->createFlowStyleMapping("energy");
+        energy->write("initial", monitor->initialEnergy);
+        energy->write("final", monitor->finalEnergy);
+        energy->write("drift", monitor->finalEnergy - monitor->initialEnergy);
+        energy->write("maxGain", monitor->maxEnergyGain);
+    }
+
+    // The motions recorded by the simulator are named with the prefix of the simulator name
+    ItemList<BodyMotionItem> motionItems;
+    motionItems.extractChildItems(worldItem);
+    const string prefix = simulatorItem->name() + "-";
+    for(size_t i=0; i < motionItems.size(); ++i){
+        if(motionItems[i]->name().compare(0, prefix.size(), prefix) == 0){
+            motionItems[i]->detachFromParentItem();
+        }
+    }
+    if(collisionSeqItem){
+        collisionSeqItem->detachFromParentItem();
+    }
+    monitor->detachFromParentItem();
+    simulatorItem->detachFromParentItem();
+}
+
+
+void SimulationBenchmarkImpl::putStepTimes(Mapping* result, SimulatorItem* simulatorItem)
+{
+    SimulationProfiler* profiler = simulatorItem->profiler();
+    const int dynamicsStage = profiler->registerStage("Dynamics");
+    const int stepStage = profiler->registerStage("Step");
+
+    Mapping* dynamics = result->createFlowStyleMapping("dynamicsTime");
+    dynamics->write("mean", profiler->averageTime(dynamicsStage) * 1.0e3);
+    dynamics->write("p50", profiler->percentileTime(dynamicsStage, 0.5) * 1.0e3);
+    dynamics->write("p90", profiler->percentileTime(dynamicsStage, 0.9) * 1.0e3);
+    dynamics->write("p99", profiler->percentileTime(dynamicsStage, 0.99) * 1.0e3);
+    dynamics->write("max", profiler->maxTime(dynamicsStage) * 1.0e3);
+
+    Mapping* step = result->createFlowStyleMapping("stepTime");
+    step->write("mean", profiler->averageTime(stepStage) * 1.0e3);
+    step->write("p50", profiler->percentileTime(stepStage, 0.5) * 1.0e3);
+    step->write("p90", profiler->percentileTime(stepStage, 0.9) * 1.0e3);
+    step->write("p99", profiler->percentileTime(stepStage, 0.99) * 1.0e3);
+    step->write("max", profiler->maxTime(stepStage) * 1.0e3);
+}
+
+
+void SimulationBenchmarkImpl::putContacts(Mapping* result, CollisionSeqItem* collisionSeqItem)
+{
+    if(!collisionSeqItem){
+        return;
+    }
+    const CollisionSeqPtr& seq = collisionSeqItem->collisionSeq();
+    const int numFrames = seq->numFrames();
+    int maxContacts = 0;
+    double totalContacts = 0.0;
+    double maxDepth = 0.0;
+    double totalDepth = 0.0;
+    for(int i=0; i < numFrames; ++i){
+        const CollisionLinkPairListPtr& pairs = seq->frame(i)[0];
+        if(!pairs){
+            continue;
+        }
+        int numContacts = 0;
+        for(size_t j=0; j < pairs->size(); ++j){
+            const vector<Collision>& collisions = (*pairs)[j]->collisions;
+            for(size_t k=0; k < collisions.size(); ++k){
+                maxDepth = std::max(maxDepth, collisions[k].depth);
+                totalDepth += collisions[k].depth;
+            }
+            numContacts += collisions.size();
+        }
+        maxContacts = std::max(maxContacts, numContacts);
+        totalContacts += numContacts;
+    }
+
+    Mapping* contacts = result->createFlowStyleMapping("contacts");
+    contacts->write("mean", (numFrames > 0) ? (totalContacts / numFrames) : 0.0);
+    contacts->write("max", maxContacts);
+
+    Mapping* penetration = result->createFlowStyleMapping("penetration");
+    penetration->write("mean", (totalContacts > 0.0) ? (totalDepth / totalContacts) : 0.0);
+    penetration->write("max", maxDepth);
+}
+
+
+void SimulationBenchmarkImpl::writeResults(double computationTime)
+{
+    MappingPtr results = new Mapping();
+    results->write("timeLength", timeLength);
+    results->write("numRuns", (int)runs.size());
+    results->write("numFailedRuns", numFailedRuns);
+    results->write("computationTime", computationTime);
+    Listing& runList = *results->createListing("runs");
+
+    for(size_t i=0; i < runs.size(); ++i){
+        BenchmarkRun& run = runs[i];
+        Mapping* info = runList.newMapping();
+        info->write("scene", scenes[run.sceneIndex].name);
+        info->write("simulator", run.simulator);
+        if(run.result){
+            info->insert(run.result.get());
+        } else {
+            info->write("succeeded", false);
+        }
+    }
+
+    YAMLWriter writer(outputFile);
+    writer.setKeyOrderPreservationMode(true);
+    writer.putNode(results.get());
+}
@@ -0,0 +1,73 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_SIMULATION_BENCHMARK_H
+#define CNOID_BODYPLUGIN_SIMULATION_BENCHMARK_H
+
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ExtensionManager;
+class SimulationBenchmarkImpl;
+
+/**
+   This class runs the same scenes with each of the available simulator items and writes
+   the step times, the contacts, the penetration depths and the energy drift of each run
+   to a YAML file. The benchmark file is a YAML file as follows:
+
+   \verbatim
+   timeLength: 5.0
+   simulators:          # "Plugin name/Item class name". All the physics engines by default.
+     - Body/AISTSimulatorItem
+     - ODE/ODESimulatorItem
+   scenes:
+     - { name: boxStack, type: boxStack, numBoxes: 10 }
+     - { name: bin, type: bin, numParts: 50 }
+     - { name: walk, project: "${SHARE}/project/SR1Walk.cnoid" }
+   \endverbatim
+
+   The scenes of the "boxStack" and "bin" types are created with the models in
+   share/model/benchmark, and a scene with "project" is the world item of the project file.
+   The simulator items which are not available because their plugins are not loaded are
+   reported as unavailable. The contacts and the penetration depths are obtained by the
+   collision detector of the world item from the recorded motions, so that they are measured
+   in the same way for all the simulators. The energy is the total mechanical energy of the
+   non-static bodies, so its drift is only meaningful for the scenes without actuators.
+
+   The benchmark can be executed from the command line with the following options:
+   --benchmark <file> [--benchmark-output <file>] [--quit]
+*/
+class CNOID_EXPORT SimulationBenchmark
+{
+public:
+    static void initialize(ExtensionManager* ext);
+
+    SimulationBenchmark();
+    ~SimulationBenchmark();
+
+    bool load(const std::string& filename);
+
+    //! The default file is "benchmark.yaml" in the current directory
+    void setOutputFile(const std::string& filename);
+
+    /**
+       Executes all the runs. This function returns when all the runs are finished.
+    */
+    bool run();
+
+    int numRuns() const;
+    int numFailedRuns() const;
+
+private:
+    SimulationBenchmarkImpl* impl;
+
+    SimulationBenchmark(const SimulationBenchmark& org);
+    SimulationBenchmark& operator=(const SimulationBenchmark& rhs);
+};
+
+}
+
+#endif
@@ -0,0 +1,64 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_BODY_PLUGIN_SIMULATION_COMMAND_QUEUE_H
+#define CNOID_BODY_PLUGIN_SIMULATION_COMMAND_QUEUE_H
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <deque>
+
+namespace cnoid {
+
+/**
+   This class passes the commands from the main thread to the simulation thread
+   with a single-producer single-consumer lock-free queue, so that the simulation thread
+   is never blocked by the inputs from the GUI.
+   post() and flush() must only be called from the main thread and pop() must only be
+   called from the simulation thread. When the queue is full, for example while the simulation
+   is paused, the commands are kept in the main thread and they are passed by the next post()
+   or flush() in the same order.
+*/
+template<class Command>
+class SimulationCommandQueue
+{
+public:
+    SimulationCommandQueue(int capacity = 1024)
+        : queue(capacity) { }
+
+    void post(const Command& command) {
+        if(!flush() || !queue.push(command)){
+            pendingCommands.push_back(command);
+        }
+    }
+
+    //! \return true if all the pending commands have been passed to the queue
+    bool flush() {
+        while(!pendingCommands.empty()){
+            if(!queue.push(pendingCommands.front())){
+                return false;
+            }
+            pendingCommands.pop_front();
+        }
+        return true;
+    }
+
+    bool pop(Command& out_command) {
+        return queue.pop(out_command);
+    }
+
+    //! This can only be called when the simulation thread is not running
+    void clear() {
+        Command command;
+        while(queue.pop(command)) { }
+        pendingCommands.clear();
+    }
+
+private:
+    boost::lockfree::spsc_queue<Command> queue;
+    std::deque<Command> pendingCommands;
+};
+
+}
+
+#endif
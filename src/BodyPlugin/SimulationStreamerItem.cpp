@@ -0,0 +1,768 @@
+/*!
+  @file
+*/
+
+#include "SimulationStreamerItem.h"
+#include "SimulatorItem.h"
+#include "BodyItem.h"
+#include <cnoid/ItemManager>
+#include <cnoid/MessageView>
+#include <cnoid/Archive>
+#include <cnoid/ValueTreeUtil>
+#include <cnoid/Timer>
+#include <cnoid/Body>
+#include <cnoid/Device>
+#include <cnoid/EigenUtil>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <boost/thread/mutex.hpp>
+#include <boost/tokenizer.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+namespace {
+
+const int PROTOCOL_VERSION = 1;
+enum MessageType { HEADER = 1, FRAME = 2 };
+
+//! The frames are dropped for a viewer while this size of the data is waiting to be sent to it
+const qint64 maxPendingBytes = 4 * 1024 * 1024;
+
+string getNameListString(const vector<string>& names)
+{
+    string nameList;
+    if(!names.empty()){
+        size_t n = names.size() - 1;
+        for(size_t i=0; i < n; ++i){
+            nameList += names[i];
+            nameList += ", ";
+        }
+        nameList += names.back();
+    }
+    return nameList;
+}
+
+bool updateNames(const string& nameListString, string& newNameListString, vector<string>& names)
+{
+    using boost::tokenizer;
+    using boost::char_separator;
+
+    names.clear();
+    char_separator<char> sep(",");
+    tokenizer< char_separator<char> > tok(nameListString, sep);
+    for(tokenizer< char_separator<char> >::iterator p = tok.begin(); p != tok.end(); ++p){
+        string name = boost::trim_copy(*p);
+        if(!name.empty()){
+            names.push_back(name);
+        }
+    }
+    newNameListString = nameListString;
+    return true;
+}
+
+
+class MessageWriter
+{
+    string& buf;
+
+public:
+    MessageWriter(string& buf, int type) : buf(buf) {
+        buf.clear();
+        putU32(0);
+        putU8(type);
+    }
+    void putU8(int value) {
+        buf += static_cast<char>(value & 0xff);
+    }
+    void putU16(int value) {
+        putU8(value);
+        putU8(value >> 8);
+    }
+    void putU32(boost::uint32_t value) {
+        for(int i=0; i < 4; ++i){
+            putU8(value >> (i * 8));
+        }
+    }
+    void putF32(float value) {
+        boost::uint32_t bits;
+        std::memcpy(&bits, &value, 4);
+        putU32(bits);
+    }
+    void putF32s(const float* values, int n) {
+        for(int i=0; i < n; ++i){
+            putF32(values[i]);
+        }
+    }
+    void putF64(double value) {
+        boost::uint64_t bits;
+        std::memcpy(&bits, &value, 8);
+        for(int i=0; i < 8; ++i){
+            putU8(static_cast<int>(bits >> (i * 8)));
+        }
+    }
+    void putString(const string& s) {
+        const int size = std::min(s.size(), static_cast<size_t>(0xffff));
+        putU16(size);
+        buf.append(s, 0, size);
+    }
+    size_t reserveU16() {
+        size_t pos = buf.size();
+        putU16(0);
+        return pos;
+    }
+    void setU16(size_t pos, int value) {
+        buf[pos] = static_cast<char>(value & 0xff);
+        buf[pos + 1] = static_cast<char>((value >> 8) & 0xff);
+    }
+    void finish() {
+        const boost::uint32_t size = buf.size() - 4;
+        for(int i=0; i < 4; ++i){
+            buf[i] = static_cast<char>((size >> (i * 8)) & 0xff);
+        }
+    }
+};
+
+//! The translation and the rotation quaternion of a link
+const int LINK_VALUE_SIZE = 7;
+
+struct StreamedState
+{
+    vector<float> linkValues;
+    vector<float> deviceValues;
+};
+
+struct StreamedBody
+{
+    Body* body;
+    vector<Device*> devices;
+    vector<int> deviceOffsets;
+};
+
+struct Viewer
+{
+    QTcpSocket* socket;
+    bool needsHeader;
+    bool needsKeyFrame;
+};
+
+}
+
+namespace cnoid {
+
+class SimulationStreamerItemImpl
+{
+public:
+    SimulationStreamerItem* self;
+    ostream& os;
+    SimulatorItem* simulatorItem;
+
+    int port;
+    double frameRate;
+    vector<string> bodyNames;
+    string bodyNameListString;
+    vector<string> deviceNames;
+    string deviceNameListString;
+
+    QTcpServer* server;
+    vector<Viewer> viewers;
+    Timer publishingTimer;
+
+    vector<StreamedBody> bodies;
+    int publishingInterval;
+    int stepsToPublish;
+    vector<double> deviceStateBuf;
+
+    // The states are passed from the simulation thread to the main thread by swapping the buffers
+    vector<StreamedState> stagedStates;
+    boost::mutex stateMutex;
+    vector<StreamedState> latestStates;
+    double latestTime;
+    bool isLatestStateUpdated;
+    vector<StreamedState> currentStates;
+    double currentTime;
+    vector<StreamedState> lastSentStates;
+
+    string headerMessage;
+    string keyFrameMessage;
+    string deltaFrameMessage;
+
+    SimulationStreamerItemImpl(SimulationStreamerItem* self);
+    SimulationStreamerItemImpl(SimulationStreamerItem* self, const SimulationStreamerItemImpl& org);
+    ~SimulationStreamerItemImpl();
+    void initialize();
+    bool openServer();
+    void closeServer();
+    bool initializeSimulation(SimulatorItem* simulatorItem);
+    void encodeHeader();
+    void onPostDynamics();
+    void storeStates(vector<StreamedState>& states);
+    void onPublishingTimeout();
+    void acceptViewers();
+    void publishFrame();
+    void encodeFrame(string& out_message, bool isKeyFrame);
+    void finalizeSimulation();
+    void doPutProperties(PutPropertyFunction& putProperty);
+    bool onPortChanged(int port);
+    bool store(Archive& archive);
+    bool restore(const Archive& archive);
+
+    template<typename Type> void setProperty(Type& variable, const Type& value){
+        if(value != variable){
+            variable = value;
+            self->notifyUpdate();
+        }
+    }
+};
+
+}
+
+
+void SimulationStreamerItem::initializeClass(ExtensionManager* ext)
+{
+    ext->itemManager().registerClass<SimulationStreamerItem>(N_("SimulationStreamerItem"));
+    ext->itemManager().addCreationPanel<SimulationStreamerItem>();
+}
+
+
+SimulationStreamerItem::SimulationStreamerItem()
+{
+    impl = new SimulationStreamerItemImpl(this);
+    setName("SimulationStreamer");
+}
+
+
+SimulationStreamerItemImpl::SimulationStreamerItemImpl(SimulationStreamerItem* self)
+    : self(self),
+      os(MessageView::instance()->cout())
+{
+    initialize();
+    port = 50200;
+    frameRate = 30.0;
+}
+
+
+SimulationStreamerItem::SimulationStreamerItem(const SimulationStreamerItem& org)
+    : SubSimulatorItem(org)
+{
+    impl = new SimulationStreamerItemImpl(this, *org.impl);
+}
+
+
+SimulationStreamerItemImpl::SimulationStreamerItemImpl
+(SimulationStreamerItem* self, const SimulationStreamerItemImpl& org)
+    : self(self),
+      os(MessageView::instance()->cout()),
+      bodyNames(org.bodyNames),
+      deviceNames(org.deviceNames)
+{
+    initialize();
+    port = org.port;
+    frameRate = org.frameRate;
+    bodyNameListString = getNameListString(bodyNames);
+    deviceNameListString = getNameListString(deviceNames);
+}
+
+
+void SimulationStreamerItemImpl::initialize()
+{
+    simulatorItem = 0;
+    server = 0;
+    publishingInterval = 1;
+    stepsToPublish = 1;
+    latestTime = 0.0;
+    isLatestStateUpdated = false;
+    currentTime = 0.0;
+    publishingTimer.sigTimeout().connect(
+        boost::bind(&SimulationStreamerItemImpl::onPublishingTimeout, this));
+}
+
+
+Item* SimulationStreamerItem::doDuplicate() const
+{
+    return new SimulationStreamerItem(*this);
+}
+
+
+SimulationStreamerItem::~SimulationStreamerItem()
+{
+    delete impl;
+}
+
+
+SimulationStreamerItemImpl::~SimulationStreamerItemImpl()
+{
+    publishingTimer.stop();
+    closeServer();
+}
+
+
+void SimulationStreamerItem::setPort(int port)
+{
+    impl->onPortChanged(port);
+}
+
+
+int SimulationStreamerItem::port() const
+{
+    return impl->port;
+}
+
+
+void SimulationStreamerItem::setFrameRate(double rate)
+{
+    impl->setProperty(impl->frameRate, rate);
+}
+
+
+void SimulationStreamerItem::setTargetBodies(const std::string& names)
+{
+    updateNames(names, impl->bodyNameListString, impl->bodyNames);
+    notifyUpdate();
+}
+
+
+void SimulationStreamerItem::setTargetDevices(const std::string& names)
+{
+    updateNames(names, impl->deviceNameListString, impl->deviceNames);
+    notifyUpdate();
+}
+
+
+int SimulationStreamerItem::numViewers() const
+{
+    return impl->viewers.size();
+}
+
+
+void SimulationStreamerItem::onDisconnectedFromRoot()
+{
+    impl->publishingTimer.stop();
+    impl->closeServer();
+}
+
+
+/**
+   The server is kept open over the simulations so that the viewers do not have to reconnect
+   to observe the next simulation. It is closed when the item is removed or the port is changed.
+*/
+bool SimulationStreamerItemImpl::openServer()
+{
+    if(server && server->isListening()){
+        if(server->serverPort() == port){
+            return true;
+        }
+        closeServer();
+    }
+    if(!server){
+        server = new QTcpServer;
+    }
+    if(!server->listen(QHostAddress::Any, port)){
+        os << (format(_("%1% cannot listen to port %2%: %3%"))
+               % self->name() % port % server->errorString().toStdString()) << endl;
+        closeServer();
+        return false;
+    }
+    os << (format(_("%1% is streaming the simulation on port %2%.")) % self->name() % port) << endl;
+    return true;
+}
+
+
+void SimulationStreamerItemImpl::closeServer()
+{
+    for(size_t i=0; i < viewers.size(); ++i){
+        viewers[i].socket->abort();
+        viewers[i].socket->deleteLater();
+    }
+    viewers.clear();
+
+    if(server){
+        server->close();
+        delete server;
+        server = 0;
+    }
+}
+
+
+bool SimulationStreamerItem::initializeSimulation(SimulatorItem* simulatorItem)
+{
+    return impl->initializeSimulation(simulatorItem);
+}
+
+
+bool SimulationStreamerItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
+{
+    this->simulatorItem = simulatorItem;
+    bodies.clear();
+
+    if(!openServer()){
+        return false;
+    }
+
+    std::set<string> bodyNameSet(bodyNames.begin(), bodyNames.end());
+    std::set<string> deviceNameSet(deviceNames.begin(), deviceNames.end());
+
+    const vector<SimulationBody*>& simBodies = simulatorItem->simulationBodies();
+    for(size_t i=0; i < simBodies.size(); ++i){
+        Body* body = simBodies[i]->body();
+        if(bodyNameSet.empty() || bodyNameSet.find(body->name()) != bodyNameSet.end()){
+            bodies.push_back(StreamedBody());
+            StreamedBody& streamed = bodies.back();
+            streamed.body = body;
+            streamed.deviceOffsets.push_back(0);
+            for(int j=0; j < body->numDevices(); ++j){
+                Device* device = body->device(j);
+                if(deviceNameSet.find(device->name()) != deviceNameSet.end() ||
+                   deviceNameSet.find(device->typeName()) != deviceNameSet.end()){
+                    streamed.devices.push_back(device);
+                    streamed.deviceOffsets.push_back(streamed.deviceOffsets.back() + device->stateSize());
+                }
+            }
+        }
+    }
+
+    stagedStates.resize(bodies.size());
+    for(size_t i=0; i < bodies.size(); ++i){
+        StreamedBody& streamed = bodies[i];
+        stagedStates[i].linkValues.resize(streamed.body->numLinks() * LINK_VALUE_SIZE);
+        stagedStates[i].deviceValues.resize(streamed.deviceOffsets.back());
+    }
+    latestStates = stagedStates;
+    currentStates = stagedStates;
+    lastSentStates.clear();
+    isLatestStateUpdated = false;
+
+    encodeHeader();
+    for(size_t i=0; i < viewers.size(); ++i){
+        viewers[i].needsHeader = true;
+    }
+
+    const double dt = simulatorItem->worldTimeStep();
+    publishingInterval = std::max(1, static_cast<int>(1.0 / (std::max(0.1, frameRate) * dt) + 0.5));
+    // The first state is published in the first step
+    stepsToPublish = 1;
+
+    simulatorItem->addPostDynamicsFunction(boost::bind(&SimulationStreamerItemImpl::onPostDynamics, this));
+
+    publishingTimer.start(std::max(1, static_cast<int>(1000.0 / std::max(0.1, frameRate) / 2.0)));
+
+    return true;
+}
+
+
+void SimulationStreamerItemImpl::encodeHeader()
+{
+    MessageWriter writer(headerMessage, HEADER);
+    writer.putU8('C');
+    writer.putU8('N');
+    writer.putU8('S');
+    writer.putU8('S');
+    writer.putU16(PROTOCOL_VERSION);
+    writer.putU16(bodies.size());
+
+    const vector<SimulationBody*>& simBodies = simulatorItem->simulationBodies();
+    for(size_t i=0; i < bodies.size(); ++i){
+        StreamedBody& streamed = bodies[i];
+        Body* body = streamed.body;
+        string modelFile;
+        for(size_t j=0; j < simBodies.size(); ++j){
+            if(simBodies[j]->body() == body){
+                modelFile = simBodies[j]->bodyItem()->filePath();
+                break;
+            }
+        }
+        writer.putString(body->name());
+        writer.putString(modelFile);
+        writer.putU16(body->numLinks());
+        for(int j=0; j < body->numLinks(); ++j){
+            writer.putString(body->link(j)->name());
+        }
+        writer.putU16(streamed.devices.size());
+        for(size_t j=0; j < streamed.devices.size(); ++j){
+            Device* device = streamed.devices[j];
+            writer.putString(device->name());
+            writer.putString(device->typeName());
+            writer.putU16(device->stateSize());
+        }
+    }
+    writer.finish();
+}
+
+
+/**
+   This is called by the simulation thread. The states are copied into the staged buffer
+   without holding the lock, and the lock is only held to swap the buffer.
+*/
+void SimulationStreamerItemImpl::onPostDynamics()
+{
+    if(--stepsToPublish > 0){
+        return;
+    }
+    stepsToPublish = publishingInterval;
+
+    storeStates(stagedStates);
+
+    boost::mutex::scoped_lock lock(stateMutex);
+    latestStates.swap(stagedStates);
+    latestTime = simulatorItem->currentTime();
+    isLatestStateUpdated = true;
+}
+
+
+void SimulationStreamerItemImpl::storeStates(vector<StreamedState>& states)
+{
+    for(size_t i=0; i < bodies.size(); ++i){
+        StreamedBody& streamed = bodies[i];
+        Body* body = streamed.body;
+        StreamedState& state = states[i];
+
+        float* v = state.linkValues.empty() ? 0 : &state.linkValues[0];
+        for(int j=0; j < body->numLinks(); ++j){
+            Link* link = body->link(j);
+            const Vector3& p = link->translation();
+            const Quat q(link->rotation());
+            v[0] = p.x();
+            v[1] = p.y();
+            v[2] = p.z();
+            v[3] = q.w();
+            v[4] = q.x();
+            v[5] = q.y();
+            v[6] = q.z();
+            v += LINK_VALUE_SIZE;
+        }
+
+        for(size_t j=0; j < streamed.devices.size(); ++j){
+            const int offset = streamed.deviceOffsets[j];
+            const int size = streamed.deviceOffsets[j + 1] - offset;
+            if(size > 0){
+                deviceStateBuf.resize(size);
+                streamed.devices[j]->writeState(&deviceStateBuf[0]);
+                std::copy(deviceStateBuf.begin(), deviceStateBuf.end(), state.deviceValues.begin() + offset);
+            }
+        }
+    }
+}
+
+
+void SimulationStreamerItemImpl::onPublishingTimeout()
+{
+    acceptViewers();
+
+    {
+        boost::mutex::scoped_lock lock(stateMutex);
+        if(!isLatestStateUpdated){
+            return;
+        }
+        currentStates.swap(latestStates);
+        currentTime = latestTime;
+        isLatestStateUpdated = false;
+    }
+
+    publishFrame();
+}
+
+
+void SimulationStreamerItemImpl::acceptViewers()
+{
+    if(server){
+        while(server->hasPendingConnections()){
+            Viewer viewer;
+            viewer.socket = server->nextPendingConnection();
+            viewer.needsHeader = (simulatorItem != 0);
+            viewer.needsKeyFrame = true;
+            viewers.push_back(viewer);
+            os << (format(_("%1%: A viewer has connected from %2%."))
+                   % self->name() % viewer.socket->peerAddress().toString().toStdString()) << endl;
+        }
+    }
+
+    vector<Viewer>::iterator p = viewers.begin();
+    while(p != viewers.end()){
+        QTcpSocket* socket = p->socket;
+        if(socket->state() != QAbstractSocket::ConnectedState){
+            socket->deleteLater();
+            p = viewers.erase(p);
+        } else {
+            // The viewers do not send anything to the server
+            if(socket->bytesAvailable() > 0){
+                socket->readAll();
+            }
+            ++p;
+        }
+    }
+}
+
+
+void SimulationStreamerItemImpl::publishFrame()
+{
+    bool isKeyFrameEncoded = false;
+    bool isDeltaFrameEncoded = false;
+    const bool hasLastSentStates = !lastSentStates.empty();
+
+    for(size_t i=0; i < viewers.size(); ++i){
+        Viewer& viewer = viewers[i];
+        QTcpSocket* socket = viewer.socket;
+        if(socket->bytesToWrite() > maxPendingBytes){
+            viewer.needsKeyFrame = true;
+            continue;
+        }
+        if(viewer.needsHeader){
+            socket->write(headerMessage.data(), headerMessage.size());
+            viewer.needsHeader = false;
+            viewer.needsKeyFrame = true;
+        }
+        if(viewer.needsKeyFrame || !hasLastSentStates){
+            if(!isKeyFrameEncoded){
+                encodeFrame(keyFrameMessage, true);
+                isKeyFrameEncoded = true;
+            }
+            socket->write(keyFrameMessage.data(), keyFrameMessage.size());
+            viewer.needsKeyFrame = false;
+        } else {
+            if(!isDeltaFrameEncoded){
+                encodeFrame(deltaFrameMessage, false);
+                isDeltaFrameEncoded = true;
+            }
+            socket->write(deltaFrameMessage.data(), deltaFrameMessage.size());
+        }
+    }
+
+    lastSentStates = currentStates;
+}
+
+
+void SimulationStreamerItemImpl::encodeFrame(string& out_message, bool isKeyFrame)
+{
+    MessageWriter writer(out_message, FRAME);
+    writer.putF64(currentTime);
+    writer.putU8(isKeyFrame ? 1 : 0);
+
+    for(size_t i=0; i < bodies.size(); ++i){
+        StreamedBody& streamed = bodies[i];
+        const StreamedState& state = currentStates[i];
+        const StreamedState* lastState = isKeyFrame ? 0 : &lastSentStates[i];
+
+        size_t countPos = writer.reserveU16();
+        int count = 0;
+        const int numLinks = state.linkValues.size() / LINK_VALUE_SIZE;
+        for(int j=0; j < numLinks; ++j){
+            const float* v = &state.linkValues[j * LINK_VALUE_SIZE];
+            if(!lastState || !std::equal(v, v + LINK_VALUE_SIZE, &lastState->linkValues[j * LINK_VALUE_SIZE])){
+                writer.putU16(j);
+                writer.putF32s(v, LINK_VALUE_SIZE);
+                ++count;
+            }
+        }
+        writer.setU16(countPos, count);
+
+        countPos = writer.reserveU16();
+        count = 0;
+        for(size_t j=0; j < streamed.devices.size(); ++j){
+            const int offset = streamed.deviceOffsets[j];
+            const int size = streamed.deviceOffsets[j + 1] - offset;
+            const float* v = size > 0 ? &state.deviceValues[offset] : 0;
+            if(!lastState || !std::equal(v, v + size, lastState->deviceValues.begin() + offset)){
+                writer.putU16(j);
+                writer.putF32s(v, size);
+                ++count;
+            }
+        }
+        writer.setU16(countPos, count);
+    }
+
+    writer.finish();
+}
+
+
+void SimulationStreamerItem::finalizeSimulation()
+{
+    impl->finalizeSimulation();
+}
+
+
+void SimulationStreamerItemImpl::finalizeSimulation()
+{
+    publishingTimer.stop();
+
+    // The last state is published
+    onPublishingTimeout();
+
+    bodies.clear();
+    simulatorItem = 0;
+}
+
+
+void SimulationStreamerItem::doPutProperties(PutPropertyFunction& putProperty)
+{
+    SubSimulatorItem::doPutProperties(putProperty);
+    impl->doPutProperties(putProperty);
+}
+
+
+void SimulationStreamerItemImpl::doPutProperties(PutPropertyFunction& putProperty)
+{
+    putProperty.min(1).max(65535)(_("Port"), port, boost::bind(&SimulationStreamerItemImpl::onPortChanged, this, _1));
+    putProperty.min(0.1)(_("Frame rate"), frameRate, changeProperty(frameRate));
+    putProperty(_("Target bodies"), bodyNameListString, boost::bind(updateNames, _1, boost::ref(bodyNameListString), boost::ref(bodyNames)));
+    putProperty(_("Target devices"), deviceNameListString, boost::bind(updateNames, _1, boost::ref(deviceNameListString), boost::ref(deviceNames)));
+    putProperty(_("Viewers"), static_cast<int>(viewers.size()));
+}
+
+
+bool SimulationStreamerItemImpl::onPortChanged(int port)
+{
+    if(port < 1 || port > 65535){
+        return false;
+    }
+    if(port != this->port){
+        this->port = port;
+        // The server is reopened with the new port when the next simulation starts
+        self->notifyUpdate();
+    }
+    return true;
+}
+
+
+bool SimulationStreamerItem::store(Archive& archive)
+{
+    SubSimulatorItem::store(archive);
+    return impl->store(archive);
+}
+
+
+bool SimulationStreamerItemImpl::store(Archive& archive)
+{
+    archive.write("port", port);
+    archive.write("frameRate", frameRate);
+    writeElements(archive, "targetBodies", bodyNames, true);
+    writeElements(archive, "targetDevices", deviceNames, true);
+    return true;
+}
+
+
+bool SimulationStreamerItem::restore(const Archive& archive)
+{
+    SubSimulatorItem::restore(archive);
+    return impl->restore(archive);
+}
+
+
+bool SimulationStreamerItemImpl::restore(const Archive& archive)
+{
+    archive.read("port", port);
+    archive.read("frameRate", frameRate);
+    readElements(archive, "targetBodies", bodyNames);
+    bodyNameListString = getNameListString(bodyNames);
+    readElements(archive, "targetDevices", deviceNames);
+    deviceNameListString = getNameListString(deviceNames);
+    return true;
+}
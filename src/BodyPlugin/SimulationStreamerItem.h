@@ -0,0 +1,76 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_SIMULATION_STREAMER_ITEM_H
+#define CNOID_BODYPLUGIN_SIMULATION_STREAMER_ITEM_H
+
+#include "SubSimulatorItem.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SimulationStreamerItemImpl;
+
+/**
+   This item publishes the link positions and the states of the selected devices of the simulated
+   bodies to the viewers connected with TCP, so that a running simulation can be observed from
+   another machine. The simulation thread only copies the states at the streaming frame rate,
+   and the messages are encoded and sent by the main thread.
+
+   Each message consists of a 32-bit length of the rest of the message, an 8-bit message type and
+   the payload. All the numbers are little endian, and a string is a 16-bit length followed by the
+   characters. The following messages are sent.
+
+   - HEADER (1): sent when a simulation starts and when a viewer connects during a simulation.
+     "CNSS", protocol version (u16), the number of the bodies (u16), and for each body, the name,
+     the model file path, the number of the links (u16), the link names, the number of the
+     devices (u16), and for each device, the name, the type name and the state size (u16).
+   - FRAME (2): the time (f64), the key frame flag (u8), and for each body, the number of the
+     link entries (u16), each of which is the link index (u16), the translation (3 x f32) and the
+     rotation quaternion in the order of w, x, y, z (4 x f32), the number of the device entries (u16),
+     each of which is the device index (u16) and the state (state size x f32).
+
+   A key frame contains all the links and the devices. The other frames only contain the ones which
+   have changed since the previous frame, so the state of the viewer is updated by applying the
+   entries to the state given by the last key frame and the following frames. A key frame is sent
+   to a viewer after the header and when the viewer catches up after its frames are dropped
+   because it does not receive them fast enough.
+*/
+class CNOID_EXPORT SimulationStreamerItem : public SubSimulatorItem
+{
+public:
+    static void initializeClass(ExtensionManager* ext);
+
+    SimulationStreamerItem();
+    SimulationStreamerItem(const SimulationStreamerItem& org);
+    ~SimulationStreamerItem();
+
+    void setPort(int port);
+    int port() const;
+    void setFrameRate(double rate);
+    void setTargetBodies(const std::string& bodyNames);
+    //! The device names or the device type names such as "ForceSensor" separated by commas
+    void setTargetDevices(const std::string& deviceNames);
+
+    int numViewers() const;
+
+    virtual bool initializeSimulation(SimulatorItem* simulatorItem);
+    virtual void finalizeSimulation();
+
+protected:
+    virtual Item* doDuplicate() const;
+    virtual void onDisconnectedFromRoot();
+    virtual void doPutProperties(PutPropertyFunction& putProperty);
+    virtual bool store(Archive& archive);
+    virtual bool restore(const Archive& archive);
+
+private:
+    SimulationStreamerItemImpl* impl;
+};
+
+typedef ref_ptr<SimulationStreamerItem> SimulationStreamerItemPtr;
+
+}
+
+#endif
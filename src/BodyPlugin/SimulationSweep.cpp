@@ -0,0 +1,631 @@
+/*!
+  @file
+*/
+
+#include "SimulationSweep.h"
+#include "BatchSimulator.h"
+#include "AISTSimulatorItem.h"
+#include "SubSimulatorItem.h"
+#include "ControllerItem.h"
+#include "WorldLogFileItem.h"
+#include "WorldItem.h"
+#include "BodyItem.h"
+#include <cnoid/RootItem>
+#include <cnoid/ItemList>
+#include <cnoid/Archive>
+#include <cnoid/YAMLReader>
+#include <cnoid/YAMLWriter>
+#include <cnoid/EigenUtil>
+#include <cnoid/TimeMeasure>
+#include <cnoid/MessageView>
+#include <cnoid/OptionManager>
+#include <cnoid/ExtensionManager>
+#include <QEventLoop>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+struct SweepRun
+{
+    string name;
+    MappingPtr itemOverrides;
+    MappingPtr linkOverrides;
+    MappingPtr summary;
+    bool isSucceeded;
+};
+
+struct LinkMass
+{
+    Link* link;
+    double mass;
+};
+
+void onSigOptionsParsed(boost::program_options::variables_map& v)
+{
+    if(v.count("sweep")){
+        SimulationSweep sweep;
+        if(sweep.load(v["sweep"].as<string>())){
+            if(v.count("sweep-output")){
+                sweep.setOutputDirectory(v["sweep-output"].as<string>());
+            }
+            if(v.count("sweep-threads")){
+                sweep.setNumThreads(v["sweep-threads"].as<int>());
+            }
+            sweep.run();
+        }
+    }
+}
+
+}
+
+namespace cnoid {
+
+class SimulationSweepImpl
+{
+public:
+    MessageView* mv;
+    vector<SweepRun> runs;
+    double timeLength;
+    int numThreads;
+    int numThreadsOption;
+    bool isConcurrentExecutionRequested;
+    string outputDirectory;
+    SimulatorItemPtr simulatorItem;
+    WorldItemPtr worldItem;
+    ItemList<BodyItem> bodyItems;
+    map<Item*, ArchivePtr> originalItemStates;
+    vector<LinkMass> originalLinkMasses;
+    int numFailedRuns;
+
+    SimulationSweepImpl();
+    bool load(const string& filename);
+    bool run();
+    bool findItems();
+    bool canExecuteConcurrently();
+    void storeOriginalStates();
+    void restoreOriginalStates();
+    bool restoreItemState(Item* item, const Mapping* overrides);
+    void applyOverrides(SweepRun& run, const Mapping* simulatorOverrides);
+    bool runConcurrently();
+    void setUpBatchRun(int runIndex);
+    void onBatchRunFinished(BatchSimulationRun& run);
+    bool runSequentially();
+    void putBodyStates(Mapping* summary, const vector<Body*>& bodies);
+    void writeSummaries(double computationTime);
+};
+
+}
+
+
+void SimulationSweep::initialize(ExtensionManager* ext)
+{
+    ext->optionManager()
+        .addOption("sweep", boost::program_options::value<string>(),
+                   "run the simulation of the project with the parameters given by a sweep file")
+        .addOption("sweep-output", boost::program_options::value<string>(),
+                   "the directory to which the results of the sweep are written")
+        .addOption("sweep-threads", boost::program_options::value<int>(),
+                   "the number of the sweep runs executed at the same time")
+        .sigOptionsParsed().connect(onSigOptionsParsed);
+}
+
+
+SimulationSweep::SimulationSweep()
+{
+    impl = new SimulationSweepImpl();
+}
+
+
+SimulationSweepImpl::SimulationSweepImpl()
+{
+    mv = MessageView::mainInstance();
+    timeLength = 10.0;
+    numThreads = 0;
+    numThreadsOption = 0;
+    isConcurrentExecutionRequested = true;
+    outputDirectory = "sweep";
+    numFailedRuns = 0;
+}
+
+
+SimulationSweep::~SimulationSweep()
+{
+    delete impl;
+}
+
+
+void SimulationSweep::setOutputDirectory(const std::string& directory)
+{
+    impl->outputDirectory = directory;
+}
+
+
+void SimulationSweep::setNumThreads(int n)
+{
+    impl->numThreadsOption = n;
+}
+
+
+void SimulationSweep::setSimulatorItem(SimulatorItem* simulatorItem)
+{
+    impl->simulatorItem = simulatorItem;
+}
+
+
+int SimulationSweep::numRuns() const
+{
+    return impl->runs.size();
+}
+
+
+int SimulationSweep::numFailedRuns() const
+{
+    return impl->numFailedRuns;
+}
+
+
+bool SimulationSweep::load(const std::string& filename)
+{
+    return impl->load(filename);
+}
+
+
+bool SimulationSweepImpl::load(const string& filename)
+{
+    runs.clear();
+
+    try {
+        YAMLReader reader;
+        if(!reader.load(filename)){
+            mv->putln(MessageView::ERROR,
+                      format(_("The sweep file \"%1%\" cannot be loaded: %2%")) % filename % reader.errorMessage());
+            return false;
+        }
+        const Mapping& sweep = *reader.document()->toMapping();
+        sweep.read("timeLength", timeLength);
+        sweep.read("numThreads", numThreads);
+        sweep.read("concurrent", isConcurrentExecutionRequested);
+
+        const Listing& runList = *sweep.findListing("runs");
+        if(runList.isValid()){
+            for(int i=0; i < runList.size(); ++i){
+                const Mapping& info = *runList[i].toMapping();
+                runs.push_back(SweepRun());
+                SweepRun& run = runs.back();
+                if(!info.read("name", run.name)){
+                    run.name = str(format("run%1$04d") % i);
+                }
+                Mapping* itemOverrides = info.findMapping("items");
+                if(itemOverrides->isValid()){
+                    run.itemOverrides = itemOverrides;
+                }
+                Mapping* linkOverrides = info.findMapping("links");
+                if(linkOverrides->isValid()){
+                    run.linkOverrides = linkOverrides;
+                }
+                run.isSucceeded = false;
+            }
+        }
+    } catch(const ValueNode::Exception& ex){
+        mv->putln(MessageView::ERROR, format(_("The sweep file \"%1%\" is invalid: %2%")) % filename % ex.message());
+        runs.clear();
+        return false;
+    }
+
+    if(runs.empty()){
+        mv->putln(MessageView::WARNING, format(_("The sweep file \"%1%\" has no runs.")) % filename);
+        return false;
+    }
+    return true;
+}
+
+
+bool SimulationSweep::run()
+{
+    return impl->run();
+}
+
+
+bool SimulationSweepImpl::run()
+{
+    numFailedRuns = 0;
+
+    if(runs.empty() || !findItems()){
+        return false;
+    }
+
+    boost::system::error_code error;
+    filesystem::create_directories(filesystem::path(outputDirectory), error);
+    if(error){
+        mv->putln(MessageView::ERROR,
+                  format(_("The output directory \"%1%\" of the sweep cannot be created.")) % outputDirectory);
+        return false;
+    }
+
+    storeOriginalStates();
+
+    TimeMeasure timer;
+    timer.begin();
+
+    bool result;
+    if(canExecuteConcurrently()){
+        result = runConcurrently();
+    } else {
+        result = runSequentially();
+    }
+
+    timer.end();
+    restoreOriginalStates();
+
+    if(result){
+        writeSummaries(timer.time());
+        mv->putln(format(_("The sweep of %1% runs has been finished in %2% [s] (%3% failed). "
+                           "The results are written to \"%4%\"."))
+                  % runs.size() % timer.time() % numFailedRuns % outputDirectory);
+    }
+    return result;
+}
+
+
+bool SimulationSweepImpl::findItems()
+{
+    if(simulatorItem){
+        worldItem = simulatorItem->findOwnerItem<WorldItem>();
+    } else {
+        ItemList<WorldItem> worldItems;
+        if(worldItems.extractChildItems(RootItem::instance())){
+            worldItem = worldItems.front();
+            ItemList<SimulatorItem> simulatorItems;
+            if(simulatorItems.extractChildItems(worldItem)){
+                simulatorItem = simulatorItems.front();
+            }
+        }
+    }
+    if(!worldItem || !simulatorItem){
+        mv->putln(MessageView::ERROR, _("The sweep requires a world item with a simulator item."));
+        return false;
+    }
+    bodyItems.extractChildItems(worldItem);
+    return true;
+}
+
+
+bool SimulationSweepImpl::canExecuteConcurrently()
+{
+    if(!isConcurrentExecutionRequested){
+        return false;
+    }
+    ItemList<ControllerItem> controllerItems;
+    ItemList<SubSimulatorItem> subSimulatorItems;
+    if(!dynamic_cast<AISTSimulatorItem*>(simulatorItem.get()) ||
+       controllerItems.extractChildItems(worldItem) ||
+       subSimulatorItems.extractChildItems(worldItem)){
+        mv->putln(_("The sweep runs are executed one by one because the simulation of the world "
+                    "requires the simulator item."));
+        return false;
+    }
+    return true;
+}
+
+
+/**
+   The states of the items and the masses of the links which are changed by any run
+   are stored before the sweep so that they can be restored after it.
+*/
+void SimulationSweepImpl::storeOriginalStates()
+{
+    originalItemStates.clear();
+    originalLinkMasses.clear();
+
+    vector<Item*> items;
+    items.push_back(simulatorItem.get());
+    ItemList<WorldLogFileItem> logItems;
+    logItems.extractChildItems(worldItem);
+    for(size_t i=0; i < logItems.size(); ++i){
+        items.push_back(logItems[i].get());
+    }
+
+    for(size_t i=0; i < runs.size(); ++i){
+        const Mapping* overrides = runs[i].itemOverrides.get();
+        if(overrides){
+            for(Mapping::const_iterator p = overrides->begin(); p != overrides->end(); ++p){
+                Item* item = worldItem->findItem(p->first);
+                if(item){
+                    items.push_back(item);
+                } else {
+                    mv->putln(MessageView::WARNING,
+                              format(_("Item \"%1%\" of sweep run \"%2%\" is not found.")) % p->first % runs[i].name);
+                }
+            }
+        }
+    }
+    for(size_t i=0; i < items.size(); ++i){
+        Item* item = items[i];
+        if(originalItemStates.find(item) == originalItemStates.end()){
+            ArchivePtr archive = new Archive();
+            archive->initSharedInfo();
+            if(item->store(*archive)){
+                originalItemStates[item] = archive;
+            }
+        }
+    }
+
+    for(size_t i=0; i < bodyItems.size(); ++i){
+        Body* body = bodyItems[i]->body();
+        for(int j=0; j < body->numLinks(); ++j){
+            LinkMass lm;
+            lm.link = body->link(j);
+            lm.mass = lm.link->m();
+            originalLinkMasses.push_back(lm);
+        }
+    }
+}
+
+
+void SimulationSweepImpl::restoreOriginalStates()
+{
+    for(map<Item*, ArchivePtr>::iterator p = originalItemStates.begin(); p != originalItemStates.end(); ++p){
+        restoreItemState(p->first, 0);
+    }
+    for(size_t i=0; i < originalLinkMasses.size(); ++i){
+        originalLinkMasses[i].link->setMass(originalLinkMasses[i].mass);
+    }
+}
+
+
+/**
+   The overrides are applied to a copy of the original state of the item, so that the values
+   overridden by the previous run do not remain in the item.
+*/
+bool SimulationSweepImpl::restoreItemState(Item* item, const Mapping* overrides)
+{
+    map<Item*, ArchivePtr>::iterator p = originalItemStates.find(item);
+    if(p == originalItemStates.end()){
+        return false;
+    }
+    ArchivePtr archive = new Archive();
+    archive->initSharedInfo();
+    archive->insert(p->second.get());
+    if(overrides){
+        archive->insert(overrides);
+    }
+    try {
+        return item->restore(*archive);
+    } catch(const ValueNode::Exception& ex){
+        mv->putln(MessageView::WARNING,
+                  format(_("The parameters of \"%1%\" are not completely applied: %2%")) % item->name() % ex.message());
+    }
+    return false;
+}
+
+
+void SimulationSweepImpl::applyOverrides(SweepRun& run, const Mapping* simulatorOverrides)
+{
+    restoreOriginalStates();
+
+    MappingPtr merged = new Mapping();
+    merged->insert(simulatorOverrides);
+    const Mapping* itemOverrides = run.itemOverrides.get();
+    if(itemOverrides){
+        for(Mapping::const_iterator p = itemOverrides->begin(); p != itemOverrides->end(); ++p){
+            Item* item = worldItem->findItem(p->first);
+            if(!item || !p->second->isMapping()){
+                continue;
+            }
+            if(item == simulatorItem.get()){
+                merged->insert(p->second->toMapping());
+            } else {
+                restoreItemState(item, p->second->toMapping());
+            }
+        }
+    }
+    restoreItemState(simulatorItem.get(), merged.get());
+
+    const Mapping* linkOverrides = run.linkOverrides.get();
+    if(linkOverrides){
+        for(Mapping::const_iterator p = linkOverrides->begin(); p != linkOverrides->end(); ++p){
+            const string& path = p->first;
+            const size_t pos = path.find('/');
+            BodyItem* bodyItem = bodyItems.find(path.substr(0, pos));
+            Link* link = 0;
+            if(bodyItem && pos != string::npos){
+                link = bodyItem->body()->link(path.substr(pos + 1));
+            }
+            if(!link){
+                mv->putln(MessageView::WARNING,
+                          format(_("Link \"%1%\" of sweep run \"%2%\" is not found.")) % path % run.name);
+                continue;
+            }
+            double mass;
+            if(p->second->isMapping() && p->second->toMapping()->read("mass", mass)){
+                link->setMass(mass);
+            }
+        }
+    }
+}
+
+
+/**
+   The bodies and the dynamics parameters of each run are copied from the items when the world
+   of the run is created, so the overrides of the run are applied to the items just before it.
+*/
+bool SimulationSweepImpl::runConcurrently()
+{
+    BatchSimulator batch;
+    batch.setWorldItem(worldItem);
+    batch.setSimulatorItem(static_cast<AISTSimulatorItem*>(simulatorItem.get()));
+    batch.setNumRuns(runs.size());
+    batch.setNumThreads((numThreadsOption > 0) ? numThreadsOption : numThreads);
+    batch.setTimeStep(simulatorItem->worldTimeStep());
+    batch.setTimeLength(timeLength);
+
+    batch.setSetupFunction(boost::bind(&SimulationSweepImpl::setUpBatchRun, this, _1));
+    batch.setFinalizationFunction(boost::bind(&SimulationSweepImpl::onBatchRunFinished, this, _1));
+
+    mv->putln(format(_("Executing %1% sweep runs concurrently ...")) % runs.size());
+    mv->flush();
+
+    if(!batch.run()){
+        return false;
+    }
+    for(size_t i=0; i < runs.size(); ++i){
+        SweepRun& run = runs[i];
+        run.summary = batch.result(i);
+        run.isSucceeded = true;
+    }
+    return true;
+}
+
+
+void SimulationSweepImpl::setUpBatchRun(int runIndex)
+{
+    MappingPtr noOverrides = new Mapping();
+    applyOverrides(runs[runIndex], noOverrides.get());
+}
+
+
+//! Called from the run thread
+void SimulationSweepImpl::onBatchRunFinished(BatchSimulationRun& run)
+{
+    World<ConstraintForceSolver>& world = run.world();
+    vector<Body*> bodies;
+    for(int i=0; i < world.numBodies(); ++i){
+        bodies.push_back(world.body(i));
+    }
+    putBodyStates(run.result(), bodies);
+}
+
+
+bool SimulationSweepImpl::runSequentially()
+{
+    MappingPtr simulatorOverrides = new Mapping();
+    simulatorOverrides->write("realtimeSync", false);
+    simulatorOverrides->write("recording", "off");
+    simulatorOverrides->write("timeRangeMode", "Specified time");
+    simulatorOverrides->write("timeLength", timeLength);
+
+    ItemList<WorldLogFileItem> logItems;
+    logItems.extractChildItems(worldItem);
+
+    for(size_t i=0; i < runs.size(); ++i){
+        SweepRun& run = runs[i];
+        mv->putln(format(_("Sweep run \"%1%\" (%2% / %3%) ...")) % run.name % (i + 1) % runs.size());
+        mv->flush();
+
+        applyOverrides(run, simulatorOverrides.get());
+        for(size_t j=0; j < logItems.size(); ++j){
+            MappingPtr logOverrides = new Mapping();
+            string filename = run.name;
+            if(logItems.size() > 1){
+                filename += "-" + logItems[j]->name();
+            }
+            logOverrides->write("filename", (filesystem::path(outputDirectory) / (filename + ".log")).string());
+            logOverrides->write("timeStampSuffix", false);
+            restoreItemState(logItems[j].get(), logOverrides.get());
+        }
+
+        TimeMeasure timer;
+        QEventLoop eventLoop;
+        Connection connection =
+            simulatorItem->sigSimulationFinished().connect(boost::bind(&QEventLoop::quit, &eventLoop));
+        timer.begin();
+        run.isSucceeded = simulatorItem->startSimulation(true);
+        if(run.isSucceeded){
+            eventLoop.exec();
+        }
+        timer.end();
+        connection.disconnect();
+
+        run.summary = new Mapping();
+        if(!run.isSucceeded){
+            ++numFailedRuns;
+            continue;
+        }
+        run.summary->write("time", simulatorItem->simulationTime());
+        run.summary->write("numSteps", simulatorItem->simulationFrame());
+        run.summary->write("computationTime", timer.time());
+
+        vector<Body*> bodies;
+        const vector<SimulationBody*>& simBodies = simulatorItem->simulationBodies();
+        for(size_t j=0; j < simBodies.size(); ++j){
+            bodies.push_back(simBodies[j]->body());
+        }
+        putBodyStates(run.summary, bodies);
+    }
+
+    return true;
+}
+
+
+void SimulationSweepImpl::putBodyStates(Mapping* summary, const vector<Body*>& bodies)
+{
+    Mapping* bodyStates = summary->createMapping("bodies");
+    for(size_t i=0; i < bodies.size(); ++i){
+        Body* body = bodies[i];
+        Mapping* state = bodyStates->createMapping(body->name());
+        Link* rootLink = body->rootLink();
+        Listing& p = *state->createFlowStyleListing("rootPosition");
+        for(int j=0; j < 3; ++j){
+            p.append(rootLink->p()[j]);
+        }
+        const Vector3 rpy = rpyFromRot(rootLink->R());
+        Listing& r = *state->createFlowStyleListing("rootAttitude");
+        for(int j=0; j < 3; ++j){
+            r.append(rpy[j]);
+        }
+        if(body->numJoints() > 0){
+            Listing& q = *state->createFlowStyleListing("jointPositions");
+            for(int j=0; j < body->numJoints(); ++j){
+                q.append(body->joint(j)->q(), 10, body->numJoints());
+            }
+        }
+    }
+}
+
+
+void SimulationSweepImpl::writeSummaries(double computationTime)
+{
+    const filesystem::path directory(outputDirectory);
+
+    MappingPtr summary = new Mapping();
+    summary->write("numRuns", (int)runs.size());
+    summary->write("numFailedRuns", numFailedRuns);
+    summary->write("computationTime", computationTime);
+    Listing& runList = *summary->createListing("runs");
+
+    for(size_t i=0; i < runs.size(); ++i){
+        SweepRun& run = runs[i];
+        const string filename = run.name + ".yaml";
+        Mapping* info = runList.newMapping();
+        info->write("name", run.name);
+        info->write("succeeded", run.isSucceeded);
+        info->write("file", filename);
+
+        MappingPtr result = new Mapping();
+        result->write("name", run.name);
+        if(run.itemOverrides){
+            result->insert("items", run.itemOverrides.get());
+        }
+        if(run.linkOverrides){
+            result->insert("links", run.linkOverrides.get());
+        }
+        if(run.summary){
+            result->insert(run.summary.get());
+        }
+        YAMLWriter writer((directory / filename).string());
+        writer.setKeyOrderPreservationMode(true);
+        writer.putNode(result.get());
+    }
+
+    YAMLWriter writer((directory / "summary.yaml").string());
+    writer.setKeyOrderPreservationMode(true);
+    writer.putNode(summary.get());
+}
@@ -0,0 +1,82 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_BODYPLUGIN_SIMULATION_SWEEP_H
+#define CNOID_BODYPLUGIN_SIMULATION_SWEEP_H
+
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ExtensionManager;
+class SimulatorItem;
+class SimulationSweepImpl;
+
+/**
+   This class runs the simulation of the loaded project many times with the different
+   parameters given by a sweep file, and writes the summary of each run to a directory.
+   The sweep file is a YAML file as follows:
+
+   \verbatim
+   timeLength: 10.0
+   numThreads: 0        # The number of the runs executed at the same time
+   concurrent: true     # false for running the sweep with the simulator item one by one
+   runs:
+     -
+       name: lowFriction
+       items:           # The archive keys of the items in the world, given by the item names
+         AISTSimulator: { staticFriction: 0.3, dynamicFriction: 0.3 }
+       links:           # The properties of the links, given by "body item name/link name"
+         box1/WAIST: { mass: 2.0 }
+   \endverbatim
+
+   The runs are executed concurrently by BatchSimulator when the simulator is AISTSimulatorItem
+   and the world has no controller items and no sub simulator items. Otherwise the runs are
+   executed one by one by the simulator item. In the latter case, the log file of each run is
+   written to the output directory if the world has a WorldLogFileItem.
+   The items and the links are restored to their original states after the sweep.
+
+   The sweep can be executed from the command line with the following options:
+   --sweep <file> [--sweep-output <directory>] [--sweep-threads <n>] [--quit]
+*/
+class CNOID_EXPORT SimulationSweep
+{
+public:
+    static void initialize(ExtensionManager* ext);
+
+    SimulationSweep();
+    ~SimulationSweep();
+
+    bool load(const std::string& filename);
+
+    //! The default directory is "sweep" in the current directory
+    void setOutputDirectory(const std::string& directory);
+
+    //! A positive value overrides "numThreads" of the sweep file
+    void setNumThreads(int n);
+
+    /**
+       The simulator item in the first world item of the project is used if this is not specified.
+    */
+    void setSimulatorItem(SimulatorItem* simulatorItem);
+
+    /**
+       Executes all the runs. This function returns when all the runs are finished.
+    */
+    bool run();
+
+    int numRuns() const;
+    int numFailedRuns() const;
+
+private:
+    SimulationSweepImpl* impl;
+
+    SimulationSweep(const SimulationSweep& org);
+    SimulationSweep& operator=(const SimulationSweep& rhs);
+};
+
+}
+
+#endif
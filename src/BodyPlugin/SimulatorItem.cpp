@@ -14,6 +14,9 @@
 #include "CollisionSeq.h"
 #include "CollisionSeqItem.h"
 #include "CollisionSeqEngine.h"
+#include "SimulationCommandQueue.h"
+#include <cnoid/BodyCollisionDetectorUtil>
+#include <cnoid/ContactBuffer>
 #include <cnoid/AppUtil>
 #include <cnoid/ExtensionManager>
 #include <cnoid/TimeBar>
@@ -22,16 +25,26 @@
 #include <cnoid/LazyCaller>
 #include <cnoid/Archive>
 #include <cnoid/MultiDeviceStateSeq>
+#include <cnoid/DeviceStateEncoder>
 #include <cnoid/Deque2D>
 #include <cnoid/ConnectionSet>
 #include <cnoid/Sleep>
 #include <cnoid/Timer>
 #include <cnoid/BodyState>
+#include <cnoid/SimulationProfiler>
+#include <cnoid/Profiler>
+#include <cnoid/AllocationTracker>
+#include <cnoid/ProfiledMutex>
+#include <cnoid/RealtimeSynchronizer>
+#include <cnoid/TaskScheduler>
+#include <cnoid/ConcurrentFunctionSet>
 #include <QThread>
-#include <QMutex>
 #include <boost/thread.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/tokenizer.hpp>
+#include <boost/lexical_cast.hpp>
 
 #ifdef ENABLE_SIMULATION_PROFILING
 #include <cnoid/ViewManager>
@@ -56,15 +69,26 @@ namespace {
 
 typedef Deque2D<SE3, Eigen::aligned_allocator<SE3> > MultiSE3Deque;
 
+// The recorded sequences larger than this are stored in temporary files in the file-mapped recording
+const size_t fileMappedRecordingThreshold = 64 * 1024 * 1024;
+
 typedef map<weak_ref_ptr<BodyItem>, SimulationBodyPtr> BodyItemToSimBodyMap;
 
+bool loadPendingFile(Item* item)
+{
+    item->loadPendingFile();
+    return false;
+}
+
 struct FunctionSet
 {
     struct FunctionInfo {
         int id;
         boost::function<void()> function;
+        bool hasDependency;
+        FunctionDependency dependency;
     };
-    vector<FunctionInfo> functions;
+    ConcurrentFunctionSet functions;
     boost::mutex mutex;
     SimulatorItemImpl* simImpl;
     int idCounter;
@@ -89,17 +113,35 @@ struct FunctionSet
         if(needToUpdate){
             updateFunctions();
         }
-        const size_t n = functions.size();
-        for(size_t i=0; i < n; ++i){
-            functions[i].function();
-        }
+        functions.call();
     }
 
-    int add(boost::function<void()>& func);
+    int add(boost::function<void()>& func, const FunctionDependency* dependency = 0);
+    void addToFunctions(FunctionInfo& info);
     void remove(int id);
     void updateFunctions();
 };
 
+/**
+   The IO given to a controller whose control period is longer than the world time step
+*/
+class MultiRateControllerIO : public ControllerItemIO
+{
+public:
+    ControllerItem* controller;
+    ControllerItemIO* baseIO;
+    double controlPeriod;
+
+    MultiRateControllerIO(ControllerItem* controller, ControllerItemIO* baseIO, double controlPeriod)
+        : controller(controller), baseIO(baseIO), controlPeriod(controlPeriod) { }
+    virtual Body* body() { return baseIO->body(); }
+    virtual double timeStep() const { return controlPeriod; }
+    virtual double currentTime() const { return baseIO->currentTime(); }
+    virtual std::string optionString() const { return baseIO->optionString(); }
+};
+
+typedef boost::shared_ptr<MultiRateControllerIO> MultiRateControllerIOPtr;
+
 }
 
 namespace cnoid {
@@ -111,6 +153,7 @@ public:
     BodyPtr body_;
     BodyItemPtr bodyItem;
     vector<ControllerItemPtr> controllers;
+    vector<MultiRateControllerIOPtr> multiRateControllerIOs;
     double frameRate;
     SimulatorItemImpl* simImpl;
 
@@ -119,10 +162,15 @@ public:
 
     Deque2D<double> jointPosBuf;
     MultiSE3Deque linkPosBuf;
+    int jointPosRecordingInterval;
+    int linkPosRecordingInterval;
+    bool isResultOutputDisabled;
     vector<Device*> devicesToNotifyResults;
-    ScopedConnectionSet deviceStateConnections;
+    ScopedConnection deviceStatesConnection;
     boost::dynamic_bitset<> deviceStateChangeFlag;
     Deque2D<DeviceStatePtr> deviceStateBuf;
+    vector<int> deviceStateRecordingIntervals;
+    vector<int> framesSinceDeviceStateRecorded;
 
     ItemPtr parentOfResultItems;
     string resultItemPrefix;
@@ -138,6 +186,8 @@ public:
     bool initialize(SimulatorItemImpl* simImpl, BodyItem* bodyItem);
     bool initialize(SimulatorItemImpl* simImpl, ControllerItem* controllerItem);
     void extractAssociatedItems(bool doReset);
+    ControllerItemIO* setupControllerIO(ControllerItem* controller, ControllerItemIO* baseIO);
+    ControllerItemIO* findControllerIO(ControllerItem* controller, ControllerItemIO* baseIO);
     void copyStateToBodyItem();
     void cloneShapesOnce();
     void initializeResultData();
@@ -145,7 +195,7 @@ public:
     void initializeResultItems();
     void setInitialStateOfBodyMotion(const BodyMotionPtr& bodyMotion);
     void setActive(bool on);
-    void onDeviceStateChanged(int deviceIndex);
+    void onDeviceStatesChanged(const vector<unsigned char>& flags);
     void bufferResults();
     void flushResults();
     void flushResultsToBodyMotionItems();
@@ -161,6 +211,38 @@ public:
 };
 
 
+class SimulationCheckpointImpl
+{
+public:
+    struct LinkState {
+        Vector3 p;
+        Matrix3 R;
+        Vector3 v;
+        Vector3 w;
+        Vector3 dv;
+        Vector3 dw;
+        Vector3 f_ext;
+        Vector3 tau_ext;
+        double q;
+        double dq;
+        double ddq;
+        double u;
+    };
+    struct SimBodyState {
+        SimulationBodyPtr simBody;
+        vector<LinkState> links;
+        vector<DeviceStatePtr> devices;
+    };
+
+    SimulatorItem* simulatorItem;
+    int frame;
+    double time;
+    vector<SimBodyState> simBodyStates;
+    vector< pair<ControllerItemPtr, ReferencedPtr> > controllerStates;
+    ReferencedPtr simulatorState;
+};
+
+
 class SimulatorItemImpl : public QThread, public ControllerItemIO
 {
 public:
@@ -191,9 +273,17 @@ public:
     ItemList<SubSimulatorItem> subSimulatorItems;
 
     vector<ControllerItem*> activeControllers;
+
+    // The controllers executed by the control thread in the concurrent control loop
+    vector<ControllerItem*> serialControllers;
+    // The groups of the parallel control enabled controllers of each body
+    vector< vector<ControllerItem*> > parallelControllerGroups;
+    vector<char> parallelControlResults;
+    bool hasMultiRateControllers;
+    bool hasDueControllers;
     boost::thread controlThread;
-    boost::condition_variable controlCondition;
-    boost::mutex controlMutex;
+    ProfiledConditionVariable controlCondition;
+    ProfiledMutex controlMutex;
     bool isExitingControlLoopRequested;
     bool isControlRequested;
     bool isControlFinished;
@@ -203,7 +293,9 @@ public:
     CollisionDetectorPtr collisionDetector;
 
     CollisionSeqPtr collisionSeq;
-    deque<CollisionLinkPairListPtr> collisionPairsBuf;
+    ContactBuffer contacts;
+    vector<ContactBuffer> contactsBuf;
+    int numBufferedContactFrames;
 
     Selection recordingMode;
     Selection timeRangeMode;
@@ -216,19 +308,61 @@ public:
     bool useControllerThreadsProperty;
     bool isAllLinkPositionOutputMode;
     bool isDeviceStateOutputEnabled;
+    bool isFileMappedRecordingEnabled;
+    Selection visionDataCompression;
+    bool isVisionDataCompressionEnabled;
+    DeviceStateEncoder deviceStateEncoder;
     bool isDoingSimulationLoop;
     volatile bool stopRequested;
     volatile bool pauseRequested;
+    bool isSteppingMode;
     bool isRealtimeSyncMode;
+    RealtimeSynchronizer realtimeSynchronizer;
+    bool isDeterministicMode;
     bool needToUpdateSimBodyLists;
     bool hasActiveFreeBodies;
     bool recordCollisionData;
+    bool isOfflineCollisionDetectionEnabled;
+    bool isCollisionRecordingInLoop;
 
     string controllerOptionString_;
+    map<string, int> deviceStateRecordingIntervals;
+    int linkPositionRecordingInterval;
+    int jointPositionRecordingInterval;
+    map<string, int> bodyRecordingIntervals;
+    bool isResultDecimationEnabled;
+
+    // The request to create or restore a checkpoint, which is processed by the simulation thread
+    boost::mutex checkpointRequestMutex;
+    boost::mutex checkpointMutex;
+    boost::condition_variable checkpointCondition;
+    volatile bool isCheckpointRequested;
+    bool isCheckpointRequestProcessed;
+    SimulationCheckpointPtr checkpointToRestore;
+    SimulationCheckpointPtr createdCheckpoint;
+    bool checkpointResult;
+
+    // The request to advance the paused simulation, which is processed by the simulation thread
+    boost::mutex stepRequestMutex;
+    boost::mutex stepMutex;
+    boost::condition_variable stepCondition;
+    int numRequestedSteps;
+    int numProcessedSteps;
+    bool isStepRequestProcessed;
+
+    SimulationProfiler profiler;
+    bool isStepProfilingEnabled;
+    string profileOutputFile;
+    enum ProfilingStageID {
+        PRE_DYNAMICS_STAGE, CONTROLLER_INPUT_STAGE, CONTROLLER_CONTROL_STAGE, CONTROLLER_OUTPUT_STAGE,
+        MID_DYNAMICS_STAGE, DYNAMICS_STAGE, CONTROL_WAIT_STAGE, POST_DYNAMICS_STAGE,
+        RESULT_BUFFERING_STAGE, NUM_PROFILING_STAGES
+    };
+    int profilingStageIds[NUM_PROFILING_STAGES];
 
     TimeBar* timeBar;
     int fillLevelId;
-    QMutex resultBufMutex;
+    ProfiledMutex resultBufMutex;
     double actualSimulationTime;
     double finishTime;
     MessageView* mv;
@@ -244,18 +378,12 @@ public:
     double nextLogTime;
     double logTimeStep;
     
-    boost::optional<int> extForceFunctionId;
-    boost::mutex extForceMutex;
     struct ExtForceInfo {
         Link* link;
         Vector3 point;
         Vector3 f;
         double time;
     };
-    ExtForceInfo extForceInfo;
-
-    boost::optional<int> virtualElasticStringFunctionId;
-    boost::mutex virtualElasticStringMutex;
     struct VirtualElasticString {
         Link* link;
         double kp;
@@ -264,6 +392,23 @@ public:
         Vector3 point;
         Vector3 goal;
     };
+
+    // The inputs from the main thread, which are applied at the beginning of a simulation step
+    struct InputCommand {
+        enum Type {
+            SET_EXTERNAL_FORCE, CLEAR_EXTERNAL_FORCES,
+            SET_VIRTUAL_ELASTIC_STRING, CLEAR_VIRTUAL_ELASTIC_STRINGS
+        };
+        int type;
+        ExtForceInfo extForce;
+        VirtualElasticString virtualElasticString;
+    };
+    SimulationCommandQueue<InputCommand> inputCommandQueue;
+
+    // The following states are only accessed by the simulation thread
+    bool isExtForceActive;
+    ExtForceInfo extForceInfo;
+    bool isVirtualElasticStringActive;
     VirtualElasticString virtualElasticString;
 
     vector<BodyMotionEnginePtr> bodyMotionEngines;
@@ -289,20 +434,37 @@ public:
     virtual void run();
     void onSimulationLoopStarted();
     void updateSimBodyLists();
+    void updateControlDueFlags();
+    static void callInput(ControllerItem* controller);
+    static bool callControl(ControllerItem* controller);
+    static void callOutput(ControllerItem* controller);
+    bool updateControlTimeStatistics();
     bool stepSimulationMain();
     void concurrentControlLoop();
+    void controlParallelControllerGroup(int groupIndex);
     void flushResults();
     void stopSimulation(bool doSync);
     void pauseSimulation();
     void restartSimulation();
     void onSimulationLoopStopped();
     void setExternalForce(BodyItem* bodyItem, Link* link, const Vector3& point, const Vector3& f, double time);
+    void applyInputCommands();
     void doSetExternalForce();
     void setVirtualElasticString(
         BodyItem* bodyItem, Link* link, const Vector3& attachmentPoint, const Vector3& endPoint);
     void setVirtualElasticStringForce();
     bool onRealtimeSyncChanged(bool on);
+    bool onRealtimeSyncSpinTimeChanged(double time);
+    bool onSimulationThreadPriorityChanged(int priority);
+    bool onSimulationThreadCpuChanged(int cpu);
+    void putRealtimeSyncStatistics();
     bool onAllLinkPositionOutputModeChanged(bool on);
+    string getDeviceStateRecordingIntervalString() const;
+    bool setDeviceStateRecordingIntervalString(const string& str);
+    string getBodyRecordingIntervalString() const;
+    bool setBodyRecordingIntervalString(const string& str);
+    bool onLinkPositionRecordingIntervalChanged(int interval);
+    bool onJointPositionRecordingIntervalChanged(int interval);
     bool setSpecifiedRecordingTimeLength(double length);
     bool store(Archive& archive);
     bool restore(const Archive& archive);
@@ -310,6 +472,16 @@ public:
     void addBodyMotionEngine(BodyMotionItem* motionItem);
     bool setPlaybackTime(double time);
     void addCollisionSeqEngine(CollisionSeqItem* collisionSeqItem);
+    void detectCollisionsOfRecordedMotions();
+    SimulationCheckpointPtr createCheckpoint();
+    bool restoreCheckpoint(SimulationCheckpoint* checkpoint);
+    bool requestCheckpointOperation(SimulationCheckpoint* checkpoint, SimulationCheckpointPtr& out_created);
+    void processCheckpointRequest();
+    int stepSimulation(int numSteps);
+    bool processStepRequest(int& frame, double& elapsedTime);
+    void wakeUpPausedLoop();
+    SimulationCheckpoint* doCreateCheckpoint();
+    bool doRestoreCheckpoint(SimulationCheckpoint* checkpoint);
 
     // Functions defined in the ControllerItemIO class
     virtual Body* body();
@@ -476,6 +648,9 @@ SimulationBodyImpl::SimulationBodyImpl(SimulationBody* self, Body* body)
     simImpl = 0;
     areShapesCloned = false;
     isActive = false;
+    jointPosRecordingInterval = 1;
+    linkPosRecordingInterval = 1;
+    isResultOutputDisabled = false;
 }
 
 
@@ -541,8 +716,9 @@ bool SimulationBodyImpl::initialize(SimulatorItemImpl* simImpl, BodyItem* bodyIt
     this->simImpl = simImpl;
     this->bodyItem = bodyItem;
     frameRate = simImpl->worldFrameRate;
-    deviceStateConnections.disconnect();
+    deviceStatesConnection.disconnect();
     controllers.clear();
+    multiRateControllerIOs.clear();
     resultItemPrefix = simImpl->self->name() + "-" + bodyItem->name();
     
     bool doReset = simImpl->doReset && !body_->isStaticModel();
@@ -571,7 +747,7 @@ void SimulationBodyImpl::extractAssociatedItems(bool doReset)
         Item* srcItem = *iter;
         ControllerItem* controllerItem = 0;
         if(controllerItem = dynamic_cast<ControllerItem*>(srcItem)){
-            if(controllerItem->initialize(this)){
+            if(controllerItem->initialize(setupControllerIO(controllerItem, this))){
                 controllers.push_back(controllerItem);
             } else {
                 controllerItem = 0;
@@ -610,6 +786,42 @@ void SimulationBodyImpl::extractAssociatedItems(bool doReset)
 }
 
 
+/**
+   The control interval of the controller is determined here. The returned IO is the base IO
+   if the controller is called every step. Otherwise it is the IO whose time step is the control period.
+*/
+ControllerItemIO* SimulationBodyImpl::setupControllerIO(ControllerItem* controller, ControllerItemIO* baseIO)
+{
+    const double dt = simImpl->worldTimeStep_;
+    int interval = 1;
+    if(controller->controlPeriod() > 0.0){
+        interval = std::max(1, (int)(controller->controlPeriod() / dt + 0.5));
+    }
+    controller->controlInterval_ = interval;
+    controller->isControlDue_ = true;
+    controller->lastControlResult_ = false;
+    controller->resetControlTimeStatistics();
+
+    if(interval == 1){
+        return baseIO;
+    }
+    MultiRateControllerIOPtr io = boost::make_shared<MultiRateControllerIO>(controller, baseIO, interval * dt);
+    multiRateControllerIOs.push_back(io);
+    return io.get();
+}
+
+
+ControllerItemIO* SimulationBodyImpl::findControllerIO(ControllerItem* controller, ControllerItemIO* baseIO)
+{
+    for(size_t i=0; i < multiRateControllerIOs.size(); ++i){
+        if(multiRateControllerIOs[i]->controller == controller){
+            return multiRateControllerIOs[i].get();
+        }
+    }
+    return baseIO;
+}
+
+
 void SimulationBodyImpl::copyStateToBodyItem()
 {
     BodyState state(*body_);
@@ -655,28 +867,65 @@ void SimulationBody::initializeResultBuffers()
 
 void SimulationBodyImpl::initializeResultBuffers()
 {
-    jointPosBuf.resizeColumn(body_->numAllJoints());
-    const int numLinksToRecord = simImpl->isAllLinkPositionOutputMode ? body_->numLinks() : 1;
-    linkPosBuf.resizeColumn(numLinksToRecord);
+    jointPosRecordingInterval = 1;
+    linkPosRecordingInterval = 1;
+    isResultOutputDisabled = false;
+    if(simImpl->isResultDecimationEnabled){
+        jointPosRecordingInterval = simImpl->jointPositionRecordingInterval;
+        linkPosRecordingInterval = simImpl->linkPositionRecordingInterval;
+        map<string, int>::const_iterator p = simImpl->bodyRecordingIntervals.find(bodyItem->name());
+        if(p != simImpl->bodyRecordingIntervals.end()){
+            if(p->second == 0){
+                isResultOutputDisabled = true;
+            } else {
+                jointPosRecordingInterval = p->second;
+                linkPosRecordingInterval = p->second;
+            }
+        }
+    }
+
+    if(isResultOutputDisabled){
+        jointPosBuf.clear();
+        linkPosBuf.clear();
+    } else {
+        jointPosBuf.resizeColumn(body_->numAllJoints());
+        const int numLinksToRecord = simImpl->isAllLinkPositionOutputMode ? body_->numLinks() : 1;
+        linkPosBuf.resizeColumn(numLinksToRecord);
+    }
 
     const DeviceList<>& devices = body_->devices();
     const int numDevices = devices.size();
-    deviceStateConnections.disconnect();
+    deviceStatesConnection.disconnect();
     deviceStateChangeFlag.reset();
     deviceStateChangeFlag.resize(numDevices, true); // set all the bits to store the initial states
     devicesToNotifyResults.clear();
     
-    if(devices.empty() || !simImpl->isDeviceStateOutputEnabled){
+    if(devices.empty() || !simImpl->isDeviceStateOutputEnabled || isResultOutputDisabled){
         deviceStateBuf.clear();
         prevFlushedDeviceStateInDirectMode.clear();
+        deviceStateRecordingIntervals.clear();
+        framesSinceDeviceStateRecorded.clear();
     } else {
         // This buf always has the first element to keep unchanged states
         deviceStateBuf.resize(1, numDevices); 
         prevFlushedDeviceStateInDirectMode.resize(numDevices);
+        deviceStateRecordingIntervals.resize(numDevices);
+        framesSinceDeviceStateRecorded.resize(numDevices);
+        deviceStatesConnection.reset(
+            body_->sigDeviceStatesChanged().connect(
+                boost::bind(&SimulationBodyImpl::onDeviceStatesChanged, this, _1)));
         for(size_t i=0; i < devices.size(); ++i){
-            deviceStateConnections.add(
-                devices[i]->sigStateChanged().connect(
-                    boost::bind(&SimulationBodyImpl::onDeviceStateChanged, this, i)));
+            // The states are not decimated when they are only output to the body items
+            int interval = 1;
+            if(simImpl->isRecordingEnabled){
+                map<string, int>::const_iterator p =
+                    simImpl->deviceStateRecordingIntervals.find(devices[i]->typeName());
+                if(p != simImpl->deviceStateRecordingIntervals.end()){
+                    interval = p->second;
+                }
+            }
+            deviceStateRecordingIntervals[i] = interval;
+            framesSinceDeviceStateRecorded[i] = interval; // to record the initial state
         }
     }
 }
@@ -690,7 +939,7 @@ void SimulationBody::initializeResultItems()
 
 void SimulationBodyImpl::initializeResultItems()
 {
-    if(!parentOfResultItems){
+    if(!parentOfResultItems || isResultOutputDisabled){
         return;
     }
     
@@ -708,8 +957,15 @@ void SimulationBodyImpl::initializeResultItems()
     motion->setOffsetTime(0.0);
     simImpl->addBodyMotionEngine(motionItem);
     jointPosResults = motion->jointPosSeq();
+    jointPosResults->setFrameRate(frameRate / jointPosRecordingInterval);
     linkPosResultItem = motionItem->linkPosSeqItem();
     linkPosResults = motion->linkPosSeq();
+    linkPosResults->setFrameRate(frameRate / linkPosRecordingInterval);
+
+    const size_t mappingThreshold =
+        simImpl->isFileMappedRecordingEnabled ? fileMappedRecordingThreshold : 0;
+    jointPosResults->setFileMappingThreshold(mappingThreshold);
+    linkPosResults->setFileMappingThreshold(mappingThreshold);
 
     const int numDevices = deviceStateBuf.colSize();
     if(numDevices == 0 || !simImpl->isDeviceStateOutputEnabled){
@@ -754,6 +1010,7 @@ bool SimulationBodyImpl::initialize(SimulatorItemImpl* simImpl, ControllerItem*
 {
     this->simImpl = simImpl;
     this->controllers.push_back(controllerItem);
+    multiRateControllerIOs.clear();
     frameRate = simImpl->worldFrameRate;
     linkPosBuf.resizeColumn(0);
     return true;
@@ -796,15 +1053,24 @@ void SimulationBodyImpl::setActive(bool on)
 
 void SimulationBody::notifyUnrecordedDeviceStateChange(Device* device)
 {
-    bool flag = impl->deviceStateChangeFlag[device->index()];
+    Body* body = impl->body_;
+    const int index = device->index();
+    const bool flag = body->deviceStateChangeFlags()[index];
     device->notifyStateChange();
-    impl->deviceStateChangeFlag[device->index()] = flag;
+    if(!flag){
+        body->clearDeviceStateChangeFlag(index);
+    }
 }
 
 
-void SimulationBodyImpl::onDeviceStateChanged(int deviceIndex)
+void SimulationBodyImpl::onDeviceStatesChanged(const vector<unsigned char>& flags)
 {
-    deviceStateChangeFlag.set(deviceIndex);
+    const int n = std::min(flags.size(), deviceStateChangeFlag.size());
+    for(int i=0; i < n; ++i){
+        if(flags[i]){
+            deviceStateChangeFlag.set(i);
+        }
+    }
 }
 
 
@@ -816,16 +1082,27 @@ void SimulationBody::bufferResults()
 
 void SimulationBodyImpl::bufferResults()
 {
-    if(jointPosBuf.colSize() > 0){
+    // The state changes of the devices in the step are published together
+    body_->notifyDeviceStateChanges();
+    
+    if(isResultOutputDisabled){
+        return;
+    }
+
+    const int frame = simImpl->currentFrame;
+    
+    if(jointPosBuf.colSize() > 0 && frame % jointPosRecordingInterval == 0){
         Deque2D<double>::Row q = jointPosBuf.append();
         for(int i=0; i < q.size() ; ++i){
             q[i] = body_->joint(i)->q();
         }
     }
-    MultiSE3Deque::Row pos = linkPosBuf.append();
-    for(int i=0; i < linkPosBuf.colSize(); ++i){
-        Link* link = body_->link(i);
-        pos[i].set(link->p(), link->R());
+    if(frame % linkPosRecordingInterval == 0){
+        MultiSE3Deque::Row pos = linkPosBuf.append();
+        for(int i=0; i < linkPosBuf.colSize(); ++i){
+            Link* link = body_->link(i);
+            pos[i].set(link->p(), link->R());
+        }
     }
 
     if(deviceStateBuf.colSize() > 0){
@@ -834,9 +1111,17 @@ void SimulationBodyImpl::bufferResults()
         Deque2D<DeviceStatePtr>::Row prev = deviceStateBuf[prevIndex];
         const DeviceList<>& devices = body_->devices();
         for(size_t i=0; i < devices.size(); ++i){
-            if(deviceStateChangeFlag[i]){
+            int& frames = framesSinceDeviceStateRecorded[i];
+            if(frames < deviceStateRecordingIntervals[i]){
+                ++frames;
+            }
+            if(deviceStateChangeFlag[i] && frames >= deviceStateRecordingIntervals[i]){
                 current[i] = devices[i]->cloneState();
+                if(simImpl->isVisionDataCompressionEnabled){
+                    simImpl->deviceStateEncoder.encodeLater(current[i]);
+                }
                 deviceStateChangeFlag.reset(i);
+                frames = 0;
             } else {
                 current[i] = prev[i];
             }
@@ -853,6 +1138,10 @@ void SimulationBody::flushResults()
 
 void SimulationBodyImpl::flushResults()
 {
+    if(isResultOutputDisabled){
+        return;
+    }
+    
     if(simImpl->isRecordingEnabled){
         flushResultsToBodyMotionItems();
     } else {
@@ -876,20 +1165,22 @@ void SimulationBodyImpl::flushResultsToBodyMotionItems()
     }
 
     const int ringBufferSize = simImpl->ringBufferSize;
-    const int numBufFrames = linkPosBuf.rowSize();
 
-    for(int i=0; i < numBufFrames; ++i){
+    // The ring buffers of the decimated sequences cover the same time length
+    const int linkPosRingBufferSize = std::max(1, ringBufferSize / linkPosRecordingInterval);
+    for(int i=0; i < linkPosBuf.rowSize(); ++i){
         MultiSE3Deque::Row buf = linkPosBuf.row(i);
-        if(linkPosResults->numFrames() >= ringBufferSize){
+        if(linkPosResults->numFrames() >= linkPosRingBufferSize){
             linkPosResults->popFrontFrame();
         }
         std::copy(buf.begin(), buf.end(), linkPosResults->appendFrame().begin());
     }
             
     if(jointPosBuf.colSize() > 0){
-        for(int i=0; i < numBufFrames; ++i){
+        const int jointPosRingBufferSize = std::max(1, ringBufferSize / jointPosRecordingInterval);
+        for(int i=0; i < jointPosBuf.rowSize(); ++i){
             Deque2D<double>::Row buf = jointPosBuf.row(i);
-            if(jointPosResults->numFrames() >= ringBufferSize){
+            if(jointPosResults->numFrames() >= jointPosRingBufferSize){
                 jointPosResults->popFrontFrame();
             }
             std::copy(buf.begin(), buf.end(), jointPosResults->appendFrame().begin());
@@ -1021,12 +1312,26 @@ SimulatorItem::SimulatorItem(const SimulatorItem& org)
     impl = new SimulatorItemImpl(this);
 
     impl->isRealtimeSyncMode = org.impl->isRealtimeSyncMode;
+    impl->realtimeSynchronizer.setSpinTime(org.impl->realtimeSynchronizer.spinTime());
+    impl->realtimeSynchronizer.setThreadPriority(org.impl->realtimeSynchronizer.threadPriority());
+    impl->realtimeSynchronizer.setCpuAffinity(org.impl->realtimeSynchronizer.cpuAffinity());
+    impl->isDeterministicMode = org.impl->isDeterministicMode;
+    impl->isSteppingMode = org.impl->isSteppingMode;
     impl->isAllLinkPositionOutputMode = org.impl->isAllLinkPositionOutputMode;
     impl->isDeviceStateOutputEnabled = org.impl->isDeviceStateOutputEnabled;
+    impl->isFileMappedRecordingEnabled = org.impl->isFileMappedRecordingEnabled;
+    impl->visionDataCompression = org.impl->visionDataCompression;
+    impl->deviceStateRecordingIntervals = org.impl->deviceStateRecordingIntervals;
+    impl->linkPositionRecordingInterval = org.impl->linkPositionRecordingInterval;
+    impl->jointPositionRecordingInterval = org.impl->jointPositionRecordingInterval;
+    impl->bodyRecordingIntervals = org.impl->bodyRecordingIntervals;
     impl->recordingMode = org.impl->recordingMode;
     impl->timeRangeMode = org.impl->timeRangeMode;
     impl->useControllerThreadsProperty = org.impl->useControllerThreadsProperty;
     impl->recordCollisionData = org.impl->recordCollisionData;
+    impl->isOfflineCollisionDetectionEnabled = org.impl->isOfflineCollisionDetectionEnabled;
+    impl->isStepProfilingEnabled = org.impl->isStepProfilingEnabled;
+    impl->profileOutputFile = org.impl->profileOutputFile;
 }
 
 
@@ -1037,15 +1342,29 @@ SimulatorItemImpl::SimulatorItemImpl(SimulatorItem* self)
       preDynamicsFunctions(this),
       midDynamicsFunctions(this),
       postDynamicsFunctions(this),
+      controlCondition("Control"),
+      controlMutex("Control"),
       recordingMode(SimulatorItem::N_RECORDING_MODES, CNOID_GETTEXT_DOMAIN_NAME),
       timeRangeMode(SimulatorItem::N_TIME_RANGE_MODES, CNOID_GETTEXT_DOMAIN_NAME),
+      visionDataCompression(SimulatorItem::N_VISION_DATA_COMPRESSIONS, CNOID_GETTEXT_DOMAIN_NAME),
+      resultBufMutex("Result buffer"),
       itemTreeView(ItemTreeView::instance())
 {
     flushTimer.sigTimeout().connect(boost::bind(&SimulatorItemImpl::flushResults, this));
+    flushTimer.sigTimeout().connect(
+        boost::bind(&SimulationCommandQueue<InputCommand>::flush, &inputCommandQueue));
     
     timeBar = TimeBar::instance();
     isDoingSimulationLoop = false;
     isRealtimeSyncMode = true;
+    isDeterministicMode = false;
+    isCheckpointRequested = false;
+    isCheckpointRequestProcessed = false;
+    checkpointResult = false;
+    isSteppingMode = false;
+    numRequestedSteps = 0;
+    numProcessedSteps = 0;
+    isStepRequestProcessed = false;
 
     recordingMode.setSymbol(SimulatorItem::REC_FULL, N_("full"));
     recordingMode.setSymbol(SimulatorItem::REC_TAIL, N_("tail"));
@@ -1061,7 +1380,30 @@ SimulatorItemImpl::SimulatorItemImpl(SimulatorItem* self)
     useControllerThreadsProperty = true;
     isAllLinkPositionOutputMode = false;
     isDeviceStateOutputEnabled = true;
+    isFileMappedRecordingEnabled = false;
+    visionDataCompression.setSymbol(SimulatorItem::VDC_NONE, N_("none"));
+    visionDataCompression.setSymbol(SimulatorItem::VDC_LOSSLESS, N_("lossless"));
+    visionDataCompression.setSymbol(SimulatorItem::VDC_LOSSY, N_("lossy"));
+    visionDataCompression.select(SimulatorItem::VDC_NONE);
+    isVisionDataCompressionEnabled = false;
+    linkPositionRecordingInterval = 1;
+    jointPositionRecordingInterval = 1;
+    isResultDecimationEnabled = true;
     recordCollisionData = false;
+    isOfflineCollisionDetectionEnabled = false;
+    isCollisionRecordingInLoop = false;
+    numBufferedContactFrames = 0;
+
+    isStepProfilingEnabled = false;
+    profilingStageIds[PRE_DYNAMICS_STAGE] = profiler.registerStage("Pre-dynamics functions");
+    profilingStageIds[CONTROLLER_INPUT_STAGE] = profiler.registerStage("Controller input");
+    profilingStageIds[CONTROLLER_CONTROL_STAGE] = profiler.registerStage("Controller control");
+    profilingStageIds[CONTROLLER_OUTPUT_STAGE] = profiler.registerStage("Controller output");
+    profilingStageIds[MID_DYNAMICS_STAGE] = profiler.registerStage("Mid-dynamics functions");
+    profilingStageIds[DYNAMICS_STAGE] = profiler.registerStage("Dynamics");
+    profilingStageIds[CONTROL_WAIT_STAGE] = profiler.registerStage("Controller thread wait");
+    profilingStageIds[POST_DYNAMICS_STAGE] = profiler.registerStage("Post-dynamics functions");
+    profilingStageIds[RESULT_BUFFERING_STAGE] = profiler.registerStage("Result buffering");
 
     currentFrame = 0;
     frameAtLastBufferWriting = 0;
@@ -1124,12 +1466,224 @@ void SimulatorItem::setRealtimeSyncMode(bool on)
 }
 
 
+void SimulatorItem::setDeterministicMode(bool on)
+{
+    impl->isDeterministicMode = on;
+}
+
+
+bool SimulatorItem::isDeterministicMode() const
+{
+    return impl->isDeterministicMode;
+}
+
+
 void SimulatorItem::setDeviceStateOutputEnabled(bool on)
 {
     impl->isDeviceStateOutputEnabled = on;
 }
 
 
+void SimulatorItem::setFileMappedRecordingEnabled(bool on)
+{
+    impl->isFileMappedRecordingEnabled = on;
+}
+
+
+bool SimulatorItem::isFileMappedRecordingEnabled() const
+{
+    return impl->isFileMappedRecordingEnabled;
+}
+
+
+void SimulatorItem::setVisionDataCompression(int selection)
+{
+    impl->visionDataCompression.select(selection);
+}
+
+
+Selection SimulatorItem::visionDataCompression() const
+{
+    return impl->visionDataCompression;
+}
+
+
+void SimulatorItem::setDeviceStateRecordingInterval(const std::string& deviceTypeName, int interval)
+{
+    if(interval > 1){
+        impl->deviceStateRecordingIntervals[deviceTypeName] = interval;
+    } else {
+        impl->deviceStateRecordingIntervals.erase(deviceTypeName);
+    }
+}
+
+
+int SimulatorItem::deviceStateRecordingInterval(const std::string& deviceTypeName) const
+{
+    map<string, int>::const_iterator p = impl->deviceStateRecordingIntervals.find(deviceTypeName);
+    return (p != impl->deviceStateRecordingIntervals.end()) ? p->second : 1;
+}
+
+
+void SimulatorItem::setLinkPositionRecordingInterval(int interval)
+{
+    impl->linkPositionRecordingInterval = std::max(1, interval);
+}
+
+
+int SimulatorItem::linkPositionRecordingInterval() const
+{
+    return impl->linkPositionRecordingInterval;
+}
+
+
+void SimulatorItem::setJointPositionRecordingInterval(int interval)
+{
+    impl->jointPositionRecordingInterval = std::max(1, interval);
+}
+
+
+int SimulatorItem::jointPositionRecordingInterval() const
+{
+    return impl->jointPositionRecordingInterval;
+}
+
+
+void SimulatorItem::setBodyRecordingInterval(const std::string& bodyItemName, int interval)
+{
+    if(interval >= 0){
+        impl->bodyRecordingIntervals[bodyItemName] = interval;
+    } else {
+        impl->bodyRecordingIntervals.erase(bodyItemName);
+    }
+}
+
+
+int SimulatorItem::bodyRecordingInterval(const std::string& bodyItemName) const
+{
+    map<string, int>::const_iterator p = impl->bodyRecordingIntervals.find(bodyItemName);
+    return (p != impl->bodyRecordingIntervals.end()) ? p->second : -1;
+}
+
+
+bool SimulatorItemImpl::onLinkPositionRecordingIntervalChanged(int interval)
+{
+    if(interval >= 1){
+        linkPositionRecordingInterval = interval;
+        return true;
+    }
+    return false;
+}
+
+
+bool SimulatorItemImpl::onJointPositionRecordingIntervalChanged(int interval)
+{
+    if(interval >= 1){
+        jointPositionRecordingInterval = interval;
+        return true;
+    }
+    return false;
+}
+
+
+/**
+   The string is a list of "name:interval" separated by spaces or commas, e.g. "Camera:10 RangeSensor:5".
+*/
+static string getIntervalString(const map<string, int>& intervals)
+{
+    string str;
+    for(map<string, int>::const_iterator p = intervals.begin(); p != intervals.end(); ++p){
+        if(!str.empty()){
+            str += " ";
+        }
+        str += p->first + ":" + boost::lexical_cast<string>(p->second);
+    }
+    return str;
+}
+
+
+/**
+   \param minInterval The intervals less than this value are not stored in the map
+*/
+static bool parseIntervalString(const string& str, int minInterval, map<string, int>& out_intervals)
+{
+    map<string, int> intervals;
+    
+    typedef boost::tokenizer< boost::char_separator<char> > Tokenizer;
+    boost::char_separator<char> sep(" ,\t");
+    Tokenizer tokens(str, sep);
+    for(Tokenizer::iterator p = tokens.begin(); p != tokens.end(); ++p){
+        const string& token = *p;
+        const size_t pos = token.find(':');
+        if(pos == string::npos || pos == 0){
+            return false;
+        }
+        int interval;
+        try {
+            interval = boost::lexical_cast<int>(token.substr(pos + 1));
+        } catch(const boost::bad_lexical_cast& ex){
+            return false;
+        }
+        if(interval >= minInterval){
+            intervals[token.substr(0, pos)] = interval;
+        }
+    }
+    out_intervals.swap(intervals);
+    return true;
+}
+
+
+string SimulatorItemImpl::getDeviceStateRecordingIntervalString() const
+{
+    return getIntervalString(deviceStateRecordingIntervals);
+}
+
+
+bool SimulatorItemImpl::setDeviceStateRecordingIntervalString(const string& str)
+{
+    return parseIntervalString(str, 2, deviceStateRecordingIntervals);
+}
+
+
+/**
+   The key of an interval is the name of a body item, e.g. "Floor:0 Robot:10".
+*/
+string SimulatorItemImpl::getBodyRecordingIntervalString() const
+{
+    return getIntervalString(bodyRecordingIntervals);
+}
+
+
+bool SimulatorItemImpl::setBodyRecordingIntervalString(const string& str)
+{
+    return parseIntervalString(str, 0, bodyRecordingIntervals);
+}
+
+
+void SimulatorItem::setStepProfilingEnabled(bool on)
+{
+    impl->isStepProfilingEnabled = on;
+}
+
+
+void SimulatorItem::setProfileOutputFile(const std::string& filename)
+{
+    impl->profileOutputFile = filename;
+}
+
+
+SimulationProfiler* SimulatorItem::profiler()
+{
+    return &impl->profiler;
+}
+
+
+RealtimeSynchronizer* SimulatorItem::realtimeSynchronizer()
+{
+    return &impl->realtimeSynchronizer;
+}
+
+
 void SimulatorItem::setAllLinkPositionOutputMode(bool on)
 {
     impl->isAllLinkPositionOutputMode = on;
@@ -1206,6 +1760,12 @@ int SimulatorItem::addPreDynamicsFunction(boost::function<void()> func)
 }
 
 
+int SimulatorItem::addPreDynamicsFunction(boost::function<void()> func, const FunctionDependency& dependency)
+{
+    return impl->preDynamicsFunctions.add(func, &dependency);
+}
+
+
 void SimulatorItem::removePreDynamicsFunction(int id)
 {
     impl->preDynamicsFunctions.remove(id);
@@ -1218,6 +1778,12 @@ int SimulatorItem::addMidDynamicsFunction(boost::function<void()> func)
 }
 
 
+int SimulatorItem::addMidDynamicsFunction(boost::function<void()> func, const FunctionDependency& dependency)
+{
+    return impl->midDynamicsFunctions.add(func, &dependency);
+}
+
+
 void SimulatorItem::removeMidDynamicsFunction(int id)
 {
     impl->midDynamicsFunctions.remove(id);
@@ -1230,18 +1796,28 @@ int SimulatorItem::addPostDynamicsFunction(boost::function<void()> func)
 }
 
 
+int SimulatorItem::addPostDynamicsFunction(boost::function<void()> func, const FunctionDependency& dependency)
+{
+    return impl->postDynamicsFunctions.add(func, &dependency);
+}
+
+
 void SimulatorItem::removePostDynamicsFunction(int id)
 {
     impl->postDynamicsFunctions.remove(id);
 }
 
 
-int FunctionSet::add(boost::function<void()>& func)
+int FunctionSet::add(boost::function<void()>& func, const FunctionDependency* dependency)
 {
     boost::unique_lock<boost::mutex> lock(mutex);
     
     FunctionInfo info;
     info.function = func;
+    info.hasDependency = (dependency != 0);
+    if(dependency){
+        info.dependency = *dependency;
+    }
     while(true){
         if(registerdIds.insert(idCounter).second){
             break;
@@ -1251,7 +1827,7 @@ int FunctionSet::add(boost::function<void()>& func)
     info.id = idCounter++;
     
     if(!simImpl->isRunning()){
-        functions.push_back(info);
+        addToFunctions(info);
     } else {
         functionsToAdd.push_back(info);
         needToUpdate = true;
@@ -1274,25 +1850,27 @@ void FunctionSet::updateFunctions()
     boost::unique_lock<boost::mutex> lock(mutex);
 
     for(size_t i=0; i < functionsToAdd.size(); ++i){
-        functions.push_back(functionsToAdd[i]);
+        addToFunctions(functionsToAdd[i]);
     }
     functionsToAdd.clear();
 
     for(size_t i=0; i < idsToRemove.size(); ++i){
-
-        const int idToRemove = idsToRemove[i];
-        vector<FunctionInfo>::iterator p = functions.end();
-        while(p != functions.begin()){
-            --p;
-            FunctionInfo& info = *p;
-            if(info.id == idToRemove){
-                functions.erase(p);
-                break;
-            }
-        }
+        functions.remove(idsToRemove[i]);
     }
+    idsToRemove.clear();
+    
     needToUpdate = false;
 }        
+
+
+void FunctionSet::addToFunctions(FunctionInfo& info)
+{
+    if(info.hasDependency){
+        functions.add(info.id, info.function, info.dependency);
+    } else {
+        functions.add(info.id, info.function);
+    }
+}
     
     
 void SimulatorItemImpl::clearSimulation()
@@ -1328,6 +1906,9 @@ bool SimulatorItemImpl::startSimulation(bool doReset)
         return false;
     }
 
+    // The files of the items in the world which have not been used yet are loaded here
+    worldItem->traverse(loadPendingFile);
+
     ItemList<Item> targetItems;
     findTargetItems(worldItem, false, targetItems);
     if(targetItems.empty()){
@@ -1348,6 +1929,21 @@ bool SimulatorItemImpl::startSimulation(bool doReset)
         isRingBufferMode = recordingMode.is(SimulatorItem::REC_TAIL);
     }
 
+    // The recorded states are compressed while they are not accessed until they are flushed
+    isVisionDataCompressionEnabled = isRecordingEnabled && !visionDataCompression.is(SimulatorItem::VDC_NONE);
+    deviceStateEncoder.setImageCompression(
+        visionDataCompression.is(SimulatorItem::VDC_LOSSY) ?
+        DeviceStateEncoder::LOSSY_IMAGE_COMPRESSION : DeviceStateEncoder::LOSSLESS_IMAGE_COMPRESSION);
+
+    /*
+      The results are not decimated while a world log file is written
+      because the log is written from the buffered frames of all the bodies.
+    */
+    ItemList<WorldLogFileItem> logFileItems;
+    logFileItems.extractChildItems(self);
+    WorldLogFileItem* logFileItem = logFileItems.toSingle(true);
+    isResultDecimationEnabled = !(logFileItem && !logFileItem->logFileName().empty());
+
     clearSimulation();
     bodyMotionEngines.clear();
 
@@ -1387,8 +1983,15 @@ bool SimulatorItemImpl::startSimulation(bool doReset)
 
     numBufferedFrames = 1;
     
+    /*
+      In the offline mode, the collisions are detected from the recorded motions after the simulation.
+      The ring buffer mode is not supported because the motions do not begin with the initial frame.
+    */
+    isCollisionRecordingInLoop =
+        isRecordingEnabled && recordCollisionData && !(isOfflineCollisionDetectionEnabled && !isRingBufferMode);
+    
     if(isRecordingEnabled && recordCollisionData){
-        collisionPairsBuf.clear();
+        numBufferedContactFrames = 0;
         string collisionSeqName = self->name() + "-collisions";
         CollisionSeqItem* collisionSeqItem = worldItem->findChildItem<CollisionSeqItem>(collisionSeqName);
         if(!collisionSeqItem){
@@ -1407,18 +2010,24 @@ bool SimulatorItemImpl::startSimulation(bool doReset)
         frame0[0]  = boost::make_shared<CollisionLinkPairList>();
     }
 
-    extForceFunctionId = boost::none;
-    virtualElasticStringFunctionId = boost::none;
+    inputCommandQueue.clear();
+    isExtForceActive = false;
+    isVirtualElasticStringActive = false;
+
+    profiler.setEnabled(false);
+    profiler.clear();
 
     bool result = self->initializeSimulation(simBodiesWithBody);
 
     if(result){
 
+        profiler.setEnabled(isStepProfilingEnabled);
+
         frameAtLastBufferWriting = 0;
         isDoingSimulationLoop = true;
         isWaitingForSimulationToStop = false;
         stopRequested = false;
-        pauseRequested = false;
+        pauseRequested = isSteppingMode;
 
         ringBufferSize = std::numeric_limits<int>::max();
         
@@ -1465,15 +2074,15 @@ bool SimulatorItemImpl::startSimulation(bool doReset)
                 bool ready = false;
                 controller->setSimulatorItem(self);
                 if(body){
-                    ready = (controller->start() &&           // new API
-                             controller->start(simBodyImpl)); // old API
+                    ready = (controller->start() && // new API
+                             controller->start(simBodyImpl->findControllerIO(controller, simBodyImpl))); // old API
                     if(!ready){
                         os << (fmt(_("%1% for %2% failed to initialize."))
                                % controller->name() % simBodyImpl->bodyItem->name()) << endl;
                     }
                 } else {
-                    ready = (controller->start() &&    // new API
-                             controller->start(this)); // old API
+                    ready = (controller->start() && // new API
+                             controller->start(simBodyImpl->setupControllerIO(controller, this))); // old API
                     if(!ready){
                         os << (fmt(_("%1% failed to initialize."))
                                % controller->name()) << endl;
@@ -1639,6 +2248,10 @@ SimulationBody* SimulatorItem::findSimulationBody(const std::string& name)
 // Simulation loop
 void SimulatorItemImpl::run()
 {
+    Profiler::setThreadName("Simulation");
+    // The allocations are only counted in the threads of the simulation
+    AllocationTracker::setEnabledInCurrentThread(true);
+
     self->initializeSimulationThread();
 
     double elapsedTime = 0.0;
@@ -1653,11 +2266,17 @@ void SimulatorItemImpl::run()
     bool isOnPause = false;
 
     if(isRealtimeSyncMode){
-        const double dt = worldTimeStep_;
-        const double compensationRatio = (dt > 0.1) ? 0.1 : dt;
-        const double dtms = dt * 1000.0;
-        double compensatedSimulationTime = 0.0;
+        realtimeSynchronizer.setTimeStep(worldTimeStep_);
+        realtimeSynchronizer.clearStatistics();
+        if(!realtimeSynchronizer.applyThreadSettings()){
+            mv->putln(MessageView::WARNING,
+                      _("The priority or the CPU affinity of the simulation thread cannot be set."));
+        }
+        realtimeSynchronizer.start();
         while(true){
+            if(isCheckpointRequested){
+                processCheckpointRequest();
+            }
             if(pauseRequested){
                 if(stopRequested){
                     break;
@@ -1666,10 +2285,13 @@ void SimulatorItemImpl::run()
                     elapsedTime += timer.elapsed();
                     isOnPause = true;
                 }
-                QThread::msleep(50);
+                if(!processStepRequest(frame, elapsedTime)){
+                    break;
+                }
             } else {
                 if(isOnPause){
                     timer.start();
+                    realtimeSynchronizer.start();
                     isOnPause = false;
                 }
 #ifdef ENABLE_SIMULATION_PROFILING
@@ -1697,24 +2319,15 @@ void SimulatorItemImpl::run()
                 }
                 buf[i] = oneStepTime;
 #endif
-                double diff = (double)compensatedSimulationTime - (elapsedTime + timer.elapsed());
-                if(diff >= 1.0){
-                    QThread::msleep(diff);
-                } else if(diff < 0.0){
-                    const double compensationTime = -diff * compensationRatio;
-                    compensatedSimulationTime += compensationTime;
-                    diff += compensationTime;
-                    const double delayOverThresh = -diff - 100.0;
-                    if(delayOverThresh > 0.0){
-                        compensatedSimulationTime += delayOverThresh;
-                    }
-                }
-                compensatedSimulationTime += dtms;
+                realtimeSynchronizer.waitForNextStep();
                 ++frame;
             }
         }
     } else {
         while(true){
+            if(isCheckpointRequested){
+                processCheckpointRequest();
+            }
             if(pauseRequested){
                 if(stopRequested){
                     break;
@@ -1723,7 +2336,9 @@ void SimulatorItemImpl::run()
                     elapsedTime += timer.elapsed();
                     isOnPause = true;
                 }
-                QThread::msleep(50);
+                if(!processStepRequest(frame, elapsedTime)){
+                    break;
+                }
             } else {
                 if(isOnPause){
                     timer.start();
@@ -1768,7 +2383,7 @@ void SimulatorItemImpl::run()
 
     if(useControllerThreads){
         {
-            boost::unique_lock<boost::mutex> lock(controlMutex);
+            boost::unique_lock<ProfiledMutex> lock(controlMutex);
             isExitingControlLoopRequested = true;
         }
         controlCondition.notify_all();
@@ -1787,7 +2402,10 @@ void SimulatorItemImpl::updateSimBodyLists()
 {
     activeSimBodies.clear();
     activeControllers.clear();
+    serialControllers.clear();
+    parallelControllerGroups.clear();
     hasActiveFreeBodies = false;
+    hasMultiRateControllers = false;
     
     for(size_t i=0; i < allSimBodies.size(); ++i){
         SimulationBody* simBody = allSimBodies[i];
@@ -1799,45 +2417,143 @@ void SimulatorItemImpl::updateSimBodyLists()
                 hasActiveFreeBodies = true;
             }
         }
+        bool hasParallelControllers = false;
         for(size_t j=0; j < controllers.size(); ++j){
-            activeControllers.push_back(controllers[j]);
-       }
+            ControllerItem* controller = controllers[j];
+            activeControllers.push_back(controller);
+            if(controller->controlInterval_ > 1){
+                hasMultiRateControllers = true;
+            } else {
+                controller->isControlDue_ = true;
+            }
+            if(!controller->isParallelControlEnabled()){
+                serialControllers.push_back(controller);
+            } else {
+                if(!hasParallelControllers){
+                    parallelControllerGroups.push_back(vector<ControllerItem*>());
+                    hasParallelControllers = true;
+                }
+                parallelControllerGroups.back().push_back(controller);
+            }
+        }
     }
+    parallelControlResults.resize(parallelControllerGroups.size());
+    hasDueControllers = !activeControllers.empty();
 
     needToUpdateSimBodyLists = false;
 }
 
 
-bool SimulatorItemImpl::stepSimulationMain()
+/**
+   A controller whose control interval is longer than one step is only called at the steps
+   which are multiples of the interval. Its outputs are kept in the body between the calls.
+*/
+void SimulatorItemImpl::updateControlDueFlags()
 {
-    currentFrame++;
-
-    if(needToUpdateSimBodyLists){
-        updateSimBodyLists();
+    const int frame = currentFrame - 1;
+    hasDueControllers = false;
+    for(size_t i=0; i < activeControllers.size(); ++i){
+        ControllerItem* controller = activeControllers[i];
+        controller->isControlDue_ = (frame % controller->controlInterval_ == 0);
+        hasDueControllers |= controller->isControlDue_;
     }
-    
-    bool doContinue = !doCheckContinue;
+}
 
-    preDynamicsFunctions.call();
 
-    if(useControllerThreads){
-#ifdef ENABLE_SIMULATION_PROFILING
-        controllerTime = 0.0;
-#endif
-        if(activeControllers.empty()){
-            isControlFinished = true;
+/**
+   The durations of input(), control() and output() are measured for the time budget of each controller.
+*/
+void SimulatorItemImpl::callInput(ControllerItem* controller)
+{
+    const double t = SimulationProfiler::currentTime();
+    controller->input();
+    controller->inputTime_ = SimulationProfiler::currentTime() - t;
+}
+
+
+bool SimulatorItemImpl::callControl(ControllerItem* controller)
+{
+    if(controller->isControlDue_){
+        const double t = SimulationProfiler::currentTime();
+        controller->lastControlResult_ = controller->control();
+        controller->controlTime_ = SimulationProfiler::currentTime() - t;
+    }
+    return controller->lastControlResult_;
+}
+
+
+void SimulatorItemImpl::callOutput(ControllerItem* controller)
+{
+    const double t = SimulationProfiler::currentTime();
+    controller->output();
+    controller->outputTime_ = SimulationProfiler::currentTime() - t;
+}
+
+
+/**
+   @return false if a controller requests stopping the simulation because of its overruns
+*/
+bool SimulatorItemImpl::updateControlTimeStatistics()
+{
+    const double time = currentFrame * worldTimeStep_;
+    bool doContinue = true;
+    for(size_t i=0; i < activeControllers.size(); ++i){
+        ControllerItem* controller = activeControllers[i];
+        if(controller->isControlDue_){
+            doContinue &= controller->updateControlTimeStatistics(time);
+        }
+    }
+    return doContinue;
+}
+
+
+bool SimulatorItemImpl::stepSimulationMain()
+{
+    currentFrame++;
+
+    Profiler::Scope profilerScope("Simulation step");
+    profiler.beginFrame(currentFrame);
+
+    if(needToUpdateSimBodyLists){
+        updateSimBodyLists();
+    }
+    if(hasMultiRateControllers){
+        updateControlDueFlags();
+    }
+    
+    bool doContinue = !doCheckContinue;
+
+    {
+        SimulationProfiler::Scope scope(&profiler, profilingStageIds[PRE_DYNAMICS_STAGE]);
+        preDynamicsFunctions.call();
+        applyInputCommands();
+    }
+
+    if(useControllerThreads){
+#ifdef ENABLE_SIMULATION_PROFILING
+        controllerTime = 0.0;
+#endif
+        if(!hasDueControllers){
+            // The results of the last control steps are kept in isControlToBeContinued
+            isControlFinished = true;
         } else {
 #ifdef ENABLE_SIMULATION_PROFILING
             timer.start();
 #endif
-            for(size_t i=0; i < activeControllers.size(); ++i){
-                activeControllers[i]->input();
+            {
+                SimulationProfiler::Scope scope(&profiler, profilingStageIds[CONTROLLER_INPUT_STAGE]);
+                for(size_t i=0; i < activeControllers.size(); ++i){
+                    ControllerItem* controller = activeControllers[i];
+                    if(controller->isControlDue_){
+                        callInput(controller);
+                    }
+                }
             }
 #ifdef ENABLE_SIMULATION_PROFILING
             controllerTime += timer.nsecsElapsed();
 #endif
             {
-                boost::unique_lock<boost::mutex> lock(controlMutex);                
+                boost::unique_lock<ProfiledMutex> lock(controlMutex);                
                 isControlRequested = true;
             }
             controlCondition.notify_all();
@@ -1849,10 +2565,20 @@ bool SimulatorItemImpl::stepSimulationMain()
 #endif
         for(size_t i=0; i < activeControllers.size(); ++i){
             ControllerItem* controller = activeControllers[i];
-            controller->input();
-            doContinue |= controller->control();
+            if(!controller->isControlDue_){
+                doContinue |= controller->lastControlResult_;
+                continue;
+            }
+            double t = profiler.begin();
+            callInput(controller);
+            profiler.end(profilingStageIds[CONTROLLER_INPUT_STAGE], t);
+            t = profiler.begin();
+            doContinue |= callControl(controller);
+            profiler.end(profilingStageIds[CONTROLLER_CONTROL_STAGE], t);
             if(controller->isImmediateMode()){
-                controller->output();
+                t = profiler.begin();
+                callOutput(controller);
+                profiler.end(profilingStageIds[CONTROLLER_OUTPUT_STAGE], t);
             }
         }
 #ifdef ENABLE_SIMULATION_PROFILING
@@ -1860,18 +2586,24 @@ bool SimulatorItemImpl::stepSimulationMain()
 #endif
     }
 
-    midDynamicsFunctions.call();
+    {
+        SimulationProfiler::Scope scope(&profiler, profilingStageIds[MID_DYNAMICS_STAGE]);
+        midDynamicsFunctions.call();
+    }
 
-    self->stepSimulation(activeSimBodies);
+    {
+        SimulationProfiler::Scope scope(&profiler, profilingStageIds[DYNAMICS_STAGE]);
+        self->stepSimulation(activeSimBodies);
+    }
 
-    CollisionLinkPairListPtr collisionPairs;
-    if(isRecordingEnabled && recordCollisionData){
-        collisionPairs = self->getCollisions();
+    if(isCollisionRecordingInLoop){
+        self->getContacts(contacts);
     }
 
     if(useControllerThreads){
         {
-            boost::unique_lock<boost::mutex> lock(controlMutex);
+            SimulationProfiler::Scope scope(&profiler, profilingStageIds[CONTROL_WAIT_STAGE]);
+            boost::unique_lock<ProfiledMutex> lock(controlMutex);
             while(!isControlFinished){
                 controlCondition.wait(lock);
             }
@@ -1880,16 +2612,26 @@ bool SimulatorItemImpl::stepSimulationMain()
         doContinue |= isControlToBeContinued;
     }
 
-    postDynamicsFunctions.call();
+    {
+        SimulationProfiler::Scope scope(&profiler, profilingStageIds[POST_DYNAMICS_STAGE]);
+        postDynamicsFunctions.call();
+    }
 
     {
+        SimulationProfiler::Scope scope(&profiler, profilingStageIds[RESULT_BUFFERING_STAGE]);
         resultBufMutex.lock();
 
         ++numBufferedFrames;
         for(size_t i=0; i < activeSimBodies.size(); ++i){
             activeSimBodies[i]->bufferResults();
         }
-        collisionPairsBuf.push_back(collisionPairs);
+        if(isCollisionRecordingInLoop){
+            // The buffers are swapped to reuse the memory of the flushed contacts
+            if(numBufferedContactFrames == (int)contactsBuf.size()){
+                contactsBuf.push_back(ContactBuffer());
+            }
+            contactsBuf[numBufferedContactFrames++].swap(contacts);
+        }
         frameAtLastBufferWriting = currentFrame;
 
         resultBufMutex.unlock();
@@ -1899,8 +2641,14 @@ bool SimulatorItemImpl::stepSimulationMain()
 #ifdef ENABLE_SIMULATION_PROFILING
         timer.start();
 #endif
-        for(size_t i=0; i < activeControllers.size(); ++i){
-            activeControllers[i]->output();
+        {
+            SimulationProfiler::Scope scope(&profiler, profilingStageIds[CONTROLLER_OUTPUT_STAGE]);
+            for(size_t i=0; i < activeControllers.size(); ++i){
+                ControllerItem* controller = activeControllers[i];
+                if(controller->isControlDue_){
+                    callOutput(controller);
+                }
+            }
         }
 #ifdef ENABLE_SIMULATION_PROFILING
         controllerTime += timer.nsecsElapsed();
@@ -1909,10 +2657,13 @@ bool SimulatorItemImpl::stepSimulationMain()
 #ifdef ENABLE_SIMULATION_PROFILING
         timer.start();
 #endif
-        for(size_t i=0; i < activeControllers.size(); ++i){
-            ControllerItem* controller = activeControllers[i];
-            if(!controller->isImmediateMode()){
-                controller->output(); 
+        {
+            SimulationProfiler::Scope scope(&profiler, profilingStageIds[CONTROLLER_OUTPUT_STAGE]);
+            for(size_t i=0; i < activeControllers.size(); ++i){
+                ControllerItem* controller = activeControllers[i];
+                if(controller->isControlDue_ && !controller->isImmediateMode()){
+                    callOutput(controller);
+                }
             }
         }
 #ifdef ENABLE_SIMULATION_PROFILING
@@ -1920,15 +2671,24 @@ bool SimulatorItemImpl::stepSimulationMain()
 #endif
     }
 
+    if(hasDueControllers && !updateControlTimeStatistics()){
+        stopRequested = true;
+    }
+
+    profiler.endFrame();
+
     return doContinue;
 }
 
 
 void SimulatorItemImpl::concurrentControlLoop()
 {
+    Profiler::setThreadName("Simulation control");
+    AllocationTracker::setEnabledInCurrentThread(true);
+
     while(true){
         {
-            boost::unique_lock<boost::mutex> lock(controlMutex);
+            boost::unique_lock<ProfiledMutex> lock(controlMutex);
             while(true){
                 if(isExitingControlLoopRequested){
                     goto exitConcurrentControlLoop;
@@ -1946,15 +2706,33 @@ void SimulatorItemImpl::concurrentControlLoop()
 #ifdef ENABLE_SIMULATION_PROFILING
         timer.start();
 #endif
-        for(size_t i=0; i < activeControllers.size(); ++i){
-            doContinue |= activeControllers[i]->control();
+        {
+            SimulationProfiler::Scope scope(&profiler, profilingStageIds[CONTROLLER_CONTROL_STAGE]);
+            if(parallelControllerGroups.empty()){
+                for(size_t i=0; i < serialControllers.size(); ++i){
+                    doContinue |= callControl(serialControllers[i]);
+                }
+            } else {
+                TaskGroup parallelControl;
+                for(size_t i=0; i < parallelControllerGroups.size(); ++i){
+                    parallelControl.run(
+                        boost::bind(&SimulatorItemImpl::controlParallelControllerGroup, this, i));
+                }
+                for(size_t i=0; i < serialControllers.size(); ++i){
+                    doContinue |= callControl(serialControllers[i]);
+                }
+                parallelControl.wait();
+                for(size_t i=0; i < parallelControlResults.size(); ++i){
+                    doContinue |= parallelControlResults[i];
+                }
+            }
         }
 #ifdef ENABLE_SIMULATION_PROFILING
         controllerTime += timer.nsecsElapsed();
 #endif
         
         {
-            boost::unique_lock<boost::mutex> lock(controlMutex);
+            boost::unique_lock<ProfiledMutex> lock(controlMutex);
             isControlFinished = true;
             isControlToBeContinued = doContinue;
         }
@@ -1966,10 +2744,27 @@ exitConcurrentControlLoop:
 }
 
 
+void SimulatorItemImpl::controlParallelControllerGroup(int groupIndex)
+{
+    vector<ControllerItem*>& controllers = parallelControllerGroups[groupIndex];
+    bool doContinue = false;
+    for(size_t i=0; i < controllers.size(); ++i){
+        doContinue |= callControl(controllers[i]);
+    }
+    parallelControlResults[groupIndex] = doContinue;
+}
+
+
 void SimulatorItemImpl::flushResults()
 {
+    Profiler::Scope profilerScope("Result flush");
+
     resultBufMutex.lock();
 
+    if(isVisionDataCompressionEnabled){
+        deviceStateEncoder.waitForEncoding();
+    }
+
     if(worldLogFileItem){
         if(numBufferedFrames > 0){
             int firstFrame = frameAtLastBufferWriting - (numBufferedFrames - 1);
@@ -1990,16 +2785,19 @@ void SimulatorItemImpl::flushResults()
     for(size_t i=0; i < activeSimBodies.size(); ++i){
         activeSimBodies[i]->flushResults();
     }
-    if(isRecordingEnabled && recordCollisionData){
-        for(int i=0 ; i < collisionPairsBuf.size(); ++i){
+    if(isCollisionRecordingInLoop){
+        for(int i=0 ; i < numBufferedContactFrames; ++i){
             if(collisionSeq->numFrames() >= ringBufferSize){
                 collisionSeq->popFrontFrame();
             }
+            CollisionLinkPairListPtr collisionPairs = boost::make_shared<CollisionLinkPairList>();
+            contactsBuf[i].appendTo(*collisionPairs);
+            contactsBuf[i].clear();
             CollisionSeq::Frame collisionSeq0 = collisionSeq->appendFrame();
-            collisionSeq0[0] = collisionPairsBuf[i];
+            collisionSeq0[0] = collisionPairs;
         }
     }
-    collisionPairsBuf.clear();
+    numBufferedContactFrames = 0;
 
 #ifdef ENABLE_SIMULATION_PROFILING
     for(int i=0 ; i < simProfilingBuf.rowSize(); i++){
@@ -2030,6 +2828,47 @@ void SimulatorItemImpl::flushResults()
 }
 
 
+/**
+   The collision sequence is rebuilt from the motions recorded for the bodies whose collision
+   detection is enabled. The frames are processed in parallel with the clones of the collision
+   detector of the world item.
+*/
+void SimulatorItemImpl::detectCollisionsOfRecordedMotions()
+{
+    WorldItem* worldItem = self->findOwnerItem<WorldItem>();
+    if(!worldItem || !collisionSeq){
+        return;
+    }
+    
+    vector<Body*> bodies;
+    vector<BodyMotion*> motions;
+    vector<bool> selfCollisionFlags;
+    for(size_t i=0; i < simBodiesWithBody.size(); ++i){
+        SimulationBodyImpl* simBodyImpl = simBodiesWithBody[i]->impl;
+        BodyItem* bodyItem = simBodyImpl->bodyItem.get();
+        if(simBodyImpl->motion && bodyItem->isCollisionDetectionEnabled()){
+            bodies.push_back(bodyItem->body());
+            motions.push_back(simBodyImpl->motion.get());
+            selfCollisionFlags.push_back(bodyItem->isSelfCollisionDetectionEnabled());
+        }
+    }
+
+    vector< vector<CollisionLinkPairPtr> > collisions;
+    if(detectCollisionsOfBodyMotions(
+           *worldItem->collisionDetector(), bodies, motions, selfCollisionFlags, worldFrameRate, collisions)){
+        const int numFrames = collisions.size();
+        collisionSeq->setNumFrames(numFrames);
+        for(int i=0; i < numFrames; ++i){
+            CollisionLinkPairListPtr pairs = boost::make_shared<CollisionLinkPairList>();
+            pairs->swap(collisions[i]);
+            collisionSeq->frame(i)[0] = pairs;
+        }
+        mv->putln(format(_("The collisions of %1% frames have been detected from the recorded motions."))
+                  % numFrames);
+    }
+}
+
+
 void SimulatorItem::pauseSimulation()
 {
     impl->pauseSimulation();
@@ -2051,6 +2890,367 @@ void SimulatorItem::restartSimulation()
 void SimulatorItemImpl::restartSimulation()
 {
     pauseRequested = false;
+    wakeUpPausedLoop();
+}
+
+
+void SimulatorItem::setSteppingMode(bool on)
+{
+    impl->isSteppingMode = on;
+}
+
+
+bool SimulatorItem::isSteppingMode() const
+{
+    return impl->isSteppingMode;
+}
+
+
+int SimulatorItem::stepSimulation(int numSteps)
+{
+    return impl->stepSimulation(numSteps);
+}
+
+
+int SimulatorItemImpl::stepSimulation(int numSteps)
+{
+    if(numSteps <= 0 || QThread::currentThread() == this){
+        return 0;
+    }
+    
+    boost::unique_lock<boost::mutex> requestLock(stepRequestMutex);
+    boost::unique_lock<boost::mutex> lock(stepMutex);
+
+    if(!isDoingSimulationLoop || !pauseRequested){
+        return 0;
+    }
+    numRequestedSteps = numSteps;
+    numProcessedSteps = 0;
+    isStepRequestProcessed = false;
+    stepCondition.notify_all();
+
+    while(!isStepRequestProcessed){
+        if(!isDoingSimulationLoop){
+            break;
+        }
+        stepCondition.timed_wait(lock, boost::posix_time::milliseconds(100));
+    }
+    numRequestedSteps = 0;
+
+    return numProcessedSteps;
+}
+
+
+/**
+   This is called by the simulation thread while the simulation is paused. The thread sleeps
+   until the steps are requested or the other requests are given, and the requested steps
+   are processed without returning to the loop.
+   @return false if the simulation loop should exit
+*/
+bool SimulatorItemImpl::processStepRequest(int& frame, double& elapsedTime)
+{
+    boost::unique_lock<boost::mutex> lock(stepMutex);
+
+    if(numRequestedSteps == 0 || isStepRequestProcessed){
+        stepCondition.timed_wait(lock, boost::posix_time::milliseconds(50));
+        return true;
+    }
+    const int numSteps = numRequestedSteps;
+    lock.unlock();
+
+    QElapsedTimer timer;
+    timer.start();
+    bool doContinue = true;
+    int numProcessed = 0;
+    while(numProcessed < numSteps){
+        if(stopRequested || frame >= maxFrame){
+            doContinue = false;
+            break;
+        }
+        const bool stepped = stepSimulationMain();
+        ++numProcessed;
+        ++frame;
+        if(!stepped){
+            doContinue = false;
+            break;
+        }
+    }
+    elapsedTime += timer.elapsed();
+
+    lock.lock();
+    numProcessedSteps = numProcessed;
+    isStepRequestProcessed = true;
+    stepCondition.notify_all();
+
+    return doContinue;
+}
+
+
+/**
+   The paused simulation loop sleeps on the step condition, so the requests given to the loop
+   notify it to be processed without the delay of the sleep.
+*/
+void SimulatorItemImpl::wakeUpPausedLoop()
+{
+    boost::unique_lock<boost::mutex> lock(stepMutex);
+    stepCondition.notify_all();
+}
+
+
+SimulationCheckpoint::SimulationCheckpoint()
+{
+    impl = new SimulationCheckpointImpl;
+    impl->simulatorItem = 0;
+    impl->frame = 0;
+    impl->time = 0.0;
+}
+
+
+SimulationCheckpoint::~SimulationCheckpoint()
+{
+    delete impl;
+}
+
+
+int SimulationCheckpoint::frame() const
+{
+    return impl->frame;
+}
+
+
+double SimulationCheckpoint::time() const
+{
+    return impl->time;
+}
+
+
+SimulationCheckpointPtr SimulatorItem::createCheckpoint()
+{
+    return impl->createCheckpoint();
+}
+
+
+SimulationCheckpointPtr SimulatorItemImpl::createCheckpoint()
+{
+    SimulationCheckpointPtr checkpoint;
+    if(QThread::currentThread() == this){
+        checkpoint = doCreateCheckpoint();
+    } else {
+        requestCheckpointOperation(0, checkpoint);
+    }
+    return checkpoint;
+}
+
+
+bool SimulatorItem::restoreCheckpoint(SimulationCheckpoint* checkpoint)
+{
+    return impl->restoreCheckpoint(checkpoint);
+}
+
+
+bool SimulatorItemImpl::restoreCheckpoint(SimulationCheckpoint* checkpoint)
+{
+    if(!checkpoint || checkpoint->impl->simulatorItem != self){
+        return false;
+    }
+    if(isRecordingEnabled){
+        mv->putln(MessageView::WARNING,
+                  format(_("The checkpoint of %1% cannot be restored while the results are recorded."))
+                  % self->name());
+        return false;
+    }
+    if(QThread::currentThread() == this){
+        return doRestoreCheckpoint(checkpoint);
+    }
+    SimulationCheckpointPtr created;
+    return requestCheckpointOperation(checkpoint, created);
+}
+
+
+/**
+   The operation is processed by the simulation thread at the beginning of the next loop,
+   which is also executed while the simulation is paused.
+*/
+bool SimulatorItemImpl::requestCheckpointOperation
+(SimulationCheckpoint* checkpoint, SimulationCheckpointPtr& out_created)
+{
+    boost::unique_lock<boost::mutex> requestLock(checkpointRequestMutex);
+    boost::unique_lock<boost::mutex> lock(checkpointMutex);
+
+    checkpointToRestore = checkpoint;
+    createdCheckpoint = 0;
+    checkpointResult = false;
+    isCheckpointRequestProcessed = false;
+    isCheckpointRequested = true;
+    wakeUpPausedLoop();
+
+    while(!isCheckpointRequestProcessed){
+        if(!isDoingSimulationLoop){
+            isCheckpointRequested = false;
+            break;
+        }
+        checkpointCondition.timed_wait(lock, boost::posix_time::milliseconds(100));
+    }
+
+    out_created = createdCheckpoint;
+    createdCheckpoint = 0;
+    checkpointToRestore = 0;
+    
+    return isCheckpointRequestProcessed && checkpointResult;
+}
+
+
+void SimulatorItemImpl::processCheckpointRequest()
+{
+    boost::unique_lock<boost::mutex> lock(checkpointMutex);
+
+    if(isCheckpointRequested){
+        if(checkpointToRestore){
+            checkpointResult = doRestoreCheckpoint(checkpointToRestore);
+        } else {
+            createdCheckpoint = doCreateCheckpoint();
+            checkpointResult = true;
+        }
+        isCheckpointRequested = false;
+        isCheckpointRequestProcessed = true;
+    }
+    checkpointCondition.notify_all();
+}
+
+
+SimulationCheckpoint* SimulatorItemImpl::doCreateCheckpoint()
+{
+    SimulationCheckpoint* checkpoint = new SimulationCheckpoint;
+    SimulationCheckpointImpl* cp = checkpoint->impl;
+
+    cp->simulatorItem = self;
+    cp->frame = currentFrame;
+    cp->time = currentFrame / worldFrameRate;
+
+    cp->simBodyStates.resize(allSimBodies.size());
+    for(size_t i=0; i < allSimBodies.size(); ++i){
+        SimulationBody* simBody = allSimBodies[i];
+        SimulationCheckpointImpl::SimBodyState& state = cp->simBodyStates[i];
+        state.simBody = simBody;
+        
+        Body* body = simBody->body();
+        if(body){
+            const int n = body->numLinks();
+            state.links.resize(n);
+            for(int j=0; j < n; ++j){
+                Link* link = body->link(j);
+                SimulationCheckpointImpl::LinkState& ls = state.links[j];
+                ls.p = link->p();
+                ls.R = link->R();
+                ls.v = link->v();
+                ls.w = link->w();
+                ls.dv = link->dv();
+                ls.dw = link->dw();
+                ls.f_ext = link->f_ext();
+                ls.tau_ext = link->tau_ext();
+                ls.q = link->q();
+                ls.dq = link->dq();
+                ls.ddq = link->ddq();
+                ls.u = link->u();
+            }
+            const int m = body->numDevices();
+            state.devices.resize(m);
+            for(int j=0; j < m; ++j){
+                state.devices[j] = body->device(j)->cloneState();
+            }
+        }
+
+        const int numControllers = simBody->numControllers();
+        for(int j=0; j < numControllers; ++j){
+            ControllerItem* controller = simBody->controller(j);
+            cp->controllerStates.push_back(make_pair(controller, controller->storeSimulationState()));
+        }
+    }
+
+    cp->simulatorState = self->storeSimulationState();
+
+    return checkpoint;
+}
+
+
+bool SimulatorItemImpl::doRestoreCheckpoint(SimulationCheckpoint* checkpoint)
+{
+    SimulationCheckpointImpl* cp = checkpoint->impl;
+
+    // The checkpoint must have been created in the current simulation
+    if(cp->simBodyStates.size() != allSimBodies.size()){
+        return false;
+    }
+    for(size_t i=0; i < allSimBodies.size(); ++i){
+        if(cp->simBodyStates[i].simBody != allSimBodies[i]){
+            return false;
+        }
+    }
+
+    for(size_t i=0; i < cp->simBodyStates.size(); ++i){
+        const SimulationCheckpointImpl::SimBodyState& state = cp->simBodyStates[i];
+        Body* body = state.simBody->body();
+        if(body){
+            for(size_t j=0; j < state.links.size(); ++j){
+                Link* link = body->link(j);
+                const SimulationCheckpointImpl::LinkState& ls = state.links[j];
+                link->p() = ls.p;
+                link->R() = ls.R;
+                link->v() = ls.v;
+                link->w() = ls.w;
+                link->dv() = ls.dv;
+                link->dw() = ls.dw;
+                link->f_ext() = ls.f_ext;
+                link->tau_ext() = ls.tau_ext;
+                link->q() = ls.q;
+                link->dq() = ls.dq;
+                link->ddq() = ls.ddq;
+                link->u() = ls.u;
+            }
+            for(size_t j=0; j < state.devices.size(); ++j){
+                Device* device = body->device(j);
+                device->copyStateFrom(*state.devices[j]);
+                device->notifyStateChange();
+            }
+        }
+    }
+
+    for(size_t i=0; i < cp->controllerStates.size(); ++i){
+        const pair<ControllerItemPtr, ReferencedPtr>& state = cp->controllerStates[i];
+        if(state.second){
+            state.first->restoreSimulationState(state.second);
+        }
+    }
+
+    if(cp->simulatorState){
+        self->restoreSimulationState(cp->simulatorState);
+    }
+
+    currentFrame = cp->frame;
+    resultBufMutex.lock();
+    frameAtLastBufferWriting = currentFrame;
+    resultBufMutex.unlock();
+
+    return true;
+}
+
+
+ReferencedPtr SimulatorItem::storeSimulationState()
+{
+    return 0;
+}
+
+
+void SimulatorItem::restoreSimulationState(const Referenced* state)
+{
+
+}
+
+
+void SimulatorItem::getContacts(ContactBuffer& out_contacts)
+{
+    out_contacts.clear();
+    out_contacts.appendFrom(*getCollisions());
 }
 
 
@@ -2067,6 +3267,7 @@ void SimulatorItemImpl::stopSimulation(bool doSync)
             isWaitingForSimulationToStop = true;
         }
         stopRequested = true;
+        wakeUpPausedLoop();
         
         if(doSync){
             wait();
@@ -2087,6 +3288,8 @@ void SimulatorItem::finalizeSimulation()
 void SimulatorItemImpl::onSimulationLoopStopped()
 {
     flushTimer.stop();
+
+    vector<string> controlTimeMessages;
     
     for(size_t i=0; i < allSimBodies.size(); ++i){
         vector<ControllerItemPtr>& controllers = allSimBodies[i]->impl->controllers;
@@ -2094,6 +3297,19 @@ void SimulatorItemImpl::onSimulationLoopStopped()
             ControllerItem* controller = controllers[j];
             controller->stop();
             controller->setSimulatorItem(0);
+
+            const ControllerItem::ControlTimeStatistics& s = controller->controlTimeStatistics();
+            if(controller->timeBudget() > 0.0 && s.numControlSteps > 0){
+                const double totalTime = s.totalInputTime + s.totalControlTime + s.totalOutputTime;
+                controlTimeMessages.push_back(
+                    str(format(_("Control step time of %1%: mean %2$.3f [ms], max %3$.3f [ms], "
+                                 "%4% overruns of the time budget %5$.3f [ms] in %6% steps."))
+                        % controller->name() % (totalTime / s.numControlSteps * 1000.0)
+                        % (s.maxStepTime * 1000.0) % s.numOverruns % (controller->timeBudget() * 1000.0)
+                        % s.numControlSteps));
+            }
+            // The properties show the statistics of the simulation
+            controller->notifyUpdate();
         }
     }
     self->finalizeSimulation();
@@ -2104,6 +3320,10 @@ void SimulatorItemImpl::onSimulationLoopStopped()
 
     flushResults();
 
+    if(isRecordingEnabled && recordCollisionData && !isCollisionRecordingInLoop){
+        detectCollisionsOfRecordedMotions();
+    }
+
     if(isRecordingEnabled){
         timeBar->stopFillLevelUpdate(fillLevelId);
     }
@@ -2116,6 +3336,27 @@ void SimulatorItemImpl::onSimulationLoopStopped()
     mv->putln(format(_("Computation time is %1% [s], computation time / simulation time = %2%."))
               % actualSimulationTime % (actualSimulationTime / finishTime));
 
+    if(isRealtimeSyncMode){
+        putRealtimeSyncStatistics();
+    }
+
+    for(size_t i=0; i < controlTimeMessages.size(); ++i){
+        mv->putln(controlTimeMessages[i]);
+    }
+
+    if(profiler.isEnabled()){
+        profiler.setEnabled(false);
+        if(!profileOutputFile.empty()){
+            if(profiler.exportFile(profileOutputFile)){
+                mv->putln(format(_("The step profile of %1% frames has been written to \"%2%\"."))
+                          % profiler.numFrames() % profileOutputFile);
+            } else {
+                mv->putln(MessageView::ERROR,
+                          format(_("The step profile cannot be written to \"%1%\".")) % profileOutputFile);
+            }
+        }
+    }
+
 }
 
 
@@ -2157,14 +3398,14 @@ double SimulatorItemImpl::currentTime() const
 
 int SimulatorItem::simulationFrame() const
 {
-    QMutexLocker locker(&impl->resultBufMutex);
+    boost::unique_lock<ProfiledMutex> lock(impl->resultBufMutex);
     return impl->frameAtLastBufferWriting;
 }
 
 
 double SimulatorItem::simulationTime() const
 {
-    QMutexLocker locker(&impl->resultBufMutex);
+    boost::unique_lock<ProfiledMutex> lock(impl->resultBufMutex);
     return impl->frameAtLastBufferWriting / impl->worldFrameRate;
 }
 
@@ -2210,18 +3451,14 @@ void SimulatorItemImpl::setExternalForce(BodyItem* bodyItem, Link* link, const V
     if(bodyItem && link){
         SimulationBody* simBody = self->findSimulationBody(bodyItem);
         if(simBody){
-            {
-                boost::unique_lock<boost::mutex> lock(extForceMutex);
-                extForceInfo.link = simBody->body()->link(link->index());
-                extForceInfo.point = point;
-                extForceInfo.f = f;
-                extForceInfo.time = time;
-            }
-            if(!extForceFunctionId){
-                extForceFunctionId =
-                    self->addPreDynamicsFunction(
-                        boost::bind(&SimulatorItemImpl::doSetExternalForce, this));
-            }
+            InputCommand command;
+            command.type = InputCommand::SET_EXTERNAL_FORCE;
+            ExtForceInfo& info = command.extForce;
+            info.link = simBody->body()->link(link->index());
+            info.point = point;
+            info.f = f;
+            info.time = time;
+            inputCommandQueue.post(command);
         }
     }
 }
@@ -2229,16 +3466,45 @@ void SimulatorItemImpl::setExternalForce(BodyItem* bodyItem, Link* link, const V
 
 void SimulatorItem::clearExternalForces()
 {
-    if(impl->extForceFunctionId){
-        removePreDynamicsFunction(*impl->extForceFunctionId);
-        impl->extForceFunctionId = boost::none;
-    }
+    SimulatorItemImpl::InputCommand command;
+    command.type = SimulatorItemImpl::InputCommand::CLEAR_EXTERNAL_FORCES;
+    impl->inputCommandQueue.post(command);
 }    
 
 
+void SimulatorItemImpl::applyInputCommands()
+{
+    InputCommand command;
+    while(inputCommandQueue.pop(command)){
+        switch(command.type){
+        case InputCommand::SET_EXTERNAL_FORCE:
+            extForceInfo = command.extForce;
+            isExtForceActive = true;
+            break;
+        case InputCommand::CLEAR_EXTERNAL_FORCES:
+            isExtForceActive = false;
+            break;
+        case InputCommand::SET_VIRTUAL_ELASTIC_STRING:
+            virtualElasticString = command.virtualElasticString;
+            isVirtualElasticStringActive = true;
+            break;
+        case InputCommand::CLEAR_VIRTUAL_ELASTIC_STRINGS:
+            isVirtualElasticStringActive = false;
+            break;
+        }
+    }
+
+    if(isExtForceActive){
+        doSetExternalForce();
+    }
+    if(isVirtualElasticStringActive){
+        setVirtualElasticStringForce();
+    }
+}
+
+
 void SimulatorItemImpl::doSetExternalForce()
 {
-    boost::unique_lock<boost::mutex> lock(extForceMutex);
     Link* link = extForceInfo.link;
     link->f_ext() += extForceInfo.f;
     const Vector3 p = link->T() * extForceInfo.point;
@@ -2246,7 +3512,7 @@ void SimulatorItemImpl::doSetExternalForce()
     if(extForceInfo.time > 0.0){
         extForceInfo.time -= worldTimeStep_;
         if(extForceInfo.time <= 0.0){
-            self->clearExternalForces();
+            isExtForceActive = false;
         }
     }
 }
@@ -2265,23 +3531,18 @@ void SimulatorItemImpl::setVirtualElasticString
     if(bodyItem && link){
         SimulationBody* simBody = self->findSimulationBody(bodyItem);
         if(simBody){
-            {
-                boost::unique_lock<boost::mutex> lock(virtualElasticStringMutex);
-                Body* body = simBody->body();
-                VirtualElasticString& s = virtualElasticString;
-                s.link = body->link(link->index());
-                double m = body->mass();
-                s.kp = 3.0 * m;
-                s.kd = 0.1 * s.kp;
-                s.f_max = s.kp;
-                s.point = attachmentPoint;
-                s.goal = endPoint;
-            }
-            if(!virtualElasticStringFunctionId){
-                virtualElasticStringFunctionId =
-                    self->addPreDynamicsFunction(
-                        boost::bind(&SimulatorItemImpl::setVirtualElasticStringForce, this));
-            }
+            InputCommand command;
+            command.type = InputCommand::SET_VIRTUAL_ELASTIC_STRING;
+            Body* body = simBody->body();
+            VirtualElasticString& s = command.virtualElasticString;
+            s.link = body->link(link->index());
+            double m = body->mass();
+            s.kp = 3.0 * m;
+            s.kd = 0.1 * s.kp;
+            s.f_max = s.kp;
+            s.point = attachmentPoint;
+            s.goal = endPoint;
+            inputCommandQueue.post(command);
         }
     }
 }
@@ -2289,16 +3550,14 @@ void SimulatorItemImpl::setVirtualElasticString
 
 void SimulatorItem::clearVirtualElasticStrings()
 {
-    if(impl->virtualElasticStringFunctionId){
-        removePreDynamicsFunction(*impl->virtualElasticStringFunctionId);
-        impl->virtualElasticStringFunctionId = boost::none;
-    }
+    SimulatorItemImpl::InputCommand command;
+    command.type = SimulatorItemImpl::InputCommand::CLEAR_VIRTUAL_ELASTIC_STRINGS;
+    impl->inputCommandQueue.post(command);
 }
 
 
 void SimulatorItemImpl::setVirtualElasticStringForce()
 {
-    boost::unique_lock<boost::mutex> lock(virtualElasticStringMutex);
     const VirtualElasticString& s = virtualElasticString;
     Link* link = s.link;
     Vector3 a = link->R() * s.point;
@@ -2338,6 +3597,39 @@ bool SimulatorItemImpl::onRealtimeSyncChanged(bool on)
 }
 
 
+bool SimulatorItemImpl::onRealtimeSyncSpinTimeChanged(double time)
+{
+    realtimeSynchronizer.setSpinTime(time / 1000.0);
+    return true;
+}
+
+
+bool SimulatorItemImpl::onSimulationThreadPriorityChanged(int priority)
+{
+    realtimeSynchronizer.setThreadPriority(priority);
+    return true;
+}
+
+
+bool SimulatorItemImpl::onSimulationThreadCpuChanged(int cpu)
+{
+    realtimeSynchronizer.setCpuAffinity(cpu);
+    return true;
+}
+
+
+void SimulatorItemImpl::putRealtimeSyncStatistics()
+{
+    const RealtimeSynchronizer& sync = realtimeSynchronizer;
+    if(sync.numSteps() > 0){
+        mv->putln(format(_("Realtime sync lateness: mean %1$.3f [ms], 99%% %2$.3f [ms], max %3$.3f [ms], "
+                           "%4% overruns in %5% steps."))
+                  % (sync.meanLateness() * 1000.0) % (sync.latenessPercentile(0.99) * 1000.0)
+                  % (sync.maxLateness() * 1000.0) % sync.numOverruns() % sync.numSteps());
+    }
+}
+
+
 /**
    This function may be overridden.
 */
@@ -2352,6 +3644,14 @@ void SimulatorItem::doPutProperties(PutPropertyFunction& putProperty)
 {
     putProperty(_("Sync with realtime"), impl->isRealtimeSyncMode,
                 boost::bind(&SimulatorItemImpl::onRealtimeSyncChanged, impl, _1));
+    putProperty.decimals(3).min(0.0)(_("Realtime sync spin time [ms]"),
+                                     impl->realtimeSynchronizer.spinTime() * 1000.0,
+                                     boost::bind(&SimulatorItemImpl::onRealtimeSyncSpinTimeChanged, impl, _1));
+    putProperty.min(0).max(99)(_("Simulation thread priority"), impl->realtimeSynchronizer.threadPriority(),
+                               boost::bind(&SimulatorItemImpl::onSimulationThreadPriorityChanged, impl, _1));
+    putProperty.min(-1)(_("Simulation thread CPU"), impl->realtimeSynchronizer.cpuAffinity(),
+                        boost::bind(&SimulatorItemImpl::onSimulationThreadCpuChanged, impl, _1));
+    putProperty(_("Deterministic mode"), impl->isDeterministicMode, changeProperty(impl->isDeterministicMode));
     putProperty(_("Time range"), impl->timeRangeMode,
                 boost::bind(&Selection::selectIndex, &impl->timeRangeMode, _1));
     putProperty(_("Time length"), impl->specifiedTimeLength,
@@ -2362,12 +3662,30 @@ void SimulatorItem::doPutProperties(PutPropertyFunction& putProperty)
                 boost::bind(&SimulatorItemImpl::onAllLinkPositionOutputModeChanged, impl, _1));
     putProperty(_("Device state output"), impl->isDeviceStateOutputEnabled,
                 changeProperty(impl->isDeviceStateOutputEnabled));
+    putProperty(_("File-mapped recording"), impl->isFileMappedRecordingEnabled,
+                changeProperty(impl->isFileMappedRecordingEnabled));
+    putProperty(_("Vision data compression"), impl->visionDataCompression,
+                boost::bind(&Selection::selectIndex, &impl->visionDataCompression, _1));
+    putProperty(_("Device state recording intervals"), impl->getDeviceStateRecordingIntervalString(),
+                boost::bind(&SimulatorItemImpl::setDeviceStateRecordingIntervalString, impl, _1));
+    putProperty.min(1)(_("Link position recording interval"), impl->linkPositionRecordingInterval,
+                       boost::bind(&SimulatorItemImpl::onLinkPositionRecordingIntervalChanged, impl, _1));
+    putProperty.min(1)(_("Joint position recording interval"), impl->jointPositionRecordingInterval,
+                       boost::bind(&SimulatorItemImpl::onJointPositionRecordingIntervalChanged, impl, _1));
+    putProperty(_("Body recording intervals"), impl->getBodyRecordingIntervalString(),
+                boost::bind(&SimulatorItemImpl::setBodyRecordingIntervalString, impl, _1));
     putProperty(_("Controller Threads"), impl->useControllerThreadsProperty,
                 changeProperty(impl->useControllerThreadsProperty));
     putProperty(_("Record collision data"), impl->recordCollisionData,
                 changeProperty(impl->recordCollisionData));
+    putProperty(_("Offline collision detection"), impl->isOfflineCollisionDetectionEnabled,
+                changeProperty(impl->isOfflineCollisionDetectionEnabled));
     putProperty(_("Controller options"), impl->controllerOptionString_,
                 changeProperty(impl->controllerOptionString_));
+    putProperty(_("Step profiling"), impl->isStepProfilingEnabled,
+                changeProperty(impl->isStepProfilingEnabled));
+    putProperty(_("Profile output file"), impl->profileOutputFile,
+                changeProperty(impl->profileOutputFile));
 }
 
 
@@ -2380,14 +3698,31 @@ bool SimulatorItem::store(Archive& archive)
 bool SimulatorItemImpl::store(Archive& archive)
 {
     archive.write("realtimeSync", isRealtimeSyncMode);
+    archive.write("realtimeSyncSpinTime", realtimeSynchronizer.spinTime());
+    archive.write("simulationThreadPriority", realtimeSynchronizer.threadPriority());
+    archive.write("simulationThreadCpu", realtimeSynchronizer.cpuAffinity());
+    archive.write("deterministicMode", isDeterministicMode);
     archive.write("recording", recordingMode.selectedSymbol(), DOUBLE_QUOTED);
     archive.write("timeRangeMode", timeRangeMode.selectedSymbol(), DOUBLE_QUOTED);
     archive.write("timeLength", specifiedTimeLength);
     archive.write("allLinkPositionOutputMode", isAllLinkPositionOutputMode);
     archive.write("deviceStateOutput", isDeviceStateOutputEnabled);
+    archive.write("fileMappedRecording", isFileMappedRecordingEnabled);
+    archive.write("visionDataCompression", visionDataCompression.selectedSymbol(), DOUBLE_QUOTED);
+    if(!deviceStateRecordingIntervals.empty()){
+        archive.write("deviceStateRecordingIntervals", getDeviceStateRecordingIntervalString(), DOUBLE_QUOTED);
+    }
+    archive.write("linkPositionRecordingInterval", linkPositionRecordingInterval);
+    archive.write("jointPositionRecordingInterval", jointPositionRecordingInterval);
+    if(!bodyRecordingIntervals.empty()){
+        archive.write("bodyRecordingIntervals", getBodyRecordingIntervalString(), DOUBLE_QUOTED);
+    }
     archive.write("controllerThreads", useControllerThreadsProperty);
     archive.write("recordCollisionData", recordCollisionData);
+    archive.write("offlineCollisionDetection", isOfflineCollisionDetectionEnabled);
     archive.write("controllerOptions", controllerOptionString_, DOUBLE_QUOTED);
+    archive.write("stepProfiling", isStepProfilingEnabled);
+    archive.write("profileOutputFile", profileOutputFile, DOUBLE_QUOTED);
 
     ListingPtr idseq = new Listing();
     idseq->setFlowStyle(true);
@@ -2448,12 +3783,45 @@ bool SimulatorItemImpl::restore(const Archive& archive)
         }
     }
     archive.read("realtimeSync", isRealtimeSyncMode);
+    double spinTime;
+    if(archive.read("realtimeSyncSpinTime", spinTime)){
+        realtimeSynchronizer.setSpinTime(spinTime);
+    }
+    int priority;
+    if(archive.read("simulationThreadPriority", priority)){
+        realtimeSynchronizer.setThreadPriority(priority);
+    }
+    int cpu;
+    if(archive.read("simulationThreadCpu", cpu)){
+        realtimeSynchronizer.setCpuAffinity(cpu);
+    }
+    archive.read("deterministicMode", isDeterministicMode);
     archive.read("timeLength", specifiedTimeLength);
     self->setAllLinkPositionOutputMode(archive.get("allLinkPositionOutputMode", isAllLinkPositionOutputMode));
     archive.read("deviceStateOutput", isDeviceStateOutputEnabled);
+    archive.read("fileMappedRecording", isFileMappedRecordingEnabled);
+    if(archive.read("visionDataCompression", symbol)){
+        visionDataCompression.select(symbol);
+    }
+    if(archive.read("deviceStateRecordingIntervals", symbol)){
+        setDeviceStateRecordingIntervalString(symbol);
+    }
+    int interval;
+    if(archive.read("linkPositionRecordingInterval", interval)){
+        onLinkPositionRecordingIntervalChanged(interval);
+    }
+    if(archive.read("jointPositionRecordingInterval", interval)){
+        onJointPositionRecordingIntervalChanged(interval);
+    }
+    if(archive.read("bodyRecordingIntervals", symbol)){
+        setBodyRecordingIntervalString(symbol);
+    }
     archive.read("recordCollisionData", recordCollisionData);
+    archive.read("offlineCollisionDetection", isOfflineCollisionDetectionEnabled);
     archive.read("controllerThreads", useControllerThreadsProperty);
     archive.read("controllerOptions", controllerOptionString_);
+    archive.read("stepProfiling", isStepProfilingEnabled);
+    archive.read("profileOutputFile", profileOutputFile);
 
     archive.addPostProcess(
         boost::bind(&SimulatorItemImpl::restoreBodyMotionEngines, this, boost::ref(archive)));
@@ -21,6 +21,7 @@ const bool SIMULATION_PROFILING = false;
 class Body;
 class Device;
 class CollisionDetector;
+class ContactBuffer;
 typedef boost::shared_ptr<CollisionDetector> CollisionDetectorPtr;
 class BodyItem;
 class ControllerItem;
@@ -28,6 +29,9 @@ class SimulationBodyImpl;
 class SimulatorItemImpl;
 class SimulatedMotionEngineManager;
 class SgCloneMap;
+class SimulationProfiler;
+class RealtimeSynchronizer;
+class FunctionDependency;
 
 class CNOID_EXPORT SimulationBody : public Referenced
 {
@@ -77,6 +81,31 @@ private:
 typedef ref_ptr<SimulationBody> SimulationBodyPtr;
 
 
+class SimulationCheckpointImpl;
+
+/**
+   The state of a running simulation between two simulation steps, which is created by
+   SimulatorItem::createCheckpoint(). The object can be restored any number of times
+   during the simulation which has created it.
+*/
+class CNOID_EXPORT SimulationCheckpoint : public Referenced
+{
+public:
+    virtual ~SimulationCheckpoint();
+
+    int frame() const;
+    double time() const;
+
+private:
+    SimulationCheckpoint();
+    SimulationCheckpoint(const SimulationCheckpoint& org);
+    SimulationCheckpointImpl* impl;
+    friend class SimulatorItemImpl;
+};
+
+typedef ref_ptr<SimulationCheckpoint> SimulationCheckpointPtr;
+
+
 class CNOID_EXPORT SimulatorItem : public Item
 {
 public:
@@ -97,6 +126,23 @@ public:
     bool isPausing() const;
     bool isActive() const; ///< isRunning() && !isPausing()
 
+    /**
+       In the stepping mode, the simulation started by startSimulation() is paused from the
+       beginning and it is advanced by stepSimulation() instead of running continuously.
+    */
+    void setSteppingMode(bool on);
+    bool isSteppingMode() const;
+
+    /**
+       Advances the paused simulation by the given number of steps and waits for them to finish.
+       The simulation thread does not touch the simulation bodies while it is paused, so the calling
+       thread can read and write their states between the calls. The realtime sync is not applied to
+       these steps. This must be called from a thread other than the simulation thread.
+       @return The number of the processed steps, which is smaller than the given number if the
+       simulation finishes during the steps, and zero if the simulation is not paused.
+    */
+    int stepSimulation(int numSteps);
+
     //! This can only be called from the simulation thread
     int currentFrame() const;
     
@@ -112,6 +158,27 @@ public:
     SignalProxy<void()> sigSimulationStarted();
     SignalProxy<void()> sigSimulationFinished();
 
+    /**
+       Creates a checkpoint of the running simulation. The checkpoint contains the positions,
+       the velocities, the accelerations and the forces of the links, the states of the devices,
+       the states of the controllers which support ControllerItem::storeSimulationState(),
+       the internal state of the physics engine given by storeSimulationState() and the simulation time.
+       When this is called from a non simulation thread, the checkpoint is created by the simulation
+       thread between two steps, and the calling thread waits for it. The simulation can be paused.
+       @return A null pointer if the simulation is not running
+    */
+    SimulationCheckpointPtr createCheckpoint();
+
+    /**
+       Rewinds the running simulation to a checkpoint created by createCheckpoint(), without
+       re-initializing the simulation. The same checkpoint can be restored repeatedly to run the
+       branches of the simulation from it with different inputs or controller parameters.
+       The checkpoint cannot be restored while the results are recorded because the recorded
+       results cannot be rewound. Set the recording mode to REC_NONE to use this function.
+       @return false if the checkpoint cannot be restored
+    */
+    bool restoreCheckpoint(SimulationCheckpoint* checkpoint);
+
     enum RecordingMode { REC_FULL, REC_TAIL, REC_NONE, N_RECORDING_MODES };
     enum TimeRangeMode { TR_UNLIMITED, TR_ACTIVE_CONTROL, TR_SPECIFIED, TR_TIMEBAR, N_TIME_RANGE_MODES };
     
@@ -121,11 +188,95 @@ public:
     void setRealtimeSyncMode(bool on);
     void setDeviceStateOutputEnabled(bool on);
 
+    /**
+       When the deterministic mode is enabled, the simulation gives bitwise identical results
+       for the same project regardless of the number of threads and the speed of the machine.
+       The parallel stages of the simulator always divide their work into fixed partitions and
+       merge the results in a fixed order, so this mode only disables the features whose results
+       depend on the timing of the execution, such as the best effort mode of the vision sensor
+       simulation. The sub simulators should check this mode in their initializeSimulation().
+    */
+    void setDeterministicMode(bool on);
+    bool isDeterministicMode() const;
+
+    /**
+       When the file-mapped recording is enabled, the recorded link positions and joint displacements
+       are stored in temporary files mapped into the memory once their size exceeds a threshold,
+       so that a long simulation does not exhaust the physical memory.
+    */
+    void setFileMappedRecordingEnabled(bool on);
+    bool isFileMappedRecordingEnabled() const;
+
+    /**
+       The images and the point data of the recorded states of the cameras and the range cameras
+       are compressed in a background thread, and they are decompressed when they are played back.
+       The lossless mode compresses the images in the PNG format and the lossy mode compresses them
+       in the JPEG format. The point data is compressed with the coordinates quantized by the depth
+       image step of the range camera in both modes. The compression is disabled by default.
+    */
+    enum VisionDataCompression { VDC_NONE, VDC_LOSSLESS, VDC_LOSSY, N_VISION_DATA_COMPRESSIONS };
+    void setVisionDataCompression(int selection);
+    Selection visionDataCompression() const;
+
+    /**
+       The state of a device whose Device::typeName() is the given name is recorded at most once
+       in the given number of simulation frames. A change between the recorded frames is recorded
+       with the next one, and the unchanged state is shared by the frames in the meantime.
+       Large payloads such as images and range data are already shared between the recorded frames
+       and the device while they are not modified, so decimating the states of the cameras and the
+       range sensors is the way to reduce the memory used by recording them.
+       The interval is one for all the types by default.
+    */
+    void setDeviceStateRecordingInterval(const std::string& deviceTypeName, int interval);
+    int deviceStateRecordingInterval(const std::string& deviceTypeName) const;
+
+    /**
+       The link positions and the joint positions are recorded once in the given number of
+       simulation frames, and the recorded sequences have the correspondingly lower frame rates.
+       The intervals are one by default. The results are not decimated while a world log file
+       is written because the log is written from the buffered results of every frame.
+    */
+    void setLinkPositionRecordingInterval(int interval);
+    int linkPositionRecordingInterval() const;
+    void setJointPositionRecordingInterval(int interval);
+    int jointPositionRecordingInterval() const;
+
+    /**
+       Overrides the link and joint position recording intervals for the body item of the given name.
+       Zero disables the recording and the output of all the results of the body, which is intended
+       for the bodies used as scenery. A negative value removes the setting.
+       @return -1 if the interval is not set for the body item
+    */
+    void setBodyRecordingInterval(const std::string& bodyItemName, int interval);
+    int bodyRecordingInterval(const std::string& bodyItemName) const;
+
     bool isRecordingEnabled() const;
     bool isDeviceStateOutputEnabled() const;
         
     bool isAllLinkPositionOutputMode();
     virtual void setAllLinkPositionOutputMode(bool on);
+
+    /**
+       When the step profiling is enabled, the durations of the stages of the simulation steps
+       are recorded and they are written to the profile output file when the simulation finishes.
+       The file is written as CSV if its extension is ".csv" and as a Chrome trace otherwise.
+    */
+    void setStepProfilingEnabled(bool on);
+    void setProfileOutputFile(const std::string& filename);
+
+    /**
+       The profiler is always available and sub classes or sub simulators can register
+       their own stages to it. It only records the events while the step profiling is enabled.
+    */
+    SimulationProfiler* profiler();
+
+    /**
+       The synchronizer which paces the simulation steps in the realtime sync mode.
+       The spin time, the priority and the CPU affinity of the simulation thread can be
+       configured with it, and the lateness statistics of the last or the current simulation
+       can be read from it.
+    */
+    RealtimeSynchronizer* realtimeSynchronizer();
         
     /**
        For sub simulators
@@ -142,6 +293,16 @@ public:
     int addMidDynamicsFunction(boost::function<void()> func);
     int addPostDynamicsFunction(boost::function<void()> func);
 
+    /**
+       The functions registered with the resources they access or the functions they depend on
+       may be executed concurrently with the other functions of the same stage on the task scheduler.
+       The functions registered without them are executed serially in the order of the registration.
+       See ConcurrentFunctionSet for the details.
+    */
+    int addPreDynamicsFunction(boost::function<void()> func, const FunctionDependency& dependency);
+    int addMidDynamicsFunction(boost::function<void()> func, const FunctionDependency& dependency);
+    int addPostDynamicsFunction(boost::function<void()> func, const FunctionDependency& dependency);
+
     void removePreDynamicsFunction(int id);
     void removeMidDynamicsFunction(int id);
     void removePostDynamicsFunction(int id);
@@ -156,6 +317,12 @@ public:
     SignalProxy<void(const std::vector<SimulationBodyPtr>& simulationBodies)>
         sigSimulationBodyListUpdated();
 
+    /*
+      The following functions for the inputs during the simulation must be called from the main thread.
+      The inputs are passed to the simulation thread with a lock-free queue and they are applied
+      at the beginning of the next simulation step.
+    */
+
     /*
     virtual void setExternalForce(BodyItem* bodyItem, Link* link, const Vector6& f);
     */
@@ -179,6 +346,16 @@ public:
     virtual bool isForcedPositionActiveFor(BodyItem* bodyItem) const;
     virtual void clearForcedPositions();
 
+    /**
+       Fills the buffer with the contacts of the last simulation step.
+       The default implementation converts the result of getCollisions(). The engines override
+       this function to fill the buffer directly, which does not allocate memory when the buffer
+       is reused over the steps. The contacts recorded by the simulator item are obtained by this
+       function, and the sub simulators and the controllers can also call it with their own buffers.
+       \note This function must be called from the simulation thread.
+    */
+    virtual void getContacts(ContactBuffer& out_contacts);
+
 protected:
     SimulatorItem(const SimulatorItem& org);
 
@@ -213,6 +390,15 @@ protected:
     */
     virtual void finalizeSimulation();
 
+    /**
+       Override these functions to include the internal state of the physics engine, such as the
+       velocities of its own and the data for warm-starting its solver, in the checkpoints.
+       The link states of the simulation bodies are stored by SimulatorItem itself.
+       \note These functions are called from the simulation thread between the simulation steps.
+    */
+    virtual ReferencedPtr storeSimulationState();
+    virtual void restoreSimulationState(const Referenced* state);
+
     virtual CollisionLinkPairListPtr getCollisions()
     {
         return boost::make_shared<CollisionLinkPairList>();
@@ -13,11 +13,13 @@
 #include <cnoid/Archive>
 #include <cnoid/ConnectionSet>
 #include <cnoid/LazyCaller>
+#include <cnoid/EventLoopMonitor>
 #include <cnoid/BodyCollisionDetectorUtil>
 #include <cnoid/SceneCollision>
 #include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
 #include <algorithm>
 #include "gettext.h"
 
@@ -32,8 +34,11 @@ struct BodyItemInfo {
     BodyItemInfo() {
         kinematicStateChanged = false;
     }
+    BodyPtr body;
     int geometryId;
+    bool isSelfCollisionDetectionEnabled;
     bool kinematicStateChanged;
+    Connection kinematicStateChangedConnection;
 };
 typedef map<BodyItem*, BodyItemInfo> BodyItemInfoMap;
 }
@@ -55,7 +60,6 @@ public:
     boost::dynamic_bitset<> collisionBodyItemsSelfCollisionFlags;
 
     Connection sigItemTreeChangedConnection;
-    ConnectionSet sigKinematicStateChangedConnections;
 
     bool isCollisionDetectionEnabled;
     LazyCaller updateCollisionsLater;
@@ -66,7 +70,42 @@ public:
     Selection collisionDetectorType;
     CollisionDetectorPtr collisionDetector;
     vector<BodyItemInfoMap::iterator> geometryIdToBodyInfoMap;
+    int numRemovedGeometries;
     boost::shared_ptr< vector<CollisionLinkPairPtr> > collisions;
+
+    /*
+      The geometry pairs detected last time and the positions of the geometries used in the detection.
+      Only the pairs of the moved geometries are detected again when the kinematic states are changed.
+    */
+    CollisionPairArray collisionPairs;
+    PositionArray geometryPositions;
+    vector<int> movedGeometryIds;
+    bool areCollisionPairsValid;
+
+    /*
+      In the asynchronous detection, the worker thread owns the collision detector and collisionPairs
+      while it is detecting, and the main thread only gives it the moved positions and takes the
+      finished result. The positions requested before the worker takes them are merged so that the
+      stale poses are dropped. The detection which is not incremental is done in the main thread
+      after the worker finishes the requested detection.
+    */
+    bool isAsyncCollisionDetectionEnabled;
+    boost::thread detectionThread;
+    boost::mutex detectionMutex;
+    boost::condition_variable detectionCondition;
+    bool isDetectionThreadActive;
+    bool isDetectionThreadStopRequested;
+    bool isDetecting;
+    vector<int> requestedGeometryIds;
+    PositionArray requestedPositions;
+    // The index of the element of requestedGeometryIds or -1 if the geometry is not requested
+    vector<int> geometryRequestIndices;
+    CollisionPairArray finishedCollisionPairs;
+    bool hasFinishedCollisionPairs;
+    CollisionPairArray shownCollisionPairs;
+    QueuedCaller detectionFinishedCaller;
+    int detectionFinishedCallPriority;
+    
     Signal<void()> sigCollisionsUpdated;
     LazyCaller updateCollisionDetectorLater;
 
@@ -77,9 +116,17 @@ public:
     void enableCollisionDetection(bool on);
     void clearCollisionDetector();
     void updateCollisionDetector(bool forceUpdate);
+    bool updateCollisionDetectorIncrementally();
+    void addBodyItemToCollisionDetector(BodyItem* bodyItem);
     void updateCollisionBodyItems();
     void onBodyKinematicStateChanged(BodyItem* bodyItem);
     void updateCollisions(bool forceUpdate);
+    void requestAsyncCollisionDetection();
+    void runCollisionDetectionThread();
+    void waitForAsyncCollisionDetection(bool doDiscardResult);
+    void stopCollisionDetectionThread();
+    void onAsyncCollisionDetectionFinished();
+    void showCollisions(const CollisionPairArray& collisionPairs);
     void extractCollisions(const CollisionPair& collisionPair);
 };
 }
@@ -112,6 +159,7 @@ WorldItemImpl::WorldItemImpl(WorldItem* self)
     };
     collisionDetectorType.select("AISTCollisionDetector");
     isCollisionDetectionEnabled = false;
+    isAsyncCollisionDetectionEnabled = true;
 
     init();
 }
@@ -132,6 +180,7 @@ WorldItemImpl::WorldItemImpl(WorldItem* self, const WorldItemImpl& org)
 {
     collisionDetectorType = org.collisionDetectorType;
     isCollisionDetectionEnabled = org.isCollisionDetectionEnabled;
+    isAsyncCollisionDetectionEnabled = org.isAsyncCollisionDetectionEnabled;
     
     init();
 }
@@ -141,6 +190,13 @@ void WorldItemImpl::init()
 {
     kinematicsBar = KinematicsBar::instance();
     collisionDetector = CollisionDetector::create(collisionDetectorType.selectedIndex());
+    numRemovedGeometries = 0;
+    areCollisionPairsValid = false;
+    isDetectionThreadActive = false;
+    isDetectionThreadStopRequested = false;
+    isDetecting = false;
+    hasFinishedCollisionPairs = false;
+    detectionFinishedCallPriority = LazyCaller::PRIORITY_NORMAL;
     collisions = boost::make_shared< vector<CollisionLinkPairPtr> >();
     sceneCollision = new SceneCollision(collisions);
     sceneCollision->setName("Collisions");
@@ -155,7 +211,10 @@ WorldItem::~WorldItem()
 
 WorldItemImpl::~WorldItemImpl()
 {
-    sigKinematicStateChangedConnections.disconnect();
+    stopCollisionDetectionThread();
+    for(BodyItemInfoMap::iterator p = bodyItemInfoMap.begin(); p != bodyItemInfoMap.end(); ++p){
+        p->second.kinematicStateChangedConnection.disconnect();
+    }
     sigItemTreeChangedConnection.disconnect();
 }
 
@@ -183,6 +242,7 @@ bool WorldItemImpl::selectCollisionDetector(int index)
     if(index >= 0 && index < collisionDetectorType.size()){
         CollisionDetectorPtr newCollisionDetector = CollisionDetector::create(index);
         if(newCollisionDetector){
+            waitForAsyncCollisionDetection(true);
             collisionDetector = newCollisionDetector;
             collisionDetectorType.select(index);
             if(isCollisionDetectionEnabled){
@@ -200,6 +260,9 @@ CollisionDetectorPtr WorldItem::collisionDetector()
     if(impl->isCollisionDetectionEnabled){
         impl->updateCollisionDetectorLater.flush();
     }
+    impl->waitForAsyncCollisionDetection(false);
+    // The positions may be changed by the caller
+    impl->areCollisionPairsValid = false;
     return impl->collisionDetector;
 }
 
@@ -219,6 +282,7 @@ void WorldItemImpl::enableCollisionDetection(bool on)
     bool changed = false;
     
     if(isCollisionDetectionEnabled && !on){
+        stopCollisionDetectionThread();
         clearCollisionDetector();
         sigItemTreeChangedConnection.disconnect();
         isCollisionDetectionEnabled = false;
@@ -247,15 +311,37 @@ bool WorldItem::isCollisionDetectionEnabled()
 }
 
 
+void WorldItem::enableAsyncCollisionDetection(bool on)
+{
+    if(!on && impl->isAsyncCollisionDetectionEnabled){
+        impl->stopCollisionDetectionThread();
+    }
+    impl->isAsyncCollisionDetectionEnabled = on;
+}
+
+
+bool WorldItem::isAsyncCollisionDetectionEnabled() const
+{
+    return impl->isAsyncCollisionDetectionEnabled;
+}
+
+
 void WorldItemImpl::clearCollisionDetector()
 {
     if(TRACE_FUNCTIONS){
         os << "WorldItemImpl::clearCollisionDetector()" << endl;
     }
 
+    waitForAsyncCollisionDetection(true);
     collisionDetector->clearGeometries();
     geometryIdToBodyInfoMap.clear();
-    sigKinematicStateChangedConnections.disconnect();
+    collisionPairs.clear();
+    geometryPositions.clear();
+    areCollisionPairsValid = false;
+    numRemovedGeometries = 0;
+    for(BodyItemInfoMap::iterator p = bodyItemInfoMap.begin(); p != bodyItemInfoMap.end(); ++p){
+        p->second.kinematicStateChangedConnection.disconnect();
+    }
     bodyItemInfoMap.clear();
 
     for(size_t i=0; i < collisionBodyItems.size(); ++i){
@@ -297,6 +383,10 @@ void WorldItemImpl::updateCollisionDetector(bool forceUpdate)
             collisionBodyItemsSelfCollisionFlags == prevSelfCollisionFlags){
             return;
         }
+        if(updateCollisionDetectorIncrementally()){
+            updateCollisions(true);
+            return;
+        }
     } else {
         updateCollisionBodyItems();
     }
@@ -304,21 +394,7 @@ void WorldItemImpl::updateCollisionDetector(bool forceUpdate)
     clearCollisionDetector();
 
     for(size_t i=0; i < collisionBodyItems.size(); ++i){
-        BodyItem* bodyItem = collisionBodyItems.get(i);
-        const BodyPtr& body = bodyItem->body();
-        const int numLinks = body->numLinks();
-            
-        pair<BodyItemInfoMap::iterator, bool> inserted =
-            bodyItemInfoMap.insert(make_pair(bodyItem, BodyItemInfo()));
-        BodyItemInfo& info = inserted.first->second;
-            
-        info.geometryId = addBodyToCollisionDetector(
-            *body, *collisionDetector, bodyItem->isSelfCollisionDetectionEnabled());
-        geometryIdToBodyInfoMap.resize(collisionDetector->numGeometries(), inserted.first);
-        
-        sigKinematicStateChangedConnections.add(
-            bodyItem->sigKinematicStateChanged().connect(
-                boost::bind(&WorldItemImpl::onBodyKinematicStateChanged, this, bodyItem)));
+        addBodyItemToCollisionDetector(collisionBodyItems.get(i));
     }
 
     collisionDetector->makeReady();
@@ -326,6 +402,83 @@ void WorldItemImpl::updateCollisionDetector(bool forceUpdate)
 }
 
 
+/**
+   Only the geometries of the removed bodies and the added bodies are changed so that
+   the collision detector can keep the other geometries and their pairs.
+   
+eturn false if the collision detector must be rebuilt.
+*/
+bool WorldItemImpl::updateCollisionDetectorIncrementally()
+{
+    waitForAsyncCollisionDetection(true);
+
+    map<BodyItem*, bool> selfCollisionFlags;
+    for(size_t i=0; i < collisionBodyItems.size(); ++i){
+        selfCollisionFlags[collisionBodyItems.get(i)] = collisionBodyItemsSelfCollisionFlags[i];
+    }
+
+    BodyItemInfoMap::iterator p = bodyItemInfoMap.begin();
+    while(p != bodyItemInfoMap.end()){
+        BodyItem* bodyItem = p->first;
+        BodyItemInfo& info = p->second;
+        map<BodyItem*, bool>::iterator q = selfCollisionFlags.find(bodyItem);
+        if(q != selfCollisionFlags.end() &&
+           q->second == info.isSelfCollisionDetectionEnabled && bodyItem->body() == info.body){
+            selfCollisionFlags.erase(q);
+            ++p;
+            continue;
+        }
+        const int numLinks = info.body->numLinks();
+        for(int i=0; i < numLinks; ++i){
+            if(!collisionDetector->removeGeometry(info.geometryId + i)){
+                return false;
+            }
+            geometryIdToBodyInfoMap[info.geometryId + i] = bodyItemInfoMap.end();
+        }
+        numRemovedGeometries += numLinks;
+        info.kinematicStateChangedConnection.disconnect();
+        bodyItem->clearCollisions();
+        bodyItemInfoMap.erase(p++);
+    }
+
+    // The IDs of the removed geometries are not reused
+    if(numRemovedGeometries > collisionDetector->numGeometries() / 2){
+        return false;
+    }
+
+    for(size_t i=0; i < collisionBodyItems.size(); ++i){
+        BodyItem* bodyItem = collisionBodyItems.get(i);
+        if(selfCollisionFlags.find(bodyItem) != selfCollisionFlags.end()){
+            addBodyItemToCollisionDetector(bodyItem);
+        }
+    }
+
+    collisionDetector->makeReady();
+
+    return true;
+}
+
+
+void WorldItemImpl::addBodyItemToCollisionDetector(BodyItem* bodyItem)
+{
+    pair<BodyItemInfoMap::iterator, bool> inserted =
+        bodyItemInfoMap.insert(make_pair(bodyItem, BodyItemInfo()));
+    BodyItemInfo& info = inserted.first->second;
+
+    info.body = bodyItem->body();
+    info.isSelfCollisionDetectionEnabled = bodyItem->isSelfCollisionDetectionEnabled();
+    info.geometryId = addBodyToCollisionDetector(
+        *info.body, *collisionDetector, info.isSelfCollisionDetectionEnabled);
+    geometryIdToBodyInfoMap.resize(collisionDetector->numGeometries(), inserted.first);
+    geometryPositions.resize(collisionDetector->numGeometries());
+    areCollisionPairsValid = false;
+
+    info.kinematicStateChangedConnection =
+        bodyItem->sigKinematicStateChanged().connect(
+            boost::bind(&WorldItemImpl::onBodyKinematicStateChanged, this, bodyItem));
+}
+
+
 void WorldItemImpl::updateCollisionBodyItems()
 {
     collisionBodyItemsSelfCollisionFlags.clear();
@@ -369,24 +522,196 @@ void WorldItem::updateCollisions()
 }
 
 
+/**
+   When the update is not forced, only the positions of the links which have actually moved are
+   updated, and only the pairs including them are detected again. This keeps the collision check
+   interactive while a few links of a big body are dragged in a world with many other geometries.
+   The incremental detection is done by the worker thread if the asynchronous detection is enabled.
+*/
 void WorldItemImpl::updateCollisions(bool forceUpdate)
 {
+    EventLoopMonitor::Scope monitorScope("WorldItem::updateCollisions");
+
+    const bool isIncremental = !forceUpdate && areCollisionPairsValid;
+    const bool isAsync = isIncremental && isAsyncCollisionDetectionEnabled;
+    if(!isAsync){
+        // The result of the worker is older than that of this detection
+        waitForAsyncCollisionDetection(true);
+    }
+    movedGeometryIds.clear();
+    
     for(BodyItemInfoMap::iterator p = bodyItemInfoMap.begin(); p != bodyItemInfoMap.end(); ++p){
         BodyItemInfo& info = p->second;
         BodyItem* bodyItem = p->first;
-        bodyItem->clearCollisions();
         if(info.kinematicStateChanged || forceUpdate){
             const BodyPtr& body = bodyItem->body();
             for(int i=0; i < body->numLinks(); ++i){
-                collisionDetector->updatePosition(info.geometryId + i, body->link(i)->T());
+                const int geometryId = info.geometryId + i;
+                const Position& T = body->link(i)->T();
+                Position& T0 = geometryPositions[geometryId];
+                if(!isIncremental || T.matrix() != T0.matrix()){
+                    if(!isAsync){
+                        collisionDetector->updatePosition(geometryId, T);
+                    }
+                    T0 = T;
+                    movedGeometryIds.push_back(geometryId);
+                }
             }
         }
         info.kinematicStateChanged = false;
     }
 
+    if(isAsync){
+        if(!movedGeometryIds.empty()){
+            requestAsyncCollisionDetection();
+        }
+    } else {
+        if(isIncremental){
+            collisionDetector->detectCollisionsOfMovedGeometries(movedGeometryIds, collisionPairs);
+        } else {
+            collisionDetector->detectCollisions(collisionPairs);
+            areCollisionPairsValid = true;
+        }
+        showCollisions(collisionPairs);
+    }
+}
+
+
+void WorldItemImpl::requestAsyncCollisionDetection()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(detectionMutex);
+        detectionFinishedCallPriority = kinematicsBar->collisionDetectionPriority();
+        if(geometryRequestIndices.size() < geometryPositions.size()){
+            geometryRequestIndices.resize(geometryPositions.size(), -1);
+        }
+        for(size_t i=0; i < movedGeometryIds.size(); ++i){
+            const int geometryId = movedGeometryIds[i];
+            int& index = geometryRequestIndices[geometryId];
+            if(index < 0){
+                index = requestedGeometryIds.size();
+                requestedGeometryIds.push_back(geometryId);
+                requestedPositions.push_back(geometryPositions[geometryId]);
+            } else {
+                requestedPositions[index] = geometryPositions[geometryId];
+            }
+        }
+    }
+    if(!isDetectionThreadActive){
+        isDetectionThreadStopRequested = false;
+        detectionThread = boost::thread(boost::bind(&WorldItemImpl::runCollisionDetectionThread, this));
+        isDetectionThreadActive = true;
+    } else {
+        detectionCondition.notify_all();
+    }
+}
+
+
+/**
+   The result is copied for the main thread so that the next detection can update collisionPairs
+   while the main thread shows the result. Only one call to show the result is queued at a time.
+*/
+void WorldItemImpl::runCollisionDetectionThread()
+{
+    vector<int> geometryIds;
+    PositionArray positions;
+    boost::unique_lock<boost::mutex> lock(detectionMutex);
+    while(true){
+        while(requestedGeometryIds.empty() && !isDetectionThreadStopRequested){
+            detectionCondition.wait(lock);
+        }
+        if(isDetectionThreadStopRequested){
+            break;
+        }
+        geometryIds.swap(requestedGeometryIds);
+        positions.swap(requestedPositions);
+        for(size_t i=0; i < geometryIds.size(); ++i){
+            geometryRequestIndices[geometryIds[i]] = -1;
+        }
+        isDetecting = true;
+        lock.unlock();
+
+        for(size_t i=0; i < geometryIds.size(); ++i){
+            collisionDetector->updatePosition(geometryIds[i], positions[i]);
+        }
+        collisionDetector->detectCollisionsOfMovedGeometries(geometryIds, collisionPairs);
+        geometryIds.clear();
+        positions.clear();
+
+        lock.lock();
+        isDetecting = false;
+        finishedCollisionPairs = collisionPairs;
+        if(!hasFinishedCollisionPairs){
+            hasFinishedCollisionPairs = true;
+            detectionFinishedCaller.callLater(
+                boost::bind(&WorldItemImpl::onAsyncCollisionDetectionFinished, this),
+                detectionFinishedCallPriority);
+        }
+        detectionCondition.notify_all();
+    }
+}
+
+
+/**
+   Wait until the worker thread applies all the requested positions to the collision detector.
+   @param doDiscardResult The result which has not been shown is discarded. This must be true
+   when the geometries of the detector are changed after this function.
+*/
+void WorldItemImpl::waitForAsyncCollisionDetection(bool doDiscardResult)
+{
+    if(!isDetectionThreadActive){
+        return;
+    }
+    boost::unique_lock<boost::mutex> lock(detectionMutex);
+    while(!requestedGeometryIds.empty() || isDetecting){
+        detectionCondition.wait(lock);
+    }
+    if(doDiscardResult){
+        hasFinishedCollisionPairs = false;
+        geometryRequestIndices.clear();
+    }
+}
+
+
+void WorldItemImpl::stopCollisionDetectionThread()
+{
+    if(isDetectionThreadActive){
+        waitForAsyncCollisionDetection(false);
+        {
+            boost::lock_guard<boost::mutex> lock(detectionMutex);
+            isDetectionThreadStopRequested = true;
+        }
+        detectionCondition.notify_all();
+        detectionThread.join();
+        isDetectionThreadActive = false;
+    }
+}
+
+
+void WorldItemImpl::onAsyncCollisionDetectionFinished()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(detectionMutex);
+        if(!hasFinishedCollisionPairs){
+            return;
+        }
+        shownCollisionPairs.swap(finishedCollisionPairs);
+        hasFinishedCollisionPairs = false;
+    }
+    showCollisions(shownCollisionPairs);
+}
+
+
+void WorldItemImpl::showCollisions(const CollisionPairArray& collisionPairs)
+{
+    for(BodyItemInfoMap::iterator p = bodyItemInfoMap.begin(); p != bodyItemInfoMap.end(); ++p){
+        p->first->clearCollisions();
+    }
     collisions->clear();
 
-    collisionDetector->detectCollisions(boost::bind(&WorldItemImpl::extractCollisions, this, _1));
+    for(size_t i=0; i < collisionPairs.size(); ++i){
+        extractCollisions(collisionPairs[i]);
+    }
 
     sceneCollision->setDirty();
 
@@ -448,6 +773,8 @@ void WorldItem::doPutProperties(PutPropertyFunction& putProperty)
                 boost::bind(&WorldItem::enableCollisionDetection, this, _1), true);
     putProperty(_("Collision detector"), impl->collisionDetectorType,
                 boost::bind(&WorldItemImpl::selectCollisionDetector, impl, _1));
+    putProperty(_("Asynchronous collision detection"), impl->isAsyncCollisionDetectionEnabled,
+                boost::bind(&WorldItem::enableAsyncCollisionDetection, this, _1), true);
 }
 
 
@@ -455,6 +782,7 @@ bool WorldItem::store(Archive& archive)
 {
     archive.write("collisionDetection", isCollisionDetectionEnabled());
     archive.write("collisionDetector", impl->collisionDetectorType.selectedSymbol());
+    archive.write("asyncCollisionDetection", impl->isAsyncCollisionDetectionEnabled);
     return true;
 }
 
@@ -465,6 +793,7 @@ bool WorldItem::restore(const Archive& archive)
     if(archive.read("collisionDetector", symbol)){
         selectCollisionDetector(symbol);
     }
+    enableAsyncCollisionDetection(archive.get("asyncCollisionDetection", true));
     if(archive.get("collisionDetection", false)){
         archive.addPostProcess(boost::bind(&WorldItemImpl::enableCollisionDetection, impl, true));
     }
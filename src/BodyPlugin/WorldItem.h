@@ -32,6 +32,16 @@ public:
     CollisionDetectorPtr collisionDetector();
     void enableCollisionDetection(bool on);
     bool isCollisionDetectionEnabled();
+
+    /**
+       When this is enabled, the collisions of the moved bodies are detected by a worker thread
+       with the link positions at the time of the request, and the latest result is shown when the
+       detection finishes. The positions requested while the worker is busy are merged into one
+       request. The detection by updateCollisions() is always done synchronously.
+       This is enabled by default.
+    */
+    void enableAsyncCollisionDetection(bool on);
+    bool isAsyncCollisionDetectionEnabled() const;
     void updateCollisionDetectorLater();
     void updateCollisionDetector();
     void updateCollisions();
@@ -10,10 +10,15 @@
 #include <cnoid/TimeSyncItemEngine>
 #include <cnoid/FileUtil>
 #include <cnoid/Archive>
+#include <cnoid/MessageView>
+#include <cnoid/WorldLogFileWriter>
 #include <QDateTime>
 #include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/cstdint.hpp>
+#include <zlib.h>
 #include <fstream>
-#include <stack>
+#include <algorithm>
 
 #include <iostream>
 
@@ -25,17 +30,25 @@ using namespace cnoid;
 
 namespace {
 
-static const int frameHeaderSize =
+typedef boost::int64_t int64;
+
+static const int firstFormatFrameHeaderSize =
       sizeof(int)   // offset to the prev frame
     + sizeof(float) // time
     + sizeof(int)   // data size
     ;
 
+// The offset to the prev frame is a 64-bit integer since the format version 2
+static const int currentFormatFrameHeaderSize = firstFormatFrameHeaderSize + 4;
+
+// The header of a chunk in the compressed format has the size of the uncompressed data
+static const int chunkHeaderSize = currentFormatFrameHeaderSize + sizeof(int);
+
 enum DataTypeID {
-    BODY_STATE,
-    LINK_POSITIONS,
-    JOINT_POSITIONS,
-    DEVICE_STATES
+    BODY_STATE = WorldLogFileWriter::BODY_STATE,
+    LINK_POSITIONS = WorldLogFileWriter::LINK_POSITIONS,
+    JOINT_POSITIONS = WorldLogFileWriter::JOINT_POSITIONS,
+    DEVICE_STATES = WorldLogFileWriter::DEVICE_STATES
 };
 
 struct NotEnoughDataException { };
@@ -148,6 +161,15 @@ public:
         return readInt();
     }
 
+    int64 readInt64(){
+        ensureSize(8);
+        int64 value = 0;
+        for(int i=0; i < 8; ++i){
+            value |= static_cast<int64>(static_cast<unsigned char>(data[pos++])) << (i * 8);
+        }
+        return value;
+    }
+
     float readFloat(){
         ensureSize(sizeof(float));
         float value;
@@ -187,122 +209,9 @@ public:
 };
 
 
-class WriteBuf
-{
-public:
-    vector<char> data;
-    ofstream& ofs;
-    size_t seekOffset;
-
-    WriteBuf(ofstream& ofs)
-        : ofs(ofs) {
-        seekOffset = 0;
-    }
-    
-    char* buf() {
-        return &data.front();
-    }
-
-    size_t pos() {
-        return data.size();
-    }
-
-    size_t seekPos() {
-        return seekOffset + data.size();
-    }
-
-    void clear(){
-        data.clear();
-        seekOffset = ofs.tellp();
-    }
-
-    int size() const {
-        return data.size();
-    }
-
-    void flush(){
-        ofs.write(&data.front(), data.size());
-        ofs.flush();
-        clear();
-    }
-        
-    void writeID(DataTypeID id){
-        writeOctet((char)id);
-    }
-
-    void writeBool(bool value){
-        data.push_back(value);
-    }
-
-    void writeOctet(char value){
-        data.push_back(value);
-    }
-
-    void writeShort(short value){
-        data.push_back(value & 0xff);
-        data.push_back(value >> 8);
-    }
-
-    void writeInt(int value){
-        data.push_back(value & 0xff);
-        data.push_back((value >> 8) & 0xff);
-        data.push_back((value >> 16) & 0xff);
-        data.push_back((value >> 24) & 0xff);
-    }
-
-    void writeInt(int pos, int value){
-        data[pos++] = value & 0xff;
-        data[pos++] = (value >> 8) & 0xff;
-        data[pos++] = (value >> 16) & 0xff;
-        data[pos++] = (value >> 24) & 0xff;
-    }
-
-    void writeSeekPos(int pos){
-        writeInt(pos);
-    }
-
-    void writeSeekOffset(int offset){
-        writeInt(offset);
-    }
-
-    void writeSeekOffset(int pos, int offset){
-        writeInt(pos, offset);
-    }
-    
-    void writeFloat(float value){
-        char* p = (char*)&value;
-        const int n = sizeof(float);
-        for(int i=0; i < n; ++i){
-            data.push_back(p[i]);
-        }
-    }
-
-    void writeSE3(const SE3& position){
-        const Vector3& p = position.translation();
-        writeFloat(p.x());
-        writeFloat(p.y());
-        writeFloat(p.z());
-        const Quat& q = position.rotation();
-        writeFloat(q.w());
-        writeFloat(q.x());
-        writeFloat(q.y());
-        writeFloat(q.z());
-    }
-
-    void writeString(const std::string& str){
-        const int size = str.size();
-        data.reserve(data.size() + size + 1);
-        writeShort((unsigned char)size);
-        for(int i=0; i < size; ++i){
-            writeOctet(str[i]);
-        }
-    }
-};
-
-
 class DeviceInfo {
 public:
-    size_t lastStateSeekPos;
+    int64 lastStateSeekPos;
     vector<double> lastState;
     bool isConsistent;
     DeviceInfo() {
@@ -390,36 +299,53 @@ public:
     bool isTimeStampSuffixEnabled;
     vector<string> bodyNames;
     
-    ofstream ofs;
-    WriteBuf writeBuf;
-    int lastOutputFramePos;
+    WorldLogFileWriter writer;
     double recordingFrameRate;
-    stack<int> sizeHeaderStack;
-
-    // for device state recording and playback
-    struct DeviceStateCache : public Referenced {
-        DeviceStatePtr state;
-        int seekPos;
-    };
-    typedef ref_ptr<DeviceStateCache> DeviceStateCachePtr;
-    
-    vector<DeviceStateCachePtr> deviceStateCacheArrays[2];
-    vector<DeviceStateCachePtr>* pLastDeviceStateCacheArray;
-    vector<DeviceStateCachePtr>* pCurrentDeviceStateCacheArray;
-    int deviceIndex;
-    int numDeviceStateCaches;
-    int currentDeviceStateCacheArrayIndex;
-    vector<double> doubleWriteBuf;
+    bool isCompressionEnabled;
+    bool isBackpressureReported;
 
     ifstream ifs;
     ReadBuf readBuf;
     ReadBuf readBuf2;
-    int currentReadFramePos;
+    int formatVersion;
+    int frameHeaderSize;
+    int64 firstFramePos;
+    int64 currentReadFramePos;
     int currentReadFrameDataSize;
-    int prevReadFrameOffset;
+    int64 prevReadFrameOffset;
     double currentReadFrameTime;
     bool isCurrentFrameDataLoaded;
     bool isOverRange;
+
+    /*
+      In the compressed format, the frame headers and the frame index are those of the chunks,
+      and the frames in the current chunk are decoded into chunkBuf.
+    */
+    bool isCompressed;
+    int currentChunkDataSize;
+    int64 loadedChunkPos;
+    ReadBuf chunkBuf;
+    struct ChunkFrame {
+        float time;
+        int pos;
+        int size;
+        bool operator<(double t) const { return time < t; }
+    };
+    vector<ChunkFrame> chunkFrames;
+    int currentChunkFrameIndex;
+
+    /*
+      The index of the frames which have been found, which is read from the end of the file
+      or is built by reading the frame headers when the file does not have it.
+    */
+    struct FrameIndexEntry {
+        float time;
+        int64 pos;
+        bool operator<(double t) const { return time < t; }
+    };
+    vector<FrameIndexEntry> frameIndex;
+    int64 frameIndexEndPos; // the position of the frame next to the last indexed frame
+    bool isFrameIndexComplete;
         
     vector<BodyInfoPtr> bodyInfos;
     ScopedConnection worldSubTreeChangedConnection;
@@ -433,8 +359,12 @@ public:
     void updateBodyInfos();
     void onWorldSubTreeChanged();
     bool readTopHeader();
-    bool readFrameHeader(int pos);
+    bool readFrameHeader(int64 pos);
+    bool readFrameIndex();
+    void extendFrameIndex(double time);
     bool seek(double time);
+    bool loadChunk();
+    bool seekInChunk(double time);
     bool recallStateAtTime(double time);
     bool loadCurrentFrameData();
     void readBodyStatees();
@@ -445,12 +375,6 @@ public:
     void readDeviceState(DeviceInfo& devInfo, Device* device, ReadBuf& buf, int size);
     void readLastDeviceState(DeviceInfo& devInfo, Device* device);
     void clearOutput();
-    void reserveSizeHeader();
-    void fixSizeHeader();
-    void endHeaderOutput();
-    void beginFrameOutput(double time);
-    void outputDeviceState(DeviceState* state);
-    void exchangeDeviceStateCacheArrays();
 };
 
 }
@@ -476,13 +400,16 @@ WorldLogFileItem::WorldLogFileItem()
 
 WorldLogFileItemImpl::WorldLogFileItemImpl(WorldLogFileItem* self)
     : self(self),
-      writeBuf(ofs),
       readBuf(ifs),
-      readBuf2(ifs)
+      readBuf2(ifs),
+      chunkBuf(ifs)
 {
     isTimeStampSuffixEnabled = false;
     recordingFrameRate = 0.0;
+    isCompressionEnabled = false;
     isBodyInfoUpdateNeeded = true;
+    writer.setAsynchronousOutputEnabled(true);
+    isBackpressureReported = false;
 }
 
 
@@ -495,14 +422,17 @@ WorldLogFileItem::WorldLogFileItem(const WorldLogFileItem& org)
 
 WorldLogFileItemImpl::WorldLogFileItemImpl(WorldLogFileItem* self, WorldLogFileItemImpl& org)
     : self(self),
-      writeBuf(ofs),
       readBuf(ifs),
-      readBuf2(ifs)
+      readBuf2(ifs),
+      chunkBuf(ifs)
 {
     filename = org.filename;
     isTimeStampSuffixEnabled = org.isTimeStampSuffixEnabled;
     recordingFrameRate = org.recordingFrameRate;
+    isCompressionEnabled = org.isCompressionEnabled;
     isBodyInfoUpdateNeeded = true;
+    writer.setAsynchronousOutputEnabled(true);
+    isBackpressureReported = false;
 }
 
 
@@ -531,6 +461,26 @@ void WorldLogFileItem::notifyUpdate()
 }
 
 
+size_t WorldLogFileItem::memoryUsage() const
+{
+    size_t usage =
+        impl->writer.memoryUsage() +
+        impl->readBuf.data.capacity() +
+        impl->readBuf2.data.capacity() +
+        impl->chunkBuf.data.capacity() +
+        impl->chunkFrames.capacity() * sizeof(WorldLogFileItemImpl::ChunkFrame) +
+        impl->frameIndex.capacity() * sizeof(WorldLogFileItemImpl::FrameIndexEntry);
+
+    for(size_t i=0; i < impl->bodyInfos.size(); ++i){
+        const vector<DeviceInfo>& deviceInfos = impl->bodyInfos[i]->deviceInfos;
+        for(size_t j=0; j < deviceInfos.size(); ++j){
+            usage += sizeof(DeviceInfo) + deviceInfos[j].lastState.capacity() * sizeof(double);
+        }
+    }
+    return usage;
+}
+
+
 const std::string& WorldLogFileItem::logFileName() const
 {
     return impl->filename;
@@ -629,10 +579,22 @@ bool WorldLogFileItemImpl::readTopHeader()
     
     bodyNames.clear();
 
+    formatVersion = 1;
+    frameHeaderSize = firstFormatFrameHeaderSize;
+    firstFramePos = 0;
     currentReadFramePos = 0;
     currentReadFrameDataSize = 0;
     prevReadFrameOffset = 0;
     currentReadFrameTime = -1.0;
+    frameIndex.clear();
+    frameIndexEndPos = 0;
+    isFrameIndexComplete = false;
+    isCompressed = false;
+    currentChunkDataSize = 0;
+    loadedChunkPos = -1;
+    chunkBuf.clear();
+    chunkFrames.clear();
+    currentChunkFrameIndex = 0;
     
     if(ifs.is_open()){
         ifs.close();
@@ -644,12 +606,26 @@ bool WorldLogFileItemImpl::readTopHeader()
             readBuf.clear();
             try {
                 int headerSize = readBuf.readSeekOffset();
-                if(readBuf.checkSize(headerSize)){
+                if(headerSize < 0){
+                    formatVersion = -headerSize;
+                    frameHeaderSize = currentFormatFrameHeaderSize;
+                    headerSize = readBuf.readSeekOffset();
+                }
+                if(formatVersion == WorldLogFileWriter::COMPRESSED_FORMAT_VERSION){
+                    isCompressed = true;
+                    frameHeaderSize = chunkHeaderSize;
+                }
+                if(formatVersion <= WorldLogFileWriter::COMPRESSED_FORMAT_VERSION && readBuf.checkSize(headerSize)){
                     while(!readBuf.isEnd()){
                         bodyNames.push_back(readBuf.readString());
                     }
-                    currentReadFramePos = readBuf.pos;
-                    result = readFrameHeader(readBuf.pos);
+                    firstFramePos = readBuf.pos;
+                    currentReadFramePos = firstFramePos;
+                    frameIndexEndPos = firstFramePos;
+                    if(formatVersion >= 2){
+                        readFrameIndex();
+                    }
+                    result = readFrameHeader(firstFramePos);
                 }
             } catch(NotEnoughDataException& ex){
                 bodyNames.clear();
@@ -663,7 +639,7 @@ bool WorldLogFileItemImpl::readTopHeader()
 }
 
 
-bool WorldLogFileItemImpl::readFrameHeader(int pos)
+bool WorldLogFileItemImpl::readFrameHeader(int64 pos)
 {
     isCurrentFrameDataLoaded = false;
     
@@ -685,12 +661,93 @@ bool WorldLogFileItemImpl::readFrameHeader(int pos)
     }
     
     currentReadFramePos = pos;
-    prevReadFrameOffset = readBuf.readSeekOffset();
+    prevReadFrameOffset = (formatVersion < 2) ? readBuf.readSeekOffset() : readBuf.readInt64();
     currentReadFrameTime = readBuf.readFloat();
     currentReadFrameDataSize = readBuf.readSeekOffset();
+    if(isCompressed){
+        currentChunkDataSize = readBuf.readSeekOffset();
+    }
 
     return true;
 }
+
+
+/**
+   @return true if the file has the frame index written by WorldLogFileWriter::close()
+*/
+bool WorldLogFileItemImpl::readFrameIndex()
+{
+    const char* signature = WorldLogFileWriter::frameIndexSignature();
+    const int trailerSize = 8 + 4;
+    
+    ifs.seekg(0, ios::end);
+    const int64 fileSize = ifs.tellg();
+    if(fileSize < firstFramePos + trailerSize){
+        return false;
+    }
+    try {
+        ifs.seekg(fileSize - trailerSize);
+        readBuf2.clear();
+        const int64 indexPos = readBuf2.readInt64();
+        for(int i=0; i < 4; ++i){
+            if(readBuf2.readOctet() != signature[i]){
+                return false;
+            }
+        }
+        if(indexPos < firstFramePos || indexPos >= fileSize - trailerSize){
+            return false;
+        }
+        ifs.seekg(indexPos);
+        readBuf2.clear();
+        if(readBuf2.readInt64() != -1){
+            return false;
+        }
+        const int numFrames = readBuf2.readInt();
+        const int entrySize = sizeof(float) + 8 + 1;
+        if(numFrames < 0 || numFrames > (fileSize - indexPos) / entrySize){
+            return false;
+        }
+        readBuf2.ensureSize(numFrames * entrySize);
+        frameIndex.resize(numFrames);
+        for(int i=0; i < numFrames; ++i){
+            FrameIndexEntry& entry = frameIndex[i];
+            entry.time = readBuf2.readFloat();
+            entry.pos = readBuf2.readInt64();
+            readBuf2.readBool(); // the key frame flag
+        }
+        frameIndexEndPos = indexPos;
+        isFrameIndexComplete = true;
+    } catch(NotEnoughDataException& ex){
+        frameIndex.clear();
+        frameIndexEndPos = firstFramePos;
+    }
+    readBuf2.clear();
+    return isFrameIndexComplete;
+}
+
+
+/**
+   Read the headers of the frames which have not been indexed until the frame after the time is found.
+   The headers are only read once, and the frames written after the last call are read in the next call.
+*/
+void WorldLogFileItemImpl::extendFrameIndex(double time)
+{
+    while(frameIndex.empty() || frameIndex.back().time <= time){
+        if(!readFrameHeader(frameIndexEndPos)){
+            break;
+        }
+        const int64 expectedOffset = frameIndex.empty() ? 0 : (frameIndexEndPos - frameIndex.back().pos);
+        if(prevReadFrameOffset != expectedOffset || currentReadFrameDataSize < 0){
+            // The frame index or a broken frame
+            break;
+        }
+        FrameIndexEntry entry;
+        entry.time = currentReadFrameTime;
+        entry.pos = frameIndexEndPos;
+        frameIndex.push_back(entry);
+        frameIndexEndPos += frameHeaderSize + currentReadFrameDataSize;
+    }
+}
         
         
 bool WorldLogFileItemImpl::seek(double time)
@@ -701,43 +758,136 @@ bool WorldLogFileItemImpl::seek(double time)
         readTopHeader();
     }
     
-    if(currentReadFrameTime == time){
+    if(currentReadFrameTime == time && !isCompressed){
         return true;
     }
 
-    if(currentReadFrameTime < time){
-        while(true){
-            int pos = currentReadFramePos;
-            if(!readFrameHeader(currentReadFramePos + frameHeaderSize + currentReadFrameDataSize)){
-                isOverRange = true;
-                return (currentReadFrameTime >= 0.0);
-            }
-            if(currentReadFrameTime == time){
-                return true;
-            } else if(currentReadFrameTime > time){
-                return readFrameHeader(pos);
-            }
-        }
+    if(!isFrameIndexComplete){
+        extendFrameIndex(time);
+    }
+    if(frameIndex.empty()){
+        return false;
     }
 
-    // currentReadFrameTime > time
-    while(true){
-        if(prevReadFrameOffset <= 0){
+    // The last frame whose time is not greater than the time
+    vector<FrameIndexEntry>::iterator p =
+        std::lower_bound(frameIndex.begin(), frameIndex.end(), time);
+    if(p == frameIndex.end() || p->time > time){
+        if(p == frameIndex.begin()){
             isOverRange = true;
-            return (currentReadFrameTime >= 0.0);
+        } else {
+            --p;
         }
-        if(!readFrameHeader(currentReadFramePos - prevReadFrameOffset)){
+    }
+    if(!readFrameHeader(p->pos)){
+        return false;
+    }
+    if(isCompressed){
+        if(!loadChunk()){
             return false;
         }
-        if(currentReadFrameTime <= time){
-            return true;
+        bool isInChunk = seekInChunk(time);
+        if(!isInChunk && (p + 1) == frameIndex.end()){
+            isOverRange = true;
+        }
+    } else if(currentReadFrameTime < time && (p + 1) == frameIndex.end()){
+        isOverRange = true;
+    }
+    return true;
+}
+
+
+/**
+   Decompress the current chunk and restore the frames from the XOR with the previous frames.
+   The decoded chunk is kept until another chunk is loaded.
+*/
+bool WorldLogFileItemImpl::loadChunk()
+{
+    if(loadedChunkPos == currentReadFramePos){
+        return true;
+    }
+    loadedChunkPos = -1;
+    chunkBuf.clear();
+    chunkFrames.clear();
+    
+    if(currentReadFrameDataSize <= 0 || currentChunkDataSize <= 0){
+        return false;
+    }
+    ifs.seekg(currentReadFramePos + frameHeaderSize);
+    readBuf2.clear();
+    if(!readBuf2.checkSize(currentReadFrameDataSize)){
+        return false;
+    }
+    chunkBuf.data.resize(currentChunkDataSize);
+    uLongf size = currentChunkDataSize;
+    int result = uncompress(reinterpret_cast<Bytef*>(chunkBuf.buf()), &size,
+                            reinterpret_cast<const Bytef*>(readBuf2.buf()), currentReadFrameDataSize);
+    readBuf2.clear();
+    if(result != Z_OK || size != chunkBuf.data.size()){
+        chunkBuf.clear();
+        return false;
+    }
+
+    const int chunkFrameHeaderSize = sizeof(float) + sizeof(int);
+    while(chunkBuf.size() - chunkBuf.pos >= chunkFrameHeaderSize){
+        ChunkFrame frame;
+        frame.time = chunkBuf.readFloat();
+        frame.size = chunkBuf.readSeekOffset();
+        frame.pos = chunkBuf.pos;
+        if(frame.size < 0 || frame.size > chunkBuf.size() - frame.pos){
+            break;
+        }
+        if(!chunkFrames.empty()){
+            const ChunkFrame& prevFrame = chunkFrames.back();
+            const char* prevFrameData = chunkBuf.buf() + prevFrame.pos;
+            char* data = chunkBuf.buf() + frame.pos;
+            const int n = std::min(frame.size, prevFrame.size);
+            for(int i=0; i < n; ++i){
+                data[i] ^= prevFrameData[i];
+            }
         }
+        chunkFrames.push_back(frame);
+        chunkBuf.seek(frame.pos + frame.size);
     }
+    if(chunkFrames.empty()){
+        chunkBuf.clear();
+        return false;
+    }
+    
+    loadedChunkPos = currentReadFramePos;
+    return true;
+}
+
+
+/**
+   Select the last frame in the loaded chunk whose time is not greater than the time.
+   @return false if the time is after the last frame of the chunk
+*/
+bool WorldLogFileItemImpl::seekInChunk(double time)
+{
+    vector<ChunkFrame>::iterator p =
+        std::lower_bound(chunkFrames.begin(), chunkFrames.end(), time);
+    if(p == chunkFrames.end() || p->time > time){
+        if(p != chunkFrames.begin()){
+            --p;
+        }
+    }
+    currentChunkFrameIndex = p - chunkFrames.begin();
+    currentReadFrameTime = p->time;
+    return (p->time >= time || (p + 1) != chunkFrames.end());
 }
 
 
 bool WorldLogFileItemImpl::loadCurrentFrameData()
 {
+    if(isCompressed){
+        const ChunkFrame& frame = chunkFrames[currentChunkFrameIndex];
+        readBuf.clear();
+        readBuf.data.assign(chunkBuf.buf() + frame.pos, chunkBuf.buf() + frame.pos + frame.size);
+        isCurrentFrameDataLoaded = true;
+        return true;
+    }
+    
     ifs.seekg(currentReadFramePos + frameHeaderSize);
     readBuf.clear();
     isCurrentFrameDataLoaded = readBuf.checkSize(currentReadFrameDataSize);
@@ -913,7 +1063,7 @@ void WorldLogFileItemImpl::readDeviceState(DeviceInfo& devInfo, Device* device,
 
 void WorldLogFileItemImpl::readLastDeviceState(DeviceInfo& devInfo, Device* device)
 {
-    size_t pos = readBuf.readSeekOffset();
+    const int64 pos = (formatVersion < 2) ? readBuf.readSeekOffset() : readBuf.readInt64();
     if(pos == devInfo.lastStateSeekPos){
         if(!devInfo.isConsistent){
             device->readState(&devInfo.lastState.front());
@@ -957,40 +1107,17 @@ void WorldLogFileItemImpl::clearOutput()
     if(ifs.is_open()){
         ifs.close();
     }
-    if(ofs.is_open()){
-        ofs.close();
-    }
     recordingStartTime = QDateTime::currentDateTime();
+    isBackpressureReported = false;
     
-    ofs.open(getActualFilename().c_str(), ios::out | ios::binary | ios::trunc);
-    writeBuf.clear();
-    lastOutputFramePos = 0;
-
-    currentDeviceStateCacheArrayIndex = 0;
-    exchangeDeviceStateCacheArrays();
-}
-
-
-void WorldLogFileItemImpl::reserveSizeHeader()
-{
-    sizeHeaderStack.push(writeBuf.size());
-    writeBuf.writeSeekOffset(0);
-}
-
-
-void WorldLogFileItemImpl::fixSizeHeader()
-{
-    if(!sizeHeaderStack.empty()){
-        writeBuf.writeSeekOffset(sizeHeaderStack.top(), writeBuf.size() - (sizeHeaderStack.top() + sizeof(int)));
-        sizeHeaderStack.pop();
-    }
+    writer.setCompressionEnabled(isCompressionEnabled);
+    writer.open(getActualFilename());
 }
 
 
 void WorldLogFileItem::beginHeaderOutput()
 {
-    impl->writeBuf.clear();
-    impl->reserveSizeHeader();
+    impl->writer.beginHeaderOutput();
 }
 
 
@@ -998,21 +1125,14 @@ int WorldLogFileItem::outputBodyHeader(const std::string& name)
 {
     int index = impl->bodyNames.size();
     impl->bodyNames.push_back(name);
-    impl->writeBuf.writeString(name);
+    impl->writer.outputBodyHeader(name);
     return index;
 }
 
 
 void WorldLogFileItem::endHeaderOutput()
 {
-    impl->endHeaderOutput();
-}
-
-
-void WorldLogFileItemImpl::endHeaderOutput()
-{
-    fixSizeHeader();
-    writeBuf.flush();
+    impl->writer.endHeaderOutput();
 }
 
 
@@ -1030,132 +1150,68 @@ const std::string& WorldLogFileItem::bodyName(int bodyIndex) const
 
 void WorldLogFileItem::beginFrameOutput(double time)
 {
-    impl->beginFrameOutput(time);
-}
-
-
-void WorldLogFileItemImpl::beginFrameOutput(double time)
-{
-    size_t pos = writeBuf.seekPos();
-    
-    if(lastOutputFramePos){
-        writeBuf.writeSeekOffset(pos - lastOutputFramePos);
-    } else {
-        writeBuf.writeSeekOffset(0);
-    }
-    lastOutputFramePos = pos;
-    
-    deviceIndex = 0;
-    writeBuf.writeFloat(time);
-    reserveSizeHeader(); // area for the frame data size
+    impl->writer.beginFrameOutput(time);
 }
 
 
 void WorldLogFileItem::beginBodyStateOutput()
 {
-    impl->writeBuf.writeID(BODY_STATE);
-    impl->reserveSizeHeader();
+    impl->writer.beginBodyStateOutput();
 }
 
 
 void WorldLogFileItem::outputLinkPositions(SE3* positions, int size)
 {
-    impl->writeBuf.writeID(LINK_POSITIONS);
-    impl->reserveSizeHeader();
-    impl->writeBuf.writeShort(size);
-    for(int i=0; i < size; ++i){
-        impl->writeBuf.writeSE3(positions[i]);
-    }
-    impl->fixSizeHeader();
+    impl->writer.outputLinkPositions(positions, size);
 }
 
 
 void WorldLogFileItem::outputJointPositions(double* values, int size)
 {
-    impl->writeBuf.writeID(JOINT_POSITIONS);
-    impl->reserveSizeHeader();
-    impl->writeBuf.writeShort(size);
-    for(int i=0; i < size; ++i){
-        impl->writeBuf.writeFloat(values[i]);
-    }
-    impl->fixSizeHeader();
+    impl->writer.outputJointPositions(values, size);
 }
 
 
 void WorldLogFileItem::beginDeviceStateOutput()
 {
-    impl->writeBuf.writeID(DEVICE_STATES);
-    impl->reserveSizeHeader();
+    impl->writer.beginDeviceStateOutput();
 }
 
 
 void WorldLogFileItem::outputDeviceState(DeviceState* state)
 {
-    impl->outputDeviceState(state);
-}
-
-
-void WorldLogFileItemImpl::outputDeviceState(DeviceState* state)
-{
-    DeviceStateCache* cache = 0;
-        
-    if(deviceIndex >= numDeviceStateCaches){
-        cache = new DeviceStateCache;
-    } else {
-        cache = (*pLastDeviceStateCacheArray)[deviceIndex];
-        if(state == cache->state){
-            writeBuf.writeOctet(-1);
-            writeBuf.writeSeekOffset(cache->seekPos);
-            goto endOutputDeviceState;
-        }
-    }
-    cache->state = state;
-    cache->seekPos = writeBuf.seekPos();
-    if(!state){
-        writeBuf.writeOctet(0);
-    } else {
-        int size = state->stateSize();
-        writeBuf.writeOctet(size);
-        doubleWriteBuf.resize(size);
-        state->writeState(&doubleWriteBuf.front());
-        for(size_t i=0; i < size; ++i){
-            writeBuf.writeFloat(doubleWriteBuf[i]);
-        }
-    }
-endOutputDeviceState:
-
-    pCurrentDeviceStateCacheArray->push_back(cache);
-    ++deviceIndex;
+    impl->writer.outputDeviceState(state);
 }
 
 
 void WorldLogFileItem::endDeviceStateOutput()
 {
-    impl->fixSizeHeader();
+    impl->writer.endDeviceStateOutput();
 }
 
 
 void WorldLogFileItem::endBodyStateOutput()
 {
-    impl->fixSizeHeader();
+    impl->writer.endBodyStateOutput();
 }
 
 
+/**
+   The frames are written by the background thread of the writer, and they are kept in memory
+   while the thread cannot write them fast enough. This is reported once in a recording.
+*/
 void WorldLogFileItem::endFrameOutput()
 {
-    impl->fixSizeHeader();
-    impl->writeBuf.flush();
-    impl->exchangeDeviceStateCacheArrays();
-}
-
+    impl->writer.endFrameOutput();
 
-void WorldLogFileItemImpl::exchangeDeviceStateCacheArrays()
-{
-    int i = 1 - currentDeviceStateCacheArrayIndex;
-    pCurrentDeviceStateCacheArray = &deviceStateCacheArrays[i];
-    pLastDeviceStateCacheArray = &deviceStateCacheArrays[1-i];
-    numDeviceStateCaches = pLastDeviceStateCacheArray->size();
-    currentDeviceStateCacheArrayIndex = i;
+    if(impl->writer.isBackpressured() && !impl->isBackpressureReported){
+        MessageView::instance()->putln(
+            MessageView::WARNING,
+            format(_("The log file of %1% cannot be written as fast as the simulation. "
+                     "The frames are kept in memory until they are written."))
+            % name());
+        impl->isBackpressureReported = true;
+    }
 }
     
 
@@ -1168,6 +1224,8 @@ void WorldLogFileItem::doPutProperties(PutPropertyFunction& putProperty)
                 changeProperty(impl->isTimeStampSuffixEnabled));
     putProperty(_("Recording frame rate"), impl->recordingFrameRate,
                 changeProperty(impl->recordingFrameRate));
+    putProperty(_("Compression"), impl->isCompressionEnabled,
+                changeProperty(impl->isCompressionEnabled));
 }
 
 
@@ -1176,6 +1234,7 @@ bool WorldLogFileItem::store(Archive& archive)
     archive.write("filename", impl->filename);
     archive.write("timeStampSuffix", impl->isTimeStampSuffixEnabled);
     archive.write("recordingFrameRate", impl->recordingFrameRate);
+    archive.write("compression", impl->isCompressionEnabled);
     return true;
 }
 
@@ -1185,8 +1244,15 @@ bool WorldLogFileItem::restore(const Archive& archive)
     string filename;
     archive.read("timeStampSuffix", impl->isTimeStampSuffixEnabled);
     archive.read("recordingFrameRate", impl->recordingFrameRate);
+    archive.read("compression", impl->isCompressionEnabled);
     if(archive.read("filename", filename)){
-        impl->setLogFileName(archive.expandPathVariables(filename));
+        filename = archive.expandPathVariables(filename);
+        if(archive.isOnDemandLoadingEnabled()){
+            // The header and the frame index are read by seek() when the log is played back
+            impl->filename = filename;
+        } else {
+            impl->setLogFileName(filename);
+        }
     }
     return true;
 }
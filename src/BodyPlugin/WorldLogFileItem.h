@@ -52,6 +52,9 @@ public:
 
     virtual void notifyUpdate();
 
+    //! The buffers of the recording and the playback, and the frame index are counted
+    virtual size_t memoryUsage() const;
+
 protected:
     virtual Item* doDuplicate() const;
     virtual void onPositionChanged();
@@ -12,11 +12,18 @@ using namespace cnoid;
 namespace {
 
 BodyItemPtr loadBodyItem(const std::string& filename) {
-    BodyItem* bodyItem = new BodyItem;
+    BodyItemPtr bodyItem = new BodyItem;
+    PyGILUnlock unlock;
     bodyItem->load(filename);
     return bodyItem;
 }
 
+bool BodyItem_loadModelFile(BodyItem& self, const std::string& filename)
+{
+    PyGILUnlock unlock;
+    return self.loadModelFile(filename);
+}
+
 BodyPtr BodyItem_body(BodyItem& self) { return self.body(); }
 LinkPtr BodyItem_currentBaseLink(BodyItem& self) { return self.currentBaseLink(); }
 
@@ -37,7 +44,7 @@ void exportBodyItem()
     {
         scope bodyItemScope = 
             class_< BodyItem, BodyItemPtr, bases<Item, SceneProvider> >("BodyItem")
-            .def("loadModelFile", &BodyItem::loadModelFile)
+            .def("loadModelFile", BodyItem_loadModelFile)
             .def("setName", &BodyItem::setName)
             .def("body", BodyItem_body)
             .def("isEditable", &BodyItem::isEditable)
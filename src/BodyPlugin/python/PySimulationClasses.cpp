@@ -6,9 +6,11 @@
 #include "../AISTSimulatorItem.h"
 #include "../SubSimulatorItem.h"
 #include "../GLVisionSimulatorItem.h"
+#include "../RayCastRangeSensorSimulatorItem.h"
 #include "../SimulationScriptItem.h"
 #include "../SimulationBar.h"
 #include "../BodyItem.h"
+#include <cnoid/RealtimeSynchronizer>
 #include <cnoid/PyBase>
 
 using namespace boost::python;
@@ -24,9 +26,55 @@ SimulatorItemPtr SimulatorItem_findActiveSimulatorItemFor(Item* item)
     return SimulatorItem::findActiveSimulatorItemFor(item);
 }
 
-BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(SimulatorItem_startSimulation_overloads, startSimulation, 0, 1)
+/*
+  The GIL is released while the simulation is started and stopped because the initialization
+  and the finalization of the simulation may take a long time, and the controllers and the scripts
+  of the simulation may need the GIL.
+*/
+bool SimulatorItem_startSimulation(SimulatorItem& self, bool doReset = true)
+{
+    PyGILUnlock unlock;
+    return self.startSimulation(doReset);
+}
+BOOST_PYTHON_FUNCTION_OVERLOADS(SimulatorItem_startSimulation_overloads, SimulatorItem_startSimulation, 1, 2)
+
+void SimulatorItem_stopSimulation(SimulatorItem& self)
+{
+    PyGILUnlock unlock;
+    self.stopSimulation();
+}
+
+void SimulatorItem_pauseSimulation(SimulatorItem& self)
+{
+    PyGILUnlock unlock;
+    self.pauseSimulation();
+}
+
+void SimulatorItem_restartSimulation(SimulatorItem& self)
+{
+    PyGILUnlock unlock;
+    self.restartSimulation();
+}
+
+int SimulatorItem_stepSimulation(SimulatorItem& self, int numSteps)
+{
+    PyGILUnlock unlock;
+    return self.stepSimulation(numSteps);
+}
+
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(SimulatorItem_setExternalForce_overloads, setExternalForce, 4, 5)
 
+boost::python::list RealtimeSynchronizer_getLatenessHistogram(RealtimeSynchronizer& self)
+{
+    std::vector<int> counts;
+    self.getLatenessHistogram(counts);
+    boost::python::list histogram;
+    for(size_t i=0; i < counts.size(); ++i){
+        histogram.append(counts[i]);
+    }
+    return histogram;
+}
+
 void AISTSimulatorItem_setFriction1(AISTSimulatorItem& self, double staticFriction, double slipFriction)
 {
     self.setFriction(staticFriction, slipFriction);
@@ -48,16 +96,38 @@ void exportSimulationClasses()
 
     implicitly_convertible<SimulationBodyPtr, ReferencedPtr>();
 
+    class_<RealtimeSynchronizer, boost::noncopyable>("RealtimeSynchronizer", no_init)
+        .def("setSpinTime", &RealtimeSynchronizer::setSpinTime)
+        .def("spinTime", &RealtimeSynchronizer::spinTime)
+        .def("setMaxDelay", &RealtimeSynchronizer::setMaxDelay)
+        .def("maxDelay", &RealtimeSynchronizer::maxDelay)
+        .def("setThreadPriority", &RealtimeSynchronizer::setThreadPriority)
+        .def("threadPriority", &RealtimeSynchronizer::threadPriority)
+        .def("setCpuAffinity", &RealtimeSynchronizer::setCpuAffinity)
+        .def("cpuAffinity", &RealtimeSynchronizer::cpuAffinity)
+        .def("setHistogramBins", &RealtimeSynchronizer::setHistogramBins)
+        .def("histogramBinWidth", &RealtimeSynchronizer::histogramBinWidth)
+        .def("getLatenessHistogram", RealtimeSynchronizer_getLatenessHistogram)
+        .def("numSteps", &RealtimeSynchronizer::numSteps)
+        .def("numOverruns", &RealtimeSynchronizer::numOverruns)
+        .def("meanLateness", &RealtimeSynchronizer::meanLateness)
+        .def("maxLateness", &RealtimeSynchronizer::maxLateness)
+        .def("latenessPercentile", &RealtimeSynchronizer::latenessPercentile);
+
     class_<SimulatorItem, SimulatorItemPtr, bases<Item>, boost::noncopyable>
         simulatorItemClass("SimulatorItem", no_init);
 
     simulatorItemClass
         .def("findActiveSimulatorItemFor", SimulatorItem_findActiveSimulatorItemFor).staticmethod("findActiveSimulatorItemFor")
         .def("worldTimeStep", &SimulatorItem::worldTimeStep)
-        .def("startSimulation", &SimulatorItem::startSimulation, SimulatorItem_startSimulation_overloads())
-        .def("stopSimulation", &SimulatorItem::stopSimulation)
-        .def("pauseSimulation", &SimulatorItem::pauseSimulation)
-        .def("restartSimulation", &SimulatorItem::restartSimulation)
+        .def("startSimulation", SimulatorItem_startSimulation, SimulatorItem_startSimulation_overloads())
+        .def("stopSimulation", SimulatorItem_stopSimulation)
+        .def("pauseSimulation", SimulatorItem_pauseSimulation)
+        .def("restartSimulation", SimulatorItem_restartSimulation)
+        .def("setSteppingMode", &SimulatorItem::setSteppingMode)
+        .def("isSteppingMode", &SimulatorItem::isSteppingMode)
+        .def("stepSimulation", SimulatorItem_stepSimulation)
+        .def("isPausing", &SimulatorItem::isPausing)
         .def("isRunning", &SimulatorItem::isRunning)
         .def("currentFrame", &SimulatorItem::currentFrame)
         .def("currentTime", &SimulatorItem::currentTime)
@@ -66,6 +136,7 @@ void exportSimulationClasses()
         .def("recordingMode", &SimulatorItem::recordingMode)
         .def("setTimeRangeMode", &SimulatorItem::setTimeRangeMode)
         .def("setRealtimeSyncMode", &SimulatorItem::setRealtimeSyncMode)
+        .def("realtimeSynchronizer", &SimulatorItem::realtimeSynchronizer, return_value_policy<reference_existing_object>())
         .def("setDeviceStateOutputEnabled", &SimulatorItem::setDeviceStateOutputEnabled)
         .def("isRecordingEnabled", &SimulatorItem::isRecordingEnabled)
         .def("isDeviceStateOutputEnabled", &SimulatorItem::isDeviceStateOutputEnabled)
@@ -146,6 +217,12 @@ void exportSimulationClasses()
         .def("setVisionDataRecordingEnabled", &GLVisionSimulatorItem::setVisionDataRecordingEnabled)
         .def("setDedicatedSensorThreadsEnabled", &GLVisionSimulatorItem::setDedicatedSensorThreadsEnabled)
         .def("setBestEffortMode", &GLVisionSimulatorItem::setBestEffortMode)
+        .def("setPixelBufferReadbackEnabled", &GLVisionSimulatorItem::setPixelBufferReadbackEnabled)
+        .def("setReadbackDelay", &GLVisionSimulatorItem::setReadbackDelay)
+        .def("setDeadlineSchedulingEnabled", &GLVisionSimulatorItem::setDeadlineSchedulingEnabled)
+        .def("setCullingEnabled", &GLVisionSimulatorItem::setCullingEnabled)
+        .def("setSharedSceneEnabled", &GLVisionSimulatorItem::setSharedSceneEnabled)
+        .def("setEGLContextEnabled", &GLVisionSimulatorItem::setEGLContextEnabled)
         .def("setRangeSensorPrecisionRatio", &GLVisionSimulatorItem::setRangeSensorPrecisionRatio)
         .def("setAllSceneObjectsEnabled", &GLVisionSimulatorItem::setAllSceneObjectsEnabled)
         .def("setHeadLightEnabled", &GLVisionSimulatorItem::setHeadLightEnabled)
@@ -155,6 +232,17 @@ void exportSimulationClasses()
     implicitly_convertible<GLVisionSimulatorItemPtr, SubSimulatorItemPtr>();
     PyItemList<GLVisionSimulatorItem>("GLVisionSimulatorItemList");
 
+    class_< RayCastRangeSensorSimulatorItem, RayCastRangeSensorSimulatorItemPtr, bases<SubSimulatorItem> >
+        ("RayCastRangeSensorSimulatorItem")
+        .def("setTargetBodies", &RayCastRangeSensorSimulatorItem::setTargetBodies)
+        .def("setTargetSensors", &RayCastRangeSensorSimulatorItem::setTargetSensors)
+        .def("setMaxFrameRate", &RayCastRangeSensorSimulatorItem::setMaxFrameRate)
+        .def("setRangeDataRecordingEnabled", &RayCastRangeSensorSimulatorItem::setRangeDataRecordingEnabled)
+        ;
+
+    implicitly_convertible<RayCastRangeSensorSimulatorItemPtr, SubSimulatorItemPtr>();
+    PyItemList<RayCastRangeSensorSimulatorItem>("RayCastRangeSensorSimulatorItemList");
+
     {
         scope simulationScriptItemScope = 
             class_< SimulationScriptItem, SimulationScriptItemPtr, bases<ScriptItem>, boost::noncopyable >
@@ -104,11 +104,14 @@ public:
     IdPairSet modelPairs;
     IdPairSet nonInterfarencePairs;
 
+    // The array given to the callback
+    CollisionPairArray callbackCollisionPairs;
+
     int addGeometry(SgNode* geometry);
     void addMesh(GeometryEx* model);
     bool makeReady();
     void updatePosition(int geometryId, const Position& _position);
-    void detectCollisions(boost::function<void(const CollisionPair&)> callback);
+    void detectCollisions(CollisionPairArray& out_collisionPairs);
     void detectObjectCollisions(btCollisionObject* object1, btCollisionObject* object2, CollisionPair& collisionPair);
 };
 }
@@ -555,20 +558,44 @@ void BulletCollisionDetectorImpl::updatePosition(int geometryId, const Position&
 }
 
 
+void BulletCollisionDetector::updatePositions(int begin, int end, const PositionArray& positions)
+{
+    for(int i=begin; i < end; ++i){
+        impl->updatePosition(i, positions[i - begin]);
+    }
+}
+
+
 void BulletCollisionDetector::detectCollisions(boost::function<void(const CollisionPair&)> callback)
 {
-    impl->detectCollisions(callback);
+    CollisionPairArray& collisionPairs = impl->callbackCollisionPairs;
+    impl->detectCollisions(collisionPairs);
+    for(size_t i=0; i < collisionPairs.size(); ++i){
+        callback(collisionPairs[i]);
+    }
+}
+
+
+void BulletCollisionDetector::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    impl->detectCollisions(out_collisionPairs);
 }
 
 
-void BulletCollisionDetectorImpl::detectCollisions(boost::function<void(const CollisionPair&)> callback)
+void BulletCollisionDetectorImpl::detectCollisions(CollisionPairArray& out_collisionPairs)
 {
-    CollisionPair collisionPair;
-    vector<Collision>& collisions = collisionPair.collisions;
+    int numPairs = 0;
     
     for(IdPairSet::iterator it = modelPairs.begin(); it!=modelPairs.end(); it++){
         GeometryExPtr& model1 = models[(*it)(0)];
         GeometryExPtr& model2 = models[(*it)(1)];
+
+        // The element is reused so that the collision array keeps its capacity
+        if(numPairs == (int)out_collisionPairs.size()){
+            out_collisionPairs.push_back(CollisionPair());
+        }
+        CollisionPair& collisionPair = out_collisionPairs[numPairs];
+        vector<Collision>& collisions = collisionPair.collisions;
         collisions.clear();
 
         if(model1->collisionObject && model2->collisionObject)
@@ -577,10 +604,11 @@ void BulletCollisionDetectorImpl::detectCollisions(boost::function<void(const Co
         if(!collisions.empty()){
             collisionPair.geometryId[0] = (*it)(0);
             collisionPair.geometryId[1] = (*it)(1);
-            callback(collisionPair);
+            ++numPairs;
         }
     }
 
+    out_collisionPairs.resize(numPairs);
 }
 
 
@@ -28,7 +28,9 @@ public:
     virtual void setNonInterfarenceGeometyrPair(int geometryId1, int geometryId2);
     virtual bool makeReady();
     virtual void updatePosition(int geometryId, const Position& position);
+    virtual void updatePositions(int begin, int end, const PositionArray& positions);
     virtual void detectCollisions(boost::function<void(const CollisionPair&)> callback);
+    virtual void detectCollisions(CollisionPairArray& out_collisionPairs);
 
 private:
     BulletCollisionDetectorImpl* impl;
@@ -23,6 +23,19 @@
 #include <HACD/hacdHACD.h>
 #include <BulletCollision/Gimpact/btGImpactShape.h>
 #include <BulletCollision/Gimpact/btGImpactCollisionAlgorithm.h>
+#ifdef BULLET_DYNAMICS_WORLD_MT
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#if BT_BULLET_VERSION >= 288
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#endif
+#include <LinearMath/btThreads.h>
+#endif
+#include <cnoid/MessageView>
+#include <boost/thread.hpp>
+#include <boost/format.hpp>
+#include <map>
+#include <algorithm>
 #include "gettext.h"
 
 using namespace std;
@@ -46,6 +59,26 @@ const bool mixedPrimitiveMesh = true;   // mixed of Primitive and Mesh on one li
 
 class BulletBody;
 
+/**
+   The collision shape of a link and the data referred by it.
+   The links which have the same shape node and the same center of mass frame share this object.
+*/
+class BulletShape : public Referenced
+{
+public:
+    vector<btScalar> vertices;
+    vector<int> triangles;
+    btTriangleIndexVertexArray* pMeshData;
+    btTriangleMesh* trimesh;
+    btCollisionShape* collisionShape;
+    btTransform shift;
+    bool isStatic;
+
+    BulletShape();
+    ~BulletShape();
+};
+typedef ref_ptr<BulletShape> BulletShapePtr;
+
 class BulletLink : public Referenced
 {
 public:
@@ -59,6 +92,7 @@ public:
     btTriangleIndexVertexArray* pMeshData;
     btTriangleMesh* trimesh;
     btCollisionShape* collisionShape;
+    BulletShapePtr shape;
 
     btDefaultMotionState* motionState;
     btRigidBody* body;
@@ -117,7 +151,10 @@ public:
     btCollisionDispatcher* dispatcher;
     btBroadphaseInterface* broadphase;
     btConstraintSolver* solver;
+    btConstraintSolver* solverMt;
     btDynamicsWorld* dynamicsWorld;
+    typedef std::multimap<SgNode*, BulletShapePtr> ShapeCache;
+    ShapeCache shapeCache;
 
     Vector3 gravity;
     double timeStep;
@@ -133,6 +170,9 @@ public:
     CollisionDetectorPtr collisionDetector;
     vector<BulletLink*> geometryIdToLink;
     bool velocityMode;
+    int numThreads;
+
+    vector<BasicSensorSimulationHelper*> gyroAndAccelerationSensorHelpers;
 
     BulletSimulatorItemImpl(BulletSimulatorItem* self);
     BulletSimulatorItemImpl(BulletSimulatorItem* self, const BulletSimulatorItemImpl& org);
@@ -144,6 +184,8 @@ public:
     void restore(const Archive& archive);
     void initialize();
     void clear();
+    void createWorld();
+    BulletShape* findShape(SgNode* node, const btTransform& shift, bool isStatic);
     void addBody(BulletBody* bulletBody, short group);
     void setSolverParameter();
 };
@@ -231,9 +273,44 @@ BulletLink::BulletLink(BulletSimulatorItemImpl* _simImpl, BulletBody* bulletBody
     }
 }
 
+BulletShape::BulletShape()
+{
+    pMeshData = 0;
+    trimesh = 0;
+    collisionShape = 0;
+    isStatic = false;
+}
+
+
+BulletShape::~BulletShape()
+{
+    if(pMeshData)
+        delete pMeshData;
+    if(trimesh)
+        delete trimesh;
+
+    btCompoundShape* compoundShape = dynamic_cast<btCompoundShape*>(collisionShape);
+    if(compoundShape){
+        int num = compoundShape->getNumChildShapes();
+        for(int i=0; i<num; i++){
+            delete compoundShape->getChildShape(i);
+        }
+        delete compoundShape;
+    }else{
+        if(collisionShape)
+            delete collisionShape;
+    }
+}
+
+
 void BulletLink::createGeometry()
 {
     if(link->shape()){
+        shape = simImpl->findShape(link->shape(), shift, isStatic);
+        if(shape){
+            collisionShape = shape->collisionShape;
+            return;
+        }
         MeshExtractor* extractor = new MeshExtractor;
         if(extractor->extract(link->shape(), boost::bind(&BulletLink::addMesh, this, extractor, meshOnly))){
             if(!simImpl->useHACD){
@@ -293,6 +370,19 @@ void BulletLink::createGeometry()
             }
         }
         delete extractor;
+
+        // The vertex buffers referred by pMeshData are kept by swapping the vectors
+        shape = new BulletShape;
+        shape->vertices.swap(vertices);
+        shape->triangles.swap(triangles);
+        shape->pMeshData = pMeshData;
+        shape->trimesh = trimesh;
+        shape->collisionShape = collisionShape;
+        shape->shift = shift;
+        shape->isStatic = isStatic;
+        pMeshData = 0;
+        trimesh = 0;
+        simImpl->shapeCache.insert(make_pair(link->shape(), shape));
     }
 }
 
@@ -691,22 +781,7 @@ void BulletLink::createLinkBody(BulletSimulatorItemImpl* simImpl, BulletLink* pa
 
 BulletLink::~BulletLink()
 {
-    if(pMeshData)
-        delete pMeshData;
-    if(trimesh)
-        delete trimesh;
-
-    btCompoundShape* compoundShape = dynamic_cast<btCompoundShape*>(collisionShape);
-    if(compoundShape){
-        int num = compoundShape->getNumChildShapes();
-        for(int i=0; i<num; i++){
-            delete compoundShape->getChildShape(i);
-        }
-        delete compoundShape;
-    }else{
-        if(collisionShape)
-            delete collisionShape;
-    }
+    // The collision shape is deleted by the shape object when it is not shared any more
     if(motionState)
         delete motionState;
     if(body){
@@ -1033,6 +1108,7 @@ BulletSimulatorItemImpl::BulletSimulatorItemImpl(BulletSimulatorItem* self)
 
     useWorldCollision = false;
     velocityMode = false;
+    numThreads = 1;
 }
 
 
@@ -1059,6 +1135,7 @@ BulletSimulatorItemImpl::BulletSimulatorItemImpl(BulletSimulatorItem* self, cons
 
     useWorldCollision = org.useWorldCollision;
     velocityMode = org.velocityMode;
+    numThreads = org.numThreads;
 }
 
 void BulletSimulatorItemImpl::initialize()
@@ -1067,6 +1144,7 @@ void BulletSimulatorItemImpl::initialize()
     dispatcher = 0;
     broadphase = 0;
     solver =0;
+    solverMt = 0;
     dynamicsWorld = 0;
     self->SimulatorItem::setAllLinkPositionOutputMode(true);
 }
@@ -1113,11 +1191,7 @@ bool BulletSimulatorItemImpl::initializeSimulation(const std::vector<SimulationB
 {
     clear();
 
-    collisionConfiguration = new btDefaultCollisionConfiguration();
-    dispatcher = new btCollisionDispatcher(collisionConfiguration);
-    broadphase = new btDbvtBroadphase();
-    solver = new btSequentialImpulseConstraintSolver();
-    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+    createWorld();
     if(useWorldCollision){
         collisionDetector = self->collisionDetector();
         collisionDetector->clearGeometries();
@@ -1141,10 +1215,87 @@ bool BulletSimulatorItemImpl::initializeSimulation(const std::vector<SimulationB
     return true;
 }
 
+#ifdef BULLET_DYNAMICS_WORLD_MT
+static btITaskScheduler* getTaskScheduler(int numThreads)
+{
+    // The task scheduler is shared by all the simulator items and it is kept until the exit
+    static btITaskScheduler* scheduler = 0;
+    static bool isSchedulerCreated = false;
+    if(!isSchedulerCreated){
+        scheduler = btCreateDefaultTaskScheduler();
+        if(scheduler){
+            btSetTaskScheduler(scheduler);
+        }
+        isSchedulerCreated = true;
+    }
+    if(scheduler){
+        scheduler->setNumThreads(std::min(numThreads, scheduler->getMaxNumThreads()));
+    }
+    return scheduler;
+}
+#endif
+
+
+void BulletSimulatorItemImpl::createWorld()
+{
+    int n = numThreads;
+    if(n <= 0){
+        n = boost::thread::hardware_concurrency();
+    }
+    
+    collisionConfiguration = new btDefaultCollisionConfiguration();
+    broadphase = new btDbvtBroadphase();
+
+#ifdef BULLET_DYNAMICS_WORLD_MT
+    if(n > 1){
+        if(getTaskScheduler(n)){
+            /*
+              The narrow phase of the GImpact shapes is not thread-safe because
+              the shapes are locked by modifying their counters.
+            */
+            if(useHACD){
+                dispatcher = new btCollisionDispatcherMt(collisionConfiguration);
+            } else {
+                dispatcher = new btCollisionDispatcher(collisionConfiguration);
+            }
+            btConstraintSolverPoolMt* solverPool = new btConstraintSolverPoolMt(n);
+            solver = solverPool;
+#if BT_BULLET_VERSION >= 288
+            solverMt = new btSequentialImpulseConstraintSolverMt();
+            dynamicsWorld = new btDiscreteDynamicsWorldMt(
+                dispatcher, broadphase, solverPool, solverMt, collisionConfiguration);
+#else
+            dynamicsWorld = new btDiscreteDynamicsWorldMt(
+                dispatcher, broadphase, solverPool, collisionConfiguration);
+#endif
+            return;
+        }
+        MessageView::instance()->putln(
+            MessageView::WARNING,
+            boost::format(_("%1%: The task scheduler of Bullet cannot be created. The simulation is executed "
+                            "on a single thread.")) % self->name());
+    }
+#else
+    if(n > 1){
+        MessageView::instance()->putln(
+            MessageView::WARNING,
+            boost::format(_("%1%: The multithreaded dynamics world is not supported by the Bullet library "
+                            "used for building this plugin.")) % self->name());
+    }
+#endif
+
+    dispatcher = new btCollisionDispatcher(collisionConfiguration);
+    solver = new btSequentialImpulseConstraintSolver();
+    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+}
+
+
 void BulletSimulatorItemImpl::clear()
 {
     if(dynamicsWorld)
         delete dynamicsWorld;
+    if(solverMt)
+        delete solverMt;
     if(solver)
         delete solver;
     if(dispatcher)
@@ -1153,6 +1304,31 @@ void BulletSimulatorItemImpl::clear()
         delete collisionConfiguration;
     if(broadphase)
         delete broadphase;
+    dynamicsWorld = 0;
+    solverMt = 0;
+    solver = 0;
+    dispatcher = 0;
+    collisionConfiguration = 0;
+    broadphase = 0;
+
+    shapeCache.clear();
+}
+
+
+/**
+   The collision shapes are shared by the links which have the same shape node,
+   such as the links of the bodies duplicated from the same body item.
+*/
+BulletShape* BulletSimulatorItemImpl::findShape(SgNode* node, const btTransform& shift, bool isStatic)
+{
+    std::pair<ShapeCache::iterator, ShapeCache::iterator> range = shapeCache.equal_range(node);
+    for(ShapeCache::iterator p = range.first; p != range.second; ++p){
+        BulletShape* shape = p->second.get();
+        if(shape->isStatic == isStatic && shape->shift == shift){
+            return shape;
+        }
+    }
+    return 0;
 }
 
 void BulletSimulatorItemImpl::addBody(BulletBody* bulletBody, short group)
@@ -1224,6 +1400,7 @@ bool BulletSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>&
         }
 #endif
 
+    gyroAndAccelerationSensorHelpers.clear();
     for(size_t i=0; i < activeSimBodies.size(); ++i){
         BulletBody* bulletBody = static_cast<BulletBody*>(activeSimBodies[i]);
         if(!bulletBody->sensorHelper.forceSensors().empty()){
@@ -1231,9 +1408,10 @@ bool BulletSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>&
         }
         bulletBody->getKinematicStateFromBullet();
         if(bulletBody->sensorHelper.hasGyroOrAccelerationSensors()){
-            bulletBody->sensorHelper.updateGyroAndAccelerationSensors();
+            gyroAndAccelerationSensorHelpers.push_back(&bulletBody->sensorHelper);
         }
     }
+    BasicSensorSimulationHelper::updateGyroAndAccelerationSensors(gyroAndAccelerationSensorHelpers);
     return true;
 }
 
@@ -1259,6 +1437,7 @@ void BulletSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty(_("use HACD"), useHACD, changeProperty(useHACD));
     putProperty(_("Collision Margin"), collisionMargin, changeProperty(collisionMargin));
     putProperty(_("Velocity Control Mode"), velocityMode, changeProperty(velocityMode));
+    putProperty.min(0)(_("Number of threads"), numThreads, changeProperty(numThreads));
 }
 
 
@@ -1281,6 +1460,7 @@ void BulletSimulatorItemImpl::store(Archive& archive)
     archive.write("useHACD", useHACD);
     archive.write("CollisionMargin", collisionMargin);
     archive.write("velocityMode", velocityMode);
+    archive.write("numThreads", numThreads);
 }
 
 
@@ -1303,6 +1483,7 @@ void BulletSimulatorItemImpl::restore(const Archive& archive)
     archive.read("useHACD", useHACD);
     archive.read("CollisionMargin", collisionMargin);
     archive.read("velocityMode", velocityMode);
+    archive.read("numThreads", numThreads);
 }
 
 void BulletSimulatorItemImpl::setSolverParameter()
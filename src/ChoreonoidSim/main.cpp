@@ -0,0 +1,398 @@
+/*
+  This file is part of Choreonoid, an extensible graphical robotics application suit.
+  Copyright (c) 2007-2014 National Institute of Advanced Industrial Science and Technology (AIST)
+  Released under the MIT license. See accompanying file 'LICENSE' for more information.
+*/
+
+/**
+   This program runs the AIST simulation of a world in a project file without the GUI
+   as fast as possible and writes the result into a world log file, which can be
+   played back by WorldLogFileItem of the GUI.
+*/
+
+#include <cnoid/YAMLReader>
+#include <cnoid/EigenArchive>
+#include <cnoid/ExecutablePath>
+#include <cnoid/FileUtil>
+#include <cnoid/BodyLoader>
+#include <cnoid/DyWorld>
+#include <cnoid/DyBody>
+#include <cnoid/ConstraintForceSolver>
+#include <cnoid/ColdetModel>
+#include <cnoid/AISTCollisionDetector>
+#include <cnoid/SimulationLoop>
+#include <cnoid/WorldLogFileWriter>
+#include <cnoid/SimulationProfiler>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+using namespace boost;
+using namespace cnoid;
+
+namespace {
+
+struct SimOptions
+{
+    string projectFile;
+    string logFile;
+    string profileFile;
+    double timeLength;
+    double timeStep;
+    double logFrameRate;
+    bool doOutputAllLinkPositions;
+    bool doCompressLog;
+    bool doUseBodyCache;
+    int numThreads;
+};
+
+
+class ProjectWorldLoader
+{
+public:
+    filesystem::path projectDirPath;
+    BodyLoader bodyLoader;
+    vector<DyBodyPtr> bodies;
+    MappingPtr simulatorData;
+
+    ProjectWorldLoader(const string& projectFile)
+        : projectDirPath(filesystem::path(projectFile).parent_path()) {
+        bodyLoader.setMessageSink(cerr);
+    }
+
+    string expandPath(const string& path) {
+        string expanded = path;
+        static const string shareVar("${SHARE}");
+        static const string topVar("${PROGRAM_TOP}");
+        static const string projectDirVar("${PROJECT_DIR}");
+        if(expanded.compare(0, shareVar.size(), shareVar) == 0){
+            expanded.replace(0, shareVar.size(), shareDirectory());
+        } else if(expanded.compare(0, topVar.size(), topVar) == 0){
+            expanded.replace(0, topVar.size(), executableTopDirectory());
+        } else if(expanded.compare(0, projectDirVar.size(), projectDirVar) == 0){
+            expanded.replace(0, projectDirVar.size(), projectDirPath.string());
+        }
+        filesystem::path fpath(expanded);
+        if(!checkAbsolute(fpath)){
+            fpath = projectDirPath / fpath;
+        }
+        return getNativePathString(fpath);
+    }
+
+    bool loadItems(const Mapping* item, bool isInWorld) {
+        string className = item->get("class", "");
+        string name = item->get("name", "");
+        const Mapping* data = item->findMapping("data");
+
+        if(className == "WorldItem"){
+            if(isInWorld){
+                cerr << "Nested world items are not supported." << endl;
+                return false;
+            }
+            isInWorld = true;
+        } else if(isInWorld && className == "BodyItem" && data->isValid()){
+            if(!loadBody(name, *data)){
+                return false;
+            }
+        } else if(isInWorld && className == "AISTSimulatorItem" && !simulatorData){
+            if(data->isValid()){
+                simulatorData = const_cast<Mapping*>(data);
+            } else {
+                simulatorData = new Mapping();
+            }
+        }
+
+        const Listing* children = item->findListing("children");
+        if(children->isValid()){
+            for(int i=0; i < children->size(); ++i){
+                const Mapping* child = children->at(i)->toMapping();
+                if(!loadItems(child, isInWorld)){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool loadBody(const string& name, const Mapping& data) {
+        string modelFile;
+        if(!data.read("modelFile", modelFile)){
+            return true;
+        }
+        DyBodyPtr body = new DyBody;
+        if(!bodyLoader.load(body, expandPath(modelFile))){
+            cerr << "The model file of " << name << " cannot be loaded." << endl;
+            return false;
+        }
+        body->setName(name);
+
+        Vector3 p;
+        Matrix3 R;
+        if(read(data, "initialRootPosition", p) || read(data, "rootPosition", p)){
+            body->rootLink()->p() = p;
+        }
+        if(read(data, "initialRootAttitude", R) || read(data, "rootAttitude", R)){
+            body->rootLink()->R() = R;
+        }
+        const Listing* qs = data.findListing("initialJointPositions");
+        if(!qs->isValid()){
+            qs = data.findListing("jointPositions");
+        }
+        if(qs->isValid()){
+            const int nj = std::min(qs->size(), body->numAllJoints());
+            for(int i=0; i < nj; ++i){
+                body->joint(i)->q() = (*qs)[i].toDouble();
+            }
+        }
+        body->calcForwardKinematics();
+        bodies.push_back(body);
+        return true;
+    }
+};
+
+
+void setWorldParameters(World<ConstraintForceSolver>& world, const Mapping& data, const SimOptions& options)
+{
+    string symbol;
+    if(data.read("integrationMode", symbol) && symbol == "Euler"){
+        world.setEulerMethod();
+    } else {
+        world.setRungeKuttaMethod();
+    }
+    Vector3 gravity(0.0, 0.0, -9.80665);
+    read(data, "gravity", gravity);
+    world.setGravityAcceleration(gravity);
+    world.enableSensors(true);
+    world.setOldAccelSensorCalcMode(data.get("oldAccelSensorMode", false));
+    world.setTimeStep(options.timeStep);
+    world.setCurrentTime(0.0);
+    world.setNumThreads(options.numThreads >= 0 ? options.numThreads : data.get("dynamicsThreads", 0));
+    world.enablePackedLinkWorkspace(data.get("packedLinkWorkspace", false));
+
+    ColdetModel::setTreeCacheDirectory(
+        data.get("collisionTreeCache", false) ? ColdetModel::defaultTreeCacheDirectory() : string());
+
+    ConstraintForceSolver& cfs = world.constraintForceSolver;
+
+    if(data.get("primitiveCollision", false)){
+        AISTCollisionDetectorPtr collisionDetector = boost::make_shared<AISTCollisionDetector>();
+        collisionDetector->enablePrimitiveCollision(true);
+        cfs.setCollisionDetector(collisionDetector);
+    }
+
+    cfs.setGaussSeidelErrorCriterion(data.get("errorCriterion", cfs.gaussSeidelErrorCriterion()));
+    cfs.setGaussSeidelMaxNumIterations(data.get("maxNumIterations", cfs.gaussSeidelMaxNumIterations()));
+    cfs.setContactDepthCorrection(
+        data.get("contactCorrectionDepth", cfs.contactCorrectionDepth()),
+        data.get("contactCorrectionVelocityRatio", cfs.contactCorrectionVelocityRatio()));
+    cfs.enableIslandDecomposition(data.get("contactIslands", false));
+    cfs.enableBlockSparseMatrix(data.get("blockSparseContactMatrix", false));
+    cfs.enableContactWarmStart(data.get("contactWarmStart", false));
+    cfs.setSpeculativeContactMargin(data.get("speculativeContactMargin", 0.0));
+
+    cfs.setFriction(data.get("staticFriction", cfs.staticFriction()),
+                    data.get("slipFriction", cfs.slipFriction()));
+    cfs.setContactCullingDistance(data.get("cullingThresh", cfs.contactCullingDistance()));
+    cfs.setContactCullingDepth(data.get("contactCullingDepth", cfs.contactCullingDepth()));
+
+    if(data.get("2Dmode", false)){
+        cfs.set2Dmode(true);
+    }
+}
+
+
+class LogOutput
+{
+public:
+    World<ConstraintForceSolver>& world;
+    WorldLogFileWriter& writer;
+    SimulationLoop& loop;
+    bool doOutputAllLinkPositions;
+    double logTimeStep;
+    double nextLogTime;
+    int nextLogFrame;
+
+    LogOutput(World<ConstraintForceSolver>& world, WorldLogFileWriter& writer, SimulationLoop& loop,
+              double logTimeStep, bool doOutputAllLinkPositions)
+        : world(world), writer(writer), loop(loop),
+          doOutputAllLinkPositions(doOutputAllLinkPositions),
+          logTimeStep(logTimeStep) {
+        nextLogTime = 0.0;
+        nextLogFrame = 0;
+    }
+
+    void writeHeader() {
+        writer.beginHeaderOutput();
+        for(int i=0; i < world.numBodies(); ++i){
+            writer.outputBodyHeader(world.body(i)->name());
+        }
+        writer.endHeaderOutput();
+    }
+
+    void output() {
+        const double time = loop.currentTime();
+        while(time >= nextLogTime){
+            writer.beginFrameOutput(time);
+            for(int i=0; i < world.numBodies(); ++i){
+                writer.outputBodyState(world.body(i), doOutputAllLinkPositions);
+            }
+            writer.endFrameOutput();
+            nextLogTime = ++nextLogFrame * logTimeStep;
+        }
+    }
+};
+
+
+bool calcNextState(World<ConstraintForceSolver>* world)
+{
+    world->constraintForceSolver.clearExternalForces();
+    world->calcNextState();
+    return true;
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    SimOptions options;
+
+    program_options::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "show help message")
+        ("project", program_options::value<string>(&options.projectFile), "the project file to simulate")
+        ("time,t", program_options::value<double>(&options.timeLength)->default_value(10.0),
+         "the time length of the simulation")
+        ("timestep", program_options::value<double>(&options.timeStep)->default_value(0.001),
+         "the time step of the simulation")
+        ("log,o", program_options::value<string>(&options.logFile)->default_value("simulation.log"),
+         "the world log file to output")
+        ("log-frame-rate", program_options::value<double>(&options.logFrameRate)->default_value(0.0),
+         "the frame rate of the log (zero means the frame rate of the simulation)")
+        ("all-link-positions", program_options::bool_switch(&options.doOutputAllLinkPositions),
+         "output the positions of all the links")
+        ("compress-log", program_options::bool_switch(&options.doCompressLog),
+         "output the log in the compressed format")
+        ("body-cache", program_options::bool_switch(&options.doUseBodyCache),
+         "restore the body models from the binary caches in the user's cache directory")
+        ("threads", program_options::value<int>(&options.numThreads)->default_value(-1),
+         "the number of the dynamics threads (a negative value means the value of the project)")
+        ("profile", program_options::value<string>(&options.profileFile),
+         "output the durations of the simulation stages (.csv for CSV, otherwise Chrome trace)");
+
+    program_options::positional_options_description positionalOptions;
+    positionalOptions.add("project", 1);
+
+    program_options::variables_map variables;
+    try {
+        program_options::store(
+            program_options::command_line_parser(argc, argv).
+            options(desc).positional(positionalOptions).run(), variables);
+        program_options::notify(variables);
+    } catch (std::exception& ex) {
+        cerr << "Command line option error! : " << ex.what() << endl;
+        return 1;
+    }
+    if(variables.count("help") || options.projectFile.empty()){
+        cout << "Usage: choreonoid-sim [options] project-file\n" << desc << endl;
+        return variables.count("help") ? 0 : 1;
+    }
+    if(options.timeStep <= 0.0){
+        cerr << "The time step must be positive." << endl;
+        return 1;
+    }
+
+    if(options.doUseBodyCache){
+        BodyLoader::setCacheDirectory(BodyLoader::defaultCacheDirectory());
+    }
+
+    ProjectWorldLoader loader(options.projectFile);
+    try {
+        YAMLReader reader;
+        if(!reader.load(options.projectFile)){
+            cerr << reader.errorMessage() << endl;
+            return 1;
+        }
+        const Mapping* items = reader.document()->toMapping()->findMapping("items");
+        if(!items->isValid()){
+            cerr << options.projectFile << " does not contain any items." << endl;
+            return 1;
+        }
+        if(!loader.loadItems(items, false)){
+            return 1;
+        }
+    } catch (const ValueNode::Exception& ex){
+        cerr << ex.message() << endl;
+        return 1;
+    }
+    if(loader.bodies.empty()){
+        cerr << "There are no bodies to simulate in " << options.projectFile << "." << endl;
+        return 1;
+    }
+    if(!loader.simulatorData){
+        loader.simulatorData = new Mapping();
+    }
+
+    World<ConstraintForceSolver> world;
+    setWorldParameters(world, *loader.simulatorData, options);
+    for(size_t i=0; i < loader.bodies.size(); ++i){
+        world.addBody(loader.bodies[i]);
+    }
+    world.initialize();
+
+    WorldLogFileWriter writer;
+    writer.setAsynchronousOutputEnabled(true);
+    writer.setCompressionEnabled(options.doCompressLog);
+    if(!writer.open(options.logFile)){
+        cerr << options.logFile << " cannot be opened." << endl;
+        return 1;
+    }
+
+    SimulationLoop loop;
+    loop.setTimeStep(options.timeStep);
+    loop.setTimeLength(options.timeLength);
+    loop.setDynamicsFunction(boost::bind(calcNextState, &world));
+
+    const double logFrameRate = (options.logFrameRate > 0.0) ? options.logFrameRate : (1.0 / options.timeStep);
+    LogOutput logOutput(world, writer, loop, 1.0 / logFrameRate, options.doOutputAllLinkPositions);
+    logOutput.writeHeader();
+    logOutput.output();
+    loop.addPostDynamicsFunction(boost::bind(&LogOutput::output, &logOutput));
+
+    SimulationProfiler profiler;
+    if(!options.profileFile.empty()){
+        world.setProfiler(&profiler);
+        loop.setProfiler(&profiler);
+        profiler.setEnabled(true);
+    }
+
+    const int numFrames = loop.run();
+
+    writer.close();
+
+    cout << "Simulated " << loop.currentTime() << " [s] (" << numFrames << " frames) in "
+         << loop.actualSimulationTime() << " [s]." << endl;
+    if(writer.numBackpressuredFrames() > 0){
+        cout << writer.numBackpressuredFrames()
+             << " log frames were buffered in memory while the log file was being written." << endl;
+    }
+
+    if(profiler.isEnabled()){
+        profiler.setEnabled(false);
+        const int n = profiler.numStages();
+        for(int i=0; i < n; ++i){
+            cout << profiler.stageName(i) << ": average " << profiler.averageTime(i) * 1.0e3
+                 << " [ms], max " << profiler.maxTime(i) * 1.0e3 << " [ms]" << endl;
+        }
+        if(!profiler.exportFile(options.profileFile)){
+            cerr << options.profileFile << " cannot be written." << endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
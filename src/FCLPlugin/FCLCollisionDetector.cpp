@@ -8,12 +8,15 @@
 #include <cnoid/IdPair>
 #include <cnoid/MeshExtractor>
 #include <cnoid/SceneDrawables>
+#include <cnoid/TaskScheduler>
 #include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
 #include <fcl/collision.h>
 #include <fcl/shape/geometric_shapes.h>
 #include <fcl/BVH/BVH_model.h>
+#include <fcl/broadphase/broadphase_dynamic_AABB_tree.h>
 #include <boost/optional.hpp>
+#include <algorithm>
 
 using namespace std;
 using namespace boost;
@@ -89,6 +92,33 @@ CollisionObjectEx::~CollisionObjectEx()
 {
         
 }
+
+//! The user data of a collision object registered to the broadphase managers
+struct ObjectInfo
+{
+    int geometryId;
+    int subIndex; // 0 for the mesh object and 1 + the index for the primitive objects
+};
+
+//! A pair of the collision objects found by the broadphase
+struct CandidatePair
+{
+    CollisionObject* objects[2];
+    const ObjectInfo* infos[2];
+
+    bool operator<(const CandidatePair& rhs) const {
+        for(int i=0; i < 2; ++i){
+            if(infos[i]->geometryId != rhs.infos[i]->geometryId){
+                return infos[i]->geometryId < rhs.infos[i]->geometryId;
+            }
+        }
+        if(infos[0]->subIndex != rhs.infos[0]->subIndex){
+            return infos[0]->subIndex < rhs.infos[0]->subIndex;
+        }
+        return infos[1]->subIndex < rhs.infos[1]->subIndex;
+    }
+};
+
 }
 
 
@@ -102,17 +132,36 @@ public:
 
     vector<CollisionObjectExPtr> models;
     typedef set< IdPair<> > IdPairSet;
-    IdPairSet modelPairs;
     IdPairSet nonInterfarencePairs;
 
+    /*
+      The objects of the static models and those of the other models are managed separately
+      so that the pairs of the static models are never given by the broadphase.
+    */
+    DynamicAABBTreeCollisionManager dynamicObjectManager;
+    DynamicAABBTreeCollisionManager staticObjectManager;
+    vector<ObjectInfo> objectInfos;
+    bool isDynamicObjectManagerDirty;
+    bool isStaticObjectManagerDirty;
+
+    vector<CandidatePair> candidatePairs;
+    vector< vector<Collision> > candidateCollisions;
+
+    // The array given to the callback
+    CollisionPairArray callbackCollisionPairs;
+
     MeshExtractor* meshExtractor;
 
     int addGeometry(SgNode* geometry);
     void addMesh(CollisionObjectEx* model);
+    void clearObjectManagers();
     bool makeReady();
+    void registerObject(CollisionObject* object, int geometryId, int subIndex, bool isStatic);
     void updatePosition(int geometryId, const Position& position);
-    void detectCollisions(boost::function<void(const CollisionPair&)> callback);
-    void detectObjectCollisions(CollisionObject* object1, CollisionObject* object2, CollisionPair& collisionPair);
+    void detectCollisions(CollisionPairArray& out_collisionPairs);
+    static bool addCandidatePair(CollisionObject* object1, CollisionObject* object2, void* data);
+    void detectCandidatePairCollisions(int index);
+    void detectObjectCollisions(CollisionObject* object1, CollisionObject* object2, vector<Collision>& collisions);
 
 private :
 
@@ -130,6 +179,8 @@ FCLCollisionDetector::FCLCollisionDetector()
 FCLCollisionDetectorImpl::FCLCollisionDetectorImpl()
 {
     meshExtractor = new MeshExtractor();
+    isDynamicObjectManagerDirty = false;
+    isStaticObjectManagerDirty = false;
 }
 
 
@@ -141,6 +192,7 @@ FCLCollisionDetector::~FCLCollisionDetector()
 
 FCLCollisionDetectorImpl::~FCLCollisionDetectorImpl()
 {
+    clearObjectManagers();
     delete meshExtractor;
 }
 
@@ -159,9 +211,10 @@ CollisionDetectorPtr FCLCollisionDetector::clone() const
         
 void FCLCollisionDetector::clearGeometries()
 {
+    // The managers refer to the objects of the models
+    impl->clearObjectManagers();
     impl->models.clear();
     impl->nonInterfarencePairs.clear();
-    impl->modelPairs.clear();
 }
 
 
@@ -370,30 +423,67 @@ bool FCLCollisionDetector::makeReady()
 }
 
 
+void FCLCollisionDetectorImpl::clearObjectManagers()
+{
+    dynamicObjectManager.clear();
+    staticObjectManager.clear();
+    objectInfos.clear();
+    candidatePairs.clear();
+    isDynamicObjectManagerDirty = false;
+    isStaticObjectManagerDirty = false;
+}
+
+
 bool FCLCollisionDetectorImpl::makeReady()
 {
-    modelPairs.clear();
+    clearObjectManagers();
 
+    // The infos must not be reallocated after their pointers are given to the objects
+    int numObjects = 0;
     const int n = models.size();
     for(int i=0; i < n; ++i){
-        CollisionObjectExPtr& model1 = models[i];
-        if(model1){
-            for(int j = i+1; j < n; ++j){
-                CollisionObjectExPtr& model2 = models[j];
-                if(model2){
-                    if(!model1->isStatic || !model2->isStatic){
-                        if(nonInterfarencePairs.find(IdPair<>(i, j)) == nonInterfarencePairs.end()){
-                            modelPairs.insert(IdPair<>(i,j));
-                        }
-                    }
-                }
+        CollisionObjectExPtr& model = models[i];
+        if(model){
+            numObjects += model->primitiveObjects.size() + 1;
+        }
+    }
+    objectInfos.reserve(numObjects);
+
+    for(int i=0; i < n; ++i){
+        CollisionObjectExPtr& model = models[i];
+        if(model){
+            if(model->meshObject){
+                registerObject(model->meshObject.get(), i, 0, model->isStatic);
+            }
+            for(size_t j=0; j < model->primitiveObjects.size(); ++j){
+                registerObject(model->primitiveObjects[j].get(), i, j + 1, model->isStatic);
             }
         }
     }
+    dynamicObjectManager.setup();
+    staticObjectManager.setup();
+
     return true;
 }
 
 
+void FCLCollisionDetectorImpl::registerObject(CollisionObject* object, int geometryId, int subIndex, bool isStatic)
+{
+    objectInfos.push_back(ObjectInfo());
+    ObjectInfo& info = objectInfos.back();
+    info.geometryId = geometryId;
+    info.subIndex = subIndex;
+    object->setUserData(&info);
+    object->computeAABB();
+
+    if(isStatic){
+        staticObjectManager.registerObject(object);
+    } else {
+        dynamicObjectManager.registerObject(object);
+    }
+}
+
+
 void FCLCollisionDetector::updatePosition(int geometryId, const Position& position)
 {
     impl->updatePosition(geometryId, position);
@@ -410,6 +500,7 @@ void FCLCollisionDetectorImpl::updatePosition(int geometryId, const Position& _p
     if(model){
         if(model->meshObject){
             model->meshObject->setTransform(R,p);
+            model->meshObject->computeAABB();
         }
         vector<Transform3f>::iterator itt = model->primitiveLocalT.begin();
         for(vector<CollisionObjectPtr>::iterator it = model->primitiveObjects.begin();
@@ -418,56 +509,140 @@ void FCLCollisionDetectorImpl::updatePosition(int geometryId, const Position& _p
                 fcl::Transform3f trans(R,p);
                 trans *= (*itt);
                 (*it)->setTransform(trans);
+                (*it)->computeAABB();
             }
+
+        // The trees of the managers are refitted at once in the next collision detection
+        if(model->isStatic){
+            isStaticObjectManagerDirty = true;
+        } else {
+            isDynamicObjectManagerDirty = true;
+        }
+    }
+}
+
+
+void FCLCollisionDetector::updatePositions(int begin, int end, const PositionArray& positions)
+{
+    for(int i=begin; i < end; ++i){
+        impl->updatePosition(i, positions[i - begin]);
     }
 }
 
 
 void FCLCollisionDetector::detectCollisions(boost::function<void(const CollisionPair&)> callback)
 {
-    impl->detectCollisions(callback);
+    CollisionPairArray& collisionPairs = impl->callbackCollisionPairs;
+    impl->detectCollisions(collisionPairs);
+    for(size_t i=0; i < collisionPairs.size(); ++i){
+        callback(collisionPairs[i]);
+    }
+}
+
+
+void FCLCollisionDetector::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    impl->detectCollisions(out_collisionPairs);
 }
 
 
-void FCLCollisionDetectorImpl::detectCollisions(boost::function<void(const CollisionPair&)> callback)
+/**
+   The candidate pairs of the objects are given by the broadphase managers, and the narrowphase
+   of them is executed in parallel by TaskScheduler. The collisions of the objects are then
+   merged for each pair of the geometries in the order of the geometry ids.
+*/
+void FCLCollisionDetectorImpl::detectCollisions(CollisionPairArray& out_collisionPairs)
 {
-    CollisionPair collisionPair;
-    vector<Collision>& collisions = collisionPair.collisions;
+    if(isDynamicObjectManagerDirty){
+        dynamicObjectManager.update();
+        isDynamicObjectManagerDirty = false;
+    }
+    if(isStaticObjectManagerDirty){
+        staticObjectManager.update();
+        isStaticObjectManagerDirty = false;
+    }
+
+    candidatePairs.clear();
+    dynamicObjectManager.collide(this, &FCLCollisionDetectorImpl::addCandidatePair);
+    dynamicObjectManager.collide(&staticObjectManager, this, &FCLCollisionDetectorImpl::addCandidatePair);
+    std::sort(candidatePairs.begin(), candidatePairs.end());
 
-    for(IdPairSet::iterator it = modelPairs.begin(); it!=modelPairs.end(); it++){
-        CollisionObjectExPtr& model1 = models[(*it)(0)];
-        CollisionObjectExPtr& model2 = models[(*it)(1)];
-        collisions.clear();
+    const int numCandidates = candidatePairs.size();
+    if(numCandidates > (int)candidateCollisions.size()){
+        candidateCollisions.resize(numCandidates);
+    }
+    if(numCandidates > 1){
+        TaskScheduler::instance()->parallelFor(
+            0, numCandidates, boost::bind(&FCLCollisionDetectorImpl::detectCandidatePairCollisions, this, _1));
+    } else if(numCandidates == 1){
+        detectCandidatePairCollisions(0);
+    }
 
-        if(model1->meshObject){
-            if(model2->meshObject)
-                detectObjectCollisions(model1->meshObject.get(), model2->meshObject.get(), collisionPair);
-            for(vector<CollisionObjectPtr>::iterator itt = model2->primitiveObjects.begin();
-                itt!=model2->primitiveObjects.end(); itt++)
-                detectObjectCollisions(model1->meshObject.get(), (*itt).get(), collisionPair);
+    int numPairs = 0;
+    CollisionPair* collisionPair = 0;
+    for(int i=0; i < numCandidates; ++i){
+        vector<Collision>& collisions = candidateCollisions[i];
+        if(collisions.empty()){
+            continue;
         }
-        for(vector<CollisionObjectPtr>::iterator iter = model1->primitiveObjects.begin();
-            iter!=model1->primitiveObjects.end(); iter++){
-            if(model2->meshObject)
-                detectObjectCollisions((*iter).get(), model2->meshObject.get(), collisionPair);
-            for(vector<CollisionObjectPtr>::iterator itt = model2->primitiveObjects.begin();
-                itt!=model2->primitiveObjects.end(); itt++)
-                detectObjectCollisions((*iter).get(), (*itt).get(), collisionPair);
+        const CandidatePair& candidate = candidatePairs[i];
+        const int id1 = candidate.infos[0]->geometryId;
+        const int id2 = candidate.infos[1]->geometryId;
+        if(!collisionPair || collisionPair->geometryId[0] != id1 || collisionPair->geometryId[1] != id2){
+            // The element is reused so that the collision array keeps its capacity
+            if(numPairs == (int)out_collisionPairs.size()){
+                out_collisionPairs.push_back(CollisionPair());
+            }
+            collisionPair = &out_collisionPairs[numPairs++];
+            collisionPair->geometryId[0] = id1;
+            collisionPair->geometryId[1] = id2;
+            collisionPair->collisions.clear();
         }
+        collisionPair->collisions.insert(collisionPair->collisions.end(), collisions.begin(), collisions.end());
+    }
+
+    out_collisionPairs.resize(numPairs);
+}
 
-        if(!collisions.empty()){
-            collisionPair.geometryId[0] = (*it)(0);
-            collisionPair.geometryId[1] = (*it)(1);
-            callback(collisionPair);
+
+bool FCLCollisionDetectorImpl::addCandidatePair(CollisionObject* object1, CollisionObject* object2, void* data)
+{
+    FCLCollisionDetectorImpl* self = static_cast<FCLCollisionDetectorImpl*>(data);
+    const ObjectInfo* info1 = static_cast<const ObjectInfo*>(object1->getUserData());
+    const ObjectInfo* info2 = static_cast<const ObjectInfo*>(object2->getUserData());
+
+    if(info1->geometryId != info2->geometryId){
+        if(info1->geometryId > info2->geometryId){
+            std::swap(object1, object2);
+            std::swap(info1, info2);
+        }
+        if(self->nonInterfarencePairs.find(IdPair<>(info1->geometryId, info2->geometryId))
+           == self->nonInterfarencePairs.end()){
+            CandidatePair candidate;
+            candidate.objects[0] = object1;
+            candidate.objects[1] = object2;
+            candidate.infos[0] = info1;
+            candidate.infos[1] = info2;
+            self->candidatePairs.push_back(candidate);
         }
     }
 
+    // false means that the broadphase continues to find the pairs
+    return false;
+}
+
+
+void FCLCollisionDetectorImpl::detectCandidatePairCollisions(int index)
+{
+    const CandidatePair& candidate = candidatePairs[index];
+    vector<Collision>& collisions = candidateCollisions[index];
+    collisions.clear();
+    detectObjectCollisions(candidate.objects[0], candidate.objects[1], collisions);
 }
 
 
-void FCLCollisionDetectorImpl::detectObjectCollisions(CollisionObject* object1, CollisionObject* object2, CollisionPair& collisionPair)
+void FCLCollisionDetectorImpl::detectObjectCollisions(CollisionObject* object1, CollisionObject* object2, vector<Collision>& collisions)
 {
-    vector<Collision>& collisions = collisionPair.collisions;
     CollisionRequest request(std::numeric_limits<int>::max(), true);
     CollisionResult result;
     std::vector<Contact> contacts;
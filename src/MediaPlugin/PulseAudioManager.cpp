@@ -27,6 +27,9 @@ namespace {
 
 const bool TRACE_FUNCTIONS = true;
 
+// The target latency of the streams in the low-latency playback mode
+const pa_usec_t lowLatencyTargetUsec = 20000;
+
 PulseAudioManager* pulseAudioManager = 0;
 
 class Source
@@ -36,6 +39,8 @@ public:
     AudioItemPtr audioItem;
     pa_stream* stream;
     int currentFrame;
+    double startTime;
+    pa_usec_t initialStreamTime;
     bool isConnected;
     bool isActive_;
     bool doAdjustTime;
@@ -63,6 +68,7 @@ public:
     void seek(double time);
     void initializePlayback(double time);
     void startPlayback();
+    bool getPlaybackTime(double& out_time);
     void write(size_t nbytes, bool isDoingInitialization);
     void onAllFramesWritten(pa_usec_t latency);
     void onBufferOverflow();
@@ -96,6 +102,14 @@ public:
        the code for doing that way has not been removed and can be enabled.
     */
     Action* connectionKeepCheck;
+
+    /**
+       The streams are connected with the small buffers, and the playback time of the time bar
+       is given by the playback position of the audio in this mode so that the animation does
+       not drift from the audio and the playback responds quickly to seeking. The connections
+       are kept in this mode to avoid the delay of connecting the streams.
+    */
+    Action* lowLatencyPlaybackCheck;
         
     Action* fullSyncPlaybackMenuItem;
     double maxTimeOfActiveSources;
@@ -108,12 +122,19 @@ public:
     PulseAudioManagerImpl(ExtensionManager* ext);
     ~PulseAudioManagerImpl();
     void finalize();
+    bool isKeepingConnection() const {
+        return connectionKeepCheck->isChecked() || lowLatencyPlaybackCheck->isChecked();
+    }
+    bool isLowLatencyMode() const {
+        return lowLatencyPlaybackCheck->isChecked();
+    }
     void onItemCheckToggled(Item* item, bool isChecked);
     void onFullSyncPlaybackToggled();
     bool onPlaybackInitialized(double time);
     void onPlaybackStarted(double time);
     void onPlaybackStopped(double time);
     bool onTimeChanged(double time);
+    bool getAudioPlaybackTime(double& out_time);
     bool store(Archive& archive);
     void restore(const Archive& archive);
     bool playAudioFile(const std::string& filename, double volumeRatio);
@@ -209,6 +230,8 @@ PulseAudioManagerImpl::PulseAudioManagerImpl(ExtensionManager* ext)
 
     connectionKeepCheck = mm.addCheckItem(_("Keep Stream Connections"));
 
+    lowLatencyPlaybackCheck = mm.addCheckItem(_("Low-Latency Playback"));
+
     fullSyncPlaybackMenuItem = mm.addCheckItem(_("Fully-Synchronized Audio Playback"));
     fullSyncPlaybackMenuItem->sigToggled().connect(
         boost::bind(&PulseAudioManagerImpl::onFullSyncPlaybackToggled, this));
@@ -360,6 +383,9 @@ void PulseAudioManagerImpl::onPlaybackStarted(double time)
         SourcePtr& source = p->second;
         source->startPlayback();
     }
+    if(isLowLatencyMode()){
+        timeBar->setPlaybackClock(boost::bind(&PulseAudioManagerImpl::getAudioPlaybackTime, this, _1));
+    }
 }
 
 
@@ -370,6 +396,7 @@ void PulseAudioManagerImpl::onPlaybackStopped(double time)
         source->stop();
     }
     sigTimeChangedConnection.disconnect();
+    timeBar->setPlaybackClock(boost::function<bool(double&)>());
 }
 
 
@@ -389,9 +416,27 @@ bool PulseAudioManagerImpl::onTimeChanged(double time)
 }
 
 
+/**
+   The playback time is given by the first source which is playing the audio data
+*/
+bool PulseAudioManagerImpl::getAudioPlaybackTime(double& out_time)
+{
+    if(timeBar->playbackSpeedScale() != 1.0){
+        return false;
+    }
+    for(SourceMap::iterator p = activeSources.begin(); p != activeSources.end(); ++p){
+        if(p->second->getPlaybackTime(out_time)){
+            return true;
+        }
+    }
+    return false;
+}
+
+
 bool PulseAudioManagerImpl::store(Archive& archive)
 {
     archive.write("keepStreamConnection", connectionKeepCheck->isChecked());
+    archive.write("lowLatencyPlayback", lowLatencyPlaybackCheck->isChecked());
     return true;
 }
 
@@ -399,6 +444,7 @@ bool PulseAudioManagerImpl::store(Archive& archive)
 void PulseAudioManagerImpl::restore(const Archive& archive)
 {
     connectionKeepCheck->setChecked(archive.get("keepStreamConnection", connectionKeepCheck->isChecked()));
+    lowLatencyPlaybackCheck->setChecked(archive.get("lowLatencyPlayback", lowLatencyPlaybackCheck->isChecked()));
 }
 
 
@@ -409,6 +455,8 @@ Source::Source(PulseAudioManagerImpl* manager, AudioItemPtr audioItem)
 {
     stream = 0;
     currentFrame = 0;
+    startTime = 0.0;
+    initialStreamTime = 0;
     isConnected = false;
     isActive_ = false;
     operation = 0;
@@ -487,7 +535,7 @@ bool Source::initialize()
 
     bool initialized;
     
-    if(manager->connectionKeepCheck->isChecked()){
+    if(manager->isKeepingConnection()){
         initialized = connectStream();
     } else {
         initialized = true;
@@ -522,18 +570,16 @@ bool Source::connectStream()
     //pa_stream_flags_t flags = PA_STREAM_START_CORKED;
     pa_stream_flags_t flags = (pa_stream_flags)(PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING);
     
-
-    /*
-      pa_buffer_attr attr;
-      attr.maxlength = -1;
-      attr.tlength = -1;
-      attr.prebuf = -1;
-      attr.minreq = -1;
-      attr.fragsize = -1;
-      flags = (pa_stream_flags_t)(
-      flags | PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
-      pattr = &attr;
-    */
+    pa_buffer_attr attr;
+    if(manager->isLowLatencyMode()){
+        attr.maxlength = (uint32_t)-1;
+        attr.tlength = pa_usec_to_bytes(lowLatencyTargetUsec, &sampleSpec);
+        attr.prebuf = (uint32_t)-1;
+        attr.minreq = pa_usec_to_bytes(lowLatencyTargetUsec / 4, &sampleSpec);
+        attr.fragsize = (uint32_t)-1;
+        flags = (pa_stream_flags_t)(flags | PA_STREAM_ADJUST_LATENCY);
+        pattr = &attr;
+    }
     
     int result = pa_stream_connect_playback(stream, NULL, pattr, flags, NULL, NULL);
     if(result < 0){
@@ -618,7 +664,18 @@ void Source::initializePlayback(double time)
     if(!isActive_ && connectStream()){
 
         seek(time);
+        startTime = time;
         initialWritingDone = false;
+
+        // The stream time at the start position is used to give the playback time from the stream time
+        initialStreamTime = 0;
+        if(manager->isLowLatencyMode()){
+            operation = pa_stream_update_timing_info(stream, pa_stream_success_callback, this);
+            waitForOperation();
+            if(pa_stream_get_time(stream, &initialStreamTime) < 0){
+                initialStreamTime = 0;
+            }
+        }
         size_t writableSize = pa_stream_writable_size(stream);
         
         if(writableSize <= 0){
@@ -672,7 +729,7 @@ void Source::write(size_t nbytes, bool isDoingInitialization)
         silenceBuf.resize(numSilentFrames * sampleSpec.channels, 0.0f);
         pa_stream_write(stream, &silenceBuf[0], (numSilentFrames * frameSize), NULL, 0, seekMode);
         currentFrame += numSilentFrames;
-        numBufFrames = pa_stream_writable_size(stream);
+        numBufFrames -= numSilentFrames;
         seekMode = PA_SEEK_RELATIVE;
     }
 
@@ -700,6 +757,31 @@ void Source::write(size_t nbytes, bool isDoingInitialization)
 }
 
 
+/**
+   The time is given from the playback position of the stream, which is interpolated from the
+   timing information of the server and corrected with the latency of the output device.
+   \return false if the stream is not playing the audio data
+*/
+bool Source::getPlaybackTime(double& out_time)
+{
+    bool isValid = false;
+    
+    pa_threaded_mainloop_lock(manager->mainloop);
+
+    if(stream && isActive_ && !hasAllFramesWritten){
+        pa_usec_t streamTime;
+        if(pa_stream_get_time(stream, &streamTime) == 0 && streamTime >= initialStreamTime){
+            out_time = startTime + (streamTime - initialStreamTime) / 1000000.0;
+            isValid = true;
+        }
+    }
+    
+    pa_threaded_mainloop_unlock(manager->mainloop);
+
+    return isValid;
+}
+
+
 void Source::onAllFramesWritten(pa_usec_t latency)
 {
     timeToFinish = manager->timeBar->realPlaybackTime() + latency / 1000000.0;
@@ -719,6 +801,11 @@ void Source::onBufferUnderflow()
 
 void Source::adjustTime(const char* reason)
 {
+    if(manager->isLowLatencyMode()){
+        // The time bar follows the audio in this mode
+        return;
+    }
+    
     pa_threaded_mainloop_lock(manager->mainloop);
     double time = manager->timeBar->realPlaybackTime();
     seek(time);
@@ -745,7 +832,7 @@ void Source::stop()
         operation = pa_stream_cork(stream, 1, pa_stream_success_callback, this);
         waitForOperation();
 
-        if(manager->connectionKeepCheck->isChecked()){
+        if(manager->isKeepingConnection()){
             operation = pa_stream_flush(stream, pa_stream_success_callback, this);
             //waitForOperation();
         } else {
@@ -101,7 +101,11 @@ public:
                  Eigen::aligned_allocator< pair<const dGeomID, Position> > > OffsetMap;
     OffsetMap offsetMap;
 
-    boost::function<void(const CollisionPair&)> callback_;
+    // The array which the pairs detected by nearCallback() are stored into
+    CollisionPairArray* collisionPairs;
+    int numCollisionPairs;
+    // The array given to the callback
+    CollisionPairArray callbackCollisionPairs;
 
     MeshExtractor* meshExtractor;
 
@@ -110,7 +114,7 @@ public:
     void setNonInterfarenceGeometyrPair(int geometryId1, int geometryId2);
     bool makeReady();
     void updatePosition(int geometryId, const Position& position);
-    void detectCollisions(boost::function<void(const CollisionPair&)> callback);
+    void detectCollisions(CollisionPairArray& out_collisionPairs);
 
 private :
 
@@ -130,6 +134,9 @@ ODECollisionDetectorImpl::ODECollisionDetectorImpl()
     spaceID = dHashSpaceCreate(0);
     dSpaceSetCleanup(spaceID, 0);
 
+    collisionPairs = 0;
+    numCollisionPairs = 0;
+
     meshExtractor = new MeshExtractor;
 }
 
@@ -395,6 +402,14 @@ void ODECollisionDetector::updatePosition(int geometryId, const Position& positi
 }
 
 
+void ODECollisionDetector::updatePositions(int begin, int end, const PositionArray& positions)
+{
+    for(int i=begin; i < end; ++i){
+        impl->updatePosition(i, positions[i - begin]);
+    }
+}
+
+
 void ODECollisionDetectorImpl::updatePosition(int geometryId, const Position& _position)
 {
     GeometryExPtr& model = models[geometryId];
@@ -440,8 +455,13 @@ static void nearCallback(void* data, dGeomID g1, dGeomID g2)
         int numContacts= dCollide(g1, g2, MaxNumContacts, &contacts[0].geom, sizeof(dContact));
 
         if(numContacts > 0 ){
-            CollisionPair collisionPair;
+            CollisionPairArray& collisionPairs = *impl->collisionPairs;
+            if(impl->numCollisionPairs == (int)collisionPairs.size()){
+                collisionPairs.push_back(CollisionPair());
+            }
+            CollisionPair& collisionPair = collisionPairs[impl->numCollisionPairs++];
             vector<Collision>& collisions = collisionPair.collisions;
+            collisions.clear();
             int id1 = impl->geomIDMap.find(g1)->second;
             int id2 = impl->geomIDMap.find(g2)->second;
             collisionPair.geometryId[0] = id2;
@@ -457,7 +477,6 @@ static void nearCallback(void* data, dGeomID g1, dGeomID g2)
                 collision.normal[2] = contacts[i].geom.normal[2];
                 collision.depth = contacts[i].geom.depth;
             }
-            impl->callback_(collisionPair);
         }
     }
 }
@@ -465,6 +484,25 @@ static void nearCallback(void* data, dGeomID g1, dGeomID g2)
 
 void ODECollisionDetector::detectCollisions(boost::function<void(const CollisionPair&)> callback)
 {
-    impl->callback_ = callback;
-    dSpaceCollide(impl->spaceID, (void*)impl, &nearCallback);
+    CollisionPairArray& collisionPairs = impl->callbackCollisionPairs;
+    impl->detectCollisions(collisionPairs);
+    for(size_t i=0; i < collisionPairs.size(); ++i){
+        callback(collisionPairs[i]);
+    }
+}
+
+
+void ODECollisionDetector::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    impl->detectCollisions(out_collisionPairs);
+}
+
+
+void ODECollisionDetectorImpl::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    collisionPairs = &out_collisionPairs;
+    numCollisionPairs = 0;
+    dSpaceCollide(spaceID, (void*)this, &nearCallback);
+    out_collisionPairs.resize(numCollisionPairs);
+    collisionPairs = 0;
 }
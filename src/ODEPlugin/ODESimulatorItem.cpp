@@ -26,8 +26,12 @@
 #define ITEM_NAME N_("GazeboODESimulatorItem")
 #else
 #include <ode/ode.h>
+#ifdef ODE_THREADING_IMPL
+#include <ode/threading_impl.h>
+#endif
 #define ITEM_NAME N_("ODESimulatorItem")
 #endif
+#include <boost/thread.hpp>
 #include <iostream>
 
 #include <cnoid/MessageView>
@@ -167,12 +171,14 @@ public:
         
     dWorldID worldID;
     dSpaceID spaceID;
+    dSpaceID staticSpaceID;
     dJointGroupID contactJointGroupID;
     double timeStep;
     CrawlerLinkMap crawlerLinks;
     vector<ODELink*> geometryIdToLink;
 
     Selection stepMode;
+    Selection broadphaseType;
     Vector3 gravity;
     double friction;
     bool isJointLimitMode;
@@ -187,6 +193,13 @@ public:
     bool useWorldCollision;
     CollisionDetectorPtr collisionDetector;
     bool velocityMode;
+    int numThreads;
+
+#ifdef ODE_THREADING_IMPL
+    dThreadingImplementationID threadingImpl;
+    dThreadingThreadPoolID threadPool;
+    int numPoolThreads;
+#endif
 
     double physicsTime;
     QElapsedTimer physicsTimer;
@@ -232,13 +245,18 @@ public:
 #endif                               /* MECANUM_WHEEL_ODE_DEBUG */
 #endif                      /* MECANUM_WHEEL_ODE */
 
+    vector<BasicSensorSimulationHelper*> gyroAndAccelerationSensorHelpers;
+
     ODESimulatorItemImpl(ODESimulatorItem* self);
     ODESimulatorItemImpl(ODESimulatorItem* self, const ODESimulatorItemImpl& org);
     void initialize();
     ~ODESimulatorItemImpl();
     void clear();
     bool initializeSimulation(const std::vector<SimulationBody*>& simBodies);
+    void createSpaces(const std::vector<SimulationBody*>& simBodies);
     void addBody(ODEBody* odeBody);
+    void setUpThreading();
+    void releaseThreading();
     bool stepSimulation(const std::vector<SimulationBody*>& activeSimBodies);
     void doPutProperties(PutPropertyFunction& putProperty);
     void store(Archive& archive);
@@ -794,7 +812,7 @@ void ODEBody::createBody(ODESimulatorItemImpl* simImpl)
         geometryId = addBodyToCollisionDetector(*body, *simImpl->collisionDetector, 
                                                 bodyItem()->isSelfCollisionDetectionEnabled());
     }else{
-        spaceID = dHashSpaceCreate(simImpl->spaceID);
+        spaceID = dHashSpaceCreate(body->isStaticModel() ? simImpl->staticSpaceID : simImpl->spaceID);
         dSpaceSetCleanup(spaceID, 0);
     }
 
@@ -997,14 +1015,19 @@ ODESimulatorItem::ODESimulatorItem()
 
 ODESimulatorItemImpl::ODESimulatorItemImpl(ODESimulatorItem* self)
     : self(self),
-      stepMode(ODESimulatorItem::NUM_STEP_MODES, CNOID_GETTEXT_DOMAIN_NAME)
-
+      stepMode(ODESimulatorItem::NUM_STEP_MODES, CNOID_GETTEXT_DOMAIN_NAME),
+      broadphaseType(ODESimulatorItem::NUM_BROADPHASE_TYPES, CNOID_GETTEXT_DOMAIN_NAME)
 {
     initialize();
 
     stepMode.setSymbol(ODESimulatorItem::STEP_ITERATIVE,  N_("Iterative (quick step)"));
     stepMode.setSymbol(ODESimulatorItem::STEP_BIG_MATRIX, N_("Big matrix"));
     stepMode.select(ODESimulatorItem::STEP_ITERATIVE);
+
+    broadphaseType.setSymbol(ODESimulatorItem::BROADPHASE_HASH, N_("Hash"));
+    broadphaseType.setSymbol(ODESimulatorItem::BROADPHASE_QUADTREE, N_("Quadtree"));
+    broadphaseType.setSymbol(ODESimulatorItem::BROADPHASE_SAP, N_("SAP"));
+    broadphaseType.select(ODESimulatorItem::BROADPHASE_HASH);
     
     gravity << 0.0, 0.0, -DEFAULT_GRAVITY_ACCELERATION;
     globalERP = 0.4;
@@ -1020,6 +1043,7 @@ ODESimulatorItemImpl::ODESimulatorItemImpl(ODESimulatorItem* self)
     flipYZ = false;
     useWorldCollision = false;
     velocityMode = false;
+    numThreads = 1;
 
 #ifdef MECANUM_WHEEL_ODE    /* MECANUM_WHEEL_ODE */
 #if (MECANUM_WHEEL_ODE_DEBUG > 0)    /* MECANUM_WHEEL_ODE_DEBUG */
@@ -1042,6 +1066,7 @@ ODESimulatorItemImpl::ODESimulatorItemImpl(ODESimulatorItem* self, const ODESimu
     initialize();
 
     stepMode = org.stepMode;
+    broadphaseType = org.broadphaseType;
     gravity = org.gravity;
     globalERP = org.globalERP;
     globalCFM = org.globalCFM;
@@ -1056,6 +1081,7 @@ ODESimulatorItemImpl::ODESimulatorItemImpl(ODESimulatorItem* self, const ODESimu
     flipYZ = org.flipYZ;
     useWorldCollision = org.useWorldCollision;
     velocityMode = org.velocityMode;
+    numThreads = org.numThreads;
 }
 
 
@@ -1063,8 +1089,15 @@ void ODESimulatorItemImpl::initialize()
 {
     worldID = 0;
     spaceID = 0;
+    staticSpaceID = 0;
     contactJointGroupID = dJointGroupCreate(0);
     self->SimulatorItem::setAllLinkPositionOutputMode(true);
+
+#ifdef ODE_THREADING_IMPL
+    threadingImpl = 0;
+    threadPool = 0;
+    numPoolThreads = 0;
+#endif
 }
 
 
@@ -1081,6 +1114,8 @@ ODESimulatorItemImpl::~ODESimulatorItemImpl()
     if(contactJointGroupID){
         dJointGroupDestroy(contactJointGroupID);
     }
+
+    releaseThreading();
 }
 
 
@@ -1090,6 +1125,12 @@ void ODESimulatorItem::setStepMode(int value)
 }
 
 
+void ODESimulatorItem::setBroadphaseType(int type)
+{
+    impl->broadphaseType.select(type);
+}
+
+
 void ODESimulatorItem::setGravity(const Vector3& gravity)
 {
     impl->gravity = gravity;
@@ -1132,6 +1173,12 @@ void ODESimulatorItem::setNumIterations(int n)
 }
 
 
+void ODESimulatorItem::setNumThreads(int n)
+{
+    impl->numThreads = n;
+}
+
+
 void ODESimulatorItem::setOverRelaxation(double value)
 {
     impl->overRelaxation = value;
@@ -1232,6 +1279,10 @@ void ODESimulatorItemImpl::clear()
         dWorldDestroy(worldID);
         worldID = 0;
     }
+    if(staticSpaceID){
+        dSpaceDestroy(staticSpaceID);
+        staticSpaceID = 0;
+    }
     if(spaceID){
         dSpaceDestroy(spaceID);
         spaceID = 0;
@@ -1291,8 +1342,7 @@ bool ODESimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody
         collisionDetector = self->collisionDetector();
         collisionDetector->clearGeometries();
     }else{
-        spaceID = dHashSpaceCreate(0);
-        dSpaceSetCleanup(spaceID, 0);
+        createSpaces(simBodies);
     }
 
     dRandSetSeed(0);
@@ -1305,6 +1355,8 @@ bool ODESimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody
     dWorldSetContactMaxCorrectingVel(worldID, enableMaxCorrectingVel ? maxCorrectingVel.value() : dInfinity);
     dWorldSetContactSurfaceLayer(worldID, surfaceLayerDepth);
 
+    setUpThreading();
+
     timeStep = self->worldTimeStep();
 
     for(size_t i=0; i < simBodies.size(); ++i){
@@ -1330,6 +1382,56 @@ bool ODESimulatorItemImpl::initializeSimulation(const std::vector<SimulationBody
 }
 
 
+/**
+   The spaces of the static bodies are put into the static space, which is a child of the top space.
+   The static space is only collided with the other children of the top space and it is never
+   collided with itself, so the pairs of the static bodies are not checked.
+   The bounds of the quadtree are determined from the initial positions of the bodies.
+*/
+void ODESimulatorItemImpl::createSpaces(const std::vector<SimulationBody*>& simBodies)
+{
+    if(broadphaseType.is(ODESimulatorItem::BROADPHASE_QUADTREE)){
+        BoundingBox bbox;
+        for(size_t i=0; i < simBodies.size(); ++i){
+            Body* body = simBodies[i]->body();
+            for(int j=0; j < body->numLinks(); ++j){
+                Link* link = body->link(j);
+                if(link->collisionShape()){
+                    BoundingBox linkBBox = link->collisionShape()->boundingBox();
+                    linkBBox.transform(Affine3(link->T()));
+                    bbox.expandBy(linkBBox);
+                }
+            }
+        }
+        Vector3 center = Vector3::Zero();
+        Vector3 extents(10.0, 10.0, 10.0);
+        if(!bbox.empty()){
+            // The margin is given for the bodies moving out of the initial bounds
+            center = bbox.center();
+            extents = bbox.size() * 1.5 + Vector3(1.0, 1.0, 1.0);
+        }
+        if(flipYZ){
+            Vector3 c = center;
+            toInternal(c, center);
+            std::swap(extents.y(), extents.z());
+        }
+        dVector3 dCenter = { center.x(), center.y(), center.z(), 0.0 };
+        dVector3 dExtents = { extents.x(), extents.y(), extents.z(), 0.0 };
+        spaceID = dQuadTreeSpaceCreate(0, dCenter, dExtents, 6);
+
+    } else if(broadphaseType.is(ODESimulatorItem::BROADPHASE_SAP)){
+        spaceID = dSweepAndPruneSpaceCreate(0, dSAP_AXES_XYZ);
+
+    } else {
+        spaceID = dHashSpaceCreate(0);
+    }
+    dSpaceSetCleanup(spaceID, 0);
+
+    staticSpaceID = dHashSpaceCreate(spaceID);
+    dSpaceSetCleanup(staticSpaceID, 0);
+}
+
+
 void ODESimulatorItemImpl::addBody(ODEBody* odeBody)
 {
     Body& body = *odeBody->body();
@@ -1523,6 +1625,72 @@ bool ODESimulatorItemImpl::getMecanumWheelSetting(dBodyID dBdyId, double* angle)
 }
 #endif                      /* MECANUM_WHEEL_ODE */
 
+/**
+   The threading implementation and the thread pool are kept over the steps and the simulations
+   until the number of the threads is changed, so that the threads are not created every time.
+*/
+void ODESimulatorItemImpl::setUpThreading()
+{
+    int n = numThreads;
+    if(n <= 0){
+        n = boost::thread::hardware_concurrency();
+    }
+
+#ifdef ODE_THREADING_IMPL
+    if(n != numPoolThreads){
+        releaseThreading();
+    }
+    if(n > 1 && !threadingImpl){
+        threadingImpl = dThreadingAllocateMultiThreadedImplementation();
+        if(threadingImpl){
+            threadPool = dThreadingAllocateThreadPool(n, 0, dAllocateFlagBasicData, 0);
+            if(threadPool){
+                dThreadingThreadPoolServeMultiThreadedImplementation(threadPool, threadingImpl);
+                numPoolThreads = n;
+            } else {
+                dThreadingFreeImplementation(threadingImpl);
+                threadingImpl = 0;
+            }
+        }
+        if(!threadingImpl){
+            MessageView::instance()->putln(
+                MessageView::WARNING,
+                boost::format(_("%1%: The threads of ODE cannot be created. The simulation is executed "
+                                "on a single thread.")) % self->name());
+        }
+    }
+    if(threadingImpl){
+        dWorldSetStepIslandsProcessingMaxThreadCount(worldID, n);
+        dWorldSetStepThreadingImplementation(
+            worldID, dThreadingImplementationGetFunctions(threadingImpl), threadingImpl);
+    }
+#else
+    if(n > 1){
+        MessageView::instance()->putln(
+            MessageView::WARNING,
+            boost::format(_("%1%: The multithreaded stepping is not supported by the ODE library "
+                            "used for building this plugin.")) % self->name());
+    }
+#endif
+}
+
+
+//! This must be called after the world which uses the threading implementation is destroyed
+void ODESimulatorItemImpl::releaseThreading()
+{
+#ifdef ODE_THREADING_IMPL
+    if(threadingImpl){
+        dThreadingImplementationShutdownProcessing(threadingImpl);
+        dThreadingFreeThreadPool(threadPool);
+        dThreadingFreeImplementation(threadingImpl);
+        threadingImpl = 0;
+        threadPool = 0;
+        numPoolThreads = 0;
+    }
+#endif
+}
+
+
 void ODESimulatorItem::initializeSimulationThread()
 {
     dAllocateODEDataForThread(dAllocateMaskAll);
@@ -1705,6 +1873,7 @@ bool ODESimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>& ac
     }
 
     //! \todo Bodies with sensors should be managed by the specialized container to increase the efficiency
+    gyroAndAccelerationSensorHelpers.clear();
     for(size_t i=0; i < activeSimBodies.size(); ++i){
         ODEBody* odeBody = static_cast<ODEBody*>(activeSimBodies[i]);
 
@@ -1718,9 +1887,10 @@ bool ODESimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>& ac
         }
         odeBody->getKinematicStateFromODE(flipYZ);
         if(odeBody->sensorHelper.hasGyroOrAccelerationSensors()){
-            odeBody->sensorHelper.updateGyroAndAccelerationSensors();
+            gyroAndAccelerationSensorHelpers.push_back(&odeBody->sensorHelper);
         }
     }
+    BasicSensorSimulationHelper::updateGyroAndAccelerationSensors(gyroAndAccelerationSensorHelpers);
 
     return true;
 }
@@ -1812,6 +1982,8 @@ void ODESimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
 {
     putProperty(_("Step mode"), stepMode, changeProperty(stepMode));
 
+    putProperty(_("Broadphase"), broadphaseType, changeProperty(broadphaseType));
+
     putProperty(_("Gravity"), str(gravity), boost::bind(toVector3, _1, boost::ref(gravity)));
 
     putProperty.decimals(2).min(0.0)
@@ -1831,6 +2003,9 @@ void ODESimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty.min(0.1).max(1.9)
         (_("Over relaxation"), overRelaxation, changeProperty(overRelaxation));
 
+    putProperty.min(0)
+        (_("Number of threads"), numThreads, changeProperty(numThreads));
+
     putProperty(_("Limit correcting vel."), enableMaxCorrectingVel, changeProperty(enableMaxCorrectingVel));
 
     putProperty(_("Max correcting vel."), maxCorrectingVel,
@@ -1861,6 +2036,7 @@ bool ODESimulatorItem::store(Archive& archive)
 void ODESimulatorItemImpl::store(Archive& archive)
 {
     archive.write("stepMode", stepMode.selectedSymbol());
+    archive.write("broadphase", broadphaseType.selectedSymbol());
     write(archive, "gravity", gravity);
     archive.write("friction", friction);
     archive.write("jointLimitMode", isJointLimitMode);
@@ -1868,6 +2044,7 @@ void ODESimulatorItemImpl::store(Archive& archive)
     archive.write("globalCFM", globalCFM);
     archive.write("numIterations", numIterations);
     archive.write("overRelaxation", overRelaxation);
+    archive.write("numThreads", numThreads);
     archive.write("limitCorrectingVel", enableMaxCorrectingVel);
     archive.write("maxCorrectingVel", maxCorrectingVel);
     archive.write("2Dmode", is2Dmode);
@@ -1890,6 +2067,9 @@ void ODESimulatorItemImpl::restore(const Archive& archive)
     if(archive.read("stepMode", symbol)){
         stepMode.select(symbol);
     }
+    if(archive.read("broadphase", symbol)){
+        broadphaseType.select(symbol);
+    }
     read(archive, "gravity", gravity);
     archive.read("friction", friction);
     archive.read("jointLimitMode", isJointLimitMode);
@@ -1897,6 +2077,7 @@ void ODESimulatorItemImpl::restore(const Archive& archive)
     globalCFM = archive.get("globalCFM", globalCFM.string());
     archive.read("numIterations", numIterations);
     archive.read("overRelaxation", overRelaxation);
+    archive.read("numThreads", numThreads);
     archive.read("limitCorrectingVel", enableMaxCorrectingVel);
     maxCorrectingVel = archive.get("maxCorrectingVel", maxCorrectingVel.string());
     archive.read("2Dmode", is2Dmode);
@@ -31,6 +31,15 @@ public:
     enum StepMode { STEP_ITERATIVE, STEP_BIG_MATRIX, NUM_STEP_MODES };
 
     void setStepMode(int value);
+
+    /**
+       The broadphase of the top-level space. The bounds of the quadtree are determined from
+       the initial positions of the bodies. The static bodies are always put into a hash space
+       under the top-level space, which is not collided with itself.
+    */
+    enum BroadphaseType { BROADPHASE_HASH, BROADPHASE_QUADTREE, BROADPHASE_SAP, NUM_BROADPHASE_TYPES };
+
+    void setBroadphaseType(int type);
     void setGravity(const Vector3& gravity);
     void setFriction(double friction);
     void setJointLimitMode(bool on);
@@ -39,6 +48,13 @@ public:
     void setGlobalCFM(double value);
     void setNumIterations(int n);
     void setOverRelaxation(double value);
+
+    /**
+       The islands of the bodies are processed in parallel by the threads of ODE when the number
+       is more than one. Zero means the number of the hardware threads. The ODE library must be
+       built with the threading implementation, which is available since ODE 0.13.
+    */
+    void setNumThreads(int n);
     void setCorrectingVelocityLimitMode(bool on);
     void setMaxCorrectingVelocity(double vel);
     void setSurfaceLayerDepth(double value);
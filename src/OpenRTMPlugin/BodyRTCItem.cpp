@@ -6,6 +6,7 @@
 #include "BodyRTCItem.h"
 #include "VirtualRobotRTC.h"
 #include "OpenRTMUtil.h"
+#include "ChoreonoidExecutionContext.h"
 #include <cnoid/BodyItem>
 #include <cnoid/Link>
 #include <cnoid/BasicSensors>
@@ -28,6 +29,30 @@ using namespace RTC;
 
 namespace {
 const bool TRACE_FUNCTIONS = false;
+
+/**
+   @return The servant of the execution context if it is a ChoreonoidExecutionContext object
+   activated in this process. Otherwise a null pointer.
+*/
+ChoreonoidExecutionContext* findLocalExecutionContext(CORBA::Object_ptr execContext)
+{
+    if(CORBA::is_nil(execContext)){
+        return 0;
+    }
+    ChoreonoidExecutionContext* localExecContext = 0;
+    try {
+        PortableServer::POA_ptr poa = RTC::Manager::instance().getPOA();
+        PortableServer::ServantBase* servant = poa->reference_to_servant(execContext);
+        if(servant){
+            localExecContext = dynamic_cast<ChoreonoidExecutionContext*>(servant);
+            servant->_remove_ref();
+        }
+    } catch(CORBA::Exception&){
+        // The execution context is not a servant of the POA in this process
+    }
+    return localExecContext;
+}
+
 }
 
 void BodyRTCItem::initialize(ExtensionManager* ext)
@@ -50,6 +75,7 @@ BodyRTCItem::BodyRTCItem()
     
     io = 0;
     virtualRobotRTC = 0;
+    localVirtualRobotEC = 0;
     rtcomp = 0;
     bridgeConf = 0;
     moduleName.clear();
@@ -81,6 +107,7 @@ BodyRTCItem::BodyRTCItem(const BodyRTCItem& org)
 {
     io = 0;
     virtualRobotRTC = org.virtualRobotRTC;
+    localVirtualRobotEC = 0;
     rtcomp = org.rtcomp;
     bridgeConf = org.bridgeConf;
     moduleName = org.moduleName;
@@ -331,6 +358,7 @@ bool BodyRTCItem::start(ControllerItemIO* io)
         detectRtcs();
         setupRtcConnections();
         activateComponents();
+        findLocalExecutionContexts();
     }
 
 #ifdef ENABLE_SIMULATION_PROFILING
@@ -369,7 +397,11 @@ bool BodyRTCItem::control()
     timer.begin();
 #endif
 
-            virtualRobotEC->tick();
+            if(localVirtualRobotEC){
+                localVirtualRobotEC->tick();
+            } else {
+                virtualRobotEC->tick();
+            }
 
 #ifdef ENABLE_SIMULATION_PROFILING
     bodyRTCTime = timer.measure();
@@ -388,7 +420,11 @@ bool BodyRTCItem::control()
         if(!CORBA::is_nil(rtcInfo->execContext)){
             rtcInfo->timeRateCounter += rtcInfo->timeRate;
             if(rtcInfo->timeRateCounter + rtcInfo->timeRate/2.0 > 1.0){
-                rtcInfo->execContext->tick();
+                if(rtcInfo->localExecContext){
+                    rtcInfo->localExecContext->tick();
+                } else {
+                    rtcInfo->execContext->tick();
+                }
                 rtcInfo->timeRateCounter -= 1.0;
             }
         }
@@ -709,6 +745,7 @@ BodyRTCItem::RtcInfoPtr BodyRTCItem::addRtcVectorWithConnection(RTC::RTObject_va
 
     RtcInfoPtr rtcInfo(new RtcInfo());
     rtcInfo->rtcRef = new_rtcRef;
+    rtcInfo->localExecContext = 0;
     makePortMap(rtcInfo);
     string rtcName = (string)rtcInfo->rtcRef->get_component_profile()->instance_name;
 
@@ -774,6 +811,17 @@ void BodyRTCItem::activateComponents()
 }
 
 
+void BodyRTCItem::findLocalExecutionContexts()
+{
+    localVirtualRobotEC = findLocalExecutionContext(virtualRobotEC);
+
+    for(RtcInfoVector::iterator p = rtcInfoVector.begin(); p != rtcInfoVector.end(); ++p){
+        RtcInfoPtr& rtcInfo = *p;
+        rtcInfo->localExecContext = findLocalExecutionContext(rtcInfo->execContext);
+    }
+}
+
+
 void BodyRTCItem::deactivateComponents()
 {
     std::vector<OpenRTM::ExtTrigExecutionContextService_var> vecExecContext;
@@ -1095,6 +1143,7 @@ void BodyRTCItem::deleteModule(bool waitToBeDeleted)
         mv->putln(fmt(_("delete %1%")) % virtualRobotRTC->getInstanceName());
         cnoid::deleteRTC(virtualRobotRTC, waitToBeDeleted);
         virtualRobotRTC = 0;
+        localVirtualRobotEC = 0;
     }
 
     if(waitToBeDeleted){
@@ -20,6 +20,7 @@
 namespace cnoid {
 
 class MessageView;
+class ChoreonoidExecutionContext;
 
 class CNOID_EXPORT BodyRTCItem : public ControllerItem
 {
@@ -96,6 +97,12 @@ private:
     BridgeConf* bridgeConf;
     VirtualRobotRTC* virtualRobotRTC;
     OpenRTM::ExtTrigExecutionContextService_var virtualRobotEC;
+
+    /*
+      The servants of the execution contexts in this process, which are ticked by
+      calling the servants directly instead of the invocations through the ORB.
+    */
+    ChoreonoidExecutionContext* localVirtualRobotEC;
         
     Selection configMode;
     bool autoConnect;
@@ -109,6 +116,7 @@ private:
         RTC::RTObject_var rtcRef;
         PortMap portMap;
         OpenRTM::ExtTrigExecutionContextService_var execContext;
+        ChoreonoidExecutionContext* localExecContext;
         double timeRate;
         double timeRateCounter;
     };
@@ -130,6 +138,7 @@ private:
     void createRTC(BodyPtr body);
     void setdefaultPort(BodyPtr body);
     void activateComponents();
+    void findLocalExecutionContexts();
     void deactivateComponents();
     void detectRtcs();
     void setupRtcConnections();
@@ -9,6 +9,7 @@
 #include <cnoid/DyBody>
 #include <cnoid/Light>
 #include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
 
 using namespace std;
 using namespace RTC;
@@ -434,11 +435,12 @@ void CameraImageOutPortHandler::onCameraStateChanged()
             default : value.data.image.format = Img::CF_UNKNOWN;
                 break;
             }
+            // The pixels are not copied but loaned to the sequence, which does not release them.
+            // The image is kept until the next image is loaned.
             size_t length = width * height * image.numComponents() * sizeof(unsigned char);
-            value.data.image.raw_data.length(length);
-            void* src = (void*)image.pixels();
-            void* dis = (void*)value.data.image.raw_data.get_buffer();
-            memcpy(dis, src, length);
+            value.data.image.raw_data.replace(
+                length, length, const_cast<CORBA::Octet*>(image.pixels()), false);
+            loanedImage = camera->sharedImage();
         }
         prevImage = camera->sharedImage();
         boost::lock_guard<boost::mutex> lock(mtx);
@@ -561,20 +563,27 @@ void CameraRangeOutPortHandler::onCameraStateChanged()
             }
             value.row_step = value.point_step * value.width;
             size_t length = points.size() * value.point_step;
-            value.data.length(length);
-            unsigned char* dis = (unsigned char*)value.data.get_buffer();
-            const unsigned char* pixels = 0;
-            if(!image.empty())
-                pixels = image.pixels();
-            for(int i=0; i<points.size(); i++, dis+=value.point_step){
-                memcpy(&dis[0], &points[i].x(), 4);
-                memcpy(&dis[4], &points[i].y(), 4);
-                memcpy(&dis[8], &points[i].z(), 4);
-                if(pixels){
-                    dis[12] = *pixels++;
-                    dis[13] = *pixels++;
-                    dis[14] = *pixels++;
-                    dis[15] = 0;
+            if(format == "xyz"){
+                // The points have the same layout as the "xyz" format, so they are loaned to the sequence
+                BOOST_STATIC_ASSERT(sizeof(Vector3f) == 12);
+                value.data.replace(
+                    length, length,
+                    reinterpret_cast<CORBA::Octet*>(const_cast<Vector3f*>(&points[0])), false);
+                loanedPoints = rangeCamera->sharedPoints();
+            } else {
+                value.data.length(length);
+                unsigned char* dis = (unsigned char*)value.data.get_buffer();
+                const unsigned char* pixels = 0;
+                if(!image.empty())
+                    pixels = image.pixels();
+                for(int i=0; i<points.size(); i++, dis+=value.point_step){
+                    memcpy(&dis[0], points[i].data(), 12);
+                    if(pixels){
+                        dis[12] = *pixels++;
+                        dis[13] = *pixels++;
+                        dis[14] = *pixels++;
+                        dis[15] = 0;
+                    }
                 }
             }
         }
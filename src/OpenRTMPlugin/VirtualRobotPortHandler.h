@@ -196,6 +196,8 @@ private:
     Camera* camera;
     std::string cameraName;
     boost::shared_ptr<const Image> prevImage;
+    // The image whose pixel buffer is loaned to the image data of the port
+    boost::shared_ptr<const Image> loanedImage;
     double controlTime;
 };
 
@@ -216,6 +218,8 @@ private:
     RangeCamera* rangeCamera;
     std::string rangeCameraName;
     boost::shared_ptr<const RangeCamera::PointData> prevPoints;
+    // The points loaned to the data of the port in the "xyz" format
+    boost::shared_ptr<const RangeCamera::PointData> loanedPoints;
     boost::shared_ptr<const Image> image;
     std::string format;
     double controlTime;
@@ -10,6 +10,8 @@
 #include <boost/bind.hpp>
 #include <cnoid/MessageView>
 #include <iostream>
+#include <limits>
+#include <cmath>
 #include "gettext.h"
 
 using namespace std;
@@ -57,6 +59,8 @@ VirtualRobotRTC::VirtualRobotRTC(RTC::Manager* manager)
     if(CONTROLLER_BRIDGE_DEBUG){
         cout << "VirtualRobotRTC::VirtualRobotRTC" << endl;
     }
+    arePortArraysUpdated = false;
+    scheduledControlTime = -std::numeric_limits<double>::max();
 }
 
 RTC::ReturnCode_t VirtualRobotRTC::onInitialize()
@@ -350,22 +354,88 @@ void VirtualRobotRTC::addConnectedRtcs(RTC::PortService_ptr portRef, RTC::RTCLis
     }
 }
 
-void VirtualRobotRTC::inputDataFromSimulator(BodyRTCItem* bodyRTC)
+void VirtualRobotRTC::updatePortArrays()
 {
-    const double controlTime = bodyRTC->controlTime();
-    const double controlTimeStep = bodyRTC->timeStep();
+    outPortGroups.clear();
+    outPortGroups.resize(1);
+    outPortGroups[0].stepTime = 0.0;
+
     for(OutPortHandlerMap::iterator it = outPortHandlers.begin(); it != outPortHandlers.end(); ++it){
-        double stepTime = it->second->stepTime;
-        if(stepTime){
-            double w = controlTime - (int)(controlTime / stepTime) * stepTime + controlTimeStep / 2;
-            if(w >= stepTime){
-                w = 0.0;
+        OutPortHandler* handler = it->second.get();
+        size_t i = 0;
+        while(i < outPortGroups.size() && outPortGroups[i].stepTime != handler->stepTime){
+            ++i;
+        }
+        if(i == outPortGroups.size()){
+            outPortGroups.push_back(OutPortGroup());
+            outPortGroups.back().stepTime = handler->stepTime;
+        }
+        OutPortGroup& group = outPortGroups[i];
+        group.handlers.push_back(handler);
+        if(handler->synchController){
+            group.synchronizedHandlers.push_back(handler);
+        }
+    }
+    for(size_t i=0; i < outPortGroups.size(); ++i){
+        outPortGroups[i].nextStepIndex = -1;
+        outPortGroups[i].isDue = false;
+    }
+
+    inPortHandlerArray.clear();
+    for(InPortHandlerMap::iterator it = inPortHandlers.begin(); it != inPortHandlers.end(); ++it){
+        inPortHandlerArray.push_back(it->second.get());
+    }
+
+    scheduledControlTime = -std::numeric_limits<double>::max();
+    arePortArraysUpdated = true;
+}
+
+
+/**
+   A group is due when the control time is within the half of the control time step from
+   a multiple of the output interval of the group.
+*/
+void VirtualRobotRTC::updateOutPortSchedule(double controlTime, double controlTimeStep)
+{
+    if(!arePortArraysUpdated){
+        updatePortArrays();
+    }
+    if(controlTime == scheduledControlTime){
+        return;
+    }
+    scheduledControlTime = controlTime;
+
+    const double halfStep = controlTimeStep / 2.0;
+    outPortGroups[0].isDue = true;
+    for(size_t i=1; i < outPortGroups.size(); ++i){
+        OutPortGroup& group = outPortGroups[i];
+        const double nextTime = group.nextStepIndex * group.stepTime;
+        if(group.nextStepIndex < 0 ||
+           nextTime < controlTime - halfStep || nextTime - group.stepTime >= controlTime + halfStep){
+            // The first step or the control time is not continuous
+            group.nextStepIndex = static_cast<long>(std::ceil((controlTime - halfStep) / group.stepTime));
+            if(group.nextStepIndex < 0){
+                group.nextStepIndex = 0;
             }
-            if(w < controlTimeStep ){
-                it->second->inputDataFromSimulator(bodyRTC);
+        }
+        group.isDue = (controlTime + halfStep >= group.nextStepIndex * group.stepTime);
+        if(group.isDue){
+            ++group.nextStepIndex;
+        }
+    }
+}
+
+
+void VirtualRobotRTC::inputDataFromSimulator(BodyRTCItem* bodyRTC)
+{
+    updateOutPortSchedule(bodyRTC->controlTime(), bodyRTC->timeStep());
+
+    for(size_t i=0; i < outPortGroups.size(); ++i){
+        const OutPortGroup& group = outPortGroups[i];
+        if(group.isDue){
+            for(size_t j=0; j < group.handlers.size(); ++j){
+                group.handlers[j]->inputDataFromSimulator(bodyRTC);
             }
-        }else{
-            it->second->inputDataFromSimulator(bodyRTC);
         }
     }
 }
@@ -373,25 +443,25 @@ void VirtualRobotRTC::inputDataFromSimulator(BodyRTCItem* bodyRTC)
 
 void VirtualRobotRTC::outputDataToSimulator(const BodyPtr& body)
 {
-    for(InPortHandlerMap::iterator it = inPortHandlers.begin(); it != inPortHandlers.end(); ++it){
-        it->second->outputDataToSimulator(body);
+    if(!arePortArraysUpdated){
+        updatePortArrays();
+    }
+    for(size_t i=0; i < inPortHandlerArray.size(); ++i){
+        inPortHandlerArray[i]->outputDataToSimulator(body);
     }
 }
 
 
 void VirtualRobotRTC::writeDataToOutPorts(double controlTime, double controlTimeStep)
 {
-    for(OutPortHandlerMap::iterator it = outPortHandlers.begin(); it != outPortHandlers.end(); ++it){
-        if(!it->second->synchController)
-            continue;
-        double stepTime = it->second->stepTime;
-        if(stepTime){
-            double w = controlTime-(int)(controlTime/stepTime)*stepTime + controlTimeStep/2;
-            if(w >= stepTime) w=0;
-            if(w < controlTimeStep )
-                it->second->writeDataToPort();
-        }else{
-            it->second->writeDataToPort();
+    updateOutPortSchedule(controlTime, controlTimeStep);
+
+    for(size_t i=0; i < outPortGroups.size(); ++i){
+        const OutPortGroup& group = outPortGroups[i];
+        if(group.isDue){
+            for(size_t j=0; j < group.synchronizedHandlers.size(); ++j){
+                group.synchronizedHandlers[j]->writeDataToPort();
+            }
         }
     }
 }
@@ -399,8 +469,11 @@ void VirtualRobotRTC::writeDataToOutPorts(double controlTime, double controlTime
 
 void VirtualRobotRTC::readDataFromInPorts()
 {
-    for(InPortHandlerMap::iterator it = inPortHandlers.begin(); it != inPortHandlers.end(); ++it){
-        it->second->readDataFromPort();
+    if(!arePortArraysUpdated){
+        updatePortArrays();
+    }
+    for(size_t i=0; i < inPortHandlerArray.size(); ++i){
+        inPortHandlerArray[i]->readDataFromPort();
     }
 }
 
@@ -424,6 +497,8 @@ bool VirtualRobotRTC::checkOutPortStepTime(double controlTimeStep)
 
 void VirtualRobotRTC::initialize(Body* simulationBody)
 {
+    updatePortArrays();
+
     for(OutPortHandlerMap::iterator it = outPortHandlers.begin(); it != outPortHandlers.end(); ++it){
         CameraImageOutPortHandler* cameaImageOutPortHandler = dynamic_cast<CameraImageOutPortHandler*>(it->second.get());
         if(cameaImageOutPortHandler)
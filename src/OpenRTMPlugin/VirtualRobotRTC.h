@@ -8,6 +8,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 #include <rtm/RTObject.h>
 #include <rtm/Manager.h>
 #include <rtm/DataFlowComponentBase.h>
@@ -50,6 +51,26 @@ private:
     typedef std::map<std::string, InPortHandlerPtr> InPortHandlerMap;
     InPortHandlerMap inPortHandlers;
 
+    /**
+       The out-port handlers grouped by the output intervals. The handlers of a group are processed
+       together when the next output time of the group comes, so the output times do not have to be
+       checked for each port every control step. The first group is for the ports without intervals.
+    */
+    struct OutPortGroup
+    {
+        double stepTime;
+        long nextStepIndex; // a negative value means that the next time is not determined yet
+        bool isDue;
+        std::vector<OutPortHandler*> handlers;
+        std::vector<OutPortHandler*> synchronizedHandlers;
+    };
+    std::vector<OutPortGroup> outPortGroups;
+    std::vector<InPortHandler*> inPortHandlerArray;
+    bool arePortArraysUpdated;
+    double scheduledControlTime;
+
+    void updatePortArrays();
+    void updateOutPortSchedule(double controlTime, double controlTimeStep);
 
     bool createOutPortHandler(PortInfo& portInfo);
     bool createInPortHandler(PortInfo& portInfo);
@@ -60,6 +81,7 @@ private:
         if(!getOutPortHandler(name)){
             if (!addOutPort(name.c_str(), handler->outPort)) return false;
             outPortHandlers.insert(std::make_pair(name, OutPortHandlerPtr(handler)));
+            arePortArraysUpdated = false;
         }
         return true;
     }
@@ -77,6 +99,7 @@ private:
         if(!getInPortHandler(name)){
             if (!addInPort(name.c_str(), handler->inPort)) return false;
             inPortHandlers.insert(std::make_pair(name, InPortHandlerPtr(handler)));
+            arePortArraysUpdated = false;
         }
         return true;
     }
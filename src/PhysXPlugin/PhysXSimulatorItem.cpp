@@ -14,8 +14,11 @@
 #include <cnoid/Link>
 #include <cnoid/BasicSensorSimulationHelper>
 #include <cnoid/BodyItem>
+#include <cnoid/Selection>
 #include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/format.hpp>
 #include "gettext.h"
 #include <iostream>
 
@@ -27,6 +30,11 @@ using std::isfinite;
 #endif
 #include <PxPhysicsAPI.h>
 
+// GPU rigid bodies, GPU broadphase and enhanced determinism are available since PhysX 3.4
+#if PX_PHYSICS_VERSION_MAJOR > 3 || (PX_PHYSICS_VERSION_MAJOR == 3 && PX_PHYSICS_VERSION_MINOR >= 4)
+#define CNOID_PHYSX_3_4_FEATURES
+#endif
+
 using namespace std;
 using namespace boost;
 using namespace cnoid;
@@ -38,6 +46,8 @@ const bool DEBUG_COLLISION = false;
 const double DEFAULT_GRAVITY_ACCELERATION = 9.80665;
 const bool meshOnly = false;     
 
+enum BroadphaseType { BROADPHASE_SAP, BROADPHASE_MBP, BROADPHASE_GPU };
+
 class PhysXBody;
 
 class PhysXLink : public Referenced
@@ -110,6 +120,9 @@ public:
     PxDefaultCpuDispatcher* pxDispatcher;
     PxScene* pxScene;
     PxMaterial* pxMaterial;
+#if defined(CNOID_PHYSX_3_4_FEATURES) && PX_SUPPORT_GPU_PHYSX
+    PxCudaContextManager* pxCudaContextManager;
+#endif
 
     Vector3 gravity;
     double timeStep;
@@ -120,12 +133,23 @@ public:
     bool isJointLimitMode;
     bool velocityMode;
 
+    int numThreads;
+    bool isPCMEnabled;
+    bool isEnhancedDeterminismEnabled;
+    bool isGPUDynamicsEnabled;
+    Selection broadphaseType;
+
+    vector<BasicSensorSimulationHelper*> gyroAndAccelerationSensorHelpers;
+
     PhysXSimulatorItemImpl(PhysXSimulatorItem* self);
     PhysXSimulatorItemImpl(PhysXSimulatorItem* self, const PhysXSimulatorItemImpl& org);
     void initialize();
     void finalize();
     ~PhysXSimulatorItemImpl();
     void clear();
+    void setUpSceneFlags(PxSceneDesc& sceneDesc);
+    void setUpGPU(PxSceneDesc& sceneDesc);
+    void addBroadphaseRegions(const std::vector<SimulationBody*>& simBodies);
     bool initializeSimulation(const std::vector<SimulationBody*>& simBodies);
     bool stepSimulation(const std::vector<SimulationBody*>& activeSimBodies);
     void addBody(PhysXBody* physXBody);
@@ -841,6 +865,16 @@ PhysXSimulatorItemImpl::PhysXSimulatorItemImpl(PhysXSimulatorItem* self)
     restitution = 0.1;
     velocityMode = false;
 
+    numThreads = 1;
+    isPCMEnabled = false;
+    isEnhancedDeterminismEnabled = false;
+    isGPUDynamicsEnabled = false;
+    broadphaseType.setSymbol(BROADPHASE_SAP, N_("SAP"));
+    broadphaseType.setSymbol(BROADPHASE_MBP, N_("MBP"));
+#ifdef CNOID_PHYSX_3_4_FEATURES
+    broadphaseType.setSymbol(BROADPHASE_GPU, N_("GPU"));
+#endif
+    broadphaseType.select(BROADPHASE_SAP);
 }
 
 
@@ -865,6 +899,11 @@ PhysXSimulatorItemImpl::PhysXSimulatorItemImpl(PhysXSimulatorItem* self, const P
     isJointLimitMode = org.isJointLimitMode;
     velocityMode = org.velocityMode;
 
+    numThreads = org.numThreads;
+    isPCMEnabled = org.isPCMEnabled;
+    isEnhancedDeterminismEnabled = org.isEnhancedDeterminismEnabled;
+    isGPUDynamicsEnabled = org.isGPUDynamicsEnabled;
+    broadphaseType = org.broadphaseType;
 }
 
 
@@ -885,6 +924,9 @@ void PhysXSimulatorItemImpl::initialize()
     pxScene = 0;
     pxDispatcher = 0;
     pxMaterial = 0;
+#if defined(CNOID_PHYSX_3_4_FEATURES) && PX_SUPPORT_GPU_PHYSX
+    pxCudaContextManager = 0;
+#endif
 }
 
 
@@ -943,7 +985,12 @@ void PhysXSimulatorItemImpl::clear()
         pxDispatcher->release();
         pxDispatcher = 0;
     }
-
+#if defined(CNOID_PHYSX_3_4_FEATURES) && PX_SUPPORT_GPU_PHYSX
+    if(pxCudaContextManager){
+        pxCudaContextManager->release();
+        pxCudaContextManager = 0;
+    }
+#endif
 }    
 
 
@@ -972,12 +1019,22 @@ bool PhysXSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBo
     PxSceneDesc sceneDesc(pxPhysics->getTolerancesScale());
     sceneDesc.gravity = PxVec3(gravity.x(), gravity.y(), gravity.z());
     //sceneDesc.flags |= PxSceneFlag::eREQUIRE_RW_LOCK;
-    pxDispatcher = PxDefaultCpuDispatcherCreate(0);
+
+    /*
+      The simulation is executed on the thread calling simulate() when there is no worker thread.
+      Otherwise the tasks are executed by the worker threads and the calling thread only waits for them.
+    */
+    int n = numThreads;
+    if(n <= 0){
+        n = boost::thread::hardware_concurrency();
+    }
+    pxDispatcher = PxDefaultCpuDispatcherCreate(n > 1 ? n : 0);
     sceneDesc.cpuDispatcher = pxDispatcher;
     sceneDesc.filterShader = customFilterShader;
     sceneDesc.contactModifyCallback = this;
     if(DEBUG_COLLISION)
         sceneDesc.simulationEventCallback = this;
+    setUpSceneFlags(sceneDesc);
 
     pxScene = pxPhysics->createScene(sceneDesc);
     if (!pxScene)
@@ -993,10 +1050,123 @@ bool PhysXSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBo
         addBody(static_cast<PhysXBody*>(simBodies[i]));
     }
 
+    if(sceneDesc.broadPhaseType == PxBroadPhaseType::eMBP){
+        addBroadphaseRegions(simBodies);
+    }
+
     return true;
 }
 
 
+void PhysXSimulatorItemImpl::setUpSceneFlags(PxSceneDesc& sceneDesc)
+{
+    if(isPCMEnabled){
+        sceneDesc.flags |= PxSceneFlag::eENABLE_PCM;
+    }
+
+    switch(broadphaseType.which()){
+    case BROADPHASE_MBP:
+        sceneDesc.broadPhaseType = PxBroadPhaseType::eMBP;
+        break;
+#ifdef CNOID_PHYSX_3_4_FEATURES
+    case BROADPHASE_GPU:
+        sceneDesc.broadPhaseType = PxBroadPhaseType::eGPU;
+        break;
+#endif
+    default:
+        sceneDesc.broadPhaseType = PxBroadPhaseType::eSAP;
+        break;
+    }
+
+#ifdef CNOID_PHYSX_3_4_FEATURES
+    if(isEnhancedDeterminismEnabled){
+        sceneDesc.flags |= PxSceneFlag::eENABLE_ENHANCED_DETERMINISM;
+    }
+#else
+    if(isEnhancedDeterminismEnabled){
+        mv->putln(MessageView::WARNING,
+                  boost::format(_("%1%: The enhanced determinism is not supported by the PhysX SDK "
+                                  "used for building this plugin.")) % self->name());
+    }
+#endif
+
+    setUpGPU(sceneDesc);
+}
+
+
+void PhysXSimulatorItemImpl::setUpGPU(PxSceneDesc& sceneDesc)
+{
+    bool isGPURequired = isGPUDynamicsEnabled || broadphaseType.is(BROADPHASE_GPU);
+    if(!isGPURequired){
+        return;
+    }
+
+#if defined(CNOID_PHYSX_3_4_FEATURES) && PX_SUPPORT_GPU_PHYSX
+    PxCudaContextManagerDesc cudaContextManagerDesc;
+    pxCudaContextManager = PxCreateCudaContextManager(*pxFoundation, cudaContextManagerDesc);
+    if(pxCudaContextManager && !pxCudaContextManager->contextIsValid()){
+        pxCudaContextManager->release();
+        pxCudaContextManager = 0;
+    }
+    if(pxCudaContextManager){
+        sceneDesc.gpuDispatcher = pxCudaContextManager->getGpuDispatcher();
+        if(isGPUDynamicsEnabled){
+            sceneDesc.flags |= PxSceneFlag::eENABLE_GPU_DYNAMICS;
+        }
+        return;
+    }
+    mv->putln(MessageView::WARNING,
+              boost::format(_("%1%: The CUDA context cannot be created. The simulation is executed on the CPU."))
+              % self->name());
+#else
+    mv->putln(MessageView::WARNING,
+              boost::format(_("%1%: The GPU simulation is not supported by the PhysX SDK "
+                              "used for building this plugin.")) % self->name());
+#endif
+
+    if(sceneDesc.broadPhaseType != PxBroadPhaseType::eSAP && sceneDesc.broadPhaseType != PxBroadPhaseType::eMBP){
+        sceneDesc.broadPhaseType = PxBroadPhaseType::eSAP;
+    }
+}
+
+
+/**
+   The multi box pruning broadphase only detects the collisions of the objects in its regions.
+   The regions are given by dividing the bounding box of the initial scene, which is enlarged
+   so that the objects moving around the initial positions can be kept in the regions.
+*/
+void PhysXSimulatorItemImpl::addBroadphaseRegions(const std::vector<SimulationBody*>& simBodies)
+{
+    PxBounds3 bounds = PxBounds3::empty();
+    for(size_t i=0; i < simBodies.size(); ++i){
+        PhysXBody* physXBody = static_cast<PhysXBody*>(simBodies[i]);
+        for(size_t j=0; j < physXBody->physXLinks.size(); ++j){
+            PxRigidActor* actor = physXBody->physXLinks[j]->pxRigidActor;
+            if(actor){
+                bounds.include(actor->getWorldBounds());
+            }
+        }
+    }
+    if(bounds.isEmpty()){
+        return;
+    }
+
+    const PxVec3 center = bounds.getCenter();
+    const PxVec3 extents = bounds.getExtents() * 2.0f + PxVec3(10.0f);
+    bounds = PxBounds3::centerExtents(center, extents);
+
+    const PxU32 numSubdivisions = 4;
+    PxBounds3 regionBounds[numSubdivisions * numSubdivisions];
+    const PxU32 numRegions = PxBroadPhaseExt::createRegionsFromWorldBounds(regionBounds, bounds, numSubdivisions, 2);
+    for(PxU32 i=0; i < numRegions; ++i){
+        PxBroadPhaseRegion region;
+        region.bounds = regionBounds[i];
+        region.userData = 0;
+        pxScene->addBroadPhaseRegion(region, true);
+    }
+}
+
+
 void PhysXSimulatorItemImpl::addBody(PhysXBody* physXBody)
 {
     Body& body = *physXBody->body();
@@ -1110,6 +1280,7 @@ bool PhysXSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>&
     pxScene->simulate(timeStep);
     pxScene->fetchResults(true);
 
+    gyroAndAccelerationSensorHelpers.clear();
     for(size_t i=0; i < activeSimBodies.size(); ++i){
         PhysXBody* physXBody = static_cast<PhysXBody*>(activeSimBodies[i]);
 
@@ -1120,9 +1291,10 @@ bool PhysXSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>&
         }
 
         if(physXBody->sensorHelper.hasGyroOrAccelerationSensors()){
-            physXBody->sensorHelper.updateGyroAndAccelerationSensors();
+            gyroAndAccelerationSensorHelpers.push_back(&physXBody->sensorHelper);
         }
     }
+    BasicSensorSimulationHelper::updateGyroAndAccelerationSensors(gyroAndAccelerationSensorHelpers);
 
     return true;
 }
@@ -1149,6 +1321,19 @@ void PhysXSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty(_("Limit joint range"), isJointLimitMode, changeProperty(isJointLimitMode));
 
     putProperty(_("Velocity Control Mode"), velocityMode, changeProperty(velocityMode));
+
+    putProperty.min(0)(_("Number of threads"), numThreads, changeProperty(numThreads));
+
+    putProperty(_("PCM"), isPCMEnabled, changeProperty(isPCMEnabled));
+
+    putProperty(_("Broadphase"), broadphaseType,
+                boost::bind(&Selection::selectIndex, &broadphaseType, _1));
+
+#ifdef CNOID_PHYSX_3_4_FEATURES
+    putProperty(_("Enhanced determinism"), isEnhancedDeterminismEnabled, changeProperty(isEnhancedDeterminismEnabled));
+
+    putProperty(_("GPU dynamics"), isGPUDynamicsEnabled, changeProperty(isGPUDynamicsEnabled));
+#endif
 }
 
 
@@ -1167,6 +1352,11 @@ void PhysXSimulatorItemImpl::store(Archive& archive)
     archive.write("Restitution", restitution);
     archive.write("jointLimitMode", isJointLimitMode);
     archive.write("velocityMode", velocityMode);
+    archive.write("numThreads", numThreads);
+    archive.write("pcm", isPCMEnabled);
+    archive.write("broadphase", broadphaseType.selectedSymbol());
+    archive.write("enhancedDeterminism", isEnhancedDeterminismEnabled);
+    archive.write("gpuDynamics", isGPUDynamicsEnabled);
 }
 
 
@@ -1187,4 +1377,11 @@ void PhysXSimulatorItemImpl::restore(const Archive& archive)
     archive.read("Restitution", restitution);
     archive.read("jointLimitMode", isJointLimitMode);
     archive.read("velocityMode", velocityMode);
+    archive.read("numThreads", numThreads);
+    archive.read("pcm", isPCMEnabled);
+    if(archive.read("broadphase", symbol)){
+        broadphaseType.select(symbol);
+    }
+    archive.read("enhancedDeterminism", isEnhancedDeterminismEnabled);
+    archive.read("gpuDynamics", isGPUDynamicsEnabled);
 }
@@ -21,7 +21,10 @@
 #include <cnoid/CheckBox>
 #include <cnoid/Dialog>
 #include <QDialogButtonBox>
+#include <QProgressDialog>
 #include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/format.hpp>
 #include <set>
 #include "gettext.h"
@@ -528,15 +531,54 @@ bool BodyMotionGenerationBar::shapeBodyMotionWithSimpleInterpolation
     BodyMotionPtr motion = motionItem->motion();
     motion->setFrameRate(timeBar->frameRate());
 
-    bool result = poseProviderToBodyMotionConverter->convert(body, provider, *motion);
+    bool result = false;
+    
+    boost::scoped_ptr<PoseProvider> providerCopy(provider->clone());
+    if(!providerCopy){
+        result = poseProviderToBodyMotionConverter->convert(body, provider, *motion);
+
+    } else {
+        /*
+          The motion is generated in a thread with the copies of the body, the provider and the motion
+          so that the progress dialog can be shown and the generation can be canceled when it takes a long time.
+          The original ones may be accessed by the GUI while the dialog is processing the events.
+        */
+        BodyPtr bodyCopy = body->clone();
+        BodyMotion motionCopy(*motion);
+        boost::thread convertingThread(
+            boost::bind(&BodyMotionGenerationBar::convertPoses,
+                        this, bodyCopy.get(), providerCopy.get(), &motionCopy, &result));
+
+        QProgressDialog progress(_("Generating a body motion..."), _("Cancel"), 0, 0, MainWindow::instance());
+        progress.setWindowTitle(_("Body Motion Generation"));
+        progress.setWindowModality(Qt::WindowModal);
+        while(!convertingThread.timed_join(boost::posix_time::milliseconds(10))){
+            progress.setMaximum(poseProviderToBodyMotionConverter->numFramesToConvert());
+            progress.setValue(poseProviderToBodyMotionConverter->numConvertedFrames());
+            if(progress.wasCanceled()){
+                poseProviderToBodyMotionConverter->cancel();
+            }
+        }
+        if(result){
+            *motion = motionCopy;
+        }
+    }
     
     if(result){
         motionItem->notifyUpdate();
+    } else {
+        MessageView::mainInstance()->notify(_("The generation of the body motion has been canceled."));
     }
     return result;
 }
 
 
+void BodyMotionGenerationBar::convertPoses(Body* body, PoseProvider* provider, BodyMotion* motion, bool* out_result)
+{
+    *out_result = poseProviderToBodyMotionConverter->convert(body, provider, *motion);
+}
+
+
 bool BodyMotionGenerationBar::storeState(Archive& archive)
 {
     archive.write("autoGenerationForNewBody", autoGenerationForNewBodyCheck->isChecked());
@@ -110,6 +110,7 @@ private:
 
     bool shapeBodyMotionWithSimpleInterpolation
         (BodyPtr& body, PoseProvider* provider, BodyMotionItemPtr motionItem);
+    void convertPoses(Body* body, PoseProvider* provider, BodyMotion* motion, bool* out_result);
             
     virtual bool storeState(Archive& archive);
     virtual bool restoreState(const Archive& archive);
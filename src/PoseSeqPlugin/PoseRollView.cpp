@@ -18,6 +18,7 @@
 #include <QPainter>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
+#include <algorithm>
 #include "gettext.h"
 
 #include <iostream>
@@ -33,6 +34,30 @@ const bool FAST_DRAW_MODE = false;
 
 const double leftMargin = 0.2;
 
+bool isPoseRefBeforeTime(const PoseSeq::iterator& poseIter, double time)
+{
+    return poseIter->time() < time;
+}
+
+bool isTimeBeforePoseRef(double time, const PoseSeq::iterator& poseIter)
+{
+    return time < poseIter->time();
+}
+
+//! \return The last element smaller than the index, or -1 if there is no such element
+int findLastIndexBefore(const vector<int>& indices, int index)
+{
+    vector<int>::const_iterator p = std::lower_bound(indices.begin(), indices.end(), index);
+    return (p == indices.begin()) ? -1 : *(p - 1);
+}
+
+//! \return The first element equal to or larger than the index, or -1 if there is no such element
+int findFirstIndexFrom(const vector<int>& indices, int index)
+{
+    vector<int>::const_iterator p = std::lower_bound(indices.begin(), indices.end(), index);
+    return (p == indices.end()) ? -1 : *p;
+}
+
 class ScrollBarEx : public ScrollBar
 {
 public:
@@ -123,6 +148,20 @@ public:
     };
     vector<RowRenderInfo> rowRenderInfos;
 
+    /*
+      The index of the key poses in the sequence order, which is used to process only the key pose
+      markers in the visible time range. Each element of the key pose lists is the position of
+      a pose in keyPoseIters.
+    */
+    bool isKeyPoseIndexValid;
+    vector<PoseSeq::iterator> keyPoseIters;
+    vector< vector<int> > jointIdToKeyPosesMap;
+    // The key poses of which markers are drawn in the rows of the links, including the IK links
+    vector< vector<int> > linkIndexToKeyPosesMap;
+    vector<int> zmpKeyPoses;
+    vector<int> pronunSymbolKeyPoses;
+    vector<int> rowEndKeyPoseIndices;
+
     double pointerX;
     double pointerY;
     double pressedScreenX;
@@ -141,6 +180,7 @@ public:
             
     // for key pose marker rendering
     PoseSeq::iterator markerPoseIter;
+    int markerPoseIndex;
     double markerTime0;
     double markerX0;
     double markerX1;
@@ -174,8 +214,11 @@ public:
     void updateRowRects();
     void updateRowRectsSub(QTreeWidgetItem* treeWidgetItem);
     LinkTreeItem* getFirstVisibleAncestor(const LinkTreeItem* item);
-    bool checkIfPoseHasRow(const PosePtr& pose, const LinkTreeItem* item);
+    void updateKeyPoseIndex();
+    void searchLastKeyPoseIndex(const LinkTreeItem* item, int& io_index);
     double searchLastPoseTime(const LinkTreeItem* item);
+    void updateRowEndKeyPoseIndices(const LinkTreeItem* item, int keyPoseIndex);
+    int getEndKeyPoseIndex(int firstIndexOutOfRight);
     void processKeyPoseMarkersSub(LinkTreeItem* item, boost::function<void()> func);
     void processKeyPoseMarkers(boost::function<void()> func);
             
@@ -243,6 +286,7 @@ void PoseRollViewImpl::initialize()
     timeLength = 10.0;
     updateRowRectsNeeded = true;
     isTmpScrollBlocked = false;
+    isKeyPoseIndexValid = false;
 
     QVBoxLayout* vbox = new QVBoxLayout();
     vbox->setSpacing(0);
@@ -509,6 +553,7 @@ void PoseRollViewImpl::setCurrentPoseSeqItem(PoseSeqItemPtr poseSeqItem)
     if(body != prevBody){
         updateRowRectsNeeded = true;
     }
+    isKeyPoseIndexValid = false;
 
     screen->update();
 }
@@ -583,6 +628,7 @@ void PoseRollViewImpl::onPoseInserted(PoseSeq::iterator it, bool isMoving)
 
     PoseSeqViewBase::onPoseInserted(it, isMoving);
 
+    isKeyPoseIndexValid = false;
     screen->update();
 }
 
@@ -595,6 +641,7 @@ void PoseRollViewImpl::onPoseRemoving(PoseSeq::iterator it, bool isMoving)
 
     PoseSeqViewBase::onPoseRemoving(it, isMoving);
 
+    isKeyPoseIndexValid = false;
     if(!isMoving){
         screen->update();
     }
@@ -604,6 +651,7 @@ void PoseRollViewImpl::onPoseRemoving(PoseSeq::iterator it, bool isMoving)
 void PoseRollViewImpl::onPoseModified(PoseSeq::iterator it)
 {
     PoseSeqViewBase::onPoseModified(it);
+    isKeyPoseIndexValid = false;
     screen->update();
 }
 
@@ -797,40 +845,151 @@ LinkTreeItem* PoseRollViewImpl::getFirstVisibleAncestor(const LinkTreeItem* item
 }
 
 
-bool PoseRollViewImpl::checkIfPoseHasRow(const PosePtr& pose, const LinkTreeItem* item)
+void PoseRollViewImpl::updateKeyPoseIndex()
 {
-    if(item == zmpRow && pose->isZmpValid()){
-        return true;
+    if(isKeyPoseIndexValid){
+        return;
+    }
+    
+    keyPoseIters.clear();
+    jointIdToKeyPosesMap.clear();
+    linkIndexToKeyPosesMap.clear();
+    zmpKeyPoses.clear();
+    pronunSymbolKeyPoses.clear();
+
+    if(seq && body){
+        const int numJoints = body->numJoints();
+        const int numLinks = body->numLinks();
+        jointIdToKeyPosesMap.resize(numJoints);
+        linkIndexToKeyPosesMap.resize(numLinks);
+        
+        for(PoseSeq::iterator it = seq->begin(); it != seq->end(); ++it){
+            const int index = keyPoseIters.size();
+            keyPoseIters.push_back(it);
+            PosePtr pose = it->get<Pose>();
+            if(pose){
+                int n = std::min(numJoints, pose->numJoints());
+                for(int i=0; i < n; ++i){
+                    if(pose->isJointValid(i)){
+                        jointIdToKeyPosesMap[i].push_back(index);
+                        Link* joint = body->joint(i);
+                        if(joint->isValid()){
+                            linkIndexToKeyPosesMap[joint->index()].push_back(index);
+                        }
+                    }
+                }
+                for(Pose::LinkInfoMap::iterator p = pose->ikLinkBegin(); p != pose->ikLinkEnd(); ++p){
+                    if(p->first < numLinks){
+                        vector<int>& keyPoses = linkIndexToKeyPosesMap[p->first];
+                        if(keyPoses.empty() || keyPoses.back() != index){
+                            keyPoses.push_back(index);
+                        }
+                    }
+                }
+                if(pose->isZmpValid()){
+                    zmpKeyPoses.push_back(index);
+                }
+            } else if(it->get<PronunSymbol>()){
+                pronunSymbolKeyPoses.push_back(index);
+            }
+        }
+    }
+
+    isKeyPoseIndexValid = true;
+}
+
+
+/**
+   This function finds the last pose before the current marker pose
+   which has a valid joint or a valid ZMP in the row or its sub rows.
+*/
+void PoseRollViewImpl::searchLastKeyPoseIndex(const LinkTreeItem* item, int& io_index)
+{
+    if(item == zmpRow){
+        io_index = std::max(io_index, findLastIndexBefore(zmpKeyPoses, markerPoseIndex));
     }
     const RowInfo& info = itemIndexToRowInfoMap[item->rowIndex()];
-    if(info.jointId >= 0 && pose->isJointValid(info.jointId)){
-        return true;
+    if(info.jointId >= 0 && info.jointId < (int)jointIdToKeyPosesMap.size()){
+        io_index = std::max(io_index, findLastIndexBefore(jointIdToKeyPosesMap[info.jointId], markerPoseIndex));
     }
     int n = item->childCount();
     for(int i=0; i < n; ++i){
         LinkTreeItem* childItem = dynamic_cast<LinkTreeItem*>(item->child(i));
-        if(childItem && checkIfPoseHasRow(pose, childItem)){
-            return true;
+        if(childItem){
+            searchLastKeyPoseIndex(childItem, io_index);
         }
     }
-    return false;
 }
 
 
 double PoseRollViewImpl::searchLastPoseTime(const LinkTreeItem* item)
 {
-    PoseSeq::iterator last = markerPoseIter;
+    int lastIndex = -1;
+    searchLastKeyPoseIndex(item, lastIndex);
+    if(lastIndex < 0){
+        lastIndex = 0;
+    }
+    return timeScale * keyPoseIters[lastIndex]->time();
+}
 
-    while(last != seq->begin()){
-        last--;
-        PosePtr pose = last->get<Pose>();
-        if(pose){
-            if(checkIfPoseHasRow(pose, item)){
-                break;
+
+void PoseRollViewImpl::updateRowEndKeyPoseIndices(const LinkTreeItem* item, int keyPoseIndex)
+{
+    if(keyPoseIndex >= 0){
+        while(item){
+            const RowInfo& rowInfo = itemIndexToRowInfoMap[item->rowIndex()];
+            int& endIndex = rowEndKeyPoseIndices[rowInfo.visibleRowIndex];
+            endIndex = std::max(endIndex, keyPoseIndex + 1);
+            item = dynamic_cast<LinkTreeItem*>(item->parent());
+        }
+    }
+}
+
+
+/**
+   A marker is drawn from the previous pose in the same row, so the marker of a pose out of the right
+   side of the screen is visible when the row does not have another pose between the right side and
+   the pose. This function returns the end of the poses to process considering such poses.
+   The pronunciation symbols do not update the start position of the next marker, so all the
+   symbols are processed if a row of the lip sync links does not have a pose after the right side.
+*/
+int PoseRollViewImpl::getEndKeyPoseIndex(int firstIndexOutOfRight)
+{
+    const int numRows = rowRenderInfos.size();
+    rowEndKeyPoseIndices.assign(numRows, -1);
+    
+    const int numLinks = std::min(linkIndexToKeyPosesMap.size(), linkIndexToVisibleRowAncestorMap.size());
+    for(int i=0; i < numLinks; ++i){
+        LinkTreeItem* row = linkIndexToVisibleRowAncestorMap[i];
+        if(row){
+            updateRowEndKeyPoseIndices(row, findFirstIndexFrom(linkIndexToKeyPosesMap[i], firstIndexOutOfRight));
+        }
+    }
+    if(visibleRowAncestorOfZmp){
+        updateRowEndKeyPoseIndices(visibleRowAncestorOfZmp, findFirstIndexFrom(zmpKeyPoses, firstIndexOutOfRight));
+    }
+
+    int endIndex = firstIndexOutOfRight;
+    for(int i=0; i < numRows; ++i){
+        endIndex = std::max(endIndex, rowEndKeyPoseIndices[i]);
+    }
+
+    if(lipSyncCheck->isChecked() && !pronunSymbolKeyPoses.empty() &&
+       pronunSymbolKeyPoses.back() >= firstIndexOutOfRight){
+        const std::vector<int>& lipSyncLinkIndices = currentPoseSeqItem->interpolator()->lipSyncLinkIndices();
+        for(size_t i=0; i < lipSyncLinkIndices.size(); ++i){
+            const int linkIndex = lipSyncLinkIndices[i];
+            if(linkIndex < numLinks){
+                LinkTreeItem* row = linkIndexToVisibleRowAncestorMap[linkIndex];
+                if(row && findFirstIndexFrom(linkIndexToKeyPosesMap[linkIndex], firstIndexOutOfRight) < 0){
+                    endIndex = std::max(endIndex, pronunSymbolKeyPoses.back() + 1);
+                    break;
+                }
             }
         }
     }
-    return timeScale * last->time();
+
+    return endIndex;
 }
 
 
@@ -875,11 +1034,21 @@ void PoseRollViewImpl::processKeyPoseMarkers(boost::function<void()> func)
         }
     }
     
-    markerPoseIter = seq->seek(seq->begin(), left / timeScale);
+    updateKeyPoseIndex();
+
+    const int beginIndex =
+        std::lower_bound(keyPoseIters.begin(), keyPoseIters.end(), left / timeScale, isPoseRefBeforeTime)
+        - keyPoseIters.begin();
+    const int firstIndexOutOfRight =
+        std::upper_bound(keyPoseIters.begin(), keyPoseIters.end(), right / timeScale, isTimeBeforePoseRef)
+        - keyPoseIters.begin();
+    const int endIndex = getEndKeyPoseIndex(firstIndexOutOfRight);
 
     const std::vector<int>& lipSyncLinkIndices = currentPoseSeqItem->interpolator()->lipSyncLinkIndices();
 
-    while(markerPoseIter != seq->end()){
+    for(markerPoseIndex = beginIndex; markerPoseIndex < endIndex; ++markerPoseIndex){
+
+        markerPoseIter = keyPoseIters[markerPoseIndex];
 
         if(FAST_DRAW_MODE){
             if(timeScale * markerPoseIter->time() > right){
@@ -929,8 +1098,6 @@ void PoseRollViewImpl::processKeyPoseMarkers(boost::function<void()> func)
                 }
             }
         }   
-
-        ++markerPoseIter;
     }
 }
 
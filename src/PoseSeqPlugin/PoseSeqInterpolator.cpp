@@ -10,6 +10,7 @@
 #include "PoseSeqInterpolator.h"
 #include "PronunSymbol.h"
 #include <list>
+#include <set>
 #include <vector>
 #include <iostream>
 #include <algorithm>
@@ -65,6 +66,7 @@ struct LinkSample
         isDirty = true;
         isSlave = info.isSlave() && !info.isTouching();
         isAux = false;
+        isKeyPoseSample = true;
     }
 
     void invalidateSegment(){
@@ -81,6 +83,7 @@ struct LinkSample
     bool isTouching;
     bool isSlave;
     bool isAux;
+    bool isKeyPoseSample; // false for the samples copied for transitions and auxiliary key poses
 
     typedef std::list<LinkSample> Seq;
 };
@@ -96,6 +99,7 @@ struct LinkZSample
         isTouching = info.isTouching();
         isEndPoint = info.isStationaryPoint() || isTouching;
         isDirty = true;
+        isKeyPoseSample = true;
     }
     void invalidateSegment(){
         segmentType = INVALID;
@@ -108,6 +112,7 @@ struct LinkZSample
     bool isEndPoint;
     bool isDirty;
     bool isTouching;
+    bool isKeyPoseSample;
 
     typedef std::list<LinkZSample> Seq;
 };
@@ -115,7 +120,7 @@ struct LinkZSample
     
 struct LinkInfo
 {
-    LinkInfo(const BodyPtr& body, int linkIndex) {
+    LinkInfo(const BodyPtr& body, int linkIndex) : linkIndex(linkIndex) {
         iter = samples.end();
         zIter = zSamples.end();
         Link* link = body->link(linkIndex);
@@ -127,6 +132,7 @@ struct LinkInfo
         jointSpaceBlendingRatio = 0.0;
         isFootLink = false;
     }
+    int linkIndex;
     int jointId;
     bool isFootLink;
     LinkSample::Seq samples;
@@ -157,6 +163,7 @@ struct JointSample
         c[0].y = pose->jointPosition(jointId);
         c[0].yp = 0.0;
         isEndPoint = pose->isJointStationaryPoint(jointId);
+        isKeyPoseSample = true;
     }
 
     SegmentType segmentType;
@@ -165,6 +172,7 @@ struct JointSample
     Coeff c[1];
     bool isEndPoint;
     bool isDirty;
+    bool isKeyPoseSample;
 
     typedef std::list<JointSample> Seq;
 };
@@ -207,6 +215,7 @@ struct ZmpSample
         }
         isEndPoint = pose->isZmpStationaryPoint();
         isDirty = true;
+        isKeyPoseSample = true;
     }
 
     ZmpSample(double time, const Vector3& p){
@@ -219,6 +228,7 @@ struct ZmpSample
         }
         isEndPoint = true;
         isDirty = true;
+        isKeyPoseSample = false;
     }
             
     SegmentType segmentType;
@@ -227,6 +237,7 @@ struct ZmpSample
     Coeff c[3];
     bool isEndPoint;
     bool isDirty;
+    bool isKeyPoseSample;
 
     typedef std::list<ZmpSample> Seq;
 };
@@ -241,6 +252,7 @@ class PSIImpl
 public:
 
     PSIImpl(PoseSeqInterpolator* self);
+    PSIImpl(PoseSeqInterpolator* self, const PSIImpl& org);
 
     PoseSeqInterpolator* self;
     BodyPtr body;
@@ -248,6 +260,13 @@ public:
 
     bool needUpdate;
 
+    // The range of the time where the key poses have been modified since the last update
+    bool hasDirtyTimeRange;
+    double dirtyTimeBegin;
+    double dirtyTimeEnd;
+    std::set<int> dirtyLinkIndices;
+    bool isLipSyncDirty;
+
     ConnectionSet poseSeqConnections;
 
     vector<JointInfo> jointInfos;
@@ -330,6 +349,7 @@ public:
     void calcIkJointPositionsSub(Link* link, Link* baseLink, LinkInfo* baseLinkInfo, bool doUpward, Link* prevLink);
     void appendPronun(PoseSeq::iterator poseIter);
     void appendLinkSamples(PoseSeq::iterator poseIter, PosePtr& pose);
+    void updateLipSyncSeq();
 
     inline bool checkZmp(const Vector3& zmp, const Vector3& centerZmp);
         
@@ -353,10 +373,24 @@ public:
 
     void adjustZmpAndFootKeyPoses();
     void insertAuxKeyPosesForStealthySteps();
+    void insertAuxKeyPosesForStealthySteps(LinkSample::Seq& samples, LinkZSample::Seq& zSamples);
+    bool isUpdateNeeded() const {
+        return needUpdate || hasDirtyTimeRange || isLipSyncDirty;
+    }
     bool update();
+    void updateAll();
+    bool updatePartially();
+    bool updateJointSamplesPartially(int jointId);
+    bool updateLinkSamplesPartially(LinkInfo& info);
+    bool updateZmpSamplesPartially();
+    void updateFootLinkAndZmpSamples();
+    void appendJointSample(JointInfo& info, JointSample::Seq& samples, PoseSeq::iterator poseIter, Pose* pose, int jointId);
     LinkInfo* getIkLinkInfo(int linkIndex);
+    void addDirtyPose(PoseSeq::iterator it);
+    void clearDirtyPoses();
     void onPoseInserted(PoseSeq::iterator it);
     void onPoseRemoving(PoseSeq::iterator it, bool isMoving);
+    void onPoseModifying(PoseSeq::iterator it);
     void onPoseModified(PoseSeq::iterator it);
 };
 }
@@ -522,15 +556,20 @@ updateCubicSplineSegment(typename SampleType::Seq::iterator s, typename SampleTy
 
 /**
    pre-determined velocity version
+   The samples from 'begin' to the one before 'end' are processed.
 */
 template <int dim, class SampleType>
-void usePredeterminedVelocities(typename SampleType::Seq& samples)
+void usePredeterminedVelocities
+(typename SampleType::Seq& samples, typename SampleType::Seq::iterator begin, typename SampleType::Seq::iterator end)
 {
-    typename SampleType::Seq::iterator s = samples.begin();
+    typename SampleType::Seq::iterator s = begin;
 
     typename SampleType::Seq::iterator prev = s;
+    if(prev != samples.begin()){
+        --prev;
+    }
 
-    while(s != samples.end()){
+    while(s != end){
 
         if(s->segmentType != INVALID){
             typename SampleType::Seq::iterator next = s; ++next;
@@ -578,18 +617,23 @@ void usePredeterminedVelocities(typename SampleType::Seq& samples)
 }
     
 
+/**
+   The segments beginning at the samples from 'begin' to the one before 'end' are initialized.
+   The samples out of the range must have been initialized when the range is a part of the sequence.
+*/
 template <int dim, class SampleType, bool useJerkMinModel>
-void initializeInterpolation(typename SampleType::Seq& samples)
+void initializeInterpolation
+(typename SampleType::Seq& samples, typename SampleType::Seq::iterator begin, typename SampleType::Seq::iterator end)
 {
     if(TRACE_FUNCTIONS){
         cout << "initializeInterpolation" << endl;
     }
 
-    usePredeterminedVelocities<dim, SampleType>(samples);
+    usePredeterminedVelocities<dim, SampleType>(samples, begin, end);
         
-    typename SampleType::Seq::iterator s = samples.begin();
+    typename SampleType::Seq::iterator s = begin;
 
-    while(s != samples.end()){
+    while(s != end){
 
         if(s->segmentType == INVALID){
             ++s;
@@ -614,6 +658,13 @@ void initializeInterpolation(typename SampleType::Seq& samples)
 }
 
 
+template <int dim, class SampleType, bool useJerkMinModel>
+void initializeInterpolation(typename SampleType::Seq& samples)
+{
+    initializeInterpolation<dim, SampleType, useJerkMinModel>(samples, samples.begin(), samples.end());
+}
+
+
 template <int dim, class SampleType>
 bool interpolate(
     typename SampleType::Seq& samples, typename SampleType::Seq::iterator& p, double x, double* out_result)
@@ -747,6 +798,7 @@ typename SampleType::Seq::iterator applyMaxTransitionTime(typename SampleType::S
             SampleType& sampleForTransition = samples.back();
             sampleForTransition.x = time - ttime;
             sampleForTransition.isEndPoint = true;
+            sampleForTransition.isKeyPoseSample = false;
             ++prev;
         }
     }
@@ -761,6 +813,141 @@ void appendSample(typename SampleType::Seq& samples, const SampleType& sample)
     samples.push_back(sample);
 }
 
+
+void appendLinkSample
+(LinkSample::Seq& samples, LinkZSample::Seq* zSamples, PoseSeq::iterator poseIter, const Pose::LinkInfo& ikLinkInfo)
+{
+    applyMaxTransitionTime<LinkSample>(samples, poseIter);
+    samples.push_back(LinkSample(poseIter, ikLinkInfo));
+
+    if(zSamples){
+        applyMaxTransitionTime<LinkZSample>(*zSamples, poseIter);
+        zSamples->push_back(LinkZSample(poseIter, ikLinkInfo));
+    }
+}
+
+
+/**
+   This function finds the samples which must be regenerated when the key poses in [time0, time1] are
+   inserted, removed or modified. The range is extended to the key pose samples just outside the time range
+   because their end point states and velocities depend on the neighbouring key poses.
+
+   @param out_begin The first sample to replace
+   @param out_last The last sample to replace, or samples.end() if the samples are replaced up to the end
+   @param out_poseBegin The first key pose to generate the new samples from
+   @param out_poseEnd The end of the key poses to generate the new samples from. This is next to the key pose
+   following out_last so that the raw end point state of out_last can be reproduced.
+*/
+template <class SampleType>
+void findSamplesToUpdate
+(typename SampleType::Seq& samples, PoseSeq& seq, double time0, double time1,
+ typename SampleType::Seq::iterator& out_begin, typename SampleType::Seq::iterator& out_last,
+ PoseSeq::iterator& out_poseBegin, PoseSeq::iterator& out_poseEnd)
+{
+    typename SampleType::Seq::iterator s = samples.begin();
+    while(s != samples.end() && s->x < time0){
+        ++s;
+    }
+
+    out_begin = samples.begin();
+    out_poseBegin = seq.begin();
+    typename SampleType::Seq::iterator p = s;
+    while(p != samples.begin()){
+        --p;
+        if(p->isKeyPoseSample){
+            out_begin = p;
+            out_poseBegin = p->poseIter;
+            break;
+        }
+    }
+
+    out_last = samples.end();
+    out_poseEnd = seq.end();
+    while(s != samples.end()){
+        if(s->isKeyPoseSample && s->x > time1){
+            out_last = s;
+            break;
+        }
+        ++s;
+    }
+    if(s != samples.end()){
+        while(++s != samples.end()){
+            if(s->isKeyPoseSample){
+                out_poseEnd = s->poseIter;
+                ++out_poseEnd;
+                break;
+            }
+        }
+    }
+}
+
+
+/**
+   This function removes the samples following the sample of the given key pose.
+*/
+template <class SampleType>
+void truncateSamples(typename SampleType::Seq& samples, PoseSeq::iterator lastPoseIter)
+{
+    typename SampleType::Seq::iterator s = samples.end();
+    while(s != samples.begin()){
+        --s;
+        if(s->isKeyPoseSample && s->poseIter == lastPoseIter){
+            samples.erase(++s, samples.end());
+            break;
+        }
+    }
+}
+
+
+/**
+   This function replaces the samples from 'begin' to 'last' with the new samples and initializes
+   the interpolation of the segments affected by the replacement.
+   @return false if the samples following the replaced ones are also affected.
+   This happens when the unwrapped rotation angle of the last sample changes.
+*/
+template <int dim, class SampleType>
+bool replaceSamples
+(typename SampleType::Seq& samples,
+ typename SampleType::Seq::iterator begin, typename SampleType::Seq::iterator last,
+ typename SampleType::Seq& newSamples, bool doInitializeInterpolation)
+{
+    typename SampleType::Seq::iterator end = last;
+    double lastValues[dim];
+    if(last != samples.end()){
+        for(int i=0; i < dim; ++i){
+            lastValues[i] = last->c[i].y;
+        }
+        ++end;
+    }
+
+    samples.erase(begin, end);
+    
+    typename SampleType::Seq::iterator first = end;
+    if(!newSamples.empty()){
+        first = newSamples.begin();
+        samples.splice(end, newSamples);
+    }
+
+    if(doInitializeInterpolation){
+        if(first != samples.begin()){
+            --first;
+        }
+        initializeInterpolation<dim, SampleType, false>(samples, first, end);
+
+        if(end != samples.end() && end != samples.begin()){
+            typename SampleType::Seq::iterator newLast = end;
+            --newLast;
+            for(int i=0; i < dim; ++i){
+                if(newLast->c[i].y != lastValues[i]){
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
 }
 
 
@@ -770,6 +957,29 @@ PoseSeqInterpolator::PoseSeqInterpolator()
 }
 
 
+/**
+   The copy does not follow the modifications of the pose sequence. It is used to interpolate
+   the sequence in another thread while the sequence is not modified.
+*/
+PoseSeqInterpolator::PoseSeqInterpolator(const PoseSeqInterpolator& org)
+{
+    impl = new PSIImpl(this, *org.impl);
+}
+
+
+PoseSeqInterpolator::~PoseSeqInterpolator()
+{
+    impl->poseSeqConnections.disconnect();
+    delete impl;
+}
+
+
+PoseProvider* PoseSeqInterpolator::clone() const
+{
+    return new PoseSeqInterpolator(*this);
+}
+
+
 PSIImpl::PSIImpl(PoseSeqInterpolator* self)
     : self(self)
 {
@@ -781,11 +991,77 @@ PSIImpl::PSIImpl(PoseSeqInterpolator* self)
     zmpMaxDistanceFromCenterSqr = 0.015 * 0.015;
 
     isStealthyStepMode = false;
+    stealthyHeightRatioThresh = 0.0;
+    flatLiftingHeight = 0.0;
+    flatLandingHeight = 0.0;
+    impactReductionHeight = 0.0;
+    impactReductionTime = 0.0;
     setStealthyStepParameters(2.0, 0.005, 0.005, 0.012, 0.3);
 
     isLipSyncMixEnabled = false;
     
     needUpdate = true;
+    clearDirtyPoses();
+}
+
+
+PSIImpl::PSIImpl(PoseSeqInterpolator* self, const PSIImpl& org)
+    : self(self),
+      poseSeq(org.poseSeq),
+      needUpdate(org.needUpdate),
+      hasDirtyTimeRange(org.hasDirtyTimeRange),
+      dirtyTimeBegin(org.dirtyTimeBegin),
+      dirtyTimeEnd(org.dirtyTimeEnd),
+      dirtyLinkIndices(org.dirtyLinkIndices),
+      isLipSyncDirty(org.isLipSyncDirty),
+      jointInfos(org.jointInfos),
+      ikLinkInfos(org.ikLinkInfos),
+      footLinkIndices(org.footLinkIndices),
+      soleCenters(org.soleCenters),
+      isAutoZmpAdjustmentMode(org.isAutoZmpAdjustmentMode),
+      minZmpTransitionTime(org.minZmpTransitionTime),
+      zmpCenteringTimeThresh(org.zmpCenteringTimeThresh),
+      zmpTimeMarginBeforeLifting(org.zmpTimeMarginBeforeLifting),
+      zmpMaxDistanceFromCenterSqr(org.zmpMaxDistanceFromCenterSqr),
+      isStealthyStepMode(org.isStealthyStepMode),
+      stealthyHeightRatioThresh(org.stealthyHeightRatioThresh),
+      flatLiftingHeight(org.flatLiftingHeight),
+      flatLandingHeight(org.flatLandingHeight),
+      impactReductionHeight(org.impactReductionHeight),
+      impactReductionTime(org.impactReductionTime),
+      impactReductionVelocity(org.impactReductionVelocity),
+      zmpSamples(org.zmpSamples),
+      isLipSyncMixEnabled(org.isLipSyncMixEnabled),
+      lipSyncJoints(org.lipSyncJoints),
+      lipSyncLinkIndices(org.lipSyncLinkIndices),
+      lipSyncShapes(org.lipSyncShapes),
+      lipSyncSeq(org.lipSyncSeq),
+      lipSyncMaxTransitionTime(org.lipSyncMaxTransitionTime),
+      timeScaleRatio(org.timeScaleRatio),
+      validIkLinkFlag(org.validIkLinkFlag),
+      waistTranslation(org.waistTranslation)
+{
+    if(org.body){
+        body = org.body->clone();
+    }
+
+    // The iterators must refer to the copied samples
+    for(size_t i=0; i < jointInfos.size(); ++i){
+        JointInfo& info = jointInfos[i];
+        info.iter = info.samples.begin();
+    }
+    for(size_t i=0; i < org.footLinkInfos.size(); ++i){
+        footLinkInfos.push_back(&ikLinkInfos.find(org.footLinkInfos[i]->linkIndex)->second);
+    }
+    for(LinkInfoMap::iterator p = ikLinkInfos.begin(); p != ikLinkInfos.end(); ++p){
+        LinkInfo& info = p->second;
+        info.iter = info.samples.begin();
+        info.zIter = info.zSamples.begin();
+    }
+    zmpIter = zmpSamples.begin();
+    lipSyncIter = lipSyncSeq.begin();
+
+    invalidateCurrentInterpolation();
 }
 
 
@@ -833,7 +1109,11 @@ void PoseSeqInterpolator::setLinearInterpolationJoint(int jointId)
 void PSIImpl::setLinearInterpolationJoint(int jointId)
 {
     if(jointId < (int)jointInfos.size()){
-        jointInfos[jointId].useLinearInterpolation = true;
+        JointInfo& info = jointInfos[jointId];
+        if(!info.useLinearInterpolation){
+            info.useLinearInterpolation = true;
+            needUpdate = true;
+        }
     }
 }
 
@@ -960,10 +1240,10 @@ void PSIImpl::setPoseSeq(PoseSeqPtr seq)
     poseSeqConnections.disconnect();
     poseSeq = seq;
 
-    // for auto update mode (not implemented yet)
     poseSeqConnections = seq->connectSignalSet(
         boost::bind(&PSIImpl::onPoseInserted, this, _1),
         boost::bind(&PSIImpl::onPoseRemoving, this, _1, _2),
+        boost::bind(&PSIImpl::onPoseModifying, this, _1),
         boost::bind(&PSIImpl::onPoseModified, this, _1));
     
     invalidateCurrentInterpolation();
@@ -995,26 +1275,38 @@ double PoseSeqInterpolator::endingTime() const
 
 void PoseSeqInterpolator::enableAutoZmpAdjustmentMode(bool on)
 {
-    impl->isAutoZmpAdjustmentMode = on;
-    impl->needUpdate = true;
+    if(on != impl->isAutoZmpAdjustmentMode){
+        impl->isAutoZmpAdjustmentMode = on;
+        impl->needUpdate = true;
+    }
 }
 
 
 void PoseSeqInterpolator::setZmpAdjustmentParameters
 (double minTransitionTime, double centeringTimeThresh, double timeMarginBeforeLifting, double maxDistanceFromCenter)
 {
-    impl->minZmpTransitionTime = minTransitionTime;
-    impl->zmpCenteringTimeThresh = centeringTimeThresh;
-    impl->zmpTimeMarginBeforeLifting = timeMarginBeforeLifting;
-    impl->zmpMaxDistanceFromCenterSqr = maxDistanceFromCenter * maxDistanceFromCenter;
-    impl->needUpdate = true;
+    const double maxDistanceFromCenterSqr = maxDistanceFromCenter * maxDistanceFromCenter;
+
+    if(minTransitionTime != impl->minZmpTransitionTime ||
+       centeringTimeThresh != impl->zmpCenteringTimeThresh ||
+       timeMarginBeforeLifting != impl->zmpTimeMarginBeforeLifting ||
+       maxDistanceFromCenterSqr != impl->zmpMaxDistanceFromCenterSqr){
+
+        impl->minZmpTransitionTime = minTransitionTime;
+        impl->zmpCenteringTimeThresh = centeringTimeThresh;
+        impl->zmpTimeMarginBeforeLifting = timeMarginBeforeLifting;
+        impl->zmpMaxDistanceFromCenterSqr = maxDistanceFromCenterSqr;
+        impl->needUpdate = true;
+    }
 }
 
 
 void PoseSeqInterpolator::enableStealthyStepMode(bool on)
 {
-    impl->isStealthyStepMode = on;
-    impl->needUpdate = true;
+    if(on != impl->isStealthyStepMode){
+        impl->isStealthyStepMode = on;
+        impl->needUpdate = true;
+    }
 }
 
 
@@ -1034,14 +1326,21 @@ void PSIImpl::setStealthyStepParameters
  double flatLiftingHeight, double flatLandingHeight,
  double impactReductionHeight, double impactReductionTime)
 {
-    this->stealthyHeightRatioThresh = heightRatioThresh;
-    this->flatLiftingHeight = flatLiftingHeight;
-    this->flatLandingHeight = flatLandingHeight;
-    this->impactReductionHeight = impactReductionHeight;
-    this->impactReductionTime = impactReductionTime;
-    this->impactReductionVelocity = -2.0 * impactReductionHeight / impactReductionTime;
+    if(heightRatioThresh != this->stealthyHeightRatioThresh ||
+       flatLiftingHeight != this->flatLiftingHeight ||
+       flatLandingHeight != this->flatLandingHeight ||
+       impactReductionHeight != this->impactReductionHeight ||
+       impactReductionTime != this->impactReductionTime){
 
-    needUpdate = true;
+        this->stealthyHeightRatioThresh = heightRatioThresh;
+        this->flatLiftingHeight = flatLiftingHeight;
+        this->flatLandingHeight = flatLandingHeight;
+        this->impactReductionHeight = impactReductionHeight;
+        this->impactReductionTime = impactReductionTime;
+        this->impactReductionVelocity = -2.0 * impactReductionHeight / impactReductionTime;
+
+        needUpdate = true;
+    }
 }
 
 
@@ -1103,7 +1402,7 @@ bool PSIImpl::interpolate(double time, int waistLinkIndex, const Vector3& waistT
         return false;
     }
 
-    if(needUpdate){
+    if(isUpdateNeeded()){
         if(!update()){
             return false;
         }
@@ -1484,7 +1783,36 @@ bool PSIImpl::update()
     if(!body || !poseSeq){
         return false;
     }
-    
+
+    if(needUpdate || !updatePartially()){
+        updateAll();
+    }
+
+    for(size_t i=0; i < jointInfos.size(); ++i){
+        JointInfo& info = jointInfos[i];
+        info.iter = info.samples.begin();
+    }
+    for(LinkInfoMap::iterator p = ikLinkInfos.begin(); p != ikLinkInfos.end(); ++p){
+        LinkInfo& info = p->second;
+        info.iter = info.samples.begin();
+        info.zIter = info.zSamples.begin();
+    }
+    zmpIter = zmpSamples.begin();
+
+    lipSyncIter = lipSyncSeq.begin();
+
+    invalidateCurrentInterpolation();
+    needUpdate = false;
+    clearDirtyPoses();
+
+    sigUpdated();
+
+    return true;
+}
+
+
+void PSIImpl::updateAll()
+{
     for(size_t i=0; i < jointInfos.size(); ++i){
         jointInfos[i].clear();
     }
@@ -1493,8 +1821,8 @@ bool PSIImpl::update()
 
     lipSyncSeq.clear();
 
+    footLinkInfos.clear();
     if(isAutoZmpAdjustmentMode || isStealthyStepMode){
-        footLinkInfos.clear();
         for(size_t i=0; i < footLinkIndices.size(); ++i){
             LinkInfo* info = getIkLinkInfo(footLinkIndices[i]);
             if(info){
@@ -1519,21 +1847,9 @@ bool PSIImpl::update()
             const int n = std::min(pose->numJoints(), (int)jointInfos.size());
 
             for(int i=0; i < n; ++i){
-                JointInfo& jointInfo = jointInfos[i];
                 if(pose->isJointValid(i)){
-
-                    // make a flipping point stationary point
-                    double q = pose->jointPosition(i);
-                    double sign = q - jointInfo.prev_q;
-                    if(jointInfo.prevSegmentDirectionSign * sign <= 0.0){
-                        if(!jointInfo.samples.empty()){
-                            jointInfo.samples.back().isEndPoint = true;
-                        }
-                    }
-                    jointInfo.prevSegmentDirectionSign = sign;
-                    jointInfo.prev_q = q;
-
-                    appendSample(jointInfo.samples, JointSample(poseIter, i, jointInfo.useLinearInterpolation));
+                    JointInfo& jointInfo = jointInfos[i];
+                    appendJointSample(jointInfo, jointInfo.samples, poseIter, pose.get(), i);
                 }
             }
             if(pose->isZmpValid()){
@@ -1559,48 +1875,252 @@ bool PSIImpl::update()
         if(!info.useLinearInterpolation){
             initializeInterpolation<1, JointSample, false>(info.samples);
         }
-        info.iter = info.samples.begin();
     }
     for(LinkInfoMap::iterator p = ikLinkInfos.begin(); p != ikLinkInfos.end(); ++p){
         LinkInfo& info = p->second;
         initializeInterpolation<6, LinkSample, false>(info.samples);
-        info.iter = info.samples.begin();
         if(info.isFootLink){
             initializeInterpolation<1, LinkZSample, false>(info.zSamples);
-            info.zIter = info.zSamples.begin();
         }
     }
     initializeInterpolation<3, ZmpSample, false>(zmpSamples);
-    zmpIter = zmpSamples.begin();
+}
 
-    lipSyncIter = lipSyncSeq.begin();
 
-    invalidateCurrentInterpolation();
-    needUpdate = false;
+/**
+   This function only regenerates the samples around the key poses modified since the last update.
+   @return false if the whole samples must be regenerated
+*/
+bool PSIImpl::updatePartially()
+{
+    if(hasDirtyTimeRange){
 
-    sigUpdated();
+        if(poseSeq->empty() ||
+           (dirtyTimeBegin <= poseSeq->beginningTime() && dirtyTimeEnd >= poseSeq->endingTime())){
+            return false;
+        }
+
+        for(size_t i=0; i < jointInfos.size(); ++i){
+            if(!updateJointSamplesPartially(i)){
+                return false;
+            }
+        }
+
+        // Tracks for the links which newly appear in the modified key poses
+        for(std::set<int>::iterator p = dirtyLinkIndices.begin(); p != dirtyLinkIndices.end(); ++p){
+            getIkLinkInfo(*p);
+        }
+
+        // The ZMP adjustment depends on the whole sequence of the foot key poses
+        const bool isZmpAdjusted = isAutoZmpAdjustmentMode && footLinkInfos.size() == 2;
+
+        LinkInfoMap::iterator p = ikLinkInfos.begin();
+        while(p != ikLinkInfos.end()){
+            LinkInfo& info = p->second;
+            if(!(info.isFootLink && isZmpAdjusted)){
+                if(!updateLinkSamplesPartially(info)){
+                    return false;
+                }
+            }
+            if(info.samples.empty() && !info.isFootLink){
+                ikLinkInfos.erase(p++);
+            } else {
+                ++p;
+            }
+        }
+
+        if(isZmpAdjusted){
+            updateFootLinkAndZmpSamples();
+        } else if(!updateZmpSamplesPartially()){
+            return false;
+        }
+    }
+
+    if(isLipSyncDirty){
+        updateLipSyncSeq();
+    }
 
     return true;
 }
 
 
+bool PSIImpl::updateJointSamplesPartially(int jointId)
+{
+    JointInfo& info = jointInfos[jointId];
+    JointSample::Seq::iterator begin, last;
+    PoseSeq::iterator poseIter, poseEnd;
+    findSamplesToUpdate<JointSample>(
+        info.samples, *poseSeq, dirtyTimeBegin, dirtyTimeEnd, begin, last, poseIter, poseEnd);
+
+    // The direction of the segment before 'begin' only affects the samples which are not replaced
+    info.prevSegmentDirectionSign = 0.0;
+    info.prev_q = 0.0;
+    if(begin != info.samples.begin()){
+        JointSample::Seq::iterator prev = begin;
+        info.prev_q = (--prev)->c[0].y;
+    }
+    
+    JointSample::Seq samples;
+    while(poseIter != poseEnd){
+        PosePtr pose = poseIter->get<Pose>();
+        if(pose && jointId < pose->numJoints() && pose->isJointValid(jointId)){
+            appendJointSample(info, samples, poseIter, pose.get(), jointId);
+        }
+        ++poseIter;
+    }
+    if(last != info.samples.end()){
+        truncateSamples<JointSample>(samples, last->poseIter);
+    }
+    
+    return replaceSamples<1, JointSample>(info.samples, begin, last, samples, !info.useLinearInterpolation);
+}
+
+
+bool PSIImpl::updateLinkSamplesPartially(LinkInfo& info)
+{
+    LinkSample::Seq::iterator begin, last;
+    PoseSeq::iterator poseIter, poseEnd;
+    findSamplesToUpdate<LinkSample>(
+        info.samples, *poseSeq, dirtyTimeBegin, dirtyTimeEnd, begin, last, poseIter, poseEnd);
+
+    LinkZSample::Seq::iterator zBegin, zLast;
+    if(info.isFootLink){
+        PoseSeq::iterator zPoseIter, zPoseEnd;
+        findSamplesToUpdate<LinkZSample>(
+            info.zSamples, *poseSeq, dirtyTimeBegin, dirtyTimeEnd, zBegin, zLast, zPoseIter, zPoseEnd);
+    }
+        
+    LinkSample::Seq samples;
+    LinkZSample::Seq zSamples;
+    LinkZSample::Seq* pzSamples = info.isFootLink ? &zSamples : 0;
+    while(poseIter != poseEnd){
+        PosePtr pose = poseIter->get<Pose>();
+        if(pose){
+            const Pose::LinkInfo* ikLinkInfo = pose->ikLinkInfo(info.linkIndex);
+            if(ikLinkInfo){
+                appendLinkSample(samples, pzSamples, poseIter, *ikLinkInfo);
+            }
+        }
+        ++poseIter;
+    }
+    if(last != info.samples.end()){
+        truncateSamples<LinkSample>(samples, last->poseIter);
+        if(info.isFootLink){
+            truncateSamples<LinkZSample>(zSamples, last->poseIter);
+        }
+    }
+
+    if(info.isFootLink){
+        if(isStealthyStepMode){
+            insertAuxKeyPosesForStealthySteps(samples, zSamples);
+        }
+        if(!replaceSamples<1, LinkZSample>(info.zSamples, zBegin, zLast, zSamples, true)){
+            return false;
+        }
+    }
+
+    return replaceSamples<6, LinkSample>(info.samples, begin, last, samples, true);
+}
+
+
+bool PSIImpl::updateZmpSamplesPartially()
+{
+    ZmpSample::Seq::iterator begin, last;
+    PoseSeq::iterator poseIter, poseEnd;
+    findSamplesToUpdate<ZmpSample>(
+        zmpSamples, *poseSeq, dirtyTimeBegin, dirtyTimeEnd, begin, last, poseIter, poseEnd);
+
+    ZmpSample::Seq samples;
+    while(poseIter != poseEnd){
+        PosePtr pose = poseIter->get<Pose>();
+        if(pose && pose->isZmpValid()){
+            appendSample(samples, ZmpSample(poseIter));
+        }
+        ++poseIter;
+    }
+    if(last != zmpSamples.end()){
+        truncateSamples<ZmpSample>(samples, last->poseIter);
+    }
+
+    return replaceSamples<3, ZmpSample>(zmpSamples, begin, last, samples, true);
+}
+
+
+void PSIImpl::updateFootLinkAndZmpSamples()
+{
+    for(size_t i=0; i < footLinkInfos.size(); ++i){
+        footLinkInfos[i]->samples.clear();
+        footLinkInfos[i]->zSamples.clear();
+    }
+    zmpSamples.clear();
+
+    for(PoseSeq::iterator poseIter = poseSeq->begin(); poseIter != poseSeq->end(); ++poseIter){
+        PosePtr pose = poseIter->get<Pose>();
+        if(pose){
+            for(size_t i=0; i < footLinkInfos.size(); ++i){
+                LinkInfo* info = footLinkInfos[i];
+                const Pose::LinkInfo* ikLinkInfo = pose->ikLinkInfo(info->linkIndex);
+                if(ikLinkInfo){
+                    appendLinkSample(info->samples, &info->zSamples, poseIter, *ikLinkInfo);
+                }
+            }
+            if(pose->isZmpValid()){
+                appendSample(zmpSamples, ZmpSample(poseIter));
+            }
+        }
+    }
+
+    adjustZmpAndFootKeyPoses();
+
+    if(isStealthyStepMode){
+        insertAuxKeyPosesForStealthySteps();
+    }
+
+    for(size_t i=0; i < footLinkInfos.size(); ++i){
+        initializeInterpolation<6, LinkSample, false>(footLinkInfos[i]->samples);
+        initializeInterpolation<1, LinkZSample, false>(footLinkInfos[i]->zSamples);
+    }
+    initializeInterpolation<3, ZmpSample, false>(zmpSamples);
+}
+
+
+void PSIImpl::updateLipSyncSeq()
+{
+    lipSyncSeq.clear();
+    for(PoseSeq::iterator poseIter = poseSeq->begin(); poseIter != poseSeq->end(); ++poseIter){
+        if(poseIter->get<PronunSymbol>()){
+            appendPronun(poseIter);
+        }
+    }
+}
+
+
+void PSIImpl::appendJointSample
+(JointInfo& info, JointSample::Seq& samples, PoseSeq::iterator poseIter, Pose* pose, int jointId)
+{
+    // make a flipping point stationary point
+    double q = pose->jointPosition(jointId);
+    double sign = q - info.prev_q;
+    if(info.prevSegmentDirectionSign * sign <= 0.0){
+        if(!samples.empty()){
+            samples.back().isEndPoint = true;
+        }
+    }
+    info.prevSegmentDirectionSign = sign;
+    info.prev_q = q;
+
+    appendSample(samples, JointSample(poseIter, jointId, info.useLinearInterpolation));
+}
+
+
 void PSIImpl::appendLinkSamples(PoseSeq::iterator poseIter, PosePtr& pose)
 {
     for(Pose::LinkInfoMap::iterator it = pose->ikLinkBegin(); it != pose->ikLinkEnd(); ++it){
         const int linkIndex = it->first;
         LinkInfo* linkInfo = getIkLinkInfo(linkIndex);
         if(linkInfo){
-            const Pose::LinkInfo& ikLinkInfo = it->second;
-    
-            LinkSample::Seq& samples = linkInfo->samples;
-            applyMaxTransitionTime<LinkSample>(samples, poseIter);
-            samples.push_back(LinkSample(poseIter, ikLinkInfo));
-
-            if(linkInfo->isFootLink){
-                LinkZSample::Seq& zSamples = linkInfo->zSamples;
-                applyMaxTransitionTime<LinkZSample>(zSamples, poseIter);
-                zSamples.push_back(LinkZSample(poseIter, ikLinkInfo));
-            }
+            appendLinkSample(
+                linkInfo->samples, linkInfo->isFootLink ? &linkInfo->zSamples : 0, poseIter, it->second);
         }
     }
 }
@@ -1629,8 +2149,10 @@ void PSIImpl::adjustZmpAndFootKeyPosesForLifting
             zmpSamples.insert(++pZmp0, ZmpSample(zmpTime, zmpOnSupport));
             LinkSample::Seq::iterator pAux = swingSamples.insert(pSwing1, LinkSample(*pSwing0));
             pAux->x = auxKeyTime;
+            pAux->isKeyPoseSample = false;
             LinkZSample::Seq::iterator pZAux = swingZSamples.insert(pSwingZ1, LinkZSample(*pSwingZ0));
             pZAux->x = auxKeyTime;
+            pZAux->isKeyPoseSample = false;
         } else {
             double zmpTime = std::max((pZmp0->x + pSwing0->x) / 2.0, pSwing0->x - zmpTimeMarginBeforeLifting);
             ZmpSample::Seq::iterator pAuxZmp = zmpSamples.insert(++pZmp0, ZmpSample(zmpTime, zmpOnSupport));
@@ -1658,8 +2180,10 @@ void PSIImpl::adjustZmpAndFootKeyPosesForLanding
                 zmpSamples.insert(pZmp1, ZmpSample(auxKeyTime, zmpOnSupport));
                 LinkSample::Seq::iterator pAux = swingSamples.insert(pSwing1, LinkSample(*pSwing1));
                 pAux->x = auxKeyTime;
+                pAux->isKeyPoseSample = false;
                 LinkZSample::Seq::iterator pZAux = swingZSamples.insert(pSwingZ1, LinkZSample(*pSwingZ1));
                 pZAux->x = auxKeyTime;
+                pZAux->isKeyPoseSample = false;
             } else {
                 zmpSamples.insert(pZmp1, ZmpSample(pSwing1->x, zmpOnSupport));
             }
@@ -2004,67 +2528,71 @@ void PSIImpl::adjustZmpAndFootKeyPoses()
 void PSIImpl::insertAuxKeyPosesForStealthySteps()
 {
     for(size_t i=0; i < footLinkInfos.size(); ++i){
-
         LinkInfo* linkInfo = footLinkInfos[i];
+        insertAuxKeyPosesForStealthySteps(linkInfo->samples, linkInfo->zSamples);
+    }
+}
 
-        LinkSample::Seq& samples = linkInfo->samples;
-        LinkZSample::Seq& zSamples = linkInfo->zSamples;
 
-        if(!samples.empty()){
-            LinkSample::Seq::iterator pprev = samples.begin();
-            LinkSample::Seq::iterator p = pprev;
-            ++p;
-            LinkZSample::Seq::iterator pprevZ = zSamples.begin();
-            LinkZSample::Seq::iterator pZ = pprevZ;
-            ++pZ;
-            while(p != samples.end()){
-
-                if(pprev->isTouching && !p->isTouching){ // lifting
-                    if(flatLiftingHeight > 0.0){
-                        double height = pZ->c[0].y - pprevZ->c[0].y;
-                        if(height >= stealthyHeightRatioThresh * flatLiftingHeight){
-                            LinkSample::Seq::iterator paux = samples.insert(p, *pprev);
-                            paux->x += (flatLiftingHeight / height) * (p->x - pprev->x);
-                        }
+void PSIImpl::insertAuxKeyPosesForStealthySteps(LinkSample::Seq& samples, LinkZSample::Seq& zSamples)
+{
+    if(!samples.empty()){
+        LinkSample::Seq::iterator pprev = samples.begin();
+        LinkSample::Seq::iterator p = pprev;
+        ++p;
+        LinkZSample::Seq::iterator pprevZ = zSamples.begin();
+        LinkZSample::Seq::iterator pZ = pprevZ;
+        ++pZ;
+        while(p != samples.end()){
+
+            if(pprev->isTouching && !p->isTouching){ // lifting
+                if(flatLiftingHeight > 0.0){
+                    double height = pZ->c[0].y - pprevZ->c[0].y;
+                    if(height >= stealthyHeightRatioThresh * flatLiftingHeight){
+                        LinkSample::Seq::iterator paux = samples.insert(p, *pprev);
+                        paux->x += (flatLiftingHeight / height) * (p->x - pprev->x);
+                        paux->isKeyPoseSample = false;
                     }
+                }
 
-                } else if(!pprev->isTouching && p->isTouching){ // landing
+            } else if(!pprev->isTouching && p->isTouching){ // landing
 
-                    if(flatLandingHeight > 0.0){
+                if(flatLandingHeight > 0.0){
 
-                        double touchingHeight = pZ->c[0].y;
-                        double height = pprevZ->c[0].y - touchingHeight;
+                    double touchingHeight = pZ->c[0].y;
+                    double height = pprevZ->c[0].y - touchingHeight;
 
-                        if(height >= stealthyHeightRatioThresh * flatLandingHeight){
+                    if(height >= stealthyHeightRatioThresh * flatLandingHeight){
                         
-                            LinkSample::Seq::iterator paux = samples.insert(p, LinkSample(*p));
-                            const double fallingTime = p->x - pprev->x;
-                            paux->isAux = true;
-                            paux->x -= (flatLandingHeight / height) * fallingTime;
-
-                            if(impactReductionHeight > 0.0 && impactReductionTime < fallingTime / 2.0){
-
-                                const double h = fallingTime;
-                                const double h2 = h * h;
-                                const double h3 = h2 * h;
-                                const double a2 = 3.0 * (pZ->c[0].y - pprevZ->c[0].y) / h2;
-                                const double a3 = 2.0 * (pprevZ->c[0].y - pZ->c[0].y) / h3;
-                                const double s = fallingTime - impactReductionTime;
-                                const double v = 2.0 * a2 * s + 3.0 * a3 * s * s;
-
-                                if(v < impactReductionVelocity){
-                                    LinkZSample::Seq::iterator pZaux = zSamples.insert(pZ, LinkZSample(*pZ));
-                                    pZaux->x -= impactReductionTime;
-                                    pZaux->c[0].y += impactReductionHeight;
-                                    pZaux->c[0].yp = impactReductionVelocity;
-                                }
+                        LinkSample::Seq::iterator paux = samples.insert(p, LinkSample(*p));
+                        const double fallingTime = p->x - pprev->x;
+                        paux->isAux = true;
+                        paux->isKeyPoseSample = false;
+                        paux->x -= (flatLandingHeight / height) * fallingTime;
+
+                        if(impactReductionHeight > 0.0 && impactReductionTime < fallingTime / 2.0){
+
+                            const double h = fallingTime;
+                            const double h2 = h * h;
+                            const double h3 = h2 * h;
+                            const double a2 = 3.0 * (pZ->c[0].y - pprevZ->c[0].y) / h2;
+                            const double a3 = 2.0 * (pprevZ->c[0].y - pZ->c[0].y) / h3;
+                            const double s = fallingTime - impactReductionTime;
+                            const double v = 2.0 * a2 * s + 3.0 * a3 * s * s;
+
+                            if(v < impactReductionVelocity){
+                                LinkZSample::Seq::iterator pZaux = zSamples.insert(pZ, LinkZSample(*pZ));
+                                pZaux->x -= impactReductionTime;
+                                pZaux->c[0].y += impactReductionHeight;
+                                pZaux->c[0].yp = impactReductionVelocity;
+                                pZaux->isKeyPoseSample = false;
                             }
                         }
                     }
                 }
-                pprev = p++;
-                pprevZ = pZ++;
             }
+            pprev = p++;
+            pprevZ = pZ++;
         }
     }
 }
@@ -2164,19 +2692,61 @@ LinkInfo* PSIImpl::getIkLinkInfo(int linkIndex)
 }
 
 
+/**
+   The time range containing both the previous and the current time of the modified key poses is recorded
+   so that the next update can only regenerate the samples in the range.
+*/
+void PSIImpl::addDirtyPose(PoseSeq::iterator it)
+{
+    const double time = it->time();
+    if(!hasDirtyTimeRange){
+        dirtyTimeBegin = time;
+        dirtyTimeEnd = time;
+        hasDirtyTimeRange = true;
+    } else if(time < dirtyTimeBegin){
+        dirtyTimeBegin = time;
+    } else if(time > dirtyTimeEnd){
+        dirtyTimeEnd = time;
+    }
+
+    PosePtr pose = it->get<Pose>();
+    if(pose){
+        for(Pose::LinkInfoMap::iterator p = pose->ikLinkBegin(); p != pose->ikLinkEnd(); ++p){
+            dirtyLinkIndices.insert(p->first);
+        }
+    } else if(it->get<PronunSymbol>()){
+        isLipSyncDirty = true;
+    }
+}
+
+
+void PSIImpl::clearDirtyPoses()
+{
+    hasDirtyTimeRange = false;
+    dirtyLinkIndices.clear();
+    isLipSyncDirty = false;
+}
+
+
 void PSIImpl::onPoseInserted(PoseSeq::iterator it)
 {
-    needUpdate = true;
+    addDirtyPose(it);
 }
 
 
 void PSIImpl::onPoseRemoving(PoseSeq::iterator it, bool isMoving)
 {
-    needUpdate = true;
+    addDirtyPose(it);
+}
+
+
+void PSIImpl::onPoseModifying(PoseSeq::iterator it)
+{
+    addDirtyPose(it);
 }
 
 
 void PSIImpl::onPoseModified(PoseSeq::iterator it)
 {
-    needUpdate = true;
+    addDirtyPose(it);
 }
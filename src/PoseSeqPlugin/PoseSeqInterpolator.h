@@ -21,6 +21,8 @@ class CNOID_EXPORT PoseSeqInterpolator : public PoseProvider
 {
 public:
     PoseSeqInterpolator();
+    PoseSeqInterpolator(const PoseSeqInterpolator& org);
+    virtual ~PoseSeqInterpolator();
 
     void setBody(Body* body);
     Body* body() const;
@@ -56,7 +58,12 @@ public:
        This function has not been implemented yet.
     */
     void setAutoUpdateMode(bool on);
-            
+
+    /**
+       When only some key poses have been inserted, removed or modified since the last update,
+       the interpolation is only recomputed for the segments around them.
+       The whole interpolation is recomputed when the body or the parameters are changed.
+    */
     bool update();
 
     SignalProxy<void()> sigUpdated();
@@ -78,6 +85,8 @@ public:
 
     virtual void getJointPositions(std::vector< boost::optional<double> >& out_q) const;
 
+    virtual PoseProvider* clone() const;
+
 private:
 
     PSIImpl* impl;
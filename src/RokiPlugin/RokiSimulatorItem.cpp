@@ -18,11 +18,13 @@
 #include <cnoid/BasicSensorSimulationHelper>
 #include <cnoid/BodyItem>
 #include <cnoid/BodyCollisionDetectorUtil>
+#include <cnoid/ContactBuffer>
 #include <cnoid/FloatingNumberString>
 #include <cnoid/EigenUtil>
 #include <cnoid/MeshExtractor>
 #include <cnoid/SceneDrawables>
 #include <cnoid/FileUtil>
+#include <cnoid/ConnectionSet>
 #include <boost/bind.hpp>
 #include "gettext.h"
 
@@ -135,6 +137,38 @@ struct Triangle {
     int indices[3];
 };
 
+/**
+   The collision shapes of the links of a body item which are kept over the simulations,
+   because converting the meshes takes much time for a large model.
+   The shapes are discarded when the model of the body item is updated.
+*/
+class RokiGeometryCache : public Referenced
+{
+public:
+    vector< vector<zShape3D*> > linkShapes;
+    vector<bool> isLinkCached;
+    bool isValid;
+    ScopedConnectionSet connections;
+
+    RokiGeometryCache(int numLinks)
+        : linkShapes(numLinks),
+          isLinkCached(numLinks, false) {
+        isValid = true;
+    }
+    ~RokiGeometryCache() {
+        for(size_t i=0; i < linkShapes.size(); ++i){
+            for(size_t j=0; j < linkShapes[i].size(); ++j){
+                zShape3DDestroy(linkShapes[i][j]);
+            }
+        }
+    }
+    void invalidate() {
+        isValid = false;
+        connections.disconnect();
+    }
+};
+typedef ref_ptr<RokiGeometryCache> RokiGeometryCachePtr;
+
 class RokiBody;
 class RokiLink : public Referenced
 {
@@ -152,13 +186,14 @@ public:
     bool isCrawler;
     vector<rkCDCell*> cd_cells;
     bool breakJoint;
+    bool ownsShapes;
 
     RokiLink(RokiSimulatorItemImpl* simImpl, RokiBody* rokiBody, RokiLink* parent,
             const Vector3& parentOrigin, Link* link, bool stuffisLinkName);
     ~RokiLink();
     void calcFrame();
     void createLink(RokiSimulatorItemImpl* simImpl, RokiBody* body, const Vector3& origin, bool stuffisLinkName);
-    void createGeometry();
+    void createGeometry(RokiGeometryCache* cache);
     void addMesh(MeshExtractor* extractor);
     void getKinematicStateFromRoki();
     void setKinematicStateToRoki(zVec dis, int k);
@@ -176,6 +211,7 @@ public:
     rkChain* chain;
     BasicSensorSimulationHelper sensorHelper;
     int geometryId;
+    RokiGeometryCachePtr geometryCache;
     RokiLinkMap rokiLinkMap;
     vector<RokiBreakLinkTraverse> linkTraverseList;
 
@@ -236,6 +272,8 @@ public:
     bool useContactFile;
     string contactFileName;
     map<rkChain*, Body*> bodyMap;
+    typedef map<BodyItem*, RokiGeometryCachePtr> GeometryCacheMap;
+    GeometryCacheMap geometryCaches;
     //bool useWorldCollision;
     CollisionDetectorPtr collisionDetector;
     vector<RokiLink*> geometryIdToLink;
@@ -243,6 +281,8 @@ public:
     double simulationTime;
     QElapsedTimer timer;
 
+    vector<BasicSensorSimulationHelper*> gyroAndAccelerationSensorHelpers;
+
     RokiSimulatorItemImpl(RokiSimulatorItem* self);
     RokiSimulatorItemImpl(RokiSimulatorItem* self, const RokiSimulatorItemImpl& org);
     ~RokiSimulatorItemImpl();
@@ -250,7 +290,9 @@ public:
     bool initializeSimulation(const std::vector<SimulationBody*>& simBodies);
     bool stepSimulation(const std::vector<SimulationBody*>& activeSimBodies);
     void addBody(RokiBody* simBody);
+    RokiGeometryCache* getGeometryCache(RokiBody* rokiBody);
     CollisionLinkPairListPtr getCollisions();
+    void getContacts(ContactBuffer& out_contacts);
 
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
@@ -266,6 +308,7 @@ RokiLink::RokiLink
 (RokiSimulatorItemImpl* simImpl, RokiBody* rokiBody, RokiLink* parent, const Vector3& parentOrigin, Link* link, bool stuffisLinkName)
 {
     isCrawler = false;
+    ownsShapes = false;
 
     rokiBody->rokiLinks.push_back(this);
     rokiBody->rokiLinkMap[link] = this;
@@ -283,7 +326,7 @@ RokiLink::RokiLink
     createLink(simImpl, rokiBody, o, stuffisLinkName);
     rkChainMass(rokiBody->chain) += link->mass();
 
-    createGeometry();
+    createGeometry(rokiBody->geometryCache);
 
     for(Link* child = link->child(); child; child = child->sibling()){
         new RokiLink(simImpl, rokiBody, this, o, child, stuffisLinkName);
@@ -513,8 +556,17 @@ void RokiLink::createLink(RokiSimulatorItemImpl* simImpl, RokiBody* body, const
 }
 
 
-void RokiLink::createGeometry()
+void RokiLink::createGeometry(RokiGeometryCache* cache)
 {
+    const int index = link->index();
+    if(cache && cache->isLinkCached[index]){
+        shapes = cache->linkShapes[index];
+        for(size_t i=0; i < shapes.size(); ++i){
+            rkLinkShapePush( rklink, shapes[i] );
+        }
+        return;
+    }
+
     if(link->collisionShape()){
         MeshExtractor* extractor = new MeshExtractor;
         if(extractor->extract(link->collisionShape(), boost::bind(&RokiLink::addMesh, this, extractor))){
@@ -550,6 +602,12 @@ void RokiLink::createGeometry()
         delete extractor;
     }
 
+    if(cache){
+        cache->linkShapes[index] = shapes;
+        cache->isLinkCached[index] = true;
+    } else {
+        ownsShapes = true;
+    }
 }
 
 
@@ -692,8 +750,10 @@ void RokiLink::addMesh(MeshExtractor* extractor)
 
 RokiLink::~RokiLink()
 {
-    for(size_t i=0; i<shapes.size(); i++)
-        zShape3DDestroy(shapes[i]);
+    if(ownsShapes){
+        for(size_t i=0; i<shapes.size(); i++)
+            zShape3DDestroy(shapes[i]);
+    }
 }
 
 
@@ -1054,6 +1114,16 @@ bool RokiSimulatorItemImpl::initializeSimulation(const std::vector<SimulationBod
         rkFDDestroy( &fd );
     }
 
+    // The shapes of the invalidated caches are not used by any simulation at this point
+    GeometryCacheMap::iterator p = geometryCaches.begin();
+    while(p != geometryCaches.end()){
+        if(p->second->isValid){
+            ++p;
+        } else {
+            geometryCaches.erase(p++);
+        }
+    }
+
     rkFDCreate( &fd );
     createdFD = true;
 
@@ -1134,12 +1204,32 @@ void RokiSimulatorItemImpl::addBody(RokiBody* rokiBody)
     body.clearExternalForces();
     body.calcForwardKinematics(true, true);
 
+    rokiBody->geometryCache = getGeometryCache(rokiBody);
     rokiBody->createBody(this, useContactFile);
 
     bodyMap[rokiBody->chain] = rokiBody->body();
 }
 
 
+RokiGeometryCache* RokiSimulatorItemImpl::getGeometryCache(RokiBody* rokiBody)
+{
+    BodyItem* bodyItem = rokiBody->bodyItem();
+    if(!bodyItem){
+        return 0;
+    }
+    const int numLinks = rokiBody->body()->numLinks();
+    RokiGeometryCachePtr& cache = geometryCaches[bodyItem];
+    if(!cache || !cache->isValid || (int)cache->linkShapes.size() != numLinks){
+        cache = new RokiGeometryCache(numLinks);
+        cache->connections.add(
+            bodyItem->sigModelUpdated().connect(boost::bind(&RokiGeometryCache::invalidate, cache.get())));
+        cache->connections.add(
+            bodyItem->sigDisconnectedFromRoot().connect(boost::bind(&RokiGeometryCache::invalidate, cache.get())));
+    }
+    return cache;
+}
+
+
 bool RokiSimulatorItem::stepSimulation(const std::vector<SimulationBody*>& activeSimBodies)
 {
     return impl->stepSimulation(activeSimBodies);
@@ -1193,6 +1283,7 @@ bool RokiSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>& a
         simulationTime += timer.nsecsElapsed();
     }
 
+    gyroAndAccelerationSensorHelpers.clear();
     for(size_t i=0; i < activeSimBodies.size(); i++){
         RokiBody* rokiBody = static_cast<RokiBody*>(activeSimBodies[i]);
 
@@ -1201,9 +1292,10 @@ bool RokiSimulatorItemImpl::stepSimulation(const std::vector<SimulationBody*>& a
             rokiBody->updateForceSensors();
         }
         if(rokiBody->sensorHelper.hasGyroOrAccelerationSensors()){
-            rokiBody->sensorHelper.updateGyroAndAccelerationSensors();
+            gyroAndAccelerationSensorHelpers.push_back(&rokiBody->sensorHelper);
         }
     }
+    BasicSensorSimulationHelper::updateGyroAndAccelerationSensors(gyroAndAccelerationSensorHelpers);
 
     return true;
 }
@@ -1223,31 +1315,44 @@ CollisionLinkPairListPtr RokiSimulatorItem::getCollisions()
 
 CollisionLinkPairListPtr RokiSimulatorItemImpl::getCollisions()
 {
+    ContactBuffer contacts;
+    getContacts(contacts);
     CollisionLinkPairListPtr collisionPairs = boost::make_shared<CollisionLinkPairList>();
+    contacts.appendTo(*collisionPairs);
+    return collisionPairs;
+}
+
+
+void RokiSimulatorItem::getContacts(ContactBuffer& out_contacts)
+{
+    impl->getContacts(out_contacts);
+}
+
+
+void RokiSimulatorItemImpl::getContacts(ContactBuffer& out_contacts)
+{
+    out_contacts.clear();
     rkCDPair *cdp;
     zListForEach( &fd.cd.plist, cdp ){
         if( !cdp->data.is_col ) continue;
-        CollisionLinkPairPtr dest = boost::make_shared<CollisionLinkPair>();
+        Body* bodies[2];
+        Link* links[2];
         for(int j=0; j<2; j++){
-            dest->body[j] = bodyMap[cdp->data.cell[j]->data.chain];
-            dest->link[j] = dest->body[j]->link(zName(cdp->data.cell[j]->data.shape));
+            bodies[j] = bodyMap[cdp->data.cell[j]->data.chain];
+            links[j] = bodies[j]->link(zName(cdp->data.cell[j]->data.shape));
         }
+        out_contacts.addLinkPair(bodies[0], links[0], bodies[1], links[1]);
         rkCDVert *v;
         zListForEach( &cdp->data.vlist, v ){
-            dest->collisions.push_back(Collision());
-            Collision& col = dest->collisions.back();
-            for(int i=0; i<3; i++)
-                col.point[i] = zVec3DElem(v->data.vert, i);
-            for(int i=0; i<3; i++)
-                col.normal[i] = -zVec3DElem(&v->data.norm, i);
-            Vector3 pro;
-            for(int i=0; i<3; i++)
+            Vector3 point, normal, pro;
+            for(int i=0; i<3; i++){
+                point[i] = zVec3DElem(v->data.vert, i);
+                normal[i] = -zVec3DElem(&v->data.norm, i);
                 pro[i] = (&v->data.pro)->e[i];
-            col.depth = (col.point - pro).norm();
+            }
+            out_contacts.addContact(point, normal, (point - pro).norm());
         }
-        collisionPairs->push_back(dest);
     }
-    return collisionPairs;
 }
 
 #if 0
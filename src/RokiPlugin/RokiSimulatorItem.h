@@ -22,6 +22,8 @@ public:
     RokiSimulatorItem(const RokiSimulatorItem& org);
     virtual ~RokiSimulatorItem();
 
+    virtual void getContacts(ContactBuffer& out_contacts);
+
 protected:
     virtual SimulationBody* createSimulationBody(Body* orgBody);
     virtual bool initializeSimulation(const std::vector<SimulationBody*>& simBodies);
@@ -769,10 +769,23 @@ void SceneGraphPropertyViewImpl::onItemSelectionChanged(const SgObject* object)
 }
 
 
+/**
+   The updates of the descendant nodes are also propagated to the current object,
+   but the properties only have to be updated when the object itself is modified
+   or when a child is added to or removed from it.
+*/
 void SceneGraphPropertyViewImpl::onSceneGraphUpdated(const SgUpdate& update)
 {
-    if(update.action() & (SgUpdate::MODIFIED))
+    const SgUpdate::Path& path = update.path();
+    if(path.empty()){
+        return;
+    }
+    if(path.front() == currentObject){
+        if(update.action() & SgUpdate::MODIFIED)
+            updateProperties();
+    } else if(path.size() == 2 && (update.action() & (SgUpdate::ADDED | SgUpdate::REMOVED))){
         updateProperties();
+    }
 }
 
 
@@ -4,7 +4,7 @@
 
 #include "SceneGraphView.h"
 #include <cassert>
-#include <list>
+#include <set>
 #include <cnoid/SceneCameras>
 #include <cnoid/SceneLights>
 #include <cnoid/SceneEffects>
@@ -34,7 +34,7 @@ class SgvItem : public QTreeWidgetItem
 {
 public:
     SgvItem(SgObject* node, QTreeWidget* widget=0) 
-        : QTreeWidgetItem(widget), node(node), markerNode(0), markerItem_(0){ }
+        : QTreeWidgetItem(widget), node(node), markerNode(0), markerItem_(0), isPopulated(true) { }
     ~SgvItem();
     inline SgvMarkerItem* markerItem() { return markerItem_; }
     inline void setMarkerItem(SgvMarkerItem* markerItem) { markerItem_ = markerItem; }
@@ -45,6 +45,9 @@ public:
     SgvItem* groupItem;
     SgNode* markerNode;
     SgvMarkerItem* markerItem_;
+
+    // false while the items of the children of the group have not been created
+    bool isPopulated;
 };
 
 class SgvMarkerItem : public QTreeWidgetItem
@@ -78,13 +81,14 @@ public:
     Signal<void(const SgObject*)> sigSelectionChanged;
 
     void createGraph();
-    void createGraph(SgvItem* item, SgNode* node);
+    void createGraph(SgvItem* item);
+    void populateItem(SgvItem* item);
+    void onItemExpanded(QTreeWidgetItem* item);
+    void syncChildItems(SgvItem* item);
     void onActivated(bool on);
     void onSceneGraphUpdated(const SgUpdate& update);
     SgvItem* findItem(SgvItem* parent, SgObject* obj);
-    SgNode* findAddNode(SgGroup* group);
-    SgvItem* findRemoveItem(SgGroup* group);
-    void removeItem(SgvItem* item);
+    void removeItem(QTreeWidgetItem* item);
 
     void visitObject(SgObject* obj);
     virtual void visitNode(SgNode* node);
@@ -174,9 +178,10 @@ SceneGraphViewImpl::SceneGraphViewImpl(SceneGraphView* self, SgNode* sceneRoot)
     self->sigDeactivated().connect(boost::bind(&SceneGraphViewImpl::onActivated, this ,false));
 
     sigItemSelectionChanged().connect(boost::bind(&SceneGraphViewImpl::onSelectionChanged, this));
+    sigItemExpanded().connect(boost::bind(&SceneGraphViewImpl::onItemExpanded, this, _1));
 
     parentItem = rootItem = 0;
-    visitNode(sceneRoot);
+    sceneRoot->accept(*this);
 
     selectedSgObject = 0;
     selectedSgvItem = 0;
@@ -190,33 +195,101 @@ SceneGraphViewImpl::~SceneGraphViewImpl()
 }
 
 
+/**
+   The items of the groups are created when they are expanded, so only the items
+   which have already been created are synchronized with the scene graph here.
+*/
 void SceneGraphViewImpl::createGraph()
 {
-    createGraph(rootItem, sceneRoot);
+    populateItem(rootItem);
+    createGraph(rootItem);
 }
 
 
-void SceneGraphViewImpl::createGraph(SgvItem* item, SgNode* node)
+void SceneGraphViewImpl::createGraph(SgvItem* item)
 {
-    SgvItem* oldParent = parentItem;
-    parentItem = item;
-    list<SgvItem*> children; 
-    for(int i=0; i<item->childCount(); i++)
-        children.push_back((SgvItem*)item->child(i));
-
-    SgGroup* group = dynamic_cast<SgGroup*>(node);
-    if(group){
-        for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
-            SgvItem* item_ = findItem(parentItem, (*p).get());
-            if(item_){
-                createGraph(item_, (*p).get());
-                children.remove(item_);
-            }else{
-                (*p)->accept(*this);
+    syncChildItems(item);
+    if(item->group == item->node){
+        for(int i=0; i < item->childCount(); ++i){
+            SgvItem* childItem = dynamic_cast<SgvItem*>(item->child(i));
+            if(childItem && childItem->isPopulated){
+                createGraph(childItem);
             }
         }
-        for(list<SgvItem*>::iterator it = children.begin(); it != children.end(); it++){
-            removeItem(*it);
+    }
+}
+
+
+void SceneGraphViewImpl::populateItem(SgvItem* item)
+{
+    if(!item->isPopulated){
+        item->isPopulated = true;
+        item->setChildIndicatorPolicy(QTreeWidgetItem::DontShowIndicatorWhenChildless);
+        // The marker item may have already been added to the item
+        syncChildItems(item);
+    }
+}
+
+
+void SceneGraphViewImpl::onItemExpanded(QTreeWidgetItem* item)
+{
+    SgvItem* expandedItem = dynamic_cast<SgvItem*>(item);
+    if(expandedItem){
+        populateItem(expandedItem);
+    }
+}
+
+
+static SgObject* objectOfItem(QTreeWidgetItem* item)
+{
+    SgvItem* sgvItem = dynamic_cast<SgvItem*>(item);
+    if(sgvItem){
+        return sgvItem->node;
+    }
+    SgvMarkerItem* markerItem = dynamic_cast<SgvMarkerItem*>(item);
+    if(markerItem){
+        return markerItem->marker.get();
+    }
+    return 0;
+}
+
+
+/**
+   Adds the items of the children which have been added to the group of the item
+   and removes the items of the children which have been removed from it.
+*/
+void SceneGraphViewImpl::syncChildItems(SgvItem* item)
+{
+    if(item->group != item->node){
+        return;
+    }
+    SgGroup* group = item->group;
+    
+    if(!item->isPopulated){
+        item->setChildIndicatorPolicy(
+            group->empty() ? QTreeWidgetItem::DontShowIndicator : QTreeWidgetItem::ShowIndicator);
+        return;
+    }
+
+    set<SgObject*> children;
+    for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
+        children.insert(p->get());
+    }
+    set<SgObject*> existingChildren;
+    for(int i = item->childCount() - 1; i >= 0; --i){
+        QTreeWidgetItem* childItem = item->child(i);
+        SgObject* object = objectOfItem(childItem);
+        if(children.find(object) == children.end()){
+            removeItem(childItem);
+        }else{
+            existingChildren.insert(object);
+        }
+    }
+    SgvItem* oldParent = parentItem;
+    parentItem = item;
+    for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
+        if(existingChildren.find(p->get()) == existingChildren.end()){
+            (*p)->accept(*this);
         }
     }
     parentItem = oldParent;
@@ -230,7 +303,6 @@ void SceneGraphViewImpl::visitNode(SgNode* node)
         sgvItem->group = dynamic_cast<SgGroup*>(node);
         sgvItem->groupItem = sgvItem;
         rootItem = sgvItem;
-        parentItem = sgvItem;
     }else{
         sgvItem = new SgvItem(node);
         SgGroup* group_ = dynamic_cast<SgGroup*>(node);
@@ -299,12 +371,11 @@ void SceneGraphViewImpl::visitNode(SgNode* node)
 void SceneGraphViewImpl::visitGroup(SgGroup* group)
 {
     visitNode(group);
-    SgvItem* oldParent = parentItem;
-    parentItem = sgvItem;
-    for(SgGroup::const_iterator p = group->begin(); p != group->end(); ++p){
-        (*p)->accept(*this);
-    }
-    parentItem = oldParent;
+
+    // The items of the children are created by populateItem() when the item is expanded
+    sgvItem->isPopulated = false;
+    sgvItem->setChildIndicatorPolicy(
+        group->empty() ? QTreeWidgetItem::DontShowIndicator : QTreeWidgetItem::ShowIndicator);
 }
 
 
@@ -383,102 +454,62 @@ void SceneGraphViewImpl::onActivated(bool on)
 }
 
 
-SgNode* SceneGraphViewImpl::findAddNode(SgGroup* group)
-{
-    for(SgGroup::const_iterator it = group->begin(); it != group->end(); it++){
-        SgNode* node = it->get();
-        if(!findItem(parentItem, node))
-            return node;
-    }
-    return 0;
-}
-
-
-SgvItem* SceneGraphViewImpl::findRemoveItem(SgGroup* group)
-{
-    int num = parentItem->childCount();
-    for(int i=0; i<num; i++){
-        SgvItem* childItem = (SgvItem*)parentItem->child(i);
-        if(!group->contains((SgNode*)childItem->node))
-            return childItem;
-    }
-    return 0;
-}
-
-
 SgvItem* SceneGraphViewImpl::findItem(SgvItem* parent, SgObject* obj)
 {
     int num = parent->childCount();
     for(int i=0; i<num; i++){
-        SgvItem* childItem = (SgvItem*)parent->child(i);
-        if( obj == childItem->node )
+        SgvItem* childItem = dynamic_cast<SgvItem*>(parent->child(i));
+        if(childItem && obj == childItem->node)
             return childItem;
     }
     return 0;
 }
 
 
+/**
+   The path of an added or removed node is [the node, its group, ..., the root].
+   Only the items of the group are updated, and nothing is done when the group is in a
+   subtree whose items have not been created yet.
+*/
 void SceneGraphViewImpl::onSceneGraphUpdated(const SgUpdate& update)
 {
-    if(update.action() & (SgUpdate::ADDED)){
-        parentItem = rootItem;
-        SgUpdate::Path path = update.path();
-        if(path.size() > 1){
-            for(SgUpdate::Path::reverse_iterator it = ++path.rbegin(); it != path.rend(); ++it){
-                parentItem = findItem(parentItem, *it);
-                if(!parentItem)
-                    return;
-            }
-        }
-
-        SgObject* parent = update.path().front();
-        SgGroup* group = dynamic_cast<SgGroup*>(parent);
-        if(group){
-            SgNode* node = findAddNode(group);
-            if(node){
-                node->accept(*this);
-            }
-        }
+    if(!(update.action() & (SgUpdate::ADDED | SgUpdate::REMOVED))){
+        return;
     }
-    if(update.action() & (SgUpdate::REMOVED)){
-        parentItem = rootItem;
-        SgUpdate::Path path = update.path();
-        if(path.size() > 1){
-            for(SgUpdate::Path::reverse_iterator it = ++path.rbegin(); it != path.rend(); ++it){
-                parentItem = findItem(parentItem, *it);
-                if(!parentItem)
-                    return;
-            }
+    const SgUpdate::Path& path = update.path();
+    if(path.size() < 2 || path.back() != sceneRoot){
+        return;
+    }
+    SgvItem* groupItem = rootItem;
+    for(int i = path.size() - 2; i >= 1; --i){
+        if(!groupItem->isPopulated){
+            return;
         }
-
-        SgObject* parent = update.path().front();
-        SgGroup* group = dynamic_cast<SgGroup*>(parent);
-        if(group){
-            SgvItem* item = findRemoveItem(group);
-            if(item){
-                removeItem(item);
-            }
+        groupItem = findItem(groupItem, path[i]);
+        if(!groupItem){
+            return;
         }
     }
+    syncChildItems(groupItem);
 }
 
 
-void SceneGraphViewImpl::removeItem(SgvItem* item)
+void SceneGraphViewImpl::removeItem(QTreeWidgetItem* item)
 {
-    int num = item->childCount();
-    if(num){
-        SgvItem* oldParent = parentItem;
-        parentItem = item;
-        SgvItem* child = (SgvItem*)item->child(0);
-        while(child){
-            removeItem(child);
-            child = (SgvItem*)item->child(0);
-        }
-        parentItem = oldParent;
+    while(item->childCount() > 0){
+        removeItem(item->child(0));
     }
-    parentItem->removeChild(item);
-    if(item->node->name()!="GraphViewMarker")
+    QTreeWidgetItem* parent = item->parent();
+    if(parent){
+        parent->removeChild(item);
+    }
+    // The marker item is owned by the selected item
+    if(!dynamic_cast<SgvMarkerItem*>(item)){
+        if(item == selectedSgvItem){
+            selectedSgvItem = 0;
+        }
         delete item;
+    }
 }
 
 
@@ -548,6 +579,9 @@ void SceneGraphViewImpl::renderMarker(GL1SceneRenderer& renderer)
     SgTransform* trans = 0;
     SgMeshBase* mesh = 0;
 
+    if(!selectedSgvItem){
+        return;
+    }
     if(selectedSgvItem->markerNode){
         node = selectedSgvItem->markerNode;
     }else if(dynamic_cast<SgScaleTransform*>(selectedSgvItem->node) ||
@@ -4,6 +4,7 @@
 
 #include "SimpleControllerItem.h"
 #include <cnoid/SimpleController>
+#include <cnoid/SharedMemorySimpleController>
 #include <cnoid/Body>
 #include <cnoid/Link>
 #include <cnoid/Archive>
@@ -12,6 +13,7 @@
 #include <cnoid/FileUtil>
 #include <cnoid/ConnectionSet>
 #include <cnoid/ProjectManager>
+#include <cnoid/Profiler>
 #include <QLibrary>
 #include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
@@ -23,22 +25,71 @@ using namespace cnoid;
 
 namespace {
 
-enum {
-    INPUT_JOINT_DISPLACEMENT = 0,
-    INPUT_JOINT_FORCE = 1,
-    INPUT_JOINT_VELOCITY = 2,
-    INPUT_JOINT_ACCELERATION = 3,
-    INPUT_LINK_POSITION = 4,
-    INPUT_NONE = 5
-};
+/**
+   The copy operations of the link states between two bodies, which are grouped by the state types
+   so that the states are copied by simple loops without interpreting the state types every step.
+   The plan is rebuilt only when the state types of the input or the output are changed.
+*/
+class LinkStateCopyPlan
+{
+public:
+    typedef std::pair<const Link*, Link*> LinkPair;
+    vector<LinkPair> displacements;
+    vector<LinkPair> velocities;
+    vector<LinkPair> accelerations;
+    vector<LinkPair> forces;
+    vector<LinkPair> positions;
+
+    void clear() {
+        displacements.clear();
+        velocities.clear();
+        accelerations.clear();
+        forces.clear();
+        positions.clear();
+    }
+
+    void build(const vector<char>& linkIndexToStateTypeMap, const Body* source, Body* destination) {
+        clear();
+        for(size_t i=0; i < linkIndexToStateTypeMap.size(); ++i){
+            const int types = linkIndexToStateTypeMap[i];
+            if(types){
+                LinkPair linkPair(source->link(i), destination->link(i));
+                if(types & SimpleControllerIO::JOINT_DISPLACEMENT){
+                    displacements.push_back(linkPair);
+                }
+                if(types & SimpleControllerIO::JOINT_VELOCITY){
+                    velocities.push_back(linkPair);
+                }
+                if(types & SimpleControllerIO::JOINT_ACCELERATION){
+                    accelerations.push_back(linkPair);
+                }
+                if(types & SimpleControllerIO::JOINT_FORCE){
+                    forces.push_back(linkPair);
+                }
+                if(types & SimpleControllerIO::LINK_POSITION){
+                    positions.push_back(linkPair);
+                }
+            }
+        }
+    }
 
-enum {
-    OUTPUT_JOINT_FORCE = 0,
-    OUTPUT_JOINT_DISPLACEMENT = 1,
-    OUTPUT_JOINT_VELOCITY = 2,
-    OUTPUT_JOINT_ACCELERATION = 3,
-    OUTPUT_LINK_POSITION = 4,
-    OUTPUT_NONE = 5
+    void execute() const {
+        for(size_t i=0; i < displacements.size(); ++i){
+            displacements[i].second->q() = displacements[i].first->q();
+        }
+        for(size_t i=0; i < velocities.size(); ++i){
+            velocities[i].second->dq() = velocities[i].first->dq();
+        }
+        for(size_t i=0; i < accelerations.size(); ++i){
+            accelerations[i].second->ddq() = accelerations[i].first->ddq();
+        }
+        for(size_t i=0; i < forces.size(); ++i){
+            forces[i].second->u() = forces[i].first->u();
+        }
+        for(size_t i=0; i < positions.size(); ++i){
+            positions[i].second->T() = positions[i].first->T();
+        }
+    }
 };
 
 }
@@ -50,16 +101,15 @@ class SimpleControllerItemImpl : public SimulationSimpleControllerIO
 public:
     SimpleControllerItem* self;
     SimpleController* controller;
+    const char* profilerScopeName;
     Body* simulationBody;
     BodyPtr ioBody;
     ControllerItemIO* io;
 
     bool isInputStateTypeSetUpdated;
     bool isOutputStateTypeSetUpdated;
-    vector<unsigned short> inputLinkIndices;
-    vector<char> inputStateTypes;
-    vector<unsigned short> outputLinkIndices;
-    vector<char> outputStateTypes;
+    LinkStateCopyPlan inputCopyPlan;
+    LinkStateCopyPlan outputCopyPlan;
 
     ConnectionSet inputDeviceStateConnections;
     boost::dynamic_bitset<> inputDeviceStateChangeFlag;
@@ -79,6 +129,9 @@ public:
     QLibrary controllerModule;
     bool doReloading;
     Selection pathBase;
+    std::string sharedMemoryName;
+    double responseTimeout;
+    Selection timeoutPolicy;
 
     enum PathBase {
         CONTROLLER_DIRECTORY = 0,
@@ -97,6 +150,7 @@ public:
     void onOutputDeviceStateChanged(int deviceIndex);
     void output();
     bool onReloadingChanged(bool on);
+    bool onSharedMemoryNameChanged(const std::string& name);
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
     bool restore(const Archive& archive);
@@ -128,15 +182,21 @@ SimpleControllerItem::SimpleControllerItem()
 
 SimpleControllerItemImpl::SimpleControllerItemImpl(SimpleControllerItem* self)
     : self(self),
-      pathBase(N_PATH_BASE, CNOID_GETTEXT_DOMAIN_NAME)
+      pathBase(N_PATH_BASE, CNOID_GETTEXT_DOMAIN_NAME),
+      timeoutPolicy(2, CNOID_GETTEXT_DOMAIN_NAME)
 {
     controller = 0;
+    profilerScopeName = 0;
     io = 0;
     mv = MessageView::instance();
     doReloading = true;
     pathBase.setSymbol(CONTROLLER_DIRECTORY, N_("Controller directory"));
     pathBase.setSymbol(PROJECT_DIRECTORY, N_("Project directory"));
     pathBase.select(CONTROLLER_DIRECTORY);
+    responseTimeout = 0.0;
+    timeoutPolicy.setSymbol(SharedMemorySimpleController::HOLD_OUTPUT, N_("Hold output"));
+    timeoutPolicy.setSymbol(SharedMemorySimpleController::STOP_SIMULATION, N_("Stop simulation"));
+    timeoutPolicy.select(SharedMemorySimpleController::HOLD_OUTPUT);
 }
 
 
@@ -149,13 +209,17 @@ SimpleControllerItem::SimpleControllerItem(const SimpleControllerItem& org)
 
 SimpleControllerItemImpl::SimpleControllerItemImpl(SimpleControllerItem* self, const SimpleControllerItemImpl& org)
     : self(self),
-      pathBase(org.pathBase)
+      pathBase(org.pathBase),
+      timeoutPolicy(org.timeoutPolicy)
 {
     controller = 0;
+    profilerScopeName = 0;
     io = 0;
     mv = MessageView::instance();
     controllerModuleName = org.controllerModuleName;
     doReloading = org.doReloading;
+    sharedMemoryName = org.sharedMemoryName;
+    responseTimeout = org.responseTimeout;
 }
 
 
@@ -180,6 +244,9 @@ void SimpleControllerItemImpl::unloadController()
         controller = 0;
     }
 
+    // The scope names given by the controller are invalidated by unloading the module
+    Profiler::collect();
+
     if(controllerModule.unload()){
         mv->putln(fmt(_("The controller module \"%2%\" of %1% has been unloaded."))
                   % self->name() % controllerModuleFileName);
@@ -253,6 +320,18 @@ bool SimpleControllerItemImpl::initialize(ControllerItemIO* io, Body* sharedIoBo
     this->io = io;
     bool result = false;
 
+    if(!controller && !sharedMemoryName.empty()){
+        controller = new SharedMemorySimpleController(sharedMemoryName);
+        mv->putln(fmt(_("%1% waits for the controller process connecting to the shared memory \"%2%\"."))
+                  % self->name() % sharedMemoryName);
+    }
+    SharedMemorySimpleController* remoteController = dynamic_cast<SharedMemorySimpleController*>(controller);
+    if(remoteController){
+        remoteController->setTimeout(responseTimeout);
+        remoteController->setTimeoutPolicy(
+            static_cast<SharedMemorySimpleController::TimeoutPolicy>(timeoutPolicy.which()));
+    }
+
     if(!controller){
 
         filesystem::path dllPath(controllerModuleName);
@@ -317,13 +396,12 @@ bool SimpleControllerItemImpl::initialize(ControllerItemIO* io, Body* sharedIoBo
         }
         
         controller->setIO(this);
+        profilerScopeName = Profiler::internName(self->name());
 
         isInputStateTypeSetUpdated = true;
         isOutputStateTypeSetUpdated = true;
-        inputLinkIndices.clear();
-        inputStateTypes.clear();
-        outputLinkIndices.clear();
-        outputStateTypes.clear();
+        inputCopyPlan.clear();
+        outputCopyPlan.clear();
         
         result = controller->initialize(this);
 
@@ -463,55 +541,6 @@ void SimpleControllerItemImpl::setLinkOutput(Link* link, int stateTypes)
 }
 
 
-static int getInputStateTypeIndex(int type){
-    switch(type){
-    case SimpleControllerIO::JOINT_DISPLACEMENT: return INPUT_JOINT_DISPLACEMENT;
-    case SimpleControllerIO::JOINT_VELOCITY:     return INPUT_JOINT_VELOCITY;
-    case SimpleControllerIO::JOINT_ACCELERATION: return INPUT_JOINT_ACCELERATION;
-    case SimpleControllerIO::JOINT_FORCE:        return INPUT_JOINT_FORCE;
-    case SimpleControllerIO::LINK_POSITION:      return INPUT_LINK_POSITION;
-    default:
-        return INPUT_NONE;
-    }
-}
-
-
-static int getOutputStateTypeIndex(int type){
-    switch(type){
-    case SimpleControllerIO::JOINT_DISPLACEMENT: return OUTPUT_JOINT_DISPLACEMENT;
-    case SimpleControllerIO::JOINT_VELOCITY:     return OUTPUT_JOINT_VELOCITY;
-    case SimpleControllerIO::JOINT_ACCELERATION: return OUTPUT_JOINT_ACCELERATION;
-    case SimpleControllerIO::JOINT_FORCE:        return OUTPUT_JOINT_FORCE;
-    case SimpleControllerIO::LINK_POSITION:      return OUTPUT_LINK_POSITION;
-    default:
-        return OUTPUT_NONE;
-    }
-}
-
-
-static void updateIOStateTypeSet
-(vector<char>& linkIndexToStateTypeMap, vector<unsigned short>& linkIndices, vector<char>& stateTypes,
- boost::function<int(int type)> getStateTypeIndex)
-{
-    linkIndices.clear();
-    stateTypes.clear();
-
-    for(size_t i=0; i < linkIndexToStateTypeMap.size(); ++i){
-        bitset<5> types(linkIndexToStateTypeMap[i]);
-        if(types.any()){
-            const int n = types.count();
-            linkIndices.push_back(i);
-            stateTypes.push_back(n);
-            for(int j=0; j < 5; ++j){
-                if(types.test(j)){
-                    stateTypes.push_back(getStateTypeIndex(1 << j));
-                }
-            }
-        }
-    }
-}
-
-
 bool SimpleControllerItemImpl::isImmediateMode() const
 {
     return self->isImmediateMode();
@@ -550,39 +579,12 @@ void SimpleControllerItem::input()
 void SimpleControllerItemImpl::input()
 {
     if(isInputStateTypeSetUpdated){
-        updateIOStateTypeSet(linkIndexToInputStateTypeMap, inputLinkIndices, inputStateTypes, getInputStateTypeIndex);
+        inputCopyPlan.build(linkIndexToInputStateTypeMap, simulationBody, ioBody);
         isInputStateTypeSetUpdated = false;
     }
 
-    int typeArrayIndex = 0;
-    for(size_t i=0; i < inputLinkIndices.size(); ++i){
-        const int linkIndex = inputLinkIndices[i];
-        const Link* simLink = simulationBody->link(linkIndex);
-        Link* ioLink = ioBody->link(linkIndex);
-        const int n = inputStateTypes[typeArrayIndex++];
-        for(int j=0; j < n; ++j){
-            switch(inputStateTypes[typeArrayIndex++]){
-            case INPUT_JOINT_DISPLACEMENT:
-                ioLink->q() = simLink->q();
-                break;
-            case INPUT_JOINT_FORCE:
-                ioLink->u() = simLink->u();
-                break;
-            case INPUT_LINK_POSITION:
-                ioLink->T() = simLink->T();
-                break;
-            case INPUT_JOINT_VELOCITY:
-                ioLink->dq() = simLink->dq();
-                break;
-            case INPUT_JOINT_ACCELERATION:
-                ioLink->ddq() = simLink->ddq();
-                break;
-            default:
-                break;
-            }
-        }
-    }
-                
+    inputCopyPlan.execute();
+
     if(inputDeviceStateChangeFlag.any()){
         const DeviceList<>& devices = simulationBody->devices();
         const DeviceList<>& ioDevices = ioBody->devices();
@@ -608,10 +610,16 @@ void SimpleControllerItemImpl::onInputDeviceStateChanged(int deviceIndex)
 
 bool SimpleControllerItem::control()
 {
-    bool result = impl->controller->control();
+    bool result;
+    {
+        Profiler::Scope profilerScope(impl->profilerScopeName);
+        result = impl->controller->control();
+    }
 
     for(size_t i=0; i < impl->childControllerItems.size(); ++i){
-        if(impl->childControllerItems[i]->impl->controller->control()){
+        SimpleControllerItemImpl* childImpl = impl->childControllerItems[i]->impl;
+        Profiler::Scope profilerScope(childImpl->profilerScopeName);
+        if(childImpl->controller->control()){
             result = true;
         }
     }
@@ -639,38 +647,11 @@ void SimpleControllerItem::output()
 void SimpleControllerItemImpl::output()
 {
     if(isOutputStateTypeSetUpdated){
-        updateIOStateTypeSet(linkIndexToOutputStateTypeMap, outputLinkIndices, outputStateTypes, getOutputStateTypeIndex);
+        outputCopyPlan.build(linkIndexToOutputStateTypeMap, ioBody, simulationBody);
         isOutputStateTypeSetUpdated = false;
     }
 
-    int typeArrayIndex = 0;
-    for(size_t i=0; i < outputLinkIndices.size(); ++i){
-        const int linkIndex = outputLinkIndices[i];
-        Link* simLink = simulationBody->link(linkIndex);
-        const Link* ioLink = ioBody->link(linkIndex);
-        const int n = outputStateTypes[typeArrayIndex++];
-        for(int j=0; j < n; ++j){
-            switch(outputStateTypes[typeArrayIndex++]){
-            case OUTPUT_JOINT_FORCE:
-                simLink->u() = ioLink->u();
-                break;
-            case OUTPUT_JOINT_DISPLACEMENT:
-                simLink->q() = ioLink->q();
-                break;
-            case OUTPUT_JOINT_VELOCITY:
-                simLink->dq() = ioLink->dq();
-                break;
-            case OUTPUT_JOINT_ACCELERATION:
-                simLink->ddq() = ioLink->ddq();
-                break;
-            case OUTPUT_LINK_POSITION:
-                simLink->T() = ioLink->T();
-                break;
-            default:
-                break;
-            }
-        }
-    }
+    outputCopyPlan.execute();
 
     if(outputDeviceStateChangeFlag.any()){
         const DeviceList<>& devices = simulationBody->devices();
@@ -711,6 +692,16 @@ bool SimpleControllerItemImpl::onReloadingChanged(bool on)
 }
 
 
+bool SimpleControllerItemImpl::onSharedMemoryNameChanged(const std::string& name)
+{
+    if(name != sharedMemoryName){
+        unloadController();
+        sharedMemoryName = name;
+    }
+    return true;
+}
+
+
 void SimpleControllerItem::doPutProperties(PutPropertyFunction& putProperty)
 {
     ControllerItem::doPutProperties(putProperty);
@@ -735,6 +726,10 @@ void SimpleControllerItemImpl::doPutProperties(PutPropertyFunction& putProperty)
                 boost::bind(&SimpleControllerItem::setController, self, _1), true);
     putProperty(_("Reloading"), doReloading,
                 boost::bind(&SimpleControllerItemImpl::onReloadingChanged, this, _1));
+    putProperty(_("Shared memory"), sharedMemoryName,
+                boost::bind(&SimpleControllerItemImpl::onSharedMemoryNameChanged, this, _1));
+    putProperty.min(0.0)(_("Response timeout"), responseTimeout, changeProperty(responseTimeout));
+    putProperty(_("Timeout policy"), timeoutPolicy, changeProperty(timeoutPolicy));
 }
 
 
@@ -752,6 +747,11 @@ bool SimpleControllerItemImpl::store(Archive& archive)
     archive.writeRelocatablePath("controller", controllerModuleName);
     archive.write("reloading", doReloading);
     archive.write("RelativePathBase", pathBase.selectedSymbol(), DOUBLE_QUOTED);
+    if(!sharedMemoryName.empty()){
+        archive.write("sharedMemory", sharedMemoryName, DOUBLE_QUOTED);
+        archive.write("responseTimeout", responseTimeout);
+        archive.write("timeoutPolicy", timeoutPolicy.selectedSymbol());
+    }
     return true;
 }
 
@@ -776,5 +776,10 @@ bool SimpleControllerItemImpl::restore(const Archive& archive)
     if (archive.read("RelativePathBase", symbol)){
         pathBase.select(symbol);
     }
+    archive.read("sharedMemory", sharedMemoryName);
+    archive.read("responseTimeout", responseTimeout);
+    if(archive.read("timeoutPolicy", symbol)){
+        timeoutPolicy.select(symbol);
+    }
     return true;
 }
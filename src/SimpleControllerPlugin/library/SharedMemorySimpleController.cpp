@@ -0,0 +1,1029 @@
+/**
+   @file
+*/
+
+#include "SharedMemorySimpleController.h"
+#include <cnoid/Link>
+#include <cnoid/Device>
+#include <cnoid/ConnectionSet>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/dynamic_bitset.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <iostream>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+using namespace boost;
+using namespace cnoid;
+namespace ipc = boost::interprocess;
+
+namespace {
+
+const int MAGIC = 0x534e4f43;
+const int VERSION = 1;
+const int MAX_OPTION_STRING_SIZE = 1024;
+
+/*
+  q, dq, ddq, u, p (3) and R (9, column major)
+*/
+const int LINK_STATE_SIZE = 16;
+
+const int ALL_STATE_TYPES =
+    SimpleControllerIO::JOINT_DISPLACEMENT |
+    SimpleControllerIO::JOINT_VELOCITY |
+    SimpleControllerIO::JOINT_ACCELERATION |
+    SimpleControllerIO::JOINT_FORCE |
+    SimpleControllerIO::LINK_POSITION;
+
+enum Command { NO_COMMAND, INITIALIZE, START, CONTROL, STOP };
+
+/**
+   The header at the top of the shared memory. The other fields and the arrays are only accessed
+   by the side which holds the turn, which is passed by posting the semaphores, so they do not
+   have to be protected by a lock.
+*/
+struct Header
+{
+    int magic;
+    int version;
+    ipc::interprocess_semaphore requestSemaphore;
+    ipc::interprocess_semaphore replySemaphore;
+    int numLinks;
+    int numDevices;
+    int deviceStateSize;
+    int hostProcessId;
+    int clientProcessId;
+    int command;
+    int sequence;
+    int replySequence;
+    int result;
+    int stateTypeRevision;
+    double timeStep;
+    char optionString[MAX_OPTION_STRING_SIZE];
+
+    Header() : requestSemaphore(0), replySemaphore(0) { }
+};
+
+
+size_t align(size_t size)
+{
+    return (size + 15) & ~static_cast<size_t>(15);
+}
+
+
+class Layout
+{
+public:
+    size_t inputStateTypes;
+    size_t outputStateTypes;
+    size_t inputDeviceFlags;
+    size_t outputDeviceFlags;
+    size_t inputLinkStates;
+    size_t outputLinkStates;
+    size_t inputDeviceStates;
+    size_t outputDeviceStates;
+    size_t totalSize;
+
+    Layout() { totalSize = 0; }
+
+    Layout(int numLinks, int numDevices, int deviceStateSize) {
+        size_t offset = align(sizeof(Header));
+        inputStateTypes = offset;
+        offset = align(offset + numLinks);
+        outputStateTypes = offset;
+        offset = align(offset + numLinks);
+        inputDeviceFlags = offset;
+        offset = align(offset + numDevices);
+        outputDeviceFlags = offset;
+        offset = align(offset + numDevices);
+        inputLinkStates = offset;
+        offset = align(offset + sizeof(double) * numLinks * LINK_STATE_SIZE);
+        outputLinkStates = offset;
+        offset = align(offset + sizeof(double) * numLinks * LINK_STATE_SIZE);
+        inputDeviceStates = offset;
+        offset = align(offset + sizeof(double) * deviceStateSize);
+        outputDeviceStates = offset;
+        totalSize = align(offset + sizeof(double) * deviceStateSize);
+    }
+};
+
+
+int getDeviceStateOffsets(Body* body, vector<int>& out_offsets)
+{
+    const DeviceList<>& devices = body->devices();
+    out_offsets.resize(devices.size());
+    int size = 0;
+    for(size_t i=0; i < devices.size(); ++i){
+        out_offsets[i] = size;
+        size += devices[i]->stateSize();
+    }
+    return size;
+}
+
+
+void writeLinkState(double* buf, const Link* link, int types)
+{
+    if(types & SimpleControllerIO::JOINT_DISPLACEMENT){
+        buf[0] = link->q();
+    }
+    if(types & SimpleControllerIO::JOINT_VELOCITY){
+        buf[1] = link->dq();
+    }
+    if(types & SimpleControllerIO::JOINT_ACCELERATION){
+        buf[2] = link->ddq();
+    }
+    if(types & SimpleControllerIO::JOINT_FORCE){
+        buf[3] = link->u();
+    }
+    if(types & SimpleControllerIO::LINK_POSITION){
+        Eigen::Map<Vector3>(buf + 4) = link->p();
+        Eigen::Map<Matrix3>(buf + 7) = link->R();
+    }
+}
+
+
+void readLinkState(const double* buf, Link* link, int types)
+{
+    if(types & SimpleControllerIO::JOINT_DISPLACEMENT){
+        link->q() = buf[0];
+    }
+    if(types & SimpleControllerIO::JOINT_VELOCITY){
+        link->dq() = buf[1];
+    }
+    if(types & SimpleControllerIO::JOINT_ACCELERATION){
+        link->ddq() = buf[2];
+    }
+    if(types & SimpleControllerIO::JOINT_FORCE){
+        link->u() = buf[3];
+    }
+    if(types & SimpleControllerIO::LINK_POSITION){
+        link->p() = Eigen::Map<const Vector3>(buf + 4);
+        link->R() = Eigen::Map<const Matrix3>(buf + 7);
+    }
+}
+
+
+int currentProcessId()
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+
+bool isProcessAlive(int processId)
+{
+    if(processId <= 0){
+        return false;
+    }
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processId);
+    if(!process){
+        return false;
+    }
+    bool isAlive = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+    CloseHandle(process);
+    return isAlive;
+#else
+    return !(kill(processId, 0) != 0 && errno == ESRCH);
+#endif
+}
+
+
+/**
+   Waits for the semaphore in the slices of the given period so that the exit of the peer process
+   can be detected. A negative timeout means waiting until the peer exits.
+*/
+bool waitSemaphore(ipc::interprocess_semaphore& semaphore, double timeout, const int& peerProcessId)
+{
+    using namespace boost::posix_time;
+
+    if(semaphore.try_wait()){
+        return true;
+    }
+    const ptime now = microsec_clock::universal_time();
+    const ptime deadline = now + microseconds(static_cast<boost::int64_t>(timeout * 1.0e6));
+    const time_duration slice = milliseconds(100);
+    while(true){
+        ptime t = microsec_clock::universal_time() + slice;
+        if(timeout >= 0.0 && t > deadline){
+            t = deadline;
+        }
+        if(semaphore.timed_wait(t)){
+            return true;
+        }
+        if(timeout >= 0.0 && t >= deadline){
+            return false;
+        }
+        if(peerProcessId > 0 && !isProcessAlive(peerProcessId)){
+            return false;
+        }
+    }
+}
+
+
+class SharedSegment
+{
+public:
+    ipc::shared_memory_object shm;
+    ipc::mapped_region region;
+    Header* header;
+    Layout layout;
+
+    SharedSegment() { header = 0; }
+
+    char* stateTypes(bool isInput) {
+        return address<char>(isInput ? layout.inputStateTypes : layout.outputStateTypes);
+    }
+    char* deviceFlags(bool isInput) {
+        return address<char>(isInput ? layout.inputDeviceFlags : layout.outputDeviceFlags);
+    }
+    double* linkState(bool isInput, int linkIndex) {
+        return address<double>(isInput ? layout.inputLinkStates : layout.outputLinkStates) + linkIndex * LINK_STATE_SIZE;
+    }
+    double* deviceState(bool isInput, int offset) {
+        return address<double>(isInput ? layout.inputDeviceStates : layout.outputDeviceStates) + offset;
+    }
+
+    template<class T> T* address(size_t offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(region.get_address()) + offset);
+    }
+
+    void release() {
+        ipc::mapped_region().swap(region);
+        ipc::shared_memory_object().swap(shm);
+        header = 0;
+    }
+};
+
+}
+
+namespace cnoid {
+
+class SharedMemorySimpleControllerImpl
+{
+public:
+    SharedMemorySimpleController* self;
+    string sharedMemoryName;
+    SharedSegment segment;
+    SimpleControllerIO* io;
+    Body* ioBody;
+    vector<int> deviceStateOffsets;
+    ConnectionSet deviceStateConnections;
+    boost::dynamic_bitset<> deviceStateChangeFlag;
+    double timeout;
+    double connectionTimeout;
+    SharedMemorySimpleController::TimeoutPolicy timeoutPolicy;
+    bool isWaitingForReply;
+    int numTimeouts;
+    int stateTypeRevision;
+
+    SharedMemorySimpleControllerImpl(SharedMemorySimpleController* self, const string& sharedMemoryName);
+    ~SharedMemorySimpleControllerImpl();
+    void release();
+    bool createSegment();
+    bool initialize(SimpleControllerIO* io);
+    void onDeviceStateChanged(int deviceIndex);
+    bool request(int command, double timeout);
+    bool waitForReply(double timeout);
+    bool control();
+    bool onTimeout();
+    void writeInputs(bool doWriteAll);
+    void readOutputs();
+    void applyStateTypes();
+};
+
+class SharedMemorySimpleControllerIOImpl
+{
+public:
+    SharedMemorySimpleControllerIO* self;
+    SharedSegment segment;
+    Body* body;
+    vector<int> deviceStateOffsets;
+    ConnectionSet deviceStateConnections;
+    boost::dynamic_bitset<> deviceStateChangeFlag;
+    string errorMessage;
+
+    SharedMemorySimpleControllerIOImpl(SharedMemorySimpleControllerIO* self);
+    bool connect(const string& sharedMemoryName, Body* body, double timeout);
+    void disconnect();
+    void onDeviceStateChanged(int deviceIndex);
+    bool run(SimpleController* controller);
+    bool initializeController(SimpleController* controller);
+    void readInputs(bool doReadAll);
+    void writeOutputs();
+    void setStateTypes(bool isInput, Link* link, int stateTypes);
+};
+
+}
+
+
+SharedMemorySimpleController::SharedMemorySimpleController(const std::string& sharedMemoryName)
+{
+    impl = new SharedMemorySimpleControllerImpl(this, sharedMemoryName);
+}
+
+
+SharedMemorySimpleControllerImpl::SharedMemorySimpleControllerImpl
+(SharedMemorySimpleController* self, const string& sharedMemoryName)
+    : self(self),
+      sharedMemoryName(sharedMemoryName)
+{
+    io = 0;
+    ioBody = 0;
+    timeout = 0.0;
+    connectionTimeout = 10.0;
+    timeoutPolicy = SharedMemorySimpleController::HOLD_OUTPUT;
+    isWaitingForReply = false;
+    numTimeouts = 0;
+    stateTypeRevision = 0;
+}
+
+
+SharedMemorySimpleController::~SharedMemorySimpleController()
+{
+    delete impl;
+}
+
+
+SharedMemorySimpleControllerImpl::~SharedMemorySimpleControllerImpl()
+{
+    release();
+}
+
+
+void SharedMemorySimpleControllerImpl::release()
+{
+    deviceStateConnections.disconnect();
+
+    if(segment.header){
+        Header* header = segment.header;
+        // The remote process reconnecting after the stop must not find this segment
+        header->magic = 0;
+        if(header->clientProcessId > 0){
+            header->command = STOP;
+            ++header->sequence;
+            header->requestSemaphore.post();
+        }
+        segment.release();
+        ipc::shared_memory_object::remove(sharedMemoryName.c_str());
+    }
+    isWaitingForReply = false;
+}
+
+
+const std::string& SharedMemorySimpleController::sharedMemoryName() const
+{
+    return impl->sharedMemoryName;
+}
+
+
+void SharedMemorySimpleController::setTimeout(double timeout)
+{
+    impl->timeout = timeout;
+}
+
+
+double SharedMemorySimpleController::timeout() const
+{
+    return impl->timeout;
+}
+
+
+void SharedMemorySimpleController::setTimeoutPolicy(TimeoutPolicy policy)
+{
+    impl->timeoutPolicy = policy;
+}
+
+
+SharedMemorySimpleController::TimeoutPolicy SharedMemorySimpleController::timeoutPolicy() const
+{
+    return impl->timeoutPolicy;
+}
+
+
+void SharedMemorySimpleController::setConnectionTimeout(double timeout)
+{
+    impl->connectionTimeout = timeout;
+}
+
+
+int SharedMemorySimpleController::numTimeouts() const
+{
+    return impl->numTimeouts;
+}
+
+
+bool SharedMemorySimpleController::initialize(SimpleControllerIO* io)
+{
+    return impl->initialize(io);
+}
+
+
+bool SharedMemorySimpleControllerImpl::createSegment()
+{
+    const int numLinks = ioBody->numLinks();
+    const int numDevices = ioBody->numDevices();
+    const int deviceStateSize = getDeviceStateOffsets(ioBody, deviceStateOffsets);
+    Layout layout(numLinks, numDevices, deviceStateSize);
+
+    Header* header = segment.header;
+    if(header){
+        // The segment is reused while the remote controller keeps running
+        if(header->numLinks == numLinks && header->numDevices == numDevices &&
+           header->deviceStateSize == deviceStateSize && !isWaitingForReply &&
+           header->clientProcessId > 0 && isProcessAlive(header->clientProcessId)){
+            return true;
+        }
+        release();
+    }
+
+    try {
+        ipc::shared_memory_object::remove(sharedMemoryName.c_str());
+        ipc::shared_memory_object shm(ipc::create_only, sharedMemoryName.c_str(), ipc::read_write);
+        shm.truncate(layout.totalSize);
+        ipc::mapped_region region(shm, ipc::read_write);
+        segment.shm.swap(shm);
+        segment.region.swap(region);
+    }
+    catch(const ipc::interprocess_exception& ex){
+        io->os() << format("The shared memory \"%1%\" cannot be created: %2%")
+            % sharedMemoryName % ex.what() << endl;
+        segment.release();
+        return false;
+    }
+    segment.layout = layout;
+    std::memset(segment.region.get_address(), 0, layout.totalSize);
+    header = new(segment.region.get_address()) Header;
+    header->version = VERSION;
+    header->numLinks = numLinks;
+    header->numDevices = numDevices;
+    header->deviceStateSize = deviceStateSize;
+    header->hostProcessId = currentProcessId();
+    segment.header = header;
+    stateTypeRevision = 0;
+
+    // The magic number is written at last so that the remote process does not access
+    // the segment under construction
+    header->magic = MAGIC;
+
+    return true;
+}
+
+
+bool SharedMemorySimpleControllerImpl::initialize(SimpleControllerIO* io)
+{
+    this->io = io;
+    ioBody = io->body();
+    numTimeouts = 0;
+
+    if(!createSegment()){
+        return false;
+    }
+
+    Header* header = segment.header;
+    header->timeStep = io->timeStep();
+    const string options = io->optionString();
+    const size_t n = std::min(options.size(), static_cast<size_t>(MAX_OPTION_STRING_SIZE - 1));
+    options.copy(header->optionString, n);
+    header->optionString[n] = '\0';
+
+    deviceStateConnections.disconnect();
+    const DeviceList<>& devices = ioBody->devices();
+    deviceStateChangeFlag.resize(devices.size());
+    deviceStateChangeFlag.set();
+    for(size_t i=0; i < devices.size(); ++i){
+        deviceStateConnections.add(
+            devices[i]->sigStateChanged().connect(
+                boost::bind(&SharedMemorySimpleControllerImpl::onDeviceStateChanged, this, i)));
+    }
+
+    writeInputs(true);
+
+    if(!request(INITIALIZE, connectionTimeout)){
+        isWaitingForReply = true;
+        io->os() << format("The controller process did not connect to the shared memory \"%1%\".")
+            % sharedMemoryName << endl;
+        return false;
+    }
+    if(!header->result){
+        return false;
+    }
+    applyStateTypes();
+
+    return true;
+}
+
+
+void SharedMemorySimpleControllerImpl::onDeviceStateChanged(int deviceIndex)
+{
+    deviceStateChangeFlag.set(deviceIndex);
+}
+
+
+bool SharedMemorySimpleControllerImpl::request(int command, double timeout)
+{
+    Header* header = segment.header;
+    header->command = command;
+    ++header->sequence;
+    header->requestSemaphore.post();
+    return waitForReply(timeout);
+}
+
+
+bool SharedMemorySimpleControllerImpl::waitForReply(double timeout)
+{
+    Header* header = segment.header;
+    while(waitSemaphore(header->replySemaphore, timeout, header->clientProcessId)){
+        // The reply to the request which timed out before is skipped
+        if(header->replySequence == header->sequence){
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool SharedMemorySimpleController::start()
+{
+    SharedMemorySimpleControllerImpl* impl = this->impl;
+    const double timeout = impl->timeout > 0.0 ? impl->timeout : -1.0;
+    if(!impl->request(START, timeout)){
+        impl->isWaitingForReply = true;
+        return false;
+    }
+    return impl->segment.header->result;
+}
+
+
+bool SharedMemorySimpleController::control()
+{
+    return impl->control();
+}
+
+
+bool SharedMemorySimpleControllerImpl::control()
+{
+    if(isWaitingForReply){
+        if(!waitForReply(0.0)){
+            return onTimeout();
+        }
+        isWaitingForReply = false;
+        readOutputs();
+    }
+
+    writeInputs(false);
+
+    if(!request(CONTROL, timeout > 0.0 ? timeout : -1.0)){
+        isWaitingForReply = true;
+        return onTimeout();
+    }
+    readOutputs();
+
+    return segment.header->result;
+}
+
+
+bool SharedMemorySimpleControllerImpl::onTimeout()
+{
+    Header* header = segment.header;
+
+    if(!isProcessAlive(header->clientProcessId)){
+        io->os() << format("The controller process of the shared memory \"%1%\" has exited.")
+            % sharedMemoryName << endl;
+        header->clientProcessId = 0;
+        return false;
+    }
+
+    if(numTimeouts++ == 0){
+        io->os() << format("The controller process of the shared memory \"%1%\" did not reply in time.")
+            % sharedMemoryName << endl;
+    }
+
+    return (timeoutPolicy == SharedMemorySimpleController::HOLD_OUTPUT);
+}
+
+
+void SharedMemorySimpleControllerImpl::writeInputs(bool doWriteAll)
+{
+    const char* stateTypes = segment.stateTypes(true);
+    const int n = ioBody->numLinks();
+    for(int i=0; i < n; ++i){
+        const int types = doWriteAll ? ALL_STATE_TYPES : stateTypes[i];
+        if(types){
+            writeLinkState(segment.linkState(true, i), ioBody->link(i), types);
+        }
+    }
+
+    if(deviceStateChangeFlag.any()){
+        const DeviceList<>& devices = ioBody->devices();
+        char* flags = segment.deviceFlags(true);
+        boost::dynamic_bitset<>::size_type i = deviceStateChangeFlag.find_first();
+        while(i != deviceStateChangeFlag.npos){
+            devices[i]->writeState(segment.deviceState(true, deviceStateOffsets[i]));
+            flags[i] = 1;
+            i = deviceStateChangeFlag.find_next(i);
+        }
+        deviceStateChangeFlag.reset();
+    }
+}
+
+
+void SharedMemorySimpleControllerImpl::readOutputs()
+{
+    if(segment.header->stateTypeRevision != stateTypeRevision){
+        applyStateTypes();
+    }
+
+    const char* stateTypes = segment.stateTypes(false);
+    const int n = ioBody->numLinks();
+    for(int i=0; i < n; ++i){
+        if(stateTypes[i]){
+            readLinkState(segment.linkState(false, i), ioBody->link(i), stateTypes[i]);
+        }
+    }
+
+    const DeviceList<>& devices = ioBody->devices();
+    char* flags = segment.deviceFlags(false);
+    for(size_t i=0; i < devices.size(); ++i){
+        if(flags[i]){
+            Device* device = devices[i];
+            device->readState(segment.deviceState(false, deviceStateOffsets[i]));
+            deviceStateConnections.block(i);
+            device->notifyStateChange();
+            deviceStateConnections.unblock(i);
+            flags[i] = 0;
+        }
+    }
+}
+
+
+void SharedMemorySimpleControllerImpl::applyStateTypes()
+{
+    const char* inputStateTypes = segment.stateTypes(true);
+    const char* outputStateTypes = segment.stateTypes(false);
+
+    io->setJointInput(0);
+    io->setJointOutput(0);
+    const int n = ioBody->numLinks();
+    for(int i=0; i < n; ++i){
+        Link* link = ioBody->link(i);
+        if(inputStateTypes[i]){
+            io->setLinkInput(link, inputStateTypes[i]);
+        }
+        if(outputStateTypes[i]){
+            io->setLinkOutput(link, outputStateTypes[i]);
+        }
+    }
+    stateTypeRevision = segment.header->stateTypeRevision;
+}
+
+
+SharedMemorySimpleControllerIO::SharedMemorySimpleControllerIO()
+{
+    impl = new SharedMemorySimpleControllerIOImpl(this);
+}
+
+
+SharedMemorySimpleControllerIOImpl::SharedMemorySimpleControllerIOImpl(SharedMemorySimpleControllerIO* self)
+    : self(self)
+{
+    body = 0;
+}
+
+
+SharedMemorySimpleControllerIO::~SharedMemorySimpleControllerIO()
+{
+    impl->disconnect();
+    delete impl;
+}
+
+
+bool SharedMemorySimpleControllerIO::connect(const std::string& sharedMemoryName, Body* body, double timeout)
+{
+    return impl->connect(sharedMemoryName, body, timeout);
+}
+
+
+bool SharedMemorySimpleControllerIOImpl::connect(const string& sharedMemoryName, Body* body, double timeout)
+{
+    using namespace boost::posix_time;
+
+    disconnect();
+    errorMessage.clear();
+
+    const ptime deadline = microsec_clock::universal_time() + microseconds(static_cast<boost::int64_t>(timeout * 1.0e6));
+    Header* header = 0;
+    while(true){
+        try {
+            ipc::shared_memory_object shm(ipc::open_only, sharedMemoryName.c_str(), ipc::read_write);
+            ipc::offset_t size;
+            if(shm.get_size(size) && size >= static_cast<ipc::offset_t>(sizeof(Header))){
+                ipc::mapped_region region(shm, ipc::read_write);
+                header = static_cast<Header*>(region.get_address());
+                if(header->magic == MAGIC){
+                    segment.shm.swap(shm);
+                    segment.region.swap(region);
+                    break;
+                }
+                header = 0;
+            }
+        }
+        catch(const ipc::interprocess_exception&){
+
+        }
+        if(timeout >= 0.0 && microsec_clock::universal_time() >= deadline){
+            errorMessage = str(format("The shared memory \"%1%\" is not found.") % sharedMemoryName);
+            return false;
+        }
+        boost::this_thread::sleep(milliseconds(100));
+    }
+
+    const int deviceStateSize = getDeviceStateOffsets(body, deviceStateOffsets);
+
+    if(header->version != VERSION){
+        errorMessage = "The version of the shared memory does not match.";
+    } else if(header->numLinks != body->numLinks() ||
+              header->numDevices != body->numDevices() ||
+              header->deviceStateSize != deviceStateSize){
+        errorMessage = str(format("The body \"%1%\" does not match the body of the simulator.") % body->name());
+    } else {
+        Layout layout(header->numLinks, header->numDevices, header->deviceStateSize);
+        if(segment.region.get_size() < layout.totalSize){
+            errorMessage = "The size of the shared memory is not enough.";
+        } else {
+            segment.layout = layout;
+            segment.header = header;
+        }
+    }
+    if(!segment.header){
+        segment.release();
+        return false;
+    }
+
+    header->clientProcessId = currentProcessId();
+
+    this->body = body;
+    const DeviceList<>& devices = body->devices();
+    deviceStateChangeFlag.resize(devices.size());
+    deviceStateChangeFlag.reset();
+    for(size_t i=0; i < devices.size(); ++i){
+        deviceStateConnections.add(
+            devices[i]->sigStateChanged().connect(
+                boost::bind(&SharedMemorySimpleControllerIOImpl::onDeviceStateChanged, this, i)));
+    }
+
+    return true;
+}
+
+
+void SharedMemorySimpleControllerIO::disconnect()
+{
+    impl->disconnect();
+}
+
+
+void SharedMemorySimpleControllerIOImpl::disconnect()
+{
+    deviceStateConnections.disconnect();
+    if(segment.header){
+        if(segment.header->clientProcessId == currentProcessId()){
+            segment.header->clientProcessId = 0;
+        }
+        segment.release();
+    }
+    body = 0;
+}
+
+
+bool SharedMemorySimpleControllerIO::isConnected() const
+{
+    return impl->segment.header != 0;
+}
+
+
+const std::string& SharedMemorySimpleControllerIO::errorMessage() const
+{
+    return impl->errorMessage;
+}
+
+
+void SharedMemorySimpleControllerIOImpl::onDeviceStateChanged(int deviceIndex)
+{
+    deviceStateChangeFlag.set(deviceIndex);
+}
+
+
+bool SharedMemorySimpleControllerIO::run(SimpleController* controller)
+{
+    return impl->run(controller);
+}
+
+
+bool SharedMemorySimpleControllerIOImpl::run(SimpleController* controller)
+{
+    if(!segment.header){
+        errorMessage = "The shared memory is not connected.";
+        return false;
+    }
+
+    Header* header = segment.header;
+
+    while(true){
+        if(!waitSemaphore(header->requestSemaphore, -1.0, header->hostProcessId)){
+            errorMessage = "The simulator has exited.";
+            return false;
+        }
+        bool result = false;
+        switch(header->command){
+        case INITIALIZE:
+            readInputs(true);
+            result = initializeController(controller);
+            break;
+        case START:
+            result = controller->start();
+            break;
+        case CONTROL:
+            readInputs(false);
+            result = controller->control();
+            writeOutputs();
+            break;
+        case STOP:
+            return true;
+        default:
+            break;
+        }
+        header->result = result;
+        header->replySequence = header->sequence;
+        header->replySemaphore.post();
+    }
+}
+
+
+bool SharedMemorySimpleControllerIOImpl::initializeController(SimpleController* controller)
+{
+    std::memset(segment.stateTypes(true), 0, body->numLinks());
+    std::memset(segment.stateTypes(false), 0, body->numLinks());
+    ++segment.header->stateTypeRevision;
+
+    controller->setIO(self);
+    bool result = controller->initialize(self);
+
+    // try the old API
+    if(!result){
+        self->setJointOutput(SimpleControllerIO::JOINT_TORQUE);
+        self->setJointInput(SimpleControllerIO::JOINT_DISPLACEMENT);
+        result = controller->initialize();
+    }
+
+    deviceStateChangeFlag.reset();
+
+    return result;
+}
+
+
+void SharedMemorySimpleControllerIOImpl::readInputs(bool doReadAll)
+{
+    const char* stateTypes = segment.stateTypes(true);
+    const int n = body->numLinks();
+    for(int i=0; i < n; ++i){
+        const int types = doReadAll ? ALL_STATE_TYPES : stateTypes[i];
+        if(types){
+            readLinkState(segment.linkState(true, i), body->link(i), types);
+        }
+    }
+
+    const DeviceList<>& devices = body->devices();
+    char* flags = segment.deviceFlags(true);
+    for(size_t i=0; i < devices.size(); ++i){
+        if(flags[i]){
+            Device* device = devices[i];
+            device->readState(segment.deviceState(true, deviceStateOffsets[i]));
+            deviceStateConnections.block(i);
+            device->notifyStateChange();
+            deviceStateConnections.unblock(i);
+            flags[i] = 0;
+        }
+    }
+}
+
+
+void SharedMemorySimpleControllerIOImpl::writeOutputs()
+{
+    const char* stateTypes = segment.stateTypes(false);
+    const int n = body->numLinks();
+    for(int i=0; i < n; ++i){
+        if(stateTypes[i]){
+            writeLinkState(segment.linkState(false, i), body->link(i), stateTypes[i]);
+        }
+    }
+
+    if(deviceStateChangeFlag.any()){
+        const DeviceList<>& devices = body->devices();
+        char* flags = segment.deviceFlags(false);
+        boost::dynamic_bitset<>::size_type i = deviceStateChangeFlag.find_first();
+        while(i != deviceStateChangeFlag.npos){
+            devices[i]->writeState(segment.deviceState(false, deviceStateOffsets[i]));
+            flags[i] = 1;
+            i = deviceStateChangeFlag.find_next(i);
+        }
+        deviceStateChangeFlag.reset();
+    }
+}
+
+
+std::string SharedMemorySimpleControllerIO::optionString() const
+{
+    return impl->segment.header ? string(impl->segment.header->optionString) : string();
+}
+
+
+std::vector<std::string> SharedMemorySimpleControllerIO::options() const
+{
+    vector<string> options;
+    const string s = trim_copy(optionString());
+    if(!s.empty()){
+        split(options, s, is_space(), token_compress_on);
+    }
+    return options;
+}
+
+
+std::ostream& SharedMemorySimpleControllerIO::os() const
+{
+    return std::cout;
+}
+
+
+Body* SharedMemorySimpleControllerIO::body()
+{
+    return impl->body;
+}
+
+
+double SharedMemorySimpleControllerIO::timeStep() const
+{
+    return impl->segment.header ? impl->segment.header->timeStep : 0.0;
+}
+
+
+void SharedMemorySimpleControllerIOImpl::setStateTypes(bool isInput, Link* link, int stateTypes)
+{
+    char* types = segment.stateTypes(isInput);
+    if(!link){
+        if(!stateTypes){
+            std::memset(types, 0, body->numLinks());
+        } else {
+            const int nj = body->numJoints();
+            for(int i=0; i < nj; ++i){
+                int linkIndex = body->joint(i)->index();
+                if(linkIndex >= 0){
+                    types[linkIndex] |= stateTypes;
+                }
+            }
+        }
+    } else {
+        types[link->index()] |= stateTypes;
+    }
+    ++segment.header->stateTypeRevision;
+}
+
+
+void SharedMemorySimpleControllerIO::setJointInput(int stateTypes)
+{
+    impl->setStateTypes(true, 0, stateTypes);
+}
+
+
+void SharedMemorySimpleControllerIO::setJointOutput(int stateTypes)
+{
+    impl->setStateTypes(false, 0, stateTypes);
+}
+
+
+void SharedMemorySimpleControllerIO::setLinkInput(Link* link, int stateTypes)
+{
+    impl->setStateTypes(true, link, stateTypes);
+}
+
+
+void SharedMemorySimpleControllerIO::setLinkOutput(Link* link, int stateTypes)
+{
+    impl->setStateTypes(false, link, stateTypes);
+}
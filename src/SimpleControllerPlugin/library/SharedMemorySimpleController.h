@@ -0,0 +1,113 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_SIMPLE_CONTROLLER_SHARED_MEMORY_SIMPLE_CONTROLLER_H
+#define CNOID_SIMPLE_CONTROLLER_SHARED_MEMORY_SIMPLE_CONTROLLER_H
+
+#include "SimpleController.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SharedMemorySimpleControllerImpl;
+class SharedMemorySimpleControllerIOImpl;
+
+/**
+   This controller relays the simulation to a controller running in another process.
+   The state of the links and the devices is exchanged through a shared memory segment
+   created by this controller, and each request is handed over by the process-shared semaphores
+   in the segment. The other process uses SharedMemorySimpleControllerIO to run the controller.
+
+   The state types of the inputs and the outputs which are set by the remote controller are applied
+   to the SimpleControllerIO object given to initialize(), so the inputs and the outputs are copied
+   from and to the simulation body in the same way as an ordinary controller.
+*/
+class CNOID_EXPORT SharedMemorySimpleController : public SimpleController
+{
+public:
+    SharedMemorySimpleController(const std::string& sharedMemoryName);
+    virtual ~SharedMemorySimpleController();
+
+    const std::string& sharedMemoryName() const;
+
+    /**
+       The time in seconds to wait for the reply of the remote controller to a control step.
+       Zero, which is the default, means waiting until the reply comes or the remote process exits.
+    */
+    void setTimeout(double timeout);
+    double timeout() const;
+
+    enum TimeoutPolicy {
+        //! The outputs of the previous step are kept until the remote controller replies
+        HOLD_OUTPUT,
+        //! control() returns false to stop the simulation
+        STOP_SIMULATION
+    };
+    void setTimeoutPolicy(TimeoutPolicy policy);
+    TimeoutPolicy timeoutPolicy() const;
+
+    //! The time in seconds to wait for the remote process connecting to the shared memory. The default is 10.
+    void setConnectionTimeout(double timeout);
+
+    //! The number of the control steps in which the reply did not come in time
+    int numTimeouts() const;
+
+    virtual bool initialize(SimpleControllerIO* io);
+    virtual bool start();
+    virtual bool control();
+
+private:
+    SharedMemorySimpleControllerImpl* impl;
+};
+
+
+/**
+   This class is used in the remote process to run a controller with the shared memory
+   created by SharedMemorySimpleController. The body given to connect() must be the same
+   model as the simulation body.
+*/
+class CNOID_EXPORT SharedMemorySimpleControllerIO : public SimpleControllerIO
+{
+public:
+    SharedMemorySimpleControllerIO();
+    virtual ~SharedMemorySimpleControllerIO();
+
+    /**
+       @param timeout The time in seconds to wait for the shared memory created by the simulator.
+       A negative value means waiting forever.
+    */
+    bool connect(const std::string& sharedMemoryName, Body* body, double timeout = -1.0);
+    void disconnect();
+    bool isConnected() const;
+
+    /**
+       Processes the requests of the simulator with the controller until the simulator stops
+       the controller or exits.
+       @return false if the simulator exits without stopping the controller
+    */
+    bool run(SimpleController* controller);
+
+    const std::string& errorMessage() const;
+
+    // virtual functions of SimpleControllerIO
+    virtual std::string optionString() const;
+    virtual std::vector<std::string> options() const;
+    virtual std::ostream& os() const;
+    virtual Body* body();
+    virtual double timeStep() const;
+    virtual void setJointInput(int stateTypes);
+    virtual void setJointOutput(int stateTypes);
+    virtual void setLinkInput(Link* link, int stateTypes);
+    virtual void setLinkOutput(Link* link, int stateTypes);
+
+private:
+    SharedMemorySimpleControllerIOImpl* impl;
+
+    SharedMemorySimpleControllerIO(const SharedMemorySimpleControllerIO& org);
+    SharedMemorySimpleControllerIO& operator=(const SharedMemorySimpleControllerIO& rhs);
+};
+
+}
+
+#endif
@@ -0,0 +1,127 @@
+/**
+   This program runs a simple controller module in its own process for SimpleControllerItem
+   whose shared memory name is specified. The body file must be the same model as the body
+   controlled by the item.
+*/
+
+#include "SharedMemorySimpleController.h"
+#include <cnoid/BodyLoader>
+#include <boost/program_options.hpp>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+using namespace std;
+using namespace boost;
+using namespace cnoid;
+
+namespace {
+
+#ifdef _WIN32
+typedef HINSTANCE DllHandle;
+inline DllHandle loadDll(const char* filename) { return LoadLibrary(filename); }
+inline void* resolveDllSymbol(DllHandle handle, const char* symbol) { return GetProcAddress(handle, symbol); }
+inline void unloadDll(DllHandle handle) { FreeLibrary(handle); }
+#else
+typedef void* DllHandle;
+inline DllHandle loadDll(const char* filename) { return dlopen(filename, RTLD_LAZY); }
+inline void* resolveDllSymbol(DllHandle handle, const char* symbol) { return dlsym(handle, symbol); }
+inline void unloadDll(DllHandle handle) { dlclose(handle); }
+#endif
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    string sharedMemoryName;
+    string bodyFile;
+    string controllerModule;
+    double connectionTimeout;
+    bool doRepeat;
+
+    program_options::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "show help message")
+        ("shared-memory,s", program_options::value<string>(&sharedMemoryName),
+         "the shared memory name specified in the controller item")
+        ("body", program_options::value<string>(&bodyFile), "the body file of the controlled body")
+        ("controller", program_options::value<string>(&controllerModule), "the controller module")
+        ("timeout", program_options::value<double>(&connectionTimeout)->default_value(-1.0),
+         "the time in seconds to wait for the simulator (a negative value means waiting forever)")
+        ("repeat,r", program_options::bool_switch(&doRepeat),
+         "wait for the next simulation after the simulation is stopped");
+
+    program_options::positional_options_description positionalOptions;
+    positionalOptions.add("body", 1);
+    positionalOptions.add("controller", 1);
+
+    program_options::variables_map variables;
+    try {
+        program_options::store(
+            program_options::command_line_parser(argc, argv).
+            options(desc).positional(positionalOptions).run(), variables);
+        program_options::notify(variables);
+    } catch (std::exception& ex) {
+        cerr << "Command line option error! : " << ex.what() << endl;
+        return 1;
+    }
+    if(variables.count("help") || sharedMemoryName.empty() || bodyFile.empty() || controllerModule.empty()){
+        cout << "Usage: choreonoid-simple-controller [options] -s shared-memory body-file controller-module\n"
+             << desc << endl;
+        return variables.count("help") ? 0 : 1;
+    }
+
+    BodyLoader bodyLoader;
+    BodyPtr body = bodyLoader.load(bodyFile);
+    if(!body){
+        cerr << "The body file \"" << bodyFile << "\" cannot be loaded." << endl;
+        return 1;
+    }
+
+    DllHandle module = loadDll(controllerModule.c_str());
+    if(!module){
+        cerr << "The controller module \"" << controllerModule << "\" cannot be loaded." << endl;
+        return 1;
+    }
+    SimpleController::Factory factory =
+        (SimpleController::Factory)resolveDllSymbol(module, "createSimpleController");
+    if(!factory){
+        cerr << "The factory function \"createSimpleController()\" is not found in the controller module." << endl;
+        unloadDll(module);
+        return 1;
+    }
+
+    int exitCode = 0;
+    SharedMemorySimpleControllerIO io;
+
+    do {
+        if(!io.connect(sharedMemoryName, body, connectionTimeout)){
+            cerr << io.errorMessage() << endl;
+            exitCode = 1;
+            break;
+        }
+        SimpleController* controller = factory();
+        if(!controller){
+            cerr << "The factory failed to create a controller instance." << endl;
+            exitCode = 1;
+            break;
+        }
+        if(!io.run(controller)){
+            cerr << io.errorMessage() << endl;
+            exitCode = 1;
+        }
+        delete controller;
+        io.disconnect();
+
+    } while(doRepeat && exitCode == 0);
+
+    io.disconnect();
+    unloadDll(module);
+
+    return exitCode;
+}
@@ -72,6 +72,12 @@ bool AbstractSeq::setOffsetTimeFrame(int offset)
 }
 
 
+size_t AbstractSeq::memoryUsage() const
+{
+    return 0;
+}
+
+
 bool AbstractSeq::readSeq(const Mapping& archive)
 {
     try {
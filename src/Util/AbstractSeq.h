@@ -7,6 +7,7 @@
 #define CNOID_UTIL_ABSTRACT_SEQ_H
 
 #include <string>
+#include <cstddef>
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 #include "exportdecl.h"
@@ -82,6 +83,12 @@ public:
         return getNumFrames() / getFrameRate();
     }
 
+    /**
+       The size of the memory occupied by the sequence data in bytes.
+       The default implementation returns zero.
+    */
+    virtual std::size_t memoryUsage() const;
+
     inline const std::string& seqContentName() {
         return content;
     }
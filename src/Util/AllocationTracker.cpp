@@ -0,0 +1,141 @@
+/**
+   @file
+*/
+
+#include "AllocationTracker.h"
+
+#ifdef CNOID_ENABLE_ALLOCATION_TRACKING
+#include <new>
+#include <cstdlib>
+#endif
+
+#ifdef _MSC_VER
+#define CNOID_THREAD_LOCAL __declspec(thread)
+#else
+#define CNOID_THREAD_LOCAL __thread
+#endif
+
+using namespace cnoid;
+
+namespace {
+
+/*
+  The counters must not be allocated on the heap because they are accessed in operator new,
+  so the thread local storage of the compiler is used instead of boost::thread_specific_ptr.
+*/
+CNOID_THREAD_LOCAL bool isTrackingEnabled = false;
+CNOID_THREAD_LOCAL long long allocationCount = 0;
+CNOID_THREAD_LOCAL long long allocatedBytes = 0;
+
+}
+
+#ifdef CNOID_ENABLE_ALLOCATION_TRACKING
+
+#ifdef __GNUC__
+#define CNOID_OPERATOR_EXPORT __attribute__ ((visibility("default")))
+#else
+#define CNOID_OPERATOR_EXPORT
+#endif
+
+#if __cplusplus >= 201103L
+#define CNOID_THROW_BAD_ALLOC
+#else
+#define CNOID_THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+namespace {
+
+inline void* allocate(std::size_t size)
+{
+    if(isTrackingEnabled){
+        ++allocationCount;
+        allocatedBytes += size;
+    }
+    return std::malloc(size ? size : 1);
+}
+
+}
+
+CNOID_OPERATOR_EXPORT void* operator new(std::size_t size) CNOID_THROW_BAD_ALLOC
+{
+    void* p = allocate(size);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+CNOID_OPERATOR_EXPORT void* operator new[](std::size_t size) CNOID_THROW_BAD_ALLOC
+{
+    void* p = allocate(size);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+CNOID_OPERATOR_EXPORT void* operator new(std::size_t size, const std::nothrow_t&) throw()
+{
+    return allocate(size);
+}
+
+CNOID_OPERATOR_EXPORT void* operator new[](std::size_t size, const std::nothrow_t&) throw()
+{
+    return allocate(size);
+}
+
+CNOID_OPERATOR_EXPORT void operator delete(void* p) throw()
+{
+    std::free(p);
+}
+
+CNOID_OPERATOR_EXPORT void operator delete[](void* p) throw()
+{
+    std::free(p);
+}
+
+CNOID_OPERATOR_EXPORT void operator delete(void* p, const std::nothrow_t&) throw()
+{
+    std::free(p);
+}
+
+CNOID_OPERATOR_EXPORT void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+    std::free(p);
+}
+
+#endif
+
+
+bool AllocationTracker::isAvailable()
+{
+#ifdef CNOID_ENABLE_ALLOCATION_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+void AllocationTracker::setEnabledInCurrentThread(bool on)
+{
+    isTrackingEnabled = on;
+}
+
+
+bool AllocationTracker::isEnabledInCurrentThread()
+{
+    return isTrackingEnabled;
+}
+
+
+long long AllocationTracker::numAllocations()
+{
+    return allocationCount;
+}
+
+
+long long AllocationTracker::numAllocatedBytes()
+{
+    return allocatedBytes;
+}
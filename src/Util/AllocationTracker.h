@@ -0,0 +1,39 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_ALLOCATION_TRACKER_H
+#define CNOID_UTIL_ALLOCATION_TRACKER_H
+
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   This class counts the heap allocations by the global operator new in the threads for which
+   the tracking is enabled. The counts are recorded in the scopes of Profiler, so the allocations
+   of the simulation stages are shown in ProfilerView.
+
+   The global operators new and delete are replaced only when the library is built with
+   the ENABLE_ALLOCATION_TRACKING option, and isAvailable() returns false otherwise.
+   The replacement takes effect for the whole process on the platforms where the operators
+   of a shared library interpose those of the standard library, such as Linux.
+*/
+class CNOID_EXPORT AllocationTracker
+{
+public:
+    static bool isAvailable();
+
+    static void setEnabledInCurrentThread(bool on);
+    static bool isEnabledInCurrentThread();
+
+    //! The number of the allocations in the calling thread while the tracking has been enabled
+    static long long numAllocations();
+
+    //! The total size in bytes of the allocations in the calling thread while the tracking has been enabled
+    static long long numAllocatedBytes();
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "CollisionDetector.h"
 #include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
 #include <map>
 
 using namespace std;
@@ -52,6 +53,20 @@ public:
     virtual void detectCollisions(boost::function<void(const CollisionPair&)> callback) { }
 };
 
+void appendCollisionPair(const CollisionPair& collisionPair, CollisionPairArray& collisionPairs, int& numPairs)
+{
+    if(numPairs < (int)collisionPairs.size()){
+        CollisionPair& pair = collisionPairs[numPairs];
+        pair.geometryId[0] = collisionPair.geometryId[0];
+        pair.geometryId[1] = collisionPair.geometryId[1];
+        pair.collisions.assign(collisionPair.collisions.begin(), collisionPair.collisions.end());
+    } else {
+        collisionPairs.push_back(collisionPair);
+    }
+    ++numPairs;
+}
+
+
 CollisionDetectorPtr factory()
 {
     return boost::make_shared<NullCollisionDetector>();
@@ -118,3 +133,61 @@ CollisionDetector::~CollisionDetector()
 {
 
 }
+
+
+bool CollisionDetector::removeGeometry(int /* geometryId */)
+{
+    return false;
+}
+
+
+bool CollisionDetector::unsetNonInterfarenceGeometryPair(int /* geometryId1 */, int /* geometryId2 */)
+{
+    return false;
+}
+
+
+void CollisionDetector::updatePositions(int begin, int end, const PositionArray& positions)
+{
+    for(int i=begin; i < end; ++i){
+        updatePosition(i, positions[i - begin]);
+    }
+}
+
+
+void CollisionDetector::detectCollisions(CollisionPairArray& out_collisionPairs)
+{
+    int numPairs = 0;
+    detectCollisions(boost::bind(appendCollisionPair, _1, boost::ref(out_collisionPairs), boost::ref(numPairs)));
+    out_collisionPairs.resize(numPairs);
+}
+
+
+void CollisionDetector::detectCollisionsOfMovedGeometries
+(const std::vector<int>& /* movedGeometryIds */, CollisionPairArray& io_collisionPairs)
+{
+    detectCollisions(io_collisionPairs);
+}
+
+
+bool CollisionDetector::castRays
+(const std::vector<Vector3>& origins, const std::vector<Vector3>& /* directions */,
+ double maxDistance, std::vector<double>& out_distances, std::vector<int>& out_geometryIds)
+{
+    out_distances.assign(origins.size(), maxDistance);
+    out_geometryIds.assign(origins.size(), -1);
+    return false;
+}
+
+
+bool CollisionDetector::computeDistances(double /* maxDistance */, DistancePairArray& out_distancePairs)
+{
+    out_distancePairs.clear();
+    return false;
+}
+
+
+bool CollisionDetector::setNumThreads(int /* n */)
+{
+    return false;
+}
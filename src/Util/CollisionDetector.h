@@ -19,6 +19,17 @@ struct CollisionPair {
     CollisionArray collisions;
 };
 typedef boost::shared_ptr<CollisionPair> CollisionPairPtr;
+typedef std::vector<CollisionPair> CollisionPairArray;
+
+typedef std::vector<Position, Eigen::aligned_allocator<Position> > PositionArray;
+
+struct DistancePair {
+    int geometryId[2];
+    double distance;
+    //! The closest points of the geometries in the world coordinate
+    Vector3 point[2];
+};
+typedef std::vector<DistancePair> DistancePairArray;
 
 class CollisionDetector;
 typedef boost::shared_ptr<CollisionDetector> CollisionDetectorPtr;
@@ -53,18 +64,92 @@ public:
     virtual int numGeometries() const = 0;
     virtual int addGeometry(SgNodePtr geometry) = 0;
     virtual void setGeometryStatic(int geometryId, bool isStatic = true) = 0;
+
+    /**
+       Remove a geometry without changing the IDs of the other geometries.
+       The ID of the removed geometry is not reused. makeReady() must be called after the removal.
+       \return false if the detector does not support the removal. Use clearGeometries() in the case.
+       \note The default implementation only returns false.
+    */
+    virtual bool removeGeometry(int geometryId);
+
     virtual void setNonInterfarenceGeometyrPair(int geometryId1, int geometryId2) = 0;
+
+    /**
+       Make the pair which has been set by setNonInterfarenceGeometyrPair() a target again.
+       \return false if the detector does not support this function.
+       \note The default implementation only returns false.
+    */
+    virtual bool unsetNonInterfarenceGeometryPair(int geometryId1, int geometryId2);
+
+    /**
+       This function must be called after the geometries or the pairs are changed.
+       A detector may only update the part affected by the changes after the first call.
+    */
     virtual bool makeReady() = 0;
     virtual void updatePosition(int geometryId, const Position& position) = 0;
 
-    // Is this faster than the above function?
-    //virtual void updatePositions(int begin, int end, const std::vector<Position>& positions) = 0;
+    /**
+       Update the positions of the geometries whose IDs are in [begin, end) at once.
+       \param positions The position of geometry (begin + i) is positions[i].
+       \note The default implementation calls updatePosition() for each geometry.
+    */
+    virtual void updatePositions(int begin, int end, const PositionArray& positions);
 
     virtual void detectCollisions(boost::function<void(const CollisionPair&)> callback) = 0;
 
-    // or
-    // virtual void detectCollisions(std::vector<CollisionPair>& out_collisionPairs) = 0;
+    /**
+       The same as the above function except that the colliding pairs are stored in the array
+       in the order in which the callback is called. The elements of the given array are
+       reused, so passing the same array every time avoids reallocating the collision arrays.
+       \note The default implementation copies the pairs given to the callback.
+    */
+    virtual void detectCollisions(CollisionPairArray& out_collisionPairs);
+
+    /**
+       Detect the collisions again only for the pairs including the geometries which have been moved
+       since the previous detection. The other pairs in the given array are kept as they are.
+       \param movedGeometryIds The IDs of all the geometries of which the positions have been updated
+       after the previous detection. The result is not correct if any of them is missing.
+       \param io_collisionPairs The result of the previous detection, which is updated with the new result.
+       The pairs are kept in the same order as those given by detectCollisions().
+       \note The default implementation detects the collisions of all the pairs again.
+    */
+    virtual void detectCollisionsOfMovedGeometries(
+        const std::vector<int>& movedGeometryIds, CollisionPairArray& io_collisionPairs);
+
+    /**
+       Find the nearest geometry hit by each ray with the current positions of the geometries.
+       \param origins The origins of the rays in the world coordinate
+       \param directions The unit direction vectors of the rays in the world coordinate
+       \param maxDistance The geometries farther than this distance are ignored.
+       \param out_distances The distance to the hit point of each ray. The value is maxDistance if the ray hits nothing.
+       \param out_geometryIds The ID of the geometry hit by each ray. The value is -1 if the ray hits nothing.
+       \return false if the detector does not support the ray casting.
+       \note The default implementation only returns false with no hits. The function may be called
+       from multiple threads at the same time as long as the positions are not updated.
+    */
+    virtual bool castRays(const std::vector<Vector3>& origins, const std::vector<Vector3>& directions,
+                          double maxDistance, std::vector<double>& out_distances, std::vector<int>& out_geometryIds);
 
+    /**
+       Compute the minimum distances and the closest points of the geometry pairs which are the
+       targets of detectCollisions(), i.e. the static pairs and the non interfarence pairs are excluded.
+       \param maxDistance Only the pairs nearer than this distance are stored. The computation of a pair
+       stops as soon as the pair is found to be farther than this, so a small value makes the query fast.
+       \param out_distancePairs The pairs are stored in the order of the geometry IDs.
+       The distance of the intersecting pair is zero.
+       \return false if the detector does not support the distance computation.
+       \note The default implementation only returns false with no pairs.
+    */
+    virtual bool computeDistances(double maxDistance, DistancePairArray& out_distancePairs);
+
+    /**
+       Sets the maximum number of the threads used in detecting the collisions.
+       \return false if the detector does not use multiple threads.
+       \note The default implementation only returns false.
+    */
+    virtual bool setNumThreads(int n);
 };
 
 }
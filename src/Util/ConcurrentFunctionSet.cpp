@@ -0,0 +1,244 @@
+/**
+   @file
+*/
+
+#include "ConcurrentFunctionSet.h"
+#include "TaskScheduler.h"
+#include <map>
+#include <algorithm>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+struct FunctionInfo
+{
+    int id;
+    ConcurrentFunctionSet::Function function;
+    bool hasDependency;
+    FunctionDependency dependency;
+};
+
+}
+
+namespace cnoid {
+
+class ConcurrentFunctionSetImpl
+{
+public:
+    TaskScheduler* scheduler;
+    vector<FunctionInfo> functions;
+    vector< vector<int> > stages;
+    bool isScheduleDirty;
+    bool hasConcurrentStages;
+
+    ConcurrentFunctionSetImpl(TaskScheduler* scheduler);
+    void add(int id, const ConcurrentFunctionSet::Function& func, const FunctionDependency* dependency);
+    void updateSchedule();
+    void call();
+};
+
+}
+
+
+ConcurrentFunctionSet::ConcurrentFunctionSet(TaskScheduler* scheduler)
+{
+    impl = new ConcurrentFunctionSetImpl(scheduler);
+}
+
+
+ConcurrentFunctionSetImpl::ConcurrentFunctionSetImpl(TaskScheduler* scheduler)
+    : scheduler(scheduler)
+{
+    isScheduleDirty = false;
+    hasConcurrentStages = false;
+}
+
+
+ConcurrentFunctionSet::~ConcurrentFunctionSet()
+{
+    delete impl;
+}
+
+
+void ConcurrentFunctionSet::add(int id, const Function& func)
+{
+    impl->add(id, func, 0);
+}
+
+
+void ConcurrentFunctionSet::add(int id, const Function& func, const FunctionDependency& dependency)
+{
+    impl->add(id, func, &dependency);
+}
+
+
+void ConcurrentFunctionSetImpl::add(int id, const ConcurrentFunctionSet::Function& func, const FunctionDependency* dependency)
+{
+    functions.push_back(FunctionInfo());
+    FunctionInfo& info = functions.back();
+    info.id = id;
+    info.function = func;
+    info.hasDependency = (dependency != 0);
+    if(dependency){
+        info.dependency = *dependency;
+    }
+    isScheduleDirty = true;
+}
+
+
+bool ConcurrentFunctionSet::remove(int id)
+{
+    vector<FunctionInfo>& functions = impl->functions;
+    for(vector<FunctionInfo>::iterator p = functions.begin(); p != functions.end(); ++p){
+        if(p->id == id){
+            functions.erase(p);
+            impl->isScheduleDirty = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void ConcurrentFunctionSet::clear()
+{
+    impl->functions.clear();
+    impl->stages.clear();
+    impl->isScheduleDirty = false;
+    impl->hasConcurrentStages = false;
+}
+
+
+bool ConcurrentFunctionSet::empty() const
+{
+    return impl->functions.empty();
+}
+
+
+int ConcurrentFunctionSet::numFunctions() const
+{
+    return impl->functions.size();
+}
+
+
+int ConcurrentFunctionSet::numStages() const
+{
+    if(impl->isScheduleDirty){
+        impl->updateSchedule();
+    }
+    return impl->stages.size();
+}
+
+
+/**
+   Each function is put into the stage next to the last stage of the functions it depends on.
+   The functions in the same stage do not depend on each other.
+*/
+void ConcurrentFunctionSetImpl::updateSchedule()
+{
+    const int n = functions.size();
+    vector<int> stageOf(n);
+    map<int, int> idToIndex;
+    map<string, int> lastWriters;
+    map<string, vector<int> > readersSinceLastWrite;
+    int barrierStage = -1;
+    int maxStage = -1;
+
+    for(int i=0; i < n; ++i){
+        FunctionInfo& info = functions[i];
+        int stage = barrierStage + 1;
+
+        if(!info.hasDependency){
+            stage = maxStage + 1;
+            barrierStage = stage;
+
+        } else {
+            const FunctionDependency& dependency = info.dependency;
+            for(size_t j=0; j < dependency.predecessors.size(); ++j){
+                map<int, int>::iterator p = idToIndex.find(dependency.predecessors[j]);
+                if(p != idToIndex.end()){
+                    stage = std::max(stage, stageOf[p->second] + 1);
+                }
+            }
+            for(size_t j=0; j < dependency.readResources.size(); ++j){
+                map<string, int>::iterator p = lastWriters.find(dependency.readResources[j]);
+                if(p != lastWriters.end()){
+                    stage = std::max(stage, stageOf[p->second] + 1);
+                }
+            }
+            for(size_t j=0; j < dependency.writeResources.size(); ++j){
+                const string& resource = dependency.writeResources[j];
+                map<string, int>::iterator p = lastWriters.find(resource);
+                if(p != lastWriters.end()){
+                    stage = std::max(stage, stageOf[p->second] + 1);
+                }
+                vector<int>& readers = readersSinceLastWrite[resource];
+                for(size_t k=0; k < readers.size(); ++k){
+                    stage = std::max(stage, stageOf[readers[k]] + 1);
+                }
+            }
+            for(size_t j=0; j < dependency.readResources.size(); ++j){
+                readersSinceLastWrite[dependency.readResources[j]].push_back(i);
+            }
+            for(size_t j=0; j < dependency.writeResources.size(); ++j){
+                const string& resource = dependency.writeResources[j];
+                lastWriters[resource] = i;
+                readersSinceLastWrite[resource].clear();
+            }
+        }
+
+        stageOf[i] = stage;
+        maxStage = std::max(maxStage, stage);
+        idToIndex[info.id] = i;
+    }
+
+    stages.clear();
+    stages.resize(maxStage + 1);
+    for(int i=0; i < n; ++i){
+        stages[stageOf[i]].push_back(i);
+    }
+    hasConcurrentStages = ((int)stages.size() < n);
+
+    isScheduleDirty = false;
+}
+
+
+void ConcurrentFunctionSet::call()
+{
+    impl->call();
+}
+
+
+void ConcurrentFunctionSetImpl::call()
+{
+    if(isScheduleDirty){
+        updateSchedule();
+    }
+
+    if(!hasConcurrentStages){
+        const size_t n = functions.size();
+        for(size_t i=0; i < n; ++i){
+            functions[i].function();
+        }
+        return;
+    }
+
+    if(!scheduler){
+        scheduler = TaskScheduler::instance();
+    }
+    for(size_t i=0; i < stages.size(); ++i){
+        const vector<int>& stage = stages[i];
+        if(stage.size() == 1){
+            functions[stage.front()].function();
+        } else {
+            TaskGroup group(scheduler);
+            for(size_t j=1; j < stage.size(); ++j){
+                group.run(functions[stage[j]].function);
+            }
+            functions[stage.front()].function();
+            group.wait();
+        }
+    }
+}
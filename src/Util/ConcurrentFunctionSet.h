@@ -0,0 +1,90 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_CONCURRENT_FUNCTION_SET_H
+#define CNOID_UTIL_CONCURRENT_FUNCTION_SET_H
+
+#include <boost/function.hpp>
+#include <vector>
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class TaskScheduler;
+class ConcurrentFunctionSetImpl;
+
+/**
+   The resources accessed by a function and the functions which must be finished before it.
+   A resource is identified by an arbitrary name such as "Robot1/joints" or "camera-images".
+*/
+class FunctionDependency
+{
+public:
+    FunctionDependency& reads(const std::string& resource) {
+        readResources.push_back(resource);
+        return *this;
+    }
+    FunctionDependency& writes(const std::string& resource) {
+        writeResources.push_back(resource);
+        return *this;
+    }
+    //! The function is executed after the function of the given id which has been added before it
+    FunctionDependency& after(int functionId) {
+        predecessors.push_back(functionId);
+        return *this;
+    }
+
+    std::vector<std::string> readResources;
+    std::vector<std::string> writeResources;
+    std::vector<int> predecessors;
+};
+
+
+/**
+   This class calls a set of functions in the order of the addition, except that the functions
+   added with their dependencies may be executed concurrently by the task scheduler.
+
+   A function added without the dependency is a barrier: it is executed after all the functions
+   added before it have been finished, and the functions added after it are executed after it.
+   A function added with the dependency is executed after the previous functions which write
+   the resources it reads or writes, the previous functions which read the resources it writes,
+   and the functions specified by FunctionDependency::after(). The other functions can be
+   executed at the same time as it, so it must be thread-safe with respect to them.
+*/
+class CNOID_EXPORT ConcurrentFunctionSet
+{
+public:
+    typedef boost::function<void()> Function;
+
+    //! The process-wide instance of the task scheduler is used if the scheduler is null
+    ConcurrentFunctionSet(TaskScheduler* scheduler = 0);
+    ~ConcurrentFunctionSet();
+
+    void add(int id, const Function& func);
+    void add(int id, const Function& func, const FunctionDependency& dependency);
+    bool remove(int id);
+    void clear();
+
+    bool empty() const;
+    int numFunctions() const;
+
+    /**
+       The number of the groups of the functions which are executed one after another.
+       This is equal to the number of the functions when no function is executed concurrently.
+    */
+    int numStages() const;
+
+    void call();
+
+private:
+    ConcurrentFunctionSetImpl* impl;
+
+    ConcurrentFunctionSet(const ConcurrentFunctionSet& org);
+    ConcurrentFunctionSet& operator=(const ConcurrentFunctionSet& rhs);
+};
+
+}
+
+#endif
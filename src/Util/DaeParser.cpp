@@ -37,6 +37,7 @@
 #include "DaeParser.h"
 #include "DaeNode.h"
 #include "FileUtil.h"
+#include "StringToNumber.h"
 
 using namespace std;
 using boost::lexical_cast;
@@ -239,7 +240,8 @@ protected:
     void split (string& value, double* point, int max, double init);
     void rotate(string& value, DaeTransform& transform);
     void array (string& value, DaeVectorXArrayPtr array);
-    void index (string& value, DaeVectorXArrayPtr index, int offset, int offsetMaximum);
+    void array (const char* text, DaeVectorXArrayPtr array);
+    void readIndexes(const char* text);
     void matrix(string& value, Matrix4d &matrix);
 
     void file  (const string& value);
@@ -1444,24 +1446,41 @@ DaeNodePtr DaeParserImpl::readSource(DaeNodePtr node)
 
 void DaeParserImpl::array(string& value, DaeVectorXArrayPtr array)
 {
-    trim(value);
+    this->array(value.c_str(), array);
+}
+
+
+static inline const char* skipSpaces(const char* p)
+{
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p;
+}
+
+
+/**
+   The numbers are converted directly from the text of the element
+   without copying the text or splitting it into the strings of the tokens.
+*/
+void DaeParserImpl::array(const char* text, DaeVectorXArrayPtr array)
+{
     array->clear();
-    for (split_iterator<string::iterator> iter  = make_split_iterator(value, token_finder(is_space(), token_compress_on));
-         iter != split_iterator<string::iterator>(); 
-         iter++)
-        {
-            if ((boost::copy_range<std::string>(*iter)).size() <= 0) {     
-                throwException(line(), (format("[%1%]invalid value:%2%") % line() % value).str());
-            }
-            try {
-                // It holds the number of the number of specified.
-                array->push_back(lexical_cast<double>(*iter));
-            } catch (...) {
-                // NaN is assigned, numerical error occurs.
-                array->push_back(0.0); 
+    const char* p = skipSpaces(text);
+    while (*p) {
+        char* tail;
+        double value = stringToDouble(p, &tail);
+        if (tail == p || (*tail && !isspace((unsigned char)*tail))) {
+            // NaN is assigned, numerical error occurs.
+            value = 0.0;
+            tail = const_cast<char*>(p);
+            while (*tail && !isspace((unsigned char)*tail)) {
+                tail++;
             }
         }
-
+        array->push_back(value);
+        p = skipSpaces(tail);
+    }
 }
 
 
@@ -1475,12 +1494,11 @@ DaeNodePtr DaeParserImpl::readFloatArray(DaeNodePtr node)
     int icount = (reader->getAttributeValue("count") ? lexical_cast<int>(reader->getAttributeValue("count")) : -1);
     DaeVectorXArrayPtr source = DaeVectorXArrayPtr(new DaeVectorXArray);
     if (0 < icount) {
-        source->resize(icount);
+        source->reserve(icount);
     }
 
     reader->read();
-    string value = reader->getNodeData();
-    array(value, source);
+    array(reader->getNodeData(), source);
     pair<DaeVectorMap::iterator, bool> pib = sources.insert(pair<string, DaeVectorXArrayPtr>(refSourceId, source));
     if (!pib.second) {
         throwException(line(), (format("[%1%]duplicate source:%2%") % line() % refSourceId).str());
@@ -2015,8 +2033,7 @@ DaeNodePtr DaeParserImpl::readVcount(DaeNodePtr node)
     DaeGeometryPtr geometry = iterg->second;
        
     reader->read();
-    string value = reader->getNodeData();
-    array(value, refMesh->vcount);
+    array(reader->getNodeData(), refMesh->vcount);
 
     return node;
 }
@@ -2028,7 +2045,7 @@ bool DaeParserImpl::createVcount(DaeVectorXArrayPtr vcount)
         return false; // no vcount
     }
     for (DaeVectorXArray::iterator iter = vcount->begin(); iter != vcount->end(); iter++) {
-        if (3 < lexical_cast<int>(*iter)) {
+        if (3 < static_cast<int>(*iter)) {
             return true;
         }    
     }
@@ -2517,38 +2534,51 @@ DaeNodePtr DaeParserImpl::readLines(DaeNodePtr node)
 }
 
 
-void DaeParserImpl::index(string &value, DaeVectorXArrayPtr index, int offset, int offsetMaximum)
+/**
+   The text of p is scanned once, and each index is added to the arrays of
+   the vertices, normals, colors and texture coordinates whose offset matches its position.
+*/
+void DaeParserImpl::readIndexes(const char* text)
 {
-    if (offset < 0) {
-        return;
+    const int numArrays = 4;
+    DaeVectorXArrayPtr arrays[numArrays] = {
+        refMesh->verticesIndexes, refMesh->normalsIndexes, refMesh->colorsIndexes, refMesh->texcoordsIndexes };
+    const int offsets[numArrays] = { offsetVertex, offsetNormal, offsetColor, offsetTexcoord };
+
+    for (int i = 0; i < numArrays; i++) {
+        if (0 <= offsets[i]) {
+            arrays[i]->clear();
+        }
     }
-    trim(value);
-    index->clear();
-    for (split_iterator<string::iterator> iter  = make_split_iterator(value, token_finder(is_space(), token_compress_on));
-         iter != split_iterator<string::iterator>(); 
-         iter++)
-        {
-            if ((boost::copy_range<std::string>(*iter)).size() <= 0) {     
-                throwException(line(), (format("[%1%]invalid value:%2%") % line() % boost::copy_range<std::string>(*iter)).str());
-            }
-            for (int n = 0; n < offset; n++) {
-                // It will skip the offset of the first
-                iter++;
-                if (iter == split_iterator<string::iterator>()) {
-                    *os << ((format("[%1%]invalid offset(before token):%2%") % line() % offset).str()) << endl;
-                    return;
-                }
+
+    int position = 0;
+    const char* p = skipSpaces(text);
+    while (*p) {
+        char* tail;
+        double value = stringToDouble(p, &tail);
+        if (tail == p || (*tail && !isspace((unsigned char)*tail))) {
+            const char* end = p;
+            while (*end && !isspace((unsigned char)*end)) {
+                end++;
             }
-            index->push_back(lexical_cast<double>(*iter));
-            for (int n = 0; n < (offsetMaximum - offset); n++) {
-                // It will skip the rest of the offset
-                iter++;
-                if (iter == split_iterator<string::iterator>()) {
-                    return; // it finish
-                }
+            throwException(line(), (format("[%1%]invalid value:%2%") % line() % string(p, end)).str());
+        }
+        for (int i = 0; i < numArrays; i++) {
+            if (offsets[i] == position) {
+                arrays[i]->push_back(value);
             }
         }
+        position = (position < offsetMaximum ? position + 1 : 0);
+        p = skipSpaces(tail);
+    }
 
+    if (0 < position) {
+        for (int i = 0; i < numArrays; i++) {
+            if (position <= offsets[i]) {
+                *os << ((format("[%1%]invalid offset(before token):%2%") % line() % offsets[i]).str()) << endl;
+            }
+        }
+    }
 }
 
 
@@ -2573,18 +2603,7 @@ DaeNodePtr DaeParserImpl::readP(DaeNodePtr node)
     }
 
     reader->read();
-    string value = reader->getNodeData();
-
-    index(value, refMesh->verticesIndexes, offsetVertex, offsetMaximum);
-    if (0 <= offsetNormal) {
-        index(value, refMesh->normalsIndexes, offsetNormal, offsetMaximum);
-    }
-    if (0 <= offsetColor) {
-        index(value, refMesh->colorsIndexes, offsetColor, offsetMaximum);
-    }
-    if (0 <= offsetTexcoord) {
-        index(value, refMesh->texcoordsIndexes, offsetTexcoord, offsetMaximum);
-    }
+    readIndexes(reader->getNodeData());
 
     return node; 
 }
@@ -2995,10 +3014,10 @@ void DaeParserImpl::setVertices(DaeGeometryPtr extGeometry, DaeMeshPtr extMesh,
         }
 
         DaeVectorXArrayPtr vertices = extMesh->vertices;
-        //sgMesh->vertices()->resize(extGeometry->vertices->size() / tstride);
+        sgMesh->vertices()->reserve(vertices->size() / tstride);
 
         for (unsigned int i = 0; i < vertices->size(); i++) {
-            value[t++] = lexical_cast<double>(vertices->at(i));
+            value[t++] = (*vertices)[i];
             if (t == tstride) {
                 t = 0;
                 // it sums the coefficients of the coordinates. 
@@ -3028,10 +3047,10 @@ void DaeParserImpl::setNormals(DaeGeometryPtr extGeometry, DaeMeshPtr extMesh, S
         }
 
         DaeVectorXArrayPtr normals = extMesh->normals;
-        //sgMesh->normals()->resize(normals->size() / tstride);
+        sgMesh->normals()->reserve(normals->size() / tstride);
 
         for (unsigned int i = 0; i < normals->size(); i++) {
-            value[t++] = lexical_cast<double>(normals->at(i));       
+            value[t++] = (*normals)[i];
             if (t == tstride) {
                 t = 0;
                 Vector3f result(value[0], value[1], value[2]);
@@ -3061,10 +3080,10 @@ void DaeParserImpl::setTexcoord(DaeGeometryPtr extGeometry, DaeMeshPtr extMesh,
         }
 
         DaeVectorXArrayPtr texcoords = extMesh->texcoords;
-        //sgMesh->texCoord()->resize(texcoords->size() / tstride);
+        sgMesh->texCoords()->reserve(texcoords->size() / tstride);
 
         for (unsigned int i = 0; i < texcoords->size(); i++) {
-            value[t++] = lexical_cast<double>(texcoords->at(i));
+            value[t++] = (*texcoords)[i];
             if (t == tstride) {
                 t = 0;
                 // !!! important !!!
@@ -3096,10 +3115,10 @@ void DaeParserImpl::setColors(DaeGeometryPtr extGeometry, DaeMeshPtr extMesh, Sg
         }
 
         DaeVectorXArrayPtr colors = extMesh->colors;
-        //sgMesh->colors()->resize(colors->size() / tstride);
+        sgMesh->colors()->reserve(colors->size() / tstride);
 
         for (unsigned int i = 0; i < colors->size(); i++) {
-            value[t++] = lexical_cast<double>(colors->at(i));
+            value[t++] = (*colors)[i];
             if (t == tstride) {
                 t = 0;
                 Vector3f result(value[0], value[1], value[2]);
@@ -3119,12 +3138,17 @@ void DaeParserImpl::setVIndexes(DaeGeometryPtr extGeometry, DaeMeshPtr extMesh,
 
     if (extMesh->verticesIndexes) {
         DaeVectorXArrayPtr vIndexes = extMesh->verticesIndexes;
+        if (polygon) {
+            static_cast<SgPolygonMesh*>(sgMesh)->polygonVertices().reserve(vIndexes->size() + extMesh->vcount->size());
+        } else {
+            static_cast<SgMesh*>(sgMesh)->triangleVertices().reserve(vIndexes->size());
+        }
         for (unsigned int i = 0; i < vIndexes->size(); i++) {
             if (t == 0) {
                 vcount = (polygon ? extMesh->vcount->at(v) : 3);
                 value.resize(vcount);
             }
-            value[t++] = lexical_cast<double>(vIndexes->at(i));
+            value[t++] = (*vIndexes)[i];
 
             if (t == vcount) {
                 t = 0; v++; 
@@ -3165,12 +3189,13 @@ void DaeParserImpl::setXIndexes(DaeGeometryPtr ext, DaeMeshPtr extMesh, string i
         }
 
         DaeVectorXArrayPtr indexes = extArray;
+        sgArray.reserve(indexes->size() + (polygon ? extMesh->vcount->size() : 0));
         for (unsigned int i = 0; i < indexes->size(); i++) {
             if (t == 0) {
                 vcount = (polygon ? extMesh->vcount->at(v) : 3);
                 value.resize(vcount);
             }
-            value[t++] = lexical_cast<double>(indexes->at(i));       
+            value[t++] = (*indexes)[i];
             if (t == vcount) {
                 t = 0; v++;
                 for (unsigned int j = 0; j < vcount; j++) {
@@ -6,6 +6,8 @@
 #ifndef CNOID_UTIL_DEQUE_2D_H
 #define CNOID_UTIL_DEQUE_2D_H
 
+#include "FileMappedMemory.h"
+#include "MemoryUsageCounter.h"
 #include <Eigen/StdVector>
 #include <memory>
 #include <iterator>
@@ -291,6 +293,8 @@ public:
         
     Deque2D() {
         buf = 0;
+        isBufFileMapped = false;
+        fileMappingThreshold_ = 0;
         offset = 0;
         rowSize_ = 0;
         colSize_ = 0;
@@ -301,6 +305,8 @@ public:
     Deque2D(int rowSize, int colSize) {
 
         buf = 0;
+        isBufFileMapped = false;
+        fileMappingThreshold_ = 0;
         offset = 0;
         rowSize_ = 0;
         colSize_ = 0;
@@ -318,9 +324,11 @@ public:
         colSize_ = org.colSize_;
         capacity_ = size_ + colSize_;
         buf = 0;
+        isBufFileMapped = false;
+        fileMappingThreshold_ = org.fileMappingThreshold_;
 
         if(capacity_){
-            buf = allocator.allocate(capacity_);
+            buf = allocateBuffer(capacity_, isBufFileMapped);
             offset = 0;
             ElementType* p = buf;
             ElementType* pend = buf + size_;
@@ -369,7 +377,7 @@ public:
                     allocator.destroy(q);
                 }
             }
-            allocator.deallocate(buf, capacity_);
+            deallocateBuffer(buf, capacity_, isBufFileMapped);
         }
     }
 
@@ -377,12 +385,57 @@ public:
         return !rowSize_ || !colSize_;
     }
 
+    /**
+       When a threshold is set, the buffer whose size in bytes is larger than it is allocated in
+       a temporary file mapped into the memory. The setting is applied when the buffer is
+       reallocated next time. Zero, which is the default value, disables the file mapping.
+    */
+    void setFileMappingThreshold(size_t numBytes) {
+        fileMappingThreshold_ = numBytes;
+    }
+
+    size_t fileMappingThreshold() const {
+        return fileMappingThreshold_;
+    }
+
+    bool isFileMapped() const {
+        return isBufFileMapped;
+    }
+
+    //! The size of the allocated buffer in bytes including the reserved area
+    size_t memoryUsage() const {
+        return capacity_ * sizeof(ElementType);
+    }
+
 private:
+    ElementType* allocateBuffer(int capacity, bool& out_isFileMapped) {
+        deque2DMemoryUsageCounter().add(capacity * sizeof(ElementType));
+        if(fileMappingThreshold_ > 0 && capacity * sizeof(ElementType) > fileMappingThreshold_){
+            void* p = allocateFileMappedMemory(capacity * sizeof(ElementType));
+            if(p){
+                out_isFileMapped = true;
+                return static_cast<ElementType*>(p);
+            }
+        }
+        out_isFileMapped = false;
+        return allocator.allocate(capacity);
+    }
+
+    void deallocateBuffer(ElementType* p, int capacity, bool isFileMapped) {
+        deque2DMemoryUsageCounter().subtract(capacity * sizeof(ElementType));
+        if(isFileMapped){
+            deallocateFileMappedMemory(p);
+        } else {
+            allocator.deallocate(p, capacity);
+        }
+    }
+    
     void reallocMemory(int newColSize, int newSize, int newCapacity, bool doCopy) {
 
         ElementType* newBuf;
+        bool isNewBufFileMapped = false;
         if(newCapacity > 0){
-            newBuf = allocator.allocate(newCapacity);
+            newBuf = allocateBuffer(newCapacity, isNewBufFileMapped);
         } else {
             newBuf = 0;
         }
@@ -400,13 +453,14 @@ private:
                         allocator.construct(p++, *q++);
                     }
                 } else {
-                    for(ElementType* r = buf; r != qend && p != pend; ++r){
-                        allocator.construct(p++, *r);
-                    }
+                    // the elements from the offset to the buffer end precede the wrapped ones
                     ElementType* qterm = buf + capacity_;
                     for(ElementType* r = q; r != qterm && p != pend; ++r){
                         allocator.construct(p++, *r);
                     }
+                    for(ElementType* r = buf; r != qend && p != pend; ++r){
+                        allocator.construct(p++, *r);
+                    }
                 }
             }
             // destory the old elements
@@ -432,9 +486,10 @@ private:
         }
 
         if(buf){
-            allocator.deallocate(buf, capacity_);
+            deallocateBuffer(buf, capacity_, isBufFileMapped);
         }
         buf = newBuf;
+        isBufFileMapped = isNewBufFileMapped;
         capacity_ = newCapacity;
         offset = 0;
     }
@@ -491,7 +546,7 @@ private:
                 if(!buf){
                     capacity_ = minCapacity;
                     if(capacity_ > 0){
-                        buf = allocator.allocate(minCapacity);
+                        buf = allocateBuffer(minCapacity, isBufFileMapped);
                         ElementType* p = buf;
                         ElementType* pend = buf + newSize;
                         // construct new elements
@@ -640,6 +695,8 @@ public:
 private:
     Allocator allocator;
     ElementType* buf;
+    bool isBufFileMapped;
+    size_t fileMappingThreshold_;
     int offset;
     int rowSize_;
     int colSize_;
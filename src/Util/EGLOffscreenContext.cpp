@@ -0,0 +1,389 @@
+/**
+   @file
+*/
+
+#include "EGLOffscreenContext.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <map>
+#include <vector>
+#include "gettext.h"
+
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_RENDERBUFFER
+#define GL_RENDERBUFFER 0x8D41
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_DEPTH_STENCIL_ATTACHMENT
+#define GL_DEPTH_STENCIL_ATTACHMENT 0x821A
+#endif
+#ifndef GL_DEPTH24_STENCIL8
+#define GL_DEPTH24_STENCIL8 0x88F0
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+typedef void (GLAPIENTRY *GenObjectsFunc)(GLsizei n, GLuint* ids);
+typedef void (GLAPIENTRY *DeleteObjectsFunc)(GLsizei n, const GLuint* ids);
+typedef void (GLAPIENTRY *BindObjectFunc)(GLenum target, GLuint id);
+typedef void (GLAPIENTRY *RenderbufferStorageFunc)(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height);
+typedef void (GLAPIENTRY *FramebufferRenderbufferFunc)(GLenum target, GLenum attachment, GLenum renderbufferTarget, GLuint renderbuffer);
+typedef GLenum (GLAPIENTRY *CheckFramebufferStatusFunc)(GLenum target);
+
+struct FrameBufferInfo
+{
+    GLuint colorBuffer;
+    GLuint depthStencilBuffer;
+};
+
+}
+
+namespace cnoid {
+
+class EGLOffscreenContextImpl
+{
+public:
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+    string errorMessage;
+
+    bool areFrameBufferFunctionsLoaded;
+    GenObjectsFunc genFramebuffers;
+    DeleteObjectsFunc deleteFramebuffers;
+    BindObjectFunc bindFramebuffer;
+    GenObjectsFunc genRenderbuffers;
+    DeleteObjectsFunc deleteRenderbuffers;
+    BindObjectFunc bindRenderbuffer;
+    RenderbufferStorageFunc renderbufferStorage;
+    FramebufferRenderbufferFunc framebufferRenderbuffer;
+    CheckFramebufferStatusFunc checkFramebufferStatus;
+    map<GLuint, FrameBufferInfo> frameBuffers;
+
+    EGLOffscreenContextImpl();
+    ~EGLOffscreenContextImpl();
+    void destroy();
+    EGLDisplay getDeviceDisplay(int deviceIndex);
+    bool initializeDisplay(EGLDisplay display);
+    bool create(bool useCoreProfile, int deviceIndex);
+    template<class FunctionType> bool getFunction(const char* name, FunctionType& out_function);
+    bool loadFrameBufferFunctions();
+    GLuint createFrameBuffer(int width, int height);
+    void deleteFrameBuffer(GLuint frameBuffer, FrameBufferInfo& info);
+};
+
+}
+
+
+EGLOffscreenContext::EGLOffscreenContext()
+{
+    impl = new EGLOffscreenContextImpl;
+}
+
+
+EGLOffscreenContextImpl::EGLOffscreenContextImpl()
+{
+    display = EGL_NO_DISPLAY;
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+    areFrameBufferFunctionsLoaded = false;
+}
+
+
+EGLOffscreenContext::~EGLOffscreenContext()
+{
+    delete impl;
+}
+
+
+EGLOffscreenContextImpl::~EGLOffscreenContextImpl()
+{
+    destroy();
+}
+
+
+/**
+   The display is not terminated because it is shared by all the contexts in the process.
+*/
+void EGLOffscreenContextImpl::destroy()
+{
+    if(context != EGL_NO_CONTEXT){
+        if(!frameBuffers.empty()){
+            if(eglMakeCurrent(display, surface, surface, context)){
+                for(map<GLuint, FrameBufferInfo>::iterator p = frameBuffers.begin(); p != frameBuffers.end(); ++p){
+                    deleteFrameBuffer(p->first, p->second);
+                }
+            }
+            frameBuffers.clear();
+        }
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        context = EGL_NO_CONTEXT;
+    }
+    if(surface != EGL_NO_SURFACE){
+        eglDestroySurface(display, surface);
+        surface = EGL_NO_SURFACE;
+    }
+    display = EGL_NO_DISPLAY;
+    areFrameBufferFunctionsLoaded = false;
+}
+
+
+EGLDisplay EGLOffscreenContextImpl::getDeviceDisplay(int deviceIndex)
+{
+#if defined(EGL_EXT_device_enumeration) && defined(EGL_EXT_platform_device)
+    PFNEGLQUERYDEVICESEXTPROC queryDevices =
+        reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if(queryDevices && getPlatformDisplay){
+        EGLint numDevices = 0;
+        if(queryDevices(0, 0, &numDevices) && deviceIndex < numDevices){
+            vector<EGLDeviceEXT> devices(numDevices);
+            if(queryDevices(numDevices, &devices[0], &numDevices) && deviceIndex < numDevices){
+                return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[deviceIndex], 0);
+            }
+        }
+    }
+#endif
+    return EGL_NO_DISPLAY;
+}
+
+
+bool EGLOffscreenContextImpl::initializeDisplay(EGLDisplay display)
+{
+    if(display == EGL_NO_DISPLAY){
+        return false;
+    }
+    EGLint major, minor;
+    if(!eglInitialize(display, &major, &minor)){
+        return false;
+    }
+    this->display = display;
+    return true;
+}
+
+
+bool EGLOffscreenContext::create(bool useCoreProfile, int deviceIndex)
+{
+    return impl->create(useCoreProfile, deviceIndex);
+}
+
+
+bool EGLOffscreenContextImpl::create(bool useCoreProfile, int deviceIndex)
+{
+    destroy();
+    errorMessage.clear();
+
+    if(deviceIndex >= 0){
+        initializeDisplay(getDeviceDisplay(deviceIndex));
+    } else {
+        // The default display may not be available without the window system
+        if(!initializeDisplay(eglGetDisplay(EGL_DEFAULT_DISPLAY))){
+            initializeDisplay(getDeviceDisplay(0));
+        }
+    }
+    if(display == EGL_NO_DISPLAY){
+        errorMessage = _("No EGL display is available.");
+        return false;
+    }
+
+    if(!eglBindAPI(EGL_OPENGL_API)){
+        errorMessage = _("The EGL display does not support OpenGL.");
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if(!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0){
+        errorMessage = _("No EGL configuration for the OpenGL rendering is available.");
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    /*
+      The rendering is done into the frame buffer objects, but a small pbuffer is made
+      for the implementations which do not support EGL_KHR_surfaceless_context.
+    */
+    static const EGLint pbufferAttribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    if(surface == EGL_NO_SURFACE){
+        errorMessage = _("The EGL pbuffer surface cannot be created.");
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    vector<EGLint> contextAttribs;
+    if(useCoreProfile){
+        contextAttribs.push_back(EGL_CONTEXT_MAJOR_VERSION_KHR);
+        contextAttribs.push_back(3);
+        contextAttribs.push_back(EGL_CONTEXT_MINOR_VERSION_KHR);
+        contextAttribs.push_back(3);
+        contextAttribs.push_back(EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR);
+        contextAttribs.push_back(EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR);
+    }
+    contextAttribs.push_back(EGL_NONE);
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, &contextAttribs[0]);
+    if(context == EGL_NO_CONTEXT){
+        errorMessage = _("The EGL context cannot be created.");
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool EGLOffscreenContext::isValid() const
+{
+    return (impl->context != EGL_NO_CONTEXT);
+}
+
+
+const std::string& EGLOffscreenContext::errorMessage() const
+{
+    return impl->errorMessage;
+}
+
+
+/**
+   The API is bound every time because the binding is the state of each thread.
+*/
+bool EGLOffscreenContext::makeCurrent()
+{
+    if(impl->context == EGL_NO_CONTEXT){
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    return eglMakeCurrent(impl->display, impl->surface, impl->surface, impl->context);
+}
+
+
+void EGLOffscreenContext::doneCurrent()
+{
+    if(impl->context != EGL_NO_CONTEXT){
+        eglMakeCurrent(impl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+}
+
+
+void* EGLOffscreenContext::getProcAddress(const char* name) const
+{
+    return reinterpret_cast<void*>(eglGetProcAddress(name));
+}
+
+
+template<class FunctionType> bool EGLOffscreenContextImpl::getFunction(const char* name, FunctionType& out_function)
+{
+    out_function = reinterpret_cast<FunctionType>(eglGetProcAddress(name));
+    return (out_function != 0);
+}
+
+
+bool EGLOffscreenContextImpl::loadFrameBufferFunctions()
+{
+    if(!areFrameBufferFunctionsLoaded){
+        areFrameBufferFunctionsLoaded =
+            getFunction("glGenFramebuffers", genFramebuffers) &&
+            getFunction("glDeleteFramebuffers", deleteFramebuffers) &&
+            getFunction("glBindFramebuffer", bindFramebuffer) &&
+            getFunction("glGenRenderbuffers", genRenderbuffers) &&
+            getFunction("glDeleteRenderbuffers", deleteRenderbuffers) &&
+            getFunction("glBindRenderbuffer", bindRenderbuffer) &&
+            getFunction("glRenderbufferStorage", renderbufferStorage) &&
+            getFunction("glFramebufferRenderbuffer", framebufferRenderbuffer) &&
+            getFunction("glCheckFramebufferStatus", checkFramebufferStatus);
+    }
+    return areFrameBufferFunctionsLoaded;
+}
+
+
+unsigned int EGLOffscreenContext::createFrameBuffer(int width, int height)
+{
+    return impl->createFrameBuffer(width, height);
+}
+
+
+GLuint EGLOffscreenContextImpl::createFrameBuffer(int width, int height)
+{
+    if(!loadFrameBufferFunctions()){
+        errorMessage = _("The OpenGL context does not support the frame buffer objects.");
+        return 0;
+    }
+
+    FrameBufferInfo info;
+    genRenderbuffers(1, &info.colorBuffer);
+    bindRenderbuffer(GL_RENDERBUFFER, info.colorBuffer);
+    renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    genRenderbuffers(1, &info.depthStencilBuffer);
+    bindRenderbuffer(GL_RENDERBUFFER, info.depthStencilBuffer);
+    renderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    bindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLuint frameBuffer;
+    genFramebuffers(1, &frameBuffer);
+    bindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, info.colorBuffer);
+    framebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, info.depthStencilBuffer);
+
+    if(checkFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        bindFramebuffer(GL_FRAMEBUFFER, 0);
+        deleteFrameBuffer(frameBuffer, info);
+        errorMessage = _("The frame buffer object is not complete.");
+        return 0;
+    }
+
+    frameBuffers[frameBuffer] = info;
+    return frameBuffer;
+}
+
+
+void EGLOffscreenContext::bindFrameBuffer(unsigned int frameBuffer)
+{
+    if(impl->areFrameBufferFunctionsLoaded){
+        impl->bindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    }
+}
+
+
+void EGLOffscreenContext::deleteFrameBuffer(unsigned int frameBuffer)
+{
+    map<GLuint, FrameBufferInfo>::iterator p = impl->frameBuffers.find(frameBuffer);
+    if(p != impl->frameBuffers.end()){
+        impl->deleteFrameBuffer(p->first, p->second);
+        impl->frameBuffers.erase(p);
+    }
+}
+
+
+void EGLOffscreenContextImpl::deleteFrameBuffer(GLuint frameBuffer, FrameBufferInfo& info)
+{
+    deleteFramebuffers(1, &frameBuffer);
+    deleteRenderbuffers(1, &info.colorBuffer);
+    deleteRenderbuffers(1, &info.depthStencilBuffer);
+}
@@ -0,0 +1,65 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_EGL_OFFSCREEN_CONTEXT_H
+#define CNOID_UTIL_EGL_OFFSCREEN_CONTEXT_H
+
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class EGLOffscreenContextImpl;
+
+/**
+   An OpenGL context created with EGL, which does not require the window system or a GUI toolkit.
+   The rendering is done into the frame buffer objects created by this class, so the context
+   can be used on the servers which only have the GPUs and the drivers.
+
+   A context must not be current in more than one thread at the same time, but it can
+   be made current in any thread without moving it to the thread.
+*/
+class CNOID_EXPORT EGLOffscreenContext
+{
+public:
+    EGLOffscreenContext();
+    ~EGLOffscreenContext();
+
+    /**
+       @param useCoreProfile The OpenGL 3.3 core profile is requested if this is true.
+       @param deviceIndex The index of the device enumerated by the EGL_EXT_device_enumeration
+       extension. The default display is used if the value is negative, and the first device is
+       used when the default display is not available.
+       @return false if the context cannot be created. The reason is given by errorMessage().
+    */
+    bool create(bool useCoreProfile, int deviceIndex = -1);
+
+    bool isValid() const;
+    const std::string& errorMessage() const;
+
+    bool makeCurrent();
+    void doneCurrent();
+
+    void* getProcAddress(const char* name) const;
+
+    /**
+       The functions for the frame buffer objects must be called while the context is current.
+       The created frame buffer has an RGBA color buffer and a combined depth and stencil buffer,
+       and it is bound to the context when this function returns.
+       @return The name of the frame buffer object, or zero if it cannot be created
+    */
+    unsigned int createFrameBuffer(int width, int height);
+    void bindFrameBuffer(unsigned int frameBuffer);
+    void deleteFrameBuffer(unsigned int frameBuffer);
+
+private:
+    EGLOffscreenContextImpl* impl;
+
+    EGLOffscreenContext(const EGLOffscreenContext& org);
+    EGLOffscreenContext& operator=(const EGLOffscreenContext& rhs);
+};
+
+}
+
+#endif
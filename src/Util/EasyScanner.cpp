@@ -4,6 +4,7 @@
 */
 
 #include "EasyScanner.h"
+#include "StringToNumber.h"
 #include <cstdio>
 #include <cctype>
 #include <cstdlib>
@@ -97,6 +98,37 @@ inline double mystrtod(const char* nptr, char** endptr) {
     return strtod(nptr, endptr);
 }
 #endif
+
+/**
+   The same conversion as strtol() with base 0, which is done without the library function
+   for a decimal number of up to nine digits.
+*/
+inline long strtoint(const char* nptr, char** endptr)
+{
+    const char* p = nptr;
+    bool negative = false;
+    if(*p == '+' || *p == '-'){
+        negative = (*p == '-');
+        ++p;
+    }
+    // the numbers beginning with '0' may be octal or hexadecimal ones
+    if(*p >= '1' && *p <= '9'){
+        long value = 0;
+        int numDigits = 0;
+        do {
+            value = value * 10 + (*p++ - '0');
+        } while(isdigit((unsigned char)*p) && ++numDigits < 9);
+        if(!isalnum((unsigned char)*p)){
+            *endptr = const_cast<char*>(p);
+            return negative ? -value : value;
+        }
+    } else if(*p == '0' && !isalnum((unsigned char)p[1])){
+        *endptr = const_cast<char*>(p + 1);
+        return 0;
+    }
+    return strtol(nptr, endptr, 0);
+}
+
 }
 
 
@@ -496,7 +528,7 @@ bool EasyScanner::readFloat()
 
     if(checkLF()) return false;
 
-    floatValue = mystrtof(text, &tail);
+    floatValue = stringToFloat(text, &tail);
 
     if(tail != text){
         text = tail;
@@ -513,7 +545,7 @@ bool EasyScanner::readDouble()
 
     if(checkLF()) return false;
 
-    doubleValue = mystrtod(text, &tail);
+    doubleValue = stringToDouble(text, &tail);
 
     if(tail != text){
         text = tail;
@@ -530,7 +562,7 @@ bool EasyScanner::readInt()
 
     if(checkLF()) return false;
 
-    intValue = strtol(text, &tail, 0);
+    intValue = strtoint(text, &tail);
     if(tail != text){
         text = tail;
         return true;
@@ -540,6 +572,54 @@ bool EasyScanner::readInt()
 }
 
 
+int EasyScanner::readFloats(float* out_values, int maxNumValues)
+{
+    int n = 0;
+    char* tail;
+    while(n < maxNumValues && !checkLF()){
+        const float value = stringToFloat(text, &tail);
+        if(tail == text){
+            break;
+        }
+        out_values[n++] = value;
+        text = tail;
+    }
+    return n;
+}
+
+
+int EasyScanner::readDoubles(double* out_values, int maxNumValues)
+{
+    int n = 0;
+    char* tail;
+    while(n < maxNumValues && !checkLF()){
+        const double value = stringToDouble(text, &tail);
+        if(tail == text){
+            break;
+        }
+        out_values[n++] = value;
+        text = tail;
+    }
+    return n;
+}
+
+
+int EasyScanner::readInts(int* out_values, int maxNumValues)
+{
+    int n = 0;
+    char* tail;
+    while(n < maxNumValues && !checkLF()){
+        const int value = strtoint(text, &tail);
+        if(tail == text){
+            break;
+        }
+        out_values[n++] = value;
+        text = tail;
+    }
+    return n;
+}
+
+
 bool EasyScanner::readChar()
 {
     skipSpace();
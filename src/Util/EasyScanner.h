@@ -87,6 +87,17 @@ public:
     bool readFloat();
     bool readDouble();
     bool readInt();
+
+    /**
+       These functions read the numbers into a buffer until a token which is not a number appears,
+       a line feed appears in the line oriented mode, or the buffer becomes full.
+       The numbers are converted independently of the locale as readFloat(), readDouble() and readInt() do.
+       \return The number of the read values
+    */
+    int readFloats(float* out_values, int maxNumValues);
+    int readDoubles(double* out_values, int maxNumValues);
+    int readInts(int* out_values, int maxNumValues);
+    
     bool readChar();
     bool readChar(int chara);
     int  peekChar();
@@ -0,0 +1,115 @@
+/**
+   @file
+*/
+
+#include "FileMappedMemory.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <fstream>
+#include <map>
+
+using namespace std;
+using namespace cnoid;
+namespace bi = boost::interprocess;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+struct MappedBlock
+{
+    bi::mapped_region* region;
+    string filename;
+};
+
+typedef map<void*, MappedBlock> MappedBlockMap;
+MappedBlockMap mappedBlocks;
+boost::mutex mappedBlocksMutex;
+
+void removeFile(const string& filename)
+{
+    boost::system::error_code ec;
+    filesystem::remove(filesystem::path(filename), ec);
+}
+
+}
+
+
+void* cnoid::allocateFileMappedMemory(std::size_t size)
+{
+    if(size == 0){
+        return 0;
+    }
+
+    boost::system::error_code ec;
+    filesystem::path tmpdir = filesystem::temp_directory_path(ec);
+    if(ec){
+        return 0;
+    }
+    const string filename = (tmpdir / filesystem::unique_path("cnoid-%%%%-%%%%-%%%%-%%%%.mem", ec)).string();
+    if(ec){
+        return 0;
+    }
+
+    {
+        std::filebuf fbuf;
+        if(!fbuf.open(filename.c_str(), ios_base::out | ios_base::trunc | ios_base::binary)){
+            return 0;
+        }
+        bool extended =
+            (fbuf.pubseekoff(size - 1, ios_base::beg) != std::streampos(std::streamoff(-1))) &&
+            (fbuf.sputc(0) != std::filebuf::traits_type::eof());
+        fbuf.close();
+        if(!extended){
+            removeFile(filename);
+            return 0;
+        }
+    }
+
+    bi::mapped_region* region = 0;
+    try {
+        bi::file_mapping file(filename.c_str(), bi::read_write);
+        region = new bi::mapped_region(file, bi::read_write, 0, size);
+    }
+    catch(const bi::interprocess_exception& ex){
+        removeFile(filename);
+        return 0;
+    }
+
+    MappedBlock block;
+    block.region = region;
+
+#ifndef _WIN32
+    // The mapping remains valid after the file is unlinked, and the file does not remain
+    // even if the process is terminated abnormally
+    removeFile(filename);
+#else
+    // A mapped file cannot be removed on Windows
+    block.filename = filename;
+#endif
+
+    void* p = region->get_address();
+    boost::mutex::scoped_lock lock(mappedBlocksMutex);
+    mappedBlocks[p] = block;
+    return p;
+}
+
+
+void cnoid::deallocateFileMappedMemory(void* p)
+{
+    MappedBlock block;
+    {
+        boost::mutex::scoped_lock lock(mappedBlocksMutex);
+        MappedBlockMap::iterator q = mappedBlocks.find(p);
+        if(q == mappedBlocks.end()){
+            return;
+        }
+        block = q->second;
+        mappedBlocks.erase(q);
+    }
+    delete block.region;
+    if(!block.filename.empty()){
+        removeFile(block.filename);
+    }
+}
@@ -0,0 +1,30 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_FILE_MAPPED_MEMORY_H
+#define CNOID_UTIL_FILE_MAPPED_MEMORY_H
+
+#include <cstddef>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   This function allocates a memory block which is backed by a temporary file instead of the swap area.
+   The pages which are not accessed for a while are written back to the file by the OS and they can be
+   released from the physical memory, so a large buffer which is mainly appended and rarely read
+   does not occupy the memory. The block is aligned to the page boundary.
+   \return The address of the block, or null if the temporary file cannot be mapped
+*/
+CNOID_EXPORT void* allocateFileMappedMemory(std::size_t size);
+
+/**
+   The block must be the one returned by allocateFileMappedMemory().
+   The temporary file is removed when the block is released.
+*/
+CNOID_EXPORT void deallocateFileMappedMemory(void* p);
+
+}
+
+#endif
@@ -9,6 +9,8 @@
 #include <boost/format.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <png.h>
+#include <csetjmp>
+#include <cstring>
 
 extern "C" {
 #define XMD_H
@@ -284,6 +286,322 @@ void loadJPEG(Image& image, const std::string& filename, bool isUpsideDown)
     fclose(fp);
 }
 
+
+
+void throwEncodingException(const std::string& description)
+{
+    exception_base exception;
+    exception << error_info_message(str(format("Image cannot be encoded. %1%") % description));
+    BOOST_THROW_EXCEPTION(exception);
+}
+
+
+void throwDecodingException(const std::string& description)
+{
+    exception_base exception;
+    exception << error_info_message(str(format("Image cannot be decoded. %1%") % description));
+    BOOST_THROW_EXCEPTION(exception);
+}
+
+
+struct PNGMemoryReader
+{
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+};
+
+
+void readPNGData(png_structp pPng, png_bytep out_data, png_size_t length)
+{
+    PNGMemoryReader* reader = static_cast<PNGMemoryReader*>(png_get_io_ptr(pPng));
+    if(reader->pos + length > reader->size){
+        png_error(pPng, "The data is truncated.");
+    }
+    memcpy(out_data, reader->data + reader->pos, length);
+    reader->pos += length;
+}
+
+
+void writePNGData(png_structp pPng, png_bytep data, png_size_t length)
+{
+    vector<unsigned char>* out_data = static_cast<vector<unsigned char>*>(png_get_io_ptr(pPng));
+    out_data->insert(out_data->end(), data, data + length);
+}
+
+
+void flushPNGData(png_structp pPng)
+{
+
+}
+
+
+void encodePNG(const Image& image, vector<unsigned char>& out_data, bool isUpsideDown)
+{
+    png_structp pPng = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if(!pPng){
+        throwEncodingException("Failed to create png_struct.");
+    }
+    png_infop pInfo = png_create_info_struct(pPng);
+    if(!pInfo){
+        png_destroy_write_struct(&pPng, NULL);
+        throwEncodingException("Failed to create png_info.");
+    }
+
+    const int height = image.height();
+    const int rowbytes = image.width() * image.numComponents();
+    vector<png_bytep> row_pointers(height);
+    
+    if(setjmp(png_jmpbuf(pPng))){
+        png_destroy_write_struct(&pPng, &pInfo);
+        throwEncodingException("Internal error.");
+    }
+
+    out_data.clear();
+    png_set_write_fn(pPng, &out_data, writePNGData, flushPNGData);
+
+    static const int colorTypes[] = {
+        PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA };
+    png_set_IHDR(pPng, pInfo, image.width(), height, 8, colorTypes[image.numComponents() - 1],
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    // The fast compression is used because the images are encoded during the simulation
+    png_set_compression_level(pPng, 1);
+    
+    png_write_info(pPng, pInfo);
+
+    unsigned char* pixels = const_cast<unsigned char*>(image.pixels());
+    for(int i=0; i < height; ++i){
+        row_pointers[i] = pixels + (isUpsideDown ? (height - i - 1) : i) * rowbytes;
+    }
+    png_write_image(pPng, &row_pointers.front());
+    png_write_end(pPng, pInfo);
+    png_destroy_write_struct(&pPng, &pInfo);
+}
+
+
+void decodePNG(Image& image, const unsigned char* data, size_t size, bool isUpsideDown)
+{
+    png_structp pPng = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if(!pPng){
+        throwDecodingException("Failed to create png_struct.");
+    }
+    png_infop pInfo = png_create_info_struct(pPng);
+    if(!pInfo){
+        png_destroy_read_struct(&pPng, NULL, NULL);
+        throwDecodingException("Failed to create png_info.");
+    }
+
+    vector<png_bytep> row_pointers;
+
+    if(setjmp(png_jmpbuf(pPng))){
+        png_destroy_read_struct(&pPng, &pInfo, NULL);
+        throwDecodingException("The PNG data is corrupted.");
+    }
+
+    PNGMemoryReader reader;
+    reader.data = data;
+    reader.size = size;
+    reader.pos = 0;
+    png_set_read_fn(pPng, &reader, readPNGData);
+
+    png_read_info(pPng, pInfo);
+
+    // The images of the other types than the ones given by encodePNG are converted to 8-bit components
+    png_set_expand(pPng);
+    png_set_strip_16(pPng);
+    png_read_update_info(pPng, pInfo);
+    
+    const int height = png_get_image_height(pPng, pInfo);
+    image.setSize(png_get_image_width(pPng, pInfo), height, png_get_channels(pPng, pInfo));
+    const png_uint_32 rowbytes = png_get_rowbytes(pPng, pInfo);
+    
+    row_pointers.resize(height);
+    unsigned char* pixels = image.pixels();
+    for(int i=0; i < height; ++i){
+        row_pointers[i] = pixels + (isUpsideDown ? (height - i - 1) : i) * rowbytes;
+    }
+    png_read_image(pPng, &row_pointers.front());
+    png_destroy_read_struct(&pPng, &pInfo, NULL);
+}
+
+
+/*
+  The errors of libjpeg are caught by longjmp because the default error handler exits the program.
+*/
+struct JPEGErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf jmpbuf;
+};
+
+
+void exitJPEGError(j_common_ptr cinfo)
+{
+    JPEGErrorManager* manager = reinterpret_cast<JPEGErrorManager*>(cinfo->err);
+    longjmp(manager->jmpbuf, 1);
+}
+
+
+/*
+  The memory source and destination managers are defined here because jpeg_mem_src and
+  jpeg_mem_dest are not available in the versions of libjpeg earlier than 8.
+*/
+const size_t JPEGOutputBlockSize = 65536;
+
+struct JPEGMemoryDestination
+{
+    jpeg_destination_mgr pub;
+    vector<unsigned char>* data;
+};
+
+
+void initJPEGDestination(j_compress_ptr cinfo)
+{
+    JPEGMemoryDestination* dest = reinterpret_cast<JPEGMemoryDestination*>(cinfo->dest);
+    dest->data->resize(JPEGOutputBlockSize);
+    dest->pub.next_output_byte = &dest->data->front();
+    dest->pub.free_in_buffer = JPEGOutputBlockSize;
+}
+
+
+boolean emptyJPEGOutputBuffer(j_compress_ptr cinfo)
+{
+    JPEGMemoryDestination* dest = reinterpret_cast<JPEGMemoryDestination*>(cinfo->dest);
+    const size_t size = dest->data->size();
+    dest->data->resize(size + JPEGOutputBlockSize);
+    dest->pub.next_output_byte = &dest->data->front() + size;
+    dest->pub.free_in_buffer = JPEGOutputBlockSize;
+    return TRUE;
+}
+
+
+void terminateJPEGDestination(j_compress_ptr cinfo)
+{
+    JPEGMemoryDestination* dest = reinterpret_cast<JPEGMemoryDestination*>(cinfo->dest);
+    dest->data->resize(dest->data->size() - dest->pub.free_in_buffer);
+}
+
+
+void initJPEGSource(j_decompress_ptr cinfo)
+{
+
+}
+
+
+boolean fillJPEGInputBuffer(j_decompress_ptr cinfo)
+{
+    // The end of the data is marked by an EOI marker as jpeg_mem_src does for the truncated data
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+
+void skipJPEGInputData(j_decompress_ptr cinfo, long numBytes)
+{
+    if(numBytes > 0){
+        if(static_cast<size_t>(numBytes) > cinfo->src->bytes_in_buffer){
+            fillJPEGInputBuffer(cinfo);
+        } else {
+            cinfo->src->next_input_byte += numBytes;
+            cinfo->src->bytes_in_buffer -= numBytes;
+        }
+    }
+}
+
+
+void terminateJPEGSource(j_decompress_ptr cinfo)
+{
+
+}
+
+
+void encodeJPEG(const Image& image, vector<unsigned char>& out_data, int quality, bool isUpsideDown)
+{
+    const int numComponents = image.numComponents();
+    if(numComponents != 1 && numComponents != 3){
+        throwEncodingException("The JPEG format does not support the alpha component.");
+    }
+    
+    jpeg_compress_struct cinfo;
+    JPEGErrorManager jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = exitJPEGError;
+    if(setjmp(jerr.jmpbuf)){
+        jpeg_destroy_compress(&cinfo);
+        throwEncodingException("Internal error.");
+    }
+    jpeg_create_compress(&cinfo);
+
+    JPEGMemoryDestination dest;
+    dest.pub.init_destination = initJPEGDestination;
+    dest.pub.empty_output_buffer = emptyJPEGOutputBuffer;
+    dest.pub.term_destination = terminateJPEGDestination;
+    dest.data = &out_data;
+    cinfo.dest = &dest.pub;
+
+    const int width = image.width();
+    const int height = image.height();
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = numComponents;
+    cinfo.in_color_space = (numComponents == 3) ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    unsigned char* pixels = const_cast<unsigned char*>(image.pixels());
+    while(cinfo.next_scanline < cinfo.image_height){
+        const int i = cinfo.next_scanline;
+        JSAMPROW row = pixels + (isUpsideDown ? (height - i - 1) : i) * width * numComponents;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+}
+
+
+void decodeJPEG(Image& image, const unsigned char* data, size_t size, bool isUpsideDown)
+{
+    jpeg_decompress_struct cinfo;
+    JPEGErrorManager jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = exitJPEGError;
+    if(setjmp(jerr.jmpbuf)){
+        jpeg_destroy_decompress(&cinfo);
+        throwDecodingException("The JPEG data is corrupted.");
+    }
+    jpeg_create_decompress(&cinfo);
+
+    jpeg_source_mgr src;
+    src.init_source = initJPEGSource;
+    src.fill_input_buffer = fillJPEGInputBuffer;
+    src.skip_input_data = skipJPEGInputData;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = terminateJPEGSource;
+    src.next_input_byte = data;
+    src.bytes_in_buffer = size;
+    cinfo.src = &src;
+
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+    const int width = cinfo.output_width;
+    const int height = cinfo.output_height;
+    const int numComponents = cinfo.output_components;
+    image.setSize(width, height, numComponents);
+
+    unsigned char* pixels = image.pixels();
+    while(cinfo.output_scanline < cinfo.output_height){
+        const int i = cinfo.output_scanline;
+        JSAMPROW row = pixels + (isUpsideDown ? (height - i - 1) : i) * width * numComponents;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+}
+
 }
 
 
@@ -313,3 +631,28 @@ void ImageIO::save(const Image& image, const std::string& filename)
         throwSaveException(filename, "unsupported image format.");
     }
 }
+
+
+void ImageIO::saveToMemory(const Image& image, Format format, std::vector<unsigned char>& out_data, int jpegQuality)
+{
+    if(image.empty()){
+        throwEncodingException("The image is empty.");
+    }
+    if(format == PNG){
+        encodePNG(image, out_data, isUpsideDown_);
+    } else {
+        encodeJPEG(image, out_data, jpegQuality, isUpsideDown_);
+    }
+}
+
+
+void ImageIO::loadFromMemory(Image& image, const unsigned char* data, size_t size)
+{
+    if(size >= 8 && !png_sig_cmp(const_cast<png_bytep>(data), 0, 8)){
+        decodePNG(image, data, size, isUpsideDown_);
+    } else if(size >= 2 && data[0] == 0xFF && data[1] == 0xD8){
+        decodeJPEG(image, data, size, isUpsideDown_);
+    } else {
+        throwDecodingException("The data format is not supported.");
+    }
+}
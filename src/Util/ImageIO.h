@@ -7,6 +7,7 @@
 #define CNOID_UTIL_IMAGE_IO_H
 
 #include "Image.h"
+#include <vector>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -24,6 +25,18 @@ public:
     void load(Image& image, const std::string& filename);
     void save(const Image& image, const std::string& filename);
 
+    enum Format { PNG, JPEG };
+
+    /**
+       Encode the image into the data of the image file format.
+       @param jpegQuality The quality (0-100) of the lossy compression of the JPEG format
+       @note The JPEG format only supports the images of one or three components.
+    */
+    void saveToMemory(const Image& image, Format format, std::vector<unsigned char>& out_data, int jpegQuality = 90);
+
+    //! The format is detected from the data.
+    void loadFromMemory(Image& image, const unsigned char* data, size_t size);
+
 private:
     bool isUpsideDown_;
 };
@@ -32,6 +32,25 @@ public:
     double getPosition(int axis) const;
     bool getButtonState(int button) const;
     bool isActive() const;
+
+    /**
+       Starts a thread which waits for the events of the device and keeps the latest state of it.
+       While the thread is running, readCurrentState() takes the latest state from the thread without
+       any system call or lock, so that a controller can call it in every control cycle from the
+       simulation thread with a small and constant cost. The signals are still emitted by the thread
+       calling readCurrentState(). This is currently supported only on Linux.
+       @return false if the thread cannot be started
+    */
+    bool startEventThread();
+    void stopEventThread();
+    bool isEventThreadRunning() const;
+
+    /**
+       The time of the last event which has been read by readCurrentState(), measured in seconds
+       by the monotonic clock of the system. Zero is returned if no event has been read.
+    */
+    double lastEventTime() const;
+
     SignalProxy<void(int id, bool isPressed)> sigButton();
     SignalProxy<void(int id, double position)> sigAxis();
 
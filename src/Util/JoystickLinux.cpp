@@ -6,10 +6,16 @@
 #include "ExtJoystick.h"
 #include <boost/format.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
 #include <linux/joystick.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <ctime>
 #include <cerrno>
 #include <cstring>
 #include <string>
@@ -20,6 +26,17 @@ using namespace std;
 using namespace boost;
 using namespace cnoid;
 
+namespace {
+
+double getMonotonicTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+}
+
 namespace cnoid {
 
 class JoystickImpl
@@ -32,15 +49,41 @@ public:
     dynamic_bitset<> axisEnabled;
     vector<bool> buttons;
     string errorMessage;
+    double lastEventTime;
     Signal<void(int id, bool isPressed)> sigButton;
     Signal<void(int id, double position)> sigAxis;
 
+    /*
+      The state read by the event thread is published with a sequence lock.
+      The thread makes the sequence odd while it updates the published state, and the reader
+      retries the copy if the sequence is odd or changes during the copy.
+    */
+    boost::thread eventThread;
+    bool isEventThreadRunning;
+    int stopEventFd;
+    vector<double> threadAxes;
+    vector<char> threadButtons;
+    boost::atomic<unsigned int> publishedSequence;
+    vector<double> publishedAxes;
+    vector<char> publishedButtons;
+    double publishedEventTime;
+    boost::atomic<bool> isDeviceLost;
+    vector<double> latestAxes;
+    vector<char> latestButtons;
+
     JoystickImpl(Joystick* self, const char* device);
     ~JoystickImpl();
     bool openDevice(const char* device);
     void closeDevice();
     bool readCurrentState();
     bool readEvent();
+    void updateButton(int id, bool isPressed);
+    void updateAxis(int id, double pos);
+    bool startEventThread();
+    void stopEventThread();
+    void runEventThread(int epollFd);
+    bool readEventsInEventThread();
+    bool readStateFromEventThread();
 };
 
 }
@@ -59,9 +102,15 @@ Joystick::Joystick(const char* device)
 
 
 JoystickImpl::JoystickImpl(Joystick* self, const char* device)
-    : self(self)
+    : self(self),
+      publishedSequence(0),
+      isDeviceLost(false)
 {
     fd = -1;
+    lastEventTime = 0.0;
+    isEventThreadRunning = false;
+    stopEventFd = -1;
+    publishedEventTime = 0.0;
 
     extJoystick = ExtJoystick::findJoystick(device);
 
@@ -107,6 +156,7 @@ Joystick::~Joystick()
 
 JoystickImpl::~JoystickImpl()
 {
+    stopEventThread();
     closeDevice();
 }
 
@@ -169,6 +219,9 @@ bool Joystick::readCurrentState()
 
 bool JoystickImpl::readCurrentState()
 {
+    if(isEventThreadRunning){
+        return readStateFromEventThread();
+    }
     while(readEvent());
     return (fd >= 0);
 }
@@ -199,28 +252,247 @@ bool JoystickImpl::readEvent()
         return false;
     }
 
+    lastEventTime = getMonotonicTime();
+
     const int id = event.number;
     double pos = (double)event.value / MAX_VALUE_16BIT;
     if(event.type & JS_EVENT_BUTTON) {
-        // button
-        bool isPressed = (pos > 0.0);
-        buttons[id] = isPressed;
-        sigButton(id, isPressed);
+        updateButton(id, pos > 0.0);
     } else if(event.type & JS_EVENT_AXIS){
-        if(axisEnabled[id]){
-            // normalize value (-1.0〜1.0)
-            pos = nearbyint(pos * 10.0) / 10.0;
-            double prevPos = axes[id];
-            if(pos != prevPos){
-                axes[id] = pos;
-                sigAxis(id, pos);
+        updateAxis(id, pos);
+    }
+    return true;
+}
+
+
+void JoystickImpl::updateButton(int id, bool isPressed)
+{
+    buttons[id] = isPressed;
+    sigButton(id, isPressed);
+}
+
+
+void JoystickImpl::updateAxis(int id, double pos)
+{
+    if(axisEnabled[id]){
+        // normalize value (-1.0〜1.0)
+        pos = nearbyint(pos * 10.0) / 10.0;
+        double prevPos = axes[id];
+        if(pos != prevPos){
+            axes[id] = pos;
+            sigAxis(id, pos);
+        }
+    }
+}
+
+
+bool Joystick::startEventThread()
+{
+    return impl->startEventThread();
+}
+
+
+bool JoystickImpl::startEventThread()
+{
+    if(isEventThreadRunning){
+        return true;
+    }
+    if(extJoystick || fd < 0){
+        return false;
+    }
+
+    // The events which have not been read are processed by the thread
+    threadAxes = axes;
+    threadButtons.assign(buttons.begin(), buttons.end());
+    publishedAxes = threadAxes;
+    publishedButtons = threadButtons;
+    publishedEventTime = lastEventTime;
+    latestAxes.resize(axes.size());
+    latestButtons.resize(buttons.size());
+    isDeviceLost = false;
+
+    stopEventFd = eventfd(0, 0);
+    if(stopEventFd < 0){
+        errorMessage = strerror(errno);
+        return false;
+    }
+    int epollFd = epoll_create(2);
+    if(epollFd < 0){
+        errorMessage = strerror(errno);
+        close(stopEventFd);
+        stopEventFd = -1;
+        return false;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    event.data.fd = stopEventFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, stopEventFd, &event);
+
+    eventThread = boost::thread(boost::bind(&JoystickImpl::runEventThread, this, epollFd));
+    isEventThreadRunning = true;
+
+    return true;
+}
+
+
+void Joystick::stopEventThread()
+{
+    impl->stopEventThread();
+}
+
+
+void JoystickImpl::stopEventThread()
+{
+    if(isEventThreadRunning){
+        uint64_t value = 1;
+        if(write(stopEventFd, &value, sizeof(value)) < 0){
+            eventThread.interrupt();
+        }
+        eventThread.join();
+        close(stopEventFd);
+        stopEventFd = -1;
+        isEventThreadRunning = false;
+        if(isDeviceLost){
+            closeDevice();
+        }
+    }
+}
+
+
+bool Joystick::isEventThreadRunning() const
+{
+    return impl->isEventThreadRunning;
+}
+
+
+void JoystickImpl::runEventThread(int epollFd)
+{
+    epoll_event events[2];
+    
+    while(true){
+        int n = epoll_wait(epollFd, events, 2, -1);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
             }
+            break;
+        }
+        bool isStopRequested = false;
+        bool hasInput = false;
+        for(int i=0; i < n; ++i){
+            if(events[i].data.fd == stopEventFd){
+                isStopRequested = true;
+            } else {
+                hasInput = true;
+            }
+        }
+        if(isStopRequested){
+            break;
+        }
+        if(hasInput && !readEventsInEventThread()){
+            isDeviceLost = true;
+            break;
         }
     }
+
+    close(epollFd);
+}
+
+
+/**
+   All the available events are applied to the state owned by the thread,
+   and then the state is published at once.
+   @return false if the device is no longer available
+*/
+bool JoystickImpl::readEventsInEventThread()
+{
+    const float MAX_VALUE_16BIT = 32767.0f;
+    js_event event;
+    bool isUpdated = false;
+    
+    while(true){
+        int len = read(fd, &event, sizeof(js_event));
+        if(len <= 0){
+            if(len < 0 && errno == EAGAIN){
+                break;
+            }
+            return false;
+        }
+        if(len < (int)sizeof(js_event)){
+            break;
+        }
+        const int id = event.number;
+        const double pos = (double)event.value / MAX_VALUE_16BIT;
+        if(event.type & JS_EVENT_BUTTON){
+            if(id < (int)threadButtons.size()){
+                threadButtons[id] = (pos > 0.0);
+                isUpdated = true;
+            }
+        } else if(event.type & JS_EVENT_AXIS){
+            if(id < (int)threadAxes.size()){
+                threadAxes[id] = pos;
+                isUpdated = true;
+            }
+        }
+    }
+
+    if(isUpdated){
+        const double time = getMonotonicTime();
+        const unsigned int sequence = publishedSequence.load(boost::memory_order_relaxed);
+        publishedSequence.store(sequence + 1, boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_release);
+        std::copy(threadAxes.begin(), threadAxes.end(), publishedAxes.begin());
+        std::copy(threadButtons.begin(), threadButtons.end(), publishedButtons.begin());
+        publishedEventTime = time;
+        publishedSequence.store(sequence + 2, boost::memory_order_release);
+    }
+
     return true;
 }
 
 
+bool JoystickImpl::readStateFromEventThread()
+{
+    double eventTime;
+    while(true){
+        const unsigned int sequence = publishedSequence.load(boost::memory_order_acquire);
+        if(sequence & 1){
+            continue;
+        }
+        std::copy(publishedAxes.begin(), publishedAxes.end(), latestAxes.begin());
+        std::copy(publishedButtons.begin(), publishedButtons.end(), latestButtons.begin());
+        eventTime = publishedEventTime;
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if(publishedSequence.load(boost::memory_order_relaxed) == sequence){
+            break;
+        }
+    }
+
+    if(eventTime != lastEventTime){
+        lastEventTime = eventTime;
+        for(size_t i=0; i < latestButtons.size(); ++i){
+            const bool isPressed = latestButtons[i];
+            if(isPressed != buttons[i]){
+                updateButton(i, isPressed);
+            }
+        }
+        for(size_t i=0; i < latestAxes.size(); ++i){
+            updateAxis(i, latestAxes[i]);
+        }
+    }
+
+    return !isDeviceLost;
+}
+
+
+double Joystick::lastEventTime() const
+{
+    return impl->lastEventTime;
+}
+
+
 double Joystick::getPosition(int axis) const
 {
     if(impl->extJoystick){
@@ -687,6 +687,30 @@ bool Joystick::getButtonState(int button) const
 }
 
 
+bool Joystick::startEventThread()
+{
+    return false;
+}
+
+
+void Joystick::stopEventThread()
+{
+
+}
+
+
+bool Joystick::isEventThreadRunning() const
+{
+    return false;
+}
+
+
+double Joystick::lastEventTime() const
+{
+    return 0.0;
+}
+
+
 SignalProxy<void(int id, bool isPressed)> Joystick::sigButton()
 {
     return impl->sigButton;
@@ -0,0 +1,69 @@
+/**
+   @file
+*/
+
+#include "MemoryUsageCounter.h"
+#include <boost/thread/mutex.hpp>
+#include <fstream>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+/*
+  The list is created on the first use because the counters may be constructed
+  during the static initialization of other modules.
+*/
+vector<MemoryUsageCounter*>& counters()
+{
+    static vector<MemoryUsageCounter*> counters_;
+    return counters_;
+}
+
+boost::mutex& countersMutex()
+{
+    static boost::mutex mutex;
+    return mutex;
+}
+
+}
+
+
+MemoryUsageCounter::MemoryUsageCounter(const std::string& name)
+    : name_(name),
+      bytes_(0)
+{
+    boost::mutex::scoped_lock lock(countersMutex());
+    counters().push_back(this);
+}
+
+
+void MemoryUsageCounter::getCounters(std::vector<MemoryUsageCounter*>& out_counters)
+{
+    boost::mutex::scoped_lock lock(countersMutex());
+    out_counters = counters();
+}
+
+
+MemoryUsageCounter& cnoid::deque2DMemoryUsageCounter()
+{
+    static MemoryUsageCounter counter("Sequence buffers");
+    return counter;
+}
+
+
+long cnoid::getResidentMemorySize()
+{
+#ifdef __linux__
+    ifstream ifs("/proc/self/statm");
+    long size, resident;
+    if(ifs >> size >> resident){
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return -1;
+}
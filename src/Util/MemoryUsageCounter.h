@@ -0,0 +1,61 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_MEMORY_USAGE_COUNTER_H
+#define CNOID_UTIL_MEMORY_USAGE_COUNTER_H
+
+#include <boost/atomic.hpp>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   A counter of the bytes allocated by a subsystem such as the sequence buffers, the GL buffers
+   or the collision models. A counter is registered in the global list when it is constructed
+   so that the memory usage of all the subsystems can be listed by getCounters().
+   The counter must be a static object because it is never unregistered.
+   The counting is thread-safe.
+*/
+class CNOID_EXPORT MemoryUsageCounter
+{
+public:
+    MemoryUsageCounter(const std::string& name);
+
+    const std::string& name() const { return name_; }
+
+    void add(std::size_t numBytes) {
+        bytes_.fetch_add(static_cast<long long>(numBytes), boost::memory_order_relaxed);
+    }
+    void subtract(std::size_t numBytes) {
+        bytes_.fetch_sub(static_cast<long long>(numBytes), boost::memory_order_relaxed);
+    }
+    long long bytes() const {
+        return bytes_.load(boost::memory_order_relaxed);
+    }
+
+    static void getCounters(std::vector<MemoryUsageCounter*>& out_counters);
+
+private:
+    std::string name_;
+    boost::atomic<long long> bytes_;
+
+    MemoryUsageCounter(const MemoryUsageCounter& org);
+    MemoryUsageCounter& operator=(const MemoryUsageCounter& rhs);
+};
+
+//! The counter of the buffers allocated by Deque2D, which is used by MultiSeq and MultiValueSeq
+CNOID_EXPORT MemoryUsageCounter& deque2DMemoryUsageCounter();
+
+/**
+   \return The resident set size of the current process in bytes,
+   or -1 if it cannot be obtained on the platform
+*/
+CNOID_EXPORT long getResidentMemorySize();
+
+}
+
+#endif
@@ -0,0 +1,280 @@
+/*!
+  @file
+*/
+
+#include "MeshLODGenerator.h"
+#include "MeshSimplifier.h"
+#include "SceneDrawables.h"
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/bind.hpp>
+#include <deque>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+/*
+  The numbers of the cells along the longest side of the bounding box for the levels
+  from the finest one. The level of a resolution is used when a cell is smaller than
+  MaxCellPixels on the screen.
+*/
+const int levelResolutions[] = { 256, 64, 16 };
+const int NumLevels = sizeof(levelResolutions) / sizeof(levelResolutions[0]);
+const double MaxCellPixels = 2.0;
+
+struct Entry
+{
+    weak_ref_ptr<SgMesh> mesh;
+    // The element is null if the level is not simpler than the original mesh
+    vector<SgMeshPtr> levels;
+    bool isValid;
+    ScopedConnection connection;
+
+    Entry(SgMesh* mesh) : mesh(mesh), isValid(true) { }
+
+    void onMeshUpdated(){
+        isValid = false;
+    }
+};
+typedef boost::shared_ptr<Entry> EntryPtr;
+
+/*
+  The source mesh of a job is a copy of the vertices and the triangles of the original mesh
+  so that the original mesh is not accessed from the background thread.
+*/
+struct Job
+{
+    EntryPtr entry;
+    SgMeshPtr source;
+    vector<SgMeshPtr> levels;
+};
+typedef boost::shared_ptr<Job> JobPtr;
+
+}
+
+namespace cnoid {
+
+class MeshLODGeneratorImpl
+{
+public:
+    int minNumTriangles;
+    typedef boost::unordered_map<SgMesh*, EntryPtr> EntryMap;
+    EntryMap entries;
+    size_t numEntriesAtLastSweep;
+
+    boost::thread thread;
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    deque<JobPtr> jobs;
+    vector<JobPtr> finishedJobs;
+    bool isThreadStarted;
+    bool isStopRequested;
+
+    MeshLODGeneratorImpl();
+    ~MeshLODGeneratorImpl();
+    SgMesh* getMesh(SgMesh* mesh, double projectedSize);
+    void collectFinishedJobs();
+    void requestLevels(SgMesh* mesh, const EntryPtr& entry);
+    void sweepEntries();
+    void clear();
+    void run();
+};
+
+}
+
+
+MeshLODGenerator::MeshLODGenerator()
+{
+    impl = new MeshLODGeneratorImpl;
+}
+
+
+MeshLODGeneratorImpl::MeshLODGeneratorImpl()
+{
+    minNumTriangles = 20000;
+    numEntriesAtLastSweep = 0;
+    isThreadStarted = false;
+    isStopRequested = false;
+}
+
+
+MeshLODGenerator::~MeshLODGenerator()
+{
+    delete impl;
+}
+
+
+MeshLODGeneratorImpl::~MeshLODGeneratorImpl()
+{
+    if(isThreadStarted){
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            isStopRequested = true;
+        }
+        condition.notify_all();
+        thread.join();
+    }
+}
+
+
+void MeshLODGenerator::setMinNumTriangles(int n)
+{
+    impl->minNumTriangles = n;
+}
+
+
+SgMesh* MeshLODGenerator::getMesh(SgMesh* mesh, double projectedSize)
+{
+    return impl->getMesh(mesh, projectedSize);
+}
+
+
+SgMesh* MeshLODGeneratorImpl::getMesh(SgMesh* mesh, double projectedSize)
+{
+    if(mesh->numTriangles() < minNumTriangles){
+        return mesh;
+    }
+
+    collectFinishedJobs();
+
+    EntryPtr& entry = entries[mesh];
+    if(entry && (!entry->isValid || entry->mesh.expired())){
+        // The mesh has been updated, or a new mesh has been created at the address of a deleted one
+        entry.reset();
+    }
+    if(!entry){
+        entry.reset(new Entry(mesh));
+        entry->connection.reset(
+            mesh->sigUpdated().connect(boost::bind(&Entry::onMeshUpdated, entry.get())));
+        requestLevels(mesh, entry);
+        if(entries.size() > 2 * numEntriesAtLastSweep + 16){
+            sweepEntries();
+        }
+        return mesh;
+    }
+
+    // The coarsest level whose cells are small enough on the screen
+    SgMesh* selected = mesh;
+    const double minResolution = projectedSize / MaxCellPixels;
+    for(size_t i=0; i < entry->levels.size(); ++i){
+        if(levelResolutions[i] < minResolution){
+            break;
+        }
+        if(entry->levels[i]){
+            selected = entry->levels[i];
+        }
+    }
+    return selected;
+}
+
+
+void MeshLODGeneratorImpl::collectFinishedJobs()
+{
+    vector<JobPtr> finished;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if(finishedJobs.empty()){
+            return;
+        }
+        finished.swap(finishedJobs);
+    }
+    for(size_t i=0; i < finished.size(); ++i){
+        Job& job = *finished[i];
+        if(job.entry->isValid){
+            job.entry->levels = job.levels;
+        }
+    }
+}
+
+
+void MeshLODGeneratorImpl::requestLevels(SgMesh* mesh, const EntryPtr& entry)
+{
+    JobPtr job(new Job);
+    job->entry = entry;
+    job->source = new SgMesh;
+    job->source->setVertices(new SgVertexArray(*mesh->vertices()));
+    job->source->triangleVertices() = mesh->triangleVertices();
+    if(mesh->hasNormals()){
+        job->source->setNormals(new SgNormalArray(*mesh->normals()));
+    }
+    job->source->setSolid(mesh->isSolid());
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        jobs.push_back(job);
+        if(!isThreadStarted){
+            thread = boost::thread(boost::bind(&MeshLODGeneratorImpl::run, this));
+            isThreadStarted = true;
+        }
+    }
+    condition.notify_all();
+}
+
+
+void MeshLODGeneratorImpl::sweepEntries()
+{
+    EntryMap::iterator p = entries.begin();
+    while(p != entries.end()){
+        if(!p->second || p->second->mesh.expired()){
+            p = entries.erase(p);
+        } else {
+            ++p;
+        }
+    }
+    numEntriesAtLastSweep = entries.size();
+}
+
+
+void MeshLODGenerator::clear()
+{
+    impl->clear();
+}
+
+
+void MeshLODGeneratorImpl::clear()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        jobs.clear();
+        finishedJobs.clear();
+    }
+    entries.clear();
+    numEntriesAtLastSweep = 0;
+}
+
+
+void MeshLODGeneratorImpl::run()
+{
+    MeshSimplifier simplifier;
+    
+    while(true){
+        JobPtr job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while(jobs.empty() && !isStopRequested){
+                condition.wait(lock);
+            }
+            if(isStopRequested){
+                break;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        const int numOrgTriangles = job->source->numTriangles();
+        for(int i=0; i < NumLevels; ++i){
+            SgMeshPtr level = simplifier.simplify(job->source, levelResolutions[i]);
+            if(level && level->numTriangles() >= numOrgTriangles){
+                level.reset();
+            }
+            job->levels.push_back(level);
+        }
+        job->source.reset();
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        finishedJobs.push_back(job);
+    }
+}
@@ -0,0 +1,51 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_MESH_LOD_GENERATOR_H
+#define CNOID_UTIL_MESH_LOD_GENERATOR_H
+
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SgMesh;
+class MeshLODGeneratorImpl;
+
+/**
+   This class generates the simplified versions of the heavy meshes for rendering them
+   with the level of detail suitable for their sizes on the screen. The levels of a mesh
+   are generated by MeshSimplifier in a background thread when the mesh is first given to
+   getMesh(), and they are cached until the mesh is updated or deleted. The original mesh
+   is not modified, so it can still be used for other purposes such as the collision detection.
+*/
+class CNOID_EXPORT MeshLODGenerator
+{
+public:
+    MeshLODGenerator();
+    ~MeshLODGenerator();
+
+    //! The meshes which have fewer triangles than this number are always used as they are.
+    void setMinNumTriangles(int n);
+
+    /**
+       @param projectedSize The diameter of the bounding sphere of the mesh on the screen in pixels
+       @return The coarsest level whose detail is enough for the projected size. The given mesh
+       itself is returned if it is light, the detail of the levels is not enough, or the levels
+       have not been generated yet.
+       @note This function must be called from the same thread.
+    */
+    SgMesh* getMesh(SgMesh* mesh, double projectedSize);
+
+    void clear();
+
+private:
+    MeshLODGeneratorImpl* impl;
+
+    MeshLODGenerator(const MeshLODGenerator& org);
+    MeshLODGenerator& operator=(const MeshLODGenerator& rhs);
+};
+
+}
+
+#endif
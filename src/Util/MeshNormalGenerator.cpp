@@ -5,12 +5,18 @@
 
 #include "MeshNormalGenerator.h"
 #include "SceneDrawables.h"
+#include "TimingProfiler.h"
+#include "TaskScheduler.h"
+#include <boost/bind.hpp>
 
 using namespace std;
 using namespace cnoid;
 
 namespace {
 const float PI = 3.14159265358979323846f;
+
+// The number of the triangles or the vertices processed as one task
+const int GrainSize = 4096;
 }
 
 namespace cnoid {
@@ -20,15 +26,35 @@ class MeshNormalGeneratorImpl
 public:
     float minCreaseAngle;
     float maxCreaseAngle;
-    SgNormalArrayPtr faceNormals;
-    vector< vector<int> > vertexIndexToTriangleIndicesMap;
-    vector< vector<int> > vertexIndexToNormalIndicesMap;
     bool isOverwritingEnabled;
 
+    vector<Vector3f> faceNormals;
+
+    /*
+      The triangles adjacent to each vertex are stored in the compressed sparse row format.
+      The triangles of vertex v are adjacentTriangles[adjacentOffsets[v]] to
+      adjacentTriangles[adjacentOffsets[v] + numAdjacentTriangles[v] - 1], and the triangles
+      which have the same normal as a preceding one are omitted.
+    */
+    vector<int> adjacentOffsets;
+    vector<int> numAdjacentTriangles;
+    vector<int> adjacentTriangles;
+
+    // The normal of each corner of the triangles
+    vector<Vector3f> cornerNormals;
+
+    // The normals of each vertex are linked in the order of their indices
+    vector<int> firstNormalOfVertex;
+    vector<int> lastNormalOfVertex;
+    vector<int> nextNormalOfVertex;
+
     MeshNormalGeneratorImpl();
     MeshNormalGeneratorImpl(const MeshNormalGeneratorImpl& org);
-    void calculateFaceNormals(SgMesh* mesh);
-    void setVertexNormals(SgMesh* mesh, float creaseAngle);        
+    void calculateFaceNormals(const SgMesh* mesh, int begin, int end);
+    void makeAdjacentTriangleArrays(const SgMesh* mesh);
+    void removeSameNormalTriangles(int begin, int end);
+    void calculateCornerNormals(const SgMesh* mesh, float cosCreaseAngle, int begin, int end);
+    void setVertexNormals(SgMesh* mesh);
 };
 }
 
@@ -85,6 +111,10 @@ void MeshNormalGenerator::setMaxCreaseAngle(float angle)
 }
 
 
+/**
+   The normals are not generated when the mesh already has them unless the overwriting is enabled.
+   The face normals and the smoothed normals of large meshes are calculated in parallel.
+*/
 bool MeshNormalGenerator::generateNormals(SgMesh* mesh, float creaseAngle)
 {
     if(!mesh->vertices() || mesh->triangleVertices().empty()){
@@ -94,31 +124,41 @@ bool MeshNormalGenerator::generateNormals(SgMesh* mesh, float creaseAngle)
         return false;
     }
 
-    if(!impl->faceNormals){
-        impl->faceNormals = new SgNormalArray;
-    }
-    impl->calculateFaceNormals(mesh);
-    impl->setVertexNormals(mesh, creaseAngle);
+    TimingProfiler::Scope timingScope("MeshNormalGenerator/Generating normals");
+
+    const SgMesh* constMesh = mesh;
+    const int numTriangles = mesh->numTriangles();
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    
+    impl->faceNormals.resize(numTriangles);
+    scheduler->parallelForRanges(
+        0, numTriangles,
+        boost::bind(&MeshNormalGeneratorImpl::calculateFaceNormals, impl, constMesh, _1, _2), GrainSize);
+
+    impl->makeAdjacentTriangleArrays(constMesh);
+    scheduler->parallelForRanges(
+        0, constMesh->vertices()->size(),
+        boost::bind(&MeshNormalGeneratorImpl::removeSameNormalTriangles, impl, _1, _2), GrainSize);
+
+    creaseAngle = std::max(impl->minCreaseAngle, std::min(impl->maxCreaseAngle, creaseAngle));
+    impl->cornerNormals.resize(numTriangles * 3);
+    scheduler->parallelForRanges(
+        0, numTriangles,
+        boost::bind(&MeshNormalGeneratorImpl::calculateCornerNormals, impl, constMesh, cosf(creaseAngle), _1, _2),
+        GrainSize);
+
+    impl->setVertexNormals(mesh);
 
     return true;
 }
 
 
-void MeshNormalGeneratorImpl::calculateFaceNormals(SgMesh* mesh)
+void MeshNormalGeneratorImpl::calculateFaceNormals(const SgMesh* mesh, int begin, int end)
 {
     const SgVertexArray& vertices = *mesh->vertices();
-    const int numVertices = vertices.size();
-    const int numTriangles = mesh->numTriangles();
-
-    faceNormals->clear();
-    faceNormals->reserve(numTriangles);
-    vertexIndexToTriangleIndicesMap.clear();
-    vertexIndexToTriangleIndicesMap.resize(numVertices);
 
-    for(int i=0; i < numTriangles; ++i){
-
-        SgMesh::TriangleRef triangle = mesh->triangle(i);
-        
+    for(int i=begin; i < end; ++i){
+        SgMesh::ConstTriangleRef triangle = mesh->triangle(i);
         const Vector3f& v0 = vertices[triangle[0]];
         const Vector3f& v1 = vertices[triangle[1]];
         const Vector3f& v2 = vertices[triangle[2]];
@@ -129,101 +169,146 @@ void MeshNormalGeneratorImpl::calculateFaceNormals(SgMesh* mesh)
         }else{
           normal.normalize();
         }
-        faceNormals->push_back(normal);
+        faceNormals[i] = normal;
+    }
+}
+
+
+void MeshNormalGeneratorImpl::makeAdjacentTriangleArrays(const SgMesh* mesh)
+{
+    const int numVertices = mesh->vertices()->size();
+    const SgIndexArray& triangleVertices = mesh->triangleVertices();
+    const int numCorners = triangleVertices.size();
+
+    adjacentOffsets.assign(numVertices + 1, 0);
+    for(int i=0; i < numCorners; ++i){
+        ++adjacentOffsets[triangleVertices[i] + 1];
+    }
+    for(int i=0; i < numVertices; ++i){
+        adjacentOffsets[i + 1] += adjacentOffsets[i];
+    }
+    numAdjacentTriangles.assign(numVertices, 0);
+    adjacentTriangles.resize(numCorners);
+    for(int i=0; i < numCorners; ++i){
+        const int vertexIndex = triangleVertices[i];
+        adjacentTriangles[adjacentOffsets[vertexIndex] + numAdjacentTriangles[vertexIndex]++] = i / 3;
+    }
+}
 
-        for(int j=0; j < 3; ++j){
-            vector<int>& trianglesOfVertex = vertexIndexToTriangleIndicesMap[triangle[j]];
 
-            /**
-               \todo Angle between adjacent edges should be taken into account
-               to generate natural normals
-            */
+/**
+   \todo Angle between adjacent edges should be taken into account
+   to generate natural normals
+*/
+void MeshNormalGeneratorImpl::removeSameNormalTriangles(int begin, int end)
+{
+    for(int vertexIndex = begin; vertexIndex < end; ++vertexIndex){
+        int* triangles = &adjacentTriangles[0] + adjacentOffsets[vertexIndex];
+        const int n = numAdjacentTriangles[vertexIndex];
+        int numUniqueTriangles = 0;
+        for(int i=0; i < n; ++i){
+            const Vector3f& normal = faceNormals[triangles[i]];
             bool isSameNormalFaceFound = false;
-            for(size_t k=0; k < trianglesOfVertex.size(); ++k){
-                const Vector3f& otherNormal = (*faceNormals)[trianglesOfVertex[k]];
+            for(int j=0; j < numUniqueTriangles; ++j){
                 // the same face is not appended
-                if(otherNormal.isApprox(normal, 5.0e-4)){
+                if(faceNormals[triangles[j]].isApprox(normal, 5.0e-4)){
                     isSameNormalFaceFound = true;
                     break;
                 }
             }
             if(!isSameNormalFaceFound){
-                trianglesOfVertex.push_back(i);
+                triangles[numUniqueTriangles++] = triangles[i];
             }
         }
+        numAdjacentTriangles[vertexIndex] = numUniqueTriangles;
     }
 }
-    
 
-void MeshNormalGeneratorImpl::setVertexNormals(SgMesh* mesh, float givenCreaseAngle)
+
+/**
+   The normal of a corner is the avarage of the normals of the faces adjacent to the vertex
+   whose crease angle to the face of the corner is below the crease angle. The angles are
+   compared by their cosines to avoid calculating acos.
+*/
+void MeshNormalGeneratorImpl::calculateCornerNormals
+(const SgMesh* mesh, float cosCreaseAngle, int begin, int end)
 {
-    const float creaseAngle = std::max(minCreaseAngle, std::min(maxCreaseAngle, givenCreaseAngle));
-    
-    const SgVertexArray& vertices = *mesh->vertices();
-    const int numVertices = vertices.size();
+    for(int faceIndex = begin; faceIndex < end; ++faceIndex){
+        SgMesh::ConstTriangleRef triangle = mesh->triangle(faceIndex);
+        const Vector3f& currentFaceNormal = faceNormals[faceIndex];
+        
+        for(int i=0; i < 3; ++i){
+            const int vertexIndex = triangle[i];
+            const int* triangles = &adjacentTriangles[0] + adjacentOffsets[vertexIndex];
+            const int n = numAdjacentTriangles[vertexIndex];
+            Vector3f normal = currentFaceNormal;
+            bool normalIsFaceNormal = true;
+            for(int j=0; j < n; ++j){
+                const Vector3f& adjacentFaceNormal = faceNormals[triangles[j]];
+                const float cosAngle = currentFaceNormal.dot(adjacentFaceNormal)
+                    / (currentFaceNormal.norm() * adjacentFaceNormal.norm());
+                // This is equivalent to the condition 0 < angle < creaseAngle
+                if(cosAngle < 1.0f && cosAngle > cosCreaseAngle){
+                    normal += adjacentFaceNormal;
+                    normalIsFaceNormal = false;
+                }
+            }
+            if(!normalIsFaceNormal){
+                normal.normalize();
+            }
+            cornerNormals[faceIndex * 3 + i] = normal;
+        }
+    }
+}
+
+
+/**
+   A corner normal shares the normal of a vertex of the same triangle if they are same.
+   This has to be processed in the order of the triangles to make the same indices as
+   the sequential processing.
+*/
+void MeshNormalGeneratorImpl::setVertexNormals(SgMesh* mesh)
+{
+    const int numVertices = mesh->vertices()->size();
     const int numTriangles = mesh->numTriangles();
 
     mesh->setNormals(new SgNormalArray());
     SgNormalArray& normals = *mesh->normals();
     SgIndexArray& normalIndices = mesh->normalIndices();
-    normalIndices.clear();
-    normalIndices.reserve(mesh->triangleVertices().size());
+    normalIndices.resize(numTriangles * 3);
 
-    vertexIndexToNormalIndicesMap.clear();
-    vertexIndexToNormalIndicesMap.resize(numVertices);
+    firstNormalOfVertex.assign(numVertices, -1);
+    lastNormalOfVertex.assign(numVertices, -1);
+    nextNormalOfVertex.clear();
 
     for(int faceIndex=0; faceIndex < numTriangles; ++faceIndex){
 
         SgMesh::TriangleRef triangle = mesh->triangle(faceIndex);
 
         for(int i=0; i < 3; ++i){
-
-            const int vertexIndex = triangle[i];
-            const vector<int>& trianglesOfVertex = vertexIndexToTriangleIndicesMap[vertexIndex];
-            const Vector3f& currentFaceNormal = (*faceNormals)[faceIndex];
-            Vector3f normal = currentFaceNormal;
-            bool normalIsFaceNormal = true;
-                
-            // avarage normals of the faces whose crease angle is below the 'creaseAngle' variable
-            for(size_t j=0; j < trianglesOfVertex.size(); ++j){
-                const int adjacentFaceIndex = trianglesOfVertex[j];
-                const Vector3f& adjacentFaceNormal = (*faceNormals)[adjacentFaceIndex];
-                float cosAngle = currentFaceNormal.dot(adjacentFaceNormal)
-                  / (currentFaceNormal.norm() * adjacentFaceNormal.norm());
-                //prevent NaN
-                if (cosAngle >  1.0) cosAngle =  1.0;
-                if (cosAngle < -1.0) cosAngle = -1.0;
-                const float angle = acosf(cosAngle);
-                if(angle > 0.0f && angle < creaseAngle){
-                    normal += adjacentFaceNormal;
-                    normalIsFaceNormal = false;
-                }
-            }
-            if(!normalIsFaceNormal){
-                normal.normalize();
-            }
-            
+            const Vector3f& normal = cornerNormals[faceIndex * 3 + i];
             int normalIndex = -1;
-            
-            for(int j=0; j < 3; ++j){
-                const int vertexIndex2 = triangle[j];
-                const vector<int>& normalIndicesOfVertex = vertexIndexToNormalIndicesMap[vertexIndex2];
-                for(size_t k=0; k < normalIndicesOfVertex.size(); ++k){
-                    int index = normalIndicesOfVertex[k];
+            for(int j=0; j < 3 && normalIndex < 0; ++j){
+                for(int index = firstNormalOfVertex[triangle[j]]; index >= 0; index = nextNormalOfVertex[index]){
                     if(normals[index].isApprox(normal)){
                         normalIndex = index;
-                        goto normalIndexFound;
+                        break;
                     }
                 }
             }
             if(normalIndex < 0){
+                const int vertexIndex = triangle[i];
                 normalIndex = normals.size();
                 normals.push_back(normal);
-                vertexIndexToNormalIndicesMap[vertexIndex].push_back(normalIndex);
+                nextNormalOfVertex.push_back(-1);
+                if(lastNormalOfVertex[vertexIndex] >= 0){
+                    nextNormalOfVertex[lastNormalOfVertex[vertexIndex]] = normalIndex;
+                } else {
+                    firstNormalOfVertex[vertexIndex] = normalIndex;
+                }
+                lastNormalOfVertex[vertexIndex] = normalIndex;
             }
-            
-    normalIndexFound:
-            normalIndices.push_back(normalIndex);
+            normalIndices[faceIndex * 3 + i] = normalIndex;
         }
     }
 }
@@ -0,0 +1,201 @@
+/*!
+  @file
+*/
+
+#include "MeshSimplifier.h"
+#include "MeshNormalGenerator.h"
+#include "SceneDrawables.h"
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// The key is the serial index of a cell
+typedef boost::unordered_map<long long, int> CellIndexMap;
+
+/*
+  A triangle is stored with the smallest vertex index first so that the same triangle
+  given in the different rotations is detected. The orientation is preserved.
+*/
+struct Triangle
+{
+    int v[3];
+
+    Triangle(int v0, int v1, int v2){
+        if(v0 < v1 && v0 < v2){
+            v[0] = v0; v[1] = v1; v[2] = v2;
+        } else if(v1 < v2){
+            v[0] = v1; v[1] = v2; v[2] = v0;
+        } else {
+            v[0] = v2; v[1] = v0; v[2] = v1;
+        }
+    }
+    bool operator==(const Triangle& rhs) const {
+        return v[0] == rhs.v[0] && v[1] == rhs.v[1] && v[2] == rhs.v[2];
+    }
+};
+
+std::size_t hash_value(const Triangle& t)
+{
+    std::size_t seed = 0;
+    boost::hash_combine(seed, t.v[0]);
+    boost::hash_combine(seed, t.v[1]);
+    boost::hash_combine(seed, t.v[2]);
+    return seed;
+}
+
+}
+
+namespace cnoid {
+
+class MeshSimplifierImpl
+{
+public:
+    float creaseAngle;
+    MeshNormalGenerator normalGenerator;
+    CellIndexMap cellIndexMap;
+    vector<int> vertexToCluster;
+    vector<Vector3> clusterPositionSums;
+    vector<int> clusterSizes;
+    boost::unordered_set<Triangle> triangles;
+
+    MeshSimplifierImpl();
+    MeshSimplifierImpl(const MeshSimplifierImpl& org);
+    SgMesh* simplify(const SgMesh* mesh, int resolution);
+};
+
+}
+
+
+MeshSimplifier::MeshSimplifier()
+{
+    impl = new MeshSimplifierImpl;
+}
+
+
+MeshSimplifierImpl::MeshSimplifierImpl()
+{
+    creaseAngle = 3.14159f / 4.0f;
+}
+
+
+MeshSimplifier::MeshSimplifier(const MeshSimplifier& org)
+{
+    impl = new MeshSimplifierImpl(*org.impl);
+}
+
+
+MeshSimplifierImpl::MeshSimplifierImpl(const MeshSimplifierImpl& org)
+{
+    creaseAngle = org.creaseAngle;
+}
+
+
+MeshSimplifier::~MeshSimplifier()
+{
+    delete impl;
+}
+
+
+void MeshSimplifier::setCreaseAngle(float angle)
+{
+    impl->creaseAngle = angle;
+}
+
+
+SgMesh* MeshSimplifier::simplify(const SgMesh* mesh, int resolution)
+{
+    return impl->simplify(mesh, resolution);
+}
+
+
+SgMesh* MeshSimplifierImpl::simplify(const SgMesh* mesh, int resolution)
+{
+    if(!mesh->hasVertices() || mesh->triangleVertices().empty() || resolution < 1){
+        return 0;
+    }
+    
+    const SgVertexArray& orgVertices = *mesh->vertices();
+    const SgIndexArray& orgTriangles = mesh->triangleVertices();
+
+    // The bounding box is computed here instead of using the cached one of the mesh
+    // so that the mesh can be simplified in a thread other than the main thread.
+    Vector3f min = orgVertices[orgTriangles[0]];
+    Vector3f max = min;
+    for(size_t i=1; i < orgTriangles.size(); ++i){
+        const Vector3f& v = orgVertices[orgTriangles[i]];
+        min = min.cwiseMin(v);
+        max = max.cwiseMax(v);
+    }
+    const double cellSize = std::max((max - min).maxCoeff() / resolution, 1.0e-9f);
+    const long long n = resolution + 1;
+
+    vertexToCluster.assign(orgVertices.size(), -1);
+    cellIndexMap.clear();
+    clusterPositionSums.clear();
+    clusterSizes.clear();
+    triangles.clear();
+
+    SgMesh* simplified = new SgMesh;
+    SgIndexArray& newTriangles = simplified->triangleVertices();
+    
+    const int numTriangles = mesh->numTriangles();
+    for(int i=0; i < numTriangles; ++i){
+        int clusters[3];
+        for(int j=0; j < 3; ++j){
+            const int vertexIndex = orgTriangles[i * 3 + j];
+            int& cluster = vertexToCluster[vertexIndex];
+            if(cluster < 0){
+                const Vector3f& v = orgVertices[vertexIndex];
+                const long long ix = std::min((long long)floor((v.x() - min.x()) / cellSize), n - 1);
+                const long long iy = std::min((long long)floor((v.y() - min.y()) / cellSize), n - 1);
+                const long long iz = std::min((long long)floor((v.z() - min.z()) / cellSize), n - 1);
+                const long long cell = (ix * n + iy) * n + iz;
+                std::pair<CellIndexMap::iterator, bool> inserted =
+                    cellIndexMap.insert(CellIndexMap::value_type(cell, clusterSizes.size()));
+                cluster = inserted.first->second;
+                if(inserted.second){
+                    clusterPositionSums.push_back(Vector3::Zero());
+                    clusterSizes.push_back(0);
+                }
+                clusterPositionSums[cluster] += v.cast<double>();
+                clusterSizes[cluster] += 1;
+            }
+            clusters[j] = cluster;
+        }
+        if(clusters[0] != clusters[1] && clusters[1] != clusters[2] && clusters[2] != clusters[0]){
+            if(triangles.insert(Triangle(clusters[0], clusters[1], clusters[2])).second){
+                newTriangles.push_back(clusters[0]);
+                newTriangles.push_back(clusters[1]);
+                newTriangles.push_back(clusters[2]);
+            }
+        }
+    }
+
+    if(newTriangles.empty()){
+        delete simplified;
+        return 0;
+    }
+    
+    SgVertexArray& vertices = *simplified->getOrCreateVertices();
+    const int numClusters = clusterSizes.size();
+    vertices.resize(numClusters);
+    for(int i=0; i < numClusters; ++i){
+        vertices[i] = (clusterPositionSums[i] / clusterSizes[i]).cast<float>();
+    }
+
+    simplified->setSolid(mesh->isSolid());
+    simplified->updateBoundingBox();
+
+    if(mesh->hasNormals()){
+        normalGenerator.generateNormals(simplified, creaseAngle);
+    }
+
+    return simplified;
+}
@@ -0,0 +1,45 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_MESH_SIMPLIFIER_H
+#define CNOID_UTIL_MESH_SIMPLIFIER_H
+
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SgMesh;
+class MeshSimplifierImpl;
+
+/**
+   This class simplifies a triangle mesh by the vertex clustering. The bounding box of the mesh is
+   divided into the cubic cells, the vertices in each cell are merged into their mean position, and
+   the triangles which are degenerated by the merge are removed. The computation time is linear in
+   the number of the triangles, so the heavy meshes of the CAD models can be simplified quickly.
+   The topology of the mesh is not preserved.
+*/
+class CNOID_EXPORT MeshSimplifier
+{
+public:
+    MeshSimplifier();
+    MeshSimplifier(const MeshSimplifier& org);
+    ~MeshSimplifier();
+
+    //! The crease angle used to generate the normals of the simplified mesh
+    void setCreaseAngle(float angle);
+
+    /**
+       @param resolution The number of the cells along the longest side of the bounding box
+       @return A new mesh which only has the vertices, the triangles and the normals.
+       The normals are generated if the given mesh has normals. Null is returned if no triangle remains.
+    */
+    SgMesh* simplify(const SgMesh* mesh, int resolution);
+
+private:
+    MeshSimplifierImpl* impl;
+};
+
+}
+
+#endif
@@ -67,16 +67,15 @@ bool MultiAffine3Seq::loadPlainFormat(const std::string& filename)
     setDimension(loader.numFrames(), 1);
     setTimeStep(loader.timeStep());
 
-    int i = 0;
+    const int n = loader.numFrames();
     Part base = part(0);
-    for(PlainSeqFileLoader::iterator it = loader.begin(); it != loader.end(); ++it){
-        vector<double>& data = *it;
+    for(int i=0; i < n; ++i){
+        const double* data = loader.frame(i);
         base[i].translation() << data[1], data[2], data[3];
         base[i].linear() <<
             data[ 4], data[ 5], data[ 6],
             data[ 7], data[ 8], data[ 9],
             data[10], data[11], data[12];
-        ++i;
     }
 
     return true;
@@ -71,12 +71,11 @@ bool MultiSE3Seq::loadPlainMatrixFormat(const std::string& filename)
     setDimension(loader.numFrames(), m);
     setTimeStep(loader.timeStep());
 
-    int f = 0;
-    Part base = part(0);
-    for(PlainSeqFileLoader::iterator it = loader.begin(); it != loader.end(); ++it){
-        vector<double>& data = *it;
+    const int numFrames = loader.numFrames();
+    for(int f=0; f < numFrames; ++f){
+        const double* data = loader.frame(f);
         int i = 0;
-        Frame frame = MultiSE3Seq::frame(f++);
+        Frame frame = MultiSE3Seq::frame(f);
         for(int j=0; j < m; ++j){
             SE3& x = frame[j];
             x.translation() << data[i++], data[i++], data[i++];
@@ -113,11 +112,10 @@ bool MultiSE3Seq::loadPlainRpyFormat(const std::string& filename)
     setDimension(loader.numFrames(), 1);
     setTimeStep(loader.timeStep());
 
-    int f = 0;
-    Part base = part(0);
-    for(PlainSeqFileLoader::iterator it = loader.begin(); it != loader.end(); ++it){
-        vector<double>& data = *it;
-        Frame frame = MultiSE3Seq::frame(f++);
+    const int numFrames = loader.numFrames();
+    for(int f=0; f < numFrames; ++f){
+        const double* data = loader.frame(f);
+        Frame frame = MultiSE3Seq::frame(f);
         SE3& x = frame[0];
         x.translation() << 0, 0, 0;
         double r, p, y;
@@ -180,20 +178,10 @@ bool MultiSE3Seq::saveTopPartAsPlainMatrixFormat(const std::string& filename)
 
 static inline void writeSE3(YAMLWriter& writer, const SE3& value)
 {
-    writer.startFlowStyleListing();
-
     const Vector3& p = value.translation();
-    writer.putScalar(p.x());
-    writer.putScalar(p.y());
-    writer.putScalar(p.z());
-
     const Quat& q = value.rotation();
-    writer.putScalar(q.w());
-    writer.putScalar(q.x());
-    writer.putScalar(q.y());
-    writer.putScalar(q.z());
-
-    writer.endListing();
+    const double values[] = { p.x(), p.y(), p.z(), q.w(), q.x(), q.y(), q.z() };
+    writer.putFlowStyleListing(values, 7);
 }
     
 
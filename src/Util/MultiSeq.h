@@ -143,6 +143,10 @@ public:
         return Container::colSize();
     }
 
+    virtual size_t memoryUsage() const {
+        return Container::memoryUsage();
+    }
+
     double timeLength() const {
         return numFrames() / frameRate();
     }
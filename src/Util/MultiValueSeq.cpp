@@ -6,11 +6,58 @@
 #include "MultiValueSeq.h"
 #include "PlainSeqFormatLoader.h"
 #include "ValueTree.h"
+#include "YAMLReader.h"
 #include "YAMLWriter.h"
 
 using namespace std;
 using namespace cnoid;
 
+namespace {
+
+class CompactFrameListing : public Listing
+{
+public:
+    int numParts;
+    vector<double> values;
+
+    int numFrames() const { return values.size() / numParts; }
+};
+
+class CompactFrameReader : public YAMLReader::NumericListingHandler
+{
+public:
+    ref_ptr<CompactFrameListing> listing;
+
+    virtual bool beginListing(const Mapping& mapping) {
+        string type;
+        int numParts;
+        if(!mapping.read("type", type) || type != "MultiValueSeq" ||
+           !mapping.read("numParts", numParts) || numParts <= 0){
+            return false;
+        }
+        listing = new CompactFrameListing;
+        listing->numParts = numParts;
+        int numFrames;
+        if(mapping.read("numFrames", numFrames) && numFrames > 0){
+            listing->values.reserve((size_t)numFrames * numParts);
+        }
+        return true;
+    }
+
+    virtual void putRow(const double* values, int size) {
+        vector<double>& v = listing->values;
+        const int n = std::min(size, listing->numParts);
+        v.insert(v.end(), values, values + n);
+        v.resize(v.size() + listing->numParts - n, 0.0);
+    }
+
+    virtual ValueNode* endListing() {
+        return listing.get();
+    }
+};
+
+}
+
 
 MultiValueSeq::MultiValueSeq()
     : BaseSeqType("MultiValueSeq")
@@ -58,9 +105,11 @@ bool MultiValueSeq::loadPlainFormat(const std::string& filename)
     setDimension(loader.numFrames(), loader.numParts());
     setFrameRate(1.0 / loader.timeStep());
 
-    int i = 0;
-    for(PlainSeqFileLoader::iterator it = loader.begin(); it != loader.end(); ++it){
-        copy((it->begin() + 1), it->end(), frame(i++).begin());
+    const int n = loader.numFrames();
+    const int m = loader.numParts();
+    for(int i=0; i < n; ++i){
+        const double* data = loader.frame(i);
+        copy(data + 1, data + 1 + m, frame(i).begin());
     }
 
     return true;
@@ -95,6 +144,12 @@ bool MultiValueSeq::saveAsPlainFormat(const std::string& filename)
 }
 
 
+void MultiValueSeq::setCompactFrameReader(YAMLReader& reader)
+{
+    reader.setNumericListingHandler("frames", new CompactFrameReader);
+}
+
+
 bool MultiValueSeq::doWriteSeq(YAMLWriter& writer)
 {
     if(BaseSeqType::doWriteSeq(writer)){
@@ -103,12 +158,8 @@ bool MultiValueSeq::doWriteSeq(YAMLWriter& writer)
         const int n = numFrames();
         const int m = numParts();
         for(int i=0; i < n; ++i){
-            writer.startFlowStyleListing();
             Frame v = frame(i);
-            for(int j=0; j < m; ++j){
-                writer.putScalar(v[j]);
-            }
-            writer.endListing();
+            writer.putFlowStyleListing(m > 0 ? &v[0] : 0, m);
         }
         writer.endListing();
         return true;
@@ -132,6 +183,17 @@ bool MultiValueSeq::doReadSeq(const Mapping& archive)
         const Listing& values = *archive.findListing("frames");
         if(!values.isValid()){
             addSeqMessage("Actual frame data is missing.");
+        } else if(const CompactFrameListing* compact = dynamic_cast<const CompactFrameListing*>(&values)){
+            const int nFrames = compact->numFrames();
+            const int n = std::min(compact->numParts, nParts);
+            setDimension(nFrames, nParts);
+            const double* src = compact->values.empty() ? 0 : &compact->values[0];
+            for(int i=0; i < nFrames; ++i){
+                Frame v = frame(i);
+                std::copy(src, src + n, v.begin());
+                src += compact->numParts;
+            }
+            return true;
         } else {
             const int nFrames = values.size();
             setDimension(nFrames, nParts);
@@ -11,6 +11,8 @@
 
 namespace cnoid {
 
+class YAMLReader;
+
 class CNOID_EXPORT MultiValueSeq : public MultiSeq<double>
 {
     typedef MultiSeq<double> BaseSeqType;
@@ -29,6 +31,14 @@ public:
     virtual bool loadPlainFormat(const std::string& filename);
     virtual bool saveAsPlainFormat(const std::string& filename);
 
+    /**
+       Makes the reader store the frames of MultiValueSeq mappings in a compact array
+       instead of creating a node for each value. readSeq() reads the frames stored in this way,
+       but they cannot be accessed as the elements of the "frames" listing.
+       The frames are read in the ordinary way if "numParts" is put after "frames".
+    */
+    static void setCompactFrameReader(YAMLReader& reader);
+
 protected:
     virtual bool doWriteSeq(YAMLWriter& writer);
     virtual bool doReadSeq(const Mapping& archive);
@@ -62,12 +62,7 @@ bool MultiVector3Seq::doWriteSeq(YAMLWriter& writer)
             Frame f = frame(i);
             writer.startFlowStyleListing();
             for(int j=0; j < m; ++j){
-                writer.startFlowStyleListing();
-                const Vector3& p = f[j];
-                writer.putScalar(p.x());
-                writer.putScalar(p.y());
-                writer.putScalar(p.z());
-                writer.endListing();
+                writer.putFlowStyleListing(f[j].data(), 3);
             }
             writer.endListing();
         }
@@ -0,0 +1,368 @@
+/*!
+  @file
+*/
+
+#include "OccupancyVoxelMap.h"
+#include "TaskScheduler.h"
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+typedef boost::uint64_t VoxelKey;
+
+// The voxel indices of each axis are packed into 21 bits of a key
+const int KeyBits = 21;
+const int KeyOffset = 1 << (KeyBits - 1);
+
+const int MinNumRaysPerTask = 256;
+
+inline VoxelKey makeKey(const Vector3i& v)
+{
+    return (VoxelKey(v.x() + KeyOffset) << (2 * KeyBits)) | (VoxelKey(v.y() + KeyOffset) << KeyBits) | VoxelKey(v.z() + KeyOffset);
+}
+
+
+inline Vector3i keyToIndices(VoxelKey key)
+{
+    const VoxelKey mask = (VoxelKey(1) << KeyBits) - 1;
+    return Vector3i(
+        static_cast<int>((key >> (2 * KeyBits)) & mask) - KeyOffset,
+        static_cast<int>((key >> KeyBits) & mask) - KeyOffset,
+        static_cast<int>(key & mask) - KeyOffset);
+}
+
+
+inline float logOdds(double p)
+{
+    return static_cast<float>(log(p / (1.0 - p)));
+}
+
+}
+
+namespace cnoid {
+
+class OccupancyVoxelMapImpl
+{
+public:
+    double voxelSize;
+    float hitLogOdds;
+    float missLogOdds;
+    float minLogOdds;
+    float maxLogOdds;
+    float thresholdLogOdds;
+
+    typedef boost::unordered_map<VoxelKey, float> VoxelMap;
+    VoxelMap voxels;
+    mutable boost::mutex mutex;
+
+    // The keys of the voxels traced by each task
+    vector< vector<VoxelKey> > freeKeyBufs;
+    vector< vector<VoxelKey> > occupiedKeyBufs;
+    vector<VoxelKey> freeKeys;
+    vector<VoxelKey> occupiedKeys;
+
+    OccupancyVoxelMapImpl();
+    bool getIndices(const Vector3d& p, Vector3i& out_indices) const;
+    void traceRays(int taskIndex, const Vector3f& origin, const Vector3f* endPoints, const unsigned char* hitFlags,
+                   int begin, int end);
+    void traceRay(const Vector3d& origin, const Vector3d& end, bool isHit,
+                  vector<VoxelKey>& io_freeKeys, vector<VoxelKey>& io_occupiedKeys) const;
+    void insertRays(const Vector3f& origin, const Vector3f* endPoints, int numRays, const unsigned char* hitFlags);
+    float findLogOdds(const Vector3& point) const;
+};
+
+}
+
+
+OccupancyVoxelMap::OccupancyVoxelMap()
+{
+    impl = new OccupancyVoxelMapImpl;
+}
+
+
+OccupancyVoxelMapImpl::OccupancyVoxelMapImpl()
+{
+    voxelSize = 0.05;
+    hitLogOdds = logOdds(0.7);
+    missLogOdds = logOdds(0.4);
+    minLogOdds = logOdds(0.12);
+    maxLogOdds = logOdds(0.97);
+    thresholdLogOdds = 0.0f;
+}
+
+
+OccupancyVoxelMap::~OccupancyVoxelMap()
+{
+    delete impl;
+}
+
+
+void OccupancyVoxelMap::setVoxelSize(double size)
+{
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    if(size > 0.0 && size != impl->voxelSize){
+        impl->voxelSize = size;
+        impl->voxels.clear();
+    }
+}
+
+
+double OccupancyVoxelMap::voxelSize() const
+{
+    return impl->voxelSize;
+}
+
+
+void OccupancyVoxelMap::setHitProbability(double p)
+{
+    impl->hitLogOdds = logOdds(p);
+}
+
+
+void OccupancyVoxelMap::setMissProbability(double p)
+{
+    impl->missLogOdds = logOdds(p);
+}
+
+
+void OccupancyVoxelMap::setProbabilityRange(double min, double max)
+{
+    impl->minLogOdds = logOdds(min);
+    impl->maxLogOdds = logOdds(max);
+}
+
+
+void OccupancyVoxelMap::setOccupancyThreshold(double p)
+{
+    impl->thresholdLogOdds = logOdds(p);
+}
+
+
+void OccupancyVoxelMap::clear()
+{
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    impl->voxels.clear();
+}
+
+
+bool OccupancyVoxelMapImpl::getIndices(const Vector3d& p, Vector3i& out_indices) const
+{
+    for(int i=0; i < 3; ++i){
+        const double x = floor(p[i]);
+        if(!(x >= -KeyOffset && x < KeyOffset)){
+            return false;
+        }
+        out_indices[i] = static_cast<int>(x);
+    }
+    return true;
+}
+
+
+void OccupancyVoxelMap::insertRays(const Vector3f& origin, const Vector3f* endPoints, int numRays, const unsigned char* hitFlags)
+{
+    impl->insertRays(origin, endPoints, numRays, hitFlags);
+}
+
+
+void OccupancyVoxelMapImpl::insertRays
+(const Vector3f& origin, const Vector3f* endPoints, int numRays, const unsigned char* hitFlags)
+{
+    if(numRays <= 0){
+        return;
+    }
+    
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int numTasks = std::max(1, std::min(scheduler->concurrency() * 4, numRays / MinNumRaysPerTask));
+    freeKeyBufs.resize(numTasks);
+    occupiedKeyBufs.resize(numTasks);
+    const int numRaysPerTask = (numRays + numTasks - 1) / numTasks;
+
+    if(numTasks == 1){
+        traceRays(0, origin, endPoints, hitFlags, 0, numRays);
+    } else {
+        TaskGroup tasks;
+        for(int i=1; i < numTasks; ++i){
+            const int begin = i * numRaysPerTask;
+            const int end = std::min(begin + numRaysPerTask, numRays);
+            tasks.run(boost::bind(&OccupancyVoxelMapImpl::traceRays, this, i, origin, endPoints, hitFlags, begin, end));
+        }
+        traceRays(0, origin, endPoints, hitFlags, 0, numRaysPerTask);
+        tasks.wait();
+    }
+
+    // A voxel is updated once in a scan, and the hit has priority over the miss
+    occupiedKeys.clear();
+    freeKeys.clear();
+    for(int i=0; i < numTasks; ++i){
+        occupiedKeys.insert(occupiedKeys.end(), occupiedKeyBufs[i].begin(), occupiedKeyBufs[i].end());
+        freeKeys.insert(freeKeys.end(), freeKeyBufs[i].begin(), freeKeyBufs[i].end());
+    }
+    std::sort(occupiedKeys.begin(), occupiedKeys.end());
+    occupiedKeys.erase(std::unique(occupiedKeys.begin(), occupiedKeys.end()), occupiedKeys.end());
+    std::sort(freeKeys.begin(), freeKeys.end());
+    freeKeys.erase(std::unique(freeKeys.begin(), freeKeys.end()), freeKeys.end());
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    vector<VoxelKey>::const_iterator p = occupiedKeys.begin();
+    for(size_t i=0; i < freeKeys.size(); ++i){
+        const VoxelKey key = freeKeys[i];
+        while(p != occupiedKeys.end() && *p < key){
+            ++p;
+        }
+        if(p != occupiedKeys.end() && *p == key){
+            continue;
+        }
+        float& value = voxels.insert(make_pair(key, 0.0f)).first->second;
+        value = std::max(minLogOdds, value + missLogOdds);
+    }
+    for(size_t i=0; i < occupiedKeys.size(); ++i){
+        float& value = voxels.insert(make_pair(occupiedKeys[i], 0.0f)).first->second;
+        value = std::min(maxLogOdds, value + hitLogOdds);
+    }
+}
+
+
+void OccupancyVoxelMapImpl::traceRays
+(int taskIndex, const Vector3f& origin, const Vector3f* endPoints, const unsigned char* hitFlags, int begin, int end)
+{
+    vector<VoxelKey>& freeKeys = freeKeyBufs[taskIndex];
+    vector<VoxelKey>& occupiedKeys = occupiedKeyBufs[taskIndex];
+    freeKeys.clear();
+    occupiedKeys.clear();
+
+    const double r = 1.0 / voxelSize;
+    const Vector3d o = origin.cast<double>() * r;
+    for(int i=begin; i < end; ++i){
+        const Vector3f& p = endPoints[i];
+        if(p.allFinite()){
+            traceRay(o, p.cast<double>() * r, hitFlags ? hitFlags[i] : true, freeKeys, occupiedKeys);
+        }
+    }
+
+    // The rays of a scan share many voxels near the origin, so the keys are reduced in each task
+    std::sort(freeKeys.begin(), freeKeys.end());
+    freeKeys.erase(std::unique(freeKeys.begin(), freeKeys.end()), freeKeys.end());
+    std::sort(occupiedKeys.begin(), occupiedKeys.end());
+    occupiedKeys.erase(std::unique(occupiedKeys.begin(), occupiedKeys.end()), occupiedKeys.end());
+}
+
+
+/**
+   The voxels are traversed by the algorithm of Amanatides and Woo.
+   The coordinates are given in the unit of the voxel size.
+*/
+void OccupancyVoxelMapImpl::traceRay
+(const Vector3d& origin, const Vector3d& end, bool isHit, vector<VoxelKey>& io_freeKeys, vector<VoxelKey>& io_occupiedKeys) const
+{
+    Vector3i v, last;
+    if(!getIndices(origin, v) || !getIndices(end, last)){
+        return;
+    }
+    const Vector3d d = end - origin;
+    Vector3i step;
+    Vector3d tMax;
+    Vector3d tDelta;
+    const double inf = std::numeric_limits<double>::infinity();
+    for(int i=0; i < 3; ++i){
+        if(d[i] > 0.0){
+            step[i] = 1;
+            tDelta[i] = 1.0 / d[i];
+            tMax[i] = (v[i] + 1 - origin[i]) * tDelta[i];
+        } else if(d[i] < 0.0){
+            step[i] = -1;
+            tDelta[i] = -1.0 / d[i];
+            tMax[i] = (origin[i] - v[i]) * tDelta[i];
+        } else {
+            step[i] = 0;
+            tDelta[i] = inf;
+            tMax[i] = inf;
+        }
+    }
+    const int numSteps = (last - v).cwiseAbs().sum();
+    for(int i=0; i < numSteps && v != last; ++i){
+        io_freeKeys.push_back(makeKey(v));
+        int axis;
+        tMax.minCoeff(&axis);
+        v[axis] += step[axis];
+        tMax[axis] += tDelta[axis];
+    }
+    if(isHit){
+        io_occupiedKeys.push_back(makeKey(last));
+    } else {
+        io_freeKeys.push_back(makeKey(last));
+    }
+}
+
+
+float OccupancyVoxelMapImpl::findLogOdds(const Vector3& point) const
+{
+    Vector3i v;
+    if(getIndices(point / voxelSize, v)){
+        VoxelMap::const_iterator p = voxels.find(makeKey(v));
+        if(p != voxels.end()){
+            return p->second;
+        }
+    }
+    return std::numeric_limits<float>::quiet_NaN();
+}
+
+
+double OccupancyVoxelMap::occupancyProbability(const Vector3& point) const
+{
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    const float l = impl->findLogOdds(point);
+    if(l != l){
+        return -1.0;
+    }
+    return 1.0 - 1.0 / (1.0 + exp(l));
+}
+
+
+bool OccupancyVoxelMap::isOccupied(const Vector3& point) const
+{
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    return impl->findLogOdds(point) > impl->thresholdLogOdds;
+}
+
+
+int OccupancyVoxelMap::numKnownVoxels() const
+{
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    return impl->voxels.size();
+}
+
+
+int OccupancyVoxelMap::numOccupiedVoxels() const
+{
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    int n = 0;
+    for(OccupancyVoxelMapImpl::VoxelMap::const_iterator p = impl->voxels.begin(); p != impl->voxels.end(); ++p){
+        if(p->second > impl->thresholdLogOdds){
+            ++n;
+        }
+    }
+    return n;
+}
+
+
+void OccupancyVoxelMap::getOccupiedVoxelCenters(SgVertexArray& out_centers) const
+{
+    out_centers.clear();
+    boost::lock_guard<boost::mutex> lock(impl->mutex);
+    const float s = impl->voxelSize;
+    for(OccupancyVoxelMapImpl::VoxelMap::const_iterator p = impl->voxels.begin(); p != impl->voxels.end(); ++p){
+        if(p->second > impl->thresholdLogOdds){
+            out_centers.push_back((keyToIndices(p->first).cast<float>() + Vector3f::Constant(0.5f)) * s);
+        }
+    }
+}
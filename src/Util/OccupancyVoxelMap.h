@@ -0,0 +1,77 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_OCCUPANCY_VOXEL_MAP_H
+#define CNOID_UTIL_OCCUPANCY_VOXEL_MAP_H
+
+#include "SceneDrawables.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class OccupancyVoxelMapImpl;
+
+/**
+   A sparse voxel map of the occupancy probabilities built from the rays of the range sensors.
+   The probability of a voxel is stored in the log-odds form. The voxels which the rays pass through
+   are updated as free and the voxels of the end points of the rays are updated as occupied.
+   The rays of a scan are traced in parallel, and a voxel is updated only once in a scan.
+
+   The map can be accessed from multiple threads. The insertion of the rays and the queries
+   are serialized by a mutex which is only locked while the traced voxels are written into the map.
+*/
+class CNOID_EXPORT OccupancyVoxelMap : public Referenced
+{
+public:
+    OccupancyVoxelMap();
+    ~OccupancyVoxelMap();
+
+    //! The map is cleared when the voxel size is changed. The default size is 0.05.
+    void setVoxelSize(double size);
+    double voxelSize() const;
+
+    /**
+       The probabilities applied to a voxel when a ray ends in it and when a ray passes through it.
+       The default values are 0.7 and 0.4.
+    */
+    void setHitProbability(double p);
+    void setMissProbability(double p);
+
+    //! The probabilities of the voxels are clamped in this range. The default range is [0.12, 0.97].
+    void setProbabilityRange(double min, double max);
+
+    //! The voxels whose probabilities are larger than this value are occupied. The default value is 0.5.
+    void setOccupancyThreshold(double p);
+
+    void clear();
+
+    /**
+       @param origin The origin of the rays in the map coordinate
+       @param endPoints The end points of the rays in the map coordinate
+       @param hitFlags If this is given, the rays whose flags are zero are the ones which did not hit anything,
+       and the voxels of their end points are updated as free.
+    */
+    void insertRays(const Vector3f& origin, const Vector3f* endPoints, int numRays, const unsigned char* hitFlags = 0);
+
+    //! @return The occupancy probability of the voxel which contains the point, or -1 if the voxel is unknown
+    double occupancyProbability(const Vector3& point) const;
+    bool isOccupied(const Vector3& point) const;
+
+    int numKnownVoxels() const;
+    int numOccupiedVoxels() const;
+
+    void getOccupiedVoxelCenters(SgVertexArray& out_centers) const;
+
+private:
+    OccupancyVoxelMapImpl* impl;
+
+    OccupancyVoxelMap(const OccupancyVoxelMap& org);
+    OccupancyVoxelMap& operator=(const OccupancyVoxelMap& rhs);
+};
+
+typedef ref_ptr<OccupancyVoxelMap> OccupancyVoxelMapPtr;
+
+}
+
+#endif
@@ -4,68 +4,204 @@
 */
 
 #include "PlainSeqFormatLoader.h"
-#include <fstream>
-#include <boost/tokenizer.hpp>
+#include "StringToNumber.h"
+#include "TaskScheduler.h"
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cstring>
 
 using namespace std;
 using namespace boost;
 using namespace cnoid;
 
+namespace {
+
+enum LineStatus { LINE_OK, INVALID_VALUE, DIFFERENT_SIZE_COLUMNS };
+
+inline bool isSpace(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v');
+}
+
+int countColumns(const char* pos, const char* end)
+{
+    int n = 0;
+    while(true){
+        while(pos != end && isSpace(*pos)){
+            ++pos;
+        }
+        if(pos == end || *pos == '\n'){
+            break;
+        }
+        while(pos != end && *pos != '\n' && !isSpace(*pos)){
+            ++pos;
+        }
+        ++n;
+    }
+    return n;
+}
+
+/**
+   The values are converted directly from the text, which is not null-terminated,
+   by copying each token into a small buffer.
+*/
+LineStatus parseLine(const char* pos, const char* end, double* out_values, int numColumns)
+{
+    char buf[64];
+    int n = 0;
+    while(true){
+        while(pos != end && isSpace(*pos)){
+            ++pos;
+        }
+        if(pos == end || *pos == '\n'){
+            break;
+        }
+        const char* token = pos;
+        while(pos != end && *pos != '\n' && !isSpace(*pos)){
+            ++pos;
+        }
+        if(n == numColumns){
+            return DIFFERENT_SIZE_COLUMNS;
+        }
+        const size_t length = pos - token;
+        if(length >= sizeof(buf)){
+            return INVALID_VALUE;
+        }
+        memcpy(buf, token, length);
+        buf[length] = '\0';
+        char* tail;
+        out_values[n++] = stringToDouble(buf, &tail);
+        if(tail != buf + length){
+            return INVALID_VALUE;
+        }
+    }
+    return (n == numColumns) ? LINE_OK : DIFFERENT_SIZE_COLUMNS;
+}
+
+struct LineParser
+{
+    const vector<const char*>& lines;
+    const char* end;
+    double* data;
+    int numColumns;
+    boost::mutex errorMutex;
+    int errorLineIndex;
+    LineStatus errorStatus;
+
+    LineParser(const vector<const char*>& lines, const char* end, double* data, int numColumns)
+        : lines(lines), end(end), data(data), numColumns(numColumns) {
+        errorLineIndex = -1;
+        errorStatus = LINE_OK;
+    }
+
+    void parse(int lineBegin, int lineEnd) {
+        for(int i=lineBegin; i < lineEnd; ++i){
+            LineStatus status = parseLine(lines[i], end, data + i * numColumns, numColumns);
+            if(status != LINE_OK){
+                boost::mutex::scoped_lock lock(errorMutex);
+                if(errorLineIndex < 0 || i < errorLineIndex){
+                    errorLineIndex = i;
+                    errorStatus = status;
+                }
+                return;
+            }
+        }
+    }
+};
+
+}
+
+
+PlainSeqFileLoader::PlainSeqFileLoader()
+{
+    numColumns_ = 0;
+    numFrames_ = 0;
+    timeStep_ = 0.01;
+}
+
 
 bool PlainSeqFileLoader::load(const std::string& filename)
 {
-    ifstream is(filename.c_str());
-  
-    string errorMessageBase("\"");
-    errorMessageBase += filename + "\"";
-  
-    if(!is){
-        errorMessage_ = errorMessageBase + " cannot be opened.";
+    iostreams::mapped_file_source file;
+    try {
+        if(filesystem::file_size(filesystem::path(filename)) > 0){
+            file.open(filename);
+        }
+    } catch(const std::exception&){
+        errorMessage_ = "\"" + filename + "\" cannot be opened.";
         return false;
     }
-  
-    size_t nColumns = 0;
-    size_t nLines = 0;
-  
-    typedef char_separator<char> Separator;
-    typedef tokenizer<Separator> Tokenizer;
-    Separator sep(" \t\r\n");
-  
-    seq.clear();
-  
-    string line;
-    while(getline(is, line)){
-        nLines++;
-        seq.push_back(vector<double>(nColumns));
-        vector<double>& v = seq.back();
-        v.clear();
-        Tokenizer tokens(line, sep);
-        for(Tokenizer::iterator it = tokens.begin(); it != tokens.end(); ++it){
-            v.push_back(lexical_cast<double>(*it));
-        }
+
+    if(!file.is_open()){
+        return load(0, 0, filename);
+    }
+    return load(file.data(), file.size(), filename);
+}
+
+
+bool PlainSeqFileLoader::load(const char* text, std::size_t size, const std::string& name)
+{
+    string errorMessageBase("\"");
+    errorMessageBase += name + "\"";
+
+    data.clear();
+    numColumns_ = 0;
+    numFrames_ = 0;
     
-        if(nColumns == 0){
-            nColumns = v.size();
-        } else if(v.size() != nColumns){
-            errorMessage_ = errorMessageBase + " contains different size columns";
-            return false;
+    const char* end = text + size;
+    vector<const char*> lines;
+    const char* pos = text;
+    while(pos != end){
+        const char* lineEnd = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if(!lineEnd){
+            lineEnd = end;
         }
+        while(pos != lineEnd && isSpace(*pos)){
+            ++pos;
+        }
+        if(pos != lineEnd && *pos != '%' && *pos != '#'){
+            lines.push_back(pos);
+        }
+        pos = (lineEnd == end) ? end : (lineEnd + 1);
     }
 
-    if(nColumns < 2 || nLines < 1){
+    const int numLines = lines.size();
+    const int numColumns = (numLines > 0) ? countColumns(lines[0], end) : 0;
+
+    if(numColumns < 2){
         errorMessage_ = errorMessageBase + ": Empty sequence.";
         return false;
     }
-  
-    numParts_ = nColumns - 1;
-    numFrames_ = nLines;
+
+    data.resize(numLines * numColumns);
+
+    LineParser parser(lines, end, &data[0], numColumns);
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int grainSize = std::max(1, std::min(1024, numLines / (scheduler->concurrency() * 4)));
+    scheduler->parallelForRanges(
+        0, numLines, boost::bind(&LineParser::parse, &parser, _1, _2), grainSize);
+
+    if(parser.errorLineIndex >= 0){
+        const int lineNumber = std::count(text, lines[parser.errorLineIndex], '\n') + 1;
+        if(parser.errorStatus == DIFFERENT_SIZE_COLUMNS){
+            errorMessage_ = errorMessageBase + " contains different size columns";
+        } else {
+            errorMessage_ = errorMessageBase + " contains an invalid value";
+        }
+        errorMessage_ += " at line " + lexical_cast<string>(lineNumber) + ".";
+        data.clear();
+        return false;
+    }
+    
+    numColumns_ = numColumns;
+    numFrames_ = numLines;
 
     if(numFrames_ >= 2){
-        iterator it = seq.begin();
-        double time0 = (*it)[0];
-        double time1 = (*(++it))[0];
-        timeStep_ = time1 - time0;
+        timeStep_ = frame(1)[0] - frame(0)[0];
         if(timeStep_ <= 0.0){
             errorMessage_ = errorMessageBase + ": Time values are not arranged.";
             return false;
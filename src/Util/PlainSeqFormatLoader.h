@@ -6,35 +6,48 @@
 #ifndef CNOID_UTIL_PLAIN_SEQ_FILE_LOADER_H_INCLUDED
 #define CNOID_UTIL_PLAIN_SEQ_FILE_LOADER_H_INCLUDED
 
-#include <list>
 #include <vector>
 #include <string>
+#include <cstddef>
 #include "exportdecl.h"
 
 namespace cnoid {
 
+/**
+   The loader of the text files where each line has the time and the values of a frame.
+   The file is mapped into memory and the lines are converted in parallel into a contiguous array.
+   Empty lines and the lines beginning with '%' or '#' are skipped.
+*/
 class CNOID_EXPORT PlainSeqFileLoader
 {
 public:
-        
-    typedef std::list< std::vector<double> > Seq;
-    typedef Seq::iterator iterator;
+
+    PlainSeqFileLoader();
         
     bool load(const std::string& filename);
-        
-    inline iterator begin() { return seq.begin(); }
-    inline iterator end() { return seq.end(); }
-        
-    inline int numParts() { return numParts_; }
-    inline int numFrames() { return numFrames_; }
-    inline double timeStep() { return timeStep_; }
+
+    /**
+       Loads the text given in memory instead of a file.
+       @param name The name used in the error message
+    */
+    bool load(const char* text, std::size_t size, const std::string& name);
+
+    int numColumns() const { return numColumns_; }
+    inline int numParts() const { return numColumns_ - 1; }
+    inline int numFrames() const { return numFrames_; }
+    inline double timeStep() const { return timeStep_; }
+
+    /**
+       @return The values of the frame. The first element is the time.
+    */
+    const double* frame(int index) const { return &data[index * numColumns_]; }
 
     const std::string& errorMessage();
         
 private:
-        
-    Seq seq;
-    int numParts_;
+
+    std::vector<double> data;
+    int numColumns_;
     int numFrames_;
     double timeStep_;
     std::string errorMessage_;
@@ -0,0 +1,278 @@
+/*!
+  @file
+*/
+
+#include "PointKdTree.h"
+#include "TaskScheduler.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const int MaxNumLeafPoints = 16;
+
+// The subtrees which have more points than this are built by separate tasks
+const int MinNumPointsForTask = 65536;
+
+struct AxisLess
+{
+    int axis;
+    AxisLess(int axis) : axis(axis) { }
+    bool operator()(const PointKdTree::Entry& e1, const PointKdTree::Entry& e2) const {
+        return e1.point[axis] < e2.point[axis];
+    }
+};
+
+}
+
+
+PointKdTree::PointKdTree()
+{
+
+}
+
+
+void PointKdTree::clear()
+{
+    entries.clear();
+    nodes.clear();
+}
+
+
+void PointKdTree::build(const SgVertexArray& points)
+{
+    clear();
+
+    const int n = points.size();
+    if(n == 0){
+        return;
+    }
+    entries.resize(n);
+    Vector3f min = points[0];
+    Vector3f max = min;
+    for(int i=0; i < n; ++i){
+        Entry& entry = entries[i];
+        entry.point = points[i];
+        entry.index = i;
+        min = min.cwiseMin(entry.point);
+        max = max.cwiseMax(entry.point);
+    }
+
+    // The points are divided at the median, so the depth of the tree is fixed by the number of the points
+    int depth = 0;
+    int maxNumNodePoints = n;
+    while(maxNumNodePoints > MaxNumLeafPoints){
+        maxNumNodePoints = (maxNumNodePoints + 1) / 2;
+        ++depth;
+    }
+    // Some of the nodes at the deepest level are not used when the number of the points is not a power of two
+    Node unused;
+    unused.min.setZero();
+    unused.max.setZero();
+    unused.begin = 0;
+    unused.end = 0;
+    unused.splitAxis = -1;
+    nodes.resize((2 << depth) - 1, unused);
+
+    buildNode(0, 0, n, min, max);
+
+    // The bounding boxes are given from the leaves because the child indices are larger than the parent's
+    for(int i = nodes.size() - 1; i >= 0; --i){
+        Node& node = nodes[i];
+        if(node.end <= node.begin){
+            continue;
+        }
+        if(node.splitAxis < 0){
+            node.min = node.max = entries[node.begin].point;
+            for(int j = node.begin + 1; j < node.end; ++j){
+                const Vector3f& p = entries[j].point;
+                node.min = node.min.cwiseMin(p);
+                node.max = node.max.cwiseMax(p);
+            }
+        } else {
+            const Node& left = nodes[2 * i + 1];
+            const Node& right = nodes[2 * i + 2];
+            node.min = left.min.cwiseMin(right.min);
+            node.max = left.max.cwiseMax(right.max);
+        }
+    }
+}
+
+
+/**
+   @param min, max The bounds of the cell of the node given by the splitting planes of the ancestors
+*/
+void PointKdTree::buildNode(int nodeIndex, int begin, int end, const Vector3f& min, const Vector3f& max)
+{
+    Node& node = nodes[nodeIndex];
+    node.begin = begin;
+    node.end = end;
+    node.splitAxis = -1;
+
+    if(end - begin <= MaxNumLeafPoints){
+        return;
+    }
+
+    // The points are divided along the longest side of the cell
+    int axis;
+    (max - min).maxCoeff(&axis);
+
+    const int mid = (begin + end + 1) / 2;
+    std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end, AxisLess(axis));
+    const float splitValue = entries[mid].point[axis];
+    node.splitAxis = axis;
+    node.splitValue = splitValue;
+
+    Vector3f leftMax = max;
+    leftMax[axis] = splitValue;
+    Vector3f rightMin = min;
+    rightMin[axis] = splitValue;
+    
+    if(end - begin > MinNumPointsForTask){
+        TaskGroup tasks;
+        tasks.run(boost::bind(&PointKdTree::buildNode, this, 2 * nodeIndex + 1, begin, mid, min, leftMax));
+        buildNode(2 * nodeIndex + 2, mid, end, rightMin, max);
+        tasks.wait();
+    } else {
+        buildNode(2 * nodeIndex + 1, begin, mid, min, leftMax);
+        buildNode(2 * nodeIndex + 2, mid, end, rightMin, max);
+    }
+}
+
+
+float PointKdTree::squaredDistanceToNode(const Node& node, const Vector3f& point) const
+{
+    return (point.cwiseMax(node.min).cwiseMin(node.max) - point).squaredNorm();
+}
+
+
+int PointKdTree::findNearestPoint(const Vector3f& point, float maxDistance) const
+{
+    if(nodes.empty()){
+        return -1;
+    }
+    int nearest = -1;
+    float squaredDistance = maxDistance * maxDistance;
+    findNearestPointIter(0, point, nearest, squaredDistance);
+    return nearest;
+}
+
+
+void PointKdTree::findNearestPointIter(int nodeIndex, const Vector3f& point, int& io_nearest, float& io_squaredDistance) const
+{
+    const Node& node = nodes[nodeIndex];
+    if(squaredDistanceToNode(node, point) > io_squaredDistance){
+        return;
+    }
+    if(node.splitAxis < 0){
+        for(int i = node.begin; i < node.end; ++i){
+            const Entry& entry = entries[i];
+            const float d2 = (entry.point - point).squaredNorm();
+            if(d2 <= io_squaredDistance){
+                io_nearest = entry.index;
+                io_squaredDistance = d2;
+            }
+        }
+    } else {
+        // The child on the side of the point is visited first to shrink the search radius early
+        const int left = 2 * nodeIndex + 1;
+        if(point[node.splitAxis] < node.splitValue){
+            findNearestPointIter(left, point, io_nearest, io_squaredDistance);
+            findNearestPointIter(left + 1, point, io_nearest, io_squaredDistance);
+        } else {
+            findNearestPointIter(left + 1, point, io_nearest, io_squaredDistance);
+            findNearestPointIter(left, point, io_nearest, io_squaredDistance);
+        }
+    }
+}
+
+
+void PointKdTree::findNearestPoints
+(const Vector3f& point, int numPoints, std::vector<int>& out_indices, std::vector<float>* out_squaredDistances) const
+{
+    // A max-heap of the squared distances and the indices of the nearest points found so far
+    vector<pair<float, int> > heap;
+    if(!nodes.empty() && numPoints > 0){
+        heap.reserve(numPoints);
+        findNearestPointsIter(0, point, numPoints, heap);
+    }
+    std::sort_heap(heap.begin(), heap.end());
+
+    const int n = heap.size();
+    out_indices.resize(n);
+    for(int i=0; i < n; ++i){
+        out_indices[i] = heap[i].second;
+    }
+    if(out_squaredDistances){
+        out_squaredDistances->resize(n);
+        for(int i=0; i < n; ++i){
+            (*out_squaredDistances)[i] = heap[i].first;
+        }
+    }
+}
+
+
+void PointKdTree::findNearestPointsIter
+(int nodeIndex, const Vector3f& point, int numPoints, std::vector<std::pair<float, int> >& io_heap) const
+{
+    const Node& node = nodes[nodeIndex];
+    const bool isFull = (static_cast<int>(io_heap.size()) == numPoints);
+    if(isFull && squaredDistanceToNode(node, point) >= io_heap.front().first){
+        return;
+    }
+    if(node.splitAxis < 0){
+        for(int i = node.begin; i < node.end; ++i){
+            const Entry& entry = entries[i];
+            const float d2 = (entry.point - point).squaredNorm();
+            if(static_cast<int>(io_heap.size()) < numPoints){
+                io_heap.push_back(make_pair(d2, entry.index));
+                std::push_heap(io_heap.begin(), io_heap.end());
+            } else if(d2 < io_heap.front().first){
+                std::pop_heap(io_heap.begin(), io_heap.end());
+                io_heap.back() = make_pair(d2, entry.index);
+                std::push_heap(io_heap.begin(), io_heap.end());
+            }
+        }
+    } else {
+        const int left = 2 * nodeIndex + 1;
+        if(point[node.splitAxis] < node.splitValue){
+            findNearestPointsIter(left, point, numPoints, io_heap);
+            findNearestPointsIter(left + 1, point, numPoints, io_heap);
+        } else {
+            findNearestPointsIter(left + 1, point, numPoints, io_heap);
+            findNearestPointsIter(left, point, numPoints, io_heap);
+        }
+    }
+}
+
+
+void PointKdTree::findPointsInSphere(const Vector3f& center, float radius, std::vector<int>& out_indices) const
+{
+    if(!nodes.empty()){
+        findPointsInSphereIter(0, center, radius * radius, out_indices);
+    }
+}
+
+
+void PointKdTree::findPointsInSphereIter
+(int nodeIndex, const Vector3f& center, float squaredRadius, std::vector<int>& out_indices) const
+{
+    const Node& node = nodes[nodeIndex];
+    if(squaredDistanceToNode(node, center) > squaredRadius){
+        return;
+    }
+    if(node.splitAxis < 0){
+        for(int i = node.begin; i < node.end; ++i){
+            const Entry& entry = entries[i];
+            if((entry.point - center).squaredNorm() <= squaredRadius){
+                out_indices.push_back(entry.index);
+            }
+        }
+    } else {
+        findPointsInSphereIter(2 * nodeIndex + 1, center, squaredRadius, out_indices);
+        findPointsInSphereIter(2 * nodeIndex + 2, center, squaredRadius, out_indices);
+    }
+}
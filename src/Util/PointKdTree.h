@@ -0,0 +1,82 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_POINT_KD_TREE_H
+#define CNOID_UTIL_POINT_KD_TREE_H
+
+#include "SceneDrawables.h"
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   A k-d tree of the points of a vertex array for the nearest point and range searches.
+   The tree stores the points in its own order with their indices in the array so that the
+   building and the searches access the memory sequentially, and it does not refer to the
+   array after it is built. The tree must be rebuilt to search the modified points.
+   The top levels of the tree are built in parallel.
+*/
+class CNOID_EXPORT PointKdTree
+{
+public:
+    PointKdTree();
+
+    void build(const SgVertexArray& points);
+    void clear();
+    bool empty() const { return nodes.empty(); }
+
+    //! The size of the tree in bytes
+    size_t memoryUsage() const {
+        return entries.capacity() * sizeof(Entry) + nodes.capacity() * sizeof(Node);
+    }
+
+    /**
+       @return The index of the nearest point whose distance from the given point is not larger than maxDistance,
+       or -1 if there is no such point
+    */
+    int findNearestPoint(const Vector3f& point, float maxDistance) const;
+
+    /**
+       The indices of the nearest points are given in order of the distance.
+       The squared distances of the points are also given if out_squaredDistances is not null.
+    */
+    void findNearestPoints(const Vector3f& point, int numPoints,
+                           std::vector<int>& out_indices, std::vector<float>* out_squaredDistances = 0) const;
+
+    //! The indices of the points in the sphere are appended to out_indices
+    void findPointsInSphere(const Vector3f& center, float radius, std::vector<int>& out_indices) const;
+
+    struct Entry
+    {
+        Vector3f point;
+        int index;
+    };
+
+private:
+    struct Node
+    {
+        Vector3f min;
+        Vector3f max;
+        int begin;
+        int end;
+        // -1 if the node is a leaf
+        int splitAxis;
+        float splitValue;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<Node> nodes;
+
+    void buildNode(int nodeIndex, int begin, int end, const Vector3f& min, const Vector3f& max);
+    void findNearestPointIter(int nodeIndex, const Vector3f& point, int& io_nearest, float& io_squaredDistance) const;
+    void findNearestPointsIter(int nodeIndex, const Vector3f& point, int numPoints,
+                               std::vector<std::pair<float, int> >& io_heap) const;
+    void findPointsInSphereIter(int nodeIndex, const Vector3f& center, float squaredRadius, std::vector<int>& out_indices) const;
+    float squaredDistanceToNode(const Node& node, const Vector3f& point) const;
+};
+
+}
+
+#endif
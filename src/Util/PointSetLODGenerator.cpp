@@ -0,0 +1,712 @@
+/*!
+  @file
+*/
+
+#include "PointSetLODGenerator.h"
+#include "SceneDrawables.h"
+#include "FileMappedMemory.h"
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/bind.hpp>
+#include <deque>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const int MaxNumLeafPoints = 32768;
+const int NumSampledPoints = 16384;
+const int MaxDepth = 20;
+
+// A node is refined when the spacing of its points is larger than this on the screen
+const double MaxPointSpacingPixels = 1.5;
+
+struct Node
+{
+    Vector3f min;
+    Vector3f max;
+    float spacing;
+    size_t offset;
+    int numPoints;
+    int firstChild;
+    int numChildren;
+
+    // These are used by the main thread
+    SgPointSetPtr pointSet;
+    int lastUsedFrame;
+
+    bool isLeaf() const { return numChildren == 0; }
+};
+
+/*
+  The points of the nodes are stored in the order of the nodes. The vertices, the colors and the
+  normals are stored in separate sections of the storage.
+*/
+class Octree
+{
+public:
+    vector<Node> nodes;
+    float* storage;
+    bool isFileMapped;
+    size_t numStoredPoints;
+    bool hasColors;
+    bool hasNormals;
+
+    Octree() : storage(0), isFileMapped(false), numStoredPoints(0), hasColors(false), hasNormals(false) { }
+
+    ~Octree(){
+        if(isFileMapped){
+            deallocateFileMappedMemory(storage);
+        } else {
+            delete[] storage;
+        }
+    }
+
+    bool allocateStorage(){
+        const size_t numFloats = numStoredPoints * 3 * (1 + (hasColors ? 1 : 0) + (hasNormals ? 1 : 0));
+        storage = static_cast<float*>(allocateFileMappedMemory(numFloats * sizeof(float)));
+        if(storage){
+            isFileMapped = true;
+        } else {
+            storage = new(std::nothrow) float[numFloats];
+        }
+        return storage != 0;
+    }
+
+    Vector3f* vertices() { return reinterpret_cast<Vector3f*>(storage); }
+    Vector3f* colors() { return vertices() + numStoredPoints; }
+    Vector3f* normals() { return vertices() + numStoredPoints * (hasColors ? 2 : 1); }
+};
+typedef boost::shared_ptr<Octree> OctreePtr;
+
+struct Entry
+{
+    weak_ref_ptr<SgPointSet> pointSet;
+    OctreePtr octree;
+    // Incremented when the point set is updated
+    int generation;
+    // The generation of the point set for which the last octree was built
+    int builtGeneration;
+    bool isJobPending;
+    int frame;
+    size_t numLoadedPoints;
+    ScopedConnection connection;
+
+    Entry(SgPointSet* pointSet)
+        : pointSet(pointSet), generation(0), builtGeneration(-1), isJobPending(false), frame(0), numLoadedPoints(0) { }
+
+    void onPointSetUpdated(){
+        ++generation;
+    }
+};
+typedef boost::shared_ptr<Entry> EntryPtr;
+
+/*
+  The arrays of a job are the copies of the ones of the original point set, which share the elements
+  with the original ones, so that the original point set is not accessed from the background thread.
+*/
+struct Job
+{
+    EntryPtr entry;
+    int generation;
+    SgVertexArrayPtr vertices;
+    SgColorArrayPtr colors;
+    SgNormalArrayPtr normals;
+    OctreePtr octree;
+};
+typedef boost::shared_ptr<Job> JobPtr;
+
+
+class OctreeBuilder
+{
+public:
+    const SgVertexArray& vertices;
+    vector<int> order;
+    vector<int> buf;
+    // The range of the points in the order for each node
+    vector<int> nodeBegins;
+    Octree& octree;
+
+    OctreeBuilder(const SgVertexArray& vertices, Octree& octree)
+        : vertices(vertices), octree(octree) { }
+
+    void build(const SgColorArray* colors, const SgNormalArray* normals);
+    void buildNode(int nodeIndex, int begin, int end, const Vector3f& center, float halfSize, int depth);
+    void storePoints(const SgColorArray* colors, const SgNormalArray* normals);
+};
+
+
+void OctreeBuilder::build(const SgColorArray* colors, const SgNormalArray* normals)
+{
+    const int n = vertices.size();
+    order.resize(n);
+    for(int i=0; i < n; ++i){
+        order[i] = i;
+    }
+    buf.resize(n);
+
+    Vector3f min = vertices[0];
+    Vector3f max = vertices[0];
+    for(int i=1; i < n; ++i){
+        min = min.cwiseMin(vertices[i]);
+        max = max.cwiseMax(vertices[i]);
+    }
+    const Vector3f center = (min + max) / 2.0f;
+    const float halfSize = std::max((max - min).maxCoeff() / 2.0f, 1.0e-6f);
+
+    octree.nodes.resize(1);
+    nodeBegins.resize(1);
+    buildNode(0, 0, n, center, halfSize, 0);
+
+    buf.clear();
+    storePoints(colors, normals);
+}
+
+
+void OctreeBuilder::buildNode(int nodeIndex, int begin, int end, const Vector3f& center, float halfSize, int depth)
+{
+    Node& node = octree.nodes[nodeIndex];
+    node.numPoints = end - begin;
+    node.firstChild = 0;
+    node.numChildren = 0;
+    node.spacing = 0.0f;
+    node.lastUsedFrame = 0;
+    nodeBegins[nodeIndex] = begin;
+
+    if(end - begin <= MaxNumLeafPoints || depth >= MaxDepth){
+        return;
+    }
+
+    // The counting sort of the points by the octants
+    int counts[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for(int i=begin; i < end; ++i){
+        const Vector3f& p = vertices[order[i]];
+        const int octant = (p.x() >= center.x() ? 1 : 0) | (p.y() >= center.y() ? 2 : 0) | (p.z() >= center.z() ? 4 : 0);
+        ++counts[octant];
+    }
+    int offsets[8];
+    int numChildren = 0;
+    int offset = begin;
+    for(int i=0; i < 8; ++i){
+        offsets[i] = offset;
+        offset += counts[i];
+        if(counts[i] > 0){
+            ++numChildren;
+        }
+    }
+    for(int i=begin; i < end; ++i){
+        const int index = order[i];
+        const Vector3f& p = vertices[index];
+        const int octant = (p.x() >= center.x() ? 1 : 0) | (p.y() >= center.y() ? 2 : 0) | (p.z() >= center.z() ? 4 : 0);
+        buf[offsets[octant]++] = index;
+    }
+    std::copy(buf.begin() + begin, buf.begin() + end, order.begin() + begin);
+
+    // The points sampled from the descendants are distributed as uniformly as the points
+    // because they are sampled in the order of the space filling curve given by the octants
+    const int firstChild = octree.nodes.size();
+    node.firstChild = firstChild;
+    node.numChildren = numChildren;
+    node.spacing = 2.0f * halfSize / sqrtf(NumSampledPoints);
+    octree.nodes.resize(firstChild + numChildren);
+    nodeBegins.resize(firstChild + numChildren);
+
+    const float childHalfSize = halfSize / 2.0f;
+    int childIndex = firstChild;
+    int childBegin = begin;
+    for(int i=0; i < 8; ++i){
+        if(counts[i] > 0){
+            const Vector3f childCenter(
+                center.x() + ((i & 1) ? childHalfSize : -childHalfSize),
+                center.y() + ((i & 2) ? childHalfSize : -childHalfSize),
+                center.z() + ((i & 4) ? childHalfSize : -childHalfSize));
+            buildNode(childIndex++, childBegin, childBegin + counts[i], childCenter, childHalfSize, depth + 1);
+            childBegin += counts[i];
+        }
+    }
+}
+
+
+void OctreeBuilder::storePoints(const SgColorArray* colors, const SgNormalArray* normals)
+{
+    vector<Node>& nodes = octree.nodes;
+    const int numNodes = nodes.size();
+
+    size_t numStoredPoints = 0;
+    for(int i=0; i < numNodes; ++i){
+        numStoredPoints += nodes[i].isLeaf() ? nodes[i].numPoints : NumSampledPoints;
+    }
+    octree.numStoredPoints = numStoredPoints;
+    octree.hasColors = (colors != 0);
+    octree.hasNormals = (normals != 0);
+    if(!octree.allocateStorage()){
+        nodes.clear();
+        return;
+    }
+    Vector3f* storedVertices = octree.vertices();
+    Vector3f* storedColors = octree.hasColors ? octree.colors() : 0;
+    Vector3f* storedNormals = octree.hasNormals ? octree.normals() : 0;
+
+    size_t offset = 0;
+    for(int i=0; i < numNodes; ++i){
+        Node& node = nodes[i];
+        const int begin = nodeBegins[i];
+        const int numSubtreePoints = node.numPoints;
+        if(!node.isLeaf()){
+            node.numPoints = NumSampledPoints;
+        }
+        node.offset = offset;
+        for(int j=0; j < node.numPoints; ++j){
+            int index;
+            if(node.isLeaf()){
+                index = order[begin + j];
+            } else {
+                index = order[begin + static_cast<int>((static_cast<long long>(j) * numSubtreePoints) / NumSampledPoints)];
+            }
+            storedVertices[offset] = vertices[index];
+            if(storedColors){
+                storedColors[offset] = (*colors)[index];
+            }
+            if(storedNormals){
+                storedNormals[offset] = (*normals)[index];
+            }
+            ++offset;
+        }
+    }
+
+    // The bounding boxes of the points of the subtrees are given from the leaves
+    for(int i = numNodes - 1; i >= 0; --i){
+        Node& node = nodes[i];
+        if(node.isLeaf()){
+            const Vector3f* p = storedVertices + node.offset;
+            node.min = node.max = p[0];
+            for(int j=1; j < node.numPoints; ++j){
+                node.min = node.min.cwiseMin(p[j]);
+                node.max = node.max.cwiseMax(p[j]);
+            }
+        } else {
+            node.min = nodes[node.firstChild].min;
+            node.max = nodes[node.firstChild].max;
+            for(int j=1; j < node.numChildren; ++j){
+                const Node& child = nodes[node.firstChild + j];
+                node.min = node.min.cwiseMin(child.min);
+                node.max = node.max.cwiseMax(child.max);
+            }
+        }
+    }
+}
+
+
+bool isOutsideFrustum(const Node& node, const Matrix4& C)
+{
+    int outsideFlags = 0x3f;
+    for(int i=0; i < 8; ++i){
+        const Vector4 corner((i & 1) ? node.max.x() : node.min.x(),
+                             (i & 2) ? node.max.y() : node.min.y(),
+                             (i & 4) ? node.max.z() : node.min.z(),
+                             1.0);
+        const Vector4 c = C * corner;
+        int flags = 0;
+        if(c.x() < -c.w()) flags |= 1;
+        if(c.x() >  c.w()) flags |= 2;
+        if(c.y() < -c.w()) flags |= 4;
+        if(c.y() >  c.w()) flags |= 8;
+        if(c.z() < -c.w()) flags |= 16;
+        if(c.z() >  c.w()) flags |= 32;
+        outsideFlags &= flags;
+        if(!outsideFlags){
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef std::pair<double, int> NodeError;
+
+}
+
+namespace cnoid {
+
+class PointSetLODGeneratorImpl
+{
+public:
+    int minNumPoints;
+    int pointBudget;
+    int maxNumPointsToLoad;
+    typedef boost::unordered_map<SgPointSet*, EntryPtr> EntryMap;
+    EntryMap entries;
+    size_t numEntriesAtLastSweep;
+
+    boost::thread thread;
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    deque<JobPtr> jobs;
+    vector<JobPtr> finishedJobs;
+    bool isThreadStarted;
+    bool isStopRequested;
+
+    PointSetLODGeneratorImpl();
+    ~PointSetLODGeneratorImpl();
+    bool getPointSets(SgPointSet* pointSet, const Matrix4& C, double viewportHeight, vector<SgPointSet*>& out_pointSets);
+    double calcProjectedSpacing(const Node& node, const Matrix4& C, double viewportHeight);
+    void loadNode(SgPointSet* pointSet, Entry& entry, Node& node);
+    void releaseUnusedNodes(Entry& entry);
+    void collectFinishedJobs();
+    void requestOctree(SgPointSet* pointSet, const EntryPtr& entry);
+    void sweepEntries();
+    void clear();
+    void run();
+};
+
+}
+
+
+PointSetLODGenerator::PointSetLODGenerator()
+{
+    impl = new PointSetLODGeneratorImpl;
+}
+
+
+PointSetLODGeneratorImpl::PointSetLODGeneratorImpl()
+{
+    minNumPoints = 1000000;
+    pointBudget = 5000000;
+    maxNumPointsToLoad = 1000000;
+    numEntriesAtLastSweep = 0;
+    isThreadStarted = false;
+    isStopRequested = false;
+}
+
+
+PointSetLODGenerator::~PointSetLODGenerator()
+{
+    delete impl;
+}
+
+
+PointSetLODGeneratorImpl::~PointSetLODGeneratorImpl()
+{
+    if(isThreadStarted){
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            isStopRequested = true;
+        }
+        condition.notify_all();
+        thread.join();
+    }
+}
+
+
+void PointSetLODGenerator::setMinNumPoints(int n)
+{
+    impl->minNumPoints = n;
+}
+
+
+void PointSetLODGenerator::setPointBudget(int n)
+{
+    impl->pointBudget = n;
+}
+
+
+void PointSetLODGenerator::setMaxNumPointsToLoad(int n)
+{
+    impl->maxNumPointsToLoad = n;
+}
+
+
+bool PointSetLODGenerator::getPointSets
+(SgPointSet* pointSet, const Matrix4& C, double viewportHeight, std::vector<SgPointSet*>& out_pointSets)
+{
+    return impl->getPointSets(pointSet, C, viewportHeight, out_pointSets);
+}
+
+
+bool PointSetLODGeneratorImpl::getPointSets
+(SgPointSet* pointSet, const Matrix4& C, double viewportHeight, vector<SgPointSet*>& out_pointSets)
+{
+    out_pointSets.clear();
+
+    if(!pointSet->hasVertices() || static_cast<int>(pointSet->vertices()->size()) < minNumPoints){
+        EntryMap::iterator p = entries.find(pointSet);
+        if(p != entries.end()){
+            entries.erase(p);
+        }
+        return false;
+    }
+
+    collectFinishedJobs();
+
+    EntryPtr& entry = entries[pointSet];
+    if(entry && entry->pointSet.expired()){
+        // A new point set has been created at the address of a deleted one
+        entry.reset();
+    }
+    if(!entry){
+        entry.reset(new Entry(pointSet));
+        entry->connection.reset(
+            pointSet->sigUpdated().connect(boost::bind(&Entry::onPointSetUpdated, entry.get())));
+        requestOctree(pointSet, entry);
+        if(entries.size() > 2 * numEntriesAtLastSweep + 16){
+            sweepEntries();
+        }
+        return false;
+    }
+    if(!entry->isJobPending && entry->builtGeneration != entry->generation){
+        requestOctree(pointSet, entry);
+    }
+
+    Octree* octree = entry->octree.get();
+    if(!octree){
+        return false;
+    }
+
+    const int frame = ++entry->frame;
+    vector<Node>& nodes = octree->nodes;
+    if(isOutsideFrustum(nodes[0], C)){
+        return true;
+    }
+
+    // The nodes whose points are the most sparse on the screen are refined first
+    std::priority_queue<NodeError> queue;
+    queue.push(NodeError(calcProjectedSpacing(nodes[0], C, viewportHeight), 0));
+    int numPoints = nodes[0].numPoints;
+    int numPointsToLoad = nodes[0].pointSet ? 0 : nodes[0].numPoints;
+
+    while(!queue.empty()){
+        const NodeError top = queue.top();
+        queue.pop();
+        Node& node = nodes[top.second];
+        bool isRefined = false;
+        if(!node.isLeaf() && top.first > MaxPointSpacingPixels){
+            int numChildPoints = 0;
+            int numChildPointsToLoad = 0;
+            for(int i=0; i < node.numChildren; ++i){
+                const Node& child = nodes[node.firstChild + i];
+                if(!isOutsideFrustum(child, C)){
+                    numChildPoints += child.numPoints;
+                    if(!child.pointSet){
+                        numChildPointsToLoad += child.numPoints;
+                    }
+                }
+            }
+            if(numPoints - node.numPoints + numChildPoints <= pointBudget &&
+               numPointsToLoad + numChildPointsToLoad <= maxNumPointsToLoad){
+                for(int i=0; i < node.numChildren; ++i){
+                    const int childIndex = node.firstChild + i;
+                    const Node& child = nodes[childIndex];
+                    if(!isOutsideFrustum(child, C)){
+                        queue.push(NodeError(calcProjectedSpacing(child, C, viewportHeight), childIndex));
+                    }
+                }
+                numPoints += numChildPoints - node.numPoints;
+                numPointsToLoad += numChildPointsToLoad;
+                isRefined = true;
+            }
+        }
+        if(!isRefined){
+            if(!node.pointSet){
+                loadNode(pointSet, *entry, node);
+            }
+            node.lastUsedFrame = frame;
+            if(node.pointSet->material() != pointSet->material()){
+                node.pointSet->setMaterial(pointSet->material());
+            }
+            node.pointSet->setPointSize(pointSet->pointSize());
+            out_pointSets.push_back(node.pointSet);
+        }
+    }
+
+    if(entry->numLoadedPoints > static_cast<size_t>(pointBudget) * 2){
+        releaseUnusedNodes(*entry);
+    }
+
+    return true;
+}
+
+
+double PointSetLODGeneratorImpl::calcProjectedSpacing(const Node& node, const Matrix4& C, double viewportHeight)
+{
+    if(node.isLeaf()){
+        return 0.0;
+    }
+    const Vector3 center = ((node.min + node.max) / 2.0f).cast<double>();
+    const double w = C.row(3).dot(center.homogeneous());
+    const double radius = (node.max - node.min).norm() / 2.0;
+    const double distance = w - radius * C.block<1, 3>(3, 0).norm();
+    if(distance <= 1.0e-6){
+        // The viewpoint is close to the node
+        return std::numeric_limits<double>::max();
+    }
+    // The scale of the normalized device coordinate to the pixels is the half of the viewport height
+    return node.spacing * C.block<1, 3>(1, 0).norm() * viewportHeight / 2.0 / distance;
+}
+
+
+void PointSetLODGeneratorImpl::loadNode(SgPointSet* pointSet, Entry& entry, Node& node)
+{
+    Octree& octree = *entry.octree;
+    const int n = node.numPoints;
+    SgPointSetPtr nodePointSet = new SgPointSet;
+    SgVertexArray* vertices = nodePointSet->setVertices(new SgVertexArray(n));
+    const Vector3f* src = octree.vertices() + node.offset;
+    std::copy(src, src + n, vertices->begin());
+    if(octree.hasColors){
+        SgColorArray* colors = nodePointSet->setColors(new SgColorArray(n));
+        src = octree.colors() + node.offset;
+        std::copy(src, src + n, colors->begin());
+    }
+    if(octree.hasNormals){
+        SgNormalArray* normals = nodePointSet->setNormals(new SgNormalArray(n));
+        src = octree.normals() + node.offset;
+        std::copy(src, src + n, normals->begin());
+    }
+    nodePointSet->setMaterial(pointSet->material());
+    node.pointSet = nodePointSet;
+    entry.numLoadedPoints += n;
+}
+
+
+/**
+   The point sets of the nodes which are not used in the current frame are released from the least
+   recently used one until the number of the loaded points becomes the point budget.
+*/
+void PointSetLODGeneratorImpl::releaseUnusedNodes(Entry& entry)
+{
+    vector<Node>& nodes = entry.octree->nodes;
+    vector<std::pair<int, int> > unusedNodes;
+    for(size_t i=0; i < nodes.size(); ++i){
+        const Node& node = nodes[i];
+        if(node.pointSet && node.lastUsedFrame != entry.frame){
+            unusedNodes.push_back(std::make_pair(node.lastUsedFrame, i));
+        }
+    }
+    std::sort(unusedNodes.begin(), unusedNodes.end());
+    for(size_t i=0; i < unusedNodes.size(); ++i){
+        if(entry.numLoadedPoints <= static_cast<size_t>(pointBudget)){
+            break;
+        }
+        Node& node = nodes[unusedNodes[i].second];
+        entry.numLoadedPoints -= node.numPoints;
+        node.pointSet.reset();
+    }
+}
+
+
+void PointSetLODGeneratorImpl::collectFinishedJobs()
+{
+    vector<JobPtr> finished;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if(finishedJobs.empty()){
+            return;
+        }
+        finished.swap(finishedJobs);
+    }
+    for(size_t i=0; i < finished.size(); ++i){
+        Job& job = *finished[i];
+        Entry& entry = *job.entry;
+        entry.isJobPending = false;
+        if(job.generation == entry.generation){
+            entry.builtGeneration = job.generation;
+            if(!job.octree->nodes.empty()){
+                entry.octree = job.octree;
+                entry.numLoadedPoints = 0;
+            }
+        }
+    }
+}
+
+
+void PointSetLODGeneratorImpl::requestOctree(SgPointSet* pointSet, const EntryPtr& entry)
+{
+    JobPtr job(new Job);
+    job->entry = entry;
+    job->generation = entry->generation;
+    const int n = pointSet->vertices()->size();
+    job->vertices = new SgVertexArray(*pointSet->vertices());
+    if(pointSet->hasColors() && pointSet->colorIndices().empty() && static_cast<int>(pointSet->colors()->size()) >= n){
+        job->colors = new SgColorArray(*pointSet->colors());
+    }
+    if(pointSet->hasNormals() && pointSet->normalIndices().empty() && static_cast<int>(pointSet->normals()->size()) >= n){
+        job->normals = new SgNormalArray(*pointSet->normals());
+    }
+    entry->isJobPending = true;
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        jobs.push_back(job);
+        if(!isThreadStarted){
+            thread = boost::thread(boost::bind(&PointSetLODGeneratorImpl::run, this));
+            isThreadStarted = true;
+        }
+    }
+    condition.notify_all();
+}
+
+
+void PointSetLODGeneratorImpl::sweepEntries()
+{
+    EntryMap::iterator p = entries.begin();
+    while(p != entries.end()){
+        if(!p->second || p->second->pointSet.expired()){
+            p = entries.erase(p);
+        } else {
+            ++p;
+        }
+    }
+    numEntriesAtLastSweep = entries.size();
+}
+
+
+void PointSetLODGenerator::clear()
+{
+    impl->clear();
+}
+
+
+void PointSetLODGeneratorImpl::clear()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        jobs.clear();
+        finishedJobs.clear();
+    }
+    entries.clear();
+    numEntriesAtLastSweep = 0;
+}
+
+
+void PointSetLODGeneratorImpl::run()
+{
+    while(true){
+        JobPtr job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while(jobs.empty() && !isStopRequested){
+                condition.wait(lock);
+            }
+            if(isStopRequested){
+                break;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        job->octree.reset(new Octree);
+        OctreeBuilder builder(*job->vertices, *job->octree);
+        builder.build(job->colors, job->normals);
+        job->vertices.reset();
+        job->colors.reset();
+        job->normals.reset();
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        finishedJobs.push_back(job);
+    }
+}
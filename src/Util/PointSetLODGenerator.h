@@ -0,0 +1,71 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_POINT_SET_LOD_GENERATOR_H
+#define CNOID_UTIL_POINT_SET_LOD_GENERATOR_H
+
+#include "EigenTypes.h"
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SgPointSet;
+class PointSetLODGeneratorImpl;
+
+/**
+   This class renders the large point sets with the level of detail suitable for the view.
+   An octree of a point set is built in a background thread when the point set is first given to
+   getPointSets(). Each leaf node of the octree has the points in its cell and each internal node
+   has the points sampled from its descendants, and the points of the nodes are stored in a memory
+   block backed by a temporary file so that the pages which are not used are written out by the OS.
+
+   The nodes used for a view are selected from the root by the spacing of their points on the screen
+   within the budget of the number of the points, and the point sets of the selected nodes are created
+   on demand. The point sets which have not been used for a while are released so that the renderer
+   also releases their buffers. The octree is rebuilt when the point set is updated, and the previous
+   one is used until the new one is built.
+*/
+class CNOID_EXPORT PointSetLODGenerator
+{
+public:
+    PointSetLODGenerator();
+    ~PointSetLODGenerator();
+
+    //! The point sets which have fewer points than this number are always rendered as they are.
+    void setMinNumPoints(int n);
+
+    //! The maximum number of the points of the nodes selected for a point set in a view
+    void setPointBudget(int n);
+
+    /**
+       The maximum number of the points of the nodes whose point sets are newly created in a call of
+       getPointSets(). The coarser nodes are used until the finer ones are loaded in the following frames.
+    */
+    void setMaxNumPointsToLoad(int n);
+
+    /**
+       @param C The matrix which maps the local coordinate of the point set to the clip coordinate
+       @param viewportHeight The height of the viewport in pixels
+       @param out_pointSets The point sets of the selected nodes which are rendered instead of the
+       given point set. It may be empty if the point set is outside of the view.
+       @return false if the point set should be rendered as it is because it is not large or its octree
+       has not been built yet
+       @note This function must be called from the same thread.
+    */
+    bool getPointSets(SgPointSet* pointSet, const Matrix4& C, double viewportHeight,
+                      std::vector<SgPointSet*>& out_pointSets);
+
+    void clear();
+
+private:
+    PointSetLODGeneratorImpl* impl;
+
+    PointSetLODGenerator(const PointSetLODGenerator& org);
+    PointSetLODGenerator& operator=(const PointSetLODGenerator& rhs);
+};
+
+}
+
+#endif
@@ -4,10 +4,21 @@
 */
 
 #include "PointSetUtil.h"
+#include "PointKdTree.h"
+#include "TaskScheduler.h"
 #include <cnoid/EasyScanner>
 #include <cnoid/Exception>
+#include <boost/bind.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/format.hpp>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 
 using namespace std;
 using namespace boost;
@@ -27,6 +38,16 @@ typedef union {
     float float_value;
 } RGBValue;
 
+struct Field
+{
+    std::string name;
+    int size;
+    char type;
+    int count;
+};
+
+const size_t numChunkPointsToWrite = 65536;
+
 
 void readPoints(SgPointSet* out_pointSet, EasyScanner& scanner, const std::vector<Element>& elements, int numPoints)
 {
@@ -110,18 +131,306 @@ void readPoints(SgPointSet* out_pointSet, EasyScanner& scanner, const std::vecto
     }
 }
 
+
+template<typename ValueType>
+void copyColumn(const char* src, size_t stride, size_t numPoints, Vector3f* dest, int component)
+{
+    ValueType value;
+    for(size_t i=0; i < numPoints; ++i){
+        memcpy(&value, src, sizeof(ValueType));
+        dest[i][component] = value;
+        src += stride;
+    }
+}
+
+
+void copyFieldColumn(const Field& field, const char* src, size_t stride, size_t numPoints, Vector3f* dest, int component)
+{
+    switch(field.type){
+    case 'F':
+        if(field.size == 4){
+            copyColumn<float>(src, stride, numPoints, dest, component);
+            return;
+        } else if(field.size == 8){
+            copyColumn<double>(src, stride, numPoints, dest, component);
+            return;
+        }
+        break;
+    case 'I':
+        switch(field.size){
+        case 1: copyColumn<boost::int8_t>(src, stride, numPoints, dest, component); return;
+        case 2: copyColumn<boost::int16_t>(src, stride, numPoints, dest, component); return;
+        case 4: copyColumn<boost::int32_t>(src, stride, numPoints, dest, component); return;
+        }
+        break;
+    case 'U':
+        switch(field.size){
+        case 1: copyColumn<boost::uint8_t>(src, stride, numPoints, dest, component); return;
+        case 2: copyColumn<boost::uint16_t>(src, stride, numPoints, dest, component); return;
+        case 4: copyColumn<boost::uint32_t>(src, stride, numPoints, dest, component); return;
+        }
+        break;
+    }
+    throw file_read_error() << error_info_message(
+        str(format("The type of the '%1%' field is not supported.") % field.name));
+}
+
+
+void copyColorColumn(const Field& field, const char* src, size_t stride, size_t numPoints, Vector3f* dest)
+{
+    if(field.size != 4){
+        throw file_read_error() << error_info_message(
+            str(format("The size of the '%1%' field must be 4.") % field.name));
+    }
+    RGBValue rgb;
+    for(size_t i=0; i < numPoints; ++i){
+        memcpy(&rgb.float_value, src, 4);
+        Vector3f& color = dest[i];
+        color[0] = rgb.red / 255.0;
+        color[1] = rgb.green / 255.0;
+        color[2] = rgb.blue / 255.0;
+        src += stride;
+    }
+}
+
+
+/**
+   Decompresses the data compressed by LZF, which is used for the "binary_compressed" format.
+   \return false if the data is broken or its decompressed size is not equal to outSize
+*/
+bool decompressLZF(const unsigned char* in, size_t inSize, unsigned char* out, size_t outSize)
+{
+    const unsigned char* inEnd = in + inSize;
+    unsigned char* const outBegin = out;
+    unsigned char* const outEnd = out + outSize;
+
+    while(in < inEnd){
+        size_t ctrl = *in++;
+        if(ctrl < 32){
+            // literal run
+            const size_t len = ctrl + 1;
+            if(len > static_cast<size_t>(inEnd - in) || len > static_cast<size_t>(outEnd - out)){
+                return false;
+            }
+            memcpy(out, in, len);
+            in += len;
+            out += len;
+        } else {
+            // back reference
+            size_t len = ctrl >> 5;
+            size_t distance = (ctrl & 0x1f) << 8;
+            if(len == 7){
+                if(in >= inEnd){
+                    return false;
+                }
+                len += *in++;
+            }
+            if(in >= inEnd){
+                return false;
+            }
+            distance += *in++ + 1;
+            len += 2;
+            if(distance > static_cast<size_t>(out - outBegin) || len > static_cast<size_t>(outEnd - out)){
+                return false;
+            }
+            const unsigned char* ref = out - distance;
+            // The regions may overlap, so the bytes must be copied one by one
+            for(size_t i=0; i < len; ++i){
+                out[i] = ref[i];
+            }
+            out += len;
+        }
+    }
+    return (out == outEnd);
+}
+
+
+void readBinaryPoints
+(SgPointSet* out_pointSet, const char* data, size_t dataSize, const std::vector<Field>& fields, size_t numPoints,
+ bool isCompressed)
+{
+    const int numFields = fields.size();
+    size_t pointSize = 0;
+    for(int i=0; i < numFields; ++i){
+        const Field& field = fields[i];
+        if(field.size <= 0 || field.count <= 0){
+            throw file_read_error() << error_info_message("The 'SIZE' or 'COUNT' field is not correctly specified.");
+        }
+        pointSize += field.size * field.count;
+    }
+
+    // The offsets of the field columns and the stride of the points in a column
+    std::vector<size_t> offsets(numFields);
+    std::vector<size_t> strides(numFields);
+    std::vector<char> decompressed;
+
+    if(!isCompressed){
+        if(dataSize / pointSize < numPoints){
+            throw file_read_error() << error_info_message("The point data is shorter than the specified number of the points.");
+        }
+        size_t offset = 0;
+        for(int i=0; i < numFields; ++i){
+            offsets[i] = offset;
+            strides[i] = pointSize;
+            offset += fields[i].size * fields[i].count;
+        }
+    } else {
+        // The data consists of the compressed size, the decompressed size and the compressed columns of the fields
+        boost::uint32_t sizes[2];
+        if(dataSize < sizeof(sizes)){
+            throw file_read_error() << error_info_message("The compressed point data is broken.");
+        }
+        memcpy(sizes, data, sizeof(sizes));
+        const size_t compressedSize = sizes[0];
+        const size_t decompressedSize = sizes[1];
+        if(compressedSize > dataSize - sizeof(sizes) || decompressedSize / pointSize < numPoints){
+            throw file_read_error() << error_info_message("The compressed point data is broken.");
+        }
+        decompressed.resize(decompressedSize);
+        if(decompressedSize > 0){
+            const unsigned char* in = reinterpret_cast<const unsigned char*>(data + sizeof(sizes));
+            if(!decompressLZF(in, compressedSize, reinterpret_cast<unsigned char*>(&decompressed[0]), decompressedSize)){
+                throw file_read_error() << error_info_message("The compressed point data is broken.");
+            }
+        }
+        data = decompressed.empty() ? 0 : &decompressed[0];
+        size_t offset = 0;
+        for(int i=0; i < numFields; ++i){
+            offsets[i] = offset;
+            strides[i] = fields[i].size * fields[i].count;
+            offset += strides[i] * numPoints;
+        }
+    }
+
+    if(numPoints == 0){
+        throw file_read_error() << error_info_message("No valid points");
+    }
+
+    SgVertexArrayPtr vertices = new SgVertexArray(numPoints);
+    SgNormalArrayPtr normals;
+    SgColorArrayPtr colors;
+    int numCoordinates = 0;
+
+    for(int i=0; i < numFields; ++i){
+        const Field& field = fields[i];
+        const char* src = data + offsets[i];
+        const std::string& name = field.name;
+        if(name == "x" || name == "y" || name == "z"){
+            copyFieldColumn(field, src, strides[i], numPoints, &vertices->front(), name[0] - 'x');
+            ++numCoordinates;
+        } else if(name == "normal_x" || name == "normal_y" || name == "normal_z"){
+            if(!normals){
+                normals = new SgNormalArray(numPoints);
+            }
+            copyFieldColumn(field, src, strides[i], numPoints, &normals->front(), name[7] - 'x');
+        } else if(name == "rgb" || name == "rgba"){
+            if(!colors){
+                colors = new SgColorArray(numPoints);
+            }
+            copyColorColumn(field, src, strides[i], numPoints, &colors->front());
+        }
+    }
+
+    if(numCoordinates < 3){
+        throw file_read_error() << error_info_message("The coordinate fields of the points are not found.");
+    }
+
+    // Remove the invalid points, which are given as NaN in the organized point clouds
+    SgVertexArray& v = *vertices;
+    size_t numValidPoints = 0;
+    for(size_t i=0; i < numPoints; ++i){
+        const Vector3f& p = v[i];
+        if((boost::math::isfinite)(p.x()) && (boost::math::isfinite)(p.y()) && (boost::math::isfinite)(p.z())){
+            if(numValidPoints < i){
+                v[numValidPoints] = p;
+                if(normals){
+                    (*normals)[numValidPoints] = (*normals)[i];
+                }
+                if(colors){
+                    (*colors)[numValidPoints] = (*colors)[i];
+                }
+            }
+            ++numValidPoints;
+        }
+    }
+    if(numValidPoints == 0){
+        throw file_read_error() << error_info_message("No valid points");
+    }
+    if(numValidPoints < numPoints){
+        v.resize(numValidPoints);
+        if(normals){
+            normals->resize(numValidPoints);
+        }
+        if(colors){
+            colors->resize(numValidPoints);
+        }
+    }
+
+    out_pointSet->setVertices(vertices);
+    out_pointSet->setNormals(normals);
+    out_pointSet->normalIndices().clear();
+    out_pointSet->setColors(colors);
+    out_pointSet->colorIndices().clear();
+}
+
+
+/**
+   \return The position next to the line of the 'DATA' field, or null if the line is not found
+*/
+const char* findDataBegin(const char* p, const char* pend)
+{
+    while(p < pend){
+        while(p < pend && (*p == ' ' || *p == '\t')){
+            ++p;
+        }
+        const bool isDataLine = (pend - p > 4 && memcmp(p, "DATA", 4) == 0 && (p[4] == ' ' || p[4] == '\t'));
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', pend - p));
+        if(!lineEnd){
+            return isDataLine ? pend : 0;
+        }
+        p = lineEnd + 1;
+        if(isDataLine){
+            return p;
+        }
+    }
+    return 0;
+}
+
 }
 
 
 void cnoid::loadPCD(SgPointSet* out_pointSet, const std::string& filename)
 {
+    namespace bi = boost::interprocess;
+
+    bi::file_mapping file;
+    bi::mapped_region region;
     try {
-        EasyScanner scanner(filename);
-        scanner.setCommentChar('#');
+        bi::file_mapping(filename.c_str(), bi::read_only).swap(file);
+        bi::mapped_region(file, bi::read_only).swap(region);
+    } catch(const bi::interprocess_exception& ex){
+        throw file_read_error() << error_info_message(
+            str(format("%1% cannot be read: %2%") % filename % ex.what()));
+    }
+    const char* fileBegin = static_cast<const char*>(region.get_address());
+    const char* fileEnd = fileBegin + region.get_size();
 
-        int numPoints = 0;
+    const char* dataBegin = findDataBegin(fileBegin, fileEnd);
+    if(!dataBegin){
+        throw file_read_error() << error_info_message(
+            str(format("The 'DATA' field is not found in %1%.") % filename));
+    }
+
+    try {
+        EasyScanner scanner;
+        scanner.setCommentChar('#');
+        scanner.setText(fileBegin, dataBegin - fileBegin);
 
+        std::vector<Field> fields;
         std::vector<Element> elements;
+        size_t numPoints = 0;
+        size_t width = 0;
+        size_t height = 1;
 
         while(true){
             scanner.skipBlankLines();
@@ -129,6 +438,12 @@ void cnoid::loadPCD(SgPointSet* out_pointSet, const std::string& filename)
 
             if(scanner.stringValue == "FIELDS"){
                 while(scanner.readWord()){
+                    Field field;
+                    field.name = scanner.stringValue;
+                    field.size = 4;
+                    field.type = 'F';
+                    field.count = 1;
+                    fields.push_back(field);
                     if(scanner.stringValue == "x"){
                         elements.push_back(E_X);
                     } else if(scanner.stringValue == "y"){
@@ -145,32 +460,60 @@ void cnoid::loadPCD(SgPointSet* out_pointSet, const std::string& filename)
                         elements.push_back(E_RGB);
                     }
                 }
+            } else if(scanner.stringValue == "SIZE"){
+                for(size_t i=0; i < fields.size() && scanner.readInt(); ++i){
+                    fields[i].size = scanner.intValue;
+                }
+            } else if(scanner.stringValue == "TYPE"){
+                for(size_t i=0; i < fields.size() && scanner.readWord(); ++i){
+                    fields[i].type = scanner.stringValue[0];
+                }
+            } else if(scanner.stringValue == "COUNT"){
+                for(size_t i=0; i < fields.size() && scanner.readInt(); ++i){
+                    fields[i].count = scanner.intValue;
+                }
+            } else if(scanner.stringValue == "WIDTH"){
+                width = scanner.readIntEx("The 'WIDTH' field is not correctly specified.");
+            } else if(scanner.stringValue == "HEIGHT"){
+                height = scanner.readIntEx("The 'HEIGHT' field is not correctly specified.");
             } else if(scanner.stringValue == "POINTS"){
                 numPoints = scanner.readIntEx("The 'POINTS' field is not correctly specified.");
             } else if(scanner.stringValue == "DATA"){
                 scanner.readWordEx("The 'DATA' field is not correctly specified.");
+                if(fields.empty()){
+                    scanner.throwException("The specification of field elements is not found.");
+                }
+                if(numPoints == 0){
+                    numPoints = width * height;
+                }
                 if(scanner.stringValue == "ascii"){
-                    scanner.readLFex();
-                    if(elements.empty()){
-                        scanner.throwException("The specification of field elements is not found.");
-                    }
-                    readPoints(out_pointSet, scanner, elements, numPoints);
-                    break;
+                    EasyScanner dataScanner;
+                    dataScanner.setCommentChar('#');
+                    dataScanner.setLineNumberOffset(scanner.lineNumber);
+                    dataScanner.setText(dataBegin, fileEnd - dataBegin);
+                    readPoints(out_pointSet, dataScanner, elements, numPoints);
+                } else if(scanner.stringValue == "binary"){
+                    readBinaryPoints(out_pointSet, dataBegin, fileEnd - dataBegin, fields, numPoints, false);
+                } else if(scanner.stringValue == "binary_compressed"){
+                    readBinaryPoints(out_pointSet, dataBegin, fileEnd - dataBegin, fields, numPoints, true);
                 } else {
-                    scanner.throwException("The 'ascii' format is only supported for the point DATA.");
+                    scanner.throwException(
+                        "The 'ascii', 'binary' and 'binary_compressed' formats are only supported for the point DATA.");
                 }
+                break;
             } else {
                 scanner.skipToLineEnd();
             }
             scanner.readLFEOFex("The field value is not correctly specified.");
         }
     } catch(EasyScanner::Exception& ex){
+        ex.filename = filename;
         throw file_read_error() << error_info_message(ex.getFullMessage());
     }
 }
 
 
-void cnoid::savePCD(SgPointSet* pointSet, const std::string& filename, const Affine3& viewpoint)
+void cnoid::savePCD(SgPointSet* pointSet, const std::string& filename, const Affine3& viewpoint, bool isBinary)
 {
     if(!pointSet->hasVertices()){
         throw empty_data_error() << error_info_message("Empty pointset");
@@ -179,7 +522,7 @@ void cnoid::savePCD(SgPointSet* pointSet, const std::string& filename, const Aff
     bool hasColors = pointSet->hasColors() && pointSet->colorIndices().empty();
 
     ofstream ofs;
-    ofs.open(filename.c_str());
+    ofs.open(filename.c_str(), isBinary ? (ios::out | ios::binary) : ios::out);
     ofs << scientific << setprecision(9);
 
     ofs << "# .PCD v.7 - Point Cloud Data file format\n";
@@ -208,10 +551,37 @@ void cnoid::savePCD(SgPointSet* pointSet, const std::string& filename, const Aff
     ofs << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << "\n";
 
     ofs << "POINTS " << numPoints << "\n";
-    
-    ofs << "DATA ascii\n";
 
-    if(hasColors){
+    if(isBinary){
+        ofs << "DATA binary\n";
+        if(!hasColors){
+            // Vector3f has no padding, so the array can be written as it is
+            ofs.write(reinterpret_cast<const char*>(points.data()), numPoints * sizeof(Vector3f));
+        } else {
+            const SgColorArray& colors = *pointSet->colors();
+            const size_t pointSize = sizeof(Vector3f) + sizeof(RGBValue);
+            std::vector<char> buf(std::min(static_cast<size_t>(numPoints), numChunkPointsToWrite) * pointSize);
+            RGBValue rgb;
+            rgb.alpha = 0;
+            int i = 0;
+            while(i < numPoints){
+                const int n = std::min(static_cast<size_t>(numPoints - i), numChunkPointsToWrite);
+                char* p = &buf[0];
+                for(int j=0; j < n; ++j){
+                    const Vector3f& c = colors[i + j];
+                    rgb.red = (unsigned char)(255.0 * c[0]);
+                    rgb.green = (unsigned char)(255.0 * c[1]);
+                    rgb.blue = (unsigned char)(255.0 * c[2]);
+                    memcpy(p, points[i + j].data(), sizeof(Vector3f));
+                    memcpy(p + sizeof(Vector3f), &rgb, sizeof(RGBValue));
+                    p += pointSize;
+                }
+                ofs.write(&buf[0], n * pointSize);
+                i += n;
+            }
+        }
+    } else if(hasColors){
+        ofs << "DATA ascii\n";
         RGBValue rgb;
         rgb.alpha = 0.0;
         const SgColorArray& colors = *pointSet->colors();
@@ -224,6 +594,7 @@ void cnoid::savePCD(SgPointSet* pointSet, const std::string& filename, const Aff
             ofs << p.x() << " " << p.y() << " " << p.z() << " " << rgb.float_value << "\n";
         }
     } else {
+        ofs << "DATA ascii\n";
         for(int i=0; i < numPoints; ++i){
             const Vector3f& p = points[i];
             ofs << p.x() << " " << p.y() << " " << p.z() << "\n";
@@ -232,3 +603,332 @@ void cnoid::savePCD(SgPointSet* pointSet, const std::string& filename, const Aff
 
     ofs.close();
 }
+
+
+namespace {
+
+// The ranges which have more points than this are sorted by separate tasks
+const int MinNumPointsForTask = 65536;
+
+// The number of the points processed as one task in the loops which do little for each point
+const int PointGrainSize = 16384;
+
+struct VoxelEntry
+{
+    int x;
+    int y;
+    int z;
+    // -1 if the point is not finite
+    int index;
+
+    // The index is also compared to make the order of the points in a cell deterministic
+    bool operator<(const VoxelEntry& rhs) const {
+        if(x != rhs.x) return x < rhs.x;
+        if(y != rhs.y) return y < rhs.y;
+        if(z != rhs.z) return z < rhs.z;
+        return index < rhs.index;
+    }
+    bool isInSameVoxel(const VoxelEntry& rhs) const {
+        return (x == rhs.x && y == rhs.y && z == rhs.z);
+    }
+};
+
+bool isInvalidVoxelEntry(const VoxelEntry& entry)
+{
+    return entry.index < 0;
+}
+
+
+void setVoxelEntries(const Vector3f* points, double invVoxelSize, vector<VoxelEntry>* entries, int begin, int end)
+{
+    // The cell coordinates must be represented by int
+    const double limit = 1.0e9;
+    
+    for(int i=begin; i < end; ++i){
+        const Vector3f& p = points[i];
+        VoxelEntry& entry = (*entries)[i];
+        const double x = std::floor(p.x() * invVoxelSize);
+        const double y = std::floor(p.y() * invVoxelSize);
+        const double z = std::floor(p.z() * invVoxelSize);
+        // The comparisons are false for NaN
+        if(std::fabs(x) < limit && std::fabs(y) < limit && std::fabs(z) < limit){
+            entry.x = x;
+            entry.y = y;
+            entry.z = z;
+            entry.index = i;
+        } else {
+            entry.index = -1;
+        }
+    }
+}
+
+
+void sortVoxelEntries(vector<VoxelEntry>* entries, int begin, int end)
+{
+    vector<VoxelEntry>::iterator p = entries->begin();
+    if(end - begin <= MinNumPointsForTask){
+        std::sort(p + begin, p + end);
+    } else {
+        const int mid = (begin + end) / 2;
+        TaskGroup tasks;
+        tasks.run(boost::bind(sortVoxelEntries, entries, begin, mid));
+        sortVoxelEntries(entries, mid, end);
+        tasks.wait();
+        std::inplace_merge(p + begin, p + mid, p + end);
+    }
+}
+
+
+/**
+   Gives the average of the vectors of the points in each cell.
+*/
+struct VectorAverager
+{
+    const SgVectorArray<Vector3f>* values;
+    // null if the values are given for each point directly
+    const SgIndexArray* valueIndices;
+    const vector<int>* pointIndices;
+    const vector<int>* voxelBegins;
+    Vector3f* out_values;
+    bool doNormalize;
+
+    void operator()(int beginVoxel, int endVoxel) const {
+        for(int i = beginVoxel; i < endVoxel; ++i){
+            const int begin = (*voxelBegins)[i];
+            const int end = (*voxelBegins)[i + 1];
+            Vector3f sum = Vector3f::Zero();
+            for(int j = begin; j < end; ++j){
+                const int index = (*pointIndices)[j];
+                sum += (*values)[valueIndices ? (*valueIndices)[index] : index];
+            }
+            sum /= (end - begin);
+            if(doNormalize){
+                const float norm = sum.norm();
+                if(norm > 0.0f){
+                    sum /= norm;
+                }
+            }
+            out_values[i] = sum;
+        }
+    }
+};
+
+
+/**
+   @param out_valueIndices The index array if the attribute is given with the indices, or null
+   @return true if the attribute is given for each point
+*/
+bool checkIfAttributeIsGivenForEachPoint
+(const SgVectorArray<Vector3f>* values, const SgIndexArray& indices, int numPoints,
+ const SgIndexArray*& out_valueIndices)
+{
+    if(!values || values->empty()){
+        return false;
+    }
+    if(indices.empty()){
+        out_valueIndices = 0;
+        return (static_cast<int>(values->size()) == numPoints);
+    }
+    out_valueIndices = &indices;
+    return (static_cast<int>(indices.size()) == numPoints);
+}
+
+
+SgVectorArray<Vector3f>* createAveragedVectors
+(const SgVectorArray<Vector3f>* values, const SgIndexArray* valueIndices,
+ const vector<int>& pointIndices, const vector<int>& voxelBegins, bool doNormalize)
+{
+    const int numVoxels = voxelBegins.size() - 1;
+    SgVectorArray<Vector3f>* averaged = new SgVectorArray<Vector3f>(numVoxels);
+    if(numVoxels > 0){
+        VectorAverager averager;
+        averager.values = values;
+        averager.valueIndices = valueIndices;
+        averager.pointIndices = &pointIndices;
+        averager.voxelBegins = &voxelBegins;
+        averager.out_values = &averaged->front();
+        averager.doNormalize = doNormalize;
+        TaskScheduler::instance()->parallelForRanges(0, numVoxels, averager, PointGrainSize / 8);
+    }
+    return averaged;
+}
+
+
+template<class Container>
+void compactElements(Container& elements, const vector<unsigned char>& keepFlags)
+{
+    const int n = keepFlags.size();
+    int numKeptElements = 0;
+    for(int i=0; i < n; ++i){
+        if(keepFlags[i]){
+            if(numKeptElements != i){
+                elements[numKeptElements] = elements[i];
+            }
+            ++numKeptElements;
+        }
+    }
+    elements.resize(numKeptElements);
+}
+
+
+void compactAttribute(SgVectorArray<Vector3f>* values, SgIndexArray& indices, const vector<unsigned char>& keepFlags)
+{
+    const SgIndexArray* valueIndices;
+    if(checkIfAttributeIsGivenForEachPoint(values, indices, keepFlags.size(), valueIndices)){
+        if(valueIndices){
+            compactElements(indices, keepFlags);
+        } else {
+            compactElements(*values, keepFlags);
+        }
+    }
+}
+
+
+void keepFlaggedPoints(SgPointSet* pointSet, const vector<unsigned char>& keepFlags)
+{
+    if(std::find(keepFlags.begin(), keepFlags.end(), 0) == keepFlags.end()){
+        return;
+    }
+    compactAttribute(pointSet->normals(), pointSet->normalIndices(), keepFlags);
+    compactAttribute(pointSet->colors(), pointSet->colorIndices(), keepFlags);
+    compactElements(*pointSet->vertices(), keepFlags);
+}
+
+
+void computeMeanNeighborDistances
+(const PointKdTree* kdTree, const SgVertexArray* points, int numNeighbors, vector<float>* out_distances,
+ int begin, int end)
+{
+    vector<int> indices;
+    vector<float> squaredDistances;
+    for(int i=begin; i < end; ++i){
+        // The nearest point is the point itself
+        kdTree->findNearestPoints((*points)[i], numNeighbors + 1, indices, &squaredDistances);
+        const int n = squaredDistances.size();
+        float sum = 0.0f;
+        for(int j=1; j < n; ++j){
+            sum += std::sqrt(squaredDistances[j]);
+        }
+        (*out_distances)[i] = (n > 1) ? (sum / (n - 1)) : 0.0f;
+    }
+}
+
+
+void checkPointsInBox
+(const SgVertexArray* points, Vector3f min, Vector3f max, vector<unsigned char>* out_flags, int begin, int end)
+{
+    for(int i=begin; i < end; ++i){
+        const Vector3f& p = (*points)[i];
+        (*out_flags)[i] = (p.x() >= min.x() && p.y() >= min.y() && p.z() >= min.z() &&
+                           p.x() <= max.x() && p.y() <= max.y() && p.z() <= max.z());
+    }
+}
+
+}
+
+
+void cnoid::groupPointsByVoxels
+(const Vector3f* points, int numPoints, double voxelSize,
+ std::vector<int>& out_pointIndices, std::vector<int>& out_voxelBegins)
+{
+    vector<VoxelEntry> entries(numPoints);
+    TaskScheduler::instance()->parallelForRanges(
+        0, numPoints, boost::bind(setVoxelEntries, points, 1.0 / voxelSize, &entries, _1, _2), PointGrainSize);
+    entries.erase(std::remove_if(entries.begin(), entries.end(), isInvalidVoxelEntry), entries.end());
+    sortVoxelEntries(&entries, 0, entries.size());
+
+    const int n = entries.size();
+    out_pointIndices.resize(n);
+    out_voxelBegins.clear();
+    for(int i=0; i < n; ++i){
+        out_pointIndices[i] = entries[i].index;
+        if(i == 0 || !entries[i].isInSameVoxel(entries[i - 1])){
+            out_voxelBegins.push_back(i);
+        }
+    }
+    out_voxelBegins.push_back(n);
+}
+
+
+void cnoid::downsamplePointSet(SgPointSet* pointSet, double voxelSize)
+{
+    if(!pointSet->hasVertices() || voxelSize <= 0.0){
+        return;
+    }
+    const SgVertexArray& points = *pointSet->vertices();
+    const int numPoints = points.size();
+    vector<int> pointIndices;
+    vector<int> voxelBegins;
+    groupPointsByVoxels(&points.front(), numPoints, voxelSize, pointIndices, voxelBegins);
+
+    const SgIndexArray* valueIndices;
+    if(checkIfAttributeIsGivenForEachPoint(pointSet->normals(), pointSet->normalIndices(), numPoints, valueIndices)){
+        pointSet->setNormals(
+            createAveragedVectors(pointSet->normals(), valueIndices, pointIndices, voxelBegins, true));
+        pointSet->normalIndices().clear();
+    }
+    if(checkIfAttributeIsGivenForEachPoint(pointSet->colors(), pointSet->colorIndices(), numPoints, valueIndices)){
+        pointSet->setColors(
+            createAveragedVectors(pointSet->colors(), valueIndices, pointIndices, voxelBegins, false));
+        pointSet->colorIndices().clear();
+    }
+    pointSet->setVertices(createAveragedVectors(&points, 0, pointIndices, voxelBegins, false));
+}
+
+
+void cnoid::removeStatisticalOutliers(SgPointSet* pointSet, int numNeighbors, double stdDevRatio)
+{
+    if(!pointSet->hasVertices() || numNeighbors < 1){
+        return;
+    }
+    const SgVertexArray& points = *pointSet->vertices();
+    const int numPoints = points.size();
+    if(numPoints <= numNeighbors){
+        return;
+    }
+
+    PointKdTree kdTree;
+    kdTree.build(points);
+    vector<float> distances(numPoints);
+    TaskScheduler::instance()->parallelForRanges(
+        0, numPoints,
+        boost::bind(computeMeanNeighborDistances, &kdTree, &points, numNeighbors, &distances, _1, _2),
+        PointGrainSize / 16);
+    kdTree.clear();
+
+    double sum = 0.0;
+    double squaredSum = 0.0;
+    for(int i=0; i < numPoints; ++i){
+        const double d = distances[i];
+        sum += d;
+        squaredSum += d * d;
+    }
+    const double mean = sum / numPoints;
+    const double variance = (squaredSum - sum * mean) / (numPoints - 1);
+    const double threshold = mean + stdDevRatio * std::sqrt(std::max(0.0, variance));
+
+    vector<unsigned char> keepFlags(numPoints);
+    for(int i=0; i < numPoints; ++i){
+        keepFlags[i] = (distances[i] <= threshold);
+    }
+    keepFlaggedPoints(pointSet, keepFlags);
+}
+
+
+void cnoid::cropPointSet(SgPointSet* pointSet, const BoundingBox& box)
+{
+    if(!pointSet->hasVertices()){
+        return;
+    }
+    const SgVertexArray* points = pointSet->vertices();
+    const int numPoints = points->size();
+    vector<unsigned char> keepFlags(numPoints, 0);
+    if(!box.empty()){
+        TaskScheduler::instance()->parallelForRanges(
+            0, numPoints,
+            boost::bind(checkPointsInBox, points, Vector3f(box.min().cast<float>()), Vector3f(box.max().cast<float>()),
+                        &keepFlags, _1, _2),
+            PointGrainSize);
+    }
+    keepFlaggedPoints(pointSet, keepFlags);
+}
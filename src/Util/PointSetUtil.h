@@ -7,12 +7,54 @@
 #define CNOID_UTIL_POINT_SET_UTIL_H
 
 #include <cnoid/SceneDrawables>
+#include <vector>
 #include "exportdecl.h"
 
 namespace cnoid {
 
+/**
+   The "ascii", "binary" and "binary_compressed" data formats are supported.
+   The binary data is read from the memory-mapped file without loading the whole file.
+*/
 CNOID_EXPORT void loadPCD(SgPointSet* out_pointSet, const std::string& filename);
-CNOID_EXPORT void savePCD(SgPointSet* pointSet, const std::string& filename, const Affine3d& viewpoint = Affine3d::Identity());
+
+/**
+   @param isBinary The points are written in the "binary" data format instead of the "ascii" one.
+*/
+CNOID_EXPORT void savePCD(SgPointSet* pointSet, const std::string& filename, const Affine3d& viewpoint = Affine3d::Identity(), bool isBinary = false);
+
+/*
+  The following functions modify the arrays of the point set in parallel without notifying the update.
+  The normals and colors are processed with the points when they are given for each point directly or
+  with the indices, and they are kept as they are otherwise.
+*/
+
+/**
+   Groups the points by the cells of the voxel grid whose origin is the origin of the coordinate.
+   @param out_pointIndices The indices of the points sorted by the cells. The points whose coordinates
+   are not finite are excluded.
+   @param out_voxelBegins The positions in out_pointIndices where the points of each cell begin,
+   followed by the size of out_pointIndices
+*/
+CNOID_EXPORT void groupPointsByVoxels(
+    const Vector3f* points, int numPoints, double voxelSize,
+    std::vector<int>& out_pointIndices, std::vector<int>& out_voxelBegins);
+
+/**
+   The points in each cell of the voxel grid are replaced with their centroid,
+   and the normals and colors of them are averaged.
+*/
+CNOID_EXPORT void downsamplePointSet(SgPointSet* pointSet, double voxelSize);
+
+/**
+   The points whose mean distance to the nearest numNeighbors points is larger than the mean of all
+   the points by more than stdDevRatio times the standard deviation are removed.
+   The coordinates of the points must be finite.
+*/
+CNOID_EXPORT void removeStatisticalOutliers(SgPointSet* pointSet, int numNeighbors, double stdDevRatio);
+
+//! The points outside the box are removed.
+CNOID_EXPORT void cropPointSet(SgPointSet* pointSet, const BoundingBox& box);
 
 }
 
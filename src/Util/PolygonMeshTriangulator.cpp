@@ -6,20 +6,44 @@
 #include "PolygonMeshTriangulator.h"
 #include "Triangulator.h"
 #include "SceneDrawables.h"
+#include "TaskScheduler.h"
 #include <boost/format.hpp>
+#include <boost/bind.hpp>
 
 using namespace std;
 using namespace boost;
 using namespace cnoid;
 
+namespace {
+
+// The number of the polygons triangulated as one task
+const int GrainSize = 1024;
+
+}
+
 namespace cnoid {
 
 class PolygonMeshTriangulatorImpl
 {
 public:
     bool isDeepCopyEnabled;
-    Triangulator<SgVertexArray> triangulator;
-    std::vector<int> polygon;
+
+    /*
+      The valid vertex indices of the polygons without the delimiters.
+      The indices of polygon i are polygonIndices[polygonOffsets[i]] to polygonIndices[polygonOffsets[i+1] - 1].
+    */
+    std::vector<int> polygonIndices;
+    std::vector<int> polygonOffsets;
+    // The position of the top index of each polygon in the original indices with the delimiters
+    std::vector<int> polygonTopIndexPositions;
+    /*
+      The triangles of polygon i are written from triangleOffsets[i], which is given by the
+      maximum number of the triangles of the preceding polygons, and the actual number of the
+      triangles is stored in numPolygonTriangles[i].
+    */
+    std::vector<int> triangleOffsets;
+    std::vector<int> numPolygonTriangles;
+
     std::vector<int> newIndexPositionToOrgPositionWithDelimitersMap;
     std::vector<int> newIndexPositionToOrgPositionMap;
     std::string errorMessage;
@@ -39,6 +63,8 @@ public:
 
     PolygonMeshTriangulatorImpl();
     SgMesh* triangulate(SgPolygonMesh* polygonMesh);
+    void triangulatePolygons(const SgVertexArray* vertices, SgIndexArray* triangleVertices, int begin, int end);
+    void removeUnusedTrianglePositions(SgIndexArray& triangleVertices);
     bool setIndices(
         SgIndexArray& indices, int numElements,
         const SgIndexArray& orgIndices, const SgIndexArray& orgPolygonVertices, int elementTypeId);
@@ -106,14 +132,16 @@ SgMesh* PolygonMeshTriangulatorImpl::triangulate(SgPolygonMesh* orgMesh)
     }
     const SgVertexArray& vertices = *mesh->vertices();
     const int numVertices = vertices.size();
-    triangulator.setVertices(vertices);
     SgIndexArray& triangleVertices = mesh->triangleVertices();
 
-    polygon.clear();
-    newIndexPositionToOrgPositionWithDelimitersMap.clear();
-    newIndexPositionToOrgPositionMap.clear();
+    polygonIndices.clear();
+    polygonIndices.reserve(polygonVertices.size());
+    polygonOffsets.clear();
+    polygonOffsets.push_back(0);
+    polygonTopIndexPositions.clear();
+    triangleOffsets.clear();
+    triangleOffsets.push_back(0);
     int polygonTopIndexPosition = 0;
-    int polygonTopIndexPositionWithoutDelimiters = 0;
     int numInvalidIndices = 0;
     
     for(size_t i=0; i < polygonVertices.size(); ++i){
@@ -124,32 +152,30 @@ SgMesh* PolygonMeshTriangulatorImpl::triangulate(SgPolygonMesh* orgMesh)
             }
             ++numInvalidIndices;
         } else if(index >= 0){
-            polygon.push_back(index);
+            polygonIndices.push_back(index);
         } else {
-            if(polygon.size() == 3){
-                for(int j=0; j < 3; ++j){
-                    triangleVertices.push_back(polygon[j]);
-                    newIndexPositionToOrgPositionWithDelimitersMap.push_back(polygonTopIndexPosition + j);
-                    newIndexPositionToOrgPositionMap.push_back(polygonTopIndexPositionWithoutDelimiters + j);
-                }
-            } else {
-                const int numTriangles = triangulator.apply(polygon);
-                const vector<int>& triangles = triangulator.triangles();
-                for(int j=0; j < numTriangles; ++j){
-                    for(int k=0; k < 3; ++k){
-                        int localIndex = triangles[j * 3 + k];
-                        triangleVertices.push_back(polygon[localIndex]);
-                        newIndexPositionToOrgPositionWithDelimitersMap.push_back(polygonTopIndexPosition + localIndex);
-                        newIndexPositionToOrgPositionMap.push_back(polygonTopIndexPositionWithoutDelimiters + localIndex);
-                    }
-                }
-            }
+            const int polygonSize = polygonIndices.size() - polygonOffsets.back();
+            polygonOffsets.push_back(polygonIndices.size());
+            polygonTopIndexPositions.push_back(polygonTopIndexPosition);
+            triangleOffsets.push_back(triangleOffsets.back() + std::max(0, polygonSize - 2));
             polygonTopIndexPosition = i + 1;
-            polygonTopIndexPositionWithoutDelimiters += polygon.size();
-            polygon.clear();
         }
     }
 
+    // The polygons are independent, so they are triangulated in parallel
+    const int numPolygons = polygonTopIndexPositions.size();
+    const int maxNumTriangleVertices = triangleOffsets.back() * 3;
+    triangleVertices.resize(maxNumTriangleVertices);
+    newIndexPositionToOrgPositionWithDelimitersMap.resize(maxNumTriangleVertices);
+    newIndexPositionToOrgPositionMap.resize(maxNumTriangleVertices);
+    numPolygonTriangles.resize(numPolygons);
+    TaskScheduler::instance()->parallelForRanges(
+        0, numPolygons,
+        boost::bind(&PolygonMeshTriangulatorImpl::triangulatePolygons, this, &vertices, &triangleVertices, _1, _2),
+        GrainSize);
+
+    removeUnusedTrianglePositions(triangleVertices);
+
     if(numInvalidIndices > 1){
         addErrorMessage(str(format("There are %1% invalied vertex indices that are over the number of vertices (%2%).")
                             % numInvalidIndices % numVertices));
@@ -200,6 +226,74 @@ SgMesh* PolygonMeshTriangulatorImpl::triangulate(SgPolygonMesh* orgMesh)
 }
 
 
+void PolygonMeshTriangulatorImpl::triangulatePolygons
+(const SgVertexArray* vertices, SgIndexArray* triangleVertices, int begin, int end)
+{
+    Triangulator<SgVertexArray> triangulator;
+    triangulator.setVertices(*vertices);
+    vector<int> polygon;
+    
+    for(int i=begin; i < end; ++i){
+        const int polygonTop = polygonOffsets[i];
+        const int polygonSize = polygonOffsets[i + 1] - polygonTop;
+        const int* indices = &polygonIndices[0] + polygonTop;
+        int pos = triangleOffsets[i] * 3;
+        const int topPosition = polygonTopIndexPositions[i];
+
+        if(polygonSize < 3){
+            numPolygonTriangles[i] = 0;
+        } else if(polygonSize == 3){
+            for(int j=0; j < 3; ++j){
+                (*triangleVertices)[pos] = indices[j];
+                newIndexPositionToOrgPositionWithDelimitersMap[pos] = topPosition + j;
+                newIndexPositionToOrgPositionMap[pos] = polygonTop + j;
+                ++pos;
+            }
+            numPolygonTriangles[i] = 1;
+        } else {
+            polygon.assign(indices, indices + polygonSize);
+            const int numTriangles = triangulator.apply(polygon);
+            const vector<int>& triangles = triangulator.triangles();
+            for(int j=0; j < numTriangles * 3; ++j){
+                const int localIndex = triangles[j];
+                (*triangleVertices)[pos] = polygon[localIndex];
+                newIndexPositionToOrgPositionWithDelimitersMap[pos] = topPosition + localIndex;
+                newIndexPositionToOrgPositionMap[pos] = polygonTop + localIndex;
+                ++pos;
+            }
+            numPolygonTriangles[i] = numTriangles;
+        }
+    }
+}
+
+
+/**
+   Packs the triangles when some polygons have fewer triangles than the maximum number
+   because their ears are flat
+*/
+void PolygonMeshTriangulatorImpl::removeUnusedTrianglePositions(SgIndexArray& triangleVertices)
+{
+    const int numPolygons = numPolygonTriangles.size();
+    int numTriangleVertices = 0;
+    for(int i=0; i < numPolygons; ++i){
+        const int orgPos = triangleOffsets[i] * 3;
+        const int n = numPolygonTriangles[i] * 3;
+        if(orgPos != numTriangleVertices){
+            for(int j=0; j < n; ++j){
+                triangleVertices[numTriangleVertices + j] = triangleVertices[orgPos + j];
+                newIndexPositionToOrgPositionWithDelimitersMap[numTriangleVertices + j] =
+                    newIndexPositionToOrgPositionWithDelimitersMap[orgPos + j];
+                newIndexPositionToOrgPositionMap[numTriangleVertices + j] = newIndexPositionToOrgPositionMap[orgPos + j];
+            }
+        }
+        numTriangleVertices += n;
+    }
+    triangleVertices.resize(numTriangleVertices);
+    newIndexPositionToOrgPositionWithDelimitersMap.resize(numTriangleVertices);
+    newIndexPositionToOrgPositionMap.resize(numTriangleVertices);
+}
+
+
 namespace {
 const char* message1(int elementTypeId){
     switch(elementTypeId){
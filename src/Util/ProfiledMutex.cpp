@@ -0,0 +1,95 @@
+/**
+   @file
+*/
+
+#include "ProfiledMutex.h"
+#include <map>
+#include <string>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+/*
+  The scope names are cached for each name pointer so that the construction does not allocate
+  memory except for the first time, because some objects such as TaskGroup are constructed
+  in every simulation step.
+*/
+typedef map<std::pair<const char*, const char*>, const char*> ScopeNameMap;
+
+const char* getScopeName(const char* name, const char* suffix)
+{
+    static boost::mutex scopeNameMapMutex;
+    static ScopeNameMap scopeNameMap;
+    boost::lock_guard<boost::mutex> lock(scopeNameMapMutex);
+    const char*& scopeName = scopeNameMap[std::make_pair(name, suffix)];
+    if(!scopeName){
+        scopeName = Profiler::internName(string(name) + suffix);
+    }
+    return scopeName;
+}
+
+}
+
+
+ProfiledMutex::ProfiledMutex(const char* name)
+    : name_(name)
+{
+    holdScopeName = getScopeName(name, " lock held");
+    waitScopeName = getScopeName(name, " lock wait");
+    holdBuffer = 0;
+}
+
+
+/**
+   The wait scope is only recorded when the mutex is held by another thread
+   so that the count of the scope is the number of the contentions.
+*/
+void ProfiledMutex::lockWithProfiling()
+{
+    if(!mutex.try_lock()){
+        Profiler::Scope scope(waitScopeName);
+        mutex.lock();
+    }
+    beginHold();
+}
+
+
+ProfiledConditionVariable::ProfiledConditionVariable(const char* name)
+{
+    waitScopeName = getScopeName(name, " condition wait");
+}
+
+
+/**
+   The underlying mutex is temporarily adopted by a lock of boost::mutex, which is released
+   without unlocking the mutex after the wait so that the ownership stays with the caller's lock.
+*/
+void ProfiledConditionVariable::waitWithMutex(ProfiledMutex& mutex)
+{
+    mutex.endHold();
+    {
+        Profiler::Scope scope(waitScopeName);
+        boost::unique_lock<boost::mutex> lock(mutex.mutex, boost::adopt_lock);
+        condition.wait(lock);
+        lock.release();
+    }
+    mutex.beginHold();
+}
+
+
+bool ProfiledConditionVariable::timedWaitWithMutex
+(ProfiledMutex& mutex, const boost::posix_time::time_duration& duration)
+{
+    bool notified;
+    mutex.endHold();
+    {
+        Profiler::Scope scope(waitScopeName);
+        boost::unique_lock<boost::mutex> lock(mutex.mutex, boost::adopt_lock);
+        notified = condition.timed_wait(lock, duration);
+        lock.release();
+    }
+    mutex.beginHold();
+    return notified;
+}
@@ -0,0 +1,119 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_PROFILED_MUTEX_H
+#define CNOID_UTIL_PROFILED_MUTEX_H
+
+#include "Profiler.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   A mutex which records its use as the scopes of Profiler so that the time for which the threads
+   are blocked at the synchronization points can be distinguished from the time for computing.
+
+   For a mutex named "X", the time for which the mutex is held is recorded as the scope "X lock held",
+   and the time for which a thread waits to lock the mutex held by another thread is recorded as
+   the scope "X lock wait". The count of the latter is the number of the contentions.
+   Nothing is recorded when the profiler is disabled, in which case a lock only checks a flag
+   in addition to locking the mutex.
+
+   The class satisfies the Lockable concept, so it can be locked by boost::unique_lock.
+   The mutexes must be unlocked in the reverse order of the locks for the scopes to be nested correctly.
+*/
+class CNOID_EXPORT ProfiledMutex
+{
+public:
+    //! \param name The name must be a string which is valid while the mutex is used, such as a string literal
+    ProfiledMutex(const char* name);
+
+    const char* name() const { return name_; }
+
+    void lock() {
+        if(Profiler::isEnabled()){
+            lockWithProfiling();
+        } else {
+            mutex.lock();
+        }
+    }
+
+    bool try_lock() {
+        if(mutex.try_lock()){
+            beginHold();
+            return true;
+        }
+        return false;
+    }
+
+    void unlock() {
+        endHold();
+        mutex.unlock();
+    }
+
+private:
+    boost::mutex mutex;
+    const char* name_;
+    const char* holdScopeName;
+    const char* waitScopeName;
+    ProfilerThreadBuffer* holdBuffer;
+
+    void lockWithProfiling();
+
+    void beginHold() {
+        holdBuffer = Profiler::isEnabled() ? Profiler::Scope::begin(holdScopeName) : 0;
+    }
+    void endHold() {
+        if(holdBuffer){
+            Profiler::Scope::end(holdBuffer);
+            holdBuffer = 0;
+        }
+    }
+
+    friend class ProfiledConditionVariable;
+
+    ProfiledMutex(const ProfiledMutex& org);
+    ProfiledMutex& operator=(const ProfiledMutex& rhs);
+};
+
+
+/**
+   A condition variable used with ProfiledMutex. For a condition variable named "X",
+   the time for which a thread waits for the notification is recorded as the scope "X condition wait"
+   of Profiler, and the mutex is not regarded as held during the wait.
+*/
+class CNOID_EXPORT ProfiledConditionVariable
+{
+public:
+    ProfiledConditionVariable(const char* name);
+
+    void notify_one() { condition.notify_one(); }
+    void notify_all() { condition.notify_all(); }
+
+    //! \param lock A lock such as boost::unique_lock<ProfiledMutex> which is locked by the calling thread
+    template<class Lock> void wait(Lock& lock) {
+        waitWithMutex(*lock.mutex());
+    }
+
+    //! \return false if the time expired
+    template<class Lock> bool timed_wait(Lock& lock, const boost::posix_time::time_duration& duration) {
+        return timedWaitWithMutex(*lock.mutex(), duration);
+    }
+
+private:
+    boost::condition_variable condition;
+    const char* waitScopeName;
+
+    void waitWithMutex(ProfiledMutex& mutex);
+    bool timedWaitWithMutex(ProfiledMutex& mutex, const boost::posix_time::time_duration& duration);
+
+    ProfiledConditionVariable(const ProfiledConditionVariable& org);
+    ProfiledConditionVariable& operator=(const ProfiledConditionVariable& rhs);
+};
+
+}
+
+#endif
@@ -0,0 +1,517 @@
+/**
+   @file
+*/
+
+#include "Profiler.h"
+#include "AllocationTracker.h"
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/format.hpp>
+#include <set>
+#include <map>
+#include <deque>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+bool Profiler::isEnabled_ = false;
+
+namespace {
+
+struct Event
+{
+    const char* name; // null for the end of a scope
+    double time;
+    // The counts of AllocationTracker in the thread
+    long long numAllocations;
+    long long numAllocatedBytes;
+};
+
+struct TreeNode
+{
+    TreeNode(const char* name)
+        : name(name), count(0), totalTime(0.0), maxTime(0.0), numAllocations(0), numAllocatedBytes(0) { }
+    ~TreeNode() {
+        for(size_t i=0; i < children.size(); ++i){
+            delete children[i];
+        }
+    }
+    TreeNode* findOrCreateChild(const char* name) {
+        for(size_t i=0; i < children.size(); ++i){
+            if(children[i]->name == name){
+                return children[i];
+            }
+        }
+        TreeNode* child = new TreeNode(name);
+        children.push_back(child);
+        return child;
+    }
+    string name;
+    int count;
+    double totalTime;
+    double maxTime;
+    long long numAllocations;
+    long long numAllocatedBytes;
+    vector<TreeNode*> children;
+};
+
+struct TraceEvent
+{
+    TreeNode* node;
+    int threadIndex;
+    double beginTime;
+    double duration;
+    long long numAllocations;
+    long long numAllocatedBytes;
+};
+
+double currentTime()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec * 1.0e-9;
+#endif
+}
+
+string escapeJsonString(const string& s)
+{
+    string escaped;
+    escaped.reserve(s.size());
+    for(size_t i=0; i < s.size(); ++i){
+        const char c = s[i];
+        if(c == '"' || c == '\\'){
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+}
+
+namespace cnoid {
+
+/**
+   The events are written only by the owner thread and read only by the collector,
+   so the buffer works as a lock-free ring buffer of a single producer and a single consumer.
+*/
+class ProfilerThreadBuffer
+{
+public:
+    vector<Event> events;
+    boost::atomic<size_t> writeIndex;
+    boost::atomic<size_t> readIndex;
+    boost::atomic<int> numDroppedScopes;
+    boost::atomic<bool> isFinished;
+    int numOpenScopes; // accessed only by the owner thread
+
+    // The following members are accessed by the collector with the mutex locked
+    int threadIndex;
+    struct OpenScope {
+        TreeNode* node;
+        double beginTime;
+        long long numAllocationsAtBegin;
+        long long numAllocatedBytesAtBegin;
+    };
+    vector<OpenScope> openScopes;
+
+    ProfilerThreadBuffer(int size, int threadIndex)
+        : events(size),
+          writeIndex(0),
+          readIndex(0),
+          numDroppedScopes(0),
+          isFinished(false),
+          numOpenScopes(0),
+          threadIndex(threadIndex) {
+    }
+
+    bool push(const char* name, size_t numReservedEvents) {
+        const size_t w = writeIndex.load(boost::memory_order_relaxed);
+        if(w - readIndex.load(boost::memory_order_acquire) + numReservedEvents > events.size()){
+            return false;
+        }
+        Event& event = events[w % events.size()];
+        event.name = name;
+        event.time = currentTime();
+        if(AllocationTracker::isEnabledInCurrentThread()){
+            event.numAllocations = AllocationTracker::numAllocations();
+            event.numAllocatedBytes = AllocationTracker::numAllocatedBytes();
+        } else {
+            event.numAllocations = 0;
+            event.numAllocatedBytes = 0;
+        }
+        writeIndex.store(w + 1, boost::memory_order_release);
+        return true;
+    }
+};
+
+}
+
+namespace {
+
+boost::mutex mutex;
+vector<ProfilerThreadBuffer*> buffers;
+int eventBufferSize = 65536;
+int numThreads = 0;
+int numDroppedScopesOfFinishedThreads = 0;
+map<int, string> threadNames;
+
+TreeNode* root = new TreeNode("");
+deque<TraceEvent> traceEvents;
+size_t maxNumTraceEvents = 1000000;
+double originTime = 0.0;
+
+set<string> internedNames;
+
+// The buffer of an exiting thread is deleted by the collector after its events are collected
+void onThreadExit(ProfilerThreadBuffer* buffer)
+{
+    buffer->isFinished.store(true, boost::memory_order_release);
+}
+
+boost::thread_specific_ptr<ProfilerThreadBuffer> currentThreadBuffer(onThreadExit);
+
+
+ProfilerThreadBuffer* getThreadBuffer()
+{
+    ProfilerThreadBuffer* buffer = currentThreadBuffer.get();
+    if(!buffer){
+        boost::mutex::scoped_lock lock(mutex);
+        buffer = new ProfilerThreadBuffer(eventBufferSize, numThreads++);
+        threadNames[buffer->threadIndex] = str(format("Thread %1%") % buffer->threadIndex);
+        buffers.push_back(buffer);
+        currentThreadBuffer.reset(buffer);
+    }
+    return buffer;
+}
+
+
+void processEvent(ProfilerThreadBuffer* buffer, const Event& event)
+{
+    vector<ProfilerThreadBuffer::OpenScope>& openScopes = buffer->openScopes;
+
+    if(event.name){
+        TreeNode* parent;
+        if(openScopes.empty()){
+            parent = root->findOrCreateChild(threadNames[buffer->threadIndex].c_str());
+        } else {
+            parent = openScopes.back().node;
+        }
+        ProfilerThreadBuffer::OpenScope scope;
+        scope.node = parent->findOrCreateChild(event.name);
+        scope.beginTime = event.time;
+        scope.numAllocationsAtBegin = event.numAllocations;
+        scope.numAllocatedBytesAtBegin = event.numAllocatedBytes;
+        openScopes.push_back(scope);
+
+    } else if(!openScopes.empty()){
+        const ProfilerThreadBuffer::OpenScope& scope = openScopes.back();
+        const double duration = event.time - scope.beginTime;
+        TreeNode* node = scope.node;
+        ++node->count;
+        node->totalTime += duration;
+        node->maxTime = std::max(node->maxTime, duration);
+        // The counts are zero if the tracking is disabled during the scope
+        const long long numAllocations = std::max(0LL, event.numAllocations - scope.numAllocationsAtBegin);
+        const long long numAllocatedBytes = std::max(0LL, event.numAllocatedBytes - scope.numAllocatedBytesAtBegin);
+        node->numAllocations += numAllocations;
+        node->numAllocatedBytes += numAllocatedBytes;
+
+        if(maxNumTraceEvents > 0){
+            TraceEvent traceEvent;
+            traceEvent.node = node;
+            traceEvent.threadIndex = buffer->threadIndex;
+            traceEvent.beginTime = scope.beginTime;
+            traceEvent.duration = duration;
+            traceEvent.numAllocations = numAllocations;
+            traceEvent.numAllocatedBytes = numAllocatedBytes;
+            traceEvents.push_back(traceEvent);
+            while(traceEvents.size() > maxNumTraceEvents){
+                traceEvents.pop_front();
+            }
+        }
+        openScopes.pop_back();
+    }
+}
+
+
+// The mutex must be locked
+void collectEvents()
+{
+    vector<ProfilerThreadBuffer*>::iterator p = buffers.begin();
+    while(p != buffers.end()){
+        ProfilerThreadBuffer* buffer = *p;
+        // The flag is checked first so that the last events of the finished thread are collected
+        const bool isFinished = buffer->isFinished.load(boost::memory_order_acquire);
+        const size_t r = buffer->readIndex.load(boost::memory_order_relaxed);
+        const size_t w = buffer->writeIndex.load(boost::memory_order_acquire);
+        const size_t size = buffer->events.size();
+        for(size_t i = r; i < w; ++i){
+            processEvent(buffer, buffer->events[i % size]);
+        }
+        buffer->readIndex.store(w, boost::memory_order_release);
+
+        if(isFinished){
+            numDroppedScopesOfFinishedThreads += buffer->numDroppedScopes;
+            delete buffer;
+            p = buffers.erase(p);
+        } else {
+            ++p;
+        }
+    }
+}
+
+
+void copyTree(const TreeNode* node, Profiler::Node& out_node)
+{
+    out_node.name = node->name;
+    out_node.count = node->count;
+    out_node.totalTime = node->totalTime;
+    out_node.maxTime = node->maxTime;
+    out_node.numAllocations = node->numAllocations;
+    out_node.numAllocatedBytes = node->numAllocatedBytes;
+    out_node.children.resize(node->children.size());
+    for(size_t i=0; i < node->children.size(); ++i){
+        copyTree(node->children[i], out_node.children[i]);
+    }
+}
+
+
+void getReportNameWidth(const TreeNode* node, int depth, size_t& io_width)
+{
+    for(size_t i=0; i < node->children.size(); ++i){
+        const TreeNode* child = node->children[i];
+        io_width = std::max(io_width, depth * 2 + child->name.size());
+        getReportNameWidth(child, depth + 1, io_width);
+    }
+}
+
+
+void putReportNodes(std::ostream& os, const TreeNode* node, int depth, const string& nameFormat, bool doPutAllocations)
+{
+    for(size_t i=0; i < node->children.size(); ++i){
+        const TreeNode* child = node->children[i];
+        os << format(nameFormat) % (string(depth * 2, ' ') + child->name);
+        if(depth == 0){
+            // The thread
+            os << "\n";
+        } else {
+            os << format(" %7d %11.3f %11.3f")
+                % child->count % (child->totalTime * 1000.0) % (child->maxTime * 1000.0);
+            if(doPutAllocations){
+                os << format(" %11d %13d") % child->numAllocations % child->numAllocatedBytes;
+            }
+            os << "\n";
+        }
+        putReportNodes(os, child, depth + 1, nameFormat, doPutAllocations);
+    }
+}
+
+}
+
+
+void Profiler::setEnabled(bool on)
+{
+    if(on && originTime == 0.0){
+        originTime = currentTime();
+    }
+    isEnabled_ = on;
+}
+
+
+void Profiler::setThreadName(const std::string& name)
+{
+    ProfilerThreadBuffer* buffer = getThreadBuffer();
+    boost::mutex::scoped_lock lock(mutex);
+    // The events recorded with the previous name are collected under the previous name
+    collectEvents();
+    threadNames[buffer->threadIndex] = name;
+}
+
+
+void Profiler::setEventBufferSize(int n)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    eventBufferSize = std::max(n, 16);
+}
+
+
+void Profiler::setMaxNumTraceEvents(int n)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    maxNumTraceEvents = std::max(n, 0);
+    while(traceEvents.size() > maxNumTraceEvents){
+        traceEvents.pop_front();
+    }
+}
+
+
+const char* Profiler::internName(const std::string& name)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return internedNames.insert(name).first->c_str();
+}
+
+
+void Profiler::collect()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    collectEvents();
+}
+
+
+void Profiler::clear()
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    collectEvents();
+
+    // The scopes which are still open are moved to the new tree
+    vector< vector<string> > openScopePaths(buffers.size());
+    for(size_t i=0; i < buffers.size(); ++i){
+        vector<ProfilerThreadBuffer::OpenScope>& openScopes = buffers[i]->openScopes;
+        for(size_t j=0; j < openScopes.size(); ++j){
+            openScopePaths[i].push_back(openScopes[j].node->name);
+        }
+    }
+
+    traceEvents.clear();
+    delete root;
+    root = new TreeNode("");
+
+    for(size_t i=0; i < buffers.size(); ++i){
+        vector<ProfilerThreadBuffer::OpenScope>& openScopes = buffers[i]->openScopes;
+        if(!openScopes.empty()){
+            TreeNode* node = root->findOrCreateChild(threadNames[buffers[i]->threadIndex].c_str());
+            for(size_t j=0; j < openScopes.size(); ++j){
+                node = node->findOrCreateChild(openScopePaths[i][j].c_str());
+                openScopes[j].node = node;
+            }
+        }
+        buffers[i]->numDroppedScopes = 0;
+    }
+    numDroppedScopesOfFinishedThreads = 0;
+
+    originTime = currentTime();
+}
+
+
+int Profiler::numDroppedScopes()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    int n = numDroppedScopesOfFinishedThreads;
+    for(size_t i=0; i < buffers.size(); ++i){
+        n += buffers[i]->numDroppedScopes;
+    }
+    return n;
+}
+
+
+void Profiler::getTree(Node& out_root)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    collectEvents();
+    copyTree(root, out_root);
+}
+
+
+void Profiler::putReport(std::ostream& os)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    collectEvents();
+
+    size_t width = 5;
+    getReportNameWidth(root, 0, width);
+    const string nameFormat = str(format("%%-%1%s") % width);
+
+    const bool doPutAllocations = AllocationTracker::isAvailable();
+    os << format(nameFormat) % "Scope" << "   Count  Total [ms]    Max [ms]";
+    if(doPutAllocations){
+        os << " Allocations Allocated [B]";
+    }
+    os << "\n";
+    putReportNodes(os, root, 0, nameFormat, doPutAllocations);
+    os.flush();
+}
+
+
+bool Profiler::exportChromeTrace(const std::string& filename)
+{
+    ofstream ofs(filename.c_str());
+    if(!ofs){
+        return false;
+    }
+
+    boost::mutex::scoped_lock lock(mutex);
+
+    collectEvents();
+
+    ofs.precision(15);
+    ofs << "{\"traceEvents\":[\n";
+    bool isFirst = true;
+    for(map<int, string>::iterator p = threadNames.begin(); p != threadNames.end(); ++p){
+        if(!isFirst){
+            ofs << ",\n";
+        }
+        ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << p->first
+            << ",\"args\":{\"name\":\"" << escapeJsonString(p->second) << "\"}}";
+        isFirst = false;
+    }
+    for(size_t i=0; i < traceEvents.size(); ++i){
+        const TraceEvent& e = traceEvents[i];
+        if(!isFirst){
+            ofs << ",\n";
+        }
+        ofs << "{\"name\":\"" << escapeJsonString(e.node->name) << "\""
+            << ",\"cat\":\"profiler\",\"ph\":\"X\""
+            << ",\"ts\":" << (e.beginTime - originTime) * 1.0e6
+            << ",\"dur\":" << e.duration * 1.0e6
+            << ",\"pid\":1,\"tid\":" << e.threadIndex;
+        if(e.numAllocations > 0){
+            ofs << ",\"args\":{\"allocations\":" << e.numAllocations
+                << ",\"allocatedBytes\":" << e.numAllocatedBytes << "}";
+        }
+        ofs << "}";
+        isFirst = false;
+    }
+    ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return ofs.good();
+}
+
+
+ProfilerThreadBuffer* Profiler::Scope::begin(const char* name)
+{
+    ProfilerThreadBuffer* buffer = getThreadBuffer();
+
+    // The space for the ends of the open scopes is kept so that the ends are always recorded
+    if(!buffer->push(name, buffer->numOpenScopes + 2)){
+        ++buffer->numDroppedScopes;
+        return 0;
+    }
+    ++buffer->numOpenScopes;
+    return buffer;
+}
+
+
+void Profiler::Scope::end(ProfilerThreadBuffer* buffer)
+{
+    buffer->push(0, 1);
+    --buffer->numOpenScopes;
+}
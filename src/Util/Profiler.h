@@ -0,0 +1,128 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_PROFILER_H
+#define CNOID_UTIL_PROFILER_H
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ProfilerThreadBuffer;
+
+/**
+   This class measures the named scopes which can be nested in any thread.
+   A scope is measured by putting a Scope object in the code, and the scopes are aggregated
+   into a tree for each thread, in which the scopes called in the same path are merged.
+
+   Each thread records the beginnings and the ends of its scopes into its own event buffer
+   without locking. The events are moved into the tree and the trace by collect(), which is
+   called by the functions getting the results. The events of a thread are discarded while its
+   buffer is full, so collect() should be called periodically when the profiler is enabled for
+   a long time. ProfilerView does it while it is shown.
+
+   Nothing is recorded unless the profiler is enabled, and a disabled Scope object only checks
+   a flag, so the scopes can be left in the code paths of the normal use. The scopes of
+   TimingProfiler and SimulationProfiler are also recorded as the scopes of this profiler.
+
+   The heap allocations in a scope are also counted when AllocationTracker is enabled in the thread.
+   The waits and the holds of the locks at the synchronization points are recorded by ProfiledMutex
+   and ProfiledConditionVariable.
+
+   The name of a scope must be a string which is valid until the events are collected, such as
+   a string literal. A name made at run time can be given by internName(). The events of
+   a module such as a controller must be collected before the module is unloaded.
+*/
+class CNOID_EXPORT Profiler
+{
+public:
+    static void setEnabled(bool on);
+    static bool isEnabled() { return isEnabled_; }
+
+    /**
+       The name of the calling thread in the tree and the trace. The trees of the threads which
+       have the same name are merged. The default name is "Thread N".
+    */
+    static void setThreadName(const std::string& name);
+
+    //! The number of the events in the buffer of each thread created after this call. The default value is 65536.
+    static void setEventBufferSize(int n);
+
+    //! The oldest events in the trace are discarded when the number exceeds this value. The default value is 1000000.
+    static void setMaxNumTraceEvents(int n);
+
+    //! @return the pointer to the string which is kept until the program exits
+    static const char* internName(const std::string& name);
+
+    //! Moves the events recorded by the threads into the tree and the trace
+    static void collect();
+
+    static void clear();
+
+    //! The number of the scopes which were not recorded because the buffers were full
+    static int numDroppedScopes();
+
+    class Node
+    {
+    public:
+        Node() : count(0), totalTime(0.0), maxTime(0.0), numAllocations(0), numAllocatedBytes(0) { }
+        std::string name;
+        int count;
+        double totalTime; ///< in seconds
+        double maxTime; ///< in seconds
+        long long numAllocations; ///< counted by AllocationTracker
+        long long numAllocatedBytes;
+        std::vector<Node> children;
+    };
+
+    /**
+       The children of the root node are the threads, whose children are their top-level scopes.
+       The events are collected before the tree is copied.
+    */
+    static void getTree(Node& out_root);
+
+    static void putReport(std::ostream& os);
+
+    //! The trace is written in the trace event format of Chrome (chrome://tracing)
+    static bool exportChromeTrace(const std::string& filename);
+
+    class CNOID_EXPORT Scope
+    {
+    public:
+        //! \param name The name is not recorded if it is null
+        Scope(const char* name) {
+            if(isEnabled_ && name){
+                buffer = begin(name);
+            } else {
+                buffer = 0;
+            }
+        }
+        ~Scope() {
+            if(buffer){
+                end(buffer);
+            }
+        }
+    private:
+        ProfilerThreadBuffer* buffer;
+
+        static ProfilerThreadBuffer* begin(const char* name);
+        static void end(ProfilerThreadBuffer* buffer);
+
+        // The hold scope of a mutex is opened by the lock and closed by the unlock
+        friend class ProfiledMutex;
+
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+    };
+
+private:
+    static bool isEnabled_;
+};
+
+}
+
+#endif
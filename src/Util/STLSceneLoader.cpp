@@ -1,106 +1,520 @@
 
 #include "STLSceneLoader.h"
 #include "SceneDrawables.h"
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
-#include <fstream>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
 
 using namespace std;
-using namespace boost::algorithm;
 using namespace cnoid;
 
+namespace {
 
-const char* STLSceneLoader::format() const
+const size_t BinaryHeaderSize = 84;
+const size_t BinaryTriangleSize = 50;
+const size_t WindowSize = 8 * 1024 * 1024;
+
+// The maximum length of the statement in an ASCII file which is guaranteed to be read in a window
+const size_t AsciiStatementMargin = 4096;
+
+/**
+   A file is mapped by the windows of a limited size so that the resident pages
+   of a large file do not increase the memory usage of the process.
+*/
+class MappedFileWindow
 {
-    return "STL";
+public:
+    const char* begin;
+    const char* end;
+
+    MappedFileWindow() : begin(0), end(0), offset(0), fileSize(0) { }
+
+    bool open(const string& filename) {
+        try {
+            fileSize = boost::filesystem::file_size(filename);
+            if(fileSize == 0){
+                return false;
+            }
+            this->filename = filename;
+            map(0);
+        } catch(const std::exception&){
+            return false;
+        }
+        return file.is_open();
+    }
+
+    boost::uintmax_t size() const { return fileSize; }
+
+    bool isLast() const { return (offset + (end - begin) == fileSize); }
+
+    /**
+       Maps the next window which starts from the page containing pos.
+       @return the pointer corresponding to pos in the new window
+    */
+    const char* slide(const char* pos) {
+        const boost::uintmax_t position = offset + (pos - begin);
+        const boost::uintmax_t alignment = boost::iostreams::mapped_file_source::alignment();
+        try {
+            map(position - position % alignment);
+        } catch(const std::exception&){
+            begin = end = 0;
+            return 0;
+        }
+        return begin + (position - offset);
+    }
+
+private:
+    boost::iostreams::mapped_file_source file;
+    string filename;
+    boost::uintmax_t offset;
+    boost::uintmax_t fileSize;
+
+    void map(boost::uintmax_t newOffset) {
+        file.close();
+        offset = newOffset;
+        const size_t length = std::min(static_cast<boost::uintmax_t>(WindowSize), fileSize - offset);
+        file.open(filename, length, offset);
+        begin = file.data();
+        end = begin + file.size();
+    }
+};
+
+/**
+   The vectors which have the same elements are merged into one element of the array
+   by an open addressing hash table of the element indices.
+*/
+class VectorWelder
+{
+public:
+    VectorWelder(SgVectorArray<Vector3f>& elements, size_t expectedSize)
+        : elements(elements) {
+        size_t size = 1024;
+        while(size < expectedSize * 2){
+            size *= 2;
+        }
+        table.resize(size, -1);
+        mask = size - 1;
+    }
+
+    int weld(const Vector3f& v) {
+        // Adding zero makes negative zero positive zero
+        const Vector3f p(v[0] + 0.0f, v[1] + 0.0f, v[2] + 0.0f);
+        size_t i = hash(p) & mask;
+        while(true){
+            const int index = table[i];
+            if(index < 0){
+                break;
+            }
+            if(elements[index] == p){
+                return index;
+            }
+            i = (i + 1) & mask;
+        }
+        const int index = elements.size();
+        elements.push_back(p);
+        table[i] = index;
+        if(elements.size() * 2 > table.size()){
+            expand();
+        }
+        return index;
+    }
+
+private:
+    SgVectorArray<Vector3f>& elements;
+    vector<int> table;
+    size_t mask;
+
+    static size_t hash(const Vector3f& v) {
+        boost::uint32_t bits[3];
+        memcpy(bits, v.data(), sizeof(bits));
+        boost::uint32_t h = bits[0] * 0x9e3779b1u;
+        h = (h ^ bits[1]) * 0x85ebca6bu;
+        h = (h ^ bits[2]) * 0xc2b2ae35u;
+        return h ^ (h >> 16);
+    }
+
+    void expand() {
+        table.assign(table.size() * 2, -1);
+        mask = table.size() - 1;
+        const int n = elements.size();
+        for(int index = 0; index < n; ++index){
+            size_t i = hash(elements[index]) & mask;
+            while(table[i] >= 0){
+                i = (i + 1) & mask;
+            }
+            table[i] = index;
+        }
+    }
+};
+
+
+class MeshBuilder
+{
+public:
+    SgMeshPtr mesh;
+    SgVertexArrayPtr vertices;
+    SgNormalArrayPtr normals;
+    SgIndexArray& normalIndices;
+    VectorWelder vertexWelder;
+    VectorWelder normalWelder;
+
+    MeshBuilder(size_t expectedNumTriangles)
+        : mesh(new SgMesh),
+          vertices(new SgVertexArray),
+          normals(new SgNormalArray),
+          normalIndices(mesh->normalIndices()),
+          vertexWelder(*vertices, expectedNumTriangles / 2),
+          normalWelder(*normals, 0) {
+        // A closed mesh has about a half number of vertices of its triangles
+        vertices->reserve(expectedNumTriangles / 2);
+        mesh->reserveNumTriangles(expectedNumTriangles);
+        normalIndices.reserve(expectedNumTriangles * 3);
+    }
+
+    int addVertex(const Vector3f& v) {
+        return vertexWelder.weld(v);
+    }
+
+    /**
+       The normal given by the file is used as it is unless it is zero or invalid.
+       In that case the normal is calculated from the vertices.
+       The faces on the same plane share one normal.
+    */
+    void addTriangle(int v0, int v1, int v2, const Vector3f& normal) {
+        mesh->addTriangle(v0, v1, v2);
+        int normalIndex;
+        float n2 = normal.squaredNorm();
+        if(n2 > 0.0f && n2 < std::numeric_limits<float>::infinity()){
+            normalIndex = normalWelder.weld(normal);
+        } else {
+            const SgVertexArray& v = *vertices;
+            Vector3f n = (v[v1] - v[v0]).cross(v[v2] - v[v0]);
+            n2 = n.squaredNorm();
+            if(n2 > 0.0f){
+                n /= sqrtf(n2);
+            }
+            normalIndex = normalWelder.weld(n);
+        }
+        normalIndices.push_back(normalIndex);
+        normalIndices.push_back(normalIndex);
+        normalIndices.push_back(normalIndex);
+    }
+
+    SgShape* createShape() {
+        if(vertices->empty()){
+            return 0;
+        }
+        mesh->setVertices(vertices);
+        mesh->setNormals(normals);
+        SgShape* shape = new SgShape;
+        shape->setMesh(mesh);
+        return shape;
+    }
+};
+
+
+inline Vector3f readBinaryVector3(const char* p)
+{
+    float v[3];
+    memcpy(v, p, sizeof(v));
+    return Vector3f(v[0], v[1], v[2]);
 }
 
 
-static void readVector3(string text, SgVectorArray<Vector3f>* array)
+SgShape* loadBinary(MappedFileWindow& window)
 {
-    trim(text);
-    Vector3f value;
-    int i = 0;
-    split_iterator<string::iterator> iter = make_split_iterator(text, token_finder(is_space(), token_compress_on));
-    while(iter != split_iterator<string::iterator>()){
-        value[i++] = boost::lexical_cast<float>(*iter++);
-        if(i == 3){
-            array->push_back(value);
-            break;
+    boost::uint32_t numTriangles;
+    memcpy(&numTriangles, window.begin + 80, 4);
+    const boost::uintmax_t numAvailableTriangles = (window.size() - BinaryHeaderSize) / BinaryTriangleSize;
+    if(numTriangles > numAvailableTriangles){
+        numTriangles = numAvailableTriangles;
+    }
+
+    MeshBuilder builder(numTriangles);
+    const char* p = window.begin + BinaryHeaderSize;
+    for(size_t i = 0; i < numTriangles; ++i){
+        if(window.end - p < static_cast<ptrdiff_t>(BinaryTriangleSize)){
+            p = window.slide(p);
+            if(!p){
+                break;
+            }
         }
+        const Vector3f normal = readBinaryVector3(p);
+        const int v0 = builder.addVertex(readBinaryVector3(p + 12));
+        const int v1 = builder.addVertex(readBinaryVector3(p + 24));
+        const int v2 = builder.addVertex(readBinaryVector3(p + 36));
+        builder.addTriangle(v0, v1, v2, normal);
+        p += BinaryTriangleSize;
     }
+    return builder.createShape();
 }
 
 
-SgNode* STLSceneLoader::load(const std::string& fileName)
+/**
+   The tokens are read directly from the mapped window, which is not null-terminated.
+*/
+class AsciiScanner
 {
-    std::ifstream ifs(fileName.c_str(), std::ios::in | std::ios::binary);
-
-    SgVertexArrayPtr vertices = new SgVertexArray;
-    SgNormalArrayPtr normals = new SgNormalArray;
-
-    uint8_t header[80];
-    ifs.read((char *)header, 80);
-    if(strncmp((char *)header, "solid", 5) != 0){
-        // stl file is in binary format
-        uint32_t ntriangle;
-        ifs.read((char *)&ntriangle, 4);
-        for(size_t i = 0; i < ntriangle; i++){
-            Vector3f value;
-            for(size_t j = 0; j < 3; j++){
-                float v;
-                ifs.read((char *)&v, 4);
-                value[j] = v;
-            }
-            normals->push_back(value);
-            for(size_t k = 0; k < 3; k++){
-                Vector3f value;
-                for(size_t j = 0; j < 3; j++){
-                    float v;
-                    ifs.read((char *)&v, 4);
-                    value[j] = v;
+public:
+    MappedFileWindow& window;
+    const char* pos;
+    const char* end;
+    char decimalPoint;
+
+    AsciiScanner(MappedFileWindow& window)
+        : window(window), pos(window.begin), end(window.end) {
+        decimalPoint = localeconv()->decimal_point[0];
+    }
+
+    /**
+       Slides the window before the next statement when the statement may exceed the window.
+       @return false if the end of the file has been reached
+    */
+    bool prepareStatement() {
+        while(pos != end && isSpace(*pos)){
+            ++pos;
+        }
+        if(!window.isLast() && end - pos < static_cast<ptrdiff_t>(AsciiStatementMargin)){
+            pos = window.slide(pos);
+            if(!pos){
+                end = 0;
+                return false;
+            }
+            end = window.end;
+        }
+        return (pos != end);
+    }
+
+    static bool isSpace(char c) {
+        return (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v');
+    }
+
+    bool readToken(const char*& token, size_t& length) {
+        while(pos != end && isSpace(*pos)){
+            ++pos;
+        }
+        if(pos == end){
+            return false;
+        }
+        token = pos;
+        while(pos != end && !isSpace(*pos)){
+            ++pos;
+        }
+        length = pos - token;
+        return true;
+    }
+
+    void skipLine() {
+        while(pos != end && *pos != '\n'){
+            ++pos;
+        }
+    }
+
+    static bool isKeyword(const char* token, size_t length, const char* keyword) {
+        for(size_t i = 0; i < length; ++i){
+            if(!keyword[i] || (token[i] | 0x20) != keyword[i]){
+                return false;
+            }
+        }
+        return !keyword[length];
+    }
+
+    bool readFloat(float& out_value) {
+        const char* token;
+        size_t length;
+        if(!readToken(token, length)){
+            return false;
+        }
+        if(parseFloatFast(token, token + length, out_value)){
+            return true;
+        }
+        // The general case such as the long mantissa is converted by the C library
+        char buf[64];
+        if(length >= sizeof(buf)){
+            return false;
+        }
+        for(size_t i = 0; i < length; ++i){
+            buf[i] = (token[i] == '.') ? decimalPoint : token[i];
+        }
+        buf[length] = '\0';
+        char* tail;
+        out_value = static_cast<float>(strtod(buf, &tail));
+        return (tail == buf + length);
+    }
+
+    bool readVector3(Vector3f& out_v) {
+        return readFloat(out_v[0]) && readFloat(out_v[1]) && readFloat(out_v[2]);
+    }
+
+    /**
+       A number whose mantissa and power of ten are exactly represented by float is
+       converted with one float multiplication or division, which gives the correctly rounded value.
+    */
+    static bool parseFloatFast(const char* p, const char* end, float& out_value) {
+        static const float powersOf10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+        bool negative = false;
+        if(p != end && (*p == '+' || *p == '-')){
+            negative = (*p == '-');
+            ++p;
+        }
+        boost::uint32_t mantissa = 0;
+        int numDigits = 0;
+        int exponent = 0;
+        bool hasDigit = false;
+        while(p != end && *p >= '0' && *p <= '9'){
+            if(mantissa > 0 || *p != '0'){
+                if(++numDigits > 8){
+                    return false;
                 }
-                vertices->push_back(value);
             }
-            uint16_t attrib;
-            ifs.read((char *)&attrib, 2);
+            mantissa = mantissa * 10 + (*p++ - '0');
+            hasDigit = true;
         }
-    } else {
-        // stl file is in text format
-        std::ifstream ifs(fileName.c_str(), std::ios::in);
-        std::string line;
-        while(!ifs.eof() && getline(ifs, line)){
-            trim(line);
-            if(boost::istarts_with(line, "vertex")){
-                readVector3(line.substr(6), vertices);
-            } else if(boost::istarts_with(line, "facet normal")){
-                readVector3(line.substr(12), normals);
-            }
-        }
-    }
-    SgShape* shape = 0;
-    
-    if(!vertices->empty()){
-        shape = new SgShape;
-        SgMesh* mesh = shape->getOrCreateMesh();
-        mesh->setVertices(vertices);
-        const int numTriangles = vertices->size() / 3;
-        mesh->reserveNumTriangles(numTriangles);
-        for(int i = 0; i < numTriangles; ++i){
-            const int j = i * 3;
-            mesh->addTriangle(j, j + 1, j + 2);
+        if(p != end && *p == '.'){
+            ++p;
+            while(p != end && *p >= '0' && *p <= '9'){
+                if(mantissa > 0 || *p != '0'){
+                    if(++numDigits > 8){
+                        return false;
+                    }
+                }
+                mantissa = mantissa * 10 + (*p++ - '0');
+                --exponent;
+                hasDigit = true;
+            }
+        }
+        if(!hasDigit){
+            return false;
         }
-        if(!normals->empty()){
-            mesh->setNormals(normals);
-            SgIndexArray& indices = mesh->normalIndices();
-            indices.reserve(normals->size() * 3);
-            for(int i = 0; i < normals->size(); ++i) {
-                indices.push_back(i);
-                indices.push_back(i);
-                indices.push_back(i);
+        if(p != end && (*p == 'e' || *p == 'E')){
+            ++p;
+            bool negativeExponent = false;
+            if(p != end && (*p == '+' || *p == '-')){
+                negativeExponent = (*p == '-');
+                ++p;
             }
+            if(p == end){
+                return false;
+            }
+            int e = 0;
+            while(p != end && *p >= '0' && *p <= '9'){
+                if(e > 1000){
+                    return false;
+                }
+                e = e * 10 + (*p++ - '0');
+            }
+            exponent += negativeExponent ? -e : e;
+        }
+        if(p != end || mantissa > (1u << 24) || exponent < -10 || exponent > 10){
+            return false;
         }
+        float value = static_cast<float>(mantissa);
+        if(exponent < 0){
+            value /= powersOf10[-exponent];
+        } else {
+            value *= powersOf10[exponent];
+        }
+        out_value = negative ? -value : value;
+        return true;
+    }
+};
+
+
+SgShape* loadAscii(MappedFileWindow& window)
+{
+    AsciiScanner scanner(window);
+    // A facet usually has about 250 characters
+    MeshBuilder builder(std::min(window.size() / 250, static_cast<boost::uintmax_t>(1 << 24)));
+
+    Vector3f normal = Vector3f::Zero();
+    Vector3f v;
+    int corners[3];
+    int numCorners = 0;
+    const char* token;
+    size_t length;
+
+    while(scanner.prepareStatement() && scanner.readToken(token, length)){
+        if(AsciiScanner::isKeyword(token, length, "vertex")){
+            if(!scanner.readVector3(v)){
+                break;
+            }
+            const int index = builder.addVertex(v);
+            if(numCorners < 3){
+                corners[numCorners++] = index;
+                if(numCorners == 3){
+                    builder.addTriangle(corners[0], corners[1], corners[2], normal);
+                }
+            } else {
+                // The polygon which has more vertices is divided into a triangle fan
+                builder.addTriangle(corners[0], corners[2], index, normal);
+                corners[2] = index;
+            }
+        } else if(AsciiScanner::isKeyword(token, length, "facet")){
+            numCorners = 0;
+            if(!scanner.readToken(token, length) || !AsciiScanner::isKeyword(token, length, "normal") ||
+               !scanner.readVector3(normal)){
+                normal.setZero();
+            }
+        } else if(AsciiScanner::isKeyword(token, length, "solid")){
+            // skip the name of the solid
+            scanner.skipLine();
+        }
+    }
+
+    return builder.createShape();
+}
+
+
+/**
+   Some binary files also begin with "solid", so the binary format is recognized
+   by the file size which matches the number of the triangles.
+*/
+bool isBinary(const MappedFileWindow& window)
+{
+    const char* data = window.begin;
+    const boost::uintmax_t size = window.size();
+    if(size >= BinaryHeaderSize){
+        boost::uint32_t numTriangles;
+        memcpy(&numTriangles, data + 80, 4);
+        if(BinaryHeaderSize + static_cast<boost::uint64_t>(numTriangles) * BinaryTriangleSize == size){
+            return true;
+        }
+    }
+    const char* p = data;
+    const char* end = window.end;
+    while(p != end && AsciiScanner::isSpace(*p)){
+        ++p;
+    }
+    if(end - p >= 5 && strncmp(p, "solid", 5) == 0){
+        return false;
+    }
+    return (size >= BinaryHeaderSize);
+}
+
+}
+
+
+const char* STLSceneLoader::format() const
+{
+    return "STL";
+}
+
+
+SgNode* STLSceneLoader::load(const std::string& fileName)
+{
+    MappedFileWindow window;
+    if(!window.open(fileName)){
+        return 0;
+    }
+    if(isBinary(window)){
+        return loadBinary(window);
+    } else {
+        return loadAscii(window);
     }
-    
-    return shape; 
 }
@@ -225,6 +225,7 @@ SgTextureTransform* SgTexture::setTextureTransform(SgTextureTransform* textureTr
 SgMeshBase::SgMeshBase()
 {
     isSolid_ = false;
+    isBboxCacheValid = false;
 }
 
 
@@ -255,6 +256,7 @@ SgMeshBase::SgMeshBase(const SgMeshBase& org, SgCloneMap& cloneMap)
     }
     isSolid_ = org.isSolid_;
     bbox = org.bbox;
+    isBboxCacheValid = org.isBboxCacheValid;
 }
 
     
@@ -279,8 +281,21 @@ SgObject* SgMeshBase::childObject(int index)
 }
 
 
+void SgMeshBase::onUpdated(SgUpdate& update)
+{
+    const SgUpdate::Path& path = update.path();
+    if(path.empty() || path.front() == vertices_){
+        isBboxCacheValid = false;
+    }
+    SgObject::onUpdated(update);
+}
+
+
 const BoundingBox& SgMeshBase::boundingBox() const
 {
+    if(!isBboxCacheValid){
+        const_cast<SgMeshBase*>(this)->updateBoundingBox();
+    }
     return bbox;
 }
 
@@ -296,11 +311,25 @@ void SgMeshBase::updateBoundingBox()
         }
         bbox = bboxf;
     }
+    isBboxCacheValid = true;
+}
+
+
+size_t SgMeshBase::memoryUsage() const
+{
+    size_t usage =
+        (normalIndices_.capacity() + colorIndices_.capacity() + texCoordIndices_.capacity()) * sizeof(int);
+    if(vertices_) usage += vertices_->memoryUsage();
+    if(normals_) usage += normals_->memoryUsage();
+    if(colors_) usage += colors_->memoryUsage();
+    if(texCoords_) usage += texCoords_->memoryUsage();
+    return usage;
 }
 
 
 SgVertexArray* SgMeshBase::setVertices(SgVertexArray* vertices)
 {
+    isBboxCacheValid = false;
     if(vertices_){
         vertices_->removeParent(this);
     }
@@ -399,6 +428,12 @@ SgObject* SgMesh::clone(SgCloneMap& cloneMap) const
 }
 
 
+size_t SgMesh::memoryUsage() const
+{
+    return SgMeshBase::memoryUsage() + triangleVertices_.capacity() * sizeof(int);
+}
+
+
 void SgMesh::updateBoundingBox()
 {
     if(!USE_FACES_FOR_BOUNDING_BOX_CALCULATION){
@@ -416,6 +451,7 @@ void SgMesh::updateBoundingBox()
             }
             bbox = bboxf;
         }
+        isBboxCacheValid = true;
     }
 }
 
@@ -440,6 +476,12 @@ SgObject* SgPolygonMesh::clone(SgCloneMap& cloneMap) const
 }
 
 
+size_t SgPolygonMesh::memoryUsage() const
+{
+    return SgMeshBase::memoryUsage() + polygonVertices_.capacity() * sizeof(int);
+}
+
+
 void SgPolygonMesh::updateBoundingBox()
 {
     if(!USE_FACES_FOR_BOUNDING_BOX_CALCULATION){
@@ -460,6 +502,7 @@ void SgPolygonMesh::updateBoundingBox()
             }
             bbox = bboxf;
         }
+        isBboxCacheValid = true;
     }
 }
 
@@ -601,7 +644,7 @@ SgTexture* SgShape::getOrCreateTexture()
 
 SgPlot::SgPlot()
 {
-
+    isBboxCacheValid = false;
 }
         
 
@@ -626,6 +669,7 @@ SgPlot::SgPlot(const SgPlot& org, SgCloneMap& cloneMap)
     normalIndices_ = org.normalIndices_;
     colorIndices_ = org.colorIndices_;
     bbox = org.bbox;
+    isBboxCacheValid = org.isBboxCacheValid;
 }
 
 
@@ -648,8 +692,31 @@ SgObject* SgPlot::childObject(int index)
 }
     
 
+void SgPlot::onUpdated(SgUpdate& update)
+{
+    const SgUpdate::Path& path = update.path();
+    if(path.empty() || path.front() == vertices_){
+        isBboxCacheValid = false;
+    }
+    SgNode::onUpdated(update);
+}
+
+
+size_t SgPlot::memoryUsage() const
+{
+    size_t usage = (normalIndices_.capacity() + colorIndices_.capacity()) * sizeof(int);
+    if(vertices_) usage += vertices_->memoryUsage();
+    if(normals_) usage += normals_->memoryUsage();
+    if(colors_) usage += colors_->memoryUsage();
+    return usage;
+}
+
+
 const BoundingBox& SgPlot::boundingBox() const
 {
+    if(!isBboxCacheValid){
+        const_cast<SgPlot*>(this)->updateBoundingBox();
+    }
     return bbox;
 }
 
@@ -665,11 +732,13 @@ void SgPlot::updateBoundingBox()
         }
         bbox = bboxf;
     }
+    isBboxCacheValid = true;
 }
 
 
 SgVertexArray* SgPlot::setVertices(SgVertexArray* vertices)
 {
+    isBboxCacheValid = false;
     if(vertices_){
         vertices_->removeParent(this);
     }
@@ -141,6 +141,13 @@ private:
 typedef ref_ptr<SgTexture> SgTexturePtr;
 
 
+/**
+   The elements are shared with the copies of the array such as the clones created by
+   SgCloneMap, and they are copied when the array is modified while it is shared.
+   Note that the functions returning a non-const reference, pointer or iterator are
+   regarded as modifying the array. Use the const object to only read the elements
+   of an array which may be shared.
+*/
 template<class T, class Alloc = std::allocator<T> > class SgVectorArray : public SgObject
 {
     typedef std::vector<T> Container;
@@ -156,55 +163,89 @@ public:
     typedef typename Container::const_pointer const_pointer;
     typedef typename T::Scalar Scalar;
 
-    SgVectorArray() { }
+    SgVectorArray() : values(new Container), isShared_(false) { }
 
-    SgVectorArray(size_t size) : values(size) { }
+    SgVectorArray(size_t size) : values(new Container(size)), isShared_(false) { }
 
-    SgVectorArray(const std::vector<T>& org) : values(org) { }
+    SgVectorArray(const std::vector<T>& org) : values(new Container(org)), isShared_(false) { }
 
     template<class Element>
-    SgVectorArray(const std::vector<Element>& org) {
-        values.reserve(org.size());
+    SgVectorArray(const std::vector<Element>& org) : values(new Container), isShared_(false) {
+        values->reserve(org.size());
         for(typename std::vector<Element>::const_iterator p = org.begin(); p != org.end(); ++p){
-            values.push_back(p->template cast<typename T::Scalar>());
+            values->push_back(p->template cast<typename T::Scalar>());
         }
     }
         
-    SgVectorArray(const SgVectorArray& org) : SgObject(org), values(org.values) { }
+    SgVectorArray(const SgVectorArray& org) : SgObject(org), values(org.values), isShared_(true) {
+        org.isShared_ = true;
+    }
 
     virtual SgObject* clone(SgCloneMap& cloneMap) const { return new SgVectorArray(*this); }
         
     SgVectorArray<T>& operator=(const SgVectorArray<T>& rhs) {
-        values = rhs.values;
+        if(values != rhs.values){
+            values = rhs.values;
+            isShared_ = true;
+            rhs.isShared_ = true;
+        }
         return *this;
     }
-    iterator begin() { return values.begin(); }
-    const_iterator begin() const { return values.begin(); }
-    iterator end() { return values.end(); }
-    const_iterator end() const { return values.end(); }
-    size_type size() const { return values.size(); }
-    void resize(size_type s) { values.resize(s); }
-    void resize(size_type s, const T& v) { values.resize(s, v); }
-    bool empty() const { return values.empty(); }
-    void reserve(size_type s) { values.reserve(s); }
-    T& operator[](size_type i) { return values[i]; }
-    const T& operator[](size_type i) const { return values[i]; }
-    T& at(size_type i) { return values[i]; }
-    const T& at(size_type i) const { return values[i]; }
-    T& front() { return values.front(); }
-    const T& front() const { return values.front(); }
-    T& back() { return values.back(); }
-    const T& back() const { return values.back(); }
-    Scalar* data() { return values.front().data(); }
-    const Scalar* data() const { return values.front().data(); }
-    void push_back(const T& v) { values.push_back(v); }
-    void pop_back() { values.pop_back(); }
-    iterator erase(iterator p) { return values.erase(p); }
-    iterator erase(iterator first, iterator last) { return values.erase(first, last); }
-    void clear() { values.clear(); }
+
+    //! Returns true if the elements may be shared with another array
+    bool isShared() const { return isShared_ && !values.unique(); }
+
+    //! The size of the element buffer in bytes. The buffer may be shared with other arrays.
+    size_t memoryUsage() const { return values->capacity() * sizeof(T); }
+
+    //! This identifies the element buffer shared by the copies of the array
+    const void* bufferId() const { return values.get(); }
+    
+    iterator begin() { return container().begin(); }
+    const_iterator begin() const { return values->begin(); }
+    iterator end() { return container().end(); }
+    const_iterator end() const { return values->end(); }
+    size_type size() const { return values->size(); }
+    void resize(size_type s) { container().resize(s); }
+    void resize(size_type s, const T& v) { container().resize(s, v); }
+    bool empty() const { return values->empty(); }
+    void reserve(size_type s) { container().reserve(s); }
+    T& operator[](size_type i) { return container()[i]; }
+    const T& operator[](size_type i) const { return (*values)[i]; }
+    T& at(size_type i) { return container()[i]; }
+    const T& at(size_type i) const { return (*values)[i]; }
+    T& front() { return container().front(); }
+    const T& front() const { return values->front(); }
+    T& back() { return container().back(); }
+    const T& back() const { return values->back(); }
+    Scalar* data() { return container().front().data(); }
+    const Scalar* data() const { return values->front().data(); }
+    void push_back(const T& v) { container().push_back(v); }
+    void pop_back() { container().pop_back(); }
+    iterator erase(iterator p) { return values->erase(p); }
+    iterator erase(iterator first, iterator last) { return values->erase(first, last); }
+    void clear() {
+        if(isShared_){
+            values.reset(new Container);
+            isShared_ = false;
+        } else {
+            values->clear();
+        }
+    }
 
 private:
-    Container values;
+    boost::shared_ptr<Container> values;
+    mutable bool isShared_;
+
+    Container& container() {
+        if(isShared_){
+            if(!values.unique()){
+                values.reset(new Container(*values));
+            }
+            isShared_ = false;
+        }
+        return *values;
+    }
 };
 
 typedef SgVectorArray<Vector3f> SgVertexArray;
@@ -231,6 +272,13 @@ protected:
 public:
     virtual int numChildObjects() const;
     virtual SgObject* childObject(int index);
+    virtual void onUpdated(SgUpdate& update);
+
+    /**
+       The bounding box is updated when it is accessed after the vertices or the mesh
+       itself are notified of an update. Call updateBoundingBox() when they are modified
+       without the notification.
+    */
     virtual const BoundingBox& boundingBox() const;
     virtual void updateBoundingBox();
 
@@ -272,8 +320,15 @@ public:
     bool isSolid() const { return isSolid_; }
     void setSolid(bool on) { isSolid_ = on; }
 
+    /**
+       The size of the arrays of the mesh in bytes. The buffers of the vertex, normal, color
+       and texture coordinate arrays may be shared with other meshes.
+    */
+    virtual size_t memoryUsage() const;
+
   protected:
     BoundingBox bbox;
+    bool isBboxCacheValid;
     
 private:
     SgVertexArrayPtr vertices_;
@@ -375,6 +430,8 @@ public:
 
     typedef boost::variant<Mesh, Box, Sphere, Cylinder, Cone> Primitive;
 
+    virtual size_t memoryUsage() const;
+
     const int primitiveType() const { return primitive_.which(); }
     template<class TPrimitive> const TPrimitive& primitive() const { return boost::get<TPrimitive>(primitive_); }
     template<class TPrimitive> void setPrimitive(const TPrimitive& prim) { primitive_ = prim; }
@@ -407,6 +464,8 @@ public:
     SgIndexArray& polygonVertices() { return polygonVertices_; }
     const SgIndexArray& polygonVertices() const { return polygonVertices_; }
 
+    virtual size_t memoryUsage() const;
+
 protected:
     SgPolygonMesh(const SgPolygonMesh& org, SgCloneMap& cloneMap);
 
@@ -460,6 +519,8 @@ public:
 
     virtual int numChildObjects() const;
     virtual SgObject* childObject(int index);
+    virtual void onUpdated(SgUpdate& update);
+    //! The bounding box is updated in the same way as SgMeshBase::boundingBox()
     virtual const BoundingBox& boundingBox() const;
     void updateBoundingBox();
     
@@ -492,11 +553,15 @@ public:
     const SgIndexArray& colorIndices() const { return colorIndices_; }
     SgIndexArray& colorIndices() { return colorIndices_; }
 
+    //! The size of the arrays in bytes in the same way as SgMeshBase::memoryUsage()
+    size_t memoryUsage() const;
+
 protected:
     SgPlot(const SgPlot& org, SgCloneMap& cloneMap);
 
 private:
     BoundingBox bbox;
+    bool isBboxCacheValid;
     SgVertexArrayPtr vertices_;
     SgNormalArrayPtr normals_;
     SgIndexArray normalIndices_;
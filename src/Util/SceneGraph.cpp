@@ -7,10 +7,75 @@
 #include "SceneVisitor.h"
 #include "Exception.h"
 #include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 using namespace cnoid;
 
+namespace {
+
+const size_t PoolAlignment = 16;
+const size_t MaxPooledObjectSize = 512;
+const size_t NumPoolSizeClasses = MaxPooledObjectSize / PoolAlignment;
+const size_t PoolChunkSize = 64 * 1024;
+
+/*
+  The blocks of each size class are cut out of the chunks allocated in order, so the objects
+  created together are placed close to each other. The released blocks are kept in the free
+  list of the size class, and the chunks are never released.
+*/
+class SgObjectPool
+{
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    struct SizeClass {
+        boost::mutex mutex;
+        FreeBlock* freeBlocks;
+        char* chunkTop;
+        char* chunkEnd;
+        SizeClass() : freeBlocks(0), chunkTop(0), chunkEnd(0) { }
+    };
+    SizeClass sizeClasses[NumPoolSizeClasses];
+
+public:
+    static SgObjectPool* instance() {
+        // The pool is not deleted because the objects may be released at the exit
+        static SgObjectPool* pool = new SgObjectPool;
+        return pool;
+    }
+    
+    void* allocate(size_t size) {
+        const size_t index = (size - 1) / PoolAlignment;
+        const size_t blockSize = (index + 1) * PoolAlignment;
+        SizeClass& sizeClass = sizeClasses[index];
+        boost::mutex::scoped_lock lock(sizeClass.mutex);
+        FreeBlock* block = sizeClass.freeBlocks;
+        if(block){
+            sizeClass.freeBlocks = block->next;
+            return block;
+        }
+        if(sizeClass.chunkTop + blockSize > sizeClass.chunkEnd){
+            char* chunk = static_cast<char*>(::operator new(PoolChunkSize));
+            sizeClass.chunkTop = chunk;
+            sizeClass.chunkEnd = chunk + PoolChunkSize;
+        }
+        void* p = sizeClass.chunkTop;
+        sizeClass.chunkTop += blockSize;
+        return p;
+    }
+
+    void release(void* p, size_t size) {
+        SizeClass& sizeClass = sizeClasses[(size - 1) / PoolAlignment];
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        boost::mutex::scoped_lock lock(sizeClass.mutex);
+        block->next = sizeClass.freeBlocks;
+        sizeClass.freeBlocks = block;
+    }
+};
+
+}
+
 
 SgUpdate::~SgUpdate()
 {
@@ -65,6 +130,28 @@ SgCloneMap::~SgCloneMap()
 }
 
 
+void* SgObject::operator new(std::size_t size)
+{
+    if(size == 0 || size > MaxPooledObjectSize){
+        return ::operator new(size);
+    }
+    return SgObjectPool::instance()->allocate(size);
+}
+
+
+void SgObject::operator delete(void* p, std::size_t size)
+{
+    if(!p){
+        return;
+    }
+    if(size == 0 || size > MaxPooledObjectSize){
+        ::operator delete(p);
+    } else {
+        SgObjectPool::instance()->release(p, size);
+    }
+}
+
+
 SgObject::SgObject()
 {
 
@@ -190,7 +277,7 @@ SgGroup::SgGroup(const SgGroup& org)
         addChild(*p, false);
     }
 
-    isBboxCacheValid = true;
+    isBboxCacheValid = org.isBboxCacheValid;
     bboxCache = org.bboxCache;
 }
 
@@ -204,7 +291,7 @@ SgGroup::SgGroup(const SgGroup& org, SgCloneMap& cloneMap)
         addChild(cloneMap.getClone<SgNode>(p->get()), false);
     }
 
-    isBboxCacheValid = true;
+    isBboxCacheValid = org.isBboxCacheValid;
     bboxCache = org.bboxCache;
 }
 
@@ -286,6 +373,7 @@ void SgGroup::addChild(SgNode* node, bool doNotify)
 {
     if(node){
         children.push_back(node);
+        isBboxCacheValid = false;
         node->addParent(this, doNotify);
     }
 }
@@ -308,6 +396,7 @@ void SgGroup::insertChild(SgNode* node, int index, bool doNotify)
             index = children.size();
         }
         children.insert(children.begin() + index, node);
+        isBboxCacheValid = false;
         node->addParent(this, doNotify);
     }
 }
@@ -318,6 +407,7 @@ SgGroup::iterator SgGroup::removeChild(iterator childIter, bool doNotify)
     iterator next;
     SgNode* child = *childIter;
     child->removeParent(this);
+    isBboxCacheValid = false;
     
     if(!doNotify){
         next = children.erase(childIter);
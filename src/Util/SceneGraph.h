@@ -82,6 +82,14 @@ public:
     typedef std::set<SgObject*> ParentContainer;
     typedef ParentContainer::iterator parentIter;
     typedef ParentContainer::const_iterator const_parentIter;
+
+    /**
+       The small scene objects are allocated from the pools of the memory blocks of the same size
+       to reduce the cost of building, cloning and destructing large scene graphs. The blocks of
+       the released objects are reused by the objects created later.
+    */
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p, std::size_t size);
         
     virtual SgObject* clone(SgCloneMap& cloneMap) const;
 
@@ -197,7 +205,7 @@ public:
     const_reverse_iterator rbegin() const { return children.rbegin(); }
     const_reverse_iterator rend() const { return children.rend(); }
 
-    iterator erase(iterator pos) { return children.erase(pos); }
+    iterator erase(iterator pos) { isBboxCacheValid = false; return children.erase(pos); }
 
     bool contains(SgNode* node) const;
 
@@ -0,0 +1,548 @@
+/*!
+  @file
+*/
+
+#include "SceneRayPicker.h"
+#include "SceneVisitor.h"
+#include "SceneDrawables.h"
+#include "SceneEffects.h"
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const int MaxNumLeafTriangles = 4;
+
+typedef vector<Affine3, Eigen::aligned_allocator<Affine3> > Affine3Array;
+
+/*
+  The bounding volume hierarchy of the triangles of a mesh in its local coordinate.
+  The children of an internal node are stored at the indices 'first' and 'first + 1'
+  of the node array, and a leaf node has the triangles from 'first' in the array of
+  the sorted triangle indices.
+*/
+struct BVHNode
+{
+    Vector3f min;
+    Vector3f max;
+    int first;
+    int numTriangles; // zero for an internal node
+};
+
+struct Entry
+{
+    weak_ref_ptr<SgMesh> mesh;
+    vector<BVHNode> nodes;
+    vector<int> triangles;
+    bool isValid;
+    ScopedConnection connection;
+
+    Entry(SgMesh* mesh) : mesh(mesh), isValid(true) { }
+
+    void onMeshUpdated(){
+        isValid = false;
+    }
+};
+typedef boost::shared_ptr<Entry> EntryPtr;
+
+
+class CentroidLess
+{
+    const vector<Vector3f>& centroids;
+    int axis;
+public:
+    CentroidLess(const vector<Vector3f>& centroids, int axis) : centroids(centroids), axis(axis) { }
+    bool operator()(int i, int j) const {
+        return centroids[i][axis] < centroids[j][axis];
+    }
+};
+
+
+/**
+   Slab test of the ray and the box
+   @param maxDistance The box farther than this distance along the ray is not regarded as being hit.
+*/
+bool checkRayBoxIntersection
+(const Vector3& origin, const Vector3& direction, const Vector3f& min, const Vector3f& max, double maxDistance)
+{
+    double tmin = 0.0;
+    double tmax = maxDistance;
+    for(int i=0; i < 3; ++i){
+        if(direction[i] == 0.0){
+            if(origin[i] < min[i] || origin[i] > max[i]){
+                return false;
+            }
+        } else {
+            const double inv = 1.0 / direction[i];
+            double t0 = (min[i] - origin[i]) * inv;
+            double t1 = (max[i] - origin[i]) * inv;
+            if(t0 > t1){
+                std::swap(t0, t1);
+            }
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+            if(tmin > tmax){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}
+
+namespace cnoid {
+
+class SceneRayPickerImpl : public SceneVisitor
+{
+public:
+    double pixelSizeAtOrigin;
+    double pixelSizeGradient;
+    double minPlotSize;
+
+    Vector3 origin;
+    Vector3 direction;
+    double maxDistance;
+    double nearestDistance;
+    Affine3Array transformStack;
+    SgNodePath currentNodePath;
+    SgNodePath pickedNodePath;
+    Vector3 pickedPoint;
+
+    typedef boost::unordered_map<SgMesh*, EntryPtr> EntryMap;
+    EntryMap entries;
+    size_t numEntriesAtLastSweep;
+
+    SceneRayPickerImpl();
+    bool pick(SgNode* root, const Vector3& origin, const Vector3& direction, double maxDistance);
+    void setPicked(SgNode* node, double distance);
+    double pixelSize(double distance) const;
+
+    virtual void visitGroup(SgGroup* group);
+    virtual void visitTransform(SgTransform* transform);
+    virtual void visitUnpickableGroup(SgUnpickableGroup* group);
+    virtual void visitShape(SgShape* shape);
+    virtual void visitPointSet(SgPointSet* pointSet);
+    virtual void visitLineSet(SgLineSet* lineSet);
+    virtual void visitOverlay(SgOverlay* overlay);
+    virtual void visitOutlineGroup(SgOutlineGroup* outline);
+
+    Entry* getEntry(SgMesh* mesh);
+    void buildBVH(SgMesh* mesh, Entry* entry);
+    void sweepEntries();
+    double castRayToMesh(
+        SgMesh* mesh, Entry* entry, const Vector3& localOrigin, const Vector3& localDirection, double maxDistance);
+};
+
+}
+
+
+SceneRayPicker::SceneRayPicker()
+{
+    impl = new SceneRayPickerImpl;
+}
+
+
+SceneRayPickerImpl::SceneRayPickerImpl()
+{
+    pixelSizeAtOrigin = 0.0;
+    pixelSizeGradient = 0.0;
+    minPlotSize = 5.0;
+    maxDistance = 0.0;
+    nearestDistance = 0.0;
+    pickedPoint.setZero();
+    numEntriesAtLastSweep = 0;
+}
+
+
+SceneRayPicker::~SceneRayPicker()
+{
+    delete impl;
+}
+
+
+void SceneRayPicker::setPixelSizes(double sizeAtOrigin, double sizeAtMaxDistance)
+{
+    impl->pixelSizeAtOrigin = sizeAtOrigin;
+    impl->pixelSizeGradient = sizeAtMaxDistance - sizeAtOrigin;
+}
+
+
+void SceneRayPicker::setMinPlotSize(double size)
+{
+    impl->minPlotSize = size;
+}
+
+
+const Vector3& SceneRayPicker::pickedPoint() const
+{
+    return impl->pickedPoint;
+}
+
+
+const SgNodePath& SceneRayPicker::pickedNodePath() const
+{
+    return impl->pickedNodePath;
+}
+
+
+void SceneRayPicker::clearCache()
+{
+    impl->entries.clear();
+    impl->numEntriesAtLastSweep = 0;
+}
+
+
+bool SceneRayPicker::pick(SgNode* root, const Vector3& origin, const Vector3& direction, double maxDistance)
+{
+    return impl->pick(root, origin, direction, maxDistance);
+}
+
+
+bool SceneRayPickerImpl::pick(SgNode* root, const Vector3& origin, const Vector3& direction, double maxDistance)
+{
+    this->origin = origin;
+    this->direction = direction;
+    this->maxDistance = maxDistance;
+    nearestDistance = maxDistance;
+    pickedNodePath.clear();
+
+    transformStack.clear();
+    transformStack.push_back(Affine3::Identity());
+    currentNodePath.clear();
+
+    root->accept(*this);
+
+    if(pickedNodePath.empty()){
+        return false;
+    }
+    pickedPoint = origin + nearestDistance * direction;
+    return true;
+}
+
+
+void SceneRayPickerImpl::setPicked(SgNode* node, double distance)
+{
+    nearestDistance = distance;
+    pickedNodePath = currentNodePath;
+    pickedNodePath.push_back(node);
+}
+
+
+inline double SceneRayPickerImpl::pixelSize(double distance) const
+{
+    if(maxDistance > 0.0){
+        return pixelSizeAtOrigin + pixelSizeGradient * distance / maxDistance;
+    }
+    return pixelSizeAtOrigin;
+}
+
+
+void SceneRayPickerImpl::visitGroup(SgGroup* group)
+{
+    currentNodePath.push_back(group);
+    SceneVisitor::visitGroup(group);
+    currentNodePath.pop_back();
+}
+
+
+void SceneRayPickerImpl::visitTransform(SgTransform* transform)
+{
+    Affine3 T;
+    transform->getTransform(T);
+    transformStack.push_back(transformStack.back() * T);
+    visitGroup(transform);
+    transformStack.pop_back();
+}
+
+
+void SceneRayPickerImpl::visitUnpickableGroup(SgUnpickableGroup* group)
+{
+
+}
+
+
+void SceneRayPickerImpl::visitOverlay(SgOverlay* overlay)
+{
+
+}
+
+
+void SceneRayPickerImpl::visitOutlineGroup(SgOutlineGroup* outline)
+{
+    for(SgGroup::const_iterator p = outline->begin(); p != outline->end(); ++p){
+        (*p)->accept(*this);
+    }
+}
+
+
+/*
+  The ray is transformed into the local coordinate of the mesh. The direction is not normalized
+  there so that the distance along the ray is the same as the one in the world coordinate.
+*/
+void SceneRayPickerImpl::visitShape(SgShape* shape)
+{
+    SgMesh* mesh = shape->mesh();
+    if(!mesh || !mesh->hasVertices() || mesh->numTriangles() == 0){
+        return;
+    }
+    const Affine3 Tinv = transformStack.back().inverse();
+    const Vector3 localOrigin = Tinv * origin;
+    const Vector3 localDirection = Tinv.linear() * direction;
+
+    const BoundingBox& bbox = mesh->boundingBox();
+    if(!checkRayBoxIntersection(
+           localOrigin, localDirection, bbox.min().cast<float>(), bbox.max().cast<float>(), nearestDistance)){
+        return;
+    }
+    Entry* entry = getEntry(mesh);
+    const double d = castRayToMesh(mesh, entry, localOrigin, localDirection, nearestDistance);
+    if(d >= 0.0){
+        setPicked(shape, d);
+    }
+}
+
+
+Entry* SceneRayPickerImpl::getEntry(SgMesh* mesh)
+{
+    EntryPtr& entry = entries[mesh];
+    if(entry && (!entry->isValid || entry->mesh.expired())){
+        // The mesh has been updated, or a new mesh has been created at the address of a deleted one
+        entry.reset();
+    }
+    if(!entry){
+        entry.reset(new Entry(mesh));
+        entry->connection.reset(
+            mesh->sigUpdated().connect(boost::bind(&Entry::onMeshUpdated, entry.get())));
+        buildBVH(mesh, entry.get());
+        if(entries.size() > 2 * numEntriesAtLastSweep + 16){
+            Entry* e = entry.get();
+            sweepEntries();
+            return e;
+        }
+    }
+    return entry.get();
+}
+
+
+void SceneRayPickerImpl::sweepEntries()
+{
+    EntryMap::iterator p = entries.begin();
+    while(p != entries.end()){
+        if(!p->second || p->second->mesh.expired()){
+            p = entries.erase(p);
+        } else {
+            ++p;
+        }
+    }
+    numEntriesAtLastSweep = entries.size();
+}
+
+
+/*
+  The triangles are divided at the median of their centroids along the longest side of
+  the bounding box of the centroids, so the depth of the hierarchy is logarithmic.
+*/
+void SceneRayPickerImpl::buildBVH(SgMesh* mesh, Entry* entry)
+{
+    const SgVertexArray& vertices = *mesh->vertices();
+    const int numTriangles = mesh->numTriangles();
+
+    vector<Vector3f> centroids(numTriangles);
+    vector<int>& triangles = entry->triangles;
+    triangles.resize(numTriangles);
+    for(int i=0; i < numTriangles; ++i){
+        SgMesh::TriangleRef t = mesh->triangle(i);
+        centroids[i] = (vertices[t[0]] + vertices[t[1]] + vertices[t[2]]) / 3.0f;
+        triangles[i] = i;
+    }
+
+    vector<BVHNode>& nodes = entry->nodes;
+    nodes.clear();
+    nodes.reserve(2 * (numTriangles / MaxNumLeafTriangles + 1));
+    nodes.push_back(BVHNode());
+    nodes[0].first = 0;
+    nodes[0].numTriangles = numTriangles;
+
+    vector<int> stack;
+    stack.push_back(0);
+    while(!stack.empty()){
+        const int index = stack.back();
+        stack.pop_back();
+        const int first = nodes[index].first;
+        const int n = nodes[index].numTriangles;
+
+        Vector3f min = Vector3f::Constant(std::numeric_limits<float>::max());
+        Vector3f max = -min;
+        Vector3f cmin = min;
+        Vector3f cmax = max;
+        for(int i=first; i < first + n; ++i){
+            SgMesh::TriangleRef t = mesh->triangle(triangles[i]);
+            for(int j=0; j < 3; ++j){
+                min = min.cwiseMin(vertices[t[j]]);
+                max = max.cwiseMax(vertices[t[j]]);
+            }
+            cmin = cmin.cwiseMin(centroids[triangles[i]]);
+            cmax = cmax.cwiseMax(centroids[triangles[i]]);
+        }
+        nodes[index].min = min;
+        nodes[index].max = max;
+
+        if(n > MaxNumLeafTriangles){
+            int axis;
+            (cmax - cmin).maxCoeff(&axis);
+            const int middle = first + n / 2;
+            std::nth_element(triangles.begin() + first, triangles.begin() + middle, triangles.begin() + first + n,
+                             CentroidLess(centroids, axis));
+            const int child = nodes.size();
+            nodes.resize(child + 2);
+            nodes[child].first = first;
+            nodes[child].numTriangles = middle - first;
+            nodes[child + 1].first = middle;
+            nodes[child + 1].numTriangles = first + n - middle;
+            nodes[index].first = child;
+            nodes[index].numTriangles = 0;
+            stack.push_back(child);
+            stack.push_back(child + 1);
+        }
+    }
+}
+
+
+/**
+   @return The distance to the nearest triangle which is nearer than maxDistance,
+   or -1.0 if there is no such triangle.
+*/
+double SceneRayPickerImpl::castRayToMesh
+(SgMesh* mesh, Entry* entry, const Vector3& localOrigin, const Vector3& localDirection, double maxDistance)
+{
+    const SgVertexArray& vertices = *mesh->vertices();
+    const vector<BVHNode>& nodes = entry->nodes;
+    double nearest = -1.0;
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while(stackSize > 0){
+        const BVHNode& node = nodes[stack[--stackSize]];
+        if(!checkRayBoxIntersection(localOrigin, localDirection, node.min, node.max, maxDistance)){
+            continue;
+        }
+        if(node.numTriangles == 0){
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = node.first + 1;
+            continue;
+        }
+        for(int i=node.first; i < node.first + node.numTriangles; ++i){
+            // Moller-Trumbore intersection without the back face culling
+            SgMesh::TriangleRef t = mesh->triangle(entry->triangles[i]);
+            const Vector3 v0 = vertices[t[0]].cast<double>();
+            const Vector3 e1 = vertices[t[1]].cast<double>() - v0;
+            const Vector3 e2 = vertices[t[2]].cast<double>() - v0;
+            const Vector3 p = localDirection.cross(e2);
+            const double det = e1.dot(p);
+            if(fabs(det) < 1.0e-12){
+                continue;
+            }
+            const double invDet = 1.0 / det;
+            const Vector3 s = localOrigin - v0;
+            const double u = s.dot(p) * invDet;
+            if(u < 0.0 || u > 1.0){
+                continue;
+            }
+            const Vector3 q = s.cross(e1);
+            const double v = localDirection.dot(q) * invDet;
+            if(v < 0.0 || u + v > 1.0){
+                continue;
+            }
+            const double d = e2.dot(q) * invDet;
+            if(d >= 0.0 && d < maxDistance){
+                maxDistance = d;
+                nearest = d;
+            }
+        }
+    }
+
+    return nearest;
+}
+
+
+void SceneRayPickerImpl::visitPointSet(SgPointSet* pointSet)
+{
+    if(!pointSet->hasVertices()){
+        return;
+    }
+    const Affine3& T = transformStack.back();
+    const double radius = std::max(pointSet->pointSize(), minPlotSize) / 2.0;
+    const SgVertexArray& vertices = *pointSet->vertices();
+    const int n = vertices.size();
+    bool isHit = false;
+    for(int i=0; i < n; ++i){
+        const Vector3 p = T * vertices[i].cast<double>() - origin;
+        const double d = p.dot(direction);
+        if(d >= 0.0 && d < nearestDistance){
+            const double r = radius * pixelSize(d);
+            if((p - d * direction).squaredNorm() <= r * r){
+                nearestDistance = d;
+                isHit = true;
+            }
+        }
+    }
+    if(isHit){
+        setPicked(pointSet, nearestDistance);
+    }
+}
+
+
+/*
+  The distance is computed between the closest points of the ray and each line segment.
+*/
+void SceneRayPickerImpl::visitLineSet(SgLineSet* lineSet)
+{
+    if(!lineSet->hasVertices()){
+        return;
+    }
+    const Affine3& T = transformStack.back();
+    const double halfWidth = std::max((double)lineSet->lineWidth(), minPlotSize) / 2.0;
+    const SgVertexArray& vertices = *lineSet->vertices();
+    const int numVertices = vertices.size();
+    const int n = lineSet->numLines();
+    bool isHit = false;
+    for(int i=0; i < n; ++i){
+        SgLineSet::LineRef line = lineSet->line(i);
+        if(line[0] >= numVertices || line[1] >= numVertices){
+            continue;
+        }
+        const Vector3 a = T * vertices[line[0]].cast<double>();
+        const Vector3 u = T * vertices[line[1]].cast<double>() - a;
+        const Vector3 w = origin - a;
+        const double b = direction.dot(u);
+        const double c = u.squaredNorm();
+        const double dw = direction.dot(w);
+        const double e = u.dot(w);
+        const double denom = c - b * b;
+        double s = 0.0;
+        if(denom > 1.0e-12 * c){
+            s = std::max(0.0, std::min(1.0, (e - b * dw) / denom));
+        }
+        const Vector3 q = a + s * u;
+        const double d = (q - origin).dot(direction);
+        if(d >= 0.0 && d < nearestDistance){
+            const double r = halfWidth * pixelSize(d);
+            if((origin + d * direction - q).squaredNorm() <= r * r){
+                nearestDistance = d;
+                isHit = true;
+            }
+        }
+    }
+    if(isHit){
+        setPicked(lineSet, nearestDistance);
+    }
+}
@@ -0,0 +1,59 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_SCENE_RAY_PICKER_H
+#define CNOID_UTIL_SCENE_RAY_PICKER_H
+
+#include "SceneGraph.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class SceneRayPickerImpl;
+
+/**
+   This class finds the nearest node of a scene graph hit by a ray without rendering the scene.
+   The triangles of each mesh are tested with a bounding volume hierarchy which is built when
+   the mesh is first picked, and it is cached until the mesh is updated or deleted.
+   The points and the lines are hit when the ray passes within the half of their sizes in pixels.
+
+   The node path of the picked node is the same as the one given by the picking of GLSLSceneRenderer,
+   i.e. it consists of the groups from the root and the picked shape, point set or line set.
+*/
+class CNOID_EXPORT SceneRayPicker
+{
+public:
+    SceneRayPicker();
+    ~SceneRayPicker();
+
+    /**
+       Set the width in the world coordinate of a pixel at the origin of the ray and at the distance
+       given to pick(). The width at the other distances is linearly interpolated.
+    */
+    void setPixelSizes(double sizeAtOrigin, double sizeAtMaxDistance);
+
+    //! The minimum size of the points and the lines in pixels for the picking. The default value is 5.
+    void setMinPlotSize(double size);
+
+    /**
+       @param direction The unit vector of the ray direction
+       @return true if a node is hit by the ray within the max distance
+    */
+    bool pick(SgNode* root, const Vector3& origin, const Vector3& direction, double maxDistance);
+
+    const Vector3& pickedPoint() const;
+    const SgNodePath& pickedNodePath() const;
+
+    void clearCache();
+
+private:
+    SceneRayPickerImpl* impl;
+
+    SceneRayPicker(const SceneRayPicker& org);
+    SceneRayPicker& operator=(const SceneRayPicker& rhs);
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "SceneUtil.h"
 #include "SceneDrawables.h"
 #include "SceneVisitor.h"
+#include "Image.h"
 
 using namespace std;
 using namespace cnoid;
@@ -119,3 +120,74 @@ int cnoid::makeTransparent(SgNode* topNode, float transparency, SgCloneMap& clon
     }
     return 0;
 }
+
+
+namespace {
+
+template<class ArrayType>
+size_t sharedArrayUsage(const ArrayType* array, std::set<const void*>& countedObjects)
+{
+    if(array && !countedObjects.insert(array->bufferId()).second){
+        return array->memoryUsage();
+    }
+    return 0;
+}
+
+size_t calcSceneMemoryUsageIter(SgObject* object, std::set<const void*>& countedObjects)
+{
+    if(!countedObjects.insert(object).second){
+        return 0;
+    }
+
+    size_t usage = 0;
+    
+    if(SgMeshBase* mesh = dynamic_cast<SgMeshBase*>(object)){
+        usage = mesh->memoryUsage();
+        usage -= sharedArrayUsage(mesh->vertices(), countedObjects);
+        usage -= sharedArrayUsage(mesh->normals(), countedObjects);
+        usage -= sharedArrayUsage(mesh->colors(), countedObjects);
+        usage -= sharedArrayUsage(mesh->texCoords(), countedObjects);
+        return usage;
+
+    } else if(SgPlot* plot = dynamic_cast<SgPlot*>(object)){
+        usage = plot->memoryUsage();
+        usage -= sharedArrayUsage(plot->vertices(), countedObjects);
+        usage -= sharedArrayUsage(plot->normals(), countedObjects);
+        usage -= sharedArrayUsage(plot->colors(), countedObjects);
+        return usage;
+        
+    } else if(SgImage* image = dynamic_cast<SgImage*>(object)){
+        const Image& data = image->constImage();
+        if(countedObjects.insert(&data).second){
+            usage = data.width() * data.height() * data.numComponents();
+        }
+        return usage;
+    }
+
+    const int n = object->numChildObjects();
+    for(int i=0; i < n; ++i){
+        SgObject* child = object->childObject(i);
+        if(child){
+            usage += calcSceneMemoryUsageIter(child, countedObjects);
+        }
+    }
+    return usage;
+}
+
+}
+
+
+size_t cnoid::calcSceneMemoryUsage(SgObject* object)
+{
+    std::set<const void*> countedObjects;
+    return calcSceneMemoryUsage(object, countedObjects);
+}
+
+
+size_t cnoid::calcSceneMemoryUsage(SgObject* object, std::set<const void*>& countedObjects)
+{
+    if(object){
+        return calcSceneMemoryUsageIter(object, countedObjects);
+    }
+    return 0;
+}
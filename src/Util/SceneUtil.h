@@ -6,6 +6,7 @@
 #define CNOID_UTIL_SCENE_UTIL_H
 
 #include "SceneGraph.h"
+#include <set>
 #include "exportdecl.h"
 
 namespace cnoid {
@@ -16,6 +17,15 @@ CNOID_EXPORT Affine3 calcTotalTransform(SgNodePath::const_iterator begin, SgNode
 
 CNOID_EXPORT int makeTransparent(SgNode* topNode, float transparency, SgCloneMap& cloneMap, bool doKeepOrgTransparency = true);
 
+/**
+   This function returns the size of the meshes, the point sets, the line sets and the images
+   in the scene graph in bytes. An object or an array buffer shared by multiple parents,
+   including the buffers shared between the clones of a mesh, is counted only once.
+   countedObjects can be given to exclude the objects counted by the previous calls.
+*/
+CNOID_EXPORT size_t calcSceneMemoryUsage(SgObject* object);
+CNOID_EXPORT size_t calcSceneMemoryUsage(SgObject* object, std::set<const void*>& countedObjects);
+
 }
 
 #endif
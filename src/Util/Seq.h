@@ -84,6 +84,10 @@ public:
         }
     }
 
+    virtual size_t memoryUsage() const {
+        return container.capacity() * sizeof(ElementType);
+    }
+
     inline bool empty() const {
         return container.empty();
     }
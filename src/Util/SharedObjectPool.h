@@ -0,0 +1,111 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_SHARED_OBJECT_POOL_H
+#define CNOID_UTIL_SHARED_OBJECT_POOL_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+#include <cstddef>
+
+namespace cnoid {
+
+/**
+   A pool of the objects given as shared_ptrs. When the last shared_ptr of an object is released,
+   the object is returned to the pool instead of being deleted, so the memory allocated by the
+   object such as the pixels of an Image is reused by the next acquire() call.
+
+   The objects can be released in any thread, and they can be kept after the pool is destroyed.
+   In that case they are deleted when they are released.
+*/
+template <class T>
+class SharedObjectPool
+{
+    struct Store
+    {
+        boost::mutex mutex;
+        std::vector<T*> objects;
+        std::size_t maxSize;
+
+        ~Store() {
+            for(std::size_t i=0; i < objects.size(); ++i){
+                delete objects[i];
+            }
+        }
+    };
+
+    struct Recycler
+    {
+        boost::weak_ptr<Store> store;
+
+        Recycler(const boost::shared_ptr<Store>& store) : store(store) { }
+
+        void operator()(T* object) const {
+            boost::shared_ptr<Store> s = store.lock();
+            if(s){
+                boost::mutex::scoped_lock lock(s->mutex);
+                if(s->objects.size() < s->maxSize){
+                    s->objects.push_back(object);
+                    return;
+                }
+            }
+            delete object;
+        }
+    };
+
+    boost::shared_ptr<Store> store;
+
+    SharedObjectPool(const SharedObjectPool& org);
+    SharedObjectPool& operator=(const SharedObjectPool& rhs);
+
+public:
+    /**
+       @param maxSize The maximum number of the released objects kept in the pool
+    */
+    SharedObjectPool(int maxSize = 4)
+        : store(new Store) {
+        store->maxSize = maxSize;
+    }
+
+    /**
+       @note The object returned to the pool keeps its previous contents.
+       The caller must overwrite or clear them.
+    */
+    boost::shared_ptr<T> acquire() {
+        T* object = 0;
+        {
+            boost::mutex::scoped_lock lock(store->mutex);
+            if(!store->objects.empty()){
+                object = store->objects.back();
+                store->objects.pop_back();
+            }
+        }
+        if(!object){
+            object = new T;
+        }
+        return boost::shared_ptr<T>(object, Recycler(store));
+    }
+
+    int numPooledObjects() const {
+        boost::mutex::scoped_lock lock(store->mutex);
+        return store->objects.size();
+    }
+
+    void clear() {
+        std::vector<T*> objects;
+        {
+            boost::mutex::scoped_lock lock(store->mutex);
+            objects.swap(store->objects);
+        }
+        for(std::size_t i=0; i < objects.size(); ++i){
+            delete objects[i];
+        }
+    }
+};
+
+}
+
+#endif
@@ -9,6 +9,8 @@
 
 #include "Referenced.h"
 #include <boost/type_traits/function_traits.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <vector>
 
 #define CNOID_SIGNAL_CONCAT( X, Y ) CNOID_SIGNAL_DO_CONCAT( X, Y )
 #define CNOID_SIGNAL_DO_CONCAT( X, Y ) CNOID_SIGNAL_DO_CONCAT2(X,Y)
@@ -20,6 +22,8 @@ class Connection;
 
 namespace signal_private {
 
+template<typename SlotType> class SlotArray;
+
 template<typename T>
 struct last_value {
     typedef T result_type;
@@ -31,6 +35,22 @@ struct last_value {
             value = *first++;
         return value;
     }
+
+    /*
+      This function is used by the signal instead of operator() to call the slots directly
+      without the iterators because this combiner is used for most of the signals.
+    */
+    template<typename SlotType, typename ArgSetType>
+    static T callSlots(const SlotArray<SlotType>& slots, int n, ArgSetType& args) {
+        T value;
+        for(int i=0; i < n; ++i){
+            SlotType* slot = slots[i];
+            if(slot->owner && !slot->isBlocked){
+                value = args.call(slot);
+            }
+        }
+        return value;
+    }
 };
 
 
@@ -42,6 +62,16 @@ struct last_value<void> {
         while (first != last)
             *first++;
     }
+
+    template<typename SlotType, typename ArgSetType>
+    static void callSlots(const SlotArray<SlotType>& slots, int n, ArgSetType& args) {
+        for(int i=0; i < n; ++i){
+            SlotType* slot = slots[i];
+            if(slot->owner && !slot->isBlocked){
+                args.call(slot);
+            }
+        }
+    }
 };
 
 
@@ -58,47 +88,137 @@ public:
 };
 
 
+/**
+   The array of the slots connected to a signal. The slots are stored contiguously so that they
+   are iterated fast in emitting the signal, and a single slot, which is the most common case,
+   is stored without allocating the array on the heap.
+*/
+template<typename SlotType>
+class SlotArray
+{
+    SlotType** elements;
+    int size_;
+    int capacity;
+    SlotType* inlineElement;
+
+    SlotArray(const SlotArray& org);
+    SlotArray& operator=(const SlotArray& rhs);
+
+    void reserve(int n) {
+        SlotType** newElements = new SlotType*[n];
+        for(int i=0; i < size_; ++i){
+            newElements[i] = elements[i];
+        }
+        if(elements != &inlineElement){
+            delete[] elements;
+        }
+        elements = newElements;
+        capacity = n;
+    }
+
+public:
+    SlotArray() : elements(&inlineElement), size_(0), capacity(1), inlineElement(0) { }
+
+    ~SlotArray() {
+        if(elements != &inlineElement){
+            delete[] elements;
+        }
+    }
+
+    int size() const { return size_; }
+    SlotType* operator[](int index) const { return elements[index]; }
+    void set(int index, SlotType* slot) { elements[index] = slot; }
+    void truncate(int n) { size_ = n; }
+
+    void push_back(SlotType* slot) {
+        if(size_ == capacity){
+            reserve(capacity * 2);
+        }
+        elements[size_++] = slot;
+    }
+
+    void insert(int index, SlotType* slot) {
+        push_back(0);
+        for(int i = size_ - 1; i > index; --i){
+            elements[i] = elements[i - 1];
+        }
+        elements[index] = slot;
+    }
+
+    void erase(int index) {
+        --size_;
+        for(int i = index; i < size_; ++i){
+            elements[i] = elements[i + 1];
+        }
+    }
+
+    int find(SlotType* slot) const {
+        for(int i=0; i < size_; ++i){
+            if(elements[i] == slot){
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+
+/**
+   The slots are accessed by the index because the array may be reallocated when a slot is
+   connected in emitting the signal. The slots disconnected in emitting the signal are kept in
+   the array with the null owner until the emission finishes. They are skipped when the iterator
+   is compared, which is done just before a slot is called.
+*/
 template<typename SlotType, typename ArgSetType>
 class SlotCallIterator
 {
     typedef typename SlotType::result_type result_type;
 
-    SlotType* currentSlot;
+    const SlotArray<SlotType>& slots;
+    mutable int index;
+    int end;
     ArgSetType& args;
 
 public:
-    void seekUnblockedSlot(){
-        while(currentSlot && currentSlot->isBlocked){
-            currentSlot = currentSlot->next;
+    void seekUnblockedSlot() const {
+        while(index < end){
+            SlotType* slot = slots[index];
+            if(slot->owner && !slot->isBlocked){
+                break;
+            }
+            ++index;
         }
     }
     
-    SlotCallIterator(SlotType* firstSlot, ArgSetType& args)
-        : currentSlot(firstSlot), args(args) {
-        seekUnblockedSlot();
+    SlotCallIterator(const SlotArray<SlotType>& slots, int index, int end, ArgSetType& args)
+        : slots(slots), index(index), end(end), args(args) {
     }
 
     SlotCallIterator(const SlotCallIterator& org)
-        : currentSlot(org.currentSlot), args(org.args) {
-        seekUnblockedSlot();
+        : slots(org.slots), index(org.index), end(org.end), args(org.args) {
     }
 
     bool operator==(const SlotCallIterator& rhs) const {
-        return (currentSlot == rhs.currentSlot);
+        seekUnblockedSlot();
+        rhs.seekUnblockedSlot();
+        return (index == rhs.index);
     }
 
     bool operator!=(const SlotCallIterator& rhs) const {
-        return (currentSlot != rhs.currentSlot);
+        return !operator==(rhs);
     }
 
     SlotCallIterator operator++(int) {
-        SlotCallIterator iter(*this);
-        currentSlot = currentSlot->next;
         seekUnblockedSlot();
+        SlotCallIterator iter(*this);
+        ++index;
         return iter;
     }
     
-    result_type operator*() const { return args.call(currentSlot); }
+    result_type operator*() const {
+        seekUnblockedSlot();
+        return args.call(slots[index]);
+    }
 };
 
 
@@ -43,18 +43,17 @@ struct CNOID_SIGNAL_SLOT_HOLDER : public SlotHolderBase
     typedef CNOID_SIGNAL_FUNCTION<R CNOID_SIGNAL_COMMA_IF_NONZERO_ARGS CNOID_SIGNAL_TEMPLATE_ARGS> FuncType;
     FuncType func;
 
-    typedef CNOID_SIGNAL_SLOT_HOLDER SlotHolder;
-    typedef ref_ptr<SlotHolder> SlotHolderPtr;
-    SlotHolderPtr next;
-    SlotHolder* prev;
     typedef CNOID_SIGNAL_SIGNAL<R, CNOID_SIGNAL_TEMPLATE_ARGS CNOID_SIGNAL_COMMA_IF_NONZERO_ARGS Combiner> SignalType;
     SignalType* owner;
+
+    // The order change requested in emitting the signal, which is applied after the emission
+    int pendingOrderId;
     
 public:
     typedef R result_type;
     
     CNOID_SIGNAL_SLOT_HOLDER(const FuncType& func)
-        : func(func), prev(0), owner(0) {
+        : func(func), owner(0), pendingOrderId(-1) {
     }
 
     virtual void disconnect() {
@@ -117,92 +116,151 @@ private:
     typedef CNOID_SIGNAL_ARGSET<R, CNOID_SIGNAL_TEMPLATE_ARGS CNOID_SIGNAL_COMMA_IF_NONZERO_ARGS Combiner> ArgSetType;
     typedef signal_private::SlotCallIterator<SlotHolderType, ArgSetType> IteratorType;
 
-    SlotHolderPtr firstSlot;
-    SlotHolderType* lastSlot;
+    signal_private::SlotArray<SlotHolderType> slots;
+    int numConnectedSlots;
+    int emissionDepth;
+    bool isCleanupNeeded;
 
     CNOID_SIGNAL_SIGNAL(const CNOID_SIGNAL_SIGNAL& org);
     CNOID_SIGNAL_SIGNAL& operator=(const CNOID_SIGNAL_SIGNAL& rhs);
 
+    /*
+      The slots are not removed from the array or reordered while the signal is being emitted.
+      The removal and the order change are done by this function after the emission.
+    */
+    void cleanup() {
+        isCleanupNeeded = false;
+        int n = 0;
+        bool isOrderChangeRequested = false;
+        for(int i=0; i < slots.size(); ++i){
+            SlotHolderType* slot = slots[i];
+            if(slot->owner != this){
+                slot->releaseRef();
+            } else {
+                if(slot->pendingOrderId >= 0){
+                    isOrderChangeRequested = true;
+                }
+                slots.set(n++, slot);
+            }
+        }
+        slots.truncate(n);
+
+        if(isOrderChangeRequested){
+            std::vector<SlotHolderType*> slotsToMove;
+            for(int i=0; i < n; ++i){
+                if(slots[i]->pendingOrderId >= 0){
+                    slotsToMove.push_back(slots[i]);
+                }
+            }
+            for(size_t i=0; i < slotsToMove.size(); ++i){
+                SlotHolderType* slot = slotsToMove[i];
+                const int orderId = slot->pendingOrderId;
+                slot->pendingOrderId = -1;
+                moveSlot(slot, orderId);
+            }
+        }
+    }
+
+    void moveSlot(SlotHolderType* slot, int orderId) {
+        const int index = slots.find(slot);
+        if(index >= 0){
+            if(orderId == Connection::FIRST){
+                if(index > 0){
+                    slots.erase(index);
+                    slots.insert(0, slot);
+                }
+            } else if(orderId == Connection::LAST){
+                if(index < slots.size() - 1){
+                    slots.erase(index);
+                    slots.push_back(slot);
+                }
+            }
+        }
+    }
+
+    struct EmissionScope {
+        CNOID_SIGNAL_SIGNAL* signal;
+        EmissionScope(CNOID_SIGNAL_SIGNAL* signal) : signal(signal) {
+            ++signal->emissionDepth;
+        }
+        ~EmissionScope() {
+            if(--signal->emissionDepth == 0 && signal->isCleanupNeeded){
+                signal->cleanup();
+            }
+        }
+    };
+    friend struct EmissionScope;
+
 public:
-    CNOID_SIGNAL_SIGNAL() : lastSlot(0) { }
+    CNOID_SIGNAL_SIGNAL() : numConnectedSlots(0), emissionDepth(0), isCleanupNeeded(false) { }
 
     ~CNOID_SIGNAL_SIGNAL() {
-        disconnect_all_slots();
+        for(int i=0; i < slots.size(); ++i){
+            SlotHolderType* slot = slots[i];
+            if(slot->owner == this){
+                slot->owner = 0;
+            }
+            slot->releaseRef();
+        }
     }
 
     Connection connect(const slot_function_type& func){
 
         SlotHolderType* slot = new SlotHolderType(func);
-
-        if(!firstSlot){
-            firstSlot = slot;
-            lastSlot = slot;
-        } else {
-            lastSlot->next = slot;
-            slot->prev = lastSlot;
-            lastSlot = slot;
-        }
         slot->owner = this;
+        slot->addRef();
+        slots.push_back(slot);
+        ++numConnectedSlots;
 
         return Connection(slot);
     }
 
     void remove(SlotHolderPtr slot){
         if(slot->owner == this){
-            SlotHolderType* next = slot->next;
-            SlotHolderType* prev = slot->prev;
-            if(next){
-                next->prev = prev;
-            } else {
-                lastSlot = prev;
-            }
-            if(prev){
-                prev->next = next;
+            slot->owner = 0;
+            slot->pendingOrderId = -1;
+            --numConnectedSlots;
+            if(emissionDepth > 0){
+                isCleanupNeeded = true;
             } else {
-                firstSlot = next;
+                const int index = slots.find(slot.get());
+                if(index >= 0){
+                    slots.erase(index);
+                    slot->releaseRef();
+                }
             }
-            slot->prev = 0;
-            slot->next = 0;
-            slot->owner = 0;
         }
     }
 
     void changeOrder(SlotHolderPtr slot, int orderId){
         if(slot->owner == this){
-            if(orderId == Connection::FIRST){
-                if(firstSlot != slot){
-                    remove(slot);
-                    slot->owner = this;
-                    if(firstSlot){
-                        slot->next = firstSlot;
-                        slot->next->prev = slot;
-                    }
-                    firstSlot = slot;
-                }
-            } else if(orderId == Connection::LAST){
-                if(lastSlot != slot){
-                    remove(slot);
-                    slot->owner = this;
-                    if(lastSlot){
-                        lastSlot->next = slot;
-                        slot->prev = lastSlot;
-                    } else {
-                        firstSlot = slot;
-                    }
-                    lastSlot = slot;
-                }
+            if(emissionDepth > 0){
+                slot->pendingOrderId = orderId;
+                isCleanupNeeded = true;
+            } else {
+                moveSlot(slot.get(), orderId);
             }
         }
     }
                         
     void disconnect_all_slots() {
-        while(firstSlot){
-            remove(firstSlot);
+        for(int i=0; i < slots.size(); ++i){
+            SlotHolderType* slot = slots[i];
+            if(slot->owner == this){
+                slot->owner = 0;
+                slot->pendingOrderId = -1;
+            }
+        }
+        numConnectedSlots = 0;
+        if(emissionDepth > 0){
+            isCleanupNeeded = true;
+        } else {
+            cleanup();
         }
     }
 
     bool empty() const {
-        return (firstSlot == 0);
+        return (numConnectedSlots == 0);
     }
 
     result_type operator()(CNOID_SIGNAL_PARMS) {
@@ -212,9 +270,28 @@ public:
 #else
         ArgSetType args(CNOID_SIGNAL_ARGS);
 #endif
-        
+        return emit(args, typename boost::is_same<Combiner, signal_private::last_value<R> >::type());
+    }
+
+private:
+    // The default combiner
+    result_type emit(ArgSetType& args, boost::true_type) {
+        const int n = slots.size();
+        if(n == 0){
+            return R();
+        }
+        EmissionScope scope(this);
+        return Combiner::callSlots(slots, n, args);
+    }
+
+    result_type emit(ArgSetType& args, boost::false_type) {
         Combiner combiner;
-        return combiner(IteratorType(firstSlot, args), IteratorType(0, args));
+        const int n = slots.size();
+        if(n == 0){
+            return combiner(IteratorType(slots, 0, 0, args), IteratorType(slots, 0, 0, args));
+        }
+        EmissionScope scope(this);
+        return combiner(IteratorType(slots, 0, n, args), IteratorType(slots, n, n, args));
     }
 };
 
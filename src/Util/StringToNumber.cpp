@@ -0,0 +1,166 @@
+/*!
+  @file
+*/
+
+#include "StringToNumber.h"
+#include <boost/cstdint.hpp>
+#include <clocale>
+#include <cctype>
+#include <cstdlib>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+template<typename T> struct FloatTraits;
+
+template<> struct FloatTraits<float> {
+    static const int mantissaBits = 24;
+    static const int maxExponent = 10;
+    static float powerOf10(int e) {
+        static const float p[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+        return p[e];
+    }
+    static float convert(const char* nptr, char** endptr) {
+#ifdef _MSC_VER
+        // strtof() is not available in old versions of Visual C++
+        return static_cast<float>(strtod(nptr, endptr));
+#else
+        return strtof(nptr, endptr);
+#endif
+    }
+};
+
+template<> struct FloatTraits<double> {
+    static const int mantissaBits = 53;
+    static const int maxExponent = 22;
+    static double powerOf10(int e) {
+        static const double p[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        return p[e];
+    }
+    static double convert(const char* nptr, char** endptr) {
+        return strtod(nptr, endptr);
+    }
+};
+
+
+/**
+   The C library function is used with the decimal point of the current locale
+   so that the numbers written with '.' are read in any locale.
+*/
+template<typename T> T convertFloatByLibrary(const char* nptr, char** endptr)
+{
+    const char point = localeconv()->decimal_point[0];
+    if(point == '.'){
+        return FloatTraits<T>::convert(nptr, endptr);
+    }
+    char buf[128];
+    size_t n = 0;
+    while(n < sizeof(buf) - 1){
+        const char c = nptr[n];
+        if(c == '.'){
+            buf[n++] = point;
+        } else if(isalnum((unsigned char)c) || c == '+' || c == '-'){
+            buf[n++] = c;
+        } else {
+            break;
+        }
+    }
+    buf[n] = '\0';
+    char* tail;
+    const T value = FloatTraits<T>::convert(buf, &tail);
+    *endptr = const_cast<char*>(nptr) + (tail - buf);
+    return value;
+}
+
+
+/**
+   A number whose mantissa and power of ten are exactly represented by the type is converted
+   by one multiplication or division, which gives the correctly rounded value.
+   The other numbers are converted by the C library function.
+*/
+template<typename T> T strtofloat(const char* nptr, char** endptr)
+{
+    typedef FloatTraits<T> Traits;
+    
+    const char* p = nptr;
+    bool negative = false;
+    if(*p == '+' || *p == '-'){
+        negative = (*p == '-');
+        ++p;
+    }
+    boost::uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool hasDigit = false;
+    while(isdigit((unsigned char)*p)){
+        if(numDigits > 0 || *p != '0'){
+            ++numDigits;
+        }
+        mantissa = mantissa * 10 + (*p++ - '0');
+        hasDigit = true;
+    }
+    if(*p == '.'){
+        ++p;
+        while(isdigit((unsigned char)*p)){
+            if(numDigits > 0 || *p != '0'){
+                ++numDigits;
+            }
+            mantissa = mantissa * 10 + (*p++ - '0');
+            --exponent;
+            hasDigit = true;
+        }
+    }
+    if(!hasDigit || numDigits > 19){
+        return convertFloatByLibrary<T>(nptr, endptr);
+    }
+    if(*p == 'e' || *p == 'E'){
+        ++p;
+        bool negativeExponent = false;
+        if(*p == '+' || *p == '-'){
+            negativeExponent = (*p == '-');
+            ++p;
+        }
+        if(!isdigit((unsigned char)*p)){
+            return convertFloatByLibrary<T>(nptr, endptr);
+        }
+        int e = 0;
+        while(isdigit((unsigned char)*p)){
+            if(e > 10000){
+                return convertFloatByLibrary<T>(nptr, endptr);
+            }
+            e = e * 10 + (*p++ - '0');
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+    if(isalnum((unsigned char)*p) || *p == '.' ||
+       mantissa > (static_cast<boost::uint64_t>(1) << Traits::mantissaBits) ||
+       exponent < -Traits::maxExponent || exponent > Traits::maxExponent){
+        return convertFloatByLibrary<T>(nptr, endptr);
+    }
+    T value = static_cast<T>(mantissa);
+    if(exponent < 0){
+        value /= Traits::powerOf10(-exponent);
+    } else if(exponent > 0){
+        value *= Traits::powerOf10(exponent);
+    }
+    *endptr = const_cast<char*>(p);
+    return negative ? -value : value;
+}
+
+}
+
+
+float cnoid::stringToFloat(const char* nptr, char** endptr)
+{
+    return strtofloat<float>(nptr, endptr);
+}
+
+
+double cnoid::stringToDouble(const char* nptr, char** endptr)
+{
+    return strtofloat<double>(nptr, endptr);
+}
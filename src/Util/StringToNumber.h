@@ -0,0 +1,23 @@
+/*!
+  @file
+*/
+
+#ifndef CNOID_UTIL_STRING_TO_NUMBER_H_INCLUDED
+#define CNOID_UTIL_STRING_TO_NUMBER_H_INCLUDED
+
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   Locale-independent versions of strtof() and strtod().
+   The numbers are written with '.' as the decimal point regardless of the current locale.
+   A number whose mantissa and power of ten are exactly represented by the type is converted
+   without the C library function, and the result is the correctly rounded value as strtod() gives.
+*/
+CNOID_EXPORT float stringToFloat(const char* nptr, char** endptr);
+CNOID_EXPORT double stringToDouble(const char* nptr, char** endptr);
+
+}
+
+#endif
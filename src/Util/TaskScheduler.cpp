@@ -0,0 +1,388 @@
+/**
+   @file
+*/
+
+#include "TaskScheduler.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+struct Task
+{
+    boost::function<void()> func;
+    TaskGroup* group;
+};
+
+struct TaskQueue
+{
+    boost::mutex mutex;
+    deque<Task> tasks;
+};
+
+struct WorkerContext
+{
+    TaskSchedulerImpl* scheduler;
+    int index;
+};
+
+void doNotDeleteWorkerContext(WorkerContext*) { }
+
+boost::thread_specific_ptr<WorkerContext> currentWorkerContext(doNotDeleteWorkerContext);
+
+boost::scoped_ptr<TaskScheduler> sharedInstance;
+boost::once_flag sharedInstanceOnceFlag = BOOST_ONCE_INIT;
+
+void createSharedInstance()
+{
+    sharedInstance.reset(new TaskScheduler());
+}
+
+void callFunctionForRange(const boost::function<void(int index)>& func, int begin, int end)
+{
+    for(int i=begin; i < end; ++i){
+        func(i);
+    }
+}
+
+}
+
+namespace cnoid {
+
+class TaskSchedulerImpl
+{
+public:
+    int numWorkers;
+
+    /**
+       The queue of each worker and the shared queue for the other threads at the last.
+    */
+    vector<TaskQueue*> queues;
+    vector<WorkerContext> workerContexts;
+    boost::thread_group workers;
+
+    /**
+       The number of the tasks in the queues. The value is incremented before a task is put
+       into a queue and decremented after a task is taken out, so it is never less than the
+       actual number.
+    */
+    boost::atomic<int> numPendingTasks;
+    boost::atomic<int> numSleepingWorkers;
+    boost::mutex sleepMutex;
+    boost::condition_variable sleepCondition;
+    bool isDestroying;
+
+    TaskSchedulerImpl(int numWorkers);
+    ~TaskSchedulerImpl();
+    int currentWorkerIndex() const;
+    void push(const boost::function<void()>& func, TaskGroup* group);
+    bool takeTask(TaskQueue& queue, TaskGroup* group, bool fromBack, Task& out_task);
+    bool popTask(int workerIndex, TaskGroup* group, Task& out_task);
+    void execute(Task& task);
+    void workerLoop(int index);
+};
+
+}
+
+
+TaskScheduler::TaskScheduler(int numWorkers)
+{
+    if(numWorkers < 1){
+        numWorkers = std::max(1, (int)boost::thread::hardware_concurrency() - 1);
+    }
+    impl = new TaskSchedulerImpl(numWorkers);
+}
+
+
+TaskSchedulerImpl::TaskSchedulerImpl(int numWorkers)
+    : numWorkers(numWorkers),
+      numPendingTasks(0),
+      numSleepingWorkers(0)
+{
+    isDestroying = false;
+
+    queues.resize(numWorkers + 1);
+    for(size_t i=0; i < queues.size(); ++i){
+        queues[i] = new TaskQueue;
+    }
+    workerContexts.resize(numWorkers);
+    for(int i=0; i < numWorkers; ++i){
+        workerContexts[i].scheduler = this;
+        workerContexts[i].index = i;
+        workers.create_thread(boost::bind(&TaskSchedulerImpl::workerLoop, this, i));
+    }
+}
+
+
+TaskScheduler::~TaskScheduler()
+{
+    delete impl;
+}
+
+
+TaskSchedulerImpl::~TaskSchedulerImpl()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(sleepMutex);
+        isDestroying = true;
+        sleepCondition.notify_all();
+    }
+    workers.join_all();
+
+    for(size_t i=0; i < queues.size(); ++i){
+        delete queues[i];
+    }
+}
+
+
+TaskScheduler* TaskScheduler::instance()
+{
+    boost::call_once(createSharedInstance, sharedInstanceOnceFlag);
+    return sharedInstance.get();
+}
+
+
+int TaskScheduler::numWorkers() const
+{
+    return impl->numWorkers;
+}
+
+
+int TaskSchedulerImpl::currentWorkerIndex() const
+{
+    WorkerContext* context = currentWorkerContext.get();
+    if(context && context->scheduler == this){
+        return context->index;
+    }
+    return -1;
+}
+
+
+void TaskSchedulerImpl::push(const boost::function<void()>& func, TaskGroup* group)
+{
+    ++numPendingTasks;
+
+    const int index = currentWorkerIndex();
+    TaskQueue& queue = *queues[(index >= 0) ? index : numWorkers];
+    {
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        queue.tasks.push_back(Task());
+        Task& task = queue.tasks.back();
+        task.func = func;
+        task.group = group;
+    }
+
+    /*
+      A worker increments numSleepingWorkers before it checks numPendingTasks with sleepMutex,
+      so the worker is woken up here unless it has already seen the new task.
+    */
+    if(numSleepingWorkers > 0){
+        boost::unique_lock<boost::mutex> lock(sleepMutex);
+        sleepCondition.notify_one();
+    }
+}
+
+
+/**
+   @param group If this is not null, only the tasks of the group are taken.
+*/
+bool TaskSchedulerImpl::takeTask(TaskQueue& queue, TaskGroup* group, bool fromBack, Task& out_task)
+{
+    boost::unique_lock<boost::mutex> lock(queue.mutex);
+
+    deque<Task>& tasks = queue.tasks;
+    if(tasks.empty()){
+        return false;
+    }
+    deque<Task>::iterator p;
+    if(!group){
+        p = fromBack ? (tasks.end() - 1) : tasks.begin();
+    } else if(fromBack){
+        deque<Task>::reverse_iterator q = tasks.rbegin();
+        while(q != tasks.rend() && q->group != group){
+            ++q;
+        }
+        if(q == tasks.rend()){
+            return false;
+        }
+        p = q.base() - 1;
+    } else {
+        p = tasks.begin();
+        while(p != tasks.end() && p->group != group){
+            ++p;
+        }
+        if(p == tasks.end()){
+            return false;
+        }
+    }
+    out_task.func.swap(p->func);
+    out_task.group = p->group;
+    tasks.erase(p);
+
+    --numPendingTasks;
+
+    return true;
+}
+
+
+/**
+   A worker takes the newest task of its own queue first because the task is likely to use
+   the data in the cache. The oldest tasks of the shared queue and the other workers' queues
+   are stolen next, which are usually the larger pieces of the work.
+*/
+bool TaskSchedulerImpl::popTask(int workerIndex, TaskGroup* group, Task& out_task)
+{
+    if(workerIndex >= 0){
+        if(takeTask(*queues[workerIndex], group, true, out_task)){
+            return true;
+        }
+    }
+    if(takeTask(*queues[numWorkers], group, false, out_task)){
+        return true;
+    }
+    const int start = (workerIndex >= 0) ? (workerIndex + 1) : 0;
+    for(int i=0; i < numWorkers; ++i){
+        const int victim = (start + i) % numWorkers;
+        if(victim != workerIndex){
+            if(takeTask(*queues[victim], group, false, out_task)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+void TaskSchedulerImpl::execute(Task& task)
+{
+    task.func();
+    task.group->onTaskFinished();
+}
+
+
+void TaskSchedulerImpl::workerLoop(int index)
+{
+    currentWorkerContext.reset(&workerContexts[index]);
+
+    while(true){
+        Task task;
+        if(popTask(index, 0, task)){
+            execute(task);
+            continue;
+        }
+        boost::unique_lock<boost::mutex> lock(sleepMutex);
+        ++numSleepingWorkers;
+        while(numPendingTasks == 0 && !isDestroying){
+            sleepCondition.wait(lock);
+        }
+        --numSleepingWorkers;
+        if(isDestroying && numPendingTasks == 0){
+            break;
+        }
+    }
+
+    currentWorkerContext.release();
+}
+
+
+void TaskScheduler::parallelFor
+(int begin, int end, const boost::function<void(int index)>& func, int grainSize)
+{
+    parallelForRanges(begin, end, boost::bind(callFunctionForRange, boost::cref(func), _1, _2), grainSize);
+}
+
+
+/**
+   The range is divided into a few times as many tasks as the concurrency
+   so that the workers can balance the load by stealing the tasks.
+*/
+void TaskScheduler::parallelForRanges
+(int begin, int end, const boost::function<void(int subBegin, int subEnd)>& func, int grainSize)
+{
+    const int n = end - begin;
+    if(n <= 0){
+        return;
+    }
+    if(grainSize < 1){
+        grainSize = 1;
+    }
+    const int numTasks = std::min((n + grainSize - 1) / grainSize, concurrency() * 4);
+    if(numTasks <= 1){
+        func(begin, end);
+        return;
+    }
+
+    TaskGroup group(this);
+    for(int i=1; i < numTasks; ++i){
+        const int subBegin = begin + (int)((long long)n * i / numTasks);
+        const int subEnd = begin + (int)((long long)n * (i + 1) / numTasks);
+        group.run(boost::bind(func, subBegin, subEnd));
+    }
+    func(begin, begin + (int)((long long)n / numTasks));
+    group.wait();
+}
+
+
+TaskGroup::TaskGroup(TaskScheduler* scheduler)
+    : scheduler_(scheduler),
+      numUnfinishedTasks(0),
+      mutex("Task group"),
+      finishCondition("Task group finish")
+{
+
+}
+
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+
+void TaskGroup::run(const boost::function<void()>& func)
+{
+    ++numUnfinishedTasks;
+    scheduler_->impl->push(func, this);
+}
+
+
+void TaskGroup::onTaskFinished()
+{
+    boost::unique_lock<ProfiledMutex> lock(mutex);
+    if(--numUnfinishedTasks == 0){
+        finishCondition.notify_all();
+    }
+}
+
+
+/**
+   The calling thread only executes the tasks of this group so that it does not
+   take a long task of another group and delay the return of this function.
+   The final check is done with the mutex so that the group can be destroyed
+   safely after this function returns.
+*/
+void TaskGroup::wait()
+{
+    TaskSchedulerImpl* impl = scheduler_->impl;
+    const int workerIndex = impl->currentWorkerIndex();
+
+    while(numUnfinishedTasks > 0){
+        Task task;
+        if(!impl->popTask(workerIndex, this, task)){
+            break;
+        }
+        impl->execute(task);
+    }
+
+    boost::unique_lock<ProfiledMutex> lock(mutex);
+    while(numUnfinishedTasks > 0){
+        finishCondition.wait(lock);
+    }
+}
@@ -0,0 +1,105 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_TASK_SCHEDULER_H
+#define CNOID_UTIL_TASK_SCHEDULER_H
+
+#include <boost/function.hpp>
+#include "ProfiledMutex.h"
+#include <boost/atomic.hpp>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class TaskSchedulerImpl;
+class TaskGroup;
+
+/**
+   This class executes short tasks with a fixed set of worker threads.
+   Each worker has its own task deque. A worker takes the newest task from its own deque
+   and steals the oldest task from the other deques when its deque is empty.
+   The tasks given from the threads which are not workers are put into a shared queue.
+
+   The process-wide instance given by instance() should usually be used so that the parallel
+   computations of the simulation (the collision detection, the forward dynamics and so on)
+   share the same threads instead of creating their own ones.
+*/
+class CNOID_EXPORT TaskScheduler
+{
+public:
+    /**
+       @param numWorkers the number of the worker threads.
+       A value less than one means the number of the hardware threads minus one,
+       which is also used for the process-wide instance.
+    */
+    TaskScheduler(int numWorkers = 0);
+    ~TaskScheduler();
+
+    static TaskScheduler* instance();
+
+    int numWorkers() const;
+
+    /**
+       The number of the tasks which can be executed at the same time,
+       i.e. the number of the workers plus the waiting thread.
+    */
+    int concurrency() const { return numWorkers() + 1; }
+
+    /**
+       Execute func(i) for each i in [begin, end) and return when all of them are finished.
+       The calling thread also executes a part of the iterations.
+       @param grainSize the minimum number of the iterations executed as one task
+    */
+    void parallelFor(int begin, int end, const boost::function<void(int index)>& func, int grainSize = 1);
+
+    /**
+       The same as parallelFor() except that func is called for sub ranges [subBegin, subEnd).
+    */
+    void parallelForRanges(int begin, int end, const boost::function<void(int subBegin, int subEnd)>& func,
+                           int grainSize = 1);
+
+private:
+    TaskSchedulerImpl* impl;
+    friend class TaskGroup;
+
+    TaskScheduler(const TaskScheduler& org);
+    TaskScheduler& operator=(const TaskScheduler& rhs);
+};
+
+
+/**
+   This class collects the tasks which are waited for together.
+   wait() executes the pending tasks of the group in the calling thread, and then it blocks
+   without spinning until the tasks executed by the other threads are finished.
+   A task may give new tasks to the same group or to other groups.
+*/
+class CNOID_EXPORT TaskGroup
+{
+public:
+    TaskGroup(TaskScheduler* scheduler = TaskScheduler::instance());
+
+    //! The destructor waits for the tasks which have not been finished.
+    ~TaskGroup();
+
+    TaskScheduler* scheduler() const { return scheduler_; }
+
+    void run(const boost::function<void()>& func);
+    void wait();
+
+private:
+    TaskScheduler* scheduler_;
+    boost::atomic<int> numUnfinishedTasks;
+    ProfiledMutex mutex;
+    ProfiledConditionVariable finishCondition;
+    friend class TaskSchedulerImpl;
+
+    void onTaskFinished();
+
+    TaskGroup(const TaskGroup& org);
+    TaskGroup& operator=(const TaskGroup& rhs);
+};
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+/**
+   @file
+*/
+
+#include "TimingProfiler.h"
+#include "ValueTree.h"
+#include "YAMLWriter.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/format.hpp>
+#include <map>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace cnoid;
+using boost::format;
+
+bool TimingProfiler::isEnabled_ = false;
+
+namespace {
+
+struct Record
+{
+    Record() : count(0), totalTime(0.0), maxTime(0.0) { }
+    int count;
+    double totalTime;
+    double maxTime;
+};
+
+typedef map<string, Record> RecordMap;
+RecordMap records;
+boost::mutex recordMutex;
+
+double currentTime()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec * 1.0e-9;
+#endif
+}
+
+}
+
+
+void TimingProfiler::setEnabled(bool on)
+{
+    isEnabled_ = on;
+}
+
+
+void TimingProfiler::addRecord(const std::string& phase, double time)
+{
+    boost::mutex::scoped_lock lock(recordMutex);
+    Record& record = records[phase];
+    ++record.count;
+    record.totalTime += time;
+    record.maxTime = std::max(record.maxTime, time);
+}
+
+
+void TimingProfiler::clear()
+{
+    boost::mutex::scoped_lock lock(recordMutex);
+    records.clear();
+}
+
+
+void TimingProfiler::putReport(std::ostream& os)
+{
+    boost::mutex::scoped_lock lock(recordMutex);
+
+    size_t width = 5;
+    for(RecordMap::iterator p = records.begin(); p != records.end(); ++p){
+        width = std::max(width, p->first.size());
+    }
+    const string phaseFormat = str(format("%%-%1%s") % width);
+
+    os << format(phaseFormat) % "Phase" << "   Count  Total [ms]    Max [ms]\n";
+    for(RecordMap::iterator p = records.begin(); p != records.end(); ++p){
+        const Record& record = p->second;
+        os << format(phaseFormat) % p->first
+           << format(" %7d %11.3f %11.3f\n") % record.count % (record.totalTime * 1000.0) % (record.maxTime * 1000.0);
+    }
+    os.flush();
+}
+
+
+bool TimingProfiler::writeReport(const std::string& filename)
+{
+    ListingPtr phases = new Listing();
+    {
+        boost::mutex::scoped_lock lock(recordMutex);
+        for(RecordMap::iterator p = records.begin(); p != records.end(); ++p){
+            const Record& record = p->second;
+            Mapping* phase = phases->newMapping();
+            phase->write("phase", p->first, DOUBLE_QUOTED);
+            phase->write("count", record.count);
+            phase->write("totalTime", record.totalTime);
+            phase->write("maxTime", record.maxTime);
+        }
+    }
+
+    MappingPtr top = new Mapping();
+    top->insert("timingProfile", phases);
+
+    ofstream ofs(filename.c_str());
+    if(!ofs){
+        return false;
+    }
+    YAMLWriter writer(ofs);
+    writer.setKeyOrderPreservationMode(true);
+    writer.putNode(top);
+    
+    return !ofs.fail();
+}
+
+
+void TimingProfiler::Scope::begin(const char* phase)
+{
+    this->phase = phase;
+    isActive = true;
+    startTime = currentTime();
+}
+
+
+void TimingProfiler::Scope::begin(const char* phase, const std::string& detail)
+{
+    this->phase = phase;
+    this->phase += detail;
+    isActive = true;
+    startTime = currentTime();
+}
+
+
+void TimingProfiler::Scope::end()
+{
+    addRecord(phase, currentTime() - startTime);
+}
@@ -0,0 +1,80 @@
+/**
+   @file
+*/
+
+#ifndef CNOID_UTIL_TIMING_PROFILER_H
+#define CNOID_UTIL_TIMING_PROFILER_H
+
+#include <string>
+#include <iosfwd>
+#include "Profiler.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+/**
+   This class accumulates the time spent in the named phases such as the plugin loading and
+   the project loading. A phase is measured by putting a Scope object in the code of the phase.
+   Nothing is measured unless the profiler is enabled, so the scopes can be left in the code paths
+   of the normal use. The phases are named in the form of "Module/Phase" and the report lists
+   them in the order of the names. The phases are also recorded as the scopes of Profiler.
+*/
+class CNOID_EXPORT TimingProfiler
+{
+public:
+    static void setEnabled(bool on);
+    static bool isEnabled() { return isEnabled_; }
+
+    //! \param time The time in seconds
+    static void addRecord(const std::string& phase, double time);
+    static void clear();
+
+    static void putReport(std::ostream& os);
+
+    //! The report is written in the YAML format
+    static bool writeReport(const std::string& filename);
+
+    class CNOID_EXPORT Scope
+    {
+    public:
+        Scope(const char* phase) : profilerScope(phase) {
+            if(isEnabled_){
+                begin(phase);
+            } else {
+                isActive = false;
+            }
+        }
+        //! The detail is appended to the phase name to measure the phase for each target
+        Scope(const char* phase, const std::string& detail) : profilerScope(phase) {
+            if(isEnabled_){
+                begin(phase, detail);
+            } else {
+                isActive = false;
+            }
+        }
+        ~Scope() {
+            if(isActive){
+                end();
+            }
+        }
+    private:
+        Profiler::Scope profilerScope;
+        std::string phase;
+        double startTime;
+        bool isActive;
+        
+        void begin(const char* phase);
+        void begin(const char* phase, const std::string& detail);
+        void end();
+
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+    };
+
+private:
+    static bool isEnabled_;
+};
+
+}
+
+#endif
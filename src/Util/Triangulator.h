@@ -91,6 +91,29 @@ template<class TVector3Array> class Triangulator
             return contains;
         }
 
+    /**
+       A convex quad whose corners are not flat is split into two triangles without
+       searching the ears
+    */
+    bool isConvexQuad()
+        {
+            for(int i=0; i < 4; ++i){
+                const TVector3& p0 = vertex((i + 3) % 4);
+                TVector3 a = vertex(i) - p0;
+                TVector3 b = vertex((i + 1) % 4) - p0;
+                TVector3 ccs = a.cross(b);
+                if((ccs.norm() / (a.norm() + b.norm())) < 1.0e-4f || this->ccs.dot(ccs) <= 0.0f){
+                    return false;
+                }
+            }
+            // The second triangle is checked in the same way as the general procedure
+            const TVector3& p0 = vertex(3);
+            TVector3 a = vertex(1) - p0;
+            TVector3 b = vertex(2) - p0;
+            TVector3 ccs = a.cross(b);
+            return (ccs.norm() / (a.norm() + b.norm())) >= 1.0e-4f && this->ccs.dot(ccs) > 0.0f;
+        }
+
 public:
     void setVertices(const TVector3Array& vertices)
         {
@@ -132,6 +155,17 @@ public:
                 ccs += (vertex(i) - o).cross(vertex((i+1) % numOrgVertices) - o);
             }
 
+            if(numOrgVertices == 4 && isConvexQuad()){
+                // The same triangles as the ones given by the following general procedure
+                triangles_.push_back(3);
+                triangles_.push_back(0);
+                triangles_.push_back(1);
+                triangles_.push_back(3);
+                triangles_.push_back(1);
+                triangles_.push_back(2);
+                return 2;
+            }
+
             int numTriangles = 0;
 
             while(true) {
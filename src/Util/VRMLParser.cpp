@@ -9,7 +9,10 @@
 #include "EasyScanner.h"
 #include "UTF8.h"
 #include "FileUtil.h"
+#include "TaskScheduler.h"
 #include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <list>
 #include <cmath>
@@ -391,11 +394,43 @@ public:
     TProtoMap protoMap;
     TDefNodeMap defNodeMap;
 
+    // Shared with the parsers of the inlined files
+    boost::shared_ptr< vector<string> > sourceFiles;
+
+    /**
+       The inlined VRML files are parsed by the tasks of inlineLoadGroup while the parent file
+       is being parsed. The results are put into the Inline nodes in the order of the nodes
+       when a top node is completed.
+    */
+    struct InlineLoad
+    {
+        VRMLInlinePtr inlineNode;
+        int childIndex;
+        string filename;
+        list<string> ancestorPathsList;
+        VRMLNodePtr node;
+        boost::shared_ptr< vector<string> > sourceFiles;
+        // The loads of the files inlined in this file
+        vector< boost::shared_ptr<InlineLoad> > subLoads;
+        bool hasError;
+        EasyScanner::Exception error;
+    };
+    typedef boost::shared_ptr<InlineLoad> InlineLoadPtr;
+
+    // Shared with the parsers of the inlined files
+    boost::shared_ptr<TaskGroup> inlineLoadGroup;
+    vector<InlineLoadPtr> topInlineLoads;
+    vector<InlineLoadPtr>* inlineLoads;
+
     void load(const string& filename);
     VRMLNodePtr readSpecificNode(VRMLNodeCategory nodeCategory, int symbol, const std::string& symbolString);
     VRMLNodePtr readInlineNode(VRMLNodeCategory nodeCategory);
     VRMLAnotherFormatFilePtr createAnotherFormatFileNode(std::string& io_filename);
-    VRMLNodePtr newInlineSource(string& io_filename);
+    VRMLNodePtr newInlineSource(VRMLInline* inlineNode, string& io_filename);
+    static void loadInlineFile(InlineLoadPtr load, boost::shared_ptr<TaskGroup> group);
+    void finishInlineLoads();
+    void finishInlineLoads(vector<InlineLoadPtr>& loads);
+    void discardInlineLoads();
     VRMLProtoPtr defineProto();
 
     void checkEOF();
@@ -477,7 +512,7 @@ public:
     void readMFNode(MFNode& out_nodes, VRMLNodeCategory nodeCategory);
     void readSFImage( SFImage& out_image );
 private:
-    VRMLParserImpl(const VRMLParserImpl& self, const list< string >& ref);
+    VRMLParserImpl(InlineLoad* load, boost::shared_ptr<TaskGroup> group);
     const list< string >* getAncestorPathsList() const {return &ancestorPathsList;}
     void setSymbols();
     void init();
@@ -510,20 +545,29 @@ void VRMLParser::init()
 
 
 VRMLParserImpl::VRMLParserImpl(VRMLParser* self)
-    : self(self)
+    : self(self),
+      sourceFiles(new vector<string>),
+      inlineLoadGroup(new TaskGroup)
 {
+    inlineLoads = &topInlineLoads;
     init();
 }
 
-VRMLParserImpl::VRMLParserImpl(const VRMLParserImpl& refThis, const list< string >& refSet)
-    : self(refThis.self), ancestorPathsList(refSet)
+
+VRMLParserImpl::VRMLParserImpl(InlineLoad* load, boost::shared_ptr<TaskGroup> group)
+    : self(0),
+      sourceFiles(load->sourceFiles),
+      inlineLoadGroup(group),
+      ancestorPathsList(load->ancestorPathsList)
 {
+    inlineLoads = &load->subLoads;
     init();
 }
 
 
 VRMLParser::~VRMLParser()
 {
+    impl->discardInlineLoads();
     delete impl;
 }
 
@@ -540,10 +584,18 @@ void VRMLParser::setProtoInstanceActualNodeExtractionMode(bool isOn)
 */
 void VRMLParser::load(const string& filename)
 {
+    impl->discardInlineLoads();
+    impl->sourceFiles->clear();
     impl->load(filename);
 }
 
 
+const std::vector<std::string>& VRMLParser::sourceFiles() const
+{
+    return *impl->sourceFiles;
+}
+
+
 void VRMLParserImpl::load(const string& filename)
 {
     currentProtoInstance = 0;
@@ -555,6 +607,7 @@ void VRMLParserImpl::load(const string& filename)
     path.normalize();
     string pathString(path.string());
     ancestorPathsList.push_back(pathString);
+    sourceFiles->push_back(getAbsolutePathString(path));
     scanner->loadFile(pathString);
     
     // header check
@@ -594,7 +647,15 @@ void VRMLParser::checkEOF()
 
 VRMLNodePtr VRMLParser::readNode()
 {
-    return impl->readNode(TOP_NODE);
+    VRMLNodePtr node;
+    try {
+        node = impl->readNode(TOP_NODE);
+    } catch(...){
+        impl->discardInlineLoads();
+        throw;
+    }
+    impl->finishInlineLoads();
+    return node;
 }
 
 
@@ -856,7 +917,7 @@ VRMLNodePtr VRMLParserImpl::readInlineNode(VRMLNodeCategory nodeCategory)
         for(size_t i=0; i < inlineUrls.size(); ++i){
             string url(fromUTF8(inlineUrls[i]));
             if(boost::algorithm::iends_with(url, "wrl")){
-                inlineNode->children.push_back(newInlineSource(url));
+                inlineNode->children.push_back(newInlineSource(inlineNode.get(), url));
             } else {
                 inlineNode->children.push_back(createAnotherFormatFileNode(url));
             }
@@ -873,6 +934,7 @@ VRMLAnotherFormatFilePtr VRMLParserImpl::createAnotherFormatFileNode(string& io_
     // If the file extension is not wrl, It will read the corresponding file in VRMLToSGConverter.
     VRMLAnotherFormatFilePtr fileNode = new VRMLAnotherFormatFile();
     fileNode->url = getRealPath(io_filename);
+    sourceFiles->push_back(fileNode->url);
     return fileNode;
 }
 
@@ -898,7 +960,11 @@ string VRMLParserImpl::getRealPath(string io_filename)
 }
 
 
-VRMLNodePtr VRMLParserImpl::newInlineSource(string& io_filename)
+/**
+   The returned node is a placeholder, which is replaced with the node of the file
+   by finishInlineLoads().
+*/
+VRMLNodePtr VRMLParserImpl::newInlineSource(VRMLInline* inlineNode, string& io_filename)
 {
     string chkFile = getRealPath(io_filename);
     for(list<string>::const_iterator p = ancestorPathsList.begin(); p != ancestorPathsList.end(); ++p){
@@ -906,28 +972,91 @@ VRMLNodePtr VRMLParserImpl::newInlineSource(string& io_filename)
             scanner->throwException("Infinity loop ! " + chkFile + " is included ancestor list");
         }
     }
+    io_filename = chkFile;
 
-    VRMLParserImpl inlineParser(*this, ancestorPathsList);
+    InlineLoadPtr load = boost::make_shared<InlineLoad>();
+    load->inlineNode = inlineNode;
+    load->childIndex = inlineNode->children.size();
+    load->filename = chkFile;
+    load->ancestorPathsList = ancestorPathsList;
+    load->sourceFiles = boost::make_shared< vector<string> >();
+    load->hasError = false;
+    inlineLoads->push_back(load);
 
-    inlineParser.load(chkFile);
-    io_filename = chkFile;
+    inlineLoadGroup->run(boost::bind(&VRMLParserImpl::loadInlineFile, load, inlineLoadGroup));
+
+    return 0;
+}
 
-    VRMLGroupPtr group = new VRMLGroup();
-    while(VRMLNodePtr node = inlineParser.readNode(TOP_NODE)){
-        if(node->isCategoryOf(CHILD_NODE)){
-            group->children.push_back(node);
+
+void VRMLParserImpl::loadInlineFile(InlineLoadPtr load, boost::shared_ptr<TaskGroup> group)
+{
+    try {
+        VRMLParserImpl inlineParser(load.get(), group);
+
+        inlineParser.load(load->filename);
+
+        VRMLGroupPtr groupNode = new VRMLGroup();
+        while(VRMLNodePtr node = inlineParser.readNode(TOP_NODE)){
+            if(node->isCategoryOf(CHILD_NODE)){
+                groupNode->children.push_back(node);
+            }
         }
+        inlineParser.checkEOF();
+
+        if(groupNode->children.size() == 1){
+            load->node = groupNode->children.front();
+        } else {
+            load->node = groupNode;
+        }
+    } catch(const EasyScanner::Exception& ex){
+        load->error = ex;
+        load->hasError = true;
+    } catch(const std::exception& ex){
+        load->error.message = ex.what();
+        load->error.filename = load->filename;
+        load->error.lineNumber = -1;
+        load->hasError = true;
     }
-    inlineParser.checkEOF();
+}
 
-    if(group->children.size() == 1){
-        return group->children.front();
-    } else {
-        return group;
+
+void VRMLParserImpl::finishInlineLoads()
+{
+    if(!topInlineLoads.empty()){
+        inlineLoadGroup->wait();
+        try {
+            finishInlineLoads(topInlineLoads);
+        } catch(...){
+            topInlineLoads.clear();
+            throw;
+        }
+        topInlineLoads.clear();
+    }
+}
+
+
+void VRMLParserImpl::finishInlineLoads(vector<InlineLoadPtr>& loads)
+{
+    for(size_t i=0; i < loads.size(); ++i){
+        InlineLoad& load = *loads[i];
+        if(load.hasError){
+            throw load.error;
+        }
+        load.inlineNode->children[load.childIndex] = load.node;
+        sourceFiles->insert(sourceFiles->end(), load.sourceFiles->begin(), load.sourceFiles->end());
+        finishInlineLoads(load.subLoads);
     }
 }
 
 
+void VRMLParserImpl::discardInlineLoads()
+{
+    inlineLoadGroup->wait();
+    topInlineLoads.clear();
+}
+
+
 VRMLProtoPtr VRMLParserImpl::defineProto()
 {
     string proto_name = scanner->readWordEx("illegal PROTO name");
@@ -2050,6 +2179,55 @@ VRMLVariantField& VRMLParserImpl::readProtoField(VRMLFieldTypeId fieldTypeId)
 }
 
 
+static inline int readScalars(EasyScanner* scanner, int* out_values, int maxNumValues)
+{
+    return scanner->readInts(out_values, maxNumValues);
+}
+
+
+static inline int readScalars(EasyScanner* scanner, float* out_values, int maxNumValues)
+{
+    return scanner->readFloats(out_values, maxNumValues);
+}
+
+
+static inline int readScalars(EasyScanner* scanner, double* out_values, int maxNumValues)
+{
+    return scanner->readDoubles(out_values, maxNumValues);
+}
+
+
+/**
+   Reads the elements of a multiple-valued field following '[' and the closing ']'.
+   The array is extended by a block of elements and the scalars of the elements are
+   read into the block at once because a large array of coordinates or indices
+   takes most of the time to read a model file.
+*/
+template<int NumScalars, typename Scalar, class ValueArray>
+static void readMFElements(EasyScanner* scanner, ValueArray& out_values, const char* message)
+{
+    BOOST_STATIC_ASSERT(sizeof(typename ValueArray::value_type) == NumScalars * sizeof(Scalar));
+    
+    static const int BlockSize = 1024;
+    while(true){
+        const size_t size = out_values.size();
+        out_values.resize(size + BlockSize);
+        const int n = readScalars(
+            scanner, reinterpret_cast<Scalar*>(&out_values[size]), BlockSize * NumScalars);
+        out_values.resize(size + n / NumScalars);
+        if(n % NumScalars != 0){
+            scanner->throwException(message);
+        }
+        if(n < BlockSize * NumScalars){
+            break;
+        }
+    }
+    if(!scanner->readChar(']')){
+        scanner->throwException(message);
+    }
+}
+
+
 void VRMLParserImpl::readSFInt32(SFInt32& out_value)
 {
     if(scanner->readSymbol(F_IS)){
@@ -2069,9 +2247,7 @@ void VRMLParserImpl::readMFInt32(MFInt32& out_value)
         if(!scanner->readChar('[')){
             out_value.push_back(scanner->readIntEx("illegal int value"));
         } else {
-            while(!scanner->readChar(']')){
-                out_value.push_back(scanner->readIntEx("illegal int value"));
-            }
+            readMFElements<1, int>(scanner, out_value, "illegal int value");
         }
     }
 }
@@ -2096,9 +2272,7 @@ void VRMLParserImpl::readMFFloat(MFFloat& out_value)
         if(!scanner->readChar('[')){
             out_value.push_back(scanner->readDoubleEx("illegal float value"));
         } else {
-            while(!scanner->readChar(']')){
-                out_value.push_back(scanner->readDoubleEx("illegal float value"));
-            }
+            readMFElements<1, double>(scanner, out_value, "illegal float value");
         }
     }
 }
@@ -2197,9 +2371,7 @@ void VRMLParserImpl::readMFVec2f(MFVec2f& out_value)
         if(!scanner->readChar('[')){
             out_value.push_back(::readSFVec2f(scanner));
         } else {
-            while(!scanner->readChar(']')){
-                out_value.push_back(::readSFVec2f(scanner));
-            }
+            readMFElements<2, double>(scanner, out_value, "illegal vector element");
         }
     }
 }
@@ -2239,9 +2411,7 @@ void VRMLParserImpl::readMFVec2s(MFVec2s& out_value)
         if(!scanner->readChar('[')){
             out_value.push_back(::readSFVec2s(scanner));
         } else {
-            while(!scanner->readChar(']')){
-                out_value.push_back(::readSFVec2s(scanner));
-            }
+            readMFElements<2, float>(scanner, out_value, "illegal vector element");
         }
     }
 }
@@ -2276,9 +2446,7 @@ void VRMLParserImpl::readMFVec3f(MFVec3f& out_value)
         if(!scanner->readChar('[')){
             out_value.push_back(::readSFVec3f(scanner));
         } else {
-            while(!scanner->readChar(']')){
-                out_value.push_back(::readSFVec3f(scanner));
-            }
+            readMFElements<3, double>(scanner, out_value, "illegal vector element");
         }
     }
 }
@@ -2318,9 +2486,7 @@ void VRMLParserImpl::readMFVec3s(MFVec3s& out_value)
         if(!scanner->readChar('[')){
             out_value.push_back(::readSFVec3s(scanner));
         } else {
-            while(!scanner->readChar(']')){
-                out_value.push_back(::readSFVec3s(scanner));
-            }
+            readMFElements<3, float>(scanner, out_value, "illegal vector element");
         }
     }
 }
@@ -2790,5 +2956,6 @@ void VRMLParserImpl::convertUrl(MFString& urls)
             scanner->throwException("Not file protocol is unsupported");
         }
         *it = chkFile;
+        sourceFiles->push_back(chkFile);
     }
 }
@@ -37,11 +37,20 @@ public:
 
     /**
        This method returns the top node of the next node tree written in the file.
+       The VRML files inlined in the tree are parsed concurrently by the tasks of
+       TaskScheduler::instance(), and they are completed when this method returns.
     */
     VRMLNodePtr readNode();
 
     void checkEOF();
 
+    /**
+       The absolute paths of the files which have been read since the last load() call,
+       which include the inlined files and the files given by the url fields.
+       The list is completed when all the nodes are read.
+    */
+    const std::vector<std::string>& sourceFiles() const;
+
 private:
     VRMLParserImpl* impl;
     void init();
@@ -15,7 +15,11 @@
 #include "DaeParser.h"
 #include "STLSceneLoader.h"
 #include "NullOut.h"
+#include "TaskScheduler.h"
 #include <boost/format.hpp>
+#include <boost/bind.hpp>
+#include <sstream>
+#include <set>
 #include <boost/tuple/tuple.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -78,6 +82,9 @@ public:
         
     typedef map<string, SgImagePtr> ImagePathToSgImageMap;
     ImagePathToSgImageMap imagePathToSgImageMap;
+
+    typedef map<VRMLAnotherFormatFilePtr, SgNodePtr> AnotherFormatFileToSgNodeMap;
+    AnotherFormatFileToSgNodeMap preloadedAnotherFormatFileMap;
         
     enum BoxFaceID { NO_FACE, LEFT_FACE, TOP_FACE, FRONT_FACE, BOTTOM_FACE, RIGHT_FACE, BACK_FACE };
         
@@ -116,6 +123,17 @@ public:
     SgSpotLight* createSpotLight(VRMLSpotLight* vlight);
     SgDirectionalLight* createDirectionalLight(VRMLDirectionalLight* vlight);
     SgNode* convertFogNode(VRMLFog* vfog);
+    void collectAnotherFormatFiles(
+        VRMLNode* vnode, std::set<VRMLNode*>& visited, vector<VRMLAnotherFormatFilePtr>& out_files);
+    void collectAnotherFormatFiles(
+        VRMLVariantField& field, std::set<VRMLNode*>& visited, vector<VRMLAnotherFormatFilePtr>& out_files);
+    void collectTextureImageUrls(VRMLNode* vnode, std::set<VRMLNode*>& visited, std::set<string>& out_urls);
+    void collectTextureImageUrls(VRMLVariantField& field, std::set<VRMLNode*>& visited, std::set<string>& out_urls);
+    static void loadTextureImageOf(const vector<string>* urls, vector<SgImagePtr>* out_images, int index);
+    static SgNode* loadAnotherFormatFile(VRMLAnotherFormatFile* anotherFormat, std::ostream& os);
+    static void loadAnotherFormatFileOf(
+        const vector<VRMLAnotherFormatFilePtr>* files, vector<SgNodePtr>* out_nodes, vector<string>* out_messages,
+        int index);
     SgNode* readAnotherFormatFile(VRMLAnotherFormatFile* anotherFormat);
 };
 
@@ -197,6 +215,59 @@ void VRMLToSGConverter::clearConvertedNodeMap()
     impl->vrmlTextureToSgTextureMap.clear();
     impl->vrmlTextureTransformToSgTextureTransformMap.clear();
     impl->imagePathToSgImageMap.clear();
+    impl->preloadedAnotherFormatFileMap.clear();
+}
+
+
+void VRMLToSGConverter::preloadAnotherFormatFiles(VRMLNodePtr vrmlNode)
+{
+    if(!vrmlNode){
+        return;
+    }
+    std::set<VRMLNode*> visited;
+    vector<VRMLAnotherFormatFilePtr> files;
+    impl->collectAnotherFormatFiles(vrmlNode.get(), visited, files);
+    if(files.empty()){
+        return;
+    }
+
+    const int n = files.size();
+    vector<SgNodePtr> nodes(n);
+    vector<string> messages(n);
+    TaskScheduler::instance()->parallelFor(
+        0, n, boost::bind(&VRMLToSGConverterImpl::loadAnotherFormatFileOf, &files, &nodes, &messages, _1));
+
+    // The messages are output in the same order as the sequential loading
+    for(int i=0; i < n; ++i){
+        impl->os() << messages[i];
+        impl->preloadedAnotherFormatFileMap[files[i]] = nodes[i];
+    }
+}
+
+
+void VRMLToSGConverter::preloadTextureImages(VRMLNodePtr vrmlNode)
+{
+    if(!vrmlNode){
+        return;
+    }
+    std::set<VRMLNode*> visited;
+    std::set<string> urlSet;
+    impl->collectTextureImageUrls(vrmlNode.get(), visited, urlSet);
+    if(urlSet.empty()){
+        return;
+    }
+
+    vector<string> urls(urlSet.begin(), urlSet.end());
+    const int n = urls.size();
+    vector<SgImagePtr> images(n);
+    TaskScheduler::instance()->parallelFor(
+        0, n, boost::bind(&VRMLToSGConverterImpl::loadTextureImageOf, &urls, &images, _1));
+
+    for(int i=0; i < n; ++i){
+        if(images[i]){
+            impl->imagePathToSgImageMap[urls[i]] = images[i];
+        }
+    }
 }
 
 
@@ -1832,12 +1903,135 @@ SgNode* VRMLToSGConverterImpl::convertFogNode(VRMLFog* vfog)
 }
 
 
+void VRMLToSGConverterImpl::collectAnotherFormatFiles
+(VRMLNode* vnode, std::set<VRMLNode*>& visited, vector<VRMLAnotherFormatFilePtr>& out_files)
+{
+    if(!vnode || !visited.insert(vnode).second){
+        return;
+    }
+    if(VRMLAnotherFormatFile* anotherFormat = dynamic_cast<VRMLAnotherFormatFile*>(vnode)){
+        if(preloadedAnotherFormatFileMap.find(anotherFormat) == preloadedAnotherFormatFileMap.end()){
+            out_files.push_back(anotherFormat);
+        }
+    } else if(AbstractVRMLGroup* group = dynamic_cast<AbstractVRMLGroup*>(vnode)){
+        const int n = group->countChildren();
+        for(int i=0; i < n; ++i){
+            collectAnotherFormatFiles(group->getChild(i), visited, out_files);
+        }
+    } else if(VRMLProtoInstance* protoInstance = dynamic_cast<VRMLProtoInstance*>(vnode)){
+        for(VRMLProtoFieldMap::iterator p = protoInstance->fields.begin(); p != protoInstance->fields.end(); ++p){
+            collectAnotherFormatFiles(p->second, visited, out_files);
+        }
+        collectAnotherFormatFiles(protoInstance->actualNode.get(), visited, out_files);
+    }
+}
+
+
+void VRMLToSGConverterImpl::collectAnotherFormatFiles
+(VRMLVariantField& field, std::set<VRMLNode*>& visited, vector<VRMLAnotherFormatFilePtr>& out_files)
+{
+    if(field.which() == SFNODE){
+        collectAnotherFormatFiles(boost::get<SFNode>(field).get(), visited, out_files);
+    } else if(field.which() == MFNODE){
+        MFNode& nodes = boost::get<MFNode>(field);
+        for(size_t i=0; i < nodes.size(); ++i){
+            collectAnotherFormatFiles(nodes[i].get(), visited, out_files);
+        }
+    }
+}
+
+
+/**
+   The first URL of each texture is collected because the others are only used when it cannot be loaded
+*/
+void VRMLToSGConverterImpl::collectTextureImageUrls
+(VRMLNode* vnode, std::set<VRMLNode*>& visited, std::set<string>& out_urls)
+{
+    if(!vnode || !visited.insert(vnode).second){
+        return;
+    }
+    if(VRMLShape* shape = dynamic_cast<VRMLShape*>(vnode)){
+        if(shape->appearance){
+            if(VRMLImageTexture* texture = dynamic_cast<VRMLImageTexture*>(shape->appearance->texture.get())){
+                const MFString& urls = texture->url;
+                for(size_t i=0; i < urls.size(); ++i){
+                    const string& url = urls[i];
+                    if(!url.empty()){
+                        if(imagePathToSgImageMap.find(url) == imagePathToSgImageMap.end()){
+                            out_urls.insert(url);
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+    } else if(AbstractVRMLGroup* group = dynamic_cast<AbstractVRMLGroup*>(vnode)){
+        const int n = group->countChildren();
+        for(int i=0; i < n; ++i){
+            collectTextureImageUrls(group->getChild(i), visited, out_urls);
+        }
+    } else if(VRMLProtoInstance* protoInstance = dynamic_cast<VRMLProtoInstance*>(vnode)){
+        for(VRMLProtoFieldMap::iterator p = protoInstance->fields.begin(); p != protoInstance->fields.end(); ++p){
+            collectTextureImageUrls(p->second, visited, out_urls);
+        }
+        collectTextureImageUrls(protoInstance->actualNode.get(), visited, out_urls);
+    }
+}
+
+
+void VRMLToSGConverterImpl::collectTextureImageUrls
+(VRMLVariantField& field, std::set<VRMLNode*>& visited, std::set<string>& out_urls)
+{
+    if(field.which() == SFNODE){
+        collectTextureImageUrls(boost::get<SFNode>(field).get(), visited, out_urls);
+    } else if(field.which() == MFNODE){
+        MFNode& nodes = boost::get<MFNode>(field);
+        for(size_t i=0; i < nodes.size(); ++i){
+            collectTextureImageUrls(nodes[i].get(), visited, out_urls);
+        }
+    }
+}
+
+
+void VRMLToSGConverterImpl::loadTextureImageOf(const vector<string>* urls, vector<SgImagePtr>* out_images, int index)
+{
+    ImageIO imageIO;
+    imageIO.setUpsideDown(true);
+    SgImagePtr image = new SgImage;
+    try {
+        imageIO.load(image->image(), (*urls)[index]);
+        (*out_images)[index] = image;
+    } catch(const exception_base& ex){
+        // The error is output when the image is loaded again in createTexture()
+    }
+}
+
+
+void VRMLToSGConverterImpl::loadAnotherFormatFileOf
+(const vector<VRMLAnotherFormatFilePtr>* files, vector<SgNodePtr>* out_nodes, vector<string>* out_messages, int index)
+{
+    ostringstream os;
+    (*out_nodes)[index] = loadAnotherFormatFile((*files)[index].get(), os);
+    (*out_messages)[index] = os.str();
+}
+
+
 SgNode* VRMLToSGConverterImpl::readAnotherFormatFile(VRMLAnotherFormatFile* anotherFormat)
+{
+    AnotherFormatFileToSgNodeMap::iterator p = preloadedAnotherFormatFileMap.find(anotherFormat);
+    if(p != preloadedAnotherFormatFileMap.end()){
+        return p->second.get();
+    }
+    return loadAnotherFormatFile(anotherFormat, os());
+}
+
+
+SgNode* VRMLToSGConverterImpl::loadAnotherFormatFile(VRMLAnotherFormatFile* anotherFormat, std::ostream& os)
 {
     BOOST_ASSERT(!anotherFormat->url.empty());
     if (boost::algorithm::iends_with(anotherFormat->url, "dae")) {
         // In the case of dae, we have to create a Sg-object directly from dae-file by using the dae-parser.
-        DaeParser parser(&os());
+        DaeParser parser(&os);
         return parser.createScene(anotherFormat->url);
 
     } else if (boost::algorithm::iends_with(anotherFormat->url, "stl")) {
@@ -29,6 +29,20 @@ public:
     void setMaxCreaseAngle(double angle);
 
     void clearConvertedNodeMap();
+
+    /**
+       The STL and COLLADA files inlined in the node tree are loaded concurrently,
+       and the loaded scenes are used when the nodes are converted by convert().
+       This is useful when the tree is converted by a number of convert() calls.
+    */
+    void preloadAnotherFormatFiles(VRMLNodePtr vrmlNode);
+
+    /**
+       The image files of the ImageTexture nodes in the node tree are decoded concurrently,
+       and the decoded images are used when the textures are created by convert().
+       The images which cannot be loaded are tried again by convert() to output the errors.
+    */
+    void preloadTextureImages(VRMLNodePtr vrmlNode);
         
     SgNodePtr convert(VRMLNodePtr vrmlNode);
 
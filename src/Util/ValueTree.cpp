@@ -4,6 +4,7 @@
 
 #include "ValueTree.h"
 #include <stack>
+#include <algorithm>
 #include <iostream>
 #include <yaml.h>
 #include <boost/lexical_cast.hpp>
@@ -444,6 +445,75 @@ void ValueNode::throwNotListingException() const
 }
 
 
+namespace {
+
+typedef std::pair<std::string, ValueNodePtr> KeyValuePair;
+
+// Mappings with at most this number of values are searched linearly
+const int MaxLinearSearchSize = 8;
+
+bool isKeyLess(const KeyValuePair& value, const std::string& key)
+{
+    return value.first < key;
+}
+
+struct KeyOrder
+{
+    const vector<KeyValuePair>& values;
+    KeyOrder(const vector<KeyValuePair>& values) : values(values) { }
+    bool operator()(int index1, int index2) const {
+        return values[index1].first < values[index2].first;
+    }
+};
+
+/*
+  The following functions move the values of a mapping by swapping them because copying
+  the keys and the reference counted nodes is expensive.
+*/
+inline void swapValues(KeyValuePair& value1, KeyValuePair& value2)
+{
+    value1.first.swap(value2.first);
+    value1.second.swap(value2.second);
+}
+
+void appendValue(vector<KeyValuePair>& values, const std::string& key, ValueNode* node)
+{
+    const size_t n = values.size();
+    if(n == values.capacity()){
+        vector<KeyValuePair> newValues;
+        newValues.reserve(std::max((size_t)4, n * 2));
+        newValues.resize(n);
+        for(size_t i=0; i < n; ++i){
+            swapValues(newValues[i], values[i]);
+        }
+        values.swap(newValues);
+    }
+    values.resize(n + 1);
+    KeyValuePair& value = values.back();
+    value.first = key;
+    value.second = node;
+}
+
+void insertValue(vector<KeyValuePair>& values, int index, const std::string& key, ValueNode* node)
+{
+    appendValue(values, key, node);
+    for(int i = values.size() - 1; i > index; --i){
+        swapValues(values[i], values[i-1]);
+    }
+}
+
+void eraseValue(vector<KeyValuePair>& values, int index)
+{
+    const int n = values.size();
+    for(int i = index + 1; i < n; ++i){
+        swapValues(values[i-1], values[i]);
+    }
+    values.pop_back();
+}
+
+}
+
+
 Mapping::Mapping()
 {
     typeBits = MAPPING;
@@ -464,6 +534,7 @@ Mapping::Mapping(int line, int column)
     column_ = column;
     mode = READ_MODE;
     indexCounter = 0;
+    keyQuoteStyle = PLAIN_STRING;
     isFlowStyle_ = false;
     doubleFormat_ = defaultDoubleFormat;
 }
@@ -517,7 +588,7 @@ ValueNode* Mapping::find(const std::string& key) const
     if(!isValid()){
         throwNotMappingException();
     }
-    const_iterator p = values.find(toUTF8(key));
+    const_iterator p = findValue(toUTF8(key));
     if(p != values.end()){
         return p->second.get();
     } else {
@@ -531,7 +602,7 @@ Mapping* Mapping::findMapping(const std::string& key) const
     if(!isValid()){
         throwNotMappingException();
     }
-    const_iterator p = values.find(toUTF8(key));
+    const_iterator p = findValue(toUTF8(key));
     if(p != values.end()){
         ValueNode* node = p->second.get();
         if(node->isMapping()){
@@ -547,7 +618,7 @@ Listing* Mapping::findListing(const std::string& key) const
     if(!isValid()){
         throwNotMappingException();
     }
-    const_iterator p = values.find(toUTF8(key));
+    const_iterator p = findValue(toUTF8(key));
     if(p != values.end()){
         ValueNode* node = p->second.get();
         if(node->isListing()){
@@ -563,10 +634,10 @@ ValueNodePtr Mapping::extract(const std::string& key)
     if(!isValid()){
         throwNotMappingException();
     }
-    iterator p = values.find(toUTF8(key));
+    iterator p = findValue(toUTF8(key));
     if(p != values.end()){
         ValueNodePtr value = p->second;
-        values.erase(p);
+        eraseValue(values, p - values.begin());
         return value;
     }
     return 0;
@@ -579,7 +650,7 @@ ValueNode& Mapping::get(const std::string& key) const
     if(!isValid()){
         throwNotMappingException();
     }
-    const_iterator p = values.find(toUTF8(key));
+    const_iterator p = findValue(toUTF8(key));
     if(p == values.end()){
         throwKeyNotFoundException(key);
     }
@@ -603,12 +674,94 @@ inline void Mapping::insertSub(const std::string& key, ValueNode* node)
         EmptyKeyException ex;
         throw ex;
     }
-    //values.insert(make_pair(key, node));
-    values[key] = node;
+    iterator p = lowerBound(key);
+    if(p != values.end() && p->first == key){
+        p->second = node;
+    } else {
+        insertValue(values, p - values.begin(), key, node);
+    }
     node->indexInMapping = indexCounter++;
 }
 
 
+Mapping::iterator Mapping::lowerBound(const std::string& key)
+{
+    if(values.size() <= MaxLinearSearchSize){
+        iterator p = values.begin();
+        while(p != values.end() && p->first < key){
+            ++p;
+        }
+        return p;
+    }
+    return std::lower_bound(values.begin(), values.end(), key, isKeyLess);
+}
+
+
+Mapping::iterator Mapping::findValue(const std::string& key)
+{
+    if(values.size() <= MaxLinearSearchSize){
+        for(iterator p = values.begin(); p != values.end(); ++p){
+            if(p->first == key){
+                return p;
+            }
+        }
+        return values.end();
+    }
+    iterator p = std::lower_bound(values.begin(), values.end(), key, isKeyLess);
+    if(p != values.end() && p->first == key){
+        return p;
+    }
+    return values.end();
+}
+
+
+/**
+   Inserting each value into the sorted position takes the time proportional to the number of
+   the values, so the values read from a document are appended and sorted at the end of the mapping.
+*/
+void Mapping::appendUnsorted(const std::string& key, ValueNode* node)
+{
+    if(key.empty()){
+        EmptyKeyException ex;
+        throw ex;
+    }
+    appendValue(values, key, node);
+    node->indexInMapping = indexCounter++;
+}
+
+
+void Mapping::sortAppendedValues()
+{
+    const int n = values.size();
+    if(n <= MaxLinearSearchSize * 2){
+        for(int i=1; i < n; ++i){
+            for(int j=i; j > 0 && values[j].first < values[j-1].first; --j){
+                swapValues(values[j], values[j-1]);
+            }
+        }
+    } else {
+        vector<int> order(n);
+        for(int i=0; i < n; ++i){
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), KeyOrder(values));
+        Container sorted(n);
+        for(int i=0; i < n; ++i){
+            swapValues(sorted[i], values[order[i]]);
+        }
+        values.swap(sorted);
+    }
+
+    // The last one of the values with the same key is used as the value of the key
+    for(int i = n - 1; i > 0; --i){
+        if(values[i].first == values[i-1].first){
+            values[i-1].second.swap(values[i].second);
+            eraseValue(values, i);
+        }
+    }
+}
+
+
 void Mapping::insert(const std::string& key, ValueNode* node)
 {
     if(!isValid()){
@@ -624,7 +777,13 @@ void Mapping::insert(const Mapping* other)
     if(!isValid()){
         throwNotMappingException();
     }
-    values.insert(other->values.begin(), other->values.end());
+    // The existing values are not overwritten
+    for(const_iterator p = other->values.begin(); p != other->values.end(); ++p){
+        iterator q = lowerBound(p->first);
+        if(q == values.end() || q->first != p->first){
+            insertValue(values, q - values.begin(), p->first, p->second);
+        }
+    }
 }
 
 
@@ -636,11 +795,11 @@ Mapping* Mapping::openMapping(const std::string& key, bool doOverwrite)
 
     Mapping* mapping = 0;
     const string uKey(toUTF8(key));
-    iterator p = values.find(uKey);
+    iterator p = findValue(uKey);
     if(p != values.end()){
         ValueNode* node = p->second.get();
         if(!node->isMapping()){
-            values.erase(p);
+            eraseValue(values, p - values.begin());
         } else {
             mapping = static_cast<Mapping*>(node);
             if(doOverwrite){
@@ -676,11 +835,11 @@ Listing* Mapping::openListing(const std::string& key, bool doOverwrite)
 
     Listing* sequence = 0;
     const string uKey(toUTF8(key));
-    iterator p = values.find(uKey);
+    iterator p = findValue(uKey);
     if(p != values.end()){
         ValueNode* node = p->second.get();
         if(!node->isListing()){
-            values.erase(p);
+            eraseValue(values, p - values.begin());
         } else {
             sequence = static_cast<Listing*>(node);
             if(doOverwrite){
@@ -710,7 +869,12 @@ Listing* Mapping::openFlowStyleListing(const std::string& key, bool doOverwrite)
 
 bool Mapping::remove(const std::string& key)
 {
-    return (values.erase(key) > 0);
+    iterator p = findValue(key);
+    if(p != values.end()){
+        eraseValue(values, p - values.begin());
+        return true;
+    }
+    return false;
 }
 
 
@@ -767,7 +931,7 @@ bool Mapping::read(const std::string &key, double &out_value) const
 void Mapping::writeUTF8(const std::string &key, const std::string& value, StringStyle stringStyle)
 {
     string uKey(toUTF8(key));
-    iterator p = values.find(uKey);
+    iterator p = findValue(uKey);
     if(p == values.end()){
         insertSub(uKey, new ScalarNode(value, stringStyle));
     } else {
@@ -790,7 +954,7 @@ void Mapping::writeUTF8(const std::string &key, const std::string& value, String
 void Mapping::writeSub(const std::string &key, const char* text, size_t length, StringStyle stringStyle)
 {
     const string uKey(toUTF8(key));
-    iterator p = values.find(uKey);
+    iterator p = findValue(uKey);
     if(p == values.end()){
         insertSub(uKey, new ScalarNode(text, length, stringStyle));
     } else {
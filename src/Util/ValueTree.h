@@ -221,9 +221,14 @@ private:
 };
 
 
+/**
+   The key-value pairs are stored in a vector sorted by the keys instead of a tree of nodes,
+   which reduces the memory allocations and the memory usage of large documents.
+   Note that inserting a value invalidates the iterators.
+*/
 class CNOID_EXPORT Mapping : public ValueNode
 {
-    typedef std::map<std::string, ValueNodePtr> Container;
+    typedef std::vector< std::pair<std::string, ValueNodePtr> > Container;
         
 public:
 
@@ -397,6 +402,16 @@ private:
 
     inline void insertSub(const std::string& key, ValueNode* node);
 
+    iterator lowerBound(const std::string& key);
+    iterator findValue(const std::string& key);
+    const_iterator findValue(const std::string& key) const {
+        return const_cast<Mapping*>(this)->findValue(key);
+    }
+
+    // used by YAMLReader, which sorts the values when all of them are appended
+    void appendUnsorted(const std::string& key, ValueNode* node);
+    void sortAppendedValues();
+
     void writeSub(const std::string &key, const char* text, size_t length, StringStyle stringStyle);
 
     static bool compareIters(const Mapping::const_iterator& it1, const Mapping::const_iterator& it2);
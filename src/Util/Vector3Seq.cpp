@@ -57,10 +57,10 @@ bool Vector3Seq::loadPlainFormat(const std::string& filename)
     setNumFrames(loader.numFrames());
     setFrameRate(1.0 / loader.timeStep());
 
-    int frame = 0;
-    for(PlainSeqFileLoader::iterator it = loader.begin(); it != loader.end(); ++it){
-        vector<double>& data = *it;
-        (*this)[frame++] << data[1], data[2], data[3];
+    const int n = loader.numFrames();
+    for(int i=0; i < n; ++i){
+        const double* data = loader.frame(i);
+        (*this)[i] << data[1], data[2], data[3];
     }
 
     return true;
@@ -99,12 +99,8 @@ bool Vector3Seq::doWriteSeq(YAMLWriter& writer)
         writer.startListing();
         const int n = numFrames();
         for(int i=0; i < n; ++i){
-            writer.startFlowStyleListing();
             const Vector3& v = (*this)[i];
-            for(int j=0; j < 3; ++j){
-                writer.putScalar(v[j]);
-            }
-            writer.endListing();
+            writer.putFlowStyleListing(v.data(), 3);
         }
         writer.endListing();
         return true;
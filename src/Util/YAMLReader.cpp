@@ -4,6 +4,7 @@
 
 #include "YAMLReader.h"
 #include <cerrno>
+#include <cstdlib>
 #include <stack>
 #include <iostream>
 #include <yaml.h>
@@ -41,6 +42,8 @@ public:
     void onListingEnd(yaml_event_t& event);
     void onScalar(yaml_event_t& event);
     void onAlias(yaml_event_t& event);
+    bool beginNumericListing(yaml_event_t& event);
+    void onNumericListingEvent(yaml_event_t& event);
 
     static ScalarNode* createScalar(const yaml_event_t& event);
         
@@ -67,6 +70,13 @@ public:
     bool isRegularMultiListingExpected;
     vector<int> expectedListingSizes;
 
+    typedef map<string, ref_ptr<YAMLReader::NumericListingHandler> > NumericListingHandlerMap;
+    NumericListingHandlerMap numericListingHandlers;
+    YAMLReader::NumericListingHandler* currentNumericListingHandler;
+    int numericListingLevel;
+    yaml_mark_t numericListingMark;
+    vector<double> numericRow;
+
     string errorMessage;
 };
 }
@@ -85,6 +95,7 @@ YAMLReaderImpl::YAMLReaderImpl()
     mappingFactory = new YAMLReader::MappingFactory<Mapping>();
     currentDocumentIndex = 0;
     isRegularMultiListingExpected = false;
+    currentNumericListingHandler = 0;
 }
 
 
@@ -126,6 +137,16 @@ void YAMLReader::expectRegularMultiListing()
 }
 
 
+void YAMLReader::setNumericListingHandler(const std::string& key, NumericListingHandler* handler)
+{
+    if(handler){
+        impl->numericListingHandlers[key] = handler;
+    } else {
+        impl->numericListingHandlers.erase(key);
+    }
+}
+
+
 void YAMLReader::clearDocuments()
 {
     impl->clearDocuments();
@@ -139,6 +160,7 @@ void YAMLReaderImpl::clearDocuments()
     }
     anchorMap.clear();
     documents.clear();
+    currentNumericListingHandler = 0;
 }
 
 
@@ -222,6 +244,12 @@ bool YAMLReaderImpl::parse()
             goto error;
         }
 
+        if(currentNumericListingHandler){
+            onNumericListingEvent(event);
+            yaml_event_delete(&event);
+            continue;
+        }
+
         switch(event.type){
             
         case YAML_STREAM_START_EVENT:
@@ -304,7 +332,7 @@ void YAMLReaderImpl::addNode(ValueNode* node)
     ValueNode* parent = info.node.get();
     if(parent->isMapping()){
         Mapping* mapping = static_cast<Mapping*>(parent);
-        mapping->insert(info.key, node);
+        mapping->appendUnsorted(toUTF8(info.key), node);
         info.key.clear();
     } else if(parent->isListing()){
         Listing* listing = static_cast<Listing*>(parent);
@@ -368,6 +396,7 @@ void YAMLReaderImpl::onMappingEnd(yaml_event_t& event)
         cout << "YAMLReaderImpl::onMappingEnd()" << endl;
     }
 
+    static_cast<Mapping*>(nodeStack.top().node.get())->sortAppendedValues();
     popNode();
 }
 
@@ -378,6 +407,10 @@ void YAMLReaderImpl::onListingStart(yaml_event_t& event)
         cout << "YAMLReaderImpl::onListingStart()" << endl;
     }
 
+    if(!numericListingHandlers.empty() && beginNumericListing(event)){
+        return;
+    }
+
     NodeInfo info;
     Listing* listing;
 
@@ -420,6 +453,90 @@ void YAMLReaderImpl::onListingEnd(yaml_event_t& event)
 }
 
 
+bool YAMLReaderImpl::beginNumericListing(yaml_event_t& event)
+{
+    if(nodeStack.empty()){
+        return false;
+    }
+    NodeInfo& info = nodeStack.top();
+    if(!info.node->isMapping()){
+        return false;
+    }
+    NumericListingHandlerMap::iterator p = numericListingHandlers.find(info.key);
+    if(p == numericListingHandlers.end()){
+        return false;
+    }
+    Mapping* mapping = static_cast<Mapping*>(info.node.get());
+    mapping->sortAppendedValues();
+    if(!p->second->beginListing(*mapping)){
+        return false;
+    }
+    currentNumericListingHandler = p->second.get();
+    numericListingLevel = 1;
+    numericListingMark = event.start_mark;
+    return true;
+}
+
+
+/**
+   The events of the listing given to a numeric listing handler are processed here
+   instead of the ordinary event handlers.
+*/
+void YAMLReaderImpl::onNumericListingEvent(yaml_event_t& event)
+{
+    switch(event.type){
+
+    case YAML_SEQUENCE_START_EVENT:
+        if(numericListingLevel == 1){
+            numericRow.clear();
+            numericListingLevel = 2;
+            return;
+        }
+        break;
+
+    case YAML_SEQUENCE_END_EVENT:
+        if(numericListingLevel == 2){
+            currentNumericListingHandler->putRow(numericRow.empty() ? 0 : &numericRow[0], numericRow.size());
+            numericListingLevel = 1;
+        } else {
+            ValueNode* node = currentNumericListingHandler->endListing();
+            currentNumericListingHandler = 0;
+            if(node){
+                node->line_ = numericListingMark.line;
+                node->column_ = numericListingMark.column;
+                addNode(node);
+            } else {
+                nodeStack.top().key.clear();
+            }
+        }
+        return;
+
+    case YAML_SCALAR_EVENT:
+        if(numericListingLevel == 2){
+            const char* nptr = (const char*)event.data.scalar.value;
+            char* endptr;
+            const double value = strtod(nptr, &endptr);
+            if(endptr != nptr){
+                numericRow.push_back(value);
+                return;
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    const string key = nodeStack.top().key;
+    currentNumericListingHandler = 0;
+    ValueNode::SyntaxException ex;
+    ex.setMessage(str(format("The elements of \"%1%\" must be the listings of numbers") % key));
+    const yaml_mark_t& mark = event.start_mark;
+    ex.setPosition(mark.line, mark.column);
+    throw ex;
+}
+
+
 void YAMLReaderImpl::onScalar(yaml_event_t& event)
 {
     if(debugTrace){
@@ -27,6 +27,24 @@ class CNOID_EXPORT YAMLReader
         
 public:
 
+    /**
+       The handler reads the listing of numeric listings which is the value of a particular key
+       directly from the parser events, so that no node is created for each number.
+       This is used to load huge numeric data such as the frames of a motion.
+    */
+    class NumericListingHandler : public Referenced
+    {
+    public:
+        /**
+           @param mapping The mapping which has the listing. It only contains the values put before the listing.
+           @return false if the listing should be read as ordinary nodes
+        */
+        virtual bool beginListing(const Mapping& mapping) = 0;
+        virtual void putRow(const double* values, int size) = 0;
+        //! @return the node stored as the value of the key, or null if the key should not be stored
+        virtual ValueNode* endListing() = 0;
+    };
+
     YAMLReader();
     ~YAMLReader();
 
@@ -35,6 +53,8 @@ public:
     }
         
     void expectRegularMultiListing();
+
+    void setNumericListingHandler(const std::string& key, NumericListingHandler* handler);
 #ifdef CNOID_BACKWARD_COMPATIBILITY
     void expectRegularMultiSequence() { expectRegularMultiListing(); }
     bool load_string(const std::string& yamlstring) { return parse(yamlstring); }
@@ -6,12 +6,146 @@
 #include "UTF8.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <boost/tokenizer.hpp>
 
 using namespace std;
 using namespace boost;
 using namespace cnoid;
 
+namespace {
+
+const double powersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/**
+   Returns the precision of the format in the form of "%.<precision>g" whose output
+   can be given by formatDoubleAsG, or zero for the other formats.
+*/
+int getPrecisionOfGFormat(const char* format)
+{
+    if(format[0] == '%' && format[1] == '.' &&
+       format[2] >= '1' && format[2] <= '9' && format[3] == 'g' && format[4] == '\0'){
+        return format[2] - '0';
+    }
+    return 0;
+}
+
+/**
+   Gives the same string as printf with "%.<precision>g" without the expensive generic
+   conversion of printf. The decimal digits are obtained by scaling the value with an exact
+   power of ten, so the values whose rounding cannot be determined from the scaled value,
+   which are very close to the midpoint of two rounded values, are left to printf as well as
+   the values out of the range where the scaling is exact enough.
+   @return the length of the string, or zero if the value is not formatted
+*/
+int formatDoubleAsG(double value, int precision, char* buf)
+{
+    char* p = buf;
+    
+    if(value == 0.0){
+        if(1.0 / value < 0.0){
+            *p++ = '-';
+        }
+        *p++ = '0';
+        *p = '\0';
+        return p - buf;
+    }
+    if(value < 0.0){
+        *p++ = '-';
+        value = -value;
+    }
+    if(!(value >= 1.0e-12 && value < 1.0e12)){
+        return 0; // including nan and inf
+    }
+
+    const double lower = powersOf10[precision - 1];
+    const double upper = powersOf10[precision];
+    int exponent = static_cast<int>(floor(log10(value)));
+    double scaled;
+    for(int i=0; i < 2; ++i){
+        const int k = precision - 1 - exponent;
+        scaled = (k >= 0) ? (value * powersOf10[k]) : (value / powersOf10[-k]);
+        if(scaled < lower){
+            --exponent;
+        } else if(scaled >= upper){
+            ++exponent;
+        } else {
+            break;
+        }
+    }
+    if(scaled < lower || scaled >= upper){
+        return 0;
+    }
+
+    const double integral = floor(scaled);
+    const double fraction = scaled - integral;
+    if(fabs(fraction - 0.5) < 1.0e-6){
+        return 0;
+    }
+    unsigned long digitsValue = static_cast<unsigned long>(integral);
+    if(fraction > 0.5){
+        ++digitsValue;
+        if(digitsValue == static_cast<unsigned long>(upper)){
+            digitsValue /= 10;
+            ++exponent;
+        }
+    }
+
+    char digits[9];
+    for(int i = precision - 1; i >= 0; --i){
+        digits[i] = '0' + (digitsValue % 10);
+        digitsValue /= 10;
+    }
+    int numDigits = precision;
+    while(numDigits > 1 && digits[numDigits - 1] == '0'){
+        --numDigits;
+    }
+
+    if(exponent < -4 || exponent >= precision){
+        *p++ = digits[0];
+        if(numDigits > 1){
+            *p++ = '.';
+            for(int i=1; i < numDigits; ++i){
+                *p++ = digits[i];
+            }
+        }
+        *p++ = 'e';
+        *p++ = (exponent < 0) ? '-' : '+';
+        const int e = abs(exponent);
+        *p++ = '0' + e / 10;
+        *p++ = '0' + e % 10;
+    } else if(exponent >= 0){
+        int i = 0;
+        while(i <= exponent){
+            *p++ = digits[i++];
+        }
+        if(numDigits > i){
+            *p++ = '.';
+            while(i < numDigits){
+                *p++ = digits[i++];
+            }
+        }
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        for(int i = -exponent - 1; i > 0; --i){
+            *p++ = '0';
+        }
+        for(int i=0; i < numDigits; ++i){
+            *p++ = digits[i];
+        }
+    }
+    *p = '\0';
+    
+    return p - buf;
+}
+
+}
+
 
 YAMLWriter::YAMLWriter(const std::string filename)
     : os(ofs)
@@ -23,6 +157,7 @@ YAMLWriter::YAMLWriter(const std::string filename)
     isKeyOrderPreservationMode = false;
 
     doubleFormat = "%.7g";
+    doublePrecision = 7;
 
     ofs.open(filename.c_str());
 
@@ -40,6 +175,7 @@ YAMLWriter::YAMLWriter(std::ostream& os)
     isKeyOrderPreservationMode = false;
 
     doubleFormat = "%.7g";
+    doublePrecision = 7;
 
     pushState(TOP, false);
 }
@@ -275,14 +411,31 @@ void YAMLWriter::putBlockStyleString(const std::string& value, bool isLiteral)
 }
 
 
-void YAMLWriter::putScalar(const double& value)
+int YAMLWriter::formatDouble(double value, char* buf)
 {
-    char buf[20];
+    int length = 0;
+    if(doublePrecision > 0){
+        length = formatDoubleAsG(value, doublePrecision, buf);
+    }
+    if(length == 0){
 #ifdef _WIN32
-    _snprintf(buf, 20, doubleFormat, value);
+        length = _snprintf(buf, 20, doubleFormat, value);
 #else
-    snprintf(buf, 20, doubleFormat, value);
+        length = snprintf(buf, 20, doubleFormat, value);
 #endif
+        if(length < 0 || length >= 20){
+            buf[19] = '\0';
+            length = strlen(buf);
+        }
+    }
+    return length;
+}
+
+
+void YAMLWriter::putScalar(const double& value)
+{
+    char buf[20];
+    formatDouble(value, buf);
     putString_(buf);
 }
 
@@ -290,6 +443,29 @@ void YAMLWriter::putScalar(const double& value)
 void YAMLWriter::setDoubleFormat(const char* format)
 {
     doubleFormat = format;
+    doublePrecision = getPrecisionOfGFormat(format);
+}
+
+
+void YAMLWriter::putFlowStyleListing(const double* values, int size)
+{
+    if(startValuePut()){
+        string row;
+        row.reserve(size * 12 + 4);
+        row += "[ ";
+        char buf[20];
+        for(int i=0; i < size; ++i){
+            if(i > 0){
+                row += ", ";
+            }
+            row.append(buf, formatDouble(values[i], buf));
+        }
+        row += " ]";
+        os.write(row.data(), row.size());
+        isCurrentNewLine = false;
+        doInsertLineFeed = false;
+        endValuePut();
+    }
 }
 
 
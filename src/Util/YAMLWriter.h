@@ -45,6 +45,12 @@ public:
     void putScalar(const double& value);
     void setDoubleFormat(const char* format);
 
+    /**
+       Puts a flow-style listing of the values. The output is the same as putting each value
+       with putScalar() between startFlowStyleListing() and endListing(), but it is faster.
+    */
+    void putFlowStyleListing(const double* values, int size);
+
     void startMapping();
     void startFlowStyleMapping();
         
@@ -84,6 +90,7 @@ private:
     bool doInsertLineFeed;
 
     const char* doubleFormat;
+    int doublePrecision;
 
     enum { TOP, MAPPING, LISTING };
 
@@ -107,6 +114,7 @@ private:
     bool makeValuePutReady();
     bool startValuePut();
     void endValuePut();
+    int formatDouble(double value, char* buf);
     void putString_(const std::string& value);
     void putSingleQuotedString_(const std::string& value);
     void putDoubleQuotedString_(const std::string& value);
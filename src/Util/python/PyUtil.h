@@ -22,6 +22,23 @@ public:
     }
 };
 
+/**
+   This releases the GIL while the object exists. Use it in the binding functions which call
+   C++ functions that may block for a long time so that the other Python threads can run meanwhile.
+   The wrapped C++ code must not access Python objects without acquiring the GIL with PyGILock.
+*/
+class PyGILUnlock
+{
+    PyThreadState* state;
+public:
+    PyGILUnlock(){
+        state = PyEval_SaveThread();
+    }
+    ~PyGILUnlock() {
+        PyEval_RestoreThread(state);
+    }
+};
+
 template <typename T>
 T* get_pointer(cnoid::ref_ptr<T> const& p)
 {
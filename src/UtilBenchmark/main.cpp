@@ -0,0 +1,448 @@
+/*
+  This file is part of Choreonoid, an extensible graphical robotics application suit.
+  Copyright (c) 2007-2014 National Institute of Advanced Industrial Science and Technology (AIST)
+  Released under the MIT license. See accompanying file 'LICENSE' for more information.
+*/
+
+/**
+   This program measures the throughput and the number of the memory allocations of the
+   hot paths of the Util library such as the YAML reading and writing, the VRML loading,
+   the mesh processing, the sequence buffers, the signals and the scene graph cloning.
+   The allocations are counted by replacing the global operator new, which also counts
+   the allocations in the shared libraries on the ELF platforms.
+*/
+
+#include <cnoid/ValueTree>
+#include <cnoid/YAMLReader>
+#include <cnoid/YAMLWriter>
+#include <cnoid/VRMLParser>
+#include <cnoid/VRMLToSGConverter>
+#include <cnoid/MeshGenerator>
+#include <cnoid/MeshNormalGenerator>
+#include <cnoid/PolygonMeshTriangulator>
+#include <cnoid/STLSceneLoader>
+#include <cnoid/SceneGraph>
+#include <cnoid/SceneDrawables>
+#include <cnoid/Deque2D>
+#include <cnoid/MultiValueSeq>
+#include <cnoid/Signal>
+#include <cnoid/ExecutablePath>
+#include <cnoid/TimeMeasure>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+using namespace cnoid;
+namespace filesystem = boost::filesystem;
+
+namespace {
+
+boost::atomic<long> numAllocations(0);
+
+void* allocate(std::size_t size)
+{
+    ++numAllocations;
+    void* p = std::malloc(size ? size : 1);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+}
+
+void* operator new(std::size_t size) throw(std::bad_alloc) { return allocate(size); }
+void* operator new[](std::size_t size) throw(std::bad_alloc) { return allocate(size); }
+void operator delete(void* p) throw() { std::free(p); }
+void operator delete[](void* p) throw() { std::free(p); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw()
+{
+    ++numAllocations;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) throw()
+{
+    ++numAllocations;
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) throw() { std::free(p); }
+
+
+namespace {
+
+double minMeasurementTime = 1.0;
+string filterPattern;
+string workingDirectory;
+
+/**
+   @param func The function of an iteration
+   @param numUnitsPerIteration The amount of the processed data in an iteration, which is
+   shown as the throughput in the unit given by unit
+*/
+void runBenchmark(const string& name, boost::function<void()> func, double numUnitsPerIteration, const char* unit)
+{
+    if(!filterPattern.empty() && name.find(filterPattern) == string::npos){
+        return;
+    }
+
+    // warm up the caches and the memory pools
+    func();
+
+    TimeMeasure timer;
+    long numIterations = 0;
+    double time = 0.0;
+    const long allocations0 = numAllocations;
+    timer.begin();
+    while(time < minMeasurementTime){
+        func();
+        ++numIterations;
+        timer.end();
+        time = timer.totalTime();
+    }
+    const long allocations = numAllocations - allocations0;
+
+    const double timePerIteration = time / numIterations;
+    char line[256];
+    snprintf(line, sizeof(line), "%-36s %8ld iter %12.3f us/iter %12.3f M%s/s %12.1f allocs/iter",
+             name.c_str(), numIterations, timePerIteration * 1.0e6,
+             numUnitsPerIteration / timePerIteration * 1.0e-6, unit,
+             (double)allocations / numIterations);
+    cout << line << endl;
+}
+
+
+MappingPtr createLargeDocument(int numElements)
+{
+    MappingPtr doc = new Mapping();
+    doc->write("name", "benchmark");
+    Listing* elements = doc->createListing("elements");
+    for(int i=0; i < numElements; ++i){
+        Mapping* element = elements->newMapping();
+        element->write("id", i);
+        element->write("name", "element");
+        element->write("enabled", (i % 2) == 0);
+        Listing* position = element->createFlowStyleListing("position");
+        position->append(i * 0.1);
+        position->append(i * 0.2);
+        position->append(i * 0.3);
+        Listing* values = element->createFlowStyleListing("values");
+        for(int j=0; j < 16; ++j){
+            values->append(i + j * 0.01);
+        }
+    }
+    return doc;
+}
+
+
+void writeYAML(const Mapping* doc, string& out_text)
+{
+    ostringstream os;
+    YAMLWriter writer(os);
+    writer.putNode(doc);
+    out_text = os.str();
+}
+
+
+void readYAML(const string& text)
+{
+    YAMLReader reader;
+    if(!reader.parse(text)){
+        cerr << "YAML parsing failed." << endl;
+    }
+}
+
+
+void benchmarkYAML()
+{
+    const int numElements = 10000;
+    MappingPtr doc = createLargeDocument(numElements);
+    string text;
+    writeYAML(doc, text);
+    const double size = text.size();
+
+    runBenchmark("YAMLWriter", boost::bind(writeYAML, doc.get(), boost::ref(text)), size, "B");
+    runBenchmark("YAMLReader", boost::bind(readYAML, boost::cref(text)), size, "B");
+}
+
+
+int loadVRML(const string& filename)
+{
+    VRMLParser parser;
+    parser.load(filename);
+    VRMLToSGConverter converter;
+    int numConvertedNodes = 0;
+    while(VRMLNodePtr vrmlNode = parser.readNode()){
+        SgNodePtr node = converter.convert(vrmlNode);
+        if(node){
+            ++numConvertedNodes;
+        }
+    }
+    return numConvertedNodes;
+}
+
+
+void benchmarkVRML(const string& shareDir)
+{
+    static const char* models[] = {
+        "PA10/PA10.wrl", "SR1/SR1.wrl", "GR001/GR001.wrl", "RIC30/RIC30.wrl", "Labo1/Labo1.wrl", 0
+    };
+    for(int i=0; models[i]; ++i){
+        filesystem::path path = filesystem::path(shareDir) / "model" / models[i];
+        if(!filesystem::exists(path)){
+            cerr << path.string() << " is not found." << endl;
+            continue;
+        }
+        const string filename = path.string();
+        const double size = filesystem::file_size(path);
+        runBenchmark(string("VRML ") + models[i], boost::bind(loadVRML, filename), size, "B");
+    }
+}
+
+
+void generateNormals(SgMesh* mesh)
+{
+    MeshNormalGenerator generator;
+    generator.setOverwritingEnabled(true);
+    generator.generateNormals(mesh, 0.785398f);
+}
+
+
+SgPolygonMeshPtr createPolygonMesh(SgMesh* mesh)
+{
+    // The triangles are given as the polygons of the polygon mesh
+    SgPolygonMeshPtr polygonMesh = new SgPolygonMesh();
+    polygonMesh->setVertices(new SgVertexArray(*mesh->vertices()));
+    SgIndexArray& polygonVertices = polygonMesh->polygonVertices();
+    const int numTriangles = mesh->numTriangles();
+    polygonVertices.reserve(numTriangles * 4);
+    for(int i=0; i < numTriangles; ++i){
+        SgMesh::TriangleRef triangle = mesh->triangle(i);
+        polygonVertices.push_back(triangle[0]);
+        polygonVertices.push_back(triangle[1]);
+        polygonVertices.push_back(triangle[2]);
+        polygonVertices.push_back(-1);
+    }
+    return polygonMesh;
+}
+
+
+void triangulate(SgPolygonMesh* polygonMesh)
+{
+    PolygonMeshTriangulator triangulator;
+    SgMeshPtr mesh = triangulator.triangulate(polygonMesh);
+}
+
+
+void writeSTL(SgMesh* mesh, const string& filename)
+{
+    ofstream ofs(filename.c_str(), ios::out | ios::binary);
+    char header[80] = "benchmark";
+    ofs.write(header, 80);
+    const uint32_t numTriangles = mesh->numTriangles();
+    ofs.write((const char*)&numTriangles, 4);
+    const SgVertexArray& vertices = *mesh->vertices();
+    for(int i=0; i < mesh->numTriangles(); ++i){
+        SgMesh::TriangleRef triangle = mesh->triangle(i);
+        const Vector3f& v0 = vertices[triangle[0]];
+        const Vector3f& v1 = vertices[triangle[1]];
+        const Vector3f& v2 = vertices[triangle[2]];
+        Vector3f normal = (v1 - v0).cross(v2 - v0).normalized();
+        ofs.write((const char*)normal.data(), 12);
+        ofs.write((const char*)v0.data(), 12);
+        ofs.write((const char*)v1.data(), 12);
+        ofs.write((const char*)v2.data(), 12);
+        const uint16_t attribute = 0;
+        ofs.write((const char*)&attribute, 2);
+    }
+}
+
+
+void loadSTL(const string& filename)
+{
+    STLSceneLoader loader;
+    SgNodePtr node = loader.load(filename);
+}
+
+
+void benchmarkMeshes()
+{
+    MeshGenerator generator;
+    generator.setDivisionNumber(200);
+    generator.enableNormalGeneration(false);
+    SgMeshPtr sphere = generator.generateSphere(1.0);
+    const double numTriangles = sphere->numTriangles();
+
+    runBenchmark("MeshNormalGenerator", boost::bind(generateNormals, sphere.get()), numTriangles, "tri");
+
+    SgPolygonMeshPtr polygonMesh = createPolygonMesh(sphere);
+    runBenchmark("PolygonMeshTriangulator", boost::bind(triangulate, polygonMesh.get()), numTriangles, "tri");
+
+    const string filename = (filesystem::path(workingDirectory) / "cnoid-util-benchmark.stl").string();
+    writeSTL(sphere, filename);
+    runBenchmark("STLSceneLoader", boost::bind(loadSTL, filename), numTriangles, "tri");
+    filesystem::remove(filename);
+}
+
+
+void appendAndPopDeque2D(Deque2D<double>* deque, int numRows)
+{
+    const int numCols = deque->colSize();
+    for(int i=0; i < numRows; ++i){
+        Deque2D<double>::Row row = deque->append();
+        for(int j=0; j < numCols; ++j){
+            row[j] = j;
+        }
+        // The buffer is kept at the constant size as the ring buffers of the recorded data
+        if(deque->rowSize() > 1000){
+            deque->pop_front();
+        }
+    }
+}
+
+
+void appendAndPopMultiValueSeq(MultiValueSeq* seq, int numFrames)
+{
+    const int numParts = seq->numParts();
+    for(int i=0; i < numFrames; ++i){
+        MultiValueSeq::Frame frame = seq->appendFrame();
+        for(int j=0; j < numParts; ++j){
+            frame[j] = j;
+        }
+        if(seq->numFrames() > 1000){
+            seq->popFrontFrame();
+        }
+    }
+}
+
+
+void benchmarkSequences()
+{
+    const int numRows = 100000;
+    Deque2D<double> deque(0, 30);
+    runBenchmark("Deque2D append/pop_front", boost::bind(appendAndPopDeque2D, &deque, numRows), numRows, "row");
+
+    MultiValueSeq seq(0, 30);
+    runBenchmark("MultiValueSeq append/pop", boost::bind(appendAndPopMultiValueSeq, &seq, numRows), numRows, "frame");
+}
+
+
+struct SignalReceiver
+{
+    double sum;
+    SignalReceiver() : sum(0.0) { }
+    void onValue(double value) { sum += value; }
+};
+
+
+void emitSignal(Signal<void(double)>* signal, int numEmissions)
+{
+    for(int i=0; i < numEmissions; ++i){
+        (*signal)(i);
+    }
+}
+
+
+SgNodePtr createSceneGraph(int numGroups, int numShapesPerGroup)
+{
+    MeshGenerator generator;
+    SgMeshPtr mesh = generator.generateBox(Vector3(0.1, 0.1, 0.1));
+    SgMaterialPtr material = new SgMaterial();
+    SgGroupPtr root = new SgGroup();
+    for(int i=0; i < numGroups; ++i){
+        SgPosTransform* transform = new SgPosTransform();
+        transform->setTranslation(Vector3(i * 0.1, 0.0, 0.0));
+        for(int j=0; j < numShapesPerGroup; ++j){
+            SgShape* shape = new SgShape();
+            shape->setMesh(mesh);
+            shape->setMaterial(material);
+            transform->addChild(shape);
+        }
+        root->addChild(transform);
+    }
+    return root;
+}
+
+
+void cloneSceneGraph(SgNode* node)
+{
+    SgCloneMap cloneMap;
+    SgNodePtr clone = cloneMap.getClone<SgNode>(node);
+}
+
+
+void benchmarkSignalAndCloning()
+{
+    const int numEmissions = 1000000;
+    Signal<void(double)> signal1;
+    SignalReceiver receiver;
+    signal1.connect(boost::bind(&SignalReceiver::onValue, &receiver, _1));
+    runBenchmark("Signal (1 slot)", boost::bind(emitSignal, &signal1, numEmissions), numEmissions, "emit");
+
+    Signal<void(double)> signal4;
+    for(int i=0; i < 4; ++i){
+        signal4.connect(boost::bind(&SignalReceiver::onValue, &receiver, _1));
+    }
+    runBenchmark("Signal (4 slots)", boost::bind(emitSignal, &signal4, numEmissions), numEmissions, "emit");
+
+    const int numGroups = 1000;
+    const int numShapesPerGroup = 4;
+    SgNodePtr scene = createSceneGraph(numGroups, numShapesPerGroup);
+    runBenchmark("SgCloneMap", boost::bind(cloneSceneGraph, scene.get()),
+                 numGroups * (numShapesPerGroup + 1), "node");
+}
+
+}
+
+
+int main(int argc, char *argv[])
+{
+    namespace po = boost::program_options;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("time,t", po::value<double>(&minMeasurementTime)->default_value(1.0),
+         "Minimum measurement time of each benchmark in seconds")
+        ("filter,f", po::value<string>(&filterPattern),
+         "Runs only the benchmarks whose names contain the given string")
+        ("share-dir", po::value<string>(), "Share directory containing the model files")
+        ("working-dir", po::value<string>(), "Directory where the temporary files are written")
+        ("help,h", "Show this help");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, options), vm);
+        po::notify(vm);
+    } catch(const po::error& ex){
+        cerr << ex.what() << endl;
+        return 1;
+    }
+    if(vm.count("help")){
+        cout << options << endl;
+        return 0;
+    }
+
+    string shareDir = vm.count("share-dir") ? vm["share-dir"].as<string>() : shareDirectory();
+    workingDirectory = vm.count("working-dir") ?
+        vm["working-dir"].as<string>() : filesystem::temp_directory_path().string();
+
+    benchmarkYAML();
+    benchmarkVRML(shareDir);
+    benchmarkMeshes();
+    benchmarkSequences();
+    benchmarkSignalAndCloning();
+
+    return 0;
+}